@@ -15,6 +15,11 @@ defines({
   "UNICODE",
 })
 
+newoption({
+  trigger = "no-debug-logging",
+  description = "Compile out debug level log lines (XELOGD and friends).",
+})
+
 vectorextensions("AVX")
 flags({
   --"ExtraWarnings",        -- Sets the compiler's maximum warning level.
@@ -22,6 +27,11 @@ flags({
   "Unicode",
 })
 
+filter("options:no-debug-logging")
+  defines({
+    "XE_OPTION_LOG_DEBUG=0",
+  })
+
 filter("kind:StaticLib")
   defines({
     "_LIB",
@@ -103,6 +113,7 @@ filter("platforms:Windows")
     "opengl32",
     "comctl32",
     "shlwapi",
+    "winmm",
   })
 
 -- Create scratch/ path and dummy flags file if needed.
@@ -172,6 +183,10 @@ solution("xenia")
   include("src/xenia/ui/gl")
   include("src/xenia/vfs")
 
+  if os.is("linux") then
+    include("src/xenia/apu/alsa")
+  end
+
   if os.is("windows") then
     include("src/xenia/apu/xaudio2")
     include("src/xenia/hid/winkey")
@@ -0,0 +1,248 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/app/benchmark.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/emulator.h"
+#include "xenia/gpu/gl4/gl4_graphics_system.h"
+#include "xenia/gpu/gpu_flags.h"
+#include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/objects/xthread.h"
+
+DEFINE_int32(benchmark_frames, 0,
+             "Runs the title for this many frames after the first one is "
+             "presented, writes --benchmark_report and exits.");
+DEFINE_int32(benchmark_seconds, 0,
+             "Like --benchmark_frames, but runs for this many seconds. The "
+             "run ends at whichever limit is reached first.");
+DEFINE_bool(benchmark_uncapped, false,
+            "Disables vsync pacing during benchmark runs so frames are "
+            "produced as fast as the title allows.");
+DEFINE_string(benchmark_report, "benchmark.json",
+              "File the benchmark results are written to.");
+
+namespace xe {
+namespace app {
+
+namespace {
+
+double TicksToMillis(uint64_t ticks) {
+  return ticks * 1000.0 / Clock::host_tick_frequency();
+}
+
+// Nearest-rank percentile of sorted values.
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double percentile) {
+  size_t rank = size_t(percentile / 100.0 * sorted.size() + 0.5);
+  return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+std::string EscapeJson(const std::string& value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (uint8_t(c) < 0x20) {
+      char hex[8];
+      std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+      escaped += hex;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+}  // namespace
+
+bool Benchmark::IsEnabled() {
+  return FLAGS_benchmark_frames > 0 || FLAGS_benchmark_seconds > 0;
+}
+
+void Benchmark::ConfigureFlags() {
+  // Nothing can answer dialogs, and the JIT totals come from the compile
+  // stats.
+  FLAGS_headless = true;
+  FLAGS_dump_compile_stats = true;
+  if (FLAGS_benchmark_uncapped) {
+    FLAGS_vsync = false;
+  }
+}
+
+std::unique_ptr<Benchmark> Benchmark::Create(Emulator* emulator) {
+  auto benchmark = std::unique_ptr<Benchmark>(new Benchmark(emulator));
+  auto benchmark_ptr = benchmark.get();
+  emulator->graphics_system()->on_frame_presented.AddListener(
+      [benchmark_ptr]() { benchmark_ptr->OnFramePresented(); });
+  return benchmark;
+}
+
+Benchmark::Benchmark(Emulator* emulator) : emulator_(emulator) {
+  if (FLAGS_benchmark_frames > 0) {
+    frame_ticks_.reserve(FLAGS_benchmark_frames);
+  }
+}
+
+void Benchmark::OnFramePresented() {
+  if (finished_) {
+    return;
+  }
+  uint64_t now = Clock::QueryHostTickCount();
+  if (!started_) {
+    // Loading is left out; the run starts once the title is drawing.
+    started_ = true;
+    start_ = TakeSnapshot();
+    last_frame_ticks_ = start_.host_ticks;
+    XELOGI("Benchmark started");
+    return;
+  }
+  frame_ticks_.push_back(now - last_frame_ticks_);
+  last_frame_ticks_ = now;
+
+  bool frames_done = FLAGS_benchmark_frames > 0 &&
+                     frame_ticks_.size() >= size_t(FLAGS_benchmark_frames);
+  bool time_done = FLAGS_benchmark_seconds > 0 &&
+                   now - start_.host_ticks >= FLAGS_benchmark_seconds *
+                                                  Clock::host_tick_frequency();
+  if (frames_done || time_done) {
+    Finish();
+  }
+}
+
+Benchmark::Snapshot Benchmark::TakeSnapshot() {
+  Snapshot snapshot;
+  snapshot.host_ticks = Clock::QueryHostTickCount();
+  snapshot.compile_totals =
+      cpu::compiler::CompileStats::global()->GetTotals("PPCTranslator");
+  auto graphics_system = static_cast<gpu::gl4::GL4GraphicsSystem*>(
+      emulator_->graphics_system());
+  snapshot.gpu_stats = graphics_system->command_processor()->stats();
+  for (auto& thread : emulator_->kernel_state()->GetThreads()) {
+    auto host_thread = thread->host_thread();
+    if (host_thread) {
+      snapshot.thread_cpu_us[thread->thread_id()] =
+          host_thread->QueryCpuTimeMicros();
+    }
+  }
+  return snapshot;
+}
+
+void Benchmark::Finish() {
+  finished_ = true;
+  auto end = TakeSnapshot();
+  if (WriteReport(end)) {
+    XELOGI("Benchmark finished after %zu frames; wrote %s",
+           frame_ticks_.size(), FLAGS_benchmark_report.c_str());
+  }
+
+  // Shut down the same way closing the window does.
+  auto window = emulator_->display_window();
+  window->loop()->Post([window]() { window->Close(); });
+}
+
+bool Benchmark::WriteReport(const Snapshot& end) {
+  FILE* file = xe::filesystem::OpenFile(
+      xe::to_wstring(FLAGS_benchmark_report), "w");
+  if (!file) {
+    XELOGE("Unable to write benchmark report %s",
+           FLAGS_benchmark_report.c_str());
+    return false;
+  }
+
+  uint64_t elapsed_ticks = end.host_ticks - start_.host_ticks;
+  std::vector<uint64_t> sorted_ticks = frame_ticks_;
+  std::sort(sorted_ticks.begin(), sorted_ticks.end());
+  uint64_t total_frame_ticks = 0;
+  for (uint64_t ticks : sorted_ticks) {
+    total_frame_ticks += ticks;
+  }
+
+  std::fprintf(file, "{\n");
+  std::fprintf(file, "  \"frames\": %zu,\n", sorted_ticks.size());
+  std::fprintf(file, "  \"elapsed_ms\": %.3f,\n", TicksToMillis(elapsed_ticks));
+  std::fprintf(file, "  \"uncapped\": %s,\n",
+               FLAGS_benchmark_uncapped ? "true" : "false");
+  std::fprintf(file, "  \"frame_time_ms\": {\n");
+  if (!sorted_ticks.empty()) {
+    std::fprintf(
+        file,
+        "    \"mean\": %.3f,\n    \"min\": %.3f,\n    \"p50\": %.3f,\n"
+        "    \"p90\": %.3f,\n    \"p95\": %.3f,\n    \"p99\": %.3f,\n"
+        "    \"max\": %.3f\n",
+        TicksToMillis(total_frame_ticks) / sorted_ticks.size(),
+        TicksToMillis(sorted_ticks.front()),
+        TicksToMillis(Percentile(sorted_ticks, 50)),
+        TicksToMillis(Percentile(sorted_ticks, 90)),
+        TicksToMillis(Percentile(sorted_ticks, 95)),
+        TicksToMillis(Percentile(sorted_ticks, 99)),
+        TicksToMillis(sorted_ticks.back()));
+  }
+  std::fprintf(file, "  },\n");
+
+  std::fprintf(file,
+               "  \"jit\": {\n    \"functions_compiled\": %llu,\n"
+               "    \"compile_ms\": %.3f\n  },\n",
+               static_cast<unsigned long long>(end.compile_totals.count -
+                                               start_.compile_totals.count),
+               TicksToMillis(end.compile_totals.total_ticks -
+                             start_.compile_totals.total_ticks));
+
+  uint64_t stall_ticks =
+      end.gpu_stats.stall_ticks - start_.gpu_stats.stall_ticks;
+  std::fprintf(
+      file,
+      "  \"gpu\": {\n    \"worker_busy_percent\": %.2f,\n"
+      "    \"draws\": %llu,\n    \"upload_kb\": %.1f,\n"
+      "    \"shader_compile_ms\": %.3f\n  },\n",
+      elapsed_ticks ? 100.0 - 100.0 * stall_ticks / elapsed_ticks : 0.0,
+      static_cast<unsigned long long>(end.gpu_stats.draw_count -
+                                      start_.gpu_stats.draw_count),
+      (end.gpu_stats.upload_bytes - start_.gpu_stats.upload_bytes) / 1024.0,
+      TicksToMillis(end.gpu_stats.shader_compile_ticks -
+                    start_.gpu_stats.shader_compile_ticks));
+
+  // Threads that exited during the run are not included.
+  std::fprintf(file, "  \"threads\": [");
+  bool first_thread = true;
+  for (auto& thread : emulator_->kernel_state()->GetThreads()) {
+    auto it = end.thread_cpu_us.find(thread->thread_id());
+    if (it == end.thread_cpu_us.end()) {
+      continue;
+    }
+    uint64_t cpu_us = it->second;
+    auto start_it = start_.thread_cpu_us.find(thread->thread_id());
+    if (start_it != start_.thread_cpu_us.end()) {
+      cpu_us -= start_it->second;
+    }
+    std::fprintf(file,
+                 "%s\n    {\"id\": %u, \"name\": \"%s\", \"guest\": %s, "
+                 "\"cpu_ms\": %.3f}",
+                 first_thread ? "" : ",", thread->thread_id(),
+                 EscapeJson(thread->name()).c_str(),
+                 thread->is_guest_thread() ? "true" : "false",
+                 cpu_us / 1000.0);
+    first_thread = false;
+  }
+  std::fprintf(file, "\n  ]\n}\n");
+  std::fclose(file);
+  return true;
+}
+
+}  // namespace app
+}  // namespace xe
@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APP_BENCHMARK_H_
+#define XENIA_APP_BENCHMARK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/cpu/compiler/compile_stats.h"
+#include "xenia/gpu/gl4/command_processor.h"
+
+namespace xe {
+class Emulator;
+}  // namespace xe
+
+namespace xe {
+namespace app {
+
+// Runs a title for --benchmark_frames frames or --benchmark_seconds seconds
+// from its first presented frame, then writes frame time percentiles, JIT
+// compile and GPU worker totals and per-thread CPU time to
+// --benchmark_report as JSON and closes the emulator.
+class Benchmark {
+ public:
+  static bool IsEnabled();
+  // Overrides the flags benchmark runs depend on. Must be called before the
+  // emulator is set up.
+  static void ConfigureFlags();
+
+  static std::unique_ptr<Benchmark> Create(Emulator* emulator);
+
+ private:
+  // Totals diffed between the start and end of the run.
+  struct Snapshot {
+    uint64_t host_ticks;
+    cpu::compiler::CompileStats::Totals compile_totals;
+    gpu::gl4::CommandProcessor::Stats gpu_stats;
+    // Thread id to CPU time in microseconds.
+    std::unordered_map<uint32_t, uint64_t> thread_cpu_us;
+  };
+
+  explicit Benchmark(Emulator* emulator);
+
+  // Called on the command processor thread.
+  void OnFramePresented();
+  Snapshot TakeSnapshot();
+  void Finish();
+  bool WriteReport(const Snapshot& end);
+
+  Emulator* emulator_ = nullptr;
+  bool started_ = false;
+  std::atomic<bool> finished_ = {false};
+  uint64_t last_frame_ticks_ = 0;
+  Snapshot start_;
+  std::vector<uint64_t> frame_ticks_;
+};
+
+}  // namespace app
+}  // namespace xe
+
+#endif  // XENIA_APP_BENCHMARK_H_
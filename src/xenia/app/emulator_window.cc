@@ -9,14 +9,21 @@
 
 #include "xenia/app/emulator_window.h"
 
+#include <gflags/gflags.h>
+
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/platform.h"
+#include "xenia/base/string.h"
 #include "xenia/base/threading.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/emulator.h"
 #include "xenia/profiling.h"
 
+DEFINE_string(snapshot_path, "scratch/snapshot.xsnap",
+              "File the emulator state is saved to (F7) and restored from "
+              "(F8).");
+
 namespace xe {
 namespace app {
 
@@ -81,10 +88,23 @@ bool EmulatorWindow::Initialize() {
       case 0x6B: {  // numpad plus
         CpuTimeScalarSetDouble();
       } break;
+      case 0x6F: {  // numpad /
+        CpuToggleFastForward();
+      } break;
+
+      case 0x76: {  // VK_F7
+        CpuSaveSnapshot();
+      } break;
+      case 0x77: {  // VK_F8
+        CpuRestoreSnapshot();
+      } break;
 
       case 0x72: {  // F3
         Profiler::ToggleDisplay();
       } break;
+      case 0x75: {  // VK_F6
+        Profiler::ToggleTrace();
+      } break;
 
       case 0x73: {  // VK_F4
         GpuTraceFrame();
@@ -137,6 +157,18 @@ bool EmulatorWindow::Initialize() {
     cpu_menu->AddChild(MenuItem::Create(
         MenuItem::Type::kString, L"Time Scalar *= 2", L"Numpad +",
         std::bind(&EmulatorWindow::CpuTimeScalarSetDouble, this)));
+    cpu_menu->AddChild(MenuItem::Create(
+        MenuItem::Type::kString, L"Toggle &Fast-Forward", L"Numpad /",
+        std::bind(&EmulatorWindow::CpuToggleFastForward, this)));
+  }
+  cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kSeparator));
+  {
+    cpu_menu->AddChild(MenuItem::Create(
+        MenuItem::Type::kString, L"&Save Snapshot", L"F7",
+        std::bind(&EmulatorWindow::CpuSaveSnapshot, this)));
+    cpu_menu->AddChild(MenuItem::Create(
+        MenuItem::Type::kString, L"&Restore Snapshot", L"F8",
+        std::bind(&EmulatorWindow::CpuRestoreSnapshot, this)));
   }
   cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kSeparator));
   {
@@ -146,6 +178,9 @@ bool EmulatorWindow::Initialize() {
     cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kString,
                                         L"&Pause/Resume Profiler", L"`",
                                         []() { Profiler::TogglePause(); }));
+    cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kString,
+                                        L"Start/Stop Profile &Trace", L"F6",
+                                        []() { Profiler::ToggleTrace(); }));
   }
   main_menu->AddChild(std::move(cpu_menu));
 
@@ -207,6 +242,19 @@ void EmulatorWindow::CpuTimeScalarSetDouble() {
   UpdateTitle();
 }
 
+void EmulatorWindow::CpuToggleFastForward() {
+  emulator()->SetFastForward(!emulator()->is_fast_forward());
+  UpdateTitle();
+}
+
+void EmulatorWindow::CpuSaveSnapshot() {
+  emulator()->SaveSnapshot(xe::to_wstring(FLAGS_snapshot_path));
+}
+
+void EmulatorWindow::CpuRestoreSnapshot() {
+  emulator()->RestoreSnapshot(xe::to_wstring(FLAGS_snapshot_path));
+}
+
 void EmulatorWindow::GpuTraceFrame() {
   emulator()->graphics_system()->RequestFrameTrace();
 }
@@ -228,6 +276,9 @@ void EmulatorWindow::UpdateTitle() {
     title += xe::to_wstring(std::to_string(Clock::guest_time_scalar()));
     title += L"x)";
   }
+  if (emulator()->is_fast_forward()) {
+    title += L" (fast-forward)";
+  }
   window_->set_title(title);
 }
 
@@ -43,6 +43,9 @@ class EmulatorWindow {
   void CpuTimeScalarReset();
   void CpuTimeScalarSetHalf();
   void CpuTimeScalarSetDouble();
+  void CpuToggleFastForward();
+  void CpuSaveSnapshot();
+  void CpuRestoreSnapshot();
   void GpuTraceFrame();
   void GpuClearCaches();
   void ToggleFullscreen();
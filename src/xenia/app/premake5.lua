@@ -47,6 +47,11 @@ project("xenia-app")
     project_root.."/third_party/elemental-forms",
   })
 
+  filter("platforms:Linux")
+    links({
+      "xenia-apu-alsa",
+    })
+
   filter("platforms:Windows")
     links({
       "xenia-apu-xaudio2",
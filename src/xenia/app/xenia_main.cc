@@ -9,6 +9,7 @@
 
 #include <gflags/gflags.h>
 
+#include "xenia/app/benchmark.h"
 #include "xenia/app/emulator_window.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/main.h"
@@ -26,6 +27,10 @@ int xenia_main(const std::vector<std::wstring>& args) {
   Profiler::Initialize();
   Profiler::ThreadEnter("main");
 
+  if (Benchmark::IsEnabled()) {
+    Benchmark::ConfigureFlags();
+  }
+
   // Create the emulator but don't initialize so we can setup the window.
   auto emulator = std::make_unique<Emulator>(L"");
 
@@ -80,6 +85,12 @@ int xenia_main(const std::vector<std::wstring>& args) {
     // Normalize the path and make absolute.
     std::wstring abs_path = xe::to_absolute_path(path);
 
+    // Listens for frames, so it must exist before the title starts.
+    std::unique_ptr<Benchmark> benchmark;
+    if (Benchmark::IsEnabled()) {
+      benchmark = Benchmark::Create(emulator.get());
+    }
+
     result = emulator->LaunchPath(abs_path);
     if (XFAILED(result)) {
       XELOGE("Failed to launch target: %.8X", result);
@@ -90,6 +101,10 @@ int xenia_main(const std::vector<std::wstring>& args) {
 
     // Wait until we are exited.
     emulator->display_window()->loop()->AwaitQuit();
+
+    // The benchmark is called from the GPU thread until it's shut down.
+    emulator.reset();
+    benchmark.reset();
   }
 
   emulator.reset();
@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/alsa/alsa_audio_driver.h"
+
+#include "xenia/apu/audio_conversion.h"
+#include "xenia/base/logging.h"
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+AlsaAudioDriver::AlsaAudioDriver(Memory* memory,
+                                 xe::threading::Semaphore* semaphore,
+                                 size_t queued_frames)
+    : AudioDriver(memory), semaphore_(semaphore) {
+  frame_ring_ = std::make_unique<AudioFrameRing>(kFrameSamples, queued_frames);
+}
+
+AlsaAudioDriver::~AlsaAudioDriver() = default;
+
+void AlsaAudioDriver::SubmitFrame(uint32_t frame_ptr) {
+  // The client semaphore keeps the guest within the ring, so this only fails
+  // if the guest submits without waiting for its callback.
+  auto output_frame = frame_ring_->BeginWrite();
+  if (!output_frame) {
+    // Drop the frame but hand back the slot the guest waited for.
+    semaphore_->Release(1, nullptr);
+    return;
+  }
+
+  // Guest frames are big endian planar; this is the only copy before mixing.
+  auto input_frame = memory_->TranslateVirtual<float*>(frame_ptr);
+  conversion::PlanarFloatBEToInterleavedFloat(input_frame, kFrameChannels,
+                                              kChannelSamples, output_frame);
+  frame_ring_->EndWrite();
+}
+
+bool AlsaAudioDriver::MixFrame(float* mix) {
+  auto frame = frame_ring_->BeginRead();
+  if (!frame) {
+    if (streaming_) {
+      frame_ring_->RecordUnderrun();
+      streaming_ = false;
+    }
+    return false;
+  }
+  streaming_ = true;
+  for (uint32_t i = 0; i < kFrameSamples; ++i) {
+    mix[i] += frame[i];
+  }
+  frame_ring_->EndRead();
+
+  auto ret = semaphore_->Release(1, nullptr);
+  assert_true(ret);
+  return true;
+}
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
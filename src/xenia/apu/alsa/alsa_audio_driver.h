@@ -0,0 +1,50 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
+#define XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
+
+#include "xenia/apu/audio_driver.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+// Per-client half of the ALSA backend. The guest side converts frames into
+// the client's ring; AlsaAudioSystem's mixer pulls them straight out of it.
+class AlsaAudioDriver : public AudioDriver {
+ public:
+  static const uint32_t kFrameChannels = 6;
+  static const uint32_t kChannelSamples = 256;
+  static const uint32_t kFrameSamples = kFrameChannels * kChannelSamples;
+
+  AlsaAudioDriver(Memory* memory, xe::threading::Semaphore* semaphore,
+                  size_t queued_frames);
+  ~AlsaAudioDriver() override;
+
+  void SubmitFrame(uint32_t frame_ptr) override;
+
+  // Called from the mixer thread. Adds the oldest queued frame (interleaved,
+  // kFrameSamples floats) into mix and returns the slot to the guest.
+  // Returns false if the client had nothing queued.
+  bool MixFrame(float* mix);
+
+ private:
+  xe::threading::Semaphore* semaphore_ = nullptr;
+  // Whether the previous MixFrame found a frame. Running dry only counts as an
+  // underrun for a client that was streaming, not for an idle one.
+  bool streaming_ = false;
+};
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
@@ -0,0 +1,175 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/alsa/alsa_audio_system.h"
+
+#include <alsa/asoundlib.h>
+
+#include <cstring>
+
+#include "xenia/apu/alsa/alsa_audio_driver.h"
+#include "xenia/apu/apu_flags.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+// Guest frames are 5.1 (FL, FR, C, LFE, BL, BR); the device gets stereo.
+static const float kCenterMix = 0.7071f;
+static const float kSurroundMix = 0.7071f;
+
+std::unique_ptr<AudioSystem> AlsaAudioSystem::Create(
+    cpu::Processor* processor) {
+  auto audio_system = std::make_unique<AlsaAudioSystem>(processor);
+  if (!audio_system->OpenDevice()) {
+    return nullptr;
+  }
+  return std::move(audio_system);
+}
+
+AlsaAudioSystem::AlsaAudioSystem(cpu::Processor* processor)
+    : AudioSystem(processor) {
+  std::memset(drivers_, 0, sizeof(drivers_));
+}
+
+AlsaAudioSystem::~AlsaAudioSystem() {
+  if (pcm_) {
+    snd_pcm_close(pcm_);
+    pcm_ = nullptr;
+  }
+}
+
+bool AlsaAudioSystem::OpenDevice() {
+  int err = snd_pcm_open(&pcm_, "default", SND_PCM_STREAM_PLAYBACK, 0);
+  if (err < 0) {
+    XELOGW("ALSA: unable to open default device: %s", snd_strerror(err));
+    pcm_ = nullptr;
+    return false;
+  }
+  // Let the device buffer about as much as a client may queue.
+  unsigned int latency_us =
+      static_cast<unsigned int>(queued_frames_ * kFrameMicroseconds);
+  err = snd_pcm_set_params(pcm_, SND_PCM_FORMAT_FLOAT_LE,
+                           SND_PCM_ACCESS_RW_INTERLEAVED, 2, 48000, 1,
+                           latency_us);
+  if (err < 0) {
+    XELOGW("ALSA: unable to configure device: %s", snd_strerror(err));
+    snd_pcm_close(pcm_);
+    pcm_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void AlsaAudioSystem::Initialize() {
+  AudioSystem::Initialize();
+
+  mixer_running_ = true;
+  mixer_thread_ = std::thread([this]() { MixerThreadMain(); });
+}
+
+void AlsaAudioSystem::Shutdown() {
+  mixer_running_ = false;
+  if (mixer_thread_.joinable()) {
+    mixer_thread_.join();
+  }
+  AudioSystem::Shutdown();
+}
+
+void AlsaAudioSystem::MixerThreadMain() {
+  xe::threading::set_name("ALSA Mixer");
+
+  const uint32_t channel_samples = AlsaAudioDriver::kChannelSamples;
+  float mix[AlsaAudioDriver::kFrameSamples];
+  float output[channel_samples * 2];
+  // About once a second while the device is unavailable.
+  const uint32_t kReopenIntervalFrames = 1000000 / kFrameMicroseconds;
+  uint32_t reopen_ticks = 0;
+  while (mixer_running_) {
+    std::memset(mix, 0, sizeof(mix));
+    bool any_mixed = false;
+    {
+      std::lock_guard<xe::mutex> lock(drivers_lock_);
+      for (auto driver : drivers_) {
+        if (driver && driver->MixFrame(mix)) {
+          any_mixed = true;
+        }
+      }
+    }
+
+    if (!any_mixed || FLAGS_mute) {
+      std::memset(output, 0, sizeof(output));
+    } else {
+      for (uint32_t i = 0; i < channel_samples; ++i) {
+        const float* in = mix + i * AlsaAudioDriver::kFrameChannels;
+        float center = in[2] * kCenterMix;
+        output[i * 2 + 0] = in[0] + center + in[4] * kSurroundMix;
+        output[i * 2 + 1] = in[1] + center + in[5] * kSurroundMix;
+      }
+    }
+
+    if (!pcm_) {
+      // The device is gone. Keep consuming frames in real time so clients
+      // waiting on their buffer events don't stall, and try to get it back.
+      xe::threading::Sleep(std::chrono::microseconds(kFrameMicroseconds));
+      if (++reopen_ticks >= kReopenIntervalFrames) {
+        reopen_ticks = 0;
+        OpenDevice();
+      }
+      continue;
+    }
+
+    // Blocks until the device has room, which is what paces the clients.
+    snd_pcm_sframes_t written =
+        snd_pcm_writei(pcm_, output, channel_samples);
+    if (written < 0) {
+      // -EPIPE (device underrun) and -ESTRPIPE (suspend) are recoverable.
+      written = snd_pcm_recover(pcm_, static_cast<int>(written), 1);
+      if (written < 0) {
+        XELOGE("ALSA: write failed: %s",
+               snd_strerror(static_cast<int>(written)));
+        snd_pcm_close(pcm_);
+        pcm_ = nullptr;
+        OpenDevice();
+      }
+    }
+  }
+}
+
+X_RESULT AlsaAudioSystem::CreateDriver(size_t index,
+                                       xe::threading::Semaphore* semaphore,
+                                       AudioDriver** out_driver) {
+  assert_not_null(out_driver);
+  auto driver = new AlsaAudioDriver(memory_, semaphore, queued_frames_);
+  {
+    std::lock_guard<xe::mutex> lock(drivers_lock_);
+    drivers_[index] = driver;
+  }
+  *out_driver = driver;
+  return X_STATUS_SUCCESS;
+}
+
+void AlsaAudioSystem::DestroyDriver(AudioDriver* driver) {
+  assert_not_null(driver);
+  {
+    std::lock_guard<xe::mutex> lock(drivers_lock_);
+    for (auto& entry : drivers_) {
+      if (entry == driver) {
+        entry = nullptr;
+      }
+    }
+  }
+  delete static_cast<AlsaAudioDriver*>(driver);
+}
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
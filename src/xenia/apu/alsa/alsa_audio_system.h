@@ -0,0 +1,63 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_ALSA_ALSA_AUDIO_SYSTEM_H_
+#define XENIA_APU_ALSA_ALSA_AUDIO_SYSTEM_H_
+
+#include <atomic>
+#include <thread>
+
+#include "xenia/apu/audio_system.h"
+
+typedef struct _snd_pcm snd_pcm_t;
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+class AlsaAudioDriver;
+
+// Linux output through ALSA. Instead of one device stream per client, a
+// single mixer thread pulls frames from every client ring, downmixes them
+// and writes one stereo stream; the blocking write paces the clients.
+class AlsaAudioSystem : public AudioSystem {
+ public:
+  explicit AlsaAudioSystem(cpu::Processor* processor);
+  ~AlsaAudioSystem() override;
+
+  // Returns nullptr if no ALSA output device could be opened.
+  static std::unique_ptr<AudioSystem> Create(cpu::Processor* processor);
+
+  void Shutdown() override;
+
+  X_RESULT CreateDriver(size_t index, xe::threading::Semaphore* semaphore,
+                        AudioDriver** out_driver) override;
+  void DestroyDriver(AudioDriver* driver) override;
+
+ protected:
+  void Initialize() override;
+
+ private:
+  bool OpenDevice();
+  void MixerThreadMain();
+
+  snd_pcm_t* pcm_ = nullptr;
+  std::atomic<bool> mixer_running_ = {false};
+  std::thread mixer_thread_;
+
+  // Guards drivers_ between the mixer and client (un)registration.
+  xe::mutex drivers_lock_;
+  AlsaAudioDriver* drivers_[kMaximumClientCount];
+};
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_ALSA_ALSA_AUDIO_SYSTEM_H_
@@ -0,0 +1,19 @@
+project_root = "../../../.."
+include(project_root.."/build_tools")
+
+group("src")
+project("xenia-apu-alsa")
+  uuid("5b0e4d6a-3c1f-4f7e-9a2d-8e6b1c4f0a37")
+  kind("StaticLib")
+  language("C++")
+  links({
+    "asound",
+    "xenia-base",
+    "xenia-apu",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/build_tools/third_party/gflags/src",
+  })
+  local_platform_files()
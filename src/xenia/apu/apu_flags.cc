@@ -9,6 +9,20 @@
 
 #include "xenia/apu/apu_flags.h"
 
-DEFINE_string(apu, "any", "Audio system. Use: [any, nop, xaudio2]");
+DEFINE_string(apu, "any", "Audio system. Use: [any, nop, xaudio2, alsa]");
 
 DEFINE_bool(mute, false, "Mutes all audio output.");
+
+DEFINE_int32(audio_latency_ms, 50,
+             "Target audio output latency; sets how many frames each client "
+             "may queue ahead of the device.");
+
+DEFINE_int32(audio_stats_interval_ms, 0,
+             "Log audio pipeline stats (XMA decode times, client callback "
+             "times, queue depths, underruns) every N ms (0 = disabled).");
+
+DEFINE_int32(xma_decoder_threads, 0,
+             "Number of XMA decoder worker threads (0 = pick from core count).");
+DEFINE_int32(xma_decode_cache_mb, 0,
+             "Memory budget for caching decoded XMA frames of replayed sounds "
+             "(0 = disabled).");
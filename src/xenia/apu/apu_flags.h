@@ -16,4 +16,10 @@ DECLARE_string(apu);
 
 DECLARE_bool(mute);
 
+DECLARE_int32(audio_latency_ms);
+DECLARE_int32(audio_stats_interval_ms);
+
+DECLARE_int32(xma_decoder_threads);
+DECLARE_int32(xma_decode_cache_mb);
+
 #endif  // XENIA_APU_APU_FLAGS_H_
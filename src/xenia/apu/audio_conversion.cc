@@ -0,0 +1,122 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/audio_conversion.h"
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+
+namespace xe {
+namespace apu {
+namespace conversion {
+
+// pshufb masks (SSSE3 is implied by our AVX baseline).
+static const __m128i kSwap16Mask =
+    _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+static const __m128i kSwap32Mask =
+    _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+static const float kS16Scale = float((1 << 15) - 1);
+
+// Same as the scalar path: clamp (NaN becomes 1.0, as std::min/max would do),
+// scale and truncate toward zero.
+static inline __m128i ScaleToS32(__m128 value) {
+  value = _mm_min_ps(value, _mm_set1_ps(1.0f));
+  value = _mm_max_ps(value, _mm_set1_ps(-1.0f));
+  return _mm_cvttps_epi32(_mm_mul_ps(value, _mm_set1_ps(kS16Scale)));
+}
+
+static inline uint16_t ScaleToS16BE(float value) {
+  int sample = static_cast<int>(xe::saturate(value) * kS16Scale);
+  return xe::byte_swap(static_cast<uint16_t>(sample & 0xFFFF));
+}
+
+void PlanarFloatToInterleavedS16BE(const float* const* channels,
+                                   uint32_t channel_count,
+                                   uint32_t sample_count, uint16_t* output) {
+  uint32_t i = 0;
+  if (channel_count == 1) {
+    const float* in = channels[0];
+    for (; i + 8 <= sample_count; i += 8) {
+      __m128i lo = ScaleToS32(_mm_loadu_ps(in + i));
+      __m128i hi = ScaleToS32(_mm_loadu_ps(in + i + 4));
+      __m128i packed = _mm_packs_epi32(lo, hi);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i),
+                       _mm_shuffle_epi8(packed, kSwap16Mask));
+    }
+  } else if (channel_count == 2) {
+    const float* in_l = channels[0];
+    const float* in_r = channels[1];
+    for (; i + 4 <= sample_count; i += 4) {
+      __m128i l = ScaleToS32(_mm_loadu_ps(in_l + i));
+      __m128i r = ScaleToS32(_mm_loadu_ps(in_r + i));
+      // L0 L1 L2 L3 R0 R1 R2 R3 -> L0 R0 L1 R1 L2 R2 L3 R3
+      __m128i packed = _mm_packs_epi32(l, r);
+      __m128i interleaved =
+          _mm_unpacklo_epi16(packed, _mm_srli_si128(packed, 8));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 2),
+                       _mm_shuffle_epi8(interleaved, kSwap16Mask));
+    }
+  }
+  for (; i < sample_count; ++i) {  // residual samples / other layouts
+    for (uint32_t j = 0; j < channel_count; ++j) {
+      output[i * channel_count + j] = ScaleToS16BE(channels[j][i]);
+    }
+  }
+}
+
+void PlanarFloatBEToInterleavedFloat(const float* planes,
+                                     uint32_t channel_count,
+                                     uint32_t sample_count, float* output) {
+  uint32_t i = 0;
+  for (; i + 4 <= sample_count; i += 4) {
+    // Transpose 4 samples x 4 channels at a time.
+    uint32_t c = 0;
+    for (; c + 4 <= channel_count; c += 4) {
+      const float* in = planes + c * sample_count + i;
+      __m128 r0 = _mm_castsi128_ps(_mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), kSwap32Mask));
+      __m128 r1 = _mm_castsi128_ps(_mm_shuffle_epi8(
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(in + sample_count)),
+          kSwap32Mask));
+      __m128 r2 = _mm_castsi128_ps(_mm_shuffle_epi8(
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(in + sample_count * 2)),
+          kSwap32Mask));
+      __m128 r3 = _mm_castsi128_ps(_mm_shuffle_epi8(
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(in + sample_count * 3)),
+          kSwap32Mask));
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      float* out = output + i * channel_count + c;
+      _mm_storeu_ps(out, r0);
+      _mm_storeu_ps(out + channel_count, r1);
+      _mm_storeu_ps(out + channel_count * 2, r2);
+      _mm_storeu_ps(out + channel_count * 3, r3);
+    }
+    for (; c < channel_count; ++c) {
+      const float* in = planes + c * sample_count + i;
+      for (uint32_t k = 0; k < 4; ++k) {
+        output[(i + k) * channel_count + c] = xe::byte_swap(in[k]);
+      }
+    }
+  }
+  for (; i < sample_count; ++i) {  // residual samples
+    for (uint32_t c = 0; c < channel_count; ++c) {
+      output[i * channel_count + c] =
+          xe::byte_swap(planes[c * sample_count + i]);
+    }
+  }
+}
+
+}  // namespace conversion
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,36 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_AUDIO_CONVERSION_H_
+#define XENIA_APU_AUDIO_CONVERSION_H_
+
+#include <cstdint>
+
+namespace xe {
+namespace apu {
+namespace conversion {
+
+// Saturates planar float samples to [-1, 1], scales them to 16-bit and writes
+// them interleaved in big endian (as XMA output buffers expect).
+// channels holds channel_count pointers of sample_count floats each.
+void PlanarFloatToInterleavedS16BE(const float* const* channels,
+                                   uint32_t channel_count,
+                                   uint32_t sample_count, uint16_t* output);
+
+// Interleaves channel_count consecutive planes of sample_count big endian
+// floats into host-endian frames (as guest audio frames are laid out).
+void PlanarFloatBEToInterleavedFloat(const float* planes,
+                                     uint32_t channel_count,
+                                     uint32_t sample_count, float* output);
+
+}  // namespace conversion
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_AUDIO_CONVERSION_H_
@@ -10,6 +10,9 @@
 #ifndef XENIA_APU_AUDIO_DRIVER_H_
 #define XENIA_APU_AUDIO_DRIVER_H_
 
+#include <memory>
+
+#include "xenia/apu/audio_frame_ring.h"
 #include "xenia/memory.h"
 #include "xenia/xbox.h"
 
@@ -23,12 +26,16 @@ class AudioDriver {
 
   virtual void SubmitFrame(uint32_t samples_ptr) = 0;
 
+  // Frames converted from the guest and not yet consumed by the device.
+  const AudioFrameRing* frame_ring() const { return frame_ring_.get(); }
+
  protected:
   inline uint8_t* TranslatePhysical(uint32_t guest_address) const {
     return memory_->TranslatePhysical(guest_address);
   }
 
   Memory* memory_ = nullptr;
+  std::unique_ptr<AudioFrameRing> frame_ring_;
 };
 
 }  // namespace apu
@@ -0,0 +1,96 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_AUDIO_FRAME_RING_H_
+#define XENIA_APU_AUDIO_FRAME_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+namespace apu {
+
+// Fixed-capacity single-producer/single-consumer ring of audio frames.
+// The guest side writes converted frames and the driver side (a device
+// callback or voice completion) consumes them; neither side locks.
+class AudioFrameRing {
+ public:
+  AudioFrameRing(size_t frame_samples, size_t capacity)
+      : frame_samples_(frame_samples),
+        capacity_(capacity),
+        storage_(frame_samples * capacity) {}
+
+  size_t frame_samples() const { return frame_samples_; }
+  size_t capacity() const { return capacity_; }
+  size_t queued() const {
+    return size_t(write_index_.load(std::memory_order_acquire) -
+                  read_index_.load(std::memory_order_acquire));
+  }
+
+  uint64_t overrun_count() const {
+    return overrun_count_.load(std::memory_order_relaxed);
+  }
+  uint64_t underrun_count() const {
+    return underrun_count_.load(std::memory_order_relaxed);
+  }
+
+  // Producer: returns the next free frame, or nullptr (counting an overrun)
+  // if the consumer hasn't released one yet.
+  float* BeginWrite() {
+    uint64_t write_index = write_index_.load(std::memory_order_relaxed);
+    if (write_index - read_index_.load(std::memory_order_acquire) >=
+        capacity_) {
+      overrun_count_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return frame(write_index);
+  }
+  void EndWrite() { write_index_.fetch_add(1, std::memory_order_release); }
+
+  // Consumer: returns the oldest queued frame, or nullptr if none is queued.
+  // An empty ring is not necessarily an underrun (the client may be idle), so
+  // consumers decide when to call RecordUnderrun.
+  const float* BeginRead() {
+    uint64_t read_index = read_index_.load(std::memory_order_relaxed);
+    if (read_index == write_index_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return frame(read_index);
+  }
+  void EndRead() { read_index_.fetch_add(1, std::memory_order_release); }
+
+  void RecordUnderrun() {
+    underrun_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+ private:
+  float* frame(uint64_t index) {
+    return storage_.data() + (index % capacity_) * frame_samples_;
+  }
+
+  static const size_t kCacheLineSize = 64;
+
+  size_t frame_samples_;
+  size_t capacity_;
+  std::vector<float> storage_;
+  // Written by the producer. Each side gets its own cache line so that one
+  // side's updates don't evict the line the other is polling.
+  alignas(kCacheLineSize) std::atomic<uint64_t> write_index_ = {0};
+  std::atomic<uint64_t> overrun_count_ = {0};
+  // Written by the consumer. The alignment also pads the end of the object
+  // out to a full line.
+  alignas(kCacheLineSize) std::atomic<uint64_t> read_index_ = {0};
+  std::atomic<uint64_t> underrun_count_ = {0};
+};
+
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_AUDIO_FRAME_RING_H_
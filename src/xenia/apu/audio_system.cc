@@ -9,9 +9,12 @@
 
 #include "xenia/apu/audio_system.h"
 
+#include <algorithm>
+
 #include "xenia/apu/apu_flags.h"
 #include "xenia/apu/audio_driver.h"
 #include "xenia/apu/xma_decoder.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/ring_buffer.h"
@@ -20,7 +23,11 @@
 #include "xenia/cpu/thread_state.h"
 #include "xenia/profiling.h"
 
+#include "xenia/apu/nop/nop_apu_flags.h"
 #include "xenia/apu/nop/nop_audio_system.h"
+#if XE_PLATFORM_LINUX
+#include "xenia/apu/alsa/alsa_audio_system.h"
+#endif  // XE_PLATFORM_LINUX
 #if XE_PLATFORM_WIN32
 #include "xenia/apu/xaudio2/xaudio2_audio_system.h"
 #endif  // XE_PLATFORM_WIN32
@@ -41,12 +48,16 @@ namespace xe {
 namespace apu {
 
 std::unique_ptr<AudioSystem> AudioSystem::Create(cpu::Processor* processor) {
-  if (FLAGS_apu.compare("nop") == 0) {
+  if (FLAGS_apu.compare("nop") == 0 || FLAGS_nop_audio_fast_forward) {
     return nop::NopAudioSystem::Create(processor);
 #if XE_PLATFORM_WIN32
   } else if (FLAGS_apu.compare("xaudio2") == 0) {
     return xaudio2::XAudio2AudioSystem::Create(processor);
 #endif  // WIN32
+#if XE_PLATFORM_LINUX
+  } else if (FLAGS_apu.compare("alsa") == 0) {
+    return alsa::AlsaAudioSystem::Create(processor);
+#endif  // XE_PLATFORM_LINUX
   } else {
     // Create best available.
     std::unique_ptr<AudioSystem> best;
@@ -58,6 +69,13 @@ std::unique_ptr<AudioSystem> AudioSystem::Create(cpu::Processor* processor) {
     }
 #endif  // XE_PLATFORM_WIN32
 
+#if XE_PLATFORM_LINUX
+    best = alsa::AlsaAudioSystem::Create(processor);
+    if (best) {
+      return best;
+    }
+#endif  // XE_PLATFORM_LINUX
+
     // Fallback to nop.
     return nop::NopAudioSystem::Create(processor);
   }
@@ -67,7 +85,13 @@ AudioSystem::AudioSystem(cpu::Processor* processor)
     : memory_(processor->memory()),
       processor_(processor),
       worker_running_(false) {
+  queued_frames_ =
+      size_t(std::max(FLAGS_audio_latency_ms, 0)) * 1000 / kFrameMicroseconds;
+  queued_frames_ =
+      std::max(size_t(2), std::min(kMaximumQueuedFrames, queued_frames_));
+
   std::memset(clients_, 0, sizeof(clients_));
+  std::memset(client_stats_, 0, sizeof(client_stats_));
   for (size_t i = 0; i < kMaximumClientCount; ++i) {
     unused_clients_.push(i);
   }
@@ -131,9 +155,17 @@ void AudioSystem::WorkerThreadMain() {
 
         if (client_callback) {
           SCOPE_profile_cpu_i("apu", "xe::apu::AudioSystem->client_callback");
+          uint64_t start_ticks = Clock::QueryHostTickCount();
           uint64_t args[] = {client_callback_arg};
           processor_->Execute(worker_thread_->thread_state(), client_callback,
                               args, xe::countof(args));
+          uint64_t ticks = Clock::QueryHostTickCount() - start_ticks;
+          auto& stats = client_stats_[index];
+          stats.callback_count++;
+          stats.callback_ticks += ticks;
+          stats.max_callback_ticks = std::max(stats.max_callback_ticks, ticks);
+          COUNT_profile_cpu("apu/AudioSystem/CallbackUs",
+                            ticks * 1000000 / Clock::host_tick_frequency());
         }
         pumped++;
         index++;
@@ -147,6 +179,14 @@ void AudioSystem::WorkerThreadMain() {
       break;
     }
 
+    if (FLAGS_audio_stats_interval_ms > 0) {
+      uint32_t now = Clock::QueryHostUptimeMillis();
+      if (now - last_stats_time_ >= uint32_t(FLAGS_audio_stats_interval_ms)) {
+        last_stats_time_ = now;
+        DumpStats();
+      }
+    }
+
     if (!pumped) {
       SCOPE_profile_cpu_i("apu", "Sleep");
       xe::threading::Sleep(std::chrono::milliseconds(500));
@@ -157,6 +197,35 @@ void AudioSystem::WorkerThreadMain() {
   // TODO(benvanik): call module API to kill?
 }
 
+void AudioSystem::DumpStats() {
+  double us_per_tick = 1000000.0 / double(Clock::host_tick_frequency());
+  {
+    std::lock_guard<xe::mutex> lock(lock_);
+    for (size_t i = 0; i < kMaximumClientCount; ++i) {
+      auto& stats = client_stats_[i];
+      auto driver = clients_[i].driver;
+      if (!driver) {
+        stats = {0};
+        continue;
+      }
+      auto frame_ring = driver->frame_ring();
+      XELOGI(
+          "Audio client %d: %5u callbacks, avg %7.1fus, max %7.1fus, "
+          "queued %d/%d, underruns %lld, overruns %lld",
+          int(i), stats.callback_count,
+          stats.callback_count
+              ? stats.callback_ticks * us_per_tick / stats.callback_count
+              : 0.0,
+          stats.max_callback_ticks * us_per_tick,
+          frame_ring ? int(frame_ring->queued()) : 0, int(queued_frames_),
+          frame_ring ? frame_ring->underrun_count() : 0ull,
+          frame_ring ? frame_ring->overrun_count() : 0ull);
+      stats = {0};
+    }
+  }
+  xma_decoder_->DumpStats();
+}
+
 void AudioSystem::Initialize() {}
 
 void AudioSystem::Shutdown() {
@@ -174,7 +243,7 @@ X_STATUS AudioSystem::RegisterClient(uint32_t callback, uint32_t callback_arg,
   auto index = unused_clients_.front();
 
   auto client_semaphore = client_semaphores_[index].get();
-  auto ret = client_semaphore->Release(kMaximumQueuedFrames, nullptr);
+  auto ret = client_semaphore->Release(int(queued_frames_), nullptr);
   assert_true(ret);
 
   AudioDriver* driver;
@@ -204,7 +273,22 @@ void AudioSystem::SubmitFrame(size_t index, uint32_t samples_ptr) {
   std::lock_guard<xe::mutex> lock(lock_);
   assert_true(index < kMaximumClientCount);
   assert_true(clients_[index].driver != NULL);
-  (clients_[index].driver)->SubmitFrame(samples_ptr);
+  if (fast_forward_) {
+    // Hand the slot straight back; frames already queued still play out.
+    auto ret = client_semaphores_[index]->Release(1, nullptr);
+    assert_true(ret);
+    return;
+  }
+  auto driver = clients_[index].driver;
+  driver->SubmitFrame(samples_ptr);
+
+  auto frame_ring = driver->frame_ring();
+  if (frame_ring) {
+    COUNT_profile_cpu("apu/AudioSystem/QueuedFrames", frame_ring->queued());
+    COUNT_profile_cpu("apu/AudioSystem/Underruns",
+                      frame_ring->underrun_count());
+    COUNT_profile_cpu("apu/AudioSystem/Overruns", frame_ring->overrun_count());
+  }
 }
 
 void AudioSystem::UnregisterClient(size_t index) {
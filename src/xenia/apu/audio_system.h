@@ -44,12 +44,18 @@ class AudioSystem {
   void UnregisterClient(size_t index);
   void SubmitFrame(size_t index, uint32_t samples_ptr);
 
+  // While set, submitted frames are dropped instead of queued on the driver,
+  // so the device no longer paces the guest.
+  void set_fast_forward(bool fast_forward) { fast_forward_ = fast_forward; }
+  bool fast_forward() const { return fast_forward_; }
+
  protected:
   explicit AudioSystem(cpu::Processor* processor);
 
   virtual void Initialize();
 
   void WorkerThreadMain();
+  void DumpStats();
 
   virtual X_STATUS CreateDriver(size_t index,
                                 xe::threading::Semaphore* semaphore,
@@ -59,12 +65,18 @@ class AudioSystem {
   // TODO(gibbed): respect XAUDIO2_MAX_QUEUED_BUFFERS somehow (ie min(64,
   // XAUDIO2_MAX_QUEUED_BUFFERS))
   static const size_t kMaximumQueuedFrames = 64;
+  // Guest frames are 256 samples at 48kHz.
+  static const size_t kFrameMicroseconds = 256 * 1000000 / 48000;
+
+  // Frames each client may have queued, from --audio_latency_ms.
+  size_t queued_frames_ = kMaximumQueuedFrames;
 
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
   std::unique_ptr<XmaDecoder> xma_decoder_;
 
   std::atomic<bool> worker_running_ = {false};
+  std::atomic<bool> fast_forward_ = {false};
   kernel::object_ref<kernel::XHostThread> worker_thread_;
 
   xe::mutex lock_;
@@ -84,6 +96,14 @@ class AudioSystem {
   std::unique_ptr<xe::threading::Event> shutdown_event_;
   xe::threading::WaitHandle* wait_handles_[kMaximumClientCount + 1];
   std::queue<size_t> unused_clients_;
+
+  // Only touched on the worker thread.
+  struct ClientStats {
+    uint32_t callback_count;
+    uint64_t callback_ticks;
+    uint64_t max_callback_ticks;
+  } client_stats_[kMaximumClientCount];
+  uint32_t last_stats_time_ = 0;
 };
 
 }  // namespace apu
@@ -8,3 +8,8 @@
  */
 
 #include "xenia/apu/nop/nop_apu_flags.h"
+
+DEFINE_bool(nop_audio_fast_forward, false,
+            "With the nop APU, accept audio clients and complete their frames "
+            "as soon as they are submitted (output is discarded), so audio "
+            "never paces the guest. For benchmarks and headless runs.");
@@ -12,4 +12,6 @@
 
 #include <gflags/gflags.h>
 
+DECLARE_bool(nop_audio_fast_forward);
+
 #endif  // XENIA_APU_NOP_NOP_APU_FLAGS_H_
@@ -10,11 +10,29 @@
 #include "xenia/apu/nop/nop_audio_system.h"
 
 #include "xenia/apu/apu_flags.h"
+#include "xenia/apu/audio_driver.h"
+#include "xenia/apu/nop/nop_apu_flags.h"
 
 namespace xe {
 namespace apu {
 namespace nop {
 
+// Discards every frame and immediately hands the slot back, so the client
+// callback runs again as soon as the guest has produced the next frame.
+class NopAudioDriver : public AudioDriver {
+ public:
+  NopAudioDriver(Memory* memory, xe::threading::Semaphore* semaphore)
+      : AudioDriver(memory), semaphore_(semaphore) {}
+
+  void SubmitFrame(uint32_t samples_ptr) override {
+    auto ret = semaphore_->Release(1, nullptr);
+    assert_true(ret);
+  }
+
+ private:
+  xe::threading::Semaphore* semaphore_ = nullptr;
+};
+
 std::unique_ptr<AudioSystem> NopAudioSystem::Create(cpu::Processor* processor) {
   return std::make_unique<NopAudioSystem>(processor);
 }
@@ -27,10 +45,18 @@ NopAudioSystem::~NopAudioSystem() = default;
 X_STATUS NopAudioSystem::CreateDriver(size_t index,
                                       xe::threading::Semaphore* semaphore,
                                       AudioDriver** out_driver) {
-  return X_STATUS_NOT_IMPLEMENTED;
+  if (!FLAGS_nop_audio_fast_forward) {
+    return X_STATUS_NOT_IMPLEMENTED;
+  }
+  assert_not_null(out_driver);
+  *out_driver = new NopAudioDriver(memory_, semaphore);
+  return X_STATUS_SUCCESS;
 }
 
-void NopAudioSystem::DestroyDriver(AudioDriver* driver) { assert_always(); }
+void NopAudioSystem::DestroyDriver(AudioDriver* driver) {
+  assert_true(FLAGS_nop_audio_fast_forward);
+  delete static_cast<NopAudioDriver*>(driver);
+}
 
 }  // namespace nop
 }  // namespace apu
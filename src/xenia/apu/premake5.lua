@@ -9,6 +9,7 @@ project("xenia-apu")
   links({
     "libavcodec",
     "libavutil",
+    "xxhash",
     "xenia-base",
   })
   defines({
@@ -19,3 +20,15 @@ project("xenia-apu")
   })
   local_platform_files()
 
+
+test_suite("xenia-apu-tests", project_root, ".", {
+  includedirs = {
+    project_root.."/build_tools/third_party/gflags/src",
+  },
+  links = {
+    "xenia-apu",
+    "xenia-base",
+    "xenia-core",
+    "xxhash",
+  },
+})
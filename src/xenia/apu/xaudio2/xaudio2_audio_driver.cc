@@ -14,6 +14,7 @@
 #include <xaudio2.h>  // NOLINT(build/include_order)
 
 #include "xenia/apu/apu_flags.h"
+#include "xenia/apu/audio_conversion.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 
@@ -23,14 +24,20 @@ namespace xaudio2 {
 
 class XAudio2AudioDriver::VoiceCallback : public IXAudio2VoiceCallback {
  public:
-  explicit VoiceCallback(xe::threading::Semaphore* semaphore)
-      : semaphore_(semaphore) {}
+  VoiceCallback(xe::threading::Semaphore* semaphore,
+                AudioFrameRing* frame_ring)
+      : semaphore_(semaphore), frame_ring_(frame_ring) {}
   ~VoiceCallback() {}
 
   void OnStreamEnd() {}
   void OnVoiceProcessingPassEnd() {}
   void OnVoiceProcessingPassStart(uint32_t samples_required) {}
   void OnBufferEnd(void* context) {
+    frame_ring_->EndRead();
+    if (!frame_ring_->queued()) {
+      // The voice played everything we gave it; the guest is behind.
+      frame_ring_->RecordUnderrun();
+    }
     auto ret = semaphore_->Release(1, nullptr);
     assert_true(ret);
   }
@@ -40,13 +47,17 @@ class XAudio2AudioDriver::VoiceCallback : public IXAudio2VoiceCallback {
 
  private:
   xe::threading::Semaphore* semaphore_ = nullptr;
+  AudioFrameRing* frame_ring_ = nullptr;
 };
 
 XAudio2AudioDriver::XAudio2AudioDriver(Memory* memory,
-                                       xe::threading::Semaphore* semaphore)
+                                       xe::threading::Semaphore* semaphore,
+                                       size_t queued_frames)
     : AudioDriver(memory), semaphore_(semaphore) {
   static_assert(frame_count_ == XAUDIO2_MAX_QUEUED_BUFFERS,
                 "xaudio header differs");
+  assert_true(queued_frames <= frame_count_);
+  frame_ring_ = std::make_unique<AudioFrameRing>(frame_samples_, queued_frames);
 }
 
 XAudio2AudioDriver::~XAudio2AudioDriver() = default;
@@ -61,7 +72,7 @@ const DWORD ChannelMasks[] = {
 void XAudio2AudioDriver::Initialize() {
   HRESULT hr;
 
-  voice_callback_ = new VoiceCallback(semaphore_);
+  voice_callback_ = new VoiceCallback(semaphore_, frame_ring_.get());
 
   hr = XAudio2Create(&audio_, 0, XAUDIO2_DEFAULT_PROCESSOR);
   if (FAILED(hr)) {
@@ -129,21 +140,20 @@ void XAudio2AudioDriver::SubmitFrame(uint32_t frame_ptr) {
   // Process samples! They are big-endian floats.
   HRESULT hr;
 
-  XAUDIO2_VOICE_STATE state;
-  pcm_voice_->GetState(&state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
-  assert_true(state.BuffersQueued < frame_count_);
+  // The client semaphore keeps the guest within the ring, so this only fails
+  // if the guest submits without waiting for its callback.
+  auto output_frame = frame_ring_->BeginWrite();
+  if (!output_frame) {
+    // Drop the frame but hand back the slot the guest waited for.
+    semaphore_->Release(1, nullptr);
+    return;
+  }
 
   auto input_frame = memory_->TranslateVirtual<float*>(frame_ptr);
-  auto output_frame = reinterpret_cast<float*>(frames_[current_frame_]);
-  auto interleave_channels = frame_channels_;
 
   // interleave the data
-  for (uint32_t index = 0, o = 0; index < channel_samples_; ++index) {
-    for (uint32_t channel = 0, table = 0; channel < interleave_channels;
-         ++channel, table += channel_samples_) {
-      output_frame[o++] = xe::byte_swap(input_frame[table + index]);
-    }
-  }
+  conversion::PlanarFloatBEToInterleavedFloat(input_frame, frame_channels_,
+                                              channel_samples_, output_frame);
 
   XAUDIO2_BUFFER buffer;
   buffer.Flags = 0;
@@ -155,6 +165,7 @@ void XAudio2AudioDriver::SubmitFrame(uint32_t frame_ptr) {
   buffer.LoopLength = 0;
   buffer.LoopCount = 0;
   buffer.pContext = 0;
+  frame_ring_->EndWrite();
   hr = pcm_voice_->SubmitSourceBuffer(&buffer);
   if (FAILED(hr)) {
     XELOGE("SubmitSourceBuffer failed with %.8X", hr);
@@ -162,8 +173,6 @@ void XAudio2AudioDriver::SubmitFrame(uint32_t frame_ptr) {
     return;
   }
 
-  current_frame_ = (current_frame_ + 1) % frame_count_;
-
   // Update playback ratio to our time scalar.
   // This will keep audio in sync with the game clock.
   pcm_voice_->SetFrequencyRatio(
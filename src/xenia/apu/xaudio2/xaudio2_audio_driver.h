@@ -23,7 +23,8 @@ namespace xaudio2 {
 
 class XAudio2AudioDriver : public AudioDriver {
  public:
-  XAudio2AudioDriver(Memory* memory, xe::threading::Semaphore* semaphore);
+  XAudio2AudioDriver(Memory* memory, xe::threading::Semaphore* semaphore,
+                     size_t queued_frames);
   ~XAudio2AudioDriver() override;
 
   void Initialize();
@@ -44,8 +45,6 @@ class XAudio2AudioDriver : public AudioDriver {
   static const uint32_t channel_samples_ = 256;
   static const uint32_t frame_samples_ = frame_channels_ * channel_samples_;
   static const uint32_t frame_size_ = sizeof(float) * frame_samples_;
-  float frames_[frame_count_][frame_samples_];
-  uint32_t current_frame_ = 0;
 };
 
 }  // namespace xaudio2
@@ -34,7 +34,7 @@ X_STATUS XAudio2AudioSystem::CreateDriver(size_t index,
                                           xe::threading::Semaphore* semaphore,
                                           AudioDriver** out_driver) {
   assert_not_null(out_driver);
-  auto driver = new XAudio2AudioDriver(memory_, semaphore);
+  auto driver = new XAudio2AudioDriver(memory_, semaphore, queued_frames_);
   driver->Initialize();
   *out_driver = driver;
   return X_STATUS_SUCCESS;
@@ -12,9 +12,11 @@
 #include <algorithm>
 #include <cstring>
 
+#include "xenia/apu/audio_conversion.h"
 #include "xenia/apu/xma_decoder.h"
 #include "xenia/apu/xma_helpers.h"
 #include "xenia/base/bit_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/ring_buffer.h"
 #include "xenia/profiling.h"
@@ -45,15 +47,32 @@ XmaContext::~XmaContext() {
   if (decoded_frame_) {
     av_frame_free(&decoded_frame_);
   }
+  if (packet_) {
+    delete packet_;
+  }
   if (current_frame_) {
     delete[] current_frame_;
   }
 }
 
-int XmaContext::Setup(uint32_t id, Memory* memory, uint32_t guest_ptr) {
+int XmaContext::Setup(uint32_t id, Memory* memory, uint32_t guest_ptr,
+                      XmaFrameCache* frame_cache) {
   id_ = id;
   memory_ = memory;
   guest_ptr_ = guest_ptr;
+  frame_cache_ = frame_cache;
+
+  // Codec state is allocated when the context is first handed out; most
+  // titles only ever use a handful of the 320 contexts.
+  return 0;
+}
+
+int XmaContext::AllocateCodecState() {
+  std::lock_guard<xe::mutex> lock(lock_);
+  if (context_) {
+    // Already allocated by an earlier user of this context.
+    return 0;
+  }
 
   // Allocate important stuff.
   codec_ = &ff_xma2_decoder;
@@ -96,6 +115,10 @@ int XmaContext::Setup(uint32_t id, Memory* memory, uint32_t guest_ptr) {
   current_frame_pos_ = 0;
   frame_samples_size_ = 0;
 
+  if (frame_cache_->enabled()) {
+    cache_frame_ = std::make_unique<XmaFrameCache::Frame>();
+  }
+
   // FYI: We're purposely not opening the context here. That is done later.
   return 0;
 }
@@ -108,10 +131,24 @@ void XmaContext::Work() {
 
   set_is_enabled(false);
 
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+
   auto context_ptr = memory()->TranslateVirtual(guest_ptr());
   XMA_CONTEXT_DATA data(context_ptr);
   DecodePackets(&data);
   data.Store(context_ptr);
+
+  uint64_t ticks = Clock::QueryHostTickCount() - start_ticks;
+  stats_.decode_count++;
+  stats_.decode_ticks += ticks;
+  stats_.max_decode_ticks = std::max(stats_.max_decode_ticks, ticks);
+}
+
+XmaContext::Stats XmaContext::TakeStats() {
+  std::lock_guard<xe::mutex> lock(lock_);
+  Stats stats = stats_;
+  stats_ = {0};
+  return stats;
 }
 
 void XmaContext::Enable() {
@@ -145,6 +182,12 @@ bool XmaContext::Block(bool poll) {
 void XmaContext::Clear() {
   std::lock_guard<xe::mutex> lock(lock_);
   XELOGAPU("XmaContext: reset context %d", id());
+  if (cache_frame_ && avcodec_is_open(context_)) {
+    // Cache keys start from a freshly opened decoder, so the next sound
+    // needs one to hit. PrepareDecoder reopens it.
+    avcodec_close(context_);
+    context_->sample_rate = 0;
+  }
 
   auto context_ptr = memory()->TranslateVirtual(guest_ptr());
   XMA_CONTEXT_DATA data(context_ptr);
@@ -248,15 +291,16 @@ bool XmaContext::ValidFrameOffset(uint8_t* block, size_t size_bytes,
     }
 
     uint64_t size = stream.Read(15);
-    if ((size - 15) > stream.BitsRemaining()) {
-      // Last frame.
+    if (size < 16 || (size - 15) > stream.BitsRemaining()) {
+      // Last frame (or a corrupt header).
       return false;
     } else if (size == 0x7FFF) {
       // Invalid frame (and last of this packet)
       return false;
     }
 
-    stream.Advance(size - 16);
+    // Bounds were checked above.
+    stream.Skip(size - 16);
 
     // Read the trailing bit to see if frames follow
     if (stream.Read(1) == 0) {
@@ -428,7 +472,7 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
       stream.SetOffset(data->input_buffer_read_offset);
 
       if (stream.BitsRemaining() >= 15) {
-        uint64_t frame_size = stream.Read(15);
+        uint64_t frame_size = stream.Peek(15);
         if (data->input_buffer_read_offset + frame_size >=
                 current_input_size * 8 &&
             frame_size != 0x7FFF) {
@@ -513,9 +557,20 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
     int invalid_frame = 0;  // invalid frame?
     int got_frame = 0;      // successfully decoded a frame?
     int frame_size = 0;
-    int len =
-        xma2_decode_frame(context_, packet_, decoded_frame_, &got_frame,
-                          &invalid_frame, &frame_size, !partial, bit_offset);
+    int len = 0;
+
+    // The decoder sees every frame, cached or not, so its state stays in
+    // step with the stream. Only the conversion is skipped on a hit. A frame
+    // that can't be keyed leaves the decoder in a state no key describes,
+    // so nothing is cached until it is reopened.
+    uint64_t frame_key = 0;
+    if (cache_frame_ && last_frame_key_ != kBrokenFrameKey) {
+      frame_key = GetFrameCacheKey(packet_->data, packet_->size, bit_offset,
+                                   data->sample_rate, num_channels);
+    }
+    last_frame_key_ = frame_key ? frame_key : kBrokenFrameKey;
+    len = xma2_decode_frame(context_, packet_, decoded_frame_, &got_frame,
+                            &invalid_frame, &frame_size, !partial, bit_offset);
     if (!partial && len == 0) {
       // Got the last frame of a packet. Advance the read offset to the next
       // packet.
@@ -588,19 +643,33 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
       // Copy to the output buffer.
       size_t written_bytes = 0;
 
-      // Validity checks.
-      assert(decoded_frame_->nb_samples <= kSamplesPerFrame);
-      assert(context_->sample_fmt == AV_SAMPLE_FMT_FLTP);
-
-      // Check the returned buffer size.
-      assert(av_samples_get_buffer_size(NULL, context_->channels,
-                                        decoded_frame_->nb_samples,
-                                        context_->sample_fmt, 1) ==
-             context_->channels * decoded_frame_->nb_samples * sizeof(float));
-
-      // Convert the frame.
-      ConvertFrame((const uint8_t**)decoded_frame_->data, context_->channels,
-                   decoded_frame_->nb_samples, current_frame_);
+      if (frame_key && frame_cache_->Lookup(frame_key, cache_frame_.get())) {
+        std::memcpy(current_frame_, cache_frame_->samples,
+                    cache_frame_->byte_count);
+      } else {
+        // Validity checks.
+        assert(decoded_frame_->nb_samples <= kSamplesPerFrame);
+        assert(context_->sample_fmt == AV_SAMPLE_FMT_FLTP);
+
+        // Check the returned buffer size.
+        assert(av_samples_get_buffer_size(NULL, context_->channels,
+                                          decoded_frame_->nb_samples,
+                                          context_->sample_fmt, 1) ==
+               context_->channels * decoded_frame_->nb_samples *
+                   sizeof(float));
+
+        // Convert the frame.
+        ConvertFrame((const uint8_t**)decoded_frame_->data,
+                     context_->channels, decoded_frame_->nb_samples,
+                     current_frame_);
+
+        if (frame_key && len >= 0) {
+          cache_frame_->byte_count = kBytesPerFrame * num_channels;
+          std::memcpy(cache_frame_->samples, current_frame_,
+                      cache_frame_->byte_count);
+          frame_cache_->Insert(frame_key, *cache_frame_);
+        }
+      }
       current_frame_pos_ = 0;
 
       if (output_remaining_bytes < kBytesPerFrame * num_channels) {
@@ -644,6 +713,30 @@ uint32_t XmaContext::GetFramePacketNumber(uint8_t* block, size_t size,
   return (uint32_t)packet_number;
 }
 
+uint64_t XmaContext::GetFrameCacheKey(uint8_t* block, size_t size,
+                                      size_t bit_offset, int sample_rate,
+                                      int channels) {
+  BitStream stream(block, size * 8);
+  stream.SetOffset(bit_offset);
+  if (stream.BitsRemaining() < 15) {
+    return 0;
+  }
+  uint64_t frame_bits = stream.Peek(15);
+  if (frame_bits == 0x7FFF || bit_offset + frame_bits > size * 8) {
+    return 0;
+  }
+
+  // Hash the bytes covering the frame (including any packet header it spans)
+  // plus everything that changes how those bytes decode.
+  size_t start = bit_offset / 8;
+  size_t end = (bit_offset + frame_bits + 7) / 8;
+  uint64_t params = (bit_offset % (kBytesPerPacket * 8)) ^
+                    (uint64_t(sample_rate) << 32) ^
+                    (uint64_t(channels) << 40);
+  return XmaFrameCache::ChainKey(last_frame_key_, block + start, end - start,
+                                 params);
+}
+
 int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
                                int channels) {
   // Sanity check: Packet metadata is always 1 for XMA2/0 for XMA
@@ -656,6 +749,7 @@ int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
     // We have to reopen the codec so it'll realloc whatever data it needs.
     // TODO(DrChat): Find a better way.
     avcodec_close(context_);
+    last_frame_key_ = 0;
 
     context_->sample_rate = sample_rate;
     context_->channels = channels;
@@ -675,27 +769,11 @@ int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
 
 bool XmaContext::ConvertFrame(const uint8_t** samples, int num_channels,
                               int num_samples, uint8_t* output_buffer) {
-  // Loop through every sample, convert and drop it into the output array.
-  // If more than one channel, we need to interleave the samples from each
-  // channel next to each other.
-  // TODO: This can definitely be optimized with AVX/SSE intrinsics!
-  uint32_t o = 0;
-  for (int i = 0; i < num_samples; i++) {
-    for (int j = 0; j < num_channels; j++) {
-      // Select the appropriate array based on the current channel.
-      auto sample_array = reinterpret_cast<const float*>(samples[j]);
-
-      // Raw sample should be within [-1, 1].
-      // Clamp it, just in case.
-      float raw_sample = xe::saturate(sample_array[i]);
-
-      // Convert the sample and output it in big endian.
-      float scaled_sample = raw_sample * ((1 << 15) - 1);
-      int sample = static_cast<int>(scaled_sample);
-      xe::store_and_swap<uint16_t>(&output_buffer[o++ * 2], sample & 0xFFFF);
-    }
-  }
-
+  // Saturate, scale to 16-bit and interleave the planar float channels into
+  // the output array in big endian.
+  conversion::PlanarFloatToInterleavedS16BE(
+      reinterpret_cast<const float* const*>(samples), num_channels,
+      num_samples, reinterpret_cast<uint16_t*>(output_buffer));
   return true;
 }
 
@@ -11,9 +11,11 @@
 #define XENIA_APU_XMA_CONTEXT_H_
 
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <queue>
 
+#include "xenia/apu/xma_frame_cache.h"
 #include "xenia/memory.h"
 #include "xenia/xbox.h"
 
@@ -145,9 +147,20 @@ class XmaContext {
   explicit XmaContext();
   ~XmaContext();
 
-  int Setup(uint32_t id, Memory* memory, uint32_t guest_ptr);
+  int Setup(uint32_t id, Memory* memory, uint32_t guest_ptr,
+            XmaFrameCache* frame_cache);
+  // Allocates the libav and frame buffers on first use of the context.
+  int AllocateCodecState();
   void Work();
 
+  struct Stats {
+    uint32_t decode_count;
+    uint64_t decode_ticks;
+    uint64_t max_decode_ticks;
+  };
+  // Returns decode timing since the last call and resets it.
+  Stats TakeStats();
+
   void Enable();
   bool Block(bool poll);
   void Clear();
@@ -173,6 +186,8 @@ class XmaContext {
                         size_t frame_offset_bits);
   void DecodePackets(XMA_CONTEXT_DATA* data);
   uint32_t GetFramePacketNumber(uint8_t* block, size_t size, size_t bit_offset);
+  uint64_t GetFrameCacheKey(uint8_t* block, size_t size, size_t bit_offset,
+                            int sample_rate, int channels);
   int PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
                      int channels);
 
@@ -216,6 +231,16 @@ class XmaContext {
   uint32_t last_input_read_pos_ = 0;  // Last seen read buffer pos
   uint8_t* current_frame_ = nullptr;
   uint32_t frame_samples_size_ = 0;
+
+  // Shared converted frame cache (may be disabled) and the key of the last
+  // frame this context decoded, which seeds the next key. 0 right after the
+  // decoder is opened.
+  static const uint64_t kBrokenFrameKey = ~0ull;
+  XmaFrameCache* frame_cache_ = nullptr;
+  uint64_t last_frame_key_ = 0;
+  std::unique_ptr<XmaFrameCache::Frame> cache_frame_;
+
+  Stats stats_ = {0};  // Guarded by lock_.
 };
 
 }  // namespace apu
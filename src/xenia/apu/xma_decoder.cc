@@ -11,7 +11,13 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "xenia/apu/apu_flags.h"
 #include "xenia/apu/xma_context.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/ring_buffer.h"
@@ -55,7 +61,12 @@ namespace xe {
 namespace apu {
 
 XmaDecoder::XmaDecoder(cpu::Processor* processor)
-    : memory_(processor->memory()), processor_(processor) {}
+    : memory_(processor->memory()), processor_(processor) {
+  for (auto& pending : pending_contexts_) {
+    pending.store(0, std::memory_order_relaxed);
+  }
+  std::memset(allocated_contexts_, 0, sizeof(allocated_contexts_));
+}
 
 XmaDecoder::~XmaDecoder() = default;
 
@@ -65,15 +76,19 @@ void av_log_callback(void* avcl, int level, const char* fmt, va_list va) {
   }
 
   char level_char = '?';
+  LogLevel log_level = LogLevel::kDebug;
   switch (level) {
     case AV_LOG_ERROR:
       level_char = '!';
+      log_level = LogLevel::kError;
       break;
     case AV_LOG_WARNING:
       level_char = 'w';
+      log_level = LogLevel::kWarning;
       break;
     case AV_LOG_INFO:
       level_char = 'i';
+      log_level = LogLevel::kInfo;
       break;
     case AV_LOG_VERBOSE:
       level_char = 'v';
@@ -82,6 +97,9 @@ void av_log_callback(void* avcl, int level, const char* fmt, va_list va) {
       level_char = 'd';
       break;
   }
+  if (!xe::ShouldLog(LogCategory::kApu, log_level)) {
+    return;
+  }
 
   StringBuffer buff;
   buff.AppendVarargs(fmt, va);
@@ -105,53 +123,141 @@ X_STATUS XmaDecoder::Setup(kernel::KernelState* kernel_state) {
       context_data_first_ptr_ + (sizeof(XMA_CONTEXT_DATA) * kContextCount - 1);
   registers_.context_array_ptr = context_data_first_ptr_;
 
+  frame_cache_ = std::make_unique<XmaFrameCache>(
+      size_t(std::max(FLAGS_xma_decode_cache_mb, 0)) * 1024 * 1024);
+
   // Setup XMA contexts.
   for (int i = 0; i < kContextCount; ++i) {
     uint32_t guest_ptr =
         registers_.context_array_ptr + i * sizeof(XMA_CONTEXT_DATA);
     XmaContext& context = contexts_[i];
-    if (context.Setup(i, memory(), guest_ptr)) {
+    if (context.Setup(i, memory(), guest_ptr, frame_cache_.get())) {
       assert_always();
     }
   }
   registers_.next_context = 1;
 
+  // Contexts are independent (each has its own codec context and lock), so
+  // decode them on a small pool.
+  uint32_t worker_count = uint32_t(FLAGS_xma_decoder_threads);
+  if (FLAGS_xma_decoder_threads <= 0) {
+    worker_count = xe::threading::logical_processor_count() / 2;
+    worker_count = std::max(1u, std::min(4u, worker_count));
+  }
   worker_running_ = true;
-  worker_thread_ = kernel::object_ref<kernel::XHostThread>(
-      new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
-        WorkerThreadMain();
-        return 0;
-      }));
-  worker_thread_->set_name("XMA Decoder Worker");
-  worker_thread_->Create();
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    auto worker_thread = kernel::object_ref<kernel::XHostThread>(
+        new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this, i]() {
+          WorkerThreadMain(i);
+          return 0;
+        }));
+    worker_thread->set_name(
+        std::string("XMA Decoder Worker ") + std::to_string(i));
+    worker_thread->Create();
+    worker_threads_.push_back(std::move(worker_thread));
+  }
 
   return X_STATUS_SUCCESS;
 }
 
-void XmaDecoder::WorkerThreadMain() {
+bool XmaDecoder::ClaimContext(uint32_t worker_index,
+                              uint32_t* out_context_id) {
+  // Start each worker at a different word so they don't all fight over the
+  // same contexts.
+  const uint32_t word_count = uint32_t(xe::countof(pending_contexts_));
+  for (uint32_t n = 0; n < word_count; ++n) {
+    uint32_t i = (worker_index + n) % word_count;
+    uint32_t bits = pending_contexts_[i].load(std::memory_order_acquire);
+    uint32_t bit;
+    while (xe::bit_scan_forward(bits, &bit)) {
+      uint32_t mask = 1u << bit;
+      bits = pending_contexts_[i].fetch_and(~mask, std::memory_order_acq_rel);
+      if (bits & mask) {
+        *out_context_id = i * 32 + bit;
+        return true;
+      }
+      // Someone else took it; try what's left.
+      bits &= ~mask;
+    }
+  }
+  return false;
+}
+
+void XmaDecoder::WorkerThreadMain(uint32_t worker_index) {
   while (worker_running_) {
-    // Okay, let's loop through XMA contexts to find ones we need to decode!
-    for (uint32_t n = 0; n < kContextCount; n++) {
-      XmaContext& context = contexts_[n];
-      context.Work();
+    uint32_t n;
+    if (!ClaimContext(worker_index, &n)) {
+      worker_fence_.Wait();
+      if (!worker_running_) {
+        // Pass the shutdown wake along to the next sleeping worker.
+        worker_fence_.Signal();
+      }
+      continue;
+    }
+
+    // Wake another worker in case there is more pending than we can take.
+    for (auto& pending : pending_contexts_) {
+      if (pending.load(std::memory_order_relaxed)) {
+        worker_fence_.Signal();
+        break;
+      }
+    }
 
-      // TODO: Need thread safety to do this.
-      // Probably not too important though.
-      // registers_.current_context = n;
-      // registers_.next_context = (n + 1) % kContextCount;
+    // Work() takes the context lock, so a context is never decoded by two
+    // workers at once.
+    XmaContext& context = contexts_[n];
+    {
+      SCOPE_profile_cpu_i("apu", "xe::apu::XmaContext::Work");
+      context.Work();
     }
-    xe::threading::MaybeYield();
+
+    // TODO: Need thread safety to do this.
+    // Probably not too important though.
+    // registers_.current_context = n;
+    // registers_.next_context = (n + 1) % kContextCount;
   }
 }
 
+void XmaDecoder::QueueContexts(uint32_t base_context_id,
+                               uint32_t context_bits) {
+  // base_context_id is always a multiple of 32 (one register per word).
+  pending_contexts_[base_context_id / 32].fetch_or(context_bits,
+                                                   std::memory_order_acq_rel);
+  worker_fence_.Signal();
+}
+
 void XmaDecoder::Shutdown() {
   worker_running_ = false;
   worker_fence_.Signal();
-  worker_thread_.reset();
+  worker_threads_.clear();
 
   memory()->SystemHeapFree(registers_.context_array_ptr);
 }
 
+void XmaDecoder::DumpStats() {
+  double us_per_tick = 1000000.0 / double(Clock::host_tick_frequency());
+  uint32_t total_count = 0;
+  uint64_t total_ticks = 0;
+  for (uint32_t n = 0; n < kContextCount; n++) {
+    XmaContext& context = contexts_[n];
+    if (!context.is_allocated()) {
+      continue;
+    }
+    auto stats = context.TakeStats();
+    if (!stats.decode_count) {
+      continue;
+    }
+    total_count += stats.decode_count;
+    total_ticks += stats.decode_ticks;
+    XELOGI("XMA context %3d: %5u decodes, avg %7.1fus, max %7.1fus", n,
+           stats.decode_count,
+           stats.decode_ticks * us_per_tick / stats.decode_count,
+           stats.max_decode_ticks * us_per_tick);
+  }
+  XELOGI("XMA total: %u decodes, %.1fms decoding", total_count,
+         total_ticks * us_per_tick / 1000.0);
+}
+
 int XmaDecoder::GetContextId(uint32_t guest_ptr) {
   static_assert(sizeof(XMA_CONTEXT_DATA) == 64, "FIXME");
   if (guest_ptr < context_data_first_ptr_ ||
@@ -165,12 +271,20 @@ int XmaDecoder::GetContextId(uint32_t guest_ptr) {
 uint32_t XmaDecoder::AllocateContext() {
   std::lock_guard<xe::mutex> lock(lock_);
 
-  for (uint32_t n = 0; n < kContextCount; n++) {
-    XmaContext& context = contexts_[n];
-    if (!context.is_allocated()) {
-      context.set_is_allocated(true);
-      return context.guest_ptr();
+  for (uint32_t i = 0; i < xe::countof(allocated_contexts_); ++i) {
+    uint32_t bit;
+    if (!xe::bit_scan_forward(~allocated_contexts_[i], &bit)) {
+      continue;
     }
+    XmaContext& context = contexts_[i * 32 + bit];
+    if (context.AllocateCodecState()) {
+      XELOGE("XmaDecoder: failed to allocate codec state for context %d",
+             i * 32 + bit);
+      return 0;
+    }
+    allocated_contexts_[i] |= 1u << bit;
+    context.set_is_allocated(true);
+    return context.guest_ptr();
   }
 
   return 0;
@@ -184,6 +298,7 @@ void XmaDecoder::ReleaseContext(uint32_t guest_ptr) {
 
   XmaContext& context = contexts_[context_id];
   context.Release();
+  allocated_contexts_[context_id / 32] &= ~(1u << (context_id % 32));
 }
 
 bool XmaDecoder::BlockOnContext(uint32_t guest_ptr, bool poll) {
@@ -243,6 +358,7 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
 
     // The context ID is a bit in the range of the entire context array.
     uint32_t base_context_id = (r - 0x1940) / 4 * 32;
+    uint32_t kicked_bits = value;
     for (int i = 0; value && i < 32; ++i, value >>= 1) {
       if (value & 1) {
         uint32_t context_id = base_context_id + i;
@@ -251,8 +367,8 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
       }
     }
 
-    // Signal the decoder thread to start processing.
-    worker_fence_.Signal();
+    // Queue the kicked contexts and wake the decoder thread.
+    QueueContexts(base_context_id, kicked_bits);
   } else if (r >= 0x1A40 && r <= 0x1A40 + 9 * 4) {
     // Context lock command.
     // This requests a lock by flagging the context.
@@ -265,9 +381,6 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
         context.Disable();
       }
     }
-
-    // Signal the decoder thread to start processing.
-    worker_fence_.Signal();
   } else if (r >= 0x1A80 && r <= 0x1A80 + 9 * 4) {
     // Context clear command.
     // This will reset the given hardware contexts.
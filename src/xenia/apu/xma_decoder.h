@@ -11,8 +11,10 @@
 #define XENIA_APU_XMA_DECODER_H_
 
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "xenia/apu/xma_context.h"
 #include "xenia/kernel/objects/xthread.h"
@@ -40,6 +42,9 @@ class XmaDecoder {
   void ReleaseContext(uint32_t guest_ptr);
   bool BlockOnContext(uint32_t guest_ptr, bool poll);
 
+  // Logs per-context decode timing since the last call.
+  void DumpStats();
+
   uint32_t ReadRegister(uint32_t addr);
   void WriteRegister(uint32_t addr, uint32_t value);
 
@@ -47,7 +52,9 @@ class XmaDecoder {
   int GetContextId(uint32_t guest_ptr);
 
  private:
-  void WorkerThreadMain();
+  void WorkerThreadMain(uint32_t worker_index);
+  bool ClaimContext(uint32_t worker_index, uint32_t* out_context_id);
+  void QueueContexts(uint32_t base_context_id, uint32_t context_bits);
 
   static uint32_t MMIOReadRegisterThunk(void* ppc_context, XmaDecoder* as,
                                         uint32_t addr) {
@@ -63,7 +70,7 @@ class XmaDecoder {
   cpu::Processor* processor_ = nullptr;
 
   std::atomic<bool> worker_running_ = {false};
-  kernel::object_ref<kernel::XHostThread> worker_thread_;
+  std::vector<kernel::object_ref<kernel::XHostThread>> worker_threads_;
   xe::threading::Fence worker_fence_;
 
   xe::mutex lock_;
@@ -90,7 +97,13 @@ class XmaDecoder {
   };
 
   static const uint32_t kContextCount = 320;
+  std::unique_ptr<XmaFrameCache> frame_cache_;
   XmaContext contexts_[kContextCount];
+  // One bit per context kicked since a worker last claimed it. Workers claim
+  // contexts one bit at a time and sleep on worker_fence_ when none are set.
+  std::atomic<uint32_t> pending_contexts_[kContextCount / 32];
+  // One bit per context handed out by AllocateContext. Guarded by lock_.
+  uint32_t allocated_contexts_[kContextCount / 32];
 
   uint32_t context_data_first_ptr_ = 0;
   uint32_t context_data_last_ptr_ = 0;
@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/xma_frame_cache.h"
+
+#include <cstring>
+
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace apu {
+
+XmaFrameCache::XmaFrameCache(size_t budget_bytes)
+    : max_entries_(budget_bytes / sizeof(EntryList::value_type)) {}
+
+XmaFrameCache::~XmaFrameCache() = default;
+
+uint64_t XmaFrameCache::ChainKey(uint64_t previous_key, const uint8_t* data,
+                                 size_t length, uint64_t params) {
+  uint64_t key = XXH64(data, length, previous_key ^ params);
+  return key != 0 && key != ~0ull ? key : 1;
+}
+
+bool XmaFrameCache::Lookup(uint64_t key, Frame* out_frame) {
+  std::lock_guard<xe::mutex> lock(lock_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++miss_count_;
+    return false;
+  }
+  ++hit_count_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  const Frame& frame = it->second->second;
+  out_frame->byte_count = frame.byte_count;
+  std::memcpy(out_frame->samples, frame.samples, frame.byte_count);
+  COUNT_profile_cpu("apu/XmaFrameCache/Hits", hit_count_);
+  return true;
+}
+
+void XmaFrameCache::Insert(uint64_t key, const Frame& frame) {
+  std::lock_guard<xe::mutex> lock(lock_);
+  if (!max_entries_ || index_.count(key)) {
+    return;
+  }
+  if (entries_.size() >= max_entries_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  entries_.emplace_front(key, frame);
+  index_[key] = entries_.begin();
+  COUNT_profile_cpu("apu/XmaFrameCache/Misses", miss_count_);
+}
+
+void XmaFrameCache::Clear() {
+  std::lock_guard<xe::mutex> lock(lock_);
+  index_.clear();
+  entries_.clear();
+}
+
+}  // namespace apu
+}  // namespace xe
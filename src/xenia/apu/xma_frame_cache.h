@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_XMA_FRAME_CACHE_H_
+#define XENIA_APU_XMA_FRAME_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "xenia/base/mutex.h"
+
+namespace xe {
+namespace apu {
+
+// Converted XMA frames shared by all contexts, so sounds that are replayed
+// (UI, loops, ambience) skip sample conversion. libav still decodes every
+// frame: its overlap state carries from one frame to the next, and a frame it
+// does not see would leave it out of step for the rest of the stream. Keys
+// chain in the key of the frame before (see ChainKey), so a converted frame
+// is only reused when the decoder state that produced it is the same. Least
+// recently used frames are evicted once the budget is reached.
+class XmaFrameCache {
+ public:
+  // Max converted frame size: 512 samples * 2 channels * 2 bytes.
+  static const size_t kMaxFrameBytes = 2048;
+
+  struct Frame {
+    uint32_t byte_count;
+    uint8_t samples[kMaxFrameBytes];
+  };
+
+  explicit XmaFrameCache(size_t budget_bytes);
+  ~XmaFrameCache();
+
+  bool enabled() const { return max_entries_ > 0; }
+
+  // Key for a frame of the given bytes following the frame with
+  // previous_key (0 at the start of a stream). params covers everything else
+  // that changes how the bytes decode. Never returns 0 or ~0.
+  static uint64_t ChainKey(uint64_t previous_key, const uint8_t* data,
+                           size_t length, uint64_t params);
+
+  bool Lookup(uint64_t key, Frame* out_frame);
+  void Insert(uint64_t key, const Frame& frame);
+  void Clear();
+
+ private:
+  typedef std::list<std::pair<uint64_t, Frame>> EntryList;
+
+  xe::mutex lock_;
+  size_t max_entries_ = 0;
+  EntryList entries_;  // Most recently used first.
+  std::unordered_map<uint64_t, EntryList::iterator> index_;
+  uint64_t hit_count_ = 0;
+  uint64_t miss_count_ = 0;
+};
+
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_XMA_FRAME_CACHE_H_
@@ -0,0 +1,139 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <utility>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/apu/xma_frame_cache.h"
+
+namespace {
+
+using xe::apu::XmaFrameCache;
+
+const uint32_t kFrameBytes = 512 * 2 * 2;
+
+typedef std::vector<uint8_t> Frame;
+typedef std::vector<Frame> Output;
+
+Frame MakeFrame(uint8_t id) { return Frame(64 + id, uint8_t(id * 13 + 1)); }
+
+// Stands in for libav: every output depends on all frames decoded before it,
+// as the MDCT overlap does.
+class FakeDecoder {
+ public:
+  uint64_t Decode(const Frame& frame) {
+    for (uint8_t value : frame) {
+      state_ = state_ * 31 + value + 1;
+    }
+    return state_;
+  }
+
+ private:
+  uint64_t state_ = 0;
+};
+
+// Follows XmaContext::DecodePackets: every frame is decoded and only the
+// conversion is served from the cache.
+class Player {
+ public:
+  explicit Player(XmaFrameCache* cache) : cache_(cache) {}
+
+  Output Play(const std::vector<Frame>& frames) {
+    Output output;
+    for (auto& frame : frames) {
+      uint64_t decoded = decoder_.Decode(frame);
+      uint64_t key = 0;
+      if (cache_) {
+        key = XmaFrameCache::ChainKey(last_key_, frame.data(), frame.size(),
+                                      0);
+      }
+      last_key_ = key;
+      if (key && cache_->Lookup(key, &frame_)) {
+        ++hit_count_;
+      } else {
+        frame_.byte_count = kFrameBytes;
+        for (uint32_t i = 0; i < kFrameBytes; ++i) {
+          frame_.samples[i] = uint8_t(decoded >> (i % 8 * 8)) ^ uint8_t(i);
+        }
+        if (key) {
+          cache_->Insert(key, frame_);
+        }
+      }
+      output.emplace_back(frame_.samples, frame_.samples + frame_.byte_count);
+    }
+    return output;
+  }
+
+  int hit_count() const { return hit_count_; }
+
+ private:
+  XmaFrameCache* cache_;
+  FakeDecoder decoder_;
+  uint64_t last_key_ = 0;
+  XmaFrameCache::Frame frame_;
+  int hit_count_ = 0;
+};
+
+Output PlayUncached(const std::vector<Frame>& frames) {
+  return Player(nullptr).Play(frames);
+}
+
+}  // namespace
+
+TEST_CASE("xma_frame_cache_replay", "XMA Frame Cache") {
+  XmaFrameCache cache(1024 * 1024);
+  std::vector<Frame> frames = {MakeFrame(0), MakeFrame(1), MakeFrame(2),
+                               MakeFrame(3)};
+  Player original(&cache);
+  REQUIRE(original.Play(frames) == PlayUncached(frames));
+  REQUIRE(original.hit_count() == 0);
+
+  Player replay(&cache);
+  REQUIRE(replay.Play(frames) == PlayUncached(frames));
+  REQUIRE(replay.hit_count() == 4);
+}
+
+TEST_CASE("xma_frame_cache_replay_diverges", "XMA Frame Cache") {
+  XmaFrameCache cache(1024 * 1024);
+  std::vector<Frame> frames = {MakeFrame(0), MakeFrame(1), MakeFrame(2),
+                               MakeFrame(3)};
+  Player(&cache).Play(frames);
+
+  // Same start, then new frames after a run of hits. The frames after the
+  // divergence must decode as if the cache was never used.
+  std::vector<Frame> diverging = {MakeFrame(0), MakeFrame(1), MakeFrame(4),
+                                  MakeFrame(5)};
+  Player replay(&cache);
+  REQUIRE(replay.Play(diverging) == PlayUncached(diverging));
+  REQUIRE(replay.hit_count() == 2);
+
+  // Frames seen before but reached through a different history don't hit.
+  std::vector<Frame> rejoining = {MakeFrame(0), MakeFrame(4), MakeFrame(2),
+                                  MakeFrame(3)};
+  Player rejoin(&cache);
+  REQUIRE(rejoin.Play(rejoining) == PlayUncached(rejoining));
+  REQUIRE(rejoin.hit_count() == 1);
+
+  // The original sequence still hits throughout.
+  Player again(&cache);
+  REQUIRE(again.Play(frames) == PlayUncached(frames));
+  REQUIRE(again.hit_count() == 4);
+}
+
+TEST_CASE("xma_frame_cache_eviction", "XMA Frame Cache") {
+  // Room for two frames only.
+  XmaFrameCache cache(2 * sizeof(std::pair<uint64_t, XmaFrameCache::Frame>));
+  std::vector<Frame> frames = {MakeFrame(0), MakeFrame(1), MakeFrame(2)};
+  Player(&cache).Play(frames);
+
+  Player replay(&cache);
+  REQUIRE(replay.Play(frames) == PlayUncached(frames));
+  REQUIRE(replay.hit_count() < 3);
+}
@@ -9,6 +9,8 @@
 
 #include "xenia/base/arena.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 
@@ -16,27 +18,122 @@
 
 namespace xe {
 
+namespace {
+
+// Chunk buffers released on a thread are kept around for the next arena that
+// needs one there, as compile workers create and tear down builders and
+// compilers and the default 4MB chunks are expensive to get from the system.
+class ChunkBufferCache {
+ public:
+  ~ChunkBufferCache() {
+    for (size_t i = 0; i < count_; ++i) {
+      free(entries_[i].buffer);
+    }
+  }
+
+  uint8_t* Take(size_t capacity) {
+    for (size_t i = 0; i < count_; ++i) {
+      if (entries_[i].capacity == capacity) {
+        uint8_t* buffer = entries_[i].buffer;
+        entries_[i] = entries_[--count_];
+        return buffer;
+      }
+    }
+    return nullptr;
+  }
+
+  bool Put(uint8_t* buffer, size_t capacity) {
+    if (count_ == kMaxEntries) {
+      return false;
+    }
+    entries_[count_++] = {buffer, capacity};
+    return true;
+  }
+
+ private:
+  static const size_t kMaxEntries = 4;
+  struct Entry {
+    uint8_t* buffer;
+    size_t capacity;
+  };
+  Entry entries_[kMaxEntries];
+  size_t count_ = 0;
+};
+
+ChunkBufferCache& thread_chunk_cache() {
+  static thread_local ChunkBufferCache cache;
+  return cache;
+}
+
+// Space always left free at the end of a chunk.
+const size_t kChunkSlack = 4096;
+
+}  // namespace
+
 Arena::Arena(size_t chunk_size)
-    : chunk_size_(chunk_size), head_chunk_(nullptr), active_chunk_(nullptr) {}
+    : chunk_size_(chunk_size),
+      head_chunk_(nullptr),
+      active_chunk_(nullptr),
+      chunk_allocation_count_(0),
+      chunk_free_count_(0),
+      alloc_count_(0),
+      peak_usage_(0),
+      reset_count_(0),
+      window_peak_chunks_(0) {}
 
 Arena::~Arena() {
   Reset();
   Chunk* chunk = head_chunk_;
   while (chunk) {
     Chunk* next = chunk->next;
-    delete chunk;
+    ReleaseChunk(chunk);
     chunk = next;
   }
   head_chunk_ = nullptr;
 }
 
 void Arena::Reset() {
+  size_t used_size = 0;
+  size_t used_chunks = 0;
+  for (Chunk* chunk = active_chunk_ ? head_chunk_ : nullptr; chunk;
+       chunk = chunk->next) {
+    used_size += chunk->offset;
+    ++used_chunks;
+    if (chunk == active_chunk_) {
+      break;
+    }
+  }
+  peak_usage_ = std::max(peak_usage_, used_size);
+  window_peak_chunks_ = std::max(window_peak_chunks_, used_chunks);
+  if (++reset_count_ % kTrimInterval == 0) {
+    Trim(std::max(window_peak_chunks_, size_t(1)));
+    window_peak_chunks_ = 0;
+  }
+
   active_chunk_ = head_chunk_;
   if (active_chunk_) {
     active_chunk_->offset = 0;
   }
 }
 
+void Arena::Trim(size_t keep_count) {
+  Chunk* chunk = head_chunk_;
+  for (size_t i = 1; chunk && i < keep_count; ++i) {
+    chunk = chunk->next;
+  }
+  if (!chunk) {
+    return;
+  }
+  Chunk* next = chunk->next;
+  chunk->next = nullptr;
+  while (next) {
+    Chunk* following = next->next;
+    ReleaseChunk(next);
+    ++chunk_free_count_;
+    next = following;
+  }
+}
+
 void Arena::DebugFill() {
   auto chunk = head_chunk_;
   while (chunk) {
@@ -45,24 +142,55 @@ void Arena::DebugFill() {
   }
 }
 
-void* Arena::Alloc(size_t size) {
-  if (active_chunk_) {
-    if (active_chunk_->capacity - active_chunk_->offset < size + 4096) {
-      Chunk* next = active_chunk_->next;
-      if (!next) {
-        assert_true(size < chunk_size_, "need to support larger chunks");
-        next = new Chunk(chunk_size_);
-        active_chunk_->next = next;
-      }
-      next->offset = 0;
-      active_chunk_ = next;
+Arena::Chunk* Arena::AcquireChunk(size_t capacity) {
+  uint8_t* buffer = thread_chunk_cache().Take(capacity);
+  if (!buffer) {
+    buffer = reinterpret_cast<uint8_t*>(malloc(capacity));
+    ++chunk_allocation_count_;
+  }
+  return new Chunk(buffer, capacity);
+}
+
+void Arena::ReleaseChunk(Chunk* chunk) {
+  if (!thread_chunk_cache().Put(chunk->buffer, chunk->capacity)) {
+    free(chunk->buffer);
+  }
+  delete chunk;
+}
+
+void* Arena::Alloc(size_t size, size_t alignment) {
+  assert_true(alignment && !(alignment & (alignment - 1)));
+  ++alloc_count_;
+  // Enough for the allocation at any alignment plus the slack.
+  size_t required = size + alignment + kChunkSlack;
+  if (!active_chunk_) {
+    head_chunk_ = active_chunk_ =
+        AcquireChunk(std::max(chunk_size_, required));
+  }
+
+  auto padding_for = [alignment](Chunk* chunk) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(chunk->buffer) + chunk->offset;
+    return size_t((alignment - (p & (alignment - 1))) & (alignment - 1));
+  };
+  size_t padding = padding_for(active_chunk_);
+  if (active_chunk_->capacity - active_chunk_->offset <
+      padding + size + kChunkSlack) {
+    Chunk* next = active_chunk_->next;
+    if (!next || next->capacity < required) {
+      // Oversized requests get their own chunk spliced in ahead of the
+      // retained ones.
+      Chunk* chunk = AcquireChunk(std::max(chunk_size_, required));
+      chunk->next = next;
+      active_chunk_->next = chunk;
+      next = chunk;
     }
-  } else {
-    head_chunk_ = active_chunk_ = new Chunk(chunk_size_);
+    next->offset = 0;
+    active_chunk_ = next;
+    padding = padding_for(active_chunk_);
   }
 
-  uint8_t* p = active_chunk_->buffer + active_chunk_->offset;
-  active_chunk_->offset += size;
+  uint8_t* p = active_chunk_->buffer + active_chunk_->offset + padding;
+  active_chunk_->offset += padding + size;
   return p;
 }
 
@@ -110,15 +238,7 @@ void Arena::CloneContents(void* buffer, size_t buffer_length) {
   }
 }
 
-Arena::Chunk::Chunk(size_t chunk_size)
-    : next(nullptr), capacity(chunk_size), buffer(0), offset(0) {
-  buffer = reinterpret_cast<uint8_t*>(malloc(capacity));
-}
-
-Arena::Chunk::~Chunk() {
-  if (buffer) {
-    free(buffer);
-  }
-}
+Arena::Chunk::Chunk(uint8_t* buffer, size_t capacity)
+    : next(nullptr), capacity(capacity), buffer(buffer), offset(0) {}
 
 }  // namespace xe
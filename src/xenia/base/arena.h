@@ -24,13 +24,29 @@ class Arena {
   void Reset();
   void DebugFill();
 
-  void* Alloc(size_t size);
+  // Raw allocations are aligned to kDefaultAlignment and typed ones to the
+  // natural alignment of the type (so vec128 members land on 16 bytes and
+  // runs of the same T stay contiguous for CloneContents).
+  // Requests larger than the chunk size get a dedicated chunk.
+  static const size_t kDefaultAlignment = 8;
+  void* Alloc(size_t size, size_t alignment = kDefaultAlignment);
   template <typename T>
   T* Alloc() {
-    return reinterpret_cast<T*>(Alloc(sizeof(T)));
+    return reinterpret_cast<T*>(Alloc(sizeof(T), alignof(T)));
   }
   void Rewind(size_t size);
 
+  // Number of chunks allocated from the heap over the arena lifetime. Chunks
+  // are kept across Reset() so this stops growing once the arena has seen
+  // its peak usage. Chunks recycled through the per-thread cache don't count.
+  size_t chunk_allocation_count() const { return chunk_allocation_count_; }
+  // Number of chunks released by trimming.
+  size_t chunk_free_count() const { return chunk_free_count_; }
+  // Number of Alloc calls over the arena lifetime.
+  size_t alloc_count() const { return alloc_count_; }
+  // Largest number of bytes in use at any Reset.
+  size_t peak_usage() const { return peak_usage_; }
+
   void* CloneContents();
   template <typename T>
   void CloneContents(std::vector<T>* buffer) {
@@ -41,8 +57,7 @@ class Arena {
  private:
   class Chunk {
    public:
-    explicit Chunk(size_t chunk_size);
-    ~Chunk();
+    Chunk(uint8_t* buffer, size_t capacity);
 
     Chunk* next;
 
@@ -51,12 +66,26 @@ class Arena {
     size_t offset;
   };
 
+  // Every kTrimInterval resets, chunks beyond the most used in that window
+  // are released so one huge function doesn't pin memory forever.
+  static const size_t kTrimInterval = 256;
+
+  Chunk* AcquireChunk(size_t capacity);
+  void ReleaseChunk(Chunk* chunk);
+  void Trim(size_t keep_count);
+
   size_t CalculateSize();
   void CloneContents(void* buffer, size_t buffer_length);
 
   size_t chunk_size_;
   Chunk* head_chunk_;
   Chunk* active_chunk_;
+  size_t chunk_allocation_count_;
+  size_t chunk_free_count_;
+  size_t alloc_count_;
+  size_t peak_usage_;
+  size_t reset_count_;
+  size_t window_peak_chunks_;
 };
 
 }  // namespace xe
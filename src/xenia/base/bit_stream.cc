@@ -25,44 +25,6 @@ void BitStream::SetOffset(size_t offset_bits) {
   offset_bits_ = std::min(offset_bits, size_bits_);
 }
 
-size_t BitStream::BitsRemaining() { return size_bits_ - offset_bits_; }
-
-uint64_t BitStream::Peek(size_t num_bits) {
-  // FYI: The reason we can't copy more than 57 bits is:
-  // 57 = 7 * 8 + 1 - that can only span a maximum of 8 bytes.
-  // We can't read in 9 bytes (easily), so we limit it.
-  assert_false(num_bits > 57);
-  assert_false(offset_bits_ + num_bits > size_bits_);
-
-  size_t offset_bytes = offset_bits_ >> 3;
-  size_t rel_offset_bits = offset_bits_ - (offset_bytes << 3);
-
-  // offset -->
-  // ..[junk]..| target bits |....[junk].............
-  uint64_t bits = *(uint64_t*)(buffer_ + offset_bytes);
-
-  // We need the data in little endian.
-  // TODO: Have a flag specifying endianness of data?
-  bits = xe::byte_swap(bits);
-
-  // Shift right
-  // .....[junk]........| target bits |
-  bits >>= 64 - (rel_offset_bits + num_bits);
-
-  // AND with mask
-  // ...................| target bits |
-  bits &= (1 << num_bits) - 1;
-
-  return bits;
-}
-
-uint64_t BitStream::Read(size_t num_bits) {
-  uint64_t val = Peek(num_bits);
-  Advance(num_bits);
-
-  return val;
-}
-
 // TODO: This is totally not tested!
 bool BitStream::Write(uint64_t val, size_t num_bits) {
   assert_false(num_bits > 57);
@@ -72,7 +34,7 @@ bool BitStream::Write(uint64_t val, size_t num_bits) {
   size_t rel_offset_bits = offset_bits_ - (offset_bytes << 3);
 
   // Construct a mask
-  uint64_t mask = (1 << num_bits) - 1;
+  uint64_t mask = (uint64_t(1) << num_bits) - 1;
   mask <<= 64 - (rel_offset_bits + num_bits);
   mask = ~mask;
 
@@ -112,7 +74,7 @@ size_t BitStream::Copy(uint8_t* dest_buffer, size_t num_bits) {
     dest_buffer[out_offset_bytes] |= (uint8_t)bits;
 
     bits_left -= 8 - rel_offset_bits;
-    Advance(8 - rel_offset_bits);
+    Skip(8 - rel_offset_bits);
     out_offset_bytes++;
   }
 
@@ -121,7 +83,7 @@ size_t BitStream::Copy(uint8_t* dest_buffer, size_t num_bits) {
     std::memcpy(dest_buffer + out_offset_bytes,
                 buffer_ + offset_bytes + out_offset_bytes, bits_left / 8);
     out_offset_bytes += (bits_left / 8);
-    Advance((bits_left / 8) * 8);
+    Skip((bits_left / 8) * 8);
     bits_left -= (bits_left / 8) * 8;
   }
 
@@ -131,13 +93,11 @@ size_t BitStream::Copy(uint8_t* dest_buffer, size_t num_bits) {
     bits <<= 8 - bits_left;
 
     dest_buffer[out_offset_bytes] |= (uint8_t)bits;
-    Advance(bits_left);
+    Skip(bits_left);
   }
 
   // Return the bit offset to the copied bits.
   return rel_offset_bits;
 }
 
-void BitStream::Advance(size_t num_bits) { SetOffset(offset_bits_ + num_bits); }
-
 }  // namespace xe
\ No newline at end of file
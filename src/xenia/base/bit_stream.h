@@ -11,6 +11,10 @@
 #define XENIA_BASE_BIT_STREAM_H_
 
 #include <cstdint>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
 
 namespace xe {
 class BitStream {
@@ -23,18 +27,62 @@ class BitStream {
   size_t offset_bits() const { return offset_bits_; }
   size_t size_bits() const { return size_bits_; }
 
-  void Advance(size_t num_bits);
+  // Moves forward, clamping to the end of the stream.
+  void Advance(size_t num_bits) { SetOffset(offset_bits_ + num_bits); }
+  // Moves forward over bits known to be in the stream (no clamping).
+  void Skip(size_t num_bits) {
+    assert_false(offset_bits_ + num_bits > size_bits_);
+    offset_bits_ += num_bits;
+  }
   void SetOffset(size_t offset_bits);
-  size_t BitsRemaining();
+  size_t BitsRemaining() const { return size_bits_ - offset_bits_; }
 
   // Note: num_bits MUST be in the range 0-57 (inclusive)
-  uint64_t Peek(size_t num_bits);
-  uint64_t Read(size_t num_bits);
+  uint64_t Peek(size_t num_bits) const {
+    // FYI: The reason we can't copy more than 57 bits is:
+    // 57 = 7 * 8 + 1 - that can only span a maximum of 8 bytes.
+    assert_false(num_bits > 57);
+    assert_false(offset_bits_ + num_bits > size_bits_);
+    if (!num_bits) {
+      return 0;
+    }
+
+    // offset -->
+    // ..[junk]..| target bits |....[junk].............
+    uint64_t bits = LoadWord(offset_bits_ >> 3);
+
+    // Shift right and mask
+    // ...................| target bits |
+    bits >>= 64 - ((offset_bits_ & 7) + num_bits);
+    return bits & ((uint64_t(1) << num_bits) - 1);
+  }
+  uint64_t Read(size_t num_bits) {
+    uint64_t val = Peek(num_bits);
+    Skip(num_bits);
+    return val;
+  }
   bool Write(uint64_t val, size_t num_bits);  // TODO: Not tested!
 
   size_t Copy(uint8_t* dest_buffer, size_t num_bits);
 
  private:
+  // Returns the 8 bytes at offset_bytes as a big endian word (first byte in
+  // the top bits). Bytes past the end of the buffer read as zero, so a read
+  // near the end never touches memory we don't own.
+  uint64_t LoadWord(size_t offset_bytes) const {
+    size_t size_bytes = (size_bits_ + 7) >> 3;
+    uint64_t word;
+    if (offset_bytes + 8 <= size_bytes) {
+      std::memcpy(&word, buffer_ + offset_bytes, sizeof(word));
+      return xe::byte_swap(word);
+    }
+    word = 0;
+    for (size_t i = offset_bytes, shift = 56; i < size_bytes; ++i, shift -= 8) {
+      word |= uint64_t(buffer_[i]) << shift;
+    }
+    return word;
+  }
+
   uint8_t* buffer_ = nullptr;
   size_t offset_bits_ = 0;
   size_t size_bits_ = 0;
@@ -10,9 +10,20 @@
 #include "xenia/base/clock.h"
 
 #include <algorithm>
+#include <atomic>
 #include <climits>
+#include <mutex>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/mutex.h"
+#include "xenia/base/platform.h"
+
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif  // XE_COMPILER_MSVC
 
 namespace xe {
 
@@ -24,27 +35,174 @@ uint64_t guest_tick_frequency_ = Clock::host_tick_frequency();
 uint64_t guest_system_time_base_ = Clock::QueryHostSystemTime();
 // Combined time and frequency scalar (computed by RecomputeGuestTickScalar).
 double guest_tick_scalar_ = 1.0;
-// Native guest ticks.
-thread_local uint64_t guest_tick_count_ = 0;
-// 100ns ticks, relative to guest_system_time_base_.
-thread_local uint64_t guest_time_filetime_ = 0;
-// Last sampled host tick count.
-thread_local uint64_t last_host_tick_count_ = Clock::QueryHostTickCount();
+
+// Current transform from host counter to guest ticks, published on first use
+// and by RecomputeGuestTickScalar. Transforms are taken round robin from a
+// fixed ring rather than allocated, as the scalar changes every time
+// fast-forward is toggled. A reader stalled long enough for the ring to wrap
+// sees the entry's sequence change and retries.
+const size_t kGuestTickTransformCount = 64;
+static Clock::GuestTickTransform
+    guest_tick_transforms_[kGuestTickTransformCount];
+static size_t next_guest_tick_transform_ = 0;
+static std::atomic<const Clock::GuestTickTransform*> guest_tick_transform_(
+    nullptr);
+static xe::mutex guest_tick_transform_mutex_;
+
+bool HasInvariantTsc() {
+#if XE_COMPILER_MSVC
+  int info[4];
+  __cpuid(info, 0x80000000);
+  if (uint32_t(info[0]) < 0x80000007) {
+    return false;
+  }
+  __cpuid(info, 0x80000007);
+  return (info[3] & (1 << 8)) != 0;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) &&
+         (edx & (1 << 8)) != 0;
+#endif  // XE_COMPILER_MSVC
+}
+
+// Measures the TSC against the host tick count over ~10ms.
+uint64_t CalibrateTscFrequency() {
+  uint64_t host_frequency = Clock::host_tick_frequency();
+  uint64_t host_start = Clock::QueryHostTickCount();
+  uint64_t tsc_start = __rdtsc();
+  uint64_t host_end;
+  do {
+    host_end = Clock::QueryHostTickCount();
+  } while (host_end - host_start < host_frequency / 100);
+  uint64_t tsc_end = __rdtsc();
+  return uint64_t(double(tsc_end - tsc_start) * host_frequency /
+                  double(host_end - host_start));
+}
+
+bool GuestTickCounterIsTsc() {
+  static const bool is_tsc = HasInvariantTsc();
+  return is_tsc;
+}
+
+uint64_t GuestTickCounterFrequency() {
+  static const uint64_t frequency = GuestTickCounterIsTsc()
+                                        ? CalibrateTscFrequency()
+                                        : Clock::host_tick_frequency();
+  return frequency;
+}
+
+// Reads the counter after all earlier loads, in particular that of the
+// transform it will be applied with.
+uint64_t QueryGuestTickCounter() {
+  if (!GuestTickCounterIsTsc()) {
+    return Clock::QueryHostTickCount();
+  }
+  _mm_lfence();
+  return __rdtsc();
+}
+
+uint64_t MulShift32(uint64_t a, uint64_t b) {
+#if XE_COMPILER_MSVC
+  uint64_t high;
+  uint64_t low = _umul128(a, b, &high);
+  return (high << 32) | (low >> 32);
+#else
+  return uint64_t((unsigned __int128)a * b >> 32);
+#endif  // XE_COMPILER_MSVC
+}
+
+// A consistent copy of a GuestTickTransform's fields.
+struct GuestTickTransformValues {
+  uint64_t counter_base;
+  uint64_t multiplier;
+  uint64_t tick_base;
+};
+
+// Reads the current transform, retrying while its entry is being rewritten.
+GuestTickTransformValues ReadGuestTickTransform() {
+  GuestTickTransformValues values;
+  while (true) {
+    auto transform = guest_tick_transform_.load(std::memory_order_acquire);
+    uint64_t sequence = transform->sequence.load(std::memory_order_acquire);
+    if (!(sequence & 1)) {
+      values.counter_base =
+          transform->counter_base.load(std::memory_order_relaxed);
+      values.multiplier = transform->multiplier.load(std::memory_order_relaxed);
+      values.tick_base = transform->tick_base.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (transform->sequence.load(std::memory_order_relaxed) == sequence) {
+        return values;
+      }
+    }
+    _mm_pause();
+  }
+}
+
+uint64_t ApplyGuestTickTransform(const GuestTickTransformValues& transform,
+                                 uint64_t counter) {
+  // The counter is read after the transform is loaded, but the TSCs of
+  // different cores may still be slightly apart.
+  uint64_t delta =
+      counter > transform.counter_base ? counter - transform.counter_base : 0;
+  return transform.tick_base + MulShift32(delta, transform.multiplier);
+}
+
+// Publishes a transform for the current frequency and scalar, continuing
+// from the current guest tick count. Caller holds the transform mutex, so
+// the previous transform can't change under us.
+void PublishGuestTickTransform() {
+  uint64_t counter = QueryGuestTickCounter();
+  auto previous = guest_tick_transform_.load(std::memory_order_acquire);
+  uint64_t tick_base = 0;
+  if (previous) {
+    GuestTickTransformValues previous_values;
+    previous_values.counter_base =
+        previous->counter_base.load(std::memory_order_relaxed);
+    previous_values.multiplier =
+        previous->multiplier.load(std::memory_order_relaxed);
+    previous_values.tick_base =
+        previous->tick_base.load(std::memory_order_relaxed);
+    tick_base = ApplyGuestTickTransform(previous_values, counter);
+  }
+  auto transform = &guest_tick_transforms_[next_guest_tick_transform_];
+  next_guest_tick_transform_ =
+      (next_guest_tick_transform_ + 1) % kGuestTickTransformCount;
+  uint64_t sequence = transform->sequence.load(std::memory_order_relaxed);
+  transform->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  transform->counter_base.store(counter, std::memory_order_relaxed);
+  transform->tick_base.store(tick_base, std::memory_order_relaxed);
+  transform->multiplier.store(
+      uint64_t(guest_tick_frequency_ * guest_time_scalar_ * 4294967296.0 /
+               double(GuestTickCounterFrequency())),
+      std::memory_order_relaxed);
+  transform->sequence.store(sequence + 2, std::memory_order_release);
+  guest_tick_transform_.store(transform, std::memory_order_release);
+}
+
+const Clock::GuestTickTransform* CurrentGuestTickTransform() {
+  auto transform = guest_tick_transform_.load(std::memory_order_acquire);
+  if (!transform) {
+    std::lock_guard<xe::mutex> lock(guest_tick_transform_mutex_);
+    if (!guest_tick_transform_.load(std::memory_order_acquire)) {
+      PublishGuestTickTransform();
+    }
+    transform = guest_tick_transform_.load(std::memory_order_acquire);
+  }
+  return transform;
+}
 
 void RecomputeGuestTickScalar() {
   guest_tick_scalar_ = (guest_tick_frequency_ * guest_time_scalar_) /
                        static_cast<double>(Clock::host_tick_frequency());
+  std::lock_guard<xe::mutex> lock(guest_tick_transform_mutex_);
+  PublishGuestTickTransform();
 }
 
-void UpdateGuestClock() {
-  uint64_t host_tick_count = Clock::QueryHostTickCount();
-  uint64_t host_tick_delta = host_tick_count > last_host_tick_count_
-                                 ? host_tick_count - last_host_tick_count_
-                                 : 0;
-  last_host_tick_count_ = host_tick_count;
-  uint64_t guest_tick_delta = uint64_t(host_tick_delta * guest_tick_scalar_);
-  guest_tick_count_ += guest_tick_delta;
-  guest_time_filetime_ += (guest_tick_delta * 10000000) / guest_tick_frequency_;
+// Converts guest ticks to 100ns FILETIME units without overflowing.
+uint64_t GuestTicksToFileTime(uint64_t ticks) {
+  return (ticks / guest_tick_frequency_) * 10000000 +
+         (ticks % guest_tick_frequency_) * 10000000 / guest_tick_frequency_;
 }
 
 double Clock::guest_time_scalar() { return guest_time_scalar_; }
@@ -68,29 +226,31 @@ void Clock::set_guest_system_time_base(uint64_t time_base) {
 }
 
 uint64_t Clock::QueryGuestTickCount() {
-  UpdateGuestClock();
-  return guest_tick_count_;
+  CurrentGuestTickTransform();
+  auto transform = ReadGuestTickTransform();
+  return ApplyGuestTickTransform(transform, QueryGuestTickCounter());
 }
 
 uint64_t Clock::QueryGuestSystemTime() {
-  UpdateGuestClock();
-  return guest_system_time_base_ + guest_time_filetime_;
+  return guest_system_time_base_ + GuestTicksToFileTime(QueryGuestTickCount());
 }
 
 uint32_t Clock::QueryGuestUptimeMillis() {
-  UpdateGuestClock();
-  uint64_t uptime_millis = guest_tick_count_ / (guest_tick_frequency_ / 1000);
+  uint64_t uptime_millis =
+      QueryGuestTickCount() / (guest_tick_frequency_ / 1000);
   uint32_t result = uint32_t(std::min(uptime_millis, uint64_t(UINT_MAX)));
   return result;
 }
 
+// The guest clock runs guest_time_scalar_ times as fast as the host's, so a
+// guest duration takes that many times less host time.
 uint32_t Clock::ScaleGuestDurationMillis(uint32_t guest_ms) {
   if (guest_ms == UINT_MAX) {
     return UINT_MAX;
   } else if (!guest_ms) {
     return 0;
   }
-  uint64_t scaled_ms = uint64_t(uint64_t(guest_ms) * guest_time_scalar_);
+  uint64_t scaled_ms = uint64_t(uint64_t(guest_ms) / guest_time_scalar_);
   return uint32_t(std::min(scaled_ms, uint64_t(UINT_MAX)));
 }
 
@@ -102,27 +262,26 @@ int64_t Clock::ScaleGuestDurationFileTime(int64_t guest_file_time) {
     uint64_t guest_time = Clock::QueryGuestSystemTime();
     int64_t relative_time = guest_file_time - static_cast<int64_t>(guest_time);
     int64_t scaled_time =
-        static_cast<int64_t>(relative_time * guest_time_scalar_);
+        static_cast<int64_t>(relative_time / guest_time_scalar_);
     return static_cast<int64_t>(guest_time) + scaled_time;
   } else {
-    // Relative time.
-    uint64_t scaled_file_time =
-        uint64_t(uint64_t(guest_file_time) * guest_time_scalar_);
-    // TODO(benvanik): check for overflow?
-    return scaled_file_time;
+    // Relative time, negative.
+    return static_cast<int64_t>(guest_file_time / guest_time_scalar_);
   }
 }
 
 void Clock::ScaleGuestDurationTimeval(int32_t* tv_sec, int32_t* tv_usec) {
-  uint64_t scaled_sec = uint64_t(uint64_t(*tv_sec) * guest_tick_scalar_);
-  uint64_t scaled_usec = uint64_t(uint64_t(*tv_usec) * guest_time_scalar_);
-  if (scaled_usec > UINT_MAX) {
-    uint64_t overflow_sec = scaled_usec / 1000000;
-    scaled_usec -= overflow_sec * 1000000;
-    scaled_sec += overflow_sec;
-  }
-  *tv_sec = int32_t(scaled_sec);
-  *tv_usec = int32_t(scaled_usec);
+  uint64_t usec = uint64_t(*tv_sec) * 1000000 + uint64_t(*tv_usec);
+  uint64_t scaled_usec = uint64_t(usec / guest_time_scalar_);
+  *tv_sec = int32_t(scaled_usec / 1000000);
+  *tv_usec = int32_t(scaled_usec % 1000000);
+}
+
+bool Clock::guest_tick_counter_is_tsc() { return GuestTickCounterIsTsc(); }
+
+const void* Clock::guest_tick_transform_address() {
+  CurrentGuestTickTransform();
+  return &guest_tick_transform_;
 }
 
 }  // namespace xe
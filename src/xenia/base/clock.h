@@ -10,6 +10,7 @@
 #ifndef XENIA_BASE_CLOCK_H_
 #define XENIA_BASE_CLOCK_H_
 
+#include <atomic>
 #include <cstdint>
 
 namespace xe {
@@ -40,19 +41,40 @@ class Clock {
   // By default this is the current system time.
   static void set_guest_system_time_base(uint64_t time_base);
   // Queries the current guest tick count, accounting for frequency adjustment
-  // and scaling.
+  // and scaling. Lock-free and monotonic across all threads.
   static uint64_t QueryGuestTickCount();
   // Queries the guest time, in FILETIME format, accounting for scaling.
   static uint64_t QueryGuestSystemTime();
   // Queries the milliseconds since the guest began, accounting for scaling.
   static uint32_t QueryGuestUptimeMillis();
 
+  // Converts a duration in guest time to the host time it takes to elapse,
+  // which is shorter when the guest clock is sped up.
   // Scales a time duration in milliseconds, from guest time.
   static uint32_t ScaleGuestDurationMillis(uint32_t guest_ms);
   // Scales a time duration in 100ns ticks like FILETIME, from guest time.
   static int64_t ScaleGuestDurationFileTime(int64_t guest_file_time);
   // Scales a time duration represented as a timeval, from guest time.
   static void ScaleGuestDurationTimeval(int32_t* tv_sec, int32_t* tv_usec);
+
+  // Maps a host counter to guest ticks:
+  //   ticks = tick_base + (((counter - counter_base) * multiplier) >> 32)
+  // A new transform is published whenever the frequency or time scalar
+  // change, rebased so that the guest tick count stays continuous. Published
+  // transforms are eventually reused, so readers check that sequence is even
+  // and unchanged across their reads of the fields and retry otherwise.
+  struct GuestTickTransform {
+    // Odd while the fields are being rewritten.
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> counter_base;
+    std::atomic<uint64_t> multiplier;
+    std::atomic<uint64_t> tick_base;
+  };
+  // Whether the host counter is an invariant TSC (read with rdtsc) rather
+  // than QueryHostTickCount.
+  static bool guest_tick_counter_is_tsc();
+  // Address of the current GuestTickTransform pointer, for generated code.
+  static const void* guest_tick_transform_address();
 };
 
 }  // namespace xe
@@ -31,6 +31,25 @@ bool IsFolder(const std::wstring& path);
 
 FILE* OpenFile(const std::wstring& path, const char* mode);
 bool DeleteFile(const std::wstring& path);
+// Renames source_path to target_path, replacing any existing target in a
+// single step: readers see either the old file or the complete new one.
+bool RenameFile(const std::wstring& source_path,
+                const std::wstring& target_path);
+
+// Exclusive lock on a file, held until the object is destroyed. Used to pick
+// a single writer among processes sharing files. The lock is released by the
+// OS if the process dies.
+class FileLock {
+ public:
+  // Creates the lock file if needed and tries to lock it without waiting.
+  // Returns nullptr if another process (or object) already holds it.
+  static std::unique_ptr<FileLock> TryAcquire(const std::wstring& path);
+
+  virtual ~FileLock() = default;
+
+ protected:
+  FileLock() = default;
+};
 
 struct FileAccess {
   // Implies kFileReadData.
@@ -56,6 +56,35 @@ bool DeleteFile(const std::wstring& path) {
   return DeleteFileW(path.c_str()) ? true : false;
 }
 
+bool RenameFile(const std::wstring& source_path,
+                const std::wstring& target_path) {
+  return MoveFileExW(source_path.c_str(), target_path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING)
+             ? true
+             : false;
+}
+
+class Win32FileLock : public FileLock {
+ public:
+  explicit Win32FileLock(HANDLE handle) : handle_(handle) {}
+  ~Win32FileLock() override { CloseHandle(handle_); }
+
+ private:
+  HANDLE handle_ = nullptr;
+};
+
+std::unique_ptr<FileLock> FileLock::TryAcquire(const std::wstring& path) {
+  // No sharing: anyone else opening the file fails until we close it.
+  HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+                              NULL, OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE,
+                              NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  return std::make_unique<Win32FileLock>(handle);
+}
+
 class Win32FileHandle : public FileHandle {
  public:
   Win32FileHandle(std::wstring path, HANDLE handle)
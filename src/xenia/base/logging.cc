@@ -11,9 +11,13 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cinttypes>
 #include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -32,18 +36,99 @@
 DEFINE_string(log_file, "",
               "Logs are written to the given file instead of the default.");
 DEFINE_bool(flush_log, true, "Flush log file after each log line batch.");
+DEFINE_int32(log_level, 3,
+             "Most verbose level logged: 0 errors, 1 warnings, 2 info, "
+             "3 debug.");
+DEFINE_string(log_categories, "",
+              "Per category --log_level overrides, e.g. gpu=0,kernel=2. "
+              "Categories are general, cpu, apu, gpu, kernel and fs.");
 
 namespace xe {
 
+uint8_t log_level_masks_[size_t(LogCategory::kCount)] = {
+    0xF, 0xF, 0xF, 0xF, 0xF, 0xF,
+};
+
 class Logger;
 
 Logger* logger_ = nullptr;
 thread_local std::vector<char> log_format_buffer_(64 * 1024);
 
+// Single-producer/single-consumer line buffer owned by one logging thread and
+// drained by the writer thread. Producers never block: a line that does not
+// fit is dropped and counted instead.
+class ThreadLogBuffer {
+ public:
+  struct LineHeader {
+    uint64_t sequence;
+    uint32_t thread_id;
+    char level_char;
+    // If set the line holds a binary record to be formatted on write.
+    LogRecordFormatter formatter;
+    size_t buffer_length;
+  };
+
+  static const size_t kCapacity = 512 * 1024;
+
+  ThreadLogBuffer() : ring_(buffer_, kCapacity), dropped_count_(0) {}
+
+  bool Write(const LineHeader& header, const char* buffer) {
+    size_t length = xe::round_up(sizeof(header) + header.buffer_length, 8);
+    auto region = ring_.BeginWrite(length);
+    if (region.length() != length) {
+      dropped_count_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    CopyIn(region, 0, &header, sizeof(header));
+    CopyIn(region, sizeof(header), buffer, header.buffer_length);
+    ring_.EndWrite(length);
+    return true;
+  }
+
+  // Reads the header of the next line without consuming it.
+  bool Peek(LineHeader* out_header) const {
+    return ring_.Peek(out_header, sizeof(*out_header));
+  }
+
+  // Consumes the line last returned by Peek, copying its payload out.
+  void Read(const LineHeader& header, void* buffer) {
+    ring_.Peek(buffer, header.buffer_length, sizeof(header));
+    ring_.EndRead(xe::round_up(sizeof(header) + header.buffer_length, 8));
+  }
+
+  bool empty() const { return ring_.empty(); }
+  uint64_t TakeDroppedCount() {
+    return dropped_count_.exchange(0, std::memory_order_relaxed);
+  }
+
+  // Set when the owning thread exits; the writer frees the buffer once it
+  // has been drained.
+  std::atomic<bool> retired{false};
+
+ private:
+  static void CopyIn(const SpscRingBuffer::Region& region, size_t offset,
+                     const void* data, size_t length) {
+    auto src = reinterpret_cast<const uint8_t*>(data);
+    if (offset < region.first_length) {
+      size_t first = std::min(length, region.first_length - offset);
+      std::memcpy(region.first + offset, src, first);
+      src += first;
+      length -= first;
+      offset = 0;
+    } else {
+      offset -= region.first_length;
+    }
+    std::memcpy(region.second + offset, src, length);
+  }
+
+  SpscRingBuffer ring_;
+  std::atomic<uint64_t> dropped_count_;
+  uint8_t buffer_[kCapacity];
+};
+
 class Logger {
  public:
-  Logger(const std::wstring& app_name)
-      : ring_buffer_(buffer_, kBufferSize), running_(true) {
+  Logger(const std::wstring& app_name) : next_sequence_(0), running_(true) {
     if (!FLAGS_log_file.empty()) {
       auto file_path = xe::to_wstring(FLAGS_log_file.c_str());
       xe::filesystem::CreateParentFolder(file_path);
@@ -68,89 +153,197 @@ class Logger {
   }
 
   void AppendLine(uint32_t thread_id, const char level_char, const char* buffer,
-                  size_t buffer_length) {
-    LogLine line;
-    line.thread_id = thread_id;
-    line.level_char = level_char;
-    line.buffer_length = buffer_length;
-    while (true) {
-      mutex_.lock();
-      if (ring_buffer_.write_count() < sizeof(line) + buffer_length) {
-        // Buffer is full. Stall.
-        mutex_.unlock();
-        xe::threading::MaybeYield();
-        continue;
-      }
-      ring_buffer_.Write(&line, sizeof(LogLine));
-      ring_buffer_.Write(buffer, buffer_length);
-      mutex_.unlock();
-      break;
+                  size_t buffer_length,
+                  LogRecordFormatter formatter = nullptr) {
+    ThreadLogBuffer::LineHeader header;
+    header.sequence = next_sequence_.fetch_add(1, std::memory_order_relaxed);
+    header.thread_id = thread_id;
+    header.level_char = level_char;
+    header.formatter = formatter;
+    header.buffer_length = std::min(buffer_length, kMaxLineLength);
+    if (GetThreadBuffer()->Write(header, buffer)) {
+      flush_event_->Set();
     }
-    flush_event_->Set();
   }
 
  private:
-  static const size_t kBufferSize = 32 * 1024 * 1024;
+  // Longest line (or binary record) kept; longer text is truncated.
+  static const size_t kMaxLineLength = 64 * 1024;
+  // Formatted lines are gathered up to this size before each fwrite.
+  static const size_t kWriteBatchSize = 256 * 1024;
 
-  struct LogLine {
-    uint32_t thread_id;
-    char level_char;
-    size_t buffer_length;
+  // Releases the thread's buffer to the writer when the thread exits.
+  struct ThreadBufferHolder {
+    std::shared_ptr<ThreadLogBuffer> buffer;
+    ~ThreadBufferHolder() {
+      if (buffer) {
+        buffer->retired = true;
+      }
+    }
   };
 
-  void WriteThread() {
-    while (running_) {
-      mutex_.lock();
-      bool did_write = false;
-      while (!ring_buffer_.empty()) {
+  ThreadLogBuffer* GetThreadBuffer() {
+    static thread_local ThreadBufferHolder holder;
+    if (!holder.buffer) {
+      holder.buffer = std::make_shared<ThreadLogBuffer>();
+      std::lock_guard<std::mutex> lock(buffers_mutex_);
+      buffers_.push_back(holder.buffer);
+    }
+    return holder.buffer.get();
+  }
+
+  void AppendOutput(uint32_t thread_id, char level_char, const char* buffer,
+                    size_t buffer_length) {
+    char prefix[16];
+    int prefix_length = std::snprintf(prefix, sizeof(prefix),
+                                      "%c> %08" PRIX32 " ", level_char,
+                                      thread_id);
+    output_.insert(output_.end(), prefix, prefix + prefix_length);
+    output_.insert(output_.end(), buffer, buffer + buffer_length);
+    if (!buffer_length || buffer[buffer_length - 1] != '\n') {
+      output_.push_back('\n');
+    }
+    if (output_.size() >= kWriteBatchSize) {
+      FlushOutput();
+    }
+  }
+
+  void FlushOutput() {
+    if (!output_.empty()) {
+      fwrite(output_.data(), 1, output_.size(), file_);
+      output_.clear();
+    }
+  }
+
+  // Writes out everything currently buffered, merging the per-thread buffers
+  // back into global sequence order. Returns true if anything was written.
+  bool Drain() {
+    std::vector<std::shared_ptr<ThreadLogBuffer>> buffers;
+    {
+      std::lock_guard<std::mutex> lock(buffers_mutex_);
+      buffers = buffers_;
+    }
+    bool did_write = false;
+    for (auto& buffer : buffers) {
+      uint64_t dropped_count = buffer->TakeDroppedCount();
+      if (dropped_count) {
+        char message[64];
+        int message_length = std::snprintf(
+            message, sizeof(message),
+            "%" PRIu64 " log lines dropped (log buffer full)", dropped_count);
+        AppendOutput(0, 'w', message, message_length);
         did_write = true;
-        LogLine line;
-        ring_buffer_.Read(&line, sizeof(line));
-        ring_buffer_.Read(log_format_buffer_.data(), line.buffer_length);
-        char prefix[] = {
-            line.level_char,
-            '>',
-            ' ',
-            '0',  // Thread ID gets placed here (8 chars).
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            ' ',
-            0,
-        };
-        std::snprintf(prefix + 3, sizeof(prefix) - 3, "%08" PRIX32 " ",
-                      line.thread_id);
-        fwrite(prefix, 1, sizeof(prefix) - 1, file_);
-        fwrite(log_format_buffer_.data(), 1, line.buffer_length, file_);
-        if (log_format_buffer_[line.buffer_length - 1] != '\n') {
-          const char suffix[1] = {'\n'};
-          fwrite(suffix, 1, sizeof(suffix), file_);
+      }
+    }
+    while (true) {
+      ThreadLogBuffer* next_buffer = nullptr;
+      ThreadLogBuffer::LineHeader next_header;
+      for (auto& buffer : buffers) {
+        ThreadLogBuffer::LineHeader header;
+        if (buffer->Peek(&header) &&
+            (!next_buffer || header.sequence < next_header.sequence)) {
+          next_buffer = buffer.get();
+          next_header = header;
         }
       }
-      mutex_.unlock();
-      if (did_write) {
-        if (FLAGS_flush_log) {
-          fflush(file_);
+      if (!next_buffer) {
+        break;
+      }
+      did_write = true;
+      size_t line_length = next_header.buffer_length;
+      if (next_header.formatter) {
+        if (record_buffer_.size() < line_length) {
+          record_buffer_.resize(line_length);
+        }
+        next_buffer->Read(next_header, record_buffer_.data());
+        line_length = next_header.formatter(
+            record_buffer_.data(), line_length, log_format_buffer_.data(),
+            log_format_buffer_.size());
+        if (!line_length) {
+          continue;
         }
+      } else {
+        next_buffer->Read(next_header, log_format_buffer_.data());
+      }
+      AppendOutput(next_header.thread_id, next_header.level_char,
+                   log_format_buffer_.data(), line_length);
+    }
+    FlushOutput();
+
+    // Free buffers of exited threads once nothing is left in them.
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    auto is_released = [](const std::shared_ptr<ThreadLogBuffer>& buffer) {
+      return buffer->retired && buffer->empty();
+    };
+    buffers_.erase(
+        std::remove_if(buffers_.begin(), buffers_.end(), is_released),
+        buffers_.end());
+    return did_write;
+  }
+
+  void WriteThread() {
+    while (true) {
+      bool did_write = Drain();
+      if (did_write && FLAGS_flush_log) {
+        fflush(file_);
+      }
+      if (!running_) {
+        break;
       }
       xe::threading::Wait(flush_event_.get(), true);
     }
   }
 
   FILE* file_ = nullptr;
-  uint8_t buffer_[kBufferSize];
-  RingBuffer ring_buffer_;
-  std::mutex mutex_;
+  std::atomic<uint64_t> next_sequence_;
+  std::mutex buffers_mutex_;
+  std::vector<std::shared_ptr<ThreadLogBuffer>> buffers_;
+  std::vector<char> output_;
+  std::vector<uint8_t> record_buffer_;
   std::atomic<bool> running_;
   std::unique_ptr<xe::threading::Event> flush_event_;
   std::unique_ptr<xe::threading::Thread> write_thread_;
 };
 
+uint8_t LogLevelMask(int32_t max_level) {
+  max_level = std::min(std::max(max_level, -1), int32_t(LogLevel::kDebug));
+  return uint8_t((1 << (max_level + 1)) - 1);
+}
+
+void InitializeLogMasks() {
+  static const char* kCategoryNames[] = {
+      "general", "cpu", "apu", "gpu", "kernel", "fs",
+  };
+  static_assert(sizeof(kCategoryNames) / sizeof(kCategoryNames[0]) ==
+                    size_t(LogCategory::kCount),
+                "one name per category");
+  for (auto& mask : log_level_masks_) {
+    mask = LogLevelMask(FLAGS_log_level);
+  }
+  size_t start = 0;
+  while (start < FLAGS_log_categories.size()) {
+    size_t end = FLAGS_log_categories.find(',', start);
+    if (end == std::string::npos) {
+      end = FLAGS_log_categories.size();
+    }
+    auto entry = FLAGS_log_categories.substr(start, end - start);
+    start = end + 1;
+    size_t equals = entry.find('=');
+    if (equals == std::string::npos) {
+      continue;
+    }
+    auto name = entry.substr(0, equals);
+    for (size_t i = 0; i < xe::countof(kCategoryNames); ++i) {
+      if (name == kCategoryNames[i]) {
+        log_level_masks_[i] =
+            LogLevelMask(std::atoi(entry.c_str() + equals + 1));
+      }
+    }
+  }
+}
+
 void InitializeLogging(const std::wstring& app_name) {
+  InitializeLogMasks();
   // We leak this intentionally - lots of cleanup code needs it.
   logger_ = new Logger(app_name);
 }
@@ -188,6 +381,13 @@ void LogLine(const char level_char, const std::string& str) {
                       str.c_str(), str.length());
 }
 
+void LogRecord(const char level_char, LogRecordFormatter formatter,
+               const void* record, size_t record_length) {
+  logger_->AppendLine(xe::threading::current_thread_id(), level_char,
+                      reinterpret_cast<const char*>(record), record_length,
+                      formatter);
+}
+
 void FatalError(const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
@@ -18,6 +18,46 @@
 namespace xe {
 
 #define XE_OPTION_ENABLE_LOGGING 1
+// Debug level lines are compiled out when 0 (premake --no-debug-logging).
+// Their arguments are still type checked but never evaluated.
+#ifndef XE_OPTION_LOG_DEBUG
+#define XE_OPTION_LOG_DEBUG 1
+#endif  // XE_OPTION_LOG_DEBUG
+
+enum class LogLevel {
+  kError,
+  kWarning,
+  kInfo,
+  kDebug,
+};
+
+enum class LogCategory {
+  kGeneral,
+  kCpu,
+  kApu,
+  kGpu,
+  kKernel,
+  kFs,
+  kCount,
+};
+
+// One bit per LogLevel for each LogCategory, set from --log_level and
+// --log_categories. Everything is logged until InitializeLogging.
+extern uint8_t log_level_masks_[size_t(LogCategory::kCount)];
+
+// Checked by the XELOG* macros before their arguments are evaluated.
+inline bool ShouldLog(LogCategory category, LogLevel level) {
+#if !XE_OPTION_ENABLE_LOGGING
+  return false;
+#else
+#if !XE_OPTION_LOG_DEBUG
+  if (level == LogLevel::kDebug) {
+    return false;
+  }
+#endif  // !XE_OPTION_LOG_DEBUG
+  return (log_level_masks_[size_t(category)] >> size_t(level)) & 1;
+#endif  // !XE_OPTION_ENABLE_LOGGING
+}
 
 // Initializes the logging system and any outputs requested.
 // Must be called on startup.
@@ -31,29 +71,40 @@ void LogLine(const char level_char, const char* str,
              size_t str_length = std::string::npos);
 void LogLine(const char level_char, const std::string& str);
 
+// Formats a binary record previously passed to LogRecord into |out| and
+// returns the number of chars written. Runs on the log writer thread.
+typedef size_t (*LogRecordFormatter)(const void* record, size_t record_length,
+                                     char* out, size_t out_capacity);
+
+// Appends a binary record to the log. The record is copied as-is and only
+// formatted (by |formatter|) when the writer thread flushes it, keeping
+// string formatting off of hot paths.
+void LogRecord(const char level_char, LogRecordFormatter formatter,
+               const void* record, size_t record_length);
+
 // Logs a fatal error with printf-style formatting and aborts the program.
 void FatalError(const char* fmt, ...);
 // Logs a fatal error and aborts the program.
 void FatalError(const std::string& str);
 
-#if XE_OPTION_ENABLE_LOGGING
-#define XELOGCORE(level, fmt, ...) xe::LogLineFormat(level, fmt, ##__VA_ARGS__)
-#else
-#define XELOGCORE(level, fmt, ...) \
-  do {                             \
+#define XELOGCORE(category, level, level_char, fmt, ...)                 \
+  do {                                                                   \
+    if (xe::ShouldLog(xe::LogCategory::category, xe::LogLevel::level)) { \
+      xe::LogLineFormat(level_char, fmt, ##__VA_ARGS__);                 \
+    }                                                                    \
   } while (false)
-#endif  // ENABLE_LOGGING
-
-#define XELOGE(fmt, ...) XELOGCORE('!', fmt, ##__VA_ARGS__)
-#define XELOGW(fmt, ...) XELOGCORE('w', fmt, ##__VA_ARGS__)
-#define XELOGI(fmt, ...) XELOGCORE('i', fmt, ##__VA_ARGS__)
-#define XELOGD(fmt, ...) XELOGCORE('d', fmt, ##__VA_ARGS__)
-
-#define XELOGCPU(fmt, ...) XELOGCORE('C', fmt, ##__VA_ARGS__)
-#define XELOGAPU(fmt, ...) XELOGCORE('A', fmt, ##__VA_ARGS__)
-#define XELOGGPU(fmt, ...) XELOGCORE('G', fmt, ##__VA_ARGS__)
-#define XELOGKERNEL(fmt, ...) XELOGCORE('K', fmt, ##__VA_ARGS__)
-#define XELOGFS(fmt, ...) XELOGCORE('F', fmt, ##__VA_ARGS__)
+
+#define XELOGE(fmt, ...) XELOGCORE(kGeneral, kError, '!', fmt, ##__VA_ARGS__)
+#define XELOGW(fmt, ...) XELOGCORE(kGeneral, kWarning, 'w', fmt, ##__VA_ARGS__)
+#define XELOGI(fmt, ...) XELOGCORE(kGeneral, kInfo, 'i', fmt, ##__VA_ARGS__)
+#define XELOGD(fmt, ...) XELOGCORE(kGeneral, kDebug, 'd', fmt, ##__VA_ARGS__)
+
+#define XELOGCPU(fmt, ...) XELOGCORE(kCpu, kDebug, 'C', fmt, ##__VA_ARGS__)
+#define XELOGAPU(fmt, ...) XELOGCORE(kApu, kDebug, 'A', fmt, ##__VA_ARGS__)
+#define XELOGGPU(fmt, ...) XELOGCORE(kGpu, kDebug, 'G', fmt, ##__VA_ARGS__)
+#define XELOGKERNEL(fmt, ...) \
+  XELOGCORE(kKernel, kDebug, 'K', fmt, ##__VA_ARGS__)
+#define XELOGFS(fmt, ...) XELOGCORE(kFs, kDebug, 'F', fmt, ##__VA_ARGS__)
 
 }  // namespace xe
 
@@ -10,6 +10,7 @@
 #ifndef XENIA_BASE_MAPPED_MEMORY_H_
 #define XENIA_BASE_MAPPED_MEMORY_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -22,9 +23,25 @@ class MappedMemory {
     kReadWrite,
   };
 
-  static std::unique_ptr<MappedMemory> Open(const std::wstring& path, Mode mode,
-                                            size_t offset = 0,
-                                            size_t length = 0);
+  // How a mapping is expected to be accessed. Passed on to the OS to tune
+  // readahead and paging; never changes behavior.
+  enum class AccessHint {
+    kNormal,
+    // Read front to back (modules, traces): aggressive readahead.
+    kSequential,
+    // Scattered reads (disc images, STFS packages): no speculative readahead,
+    // callers Prefetch what they need.
+    kRandom,
+    // Fault the whole mapping in up front. Only sensible for small files.
+    kPopulate,
+  };
+
+  // Maps length bytes of the file starting at offset, or everything past
+  // offset if length is 0. Offsets need not be page aligned and may be past
+  // 4GB; data() always points at the requested offset.
+  static std::unique_ptr<MappedMemory> Open(
+      const std::wstring& path, Mode mode, size_t offset = 0,
+      size_t length = 0, AccessHint hint = AccessHint::kNormal);
 
   MappedMemory(const std::wstring& path, Mode mode)
       : path_(path), mode_(mode), data_(nullptr), size_(0) {}
@@ -32,7 +49,11 @@ class MappedMemory {
       : path_(path), mode_(mode), data_(data), size_(size) {}
   virtual ~MappedMemory() = default;
 
+  // Returns a view onto part of this mapping without mapping anything new.
+  // The view must not outlive this mapping. The range is clamped.
   std::unique_ptr<MappedMemory> Slice(Mode mode, size_t offset, size_t length) {
+    offset = offset < size_ ? offset : size_;
+    length = length < size_ - offset ? length : size_ - offset;
     return std::make_unique<MappedMemory>(path_, mode, data() + offset, length);
   }
 
@@ -41,6 +62,15 @@ class MappedMemory {
 
   virtual void Flush() {}
 
+  // Hints to the OS that the given range of the mapping will be read soon so
+  // that it can be paged in ahead of time with large sequential I/O.
+  // Ranges outside of the mapping are clamped. May be a no-op.
+  void Prefetch(size_t offset, size_t length);
+
+  // Applies an access hint to a range of the mapping, clamped to its size.
+  // May be a no-op.
+  void Advise(AccessHint hint, size_t offset = 0, size_t length = SIZE_MAX);
+
  protected:
   std::wstring path_;
   Mode mode_;
@@ -9,8 +9,13 @@
 
 #include "xenia/base/mapped_memory.h"
 
+#include <fcntl.h>
 #include <sys/mman.h>
-#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
 
 #include "xenia/base/string.h"
 
@@ -19,57 +24,141 @@ namespace xe {
 class PosixMappedMemory : public MappedMemory {
  public:
   PosixMappedMemory(const std::wstring& path, Mode mode)
-      : MappedMemory(path, mode), file_handle(nullptr) {}
+      : MappedMemory(path, mode),
+        file_descriptor(-1),
+        mapping_base(nullptr),
+        mapping_length(0) {}
 
   ~PosixMappedMemory() override {
-    if (data_) {
-      munmap(data_, size_);
+    if (mapping_base) {
+      munmap(mapping_base, mapping_length);
+    }
+    if (file_descriptor != -1) {
+      close(file_descriptor);
     }
-    if (file_handle) {
-      fclose(file_handle);
+  }
+
+  void Flush() override {
+    if (mapping_base && mode_ == Mode::kReadWrite) {
+      msync(mapping_base, mapping_length, MS_SYNC);
     }
   }
 
-  FILE* file_handle;
+  int file_descriptor;
+  // The mapping itself starts on a page boundary at or before data_.
+  void* mapping_base;
+  size_t mapping_length;
 };
 
+namespace {
+
+size_t page_size() {
+  static size_t value = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return value;
+}
+
+// madvise requires a page aligned start address, so the range is widened to
+// cover the page the start falls in.
+void AdviseRange(uint8_t* data, size_t size, size_t offset, size_t length,
+                 int advice) {
+  if (offset >= size) {
+    return;
+  }
+  length = std::min(length, size - offset);
+  uintptr_t start = reinterpret_cast<uintptr_t>(data + offset);
+  uintptr_t aligned_start = start & ~(page_size() - 1);
+  madvise(reinterpret_cast<void*>(aligned_start),
+          length + (start - aligned_start), advice);
+}
+
+int ToAdvice(MappedMemory::AccessHint hint) {
+  switch (hint) {
+    case MappedMemory::AccessHint::kSequential:
+      return MADV_SEQUENTIAL;
+    case MappedMemory::AccessHint::kRandom:
+      return MADV_RANDOM;
+    case MappedMemory::AccessHint::kPopulate:
+      return MADV_WILLNEED;
+    case MappedMemory::AccessHint::kNormal:
+    default:
+      return MADV_NORMAL;
+  }
+}
+
+}  // namespace
+
+void MappedMemory::Prefetch(size_t offset, size_t length) {
+  AdviseRange(data(), size_, offset, length, MADV_WILLNEED);
+}
+
+void MappedMemory::Advise(AccessHint hint, size_t offset, size_t length) {
+  AdviseRange(data(), size_, offset, length, ToAdvice(hint));
+}
+
 std::unique_ptr<MappedMemory> MappedMemory::Open(const std::wstring& path,
                                                  Mode mode, size_t offset,
-                                                 size_t length) {
-  const char* mode_str;
+                                                 size_t length,
+                                                 AccessHint hint) {
+  int open_flags;
   int prot;
   switch (mode) {
     case Mode::kRead:
-      mode_str = "rb";
+      open_flags = O_RDONLY;
       prot = PROT_READ;
       break;
     case Mode::kReadWrite:
-      mode_str = "r+b";
+      open_flags = O_RDWR;
       prot = PROT_READ | PROT_WRITE;
       break;
   }
 
   auto mm = std::make_unique<PosixMappedMemory>(path, mode);
 
-  mm->file_handle = fopen(xe::to_string(path).c_str(), mode_str);
-  if (!mm->file_handle) {
+  mm->file_descriptor = open(xe::to_string(path).c_str(), open_flags);
+  if (mm->file_descriptor == -1) {
     return nullptr;
   }
 
-  size_t map_length;
-  map_length = length;
+  struct stat file_stat;
+  if (fstat(mm->file_descriptor, &file_stat) == -1) {
+    return nullptr;
+  }
+  // off_t is 64-bit on all the 64-bit hosts we support, so multi-GB images
+  // need no special handling here.
+  uint64_t file_size = static_cast<uint64_t>(file_stat.st_size);
+  if (offset > file_size) {
+    return nullptr;
+  }
   if (!length) {
-    fseeko(mm->file_handle, 0, SEEK_END);
-    map_length = ftello(mm->file_handle);
-    fseeko(mm->file_handle, 0, SEEK_SET);
+    length = static_cast<size_t>(file_size - offset);
   }
-  mm->size_ = map_length;
+  if (!length) {
+    // mmap rejects empty mappings.
+    return nullptr;
+  }
+
+  const size_t aligned_offset = offset & ~(page_size() - 1);
+  const size_t aligned_length = length + (offset - aligned_offset);
 
-  mm->data_ =
-      mmap(0, map_length, prot, MAP_SHARED, fileno(mm->file_handle), offset);
-  if (!mm->data_) {
+  int map_flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+  if (hint == AccessHint::kPopulate) {
+    map_flags |= MAP_POPULATE;
+  }
+#endif  // MAP_POPULATE
+  void* base = mmap(nullptr, aligned_length, prot, map_flags,
+                    mm->file_descriptor, static_cast<off_t>(aligned_offset));
+  if (base == MAP_FAILED) {
     return nullptr;
   }
+  mm->mapping_base = base;
+  mm->mapping_length = aligned_length;
+  mm->data_ = reinterpret_cast<uint8_t*>(base) + (offset - aligned_offset);
+  mm->size_ = length;
+
+  if (hint != AccessHint::kNormal) {
+    madvise(base, aligned_length, ToAdvice(hint));
+  }
 
   return std::move(mm);
 }
@@ -9,6 +9,7 @@
 
 #include "xenia/base/mapped_memory.h"
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -24,11 +25,12 @@ class Win32MappedMemory : public MappedMemory {
   Win32MappedMemory(const std::wstring& path, Mode mode)
       : MappedMemory(path, mode),
         file_handle(nullptr),
-        mapping_handle(nullptr) {}
+        mapping_handle(nullptr),
+        view_base(nullptr) {}
 
   ~Win32MappedMemory() override {
-    if (data_) {
-      UnmapViewOfFile(data_);
+    if (view_base) {
+      UnmapViewOfFile(view_base);
     }
     if (mapping_handle) {
       CloseHandle(mapping_handle);
@@ -42,11 +44,43 @@ class Win32MappedMemory : public MappedMemory {
 
   HANDLE file_handle;
   HANDLE mapping_handle;
+  // The view starts on an allocation granularity boundary at or before data_.
+  void* view_base;
 };
 
+void MappedMemory::Prefetch(size_t offset, size_t length) {
+  if (offset >= size_) {
+    return;
+  }
+  length = std::min(length, size_ - offset);
+
+  // PrefetchVirtualMemory is Windows 8+, so look it up dynamically.
+  typedef BOOL(WINAPI * PrefetchVirtualMemoryFn)(
+      HANDLE, ULONG_PTR, PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+  static PrefetchVirtualMemoryFn prefetch_virtual_memory =
+      reinterpret_cast<PrefetchVirtualMemoryFn>(GetProcAddress(
+          GetModuleHandle(L"kernel32.dll"), "PrefetchVirtualMemory"));
+  if (!prefetch_virtual_memory) {
+    return;
+  }
+  WIN32_MEMORY_RANGE_ENTRY range;
+  range.VirtualAddress = data() + offset;
+  range.NumberOfBytes = length;
+  prefetch_virtual_memory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedMemory::Advise(AccessHint hint, size_t offset, size_t length) {
+  // Readahead policy is set per file handle at open time; only population
+  // can be requested after the fact.
+  if (hint == AccessHint::kPopulate) {
+    Prefetch(offset, length);
+  }
+}
+
 std::unique_ptr<MappedMemory> MappedMemory::Open(const std::wstring& path,
                                                  Mode mode, size_t offset,
-                                                 size_t length) {
+                                                 size_t length,
+                                                 AccessHint hint) {
   DWORD file_access = 0;
   DWORD file_share = 0;
   DWORD create_mode = 0;
@@ -69,20 +103,42 @@ std::unique_ptr<MappedMemory> MappedMemory::Open(const std::wstring& path,
       break;
   }
 
+  DWORD file_flags = FILE_ATTRIBUTE_NORMAL;
+  switch (hint) {
+    case AccessHint::kSequential:
+      file_flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+      break;
+    case AccessHint::kRandom:
+      file_flags |= FILE_FLAG_RANDOM_ACCESS;
+      break;
+    default:
+      break;
+  }
+
   SYSTEM_INFO system_info;
   GetSystemInfo(&system_info);
 
-  const size_t aligned_offset =
-      offset & ~static_cast<size_t>(system_info.dwAllocationGranularity - 1);
-  const size_t aligned_length = length + (offset - aligned_offset);
-
   auto mm = std::make_unique<Win32MappedMemory>(path, mode);
 
   mm->file_handle = CreateFile(path.c_str(), file_access, file_share, nullptr,
-                               create_mode, FILE_ATTRIBUTE_NORMAL, nullptr);
-  if (!mm->file_handle) {
+                               create_mode, file_flags, nullptr);
+  if (mm->file_handle == INVALID_HANDLE_VALUE) {
+    mm->file_handle = nullptr;
+    return nullptr;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(mm->file_handle, &file_size) ||
+      offset > uint64_t(file_size.QuadPart)) {
     return nullptr;
   }
+  if (!length) {
+    length = size_t(file_size.QuadPart - offset);
+  }
+
+  const size_t aligned_offset =
+      offset & ~static_cast<size_t>(system_info.dwAllocationGranularity - 1);
+  const size_t aligned_length = length + (offset - aligned_offset);
 
   mm->mapping_handle = CreateFileMapping(mm->file_handle, nullptr,
                                          mapping_protect, 0, 0, nullptr);
@@ -90,20 +146,18 @@ std::unique_ptr<MappedMemory> MappedMemory::Open(const std::wstring& path,
     return nullptr;
   }
 
-  mm->data_ = reinterpret_cast<uint8_t*>(MapViewOfFile(
+  mm->view_base = MapViewOfFile(
       mm->mapping_handle, view_access, static_cast<DWORD>(aligned_offset >> 32),
-      static_cast<DWORD>(aligned_offset & 0xFFFFFFFF), aligned_length));
-  if (!mm->data_) {
+      static_cast<DWORD>(aligned_offset & 0xFFFFFFFF), aligned_length);
+  if (!mm->view_base) {
     return nullptr;
   }
+  mm->data_ =
+      reinterpret_cast<uint8_t*>(mm->view_base) + (offset - aligned_offset);
+  mm->size_ = length;
 
-  if (length) {
-    mm->size_ = aligned_length;
-  } else {
-    DWORD length_high;
-    size_t map_length = GetFileSize(mm->file_handle, &length_high);
-    map_length |= static_cast<uint64_t>(length_high) << 32;
-    mm->size_ = map_length - aligned_offset;
+  if (hint == AccessHint::kPopulate) {
+    mm->Prefetch(0, length);
   }
 
   return std::move(mm);
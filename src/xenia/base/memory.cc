@@ -10,13 +10,103 @@
 #include "xenia/base/memory.h"
 
 #include <algorithm>
+#include <cstring>
+
+#include "xenia/base/platform.h"
+
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif  // XE_COMPILER_MSVC
+
+#if XE_COMPILER_MSVC
+#define XE_MEMORY_AVX2_TARGET
+#else
+#define XE_MEMORY_AVX2_TARGET __attribute__((target("avx2")))
+#endif  // XE_COMPILER_MSVC
 
 namespace xe {
 
-// TODO(benvanik): fancy AVX versions.
-// http://gnuradio.org/redmine/projects/gnuradio/repository/revisions/cb32b70b79f430456208a2cd521d028e0ece5d5b/entry/volk/kernels/volk/volk_16u_byteswap.h
-// http://gnuradio.org/redmine/projects/gnuradio/repository/revisions/f2bc76cc65ffba51a141950f98e75364e49df874/entry/volk/kernels/volk/volk_32u_byteswap.h
-// http://gnuradio.org/redmine/projects/gnuradio/repository/revisions/2c4c371885c31222362f70a1cd714415d1398021/entry/volk/kernels/volk/volk_64u_byteswap.h
+// All swaps use pshufb to permute bytes within each 16b lane. SSSE3 is
+// implied by the AVX baseline we build for; hosts with AVX2 swap two 32b
+// registers per iteration instead, picked at runtime. Residual elements fall
+// back to scalar swaps.
+static const __m128i kSwap16Mask =
+    _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+static const __m128i kSwap32Mask =
+    _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+static const __m128i kSwap64Mask =
+    _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+static const __m128i kSwap16In32Mask =
+    _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+
+static bool has_avx2() {
+#if XE_COMPILER_MSVC
+  int info[4];
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2);
+#endif  // XE_COMPILER_MSVC
+}
+
+XE_MEMORY_AVX2_TARGET static size_t shuffle_bytes_avx2(uint8_t* dest,
+                                                       const uint8_t* src,
+                                                       size_t length,
+                                                       __m128i mask) {
+  __m256i mask_256 = _mm256_broadcastsi128_si256(mask);
+  size_t i = 0;
+  for (; i + 64 <= length; i += 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i),
+                        _mm256_shuffle_epi8(a, mask_256));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i + 32),
+                        _mm256_shuffle_epi8(b, mask_256));
+  }
+  if (i + 32 <= length) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i),
+                        _mm256_shuffle_epi8(a, mask_256));
+    i += 32;
+  }
+  if (i + 16 <= length) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+                     _mm_shuffle_epi8(a, mask));
+    i += 16;
+  }
+  return i;
+}
+
+// Shuffles length bytes (rounded down to 16b) and returns the bytes handled.
+static size_t shuffle_bytes(uint8_t* dest, const uint8_t* src, size_t length,
+                            __m128i mask) {
+  static const bool use_avx2 = has_avx2();
+  if (use_avx2) {
+    return shuffle_bytes_avx2(dest, src, length, mask);
+  }
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+                     _mm_shuffle_epi8(a, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i + 16),
+                     _mm_shuffle_epi8(b, mask));
+  }
+  if (i + 16 <= length) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+                     _mm_shuffle_epi8(a, mask));
+    i += 16;
+  }
+  return i;
+}
 
 void copy_and_swap_16_aligned(uint16_t* dest, const uint16_t* src,
                               size_t count) {
@@ -25,15 +115,10 @@ void copy_and_swap_16_aligned(uint16_t* dest, const uint16_t* src,
 
 void copy_and_swap_16_unaligned(uint16_t* dest, const uint16_t* src,
                                 size_t count) {
-  size_t i;
-  __m128i input, output;
-
-  for (i = 0; i + 8 <= count; i += 8) {
-    input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    output = _mm_or_si128(_mm_slli_epi16(input, 8), _mm_srli_epi16(input, 8));
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
-  }
-
+  size_t i = shuffle_bytes(reinterpret_cast<uint8_t*>(dest),
+                           reinterpret_cast<const uint8_t*>(src),
+                           count * sizeof(uint16_t), kSwap16Mask) /
+             sizeof(uint16_t);
   for (; i < count; ++i) {  // handle residual elements
     dest[i] = byte_swap(src[i]);
   }
@@ -46,30 +131,10 @@ void copy_and_swap_32_aligned(uint32_t* dest, const uint32_t* src,
 
 void copy_and_swap_32_unaligned(uint32_t* dest, const uint32_t* src,
                                 size_t count) {
-  size_t i;
-  __m128i input, byte1, byte2, byte3, byte4, output;
-  __m128i byte2mask = _mm_set1_epi32(0x00FF0000);
-  __m128i byte3mask = _mm_set1_epi32(0x0000FF00);
-
-  for (i = 0; i + 4 <= count; i += 4) {
-    input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-
-    // Do the four shifts
-    byte1 = _mm_slli_epi32(input, 24);
-    byte2 = _mm_slli_epi32(input, 8);
-    byte3 = _mm_srli_epi32(input, 8);
-    byte4 = _mm_srli_epi32(input, 24);
-
-    // Or bytes together
-    output = _mm_or_si128(byte1, byte4);
-    byte2 = _mm_and_si128(byte2, byte2mask);
-    output = _mm_or_si128(output, byte2);
-    byte3 = _mm_and_si128(byte3, byte3mask);
-    output = _mm_or_si128(output, byte3);
-
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
-  }
-
+  size_t i = shuffle_bytes(reinterpret_cast<uint8_t*>(dest),
+                           reinterpret_cast<const uint8_t*>(src),
+                           count * sizeof(uint32_t), kSwap32Mask) /
+             sizeof(uint32_t);
   for (; i < count; ++i) {  // handle residual elements
     dest[i] = byte_swap(src[i]);
   }
@@ -82,50 +147,254 @@ void copy_and_swap_64_aligned(uint64_t* dest, const uint64_t* src,
 
 void copy_and_swap_64_unaligned(uint64_t* dest, const uint64_t* src,
                                 size_t count) {
-  size_t i;
-  __m128i input, byte1, byte2, byte3, byte4, output;
-  __m128i byte2mask = _mm_set1_epi32(0x00FF0000);
-  __m128i byte3mask = _mm_set1_epi32(0x0000FF00);
+  size_t i = shuffle_bytes(reinterpret_cast<uint8_t*>(dest),
+                           reinterpret_cast<const uint8_t*>(src),
+                           count * sizeof(uint64_t), kSwap64Mask) /
+             sizeof(uint64_t);
+  for (; i < count; ++i) {  // handle residual elements
+    dest[i] = byte_swap(src[i]);
+  }
+}
 
-  for (i = 0; i + 2 <= count; i += 2) {
-    input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+void copy_and_swap_16_in_32_aligned(uint32_t* dest, const uint32_t* src,
+                                    size_t count) {
+  size_t i = shuffle_bytes(reinterpret_cast<uint8_t*>(dest),
+                           reinterpret_cast<const uint8_t*>(src),
+                           count * sizeof(uint32_t), kSwap16In32Mask) /
+             sizeof(uint32_t);
+  for (; i < count; ++i) {  // handle residual elements
+    dest[i] = (src[i] >> 16) | (src[i] << 16);
+  }
+}
 
-    // Do the four shifts
-    byte1 = _mm_slli_epi32(input, 24);
-    byte2 = _mm_slli_epi32(input, 8);
-    byte3 = _mm_srli_epi32(input, 8);
-    byte4 = _mm_srli_epi32(input, 24);
+// The unsigned min/max below are SSE4.1, also implied by the AVX baseline.
+static uint16_t horizontal_min_epu16(__m128i v) {
+  return uint16_t(_mm_cvtsi128_si32(_mm_minpos_epu16(v)));
+}
 
-    // Or bytes together
-    output = _mm_or_si128(byte1, byte4);
-    byte2 = _mm_and_si128(byte2, byte2mask);
-    output = _mm_or_si128(output, byte2);
-    byte3 = _mm_and_si128(byte3, byte3mask);
-    output = _mm_or_si128(output, byte3);
+static uint16_t horizontal_max_epu16(__m128i v) {
+  __m128i inverted = _mm_xor_si128(v, _mm_set1_epi32(-1));
+  return uint16_t(~_mm_cvtsi128_si32(_mm_minpos_epu16(inverted)));
+}
 
-    // Reorder the two words
-    output = _mm_shuffle_epi32(output, _MM_SHUFFLE(2, 3, 0, 1));
+static uint32_t horizontal_min_epu32(__m128i v) {
+  v = _mm_min_epu32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_min_epu32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return uint32_t(_mm_cvtsi128_si32(v));
+}
 
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+static uint32_t horizontal_max_epu32(__m128i v) {
+  v = _mm_max_epu32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_max_epu32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return uint32_t(_mm_cvtsi128_si32(v));
+}
+
+// Swap and min/max count elements rounded down to 32b, folding the result
+// into the 16b accumulators, and return the elements handled.
+XE_MEMORY_AVX2_TARGET static size_t swap_min_max_16_avx2(uint16_t* dest,
+                                                         const uint16_t* src,
+                                                         size_t count,
+                                                         __m128i* min,
+                                                         __m128i* max) {
+  __m256i mask = _mm256_broadcastsi128_si256(kSwap16Mask);
+  __m256i min_256 = _mm256_broadcastsi128_si256(*min);
+  __m256i max_256 = _mm256_broadcastsi128_si256(*max);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i v = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), mask);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), v);
+    min_256 = _mm256_min_epu16(min_256, v);
+    max_256 = _mm256_max_epu16(max_256, v);
   }
+  *min = _mm_min_epu16(_mm256_castsi256_si128(min_256),
+                       _mm256_extracti128_si256(min_256, 1));
+  *max = _mm_max_epu16(_mm256_castsi256_si128(max_256),
+                       _mm256_extracti128_si256(max_256, 1));
+  return i;
+}
 
+XE_MEMORY_AVX2_TARGET static size_t swap_min_max_32_avx2(uint32_t* dest,
+                                                         const uint32_t* src,
+                                                         size_t count,
+                                                         __m128i* min,
+                                                         __m128i* max) {
+  __m256i mask = _mm256_broadcastsi128_si256(kSwap32Mask);
+  __m256i min_256 = _mm256_broadcastsi128_si256(*min);
+  __m256i max_256 = _mm256_broadcastsi128_si256(*max);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), mask);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), v);
+    min_256 = _mm256_min_epu32(min_256, v);
+    max_256 = _mm256_max_epu32(max_256, v);
+  }
+  *min = _mm_min_epu32(_mm256_castsi256_si128(min_256),
+                       _mm256_extracti128_si256(min_256, 1));
+  *max = _mm_max_epu32(_mm256_castsi256_si128(max_256),
+                       _mm256_extracti128_si256(max_256, 1));
+  return i;
+}
+
+void copy_and_swap_16_min_max(uint16_t* dest, const uint16_t* src,
+                              size_t count, uint16_t* out_min,
+                              uint16_t* out_max) {
+  static const bool use_avx2 = has_avx2();
+  __m128i min = _mm_set1_epi32(-1);
+  __m128i max = _mm_setzero_si128();
+  size_t i = 0;
+  if (use_avx2) {
+    i = swap_min_max_16_avx2(dest, src, count, &min, &max);
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)),
+        kSwap16Mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), v);
+    min = _mm_min_epu16(min, v);
+    max = _mm_max_epu16(max, v);
+  }
+  uint16_t min_value = horizontal_min_epu16(min);
+  uint16_t max_value = horizontal_max_epu16(max);
   for (; i < count; ++i) {  // handle residual elements
     dest[i] = byte_swap(src[i]);
+    min_value = std::min(min_value, dest[i]);
+    max_value = std::max(max_value, dest[i]);
   }
+  *out_min = min_value;
+  *out_max = max_value;
 }
 
-void copy_and_swap_16_in_32_aligned(uint32_t* dest, const uint32_t* src,
-                                    size_t count) {
-  size_t i;
-  __m128i input, output;
-  for (i = 0; i + 4 <= count; i += 4) {
-    input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    output = _mm_or_si128(_mm_slli_epi32(input, 16), _mm_srli_epi32(input, 16));
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+void copy_and_swap_32_min_max(uint32_t* dest, const uint32_t* src,
+                              size_t count, uint32_t* out_min,
+                              uint32_t* out_max) {
+  static const bool use_avx2 = has_avx2();
+  __m128i min = _mm_set1_epi32(-1);
+  __m128i max = _mm_setzero_si128();
+  size_t i = 0;
+  if (use_avx2) {
+    i = swap_min_max_32_avx2(dest, src, count, &min, &max);
+  }
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)),
+        kSwap32Mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), v);
+    min = _mm_min_epu32(min, v);
+    max = _mm_max_epu32(max, v);
   }
+  uint32_t min_value = horizontal_min_epu32(min);
+  uint32_t max_value = horizontal_max_epu32(max);
   for (; i < count; ++i) {  // handle residual elements
-    dest[i] = (src[i] >> 16) | (src[i] << 16);
+    dest[i] = byte_swap(src[i]);
+    min_value = std::min(min_value, dest[i]);
+    max_value = std::max(max_value, dest[i]);
+  }
+  *out_min = min_value;
+  *out_max = max_value;
+}
+
+// Past this the destination is unlikely to be read again before it would be
+// evicted anyway.
+const size_t kNonTemporalThreshold = 1024 * 1024;
+
+// Streams value over length bytes of 32b aligned dest, rounded down to 32b,
+// and returns the bytes handled.
+static size_t stream_fill(uint8_t* dest, __m256i value, size_t length) {
+  size_t i = 0;
+  for (; i + 128 <= length; i += 128) {
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(dest + i), value);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(dest + i + 32), value);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(dest + i + 64), value);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(dest + i + 96), value);
+  }
+  for (; i + 32 <= length; i += 32) {
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(dest + i), value);
   }
+  // Streaming stores are weakly ordered.
+  _mm_sfence();
+  return i;
 }
 
+void fill_bulk(void* dest, uint8_t value, size_t length) {
+  auto p = reinterpret_cast<uint8_t*>(dest);
+  if (length < kNonTemporalThreshold) {
+    std::memset(p, value, length);
+    return;
+  }
+  size_t head = (32 - (reinterpret_cast<uintptr_t>(p) & 31)) & 31;
+  std::memset(p, value, head);
+  p += head;
+  length -= head;
+  size_t i = stream_fill(p, _mm256_set1_epi8(char(value)), length);
+  std::memset(p + i, value, length - i);
+}
+
+void fill_bulk_32(uint32_t* dest, uint32_t value, size_t count) {
+  // The vector pattern only lines up with 4b aligned destinations.
+  if (count * sizeof(uint32_t) < kNonTemporalThreshold ||
+      reinterpret_cast<uintptr_t>(dest) & 3) {
+    for (size_t i = 0; i < count; ++i) {
+      dest[i] = value;
+    }
+    return;
+  }
+  for (; reinterpret_cast<uintptr_t>(dest) & 31; ++dest, --count) {
+    *dest = value;
+  }
+  size_t i = stream_fill(reinterpret_cast<uint8_t*>(dest),
+                         _mm256_set1_epi32(int(value)),
+                         count * sizeof(uint32_t)) /
+             sizeof(uint32_t);
+  for (; i < count; ++i) {
+    dest[i] = value;
+  }
+}
+
+void copy_bulk(void* dest, const void* src, size_t length) {
+  auto pd = reinterpret_cast<uint8_t*>(dest);
+  auto ps = reinterpret_cast<const uint8_t*>(src);
+  if (length < kNonTemporalThreshold) {
+    std::memcpy(pd, ps, length);
+    return;
+  }
+  // Align the stores; loads may stay unaligned.
+  size_t head = (32 - (reinterpret_cast<uintptr_t>(pd) & 31)) & 31;
+  std::memcpy(pd, ps, head);
+  pd += head;
+  ps += head;
+  length -= head;
+  size_t i = 0;
+  for (; i + 128 <= length; i += 128) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ps + i));
+    __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ps + i + 32));
+    __m256i c =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ps + i + 64));
+    __m256i d =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ps + i + 96));
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(pd + i), a);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(pd + i + 32), b);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(pd + i + 64), c);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(pd + i + 96), d);
+  }
+  for (; i + 32 <= length; i += 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ps + i));
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(pd + i), a);
+  }
+  _mm_sfence();
+  std::memcpy(pd + i, ps + i, length - i);
+}
+
+namespace memory {
+
+static int numa_placement_ = kNumaNodeAny;
+
+int numa_placement() { return numa_placement_; }
+
+void set_numa_placement(int placement) { numa_placement_ = placement; }
+
+}  // namespace memory
+
 }  // namespace xe
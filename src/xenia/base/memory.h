@@ -60,6 +60,8 @@ bool DeallocFixed(void* base_address, size_t length,
 
 // Sets the access rights for the given block of memory and returns the previous
 // access rights. Both base_address and length will be adjusted to page_size().
+// POSIX hosts can't query the previous access rights, so there this fails
+// without changing anything if out_old_access is given.
 bool Protect(void* base_address, size_t length, PageAccess access,
              PageAccess* out_old_access);
 
@@ -97,6 +99,31 @@ void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
                   PageAccess access, size_t file_offset);
 bool UnmapFileView(FileMappingHandle handle, void* base_address, size_t length);
 
+// Returns the size of the large pages the host can back mappings with, in
+// bytes, or 0 if it has none. This is likely 2MiB.
+size_t large_page_size();
+
+// Asks the host to back the given mapped view with large pages. Pages are
+// split back into normal pages as needed when parts of the range are
+// protected, so page granular protection keeps working. Returns false if
+// large pages are unavailable for the view, in which case nothing changes.
+bool AdviseLargePages(void* base_address, size_t length);
+
+// NUMA placements besides a node number.
+const int kNumaNodeAny = -1;
+const int kNumaInterleave = -2;
+
+// Placement of long-lived memory such as guest memory and generated code,
+// chosen once at startup: a node number, kNumaNodeAny or kNumaInterleave.
+int numa_placement();
+void set_numa_placement(int placement);
+
+// Asks the host to place the not yet resident pages of the given mapped range
+// on a NUMA node, or to interleave them across all nodes. Returns false if
+// that isn't possible, in which case pages come from the node of the thread
+// that first touches them.
+bool AdviseNumaPlacement(void* base_address, size_t length, int placement);
+
 inline size_t hash_combine(size_t seed) { return seed; }
 
 template <typename T, typename... Ts>
@@ -128,6 +155,23 @@ void copy_and_swap_64_unaligned(uint64_t* dest, const uint64_t* src,
                                 size_t count);
 void copy_and_swap_16_in_32_aligned(uint32_t* dest, const uint32_t* src,
                                     size_t count);
+// copy_and_swap_*_unaligned that also return the smallest and largest
+// swapped value, for index buffers. A count of 0 returns the maximum value
+// as the minimum and 0 as the maximum.
+void copy_and_swap_16_min_max(uint16_t* dest, const uint16_t* src,
+                              size_t count, uint16_t* out_min,
+                              uint16_t* out_max);
+void copy_and_swap_32_min_max(uint32_t* dest, const uint32_t* src,
+                              size_t count, uint32_t* out_min,
+                              uint32_t* out_max);
+
+// Bulk fills and copies of guest sized buffers. Below a megabyte these are
+// plain memset/memcpy; above it they use 32b non-temporal stores so that
+// large clears and copies don't evict everything else from the caches.
+// copy_bulk ranges must not overlap.
+void fill_bulk(void* dest, uint8_t value, size_t length);
+void fill_bulk_32(uint32_t* dest, uint32_t value, size_t count);
+void copy_bulk(void* dest, const void* src, size_t length);
 
 template <typename T>
 void copy_and_swap(T* dest, const T* src, size_t count) {
@@ -0,0 +1,264 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/memory.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace memory {
+
+size_t page_size() {
+  static size_t value = 0;
+  if (!value) {
+    value = size_t(sysconf(_SC_PAGESIZE));
+  }
+  return value;
+}
+
+size_t allocation_granularity() { return page_size(); }
+
+// mmap doesn't remember how large a mapping was, but releases pass a length of
+// zero to free the whole region, so reservations are tracked by base address.
+static std::mutex reservations_mutex_;
+static std::map<uintptr_t, size_t> reservations_;
+
+// Returns the length of the reservation starting at base_address, or 0 if
+// there isn't one.
+static size_t LookupReservation(void* base_address, bool remove) {
+  std::lock_guard<std::mutex> lock(reservations_mutex_);
+  auto it = reservations_.find(uintptr_t(base_address));
+  if (it == reservations_.end()) {
+    return 0;
+  }
+  size_t length = it->second;
+  if (remove) {
+    reservations_.erase(it);
+  }
+  return length;
+}
+
+int ToPosixProtectFlags(PageAccess access) {
+  switch (access) {
+    case PageAccess::kNoAccess:
+      return PROT_NONE;
+    case PageAccess::kReadOnly:
+      return PROT_READ;
+    case PageAccess::kReadWrite:
+      return PROT_READ | PROT_WRITE;
+    case PageAccess::kExecuteReadWrite:
+      return PROT_READ | PROT_WRITE | PROT_EXEC;
+    default:
+      assert_unhandled_case(access);
+      return PROT_NONE;
+  }
+}
+
+void* AllocFixed(void* base_address, size_t length,
+                 AllocationType allocation_type, PageAccess access) {
+  if (allocation_type == AllocationType::kCommit) {
+    // Committing pages of an existing mapping just makes them accessible;
+    // the host backs them on first touch.
+    if (mprotect(base_address, length, ToPosixProtectFlags(access))) {
+      return nullptr;
+    }
+    return base_address;
+  }
+  int prot = allocation_type == AllocationType::kReserve
+                 ? PROT_NONE
+                 : ToPosixProtectFlags(access);
+  void* result = mmap(base_address, length, prot,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (result == MAP_FAILED) {
+    return nullptr;
+  }
+  if (base_address && result != base_address) {
+    // Something else lives there already.
+    munmap(result, length);
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(reservations_mutex_);
+  reservations_[uintptr_t(result)] = length;
+  return result;
+}
+
+bool DeallocFixed(void* base_address, size_t length,
+                  DeallocationType deallocation_type) {
+  switch (deallocation_type) {
+    case DeallocationType::kRelease:
+    case DeallocationType::kDecommitRelease: {
+      // Only whole reservations can be released, as with VirtualFree. This
+      // also keeps pages of mapped views from being unmapped.
+      size_t reserved_length = LookupReservation(base_address, true);
+      if (!reserved_length) {
+        return false;
+      }
+      return munmap(base_address, reserved_length) == 0;
+    }
+    case DeallocationType::kDecommit:
+      if (!length) {
+        length = LookupReservation(base_address, false);
+        if (!length) {
+          return false;
+        }
+      }
+      return madvise(base_address, length, MADV_DONTNEED) == 0 &&
+             mprotect(base_address, length, PROT_NONE) == 0;
+    default:
+      assert_unhandled_case(deallocation_type);
+      return false;
+  }
+}
+
+bool Protect(void* base_address, size_t length, PageAccess access,
+             PageAccess* out_old_access) {
+  if (out_old_access) {
+    // mprotect doesn't report the previous protection, and guessing it would
+    // have callers restore the wrong one.
+    return false;
+  }
+  size_t page_mask = page_size() - 1;
+  uintptr_t start = uintptr_t(base_address) & ~page_mask;
+  uintptr_t end = (uintptr_t(base_address) + length + page_mask) & ~page_mask;
+  return mprotect(reinterpret_cast<void*>(start), end - start,
+                  ToPosixProtectFlags(access)) == 0;
+}
+
+FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
+                                          PageAccess access, bool commit) {
+  // Shared memory pages are always allocated on first touch, so commit has
+  // no effect. The name is unlinked right away so that nothing outlives the
+  // process.
+  static std::atomic<int> mapping_count(0);
+  char name[64];
+  std::snprintf(name, sizeof(name), "/xenia_%d_%d", int(getpid()),
+                mapping_count++);
+  int oflag = access == PageAccess::kReadOnly ? O_RDONLY : O_RDWR;
+  int fd = shm_open(name, oflag | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    return nullptr;
+  }
+  shm_unlink(name);
+  if (ftruncate(fd, length)) {
+    close(fd);
+    return nullptr;
+  }
+  return reinterpret_cast<FileMappingHandle>(intptr_t(fd));
+}
+
+void CloseFileMappingHandle(FileMappingHandle handle) {
+  close(static_cast<int>(reinterpret_cast<intptr_t>(handle)));
+}
+
+void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
+                  PageAccess access, size_t file_offset) {
+  int fd = static_cast<int>(reinterpret_cast<intptr_t>(handle));
+  void* result = mmap(base_address, length, ToPosixProtectFlags(access),
+                      MAP_SHARED, fd, file_offset);
+  if (result == MAP_FAILED) {
+    return nullptr;
+  }
+  if (base_address && result != base_address) {
+    // Not mapping over whatever is there, matching MapViewOfFileEx.
+    munmap(result, length);
+    return nullptr;
+  }
+  return result;
+}
+
+bool UnmapFileView(FileMappingHandle handle, void* base_address,
+                   size_t length) {
+  return munmap(base_address, length) == 0;
+}
+
+// Returns the selected mode of a transparent huge page setting, such as
+// "always" out of "always [advise] never".
+static std::string ReadHugePageMode(const char* path) {
+  std::ifstream file(path);
+  std::string mode;
+  while (file >> mode) {
+    if (mode.size() > 2 && mode.front() == '[' && mode.back() == ']') {
+      return mode.substr(1, mode.size() - 2);
+    }
+  }
+  return "";
+}
+
+size_t large_page_size() {
+  static size_t value = SIZE_MAX;
+  if (value == SIZE_MAX) {
+    value = 0;
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+    file >> value;
+  }
+  return value;
+}
+
+bool AdviseLargePages(void* base_address, size_t length) {
+#ifdef MADV_HUGEPAGE
+  // Views are of shared memory, which only gets huge pages when shmem is
+  // allowed to use them and not just anonymous memory.
+  auto mode =
+      ReadHugePageMode("/sys/kernel/mm/transparent_hugepage/shmem_enabled");
+  if (!large_page_size() || mode.empty() || mode == "never" ||
+      mode == "deny") {
+    return false;
+  }
+  return madvise(base_address, length, MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif  // MADV_HUGEPAGE
+}
+
+bool AdviseNumaPlacement(void* base_address, size_t length, int placement) {
+#ifdef SYS_mbind
+  // From numaif.h, which only comes with libnuma.
+  const int kMpolPreferred = 1;
+  const int kMpolInterleave = 3;
+  auto& node_masks = xe::threading::numa_node_masks();
+  unsigned long node_mask = 0;  // NOLINT(runtime/int)
+  int mode;
+  if (placement == kNumaInterleave) {
+    mode = kMpolInterleave;
+    for (size_t i = 0; i < node_masks.size() && i < 64; ++i) {
+      if (node_masks[i]) {
+        node_mask |= 1ul << i;
+      }
+    }
+  } else if (placement >= 0 && size_t(placement) < node_masks.size() &&
+             placement < 64) {
+    mode = kMpolPreferred;
+    node_mask = 1ul << placement;
+  } else {
+    return false;
+  }
+  if (!node_mask) {
+    return false;
+  }
+  return syscall(SYS_mbind, base_address, length, mode, &node_mask,
+                 sizeof(node_mask) * 8, 0) == 0;
+#else
+  return false;
+#endif  // SYS_mbind
+}
+
+}  // namespace memory
+}  // namespace xe
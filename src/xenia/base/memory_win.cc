@@ -163,5 +163,21 @@ bool UnmapFileView(FileMappingHandle handle, void* base_address,
   return UnmapViewOfFile(base_address) ? true : false;
 }
 
+size_t large_page_size() { return GetLargePageMinimum(); }
+
+bool AdviseLargePages(void* base_address, size_t length) {
+  // Views of pagefile backed sections only get large pages if the section is
+  // created with SEC_LARGE_PAGES, which commits and locks the whole section
+  // up front and cannot be protected at page granularity.
+  return false;
+}
+
+bool AdviseNumaPlacement(void* base_address, size_t length, int placement) {
+  // Committed pages can't be moved or interleaved after the fact. They come
+  // from the node of the thread that first touches them, which is the chosen
+  // node once the process affinity is restricted to it.
+  return false;
+}
+
 }  // namespace memory
 }  // namespace xe
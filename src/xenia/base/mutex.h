@@ -10,6 +10,8 @@
 #ifndef XENIA_BASE_MUTEX_H_
 #define XENIA_BASE_MUTEX_H_
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 
 namespace xe {
@@ -21,6 +23,32 @@ namespace xe {
 using mutex = std::mutex;
 using recursive_mutex = std::recursive_mutex;
 
+// Wraps a mutex to count how many times lock() found it held by another
+// thread, for finding contended locks. Uncontended locks cost one try_lock.
+template <typename T>
+class contention_counting {
+ public:
+  void lock() {
+    if (!mutex_.try_lock()) {
+      contention_count_.fetch_add(1, std::memory_order_relaxed);
+      mutex_.lock();
+    }
+  }
+  bool try_lock() { return mutex_.try_lock(); }
+  void unlock() { mutex_.unlock(); }
+
+  uint64_t contention_count() const {
+    return contention_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  T mutex_;
+  std::atomic<uint64_t> contention_count_ = {0};
+};
+
+using counted_mutex = contention_counting<mutex>;
+using counted_recursive_mutex = contention_counting<recursive_mutex>;
+
 }  // namespace xe
 
 #endif  // XENIA_BASE_MUTEX_H_
@@ -0,0 +1,21 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/perf_counters.h"
+
+#include "xenia/base/platform.h"
+
+namespace xe {
+
+#if !XE_PLATFORM_LINUX
+// Only Linux exposes the PMU to user mode (through perf_event_open).
+std::unique_ptr<PerfCounters> PerfCounters::Create() { return nullptr; }
+#endif  // !XE_PLATFORM_LINUX
+
+}  // namespace xe
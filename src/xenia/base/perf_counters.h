@@ -0,0 +1,55 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_PERF_COUNTERS_H_
+#define XENIA_BASE_PERF_COUNTERS_H_
+
+#include <cstdint>
+#include <memory>
+
+namespace xe {
+
+// Hardware performance counters of a single host thread, read from the PMU.
+// Only available where user mode can program the PMU (perf_event on Linux).
+class PerfCounters {
+ public:
+  struct Values {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t cache_misses = 0;
+    uint64_t branch_misses = 0;
+
+    Values operator-(const Values& other) const {
+      Values result;
+      result.cycles = cycles - other.cycles;
+      result.instructions = instructions - other.instructions;
+      result.cache_misses = cache_misses - other.cache_misses;
+      result.branch_misses = branch_misses - other.branch_misses;
+      return result;
+    }
+    double ipc() const {
+      return cycles ? double(instructions) / double(cycles) : 0.0;
+    }
+  };
+
+  virtual ~PerfCounters() = default;
+
+  // Starts counting user mode events of the calling thread.
+  // Returns nullptr if counters are not available on this host.
+  static std::unique_ptr<PerfCounters> Create();
+
+  // Reads the counts accumulated since creation, scaled up if the kernel had
+  // to multiplex the counters. May be called from any thread. Counters that
+  // the host does not support read as zero.
+  virtual bool Read(Values* out_values) = 0;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_PERF_COUNTERS_H_
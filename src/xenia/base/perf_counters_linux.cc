@@ -0,0 +1,106 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/perf_counters.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "xenia/base/math.h"
+
+namespace xe {
+
+class LinuxPerfCounters : public PerfCounters {
+ public:
+  ~LinuxPerfCounters() override {
+    // Members first; the group leader must be closed last.
+    for (size_t i = event_count_; i > 0; --i) {
+      close(events_[i - 1].fd);
+    }
+  }
+
+  bool Initialize() {
+    static const struct {
+      uint32_t type;
+      uint64_t config;
+      uint64_t Values::*value;
+    } kEvents[] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, &Values::cycles},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+         &Values::instructions},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+         &Values::cache_misses},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+         &Values::branch_misses},
+    };
+    for (size_t i = 0; i < xe::countof(kEvents); ++i) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = kEvents[i].type;
+      attr.config = kEvents[i].config;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int group_fd = event_count_ ? events_[0].fd : -1;
+      // pid 0, cpu -1: the calling thread on whatever core it runs on.
+      int fd = static_cast<int>(
+          syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+      if (fd < 0) {
+        if (!event_count_) {
+          // No cycle counter (perf_event_paranoid, VM without a vPMU, ...).
+          return false;
+        }
+        continue;
+      }
+      events_[event_count_++] = {fd, kEvents[i].value};
+    }
+    return true;
+  }
+
+  bool Read(Values* out_values) override {
+    // nr, time_enabled, time_running, values[nr]
+    uint64_t data[3 + kMaxEventCount];
+    ssize_t length = read(events_[0].fd, data, sizeof(data));
+    if (length < ssize_t(3 * sizeof(uint64_t)) || data[0] != event_count_) {
+      return false;
+    }
+    *out_values = Values();
+    double scale =
+        data[2] && data[2] < data[1] ? double(data[1]) / double(data[2]) : 1.0;
+    for (size_t i = 0; i < event_count_; ++i) {
+      out_values->*events_[i].value = uint64_t(data[3 + i] * scale);
+    }
+    return true;
+  }
+
+ private:
+  static const size_t kMaxEventCount = 4;
+
+  struct Event {
+    int fd;
+    uint64_t Values::*value;
+  };
+  Event events_[kMaxEventCount];
+  size_t event_count_ = 0;
+};
+
+std::unique_ptr<PerfCounters> PerfCounters::Create() {
+  auto counters = std::make_unique<LinuxPerfCounters>();
+  if (!counters->Initialize()) {
+    return nullptr;
+  }
+  return std::move(counters);
+}
+
+}  // namespace xe
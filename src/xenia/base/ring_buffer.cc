@@ -57,4 +57,76 @@ size_t RingBuffer::Write(const uint8_t* buffer, size_t count) {
   return count;
 }
 
+SpscRingBuffer::SpscRingBuffer(uint8_t* buffer, size_t capacity)
+    : buffer_(buffer),
+      capacity_(capacity),
+      read_offset_(0),
+      write_offset_(0),
+      cached_read_offset_(0) {
+  assert_true(capacity && !(capacity & (capacity - 1)));
+}
+
+SpscRingBuffer::Region SpscRingBuffer::MakeRegion(size_t offset,
+                                                  size_t count) const {
+  offset &= capacity_ - 1;
+  Region region;
+  region.first = buffer_ + offset;
+  region.first_length = std::min(count, capacity_ - offset);
+  region.second = buffer_;
+  region.second_length = count - region.first_length;
+  return region;
+}
+
+SpscRingBuffer::Region SpscRingBuffer::BeginRead(size_t count,
+                                                 size_t skip) const {
+  size_t read_offset = read_offset_.load(std::memory_order_relaxed);
+  size_t available =
+      write_offset_.load(std::memory_order_acquire) - read_offset;
+  if (skip >= available) {
+    return MakeRegion(read_offset, 0);
+  }
+  return MakeRegion(read_offset + skip, std::min(count, available - skip));
+}
+
+bool SpscRingBuffer::Peek(void* buffer, size_t count, size_t skip) const {
+  auto region = BeginRead(count, skip);
+  if (region.length() != count) {
+    return false;
+  }
+  std::memcpy(buffer, region.first, region.first_length);
+  std::memcpy(reinterpret_cast<uint8_t*>(buffer) + region.first_length,
+              region.second, region.second_length);
+  return true;
+}
+
+bool SpscRingBuffer::Read(void* buffer, size_t count) {
+  if (!Peek(buffer, count)) {
+    return false;
+  }
+  EndRead(count);
+  return true;
+}
+
+SpscRingBuffer::Region SpscRingBuffer::BeginWrite(size_t count) {
+  size_t write_offset = write_offset_.load(std::memory_order_relaxed);
+  if (capacity_ - (write_offset - cached_read_offset_) < count &&
+      write_count() < count) {
+    return MakeRegion(write_offset, 0);
+  }
+  return MakeRegion(write_offset, count);
+}
+
+bool SpscRingBuffer::Write(const void* buffer, size_t count) {
+  auto region = BeginWrite(count);
+  if (region.length() != count) {
+    return false;
+  }
+  std::memcpy(region.first, buffer, region.first_length);
+  std::memcpy(region.second,
+              reinterpret_cast<const uint8_t*>(buffer) + region.first_length,
+              region.second_length);
+  EndWrite(count);
+  return true;
+}
+
 }  // namespace xe
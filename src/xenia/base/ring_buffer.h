@@ -10,10 +10,13 @@
 #ifndef XENIA_BASE_RING_BUFFER_H_
 #define XENIA_BASE_RING_BUFFER_H_
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 #include <vector>
 
+#include "xenia/base/assert.h"
+
 namespace xe {
 
 class RingBuffer {
@@ -67,6 +70,89 @@ class RingBuffer {
   size_t write_offset_ = 0;
 };
 
+// Wait-free single-producer/single-consumer byte ring.
+// One thread may write and one (other) thread may read concurrently without
+// locks: offsets are published with release and observed with acquire, and
+// each side's offset lives on its own cache line so the two don't bounce.
+// Offsets only ever grow and are wrapped when indexing, so full and empty are
+// never ambiguous. The capacity must be a power of two.
+//
+// Besides copying Read/Write there is a zero-copy API: Begin* returns the
+// (possibly wrapped) region of the ring to fill or consume in place and End*
+// publishes it.
+class SpscRingBuffer {
+ public:
+  // A span of the ring that may wrap around its end.
+  struct Region {
+    uint8_t* first;
+    size_t first_length;
+    uint8_t* second;
+    size_t second_length;
+    size_t length() const { return first_length + second_length; }
+  };
+
+  SpscRingBuffer(uint8_t* buffer, size_t capacity);
+
+  uint8_t* buffer() const { return buffer_; }
+  size_t capacity() const { return capacity_; }
+
+  // Safe from either side; the answer may be stale by the time it's used.
+  bool empty() const {
+    return read_offset_.load(std::memory_order_acquire) ==
+           write_offset_.load(std::memory_order_acquire);
+  }
+
+  // Consumer side.
+  size_t read_count() const {
+    return write_offset_.load(std::memory_order_acquire) -
+           read_offset_.load(std::memory_order_relaxed);
+  }
+  // Returns up to count readable bytes (fewer if not yet written) starting at
+  // byte skip of the readable data.
+  Region BeginRead(size_t count, size_t skip = 0) const;
+  void EndRead(size_t count) {
+    assert_true(count <= read_count());
+    read_offset_.store(read_offset_.load(std::memory_order_relaxed) + count,
+                       std::memory_order_release);
+  }
+  // Copies out and consumes exactly count bytes, or nothing.
+  bool Read(void* buffer, size_t count);
+  // Copies out count bytes from byte skip onward without consuming, or
+  // nothing.
+  bool Peek(void* buffer, size_t count, size_t skip = 0) const;
+
+  // Producer side.
+  size_t write_count() {
+    size_t write_offset = write_offset_.load(std::memory_order_relaxed);
+    cached_read_offset_ = read_offset_.load(std::memory_order_acquire);
+    return capacity_ - (write_offset - cached_read_offset_);
+  }
+  // Returns exactly count writable bytes, or an empty region if they aren't
+  // available yet.
+  Region BeginWrite(size_t count);
+  void EndWrite(size_t count) {
+    write_offset_.store(write_offset_.load(std::memory_order_relaxed) + count,
+                        std::memory_order_release);
+  }
+  // Copies in and publishes exactly count bytes, or nothing.
+  bool Write(const void* buffer, size_t count);
+
+ private:
+  static const size_t kCacheLineSize = 64;
+
+  Region MakeRegion(size_t offset, size_t count) const;
+
+  uint8_t* buffer_;
+  size_t capacity_;
+  // Written by the consumer.
+  alignas(kCacheLineSize) std::atomic<size_t> read_offset_;
+  // Written by the producer, along with its cached copy of read_offset_ that
+  // saves touching the consumer's line until the ring looks full. The
+  // alignment also pads the end of the object out to a full line.
+  alignas(kCacheLineSize) std::atomic<size_t> write_offset_;
+  size_t cached_read_offset_;
+};
+
 }  // namespace xe
 
 #endif  // XENIA_BASE_RING_BUFFER_H_
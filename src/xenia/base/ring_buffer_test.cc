@@ -0,0 +1,96 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/base/ring_buffer.h"
+
+namespace {
+
+const size_t kTestCapacity = 64;
+const uint32_t kThreadedValueCount = 100000;
+
+}  // namespace
+
+TEST_CASE("spsc_ring_buffer_layout", "SPSC Ring Buffer") {
+  // The producer and consumer offsets must not share a cache line.
+  REQUIRE(alignof(xe::SpscRingBuffer) >= 64);
+  REQUIRE(sizeof(xe::SpscRingBuffer) % 64 == 0);
+}
+
+TEST_CASE("spsc_ring_buffer_read_write", "SPSC Ring Buffer") {
+  std::vector<uint8_t> storage(kTestCapacity);
+  xe::SpscRingBuffer ring(storage.data(), storage.size());
+  REQUIRE(ring.empty());
+  REQUIRE(ring.write_count() == kTestCapacity);
+
+  uint8_t data[kTestCapacity];
+  for (size_t i = 0; i < kTestCapacity; ++i) {
+    data[i] = uint8_t(i);
+  }
+  REQUIRE(ring.Write(data, 40));
+  REQUIRE(ring.read_count() == 40);
+  // All or nothing.
+  REQUIRE_FALSE(ring.Write(data, 40));
+  REQUIRE(ring.read_count() == 40);
+
+  uint8_t out[kTestCapacity] = {0};
+  REQUIRE(ring.Peek(out, 4, 2));
+  REQUIRE(out[0] == 2);
+  REQUIRE(out[3] == 5);
+  REQUIRE(ring.read_count() == 40);
+
+  REQUIRE(ring.Read(out, 40));
+  for (size_t i = 0; i < 40; ++i) {
+    REQUIRE(out[i] == uint8_t(i));
+  }
+  REQUIRE(ring.empty());
+  REQUIRE_FALSE(ring.Read(out, 1));
+
+  // Wraps around the end of the buffer.
+  REQUIRE(ring.Write(data, 48));
+  auto region = ring.BeginRead(48);
+  REQUIRE(region.first_length == kTestCapacity - 40);
+  REQUIRE(region.second_length == 48 - (kTestCapacity - 40));
+  REQUIRE(ring.Read(out, 48));
+  for (size_t i = 0; i < 48; ++i) {
+    REQUIRE(out[i] == uint8_t(i));
+  }
+}
+
+TEST_CASE("spsc_ring_buffer_threaded", "SPSC Ring Buffer") {
+  std::vector<uint8_t> storage(kTestCapacity);
+  xe::SpscRingBuffer ring(storage.data(), storage.size());
+
+  std::thread producer([&ring]() {
+    for (uint32_t value = 0; value < kThreadedValueCount;) {
+      if (ring.Write(&value, sizeof(value))) {
+        ++value;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  bool in_order = true;
+  for (uint32_t expected = 0; expected < kThreadedValueCount;) {
+    uint32_t value;
+    if (ring.Read(&value, sizeof(value))) {
+      in_order = in_order && value == expected;
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  REQUIRE(in_order);
+  REQUIRE(ring.empty());
+}
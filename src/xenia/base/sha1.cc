@@ -0,0 +1,245 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/sha1.h"
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/memory.h"
+#include "xenia/base/platform.h"
+
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif  // XE_COMPILER_MSVC
+
+#if XE_COMPILER_MSVC
+#define XE_SHA1_SHA_TARGET
+#else
+#define XE_SHA1_SHA_TARGET __attribute__((target("sha,sse4.1")))
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+
+namespace {
+
+uint32_t rotl(uint32_t value, int shift) {
+  return (value << shift) | (value >> (32 - shift));
+}
+
+}  // namespace
+
+Sha1::Sha1() {
+  digest_[0] = 0x67452301;
+  digest_[1] = 0xEFCDAB89;
+  digest_[2] = 0x98BADCFE;
+  digest_[3] = 0x10325476;
+  digest_[4] = 0xC3D2E1F0;
+}
+
+Sha1::Sha1(const uint32_t digest[5], uint64_t byte_count,
+           const uint8_t* partial_block)
+    : byte_count_(byte_count) {
+  std::memcpy(digest_, digest, sizeof(digest_));
+  std::memcpy(block_, partial_block, partial_block_length());
+}
+
+void Sha1::Update(const void* data, size_t length) {
+  auto src = reinterpret_cast<const uint8_t*>(data);
+  size_t block_length = partial_block_length();
+  byte_count_ += length;
+  if (block_length) {
+    size_t fill = std::min(length, 64 - block_length);
+    std::memcpy(block_ + block_length, src, fill);
+    src += fill;
+    length -= fill;
+    if (block_length + fill < 64) {
+      return;
+    }
+    ProcessBlocks(digest_, block_, 1);
+  }
+  // Whole blocks straight from the input.
+  ProcessBlocks(digest_, src, length / 64);
+  std::memcpy(block_, src + (length & ~size_t(63)), length % 64);
+}
+
+void Sha1::Finalize(uint32_t out_digest[5]) {
+  uint64_t bit_count = byte_count_ * 8;
+  size_t block_length = partial_block_length();
+  block_[block_length++] = 0x80;
+  if (block_length > 56) {
+    std::memset(block_ + block_length, 0, 64 - block_length);
+    ProcessBlocks(digest_, block_, 1);
+    block_length = 0;
+  }
+  std::memset(block_ + block_length, 0, 56 - block_length);
+  xe::store_and_swap<uint64_t>(block_ + 56, bit_count);
+  ProcessBlocks(digest_, block_, 1);
+  std::memcpy(out_digest, digest_, sizeof(digest_));
+}
+
+void Sha1::ProcessBlocks(uint32_t digest[5], const uint8_t* data,
+                         size_t block_count) {
+  static const bool use_sha_extensions = has_sha_extensions();
+  if (use_sha_extensions) {
+    ProcessBlocksShaExtensions(digest, data, block_count);
+  } else {
+    ProcessBlocksGeneric(digest, data, block_count);
+  }
+}
+
+void Sha1::ProcessBlocksGeneric(uint32_t digest[5], const uint8_t* data,
+                                size_t block_count) {
+  for (; block_count; --block_count, data += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = xe::load_and_swap<uint32_t>(data + i * 4);
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = digest[0];
+    uint32_t b = digest[1];
+    uint32_t c = digest[2];
+    uint32_t d = digest[3];
+    uint32_t e = digest[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f;
+      uint32_t k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotl(b, 30);
+      b = a;
+      a = temp;
+    }
+    digest[0] += a;
+    digest[1] += b;
+    digest[2] += c;
+    digest[3] += d;
+    digest[4] += e;
+  }
+}
+
+bool Sha1::has_sha_extensions() {
+#if XE_COMPILER_MSVC
+  int info[4];
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 29)) != 0;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+         (ebx & (1 << 29));
+#endif  // XE_COMPILER_MSVC
+}
+
+XE_SHA1_SHA_TARGET void Sha1::ProcessBlocksShaExtensions(uint32_t digest[5],
+                                                         const uint8_t* data,
+                                                         size_t block_count) {
+  // Words are big endian; sha1rnds4 wants them in reverse order in a lane.
+  const __m128i byte_mask =
+      _mm_set_epi64x(0x0001020304050607ull, 0x08090A0B0C0D0E0Full);
+  __m128i abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(digest)), 0x1B);
+  __m128i e0 = _mm_set_epi32(digest[4], 0, 0, 0);
+  __m128i e1;
+  __m128i msg[4];
+
+  // Four rounds, consuming msg[n % 4] and expanding the schedule for the
+  // rounds 16 ahead.
+#define XE_SHA1_ROUNDS(n, e_in, e_out, f)                                  \
+  e_in = _mm_sha1nexte_epu32(e_in, msg[(n) % 4]);                          \
+  e_out = abcd;                                                            \
+  msg[((n) + 1) % 4] = _mm_sha1msg2_epu32(msg[((n) + 1) % 4], msg[(n) % 4]); \
+  abcd = _mm_sha1rnds4_epu32(abcd, e_in, f);                               \
+  msg[((n) + 3) % 4] = _mm_sha1msg1_epu32(msg[((n) + 3) % 4], msg[(n) % 4]); \
+  msg[((n) + 2) % 4] = _mm_xor_si128(msg[((n) + 2) % 4], msg[(n) % 4])
+
+  for (; block_count; --block_count, data += 64) {
+    __m128i abcd_save = abcd;
+    __m128i e_save = e0;
+    for (int i = 0; i < 4; ++i) {
+      msg[i] = _mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16)),
+          byte_mask);
+    }
+
+    // Rounds 0-15 only start the schedule.
+    e0 = _mm_add_epi32(e0, msg[0]);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    e1 = _mm_sha1nexte_epu32(e1, msg[1]);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    msg[0] = _mm_sha1msg1_epu32(msg[0], msg[1]);
+    e0 = _mm_sha1nexte_epu32(e0, msg[2]);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    msg[1] = _mm_sha1msg1_epu32(msg[1], msg[2]);
+    msg[0] = _mm_xor_si128(msg[0], msg[2]);
+    XE_SHA1_ROUNDS(3, e1, e0, 0);
+
+    // Rounds 16-67.
+    XE_SHA1_ROUNDS(4, e0, e1, 0);
+    XE_SHA1_ROUNDS(5, e1, e0, 1);
+    XE_SHA1_ROUNDS(6, e0, e1, 1);
+    XE_SHA1_ROUNDS(7, e1, e0, 1);
+    XE_SHA1_ROUNDS(8, e0, e1, 1);
+    XE_SHA1_ROUNDS(9, e1, e0, 1);
+    XE_SHA1_ROUNDS(10, e0, e1, 2);
+    XE_SHA1_ROUNDS(11, e1, e0, 2);
+    XE_SHA1_ROUNDS(12, e0, e1, 2);
+    XE_SHA1_ROUNDS(13, e1, e0, 2);
+    XE_SHA1_ROUNDS(14, e0, e1, 2);
+    XE_SHA1_ROUNDS(15, e1, e0, 3);
+    XE_SHA1_ROUNDS(16, e0, e1, 3);
+
+    // Rounds 68-79 wind the schedule down.
+    e1 = _mm_sha1nexte_epu32(e1, msg[1]);
+    e0 = abcd;
+    msg[2] = _mm_sha1msg2_epu32(msg[2], msg[1]);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    msg[3] = _mm_xor_si128(msg[3], msg[1]);
+    e0 = _mm_sha1nexte_epu32(e0, msg[2]);
+    e1 = abcd;
+    msg[3] = _mm_sha1msg2_epu32(msg[3], msg[2]);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+    e1 = _mm_sha1nexte_epu32(e1, msg[3]);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+    e0 = _mm_sha1nexte_epu32(e0, e_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+#undef XE_SHA1_ROUNDS
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(digest),
+                   _mm_shuffle_epi32(abcd, 0x1B));
+  digest[4] = uint32_t(_mm_extract_epi32(e0, 3));
+}
+
+}  // namespace xe
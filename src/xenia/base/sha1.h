@@ -0,0 +1,56 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_SHA1_H_
+#define XENIA_BASE_SHA1_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xe {
+
+// SHA-1, compressing with the x86 SHA extensions when the host has them.
+class Sha1 {
+ public:
+  Sha1();
+  // Resumes a hash from its chaining value, the number of bytes hashed so
+  // far and the (byte_count % 64) bytes of the partial block.
+  Sha1(const uint32_t digest[5], uint64_t byte_count,
+       const uint8_t* partial_block);
+
+  void Update(const void* data, size_t length);
+  // Pads and returns the final digest. The hash can't be updated afterwards.
+  void Finalize(uint32_t out_digest[5]);
+
+  const uint32_t* digest() const { return digest_; }
+  uint64_t byte_count() const { return byte_count_; }
+  const uint8_t* partial_block() const { return block_; }
+  size_t partial_block_length() const { return size_t(byte_count_ % 64); }
+
+  // Compresses block_count 64-byte blocks into digest with the best
+  // implementation for the host.
+  static void ProcessBlocks(uint32_t digest[5], const uint8_t* data,
+                            size_t block_count);
+  // The implementations ProcessBlocks picks from, exposed for tests.
+  static void ProcessBlocksGeneric(uint32_t digest[5], const uint8_t* data,
+                                   size_t block_count);
+  static bool has_sha_extensions();
+  static void ProcessBlocksShaExtensions(uint32_t digest[5],
+                                         const uint8_t* data,
+                                         size_t block_count);
+
+ private:
+  uint32_t digest_[5];
+  uint64_t byte_count_ = 0;
+  uint8_t block_[64];
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_SHA1_H_
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/base/sha1.h"
+
+namespace {
+
+std::string ToHex(const uint32_t digest[5]) {
+  char hex[41];
+  for (int i = 0; i < 5; ++i) {
+    std::snprintf(hex + i * 8, 9, "%08x", digest[i]);
+  }
+  return hex;
+}
+
+std::string Hash(const std::string& data) {
+  xe::Sha1 sha;
+  sha.Update(data.data(), data.size());
+  uint32_t digest[5];
+  sha.Finalize(digest);
+  return ToHex(digest);
+}
+
+}  // namespace
+
+TEST_CASE("sha1_vectors", "SHA-1") {
+  REQUIRE(Hash("") == "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+  REQUIRE(Hash("abc") == "a9993e364706816aba3e25717850c26c9cd0d89d");
+  REQUIRE(Hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+          "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+  REQUIRE(Hash(std::string(1000000, 'a')) ==
+          "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+}
+
+TEST_CASE("sha1_split_updates", "SHA-1") {
+  std::string data(1000, 0);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = char(i * 7 + 3);
+  }
+  std::string expected = Hash(data);
+  for (size_t split : {size_t(1), size_t(55), size_t(64), size_t(129)}) {
+    xe::Sha1 sha;
+    sha.Update(data.data(), split);
+    // Resuming from saved state must be the same as continuing.
+    xe::Sha1 resumed(sha.digest(), sha.byte_count(), sha.partial_block());
+    resumed.Update(data.data() + split, data.size() - split);
+    uint32_t digest[5];
+    resumed.Finalize(digest);
+    REQUIRE(ToHex(digest) == expected);
+  }
+}
+
+TEST_CASE("sha1_sha_extensions", "SHA-1") {
+  if (!xe::Sha1::has_sha_extensions()) {
+    return;
+  }
+  std::vector<uint8_t> data(64 * 17);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = uint8_t(i * 13 + 5);
+  }
+  for (size_t block_count = 1; block_count <= 17; block_count += 4) {
+    uint32_t generic[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                           0xC3D2E1F0};
+    uint32_t sha_ni[5];
+    std::memcpy(sha_ni, generic, sizeof(generic));
+    xe::Sha1::ProcessBlocksGeneric(generic, data.data(), block_count);
+    xe::Sha1::ProcessBlocksShaExtensions(sha_ni, data.data(), block_count);
+    REQUIRE(std::memcmp(generic, sha_ni, sizeof(generic)) == 0);
+  }
+}
+
+// Hidden from the default run. Use `xenia-base-tests [benchmark]`.
+TEST_CASE("BENCHMARK_SHA1", "[.benchmark]") {
+  // About the size of a XEX header block hashed at load.
+  const size_t kLength = 64 * 1024;
+  const size_t kIterationCount = 4096;
+  std::vector<uint8_t> data(kLength, 0x5A);
+  auto benchmark = [&](const char* name,
+                       void (*fn)(uint32_t*, const uint8_t*, size_t)) {
+    uint32_t digest[5] = {0};
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < kIterationCount; ++i) {
+      fn(digest, data.data(), kLength / 64);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start;
+    std::printf("%-40s %8.1f MB/s\n", name,
+                kIterationCount * kLength / elapsed.count() / (1024 * 1024));
+  };
+  benchmark("sha1 (generic)", xe::Sha1::ProcessBlocksGeneric);
+  if (xe::Sha1::has_sha_extensions()) {
+    benchmark("sha1 (SHA extensions)", xe::Sha1::ProcessBlocksShaExtensions);
+  }
+}
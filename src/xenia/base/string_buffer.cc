@@ -17,16 +17,27 @@
 namespace xe {
 
 StringBuffer::StringBuffer(size_t initial_capacity) {
-  buffer_capacity_ = std::max(initial_capacity, static_cast<size_t>(16 * 1024));
-  buffer_ = reinterpret_cast<char*>(malloc(buffer_capacity_));
+  if (initial_capacity > kInlineCapacity) {
+    buffer_capacity_ = initial_capacity;
+    buffer_ = reinterpret_cast<char*>(malloc(buffer_capacity_));
+  } else {
+    buffer_capacity_ = kInlineCapacity;
+    buffer_ = inline_buffer_;
+  }
+  buffer_[0] = 0;
 }
 
 StringBuffer::~StringBuffer() {
-  free(buffer_);
+  if (buffer_ != inline_buffer_) {
+    free(buffer_);
+  }
   buffer_ = nullptr;
 }
 
-void StringBuffer::Reset() { buffer_offset_ = 0; }
+void StringBuffer::Reset() {
+  buffer_offset_ = 0;
+  buffer_[0] = 0;
+}
 
 void StringBuffer::Grow(size_t additional_length) {
   if (buffer_offset_ + additional_length <= buffer_capacity_) {
@@ -36,7 +47,12 @@ void StringBuffer::Grow(size_t additional_length) {
   size_t new_capacity =
       std::max(xe::round_up(buffer_offset_ + additional_length, 16 * 1024),
                old_capacity * 2);
-  buffer_ = reinterpret_cast<char*>(realloc(buffer_, new_capacity));
+  if (buffer_ == inline_buffer_) {
+    buffer_ = reinterpret_cast<char*>(malloc(new_capacity));
+    memcpy(buffer_, inline_buffer_, buffer_offset_ + 1);
+  } else {
+    buffer_ = reinterpret_cast<char*>(realloc(buffer_, new_capacity));
+  }
   buffer_capacity_ = new_capacity;
 }
 
@@ -60,11 +76,24 @@ void StringBuffer::AppendFormat(const char* format, ...) {
 }
 
 void StringBuffer::AppendVarargs(const char* format, va_list args) {
-  int length = vsnprintf(nullptr, 0, format, args);
-  Grow(length + 1);
-  vsnprintf(buffer_ + buffer_offset_, buffer_capacity_, format, args);
+  // Format straight into the free space and only go around again (with a
+  // fresh copy of the args) if it didn't fit.
+  va_list args_copy;
+  va_copy(args_copy, args);
+  size_t remaining = buffer_capacity_ - buffer_offset_;
+  int length = vsnprintf(buffer_ + buffer_offset_, remaining, format, args);
+  if (length < 0) {
+    buffer_[buffer_offset_] = 0;
+    va_end(args_copy);
+    return;
+  }
+  if (size_t(length) >= remaining) {
+    Grow(length + 1);
+    vsnprintf(buffer_ + buffer_offset_, buffer_capacity_ - buffer_offset_,
+              format, args_copy);
+  }
+  va_end(args_copy);
   buffer_offset_ += length;
-  buffer_[buffer_offset_] = 0;
 }
 
 void StringBuffer::AppendBytes(const uint8_t* buffer, size_t length) {
@@ -74,6 +103,41 @@ void StringBuffer::AppendBytes(const uint8_t* buffer, size_t length) {
   buffer_[buffer_offset_] = 0;
 }
 
+void StringBuffer::AppendDecimal(int64_t value) {
+  char digits[20];
+  uint64_t magnitude =
+      value < 0 ? 0 - static_cast<uint64_t>(value) : uint64_t(value);
+  size_t count = 0;
+  do {
+    digits[sizeof(digits) - ++count] = char('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+  Grow(count + 2);
+  if (value < 0) {
+    buffer_[buffer_offset_++] = '-';
+  }
+  memcpy(buffer_ + buffer_offset_, digits + sizeof(digits) - count, count);
+  buffer_offset_ += count;
+  buffer_[buffer_offset_] = 0;
+}
+
+void StringBuffer::AppendHex(uint64_t value, size_t min_digits) {
+  static const char kHexDigits[] = "0123456789ABCDEF";
+  size_t count = 1;
+  while (count < 16 && (value >> (count * 4))) {
+    ++count;
+  }
+  count = std::max(count, std::min(min_digits, static_cast<size_t>(16)));
+  Grow(count + 1);
+  char* dest = buffer_ + buffer_offset_;
+  for (size_t n = count; n; --n) {
+    dest[n - 1] = kHexDigits[value & 0xF];
+    value >>= 4;
+  }
+  buffer_offset_ += count;
+  buffer_[buffer_offset_] = 0;
+}
+
 const char* StringBuffer::GetString() const { return buffer_; }
 
 std::string StringBuffer::to_string() {
@@ -15,10 +15,18 @@
 
 namespace xe {
 
+// Append-only string builder.
+// Small strings stay in inline storage and never touch the heap. The integer
+// formatters skip printf format parsing and should be preferred on hot paths
+// (disassembly, HIR dumps, call logging).
 class StringBuffer {
  public:
+  static const size_t kInlineCapacity = 256;
+
   explicit StringBuffer(size_t initial_capacity = 0);
   ~StringBuffer();
+  StringBuffer(const StringBuffer&) = delete;
+  StringBuffer& operator=(const StringBuffer&) = delete;
 
   size_t length() const { return buffer_offset_; }
 
@@ -30,6 +38,10 @@ class StringBuffer {
   void AppendFormat(const char* format, ...);
   void AppendVarargs(const char* format, va_list args);
   void AppendBytes(const uint8_t* buffer, size_t length);
+  // Signed decimal, as %d/%lld.
+  void AppendDecimal(int64_t value);
+  // Uppercase hex zero padded to min_digits, as %X/%.8X.
+  void AppendHex(uint64_t value, size_t min_digits = 0);
 
   const char* GetString() const;
   std::string to_string();
@@ -41,6 +53,7 @@ class StringBuffer {
   char* buffer_ = nullptr;
   size_t buffer_offset_ = 0;
   size_t buffer_capacity_ = 0;
+  char inline_buffer_[kInlineCapacity];
 };
 
 }  // namespace xe
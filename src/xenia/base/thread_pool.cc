@@ -0,0 +1,226 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/thread_pool.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <string>
+
+#include "xenia/base/assert.h"
+
+DEFINE_int32(thread_pool_size, 0,
+             "Number of shared task worker threads. 0 uses one per physical "
+             "core, less one.");
+
+namespace xe {
+namespace threading {
+
+namespace {
+thread_local ThreadPool* current_pool_ = nullptr;
+thread_local int current_worker_index_ = -1;
+}  // namespace
+
+ThreadPool::ThreadPool(uint32_t worker_count)
+    : running_(true), pending_count_(0) {
+  worker_count = std::max(worker_count, 1u);
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // Queues must all exist before the first worker starts stealing.
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    int worker_index = int(i);
+    auto thread = Thread::Create(
+        {}, [this, worker_index]() { WorkerMain(worker_index); });
+    thread->set_name("Task Worker " + std::to_string(i));
+    workers_[i]->thread = std::move(thread);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    running_ = false;
+  }
+  sleep_cond_.notify_all();
+  for (auto& worker : workers_) {
+    Wait(worker->thread.get(), false);
+  }
+}
+
+ThreadPool* ThreadPool::global() {
+  // Leaked on purpose: joining workers from static destructors can deadlock
+  // once the process has started tearing down threads.
+  static ThreadPool* pool = []() {
+    uint32_t worker_count = uint32_t(std::max(FLAGS_thread_pool_size, 0));
+    if (!worker_count) {
+      uint32_t core_count = uint32_t(available_core_masks().size());
+      if (!core_count) {
+        core_count = logical_processor_count();
+      }
+      worker_count = core_count > 1 ? core_count - 1 : 1;
+    }
+    return new ThreadPool(worker_count);
+  }();
+  return pool;
+}
+
+void ThreadPool::Submit(std::function<void()> fn, TaskPriority priority,
+                        TaskGroup* group) {
+  TaskQueue* queue = current_pool_ == this
+                         ? &workers_[current_worker_index_]->queue
+                         : &shared_queue_;
+  // Counted first so that a worker never sees the task without the count.
+  pending_count_.fetch_add(1);
+  {
+    std::lock_guard<xe::mutex> lock(queue->mutex);
+    queue->tasks[size_t(priority)].push_back({std::move(fn), group});
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+  }
+  sleep_cond_.notify_one();
+}
+
+bool ThreadPool::TakeTask(int worker_index, TaskGroup* group,
+                          Task* out_task) {
+  if (!pending_count_.load()) {
+    return false;
+  }
+  auto take = [this, group, out_task](TaskQueue* queue, size_t priority,
+                                      bool newest) {
+    std::lock_guard<xe::mutex> lock(queue->mutex);
+    auto& tasks = queue->tasks[priority];
+    if (tasks.empty()) {
+      return false;
+    }
+    if (!group) {
+      if (newest) {
+        *out_task = std::move(tasks.back());
+        tasks.pop_back();
+      } else {
+        *out_task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+    } else {
+      auto matches = [group](const Task& task) { return task.group == group; };
+      auto it = tasks.end();
+      if (newest) {
+        auto rit = std::find_if(tasks.rbegin(), tasks.rend(), matches);
+        if (rit != tasks.rend()) {
+          it = std::next(rit).base();
+        }
+      } else {
+        it = std::find_if(tasks.begin(), tasks.end(), matches);
+      }
+      if (it == tasks.end()) {
+        return false;
+      }
+      *out_task = std::move(*it);
+      tasks.erase(it);
+    }
+    pending_count_.fetch_sub(1);
+    return true;
+  };
+  size_t worker_count = workers_.size();
+  for (size_t priority = 0; priority < kPriorityCount; ++priority) {
+    if (worker_index >= 0 &&
+        take(&workers_[worker_index]->queue, priority, true)) {
+      return true;
+    }
+    if (take(&shared_queue_, priority, false)) {
+      return true;
+    }
+    // Steal, starting after ourselves so that thieves spread out.
+    for (size_t i = 1; i <= worker_count; ++i) {
+      size_t victim = (worker_index + i) % worker_count;
+      if (int(victim) == worker_index) {
+        continue;
+      }
+      if (take(&workers_[victim]->queue, priority, false)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::RunOneTask(TaskGroup* group) {
+  Task task;
+  if (!TakeTask(current_pool_ == this ? current_worker_index_ : -1, group,
+                &task)) {
+    return false;
+  }
+  RunTask(&task);
+  return true;
+}
+
+void ThreadPool::RunTask(Task* task) {
+  task->fn();
+  task->fn = nullptr;
+  if (task->group) {
+    task->group->OnTaskCompleted();
+  }
+}
+
+void ThreadPool::WorkerMain(int worker_index) {
+  current_pool_ = this;
+  current_worker_index_ = worker_index;
+  Task task;
+  while (true) {
+    if (TakeTask(worker_index, nullptr, &task)) {
+      RunTask(&task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleep_cond_.wait(lock,
+                     [this]() { return pending_count_.load() || !running_; });
+    if (!running_ && !pending_count_.load()) {
+      break;
+    }
+  }
+}
+
+TaskGroup::TaskGroup(TaskPriority priority, ThreadPool* pool)
+    : pool_(pool), priority_(priority), pending_count_(0) {}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+void TaskGroup::Run(std::function<void()> fn) {
+  pending_count_.fetch_add(1);
+  pool_->Submit(std::move(fn), priority_, this);
+}
+
+void TaskGroup::Wait() {
+  while (pending_count_.load()) {
+    if (pool_->RunOneTask(this)) {
+      continue;
+    }
+    // Our remaining tasks are running elsewhere.
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, std::chrono::milliseconds(1),
+                   [this]() { return !pending_count_.load(); });
+  }
+  // The last completing task may still be notifying; the group must not go
+  // away under it.
+  std::lock_guard<std::mutex> lock(mutex_);
+}
+
+void TaskGroup::OnTaskCompleted() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_count_.fetch_sub(1) == 1) {
+    cond_.notify_all();
+  }
+}
+
+}  // namespace threading
+}  // namespace xe
@@ -0,0 +1,133 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_THREAD_POOL_H_
+#define XENIA_BASE_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace threading {
+
+class TaskGroup;
+
+// Order in which queued tasks are picked up. Higher priority tasks anywhere
+// in the pool are run before any lower priority task.
+enum class TaskPriority {
+  // Work something is blocked on, such as a JIT compile the guest waits for.
+  kHigh = 0,
+  // Throughput work such as texture decoding.
+  kNormal = 1,
+  // Background work such as I/O prefetching and speculative compiles.
+  kLow = 2,
+};
+
+// Work-stealing pool of host worker threads shared by all subsystems.
+// Tasks queued from a worker go to that worker's own queue and run LIFO for
+// locality; idle workers steal the oldest tasks from the others. Tasks
+// queued from any other thread go to a shared queue.
+class ThreadPool {
+ public:
+  // Creates a pool with the given number of worker threads.
+  explicit ThreadPool(uint32_t worker_count);
+  // Runs all queued tasks to completion and joins the workers.
+  ~ThreadPool();
+
+  // Returns the process-wide pool, created on first use with
+  // --thread_pool_size workers (default: one per physical core, less the
+  // one the caller usually keeps busy). It is never destroyed.
+  static ThreadPool* global();
+
+  uint32_t worker_count() const { return uint32_t(workers_.size()); }
+
+  // Queues a task. Prefer TaskGroup when the caller needs to wait on it.
+  void Submit(std::function<void()> fn,
+              TaskPriority priority = TaskPriority::kNormal) {
+    Submit(std::move(fn), priority, nullptr);
+  }
+
+ private:
+  friend class TaskGroup;
+
+  static const size_t kPriorityCount = 3;
+
+  struct Task {
+    std::function<void()> fn;
+    TaskGroup* group;
+  };
+  struct TaskQueue {
+    xe::mutex mutex;
+    std::deque<Task> tasks[kPriorityCount];
+  };
+  struct Worker {
+    std::unique_ptr<Thread> thread;
+    TaskQueue queue;
+  };
+
+  void Submit(std::function<void()> fn, TaskPriority priority,
+              TaskGroup* group);
+  // Takes the next task for the given worker (or a non-worker thread if
+  // worker_index is -1): own queue first, then the shared queue, then the
+  // other workers' queues. If group is set only its tasks are taken.
+  bool TakeTask(int worker_index, TaskGroup* group, Task* out_task);
+  // Runs one queued task of the group on the calling thread, if there is any.
+  bool RunOneTask(TaskGroup* group);
+  void RunTask(Task* task);
+  void WorkerMain(int worker_index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  TaskQueue shared_queue_;
+
+  std::atomic<bool> running_;
+  // Tasks queued but not yet taken.
+  std::atomic<uint32_t> pending_count_;
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cond_;
+};
+
+// Set of tasks that can be waited on together.
+// While waiting, the calling thread runs the group's own queued tasks itself
+// so that nested groups and single core hosts make progress. Unrelated tasks
+// are never run from Wait, as they could take locks the waiter holds.
+class TaskGroup {
+ public:
+  explicit TaskGroup(TaskPriority priority = TaskPriority::kNormal,
+                     ThreadPool* pool = ThreadPool::global());
+  // Waits for all tasks of the group.
+  ~TaskGroup();
+
+  // Queues a task as part of the group.
+  void Run(std::function<void()> fn);
+  // Waits until all tasks queued so far have completed.
+  void Wait();
+
+ private:
+  friend class ThreadPool;
+
+  void OnTaskCompleted();
+
+  ThreadPool* pool_;
+  TaskPriority priority_;
+  std::atomic<uint32_t> pending_count_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
+
+}  // namespace threading
+}  // namespace xe
+
+#endif  // XENIA_BASE_THREAD_POOL_H_
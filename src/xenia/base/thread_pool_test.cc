@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <atomic>
+#include <thread>
+
+#include "third_party/catch/include/catch.hpp"
+#include "xenia/base/thread_pool.h"
+
+using xe::threading::TaskGroup;
+using xe::threading::TaskPriority;
+using xe::threading::ThreadPool;
+
+TEST_CASE("thread_pool_task_group", "Thread Pool") {
+  ThreadPool pool(2);
+  std::atomic<uint32_t> run_count(0);
+  {
+    TaskGroup group(TaskPriority::kNormal, &pool);
+    for (uint32_t i = 0; i < 100; ++i) {
+      group.Run([&run_count]() { run_count.fetch_add(1); });
+    }
+    group.Wait();
+    REQUIRE(run_count.load() == 100);
+    // Reusable after a wait.
+    group.Run([&run_count]() { run_count.fetch_add(1); });
+  }
+  REQUIRE(run_count.load() == 101);
+}
+
+TEST_CASE("thread_pool_nested_groups", "Thread Pool") {
+  // A single worker waiting on a nested group has to run it itself.
+  ThreadPool pool(1);
+  std::atomic<uint32_t> run_count(0);
+  TaskGroup outer(TaskPriority::kNormal, &pool);
+  for (uint32_t i = 0; i < 4; ++i) {
+    outer.Run([&pool, &run_count]() {
+      TaskGroup inner(TaskPriority::kHigh, &pool);
+      for (uint32_t j = 0; j < 4; ++j) {
+        inner.Run([&run_count]() { run_count.fetch_add(1); });
+      }
+      inner.Wait();
+    });
+  }
+  outer.Wait();
+  REQUIRE(run_count.load() == 16);
+}
+
+TEST_CASE("thread_pool_wait_runs_only_own_tasks", "Thread Pool") {
+  ThreadPool pool(1);
+
+  // Park the only worker so queued tasks stay queued.
+  std::atomic<bool> worker_parked(false);
+  std::atomic<bool> release_worker(false);
+  pool.Submit([&worker_parked, &release_worker]() {
+    worker_parked = true;
+    while (!release_worker) {
+      std::this_thread::yield();
+    }
+  });
+  while (!worker_parked) {
+    std::this_thread::yield();
+  }
+
+  auto waiter_id = std::this_thread::get_id();
+  std::atomic<bool> unrelated_ran_on_waiter(false);
+  std::atomic<bool> unrelated_ran(false);
+  pool.Submit([&]() {
+    unrelated_ran_on_waiter = std::this_thread::get_id() == waiter_id;
+    unrelated_ran = true;
+  });
+
+  std::atomic<bool> own_ran(false);
+  TaskGroup group(TaskPriority::kNormal, &pool);
+  group.Run([&own_ran]() { own_ran = true; });
+  group.Wait();
+  REQUIRE(own_ran.load());
+
+  release_worker = true;
+  while (!unrelated_ran) {
+    std::this_thread::yield();
+  }
+  REQUIRE(!unrelated_ran_on_waiter.load());
+}
@@ -21,5 +21,16 @@ uint32_t current_thread_id() {
 
 void set_current_thread_id(uint32_t id) { current_thread_id_ = id; }
 
+std::vector<uint64_t> available_core_masks() {
+  uint64_t process_mask = process_affinity_mask();
+  std::vector<uint64_t> masks;
+  for (uint64_t core_mask : physical_core_masks()) {
+    if (core_mask & process_mask) {
+      masks.push_back(core_mask & process_mask);
+    }
+  }
+  return masks;
+}
+
 }  // namespace threading
 }  // namespace xe
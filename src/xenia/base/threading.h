@@ -50,6 +50,26 @@ class Fence {
 // Returns the total number of logical processors in the host system.
 uint32_t logical_processor_count();
 
+// Returns one affinity mask per physical core in the host system, each with
+// the bits of all logical processors (SMT siblings) sharing that core set.
+// Cores are ordered by their lowest logical processor.
+const std::vector<uint64_t>& physical_core_masks();
+
+// Returns the affinity mask of each NUMA node in the host system, indexed by
+// node number. Nodes without logical processors have an empty mask. Hosts
+// without NUMA report a single node with all logical processors.
+const std::vector<uint64_t>& numa_node_masks();
+
+// Gets the logical processors the process may run on.
+uint64_t process_affinity_mask();
+// Restricts the process to the given logical processors. Threads created
+// afterwards inherit the restriction.
+bool set_process_affinity_mask(uint64_t mask);
+
+// Returns physical_core_masks() restricted to the process affinity mask,
+// without cores the process may not run on.
+std::vector<uint64_t> available_core_masks();
+
 // Enables the current process to set thread affinity.
 // Must be called at startup before attempting to set thread affinity.
 void EnableAffinityConfiguration();
@@ -97,6 +117,22 @@ SleepResult AlertableSleep(std::chrono::duration<Rep, Period> duration) {
       std::chrono::duration_cast<std::chrono::microseconds>(duration));
 }
 
+// Sleeps the current thread until the given duration has elapsed, with
+// sub-millisecond accuracy. The bulk of the duration is slept through and
+// the remainder is spent yielding, so only the last moments cost CPU time.
+void PreciseSleep(std::chrono::microseconds duration);
+template <typename Rep, typename Period>
+void PreciseSleep(std::chrono::duration<Rep, Period> duration) {
+  PreciseSleep(std::chrono::duration_cast<std::chrono::microseconds>(duration));
+}
+// Alertable PreciseSleep, returning early like AlertableSleep.
+SleepResult AlertablePreciseSleep(std::chrono::microseconds duration);
+template <typename Rep, typename Period>
+SleepResult AlertablePreciseSleep(std::chrono::duration<Rep, Period> duration) {
+  return AlertablePreciseSleep(
+      std::chrono::duration_cast<std::chrono::microseconds>(duration));
+}
+
 typedef uint32_t TlsHandle;
 constexpr TlsHandle kInvalidTlsHandle = UINT_MAX;
 
@@ -392,6 +428,10 @@ class Thread : public WaitHandle {
   // Suspends the specified thread.
   virtual bool Suspend(uint32_t* out_previous_suspend_count = nullptr) = 0;
 
+  // Returns the user and kernel CPU time the thread has used, in
+  // microseconds.
+  virtual uint64_t QueryCpuTimeMicros() = 0;
+
   // Terminates the thread.
   // No destructors are called, and this function does not return.
   // The state of the thread object becomes signaled, releasing any other
@@ -9,13 +9,654 @@
 
 #include "xenia/base/threading.h"
 
+#include <linux/futex.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
 
 namespace xe {
 namespace threading {
 
+// Parses a sysfs cpu list such as "0-7,16-23" into an affinity mask.
+static uint64_t ParseCpuList(const std::string& list) {
+  uint64_t mask = 0;
+  const char* p = list.c_str();
+  while (*p) {
+    char* end = nullptr;
+    unsigned long first = std::strtoul(p, &end, 10);  // NOLINT(runtime/int)
+    unsigned long last = first;                       // NOLINT(runtime/int)
+    if (end == p) {
+      break;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = std::strtoul(p, &end, 10);
+    }
+    for (unsigned long cpu = first; cpu <= last && cpu < 64; ++cpu) {
+      mask |= 1ull << cpu;
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  return mask;
+}
+
+uint32_t logical_processor_count() {
+  static uint32_t value = 0;
+  if (!value) {
+    long count = sysconf(_SC_NPROCESSORS_CONF);  // NOLINT(runtime/int)
+    value = count > 0 ? uint32_t(count) : 1;
+  }
+  return value;
+}
+
+const std::vector<uint64_t>& physical_core_masks() {
+  static std::vector<uint64_t> masks;
+  static std::once_flag once;
+  std::call_once(once, []() {
+    for (uint32_t cpu = 0; cpu < logical_processor_count() && cpu < 64;
+         ++cpu) {
+      char path[80];
+      snprintf(path, sizeof(path),
+               "/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list",
+               cpu);
+      std::ifstream file(path);
+      std::string list;
+      uint64_t mask = 0;
+      if (file && std::getline(file, list)) {
+        mask = ParseCpuList(list);
+      }
+      if (!(mask & (1ull << cpu))) {
+        // No topology information (or offline); treat it as its own core.
+        mask = 1ull << cpu;
+      }
+      // Each core is listed once, by its lowest logical processor.
+      if ((mask & (~mask + 1)) == (1ull << cpu)) {
+        masks.push_back(mask);
+      }
+    }
+  });
+  return masks;
+}
+
+const std::vector<uint64_t>& numa_node_masks() {
+  static std::vector<uint64_t> masks;
+  static std::once_flag once;
+  std::call_once(once, []() {
+    // Node numbers may have gaps, so every possible node is probed.
+    for (int node = 0; node < 64; ++node) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+               node);
+      std::ifstream file(path);
+      std::string list;
+      if (file && std::getline(file, list)) {
+        masks.resize(node + 1, 0);
+        masks[node] = ParseCpuList(list);
+      }
+    }
+    if (masks.empty()) {
+      masks.push_back(process_affinity_mask());
+    }
+  });
+  return masks;
+}
+
+uint64_t process_affinity_mask() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set)) {
+    return ~0ull;
+  }
+  uint64_t mask = 0;
+  for (int cpu = 0; cpu < 64; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      mask |= 1ull << cpu;
+    }
+  }
+  return mask;
+}
+
+bool set_process_affinity_mask(uint64_t mask) {
+  // Affinity is per thread on Linux; this sets the calling thread's, which
+  // threads it creates inherit.
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu = 0; cpu < 64; ++cpu) {
+    if (mask & (1ull << cpu)) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
 void MaybeYield() { pthread_yield(); }
 
+// Dispatcher objects are built the same way the guest kernel builds them:
+// every object has a lock and a list of threads waiting on it, and a waiting
+// thread sleeps on a single futex word in its own wait block. Signaling an
+// object wakes everyone registered on it and they re-evaluate their waits, so
+// a wait on N objects costs one futex no matter how many objects are involved
+// and WaitAll can be evaluated atomically by taking the object locks in
+// address order.
+namespace {
+
+const size_t kMaximumWaitObjects = 64;
+
+struct WaitBlock {
+  std::atomic<uint32_t> state;
+};
+
+WaitBlock* current_wait_block() {
+  static thread_local WaitBlock wait_block;
+  return &wait_block;
+}
+
+int FutexWait(std::atomic<uint32_t>* address, uint32_t expected,
+              const timespec* timeout) {
+  return int(syscall(SYS_futex, reinterpret_cast<uint32_t*>(address),
+                     FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0));
+}
+
+void FutexWake(std::atomic<uint32_t>* address) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAKE_PRIVATE,
+          INT_MAX, nullptr, nullptr, 0);
+}
+
+class Dispatcher {
+ public:
+  virtual ~Dispatcher() = default;
+
+  // Both are called with lock_ held. pulsed is true if the object was pulsed
+  // since the calling thread registered as a waiter.
+  virtual bool IsSignaled(bool pulsed) = 0;
+  virtual void Acquire(bool pulsed) = 0;
+  // Signals the object the way SignalObjectAndWait would. Takes lock_.
+  virtual bool Signal() = 0;
+
+  std::mutex lock_;
+  // Bumped by Event::Pulse so waiters can tell they were released by it.
+  uint32_t pulse_generation_ = 0;
+
+  void AddWaiter(WaitBlock* wait_block) { waiters_.push_back(wait_block); }
+  void RemoveWaiter(WaitBlock* wait_block) {
+    auto it = std::find(waiters_.begin(), waiters_.end(), wait_block);
+    if (it != waiters_.end()) {
+      *it = waiters_.back();
+      waiters_.pop_back();
+    }
+  }
+
+  // Called with lock_ held after the object becomes signaled.
+  void WakeWaiters() {
+    for (auto wait_block : waiters_) {
+      wait_block->state.store(1, std::memory_order_release);
+      FutexWake(&wait_block->state);
+    }
+  }
+
+ private:
+  std::vector<WaitBlock*> waiters_;
+};
+
+template <typename T>
+class PosixHandle : public T, public Dispatcher {
+ public:
+  ~PosixHandle() override = default;
+
+ protected:
+  void* native_handle() const override {
+    return const_cast<Dispatcher*>(static_cast<const Dispatcher*>(this));
+  }
+};
+
+Dispatcher* dispatcher_of(WaitHandle* wait_handle) {
+  return reinterpret_cast<Dispatcher*>(wait_handle->native_handle());
+}
+
+}  // namespace
+
+std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
+                                           size_t wait_handle_count,
+                                           bool wait_all, bool is_alertable,
+                                           std::chrono::milliseconds timeout) {
+  if (!wait_handle_count || wait_handle_count > kMaximumWaitObjects) {
+    return std::pair<WaitResult, size_t>(WaitResult::kFailed, 0);
+  }
+  // is_alertable has no effect as host threads have no callback queue here.
+  Dispatcher* dispatchers[kMaximumWaitObjects];
+  Dispatcher* lock_order[kMaximumWaitObjects];
+  uint32_t seen_generations[kMaximumWaitObjects];
+  for (size_t i = 0; i < wait_handle_count; ++i) {
+    dispatchers[i] = lock_order[i] = dispatcher_of(wait_handles[i]);
+  }
+  std::sort(lock_order, lock_order + wait_handle_count);
+  size_t lock_count = size_t(
+      std::unique(lock_order, lock_order + wait_handle_count) - lock_order);
+  if (wait_all && lock_count != wait_handle_count) {
+    // Same as Win32: an object may only appear once in a wait-all.
+    return std::pair<WaitResult, size_t>(WaitResult::kFailed, 0);
+  }
+  auto lock_all = [&]() {
+    for (size_t i = 0; i < lock_count; ++i) {
+      lock_order[i]->lock_.lock();
+    }
+  };
+  auto unlock_all = [&]() {
+    for (size_t i = lock_count; i; --i) {
+      lock_order[i - 1]->lock_.unlock();
+    }
+  };
+
+  bool infinite = timeout == std::chrono::milliseconds::max();
+  auto deadline = std::chrono::steady_clock::now() +
+                  (infinite ? std::chrono::milliseconds(0) : timeout);
+  auto wait_block = current_wait_block();
+  bool registered = false;
+
+  lock_all();
+  while (true) {
+    if (registered) {
+      for (size_t i = 0; i < lock_count; ++i) {
+        lock_order[i]->RemoveWaiter(wait_block);
+      }
+    }
+    auto pulsed = [&](size_t i) {
+      return registered &&
+             dispatchers[i]->pulse_generation_ != seen_generations[i];
+    };
+    if (wait_all) {
+      bool all_signaled = true;
+      for (size_t i = 0; i < wait_handle_count && all_signaled; ++i) {
+        all_signaled = dispatchers[i]->IsSignaled(pulsed(i));
+      }
+      if (all_signaled) {
+        for (size_t i = 0; i < wait_handle_count; ++i) {
+          dispatchers[i]->Acquire(pulsed(i));
+        }
+        unlock_all();
+        return std::pair<WaitResult, size_t>(WaitResult::kSuccess, 0);
+      }
+    } else {
+      for (size_t i = 0; i < wait_handle_count; ++i) {
+        if (dispatchers[i]->IsSignaled(pulsed(i))) {
+          dispatchers[i]->Acquire(pulsed(i));
+          unlock_all();
+          return std::pair<WaitResult, size_t>(WaitResult::kSuccess, i);
+        }
+      }
+    }
+
+    if (!infinite && std::chrono::steady_clock::now() >= deadline) {
+      unlock_all();
+      return std::pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+    }
+
+    wait_block->state.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < wait_handle_count; ++i) {
+      seen_generations[i] = dispatchers[i]->pulse_generation_;
+    }
+    for (size_t i = 0; i < lock_count; ++i) {
+      lock_order[i]->AddWaiter(wait_block);
+    }
+    registered = true;
+    unlock_all();
+
+    while (!wait_block->state.load(std::memory_order_acquire)) {
+      if (infinite) {
+        FutexWait(&wait_block->state, 0, nullptr);
+        continue;
+      }
+      // Recomputed on every pass so spurious wakeups don't extend the wait.
+      auto remaining = deadline - std::chrono::steady_clock::now();
+      if (remaining <= std::chrono::steady_clock::duration::zero()) {
+        break;
+      }
+      auto remaining_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(remaining)
+              .count();
+      timespec relative_timeout;
+      relative_timeout.tv_sec = time_t(remaining_ns / 1000000000);
+      relative_timeout.tv_nsec = long(remaining_ns % 1000000000);  // NOLINT
+      if (FutexWait(&wait_block->state, 0, &relative_timeout) == -1 &&
+          errno == ETIMEDOUT) {
+        break;
+      }
+    }
+    lock_all();
+  }
+}
+
+WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
+                std::chrono::milliseconds timeout) {
+  return WaitMultiple(&wait_handle, 1, false, is_alertable, timeout).first;
+}
+
+class PosixEvent : public PosixHandle<Event> {
+ public:
+  PosixEvent(bool manual_reset, bool initial_state)
+      : manual_reset_(manual_reset), signaled_(initial_state) {}
+  ~PosixEvent() override = default;
+
+  void Set() override {
+    std::lock_guard<std::mutex> lock(lock_);
+    signaled_ = true;
+    WakeWaiters();
+  }
+  void Reset() override {
+    std::lock_guard<std::mutex> lock(lock_);
+    signaled_ = false;
+  }
+  void Pulse() override {
+    // Releases whoever is waiting right now (only one of them for an
+    // auto-reset event) and leaves the event nonsignaled.
+    std::lock_guard<std::mutex> lock(lock_);
+    signaled_ = false;
+    pulse_available_ = true;
+    ++pulse_generation_;
+    WakeWaiters();
+  }
+
+  bool IsSignaled(bool pulsed) override {
+    return signaled_ || (pulsed && pulse_available_);
+  }
+  bool Signal() override {
+    Set();
+    return true;
+  }
+  void Acquire(bool pulsed) override {
+    if (manual_reset_) {
+      return;
+    }
+    if (signaled_) {
+      signaled_ = false;
+    } else {
+      pulse_available_ = false;
+    }
+  }
+
+ private:
+  bool manual_reset_;
+  bool signaled_;
+  bool pulse_available_ = false;
+};
+
+std::unique_ptr<Event> Event::CreateManualResetEvent(bool initial_state) {
+  return std::make_unique<PosixEvent>(true, initial_state);
+}
+
+std::unique_ptr<Event> Event::CreateAutoResetEvent(bool initial_state) {
+  return std::make_unique<PosixEvent>(false, initial_state);
+}
+
+class PosixSemaphore : public PosixHandle<Semaphore> {
+ public:
+  PosixSemaphore(int initial_count, int maximum_count)
+      : count_(initial_count), maximum_count_(maximum_count) {}
+  ~PosixSemaphore() override = default;
+
+  bool Release(int release_count, int* out_previous_count) override {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (release_count <= 0 || release_count > maximum_count_ - count_) {
+      return false;
+    }
+    if (out_previous_count) {
+      *out_previous_count = count_;
+    }
+    count_ += release_count;
+    WakeWaiters();
+    return true;
+  }
+
+  bool IsSignaled(bool pulsed) override { return count_ > 0; }
+  bool Signal() override { return Release(1, nullptr); }
+  void Acquire(bool pulsed) override { --count_; }
+
+ private:
+  int count_;
+  int maximum_count_;
+};
+
+std::unique_ptr<Semaphore> Semaphore::Create(int initial_count,
+                                             int maximum_count) {
+  if (initial_count < 0 || initial_count > maximum_count) {
+    return nullptr;
+  }
+  return std::make_unique<PosixSemaphore>(initial_count, maximum_count);
+}
+
+class PosixMutant : public PosixHandle<Mutant> {
+ public:
+  explicit PosixMutant(bool initial_owner) {
+    if (initial_owner) {
+      owner_ = std::this_thread::get_id();
+      recursion_count_ = 1;
+    }
+  }
+  ~PosixMutant() override = default;
+
+  bool Release() override {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (owner_ != std::this_thread::get_id()) {
+      return false;
+    }
+    if (!--recursion_count_) {
+      owner_ = std::thread::id();
+      WakeWaiters();
+    }
+    return true;
+  }
+
+  bool IsSignaled(bool pulsed) override {
+    return owner_ == std::thread::id() ||
+           owner_ == std::this_thread::get_id();
+  }
+  bool Signal() override { return Release(); }
+  void Acquire(bool pulsed) override {
+    owner_ = std::this_thread::get_id();
+    ++recursion_count_;
+  }
+
+ private:
+  // Default-constructed while unowned.
+  std::thread::id owner_;
+  uint32_t recursion_count_ = 0;
+};
+
+std::unique_ptr<Mutant> Mutant::Create(bool initial_owner) {
+  return std::make_unique<PosixMutant>(initial_owner);
+}
+
+WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
+                         WaitHandle* wait_handle_to_wait_on, bool is_alertable,
+                         std::chrono::milliseconds timeout) {
+  if (!dispatcher_of(wait_handle_to_signal)->Signal()) {
+    return WaitResult::kFailed;
+  }
+  return Wait(wait_handle_to_wait_on, is_alertable, timeout);
+}
+
+namespace {
+
+// Single thread firing every timer in the process, like the Win32 timer
+// queue. Entries are tagged with the timer's arm generation so that
+// re-setting or cancelling a timer simply orphans its old entry.
+class TimerQueue {
+ public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+  struct Entry {
+    std::function<void(uint64_t)> fire;
+    uint64_t generation;
+  };
+
+  // Held while an entry fires. Timers take it on destruction so they can't
+  // go away underneath a callback. Recursive as callbacks may destroy timers.
+  std::recursive_mutex& fire_mutex() { return fire_mutex_; }
+
+  static TimerQueue* Get() {
+    static TimerQueue* queue = new TimerQueue();
+    return queue;
+  }
+
+  void Schedule(TimePoint due, uint64_t generation,
+                std::function<void(uint64_t)> fire) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.emplace(due, Entry{std::move(fire), generation});
+    cond_.notify_one();
+  }
+
+ private:
+  TimerQueue() {
+    std::thread thread([this]() { ThreadMain(); });
+    thread.detach();
+  }
+
+  void ThreadMain() {
+    set_name("Timer Queue");
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      if (entries_.empty()) {
+        cond_.wait(lock);
+        continue;
+      }
+      auto it = entries_.begin();
+      if (std::chrono::steady_clock::now() < it->first) {
+        cond_.wait_until(lock, it->first);
+        continue;
+      }
+      Entry entry = std::move(it->second);
+      entries_.erase(it);
+      lock.unlock();
+      {
+        std::lock_guard<std::recursive_mutex> fire_lock(fire_mutex_);
+        entry.fire(entry.generation);
+      }
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::recursive_mutex fire_mutex_;
+  std::condition_variable cond_;
+  std::multimap<TimePoint, Entry> entries_;
+};
+
+}  // namespace
+
+class PosixTimer : public PosixHandle<Timer> {
+ public:
+  explicit PosixTimer(bool manual_reset) : manual_reset_(manual_reset) {}
+  ~PosixTimer() override {
+    // Entries still queued hold only the shared flag, and one that is firing
+    // right now finishes before we get the fire lock.
+    std::lock_guard<std::recursive_mutex> fire_lock(
+        TimerQueue::Get()->fire_mutex());
+    *alive_ = false;
+  }
+
+  bool SetOnce(std::chrono::nanoseconds due_time,
+               std::function<void()> opt_callback) override {
+    return Set(due_time, std::chrono::milliseconds(0),
+               std::move(opt_callback));
+  }
+  bool SetRepeating(std::chrono::nanoseconds due_time,
+                    std::chrono::milliseconds period,
+                    std::function<void()> opt_callback) override {
+    return Set(due_time, period, std::move(opt_callback));
+  }
+  bool Cancel() override {
+    std::lock_guard<std::mutex> lock(lock_);
+    ++generation_;
+    callback_ = nullptr;
+    return true;
+  }
+
+  bool IsSignaled(bool pulsed) override { return signaled_; }
+  bool Signal() override { return false; }
+  void Acquire(bool pulsed) override {
+    if (!manual_reset_) {
+      signaled_ = false;
+    }
+  }
+
+ private:
+  // Same convention as SetWaitableTimer: negative due times are relative,
+  // positive ones absolute host system time (FILETIME scaled to ns).
+  bool Set(std::chrono::nanoseconds due_time, std::chrono::milliseconds period,
+           std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(lock_);
+    uint64_t generation = ++generation_;
+    callback_ = std::move(callback);
+    period_ = period;
+    signaled_ = false;
+    auto relative_time = std::chrono::nanoseconds(-due_time.count());
+    if (due_time.count() > 0) {
+      relative_time = std::chrono::nanoseconds(
+          due_time.count() - int64_t(Clock::QueryHostSystemTime()) * 100);
+    }
+    auto due = std::chrono::steady_clock::now() +
+               std::max(relative_time, std::chrono::nanoseconds(0));
+    Schedule(due, generation);
+    return true;
+  }
+
+  // Called with lock_ held.
+  void Schedule(TimerQueue::TimePoint due, uint64_t generation) {
+    auto alive = alive_;
+    TimerQueue::Get()->Schedule(
+        due, generation, [this, alive, due](uint64_t generation) {
+          // The timer may have been destroyed while queued.
+          if (!*alive) {
+            return;
+          }
+          std::function<void()> callback;
+          {
+            std::lock_guard<std::mutex> lock(lock_);
+            if (generation != generation_) {
+              return;
+            }
+            signaled_ = true;
+            WakeWaiters();
+            callback = callback_;
+            if (period_.count()) {
+              Schedule(due + period_, generation);
+            }
+          }
+          // Win32 would run this as an APC on the thread that set the timer;
+          // we have no APCs so it runs here.
+          if (callback) {
+            callback();
+          }
+        });
+  }
+
+  bool manual_reset_;
+  bool signaled_ = false;
+  uint64_t generation_ = 0;
+  std::chrono::milliseconds period_;
+  std::function<void()> callback_;
+  // Only read or written under the queue fire lock.
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+};
+
+std::unique_ptr<Timer> Timer::CreateManualResetTimer() {
+  return std::make_unique<PosixTimer>(true);
+}
+
+std::unique_ptr<Timer> Timer::CreateSynchronizationTimer() {
+  return std::make_unique<PosixTimer>(false);
+}
+
 }  // namespace threading
 }  // namespace xe
@@ -9,10 +9,17 @@
 
 #include "xenia/base/threading.h"
 
+#include <algorithm>
+#include <mutex>
+
 #include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/platform_win.h"
 
+// Needs windows.h first.
+#include <mmsystem.h>  // NOLINT(build/include_order)
+
 namespace xe {
 namespace threading {
 
@@ -26,6 +33,75 @@ uint32_t logical_processor_count() {
   return value;
 }
 
+const std::vector<uint64_t>& physical_core_masks() {
+  static std::vector<uint64_t> masks;
+  static std::once_flag once;
+  std::call_once(once, []() {
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(
+        length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!infos.empty() && GetLogicalProcessorInformation(infos.data(),
+                                                         &length)) {
+      for (auto& info : infos) {
+        if (info.Relationship == RelationProcessorCore) {
+          masks.push_back(static_cast<uint64_t>(info.ProcessorMask));
+        }
+      }
+      std::sort(masks.begin(), masks.end(), [](uint64_t a, uint64_t b) {
+        return (a & (~a + 1)) < (b & (~b + 1));
+      });
+    }
+    if (masks.empty()) {
+      // No topology information; treat each logical processor as a core.
+      for (uint32_t i = 0; i < logical_processor_count() && i < 64; ++i) {
+        masks.push_back(1ull << i);
+      }
+    }
+  });
+  return masks;
+}
+
+const std::vector<uint64_t>& numa_node_masks() {
+  static std::vector<uint64_t> masks;
+  static std::once_flag once;
+  std::call_once(once, []() {
+    ULONG highest_node = 0;
+    if (GetNumaHighestNodeNumber(&highest_node)) {
+      for (ULONG node = 0; node <= highest_node && node < 64; ++node) {
+        ULONGLONG mask = 0;
+        GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask);
+        masks.push_back(static_cast<uint64_t>(mask));
+      }
+    }
+    if (masks.empty()) {
+      uint64_t mask = 0;
+      for (uint64_t core_mask : physical_core_masks()) {
+        mask |= core_mask;
+      }
+      masks.push_back(mask);
+    }
+  });
+  return masks;
+}
+
+uint64_t process_affinity_mask() {
+  DWORD_PTR process_affinity_mask;
+  DWORD_PTR system_affinity_mask;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &process_affinity_mask,
+                              &system_affinity_mask)) {
+    return ~0ull;
+  }
+  return static_cast<uint64_t>(process_affinity_mask);
+}
+
+bool set_process_affinity_mask(uint64_t mask) {
+  return SetProcessAffinityMask(GetCurrentProcess(),
+                                static_cast<DWORD_PTR>(mask))
+             ? true
+             : false;
+}
+
 void EnableAffinityConfiguration() {
   HANDLE process_handle = GetCurrentProcess();
   DWORD_PTR process_affinity_mask;
@@ -80,6 +156,13 @@ void MaybeYield() {
 
 void SyncMemory() { MemoryBarrier(); }
 
+// Raises the system timer resolution to 1ms for the life of the process, so
+// that sleeps and waitable timers don't round up to the 15.6ms default.
+static void EnsureHighTimerResolution() {
+  static std::once_flag once;
+  std::call_once(once, []() { timeBeginPeriod(1); });
+}
+
 void Sleep(std::chrono::microseconds duration) {
   if (duration.count() < 100) {
     MaybeYield();
@@ -96,6 +179,42 @@ SleepResult AlertableSleep(std::chrono::microseconds duration) {
   return SleepResult::kSuccess;
 }
 
+// Host sleeps may overshoot by this much even at 1ms timer resolution.
+const std::chrono::microseconds kPreciseSleepSlack(1500);
+
+static SleepResult PreciseSleep(std::chrono::microseconds duration,
+                                bool alertable) {
+  EnsureHighTimerResolution();
+  uint64_t deadline = Clock::QueryHostTickCount() +
+                      uint64_t(duration.count()) *
+                          Clock::host_tick_frequency() / 1000000;
+  if (duration > kPreciseSleepSlack) {
+    auto sleep_ms = DWORD((duration - kPreciseSleepSlack).count() / 1000);
+    if (SleepEx(sleep_ms, alertable ? TRUE : FALSE) == WAIT_IO_COMPLETION) {
+      return SleepResult::kAlerted;
+    }
+  }
+  // Always give up the timeslice at least once, as a zero delay is a yield.
+  do {
+    if (alertable) {
+      if (SleepEx(0, TRUE) == WAIT_IO_COMPLETION) {
+        return SleepResult::kAlerted;
+      }
+    } else {
+      MaybeYield();
+    }
+  } while (Clock::QueryHostTickCount() < deadline);
+  return SleepResult::kSuccess;
+}
+
+void PreciseSleep(std::chrono::microseconds duration) {
+  PreciseSleep(duration, false);
+}
+
+SleepResult AlertablePreciseSleep(std::chrono::microseconds duration) {
+  return PreciseSleep(duration, true);
+}
+
 TlsHandle AllocateTlsHandle() { return TlsAlloc(); }
 
 bool FreeTlsHandle(TlsHandle handle) { return TlsFree(handle) ? true : false; }
@@ -208,18 +327,23 @@ std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
                                            size_t wait_handle_count,
                                            bool wait_all, bool is_alertable,
                                            std::chrono::milliseconds timeout) {
-  std::vector<HANDLE> handles(wait_handle_count);
+  // WaitForMultipleObjectsEx can't take more than this anyway, so avoid a heap
+  // allocation per wait.
+  if (wait_handle_count > MAXIMUM_WAIT_OBJECTS) {
+    return std::pair<WaitResult, size_t>(WaitResult::kFailed, 0);
+  }
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
   for (size_t i = 0; i < wait_handle_count; ++i) {
     handles[i] = wait_handles[i]->native_handle();
   }
   DWORD result = WaitForMultipleObjectsEx(
-      DWORD(handles.size()), handles.data(), wait_all ? TRUE : FALSE,
+      DWORD(wait_handle_count), handles, wait_all ? TRUE : FALSE,
       DWORD(timeout.count()), is_alertable ? TRUE : FALSE);
-  if (result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + handles.size()) {
+  if (result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + wait_handle_count) {
     return std::pair<WaitResult, size_t>(WaitResult::kSuccess,
                                          result - WAIT_OBJECT_0);
   } else if (result >= WAIT_ABANDONED_0 &&
-             result < WAIT_ABANDONED_0 + handles.size()) {
+             result < WAIT_ABANDONED_0 + wait_handle_count) {
     return std::pair<WaitResult, size_t>(WaitResult::kAbandoned,
                                          result - WAIT_ABANDONED_0);
   }
@@ -340,10 +464,12 @@ class Win32Timer : public Win32Handle<Timer> {
 };
 
 std::unique_ptr<Timer> Timer::CreateManualResetTimer() {
+  EnsureHighTimerResolution();
   return std::make_unique<Win32Timer>(CreateWaitableTimer(NULL, TRUE, NULL));
 }
 
 std::unique_ptr<Timer> Timer::CreateSynchronizationTimer() {
+  EnsureHighTimerResolution();
   return std::make_unique<Win32Timer>(CreateWaitableTimer(NULL, FALSE, NULL));
 }
 
@@ -416,6 +542,20 @@ class Win32Thread : public Win32Handle<Thread> {
     return true;
   }
 
+  uint64_t QueryCpuTimeMicros() override {
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetThreadTimes(handle_, &creation_time, &exit_time, &kernel_time,
+                        &user_time)) {
+      return 0;
+    }
+    // Both are in 100ns units.
+    uint64_t kernel_ticks = (uint64_t(kernel_time.dwHighDateTime) << 32) |
+                            kernel_time.dwLowDateTime;
+    uint64_t user_ticks =
+        (uint64_t(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+    return (kernel_ticks + user_ticks) / 10;
+  }
+
   void Terminate(int exit_code) override {
     TerminateThread(handle_, exit_code);
   }
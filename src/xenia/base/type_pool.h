@@ -10,9 +10,15 @@
 #ifndef XENIA_BASE_TYPE_POOL_H_
 #define XENIA_BASE_TYPE_POOL_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <mutex>
+#include <new>
+#include <type_traits>
 #include <vector>
 
+#include "xenia/base/assert.h"
 #include "xenia/base/mutex.h"
 
 namespace xe {
@@ -56,6 +62,192 @@ class TypePool {
   std::vector<T*> list_;
 };
 
+struct FreeListEntry {
+  std::atomic<FreeListEntry*> next;
+};
+
+// Lock-free intrusive LIFO (a Treiber stack).
+// The head pointer carries a 16-bit tag in its unused upper bits that changes
+// on every update so a pop racing a pop+push of the same entry fails (ABA).
+// Entries are only ever read, never freed, by racing pops, so their memory
+// must stay valid for as long as the list is in use.
+class AtomicFreeList {
+ public:
+  constexpr AtomicFreeList() : head_(0) {}
+
+  void Push(FreeListEntry* entry) {
+    assert_zero(reinterpret_cast<uintptr_t>(entry) & ~kPointerMask);
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t new_head;
+    do {
+      entry->next.store(entry_of(head), std::memory_order_relaxed);
+      new_head = pack(entry, head);
+    } while (!head_.compare_exchange_weak(head, new_head,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  FreeListEntry* Pop() {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    while (true) {
+      FreeListEntry* entry = entry_of(head);
+      if (!entry) {
+        return nullptr;
+      }
+      // May read a stale next if another thread popped the entry first; the
+      // tag then no longer matches and the exchange fails.
+      FreeListEntry* next = entry->next.load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, pack(next, head),
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+        return entry;
+      }
+    }
+  }
+
+  // Detaches the whole list, returning its first entry.
+  FreeListEntry* PopAll() {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    while (!head_.compare_exchange_weak(head, pack(nullptr, head),
+                                        std::memory_order_acquire,
+                                        std::memory_order_acquire)) {
+    }
+    return entry_of(head);
+  }
+
+ private:
+  static const uint64_t kPointerMask = (1ull << 48) - 1;
+
+  static FreeListEntry* entry_of(uint64_t head) {
+    return reinterpret_cast<FreeListEntry*>(head & kPointerMask);
+  }
+  static uint64_t pack(FreeListEntry* entry, uint64_t old_head) {
+    return reinterpret_cast<uintptr_t>(entry) |
+           ((old_head & ~kPointerMask) + (1ull << 48));
+  }
+
+  std::atomic<uint64_t> head_;
+};
+
+// Lock-free TypePool. Values are kept constructed while pooled, exactly as
+// with TypePool, but live in slots that carry their own free list link.
+template <class T, typename A>
+class LockFreeTypePool {
+ public:
+  ~LockFreeTypePool() { Reset(); }
+
+  // Not safe to call concurrently with Allocate/Release.
+  void Reset() {
+    auto entry = free_list_.PopAll();
+    while (entry) {
+      auto slot = reinterpret_cast<Slot*>(entry);
+      entry = entry->next.load(std::memory_order_relaxed);
+      reinterpret_cast<T*>(&slot->storage)->~T();
+      delete slot;
+    }
+  }
+
+  T* Allocate(A arg0) {
+    auto slot = reinterpret_cast<Slot*>(free_list_.Pop());
+    if (slot) {
+      return reinterpret_cast<T*>(&slot->storage);
+    }
+    slot = new Slot();
+    return new (&slot->storage) T(arg0);
+  }
+
+  void Release(T* value) {
+    auto slot = reinterpret_cast<Slot*>(reinterpret_cast<uint8_t*>(value) -
+                                        offsetof(Slot, storage));
+    free_list_.Push(&slot->link);
+  }
+
+ private:
+  struct Slot {
+    FreeListEntry link;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  AtomicFreeList free_list_;
+};
+
+// Class-specific operator new/delete backed by a per-type block pool.
+// Derive frequently created and destroyed types from this to recycle their
+// memory:
+//   class XEvent : public XObject, public PooledObject<XEvent> { ... };
+// Freed blocks go to a small per-thread cache first and overflow into a
+// shared lock-free list. Blocks are never returned to the system. Requests for
+// any other size (further derived types) fall through to the global heap.
+template <typename T>
+class PooledObject {
+ public:
+  static void* operator new(size_t size) {
+    if (size != sizeof(T)) {
+      return ::operator new(size);
+    }
+    auto& cache = thread_cache();
+    if (cache.head) {
+      auto entry = cache.head;
+      cache.head = entry->next.load(std::memory_order_relaxed);
+      --cache.count;
+      return entry;
+    }
+    auto entry = global_list().Pop();
+    if (entry) {
+      return entry;
+    }
+    return ::operator new(kBlockSize);
+  }
+
+  static void operator delete(void* ptr, size_t size) {
+    if (!ptr) {
+      return;
+    }
+    if (size != sizeof(T)) {
+      ::operator delete(ptr);
+      return;
+    }
+    auto entry = reinterpret_cast<FreeListEntry*>(ptr);
+    auto& cache = thread_cache();
+    if (cache.count >= kMaxThreadCacheCount) {
+      global_list().Push(entry);
+      return;
+    }
+    entry->next.store(cache.head, std::memory_order_relaxed);
+    cache.head = entry;
+    ++cache.count;
+  }
+
+ private:
+  static const size_t kBlockSize = sizeof(T) > sizeof(FreeListEntry)
+                                       ? sizeof(T)
+                                       : sizeof(FreeListEntry);
+  static const size_t kMaxThreadCacheCount = 64;
+
+  struct ThreadCache {
+    FreeListEntry* head = nullptr;
+    size_t count = 0;
+    ~ThreadCache() {
+      // Hand everything back so other threads can reuse it.
+      while (head) {
+        auto entry = head;
+        head = entry->next.load(std::memory_order_relaxed);
+        global_list().Push(entry);
+      }
+    }
+  };
+
+  static ThreadCache& thread_cache() {
+    static thread_local ThreadCache cache;
+    return cache;
+  }
+  static AtomicFreeList& global_list() {
+    // Constant initialized, so usable from thread exit at any point.
+    static AtomicFreeList list;
+    return list;
+  }
+};
+
 }  // namespace xe
 
 #endif  // XENIA_BASE_TYPE_POOL_H_
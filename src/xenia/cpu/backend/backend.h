@@ -11,6 +11,7 @@
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
 #include <memory>
+#include <string>
 
 #include "xenia/cpu/backend/machine_info.h"
 
@@ -51,6 +52,33 @@ class Backend {
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
       Module* module, uint32_t address) = 0;
 
+  // Attaches any persisted machine code for the given module code range.
+  // Must be called after the code has been loaded into guest memory.
+  virtual void InitializeCodeCacheFile(const std::string& module_name,
+                                       uint32_t guest_low,
+                                       uint32_t guest_high) {}
+
+  // Attempts to define the function from previously persisted machine code.
+  // On success the function is ready for execution and translation can be
+  // skipped entirely.
+  virtual bool LoadCachedFunction(GuestFunction* function) { return false; }
+
+  // Whether the function was recorded as hot, in this or a previous run.
+  virtual bool IsHotFunction(GuestFunction* function) { return false; }
+  // Records the function as hot along with its current call count so that
+  // later runs can compile it with the hot pipeline up front.
+  virtual void RecordHotFunction(GuestFunction* function) {}
+
+  // Points every way of reaching the function's current code back at the
+  // resolver so the next call goes through Processor::ResolveFunction.
+  virtual void UnlinkFunction(GuestFunction* function) {}
+
+  // Patches a trap into the code of every function containing the guest
+  // address, including functions translated later, and reports hits to the
+  // debugger. Calls are counted; the trap stays until each is uninstalled.
+  virtual bool InstallBreakpoint(uint32_t guest_address) { return false; }
+  virtual void UninstallBreakpoint(uint32_t guest_address) {}
+
  protected:
   Processor* processor_;
   MachineInfo machine_info_;
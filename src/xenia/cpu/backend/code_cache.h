@@ -18,6 +18,17 @@ namespace xe {
 namespace cpu {
 namespace backend {
 
+// Unwind info returned by LookupUnwindInfo on platforms without a system
+// unwinder for generated code. Every placed function allocates its whole
+// frame with a single sub rsp in the prolog and frees it right before its
+// final ret or tail jmp.
+struct CodeUnwindInfo {
+  // Host address of the first instruction after the frame is allocated.
+  uint32_t prolog_end;
+  // Bytes allocated below the return address.
+  uint32_t stack_size;
+};
+
 class CodeCache {
  public:
   CodeCache() = default;
@@ -32,6 +43,7 @@ class CodeCache {
   virtual GuestFunction* LookupFunction(uint64_t host_pc) = 0;
 
   // Finds platform-specific function unwind info for the given host PC.
+  // This is a RUNTIME_FUNCTION on Windows and a CodeUnwindInfo elsewhere.
   virtual void* LookupUnwindInfo(uint64_t host_pc) = 0;
 };
 
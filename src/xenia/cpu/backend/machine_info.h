@@ -18,6 +18,8 @@ namespace backend {
 
 struct MachineInfo {
   bool supports_extended_load_store;
+  // Backend-specific host CPU feature bits, queried once at startup.
+  uint32_t host_feature_flags;
 
   struct RegisterSet {
     enum Types {
@@ -77,13 +77,21 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   void* machine_code = nullptr;
   size_t code_size = 0;
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size, &source_map_)) {
     return false;
   }
+  function->source_map().Assign(source_map_);
+
+  // Persist for later runs, if enabled and possible.
+  if (x64_backend_->code_cache_file_enabled() && emitter_->persistable()) {
+    x64_backend_->PersistFunction(
+        function, reinterpret_cast<uint8_t*>(machine_code), code_size,
+        emitter_->stack_size(), emitter_->image_relocations(), source_map_);
+  }
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
+    DumpMachineCode(machine_code, code_size, source_map_,
                     &string_buffer_);
     debug_info->set_machine_code_disasm(string_buffer_.ToString());
     string_buffer_.Reset();
@@ -100,6 +108,7 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   function->set_debug_info(std::move(debug_info));
   static_cast<X64Function*>(function)
       ->Setup(reinterpret_cast<uint8_t*>(machine_code), code_size);
+  x64_backend_->PatchBreakpoints(function);
 
   return true;
 }
@@ -126,7 +135,8 @@ void X64Assembler::DumpMachineCode(
     if (code_offset >= next_code_offset &&
         source_map_index < source_map.size()) {
       auto& source_map_entry = source_map[source_map_index];
-      str->AppendFormat("%.8X ", source_map_entry.source_offset);
+      str->AppendHex(source_map_entry.source_offset, 8);
+      str->Append(' ');
       ++source_map_index;
       next_code_offset = source_map_index < source_map.size()
                              ? source_map[source_map_index].code_offset
@@ -135,8 +145,8 @@ void X64Assembler::DumpMachineCode(
       str->Append("         ");
     }
 
-    str->AppendFormat("%.8X      %-6s %s\n", uint32_t(insn.address),
-                      insn.mnemonic, insn.op_str);
+    str->AppendHex(uint32_t(insn.address), 8);
+    str->AppendFormat("      %-6s %s\n", insn.mnemonic, insn.op_str);
   }
 }
 
@@ -51,6 +51,9 @@ class X64Assembler : public Assembler {
   uintptr_t capstone_handle_;
 
   StringBuffer string_buffer_;
+  // Uncompressed source map of the function being assembled. Kept around so
+  // the storage is reused between functions.
+  std::vector<SourceMapEntry> source_map_;
 };
 
 }  // namespace x64
@@ -9,23 +9,57 @@
 
 #include "xenia/cpu/backend/x64/x64_backend.h"
 
+#include <cstring>
+
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
+#include "xenia/cpu/backend/x64/x64_code_cache_file.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
 #include "xenia/cpu/backend/x64/x64_function.h"
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/frontend/ppc_context.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/debug/debugger.h"
 
 DEFINE_bool(
     enable_haswell_instructions, true,
     "Uses the AVX2/FMA/etc instructions on Haswell processors, if available.");
+DEFINE_string(code_cache_path, "",
+              "Persists emitted machine code to this path so that later runs "
+              "can skip translation. Disabled if empty.");
 
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
+// Version of the code generator persisted to code cache files.
+// Bump this whenever emitted code changes in a way not captured by the other
+// fingerprint inputs, such as sequence bodies or HIR pass behavior.
+static const uint32_t kCodeGenVersion = 3;
+
+// Hash of the HIR opcode table, which changes with the HIR definition.
+static uint64_t HashOpcodeTable() {
+  XXH64_state_t state;
+  XXH64_reset(&state, 0);
+  auto hash_opcode = [&state](const hir::OpcodeInfo& info) {
+    XXH64_update(&state, &info.num, sizeof(info.num));
+    XXH64_update(&state, &info.flags, sizeof(info.flags));
+    XXH64_update(&state, &info.signature, sizeof(info.signature));
+    XXH64_update(&state, info.name, std::strlen(info.name));
+  };
+#define DEFINE_OPCODE(num, name, sig, flags) hash_opcode(hir::num##_info);
+#include "xenia/cpu/hir/opcodes.inl"
+#undef DEFINE_OPCODE
+  return XXH64_digest(&state);
+}
+
 class X64ThunkEmitter : public X64Emitter {
  public:
   X64ThunkEmitter(X64Backend* backend, XbyakAllocator* allocator);
@@ -33,12 +67,20 @@ class X64ThunkEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+
+ private:
+  // Loads the MXCSR matching the guest FPSCR mode held in the given context.
+  void EmitLoadGuestMXCSR(const Xbyak::Reg64& context,
+                          const Xbyak::Reg64& scratch);
+  // Loads the MXCSR host code expects.
+  void EmitLoadHostMXCSR();
 };
 
 X64Backend::X64Backend(Processor* processor)
     : Backend(processor), code_cache_(nullptr), emitter_data_(0) {}
 
 X64Backend::~X64Backend() {
+  processor()->memory()->SetCodeBreakpointCallback(nullptr, nullptr);
   if (emitter_data_) {
     processor()->memory()->SystemHeapFree(emitter_data_);
     emitter_data_ = 0;
@@ -52,15 +94,33 @@ bool X64Backend::Initialize() {
 
   RegisterSequences();
 
-  // Need movbe to do advanced LOAD/STORE tricks.
+  // Query host features once; all emitters share the result.
+  machine_info_.host_feature_flags = 0;
   if (FLAGS_enable_haswell_instructions) {
     Xbyak::util::Cpu cpu;
-    machine_info_.supports_extended_load_store =
-        cpu.has(Xbyak::util::Cpu::tMOVBE);
-  } else {
-    machine_info_.supports_extended_load_store = false;
+    machine_info_.host_feature_flags =
+        (cpu.has(Xbyak::util::Cpu::tAVX2) ? kX64EmitAVX2 : 0) |
+        (cpu.has(Xbyak::util::Cpu::tFMA) ? kX64EmitFMA : 0) |
+        (cpu.has(Xbyak::util::Cpu::tLZCNT) ? kX64EmitLZCNT : 0) |
+        (cpu.has(Xbyak::util::Cpu::tBMI2) ? kX64EmitBMI2 : 0) |
+        (cpu.has(Xbyak::util::Cpu::tF16C) ? kX64EmitF16C : 0) |
+        (cpu.has(Xbyak::util::Cpu::tMOVBE) ? kX64EmitMovbe : 0);
+  }
+  {
+    // Not a Haswell feature; older CPUs decode prefetchw as a nop anyway.
+    Xbyak::util::Cpu cpu;
+    if (cpu.has(Xbyak::util::Cpu::tPREFETCHW)) {
+      machine_info_.host_feature_flags |= kX64EmitPrefetchW;
+    }
+  }
+  if (Clock::guest_tick_counter_is_tsc()) {
+    machine_info_.host_feature_flags |= kX64EmitInvariantTsc;
   }
 
+  // Need movbe to do advanced LOAD/STORE tricks.
+  machine_info_.supports_extended_load_store =
+      (machine_info_.host_feature_flags & kX64EmitMovbe) != 0;
+
   auto& gprs = machine_info_.register_sets[0];
   gprs.id = 0;
   std::strcpy(gprs.name, "gpr");
@@ -99,9 +159,285 @@ bool X64Backend::Initialize() {
   // Allocate emitter constant data.
   emitter_data_ = X64Emitter::PlaceData(processor()->memory());
 
+  code_cache_fingerprint_ = CalculateCodeCacheFingerprint();
+
+  code_breakpoints_supported_ =
+      processor()->memory()->SetCodeBreakpointCallback(CodeBreakpointThunk,
+                                                       this);
+
+  return true;
+}
+
+uint64_t X64Backend::CalculateCodeCacheFingerprint() {
+  // Everything baked into emitted code that is not relocated must be part of
+  // this, as must anything that changes what we would emit.
+  struct {
+    uint64_t host_to_guest_thunk;
+    uint64_t guest_to_host_thunk;
+    uint64_t resolve_function_thunk;
+    uint32_t emitter_data;
+    uint32_t feature_flags;
+    uint32_t codegen_version;
+    uint32_t context_size;
+    uint64_t thunk_stack_size;
+    uint64_t guest_stack_size;
+    uint64_t sequence_table_hash;
+    uint64_t opcode_table_hash;
+  } fingerprint_data;
+  std::memset(&fingerprint_data, 0, sizeof(fingerprint_data));
+  fingerprint_data.host_to_guest_thunk = uint64_t(host_to_guest_thunk_);
+  fingerprint_data.guest_to_host_thunk = uint64_t(guest_to_host_thunk_);
+  fingerprint_data.resolve_function_thunk = uint64_t(resolve_function_thunk_);
+  fingerprint_data.emitter_data = emitter_data_;
+  fingerprint_data.feature_flags = machine_info_.host_feature_flags;
+  fingerprint_data.codegen_version = kCodeGenVersion;
+  fingerprint_data.context_size = uint32_t(sizeof(frontend::PPCContext));
+  fingerprint_data.thunk_stack_size = StackLayout::THUNK_STACK_SIZE;
+  fingerprint_data.guest_stack_size = StackLayout::GUEST_STACK_SIZE;
+  fingerprint_data.sequence_table_hash = HashSequenceTable();
+  fingerprint_data.opcode_table_hash = HashOpcodeTable();
+  return XXH64(&fingerprint_data, sizeof(fingerprint_data), 0);
+}
+
+void X64Backend::InitializeCodeCacheFile(const std::string& module_name,
+                                         uint32_t guest_low,
+                                         uint32_t guest_high) {
+  if (!code_cache_file_enabled()) {
+    return;
+  }
+  auto guest_code = processor()->memory()->TranslateVirtual(guest_low);
+  auto cache_file = X64CodeCacheFile::Open(
+      xe::to_wstring(FLAGS_code_cache_path), module_name,
+      code_cache_fingerprint_, guest_low, guest_high, guest_code);
+  if (cache_file) {
+    code_cache_files_.push_back(std::move(cache_file));
+  }
+}
+
+X64CodeCacheFile* X64Backend::LookupCodeCacheFile(uint32_t guest_address) {
+  for (auto& cache_file : code_cache_files_) {
+    if (cache_file->ContainsAddress(guest_address)) {
+      return cache_file.get();
+    }
+  }
+  return nullptr;
+}
+
+bool X64Backend::LoadCachedFunction(GuestFunction* function) {
+  auto cache_file = LookupCodeCacheFile(function->address());
+  if (!cache_file) {
+    return false;
+  }
+  auto record = cache_file->Lookup(function->address());
+  if (!record) {
+    return false;
+  }
+  // Non-hot code has no call counters, so it would never get promoted.
+  if (FLAGS_hot_function_recompilation && !record->is_hot) {
+    return false;
+  }
+
+  // Ensure the guest code hasn't changed (patching/reloading/etc).
+  auto memory = processor()->memory();
+  uint64_t guest_hash = X64CodeCacheFile::HashGuestCode(
+      memory->TranslateVirtual(record->guest_address),
+      record->end_address + 4 - record->guest_address);
+  if (guest_hash != record->guest_hash) {
+    return false;
+  }
+
+  std::vector<uint8_t> machine_code(record->machine_code_length);
+  X64CodeCacheFile::Relocate(*record, machine_code.data());
+
+  function->set_end_address(record->end_address);
+  function->source_map().Assign(record->source_map, record->source_map_count);
+  auto code_address = code_cache_->PlaceGuestCode(
+      function->address(), machine_code.data(), machine_code.size(),
+      record->stack_size, function);
+  static_cast<X64Function*>(function)->Setup(
+      reinterpret_cast<uint8_t*>(code_address), machine_code.size());
+  PatchBreakpoints(function);
+  function->set_tier(record->is_hot ? GuestFunction::Tier::kHot
+                                    : GuestFunction::Tier::kOptimized);
+  return true;
+}
+
+bool X64Backend::IsHotFunction(GuestFunction* function) {
+  auto cache_file = LookupCodeCacheFile(function->address());
+  if (!cache_file) {
+    return false;
+  }
+  auto profile = cache_file->LookupProfile(function->address());
+  if (!profile) {
+    return false;
+  }
+  // The profile is stale if the guest code has changed.
+  auto memory = processor()->memory();
+  uint64_t guest_hash = X64CodeCacheFile::HashGuestCode(
+      memory->TranslateVirtual(profile->guest_address),
+      profile->end_address + 4 - profile->guest_address);
+  return guest_hash == profile->guest_hash;
+}
+
+void X64Backend::RecordHotFunction(GuestFunction* function) {
+  auto cache_file = LookupCodeCacheFile(function->address());
+  if (!cache_file) {
+    return;
+  }
+  auto memory = processor()->memory();
+  uint64_t guest_hash = X64CodeCacheFile::HashGuestCode(
+      memory->TranslateVirtual(function->address()),
+      function->end_address() + 4 - function->address());
+  cache_file->AppendProfile(function->address(), function->end_address(),
+                            guest_hash, function->call_count());
+}
+
+void X64Backend::UnlinkFunction(GuestFunction* function) {
+  code_cache_->UnlinkGuestCode(function->address());
+}
+
+bool X64Backend::InstallBreakpoint(uint32_t guest_address) {
+  if (!code_breakpoints_supported_) {
+    XELOGE("Code breakpoints are not supported on this host");
+    return false;
+  }
+  std::lock_guard<xe::mutex> guard(breakpoint_lock_);
+  if (breakpoints_[guest_address]++) {
+    // Already patched everywhere.
+    return true;
+  }
+  for (auto function : processor()->FindFunctionsWithAddress(guest_address)) {
+    if (function->is_guest()) {
+      PatchBreakpoint(static_cast<GuestFunction*>(function), guest_address);
+    }
+  }
+  return true;
+}
+
+void X64Backend::UninstallBreakpoint(uint32_t guest_address) {
+  std::lock_guard<xe::mutex> guard(breakpoint_lock_);
+  auto it = breakpoints_.find(guest_address);
+  if (it == breakpoints_.end() || --it->second) {
+    return;
+  }
+  breakpoints_.erase(it);
+  for (auto patch = patched_breakpoints_.begin();
+       patch != patched_breakpoints_.end();) {
+    if (patch->second.guest_address == guest_address) {
+      *reinterpret_cast<volatile uint8_t*>(patch->first) =
+          patch->second.original_byte;
+      patch = patched_breakpoints_.erase(patch);
+    } else {
+      ++patch;
+    }
+  }
+}
+
+void X64Backend::PatchBreakpoints(GuestFunction* function) {
+  std::lock_guard<xe::mutex> guard(breakpoint_lock_);
+  for (auto& it : breakpoints_) {
+    if (it.first >= function->address() &&
+        it.first <= function->end_address()) {
+      PatchBreakpoint(function, it.first);
+    }
+  }
+}
+
+bool X64Backend::PatchBreakpoint(GuestFunction* function,
+                                 uint32_t guest_address) {
+  if (!function->machine_code()) {
+    // Not yet translated; done when it is placed.
+    return false;
+  }
+  SourceMapEntry entry;
+  if (!function->LookupSourceOffset(guest_address, &entry)) {
+    return false;
+  }
+  // Code offsets are recorded one past the start of the instruction's code.
+  if (!entry.code_offset ||
+      entry.code_offset - 1 >= function->machine_code_length()) {
+    return false;
+  }
+  auto host_pc = function->machine_code() + entry.code_offset - 1;
+  if (patched_breakpoints_.count(uint64_t(host_pc))) {
+    // Shared with another guest address, or being stepped over.
+    return true;
+  }
+  PatchedBreakpoint patch;
+  patch.guest_address = guest_address;
+  patch.original_byte = *host_pc;
+  patched_breakpoints_.emplace(uint64_t(host_pc), patch);
+  // A single byte store is atomic with respect to executing threads.
+  *reinterpret_cast<volatile uint8_t*>(host_pc) = 0xCC;
   return true;
 }
 
+CodeBreakpointAction X64Backend::CodeBreakpointThunk(void* context_ptr,
+                                                     uint64_t host_pc,
+                                                     bool is_step_complete) {
+  return reinterpret_cast<X64Backend*>(context_ptr)
+      ->OnCodeBreakpoint(host_pc, is_step_complete);
+}
+
+CodeBreakpointAction X64Backend::OnCodeBreakpoint(uint64_t host_pc,
+                                                  bool is_step_complete) {
+  auto code = reinterpret_cast<volatile uint8_t*>(host_pc);
+  uint32_t guest_address;
+  {
+    std::lock_guard<xe::mutex> guard(breakpoint_lock_);
+    auto it = patched_breakpoints_.find(host_pc);
+    if (is_step_complete) {
+      // Re-arm, unless the breakpoint was removed while stepping.
+      if (it != patched_breakpoints_.end()) {
+        *code = 0xCC;
+      }
+      return CodeBreakpointAction::kResume;
+    }
+    if (it == patched_breakpoints_.end()) {
+      // Either an int3 of someone else's or one we removed after the thread
+      // trapped on it.
+      return *code == 0xCC ? CodeBreakpointAction::kNotHandled
+                           : CodeBreakpointAction::kResume;
+    }
+    guest_address = it->second.guest_address;
+  }
+
+  // Blocks until the debugger resumes this thread.
+  auto debugger = processor()->debugger();
+  if (debugger) {
+    debugger->OnBreakpointHit(guest_address);
+  }
+
+  // Run the original instruction with the trap lifted. Other threads may
+  // slip past the breakpoint during the step.
+  std::lock_guard<xe::mutex> guard(breakpoint_lock_);
+  auto it = patched_breakpoints_.find(host_pc);
+  if (it == patched_breakpoints_.end()) {
+    return CodeBreakpointAction::kResume;
+  }
+  *code = it->second.original_byte;
+  return CodeBreakpointAction::kStepOver;
+}
+
+void X64Backend::PersistFunction(
+    GuestFunction* function, const uint8_t* machine_code,
+    size_t machine_code_length, size_t stack_size,
+    const std::vector<uint32_t>& image_relocations,
+    const std::vector<SourceMapEntry>& source_map) {
+  auto cache_file = LookupCodeCacheFile(function->address());
+  if (!cache_file) {
+    return;
+  }
+  auto memory = processor()->memory();
+  uint64_t guest_hash = X64CodeCacheFile::HashGuestCode(
+      memory->TranslateVirtual(function->address()),
+      function->end_address() + 4 - function->address());
+  cache_file->Append(function->address(), function->end_address(), guest_hash,
+                     uint32_t(stack_size), machine_code, machine_code_length,
+                     image_relocations, source_map,
+                     function->tier() == GuestFunction::Tier::kHot);
+}
+
 void X64Backend::CommitExecutableRange(uint32_t guest_low,
                                        uint32_t guest_high) {
   code_cache_->CommitExecutableRange(guest_low, guest_high);
@@ -121,6 +457,29 @@ X64ThunkEmitter::X64ThunkEmitter(X64Backend* backend, XbyakAllocator* allocator)
 
 X64ThunkEmitter::~X64ThunkEmitter() {}
 
+// Thunk frames keep rsp + 32..47 free; the MXCSR is staged at rsp + 44 and
+// the host MXCSR on thunk entry is saved at rsp + 40.
+void X64ThunkEmitter::EmitLoadGuestMXCSR(const Xbyak::Reg64& context,
+                                         const Xbyak::Reg64& scratch) {
+  if (FLAGS_assume_default_fpscr_mode) {
+    EmitLoadHostMXCSR();
+    return;
+  }
+  mov(scratch.cvt32(),
+      dword[context + offsetof(frontend::PPCContext, fpscr)]);
+  and_(scratch.cvt32(), 7);
+  mov(eax, scratch.cvt32());
+  mov(scratch, reinterpret_cast<uint64_t>(kGuestMXCSRTable));
+  mov(eax, dword[scratch + rax * 4]);
+  mov(dword[rsp + 44], eax);
+  vldmxcsr(dword[rsp + 44]);
+}
+
+void X64ThunkEmitter::EmitLoadHostMXCSR() {
+  mov(dword[rsp + 44], kHostMXCSR);
+  vldmxcsr(dword[rsp + 44]);
+}
+
 HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   // rcx = target
   // rdx = arg0
@@ -154,11 +513,18 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   movaps(ptr[rsp + 256], xmm14);
   movaps(ptr[rsp + 272], xmm15);*/
 
+  // Guest code runs with the MXCSR matching its FPSCR; the host value is
+  // restored on the way out.
+  vstmxcsr(dword[rsp + 40]);
+  EmitLoadGuestMXCSR(rdx, r9);
+
   mov(rax, rcx);
   mov(rcx, rdx);
   mov(rdx, r8);
   call(rax);
 
+  vldmxcsr(dword[rsp + 40]);
+
   /*movaps(xmm6, ptr[rsp + 128]);
   movaps(xmm7, ptr[rsp + 144]);
   movaps(xmm8, ptr[rsp + 160]);
@@ -215,12 +581,22 @@ GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
 
   // TODO(benvanik): save things? XMM0-5?
 
+  // Host code expects the default MXCSR. The guest mode is reloaded from the
+  // context afterwards as the callee may have run guest code that changed it.
+  EmitLoadHostMXCSR();
+
   mov(rax, rdx);
   mov(rdx, r8);
   mov(r8, r9);
   mov(r9, r10);
   call(rax);
 
+  // rax = host return
+  mov(r10, rax);
+  mov(rcx, qword[rsp + 56]);
+  EmitLoadGuestMXCSR(rcx, r11);
+  mov(rax, r10);
+
   mov(rbx, qword[rsp + 48]);
   mov(rcx, qword[rsp + 56]);
   mov(rbp, qword[rsp + 64]);
@@ -263,10 +639,18 @@ ResolveFunctionThunk X64ThunkEmitter::EmitResolveFunctionThunk() {
   mov(qword[rsp + 104], r14);
   mov(qword[rsp + 112], r15);
 
+  EmitLoadHostMXCSR();
+
   mov(rdx, rbx);
   mov(rax, uint64_t(&ResolveFunction));
   call(rax);
 
+  // rax = resolved machine code
+  mov(r10, rax);
+  mov(rcx, qword[rsp + 56]);
+  EmitLoadGuestMXCSR(rcx, r11);
+  mov(rax, r10);
+
   mov(rbx, qword[rsp + 48]);
   mov(rcx, qword[rsp + 56]);
   mov(rbp, qword[rsp + 64]);
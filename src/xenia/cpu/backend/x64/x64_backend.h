@@ -13,10 +13,16 @@
 #include <gflags/gflags.h>
 
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/mmio_handler.h"
 
 DECLARE_bool(enable_haswell_instructions);
+DECLARE_string(code_cache_path);
 
 namespace xe {
 namespace cpu {
@@ -24,6 +30,7 @@ namespace backend {
 namespace x64 {
 
 class X64CodeCache;
+class X64CodeCacheFile;
 
 #define XENIA_HAS_X64_BACKEND 1
 
@@ -59,14 +66,64 @@ class X64Backend : public Backend {
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
+  // True if emitted code is being persisted to disk.
+  bool code_cache_file_enabled() const {
+    return !FLAGS_code_cache_path.empty();
+  }
+  void InitializeCodeCacheFile(const std::string& module_name,
+                               uint32_t guest_low,
+                               uint32_t guest_high) override;
+  bool LoadCachedFunction(GuestFunction* function) override;
+  bool IsHotFunction(GuestFunction* function) override;
+  void RecordHotFunction(GuestFunction* function) override;
+  void UnlinkFunction(GuestFunction* function) override;
+  bool InstallBreakpoint(uint32_t guest_address) override;
+  void UninstallBreakpoint(uint32_t guest_address) override;
+  // Patches installed breakpoints into newly placed code of the function.
+  void PatchBreakpoints(GuestFunction* function);
+  // Writes the emitted machine code of the function to the code cache file
+  // covering it, if any.
+  void PersistFunction(GuestFunction* function, const uint8_t* machine_code,
+                       size_t machine_code_length, size_t stack_size,
+                       const std::vector<uint32_t>& image_relocations,
+                       const std::vector<SourceMapEntry>& source_map);
+
  private:
+  uint64_t CalculateCodeCacheFingerprint();
+  X64CodeCacheFile* LookupCodeCacheFile(uint32_t guest_address);
+
+  // Writes an int3 over the first instruction emitted for the guest address.
+  // Must be called with breakpoint_lock_ held.
+  bool PatchBreakpoint(GuestFunction* function, uint32_t guest_address);
+  static CodeBreakpointAction CodeBreakpointThunk(void* context_ptr,
+                                                  uint64_t host_pc,
+                                                  bool is_step_complete);
+  CodeBreakpointAction OnCodeBreakpoint(uint64_t host_pc,
+                                        bool is_step_complete);
+
   std::unique_ptr<X64CodeCache> code_cache_;
+  uint64_t code_cache_fingerprint_ = 0;
+  std::vector<std::unique_ptr<X64CodeCacheFile>> code_cache_files_;
 
   uint32_t emitter_data_;
 
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+
+  // An int3 written over generated code.
+  struct PatchedBreakpoint {
+    uint32_t guest_address;
+    uint8_t original_byte;
+  };
+  // False if the host can't route int3s back to us; nothing is patched then.
+  bool code_breakpoints_supported_ = false;
+  xe::mutex breakpoint_lock_;
+  // Install counts by guest address.
+  std::unordered_map<uint32_t, uint32_t> breakpoints_;
+  // Every patched site by host address, including those in code that has
+  // since been replaced by a recompile but may still be running.
+  std::unordered_map<uint64_t, PatchedBreakpoint> patched_breakpoints_;
 };
 
 }  // namespace x64
@@ -9,10 +9,11 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
-#include <cstdlib>
+#include <algorithm>
 #include <cstring>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
@@ -79,8 +80,18 @@ bool X64CodeCache::Initialize() {
     return false;
   }
 
+  // Keep code and its lookups on the node the guest threads run on.
+  int numa_placement = xe::memory::numa_placement();
+  if (numa_placement != xe::memory::kNumaNodeAny) {
+    xe::memory::AdviseNumaPlacement(indirection_table_base_,
+                                    kIndirectionTableSize, numa_placement);
+    xe::memory::AdviseNumaPlacement(generated_code_base_, kGeneratedCodeSize,
+                                    numa_placement);
+  }
+
   // Preallocate the function map to a large, reasonable size.
-  generated_code_map_.reserve(kMaximumFunctionCount);
+  code_maps_.emplace_back(new CodeMap(kInitialFunctionCount));
+  code_map_ = code_maps_.back().get();
 
   return true;
 }
@@ -119,9 +130,17 @@ void* X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                         nullptr);
 }
 
+// Atomically points a rel32 displacement at the given target.
+static void LinkCallSite(uint8_t* rel32_address, uint32_t target) {
+  assert_zero(uintptr_t(rel32_address) & 0x3);
+  auto disp = int32_t(int64_t(target) - int64_t(uintptr_t(rel32_address) + 4));
+  xe::atomic_exchange(disp, reinterpret_cast<volatile int32_t*>(rel32_address));
+}
+
 void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
                                    size_t code_size, size_t stack_size,
-                                   GuestFunction* function_info) {
+                                   GuestFunction* function_info,
+                                   const std::vector<X64CallSite>& call_sites) {
   // Hold a lock while we bump the pointers up. This is important as the
   // unwind table requires entries AND code to be sorted in order.
   size_t low_mark;
@@ -132,6 +151,7 @@ void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
     std::lock_guard<xe::mutex> allocation_lock(allocation_mutex_);
 
     low_mark = generated_code_offset_;
+    EnsureGeneratedCodeSpace(code_size + 64);
 
     // Reserve code.
     // Always move the code to land on 16b alignment.
@@ -149,10 +169,8 @@ void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
 
     // Store in map. It is maintained in sorted order of host PC dependent on
     // us also being append-only.
-    generated_code_map_.emplace_back(
-        (uint64_t(code_address - generated_code_base_) << 32) |
-            generated_code_offset_,
-        function_info);
+    AddCodeMapEntry(uint32_t(code_address - generated_code_base_),
+                    uint32_t(generated_code_offset_), function_info);
   }
 
   // If we are going above the high water mark of committed memory, commit some
@@ -175,18 +193,104 @@ void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   PlaceCode(guest_address, machine_code, code_size, stack_size, code_address,
             unwind_reservation);
 
+  std::lock_guard<xe::mutex> call_site_lock(call_site_mutex_);
+
+  // Link our outgoing call sites to whatever their targets currently are.
+  // This happens before we are published so nothing can be executing them.
+  for (auto& call_site : call_sites) {
+    uint8_t* rel32_address = code_address + call_site.code_offset;
+    uint32_t target = *reinterpret_cast<uint32_t*>(
+        indirection_table_base_ +
+        (call_site.target_address - kIndirectionTableBase));
+    LinkCallSite(rel32_address, target);
+    call_sites_[call_site.target_address].push_back(rel32_address);
+  }
+
   // Now that everything is ready, fix up the indirection table.
   // Note that we do support code that doesn't have an indirection fixup, so
   // ignore those when we see them.
   if (guest_address) {
     uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
         indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot = uint32_t(reinterpret_cast<uint64_t>(code_address));
+    // A single atomic store switches callers over; threads already inside
+    // the old code finish running it.
+    uint32_t old_code = xe::atomic_exchange(
+        uint32_t(reinterpret_cast<uint64_t>(code_address)), indirection_slot);
+    if (old_code != indirection_default_value_) {
+      NoteSupersededCode(old_code);
+    }
+
+    // Relink everyone calling us (they may have been pointing at the resolve
+    // thunk or at a previous version of our code).
+    auto it = call_sites_.find(guest_address);
+    if (it != call_sites_.end()) {
+      for (auto rel32_address : it->second) {
+        LinkCallSite(rel32_address, *indirection_slot);
+      }
+    }
   }
 
   return code_address;
 }
 
+void X64CodeCache::EnsureGeneratedCodeSpace(size_t size) {
+  // Unwind info and alignment padding follow the code; callers include a
+  // margin for them.
+  if (generated_code_offset_ + xe::round_up(size, 16) <= kGeneratedCodeSize) {
+    return;
+  }
+  xe::FatalError(
+      "Generated code space exhausted (%lldMB used, %lldMB superseded by "
+      "recompiles)",
+      static_cast<long long>(generated_code_offset_ / (1024 * 1024)),
+      static_cast<long long>(superseded_code_size_ / (1024 * 1024)));
+}
+
+void X64CodeCache::NoteSupersededCode(uint32_t old_host_address) {
+  auto code_map = code_map_.load(std::memory_order_acquire);
+  uint32_t offset = uint32_t(old_host_address - kGeneratedCodeBase);
+  auto begin = code_map->entries.data();
+  auto end = begin + code_map->count.load(std::memory_order_acquire);
+  auto it = std::upper_bound(begin, end, offset,
+                             [](uint32_t offset, const CodeMapEntry& entry) {
+                               return offset < entry.code_start;
+                             });
+  if (it != begin && (it - 1)->code_start == offset) {
+    superseded_code_size_ += (it - 1)->code_end - offset;
+  }
+}
+
+void X64CodeCache::AddCodeMapEntry(uint32_t code_start, uint32_t code_end,
+                                   GuestFunction* function) {
+  auto code_map = code_map_.load(std::memory_order_relaxed);
+  size_t count = code_map->count.load(std::memory_order_relaxed);
+  assert_true(!count || code_map->entries[count - 1].code_end <= code_start);
+  if (count == code_map->entries.size()) {
+    auto new_code_map = new CodeMap(code_map->entries.size() * 2);
+    std::memcpy(new_code_map->entries.data(), code_map->entries.data(),
+                count * sizeof(CodeMapEntry));
+    new_code_map->count.store(count, std::memory_order_relaxed);
+    code_maps_.emplace_back(new_code_map);
+    code_map_.store(new_code_map, std::memory_order_release);
+    code_map = new_code_map;
+  }
+  code_map->entries[count] = {code_start, code_end, function};
+  code_map->count.store(count + 1, std::memory_order_release);
+}
+
+void X64CodeCache::UnlinkGuestCode(uint32_t guest_address) {
+  std::lock_guard<xe::mutex> call_site_lock(call_site_mutex_);
+  uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+      indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  *indirection_slot = indirection_default_value_;
+  auto it = call_sites_.find(guest_address);
+  if (it != call_sites_.end()) {
+    for (auto rel32_address : it->second) {
+      LinkCallSite(rel32_address, indirection_default_value_);
+    }
+  }
+}
+
 uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   // Hold a lock while we bump the pointers up.
   size_t high_mark;
@@ -194,6 +298,8 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   {
     std::lock_guard<xe::mutex> allocation_lock(allocation_mutex_);
 
+    EnsureGeneratedCodeSpace(length);
+
     // Reserve code.
     // Always move the code to land on 16b alignment.
     data_address = generated_code_base_ + generated_code_offset_;
@@ -222,30 +328,30 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
 }
 
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
-  uint32_t key = uint32_t(host_pc - kGeneratedCodeBase);
-  void* fn_entry = std::bsearch(
-      &key, generated_code_map_.data(), generated_code_map_.size() + 1,
-      sizeof(std::pair<uint32_t, Function*>),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key = *reinterpret_cast<const uint32_t*>(key_ptr);
-        auto element =
-            reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-                element_ptr);
-        if (key < (element->first >> 32)) {
-          return -1;
-        } else if (key > uint32_t(element->first)) {
-          return 1;
-        } else {
-          return 0;
-        }
-      });
-  if (fn_entry) {
-    return reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-               fn_entry)
-        ->second;
-  } else {
+  auto entry = LookupCodeMapEntry(host_pc);
+  return entry ? entry->function : nullptr;
+}
+
+const X64CodeCache::CodeMapEntry* X64CodeCache::LookupCodeMapEntry(
+    uint64_t host_pc) {
+  if (host_pc < uint64_t(generated_code_base_) ||
+      host_pc >= uint64_t(generated_code_base_) + kGeneratedCodeSize) {
+    return nullptr;
+  }
+  uint32_t offset = uint32_t(host_pc - uint64_t(generated_code_base_));
+  auto code_map = code_map_.load(std::memory_order_acquire);
+  auto begin = code_map->entries.data();
+  auto end = begin + code_map->count.load(std::memory_order_acquire);
+  // First entry starting after the PC; the one before it may contain it.
+  auto it = std::upper_bound(begin, end, offset,
+                             [](uint32_t offset, const CodeMapEntry& entry) {
+                               return offset < entry.code_start;
+                             });
+  if (it == begin) {
     return nullptr;
   }
+  --it;
+  return offset < it->code_end ? it : nullptr;
 }
 
 }  // namespace x64
@@ -14,6 +14,7 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -26,6 +27,14 @@ namespace cpu {
 namespace backend {
 namespace x64 {
 
+// A direct rel32 call/jmp to another guest function within placed code.
+struct X64CallSite {
+  // Offset of the 4b-aligned rel32 displacement from the code start.
+  uint32_t code_offset;
+  // Guest address of the function being called.
+  uint32_t target_address;
+};
+
 class X64CodeCache : public CodeCache {
  public:
   ~X64CodeCache() override;
@@ -49,28 +58,49 @@ class X64CodeCache : public CodeCache {
 
   void* PlaceHostCode(uint32_t guest_address, void* machine_code,
                       size_t code_size, size_t stack_size);
+  // Places guest code and publishes it in the indirection table.
+  // Any call_sites are linked directly to their targets if already placed or
+  // to the resolve thunk otherwise, and are relinked whenever their target is
+  // (re)placed.
   void* PlaceGuestCode(uint32_t guest_address, void* machine_code,
                        size_t code_size, size_t stack_size,
-                       GuestFunction* function_info);
+                       GuestFunction* function_info,
+                       const std::vector<X64CallSite>& call_sites = {});
   uint32_t PlaceData(const void* data, size_t length);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Whether the given guest address can be the target of a direct call site.
+  bool IsLinkableAddress(uint32_t guest_address) const {
+    return guest_address >= kIndirectionTableBase &&
+           guest_address < kIndirectionTableBase + kIndirectionTableSize;
+  }
+
+  // Unlinks the code placed for the given guest address: the indirection
+  // table and all direct call sites are pointed back at the resolve thunk so
+  // the next call will resolve the function again.
+  void UnlinkGuestCode(uint32_t guest_address);
+
+  // Bytes of generated code and data placed so far.
+  size_t generated_code_size() const { return generated_code_offset_; }
+  // Bytes of generated code that has been replaced by a recompile of the
+  // same function. The space is not reused as a thread may still be running
+  // the old code.
+  size_t superseded_code_size() const { return superseded_code_size_; }
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
   static const uint64_t kIndirectionTableBase = 0x80000000;
   static const uint64_t kIndirectionTableSize = 0x1FFFFFFF;
-  // The code range is 512MB, but we know the total code games will have is
-  // pretty small (dozens of mb at most) and our expansion is reasonablish
-  // so 256MB should be more than enough.
+  // The code range is 512MB and the whole of it is reserved up front. Pages
+  // are only committed as code is placed so the cost is address space alone.
+  // Tiered recompiles leave superseded code behind, so we need the headroom.
   static const uint64_t kGeneratedCodeBase = 0xA0000000;
-  static const uint64_t kGeneratedCodeSize = 0x0FFFFFFF;
+  static const uint64_t kGeneratedCodeSize = 0x1FFFFFFF;
 
-  // This is picked to be high enough to cover whatever we can reasonably
-  // expect. If we hit issues with this it probably means some corner case
-  // in analysis triggering.
-  static const size_t kMaximumFunctionCount = 30000;
+  // Initial capacity of the per-function tables. They grow when exceeded.
+  static const size_t kInitialFunctionCount = 30000;
 
   struct UnwindReservation {
     size_t data_size = 0;
@@ -109,10 +139,49 @@ class X64CodeCache : public CodeCache {
   size_t generated_code_offset_ = 0;
   // Current high water mark of COMMITTED code.
   std::atomic<size_t> generated_code_commit_mark_ = {0};
-  // Sorted map by host PC base offsets to source function info.
-  // This can be used to bsearch on host PC to find the guest function.
-  // The key is [start address | end address].
-  std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+  std::atomic<size_t> superseded_code_size_ = {0};
+  // Guards call_sites_ and the publishing of indirection entries, so that
+  // call sites and their targets are always linked consistently.
+  xe::mutex call_site_mutex_;
+  // Absolute addresses of every rel32 call site, by target guest address.
+  std::unordered_map<uint32_t, std::vector<uint8_t*>> call_sites_;
+
+  // Host code range of a placed function, as offsets from
+  // generated_code_base_. Ranges are [code_start, code_end) and include the
+  // unwind info that follows the code.
+  struct CodeMapEntry {
+    uint32_t code_start;
+    uint32_t code_end;
+    GuestFunction* function;
+  };
+  // Fixed capacity array of entries sorted by host PC. Entries below count
+  // are immutable once published.
+  struct CodeMap {
+    explicit CodeMap(size_t capacity) : entries(capacity) {}
+    std::vector<CodeMapEntry> entries;
+    std::atomic<size_t> count = {0};
+  };
+
+  // Aborts if placing size more bytes would overflow the generated code
+  // region. allocation_mutex_ must be held.
+  void EnsureGeneratedCodeSpace(size_t size);
+  // Accounts for the code previously published at the given host address
+  // being replaced.
+  void NoteSupersededCode(uint32_t old_host_address);
+  // Appends the range of newly placed code to the code map.
+  // allocation_mutex_ must be held.
+  void AddCodeMapEntry(uint32_t code_start, uint32_t code_end,
+                       GuestFunction* function);
+  // Finds the code map entry containing the given host PC without locking.
+  const CodeMapEntry* LookupCodeMapEntry(uint64_t host_pc);
+
+  // Map from host PC to source function used to find the guest function of
+  // a host frame. As code is only ever appended at increasing addresses the
+  // map stays sorted and readers can binary search it without locking.
+  // When full it is copied into a map twice the size; the old maps are kept
+  // alive as concurrent readers may still be searching them.
+  std::atomic<CodeMap*> code_map_ = {nullptr};
+  std::vector<std::unique_ptr<CodeMap>> code_maps_;
 };
 
 }  // namespace x64
@@ -0,0 +1,335 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/x64/x64_code_cache_file.h"
+
+#include <cstring>
+
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/string.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// 'XCC1'
+static const uint32_t kFileMagic = 0x31434358;
+// Bump whenever the file layout changes.
+static const uint32_t kFileVersion = 2;
+
+enum RecordFlags : uint32_t {
+  // Code was compiled with the hot pass pipeline.
+  kRecordFlagHot = 1 << 0,
+  // No code follows; the record only marks the function as hot.
+  kRecordFlagProfile = 1 << 1,
+};
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t fingerprint;
+  uint64_t guest_hash;
+  uint32_t guest_low;
+  uint32_t guest_high;
+};
+static_assert(sizeof(FileHeader) == 32, "header layout");
+
+struct RecordHeader {
+  uint32_t guest_address;
+  uint32_t end_address;
+  uint64_t guest_hash;
+  uint32_t stack_size;
+  uint32_t machine_code_length;
+  uint32_t image_relocation_count;
+  uint32_t source_map_count;
+  uint32_t flags;
+  uint32_t call_count;
+};
+static_assert(sizeof(RecordHeader) == 40, "record layout");
+
+// All image relocations are stored relative to this symbol. As the whole
+// executable image moves as a unit this lets us survive ASLR.
+static uint64_t image_anchor() {
+  return reinterpret_cast<uint64_t>(&kFileMagic);
+}
+
+X64CodeCacheFile::~X64CodeCacheFile() {
+  if (file_) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+uint64_t X64CodeCacheFile::HashGuestCode(const uint8_t* guest_code,
+                                         size_t length) {
+  return XXH64(guest_code, length, 0);
+}
+
+std::unique_ptr<X64CodeCacheFile> X64CodeCacheFile::Open(
+    const std::wstring& root_path, const std::string& module_name,
+    uint64_t fingerprint, uint32_t guest_low, uint32_t guest_high,
+    const uint8_t* guest_code) {
+  auto cache_file = std::unique_ptr<X64CodeCacheFile>(new X64CodeCacheFile());
+  cache_file->fingerprint_ = fingerprint;
+  cache_file->guest_low_ = guest_low;
+  cache_file->guest_high_ = guest_high;
+  cache_file->guest_hash_ = HashGuestCode(guest_code, guest_high - guest_low);
+
+  char file_name[256];
+  std::snprintf(file_name, xe::countof(file_name), "%s_%.16llX.xcc",
+                module_name.c_str(),
+                static_cast<unsigned long long>(cache_file->guest_hash_));
+  auto base_path = xe::to_absolute_path(root_path);
+  xe::filesystem::CreateFolder(base_path);
+  cache_file->path_ = xe::join_paths(base_path, xe::to_wstring(file_name));
+
+  // Only one instance appends to a file; the others use it read-only.
+  cache_file->write_lock_ =
+      xe::filesystem::FileLock::TryAcquire(cache_file->path_ + L".lock");
+
+  if (!cache_file->Load()) {
+    // Missing, truncated header, or stale. Start over.
+    cache_file->records_.clear();
+    cache_file->profile_records_.clear();
+    cache_file->file_data_.clear();
+    if (!cache_file->write_lock_) {
+      XELOGCPU("Code cache file %.8X-%.8X is owned by another instance and "
+               "not usable yet",
+               guest_low, guest_high);
+    } else if (!cache_file->Create()) {
+      XELOGE("Unable to create code cache file");
+      return nullptr;
+    }
+  }
+
+  XELOGCPU("Code cache file %.8X-%.8X: %d functions, %d hot", guest_low,
+           guest_high, int(cache_file->records_.size()),
+           int(cache_file->profile_records_.size()));
+  return cache_file;
+}
+
+bool X64CodeCacheFile::Load() {
+  if (!xe::filesystem::PathExists(path_)) {
+    return false;
+  }
+  FILE* file = xe::filesystem::OpenFile(path_, "rb");
+  if (!file) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (file_size < long(sizeof(FileHeader))) {
+    fclose(file);
+    return false;
+  }
+  file_data_.resize(file_size);
+  bool read_ok =
+      fread(file_data_.data(), 1, file_size, file) == size_t(file_size);
+  fclose(file);
+  if (!read_ok) {
+    return false;
+  }
+
+  auto header = reinterpret_cast<const FileHeader*>(file_data_.data());
+  if (header->magic != kFileMagic || header->version != kFileVersion ||
+      header->fingerprint != fingerprint_ ||
+      header->guest_hash != guest_hash_ || header->guest_low != guest_low_ ||
+      header->guest_high != guest_high_) {
+    return false;
+  }
+
+  // Walk records. A partial trailing record (from a crash mid-write) ends the
+  // walk and is overwritten by subsequent appends.
+  size_t offset = sizeof(FileHeader);
+  while (offset + sizeof(RecordHeader) <= file_data_.size()) {
+    auto record_header =
+        reinterpret_cast<const RecordHeader*>(file_data_.data() + offset);
+    size_t record_size =
+        sizeof(RecordHeader) +
+        xe::round_up(record_header->machine_code_length, 4) +
+        record_header->image_relocation_count * sizeof(uint32_t) +
+        record_header->source_map_count * sizeof(SourceMapEntry);
+    if (offset + record_size > file_data_.size()) {
+      break;
+    }
+    if (record_header->flags & kRecordFlagProfile) {
+      ProfileRecord profile;
+      profile.guest_address = record_header->guest_address;
+      profile.end_address = record_header->end_address;
+      profile.guest_hash = record_header->guest_hash;
+      profile.call_count = record_header->call_count;
+      profile_records_[profile.guest_address] = profile;
+      offset += record_size;
+      continue;
+    }
+    const uint8_t* p = file_data_.data() + offset + sizeof(RecordHeader);
+    FunctionRecord record;
+    record.guest_address = record_header->guest_address;
+    record.end_address = record_header->end_address;
+    record.guest_hash = record_header->guest_hash;
+    record.stack_size = record_header->stack_size;
+    record.machine_code = p;
+    record.machine_code_length = record_header->machine_code_length;
+    p += xe::round_up(record_header->machine_code_length, 4);
+    record.image_relocations = reinterpret_cast<const uint32_t*>(p);
+    record.image_relocation_count = record_header->image_relocation_count;
+    p += record_header->image_relocation_count * sizeof(uint32_t);
+    record.source_map = reinterpret_cast<const SourceMapEntry*>(p);
+    record.source_map_count = record_header->source_map_count;
+    record.is_hot = (record_header->flags & kRecordFlagHot) != 0;
+    records_[record.guest_address] = record;
+    offset += record_size;
+  }
+
+  if (!write_lock_) {
+    // Use whatever the writing instance has published so far. A partial
+    // record at the end is just one it is still writing.
+    return true;
+  }
+  if (offset == file_data_.size()) {
+    file_ = xe::filesystem::OpenFile(path_, "ab");
+    return file_ != nullptr;
+  }
+
+  // Partial tail; rewrite only the valid prefix so that new appends don't
+  // leave stale bytes behind.
+  file_ = xe::filesystem::OpenFile(path_, "wb");
+  if (!file_) {
+    return false;
+  }
+  fwrite(file_data_.data(), 1, offset, file_);
+  fflush(file_);
+  return true;
+}
+
+bool X64CodeCacheFile::Create() {
+  file_ = xe::filesystem::OpenFile(path_, "wb");
+  if (!file_) {
+    return false;
+  }
+  FileHeader header;
+  header.magic = kFileMagic;
+  header.version = kFileVersion;
+  header.fingerprint = fingerprint_;
+  header.guest_hash = guest_hash_;
+  header.guest_low = guest_low_;
+  header.guest_high = guest_high_;
+  fwrite(&header, sizeof(header), 1, file_);
+  fflush(file_);
+  return true;
+}
+
+const X64CodeCacheFile::FunctionRecord* X64CodeCacheFile::Lookup(
+    uint32_t guest_address) {
+  std::lock_guard<xe::mutex> guard(lock_);
+  auto it = records_.find(guest_address);
+  return it != records_.end() ? &it->second : nullptr;
+}
+
+const X64CodeCacheFile::ProfileRecord* X64CodeCacheFile::LookupProfile(
+    uint32_t guest_address) {
+  std::lock_guard<xe::mutex> guard(lock_);
+  auto it = profile_records_.find(guest_address);
+  return it != profile_records_.end() ? &it->second : nullptr;
+}
+
+void X64CodeCacheFile::Append(uint32_t guest_address, uint32_t end_address,
+                              uint64_t guest_hash, uint32_t stack_size,
+                              const uint8_t* machine_code,
+                              size_t machine_code_length,
+                              const std::vector<uint32_t>& image_relocations,
+                              const std::vector<SourceMapEntry>& source_map,
+                              bool is_hot) {
+  // Make image addresses anchor-relative before writing.
+  std::vector<uint8_t> code(xe::round_up(machine_code_length, 4), 0);
+  std::memcpy(code.data(), machine_code, machine_code_length);
+  for (auto offset : image_relocations) {
+    assert_true(offset + sizeof(uint64_t) <= machine_code_length);
+    uint64_t value;
+    std::memcpy(&value, code.data() + offset, sizeof(value));
+    value -= image_anchor();
+    std::memcpy(code.data() + offset, &value, sizeof(value));
+  }
+
+  RecordHeader record_header;
+  record_header.guest_address = guest_address;
+  record_header.end_address = end_address;
+  record_header.guest_hash = guest_hash;
+  record_header.stack_size = stack_size;
+  record_header.machine_code_length = uint32_t(machine_code_length);
+  record_header.image_relocation_count = uint32_t(image_relocations.size());
+  record_header.source_map_count = uint32_t(source_map.size());
+  record_header.flags = is_hot ? kRecordFlagHot : 0;
+  record_header.call_count = 0;
+
+  std::lock_guard<xe::mutex> guard(lock_);
+  if (!file_ || records_.count(guest_address) ||
+      !appended_addresses_.insert(guest_address).second) {
+    return;
+  }
+  fwrite(&record_header, sizeof(record_header), 1, file_);
+  fwrite(code.data(), 1, code.size(), file_);
+  if (!image_relocations.empty()) {
+    fwrite(image_relocations.data(), sizeof(uint32_t),
+           image_relocations.size(), file_);
+  }
+  if (!source_map.empty()) {
+    fwrite(source_map.data(), sizeof(SourceMapEntry), source_map.size(),
+           file_);
+  }
+  fflush(file_);
+}
+
+void X64CodeCacheFile::AppendProfile(uint32_t guest_address,
+                                     uint32_t end_address, uint64_t guest_hash,
+                                     uint32_t call_count) {
+  RecordHeader record_header;
+  std::memset(&record_header, 0, sizeof(record_header));
+  record_header.guest_address = guest_address;
+  record_header.end_address = end_address;
+  record_header.guest_hash = guest_hash;
+  record_header.flags = kRecordFlagProfile;
+  record_header.call_count = call_count;
+
+  std::lock_guard<xe::mutex> guard(lock_);
+  if (!file_ || profile_records_.count(guest_address)) {
+    return;
+  }
+  fwrite(&record_header, sizeof(record_header), 1, file_);
+  fflush(file_);
+  ProfileRecord profile;
+  profile.guest_address = guest_address;
+  profile.end_address = end_address;
+  profile.guest_hash = guest_hash;
+  profile.call_count = call_count;
+  profile_records_[guest_address] = profile;
+}
+
+void X64CodeCacheFile::Relocate(const FunctionRecord& record,
+                                uint8_t* target_buffer) {
+  std::memcpy(target_buffer, record.machine_code, record.machine_code_length);
+  for (uint32_t i = 0; i < record.image_relocation_count; ++i) {
+    uint32_t offset = record.image_relocations[i];
+    uint64_t value;
+    std::memcpy(&value, target_buffer + offset, sizeof(value));
+    value += image_anchor();
+    std::memcpy(target_buffer + offset, &value, sizeof(value));
+  }
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
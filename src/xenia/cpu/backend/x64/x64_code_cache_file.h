@@ -0,0 +1,147 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_X64_X64_CODE_CACHE_FILE_H_
+#define XENIA_CPU_BACKEND_X64_X64_CODE_CACHE_FILE_H_
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// On-disk store of emitted machine code for a single guest code range.
+// Files are append-only: each newly emitted function is written as a record
+// as soon as it is assembled so that a crash only loses the tail of the file.
+//
+// Files are keyed by a hash of the guest code range and by a fingerprint of
+// the backend (thunk addresses, CPU features, code generator version) so that
+// stale code is never reused. Each function record also carries a hash of
+// its guest instructions which is checked before the record is used.
+//
+// Functions found hot by --hot_function_recompilation additionally get a
+// profile record so that later runs can compile them with the hot pipeline
+// up front even if their code could not be persisted.
+//
+// Several emulator instances may share a cache directory. The first to open
+// a file holds its lock and appends to it; the others only read what had been
+// written at open time and never modify the file.
+//
+// Host image addresses embedded in the machine code (native helpers, static
+// tables) are stored relative to an anchor within the executable and rebased
+// on load. Code referencing any other host memory is never persisted.
+class X64CodeCacheFile {
+ public:
+  struct FunctionRecord {
+    uint32_t guest_address;
+    uint32_t end_address;
+    uint64_t guest_hash;
+    uint32_t stack_size;
+    const uint8_t* machine_code;
+    uint32_t machine_code_length;
+    // Offsets into machine_code of 8b anchor-relative image addresses.
+    const uint32_t* image_relocations;
+    uint32_t image_relocation_count;
+    const SourceMapEntry* source_map;
+    uint32_t source_map_count;
+    // Code was compiled with the hot pass pipeline.
+    bool is_hot;
+  };
+  struct ProfileRecord {
+    uint32_t guest_address;
+    uint32_t end_address;
+    uint64_t guest_hash;
+    // Calls observed when the function was found hot.
+    uint32_t call_count;
+  };
+
+  ~X64CodeCacheFile();
+
+  // Opens or creates the cache file for the guest range [guest_low,
+  // guest_high). If the existing file does not match the fingerprint it is
+  // discarded and recreated.
+  static std::unique_ptr<X64CodeCacheFile> Open(const std::wstring& root_path,
+                                                const std::string& module_name,
+                                                uint64_t fingerprint,
+                                                uint32_t guest_low,
+                                                uint32_t guest_high,
+                                                const uint8_t* guest_code);
+
+  uint32_t guest_low() const { return guest_low_; }
+  uint32_t guest_high() const { return guest_high_; }
+  bool ContainsAddress(uint32_t address) const {
+    return address >= guest_low_ && address < guest_high_;
+  }
+  size_t record_count() const { return records_.size(); }
+
+  // Returns the record for the given function, if present.
+  const FunctionRecord* Lookup(uint32_t guest_address);
+  // Returns the profile record for the given hot function, if present.
+  const ProfileRecord* LookupProfile(uint32_t guest_address);
+
+  // Appends a function to the file.
+  // image_relocations are offsets of absolute host image addresses embedded
+  // in machine_code that will be made anchor-relative.
+  void Append(uint32_t guest_address, uint32_t end_address,
+              uint64_t guest_hash, uint32_t stack_size,
+              const uint8_t* machine_code, size_t machine_code_length,
+              const std::vector<uint32_t>& image_relocations,
+              const std::vector<SourceMapEntry>& source_map, bool is_hot);
+  // Appends a profile record marking the function as hot.
+  void AppendProfile(uint32_t guest_address, uint32_t end_address,
+                     uint64_t guest_hash, uint32_t call_count);
+
+  // Copies the record machine code into target_buffer and rebases all image
+  // relocations to the current process.
+  static void Relocate(const FunctionRecord& record, uint8_t* target_buffer);
+
+  // Computes the hash used to validate guest instruction bytes.
+  static uint64_t HashGuestCode(const uint8_t* guest_code, size_t length);
+
+ private:
+  X64CodeCacheFile() = default;
+
+  bool Load();
+  bool Create();
+
+  std::wstring path_;
+  uint64_t fingerprint_ = 0;
+  uint64_t guest_hash_ = 0;
+  uint32_t guest_low_ = 0;
+  uint32_t guest_high_ = 0;
+
+  xe::mutex lock_;
+  // Held while this instance is the one appending to the file.
+  std::unique_ptr<xe::filesystem::FileLock> write_lock_;
+  FILE* file_ = nullptr;
+  // Contents of the file as loaded at open time. Records point into this.
+  std::vector<uint8_t> file_data_;
+  std::unordered_map<uint32_t, FunctionRecord> records_;
+  std::unordered_map<uint32_t, ProfileRecord> profile_records_;
+  // Functions appended by this instance. Recompiles of these within the same
+  // run are not written again.
+  std::unordered_set<uint32_t> appended_addresses_;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_X64_X64_CODE_CACHE_FILE_H_
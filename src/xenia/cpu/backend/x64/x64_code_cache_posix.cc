@@ -0,0 +1,110 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// Thunks spill their arguments before allocating their frame, so the
+// sub rsp is not always the first instruction.
+static const size_t kMaxPrologScanSize = 64;
+
+class PosixX64CodeCache : public X64CodeCache {
+ public:
+  PosixX64CodeCache() = default;
+  ~PosixX64CodeCache() override = default;
+
+  void* LookupUnwindInfo(uint64_t host_pc) override;
+
+ private:
+  UnwindReservation RequestUnwindReservation(uint8_t* entry_address) override;
+  void PlaceCode(uint32_t guest_address, void* machine_code, size_t code_size,
+                 size_t stack_size, void* code_address,
+                 UnwindReservation unwind_reservation) override;
+};
+
+std::unique_ptr<X64CodeCache> X64CodeCache::Create() {
+  return std::make_unique<PosixX64CodeCache>();
+}
+
+PosixX64CodeCache::UnwindReservation
+PosixX64CodeCache::RequestUnwindReservation(uint8_t* entry_address) {
+  UnwindReservation unwind_reservation;
+  unwind_reservation.data_size = xe::round_up(sizeof(CodeUnwindInfo), 16);
+  unwind_reservation.entry_address = entry_address;
+  return unwind_reservation;
+}
+
+// Returns the offset of the instruction following the sub rsp, stack_size
+// that allocates the frame, or 0 if the code has none.
+static size_t FindPrologEnd(const uint8_t* code, size_t code_size,
+                            size_t stack_size) {
+  size_t scan_size = std::min(code_size, kMaxPrologScanSize);
+  for (size_t i = 0; i + 4 <= scan_size; ++i) {
+    if (code[i] != 0x48 || code[i + 2] != 0xEC) {
+      continue;
+    }
+    if (code[i + 1] == 0x83 && code[i + 3] == stack_size) {
+      // sub rsp, imm8
+      return i + 4;
+    }
+    uint32_t imm32;
+    if (code[i + 1] == 0x81 && i + 7 <= scan_size) {
+      std::memcpy(&imm32, code + i + 3, sizeof(imm32));
+      if (imm32 == stack_size) {
+        // sub rsp, imm32
+        return i + 7;
+      }
+    }
+  }
+  return 0;
+}
+
+void PosixX64CodeCache::PlaceCode(uint32_t guest_address, void* machine_code,
+                                  size_t code_size, size_t stack_size,
+                                  void* code_address,
+                                  UnwindReservation unwind_reservation) {
+  // Written before the code is published, so any thread running the code
+  // (or a signal interrupting it) sees it.
+  auto unwind_info =
+      reinterpret_cast<CodeUnwindInfo*>(unwind_reservation.entry_address);
+  size_t prolog_end = 0;
+  if (stack_size) {
+    prolog_end = FindPrologEnd(reinterpret_cast<uint8_t*>(machine_code),
+                               code_size, stack_size);
+    assert_not_zero(prolog_end);
+  }
+  unwind_info->prolog_end =
+      uint32_t(reinterpret_cast<uintptr_t>(code_address) + prolog_end);
+  unwind_info->stack_size = uint32_t(stack_size);
+}
+
+void* PosixX64CodeCache::LookupUnwindInfo(uint64_t host_pc) {
+  // The unwind info is the last thing reserved for each function.
+  auto entry = LookupCodeMapEntry(host_pc);
+  if (!entry) {
+    return nullptr;
+  }
+  return generated_code_base_ + entry->code_end -
+         xe::round_up(sizeof(CodeUnwindInfo), 16);
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -51,7 +52,12 @@ class Win32X64CodeCache : public X64CodeCache {
   void InitializeUnwindEntry(uint8_t* unwind_entry_address,
                              size_t unwind_table_slot, void* code_address,
                              size_t code_size, size_t stack_size);
+  // Reallocates the unwind table with room for at least min_capacity
+  // entries. unwind_table_mutex_ must be held.
+  bool GrowUnwindTable(size_t min_capacity);
 
+  // Guards unwind_table_ storage, which moves when the table grows.
+  xe::mutex unwind_table_mutex_;
   // Growable function table system handle.
   void* unwind_table_handle_ = nullptr;
   // Actual unwind table entries.
@@ -84,23 +90,16 @@ bool Win32X64CodeCache::Initialize() {
     return false;
   }
 
-  // Compute total number of unwind entries we should allocate.
-  // We don't support reallocing right now, so this should be high.
-  unwind_table_.resize(kMaximumFunctionCount);
-
 #ifdef USE_GROWABLE_FUNCTION_TABLE
   // Create table and register with the system. It's empty now, but we'll grow
   // it as functions are added.
-  if (RtlAddGrowableFunctionTable(
-          &unwind_table_handle_, unwind_table_.data(), unwind_table_count_,
-          DWORD(unwind_table_.size()),
-          reinterpret_cast<ULONG_PTR>(generated_code_base_),
-          reinterpret_cast<ULONG_PTR>(generated_code_base_ +
-                                      kGeneratedCodeSize))) {
-    XELOGE("Unable to create unwind function table");
+  std::lock_guard<xe::mutex> lock(unwind_table_mutex_);
+  if (!GrowUnwindTable(kInitialFunctionCount)) {
     return false;
   }
 #else
+  unwind_table_.resize(kInitialFunctionCount);
+
   // Install a callback that the debugger will use to lookup unwind info on
   // demand.
   if (!RtlInstallFunctionTableCallback(
@@ -123,7 +122,7 @@ Win32X64CodeCache::UnwindReservation
 Win32X64CodeCache::RequestUnwindReservation(uint8_t* entry_address) {
   UnwindReservation unwind_reservation;
   unwind_reservation.data_size = xe::round_up(kUnwindInfoSize, 16);
-  unwind_reservation.table_slot = ++unwind_table_count_;
+  unwind_reservation.table_slot = unwind_table_count_++;
   unwind_reservation.entry_address = entry_address;
   return unwind_reservation;
 }
@@ -132,21 +131,62 @@ void Win32X64CodeCache::PlaceCode(uint32_t guest_address, void* machine_code,
                                   size_t code_size, size_t stack_size,
                                   void* code_address,
                                   UnwindReservation unwind_reservation) {
-  // Add unwind info.
-  InitializeUnwindEntry(unwind_reservation.entry_address,
-                        unwind_reservation.table_slot, code_address, code_size,
-                        stack_size);
+  {
+    std::lock_guard<xe::mutex> lock(unwind_table_mutex_);
+    // Slots are handed out under the allocation lock, so other threads may
+    // already hold slots past ours.
+    uint32_t table_count = unwind_table_count_;
+    if (table_count > unwind_table_.size() &&
+        !GrowUnwindTable(std::max(size_t(table_count),
+                                  unwind_table_.size() * 2))) {
+      xe::FatalError("Unable to grow unwind function table");
+    }
+
+    // Add unwind info.
+    InitializeUnwindEntry(unwind_reservation.entry_address,
+                          unwind_reservation.table_slot, code_address,
+                          code_size, stack_size);
 
 #ifdef USE_GROWABLE_FUNCTION_TABLE
-  // Notify that the unwind table has grown.
-  // We do this outside of the lock, but with the latest total count.
-  RtlGrowFunctionTable(unwind_table_handle_, unwind_table_count_);
+    // Notify that the unwind table has grown.
+    RtlGrowFunctionTable(unwind_table_handle_, table_count);
 #endif  // USE_GROWABLE_FUNCTION_TABLE
+  }
 
   // This isn't needed on x64 (probably), but is convention.
   FlushInstructionCache(GetCurrentProcess(), code_address, code_size);
 }
 
+bool Win32X64CodeCache::GrowUnwindTable(size_t min_capacity) {
+  std::vector<RUNTIME_FUNCTION> new_table(min_capacity);
+  std::memcpy(new_table.data(), unwind_table_.data(),
+              unwind_table_.size() * sizeof(RUNTIME_FUNCTION));
+
+#ifdef USE_GROWABLE_FUNCTION_TABLE
+  // Growable tables have a fixed maximum size so register a new one over the
+  // same range before dropping the old. Only fully written entries are
+  // published.
+  void* new_handle = nullptr;
+  if (RtlAddGrowableFunctionTable(
+          &new_handle, new_table.data(),
+          DWORD(std::min(size_t(unwind_table_count_), unwind_table_.size())),
+          DWORD(new_table.size()),
+          reinterpret_cast<ULONG_PTR>(generated_code_base_),
+          reinterpret_cast<ULONG_PTR>(generated_code_base_ +
+                                      kGeneratedCodeSize))) {
+    XELOGE("Unable to create unwind function table");
+    return false;
+  }
+  if (unwind_table_handle_) {
+    RtlDeleteGrowableFunctionTable(unwind_table_handle_);
+  }
+  unwind_table_handle_ = new_handle;
+#endif  // USE_GROWABLE_FUNCTION_TABLE
+
+  unwind_table_.swap(new_table);
+  return true;
+}
+
 // http://msdn.microsoft.com/en-us/library/ssa62fwe.aspx
 typedef enum _UNWIND_OP_CODES {
   UWOP_PUSH_NONVOL = 0, /* info == register number */
@@ -271,8 +311,10 @@ void Win32X64CodeCache::InitializeUnwindEntry(uint8_t* unwind_entry_address,
 }
 
 void* Win32X64CodeCache::LookupUnwindInfo(uint64_t host_pc) {
+  std::lock_guard<xe::mutex> lock(unwind_table_mutex_);
   return std::bsearch(
-      &host_pc, unwind_table_.data(), unwind_table_count_ + 1,
+      &host_pc, unwind_table_.data(),
+      std::min(size_t(unwind_table_count_), unwind_table_.size()),
       sizeof(RUNTIME_FUNCTION),
       [](const void* key_ptr, const void* element_ptr) {
         auto key =
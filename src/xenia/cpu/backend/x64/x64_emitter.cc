@@ -38,6 +38,18 @@ DEFINE_bool(enable_debugprint_log, false,
             "Log debugprint traps to the active debugger");
 DEFINE_bool(ignore_undefined_externs, false,
             "Don't exit when an undefined extern is called.");
+DEFINE_bool(direct_guest_calls, true,
+            "Link guest-to-guest calls directly to their targets instead of "
+            "going through the indirection table.");
+DEFINE_bool(inline_kernel_fast_paths, true,
+            "Emit the uncontended paths of critical section and spinlock "
+            "kernel exports inline at their call sites.");
+DEFINE_bool(fast_kernel_calls, true,
+            "Call exports tagged kFastCall directly with their arguments in "
+            "registers instead of through the guest-to-host thunk.");
+DEFINE_bool(bind_import_thunks, true,
+            "Call kernel exports directly from guest call sites instead of "
+            "calling the code translated for their import thunks.");
 
 namespace xe {
 namespace cpu {
@@ -61,21 +73,20 @@ const uint32_t X64Emitter::xmm_reg_map_[X64Emitter::XMM_COUNT] = {
     6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
 };
 
+// Exceptions stay masked and NI maps to FTZ | DAZ.
+// RN: 0 = nearest, 1 = toward zero, 2 = +inf, 3 = -inf
+// RC: 0 = nearest, 1 = -inf, 2 = +inf, 3 = toward zero
+const uint32_t X64Emitter::kGuestMXCSRTable[8] = {
+    0x1F80, 0x7F80, 0x5F80, 0x3F80, 0x9FC0, 0xFFC0, 0xDFC0, 0xBFC0,
+};
+
 X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
     : CodeGenerator(kMaxCodeSize, Xbyak::AutoGrow, allocator),
       processor_(backend->processor()),
       backend_(backend),
       code_cache_(backend->code_cache()),
-      allocator_(allocator) {
-  if (FLAGS_enable_haswell_instructions) {
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tAVX2) ? kX64EmitAVX2 : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tFMA) ? kX64EmitFMA : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tLZCNT) ? kX64EmitLZCNT : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tBMI2) ? kX64EmitBMI2 : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tF16C) ? kX64EmitF16C : 0;
-    feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tMOVBE) ? kX64EmitMovbe : 0;
-  }
-
+      allocator_(allocator),
+      feature_flags_(backend->machine_info()->host_feature_flags) {
   if (!cpu_.has(Xbyak::util::Cpu::tAVX)) {
     xe::FatalError(
         "Your CPU is too old to support Xenia. See the FAQ for system "
@@ -93,10 +104,14 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   SCOPE_profile_cpu_f("cpu");
 
   // Reset.
+  function_ = function;
   debug_info_ = debug_info;
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  persistable_ = debug_info_flags == 0;
+  image_relocations_.clear();
+  call_sites_.clear();
 
   // Fill the generator with code.
   size_t stack_size = 0;
@@ -122,8 +137,8 @@ void* X64Emitter::Emplace(size_t stack_size, GuestFunction* function) {
   uint8_t* old_address = top_;
   void* new_address;
   if (function) {
-    new_address = code_cache_->PlaceGuestCode(function->address(), top_, size_,
-                                              stack_size, function);
+    new_address = code_cache_->PlaceGuestCode(
+        function->address(), top_, size_, stack_size, function, call_sites_);
   } else {
     new_address = code_cache_->PlaceHostCode(0, top_, size_, stack_size);
   }
@@ -202,14 +217,25 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
 
+  // Code below the top tier counts its calls so hot functions get
+  // recompiled.
+  if (function_ && function_->recompile_threshold()) {
+    EmitCallCounter();
+  }
+
   // Load membase.
   mov(rdx, qword[rcx + 8]);
 
   // Body.
+  known_rounding_mode_ = -1;
   auto block = builder->first_block();
   while (block) {
     // Mark block labels.
     auto label = block->label_head;
+    if (label) {
+      // May be branched to with any mode.
+      known_rounding_mode_ = -1;
+    }
     while (label) {
       L(label->name);
       label = label->next;
@@ -265,14 +291,50 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
   }
 
   if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctionCoverage) {
-    uint32_t instruction_index =
-        (entry->source_offset - trace_data_->start_address()) / 4;
-    lock();
-    inc(qword[low_address(trace_data_->instruction_execute_counts() +
-                          instruction_index * 8)]);
+    EmitTraceInstructionCoverage(entry->source_offset);
   }
 }
 
+void X64Emitter::EmitTraceInstructionCoverage(uint32_t guest_address) {
+  uint32_t instruction_index =
+      (guest_address - trace_data_->start_address()) / 4;
+  auto counter = trace_data_->instruction_execute_counts() +
+                 instruction_index * trace_data_->instruction_counter_size();
+  Xbyak::Label skip_label;
+
+  // When sampling only calls whose count has the low bits clear are recorded.
+  // The count may be bumped by another thread mid-call, which is fine for
+  // statistics.
+  uint8_t sample_shift = trace_data_->instruction_sample_shift();
+  if (sample_shift) {
+    auto trace_header = trace_data_->header();
+    test(dword[low_address(&trace_header->function_call_count)],
+         uint32_t((1ull << sample_shift) - 1));
+    jnz(skip_label, T_NEAR);
+  }
+
+  // Narrow counters saturate rather than wrap and skip the bus lock; losing
+  // the odd racing increment is an acceptable trade for soak testing.
+  switch (trace_data_->instruction_counter_size()) {
+    case 1:
+      cmp(byte[low_address(counter)], 0xFF);
+      je(skip_label, T_NEAR);
+      inc(byte[low_address(counter)]);
+      break;
+    case 2:
+      cmp(word[low_address(counter)], 0xFFFF);
+      je(skip_label, T_NEAR);
+      inc(word[low_address(counter)]);
+      break;
+    default:
+      lock();
+      inc(qword[low_address(counter)]);
+      break;
+  }
+
+  L(skip_label);
+}
+
 void X64Emitter::EmitGetCurrentThreadId() {
   // rcx must point to context. We could fetch from the stack if needed.
   mov(ax,
@@ -281,6 +343,35 @@ void X64Emitter::EmitGetCurrentThreadId() {
 
 void X64Emitter::EmitTraceUserCallReturn() {}
 
+uint64_t RequestFunctionRecompile(void* raw_context, uint64_t function_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto function = reinterpret_cast<GuestFunction*>(function_ptr);
+  thread_state->processor()->QueueFunctionRecompile(function);
+  return 0;
+}
+
+void X64Emitter::EmitCallCounter() {
+  // The counter lives in the function object on the heap.
+  MarkNotPersistable();
+
+  // rdx is free until membase is loaded.
+  Xbyak::Label skip_label;
+  // A plain increment: an atomic one would make the counter of every hot
+  // function a cache line all calling threads contend on. Increments racing
+  // on other threads may be lost, which only delays the recompile. Each store
+  // is one more than some earlier value, so the threshold is never skipped;
+  // it may be hit more than once, and repeated requests are ignored.
+  mov(rdx, reinterpret_cast<uint64_t>(function_->call_count_address()));
+  mov(eax, dword[rdx]);
+  inc(eax);
+  mov(dword[rdx], eax);
+  // Only the call that reaches the threshold requests the recompile.
+  cmp(eax, function_->recompile_threshold());
+  jne(skip_label);
+  CallNative(RequestFunctionRecompile, reinterpret_cast<uint64_t>(function_));
+  L(skip_label);
+}
+
 void X64Emitter::DebugBreak() {
   // TODO(benvanik): notify debugger.
   db(0xCC);
@@ -358,11 +449,156 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
 
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
+  // The callee may change the mode.
+  known_rounding_mode_ = -1;
+  if (function->behavior() != Function::Behavior::kExtern) {
+    EmitCall(instr, function);
+    return;
+  }
+
+  Xbyak::Label slow;
+  Xbyak::Label done;
+  if (FLAGS_inline_kernel_fast_paths && EmitExternFastPath(function, slow)) {
+    if (instr->flags & hir::CALL_TAIL) {
+      // The export would have returned to our caller.
+      jmp(epilog_label(), CodeGenerator::T_NEAR);
+    } else {
+      jmp(done, CodeGenerator::T_NEAR);
+    }
+    L(slow);
+  }
+  if (FLAGS_bind_import_thunks) {
+    // Import thunks are just sc; blr, so make the extern call here instead
+    // of calling into the thunk, which then never needs translating.
+    CallExtern(instr, function);
+    if (instr->flags & hir::CALL_TAIL) {
+      jmp(epilog_label(), CodeGenerator::T_NEAR);
+    }
+  } else {
+    EmitCall(instr, function);
+  }
+  L(done);
+}
+
+// Layout of X_RTL_CRITICAL_SECTION as kept by the xboxkrnl shims. lock_count
+// is in host byte order, the rest is big-endian.
+const uint32_t kCriticalSectionLockCountOffset = 0x10;
+const uint32_t kCriticalSectionRecursionCountOffset = 0x14;
+const uint32_t kCriticalSectionOwningThreadOffset = 0x18;
+
+bool X64Emitter::EmitExternFastPath(GuestFunction* function,
+                                    Xbyak::Label& slow) {
+  // The argument is in r3, which was stored to the context for the call.
+  // r9 = host address of the object it points at.
+  auto load_r3_address = [this]() {
+    mov(eax, dword[rcx + offsetof(cpu::frontend::PPCContext, r) + 3 * 8]);
+    lea(r9, ptr[rdx + rax]);
+  };
+  const auto& name = function->name();
+  if (name == "RtlEnterCriticalSection") {
+    // Take the lock if it is free; recursion and contention are left to the
+    // shim.
+    load_r3_address();
+    mov(eax, -1);
+    xor_(r8d, r8d);
+    lock();
+    cmpxchg(dword[r9 + kCriticalSectionLockCountOffset], r8d);
+    jne(slow, CodeGenerator::T_NEAR);
+    mov(eax, dword[rcx + offsetof(cpu::frontend::PPCContext, thread_id)]);
+    bswap(eax);
+    mov(dword[r9 + kCriticalSectionOwningThreadOffset], eax);
+    mov(dword[r9 + kCriticalSectionRecursionCountOffset],
+        xe::byte_swap(uint32_t(1)));
+    return true;
+  } else if (name == "RtlLeaveCriticalSection") {
+    // Release a lock held once with nobody waiting; anything else is left
+    // to the shim. The lock is still ours until lock_count drops, so the
+    // owner can be put back if it turns out there are waiters. Like the
+    // shim, pending APCs are delivered once the lock is released.
+    auto check_apcs_handler = processor()->check_apcs_handler();
+    if (!check_apcs_handler) {
+      return false;
+    }
+    load_r3_address();
+    cmp(dword[r9 + kCriticalSectionRecursionCountOffset],
+        xe::byte_swap(uint32_t(1)));
+    jne(slow, CodeGenerator::T_NEAR);
+    mov(r8d, dword[r9 + kCriticalSectionOwningThreadOffset]);
+    mov(dword[r9 + kCriticalSectionOwningThreadOffset], 0);
+    mov(dword[r9 + kCriticalSectionRecursionCountOffset], 0);
+    xor_(eax, eax);
+    mov(r10d, -1);
+    lock();
+    cmpxchg(dword[r9 + kCriticalSectionLockCountOffset], r10d);
+    Xbyak::Label released;
+    je(released);
+    mov(dword[r9 + kCriticalSectionOwningThreadOffset], r8d);
+    mov(dword[r9 + kCriticalSectionRecursionCountOffset],
+        xe::byte_swap(uint32_t(1)));
+    jmp(slow, CodeGenerator::T_NEAR);
+    L(released);
+    // APCs may run guest code, so go through the thunk as CallExtern does.
+    // rcx = context
+    // rdx = target host function
+    MovImageAddress(rdx, reinterpret_cast<void*>(check_apcs_handler));
+    mov(r8, qword[rcx + offsetof(cpu::frontend::PPCContext, kernel_state)]);
+    auto thunk = backend()->guest_to_host_thunk();
+    mov(rax, reinterpret_cast<uint64_t>(thunk));
+    call(rax);
+    ReloadECX();
+    ReloadEDX();
+    known_rounding_mode_ = -1;
+    return true;
+  } else if (name == "KeAcquireSpinLockAtRaisedIrql") {
+    load_r3_address();
+    xor_(eax, eax);
+    mov(r8d, 1);
+    lock();
+    cmpxchg(dword[r9], r8d);
+    jne(slow, CodeGenerator::T_NEAR);
+    return true;
+  } else if (name == "KeReleaseSpinLockFromRaisedIrql") {
+    load_r3_address();
+    lock();
+    dec(dword[r9]);
+    return true;
+  }
+  return false;
+}
+
+void X64Emitter::EmitCall(const hir::Instr* instr, GuestFunction* function) {
   auto fn = static_cast<X64Function*>(function);
+  if (FLAGS_direct_guest_calls && !backend()->code_cache_file_enabled() &&
+      code_cache_->IsLinkableAddress(function->address())) {
+    // Emit a rel32 call/jmp that the code cache links to the target (or the
+    // resolve thunk until the target is compiled). It gets relinked whenever
+    // the target is replaced, so recompiled targets are fine here.
+    // NOTE: the displacement depends on where everything was placed, so this
+    // is never done when persisting code.
+    // ebx must hold the target for the resolve thunk.
+    mov(ebx, function->address());
+    if (instr->flags & hir::CALL_TAIL) {
+      EmitTraceUserCallReturn();
+      mov(rdx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+      add(rsp, static_cast<uint32_t>(stack_size()));
+      EmitDirectCallSite(0xE9, function->address());
+    } else {
+      mov(rdx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+      EmitDirectCallSite(0xE8, function->address());
+    }
+    return;
+  }
+
   // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
+  if (fn->machine_code() && !fn->recompile_threshold() &&
+      !backend()->code_cache_file_enabled() &&
+      !FLAGS_invalidate_modified_code) {
     // TODO(benvanik): is it worth it to do this? It removes the need for
     // a ResolveFunction call, but makes the table less useful.
+    // NOTE: the target's placement differs between runs, so when persisting
+    // code we always go through the (fixed) indirection table instead.
+    // Targets that will be recompiled (or may be invalidated) also use the
+    // table.
     assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
     mov(eax, uint32_t(uint64_t(fn->machine_code())));
   } else {
@@ -391,8 +627,20 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   }
 }
 
+void X64Emitter::EmitDirectCallSite(uint8_t opcode, uint32_t target_address) {
+  // Align the displacement so that it can be atomically relinked while other
+  // threads may be executing it. Code is placed 16b aligned so offsets hold.
+  while ((getSize() + 1) & 0x3) {
+    nop();
+  }
+  db(opcode);
+  call_sites_.push_back({static_cast<uint32_t>(getSize()), target_address});
+  dd(0);
+}
+
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
+  known_rounding_mode_ = -1;
   // Check if return.
   if (instr->flags & hir::CALL_POSSIBLE_RETURN) {
     cmp(reg.cvt32(), dword[rsp + StackLayout::GUEST_RET_ADDR]);
@@ -437,11 +685,15 @@ uint64_t UndefinedCallExtern(void* raw_context, uint64_t function_ptr) {
   return 0;
 }
 void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
+  // Externs may run guest callbacks.
+  known_rounding_mode_ = -1;
   bool undefined = true;
   if (function->behavior() == Function::Behavior::kBuiltin) {
     auto builtin_function = static_cast<const BuiltinFunction*>(function);
     if (builtin_function->handler()) {
       undefined = false;
+      // arg0/arg1 are arbitrary host pointers.
+      MarkNotPersistable();
       // rcx = context
       // rdx = target host function
       // r8  = arg0
@@ -458,11 +710,28 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   } else if (function->behavior() == Function::Behavior::kExtern) {
     auto extern_function = static_cast<const GuestFunction*>(function);
-    if (extern_function->extern_handler()) {
+    if (FLAGS_fast_kernel_calls && extern_function->extern_fast_handler()) {
+      undefined = false;
+      // The export never re-enters guest code, so skip the thunk and pass
+      // the arguments in registers.
+      // rcx = context
+      // rdx = r3
+      // r8  = r4
+      // r9  = r5
+      mov(rdx, qword[rcx + offsetof(cpu::frontend::PPCContext, r) + 3 * 8]);
+      mov(r8, qword[rcx + offsetof(cpu::frontend::PPCContext, r) + 4 * 8]);
+      mov(r9, qword[rcx + offsetof(cpu::frontend::PPCContext, r) + 5 * 8]);
+      MovImageAddress(
+          rax, reinterpret_cast<void*>(extern_function->extern_fast_handler()));
+      call(rax);
+      ReloadECX();
+      ReloadEDX();
+    } else if (extern_function->extern_handler()) {
       undefined = false;
       // rcx = context
       // rdx = target host function
-      mov(rdx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovImageAddress(
+          rdx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(r8, qword[rcx + offsetof(cpu::frontend::PPCContext, kernel_state)]);
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
@@ -473,38 +742,43 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNotPersistable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
 
 void X64Emitter::CallNative(void* fn) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovImageAddress(rax, fn);
   call(rax);
   ReloadECX();
   ReloadEDX();
+  known_rounding_mode_ = -1;
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovImageAddress(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
+  known_rounding_mode_ = -1;
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0)) {
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovImageAddress(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
+  known_rounding_mode_ = -1;
 }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0),
                             uint64_t arg0) {
   mov(rdx, arg0);
-  mov(rax, reinterpret_cast<uint64_t>(fn));
+  MovImageAddress(rax, reinterpret_cast<void*>(fn));
   call(rax);
   ReloadECX();
   ReloadEDX();
+  known_rounding_mode_ = -1;
 }
 
 void X64Emitter::CallNativeSafe(void* fn) {
@@ -513,12 +787,13 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // r8  = arg0
   // r9  = arg1
   // r10 = arg2
-  mov(rdx, reinterpret_cast<uint64_t>(fn));
+  MovImageAddress(rdx, fn);
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
   call(rax);
   ReloadECX();
   ReloadEDX();
+  known_rounding_mode_ = -1;
   // rax = host return
 }
 
@@ -526,6 +801,16 @@ void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], value);
 }
 
+void X64Emitter::MovImageAddress(const Xbyak::Reg64& dest,
+                                 const void* address) {
+  // Always use the 10b REX.W B8+r imm64 form (xbyak may pick a shorter one
+  // based on the value) so that the relocation is a fixed size.
+  db(0x48 | (dest.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (dest.getIdx() & 7));
+  image_relocations_.push_back(static_cast<uint32_t>(getSize()));
+  dq(reinterpret_cast<uint64_t>(address));
+}
+
 void X64Emitter::ReloadECX() {
   mov(rcx, qword[rsp + StackLayout::GUEST_RCX_HOME]);
 }
@@ -657,6 +942,14 @@ uint32_t X64Emitter::PlaceData(Memory* memory) {
                                            0x80000000u, 0x80000000u),
       /* XMMShortMinPS          */ vec128f(SHRT_MIN),
       /* XMMShortMaxPS          */ vec128f(SHRT_MAX),
+      /* XMMShlByteMask4        */ vec128b(0xF0),
+      /* XMMShlByteMask2        */ vec128b(0xFC),
+      /* XMMShrByteMask4        */ vec128b(0x0F),
+      /* XMMShrByteMask2        */ vec128b(0x3F),
+      /* XMMShrByteMask1        */ vec128b(0x7F),
+      /* XMMShaByteSign4        */ vec128b(0x08),
+      /* XMMShaByteSign2        */ vec128b(0x20),
+      /* XMMShaByteSign1        */ vec128b(0x40),
   };
   uint32_t ptr = memory->SystemHeapAlloc(sizeof(xmm_consts));
   std::memcpy(memory->TranslateVirtual(ptr), xmm_consts, sizeof(xmm_consts));
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/hir/hir_builder.h"
 #include "xenia/cpu/hir/instr.h"
@@ -36,7 +37,6 @@ namespace backend {
 namespace x64 {
 
 class X64Backend;
-class X64CodeCache;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
@@ -89,6 +89,14 @@ enum XmmConst {
   XMMSignMaskF32,
   XMMShortMinPS,
   XMMShortMaxPS,
+  XMMShlByteMask4,
+  XMMShlByteMask2,
+  XMMShrByteMask4,
+  XMMShrByteMask2,
+  XMMShrByteMask1,
+  XMMShaByteSign4,
+  XMMShaByteSign2,
+  XMMShaByteSign1,
 };
 
 // Unfortunately due to the design of xbyak we have to pass this to the ctor.
@@ -104,6 +112,9 @@ enum X64EmitterFeatureFlags {
   kX64EmitBMI2 = 1 << 4,
   kX64EmitF16C = 1 << 5,
   kX64EmitMovbe = 1 << 6,
+  // The guest clock is derived from an invariant TSC, so mftb can be inlined.
+  kX64EmitInvariantTsc = 1 << 7,
+  kX64EmitPrefetchW = 1 << 8,
 };
 
 class X64Emitter : public Xbyak::CodeGenerator {
@@ -169,6 +180,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
                   uint64_t arg0);
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
+  // Loads the address of a function or static data within the host executable
+  // into dest. The address is recorded as a relocation for persistence.
+  void MovImageAddress(const Xbyak::Reg64& dest, const void* address);
   void ReloadECX();
   void ReloadEDX();
 
@@ -192,13 +206,44 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   DebugInfo* debug_info() const { return debug_info_; }
 
+  // Whether the last emitted function only references host memory that can be
+  // relocated in another process (see MovImageAddress).
+  bool persistable() const { return persistable_; }
+  // Marks the function being emitted as referencing process-specific host
+  // memory (heap objects/etc) that will not be valid in another run.
+  void MarkNotPersistable() { persistable_ = false; }
+  // Code offsets of all image addresses embedded by MovImageAddress.
+  const std::vector<uint32_t>& image_relocations() const {
+    return image_relocations_;
+  }
+
   size_t stack_size() const { return stack_size_; }
 
+  // MXCSR for each guest FPSCR mode (RN | NI << 2).
+  static const uint32_t kGuestMXCSRTable[8];
+  // MXCSR host code runs with: round to nearest, all exceptions masked.
+  static const uint32_t kHostMXCSR = 0x1F80;
+
+  // Guest FPSCR mode bits (RN | NI << 2) the host MXCSR is known to hold at
+  // the current emit position, or -1 if unknown. Known modes carry across
+  // fallthrough blocks but not labels or calls.
+  int32_t known_rounding_mode() const { return known_rounding_mode_; }
+  void set_known_rounding_mode(int32_t mode) { known_rounding_mode_ = mode; }
+
  protected:
   void* Emplace(size_t stack_size, GuestFunction* function = nullptr);
   bool Emit(hir::HIRBuilder* builder, size_t* out_stack_size);
   void EmitGetCurrentThreadId();
+  void EmitCallCounter();
   void EmitTraceUserCallReturn();
+  void EmitTraceInstructionCoverage(uint32_t guest_address);
+  // Emits a rel32 call (E8) or jmp (E9) to be linked by the code cache.
+  void EmitDirectCallSite(uint8_t opcode, uint32_t target_address);
+  // Emits the common case of some kernel exports inline, branching to slow
+  // when the export has to be called after all. Returns false if function
+  // has no fast path.
+  bool EmitExternFastPath(GuestFunction* function, Xbyak::Label& slow);
+  void EmitCall(const hir::Instr* instr, GuestFunction* function);
 
  protected:
   Processor* processor_ = nullptr;
@@ -212,12 +257,18 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   hir::Instr* current_instr_ = nullptr;
 
+  GuestFunction* function_ = nullptr;
   DebugInfo* debug_info_ = nullptr;
   uint32_t debug_info_flags_ = 0;
   debug::FunctionTraceData* trace_data_ = nullptr;
   Arena source_map_arena_;
 
   size_t stack_size_ = 0;
+  int32_t known_rounding_mode_ = -1;
+
+  bool persistable_ = true;
+  std::vector<uint32_t> image_relocations_;
+  std::vector<X64CallSite> call_sites_;
 
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
@@ -27,13 +27,17 @@
 #include <algorithm>
 #include <cstring>
 #include <unordered_map>
+#include <vector>
 
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
+#include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
+#include "xenia/cpu/frontend/ppc_context.h"
 #include "xenia/cpu/hir/hir_builder.h"
 #include "xenia/cpu/processor.h"
 
@@ -648,6 +652,142 @@ const Reg64 GetTempReg<Reg64>(X64Emitter& e) {
   return e.rax;
 }
 
+// Whether the compare only feeds the conditional branch right after it. The
+// compare then just sets flags and the branch jumps on them directly.
+bool IsFusedCompare(const Instr* i) {
+  auto next = i->next;
+  return i->opcode->num >= OPCODE_COMPARE_EQ &&
+         i->opcode->num <= OPCODE_COMPARE_UGE && next &&
+         (next->opcode == &OPCODE_BRANCH_TRUE_info ||
+          next->opcode == &OPCODE_BRANCH_FALSE_info) &&
+         next->src1.value == i->dest && !i->dest->use_head->next;
+}
+
+// Emits a jump on the flags left by a fused compare, if the branch has one.
+bool EmitFusedBranch(X64Emitter& e, const Instr* branch, bool on_true) {
+  auto compare = branch->prev;
+  if (!compare || !IsFusedCompare(compare)) {
+    return false;
+  }
+  // x86 condition code encodings; XOR 1 negates.
+  enum : uint32_t {
+    kB = 2,
+    kAE = 3,
+    kE = 4,
+    kNE = 5,
+    kBE = 6,
+    kA = 7,
+    kL = 12,
+    kGE = 13,
+    kLE = 14,
+    kG = 15,
+  };
+  bool is_float = compare->src1.value->type == FLOAT32_TYPE ||
+                  compare->src1.value->type == FLOAT64_TYPE;
+  uint32_t cc;
+  switch (compare->opcode->num) {
+    case OPCODE_COMPARE_EQ:
+      cc = kE;
+      break;
+    case OPCODE_COMPARE_NE:
+      cc = kNE;
+      break;
+    case OPCODE_COMPARE_SLT:
+      cc = is_float ? kB : kL;
+      break;
+    case OPCODE_COMPARE_SLE:
+      cc = is_float ? kBE : kLE;
+      break;
+    case OPCODE_COMPARE_SGT:
+      cc = is_float ? kA : kG;
+      break;
+    case OPCODE_COMPARE_SGE:
+      cc = is_float ? kAE : kGE;
+      break;
+    case OPCODE_COMPARE_ULT:
+      cc = kB;
+      break;
+    case OPCODE_COMPARE_ULE:
+      cc = kBE;
+      break;
+    case OPCODE_COMPARE_UGT:
+      cc = kA;
+      break;
+    case OPCODE_COMPARE_UGE:
+      cc = kAE;
+      break;
+    default:
+      assert_unhandled_case(compare->opcode->num);
+      return false;
+  }
+  if (!is_float && compare->src1.value->IsConstant()) {
+    // Integer compares against a constant are emitted with swapped operands.
+    switch (cc) {
+      case kB:
+        cc = kA;
+        break;
+      case kBE:
+        cc = kAE;
+        break;
+      case kA:
+        cc = kB;
+        break;
+      case kAE:
+        cc = kBE;
+        break;
+      case kL:
+        cc = kG;
+        break;
+      case kLE:
+        cc = kGE;
+        break;
+      case kG:
+        cc = kL;
+        break;
+      case kGE:
+        cc = kLE;
+        break;
+    }
+  }
+  if (!on_true) {
+    cc ^= 1;
+  }
+  auto& label = branch->src2.label->name;
+  switch (cc) {
+    case kB:
+      e.jb(label, e.T_NEAR);
+      break;
+    case kAE:
+      e.jae(label, e.T_NEAR);
+      break;
+    case kE:
+      e.je(label, e.T_NEAR);
+      break;
+    case kNE:
+      e.jne(label, e.T_NEAR);
+      break;
+    case kBE:
+      e.jbe(label, e.T_NEAR);
+      break;
+    case kA:
+      e.ja(label, e.T_NEAR);
+      break;
+    case kL:
+      e.jl(label, e.T_NEAR);
+      break;
+    case kGE:
+      e.jge(label, e.T_NEAR);
+      break;
+    case kLE:
+      e.jle(label, e.T_NEAR);
+      break;
+    case kG:
+      e.jg(label, e.T_NEAR);
+      break;
+  }
+  return true;
+}
+
 template <typename T>
 void Register() {
   sequence_table.insert({T::head_key(), T::Select});
@@ -670,6 +810,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
+      e.MarkNotPersistable();
       e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
@@ -1125,6 +1266,9 @@ EMITTER_OPCODE_TABLE(OPCODE_BRANCH, BRANCH);
 struct BRANCH_TRUE_I8
     : Sequence<BRANCH_TRUE_I8, I<OPCODE_BRANCH_TRUE, VoidOp, I8Op, LabelOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitFusedBranch(e, i.instr, true)) {
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jnz(i.src2.value->name, e.T_NEAR);
   }
@@ -1174,6 +1318,9 @@ EMITTER_OPCODE_TABLE(OPCODE_BRANCH_TRUE, BRANCH_TRUE_I8, BRANCH_TRUE_I16,
 struct BRANCH_FALSE_I8
     : Sequence<BRANCH_FALSE_I8, I<OPCODE_BRANCH_FALSE, VoidOp, I8Op, LabelOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitFusedBranch(e, i.instr, false)) {
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jz(i.src2.value->name, e.T_NEAR);
   }
@@ -1602,12 +1749,11 @@ struct LOAD_VECTOR_SHL_I8
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
-      e.movzx(e.rdx, i.src1);
-      e.and_(e.dx, 0xF);
-      e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsl_table);
-      e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
-      e.ReloadEDX();
+      e.movzx(e.eax, i.src1);
+      e.and_(e.eax, 0xF);
+      e.shl(e.eax, 4);
+      e.mov(e.r8, (uintptr_t)lvsl_table);
+      e.vmovaps(i.dest, e.ptr[e.r8 + e.rax]);
     }
   }
 };
@@ -1644,12 +1790,11 @@ struct LOAD_VECTOR_SHR_I8
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
-      e.movzx(e.rdx, i.src1);
-      e.and_(e.dx, 0xF);
-      e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsr_table);
-      e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
-      e.ReloadEDX();
+      e.movzx(e.eax, i.src1);
+      e.and_(e.eax, 0xF);
+      e.shl(e.eax, 4);
+      e.mov(e.r8, (uintptr_t)lvsr_table);
+      e.vmovaps(i.dest, e.ptr[e.r8 + e.rax]);
     }
   }
 };
@@ -1660,9 +1805,43 @@ EMITTER_OPCODE_TABLE(OPCODE_LOAD_VECTOR_SHR, LOAD_VECTOR_SHR_I8);
 // ============================================================================
 struct LOAD_CLOCK : Sequence<LOAD_CLOCK, I<OPCODE_LOAD_CLOCK, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // It'd be cool to call QueryPerformanceCounter directly, but w/e.
-    e.CallNative(LoadClock);
+    if (!e.IsFeatureEnabled(kX64EmitInvariantTsc)) {
+      e.CallNative(LoadClock);
+      e.mov(i.dest, e.rax);
+      return;
+    }
+    // Same as Clock::QueryGuestTickCount:
+    // tick_base + (((max(rdtsc - counter_base, 0)) * multiplier) >> 32)
+    // The transform must be loaded before the counter is read, or a counter
+    // read before a transform was published would be below its base. rdtsc
+    // isn't ordered with loads so the lfence is needed too.
+    // The transform's entry may be rewritten while we read it, so its
+    // sequence is checked to be even before and unchanged after the field
+    // loads (loads are not reordered with each other on x64), else retry.
+    Xbyak::Label read;
+    e.MovImageAddress(e.r9, Clock::guest_tick_transform_address());
+    e.L(read);
+    e.mov(e.r8, e.qword[e.r9]);
+    e.mov(e.r10, e.qword[e.r8 + offsetof(Clock::GuestTickTransform, sequence)]);
+    e.test(e.r10d, 1);
+    e.jnz(read);
+    e.lfence();
+    e.rdtsc();
+    e.shl(e.rdx, 32);
+    e.or_(e.rax, e.rdx);
+    // TSCs of different cores may still be slightly apart.
+    e.xor_(e.edx, e.edx);
+    e.sub(e.rax,
+          e.qword[e.r8 + offsetof(Clock::GuestTickTransform, counter_base)]);
+    e.cmovb(e.rax, e.rdx);
+    e.mul(e.qword[e.r8 + offsetof(Clock::GuestTickTransform, multiplier)]);
+    e.shrd(e.rax, e.rdx, 32);
+    e.add(e.rax,
+          e.qword[e.r8 + offsetof(Clock::GuestTickTransform, tick_base)]);
+    e.cmp(e.r10, e.qword[e.r8 + offsetof(Clock::GuestTickTransform, sequence)]);
+    e.jne(read);
     e.mov(i.dest, e.rax);
+    e.ReloadEDX();
   }
   static uint64_t LoadClock(void* raw_context) {
     return Clock::QueryGuestTickCount();
@@ -2017,6 +2196,8 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkNotPersistable();
     e.mov(e.r8, uint64_t(mmio_range->callback_context));
     e.mov(e.r9d, read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -2042,6 +2223,8 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkNotPersistable();
     e.mov(e.r8, uint64_t(mmio_range->callback_context));
     e.mov(e.r9d, write_address);
     if (i.src3.is_constant) {
@@ -2083,6 +2266,36 @@ RegExp ComputeMemoryAddress(X64Emitter& e, const T& guest) {
     return e.rdx + e.rax;
   }
 }
+// Accesses at sites that have faulted on MMIO ranges go through these instead
+// of faulting again. Values are in guest memory byte order.
+uint64_t CheckedLoadI32(void* raw_context, uint64_t address) {
+  uint32_t value;
+  if (MMIOHandler::global_handler()->CheckLoad(uint32_t(address), &value)) {
+    // MMIO callbacks produce host order.
+    return xe::byte_swap(value);
+  }
+  auto context = reinterpret_cast<frontend::PPCContext*>(raw_context);
+  return xe::load<uint32_t>(context->virtual_membase + uint32_t(address));
+}
+uint64_t CheckedStoreI32(void* raw_context, uint64_t address, uint64_t value) {
+  if (MMIOHandler::global_handler()->CheckStore(
+          uint32_t(address), xe::byte_swap(uint32_t(value)))) {
+    return 0;
+  }
+  auto context = reinterpret_cast<frontend::PPCContext*>(raw_context);
+  xe::store<uint32_t>(context->virtual_membase + uint32_t(address),
+                      uint32_t(value));
+  return 0;
+}
+template <typename T>
+void SetupCheckedAddress(X64Emitter& e, const T& guest) {
+  if (guest.is_constant) {
+    e.mov(e.r8d, static_cast<uint32_t>(guest.constant()));
+  } else {
+    e.mov(e.r8d, guest.reg().cvt32());
+  }
+}
+
 struct LOAD_I8 : Sequence<LOAD_I8, I<OPCODE_LOAD, I8Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
@@ -2116,6 +2329,15 @@ struct LOAD_I16 : Sequence<LOAD_I16, I<OPCODE_LOAD, I16Op, I64Op>> {
 };
 struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_CHECK_MMIO) {
+      SetupCheckedAddress(e, i.src1);
+      e.CallNativeSafe(reinterpret_cast<void*>(CheckedLoadI32));
+      if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+        e.bswap(e.eax);
+      }
+      e.mov(i.dest, e.eax);
+      return;
+    }
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
@@ -2248,6 +2470,23 @@ struct STORE_I16 : Sequence<STORE_I16, I<OPCODE_STORE, VoidOp, I64Op, I16Op>> {
 };
 struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_CHECK_MMIO) {
+      SetupCheckedAddress(e, i.src1);
+      if (i.src2.is_constant) {
+        uint32_t value = i.src2.constant();
+        if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+          value = xe::byte_swap(value);
+        }
+        e.mov(e.r9d, value);
+      } else {
+        e.mov(e.r9d, i.src2);
+        if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+          e.bswap(e.r9d);
+        }
+      }
+      e.CallNativeSafe(reinterpret_cast<void*>(CheckedStoreI32));
+      return;
+    }
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src2.is_constant);
@@ -2371,7 +2610,17 @@ EMITTER_OPCODE_TABLE(OPCODE_STORE, STORE_I8, STORE_I16, STORE_I32, STORE_I64,
 struct PREFETCH
     : Sequence<PREFETCH, I<OPCODE_PREFETCH, VoidOp, I64Op, OffsetOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): prefetch addr -> length.
+    // Host lines are 64b, so one prefetch per host line in the range.
+    // Prefetches never fault, so no checking is needed on the address.
+    auto addr = ComputeMemoryAddress(e, i.src1);
+    for (size_t offset = 0; offset < i.src2.offset; offset += 64) {
+      if ((i.instr->flags & PREFETCH_STORE) &&
+          e.IsFeatureEnabled(kX64EmitPrefetchW)) {
+        e.prefetchw(e.ptr[addr + offset]);
+      } else {
+        e.prefetcht0(e.ptr[addr + offset]);
+      }
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_PREFETCH, PREFETCH);
@@ -2381,7 +2630,20 @@ EMITTER_OPCODE_TABLE(OPCODE_PREFETCH, PREFETCH);
 // ============================================================================
 struct MEMORY_BARRIER
     : Sequence<MEMORY_BARRIER, I<OPCODE_MEMORY_BARRIER, VoidOp>> {
-  static void Emit(X64Emitter& e, const EmitArgType& i) { e.mfence(); }
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    switch (i.instr->flags) {
+      case MEMORY_BARRIER_LIGHTWEIGHT:
+      case MEMORY_BARRIER_STORE:
+        // x86-TSO already keeps loads and stores to normal memory in order
+        // except for stores against later loads, so no fence is needed. The
+        // instruction itself is volatile and still stops the optimizer from
+        // moving memory accesses across it.
+        break;
+      default:
+        e.mfence();
+        break;
+    }
+  }
 };
 EMITTER_OPCODE_TABLE(OPCODE_MEMORY_BARRIER, MEMORY_BARRIER);
 
@@ -2395,27 +2657,27 @@ struct MEMSET_I64_I8_I64
     assert_true(i.src2.is_constant);
     assert_true(i.src3.is_constant);
     assert_true(i.src2.constant() == 0);
+    // The VEX xor clears all of ymm0.
     e.vpxor(e.xmm0, e.xmm0);
     auto addr = ComputeMemoryAddress(e, i.src1);
     switch (i.src3.constant()) {
       case 32:
-        e.vmovaps(e.ptr[addr + 0 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 1 * 16], e.xmm0);
+        // Guest blocks are aligned to their size and the membase is page
+        // aligned, so full width aligned stores are safe.
+        e.vmovaps(e.ptr[addr + 0 * 32], e.ymm0);
         break;
       case 128:
-        e.vmovaps(e.ptr[addr + 0 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 1 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 2 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 3 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 4 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 5 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 6 * 16], e.xmm0);
-        e.vmovaps(e.ptr[addr + 7 * 16], e.xmm0);
+        e.vmovaps(e.ptr[addr + 0 * 32], e.ymm0);
+        e.vmovaps(e.ptr[addr + 1 * 32], e.ymm0);
+        e.vmovaps(e.ptr[addr + 2 * 32], e.ymm0);
+        e.vmovaps(e.ptr[addr + 3 * 32], e.ymm0);
         break;
       default:
         assert_unhandled_case(i.src3.constant());
         break;
     }
+    // Avoid SSE/AVX transition stalls in any host code called later.
+    e.vzeroupper();
     if (IsTracingData()) {
       addr = ComputeMemoryAddress(e, i.src1);
       e.mov(e.r9, i.src3.constant());
@@ -2881,7 +3143,9 @@ struct COMPARE_EQ_I8
                                       const Reg8& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg8& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I16
@@ -2891,7 +3155,9 @@ struct COMPARE_EQ_I16
                                       const Reg16& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg16& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I32
@@ -2901,7 +3167,9 @@ struct COMPARE_EQ_I32
                                       const Reg32& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg32& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I64
@@ -2911,21 +3179,27 @@ struct COMPARE_EQ_I64
                                       const Reg64& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg64& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_F32
     : Sequence<COMPARE_EQ_F32, I<OPCODE_COMPARE_EQ, I8Op, F32Op, F32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.vcomiss(i.src1, i.src2);
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_F64
     : Sequence<COMPARE_EQ_F64, I<OPCODE_COMPARE_EQ, I8Op, F64Op, F64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.vcomisd(i.src1, i.src2);
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_COMPARE_EQ, COMPARE_EQ_I8, COMPARE_EQ_I16,
@@ -2942,7 +3216,9 @@ struct COMPARE_NE_I8
                                       const Reg8& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg8& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I16
@@ -2952,7 +3228,9 @@ struct COMPARE_NE_I16
                                       const Reg16& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg16& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I32
@@ -2962,7 +3240,9 @@ struct COMPARE_NE_I32
                                       const Reg32& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg32& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I64
@@ -2972,21 +3252,27 @@ struct COMPARE_NE_I64
                                       const Reg64& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg64& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_F32
     : Sequence<COMPARE_NE_F32, I<OPCODE_COMPARE_NE, I8Op, F32Op, F32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.vcomiss(i.src1, i.src2);
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_F64
     : Sequence<COMPARE_NE_F64, I<OPCODE_COMPARE_NE, I8Op, F64Op, F64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.vcomisd(i.src1, i.src2);
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_COMPARE_NE, COMPARE_NE_I8, COMPARE_NE_I16,
@@ -3002,20 +3288,29 @@ EMITTER_OPCODE_TABLE(OPCODE_COMPARE_NE, COMPARE_NE_I8, COMPARE_NE_I16,
       : Sequence<COMPARE_##op##_##type,                                 \
                  I<OPCODE_COMPARE_##op, I8Op, type, type>> {            \
     static void Emit(X64Emitter& e, const EmitArgType& i) {             \
+      bool fused = IsFusedCompare(i.instr);                             \
       EmitAssociativeCompareOp(                                         \
           e, i,                                                         \
-          [](X64Emitter& e, const Reg8& dest, const reg_type& src1,     \
-             const reg_type& src2, bool inverse) {                      \
+          [fused](X64Emitter& e, const Reg8& dest,                      \
+                  const reg_type& src1, const reg_type& src2,           \
+                  bool inverse) {                                       \
             e.cmp(src1, src2);                                          \
+            if (fused) {                                                \
+              return;                                                   \
+            }                                                           \
             if (!inverse) {                                             \
               e.instr(dest);                                            \
             } else {                                                    \
               e.inverse_instr(dest);                                    \
             }                                                           \
           },                                                            \
-          [](X64Emitter& e, const Reg8& dest, const reg_type& src1,     \
-             int32_t constant, bool inverse) {                          \
+          [fused](X64Emitter& e, const Reg8& dest,                      \
+                  const reg_type& src1, int32_t constant,               \
+                  bool inverse) {                                       \
             e.cmp(src1, constant);                                      \
+            if (fused) {                                                \
+              return;                                                   \
+            }                                                           \
             if (!inverse) {                                             \
               e.instr(dest);                                            \
             } else {                                                    \
@@ -3048,7 +3343,9 @@ EMITTER_ASSOCIATIVE_COMPARE_XX(UGE, setae, setbe);
                  I<OPCODE_COMPARE_##op, I8Op, F32Op, F32Op>> {        \
     static void Emit(X64Emitter& e, const EmitArgType& i) {           \
       e.vcomiss(i.src1, i.src2);                                      \
-      e.instr(i.dest);                                                \
+      if (!IsFusedCompare(i.instr)) {                                 \
+        e.instr(i.dest);                                              \
+      }                                                               \
     }                                                                 \
   };                                                                  \
   struct COMPARE_##op##_F64                                           \
@@ -3064,7 +3361,9 @@ EMITTER_ASSOCIATIVE_COMPARE_XX(UGE, setae, setbe);
       } else {                                                        \
         e.vcomisd(i.src1, i.src2);                                    \
       }                                                               \
-      e.instr(i.dest);                                                \
+      if (!IsFusedCompare(i.instr)) {                                 \
+        e.instr(i.dest);                                              \
+      }                                                               \
     }                                                                 \
   };                                                                  \
   EMITTER_OPCODE_TABLE(OPCODE_COMPARE_##op##_FLT, COMPARE_##op##_F32, \
@@ -3409,40 +3708,6 @@ EMITTER_OPCODE_TABLE(OPCODE_ADD_CARRY, ADD_CARRY_I8, ADD_CARRY_I16,
 // ============================================================================
 struct VECTOR_ADD
     : Sequence<VECTOR_ADD, I<OPCODE_VECTOR_ADD, V128Op, V128Op, V128Op>> {
-  static __m128i EmulateVectorAddUnsignedSatI32(void*, __m128i src1,
-                                                __m128i src2) {
-    alignas(16) uint32_t a[4];
-    alignas(16) uint32_t b[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(b), src2);
-    for (size_t i = 0; i < 4; ++i) {
-      uint64_t v = (uint64_t)a[i] + (uint64_t)b[i];
-      if (v > 0xFFFFFFFF) {
-        a[i] = 0xFFFFFFFF;
-      } else {
-        a[i] = (uint32_t)v;
-      }
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(a));
-  }
-  static __m128i EmulateVectorAddSignedSatI32(void*, __m128i src1,
-                                              __m128i src2) {
-    alignas(16) int32_t a[4];
-    alignas(16) int32_t b[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(b), src2);
-    for (size_t i = 0; i < 4; ++i) {
-      int64_t v = (int64_t)a[i] + (int64_t)b[i];
-      if (v > 0x7FFFFFFF) {
-        a[i] = 0x7FFFFFFF;
-      } else if (v < -0x80000000ll) {
-        a[i] = 0x80000000;
-      } else {
-        a[i] = (uint32_t)v;
-      }
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(a));
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     EmitCommutativeBinaryXmmOp(e, i, [&i](X64Emitter& e, const Xmm& dest,
                                           const Xmm& src1, const Xmm& src2) {
@@ -3477,72 +3742,28 @@ struct VECTOR_ADD
           break;
         case INT32_TYPE:
           if (saturate) {
+            // One of src1/src2 may be xmm0 (a loaded constant), so it's only
+            // written once both have been consumed.
             if (is_unsigned) {
-              // TODO(benvanik): broken with UINT32MAX+1
-              //// We reuse all these temps...
-              // assert_true(src1 != e.xmm0 && src1 != e.xmm1 && src1 !=
-              // e.xmm2);
-              // assert_true(src2 != e.xmm0 && src2 != e.xmm1 && src2 !=
-              // e.xmm2);
-              //// Clamp to 0xFFFFFFFF.
-              //// Wish there was a vpaddusd...
-              //// | A | B | C | D |
-              //// |     B |     D |
-              // e.vpsllq(e.xmm0, src1, 32);
-              // e.vpsllq(e.xmm1, src2, 32);
-              // e.vpsrlq(e.xmm0, 32);
-              // e.vpsrlq(e.xmm1, 32);
-              // e.vpaddq(e.xmm0, e.xmm1);
-              // e.vpcmpgtq(e.xmm0, e.GetXmmConstPtr(XMMUnsignedDwordMax));
-              // e.vpsllq(e.xmm0, 32);
-              // e.vpsrlq(e.xmm0, 32);
-              //// |     A |     C |
-              // e.vpsrlq(e.xmm1, src1, 32);
-              // e.vpsrlq(e.xmm2, src2, 32);
-              // e.vpaddq(e.xmm1, e.xmm2);
-              // e.vpcmpgtq(e.xmm1, e.GetXmmConstPtr(XMMUnsignedDwordMax));
-              // e.vpsllq(e.xmm1, 32);
-              //// xmm0 = mask for with saturated dwords == 111...
-              // e.vpor(e.xmm0, e.xmm1);
-              // e.vpaddd(dest, src1, src2);
-              //// dest.f[n] = xmm1.f[n] ? xmm1.f[n] : dest.f[n];
-              // e.vblendvps(dest, dest, e.xmm1, e.xmm1);
-              if (i.src2.is_constant) {
-                e.LoadConstantXmm(e.xmm0, i.src2.constant());
-                e.lea(e.r9, e.StashXmm(1, e.xmm0));
-              } else {
-                e.lea(e.r9, e.StashXmm(1, i.src2));
-              }
-              e.lea(e.r8, e.StashXmm(0, i.src1));
-              e.CallNativeSafe(
-                  reinterpret_cast<void*>(EmulateVectorAddUnsignedSatI32));
-              e.vmovaps(i.dest, e.xmm0);
+              // The add carried out if the result is below either input.
+              // There's no unsigned dword compare, so bias both by the sign
+              // bit and compare signed.
+              e.vpaddd(e.xmm1, src1, src2);
+              e.vpxor(e.xmm2, src1, e.GetXmmConstPtr(XMMSignMaskI32));
+              e.vpxor(e.xmm0, e.xmm1, e.GetXmmConstPtr(XMMSignMaskI32));
+              e.vpcmpgtd(e.xmm2, e.xmm2, e.xmm0);
+              e.vpor(dest, e.xmm1, e.xmm2);
             } else {
-              // https://software.intel.com/en-us/forums/topic/285219
-              // TODO(benvanik): this is broken with INTMAX+1.
-              // We reuse all these temps...
-              // assert_true(src1 != e.xmm0 && src1 != e.xmm1 && src1 !=
-              // e.xmm2);
-              // assert_true(src2 != e.xmm0 && src2 != e.xmm1 && src2 !=
-              // e.xmm2);
-              // e.vpaddd(e.xmm0, src1, src2);  // res
-              // e.vpand(e.xmm1, src1, src2);  // sign_and
-              // e.vpandn(e.xmm2, e.xmm0, e.xmm1);  // min_sat_mask
-              // e.vblendvps(dest, e.xmm0, e.GetXmmConstPtr(XMMSignMaskPS),
-              // e.xmm2);
-              // e.vpor(e.xmm1, src1, src2);  // sign_or
-              // e.vpandn(e.xmm1, e.xmm0);  // max_sat_mask
-              // e.vblendvps(dest, e.GetXmmConstPtr(XMMAbsMaskPS), e.xmm1);
-              if (i.src2.is_constant) {
-                e.LoadConstantXmm(e.xmm0, i.src2.constant());
-                e.lea(e.r9, e.StashXmm(1, e.xmm0));
-              } else {
-                e.lea(e.r9, e.StashXmm(1, i.src2));
-              }
-              e.lea(e.r8, e.StashXmm(0, i.src1));
-              e.CallNativeSafe(
-                  reinterpret_cast<void*>(EmulateVectorAddSignedSatI32));
-              e.vmovaps(i.dest, e.xmm0);
+              // Overflowed if both inputs have a sign different from the
+              // result; the result then saturates towards the inputs' sign.
+              e.vpaddd(e.xmm1, src1, src2);
+              e.vpxor(e.xmm2, src1, e.xmm1);
+              e.vpxor(e.xmm0, src2, e.xmm1);
+              e.vpand(e.xmm2, e.xmm2, e.xmm0);
+              // INT_MAX if the wrapped result is negative, else INT_MIN.
+              e.vpsrad(e.xmm0, e.xmm1, 31);
+              e.vpxor(e.xmm0, e.xmm0, e.GetXmmConstPtr(XMMSignMaskI32));
+              e.vblendvps(dest, e.xmm1, e.xmm0, e.xmm2);
             }
           } else {
             e.vpaddd(dest, src1, src2);
@@ -3621,19 +3842,6 @@ EMITTER_OPCODE_TABLE(OPCODE_SUB, SUB_I8, SUB_I16, SUB_I32, SUB_I64, SUB_F32,
 // ============================================================================
 struct VECTOR_SUB
     : Sequence<VECTOR_SUB, I<OPCODE_VECTOR_SUB, V128Op, V128Op, V128Op>> {
-  static __m128i EmulateVectorSubSignedSatI32(void*, __m128i src1,
-                                              __m128i src2) {
-    alignas(16) int32_t src1v[4];
-    alignas(16) int32_t src2v[4];
-    alignas(16) int32_t value[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(src1v), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(src2v), src2);
-    for (size_t i = 0; i < 4; ++i) {
-      auto t = int64_t(src1v[i]) - int64_t(src2v[i]);
-      value[i] = t < INT_MIN ? INT_MIN : (t > INT_MAX ? INT_MAX : int32_t(t));
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     EmitCommutativeBinaryXmmOp(e, i, [&i](X64Emitter& e, const Xmm& dest,
                                           const Xmm& src1, const Xmm& src2) {
@@ -3669,13 +3877,20 @@ struct VECTOR_SUB
         case INT32_TYPE:
           if (saturate) {
             if (is_unsigned) {
-              assert_always();
+              // max(a, b) - b clamps at zero.
+              e.vpmaxud(e.xmm1, src1, src2);
+              e.vpsubd(dest, e.xmm1, src2);
             } else {
-              e.lea(e.r8, e.StashXmm(0, i.src1));
-              e.lea(e.r9, e.StashXmm(1, i.src2));
-              e.CallNativeSafe(
-                  reinterpret_cast<void*>(EmulateVectorSubSignedSatI32));
-              e.vmovaps(i.dest, e.xmm0);
+              // Overflowed if the inputs' signs differ and the result's sign
+              // differs from src1; it then saturates towards src1's sign.
+              e.vpsubd(e.xmm1, src1, src2);
+              e.vpxor(e.xmm2, src1, src2);
+              e.vpxor(e.xmm0, src1, e.xmm1);
+              e.vpand(e.xmm2, e.xmm2, e.xmm0);
+              // INT_MAX if the wrapped result is negative, else INT_MIN.
+              e.vpsrad(e.xmm0, e.xmm1, 31);
+              e.vpxor(e.xmm0, e.xmm0, e.GetXmmConstPtr(XMMSignMaskI32));
+              e.vblendvps(dest, e.xmm1, e.xmm0, e.xmm2);
             }
           } else {
             e.vpsubd(dest, src1, src2);
@@ -3717,6 +3932,7 @@ struct MUL_I8 : Sequence<MUL_I8, I<OPCODE_MUL, I8Op, I8Op, I8Op>> {
         e.movzx(e.edx, i.src2);
         e.mulx(e.edx, i.dest.reg().cvt32(), i.src1.reg().cvt32());
       }
+      e.ReloadEDX();
     } else {
       // x86 mul instruction
       // AH:AL = AL * $1;
@@ -3737,8 +3953,6 @@ struct MUL_I8 : Sequence<MUL_I8, I<OPCODE_MUL, I8Op, I8Op, I8Op>> {
         e.mov(i.dest, e.al);
       }
     }
-
-    e.ReloadEDX();
   }
 };
 struct MUL_I16 : Sequence<MUL_I16, I<OPCODE_MUL, I16Op, I16Op, I16Op>> {
@@ -3914,6 +4128,7 @@ struct MUL_HI_I8 : Sequence<MUL_HI_I8, I<OPCODE_MUL_HI, I8Op, I8Op, I8Op>> {
         // TODO(benvanik): place src1 in eax? still need to sign extend
         e.movzx(e.edx, i.src1);
         e.mulx(i.dest.reg().cvt32(), e.eax, i.src2.reg().cvt32());
+        e.ReloadEDX();
       } else {
         // x86 mul instruction
         // AH:AL = AL * $1;
@@ -3947,7 +4162,6 @@ struct MUL_HI_I8 : Sequence<MUL_HI_I8, I<OPCODE_MUL_HI, I8Op, I8Op, I8Op>> {
       }
       e.mov(i.dest, e.ah);
     }
-    e.ReloadEDX();
   }
 };
 struct MUL_HI_I16
@@ -4108,18 +4322,16 @@ struct DIV_I8 : Sequence<DIV_I8, I<OPCODE_DIV, I8Op, I8Op, I8Op>> {
     Xbyak::Label skip;
     e.inLocalLabel();
 
-    // NOTE: RDX clobbered.
-    bool clobbered_rcx = false;
+    // 8-bit divides only use AX, so RDX is left alone.
     if (i.src2.is_constant) {
       assert_true(!i.src1.is_constant);
-      clobbered_rcx = true;
-      e.mov(e.cl, i.src2.constant());
+      e.mov(e.r8b, i.src2.constant());
       if (i.instr->flags & ARITHMETIC_UNSIGNED) {
         e.movzx(e.ax, i.src1);
-        e.div(e.cl);
+        e.div(e.r8b);
       } else {
         e.movsx(e.ax, i.src1);
-        e.idiv(e.cl);
+        e.idiv(e.r8b);
       }
     } else {
       // Skip if src2 is zero.
@@ -4146,10 +4358,6 @@ struct DIV_I8 : Sequence<DIV_I8, I<OPCODE_DIV, I8Op, I8Op, I8Op>> {
     e.L(skip);
     e.outLocalLabel();
     e.mov(i.dest, e.al);
-    if (clobbered_rcx) {
-      e.ReloadECX();
-    }
-    e.ReloadEDX();
   }
 };
 struct DIV_I16 : Sequence<DIV_I16, I<OPCODE_DIV, I16Op, I16Op, I16Op>> {
@@ -4158,20 +4366,18 @@ struct DIV_I16 : Sequence<DIV_I16, I<OPCODE_DIV, I16Op, I16Op, I16Op>> {
     e.inLocalLabel();
 
     // NOTE: RDX clobbered.
-    bool clobbered_rcx = false;
     if (i.src2.is_constant) {
       assert_true(!i.src1.is_constant);
-      clobbered_rcx = true;
-      e.mov(e.cx, i.src2.constant());
+      e.mov(e.r8w, i.src2.constant());
       if (i.instr->flags & ARITHMETIC_UNSIGNED) {
         e.mov(e.ax, i.src1);
         // Zero upper bits.
         e.xor_(e.dx, e.dx);
-        e.div(e.cx);
+        e.div(e.r8w);
       } else {
         e.mov(e.ax, i.src1);
         e.cwd();  // dx:ax = sign-extend ax
-        e.idiv(e.cx);
+        e.idiv(e.r8w);
       }
     } else {
       // Skip if src2 is zero.
@@ -4201,9 +4407,6 @@ struct DIV_I16 : Sequence<DIV_I16, I<OPCODE_DIV, I16Op, I16Op, I16Op>> {
     e.L(skip);
     e.outLocalLabel();
     e.mov(i.dest, e.ax);
-    if (clobbered_rcx) {
-      e.ReloadECX();
-    }
     e.ReloadEDX();
   }
 };
@@ -4213,20 +4416,18 @@ struct DIV_I32 : Sequence<DIV_I32, I<OPCODE_DIV, I32Op, I32Op, I32Op>> {
     e.inLocalLabel();
 
     // NOTE: RDX clobbered.
-    bool clobbered_rcx = false;
     if (i.src2.is_constant) {
       assert_true(!i.src1.is_constant);
-      clobbered_rcx = true;
-      e.mov(e.ecx, i.src2.constant());
+      e.mov(e.r8d, i.src2.constant());
       if (i.instr->flags & ARITHMETIC_UNSIGNED) {
         e.mov(e.eax, i.src1);
         // Zero upper bits.
         e.xor_(e.edx, e.edx);
-        e.div(e.ecx);
+        e.div(e.r8d);
       } else {
         e.mov(e.eax, i.src1);
         e.cdq();  // edx:eax = sign-extend eax
-        e.idiv(e.ecx);
+        e.idiv(e.r8d);
       }
     } else {
       // Skip if src2 is zero.
@@ -4256,9 +4457,6 @@ struct DIV_I32 : Sequence<DIV_I32, I<OPCODE_DIV, I32Op, I32Op, I32Op>> {
     e.L(skip);
     e.outLocalLabel();
     e.mov(i.dest, e.eax);
-    if (clobbered_rcx) {
-      e.ReloadECX();
-    }
     e.ReloadEDX();
   }
 };
@@ -4268,20 +4466,18 @@ struct DIV_I64 : Sequence<DIV_I64, I<OPCODE_DIV, I64Op, I64Op, I64Op>> {
     e.inLocalLabel();
 
     // NOTE: RDX clobbered.
-    bool clobbered_rcx = false;
     if (i.src2.is_constant) {
       assert_true(!i.src1.is_constant);
-      clobbered_rcx = true;
-      e.mov(e.rcx, i.src2.constant());
+      e.mov(e.r8, i.src2.constant());
       if (i.instr->flags & ARITHMETIC_UNSIGNED) {
         e.mov(e.rax, i.src1);
         // Zero upper bits.
         e.xor_(e.rdx, e.rdx);
-        e.div(e.rcx);
+        e.div(e.r8);
       } else {
         e.mov(e.rax, i.src1);
         e.cqo();  // rdx:rax = sign-extend rax
-        e.idiv(e.rcx);
+        e.idiv(e.r8);
       }
     } else {
       // Skip if src2 is zero.
@@ -4311,9 +4507,6 @@ struct DIV_I64 : Sequence<DIV_I64, I<OPCODE_DIV, I64Op, I64Op, I64Op>> {
     e.L(skip);
     e.outLocalLabel();
     e.mov(i.dest, e.rax);
-    if (clobbered_rcx) {
-      e.ReloadECX();
-    }
     e.ReloadEDX();
   }
 };
@@ -5042,28 +5235,33 @@ struct SHL_I64 : Sequence<SHL_I64, I<OPCODE_SHL, I64Op, I64Op, I8Op>> {
 };
 struct SHL_V128 : Sequence<SHL_V128, I<OPCODE_SHL, V128Op, V128Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
+    // Almost all instances are shamt = 1, but non-constant.
+    // shamt is [0,7], so only the neighboring dword is ever pulled in: words
+    // are big-endian within their dword and the dwords are in guest order.
     if (i.src2.is_constant) {
-      e.mov(e.r9, i.src2.constant());
+      uint8_t shamt = i.src2.constant() & 0x7;
+      if (!shamt) {
+        if (i.dest != i.src1) {
+          e.vmovdqa(i.dest, i.src1);
+        }
+        return;
+      }
+      e.vpsrldq(e.xmm1, i.src1, 4);
+      e.vpsrld(e.xmm1, e.xmm1, 32 - shamt);
+      e.vpslld(e.xmm0, i.src1, shamt);
     } else {
-      e.mov(e.r9, i.src2);
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateShlV128));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateShlV128(void*, __m128i src1, uint8_t src2) {
-    // Almost all instances are shamt = 1, but non-constant.
-    // shamt is [0,7]
-    uint8_t shamt = src2 & 0x7;
-    alignas(16) vec128_t value;
-    _mm_store_si128(reinterpret_cast<__m128i*>(&value), src1);
-    for (int i = 0; i < 15; ++i) {
-      value.u8[i ^ 0x3] = (value.u8[i ^ 0x3] << shamt) |
-                          (value.u8[(i + 1) ^ 0x3] >> (8 - shamt));
+      e.movzx(e.eax, i.src2);
+      e.and_(e.eax, 0x7);
+      e.vmovd(e.xmm0, e.eax);
+      // A count of 32 (shamt = 0) shifts the carried in bits out entirely.
+      e.neg(e.eax);
+      e.add(e.eax, 32);
+      e.vmovd(e.xmm1, e.eax);
+      e.vpsrldq(e.xmm2, i.src1, 4);
+      e.vpsrld(e.xmm1, e.xmm2, e.xmm1);
+      e.vpslld(e.xmm0, i.src1, e.xmm0);
     }
-    value.u8[15 ^ 0x3] = value.u8[15 ^ 0x3] << shamt;
-    return _mm_load_si128(reinterpret_cast<__m128i*>(&value));
+    e.vpor(i.dest, e.xmm0, e.xmm1);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_SHL, SHL_I8, SHL_I16, SHL_I32, SHL_I64, SHL_V128);
@@ -5120,28 +5318,30 @@ struct SHR_I64 : Sequence<SHR_I64, I<OPCODE_SHR, I64Op, I64Op, I8Op>> {
 };
 struct SHR_V128 : Sequence<SHR_V128, I<OPCODE_SHR, V128Op, V128Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
+    // Same as SHL_V128, but pulling bits in from the preceding dword.
     if (i.src2.is_constant) {
-      e.mov(e.r9, i.src2.constant());
+      uint8_t shamt = i.src2.constant() & 0x7;
+      if (!shamt) {
+        if (i.dest != i.src1) {
+          e.vmovdqa(i.dest, i.src1);
+        }
+        return;
+      }
+      e.vpslldq(e.xmm1, i.src1, 4);
+      e.vpslld(e.xmm1, e.xmm1, 32 - shamt);
+      e.vpsrld(e.xmm0, i.src1, shamt);
     } else {
-      e.mov(e.r9, i.src2);
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateShrV128));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateShrV128(void*, __m128i src1, uint8_t src2) {
-    // Almost all instances are shamt = 1, but non-constant.
-    // shamt is [0,7]
-    uint8_t shamt = src2 & 0x7;
-    alignas(16) vec128_t value;
-    _mm_store_si128(reinterpret_cast<__m128i*>(&value), src1);
-    for (int i = 15; i > 0; --i) {
-      value.u8[i ^ 0x3] = (value.u8[i ^ 0x3] >> shamt) |
-                          (value.u8[(i - 1) ^ 0x3] << (8 - shamt));
+      e.movzx(e.eax, i.src2);
+      e.and_(e.eax, 0x7);
+      e.vmovd(e.xmm0, e.eax);
+      e.neg(e.eax);
+      e.add(e.eax, 32);
+      e.vmovd(e.xmm1, e.eax);
+      e.vpslldq(e.xmm2, i.src1, 4);
+      e.vpslld(e.xmm1, e.xmm2, e.xmm1);
+      e.vpsrld(e.xmm0, i.src1, e.xmm0);
     }
-    value.u8[0 ^ 0x3] = value.u8[0 ^ 0x3] >> shamt;
-    return _mm_load_si128(reinterpret_cast<__m128i*>(&value));
+    e.vpor(i.dest, e.xmm0, e.xmm1);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_SHR, SHR_I8, SHR_I16, SHR_I32, SHR_I64, SHR_V128);
@@ -5199,6 +5399,103 @@ EMITTER_OPCODE_TABLE(OPCODE_SHA, SHA_I8, SHA_I16, SHA_I32, SHA_I64);
 // ============================================================================
 // OPCODE_VECTOR_SHL
 // ============================================================================
+// x86 has no per-element variable shifts for bytes or words (and none for
+// dwords before AVX2), so those are built out of constant shifts: the value is
+// shifted by 4, 2, 1 (8, 4, 2, 1 for words) and each step is blended in for
+// the elements whose count has that bit set.
+// xmm0 must hold the counts shifted so that the bit for the first step is in
+// the sign bit of every byte of the element, which is what vpblendvb tests.
+// Clobbers xmm0-xmm2.
+template <typename FN>
+void EmitVectorShiftSteps(X64Emitter& e, const Xmm& dest, const Xmm& src,
+                          int first_step, const FN& shift_by) {
+  Xmm value = src;
+  for (int n = first_step; n > 1; n >>= 1) {
+    shift_by(e, e.xmm2, value, n);
+    e.vpblendvb(e.xmm1, value, e.xmm2, e.xmm0);
+    // Move the next count bit up into the sign bits.
+    e.vpaddb(e.xmm0, e.xmm0, e.xmm0);
+    value = e.xmm1;
+  }
+  shift_by(e, e.xmm2, value, 1);
+  e.vpblendvb(dest, value, e.xmm2, e.xmm0);
+}
+template <typename ARGS>
+Xmm GetVectorShiftSource(X64Emitter& e, const ARGS& i) {
+  if (i.src1.is_constant) {
+    e.LoadConstantXmm(e.xmm1, i.src1.constant());
+    return e.xmm1;
+  }
+  return i.src1;
+}
+template <typename ARGS, typename FN>
+void EmitVectorShiftI8(X64Emitter& e, const ARGS& i, const FN& shift_by) {
+  // Bit 2 of each count goes to the top of its byte.
+  if (i.src2.is_constant) {
+    vec128_t shamt = i.src2.constant();
+    for (size_t n = 0; n < 16; ++n) {
+      shamt.u8[n] = (shamt.u8[n] & 0x7) << 5;
+    }
+    e.LoadConstantXmm(e.xmm0, shamt);
+  } else {
+    // Bits spilling into the neighboring byte land below its sign bit and
+    // are never tested.
+    e.vpsllw(e.xmm0, i.src2, 5);
+  }
+  EmitVectorShiftSteps(e, i.dest, GetVectorShiftSource(e, i), 4, shift_by);
+}
+template <typename ARGS, typename FN>
+void EmitVectorShiftI16(X64Emitter& e, const ARGS& i, const FN& shift_by) {
+  // Bit 3 of each count goes to the top of both bytes of its word.
+  if (i.src2.is_constant) {
+    vec128_t shamt = i.src2.constant();
+    for (size_t n = 0; n < 8; ++n) {
+      uint16_t count = shamt.u16[n] & 0xF;
+      shamt.u16[n] = (count << 12) | (count << 4);
+    }
+    e.LoadConstantXmm(e.xmm0, shamt);
+  } else {
+    e.vpsllw(e.xmm0, i.src2, 12);
+    e.vpsrlw(e.xmm2, e.xmm0, 8);
+    e.vpor(e.xmm0, e.xmm0, e.xmm2);
+  }
+  EmitVectorShiftSteps(e, i.dest, GetVectorShiftSource(e, i), 8, shift_by);
+}
+// Dword shifts for when vpsllvd/vpsrlvd/vpsravd are unavailable: each count is
+// moved into the low qword of a temp in turn for the shift-by-xmm forms, and
+// the shifted dword is blended into place.
+// Clobbers xmm0-xmm2.
+template <typename ARGS, typename FN>
+void EmitVectorShiftI32(X64Emitter& e, const ARGS& i, const FN& shift) {
+  if (i.src2.is_constant) {
+    vec128_t masked = i.src2.constant();
+    for (size_t n = 0; n < 4; ++n) {
+      masked.u32[n] &= 0x1F;
+    }
+    e.LoadConstantXmm(e.xmm0, masked);
+  } else {
+    e.vpand(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
+  }
+  Xmm src = i.dest;
+  if (i.src1.is_constant) {
+    // dest is only written at the very end, after the counts are in xmm0.
+    e.LoadConstantXmm(i.dest, i.src1.constant());
+  } else {
+    src = i.src1;
+  }
+  e.vpmovzxdq(e.xmm2, e.xmm0);
+  shift(e, e.xmm1, src, e.xmm2);
+  e.vpsrlq(e.xmm2, e.xmm0, 32);
+  shift(e, e.xmm2, src, e.xmm2);
+  e.vpblendw(e.xmm1, e.xmm1, e.xmm2, 0b00001100);
+  e.vpsrldq(e.xmm2, e.xmm0, 8);
+  e.vpmovzxdq(e.xmm2, e.xmm2);
+  shift(e, e.xmm2, src, e.xmm2);
+  e.vpblendw(e.xmm1, e.xmm1, e.xmm2, 0b00110000);
+  e.vpsrldq(e.xmm2, e.xmm0, 12);
+  shift(e, e.xmm2, src, e.xmm2);
+  e.vpblendw(i.dest, e.xmm1, e.xmm2, 0b11000000);
+}
 struct VECTOR_SHL_V128
     : Sequence<VECTOR_SHL_V128, I<OPCODE_VECTOR_SHL, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
@@ -5217,43 +5514,24 @@ struct VECTOR_SHL_V128
         break;
     }
   }
-  static __m128i EmulateVectorShlI8(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint8_t value[16];
-    alignas(16) uint8_t shamt[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 16; ++i) {
-      value[i] = value[i] << (shamt[i] & 0x7);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
-    } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShlI8));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateVectorShlI16(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint16_t value[8];
-    alignas(16) uint16_t shamt[8];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 8; ++i) {
-      value[i] = value[i] << (shamt[i] & 0xF);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+    EmitVectorShiftI8(
+        e, i, [](X64Emitter& e, const Xmm& dest, const Xmm& src, int n) {
+          if (n == 1) {
+            e.vpaddb(dest, src, src);
+          } else {
+            // Shift words and drop the bits carried over from the low byte.
+            e.vpsllw(dest, src, n);
+            e.vpand(dest, dest, e.GetXmmConstPtr(n == 4 ? XMMShlByteMask4
+                                                        : XMMShlByteMask2));
+          }
+        });
   }
   static void EmitInt16(X64Emitter& e, const EmitArgType& i) {
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
       bool all_same = true;
-      for (size_t n = 0; n < 8 - n; ++n) {
+      for (size_t n = 0; n < 7; ++n) {
         if (shamt.u16[n] != shamt.u16[n + 1]) {
           all_same = false;
           break;
@@ -5265,50 +5543,36 @@ struct VECTOR_SHL_V128
         return;
       }
     }
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
-    } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShlI16));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateVectorShlI32(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint32_t value[4];
-    alignas(16) uint32_t shamt[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 4; ++i) {
-      value[i] = value[i] << (shamt[i] & 0x1F);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+    EmitVectorShiftI16(
+        e, i, [](X64Emitter& e, const Xmm& dest, const Xmm& src, int n) {
+          e.vpsllw(dest, src, n);
+        });
   }
   static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
+    if (i.src2.is_constant) {
+      const auto& shamt = i.src2.constant();
+      bool all_same = true;
+      for (size_t n = 0; n < 3; ++n) {
+        if (shamt.u32[n] != shamt.u32[n + 1]) {
+          all_same = false;
+          break;
+        }
+      }
+      if (all_same) {
+        // Every count is the same, so we can use vpslld.
+        e.vpslld(i.dest, i.src1, shamt.u8[0] & 0x1F);
+        return;
+      }
+    }
     if (e.IsFeatureEnabled(kX64EmitAVX2)) {
       if (i.src2.is_constant) {
-        const auto& shamt = i.src2.constant();
-        bool all_same = true;
-        for (size_t n = 0; n < 4 - n; ++n) {
-          if (shamt.u32[n] != shamt.u32[n + 1]) {
-            all_same = false;
-            break;
-          }
-        }
-        if (all_same) {
-          // Every count is the same, so we can use vpslld.
-          e.vpslld(i.dest, i.src1, shamt.u8[0] & 0x1F);
-        } else {
-          // Counts differ, so pre-mask and load constant.
-          vec128_t masked = i.src2.constant();
-          for (size_t n = 0; n < 4; ++n) {
-            masked.u32[n] &= 0x1F;
-          }
-          e.LoadConstantXmm(e.xmm0, masked);
-          e.vpsllvd(i.dest, i.src1, e.xmm0);
+        // Counts differ, so pre-mask and load constant.
+        vec128_t masked = i.src2.constant();
+        for (size_t n = 0; n < 4; ++n) {
+          masked.u32[n] &= 0x1F;
         }
+        e.LoadConstantXmm(e.xmm0, masked);
+        e.vpsllvd(i.dest, i.src1, e.xmm0);
       } else {
         // Fully variable shift.
         // src shift mask may have values >31, and x86 sets to zero when
@@ -5317,16 +5581,10 @@ struct VECTOR_SHL_V128
         e.vpsllvd(i.dest, i.src1, e.xmm0);
       }
     } else {
-      // TODO(benvanik): native version (with shift magic).
-      if (i.src2.is_constant) {
-        e.LoadConstantXmm(e.xmm0, i.src2.constant());
-        e.lea(e.r9, e.StashXmm(1, e.xmm0));
-      } else {
-        e.lea(e.r9, e.StashXmm(1, i.src2));
-      }
-      e.lea(e.r8, e.StashXmm(0, i.src1));
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShlI32));
-      e.vmovaps(i.dest, e.xmm0);
+      EmitVectorShiftI32(e, i, [](X64Emitter& e, const Xmm& dest,
+                                  const Xmm& src, const Xmm& count) {
+        e.vpslld(dest, src, count);
+      });
     }
   }
 };
@@ -5353,123 +5611,76 @@ struct VECTOR_SHR_V128
         break;
     }
   }
-  static __m128i EmulateVectorShrI8(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint8_t value[16];
-    alignas(16) uint8_t shamt[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 16; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0x7);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
-    } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShrI8));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateVectorShrI16(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint16_t value[8];
-    alignas(16) uint16_t shamt[8];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 8; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0xF);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+    EmitVectorShiftI8(
+        e, i, [](X64Emitter& e, const Xmm& dest, const Xmm& src, int n) {
+          // Shift words and drop the bits carried over from the high byte.
+          e.vpsrlw(dest, src, n);
+          e.vpand(dest, dest,
+                  e.GetXmmConstPtr(n == 4 ? XMMShrByteMask4
+                                          : n == 2 ? XMMShrByteMask2
+                                                   : XMMShrByteMask1));
+        });
   }
   static void EmitInt16(X64Emitter& e, const EmitArgType& i) {
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
       bool all_same = true;
-      for (size_t n = 0; n < 8 - n; ++n) {
+      for (size_t n = 0; n < 7; ++n) {
         if (shamt.u16[n] != shamt.u16[n + 1]) {
           all_same = false;
           break;
         }
       }
       if (all_same) {
-        // Every count is the same, so we can use vpsllw.
+        // Every count is the same, so we can use vpsrlw.
         e.vpsrlw(i.dest, i.src1, shamt.u16[0] & 0xF);
         return;
       }
     }
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
-    } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
-    }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShrI16));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateVectorShrI32(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint32_t value[4];
-    alignas(16) uint32_t shamt[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 4; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0x1F);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+    EmitVectorShiftI16(
+        e, i, [](X64Emitter& e, const Xmm& dest, const Xmm& src, int n) {
+          e.vpsrlw(dest, src, n);
+        });
   }
   static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
       bool all_same = true;
-      for (size_t n = 0; n < 4 - n; ++n) {
+      for (size_t n = 0; n < 3; ++n) {
         if (shamt.u32[n] != shamt.u32[n + 1]) {
           all_same = false;
           break;
         }
       }
       if (all_same) {
-        // Every count is the same, so we can use vpslld.
+        // Every count is the same, so we can use vpsrld.
         e.vpsrld(i.dest, i.src1, shamt.u8[0] & 0x1F);
         return;
-      } else {
-        if (e.IsFeatureEnabled(kX64EmitAVX2)) {
-          // Counts differ, so pre-mask and load constant.
-          vec128_t masked = i.src2.constant();
-          for (size_t n = 0; n < 4; ++n) {
-            masked.u32[n] &= 0x1F;
-          }
-          e.LoadConstantXmm(e.xmm0, masked);
-          e.vpsrlvd(i.dest, i.src1, e.xmm0);
-          return;
-        }
       }
-    } else {
-      if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      if (i.src2.is_constant) {
+        // Counts differ, so pre-mask and load constant.
+        vec128_t masked = i.src2.constant();
+        for (size_t n = 0; n < 4; ++n) {
+          masked.u32[n] &= 0x1F;
+        }
+        e.LoadConstantXmm(e.xmm0, masked);
+        e.vpsrlvd(i.dest, i.src1, e.xmm0);
+      } else {
         // Fully variable shift.
         // src shift mask may have values >31, and x86 sets to zero when
         // that happens so we mask.
         e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
         e.vpsrlvd(i.dest, i.src1, e.xmm0);
-        return;
       }
-    }
-
-    // We've reached here if we don't have AVX2 and it's a variable shift.
-    // TODO(benvanik): native version.
-    if (i.src2.is_constant) {
-      e.LoadConstantXmm(e.xmm0, i.src2.constant());
-      e.lea(e.r9, e.StashXmm(1, e.xmm0));
     } else {
-      e.lea(e.r9, e.StashXmm(1, i.src2));
+      EmitVectorShiftI32(e, i, [](X64Emitter& e, const Xmm& dest,
+                                  const Xmm& src, const Xmm& count) {
+        e.vpsrld(dest, src, count);
+      });
     }
-    e.lea(e.r8, e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShrI32));
-    e.vmovaps(i.dest, e.xmm0);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SHR, VECTOR_SHR_V128);
@@ -5479,91 +5690,92 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SHR, VECTOR_SHR_V128);
 // ============================================================================
 struct VECTOR_SHA_V128
     : Sequence<VECTOR_SHA_V128, I<OPCODE_VECTOR_SHA, V128Op, V128Op, V128Op>> {
-  static __m128i EmulateVectorShaI8(void*, __m128i src1, __m128i src2) {
-    alignas(16) int8_t value[16];
-    alignas(16) int8_t shamt[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 16; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0x7);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
-  static __m128i EmulateVectorShaI16(void*, __m128i src1, __m128i src2) {
-    alignas(16) int16_t value[8];
-    alignas(16) int16_t shamt[8];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 8; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0xF);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
-  static __m128i EmulateVectorShaI32(void*, __m128i src1, __m128i src2) {
-    alignas(16) int32_t value[4];
-    alignas(16) int32_t shamt[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-    for (size_t i = 0; i < 4; ++i) {
-      value[i] = value[i] >> (shamt[i] & 0x1F);
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     switch (i.instr->flags) {
       case INT8_TYPE:
-        // TODO(benvanik): native version (with shift magic).
-        if (i.src2.is_constant) {
-          e.LoadConstantXmm(e.xmm0, i.src2.constant());
-          e.lea(e.r9, e.StashXmm(1, e.xmm0));
-        } else {
-          e.lea(e.r9, e.StashXmm(1, i.src2));
-        }
-        e.lea(e.r8, e.StashXmm(0, i.src1));
-        e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShaI8));
-        e.vmovaps(i.dest, e.xmm0);
+        EmitInt8(e, i);
         break;
       case INT16_TYPE:
-        // TODO(benvanik): native version (with shift magic).
-        if (i.src2.is_constant) {
-          e.LoadConstantXmm(e.xmm0, i.src2.constant());
-          e.lea(e.r9, e.StashXmm(1, e.xmm0));
-        } else {
-          e.lea(e.r9, e.StashXmm(1, i.src2));
-        }
-        e.lea(e.r8, e.StashXmm(0, i.src1));
-        e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShaI16));
-        e.vmovaps(i.dest, e.xmm0);
+        EmitInt16(e, i);
         break;
       case INT32_TYPE:
-        if (e.IsFeatureEnabled(kX64EmitAVX2)) {
-          // src shift mask may have values >31, and x86 sets to zero when
-          // that happens so we mask.
-          if (i.src2.is_constant) {
-            e.LoadConstantXmm(e.xmm0, i.src2.constant());
-            e.vandps(e.xmm0, e.GetXmmConstPtr(XMMShiftMaskPS));
-          } else {
-            e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
-          }
-          e.vpsravd(i.dest, i.src1, e.xmm0);
-        } else {
-          // TODO(benvanik): native version.
-          if (i.src2.is_constant) {
-            e.LoadConstantXmm(e.xmm0, i.src2.constant());
-            e.lea(e.r9, e.StashXmm(1, e.xmm0));
-          } else {
-            e.lea(e.r9, e.StashXmm(1, i.src2));
-          }
-          e.lea(e.r8, e.StashXmm(0, i.src1));
-          e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShaI32));
-          e.vmovaps(i.dest, e.xmm0);
-        }
+        EmitInt32(e, i);
         break;
       default:
         assert_always();
         break;
     }
   }
+  static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
+    EmitVectorShiftI8(e, i, [](X64Emitter& e, const Xmm& dest, const Xmm& src,
+                               int n) {
+      // Logical shift, then sign extend from the bit the sign landed on:
+      // (x ^ s) - s with s = 0x80 >> n.
+      XmmConst sign = n == 4 ? XMMShaByteSign4
+                             : n == 2 ? XMMShaByteSign2 : XMMShaByteSign1;
+      e.vpsrlw(dest, src, n);
+      e.vpand(dest, dest,
+              e.GetXmmConstPtr(n == 4 ? XMMShrByteMask4
+                                      : n == 2 ? XMMShrByteMask2
+                                               : XMMShrByteMask1));
+      e.vpxor(dest, dest, e.GetXmmConstPtr(sign));
+      e.vpsubb(dest, dest, e.GetXmmConstPtr(sign));
+    });
+  }
+  static void EmitInt16(X64Emitter& e, const EmitArgType& i) {
+    if (i.src2.is_constant) {
+      const auto& shamt = i.src2.constant();
+      bool all_same = true;
+      for (size_t n = 0; n < 7; ++n) {
+        if (shamt.u16[n] != shamt.u16[n + 1]) {
+          all_same = false;
+          break;
+        }
+      }
+      if (all_same) {
+        // Every count is the same, so we can use vpsraw.
+        e.vpsraw(i.dest, i.src1, shamt.u16[0] & 0xF);
+        return;
+      }
+    }
+    EmitVectorShiftI16(
+        e, i, [](X64Emitter& e, const Xmm& dest, const Xmm& src, int n) {
+          e.vpsraw(dest, src, n);
+        });
+  }
+  static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
+    if (i.src2.is_constant) {
+      const auto& shamt = i.src2.constant();
+      bool all_same = true;
+      for (size_t n = 0; n < 3; ++n) {
+        if (shamt.u32[n] != shamt.u32[n + 1]) {
+          all_same = false;
+          break;
+        }
+      }
+      if (all_same) {
+        // Every count is the same, so we can use vpsrad.
+        e.vpsrad(i.dest, i.src1, shamt.u8[0] & 0x1F);
+        return;
+      }
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      // src shift mask may have values >31, and x86 sets to zero when
+      // that happens so we mask.
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(e.xmm0, i.src2.constant());
+        e.vandps(e.xmm0, e.GetXmmConstPtr(XMMShiftMaskPS));
+      } else {
+        e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
+      }
+      e.vpsravd(i.dest, i.src1, e.xmm0);
+    } else {
+      EmitVectorShiftI32(e, i, [](X64Emitter& e, const Xmm& dest,
+                                  const Xmm& src, const Xmm& count) {
+        e.vpsrad(dest, src, count);
+      });
+    }
+  }
 };
 EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SHA, VECTOR_SHA_V128);
 
@@ -5614,13 +5826,25 @@ struct ROTATE_LEFT_I16
 struct ROTATE_LEFT_I32
     : Sequence<ROTATE_LEFT_I32, I<OPCODE_ROTATE_LEFT, I32Op, I32Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitRotateLeftXX<ROTATE_LEFT_I32, Reg32>(e, i);
+    if (e.IsFeatureEnabled(kX64EmitBMI2) && i.src2.is_constant &&
+        !i.src1.is_constant) {
+      // rorx is non-destructive and leaves flags alone.
+      e.rorx(i.dest, i.src1, (32 - (i.src2.constant() & 31)) & 31);
+    } else {
+      EmitRotateLeftXX<ROTATE_LEFT_I32, Reg32>(e, i);
+    }
   }
 };
 struct ROTATE_LEFT_I64
     : Sequence<ROTATE_LEFT_I64, I<OPCODE_ROTATE_LEFT, I64Op, I64Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitRotateLeftXX<ROTATE_LEFT_I64, Reg64>(e, i);
+    if (e.IsFeatureEnabled(kX64EmitBMI2) && i.src2.is_constant &&
+        !i.src1.is_constant) {
+      // rorx is non-destructive and leaves flags alone.
+      e.rorx(i.dest, i.src1, (64 - (i.src2.constant() & 63)) & 63);
+    } else {
+      EmitRotateLeftXX<ROTATE_LEFT_I64, Reg64>(e, i);
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_ROTATE_LEFT, ROTATE_LEFT_I8, ROTATE_LEFT_I16,
@@ -6060,11 +6284,10 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
-      e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
+      e.MovImageAddress(e.r8, extract_table_32);
+      e.vmovaps(e.xmm0, e.ptr[e.r8 + e.rax]);
       e.vpshufb(e.xmm0, i.src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
-      e.ReloadEDX();
     }
   }
 };
@@ -7024,6 +7247,95 @@ EMITTER_OPCODE_TABLE(OPCODE_ATOMIC_EXCHANGE, ATOMIC_EXCHANGE_I8,
                      ATOMIC_EXCHANGE_I16, ATOMIC_EXCHANGE_I32,
                      ATOMIC_EXCHANGE_I64);
 
+// ============================================================================
+// OPCODE_ATOMIC_COMPARE_EXCHANGE
+// ============================================================================
+// Unlike OPCODE_ATOMIC_EXCHANGE the address is a guest address.
+// cmpxchg wants the expected value in rax, which ComputeMemoryAddress uses, so
+// the address goes through r8 instead.
+template <typename ARGS>
+void SetupAtomicCompareExchange(X64Emitter& e, const ARGS& i) {
+  if (i.src1.is_constant) {
+    e.mov(e.r8d, static_cast<uint32_t>(i.src1.constant()));
+  } else {
+    e.mov(e.r8d, i.src1.reg().cvt32());
+  }
+  if (i.src2.is_constant) {
+    e.mov(e.rax, i.src2.constant());
+  } else {
+    e.mov(e.rax, i.src2.reg().cvt64());
+  }
+}
+struct ATOMIC_COMPARE_EXCHANGE_I32
+    : Sequence<ATOMIC_COMPARE_EXCHANGE_I32,
+               I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I32Op, I32Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    SetupAtomicCompareExchange(e, i);
+    Reg32 new_value = e.r9d;
+    if (i.src3.is_constant) {
+      e.mov(new_value, static_cast<uint32_t>(i.src3.constant()));
+    } else {
+      new_value = i.src3;
+    }
+    e.lock();
+    e.cmpxchg(e.dword[e.rdx + e.r8], new_value);
+    e.sete(i.dest);
+  }
+};
+struct ATOMIC_COMPARE_EXCHANGE_I64
+    : Sequence<ATOMIC_COMPARE_EXCHANGE_I64,
+               I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I64Op, I64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    SetupAtomicCompareExchange(e, i);
+    Reg64 new_value = e.r9;
+    if (i.src3.is_constant) {
+      e.mov(new_value, i.src3.constant());
+    } else {
+      new_value = i.src3;
+    }
+    e.lock();
+    e.cmpxchg(e.qword[e.rdx + e.r8], new_value);
+    e.sete(i.dest);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_ATOMIC_COMPARE_EXCHANGE,
+                     ATOMIC_COMPARE_EXCHANGE_I32, ATOMIC_COMPARE_EXCHANGE_I64);
+
+// ============================================================================
+// OPCODE_SET_ROUNDING_MODE
+// ============================================================================
+struct SET_ROUNDING_MODE_I32
+    : Sequence<SET_ROUNDING_MODE_I32,
+               I<OPCODE_SET_ROUNDING_MODE, VoidOp, I32Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.src1.is_constant) {
+      int32_t mode = i.src1.constant() & 7;
+      if (e.known_rounding_mode() == mode) {
+        return;
+      }
+      e.mov(e.eax, X64Emitter::kGuestMXCSRTable[mode]);
+      e.set_known_rounding_mode(mode);
+    } else {
+      e.mov(e.eax, i.src1);
+      e.and_(e.eax, 7);
+      e.MovImageAddress(e.r8, X64Emitter::kGuestMXCSRTable);
+      e.mov(e.eax, e.dword[e.r8 + e.rax * 4]);
+      e.set_known_rounding_mode(-1);
+    }
+    // Titles tend to rewrite the same mode over and over and ldmxcsr is far
+    // more expensive than checking first.
+    Xbyak::Label skip;
+    auto scratch = e.dword[e.rsp + StackLayout::GUEST_SCRATCH];
+    e.vstmxcsr(scratch);
+    e.cmp(e.eax, scratch);
+    e.je(skip, CodeGenerator::T_SHORT);
+    e.mov(scratch, e.eax);
+    e.vldmxcsr(scratch);
+    e.L(skip);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_SET_ROUNDING_MODE, SET_ROUNDING_MODE_I32);
+
 void RegisterSequences() {
   Register_OPCODE_COMMENT();
   Register_OPCODE_NOP();
@@ -7138,6 +7450,8 @@ void RegisterSequences() {
   Register_OPCODE_PACK();
   Register_OPCODE_UNPACK();
   Register_OPCODE_ATOMIC_EXCHANGE();
+  Register_OPCODE_ATOMIC_COMPARE_EXCHANGE();
+  Register_OPCODE_SET_ROUNDING_MODE();
 }
 
 bool SelectSequence(X64Emitter* e, const Instr* i, const Instr** new_tail) {
@@ -7153,6 +7467,16 @@ bool SelectSequence(X64Emitter* e, const Instr* i, const Instr** new_tail) {
   return false;
 }
 
+uint64_t HashSequenceTable() {
+  std::vector<uint32_t> keys;
+  keys.reserve(sequence_table.size());
+  for (auto& it : sequence_table) {
+    keys.push_back(it.first);
+  }
+  std::sort(keys.begin(), keys.end());
+  return XXH64(keys.data(), keys.size() * sizeof(uint32_t), 0);
+}
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
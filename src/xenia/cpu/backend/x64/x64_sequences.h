@@ -22,6 +22,9 @@ class X64Emitter;
 void RegisterSequences();
 bool SelectSequence(X64Emitter* e, const hir::Instr* i,
                     const hir::Instr** new_tail);
+// Hash of the registered sequence keys, changing whenever sequences are
+// added or removed.
+uint64_t HashSequenceTable();
 
 }  // namespace x64
 }  // namespace backend
@@ -118,6 +118,7 @@ class StackLayout {
   static const size_t THUNK_STACK_SIZE = 120;
 
   static const size_t GUEST_STACK_SIZE = 104;
+  static const size_t GUEST_SCRATCH = 32;
   static const size_t GUEST_RCX_HOME = 80;
   static const size_t GUEST_RET_ADDR = 88;
   static const size_t GUEST_CALL_RET_ADDR = 96;
@@ -0,0 +1,304 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/main.h"
+#include "xenia/base/math.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/backend/assembler.h"
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/hir_corpus.h"
+#include "xenia/cpu/compiler/passes/register_allocation_pass.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/frontend/ppc_translator.h"
+#include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/memory.h"
+
+DEFINE_string(corpus, "", "HIR corpus written with --hir_corpus_path.");
+DEFINE_string(configs, "baseline,optimized,hot",
+              "Comma separated pass configurations to measure. Each is a tier "
+              "(baseline, optimized or hot) followed by -PassName for each "
+              "pass to leave out, e.g. optimized-CompareSinkingPass.");
+DEFINE_int32(iterations, 1,
+             "Times the corpus is compiled per configuration. Times are "
+             "averaged over them.");
+
+namespace xe {
+namespace cpu {
+namespace benchmark {
+
+using xe::cpu::compiler::Compiler;
+using xe::cpu::compiler::CompileStats;
+using xe::cpu::compiler::passes::RegisterAllocationPass;
+using xe::cpu::frontend::PPCTranslator;
+
+// Functions are only declared so that calls between them can be emitted.
+class CorpusModule : public Module {
+ public:
+  explicit CorpusModule(Processor* processor) : Module(processor) {}
+
+  const std::string& name() const override { return name_; }
+  bool ContainsAddress(uint32_t address) override { return true; }
+
+ protected:
+  std::unique_ptr<Function> CreateFunction(uint32_t address) override {
+    return processor_->backend()->CreateGuestFunction(this, address);
+  }
+
+ private:
+  std::string name_ = "corpus";
+};
+
+struct CorpusFunction {
+  uint32_t guest_address;
+  std::vector<uint8_t> data;
+};
+
+struct Config {
+  std::string name;
+  GuestFunction::Tier tier;
+  std::vector<std::string> removed_passes;
+};
+
+std::vector<std::string> Split(const std::string& value, char separator) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t end = value.find(separator, start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    if (end > start) {
+      parts.push_back(value.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return parts;
+}
+
+bool ParseConfigs(const std::string& value, std::vector<Config>* out_configs) {
+  for (auto& config_name : Split(value, ',')) {
+    auto parts = Split(config_name, '-');
+    Config config;
+    config.name = config_name;
+    if (parts.empty()) {
+      return false;
+    } else if (parts[0] == "baseline") {
+      config.tier = GuestFunction::Tier::kBaseline;
+    } else if (parts[0] == "optimized") {
+      config.tier = GuestFunction::Tier::kOptimized;
+    } else if (parts[0] == "hot") {
+      config.tier = GuestFunction::Tier::kHot;
+    } else {
+      fprintf(stderr, "Unknown tier in configuration %s\n",
+              config_name.c_str());
+      return false;
+    }
+    config.removed_passes.assign(parts.begin() + 1, parts.end());
+    out_configs->push_back(config);
+  }
+  return !out_configs->empty();
+}
+
+double TicksToMs(uint64_t ticks) {
+  return double(ticks) * 1000.0 / double(Clock::host_tick_frequency());
+}
+
+void RunConfig(Processor* processor, CorpusModule* module,
+               const std::vector<CorpusFunction>& corpus,
+               const Config& config) {
+  auto backend = processor->backend();
+  Compiler compiler(processor);
+  PPCTranslator::AddPasses(&compiler, backend, config.tier);
+  // Inlining rebuilds callees from guest code, which the corpus doesn't have.
+  compiler.RemovePass("InliningPass");
+  for (auto& name : config.removed_passes) {
+    compiler.RemovePass(name);
+  }
+  const RegisterAllocationPass* register_allocation_pass = nullptr;
+  std::vector<std::string> pass_names;
+  for (auto& pass : compiler.passes()) {
+    if (std::string(pass->name()) == "RegisterAllocationPass") {
+      register_allocation_pass =
+          static_cast<const RegisterAllocationPass*>(pass.get());
+    }
+    if (std::find(pass_names.begin(), pass_names.end(), pass->name()) ==
+        pass_names.end()) {
+      pass_names.push_back(pass->name());
+    }
+  }
+  auto assembler = backend->CreateAssembler();
+  assembler->Initialize();
+  hir::HIRBuilder builder;
+
+  // Passes used more than once in a pipeline share their totals.
+  auto compile_stats = CompileStats::global();
+  std::vector<CompileStats::Totals> pass_totals;
+  for (auto& name : pass_names) {
+    pass_totals.push_back(compile_stats->GetTotals(name));
+  }
+
+  auto resolve_function = [module](uint32_t address) {
+    Function* function = nullptr;
+    module->DeclareFunction(address, &function);
+    return function;
+  };
+  // Never called; only its address ends up in the code.
+  static MMIORange mmio_range = {0};
+  auto resolve_mmio_range = [](uint32_t address) { return &mmio_range; };
+
+  uint32_t iterations = uint32_t(std::max(FLAGS_iterations, 1));
+  uint64_t compile_ticks = 0;
+  uint64_t emit_ticks = 0;
+  size_t function_count = 0;
+  size_t failed_count = 0;
+  size_t code_size = 0;
+  RegisterAllocationPass::Stats spills = {};
+  for (uint32_t iteration = 0; iteration < iterations; ++iteration) {
+    bool last_iteration = iteration == iterations - 1;
+    for (auto& entry : corpus) {
+      if (!builder.Deserialize(entry.data.data(), entry.data.size(),
+                               resolve_function, resolve_mmio_range)) {
+        failed_count += last_iteration ? 1 : 0;
+        continue;
+      }
+      auto function =
+          static_cast<GuestFunction*>(resolve_function(entry.guest_address));
+
+      uint64_t start_ticks = Clock::QueryHostTickCount();
+      bool compiled = compiler.Compile(&builder);
+      uint64_t compiled_ticks = Clock::QueryHostTickCount();
+      compile_ticks += compiled_ticks - start_ticks;
+      if (!compiled) {
+        failed_count += last_iteration ? 1 : 0;
+        continue;
+      }
+      bool assembled = assembler->Assemble(function, &builder, 0, nullptr);
+      emit_ticks += Clock::QueryHostTickCount() - compiled_ticks;
+      if (!last_iteration) {
+        continue;
+      }
+      if (!assembled) {
+        ++failed_count;
+        continue;
+      }
+      ++function_count;
+      code_size += function->machine_code_length();
+      if (register_allocation_pass) {
+        auto& stats = register_allocation_pass->stats();
+        for (size_t i = 0; i < xe::countof(stats.spills); ++i) {
+          spills.spills[i] += stats.spills[i];
+          spills.spill_stores[i] += stats.spill_stores[i];
+          spills.rematerializations[i] += stats.rematerializations[i];
+        }
+        spills.loop_weighted_spills += stats.loop_weighted_spills;
+      }
+    }
+  }
+
+  printf("%s: %zu functions, %zu failed\n", config.name.c_str(),
+         function_count, failed_count);
+  printf("  passes   %10.2f ms\n", TicksToMs(compile_ticks) / iterations);
+  printf("  emitter  %10.2f ms\n", TicksToMs(emit_ticks) / iterations);
+  printf("  code     %10zu bytes\n", code_size);
+  printf(
+      "  spills   int %u, float %u, vec %u (%u stores, %u rematerialized, "
+      "%u loop-weighted)\n",
+      spills.spills[0], spills.spills[1], spills.spills[2],
+      spills.spill_stores[0] + spills.spill_stores[1] + spills.spill_stores[2],
+      spills.rematerializations[0] + spills.rematerializations[1] +
+          spills.rematerializations[2],
+      spills.loop_weighted_spills);
+  for (size_t i = 0; i < pass_names.size(); ++i) {
+    auto totals = compile_stats->GetTotals(pass_names[i]);
+    uint64_t ticks = totals.total_ticks - pass_totals[i].total_ticks;
+    printf("    %-40s %10.2f ms\n", pass_names[i].c_str(),
+           TicksToMs(ticks) / iterations);
+  }
+  printf("\n");
+}
+
+int main(const std::vector<std::wstring>& args) {
+  if (FLAGS_corpus.empty()) {
+    fprintf(stderr, "No --corpus given\n");
+    return 1;
+  }
+  std::vector<Config> configs;
+  if (!ParseConfigs(FLAGS_configs, &configs)) {
+    fprintf(stderr, "Invalid --configs\n");
+    return 1;
+  }
+  // Per pass times come from the compile stats.
+  FLAGS_dump_compile_stats = true;
+
+  compiler::HIRCorpusReader reader;
+  if (!reader.Open(xe::to_wstring(FLAGS_corpus))) {
+    fprintf(stderr, "Unable to read corpus %s\n", FLAGS_corpus.c_str());
+    return 1;
+  }
+  std::vector<CorpusFunction> corpus;
+  uint32_t low_address = UINT32_MAX;
+  uint32_t high_address = 0;
+  CorpusFunction entry;
+  while (reader.Next(&entry.guest_address, &entry.data)) {
+    // Only code in the indirection table range can be placed.
+    if (entry.guest_address < 0x80000000 || entry.guest_address >= 0xA0000000) {
+      continue;
+    }
+    low_address = std::min(low_address, entry.guest_address);
+    high_address = std::max(high_address, entry.guest_address);
+    corpus.push_back(std::move(entry));
+  }
+  if (corpus.empty()) {
+    fprintf(stderr, "Corpus %s is empty\n", FLAGS_corpus.c_str());
+    return 1;
+  }
+  printf("%zu functions in %s\n\n", corpus.size(), FLAGS_corpus.c_str());
+
+  auto memory = std::make_unique<Memory>();
+  memory->Initialize();
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr, nullptr);
+  if (!processor->Setup()) {
+    fprintf(stderr, "Unable to set up the processor\n");
+    return 1;
+  }
+  auto module = std::make_unique<CorpusModule>(processor.get());
+  auto module_ptr = module.get();
+  processor->AddModule(std::move(module));
+  processor->backend()->CommitExecutableRange(
+      low_address & ~0xFFFFu, xe::round_up(high_address + 4, 0x10000u));
+
+  for (auto& config : configs) {
+    RunConfig(processor.get(), module_ptr, corpus, config);
+  }
+
+  processor.reset();
+  memory.reset();
+  return 0;
+}
+
+}  // namespace benchmark
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-hir-benchmark",
+                   L"xenia-cpu-hir-benchmark --corpus=<file> "
+                   L"[--configs=<tier[-PassName...]>,...]",
+                   xe::cpu::benchmark::main);
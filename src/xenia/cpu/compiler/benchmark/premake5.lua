@@ -0,0 +1,26 @@
+project_root = "../../../../.."
+include(project_root.."/build_tools")
+
+group("tools")
+project("xenia-cpu-hir-benchmark")
+  uuid("6f1c4c3e-8b0a-4f5d-9a43-2e6f7d51c9b8")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "gflags",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+
+    -- TODO(benvanik): remove these dependencies.
+    "xenia-debug",
+    "xenia-kernel"
+  })
+  files({
+    "hir_benchmark_main.cc",
+    "../../../base/main_"..platform_suffix..".cc",
+  })
+  includedirs({
+    project_root.."/build_tools/third_party/gflags/src",
+  })
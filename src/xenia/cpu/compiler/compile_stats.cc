@@ -0,0 +1,146 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/compile_stats.h"
+
+#include <algorithm>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Upper bounds of all but the last histogram bucket, in microseconds.
+static const uint64_t kHistogramBoundsUs[] = {10,   30,   100,  300,
+                                              1000, 3000, 10000};
+static_assert(sizeof(kHistogramBoundsUs) / sizeof(uint64_t) ==
+                  CompileStats::kHistogramBucketCount - 1,
+              "one bound per bucket");
+
+CompileStats* CompileStats::global() {
+  static CompileStats stats;
+  return &stats;
+}
+
+CompileStats::CompileStats() : enabled_(FLAGS_dump_compile_stats) {}
+
+CompileStats::StageId CompileStats::GetStage(const std::string& name) {
+  std::lock_guard<xe::mutex> guard(lock_);
+  StageId id;
+  id.index = stages_.size();
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    if (stages_[i].name == name) {
+      id.index = i;
+      break;
+    }
+  }
+  if (id.index == stages_.size()) {
+    Stage stage = {name, 0, 0, 0, {0}};
+    stages_.push_back(stage);
+  }
+#if XE_OPTION_PROFILING
+  id.profile_token = MicroProfileGetToken("cpu", name.c_str(),
+                                          Profiler::GetColor(name.c_str()),
+                                          MicroProfileTokenTypeCpu);
+#else
+  id.profile_token = 0;
+#endif  // XE_OPTION_PROFILING
+  return id;
+}
+
+void CompileStats::Record(const StageId& stage, uint64_t host_ticks) {
+  uint64_t us = host_ticks * 1000000 / Clock::host_tick_frequency();
+  size_t bucket = 0;
+  while (bucket < kHistogramBucketCount - 1 &&
+         us >= kHistogramBoundsUs[bucket]) {
+    ++bucket;
+  }
+  std::lock_guard<xe::mutex> guard(lock_);
+  auto& entry = stages_[stage.index];
+  ++entry.count;
+  entry.total_ticks += host_ticks;
+  entry.max_ticks = std::max(entry.max_ticks, host_ticks);
+  ++entry.histogram[bucket];
+}
+
+CompileStats::Totals CompileStats::GetTotals(const std::string& name) {
+  std::lock_guard<xe::mutex> guard(lock_);
+  Totals totals = {0, 0};
+  for (auto& stage : stages_) {
+    if (stage.name == name) {
+      totals.count = stage.count;
+      totals.total_ticks = stage.total_ticks;
+      break;
+    }
+  }
+  return totals;
+}
+
+void CompileStats::Dump() {
+  std::vector<Stage> stages;
+  {
+    std::lock_guard<xe::mutex> guard(lock_);
+    stages = stages_;
+  }
+  std::sort(stages.begin(), stages.end(), [](const Stage& a, const Stage& b) {
+    return a.total_ticks > b.total_ticks;
+  });
+
+  double us_per_tick = 1000000.0 / Clock::host_tick_frequency();
+  XELOGI("Compile stats (histogram buckets <10 <30 <100 <300 <1k <3k <10k "
+         ">=10k us):");
+  for (auto& stage : stages) {
+    if (!stage.count) {
+      continue;
+    }
+    XELOGI(
+        "  %-32s %8lld calls %10.1fms total %8.1fus avg %9.1fus max | %lld "
+        "%lld %lld %lld %lld %lld %lld %lld",
+        stage.name.c_str(), static_cast<long long>(stage.count),
+        stage.total_ticks * us_per_tick / 1000.0,
+        stage.total_ticks * us_per_tick / stage.count,
+        stage.max_ticks * us_per_tick,
+        static_cast<long long>(stage.histogram[0]),
+        static_cast<long long>(stage.histogram[1]),
+        static_cast<long long>(stage.histogram[2]),
+        static_cast<long long>(stage.histogram[3]),
+        static_cast<long long>(stage.histogram[4]),
+        static_cast<long long>(stage.histogram[5]),
+        static_cast<long long>(stage.histogram[6]),
+        static_cast<long long>(stage.histogram[7]));
+  }
+}
+
+CompileStageScope::CompileStageScope(const CompileStats::StageId& stage)
+    : stage_(stage) {
+#if XE_OPTION_PROFILING
+  profile_ticks_ = MicroProfileEnter(stage_.profile_token);
+#endif  // XE_OPTION_PROFILING
+  if (CompileStats::global()->is_enabled()) {
+    start_ticks_ = Clock::QueryHostTickCount();
+  }
+}
+
+CompileStageScope::~CompileStageScope() {
+  if (CompileStats::global()->is_enabled()) {
+    CompileStats::global()->Record(stage_,
+                                   Clock::QueryHostTickCount() - start_ticks_);
+  }
+#if XE_OPTION_PROFILING
+  MicroProfileLeave(stage_.profile_token, profile_ticks_);
+#endif  // XE_OPTION_PROFILING
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,90 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_COMPILE_STATS_H_
+#define XENIA_CPU_COMPILER_COMPILE_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Accumulates JIT compile time per stage (scanning, HIR building, each
+// compiler pass, machine code emission) over all translator threads.
+// Stages are also entered as profiler scopes so they show up in the profiler
+// timeline. Times are only accumulated with --dump_compile_stats.
+class CompileStats {
+ public:
+  // Buckets of the per-call time histogram, in microseconds. The last bucket
+  // holds everything at or above the last bound.
+  static const size_t kHistogramBucketCount = 8;
+
+  struct StageId {
+    size_t index;
+    uint64_t profile_token;
+  };
+
+  static CompileStats* global();
+
+  bool is_enabled() const { return enabled_; }
+
+  // Returns the id of the named stage, adding it on first use. Stages with
+  // the same name (such as a pass used in several pipelines) share totals.
+  StageId GetStage(const std::string& name);
+  void Record(const StageId& stage, uint64_t host_ticks);
+
+  struct Totals {
+    uint64_t count;
+    uint64_t total_ticks;
+  };
+  // Returns the totals of the named stage so far, or zeros if it never ran.
+  Totals GetTotals(const std::string& name);
+
+  // Logs all stages sorted by total time.
+  void Dump();
+
+ private:
+  struct Stage {
+    std::string name;
+    uint64_t count;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+    uint64_t histogram[kHistogramBucketCount];
+  };
+
+  CompileStats();
+
+  bool enabled_ = false;
+  xe::mutex lock_;
+  std::vector<Stage> stages_;
+};
+
+// Times the enclosing block as the given stage.
+class CompileStageScope {
+ public:
+  explicit CompileStageScope(const CompileStats::StageId& stage);
+  ~CompileStageScope();
+
+ private:
+  CompileStats::StageId stage_;
+  uint64_t start_ticks_ = 0;
+  uint64_t profile_ticks_ = 0;
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_COMPILE_STATS_H_
@@ -22,9 +22,21 @@ Compiler::~Compiler() { Reset(); }
 
 void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
   pass->Initialize(this);
+  pass_stages_.push_back(CompileStats::global()->GetStage(pass->name()));
   passes_.push_back(std::move(pass));
 }
 
+void Compiler::RemovePass(const std::string& name) {
+  for (size_t i = 0; i < passes_.size();) {
+    if (name == passes_[i]->name()) {
+      passes_.erase(passes_.begin() + i);
+      pass_stages_.erase(pass_stages_.begin() + i);
+    } else {
+      ++i;
+    }
+  }
+}
+
 void Compiler::Reset() {}
 
 bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
@@ -33,6 +45,7 @@ bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   for (size_t i = 0; i < passes_.size(); ++i) {
     auto& pass = passes_[i];
     scratch_arena_.Reset();
+    CompileStageScope stage_scope(pass_stages_[i]);
     if (!pass->Run(builder)) {
       return false;
     }
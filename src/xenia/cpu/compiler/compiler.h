@@ -11,9 +11,11 @@
 #define XENIA_CPU_COMPILER_COMPILER_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/compiler/compile_stats.h"
 #include "xenia/cpu/hir/hir_builder.h"
 
 namespace xe {
@@ -37,16 +39,34 @@ class Compiler {
   Arena* scratch_arena() { return &scratch_arena_; }
 
   void AddPass(std::unique_ptr<CompilerPass> pass);
+  // Drops all passes with the given name, such as to measure a pipeline
+  // without one of them.
+  void RemovePass(const std::string& name);
+  const std::vector<std::unique_ptr<CompilerPass>>& passes() const {
+    return passes_;
+  }
 
   void Reset();
 
+  // Times the scratch arena or a pass side structure had to grow since the
+  // compiler was created. Passes report their own growth through
+  // NoteScratchGrowth; other allocations are not counted. Passes keep their
+  // side structures across runs so in steady state a compile adds nothing.
+  uint64_t scratch_growth_count() const {
+    return scratch_growth_count_ + scratch_arena_.chunk_allocation_count();
+  }
+  void NoteScratchGrowth() { ++scratch_growth_count_; }
+
   bool Compile(hir::HIRBuilder* builder);
 
  private:
   Processor* processor_;
   Arena scratch_arena_;
+  uint64_t scratch_growth_count_ = 0;
 
   std::vector<std::unique_ptr<CompilerPass>> passes_;
+  // Timing stage of each pass, by pass index.
+  std::vector<CompileStats::StageId> pass_stages_;
 };
 
 }  // namespace compiler
@@ -0,0 +1,105 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/hir_corpus.h"
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/cpu_flags.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// File header, followed by a record per function of its guest address, the
+// size of its serialized HIR and the HIR itself.
+const uint32_t kHIRCorpusMagic = 'XHIR';
+const uint32_t kHIRCorpusVersion = 1;
+
+HIRCorpusWriter* HIRCorpusWriter::global() {
+  static HIRCorpusWriter writer;
+  return &writer;
+}
+
+HIRCorpusWriter::HIRCorpusWriter() {
+  if (FLAGS_hir_corpus_path.empty()) {
+    return;
+  }
+  file_ = xe::filesystem::OpenFile(xe::to_wstring(FLAGS_hir_corpus_path),
+                                   "wb");
+  if (!file_) {
+    XELOGE("Unable to create HIR corpus %s", FLAGS_hir_corpus_path.c_str());
+    return;
+  }
+  uint32_t header[] = {kHIRCorpusMagic, kHIRCorpusVersion};
+  fwrite(header, sizeof(header), 1, file_);
+  enabled_ = true;
+}
+
+HIRCorpusWriter::~HIRCorpusWriter() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+void HIRCorpusWriter::Append(uint32_t guest_address,
+                             hir::HIRBuilder* builder) {
+  {
+    std::lock_guard<xe::mutex> guard(lock_);
+    if (!captured_addresses_.insert(guest_address).second) {
+      return;
+    }
+  }
+  std::vector<uint8_t> data;
+  builder->Serialize(&data);
+  uint32_t record_header[] = {guest_address, uint32_t(data.size())};
+  std::lock_guard<xe::mutex> guard(lock_);
+  fwrite(record_header, sizeof(record_header), 1, file_);
+  fwrite(data.data(), data.size(), 1, file_);
+  // Keep what we have if the session crashes.
+  fflush(file_);
+}
+
+HIRCorpusReader::~HIRCorpusReader() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool HIRCorpusReader::Open(const std::wstring& path) {
+  file_ = xe::filesystem::OpenFile(path, "rb");
+  if (!file_) {
+    return false;
+  }
+  uint32_t header[2];
+  if (fread(header, sizeof(header), 1, file_) != 1 ||
+      header[0] != kHIRCorpusMagic || header[1] != kHIRCorpusVersion) {
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool HIRCorpusReader::Next(uint32_t* out_guest_address,
+                           std::vector<uint8_t>* out_data) {
+  uint32_t record_header[2];
+  if (!file_ || fread(record_header, sizeof(record_header), 1, file_) != 1) {
+    return false;
+  }
+  *out_guest_address = record_header[0];
+  out_data->resize(record_header[1]);
+  return out_data->empty() ||
+         fread(out_data->data(), out_data->size(), 1, file_) == 1;
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
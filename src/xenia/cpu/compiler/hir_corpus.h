@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_HIR_CORPUS_H_
+#define XENIA_CPU_COMPILER_HIR_CORPUS_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/hir/hir_builder.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Captures the HIR of every function translated in a session, before any
+// pass has run, to the file given by --hir_corpus_path.
+// xenia-cpu-hir-benchmark replays the corpus through the pass pipelines so
+// that passes can be measured without running titles.
+class HIRCorpusWriter {
+ public:
+  static HIRCorpusWriter* global();
+
+  bool is_enabled() const { return enabled_; }
+
+  // Appends the function unless it was already captured, such as when it is
+  // retranslated at a higher tier.
+  void Append(uint32_t guest_address, hir::HIRBuilder* builder);
+
+ private:
+  HIRCorpusWriter();
+  ~HIRCorpusWriter();
+
+  bool enabled_ = false;
+  xe::mutex lock_;
+  FILE* file_ = nullptr;
+  std::unordered_set<uint32_t> captured_addresses_;
+};
+
+class HIRCorpusReader {
+ public:
+  HIRCorpusReader() = default;
+  ~HIRCorpusReader();
+
+  bool Open(const std::wstring& path);
+
+  // Reads the serialized HIR of the next function, as passed to
+  // HIRBuilder::Deserialize. Returns false at the end of the corpus.
+  bool Next(uint32_t* out_guest_address, std::vector<uint8_t>* out_data);
+
+ private:
+  FILE* file_ = nullptr;
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_HIR_CORPUS_H_
@@ -0,0 +1,231 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/byte_swap_elimination_pass.h"
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::TypeName;
+using xe::cpu::hir::Value;
+
+namespace {
+// Bounds how far up the expression tree of a swap we look.
+const uint32_t kMaxSwapDepth = 8;
+
+bool HasSingleUse(const Value* value) {
+  return value->use_head && !value->use_head->next;
+}
+
+// Returns a new constant holding byte_swap(truncate(value, type)).
+Value* LoadSwappedConstant(HIRBuilder* builder, const Value* value,
+                           TypeName type) {
+  uint64_t bits = uint64_t(value->constant.i64);
+  switch (type) {
+    case INT16_TYPE:
+      return builder->LoadConstantUint16(xe::byte_swap(uint16_t(bits)));
+    case INT32_TYPE:
+      return builder->LoadConstantUint32(xe::byte_swap(uint32_t(bits)));
+    case INT64_TYPE:
+      return builder->LoadConstantUint64(xe::byte_swap(bits));
+    default:
+      assert_unhandled_case(type);
+      return nullptr;
+  }
+}
+
+bool IsBinaryBitwiseOp(const Instr* i) {
+  return i->opcode == &OPCODE_AND_info || i->opcode == &OPCODE_OR_info ||
+         i->opcode == &OPCODE_XOR_info;
+}
+}  // namespace
+
+ByteSwapEliminationPass::ByteSwapEliminationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass(),
+      fold_memory_ops_(machine_info->supports_extended_load_store) {}
+
+ByteSwapEliminationPass::~ByteSwapEliminationPass() = default;
+
+bool ByteSwapEliminationPass::Run(HIRBuilder* builder) {
+  // Guest memory is big-endian so every guest load and store gets a byte
+  // swap, even when the value is only masked/merged and written back:
+  //   v1.i32 = load v0
+  //   v2.i32 = byte_swap v1.i32
+  //   v3.i32 = and v2.i32, 0x0000FF00
+  //   v4.i32 = byte_swap v3.i32
+  //   store v0, v4.i32
+  // Bitwise ops commute with byte swapping, so the expression can be
+  // evaluated in guest byte order instead:
+  //   v1.i32 = load v0
+  //   v3.i32 = and v1.i32, 0x00FF0000
+  //   store v0, v3.i32
+  // The same applies to the swap flag on combined loads/stores. Truncations
+  // of wider ops (GPRs are 64-bit) are narrowed on the way.
+  //
+  // Interior values must have no other uses as they are rewritten in place,
+  // which means no instructions are ever added. Values do not live across
+  // blocks so this is per block; tight loops are usually a single block and
+  // end up with a swap-free body.
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      if (i->opcode == &OPCODE_BYTE_SWAP_info) {
+        if (CanSwap(i->src1.value, i->dest->type, 0)) {
+          auto value = Swap(builder, i->src1.value);
+          i->Replace(&OPCODE_ASSIGN_info, 0);
+          i->set_src1(value);
+        }
+      } else if (fold_memory_ops_ && i->opcode == &OPCODE_STORE_info &&
+                 (i->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+        auto src = i->src2.value;
+        if (!src->IsConstant() && CanSwap(src, src->type, 0)) {
+          i->flags ^= LoadStoreFlags::LOAD_STORE_BYTE_SWAP;
+          i->set_src2(Swap(builder, src));
+        }
+      }
+      i = i->next;
+    }
+    block = block->next;
+  }
+  return true;
+}
+
+bool ByteSwapEliminationPass::CanSwap(Value* value, TypeName type,
+                                      uint32_t depth) {
+  // Only scalar integers; i8 swaps are no-ops.
+  if (depth > kMaxSwapDepth || value->type != type || type < INT16_TYPE ||
+      type > INT64_TYPE) {
+    return false;
+  }
+  if (value->IsConstant()) {
+    return true;
+  }
+  auto def = value->def;
+  if (!def) {
+    return false;
+  }
+  if (def->opcode == &OPCODE_BYTE_SWAP_info) {
+    // Other uses of the swap are unaffected.
+    return true;
+  }
+
+  // Everything past here is rewritten in place.
+  if (!HasSingleUse(value)) {
+    return false;
+  }
+  if (def->opcode == &OPCODE_LOAD_info) {
+    return fold_memory_ops_;
+  } else if (def->opcode == &OPCODE_TRUNCATE_info) {
+    return CanSwapNarrowed(def->src1.value, type, depth + 1);
+  } else if (IsBinaryBitwiseOp(def)) {
+    return CanSwap(def->src1.value, type, depth + 1) &&
+           CanSwap(def->src2.value, type, depth + 1);
+  } else if (def->opcode == &OPCODE_NOT_info) {
+    return CanSwap(def->src1.value, type, depth + 1);
+  }
+  return false;
+}
+
+bool ByteSwapEliminationPass::CanSwapNarrowed(Value* value, TypeName type,
+                                              uint32_t depth) {
+  if (depth > kMaxSwapDepth) {
+    return false;
+  }
+  if (value->IsConstant()) {
+    return true;
+  }
+  auto def = value->def;
+  if (!def) {
+    return false;
+  }
+  if (def->opcode == &OPCODE_ZERO_EXTEND_info ||
+      def->opcode == &OPCODE_SIGN_EXTEND_info) {
+    // The extension bits are dropped by the truncate. If the extend is used
+    // elsewhere its source must not be rewritten.
+    auto src = def->src1.value;
+    if (!HasSingleUse(value) &&
+        (!src->def || src->def->opcode != &OPCODE_BYTE_SWAP_info)) {
+      return false;
+    }
+    return CanSwap(src, type, depth + 1);
+  }
+  if (!HasSingleUse(value)) {
+    return false;
+  }
+  if (IsBinaryBitwiseOp(def)) {
+    return CanSwapNarrowed(def->src1.value, type, depth + 1) &&
+           CanSwapNarrowed(def->src2.value, type, depth + 1);
+  } else if (def->opcode == &OPCODE_NOT_info) {
+    return CanSwapNarrowed(def->src1.value, type, depth + 1);
+  }
+  return false;
+}
+
+Value* ByteSwapEliminationPass::Swap(HIRBuilder* builder, Value* value) {
+  if (value->IsConstant()) {
+    return LoadSwappedConstant(builder, value, value->type);
+  }
+  auto def = value->def;
+  if (def->opcode == &OPCODE_BYTE_SWAP_info) {
+    return def->src1.value;
+  } else if (def->opcode == &OPCODE_LOAD_info) {
+    def->flags ^= LoadStoreFlags::LOAD_STORE_BYTE_SWAP;
+    return value;
+  } else if (def->opcode == &OPCODE_TRUNCATE_info) {
+    // The truncate is left as a dead assign for DCE.
+    auto narrowed = SwapNarrowed(builder, def->src1.value, value->type);
+    def->Replace(&OPCODE_ASSIGN_info, 0);
+    def->set_src1(narrowed);
+    return narrowed;
+  }
+  // Bitwise op; from here on it produces the swapped value.
+  def->set_src1(Swap(builder, def->src1.value));
+  if (def->opcode != &OPCODE_NOT_info) {
+    def->set_src2(Swap(builder, def->src2.value));
+  }
+  return value;
+}
+
+Value* ByteSwapEliminationPass::SwapNarrowed(HIRBuilder* builder,
+                                             Value* value, TypeName type) {
+  if (value->IsConstant()) {
+    return LoadSwappedConstant(builder, value, type);
+  }
+  auto def = value->def;
+  if (def->opcode == &OPCODE_ZERO_EXTEND_info ||
+      def->opcode == &OPCODE_SIGN_EXTEND_info) {
+    return Swap(builder, def->src1.value);
+  }
+  // Bitwise op; its only use was the truncate so it can be narrowed in place.
+  def->set_src1(SwapNarrowed(builder, def->src1.value, type));
+  if (def->opcode != &OPCODE_NOT_info) {
+    def->set_src2(SwapNarrowed(builder, def->src2.value, type));
+  }
+  value->type = type;
+  return value;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
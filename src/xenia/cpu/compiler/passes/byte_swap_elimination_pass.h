@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_BYTE_SWAP_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_BYTE_SWAP_ELIMINATION_PASS_H_
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Evaluates bitwise expressions on byte swapped values in guest byte order so
+// that the swaps around them (and on the loads/stores feeding them) vanish.
+class ByteSwapEliminationPass : public CompilerPass {
+ public:
+  explicit ByteSwapEliminationPass(const backend::MachineInfo* machine_info);
+  ~ByteSwapEliminationPass() override;
+
+  const char* name() const override { return "ByteSwapEliminationPass"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  // Whether a value equal to byte_swap(value) can be produced without adding
+  // instructions.
+  bool CanSwap(hir::Value* value, hir::TypeName type, uint32_t depth);
+  // As CanSwap, for byte_swap(truncate(value, type)).
+  bool CanSwapNarrowed(hir::Value* value, hir::TypeName type, uint32_t depth);
+  // Rewrites the expression and returns the swapped value. Only valid if the
+  // matching Can* check succeeded.
+  hir::Value* Swap(hir::HIRBuilder* builder, hir::Value* value);
+  hir::Value* SwapNarrowed(hir::HIRBuilder* builder, hir::Value* value,
+                           hir::TypeName type);
+
+  // Loads and stores may have their byte swap flag toggled.
+  bool fold_memory_ops_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_BYTE_SWAP_ELIMINATION_PASS_H_
@@ -0,0 +1,220 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/common_subexpression_elimination_pass.h"
+
+#include <cstring>
+
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// Looks through assignments so renamed copies compare equal.
+Value* ResolveValue(Value* value) {
+  while (value->def && value->def->opcode == &OPCODE_ASSIGN_info) {
+    value = value->def->src1.value;
+  }
+  return value;
+}
+
+bool IsSameValue(Value* a, Value* b) {
+  a = ResolveValue(a);
+  b = ResolveValue(b);
+  if (a == b) {
+    return true;
+  }
+  if (a->IsConstant() && b->IsConstant() && a->type == b->type) {
+    // Compare bits so that NaN and -0.0 constants behave.
+    return !std::memcmp(&a->constant, &b->constant, GetTypeSize(a->type));
+  }
+  return false;
+}
+
+uint64_t HashValue(Value* value) {
+  value = ResolveValue(value);
+  if (!value->IsConstant()) {
+    return reinterpret_cast<uintptr_t>(value);
+  }
+  // FNV-1a over the constant bits.
+  uint64_t hash = 14695981039346656037ull ^ value->type;
+  auto bytes = reinterpret_cast<const uint8_t*>(&value->constant);
+  for (size_t n = 0; n < GetTypeSize(value->type); ++n) {
+    hash = (hash ^ bytes[n]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+uint64_t HashOperand(Instr::Op& op, uint32_t sig_type) {
+  switch (sig_type) {
+    case OPCODE_SIG_TYPE_V:
+      return HashValue(op.value);
+    case OPCODE_SIG_TYPE_O:
+      return op.offset;
+    default:
+      return 0;
+  }
+}
+
+bool IsSameOperand(Instr::Op& a, Instr::Op& b, uint32_t sig_type) {
+  switch (sig_type) {
+    case OPCODE_SIG_TYPE_V:
+      return IsSameValue(a.value, b.value);
+    case OPCODE_SIG_TYPE_O:
+      return a.offset == b.offset;
+    default:
+      return true;
+  }
+}
+
+}  // namespace
+
+CommonSubexpressionEliminationPass::CommonSubexpressionEliminationPass()
+    : CompilerPass() {}
+
+CommonSubexpressionEliminationPass::~CommonSubexpressionEliminationPass() {}
+
+bool CommonSubexpressionEliminationPass::Run(HIRBuilder* builder) {
+  // Guest code recomputes the same values a lot, for example the effective
+  // address of each field in a structure copy:
+  //   v1 = add v0, 8
+  //   v2 = load v1
+  //   v3 = add v0, 8
+  //   v4 = load v3
+  // becomes
+  //   v1 = add v0, 8
+  //   v2 = load v1
+  //   v3 = assign v1
+  //   v4 = load v3
+  // Only instructions whose result depends on nothing but their operands are
+  // merged, so memory side effects in between don't matter. Values can't
+  // cross blocks in HIR, so this stays within each block.
+  auto block = builder->first_block();
+  while (block) {
+    ProcessBlock(block);
+    block = block->next;
+  }
+  return true;
+}
+
+void CommonSubexpressionEliminationPass::ProcessBlock(Block* block) {
+  available_.clear();
+  for (auto i = block->instr_head; i; i = i->next) {
+    if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
+      // May change how FP math rounds (or worse).
+      available_.clear();
+      continue;
+    }
+    if (!IsCandidate(i)) {
+      continue;
+    }
+    uint64_t hash = HashInstr(i);
+    bool replaced = false;
+    auto range = available_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      auto prev = it->second;
+      if (IsEquivalent(prev, i)) {
+        i->Replace(&OPCODE_ASSIGN_info, 0);
+        i->set_src1(prev->dest);
+        replaced = true;
+        break;
+      }
+    }
+    if (!replaced) {
+      available_.emplace(hash, i);
+    }
+  }
+}
+
+bool CommonSubexpressionEliminationPass::IsCandidate(Instr* i) {
+  if (!i->dest) {
+    return false;
+  }
+  if (i->opcode->flags &
+      (OPCODE_FLAG_BRANCH | OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE |
+       OPCODE_FLAG_IGNORE | OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+  // These read state that isn't in their operands. Context is handled by
+  // ContextPromotionPass.
+  if (i->opcode == &OPCODE_ASSIGN_info ||
+      i->opcode == &OPCODE_LOAD_CLOCK_info ||
+      i->opcode == &OPCODE_LOAD_LOCAL_info ||
+      i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    return false;
+  }
+  // Instructions whose flags are read by the next one must stay.
+  if (i->next && i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    return false;
+  }
+  auto signature = i->opcode->signature;
+  auto is_simple = [](uint32_t sig_type) {
+    return sig_type == OPCODE_SIG_TYPE_X || sig_type == OPCODE_SIG_TYPE_V ||
+           sig_type == OPCODE_SIG_TYPE_O;
+  };
+  return is_simple(GET_OPCODE_SIG_TYPE_SRC1(signature)) &&
+         is_simple(GET_OPCODE_SIG_TYPE_SRC2(signature)) &&
+         is_simple(GET_OPCODE_SIG_TYPE_SRC3(signature));
+}
+
+uint64_t CommonSubexpressionEliminationPass::HashInstr(Instr* i) {
+  auto signature = i->opcode->signature;
+  uint64_t src1 = HashOperand(i->src1, GET_OPCODE_SIG_TYPE_SRC1(signature));
+  uint64_t src2 = HashOperand(i->src2, GET_OPCODE_SIG_TYPE_SRC2(signature));
+  uint64_t src3 = HashOperand(i->src3, GET_OPCODE_SIG_TYPE_SRC3(signature));
+  uint64_t hash = reinterpret_cast<uintptr_t>(i->opcode);
+  hash = hash * 31 + i->flags;
+  hash = hash * 31 + i->dest->type;
+  if (i->opcode->flags & OPCODE_FLAG_COMMUNATIVE) {
+    // Order independent so that add(a, b) finds add(b, a).
+    hash = hash * 31 + (src1 + src2);
+  } else {
+    hash = (hash * 31 + src1) * 31 + src2;
+  }
+  return hash * 31 + src3;
+}
+
+bool CommonSubexpressionEliminationPass::IsEquivalent(Instr* a, Instr* b) {
+  if (a->opcode != b->opcode || a->flags != b->flags ||
+      a->dest->type != b->dest->type) {
+    return false;
+  }
+  auto signature = a->opcode->signature;
+  auto src1_type = GET_OPCODE_SIG_TYPE_SRC1(signature);
+  auto src2_type = GET_OPCODE_SIG_TYPE_SRC2(signature);
+  auto src3_type = GET_OPCODE_SIG_TYPE_SRC3(signature);
+  if (!IsSameOperand(a->src3, b->src3, src3_type)) {
+    return false;
+  }
+  if (IsSameOperand(a->src1, b->src1, src1_type) &&
+      IsSameOperand(a->src2, b->src2, src2_type)) {
+    return true;
+  }
+  return (a->opcode->flags & OPCODE_FLAG_COMMUNATIVE) &&
+         src1_type == src2_type &&
+         IsSameOperand(a->src1, b->src2, src1_type) &&
+         IsSameOperand(a->src2, b->src1, src2_type);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Replaces pure instructions that recompute a value already available in the
+// block with assignments of that value. Memory and context accesses are never
+// merged. Run SimplificationPass afterwards to fold the assignments.
+class CommonSubexpressionEliminationPass : public CompilerPass {
+ public:
+  CommonSubexpressionEliminationPass();
+  ~CommonSubexpressionEliminationPass() override;
+
+  const char* name() const override {
+    return "CommonSubexpressionEliminationPass";
+  }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  void ProcessBlock(hir::Block* block);
+  bool IsCandidate(hir::Instr* i);
+  uint64_t HashInstr(hir::Instr* i);
+  bool IsEquivalent(hir::Instr* a, hir::Instr* b);
+
+ private:
+  // Candidates seen so far in the current block, by HashInstr.
+  std::unordered_multimap<uint64_t, hir::Instr*> available_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_COMMON_SUBEXPRESSION_ELIMINATION_PASS_H_
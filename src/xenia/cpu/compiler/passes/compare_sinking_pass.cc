@@ -0,0 +1,84 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/compare_sinking_pass.h"
+
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+CompareSinkingPass::CompareSinkingPass() : CompilerPass() {}
+
+CompareSinkingPass::~CompareSinkingPass() {}
+
+bool CompareSinkingPass::Run(HIRBuilder* builder) {
+  // A cmpw/bc pair writes all of the CR field to context and the branch reads
+  // one bit of it back. Once context promotion and dead store elimination
+  // are done this is usually just:
+  //   v3 = compare_eq v1, v2
+  //   ...
+  //   branch_true v3, loc_82001000
+  // With the compare right before the branch the backend can emit cmp+jcc
+  // instead of materializing v3 and testing it:
+  //   ...
+  //   v3 = compare_eq v1, v2
+  //   branch_true v3, loc_82001000
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_tail;
+    while (i) {
+      auto prev = i->prev;
+      if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+          i->opcode == &OPCODE_BRANCH_FALSE_info) {
+        auto value = i->src1.value;
+        auto def = value->def;
+        if (def && def->block == block && def->next != i &&
+            IsScalarCompare(def) && value->use_head &&
+            !value->use_head->next) {
+          // Leave compares whose flags are consumed by the next instruction.
+          if (!def->next ||
+              !(def->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV)) {
+            def->MoveBefore(i);
+          }
+        }
+      }
+      i = prev;
+    }
+    block = block->next;
+  }
+  return true;
+}
+
+bool CompareSinkingPass::IsScalarCompare(Instr* i) {
+  return i->opcode == &OPCODE_COMPARE_EQ_info ||
+         i->opcode == &OPCODE_COMPARE_NE_info ||
+         i->opcode == &OPCODE_COMPARE_SLT_info ||
+         i->opcode == &OPCODE_COMPARE_SLE_info ||
+         i->opcode == &OPCODE_COMPARE_SGT_info ||
+         i->opcode == &OPCODE_COMPARE_SGE_info ||
+         i->opcode == &OPCODE_COMPARE_ULT_info ||
+         i->opcode == &OPCODE_COMPARE_ULE_info ||
+         i->opcode == &OPCODE_COMPARE_UGT_info ||
+         i->opcode == &OPCODE_COMPARE_UGE_info;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,41 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_COMPARE_SINKING_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_COMPARE_SINKING_PASS_H_
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Moves compares used only by a conditional branch down to just before that
+// branch so backends can branch on the compare flags directly.
+// Should run after dead store elimination has removed CR stores.
+class CompareSinkingPass : public CompilerPass {
+ public:
+  CompareSinkingPass();
+  ~CompareSinkingPass() override;
+
+  const char* name() const override { return "CompareSinkingPass"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  bool IsScalarCompare(hir::Instr* i);
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_COMPARE_SINKING_PASS_H_
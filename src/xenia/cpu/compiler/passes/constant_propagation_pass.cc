@@ -457,7 +457,27 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder) {
             i->Remove();
           }
           break;
-        // TODO(benvanik): VECTOR_SHL
+        case OPCODE_VECTOR_SHL:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorShl(i->src2.value, TypeName(i->flags));
+            i->Remove();
+          }
+          break;
+        case OPCODE_VECTOR_SHR:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorShr(i->src2.value, TypeName(i->flags));
+            i->Remove();
+          }
+          break;
+        case OPCODE_VECTOR_SHA:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorSha(i->src2.value, TypeName(i->flags));
+            i->Remove();
+          }
+          break;
         case OPCODE_SHR:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -472,7 +492,13 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder) {
             i->Remove();
           }
           break;
-        // TODO(benvanik): ROTATE_LEFT
+        case OPCODE_ROTATE_LEFT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->RotateLeft(i->src2.value);
+            i->Remove();
+          }
+          break;
         case OPCODE_BYTE_SWAP:
           if (i->src1.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -487,11 +513,58 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder) {
             i->Remove();
           }
           break;
-        // TODO(benvanik): INSERT/EXTRACT
-        // TODO(benvanik): SPLAT/PERMUTE/SWIZZLE
+        case OPCODE_INSERT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->src3.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->Insert(i->src2.value, i->src3.value);
+            i->Remove();
+          }
+          break;
+        case OPCODE_EXTRACT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_zero(v->type);
+            v->Extract(i->src1.value, i->src2.value);
+            i->Remove();
+          }
+          break;
         case OPCODE_SPLAT:
+          // Quite a few of these, from building vec128s.
           if (i->src1.value->IsConstant()) {
-            // Quite a few of these, from building vec128s.
+            v->set_zero(v->type);
+            v->Splat(i->src1.value);
+            i->Remove();
+          }
+          break;
+        case OPCODE_PERMUTE:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->src3.value->IsConstant() &&
+              (i->flags == INT8_TYPE || i->flags == INT32_TYPE)) {
+            v->set_zero(v->type);
+            v->Permute(i->src1.value, i->src2.value, i->src3.value,
+                       TypeName(i->flags));
+            i->Remove();
+          }
+          break;
+        case OPCODE_SWIZZLE:
+          if (i->src1.value->IsConstant() &&
+              (i->flags == INT32_TYPE || i->flags == FLOAT32_TYPE)) {
+            v->set_from(i->src1.value);
+            v->Swizzle(uint32_t(i->src2.offset), TypeName(i->flags));
+            i->Remove();
+          }
+          break;
+        case OPCODE_VECTOR_COMPARE_EQ:
+        case OPCODE_VECTOR_COMPARE_SGT:
+        case OPCODE_VECTOR_COMPARE_SGE:
+        case OPCODE_VECTOR_COMPARE_UGT:
+        case OPCODE_VECTOR_COMPARE_UGE:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->flags <= FLOAT32_TYPE && i->flags != INT64_TYPE) {
+            v->set_from(i->src1.value);
+            v->VectorCompare(i->opcode->num, i->src2.value,
+                             TypeName(i->flags));
+            i->Remove();
           }
           break;
 
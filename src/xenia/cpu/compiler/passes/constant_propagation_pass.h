@@ -22,6 +22,8 @@ class ConstantPropagationPass : public CompilerPass {
   ConstantPropagationPass();
   ~ConstantPropagationPass() override;
 
+  const char* name() const override { return "ConstantPropagationPass"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/platform.h"
 #include "xenia/cpu/backend/backend.h"
@@ -16,16 +18,6 @@
 #include "xenia/cpu/processor.h"
 #include "xenia/profiling.h"
 
-#if XE_COMPILER_MSVC
-#pragma warning(push)
-#pragma warning(disable : 4244)
-#pragma warning(disable : 4267)
-#include <llvm/ADT/BitVector.h>
-#pragma warning(pop)
-#else
-#include <llvm/ADT/BitVector.h>
-#endif  // XE_COMPILER_MSVC
-
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -64,6 +56,26 @@ uint32_t DataFlowAnalysisPass::LinearizeBlocks(HIRBuilder* builder) {
   return block_ordinal;
 }
 
+void DataFlowAnalysisPass::PrepareBitVectors(uint32_t block_count,
+                                             uint32_t bit_count) {
+  if (block_count > incoming_bitvectors_.size() || bit_count > bit_capacity_) {
+    compiler_->NoteScratchGrowth();
+    bit_capacity_ = std::max(bit_capacity_, bit_count);
+    incoming_bitvectors_.resize(
+        std::max(size_t(block_count), incoming_bitvectors_.size()));
+    for (auto& bits : incoming_bitvectors_) {
+      bits.reserve(bit_capacity_);
+    }
+    outgoing_values_.reserve(bit_capacity_);
+  }
+  for (uint32_t n = 0; n < block_count; n++) {
+    incoming_bitvectors_[n].clear();
+    incoming_bitvectors_[n].resize(bit_count);
+  }
+  outgoing_values_.clear();
+  outgoing_values_.resize(bit_count);
+}
+
 void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
                                        uint32_t block_count) {
   uint32_t max_value_estimate =
@@ -74,21 +86,16 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
   auto value_map = reinterpret_cast<Value**>(
       arena->Alloc(sizeof(Value*) * max_value_estimate));
 
-  // Allocate incoming bitvectors for use by blocks. We don't need outgoing
+  // Clear incoming bitvectors for use by blocks. We don't need outgoing
   // because they are only used during the block iteration.
   // Mapped by block ordinal.
-  // TODO(benvanik): cache this list, grow as needed, etc.
-  auto incoming_bitvectors =
-      (llvm::BitVector**)arena->Alloc(sizeof(llvm::BitVector*) * block_count);
-  for (auto n = 0u; n < block_count; n++) {
-    incoming_bitvectors[n] = new llvm::BitVector(max_value_estimate);
-  }
+  PrepareBitVectors(block_count, max_value_estimate);
 
   // Walk blocks in reverse and calculate incoming/outgoing values.
   auto block = builder->last_block();
   while (block) {
     // Allocate bitsets based on max value number.
-    block->incoming_values = incoming_bitvectors[block->ordinal];
+    block->incoming_values = &incoming_bitvectors_[block->ordinal];
     auto& incoming_values = *block->incoming_values;
 
     // Walk instructions and gather up incoming values.
@@ -116,7 +123,8 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
 
     // Add all successor incoming values to our outgoing, as we need to
     // pass them through.
-    llvm::BitVector outgoing_values(max_value_estimate);
+    auto& outgoing_values = outgoing_values_;
+    outgoing_values.reset();
     auto outgoing_edge = block->outgoing_edge_head;
     while (outgoing_edge) {
       if (outgoing_edge->dest->ordinal > block->ordinal) {
@@ -200,11 +208,6 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
 
     block = block->prev;
   }
-
-  // Cleanup bitvectors.
-  for (auto n = 0u; n < block_count; n++) {
-    delete incoming_bitvectors[n];
-  }
 }
 
 }  // namespace passes
@@ -10,8 +10,21 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_DATA_FLOW_ANALYSIS_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_DATA_FLOW_ANALYSIS_PASS_H_
 
+#include <vector>
+
+#include "xenia/base/platform.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
 
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -22,11 +35,20 @@ class DataFlowAnalysisPass : public CompilerPass {
   DataFlowAnalysisPass();
   ~DataFlowAnalysisPass() override;
 
+  const char* name() const override { return "DataFlowAnalysisPass"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
   uint32_t LinearizeBlocks(hir::HIRBuilder* builder);
   void AnalyzeFlow(hir::HIRBuilder* builder, uint32_t block_count);
+  void PrepareBitVectors(uint32_t block_count, uint32_t bit_count);
+
+  // Kept across runs and only ever grown. Every vector has room for at least
+  // bit_capacity_ bits.
+  std::vector<llvm::BitVector> incoming_bitvectors_;
+  llvm::BitVector outgoing_values_;
+  uint32_t bit_capacity_ = 0;
 };
 
 }  // namespace passes
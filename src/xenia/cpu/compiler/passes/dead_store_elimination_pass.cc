@@ -0,0 +1,164 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include <gflags/gflags.h>
+
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/profiling.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() = default;
+
+bool DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+  context_size_ =
+      static_cast<uint32_t>(processor_->frontend()->context_info()->size());
+  live_.resize(context_size_);
+  return true;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  // Same restrictions as the block-local version in ContextPromotionPass.
+  if (FLAGS_debug || FLAGS_store_all_context_values) {
+    return true;
+  }
+
+  // Example:
+  //   block0:
+  //     store_context +100, v0  <-- removed, killed in both successors
+  //     branch_true v1, block2
+  //   block1:
+  //     store_context +100, v2
+  //     ...
+  //   block2:
+  //     store_context +100, v3
+  //     ...
+  // Anything that leaves the function (or may observe the context, like
+  // calls and traps) makes the whole context live.
+  uint32_t block_count = LinearizeBlocks(builder);
+  if (block_count > live_in_.size()) {
+    // Sets are kept across runs; only new ones need allocating.
+    compiler_->NoteScratchGrowth();
+    live_in_.resize(block_count);
+  }
+  for (uint32_t n = 0; n < block_count; n++) {
+    live_in_[n].clear();
+    live_in_[n].resize(context_size_);
+  }
+
+  // Iterate backwards to a fixed point. Live sets only ever grow.
+  auto& live = live_;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->last_block(); block; block = block->prev) {
+      AnalyzeBlock(block, &live, false);
+      if (live != live_in_[block->ordinal]) {
+        live_in_[block->ordinal] = live;
+        changed = true;
+      }
+    }
+  }
+
+  for (auto block = builder->first_block(); block; block = block->next) {
+    AnalyzeBlock(block, &live, true);
+  }
+
+  return true;
+}
+
+uint32_t DeadStoreEliminationPass::LinearizeBlocks(HIRBuilder* builder) {
+  uint16_t block_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_ordinal++;
+    block = block->next;
+  }
+  return block_ordinal;
+}
+
+void DeadStoreEliminationPass::AnalyzeBlock(Block* block,
+                                            llvm::BitVector* live,
+                                            bool remove_dead_stores) {
+  // Live-out: blocks normally end in an unconditional jump (which we handle
+  // below). Blocks ending in a conditional branch, or in nothing, also fall
+  // through to the next block; the branch target is merged in below.
+  live->reset();
+  auto tail = block->instr_tail;
+  if (!tail || !(tail->opcode->flags & OPCODE_FLAG_BRANCH) ||
+      tail->opcode == &OPCODE_BRANCH_TRUE_info ||
+      tail->opcode == &OPCODE_BRANCH_FALSE_info) {
+    if (block->next) {
+      *live |= live_in_[block->next->ordinal];
+    } else {
+      live->set();
+    }
+  }
+
+  Instr* i = block->instr_tail;
+  while (i) {
+    Instr* prev = i->prev;
+    if (i->opcode == &OPCODE_BRANCH_info) {
+      *live = live_in_[i->src1.label->block->ordinal];
+    } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+               i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      *live |= live_in_[i->src2.label->block->ordinal];
+    } else if (i->opcode->flags &
+               (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
+      // Calls/returns/traps/etc may observe everything.
+      live->set();
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->dest->type));
+      live->set(offset, offset + size);
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      bool is_live = false;
+      for (uint32_t n = offset; n < offset + size; ++n) {
+        if (live->test(n)) {
+          is_live = true;
+          break;
+        }
+      }
+      if (!is_live && remove_dead_stores) {
+        i->Remove();
+      } else {
+        live->reset(offset, offset + size);
+      }
+    }
+    i = prev;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
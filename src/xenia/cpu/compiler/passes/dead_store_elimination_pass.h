@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context stores that are overwritten on every path before being
+// read. Unlike the block-local cleanup in ContextPromotionPass this tracks
+// context liveness (per byte) across blocks.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  const char* name() const override { return "DeadStoreEliminationPass"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  uint32_t LinearizeBlocks(hir::HIRBuilder* builder);
+  // Computes the live context bytes on entry to the block given the current
+  // live-in sets of all other blocks, optionally removing dead stores.
+  void AnalyzeBlock(hir::Block* block, llvm::BitVector* live,
+                    bool remove_dead_stores);
+
+ private:
+  uint32_t context_size_ = 0;
+  // Live context bytes on entry to each block, by block ordinal.
+  std::vector<llvm::BitVector> live_in_;
+  // Scratch live set, kept across runs.
+  llvm::BitVector live_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
@@ -0,0 +1,191 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/inlining_pass.h"
+
+#include <gflags/gflags.h>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/frontend/ppc_context.h"
+#include "xenia/cpu/frontend/ppc_frontend.h"
+#include "xenia/cpu/frontend/ppc_instr.h"
+#include "xenia/cpu/processor.h"
+
+DECLARE_bool(debug);
+
+DEFINE_bool(inline_functions, true,
+            "Inline small leaf guest functions into their callers.");
+DEFINE_int32(inline_max_instructions, 24,
+             "Maximum number of PPC instructions in an inlined function.");
+DEFINE_int32(hot_inline_max_instructions, 96,
+             "Maximum number of PPC instructions in a function inlined into "
+             "a hot function.");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::frontend::PPCContext;
+using xe::cpu::frontend::PPCHIRBuilder;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+// blr
+static const uint32_t kBlrInstruction = 0x4E800020;
+
+InliningPass::InliningPass(bool aggressive)
+    : CompilerPass(),
+      max_instructions_(aggressive ? FLAGS_hot_inline_max_instructions
+                                   : FLAGS_inline_max_instructions) {}
+
+InliningPass::~InliningPass() = default;
+
+bool InliningPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+  callee_builder_.reset(new PPCHIRBuilder(processor_->frontend()));
+  return true;
+}
+
+bool InliningPass::Run(HIRBuilder* builder) {
+  // Inlined functions vanish from stack traces, so don't bother when
+  // debugging.
+  if (!FLAGS_inline_functions || FLAGS_debug) {
+    return true;
+  }
+
+  // Only direct calls are candidates:
+  //   set_return_address +4
+  //   store_context +lr, +4
+  //   call fn             <-- replaced with fn's body (minus the blr)
+  // Inlined bodies never contain calls, so there's nothing to reconsider.
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      auto next = i->next;
+      if (i->opcode == &OPCODE_CALL_info) {
+        InlineCall(builder, i);
+      }
+      i = next;
+    }
+    block = block->next;
+  }
+
+  return true;
+}
+
+bool InliningPass::FindInlineEndAddress(uint32_t address,
+                                        uint32_t* out_end_address) {
+  // Walk forward until the first control flow instruction. The function is
+  // straight-line only if that is a plain blr.
+  auto memory = processor_->memory();
+  for (int32_t n = 0; n <= max_instructions_; ++n) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    auto type = frontend::GetInstrType(code);
+    if (!type) {
+      return false;
+    }
+    if (type->type &
+        (frontend::kXEPPCInstrTypeBranch | frontend::kXEPPCInstrTypeSyscall)) {
+      if (code != kBlrInstruction) {
+        return false;
+      }
+      *out_end_address = address;
+      return true;
+    }
+    address += 4;
+  }
+  return false;
+}
+
+bool InliningPass::IsInlinable(bool is_tail_call) {
+  auto block = callee_builder_->first_block();
+  if (!block || block != callee_builder_->last_block()) {
+    return false;
+  }
+  for (auto i = block->instr_head; i; i = i->next) {
+    if (i == block->instr_tail) {
+      // Must be the trailing blr.
+      return i->opcode == &OPCODE_CALL_INDIRECT_info;
+    }
+    if (i->opcode->flags & OPCODE_FLAG_BRANCH) {
+      return false;
+    }
+    if (i->opcode == &OPCODE_TRAP_info || i->opcode == &OPCODE_TRAP_TRUE_info ||
+        i->opcode == &OPCODE_DEBUG_BREAK_info ||
+        i->opcode == &OPCODE_DEBUG_BREAK_TRUE_info ||
+        i->opcode == &OPCODE_CALL_EXTERN_info ||
+        i->opcode == &OPCODE_LOAD_LOCAL_info ||
+        i->opcode == &OPCODE_STORE_LOCAL_info) {
+      return false;
+    }
+    if (!is_tail_call && i->opcode == &OPCODE_STORE_CONTEXT_info &&
+        i->src1.offset == offsetof(PPCContext, lr)) {
+      // The blr would no longer return to us.
+      return false;
+    }
+  }
+  return false;
+}
+
+bool InliningPass::InlineCall(HIRBuilder* builder, Instr* call_instr) {
+  auto symbol = call_instr->src1.symbol;
+  if (!symbol->is_guest() ||
+      symbol->behavior() == Function::Behavior::kExtern) {
+    return false;
+  }
+  auto function = static_cast<GuestFunction*>(symbol);
+  bool is_tail_call = (call_instr->flags & CALL_TAIL) != 0;
+
+  uint32_t end_address;
+  if (!FindInlineEndAddress(function->address(), &end_address)) {
+    return false;
+  }
+
+  callee_builder_->Reset();
+  if (!callee_builder_->Emit(function, 0, end_address) ||
+      !IsInlinable(is_tail_call)) {
+    return false;
+  }
+
+  // Source offsets from the callee would confuse source maps, and comments
+  // point into the callee builder arena.
+  auto block = callee_builder_->first_block();
+  auto i = block->instr_head;
+  while (i) {
+    auto next = i->next;
+    if (i->opcode == &OPCODE_SOURCE_OFFSET_info ||
+        i->opcode == &OPCODE_COMMENT_info) {
+      i->Remove();
+    }
+    i = next;
+  }
+
+  // Tail calls keep the blr so they return to our caller; otherwise we just
+  // fall through past the call.
+  auto last = is_tail_call ? block->instr_tail : block->instr_tail->prev;
+  if (last) {
+    builder->CloneInstrsBefore(block->instr_head, last, call_instr);
+  }
+  call_instr->Remove();
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,54 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_INLINING_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_INLINING_PASS_H_
+
+#include <memory>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/frontend/ppc_hir_builder.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Splices the bodies of small leaf guest functions (getters/setters, the
+// save/restore GPR helpers, etc) into their callers. Only straight-line
+// functions ending in a blr are inlined so that no control flow needs to be
+// rewritten.
+class InliningPass : public CompilerPass {
+ public:
+  // Aggressive inlining allows larger callees and is used for hot functions.
+  explicit InliningPass(bool aggressive = false);
+  ~InliningPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  const char* name() const override { return "InliningPass"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  bool InlineCall(hir::HIRBuilder* builder, hir::Instr* call_instr);
+  bool FindInlineEndAddress(uint32_t address, uint32_t* out_end_address);
+  bool IsInlinable(bool is_tail_call);
+
+  int32_t max_instructions_;
+  // Scratch builder used to emit callee HIR before it is cloned.
+  std::unique_ptr<frontend::PPCHIRBuilder> callee_builder_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_INLINING_PASS_H_
@@ -0,0 +1,349 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
+
+#include <gflags/gflags.h>
+
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/profiling.h"
+
+DEFINE_bool(dump_loop_invariant_code_motion_stats, false,
+            "Log per-function loop and hoisted instruction counts.");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+LoopInvariantCodeMotionPass::LoopInvariantCodeMotionPass() : CompilerPass() {}
+
+LoopInvariantCodeMotionPass::~LoopInvariantCodeMotionPass() {}
+
+bool LoopInvariantCodeMotionPass::Run(HIRBuilder* builder) {
+  // Tight guest loops are usually a single block ending in a bdnz/bc back to
+  // itself, and often redo work that doesn't depend on the iteration:
+  //   loc_82001000:
+  //     v10 = load_context +r5
+  //     v11 = shl v10, 2
+  //     v12 = add v11, 0x40
+  //     v13 = load_context +r3
+  //     v14 = add v13, v12
+  //     ...
+  //     branch_true v20, loc_82001000
+  // The loop block is entered from the block before it, so we compute
+  // v10-v12 there once and pass v12 in through a local:
+  //     v10 = load_context +r5
+  //     v11 = shl v10, 2
+  //     v12 = add v11, 0x40
+  //     store_local l0, v12
+  //   loc_82001000:
+  //     v30 = load_local l0
+  //     v13 = load_context +r3
+  //     v14 = add v13, v30
+  // Loads of context not written in the loop are invariant, but moving only
+  // those would just trade a context load for a local load, so they are
+  // hoisted only as inputs to hoisted computation.
+  // When the entry block ends in branches the hoisted code gets a block of its
+  // own between it and the loop. Putting it before the branches would split
+  // compares from their branches and run it on paths skipping the loop.
+  std::memset(&stats_, 0, sizeof(stats_));
+
+  auto block = builder->first_block();
+  while (block) {
+    Instr* first_branch = nullptr;
+    if (FindEntryBranches(block, &first_branch)) {
+      ++stats_.loops;
+      HoistBlock(builder, block, first_branch);
+    }
+    block = block->next;
+  }
+
+  if (FLAGS_dump_loop_invariant_code_motion_stats && stats_.loops) {
+    DumpStats(builder);
+  }
+
+  return true;
+}
+
+bool LoopInvariantCodeMotionPass::FindEntryBranches(Block* loop,
+                                                    Instr** out_first_branch) {
+  // Must branch to itself and otherwise only be entered from the previous
+  // block (by branch or fallthrough).
+  auto entry = loop->prev;
+  if (!entry || !loop->instr_head || !entry->instr_tail) {
+    return false;
+  }
+  bool is_loop = false;
+  for (auto edge = loop->incoming_edge_head; edge; edge = edge->incoming_next) {
+    if (edge->src == loop) {
+      is_loop = true;
+    } else if (edge->src != entry) {
+      return false;
+    }
+  }
+  if (!is_loop) {
+    return false;
+  }
+
+  // Branches ending the entry block are retargeted to the preheader. Anything
+  // else in that position (calls, returns) may leave the block or change
+  // context, so give up in that case.
+  Instr* first_branch = nullptr;
+  for (auto i = entry->instr_tail; i; i = i->prev) {
+    if (i->opcode == &OPCODE_BRANCH_info ||
+        i->opcode == &OPCODE_BRANCH_TRUE_info ||
+        i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      first_branch = i;
+    } else if (i->opcode->flags & OPCODE_FLAG_BRANCH) {
+      return false;
+    } else {
+      break;
+    }
+  }
+  *out_first_branch = first_branch;
+  return true;
+}
+
+bool LoopInvariantCodeMotionPass::IsInvariant(Block* loop, Instr* i) {
+  if (!i->dest) {
+    return false;
+  }
+  if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    size_t offset = i->src1.offset;
+    size_t size = GetTypeSize(i->dest->type);
+    for (auto& store : context_stores_) {
+      if (offset < store.first + store.second &&
+          store.first < offset + size) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (i->opcode->flags &
+      (OPCODE_FLAG_BRANCH | OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE |
+       OPCODE_FLAG_IGNORE | OPCODE_FLAG_PAIRED_PREV)) {
+    return false;
+  }
+  if (i->opcode == &OPCODE_LOAD_LOCAL_info ||
+      i->opcode == &OPCODE_LOAD_CLOCK_info) {
+    return false;
+  }
+  // Instructions whose flags are read by the next one must stay with it.
+  if (i->next && i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    return false;
+  }
+  auto signature = i->opcode->signature;
+  auto is_invariant_value = [this, loop](Value* value) {
+    if (value->IsConstant()) {
+      return true;
+    }
+    return value->def && value->def->block == loop &&
+           states_[value->def->ordinal] != kVariant;
+  };
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+      !is_invariant_value(i->src1.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+      !is_invariant_value(i->src2.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+      !is_invariant_value(i->src3.value)) {
+    return false;
+  }
+  return true;
+}
+
+void LoopInvariantCodeMotionPass::HoistBlock(HIRBuilder* builder, Block* loop,
+                                             Instr* first_branch) {
+  // Number the instructions so we can keep state by ordinal. Anything that
+  // may change context (other than the looping branches) makes us bail, as
+  // would anything that changes how FP math rounds.
+  context_stores_.clear();
+  uint32_t count = 0;
+  for (auto i = loop->instr_head; i; i = i->next) {
+    i->ordinal = count++;
+    if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      context_stores_.emplace_back(i->src1.offset,
+                                   GetTypeSize(i->src2.value->type));
+    } else if ((i->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+               i->opcode != &OPCODE_BRANCH_TRUE_info &&
+               i->opcode != &OPCODE_BRANCH_FALSE_info) {
+      return;
+    }
+  }
+  states_.assign(count, kVariant);
+
+  // Find everything invariant. Operands are always defined earlier in the
+  // block, so one forward walk is enough.
+  for (auto i = loop->instr_head; i; i = i->next) {
+    if (IsInvariant(loop, i)) {
+      states_[i->ordinal] = kInvariant;
+    }
+  }
+
+  // Hoist invariant computation along with the invariant values feeding it.
+  // Walking backwards visits users before their operands.
+  bool any_hoisted = false;
+  for (auto i = loop->instr_tail; i; i = i->prev) {
+    if (states_[i->ordinal] != kInvariant) {
+      continue;
+    }
+    if (i->opcode != &OPCODE_LOAD_CONTEXT_info &&
+        i->opcode != &OPCODE_ASSIGN_info) {
+      states_[i->ordinal] = kHoisted;
+      any_hoisted = true;
+    } else {
+      // Only when feeding something hoisted.
+      for (auto use = i->dest->use_head; use; use = use->next) {
+        if (use->instr->block == loop &&
+            states_[use->instr->ordinal] == kHoisted) {
+          states_[i->ordinal] = kHoisted;
+          break;
+        }
+      }
+    }
+  }
+  if (!any_hoisted) {
+    return;
+  }
+  ++stats_.loops_hoisted;
+
+  // Move hoisted instructions in order to the end of the entry block, after
+  // any branches; those are split off into the preheader at the end. We
+  // append by moving before the tail and then the tail before us.
+  std::vector<Instr*> hoisted;
+  auto entry = loop->prev;
+  auto last_branch = first_branch ? entry->instr_tail : nullptr;
+  auto i = loop->instr_head;
+  while (i) {
+    auto next = i->next;
+    if (states_[i->ordinal] == kHoisted) {
+      auto tail = entry->instr_tail;
+      i->MoveBefore(tail);
+      tail->MoveBefore(i);
+      hoisted.push_back(i);
+      ++stats_.instrs_hoisted;
+    }
+    i = next;
+  }
+
+  // Pass any hoisted values still used in the loop through locals.
+  auto loop_head = loop->instr_head;
+  std::vector<Value::Use*> loop_uses;
+  for (auto def : hoisted) {
+    auto value = def->dest;
+    loop_uses.clear();
+    for (auto use = value->use_head; use; use = use->next) {
+      if (use->instr->block == loop) {
+        loop_uses.push_back(use);
+      }
+    }
+    if (loop_uses.empty()) {
+      continue;
+    }
+    ++stats_.locals;
+    auto slot = builder->AllocLocal(value->type);
+    builder->StoreLocal(slot, value);
+    auto store = builder->last_instr();
+    auto tail = entry->instr_tail;
+    store->MoveBefore(tail);
+    tail->MoveBefore(store);
+    auto new_value = builder->LoadLocal(slot);
+    auto load = builder->last_instr();
+    load->MoveBefore(loop_head);
+    new_value->local_slot = slot;
+    for (auto use : loop_uses) {
+      auto user = use->instr;
+      auto user_signature = user->opcode->signature;
+      if (GET_OPCODE_SIG_TYPE_SRC1(user_signature) == OPCODE_SIG_TYPE_V &&
+          user->src1.value == value) {
+        user->set_src1(new_value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(user_signature) == OPCODE_SIG_TYPE_V &&
+          user->src2.value == value) {
+        user->set_src2(new_value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(user_signature) == OPCODE_SIG_TYPE_V &&
+          user->src3.value == value) {
+        user->set_src3(new_value);
+      }
+    }
+  }
+
+  if (last_branch) {
+    SplitPreheader(builder, loop, first_branch, last_branch);
+  }
+}
+
+void LoopInvariantCodeMotionPass::SplitPreheader(HIRBuilder* builder,
+                                                 Block* loop,
+                                                 Instr* first_branch,
+                                                 Instr* last_branch) {
+  auto entry = loop->prev;
+  auto label = builder->NewLabel();
+  builder->InsertLabel(label, last_branch);
+  auto preheader = label->block;
+  assert_true(preheader->prev == entry && preheader->next == loop);
+
+  // The preheader falls through into the loop, so only branches need moving.
+  for (auto i = first_branch; i; i = i->next) {
+    bool is_conditional = i->opcode != &OPCODE_BRANCH_info;
+    auto& target = is_conditional ? i->src2.label : i->src1.label;
+    if (target->block != loop) {
+      continue;
+    }
+    target = label;
+    builder->RemoveEdge(entry, loop);
+    builder->AddEdge(entry, preheader,
+                     is_conditional ? 0 : Edge::UNCONDITIONAL);
+  }
+  if (preheader->incoming_edge_head &&
+      !preheader->incoming_edge_head->incoming_next) {
+    preheader->incoming_edge_head->flags |= Edge::DOMINATES;
+  }
+}
+
+void LoopInvariantCodeMotionPass::DumpStats(HIRBuilder* builder) {
+  // We don't know which function this is, but the first source offset is its
+  // guest address.
+  uint32_t address = 0;
+  for (auto block = builder->first_block(); block && !address;
+       block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      if (instr->opcode == &OPCODE_SOURCE_OFFSET_info) {
+        address = static_cast<uint32_t>(instr->src1.offset);
+        break;
+      }
+    }
+  }
+  XELOGCPU(
+      "Loop invariant code motion %.8X: %d loops, %d hoisted from, %d "
+      "instructions hoisted, %d locals",
+      address, stats_.loops, stats_.loops_hoisted, stats_.instrs_hoisted,
+      stats_.locals);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
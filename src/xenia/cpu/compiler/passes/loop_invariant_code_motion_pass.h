@@ -0,0 +1,76 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Moves computations that do not change between iterations out of loops and
+// into the block that enters them, or a preheader block split off it when it
+// ends in branches. Values are SSA and never cross blocks, so hoisted results
+// reach the loop through locals.
+// Only single-block loops (a block branching back to itself) are handled.
+// Requires an up to date CFG.
+class LoopInvariantCodeMotionPass : public CompilerPass {
+ public:
+  LoopInvariantCodeMotionPass();
+  ~LoopInvariantCodeMotionPass() override;
+
+  const char* name() const override { return "LoopInvariantCodeMotionPass"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  // Returns the first of the branches ending the block entering the loop
+  // (null if it falls through), or false if the loop can't be handled.
+  bool FindEntryBranches(hir::Block* loop, hir::Instr** out_first_branch);
+  void HoistBlock(hir::HIRBuilder* builder, hir::Block* loop,
+                  hir::Instr* first_branch);
+  // Splits everything after the entry block's branches into a new block
+  // before the loop and points the branches into the loop at it.
+  void SplitPreheader(hir::HIRBuilder* builder, hir::Block* loop,
+                      hir::Instr* first_branch, hir::Instr* last_branch);
+  bool IsInvariant(hir::Block* loop, hir::Instr* i);
+  void DumpStats(hir::HIRBuilder* builder);
+
+ private:
+  enum : uint8_t {
+    kVariant = 0,
+    kInvariant = 1,
+    kHoisted = 2,
+  };
+  // Per instruction state in the current loop block, by ordinal.
+  std::vector<uint8_t> states_;
+  // Context ranges (offset, size) stored to in the current loop block.
+  std::vector<std::pair<size_t, size_t>> context_stores_;
+
+  struct {
+    uint32_t loops;
+    uint32_t loops_hoisted;
+    uint32_t instrs_hoisted;
+    uint32_t locals;
+  } stats_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
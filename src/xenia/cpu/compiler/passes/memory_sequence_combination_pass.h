@@ -22,6 +22,8 @@ class MemorySequenceCombinationPass : public CompilerPass {
   MemorySequenceCombinationPass();
   ~MemorySequenceCombinationPass() override;
 
+  const char* name() const override { return "MemorySequenceCombinationPass"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/compiler/passes/register_allocation_pass.h"
 
+#include <gflags/gflags.h>
+
 #include <algorithm>
 #include <cstring>
 
@@ -33,378 +35,336 @@ using xe::cpu::hir::RegAssignment;
 using xe::cpu::hir::TypeName;
 using xe::cpu::hir::Value;
 
+DEFINE_bool(dump_register_allocation_stats, false,
+            "Log per-function register allocation and spill counts.");
+
 #define ASSERT_NO_CYCLES 0
 
-RegisterAllocationPass::RegisterAllocationPass(const MachineInfo* machine_info)
-    : CompilerPass() {
-  // Initialize register sets.
-  // TODO(benvanik): rewrite in a way that makes sense - this is terrible.
+namespace {
+// Instructions are numbered this far apart so that reloads inserted in front
+// of one get a position of their own between it and its predecessor.
+const uint32_t kPositionStep = 2;
+// Costs of splitting an interval, in units of instruction distance.
+const uint32_t kReloadCost = 1;
+const uint32_t kStoreCost = 1;
+// Keeps precision when dividing distances by costs.
+const uint64_t kPriorityScale = 16;
+// Spilling a value in a loop costs this much more per level of nesting.
+const uint32_t kLoopSpillWeight = 8;
+}  // namespace
+
+RegisterAllocationPass::RegisterAllocationPass(const MachineInfo* machine_info,
+                                               bool loop_aware)
+    : CompilerPass(), loop_aware_(loop_aware) {
   auto mi_sets = machine_info->register_sets;
-  std::memset(&usage_sets_, 0, sizeof(usage_sets_));
-  uint32_t n = 0;
-  while (mi_sets[n].count) {
+  for (uint32_t n = 0; mi_sets[n].count; ++n) {
+    assert_true(n < xe::countof(register_files_));
+    assert_true(mi_sets[n].count <= 32);
     auto& mi_set = mi_sets[n];
-    auto usage_set = new RegisterSetUsage();
-    usage_sets_.all_sets[n] = usage_set;
-    usage_set->count = mi_set.count;
-    usage_set->set = &mi_set;
+    auto file = &register_files_[n];
+    file->set = &mi_set;
     if (mi_set.types & MachineInfo::RegisterSet::INT_TYPES) {
-      usage_sets_.int_set = usage_set;
+      int_file_ = file;
     }
     if (mi_set.types & MachineInfo::RegisterSet::FLOAT_TYPES) {
-      usage_sets_.float_set = usage_set;
+      float_file_ = file;
     }
     if (mi_set.types & MachineInfo::RegisterSet::VEC_TYPES) {
-      usage_sets_.vec_set = usage_set;
+      vec_file_ = file;
     }
-    n++;
   }
 }
 
-RegisterAllocationPass::~RegisterAllocationPass() {
-  for (size_t n = 0; n < xe::countof(usage_sets_.all_sets); n++) {
-    if (!usage_sets_.all_sets[n]) {
-      break;
-    }
-    delete usage_sets_.all_sets[n];
-  }
-}
+RegisterAllocationPass::~RegisterAllocationPass() = default;
 
 bool RegisterAllocationPass::Run(HIRBuilder* builder) {
-  // Simple per-block allocator that operates on SSA form.
-  // Registers do not move across blocks, though this could be
-  // optimized with some intra-block analysis (dominators/etc).
-  // Really, it'd just be nice to have someone who knew what they
-  // were doing lower SSA and do this right.
+  std::memset(&stats_, 0, sizeof(stats_));
 
+  // Sequential block ordinals.
   uint16_t block_ordinal = 0;
-  uint32_t instr_ordinal = 0;
-  auto block = builder->first_block();
-  while (block) {
-    // Sequential block ordinals.
+  for (auto block = builder->first_block(); block; block = block->next) {
     block->ordinal = block_ordinal++;
+  }
+  ComputeLoopDepths(builder, block_ordinal);
+  remat_limits_.assign(builder->max_value_ordinal(), 0);
 
-    // Reset all state.
-    PrepareBlockState();
-
-    // Renumber all instructions in the block. This is required so that
-    // we can sort the usage pointers below.
-    auto instr = block->instr_head;
-    while (instr) {
-      // Sequential global instruction ordinals.
+  uint32_t instr_ordinal = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    if (!AllocateBlock(builder, block)) {
+      return false;
+    }
+    // Positions are only meaningful during the scan. Leave sequential global
+    // ordinals behind, spill code included.
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
       instr->ordinal = instr_ordinal++;
-      instr = instr->next;
     }
+  }
 
-    instr = block->instr_head;
-    while (instr) {
-      const auto info = instr->opcode;
-      uint32_t signature = info->signature;
-
-      // Update the register use heaps.
-      AdvanceUses(instr);
-
-      // Check sources for retirement. If any are unused after this instruction
-      // we can eagerly evict them to speed up register allocation.
-      // Since X64 (and other platforms) can often take advantage of dest==src1
-      // register mappings we track retired src1 so that we can attempt to
-      // reuse it.
-      // NOTE: these checks require that the usage list be sorted!
-      bool has_preferred_reg = false;
-      RegAssignment preferred_reg = {0};
-      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
-          !instr->src1.value->IsConstant()) {
-        if (!instr->src1_use->next) {
-          // Pull off preferred register. We will try to reuse this for the
-          // dest.
-          // NOTE: set may be null if this is a store local.
-          if (preferred_reg.set) {
-            has_preferred_reg = true;
-            preferred_reg = instr->src1.value->reg;
-          }
-        }
-      }
-
-      if (GET_OPCODE_SIG_TYPE_DEST(signature) == OPCODE_SIG_TYPE_V) {
-        // Must not have been set already.
-        assert_null(instr->dest->reg.set);
-
-        // Sort the usage list. We depend on this in future uses of this
-        // variable.
-        SortUsageList(instr->dest);
-
-        // If we have a preferred register, use that.
-        // This way we can help along the stupid X86 two opcode instructions.
-        bool allocated;
-        if (has_preferred_reg) {
-          // Allocate with the given preferred register. If the register is in
-          // the wrong set it will not be reused.
-          allocated = TryAllocateRegister(instr->dest, preferred_reg);
-        } else {
-          // Allocate a register. This will either reserve a free one or
-          // spill and reuse an active one.
-          allocated = TryAllocateRegister(instr->dest);
-        }
-        if (!allocated) {
-          // Failed to allocate register -- need to spill and try again.
-          // We spill only those registers we aren't using.
-          if (!SpillOneRegister(builder, block, instr->dest->type)) {
-            // Unable to spill anything - this shouldn't happen.
-            XELOGE("Unable to spill any registers");
-            assert_always();
-            return false;
-          }
-
-          // Demand allocation.
-          if (!TryAllocateRegister(instr->dest)) {
-            // Boned.
-            XELOGE("Register allocation failed");
-            assert_always();
-            return false;
-          }
-        }
-      }
-
-      instr = instr->next;
-    }
-    block = block->next;
+  if (FLAGS_dump_register_allocation_stats) {
+    DumpStats(builder);
   }
 
   return true;
 }
 
-void RegisterAllocationPass::DumpUsage(const char* name) {
-#if 0
-  fprintf(stdout, "\n%s:\n", name);
-  for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
-    auto usage_set = usage_sets_.all_sets[i];
-    if (usage_set) {
-      fprintf(stdout, "set %s:\n", usage_set->set->name);
-      fprintf(stdout, "  avail: %s\n",
-              usage_set->availability.to_string().c_str());
-      fprintf(stdout, "  upcoming uses:\n");
-      for (auto it = usage_set->upcoming_uses.begin();
-           it != usage_set->upcoming_uses.end(); ++it) {
-        fprintf(stdout, "    v%d, used at %d\n",
-                it->value->ordinal,
-                it->use->instr->ordinal);
-      }
+bool RegisterAllocationPass::AllocateBlock(HIRBuilder* builder, Block* block) {
+  for (auto& file : register_files_) {
+    if (!file.set) {
+      break;
+    }
+    file.free_registers.reset();
+    for (uint32_t n = 0; n < file.set->count; ++n) {
+      file.free_registers.set(n);
     }
+    file.active.clear();
   }
-  fflush(stdout);
-#endif
-}
 
-void RegisterAllocationPass::PrepareBlockState() {
-  for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
-    auto usage_set = usage_sets_.all_sets[i];
-    if (usage_set) {
-      usage_set->availability.set();
-      usage_set->upcoming_uses.clear();
-    }
+  // Positions order the scan. Uses are compared by position, so this must
+  // happen before any use list is sorted.
+  uint32_t position = 0;
+  for (auto instr = block->instr_head; instr; instr = instr->next) {
+    instr->ordinal = position;
+    position += kPositionStep;
   }
-  DumpUsage("PrepareBlockState");
-}
+  ComputeRematerializationLimits(block);
 
-void RegisterAllocationPass::AdvanceUses(Instr* instr) {
-  for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
-    auto usage_set = usage_sets_.all_sets[i];
-    if (!usage_set) {
-      break;
+  for (auto instr = block->instr_head; instr; instr = instr->next) {
+    uint32_t signature = instr->opcode->signature;
+
+    // Free the registers of intervals that end here. Since X64 (and other
+    // platforms) can often take advantage of dest==src1 register mappings,
+    // a src1 retired by this instruction is offered to the dest.
+    ExpireIntervals(instr);
+    RegAssignment preferred_reg = {0};
+    if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+        !instr->src1.value->IsConstant() && !instr->src1_use->next) {
+      // NOTE: set is null if this is a local slot.
+      preferred_reg = instr->src1.value->reg;
     }
-    auto& upcoming_uses = usage_set->upcoming_uses;
-    for (size_t j = 0; j < upcoming_uses.size();) {
-      auto& upcoming_use = upcoming_uses.at(j);
-      if (!upcoming_use.use) {
-        // No uses at all - we can remove right away.
-        // This comes up from instructions where the dest is never used,
-        // like the ATOMIC ops.
-        MarkRegAvailable(upcoming_use.value->reg);
-        upcoming_uses.erase(upcoming_uses.begin() + j);
-        // i remains the same.
-        continue;
-      }
-      if (upcoming_use.use->instr != instr) {
-        // Not yet at this instruction.
-        ++j;
-        continue;
+
+    if (GET_OPCODE_SIG_TYPE_DEST(signature) != OPCODE_SIG_TYPE_V) {
+      continue;
+    }
+    // Must not have been set already.
+    assert_null(instr->dest->reg.set);
+
+    // Sort the usage list. The interval walks it in order.
+    SortUsageList(instr->dest);
+
+    if (!TryAllocateRegister(instr->dest, preferred_reg)) {
+      // Make room by splitting the interval that is cheapest to spill.
+      if (!SplitInterval(builder, block, RegisterFileForValue(instr->dest),
+                         instr->ordinal)) {
+        // Unable to spill anything - this shouldn't happen.
+        XELOGE("Unable to spill any registers");
+        assert_always();
+        return false;
       }
-      // The use is from this instruction.
-      if (!upcoming_use.use->next) {
-        // Last use of the value. We can retire it now.
-        MarkRegAvailable(upcoming_use.value->reg);
-        upcoming_uses.erase(upcoming_uses.begin() + j);
-        // i remains the same.
-        continue;
-      } else {
-        // Used again. Push back the next use.
-        // Note that we may be used multiple times this instruction, so
-        // eat those.
-        auto next_use = upcoming_use.use->next;
-        while (next_use->next && next_use->instr == instr) {
-          next_use = next_use->next;
-        }
-        // Remove the iterator.
-        auto value = upcoming_use.value;
-        upcoming_uses.erase(upcoming_uses.begin() + j);
-        assert_true(next_use->instr->block == instr->block);
-        assert_true(value->def->block == instr->block);
-        upcoming_uses.emplace_back(value, next_use);
-        // i remains the same.
-        continue;
+      if (!TryAllocateRegister(instr->dest, preferred_reg)) {
+        // Boned.
+        XELOGE("Register allocation failed");
+        assert_always();
+        return false;
       }
     }
   }
-  DumpUsage("AdvanceUses");
-}
 
-bool RegisterAllocationPass::IsRegInUse(const RegAssignment& reg) {
-  RegisterSetUsage* usage_set;
-  if (reg.set == usage_sets_.int_set->set) {
-    usage_set = usage_sets_.int_set;
-  } else if (reg.set == usage_sets_.float_set->set) {
-    usage_set = usage_sets_.float_set;
-  } else {
-    usage_set = usage_sets_.vec_set;
-  }
-  return !usage_set->availability.test(reg.index);
+  return true;
 }
 
-RegisterAllocationPass::RegisterSetUsage* RegisterAllocationPass::MarkRegUsed(
-    const RegAssignment& reg, Value* value, Value::Use* use) {
-  auto usage_set = RegisterSetForValue(value);
-  usage_set->availability.set(reg.index, false);
-  usage_set->upcoming_uses.emplace_back(value, use);
-  DumpUsage("MarkRegUsed");
-  return usage_set;
-}
+void RegisterAllocationPass::ExpireIntervals(Instr* instr) {
+  uint32_t position = instr->ordinal;
+  for (auto& file : register_files_) {
+    if (!file.set) {
+      break;
+    }
+    // Active intervals are sorted by end, so the expired ones lead.
+    auto& active = file.active;
+    size_t expired_count = 0;
+    while (expired_count < active.size() &&
+           active[expired_count].end <= position) {
+      file.free_registers.set(active[expired_count].value->reg.index);
+      ++expired_count;
+    }
+    active.erase(active.begin(), active.begin() + expired_count);
 
-RegisterAllocationPass::RegisterSetUsage*
-RegisterAllocationPass::MarkRegAvailable(const hir::RegAssignment& reg) {
-  RegisterSetUsage* usage_set;
-  if (reg.set == usage_sets_.int_set->set) {
-    usage_set = usage_sets_.int_set;
-  } else if (reg.set == usage_sets_.float_set->set) {
-    usage_set = usage_sets_.float_set;
-  } else {
-    usage_set = usage_sets_.vec_set;
+    // Step the rest past their uses by this instruction (there may be
+    // several).
+    for (auto& interval : active) {
+      while (interval.next_use->instr == instr) {
+        interval.next_use = interval.next_use->next;
+      }
+      assert_true(interval.next_use->instr->ordinal > position);
+    }
   }
-  usage_set->availability.set(reg.index, true);
-  return usage_set;
 }
 
 bool RegisterAllocationPass::TryAllocateRegister(
     Value* value, const RegAssignment& preferred_reg) {
-  // If the preferred register matches type and is available, use it.
-  auto usage_set = RegisterSetForValue(value);
-  if (usage_set->set == preferred_reg.set) {
-    // Check if available.
-    if (!IsRegInUse(preferred_reg)) {
-      // Mark as in-use and return. Best case.
-      MarkRegUsed(preferred_reg, value, value->use_head);
-      value->reg = preferred_reg;
-      return true;
-    }
+  auto file = RegisterFileForValue(value);
+  if (file->free_registers.none()) {
+    // Spill required.
+    return false;
   }
 
-  // Otherwise, fallback to allocating like normal.
-  return TryAllocateRegister(value);
+  // If the preferred register matches type and is free, use it. If it is in
+  // the wrong set it will not be reused.
+  if (preferred_reg.set == file->set &&
+      file->free_registers.test(preferred_reg.index)) {
+    value->reg = preferred_reg;
+  } else {
+    uint32_t first_free = 0;
+    while (!file->free_registers.test(first_free)) {
+      ++first_free;
+    }
+    value->reg.set = file->set;
+    value->reg.index = first_free;
+  }
+  file->free_registers.reset(value->reg.index);
+
+  LiveInterval interval;
+  interval.value = value;
+  interval.end =
+      value->use_head ? value->last_use->ordinal : value->def->ordinal;
+  interval.next_use = value->use_head;
+  auto it = std::upper_bound(file->active.begin(), file->active.end(),
+                             interval,
+                             [](const LiveInterval& a, const LiveInterval& b) {
+                               return a.end < b.end;
+                             });
+  file->active.insert(it, interval);
+
+  ++stats_.allocations[StatsIndex(value)];
+  return true;
 }
 
-bool RegisterAllocationPass::TryAllocateRegister(Value* value) {
-  // Get the set this register is in.
-  RegisterSetUsage* usage_set = RegisterSetForValue(value);
-
-  // Find the first free register, if any.
-  // We have to ensure it's a valid one (in our count).
-  uint32_t first_unused = 0;
-  bool none_used = xe::bit_scan_forward(
-      static_cast<uint32_t>(usage_set->availability.to_ulong()), &first_unused);
-  if (none_used && first_unused < usage_set->count) {
-    // Available! Use it!
-    value->reg.set = usage_set->set;
-    value->reg.index = first_unused;
-    MarkRegUsed(value->reg, value, value->use_head);
-    return true;
+void RegisterAllocationPass::ComputeRematerializationLimits(Block* block) {
+  // Walk backwards tracking the next instruction that may change each context
+  // byte. Conditional branches leave the context alone.
+  uint32_t volatile_position = UINT32_MAX;
+  context_store_positions_.clear();
+  for (auto instr = block->instr_tail; instr; instr = instr->prev) {
+    if (instr->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      size_t offset = instr->src1.offset;
+      uint32_t limit = volatile_position;
+      for (size_t n = 0; n < GetTypeSize(instr->dest->type); ++n) {
+        auto it = context_store_positions_.find(offset + n);
+        if (it != context_store_positions_.end()) {
+          limit = std::min(limit, it->second);
+        }
+      }
+      remat_limits_[instr->dest->ordinal] = limit;
+    } else if (instr->opcode == &OPCODE_STORE_CONTEXT_info) {
+      size_t offset = instr->src1.offset;
+      for (size_t n = 0; n < GetTypeSize(instr->src2.value->type); ++n) {
+        context_store_positions_[offset + n] = instr->ordinal;
+      }
+    } else if ((instr->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+               instr->opcode != &OPCODE_BRANCH_TRUE_info &&
+               instr->opcode != &OPCODE_BRANCH_FALSE_info) {
+      volatile_position = instr->ordinal;
+    }
   }
+}
 
-  // None available! Spill required.
-  return false;
+bool RegisterAllocationPass::CanRematerialize(const Value* value,
+                                              uint32_t position) const {
+  // Reloads go right before the use, so an instruction that changes the
+  // context at the use itself is fine.
+  return value->ordinal < remat_limits_.size() &&
+         position <= remat_limits_[value->ordinal];
 }
 
-bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
-                                              TypeName required_type) {
-  // Get the set that we will be picking from.
-  RegisterSetUsage* usage_set;
-  if (required_type <= INT64_TYPE) {
-    usage_set = usage_sets_.int_set;
-  } else if (required_type <= FLOAT64_TYPE) {
-    usage_set = usage_sets_.float_set;
-  } else {
-    usage_set = usage_sets_.vec_set;
+uint64_t RegisterAllocationPass::SpillPriority(const LiveInterval& interval,
+                                               Block* block,
+                                               uint32_t position) const {
+  // Furthest next use first, as that frees the register for longest. This is
+  // divided by the cost of the split: a reload before the next use, and a
+  // store unless the value is already in a local (as a reload itself or
+  // from an earlier split) or can be loaded from the context again. Inside
+  // loops the store is repeated every iteration so when loop aware it weighs
+  // more with the nesting depth.
+  uint32_t next_position = interval.next_use->instr->ordinal;
+  uint64_t distance = next_position - position;
+  uint64_t cost = kReloadCost;
+  if (!interval.value->local_slot &&
+      !CanRematerialize(interval.value, next_position)) {
+    cost += kStoreCost * (loop_aware_ ? 1 + loop_depths_[block->ordinal] : 1);
   }
+  return distance * kPriorityScale / cost;
+}
 
-  DumpUsage("SpillOneRegister (pre)");
-  // Pick the one with the furthest next use.
-  assert_true(!usage_set->upcoming_uses.empty());
-  auto furthest_usage = std::max_element(usage_set->upcoming_uses.begin(),
-                                         usage_set->upcoming_uses.end(),
-                                         RegisterUsage::Comparer());
-  assert_true(furthest_usage->value->def->block == block);
-  assert_true(furthest_usage->use->instr->block == block);
-  auto spill_value = furthest_usage->value;
-  Value::Use* prev_use = furthest_usage->use->prev;
-  Value::Use* next_use = furthest_usage->use;
-  assert_not_null(next_use);
-  usage_set->upcoming_uses.erase(furthest_usage);
-  DumpUsage("SpillOneRegister (post)");
-  const auto reg = spill_value->reg;
-
-  // We know the spill_value use list is sorted, so we can cut it right now.
-  // This makes it easier down below.
-  auto new_head_use = next_use;
+bool RegisterAllocationPass::SplitInterval(HIRBuilder* builder, Block* block,
+                                           RegisterFile* file,
+                                           uint32_t position) {
+  if (file->active.empty()) {
+    return false;
+  }
+  auto victim = file->active.begin();
+  uint64_t victim_priority = SpillPriority(*victim, block, position);
+  for (auto it = victim + 1; it != file->active.end(); ++it) {
+    uint64_t priority = SpillPriority(*it, block, position);
+    if (priority > victim_priority) {
+      victim = it;
+      victim_priority = priority;
+    }
+  }
+  auto spill_value = victim->value;
+  Value::Use* next_use = victim->next_use;
+  Value::Use* prev_use = next_use->prev;
+  Instr* last_use = prev_use ? prev_use->instr : nullptr;
+  assert_true(spill_value->def->block == block);
+  assert_true(next_use->instr->block == block);
+  // Nothing can be put between a paired instruction and its predecessor.
+  // The only one reads the value defined right before it, which is never
+  // live across an allocation.
+  assert_false(next_use->instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV);
+  file->free_registers.set(spill_value->reg.index);
+  file->active.erase(victim);
+
+  uint32_t stats_index = StatsIndex(spill_value);
+  ++stats_.spills[stats_index];
+  stats_.loop_weighted_spills +=
+      1 + loop_depths_[block->ordinal] * kLoopSpillWeight;
 
   // Allocate local.
+  bool rematerialize =
+      !spill_value->local_slot &&
+      CanRematerialize(spill_value, next_use->instr->ordinal);
   if (spill_value->local_slot) {
     // Value is already assigned a slot. Since we allocate in order and this is
     // all SSA we know the stored value will be exactly what we want. Yay,
     // we can prevent the redundant store!
-    // In fact, we may even want to pin this spilled value so that we always
-    // use the spilled value and prevent the need for more locals.
+  } else if (rematerialize) {
+    // Nothing has changed the context since the value was loaded from it, so
+    // it is loaded again instead of going through a local.
+    ++stats_.rematerializations[stats_index];
   } else {
+    ++stats_.spill_stores[stats_index];
+
     // Allocate a local slot.
     spill_value->local_slot = builder->AllocLocal(spill_value->type);
 
-    // Add store.
+    // Add store. It goes as late as possible, which is right before the last
+    // use before the split (the value is still in its register there).
     builder->StoreLocal(spill_value->local_slot, spill_value);
     auto spill_store = builder->last_instr();
-    auto spill_store_use = spill_store->src2_use;
-    assert_null(spill_store_use->prev);
     if (prev_use && prev_use->instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
       // Instruction is paired. This is bad. We will insert the spill after the
       // paired instruction.
       assert_not_null(prev_use->instr->next);
       spill_store->MoveBefore(prev_use->instr->next);
-
-      // Update last use.
-      spill_value->last_use = spill_store;
+      last_use = spill_store;
     } else if (prev_use) {
-      // We insert the store immediately before the previous use.
-      // If we were smarter we could then re-run allocation and reuse the
-      // register
-      // once dropped.
       spill_store->MoveBefore(prev_use->instr);
-
-      // Update last use.
-      spill_value->last_use = prev_use->instr;
     } else {
       // This is the first use, so the only thing we have is the define.
       // Move the store to right after that.
       spill_store->MoveBefore(spill_value->def->next);
-
-      // Update last use.
-      spill_value->last_use = spill_store;
+      last_use = spill_store;
     }
+    // Already scanned past, so its position only needs to be plausible.
+    spill_store->ordinal = spill_store->prev ? spill_store->prev->ordinal : 0;
   }
 
 #if ASSERT_NO_CYCLES
@@ -412,31 +372,33 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   spill_value->def->block->AssertNoCycles();
 #endif  // ASSERT_NO_CYCLES
 
-  // Add load.
-  // Inserted immediately before the next use. Since by definition the next
-  // use is after the instruction requesting the spill we know we haven't
-  // done allocation for that code yet and can let that be handled
-  // automatically when we get to it.
-  auto new_value = builder->LoadLocal(spill_value->local_slot);
+  // Add the reload immediately before the next use. That is past the current
+  // position, so the scan allocates its interval when it gets there.
+  Value* new_value;
+  if (rematerialize) {
+    new_value =
+        builder->LoadContext(spill_value->def->src1.offset, spill_value->type);
+    // Loadable again up to the same point.
+    remat_limits_.resize(builder->max_value_ordinal(), 0);
+    remat_limits_[new_value->ordinal] = remat_limits_[spill_value->ordinal];
+  } else {
+    new_value = builder->LoadLocal(spill_value->local_slot);
+    // Set the local slot of the new value to our existing one. This way we
+    // will reuse that same memory if needed.
+    new_value->local_slot = spill_value->local_slot;
+  }
   auto spill_load = builder->last_instr();
   spill_load->MoveBefore(next_use->instr);
-// Note: implicit first use added.
+  spill_load->ordinal = next_use->instr->ordinal - 1;
 
 #if ASSERT_NO_CYCLES
   builder->AssertNoCycles();
   spill_value->def->block->AssertNoCycles();
 #endif  // ASSERT_NO_CYCLES
 
-  // Set the local slot of the new value to our existing one. This way we will
-  // reuse that same memory if needed.
-  new_value->local_slot = spill_value->local_slot;
-
-  // Rename all future uses of the SSA value to the new value as loaded
-  // from the local.
-  // We can quickly do this by walking the use list. Because the list is
-  // already sorted we know we are going to end up with a sorted list.
-  auto walk_use = new_head_use;
-  auto new_use_tail = walk_use;
+  // Rename all future uses of the SSA value to the reloaded value. The new
+  // use list is sorted when the reload is reached.
+  auto walk_use = next_use;
   while (walk_use) {
     auto next_walk_use = walk_use->next;
     auto instr = walk_use->instr;
@@ -459,27 +421,76 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
     }
 
     walk_use = next_walk_use;
-    if (walk_use) {
-      new_use_tail = walk_use;
-    }
   }
-  new_value->last_use = new_use_tail->instr;
 
-  // Update tracking.
-  MarkRegAvailable(reg);
+  // The value now ends at the store or at its last use before the split.
+  spill_value->last_use = last_use;
 
   return true;
 }
 
-RegisterAllocationPass::RegisterSetUsage*
-RegisterAllocationPass::RegisterSetForValue(const Value* value) {
+RegisterAllocationPass::RegisterFile*
+RegisterAllocationPass::RegisterFileForValue(const Value* value) {
+  if (value->type <= INT64_TYPE) {
+    return int_file_;
+  } else if (value->type <= FLOAT64_TYPE) {
+    return float_file_;
+  } else {
+    return vec_file_;
+  }
+}
+
+uint32_t RegisterAllocationPass::StatsIndex(const Value* value) {
   if (value->type <= INT64_TYPE) {
-    return usage_sets_.int_set;
+    return 0;
   } else if (value->type <= FLOAT64_TYPE) {
-    return usage_sets_.float_set;
+    return 1;
   } else {
-    return usage_sets_.vec_set;
+    return 2;
+  }
+}
+
+void RegisterAllocationPass::ComputeLoopDepths(HIRBuilder* builder,
+                                               uint32_t block_count) {
+  // Blocks are laid out in guest order, so any CFG edge to an earlier (or the
+  // same) block closes a loop spanning everything in between. Overlapping
+  // spans nest. Without a CFG (the baseline pipeline runs no
+  // ControlFlowAnalysisPass) every block is at depth 0.
+  loop_depths_.assign(block_count, 0);
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto edge = block->outgoing_edge_head; edge;
+         edge = edge->outgoing_next) {
+      if (edge->dest->ordinal > block->ordinal) {
+        continue;
+      }
+      for (uint32_t n = edge->dest->ordinal; n <= block->ordinal; ++n) {
+        ++loop_depths_[n];
+      }
+    }
+  }
+}
+
+void RegisterAllocationPass::DumpStats(HIRBuilder* builder) {
+  // We don't know which function this is, but the first source offset is its
+  // guest address.
+  uint32_t address = 0;
+  for (auto block = builder->first_block(); block && !address;
+       block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      if (instr->opcode == &OPCODE_SOURCE_OFFSET_info) {
+        address = static_cast<uint32_t>(instr->src1.offset);
+        break;
+      }
+    }
   }
+  XELOGCPU(
+      "Register allocation %.8X: int %d/%d/%d/%d, float %d/%d/%d/%d, vec "
+      "%d/%d/%d/%d (allocs/spills/stores/remats), %d loop-weighted spills",
+      address, stats_.allocations[0], stats_.spills[0], stats_.spill_stores[0],
+      stats_.rematerializations[0], stats_.allocations[1], stats_.spills[1],
+      stats_.spill_stores[1], stats_.rematerializations[1],
+      stats_.allocations[2], stats_.spills[2], stats_.spill_stores[2],
+      stats_.rematerializations[2], stats_.loop_weighted_spills);
 }
 
 namespace {
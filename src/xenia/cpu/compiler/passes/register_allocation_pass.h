@@ -10,9 +10,9 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_REGISTER_ALLOCATION_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_REGISTER_ALLOCATION_PASS_H_
 
-#include <algorithm>
 #include <bitset>
-#include <functional>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -23,61 +23,91 @@ namespace cpu {
 namespace compiler {
 namespace passes {
 
+// Linear scan register allocation with live range splitting.
+// Values never live across blocks (context promotion is block-local and
+// there are no phis), so every block is scanned on its own in instruction
+// order. When a register file runs out the active interval that is cheapest
+// to spill is split before its next use: its value goes to a local and the
+// rest of its uses read a reload, which gets its own interval and register
+// when the scan reaches it. Values loaded from the context are loaded again
+// instead while nothing can have changed it.
 class RegisterAllocationPass : public CompilerPass {
  public:
-  explicit RegisterAllocationPass(const backend::MachineInfo* machine_info);
+  // When loop_aware is set spill choices also account for the loop depth of
+  // the block being allocated, taken from the CFG.
+  explicit RegisterAllocationPass(const backend::MachineInfo* machine_info,
+                                  bool loop_aware = false);
   ~RegisterAllocationPass() override;
 
+  const char* name() const override { return "RegisterAllocationPass"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
+  // Indexed by value type: int, float, vec.
+  struct Stats {
+    uint32_t allocations[3];
+    uint32_t spills[3];
+    // Spills that needed a new store (vs. reusing the existing local).
+    uint32_t spill_stores[3];
+    // Spills that reloaded from the context, needing no store.
+    uint32_t rematerializations[3];
+    // Spills weighted by the loop depth of the block they occur in.
+    uint32_t loop_weighted_spills;
+  };
+  // Counts of the last run.
+  const Stats& stats() const { return stats_; }
+
  private:
-  // TODO(benvanik): rewrite all this set shit -- too much indirection, the
-  // complexity is not needed.
-  struct RegisterUsage {
+  // The part of a value's live range that still holds a register.
+  struct LiveInterval {
     hir::Value* value;
-    hir::Value::Use* use;
-    RegisterUsage() : value(nullptr), use(nullptr) {}
-    RegisterUsage(hir::Value* value_, hir::Value::Use* use_)
-        : value(value_), use(use_) {}
-    struct Comparer : std::binary_function<RegisterUsage, RegisterUsage, bool> {
-      bool operator()(const RegisterUsage& a, const RegisterUsage& b) const {
-        return a.use->instr->ordinal < b.use->instr->ordinal;
-      }
-    };
+    // Position of the last use, or of the definition if there is none.
+    uint32_t end;
+    // First use after the current position. Use lists are sorted.
+    hir::Value::Use* next_use;
   };
-  struct RegisterSetUsage {
+  struct RegisterFile {
     const backend::MachineInfo::RegisterSet* set = nullptr;
-    uint32_t count = 0;
-    std::bitset<32> availability = 0;
-    // TODO(benvanik): another data type.
-    std::vector<RegisterUsage> upcoming_uses;
+    std::bitset<32> free_registers;
+    // Intervals holding a register, sorted by end.
+    std::vector<LiveInterval> active;
   };
 
-  void DumpUsage(const char* name);
-  void PrepareBlockState();
-  void AdvanceUses(hir::Instr* instr);
-  bool IsRegInUse(const hir::RegAssignment& reg);
-  RegisterSetUsage* MarkRegUsed(const hir::RegAssignment& reg,
-                                hir::Value* value, hir::Value::Use* use);
-  RegisterSetUsage* MarkRegAvailable(const hir::RegAssignment& reg);
-
+  bool AllocateBlock(hir::HIRBuilder* builder, hir::Block* block);
+  void ExpireIntervals(hir::Instr* instr);
   bool TryAllocateRegister(hir::Value* value,
                            const hir::RegAssignment& preferred_reg);
-  bool TryAllocateRegister(hir::Value* value);
-  bool SpillOneRegister(hir::HIRBuilder* builder, hir::Block* block,
-                        hir::TypeName required_type);
+  void ComputeRematerializationLimits(hir::Block* block);
+  bool CanRematerialize(const hir::Value* value, uint32_t position) const;
+  bool SplitInterval(hir::HIRBuilder* builder, hir::Block* block,
+                     RegisterFile* file, uint32_t position);
+  uint64_t SpillPriority(const LiveInterval& interval, hir::Block* block,
+                         uint32_t position) const;
 
-  RegisterSetUsage* RegisterSetForValue(const hir::Value* value);
+  RegisterFile* RegisterFileForValue(const hir::Value* value);
+  static uint32_t StatsIndex(const hir::Value* value);
 
   void SortUsageList(hir::Value* value);
 
+  // Computes the loop depth of each block (by ordinal) from back edges.
+  void ComputeLoopDepths(hir::HIRBuilder* builder, uint32_t block_count);
+  void DumpStats(hir::HIRBuilder* builder);
+
  private:
-  struct {
-    RegisterSetUsage* int_set = nullptr;
-    RegisterSetUsage* float_set = nullptr;
-    RegisterSetUsage* vec_set = nullptr;
-    RegisterSetUsage* all_sets[3];
-  } usage_sets_;
+  Stats stats_;
+  std::vector<uint32_t> loop_depths_;
+  bool loop_aware_;
+  // Last position each context loaded value can be loaded again at, by value
+  // ordinal, or 0 if it can't.
+  std::vector<uint32_t> remat_limits_;
+  // Scratch for ComputeRematerializationLimits, by context byte.
+  std::unordered_map<size_t, uint32_t> context_store_positions_;
+
+  // One per machine register set. Float and vector values may share one.
+  RegisterFile register_files_[3];
+  RegisterFile* int_file_ = nullptr;
+  RegisterFile* float_file_ = nullptr;
+  RegisterFile* vec_file_ = nullptr;
 };
 
 }  // namespace passes
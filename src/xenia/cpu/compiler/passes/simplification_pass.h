@@ -22,6 +22,8 @@ class SimplificationPass : public CompilerPass {
   SimplificationPass();
   ~SimplificationPass() override;
 
+  const char* name() const override { return "SimplificationPass"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -23,6 +23,12 @@ DEFINE_bool(trace_functions, false,
             "Generate tracing for function statistics.");
 DEFINE_bool(trace_function_coverage, false,
             "Generate tracing for function instruction coverage statistics.");
+DEFINE_int32(trace_function_counter_size, 8,
+             "Bytes per instruction coverage counter (1, 2 or 8). Narrow "
+             "counters saturate and are updated without a bus lock.");
+DEFINE_int32(trace_function_coverage_sample_shift, 0,
+             "Only record instruction coverage on 1 in 2^n calls to each "
+             "function. 0 records every call.");
 DEFINE_bool(trace_function_references, false,
             "Generate tracing for function address references.");
 DEFINE_bool(trace_function_data, false,
@@ -31,6 +37,64 @@ DEFINE_bool(trace_function_data, false,
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.");
 
+DEFINE_bool(tiered_compilation, false,
+            "Compile functions with a minimal pass pipeline first and "
+            "recompile hot functions with all optimizations in the "
+            "background.");
+DEFINE_int32(compile_thread_count, 2,
+             "Number of background compile threads used for tiered "
+             "compilation.");
+DEFINE_int32(tiered_compilation_threshold, 1000,
+             "Number of calls to a baseline function before it is "
+             "recompiled with all optimizations.");
+DEFINE_bool(hot_function_recompilation, false,
+            "Count calls to optimized functions and recompile hot ones in "
+            "the background with an aggressive pass pipeline. With "
+            "--code_cache_path the hot set is persisted so that later runs "
+            "start with it optimized.");
+DEFINE_int32(hot_function_threshold, 100000,
+             "Number of calls to an optimized function before it is "
+             "recompiled with the aggressive pass pipeline.");
+DEFINE_bool(recompile_mmio_access_sites, false,
+            "Recompile functions whose loads/stores fault on MMIO ranges so "
+            "that those sites check for MMIO instead of faulting. The fault "
+            "handler then takes locks and queues work for the compile "
+            "threads, which is unsafe if the faulting thread holds them.");
+DEFINE_bool(invalidate_modified_code, false,
+            "Write protect guest code once translated and retranslate "
+            "functions whose code is written to (overlays, runtime patches). "
+            "Titles that keep data next to their code take a write fault "
+            "each time the page is rewatched.");
+DEFINE_bool(dump_compile_stats, false,
+            "Time each translation stage and compiler pass and log the "
+            "totals, maxima and histograms on shutdown.");
+DEFINE_string(hir_corpus_path, "",
+              "Writes the HIR of every function translated to this file, "
+              "before any compiler pass, for replay by "
+              "xenia-cpu-hir-benchmark. Functions loaded from the code cache "
+              "are not captured.");
+DEFINE_bool(kernel_call_stats, false,
+            "Time each kernel export call and log per-export call counts, "
+            "totals, percentiles and histograms on shutdown.");
+DEFINE_bool(precompile_module_functions, false,
+            "Scan and compile all functions known from module metadata "
+            "(entry point, exports, .pdata) on the background compile "
+            "threads as soon as the module is loaded.");
+DEFINE_bool(assume_default_fpscr_mode, false,
+            "Ignore guest changes to the FPSCR rounding and non-IEEE mode "
+            "bits and always run with round-to-nearest. Only safe for titles "
+            "that never change them.");
+DEFINE_bool(yield_in_spin_loops, true,
+            "Recognize guest loops that only poll memory or the timebase and "
+            "have them pause, then yield the host thread, while they spin.");
+DEFINE_bool(call_local_subroutines, true,
+            "Emit bl to an address inside the calling function as a host "
+            "call instead of a jump, so the matching blr returns with a host "
+            "ret rather than missing the return address check.");
+DEFINE_int32(thread_state_pool_size, 16,
+             "Number of exited guest thread states (stack, context) kept for "
+             "reuse by new threads with the same stack size. 0 disables.");
+
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
               "int3 before the given guest address is executed.");
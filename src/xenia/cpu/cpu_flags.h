@@ -20,11 +20,29 @@ DECLARE_bool(disassemble_functions);
 
 DECLARE_bool(trace_functions);
 DECLARE_bool(trace_function_coverage);
+DECLARE_int32(trace_function_counter_size);
+DECLARE_int32(trace_function_coverage_sample_shift);
 DECLARE_bool(trace_function_references);
 DECLARE_bool(trace_function_data);
 
 DECLARE_bool(validate_hir);
 
+DECLARE_bool(tiered_compilation);
+DECLARE_int32(compile_thread_count);
+DECLARE_int32(tiered_compilation_threshold);
+DECLARE_bool(hot_function_recompilation);
+DECLARE_int32(hot_function_threshold);
+DECLARE_bool(recompile_mmio_access_sites);
+DECLARE_bool(precompile_module_functions);
+DECLARE_bool(assume_default_fpscr_mode);
+DECLARE_int32(thread_state_pool_size);
+DECLARE_bool(invalidate_modified_code);
+DECLARE_bool(dump_compile_stats);
+DECLARE_string(hir_corpus_path);
+DECLARE_bool(yield_in_spin_loops);
+DECLARE_bool(call_local_subroutines);
+DECLARE_bool(kernel_call_stats);
+
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
 DECLARE_uint64(break_condition_value);
@@ -15,20 +15,50 @@
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::EntryTable() : pages_(new std::atomic<Page*>[kPageCount]) {
+  for (uint32_t i = 0; i < kPageCount; ++i) {
+    pages_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
 
 EntryTable::~EntryTable() {
-  std::lock_guard<xe::mutex> guard(lock_);
-  for (auto it : map_) {
-    Entry* entry = it.second;
+  std::lock_guard<xe::mutex> guard(list_lock_);
+  for (auto entry : list_) {
     delete entry;
   }
+  for (uint32_t i = 0; i < kPageCount; ++i) {
+    delete pages_[i].load();
+  }
+}
+
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address, bool create) {
+  auto& page_ptr = pages_[address >> kPageShift];
+  Page* page = page_ptr.load(std::memory_order_acquire);
+  if (!page) {
+    if (!create) {
+      return nullptr;
+    }
+    auto new_page = new Page();
+    for (uint32_t i = 0; i < kSlotsPerPage; ++i) {
+      new_page->slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+    if (page_ptr.compare_exchange_strong(page, new_page,
+                                         std::memory_order_acq_rel)) {
+      page = new_page;
+    } else {
+      // Another thread beat us to it; page now holds theirs.
+      delete new_page;
+    }
+  }
+  return &page->slots[(address & ((1 << kPageShift) - 1)) >> 2];
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  std::lock_guard<xe::mutex> guard(lock_);
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  auto slot = LookupSlot(address, false);
+  if (!slot) {
+    return nullptr;
+  }
+  Entry* entry = slot->load(std::memory_order_acquire);
   if (entry) {
     // TODO(benvanik): wait if needed?
     if (entry->status != Entry::STATUS_READY) {
@@ -39,45 +69,41 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
-
-  lock_.lock();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        lock_.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        lock_.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+  auto slot = LookupSlot(address, true);
+  Entry* entry = slot->load(std::memory_order_acquire);
+  if (!entry) {
+    // Try to claim the slot. Whoever wins the race gets to initialize it.
+    auto new_entry = new Entry();
+    new_entry->address = address;
+    new_entry->end_address = 0;
+    new_entry->status = Entry::STATUS_COMPILING;
+    new_entry->function = nullptr;
+    if (slot->compare_exchange_strong(entry, new_entry,
+                                      std::memory_order_acq_rel)) {
+      {
+        std::lock_guard<xe::mutex> guard(list_lock_);
+        list_.push_back(new_entry);
+      }
+      *out_entry = new_entry;
+      return Entry::STATUS_NEW;
     }
-    status = entry->status;
-  } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
-    status = Entry::STATUS_NEW;
+    // Lost; entry now holds the winner.
+    delete new_entry;
+  }
+
+  // If we aren't ready yet spin and wait.
+  while (entry->status == Entry::STATUS_COMPILING) {
+    // TODO(benvanik): sleep for less time?
+    xe::threading::Sleep(std::chrono::microseconds(10));
   }
-  lock_.unlock();
   *out_entry = entry;
-  return status;
+  return entry->status;
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  std::lock_guard<xe::mutex> guard(lock_);
+  std::lock_guard<xe::mutex> guard(list_lock_);
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
+  for (auto entry : list_) {
     if (address >= entry->address && address <= entry->end_address) {
       if (entry->status == Entry::STATUS_READY) {
         fns.push_back(entry->function);
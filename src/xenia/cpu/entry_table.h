@@ -10,8 +10,9 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
+#include <atomic>
+#include <memory>
 #include <mutex>
-#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/mutex.h"
@@ -31,10 +32,17 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
-  Function* function;
+  // Written after function/end_address so readers that see STATUS_READY also
+  // see a valid function.
+  std::atomic<Status> status;
+  // Swapped for the new function when a recompile is published.
+  std::atomic<Function*> function;
 } Entry;
 
+// Maps guest function start addresses to entries.
+// Lookups are lock-free: the 4GB guest address space is split into 64KB pages
+// each holding one slot per instruction. Pages are allocated on demand and
+// published, as are entries, with a compare-and-swap.
 class EntryTable {
  public:
   EntryTable();
@@ -46,9 +54,21 @@ class EntryTable {
   std::vector<Function*> FindWithAddress(uint32_t address);
 
  private:
-  // TODO(benvanik): replace with a better data structure.
-  xe::mutex lock_;
-  std::unordered_map<uint32_t, Entry*> map_;
+  static const uint32_t kPageShift = 16;
+  static const uint32_t kPageCount = 1 << (32 - kPageShift);
+  static const uint32_t kSlotsPerPage = (1 << kPageShift) / 4;
+
+  struct Page {
+    std::atomic<Entry*> slots[kSlotsPerPage];
+  };
+
+  std::atomic<Entry*>* LookupSlot(uint32_t address, bool create);
+
+  std::unique_ptr<std::atomic<Page*>[]> pages_;
+
+  // Only used when adding entries, to keep a list for iteration.
+  xe::mutex list_lock_;
+  std::vector<Entry*> list_;
 };
 
 }  // namespace cpu
@@ -9,12 +9,65 @@
 
 #include "xenia/cpu/export_resolver.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/profiling.h"
 
 namespace xe {
 namespace cpu {
 
+// Upper bounds of all but the last histogram bucket, in microseconds.
+static const uint64_t kHistogramBoundsUs[] = {1,   4,    16,   64,
+                                              256, 1024, 4096};
+static_assert(sizeof(kHistogramBoundsUs) / sizeof(uint64_t) ==
+                  Export::kHistogramBucketCount - 1,
+              "one bound per bucket");
+
+ExportCallScope::ExportCallScope(Export* export_entry)
+    : export_entry_(export_entry) {
+  xe::atomic_exchange_add(uint64_t(1), &export_entry_->call_stats.call_count);
+#if XE_OPTION_PROFILING
+  if (!export_entry_->profile_token) {
+    export_entry_->profile_token = MicroProfileGetToken(
+        "kernel", export_entry_->name,
+        Profiler::GetColor(export_entry_->name), MicroProfileTokenTypeCpu);
+  }
+  profile_ticks_ = MicroProfileEnter(export_entry_->profile_token);
+#endif  // XE_OPTION_PROFILING
+  if (FLAGS_kernel_call_stats) {
+    start_ticks_ = Clock::QueryHostTickCount();
+  }
+}
+
+ExportCallScope::~ExportCallScope() {
+  if (FLAGS_kernel_call_stats) {
+    uint64_t ticks = Clock::QueryHostTickCount() - start_ticks_;
+    uint64_t us = ticks * 1000000 / Clock::host_tick_frequency();
+    size_t bucket = 0;
+    while (bucket < Export::kHistogramBucketCount - 1 &&
+           us >= kHistogramBoundsUs[bucket]) {
+      ++bucket;
+    }
+    auto& stats = export_entry_->call_stats;
+    xe::atomic_exchange_add(ticks, &stats.total_ticks);
+    xe::atomic_exchange_add(uint64_t(1), &stats.histogram[bucket]);
+    uint64_t max_ticks = stats.max_ticks;
+    while (ticks > max_ticks &&
+           !xe::atomic_cas(max_ticks, ticks, &stats.max_ticks)) {
+      max_ticks = stats.max_ticks;
+    }
+  }
+#if XE_OPTION_PROFILING
+  MicroProfileLeave(export_entry_->profile_token, profile_ticks_);
+#endif  // XE_OPTION_PROFILING
+}
+
 ExportResolver::ExportResolver() = default;
 
 ExportResolver::~ExportResolver() = default;
@@ -22,20 +75,22 @@ ExportResolver::~ExportResolver() = default;
 void ExportResolver::RegisterTable(
     const std::string& library_name,
     const std::vector<xe::cpu::Export*>* exports) {
+  auto library_id = static_cast<LibraryId>(tables_.size());
   tables_.emplace_back(library_name, exports);
+  const auto& table = tables_.back();
+  library_ids_.emplace(table.name, library_id);
+  library_ids_.emplace(table.simple_name, library_id);
+}
+
+ExportResolver::LibraryId ExportResolver::GetLibraryId(
+    const std::string& library_name) const {
+  auto it = library_ids_.find(library_name);
+  return it != library_ids_.end() ? it->second : kInvalidLibraryId;
 }
 
 Export* ExportResolver::GetExportByOrdinal(const std::string& library_name,
                                            uint16_t ordinal) {
-  for (const auto& table : tables_) {
-    if (table.name == library_name || table.simple_name == library_name) {
-      if (ordinal > table.exports->size()) {
-        return nullptr;
-      }
-      return table.exports->at(ordinal);
-    }
-  }
-  return nullptr;
+  return GetExportByOrdinal(GetLibraryId(library_name), ordinal);
 }
 
 void ExportResolver::SetVariableMapping(const std::string& library_name,
@@ -64,5 +119,62 @@ void ExportResolver::SetFunctionMapping(const std::string& library_name,
   export_entry->function_data.trampoline = trampoline;
 }
 
+void ExportResolver::DumpCallStats() {
+  std::vector<Export*> exports;
+  for (const auto& table : tables_) {
+    for (auto export_entry : *table.exports) {
+      if (export_entry && export_entry->type == Export::Type::kFunction &&
+          export_entry->call_stats.call_count) {
+        exports.push_back(export_entry);
+      }
+    }
+  }
+  std::sort(exports.begin(), exports.end(), [](Export* a, Export* b) {
+    if (a->call_stats.total_ticks != b->call_stats.total_ticks) {
+      return a->call_stats.total_ticks > b->call_stats.total_ticks;
+    }
+    return a->call_stats.call_count > b->call_stats.call_count;
+  });
+
+  // Percentiles are reported as the upper bound of the bucket they fall in.
+  auto percentile = [](const Export::CallStats& stats, double fraction) {
+    uint64_t timed_count = 0;
+    for (size_t i = 0; i < Export::kHistogramBucketCount; ++i) {
+      timed_count += stats.histogram[i];
+    }
+    uint64_t target = static_cast<uint64_t>(timed_count * fraction);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < Export::kHistogramBucketCount - 1; ++i) {
+      seen += stats.histogram[i];
+      if (seen > target) {
+        return static_cast<long long>(kHistogramBoundsUs[i]);
+      }
+    }
+    return -1ll;
+  };
+
+  double us_per_tick = 1000000.0 / Clock::host_tick_frequency();
+  XELOGI("Kernel call stats (histogram buckets <1 <4 <16 <64 <256 <1k <4k "
+         ">=4k us, -1 = over the last bound):");
+  for (auto export_entry : exports) {
+    const auto& stats = export_entry->call_stats;
+    XELOGI(
+        "  %-40s %10lld calls %10.1fms total %8.1fus avg %9.1fus max p50<%lld "
+        "p99<%lld | %lld %lld %lld %lld %lld %lld %lld %lld",
+        export_entry->name, static_cast<long long>(stats.call_count),
+        stats.total_ticks * us_per_tick / 1000.0,
+        stats.total_ticks * us_per_tick / stats.call_count,
+        stats.max_ticks * us_per_tick, percentile(stats, 0.5),
+        percentile(stats, 0.99), static_cast<long long>(stats.histogram[0]),
+        static_cast<long long>(stats.histogram[1]),
+        static_cast<long long>(stats.histogram[2]),
+        static_cast<long long>(stats.histogram[3]),
+        static_cast<long long>(stats.histogram[4]),
+        static_cast<long long>(stats.histogram[5]),
+        static_cast<long long>(stats.histogram[6]),
+        static_cast<long long>(stats.histogram[7]));
+  }
+}
+
 }  // namespace cpu
 }  // namespace xe
@@ -11,6 +11,7 @@
 #define XENIA_CPU_EXPORT_RESOLVER_H_
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/math.h"
@@ -32,6 +33,10 @@ struct ExportTag {
   static const type kHighFrequency = 1u << 3;
   // Export is important and should always be logged.
   static const type kImportant = 1u << 4;
+  // Export is short and never re-enters guest code (no callbacks, waits or
+  // APC delivery). Generated code may call it directly with its arguments in
+  // host registers instead of going through the guest-to-host thunk.
+  static const type kFastCall = 1u << 5;
 
   static const type kThreading = 1u << 10;
   static const type kInput = 1u << 11;
@@ -53,6 +58,12 @@ struct ExportTag {
 typedef void (*xe_kernel_export_shim_fn)(void*, void*);
 
 typedef void (*ExportTrampoline)(xe::cpu::frontend::PPCContext* ppc_context);
+// Trampoline for kFastCall exports. The first kFastCallArgCount integer
+// arguments (r3+) are passed in host registers.
+typedef void (*ExportFastTrampoline)(xe::cpu::frontend::PPCContext* ppc_context,
+                                     uint64_t arg0, uint64_t arg1,
+                                     uint64_t arg2);
+const size_t kFastCallArgCount = 3;
 
 class Export {
  public:
@@ -61,12 +72,26 @@ class Export {
     kVariable = 1,
   };
 
+  // Buckets of the per-call host time histogram, in microseconds. The last
+  // bucket holds everything at or above the last bound.
+  static const size_t kHistogramBucketCount = 8;
+
+  // Updated atomically by the kernel trampolines from any guest thread. Time
+  // is only collected with --kernel_call_stats.
+  struct CallStats {
+    uint64_t call_count;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+    uint64_t histogram[kHistogramBucketCount];
+  };
+
   Export(uint16_t ordinal, Type type, const char* name,
          ExportTag::type tags = 0)
       : ordinal(ordinal),
         type(type),
         tags(tags),
-        function_data({nullptr, nullptr, 0}) {
+        function_data({nullptr, nullptr, nullptr}),
+        call_stats({0, 0, 0, {0}}) {
     std::strncpy(this->name, name, xe::countof(this->name));
   }
 
@@ -92,9 +117,29 @@ class Export {
       // Trampoline that is called from the guest-to-host thunk.
       // Expects only PPC context as first arg.
       ExportTrampoline trampoline;
-      uint64_t call_count;
+
+      // Only set for kFastCall exports whose arguments all fit in
+      // registers.
+      ExportFastTrampoline fast_trampoline;
     } function_data;
   };
+
+  CallStats call_stats;
+  // Lazily fetched profiler token the export's calls are entered under.
+  uint64_t profile_token = 0;
+};
+
+// Counts a call to the given export and, with --kernel_call_stats, times it.
+// The call is also entered as a profiler scope under the "kernel" group.
+class ExportCallScope {
+ public:
+  explicit ExportCallScope(Export* export_entry);
+  ~ExportCallScope();
+
+ private:
+  Export* export_entry_;
+  uint64_t start_ticks_ = 0;
+  uint64_t profile_ticks_ = 0;
 };
 
 class ExportResolver {
@@ -102,9 +147,24 @@ class ExportResolver {
   ExportResolver();
   ~ExportResolver();
 
+  // Interned handle of a registered export table. Resolve once with
+  // GetLibraryId and index by ordinal from then on.
+  typedef uint32_t LibraryId;
+  static const LibraryId kInvalidLibraryId = ~0u;
+
   void RegisterTable(const std::string& library_name,
                      const std::vector<Export*>* exports);
 
+  // Accepts the full (xboxkrnl.exe) or extensionless (xboxkrnl) name.
+  LibraryId GetLibraryId(const std::string& library_name) const;
+
+  Export* GetExportByOrdinal(LibraryId library_id, uint16_t ordinal) const {
+    if (library_id >= tables_.size()) {
+      return nullptr;
+    }
+    auto exports = tables_[library_id].exports;
+    return ordinal < exports->size() ? (*exports)[ordinal] : nullptr;
+  }
   Export* GetExportByOrdinal(const std::string& library_name, uint16_t ordinal);
 
   void SetVariableMapping(const std::string& library_name, uint16_t ordinal,
@@ -114,6 +174,10 @@ class ExportResolver {
   void SetFunctionMapping(const std::string& library_name, uint16_t ordinal,
                           ExportTrampoline trampoline);
 
+  // Logs all called function exports sorted by total time (or by call count
+  // when time was not collected).
+  void DumpCallStats();
+
  private:
   struct ExportTable {
     std::string name;
@@ -130,6 +194,8 @@ class ExportResolver {
     }
   };
   std::vector<ExportTable> tables_;
+  // Both names of each table map to its index in tables_.
+  std::unordered_map<std::string, LibraryId> library_ids_;
 };
 
 }  // namespace cpu
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_FRONTEND_PPC_CONTEXT_H_
 #define XENIA_CPU_FRONTEND_PPC_CONTEXT_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
@@ -252,12 +253,12 @@ typedef struct alignas(64) PPCContext_s {
   // TODO(benvanik): this is getting nasty. Must be here.
   uint8_t* virtual_membase;
 
-  // Most frequently used registers first.
-  uint64_t lr;      // Link register
-  uint64_t ctr;     // Count register
-  uint64_t r[32];   // General purpose registers
-  double f[32];     // Floating-point registers
-  vec128_t v[128];  // VMX128 vector registers
+  // Hot integer state is grouped in the first cache lines: LR, CTR, XER
+  // and the CR fields share the first line with the pointers above and
+  // r1-r12 follow right after. Everything from lr up to thread_id is guest
+  // state and is saved as one block by snapshots.
+  uint64_t lr;   // Link register
+  uint64_t ctr;  // Count register
 
   // XER register
   // Split to make it easier to do individual updates.
@@ -342,6 +343,12 @@ typedef struct alignas(64) PPCContext_s {
     };
   } cr7;
 
+  uint64_t r[32];  // General purpose registers
+
+  // Cold state follows.
+  double f[32];     // Floating-point registers
+  vec128_t v[128];  // VMX128 vector registers
+
   union {
     uint32_t value;
     struct {
@@ -404,8 +411,11 @@ typedef struct alignas(64) PPCContext_s {
   // Thread ID assigned to this context.
   uint32_t thread_id;
 
-  // Reserve address for load acquire/store release. Shared.
-  uint64_t* reserve_address;
+  // Reservation taken by lwarx/ldarx: the value loaded (in memory byte
+  // order) and its guest address, or 0 if there is none. stwcx./stdcx. only
+  // store if memory still holds the reserved value.
+  uint64_t reserved_val;
+  uint32_t reserved_addr;
 
   // Used to shuttle data into externs. Contents volatile.
   uint64_t scratch;
@@ -432,6 +442,8 @@ typedef struct alignas(64) PPCContext_s {
 } PPCContext;
 #pragma pack(pop)
 static_assert(sizeof(PPCContext) % 64 == 0, "64b padded");
+static_assert(offsetof(PPCContext, cr6) + 4 <= 64,
+              "LR, CTR, XER and CR0-CR6 must share the first cache line");
 
 }  // namespace frontend
 }  // namespace cpu
@@ -10,6 +10,7 @@
 #include "xenia/cpu/frontend/ppc_emit-private.h"
 
 #include "xenia/base/assert.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/frontend/ppc_context.h"
 #include "xenia/cpu/frontend/ppc_hir_builder.h"
 
@@ -56,7 +57,13 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
     if (nia_value == f.function()->address() && lk) {
       is_recursion = true;
     }
-    Label* label = is_recursion ? NULL : f.LookupLabel(nia_value);
+    // A bl to a label inside ourselves is a local subroutine whose blr
+    // returns to cia + 4. Calling it keeps that blr paired with a host call;
+    // bl $+4 only reads the PC and stays a jump.
+    bool is_local_call = lk && nia_value != cia + 4 &&
+                         FLAGS_call_local_subroutines;
+    Label* label =
+        is_recursion || is_local_call ? NULL : f.LookupLabel(nia_value);
     if (label) {
       // Branch to label.
       uint32_t branch_flags = 0;
@@ -453,14 +453,30 @@ XEEMITTER(mffsx, 0xFC00048E, X)(PPCHIRBuilder& f, InstrData& i) {
   return 0;
 }
 
+int InstrEmit_mtfsbx_(PPCHIRBuilder& f, InstrData& i, bool set) {
+  // FPSCR[BT] <- set
+  if (i.X.Rc) {
+    XEINSTRNOTIMPLEMENTED();
+    return 1;
+  }
+  uint64_t mask = 1ull << (31 - i.X.RT);
+  Value* v = f.LoadFPSCR();
+  if (set) {
+    v = f.Or(v, f.LoadConstantUint64(mask));
+  } else {
+    v = f.And(v, f.LoadConstantUint64(~mask));
+  }
+  // Only bits 29-31 (NI/RN) affect the host mode.
+  f.StoreFPSCR(v, i.X.RT >= 29);
+  return 0;
+}
+
 XEEMITTER(mtfsb0x, 0xFC00008C, X)(PPCHIRBuilder& f, InstrData& i) {
-  XEINSTRNOTIMPLEMENTED();
-  return 1;
+  return InstrEmit_mtfsbx_(f, i, false);
 }
 
 XEEMITTER(mtfsb1x, 0xFC00004C, X)(PPCHIRBuilder& f, InstrData& i) {
-  XEINSTRNOTIMPLEMENTED();
-  return 1;
+  return InstrEmit_mtfsbx_(f, i, true);
 }
 
 XEEMITTER(mtfsfx, 0xFC00058E, XFL)(PPCHIRBuilder& f, InstrData& i) {
@@ -483,8 +499,19 @@ XEEMITTER(mtfsfx, 0xFC00058E, XFL)(PPCHIRBuilder& f, InstrData& i) {
 }
 
 XEEMITTER(mtfsfix, 0xFC00010C, X)(PPCHIRBuilder& f, InstrData& i) {
-  XEINSTRNOTIMPLEMENTED();
-  return 1;
+  // FPSCR[4*BF:4*BF+3] <- U
+  if (i.X.Rc) {
+    XEINSTRNOTIMPLEMENTED();
+    return 1;
+  }
+  uint32_t bf = i.X.RT >> 2;
+  uint32_t u = i.X.RB >> 1;
+  uint32_t shift = 28 - 4 * bf;
+  Value* v = f.And(f.LoadFPSCR(), f.LoadConstantUint64(~(0xFull << shift)));
+  v = f.Or(v, f.LoadConstantUint64(uint64_t(u) << shift));
+  // Only field 7 holds NI/RN.
+  f.StoreFPSCR(v, bf == 7);
+  return 0;
 }
 
 // Floating-point move (A-21)
@@ -658,12 +658,19 @@ XEEMITTER(stswx, 0x7C00052A, X)(PPCHIRBuilder& f, InstrData& i) {
 // Memory synchronization (A-18)
 
 XEEMITTER(eieio, 0x7C0006AC, X)(PPCHIRBuilder& f, InstrData& i) {
-  f.MemoryBarrier();
+  // MMIO goes through handlers that are ordered anyway, so this only needs
+  // to order stores to normal memory.
+  f.MemoryBarrier(MEMORY_BARRIER_STORE);
   return 0;
 }
 
 XEEMITTER(sync, 0x7C0004AC, X)(PPCHIRBuilder& f, InstrData& i) {
-  f.MemoryBarrier();
+  // L = 1 is lwsync.
+  if ((i.X.RT & 3) == 1) {
+    f.MemoryBarrier(MEMORY_BARRIER_LIGHTWEIGHT);
+  } else {
+    f.MemoryBarrier(MEMORY_BARRIER_FULL);
+  }
   return 0;
 }
 
@@ -965,19 +972,25 @@ XEEMITTER(dcbst, 0x7C00006C, X)(PPCHIRBuilder& f, InstrData& i) {
   return 0;
 }
 
+// Touches the whole 128b line containing EA.
+// Nonzero TH values are data stream controls rather than prefetches and are
+// ignored.
+void EmitTouchBlock(PPCHIRBuilder& f, InstrData& i, uint32_t prefetch_flags) {
+  if (i.X.RT) {
+    f.Nop();
+    return;
+  }
+  Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
+  f.Prefetch(f.And(ea, f.LoadConstantInt64(~127)), 128, prefetch_flags);
+}
+
 XEEMITTER(dcbt, 0x7C00022C, X)(PPCHIRBuilder& f, InstrData& i) {
-  // No-op for now.
-  // TODO(benvanik): use prefetch
-  // XEINSTRNOTIMPLEMENTED();
-  f.Nop();
+  EmitTouchBlock(f, i, PREFETCH_LOAD);
   return 0;
 }
 
 XEEMITTER(dcbtst, 0x7C0001EC, X)(PPCHIRBuilder& f, InstrData& i) {
-  // No-op for now.
-  // TODO(benvanik): use prefetch
-  // XEINSTRNOTIMPLEMENTED();
-  f.Nop();
+  EmitTouchBlock(f, i, PREFETCH_STORE);
   return 0;
 }
 
@@ -9,6 +9,10 @@
 
 #include "xenia/cpu/frontend/ppc_frontend.h"
 
+#include "xenia/base/clock.h"
+#include "xenia/base/math.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/frontend/ppc_context.h"
 #include "xenia/cpu/frontend/ppc_disasm.h"
 #include "xenia/cpu/frontend/ppc_emit.h"
@@ -75,6 +79,31 @@ void HandleGlobalLock(PPCContext* ppc_context, void* arg0, void* arg1) {
   }
 }
 
+// Called on each iteration of a loop that only polls memory or the
+// timebase. Guest threads are host threads, so calls in quick succession are
+// one thread spinning in one loop.
+void SpinWait(PPCContext* ppc_context, void* arg0, void* arg1) {
+  thread_local uint64_t last_spin_tick = 0;
+  thread_local uint32_t spin_count = 0;
+  if (Clock::QueryHostTickCount() - last_spin_tick >
+      Clock::host_tick_frequency() / 10000) {
+    // Over 100us since the last iteration, so this is a new wait.
+    spin_count = 0;
+  }
+  ++spin_count;
+  if (spin_count < 64) {
+    // Most waits are short handoffs between hardware threads; stay on the
+    // core but let an SMT sibling have the pipeline.
+    _mm_pause();
+  } else if (spin_count < 1024) {
+    xe::threading::MaybeYield();
+  } else {
+    // Waiting on something slow (vsync, the GPU); give the core up.
+    xe::threading::Sleep(std::chrono::microseconds(100));
+  }
+  last_spin_tick = Clock::QueryHostTickCount();
+}
+
 bool PPCFrontend::Initialize() {
   void* arg0 = reinterpret_cast<void*>(&builtins_.global_lock);
   void* arg1 = reinterpret_cast<void*>(&builtins_.global_lock_taken);
@@ -82,6 +111,8 @@ bool PPCFrontend::Initialize() {
       processor_->DefineBuiltin("CheckGlobalLock", CheckGlobalLock, arg0, arg1);
   builtins_.handle_global_lock = processor_->DefineBuiltin(
       "HandleGlobalLock", HandleGlobalLock, arg0, arg1);
+  builtins_.spin_wait =
+      processor_->DefineBuiltin("SpinWait", SpinWait, nullptr, nullptr);
 
   return true;
 }
@@ -97,8 +128,54 @@ bool PPCFrontend::DeclareFunction(GuestFunction* function) {
 
 bool PPCFrontend::DefineFunction(GuestFunction* function,
                                  uint32_t debug_info_flags) {
+  auto tier = FLAGS_tiered_compilation ? GuestFunction::Tier::kBaseline
+                                       : GuestFunction::Tier::kOptimized;
+  // Functions found hot in a previous run skip straight to the top tier.
+  if (FLAGS_hot_function_recompilation &&
+      processor_->backend()->IsHotFunction(function)) {
+    tier = GuestFunction::Tier::kHot;
+  }
+  auto translator = translator_pool_.Allocate(this);
+  bool result = translator->Translate(function, debug_info_flags, tier);
+  translator_pool_.Release(translator);
+  return result;
+}
+
+std::unique_ptr<GuestFunction> PPCFrontend::RecompileFunction(
+    GuestFunction* function, uint32_t debug_info_flags) {
+  // Recompiles are also requested for other reasons (MMIO access sites), so
+  // only move up a tier once the call threshold has been crossed.
+  auto tier = function->tier();
+  if (function->recompile_threshold() &&
+      function->call_count() >= function->recompile_threshold()) {
+    tier = function->is_baseline() ? GuestFunction::Tier::kOptimized
+                                   : GuestFunction::Tier::kHot;
+  }
+  if (tier == GuestFunction::Tier::kHot &&
+      function->tier() != GuestFunction::Tier::kHot) {
+    // Remember for the next run. This must happen before the call count is
+    // reset by the translation.
+    processor_->backend()->RecordHotFunction(function);
+  }
+  // Threads may be running the current code, so never touch it: the new code
+  // and its source map go into a new function.
+  auto new_function = processor_->backend()->CreateGuestFunction(
+      function->module(), function->address());
+  new_function->CopyDeclaration(function);
+  auto translator = translator_pool_.Allocate(this);
+  bool result = translator->Translate(new_function.get(), debug_info_flags,
+                                      tier);
+  translator_pool_.Release(translator);
+  if (!result) {
+    return nullptr;
+  }
+  return new_function;
+}
+
+bool PPCFrontend::DisassembleFunction(GuestFunction* function,
+                                      uint32_t debug_info_flags) {
   auto translator = translator_pool_.Allocate(this);
-  bool result = translator->Translate(function, debug_info_flags);
+  bool result = translator->Disassemble(function, debug_info_flags);
   translator_pool_.Release(translator);
   return result;
 }
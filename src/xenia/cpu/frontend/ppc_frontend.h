@@ -36,6 +36,7 @@ struct PPCBuiltins {
   bool global_lock_taken;
   Function* check_global_lock;
   Function* handle_global_lock;
+  Function* spin_wait;
 };
 
 class PPCFrontend {
@@ -52,12 +53,22 @@ class PPCFrontend {
 
   bool DeclareFunction(GuestFunction* function);
   bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags);
+  // Translates an already defined function again into a new function object.
+  // Once it has crossed its call threshold it moves to the next tier:
+  // baseline code gets all optimizations and optimized code the aggressive
+  // hot pipeline. The new code replaces the old in the indirection table but
+  // the caller must publish the new function in the module.
+  std::unique_ptr<GuestFunction> RecompileFunction(GuestFunction* function,
+                                                   uint32_t debug_info_flags);
+  // Regenerates source/HIR disassembly of a defined function into its debug
+  // info without touching its code.
+  bool DisassembleFunction(GuestFunction* function, uint32_t debug_info_flags);
 
  private:
   Processor* processor_;
   std::unique_ptr<ContextInfo> context_info_;
   PPCBuiltins builtins_;
-  TypePool<PPCTranslator, PPCFrontend*> translator_pool_;
+  LockFreeTypePool<PPCTranslator, PPCFrontend*> translator_pool_;
 };
 
 }  // namespace frontend
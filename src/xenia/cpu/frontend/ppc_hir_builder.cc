@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/frontend/ppc_hir_builder.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "xenia/base/byte_order.h"
@@ -19,6 +20,7 @@
 #include "xenia/cpu/frontend/ppc_disasm.h"
 #include "xenia/cpu/frontend/ppc_frontend.h"
 #include "xenia/cpu/frontend/ppc_instr.h"
+#include "xenia/cpu/frontend/ppc_scanner.h"
 #include "xenia/cpu/hir/label.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/profiling.h"
@@ -45,23 +47,29 @@ void PPCHIRBuilder::Reset() {
   instr_count_ = 0;
   instr_offset_list_ = NULL;
   label_list_ = NULL;
+  mmio_access_sites_.clear();
   with_debug_info_ = false;
   HIRBuilder::Reset();
 }
 
-bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
+bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags,
+                         uint32_t end_address) {
   SCOPE_profile_cpu_f("cpu");
 
   Memory* memory = frontend_->memory();
 
   function_ = function;
   start_address_ = function_->address();
-  instr_count_ = (function_->end_address() - function_->address()) / 4 + 1;
+  mmio_access_sites_ = function_->mmio_access_sites();
+  if (!end_address) {
+    end_address = function_->end_address();
+  }
+  instr_count_ = (end_address - function_->address()) / 4 + 1;
 
   with_debug_info_ = (flags & EMIT_DEBUG_COMMENTS) == EMIT_DEBUG_COMMENTS;
   if (with_debug_info_) {
     CommentFormat("%s fn %.8X-%.8X %s", function_->module()->name().c_str(),
-                  function_->address(), function_->end_address(),
+                  function_->address(), end_address,
                   function_->name().c_str());
   }
 
@@ -81,14 +89,11 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   label_list_[0] = NewLabel();
 
   uint32_t start_address = function_->address();
-  uint32_t end_address = function_->end_address();
+  PPCInstrReader reader(memory, function_);
   InstrData i;
   for (uint32_t address = start_address, offset = 0; address <= end_address;
        address += 4, offset++) {
-    i.address = address;
-    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
-    // TODO(benvanik): find a way to avoid using the opcode tables.
-    i.type = GetInstrType(i.code);
+    reader.Read(address, &i);
     trace_info_.dest_count = 0;
 
     // Mark label, if we were assigned one earlier on in the walk.
@@ -148,6 +153,13 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       }
     }
 
+    // bc (opcode 16) closing a polling loop.
+    if (FLAGS_yield_in_spin_loops && i.code >> 26 == 16 &&
+        IsSpinLoopBranch(reader, i)) {
+      Comment("spin loop");
+      CallExtern(frontend_->builtins()->spin_wait);
+    }
+
     if (!i.type->emit || emit(*this, i)) {
       XELOGE("Unimplemented instr %.8llX %.8X %s", i.address, i.code,
              i.type->name);
@@ -155,11 +167,140 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       // DebugBreak();
       // TraceInvalidInstruction(i);
     }
+
+    if (!mmio_access_sites_.empty() &&
+        std::binary_search(mmio_access_sites_.begin(),
+                           mmio_access_sites_.end(), address)) {
+      MarkMMIOAccessSite(first_instr);
+    }
   }
 
   return Finalize();
 }
 
+void PPCHIRBuilder::MarkMMIOAccessSite(Instr* first_instr) {
+  // Guest memory instructions never end a block, so their loads/stores all
+  // follow the SOURCE_OFFSET in the same block.
+  for (auto instr = first_instr; instr; instr = instr->next) {
+    if ((instr->opcode == &OPCODE_LOAD_info &&
+         instr->dest->type == INT32_TYPE) ||
+        (instr->opcode == &OPCODE_STORE_info &&
+         instr->src2.value->type == INT32_TYPE)) {
+      instr->flags |= LoadStoreFlags::LOAD_STORE_CHECK_MMIO;
+    }
+  }
+}
+
+namespace {
+
+uint32_t GprBit(uint32_t reg) { return 1u << reg; }
+
+// rA = 0 in address computations means 0, not r0.
+uint32_t BaseGprBit(uint32_t reg) { return reg ? 1u << reg : 0; }
+
+// Gets the GPRs read and written by instructions allowed in polling loops:
+// loads, compares, simple logic and timebase reads. Returns false for
+// anything else.
+bool GetPollingInstrGprs(const InstrData& i, uint32_t* out_reads,
+                         uint32_t* out_writes) {
+  auto is = [&i](const char* name) { return !std::strcmp(i.type->name, name); };
+  uint32_t reads = 0;
+  uint32_t writes = 0;
+  if (is("lbz") || is("lhz") || is("lha") || is("lwz")) {
+    reads = BaseGprBit(i.D.RA);
+    writes = GprBit(i.D.RT);
+  } else if (is("ld") || is("lwa")) {
+    reads = BaseGprBit(i.DS.RA);
+    writes = GprBit(i.DS.RT);
+  } else if (is("lbzx") || is("lhzx") || is("lhax") || is("lwzx") ||
+             is("lwax") || is("ldx") || is("lhbrx") || is("lwbrx") ||
+             is("ldbrx")) {
+    reads = BaseGprBit(i.X.RA) | GprBit(i.X.RB);
+    writes = GprBit(i.X.RT);
+  } else if (is("cmp") || is("cmpl")) {
+    reads = GprBit(i.X.RA) | GprBit(i.X.RB);
+  } else if (is("cmpi") || is("cmpli")) {
+    reads = GprBit(i.D.RA);
+  } else if (is("andix") || is("andisx") || is("ori") || is("oris") ||
+             is("xori") || is("xoris")) {
+    reads = GprBit(i.D.RT);
+    writes = GprBit(i.D.RA);
+  } else if (is("orx") && i.X.RT == i.X.RA && i.X.RT == i.X.RB) {
+    // or rx, rx, rx: nop or thread priority hint.
+  } else if (is("andx") || is("andcx") || is("orx") || is("xorx")) {
+    reads = GprBit(i.X.RT) | GprBit(i.X.RB);
+    writes = GprBit(i.X.RA);
+  } else if (is("extsbx") || is("extshx") || is("extswx") ||
+             is("cntlzwx") || is("cntlzdx")) {
+    reads = GprBit(i.X.RT);
+    writes = GprBit(i.X.RA);
+  } else if (is("rlwinmx")) {
+    reads = GprBit(i.M.RT);
+    writes = GprBit(i.M.RA);
+  } else if (is("rldiclx") || is("rldicrx") || is("rldicx")) {
+    reads = GprBit(i.MD.RT);
+    writes = GprBit(i.MD.RA);
+  } else if (is("mftb") || is("mfspr")) {
+    const uint32_t n = ((i.XFX.spr & 0x1F) << 5) | ((i.XFX.spr >> 5) & 0x1F);
+    if (n != 268 && n != 269) {
+      // Not TBL/TBU.
+      return false;
+    }
+    writes = GprBit(i.XFX.RT);
+  } else if (!is("sync") && !is("isync") && !is("eieio")) {
+    return false;
+  }
+  *out_reads = reads;
+  *out_writes = writes;
+  return true;
+}
+
+}  // namespace
+
+bool PPCHIRBuilder::IsSpinLoopBranch(const PPCInstrReader& reader,
+                                     const InstrData& branch) {
+  // Recognizes loops such as
+  //   loc_8200: lwz r11, 0(r31)
+  //             cmpwi cr6, r11, 0
+  //             beq cr6, loc_8200
+  // where no register carries a value from one iteration to the next, so
+  // every iteration does the same until another thread (or time) changes
+  // what is read.
+  const uint32_t kMaxLoopInstrs = 8;
+  if (branch.B.LK || !(branch.B.BO & 0x4)) {
+    // A call, or a counted loop (decrementing CTR).
+    return false;
+  }
+  uint32_t target =
+      (branch.B.AA ? 0 : branch.address) + uint32_t(XEEXTS16(branch.B.BD << 2));
+  if (target > branch.address || target < start_address_ ||
+      branch.address - target > (kMaxLoopInstrs - 1) * 4) {
+    return false;
+  }
+  uint32_t loop_reads[kMaxLoopInstrs];
+  uint32_t loop_writes[kMaxLoopInstrs];
+  uint32_t all_writes = 0;
+  uint32_t count = 0;
+  for (uint32_t address = target; address < branch.address; address += 4) {
+    InstrData i;
+    reader.Read(address, &i);
+    if (!i.type ||
+        !GetPollingInstrGprs(i, &loop_reads[count], &loop_writes[count])) {
+      return false;
+    }
+    all_writes |= loop_writes[count++];
+  }
+  // Registers written in the loop must be written before they are read.
+  uint32_t written = 0;
+  for (uint32_t n = 0; n < count; ++n) {
+    if (loop_reads[n] & all_writes & ~written) {
+      return false;
+    }
+    written |= loop_writes[n];
+  }
+  return true;
+}
+
 void PPCHIRBuilder::AnnotateLabel(uint32_t address, Label* label) {
   char name_buffer[13];
   snprintf(name_buffer, xe::countof(name_buffer), "loc_%.8X", address);
@@ -363,9 +504,13 @@ Value* PPCHIRBuilder::LoadFPSCR() {
   return LoadContext(offsetof(PPCContext, fpscr), INT64_TYPE);
 }
 
-void PPCHIRBuilder::StoreFPSCR(Value* value) {
+void PPCHIRBuilder::StoreFPSCR(Value* value, bool mode_changed) {
   assert_true(value->type == INT64_TYPE);
   StoreContext(offsetof(PPCContext, fpscr), value);
+  if (mode_changed && !FLAGS_assume_default_fpscr_mode) {
+    // RN is FPSCR[30:31] and NI FPSCR[29], so the low 3 bits.
+    SetRoundingMode(And(Truncate(value, INT32_TYPE), LoadConstantInt32(7)));
+  }
 
   auto& trace_reg = trace_info_.dests[trace_info_.dest_count++];
   trace_reg.reg = 67;
@@ -444,28 +589,36 @@ void PPCHIRBuilder::StoreVR(uint32_t reg, Value* value) {
   trace_reg.value = value;
 }
 
+// Reservations are emulated by value: the conditional store is a
+// compare-exchange against what the reserving load saw. That misses an ABA
+// write of the same value in between, which lock-free guest code tolerates
+// the same way it would on a host with only CAS.
 Value* PPCHIRBuilder::LoadAcquire(Value* address, TypeName type,
                                   uint32_t load_flags) {
-  AtomicExchange(LoadContext(offsetof(PPCContext, reserve_address), INT64_TYPE),
-                 Truncate(address, INT32_TYPE));
-  return Load(address, type, load_flags);
-}
-
-Value* PPCHIRBuilder::StoreRelease(Value* address, Value* value,
-                                   uint32_t store_flags) {
-  Value* old_address = AtomicExchange(
-      LoadContext(offsetof(PPCContext, reserve_address), INT64_TYPE),
-      LoadZeroInt32());
-  // Ensure the reservation addresses match.
-  Value* eq = CompareEQ(Truncate(address, INT32_TYPE), old_address);
-  StoreContext(offsetof(PPCContext, cr0.cr0_eq), eq);
+  // Loaded in memory byte order so it can be compared against memory as-is.
+  Value* value = Load(address, type, load_flags);
+  StoreContext(offsetof(PPCContext, reserved_addr),
+               Truncate(address, INT32_TYPE));
+  StoreContext(offsetof(PPCContext, reserved_val), value);
+  return value;
+}
+
+void PPCHIRBuilder::StoreRelease(Value* address, Value* value) {
+  // The reservation is lost whether or not the store happens.
+  Value* reserved_addr =
+      LoadContext(offsetof(PPCContext, reserved_addr), INT32_TYPE);
+  StoreContext(offsetof(PPCContext, reserved_addr), LoadZeroInt32());
   StoreContext(offsetof(PPCContext, cr0.cr0_lt), LoadZeroInt8());
   StoreContext(offsetof(PPCContext, cr0.cr0_gt), LoadZeroInt8());
+  StoreContext(offsetof(PPCContext, cr0.cr0_eq), LoadZeroInt8());
   auto skip_label = NewLabel();
-  BranchFalse(eq, skip_label, BRANCH_UNLIKELY);
-  Store(address, value, store_flags);
+  BranchFalse(CompareEQ(Truncate(address, INT32_TYPE), reserved_addr),
+              skip_label, BRANCH_UNLIKELY);
+  Value* reserved_val =
+      LoadContext(offsetof(PPCContext, reserved_val), value->type);
+  StoreContext(offsetof(PPCContext, cr0.cr0_eq),
+               AtomicCompareExchange(address, reserved_val, value));
   MarkLabel(skip_label);
-  return eq;
 }
 
 }  // namespace frontend
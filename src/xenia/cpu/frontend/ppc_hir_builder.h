@@ -12,6 +12,7 @@
 
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/frontend/ppc_instr.h"
 #include "xenia/cpu/function.h"
 
 namespace xe {
@@ -19,6 +20,7 @@ namespace cpu {
 namespace frontend {
 
 class PPCFrontend;
+class PPCInstrReader;
 
 class PPCHIRBuilder : public hir::HIRBuilder {
   using Instr = xe::cpu::hir::Instr;
@@ -35,7 +37,9 @@ class PPCHIRBuilder : public hir::HIRBuilder {
     // Emit comment nodes.
     EMIT_DEBUG_COMMENTS = 1 << 0,
   };
-  bool Emit(GuestFunction* function, uint32_t flags);
+  // Emits the given function. If end_address is non-zero it is used in place
+  // of the function end address (for functions that have not been scanned).
+  bool Emit(GuestFunction* function, uint32_t flags, uint32_t end_address = 0);
 
   GuestFunction* function() const { return function_; }
   Function* LookupFunction(uint32_t address);
@@ -57,7 +61,9 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   Value* LoadMSR();
   void StoreMSR(Value* value);
   Value* LoadFPSCR();
-  void StoreFPSCR(Value* value);
+  // mode_changed is false when the RN/NI bits are known to be untouched, so
+  // the host mode need not be updated.
+  void StoreFPSCR(Value* value, bool mode_changed = true);
   Value* LoadXER();
   void StoreXER(Value* value);
   // void UpdateXERWithOverflow();
@@ -77,10 +83,15 @@ class PPCHIRBuilder : public hir::HIRBuilder {
 
   Value* LoadAcquire(Value* address, hir::TypeName type,
                      uint32_t load_flags = 0);
-  Value* StoreRelease(Value* address, Value* value, uint32_t store_flags = 0);
+  void StoreRelease(Value* address, Value* value);
 
  private:
   void AnnotateLabel(uint32_t address, Label* label);
+  // Makes the 32-bit loads/stores emitted since first_instr check for MMIO.
+  void MarkMMIOAccessSite(Instr* first_instr);
+  // Whether the conditional branch closes a short loop that only polls
+  // memory or the timebase.
+  bool IsSpinLoopBranch(const PPCInstrReader& reader, const InstrData& branch);
 
   PPCFrontend* frontend_;
 
@@ -94,6 +105,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   uint64_t instr_count_;
   Instr** instr_offset_list_;
   Label** label_list_;
+  std::vector<uint32_t> mmio_access_sites_;
 
   // Reset each instruction.
   struct {
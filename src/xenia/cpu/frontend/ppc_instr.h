@@ -395,6 +395,9 @@ typedef struct {
   };
 } InstrData;
 
+// Instructions of a contiguous guest range. Entry n is at base + n * 4.
+typedef std::vector<InstrData> InstrDataList;
+
 typedef struct {
   enum RegisterSet {
     kXER,
@@ -11,6 +11,8 @@
 
 #include <algorithm>
 #include <map>
+#include <memory>
+#include <utility>
 
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
@@ -20,7 +22,7 @@
 #include "xenia/profiling.h"
 
 #if 0
-#define LOGPPC(fmt, ...) XELOGCORE('p', fmt, ##__VA_ARGS__)
+#define LOGPPC(fmt, ...) XELOGCORE(kCpu, kDebug, 'p', fmt, ##__VA_ARGS__)
 #else
 #define LOGPPC(fmt, ...) \
   do {                   \
@@ -31,6 +33,23 @@ namespace xe {
 namespace cpu {
 namespace frontend {
 
+PPCInstrReader::PPCInstrReader(Memory* memory, GuestFunction* function)
+    : memory_(memory),
+      base_address_(function->address()),
+      instrs_(function->decoded_instrs()) {}
+
+void PPCInstrReader::Read(uint32_t address, InstrData* out_i) const {
+  size_t index = (address - base_address_) / 4;
+  if (instrs_ && address >= base_address_ && index < instrs_->size()) {
+    *out_i = (*instrs_)[index];
+    return;
+  }
+  out_i->address = address;
+  out_i->code = xe::load_and_swap<uint32_t>(memory_->TranslateVirtual(address));
+  // TODO(benvanik): find a way to avoid using the opcode tables.
+  out_i->type = GetInstrType(out_i->code);
+}
+
 PPCScanner::PPCScanner(PPCFrontend* frontend) : frontend_(frontend) {}
 
 PPCScanner::~PPCScanner() {}
@@ -63,10 +82,12 @@ bool PPCScanner::Scan(GuestFunction* function, DebugInfo* debug_info) {
   size_t blocks_found = 0;
   bool in_block = false;
   bool starts_with_mfspr_lr = false;
+  // Rescans (tier ups, disassembly) reuse what the last scan decoded.
+  PPCInstrReader reader(memory, function);
+  InstrDataList instrs;
   InstrData i;
   while (true) {
-    i.address = address;
-    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    reader.Read(address, &i);
 
     // If we fetched 0 assume that we somehow hit one of the awesome
     // 'no really we meant to end after that bl' functions.
@@ -76,10 +97,7 @@ bool PPCScanner::Scan(GuestFunction* function, DebugInfo* debug_info) {
       address -= 4;
       break;
     }
-
-    // TODO(benvanik): find a way to avoid using the opcode tables.
-    // This lookup is *expensive* and should be avoided when scanning.
-    i.type = GetInstrType(i.code);
+    instrs.push_back(i);
 
     // TODO(benvanik): switch on instruction metadata.
     ++address_reference_count;
@@ -273,6 +291,13 @@ bool PPCScanner::Scan(GuestFunction* function, DebugInfo* debug_info) {
   }
   function->set_end_address(address);
 
+  // Keep only what lies within the function, which may be less than was
+  // read if we ran over the expected end.
+  instrs.resize(
+      std::min(instrs.size(), size_t((address - start_address) / 4 + 1)));
+  function->set_decoded_instrs(
+      std::make_shared<const InstrDataList>(std::move(instrs)));
+
   // If there's spare bits at the end, split the function.
   // TODO(benvanik): splitting?
 
@@ -299,18 +324,14 @@ std::vector<BlockInfo> PPCScanner::FindBlocks(GuestFunction* function) {
   uint32_t end_address = function->end_address();
   bool in_block = false;
   uint32_t block_start = 0;
+  PPCInstrReader reader(memory, function);
   InstrData i;
   for (uint32_t address = start_address; address <= end_address; address += 4) {
-    i.address = address;
-    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    reader.Read(address, &i);
     if (!i.code) {
       continue;
     }
 
-    // TODO(benvanik): find a way to avoid using the opcode tables.
-    // This lookup is *expensive* and should be avoided when scanning.
-    i.type = GetInstrType(i.code);
-
     if (!in_block) {
       in_block = true;
       block_start = address;
@@ -10,10 +10,13 @@
 #ifndef XENIA_CPU_FRONTEND_PPC_SCANNER_H_
 #define XENIA_CPU_FRONTEND_PPC_SCANNER_H_
 
+#include <memory>
 #include <vector>
 
 #include "xenia/cpu/debug_info.h"
+#include "xenia/cpu/frontend/ppc_instr.h"
 #include "xenia/cpu/function.h"
+#include "xenia/memory.h"
 
 namespace xe {
 namespace cpu {
@@ -26,11 +29,28 @@ struct BlockInfo {
   uint32_t end_address;
 };
 
+// Reads the instructions of a function from its decoded instructions, and
+// decodes from guest memory anything outside of them (before the function has
+// been scanned, or past its end when inlining).
+class PPCInstrReader {
+ public:
+  PPCInstrReader(Memory* memory, GuestFunction* function);
+
+  void Read(uint32_t address, InstrData* out_i) const;
+
+ private:
+  Memory* memory_;
+  uint32_t base_address_;
+  std::shared_ptr<const InstrDataList> instrs_;
+};
+
 class PPCScanner {
  public:
   explicit PPCScanner(PPCFrontend* frontend);
   ~PPCScanner();
 
+  // Finds the extents of the function and stores its decoded instructions
+  // on it for use by translation.
   bool Scan(GuestFunction* function, DebugInfo* debug_info);
 
   std::vector<BlockInfo> FindBlocks(GuestFunction* function);
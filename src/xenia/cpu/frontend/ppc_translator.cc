@@ -11,11 +11,15 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/reset_scope.h"
 #include "xenia/cpu/compiler/compiler_passes.h"
+#include "xenia/cpu/compiler/hir_corpus.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/frontend/ppc_disasm.h"
 #include "xenia/cpu/frontend/ppc_frontend.h"
@@ -26,8 +30,12 @@
 #include "xenia/debug/debugger.h"
 #include "xenia/profiling.h"
 
-DEFINE_bool(preserve_hir_disasm, true,
-            "Preserves HIR disassembly for the debugger when it is attached.");
+DEFINE_bool(preserve_hir_disasm, false,
+            "Preserves HIR disassembly for the debugger when it is attached. "
+            "Otherwise it is regenerated from guest code when requested.");
+DEFINE_bool(dump_translation_scratch_growth, false,
+            "Log translations that had to grow the HIR arena or pass side "
+            "structures. Once warmed up translations should log nothing.");
 
 namespace xe {
 namespace cpu {
@@ -37,72 +45,158 @@ using xe::cpu::backend::Backend;
 using xe::cpu::compiler::Compiler;
 namespace passes = xe::cpu::compiler::passes;
 
-PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
-  Backend* backend = frontend->processor()->backend();
-
-  scanner_.reset(new PPCScanner(frontend));
-  builder_.reset(new PPCHIRBuilder(frontend));
-  compiler_.reset(new Compiler(frontend->processor()));
-  assembler_ = backend->CreateAssembler();
-  assembler_->Initialize();
-
+// Adds the full optimizing pass pipeline. The aggressive variant is used for
+// hot functions and trades translation time for better code.
+static void AddOptimizingPasses(Compiler* compiler, Backend* backend,
+                                bool aggressive) {
   bool validate = FLAGS_validate_hir;
 
   // Merge blocks early. This will let us use more context in other passes.
   // The CFG is required for simplification and dirtied by it.
-  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
-  compiler_->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
+  compiler->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
 
   // Passes are executed in the order they are added. Multiple of the same
   // pass type may be used.
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  // Inline before promotion so that callee context accesses get promoted
+  // along with ours.
+  compiler->AddPass(std::make_unique<passes::InliningPass>(aggressive));
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::SimplificationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::ConstantPropagationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
   if (backend->machine_info()->supports_extended_load_store) {
     // Backend supports the advanced LOAD/STORE instructions.
     // These will save us a lot of HIR opcodes.
-    compiler_->AddPass(
+    compiler->AddPass(
         std::make_unique<passes::MemorySequenceCombinationPass>());
-    if (validate)
-      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  // Leaves assignments behind for simplification to fold.
+  compiler->AddPass(
+      std::make_unique<passes::CommonSubexpressionEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::SimplificationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  // Hoist loop invariant work now that context loads are promoted and
+  // constants folded. Simplification above dirtied the CFG.
+  compiler->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler->AddPass(std::make_unique<passes::LoopInvariantCodeMotionPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  if (aggressive) {
+    // Inlined bodies and combined memory sequences expose more constants.
+    compiler->AddPass(std::make_unique<passes::ConstantPropagationPass>());
+    if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+    compiler->AddPass(std::make_unique<passes::SimplificationPass>());
+    if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
   }
-  compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  // Once dead context stores are gone more values have a single use.
+  compiler->AddPass(std::make_unique<passes::ByteSwapEliminationPass>(
+      backend->machine_info()));
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  // Dead CR stores are gone, so compares feeding branches have a single use.
+  compiler->AddPass(std::make_unique<passes::CompareSinkingPass>());
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
 
   //// Removes all unneeded variables. Try not to add new ones after this.
-  // compiler_->AddPass(new passes::ValueReductionPass());
-  // if (validate) compiler_->AddPass(new passes::ValidationPass());
+  // compiler->AddPass(new passes::ValueReductionPass());
+  // if (validate) compiler->AddPass(new passes::ValidationPass());
 
   // Register allocation for the target backend.
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info(), aggressive));
+  if (validate) compiler->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
-  compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+  compiler->AddPass(std::make_unique<passes::FinalizationPass>());
+}
+
+void PPCTranslator::AddPasses(Compiler* compiler, Backend* backend,
+                              GuestFunction::Tier tier) {
+  if (tier != GuestFunction::Tier::kBaseline) {
+    AddOptimizingPasses(compiler, backend, tier == GuestFunction::Tier::kHot);
+    return;
+  }
+  // The baseline pipeline does only what is required to get valid code out,
+  // trading code quality for translation speed.
+  compiler->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  if (FLAGS_validate_hir) {
+    compiler->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  compiler->AddPass(std::make_unique<passes::FinalizationPass>());
+}
+
+PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
+  Backend* backend = frontend->processor()->backend();
+
+  scanner_.reset(new PPCScanner(frontend));
+  builder_.reset(new PPCHIRBuilder(frontend));
+  compiler_.reset(new Compiler(frontend->processor()));
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
+  assembler_ = backend->CreateAssembler();
+  assembler_->Initialize();
+
+  AddPasses(compiler_.get(), backend, GuestFunction::Tier::kOptimized);
+  if (FLAGS_hot_function_recompilation) {
+    hot_compiler_.reset(new Compiler(frontend->processor()));
+    AddPasses(hot_compiler_.get(), backend, GuestFunction::Tier::kHot);
+  }
+  AddPasses(baseline_compiler_.get(), backend, GuestFunction::Tier::kBaseline);
+
+  auto compile_stats = compiler::CompileStats::global();
+  translate_stage_ = compile_stats->GetStage("PPCTranslator");
+  scan_stage_ = compile_stats->GetStage("PPCScanner");
+  emit_stage_ = compile_stats->GetStage("PPCHIRBuilder");
+  assemble_stage_ = compile_stats->GetStage("Assembler");
 }
 
 PPCTranslator::~PPCTranslator() = default;
 
+uint64_t PPCTranslator::scratch_growth_count() const {
+  uint64_t count = builder_->arena()->chunk_allocation_count() +
+                   compiler_->scratch_growth_count() +
+                   baseline_compiler_->scratch_growth_count();
+  if (hot_compiler_) {
+    count += hot_compiler_->scratch_growth_count();
+  }
+  return count;
+}
+
+uint32_t PPCTranslator::RecompileThreshold(GuestFunction::Tier tier) {
+  switch (tier) {
+    case GuestFunction::Tier::kBaseline:
+      return uint32_t(std::max(FLAGS_tiered_compilation_threshold, 1));
+    case GuestFunction::Tier::kOptimized:
+      return FLAGS_hot_function_recompilation
+                 ? uint32_t(std::max(FLAGS_hot_function_threshold, 1))
+                 : 0;
+    default:
+      return 0;
+  }
+}
+
 bool PPCTranslator::Translate(GuestFunction* function,
-                              uint32_t debug_info_flags) {
+                              uint32_t debug_info_flags,
+                              GuestFunction::Tier tier) {
   SCOPE_profile_cpu_f("cpu");
 
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
+  xe::make_reset_scope(hot_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -127,14 +221,30 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (FLAGS_trace_function_data) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionData;
   }
+  // Reuse machine code persisted by a previous run, if we can. Debug info
+  // isn't stored so we must translate when it has been requested.
+  if (!debug_info_flags &&
+      frontend_->processor()->backend()->LoadCachedFunction(function)) {
+    // Persisted code never contains call counters. The backend sets the tier
+    // it was compiled at.
+    function->set_recompile_threshold(0);
+    return true;
+  }
+
+  // Time spent in the whole translation gives the per-function histogram.
+  compiler::CompileStageScope translate_scope(translate_stage_);
+
   std::unique_ptr<DebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new DebugInfo());
   }
 
   // Scan the function to find its extents and gather debug data.
-  if (!scanner_->Scan(function, debug_info.get())) {
-    return false;
+  {
+    compiler::CompileStageScope stage_scope(scan_stage_);
+    if (!scanner_->Scan(function, debug_info.get())) {
+      return false;
+    }
   }
 
   auto debugger = frontend_->processor()->debugger();
@@ -146,16 +256,24 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctions) {
     // Base trace data.
     size_t trace_data_size = debug::FunctionTraceData::SizeOfHeader();
+    uint8_t counter_size =
+        debug::FunctionTraceData::kDefaultInstructionCounterSize;
+    if (FLAGS_trace_function_counter_size == 1 ||
+        FLAGS_trace_function_counter_size == 2) {
+      counter_size = uint8_t(FLAGS_trace_function_counter_size);
+    }
+    uint8_t sample_shift = uint8_t(
+        std::min(std::max(FLAGS_trace_function_coverage_sample_shift, 0), 31));
     if (debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctionCoverage) {
       // Additional space for instruction coverage counts.
       trace_data_size += debug::FunctionTraceData::SizeOfInstructionCounts(
-          function->address(), function->end_address());
+          function->address(), function->end_address(), counter_size);
     }
     uint8_t* trace_data = debugger->AllocateFunctionTraceData(trace_data_size);
     if (trace_data) {
-      function->trace_data().Reset(trace_data, trace_data_size,
-                                   function->address(),
-                                   function->end_address());
+      function->trace_data().Reset(
+          trace_data, trace_data_size, function->address(),
+          function->end_address(), counter_size, sample_shift);
     }
   }
 
@@ -170,13 +288,22 @@ bool PPCTranslator::Translate(GuestFunction* function,
     xe::cpu::frontend::DumpAllInstrCounts();
   }
 
+  uint64_t growth_count = scratch_growth_count();
+
   // Emit function.
   uint32_t emit_flags = 0;
   if (debug_info) {
     emit_flags |= PPCHIRBuilder::EMIT_DEBUG_COMMENTS;
   }
-  if (!builder_->Emit(function, emit_flags)) {
-    return false;
+  {
+    compiler::CompileStageScope stage_scope(emit_stage_);
+    if (!builder_->Emit(function, emit_flags)) {
+      return false;
+    }
+  }
+  auto corpus_writer = compiler::HIRCorpusWriter::global();
+  if (corpus_writer->is_enabled()) {
+    corpus_writer->Append(function->address(), builder_.get());
   }
 
   // Stash raw HIR.
@@ -187,9 +314,14 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  if (!SelectCompiler(tier)->Compile(builder_.get())) {
     return false;
   }
+  if (FLAGS_dump_translation_scratch_growth &&
+      scratch_growth_count() != growth_count) {
+    XELOGCPU("Translation of %.8X grew scratch structures %d times",
+             function->address(), int(scratch_growth_count() - growth_count));
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -199,14 +331,85 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Assemble to backend machine code.
-  if (!assembler_->Assemble(function, builder_.get(), debug_info_flags,
-                            std::move(debug_info))) {
+  // The assembler needs to know the tier to decide whether to count calls.
+  function->set_tier(tier);
+  function->set_recompile_threshold(RecompileThreshold(tier));
+  {
+    compiler::CompileStageScope stage_scope(assemble_stage_);
+    if (!assembler_->Assemble(function, builder_.get(), debug_info_flags,
+                              std::move(debug_info))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool PPCTranslator::Disassemble(GuestFunction* function,
+                                uint32_t debug_info_flags) {
+  SCOPE_profile_cpu_f("cpu");
+
+  xe::make_reset_scope(builder_);
+  xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
+  xe::make_reset_scope(hot_compiler_);
+  xe::make_reset_scope(&string_buffer_);
+
+  debug_info_flags &= DebugInfoFlags::kDebugInfoDisasmSource |
+                      DebugInfoFlags::kDebugInfoDisasmRawHir |
+                      DebugInfoFlags::kDebugInfoDisasmHir;
+  if (!debug_info_flags) {
+    return false;
+  }
+  auto debug_info = std::make_unique<DebugInfo>();
+
+  // The function extents are already known; scanning again only gathers the
+  // instruction statistics held by the debug info.
+  if (!scanner_->Scan(function, debug_info.get())) {
+    return false;
+  }
+  if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmSource) {
+    DumpSource(function, &string_buffer_);
+    debug_info->set_source_disasm(string_buffer_.ToString());
+    string_buffer_.Reset();
+  }
+  if (!(debug_info_flags & (DebugInfoFlags::kDebugInfoDisasmRawHir |
+                            DebugInfoFlags::kDebugInfoDisasmHir))) {
+    function->set_debug_info(std::move(debug_info));
+    return true;
+  }
+
+  if (!builder_->Emit(function, PPCHIRBuilder::EMIT_DEBUG_COMMENTS)) {
     return false;
   }
+  if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
+    builder_->Dump(&string_buffer_);
+    debug_info->set_raw_hir_disasm(string_buffer_.ToString());
+    string_buffer_.Reset();
+  }
+  if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
+    // Same pipeline as the live code so the output matches what ran.
+    if (!SelectCompiler(function->tier())->Compile(builder_.get())) {
+      return false;
+    }
+    builder_->Dump(&string_buffer_);
+    debug_info->set_hir_disasm(string_buffer_.ToString());
+    string_buffer_.Reset();
+  }
 
+  function->set_debug_info(std::move(debug_info));
   return true;
 }
 
+Compiler* PPCTranslator::SelectCompiler(GuestFunction::Tier tier) {
+  if (tier == GuestFunction::Tier::kBaseline) {
+    return baseline_compiler_.get();
+  } else if (tier == GuestFunction::Tier::kHot && hot_compiler_) {
+    return hot_compiler_.get();
+  }
+  return compiler_.get();
+}
+
 void PPCTranslator::DumpSource(GuestFunction* function,
                                StringBuffer* string_buffer) {
   Memory* memory = frontend_->memory();
@@ -219,23 +422,26 @@ void PPCTranslator::DumpSource(GuestFunction* function,
 
   uint32_t start_address = function->address();
   uint32_t end_address = function->end_address();
+  PPCInstrReader reader(memory, function);
   InstrData i;
   auto block_it = blocks.begin();
   for (uint32_t address = start_address, offset = 0; address <= end_address;
        address += 4, offset++) {
-    i.address = address;
-    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
-    // TODO(benvanik): find a way to avoid using the opcode tables.
-    i.type = GetInstrType(i.code);
+    reader.Read(address, &i);
 
     // Check labels.
     if (block_it != blocks.end() && block_it->start_address == address) {
-      string_buffer->AppendFormat("%.8X          loc_%.8X:\n", address,
-                                  address);
+      string_buffer->AppendHex(address, 8);
+      string_buffer->Append("          loc_");
+      string_buffer->AppendHex(address, 8);
+      string_buffer->Append(":\n");
       ++block_it;
     }
 
-    string_buffer->AppendFormat("%.8X %.8X   ", address, i.code);
+    string_buffer->AppendHex(address, 8);
+    string_buffer->Append(' ');
+    string_buffer->AppendHex(i.code, 8);
+    string_buffer->Append("   ");
     DisasmPPC(&i, string_buffer);
     string_buffer->Append('\n');
   }
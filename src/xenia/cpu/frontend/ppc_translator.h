@@ -30,17 +30,49 @@ class PPCTranslator {
   explicit PPCTranslator(PPCFrontend* frontend);
   ~PPCTranslator();
 
-  bool Translate(GuestFunction* function, uint32_t debug_info_flags);
+  // Translates the function into machine code with the pass pipeline of the
+  // given tier. Code below the top enabled tier counts its calls so that it
+  // may later be retranslated at the next tier.
+  bool Translate(GuestFunction* function, uint32_t debug_info_flags,
+                 GuestFunction::Tier tier);
+
+  // Rebuilds the requested source and HIR disassembly of an already
+  // translated function from its guest code, replacing its debug info.
+  // Machine code is not regenerated. This lets disassembly be dropped after
+  // translation and recreated only when someone looks at it.
+  bool Disassemble(GuestFunction* function, uint32_t debug_info_flags);
+
+  // Number of calls before code of the given tier is recompiled, or 0 if it
+  // never is.
+  static uint32_t RecompileThreshold(GuestFunction::Tier tier);
+
+  // Adds the pass pipeline used to translate code of the given tier.
+  static void AddPasses(compiler::Compiler* compiler, backend::Backend* backend,
+                        GuestFunction::Tier tier);
+
+  // Times the HIR arena or compiler scratch structures had to grow since the
+  // translator was created. They are reused across functions so this only
+  // grows when a function is bigger than any seen before.
+  uint64_t scratch_growth_count() const;
 
  private:
+  compiler::Compiler* SelectCompiler(GuestFunction::Tier tier);
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
 
   PPCFrontend* frontend_;
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
+  // Only created with --hot_function_recompilation.
+  std::unique_ptr<compiler::Compiler> hot_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
+  compiler::CompileStats::StageId translate_stage_;
+  compiler::CompileStats::StageId scan_stage_;
+  compiler::CompileStats::StageId emit_stage_;
+  compiler::CompileStats::StageId assemble_stage_;
+
   StringBuffer string_buffer_;
 };
 
@@ -9,6 +9,7 @@
 
 #include <gflags/gflags.h>
 
+#include "xenia/base/clock.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/main.h"
@@ -28,6 +29,10 @@ DEFINE_string(test_path, "src/xenia/cpu/frontend/testing/",
               "Directory scanned for test files.");
 DEFINE_string(test_bin_path, "src/xenia/cpu/frontend/testing/bin/",
               "Directory with binary outputs of the test files.");
+DEFINE_int32(benchmark_iterations, 0,
+             "If nonzero, each passing test is run this many more times and "
+             "its guest instruction throughput and translation time are "
+             "reported.");
 
 namespace xe {
 namespace cpu {
@@ -224,12 +229,15 @@ class TestRunner {
       return false;
     }
 
-    // Execute test.
+    // Execute test. The first resolve translates the function.
+    uint64_t translate_start = Clock::QueryHostTickCount();
     auto fn = processor->ResolveFunction(test_case.address);
+    translation_ticks = Clock::QueryHostTickCount() - translate_start;
     if (!fn) {
       XELOGE("Entry function not found");
       return false;
     }
+    function = fn;
 
     auto ctx = thread_state->context();
     ctx->lr = 0xBCBCBCBC;
@@ -247,6 +255,29 @@ class TestRunner {
     return result;
   }
 
+  // Calls the function translated by Run the given number of times and
+  // returns the host ticks taken. Registers and memory are not reset between
+  // calls; tests are straight-line code, so each call executes the same
+  // instructions.
+  uint64_t Benchmark(int iterations) {
+    auto ctx = thread_state->context();
+    uint64_t start = Clock::QueryHostTickCount();
+    for (int i = 0; i < iterations; ++i) {
+      ctx->lr = 0xBCBCBCBC;
+      function->Call(thread_state.get(), uint32_t(ctx->lr));
+    }
+    return Clock::QueryHostTickCount() - start;
+  }
+
+  // Guest instructions executed per call of the function, counting the
+  // return.
+  uint32_t instruction_count() const {
+    if (!function->has_end_address()) {
+      return 0;
+    }
+    return (function->end_address() - function->address()) / 4 + 1;
+  }
+
   bool SetupTestState(TestCase& test_case) {
     auto ppc_context = thread_state->context();
     for (auto& it : test_case.annotations) {
@@ -333,6 +364,8 @@ class TestRunner {
   std::unique_ptr<Memory> memory;
   std::unique_ptr<Processor> processor;
   std::unique_ptr<ThreadState> thread_state;
+  Function* function = nullptr;
+  uint64_t translation_ticks = 0;
 };
 
 bool DiscoverTests(std::wstring& test_path,
@@ -355,6 +388,18 @@ int filter(unsigned int code) {
 }
 #endif  // XE_COMPILER_MSVC
 
+void ReportBenchmark(TestRunner& runner) {
+  double tick_frequency = double(Clock::host_tick_frequency());
+  uint64_t ticks = runner.Benchmark(FLAGS_benchmark_iterations);
+  double seconds = ticks / tick_frequency;
+  double instructions =
+      double(runner.instruction_count()) * FLAGS_benchmark_iterations;
+  XELOGI("    %.2f M guest instructions/s (%u per call), %.3f ms translation",
+         seconds > 0 ? instructions / seconds / 1000000.0 : 0.0,
+         runner.instruction_count(),
+         runner.translation_ticks * 1000.0 / tick_frequency);
+}
+
 void ProtectedRunTest(TestSuite& test_suite, TestRunner& runner,
                       TestCase& test_case, int& failed_count,
                       int& passed_count) {
@@ -368,6 +413,9 @@ void ProtectedRunTest(TestSuite& test_suite, TestRunner& runner,
     }
     if (runner.Run(test_case)) {
       ++passed_count;
+      if (FLAGS_benchmark_iterations > 0) {
+        ReportBenchmark(runner);
+      }
     } else {
       XELOGE("    TEST FAILED");
       ++failed_count;
@@ -9,7 +9,12 @@
 
 #include "xenia/cpu/function.h"
 
+#include <algorithm>
+#include <utility>
+
+#include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/math.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -18,6 +23,156 @@ namespace cpu {
 
 using xe::debug::Breakpoint;
 
+namespace {
+
+void AppendVarint(std::vector<uint8_t>* data, uint32_t value) {
+  while (value >= 0x80) {
+    data->push_back(uint8_t(value | 0x80));
+    value >>= 7;
+  }
+  data->push_back(uint8_t(value));
+}
+
+uint32_t ReadVarint(const uint8_t* data, size_t* offset) {
+  uint32_t value = 0;
+  for (uint32_t shift = 0;; shift += 7) {
+    uint8_t b = data[(*offset)++];
+    value |= uint32_t(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return value;
+    }
+  }
+}
+
+// Source and HIR offsets may move backwards; zigzag keeps small negative
+// deltas small.
+uint32_t ZigZagEncode(uint32_t delta) {
+  return (delta << 1) ^ uint32_t(int32_t(delta) >> 31);
+}
+
+uint32_t ZigZagDecode(uint32_t value) {
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+}  // namespace
+
+size_t SourceMap::memory_usage() const {
+  return checkpoints_.capacity() * sizeof(Checkpoint) + data_.capacity();
+}
+
+void SourceMap::Assign(const SourceMapEntry* entries, size_t count) {
+  count_ = count;
+  checkpoints_.clear();
+  data_.clear();
+  checkpoints_.reserve(xe::round_up(count, kCheckpointInterval) /
+                       kCheckpointInterval);
+  for (size_t i = 0; i < count; ++i) {
+    auto& entry = entries[i];
+    if (i % kCheckpointInterval == 0) {
+      checkpoints_.push_back({entry, uint32_t(data_.size())});
+    } else {
+      auto& prev = entries[i - 1];
+      assert_true(entry.code_offset >= prev.code_offset);
+      AppendVarint(&data_,
+                   ZigZagEncode(entry.source_offset - prev.source_offset));
+      AppendVarint(&data_, entry.code_offset - prev.code_offset);
+      AppendVarint(&data_, ZigZagEncode(entry.hir_offset - prev.hir_offset));
+    }
+  }
+  // Functions are compiled once and then live forever; don't hold slack.
+  checkpoints_.shrink_to_fit();
+  data_.shrink_to_fit();
+}
+
+void SourceMap::DecodeNext(size_t* data_offset, SourceMapEntry* entry) const {
+  entry->source_offset += ZigZagDecode(ReadVarint(data_.data(), data_offset));
+  entry->code_offset += ReadVarint(data_.data(), data_offset);
+  entry->hir_offset += ZigZagDecode(ReadVarint(data_.data(), data_offset));
+}
+
+std::vector<SourceMapEntry> SourceMap::Decode() const {
+  std::vector<SourceMapEntry> entries;
+  entries.reserve(count_);
+  size_t data_offset = 0;
+  SourceMapEntry entry;
+  for (size_t i = 0; i < count_; ++i) {
+    if (i % kCheckpointInterval == 0) {
+      entry = checkpoints_[i / kCheckpointInterval].entry;
+    } else {
+      DecodeNext(&data_offset, &entry);
+    }
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+bool SourceMap::LookupSourceOffset(uint32_t offset,
+                                   SourceMapEntry* out_entry) const {
+  size_t data_offset = 0;
+  SourceMapEntry entry;
+  for (size_t i = 0; i < count_; ++i) {
+    if (i % kCheckpointInterval == 0) {
+      entry = checkpoints_[i / kCheckpointInterval].entry;
+    } else {
+      DecodeNext(&data_offset, &entry);
+    }
+    if (entry.source_offset == offset) {
+      *out_entry = entry;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SourceMap::LookupHIROffset(uint32_t offset,
+                                SourceMapEntry* out_entry) const {
+  size_t data_offset = 0;
+  SourceMapEntry entry;
+  for (size_t i = 0; i < count_; ++i) {
+    if (i % kCheckpointInterval == 0) {
+      entry = checkpoints_[i / kCheckpointInterval].entry;
+    } else {
+      DecodeNext(&data_offset, &entry);
+    }
+    if (entry.hir_offset >= offset) {
+      *out_entry = entry;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SourceMap::LookupCodeOffset(uint32_t offset,
+                                 SourceMapEntry* out_entry) const {
+  if (!count_) {
+    return false;
+  }
+  // Last checkpoint at or before the offset. Code offsets never decrease so
+  // the entry we want is in its run.
+  auto it = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), offset,
+                             [](uint32_t code_offset, const Checkpoint& cp) {
+                               return code_offset < cp.entry.code_offset;
+                             });
+  if (it == checkpoints_.begin()) {
+    *out_entry = checkpoints_[0].entry;
+    return true;
+  }
+  --it;
+  size_t index = size_t(it - checkpoints_.begin()) * kCheckpointInterval;
+  size_t end_index = std::min(index + kCheckpointInterval, count_);
+  size_t data_offset = it->data_offset;
+  SourceMapEntry entry = it->entry;
+  *out_entry = entry;
+  for (++index; index < end_index; ++index) {
+    DecodeNext(&data_offset, &entry);
+    if (entry.code_offset > offset) {
+      break;
+    }
+    *out_entry = entry;
+  }
+  return true;
+}
+
 Function::Function(Module* module, uint32_t address)
     : Symbol(Symbol::Type::kFunction, module, address) {}
 
@@ -62,42 +217,51 @@ GuestFunction::GuestFunction(Module* module, uint32_t address)
 
 GuestFunction::~GuestFunction() = default;
 
-void GuestFunction::SetupExtern(ExternHandler handler) {
+void GuestFunction::SetupExtern(ExternHandler handler,
+                                ExternFastHandler fast_handler) {
   behavior_ = Behavior::kExtern;
   extern_handler_ = handler;
+  extern_fast_handler_ = fast_handler;
 }
 
-const SourceMapEntry* GuestFunction::LookupSourceOffset(uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.source_offset == offset) {
-      return &entry;
-    }
+void GuestFunction::CopyDeclaration(GuestFunction* other) {
+  name_ = other->name();
+  end_address_ = other->end_address();
+  behavior_ = other->behavior();
+  extern_handler_ = other->extern_handler();
+  extern_fast_handler_ = other->extern_fast_handler();
+  mmio_access_sites_ = other->mmio_access_sites();
+  if (!other->is_invalidated()) {
+    decoded_instrs_ = other->decoded_instrs();
   }
-  return nullptr;
 }
 
-const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.hir_offset >= offset) {
-      return &entry;
-    }
+bool GuestFunction::AddMMIOAccessSite(uint32_t guest_address) {
+  std::lock_guard<xe::mutex> guard(mmio_access_sites_lock_);
+  auto it = std::lower_bound(mmio_access_sites_.begin(),
+                             mmio_access_sites_.end(), guest_address);
+  if (it != mmio_access_sites_.end() && *it == guest_address) {
+    return false;
   }
-  return nullptr;
+  mmio_access_sites_.insert(it, guest_address);
+  return true;
 }
 
-const SourceMapEntry* GuestFunction::LookupCodeOffset(uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
-    if (entry.code_offset <= offset) {
-      return &entry;
-    }
-  }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+std::vector<uint32_t> GuestFunction::mmio_access_sites() {
+  std::lock_guard<xe::mutex> guard(mmio_access_sites_lock_);
+  return mmio_access_sites_;
+}
+
+std::shared_ptr<const frontend::InstrDataList>
+GuestFunction::decoded_instrs() {
+  std::lock_guard<xe::mutex> guard(decoded_instrs_lock_);
+  return decoded_instrs_;
+}
+
+void GuestFunction::set_decoded_instrs(
+    std::shared_ptr<const frontend::InstrDataList> value) {
+  std::lock_guard<xe::mutex> guard(decoded_instrs_lock_);
+  decoded_instrs_ = std::move(value);
 }
 
 bool GuestFunction::Call(ThreadState* thread_state, uint32_t return_address) {
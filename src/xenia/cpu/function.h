@@ -10,12 +10,14 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/debug_info.h"
 #include "xenia/cpu/frontend/ppc_context.h"
+#include "xenia/cpu/frontend/ppc_instr.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
 #include "xenia/debug/breakpoint.h"
@@ -30,6 +32,50 @@ struct SourceMapEntry {
   uint32_t code_offset;    // Offset from emitted code start.
 };
 
+// Source map of a function, ordered by code offset.
+// Entries are delta encoded against the previous one as varints, which takes
+// a few bytes per entry instead of 12. Every kCheckpointInterval-th entry is
+// kept whole so that lookups by code offset binary search the checkpoints and
+// decode only a short run.
+class SourceMap {
+ public:
+  static const size_t kCheckpointInterval = 32;
+
+  bool empty() const { return count_ == 0; }
+  size_t size() const { return count_; }
+  // Heap memory held by the encoded entries.
+  size_t memory_usage() const;
+
+  // Replaces all entries. They must be sorted by code offset.
+  void Assign(const SourceMapEntry* entries, size_t count);
+  void Assign(const std::vector<SourceMapEntry>& entries) {
+    Assign(entries.data(), entries.size());
+  }
+  std::vector<SourceMapEntry> Decode() const;
+
+  // Finds the first entry with the given guest source offset.
+  bool LookupSourceOffset(uint32_t offset, SourceMapEntry* out_entry) const;
+  // Finds the first entry at or after the given HIR offset.
+  bool LookupHIROffset(uint32_t offset, SourceMapEntry* out_entry) const;
+  // Finds the last entry at or before the given code offset, falling back to
+  // the first entry.
+  bool LookupCodeOffset(uint32_t offset, SourceMapEntry* out_entry) const;
+
+ private:
+  struct Checkpoint {
+    SourceMapEntry entry;
+    // Offset in data_ of the entry following this one.
+    uint32_t data_offset;
+  };
+
+  // Decodes the entry at data_[*data_offset] relative to entry.
+  void DecodeNext(size_t* data_offset, SourceMapEntry* entry) const;
+
+  size_t count_ = 0;
+  std::vector<Checkpoint> checkpoints_;
+  std::vector<uint8_t> data_;
+};
+
 class Function : public Symbol {
  public:
   enum class Behavior {
@@ -51,6 +97,21 @@ class Function : public Symbol {
   void set_behavior(Behavior value) { behavior_ = value; }
   bool is_guest() const { return behavior_ != Behavior::kBuiltin; }
 
+  // Set once a recompile of this function has been published in its place
+  // by Module::ReplaceFunction. The function and its code stay valid as
+  // threads may still be running it.
+  Function* replacement() const {
+    return replacement_.load(std::memory_order_acquire);
+  }
+  // Follows replacements to the function currently published.
+  Function* current() {
+    Function* function = this;
+    while (Function* next = function->replacement()) {
+      function = next;
+    }
+    return function;
+  }
+
   virtual bool Call(ThreadState* thread_state, uint32_t return_address) = 0;
 
  protected:
@@ -58,6 +119,9 @@ class Function : public Symbol {
 
   uint32_t end_address_ = 0;
   Behavior behavior_ = Behavior::kDefault;
+  std::atomic<Function*> replacement_ = {nullptr};
+
+  friend class Module;
 };
 
 class BuiltinFunction : public Function {
@@ -86,6 +150,11 @@ class GuestFunction : public Function {
  public:
   typedef void (*ExternHandler)(frontend::PPCContext* ppc_context,
                                 kernel::KernelState* kernel_state);
+  // Called directly from generated code with r3-r5 in host registers. See
+  // ExportTag::kFastCall.
+  typedef void (*ExternFastHandler)(frontend::PPCContext* ppc_context,
+                                    uint64_t arg0, uint64_t arg1,
+                                    uint64_t arg2);
 
   GuestFunction(Module* module, uint32_t address);
   ~GuestFunction() override;
@@ -103,14 +172,69 @@ class GuestFunction : public Function {
     debug_info_ = std::move(debug_info);
   }
   debug::FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
+  SourceMap& source_map() { return source_map_; }
 
   ExternHandler extern_handler() const { return extern_handler_; }
-  void SetupExtern(ExternHandler handler);
+  ExternFastHandler extern_fast_handler() const {
+    return extern_fast_handler_;
+  }
+  void SetupExtern(ExternHandler handler,
+                   ExternFastHandler fast_handler = nullptr);
+
+  // Copies everything known about the function before translation (name,
+  // extent, behavior, extern handlers and MMIO access sites) from the
+  // function this one is a recompile of.
+  void CopyDeclaration(GuestFunction* other);
+
+  // Pass pipeline the current machine code was translated with.
+  // Baseline code uses a minimal pipeline and hot code an aggressive one.
+  enum class Tier {
+    kBaseline,
+    kOptimized,
+    kHot,
+  };
+  Tier tier() const { return tier_; }
+  void set_tier(Tier value) { tier_ = value; }
+  bool is_baseline() const { return tier_ == Tier::kBaseline; }
+
+  // Code below the top enabled tier counts its calls and requests a
+  // recompile once the count reaches the threshold. A threshold of 0 means
+  // the code is final and emits no counter.
+  uint32_t recompile_threshold() const { return recompile_threshold_; }
+  void set_recompile_threshold(uint32_t value) {
+    recompile_threshold_ = value;
+    call_count_ = 0;
+  }
+  uint32_t call_count() const { return call_count_; }
+  uint32_t* call_count_address() { return &call_count_; }
 
-  const SourceMapEntry* LookupSourceOffset(uint32_t offset) const;
-  const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
-  const SourceMapEntry* LookupCodeOffset(uint32_t offset) const;
+  // Guest addresses of load/store instructions that have faulted on MMIO
+  // ranges. Translation emits checked accesses at these sites instead.
+  // Returns true if the site was not yet known.
+  bool AddMMIOAccessSite(uint32_t guest_address);
+  std::vector<uint32_t> mmio_access_sites();
+
+  // Instructions from address() to end_address() as decoded by the scanner.
+  // Shared by scanning, translation and disassembly so that each word is
+  // only fetched and looked up in the opcode tables once. Null until the
+  // function has been scanned and again once it has been invalidated.
+  std::shared_ptr<const frontend::InstrDataList> decoded_instrs();
+  void set_decoded_instrs(std::shared_ptr<const frontend::InstrDataList> value);
+
+  // Set when the guest code of the function has been written to since it
+  // was translated. The function is retranslated on its next resolve.
+  bool is_invalidated() const { return invalidated_; }
+  void set_invalidated(bool value) { invalidated_ = value; }
+
+  bool LookupSourceOffset(uint32_t offset, SourceMapEntry* out_entry) const {
+    return source_map_.LookupSourceOffset(offset, out_entry);
+  }
+  bool LookupHIROffset(uint32_t offset, SourceMapEntry* out_entry) const {
+    return source_map_.LookupHIROffset(offset, out_entry);
+  }
+  bool LookupCodeOffset(uint32_t offset, SourceMapEntry* out_entry) const {
+    return source_map_.LookupCodeOffset(offset, out_entry);
+  }
 
   bool Call(ThreadState* thread_state, uint32_t return_address) override;
 
@@ -120,8 +244,19 @@ class GuestFunction : public Function {
  protected:
   std::unique_ptr<DebugInfo> debug_info_;
   debug::FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
+  SourceMap source_map_;
   ExternHandler extern_handler_ = nullptr;
+  ExternFastHandler extern_fast_handler_ = nullptr;
+  Tier tier_ = Tier::kOptimized;
+  uint32_t recompile_threshold_ = 0;
+  uint32_t call_count_ = 0;
+  std::atomic<bool> invalidated_ = {false};
+  // Sorted. Appended to from the fault handler on any guest thread.
+  xe::mutex mmio_access_sites_lock_;
+  std::vector<uint32_t> mmio_access_sites_;
+  // Replaced by translation while other threads may be disassembling.
+  xe::mutex decoded_instrs_lock_;
+  std::shared_ptr<const frontend::InstrDataList> decoded_instrs_;
 };
 
 }  // namespace cpu
@@ -110,16 +110,16 @@ void HIRBuilder::DumpValue(StringBuffer* str, Value* value) {
   if (value->IsConstant()) {
     switch (value->type) {
       case INT8_TYPE:
-        str->AppendFormat("%X", value->constant.i8);
+        str->AppendHex(uint32_t(value->constant.i8));
         break;
       case INT16_TYPE:
-        str->AppendFormat("%X", value->constant.i16);
+        str->AppendHex(uint32_t(value->constant.i16));
         break;
       case INT32_TYPE:
-        str->AppendFormat("%X", value->constant.i32);
+        str->AppendHex(uint32_t(value->constant.i32));
         break;
       case INT64_TYPE:
-        str->AppendFormat("%" PRIX64, value->constant.i64);
+        str->AppendHex(uint64_t(value->constant.i64));
         break;
       case FLOAT32_TYPE:
         str->AppendFormat("%F", value->constant.f32);
@@ -140,10 +140,16 @@ void HIRBuilder::DumpValue(StringBuffer* str, Value* value) {
     static const char* type_names[] = {
         "i8", "i16", "i32", "i64", "f32", "f64", "v128",
     };
-    str->AppendFormat("v%d.%s", value->ordinal, type_names[value->type]);
+    str->Append('v');
+    str->AppendDecimal(value->ordinal);
+    str->Append('.');
+    str->Append(type_names[value->type]);
   }
   if (value->reg.index != -1) {
-    str->AppendFormat("<%s%d>", value->reg.set->name, value->reg.index);
+    str->Append('<');
+    str->Append(value->reg.set->name);
+    str->AppendDecimal(value->reg.index);
+    str->Append('>');
   }
 }
 
@@ -156,7 +162,8 @@ void HIRBuilder::DumpOp(StringBuffer* str, OpcodeSignatureType sig_type,
       if (op->label->name) {
         str->Append(op->label->name);
       } else {
-        str->AppendFormat("label%d", op->label->id);
+        str->Append("label");
+        str->AppendDecimal(op->label->id);
       }
       break;
     case OPCODE_SIG_TYPE_O:
@@ -260,7 +267,9 @@ void HIRBuilder::Dump(StringBuffer* str) {
         str->Append(" = ");
       }
       if (i->flags) {
-        str->AppendFormat("%s.%d", info->name, i->flags);
+        str->Append(info->name);
+        str->Append('.');
+        str->AppendDecimal(i->flags);
       } else {
         str->Append(info->name);
       }
@@ -349,6 +358,403 @@ void HIRBuilder::MarkLabel(Label* label, Block* block) {
   }
 }
 
+void HIRBuilder::CloneInstrsBefore(Instr* first, Instr* last,
+                                   Instr* insert_before) {
+  auto map_value = [this](Value* source) {
+    if (source->IsConstant()) {
+      return CloneValue(source);
+    }
+    assert_not_null(source->tag);
+    return reinterpret_cast<Value*>(source->tag);
+  };
+  auto clone_op = [&](OpcodeSignatureType sig_type, const Instr::Op& op,
+                      Instr* instr, void (Instr::*set_src)(Value*),
+                      Instr::Op* out_op) {
+    switch (sig_type) {
+      case OPCODE_SIG_TYPE_V:
+        (instr->*set_src)(map_value(op.value));
+        break;
+      case OPCODE_SIG_TYPE_L:
+        assert_always("Labels cannot be cloned");
+        break;
+      default:
+        *out_op = op;
+        break;
+    }
+  };
+
+  Block* block = insert_before->block;
+  for (Instr* source = first; source; source = source->next) {
+    Instr* instr = arena_->Alloc<Instr>();
+    instr->block = block;
+    instr->next = insert_before;
+    instr->prev = insert_before->prev;
+    if (instr->prev) {
+      instr->prev->next = instr;
+    } else {
+      block->instr_head = instr;
+    }
+    insert_before->prev = instr;
+    instr->ordinal = UINT32_MAX;
+    instr->opcode = source->opcode;
+    instr->flags = source->flags;
+    instr->dest = nullptr;
+    instr->src1.value = instr->src2.value = instr->src3.value = nullptr;
+    instr->src1_use = instr->src2_use = instr->src3_use = nullptr;
+
+    uint32_t signature = source->opcode->signature;
+    if (source->dest) {
+      Value* dest = AllocValue(source->dest->type);
+      dest->def = instr;
+      instr->dest = dest;
+      source->dest->tag = dest;
+    }
+    clone_op(GET_OPCODE_SIG_TYPE_SRC1(signature), source->src1, instr,
+             &Instr::set_src1, &instr->src1);
+    clone_op(GET_OPCODE_SIG_TYPE_SRC2(signature), source->src2, instr,
+             &Instr::set_src2, &instr->src2);
+    clone_op(GET_OPCODE_SIG_TYPE_SRC3(signature), source->src3, instr,
+             &Instr::set_src3, &instr->src3);
+
+    if (source == last) {
+      break;
+    }
+  }
+}
+
+namespace {
+
+// Bumped whenever the serialized form or the opcode numbering changes.
+const uint32_t kSerializedHIRVersion = 1;
+
+enum SerializedValueKind : uint8_t {
+  kSerializedValueNone,
+  kSerializedValueConstant,
+  kSerializedValueDefined,
+};
+
+class SerializedWriter {
+ public:
+  explicit SerializedWriter(std::vector<uint8_t>* data) : data_(data) {}
+
+  size_t offset() const { return data_->size(); }
+
+  void Write(const void* p, size_t size) {
+    auto bytes = reinterpret_cast<const uint8_t*>(p);
+    data_->insert(data_->end(), bytes, bytes + size);
+  }
+  template <typename T>
+  void Write(T value) {
+    Write(&value, sizeof(value));
+  }
+  // Replaces a count written before its items were.
+  void Patch(size_t offset, uint32_t value) {
+    std::memcpy(data_->data() + offset, &value, sizeof(value));
+  }
+  void WriteString(const char* value) {
+    uint32_t length = value ? uint32_t(std::strlen(value)) : 0;
+    Write(length);
+    Write(value, length);
+  }
+  void WriteValue(const Value* value) {
+    if (!value) {
+      Write(kSerializedValueNone);
+    } else if (value->IsConstant()) {
+      Write(kSerializedValueConstant);
+      Write(uint8_t(value->type));
+      Write(value->constant.v128);
+    } else {
+      Write(kSerializedValueDefined);
+      Write(uint8_t(value->type));
+      Write(value->ordinal);
+    }
+  }
+
+ private:
+  std::vector<uint8_t>* data_;
+};
+
+class SerializedReader {
+ public:
+  SerializedReader(const uint8_t* data, size_t size)
+      : ptr_(data), end_(data + size) {}
+
+  bool ok() const { return ok_; }
+  void Fail() { ok_ = false; }
+
+  bool Read(void* out, size_t size) {
+    if (!ok_ || size_t(end_ - ptr_) < size) {
+      ok_ = false;
+      std::memset(out, 0, size);
+      return false;
+    }
+    std::memcpy(out, ptr_, size);
+    ptr_ += size;
+    return true;
+  }
+  template <typename T>
+  T Read() {
+    T value;
+    Read(&value, sizeof(value));
+    return value;
+  }
+  // Returns a pointer into the data, valid as long as it is.
+  const char* ReadString(uint32_t* out_length) {
+    *out_length = Read<uint32_t>();
+    if (!ok_ || size_t(end_ - ptr_) < *out_length) {
+      ok_ = false;
+      return nullptr;
+    }
+    auto value = reinterpret_cast<const char*>(ptr_);
+    ptr_ += *out_length;
+    return value;
+  }
+
+ private:
+  const uint8_t* ptr_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+const OpcodeInfo* LookupOpcodeInfo(uint16_t num) {
+  static const std::vector<const OpcodeInfo*> opcode_infos = []() {
+    std::vector<const OpcodeInfo*> infos(__OPCODE_MAX_VALUE, nullptr);
+#define DEFINE_OPCODE(num, name, sig, flags) infos[num] = &num##_info;
+#include "xenia/cpu/hir/opcodes.inl"
+#undef DEFINE_OPCODE
+    return infos;
+  }();
+  return num < opcode_infos.size() ? opcode_infos[num] : nullptr;
+}
+
+}  // namespace
+
+void HIRBuilder::Serialize(std::vector<uint8_t>* out_data) {
+  SerializedWriter writer(out_data);
+  writer.Write(kSerializedHIRVersion);
+  writer.Write(attributes_);
+  writer.Write(next_value_ordinal_);
+
+  // Labels by id, so that names survive for dumps.
+  std::vector<const Label*> labels(next_label_id_, nullptr);
+  uint32_t block_count = 0;
+  for (auto block = block_head_; block; block = block->next) {
+    for (auto label = block->label_head; label; label = label->next) {
+      labels[label->id] = label;
+    }
+    ++block_count;
+  }
+  writer.Write(next_label_id_);
+  for (auto label : labels) {
+    writer.WriteString(label ? label->name : nullptr);
+  }
+
+  writer.Write(uint32_t(locals_.size()));
+  for (auto local : locals_) {
+    writer.WriteValue(local);
+  }
+
+  auto write_op = [&writer](const Instr* instr, OpcodeSignatureType sig_type,
+                            const Instr::Op& op) {
+    switch (sig_type) {
+      case OPCODE_SIG_TYPE_X:
+        break;
+      case OPCODE_SIG_TYPE_L:
+        writer.Write(op.label->id);
+        break;
+      case OPCODE_SIG_TYPE_O:
+        if (instr->opcode == &OPCODE_COMMENT_info) {
+          writer.WriteString(reinterpret_cast<const char*>(op.offset));
+        } else {
+          // MMIO range pointers are written too but ignored when read.
+          writer.Write(op.offset);
+        }
+        break;
+      case OPCODE_SIG_TYPE_S:
+        writer.Write(op.symbol->address());
+        break;
+      case OPCODE_SIG_TYPE_V:
+        writer.WriteValue(op.value);
+        break;
+    }
+  };
+
+  writer.Write(block_count);
+  for (auto block = block_head_; block; block = block->next) {
+    size_t label_count_offset = writer.offset();
+    uint32_t label_count = 0;
+    writer.Write(label_count);
+    for (auto label = block->label_head; label; label = label->next) {
+      writer.Write(label->id);
+      ++label_count;
+    }
+    writer.Patch(label_count_offset, label_count);
+
+    size_t instr_count_offset = writer.offset();
+    uint32_t instr_count = 0;
+    writer.Write(instr_count);
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      uint32_t signature = instr->opcode->signature;
+      writer.Write(uint16_t(instr->opcode->num));
+      writer.Write(instr->flags);
+      writer.WriteValue(instr->dest);
+      write_op(instr, GET_OPCODE_SIG_TYPE_SRC1(signature), instr->src1);
+      write_op(instr, GET_OPCODE_SIG_TYPE_SRC2(signature), instr->src2);
+      write_op(instr, GET_OPCODE_SIG_TYPE_SRC3(signature), instr->src3);
+      ++instr_count;
+    }
+    writer.Patch(instr_count_offset, instr_count);
+  }
+}
+
+bool HIRBuilder::Deserialize(
+    const uint8_t* data, size_t data_size,
+    std::function<Function*(uint32_t)> resolve_function,
+    std::function<MMIORange*(uint32_t)> resolve_mmio_range) {
+  Reset();
+  SerializedReader reader(data, data_size);
+  if (reader.Read<uint32_t>() != kSerializedHIRVersion) {
+    return false;
+  }
+  attributes_ = reader.Read<uint32_t>();
+
+  // Values are created on first reference as they may be used in blocks
+  // placed before the one defining them.
+  std::vector<Value*> values(reader.Read<uint32_t>(), nullptr);
+  auto read_value = [&]() -> Value* {
+    auto kind = reader.Read<SerializedValueKind>();
+    if (kind == kSerializedValueNone) {
+      return nullptr;
+    }
+    auto type = TypeName(reader.Read<uint8_t>());
+    if (type >= MAX_TYPENAME) {
+      reader.Fail();
+      return nullptr;
+    }
+    if (kind == kSerializedValueConstant) {
+      Value* value = AllocValue(type);
+      value->flags |= VALUE_IS_CONSTANT;
+      reader.Read(&value->constant.v128, sizeof(vec128_t));
+      return value;
+    }
+    uint32_t ordinal = reader.Read<uint32_t>();
+    if (kind != kSerializedValueDefined || ordinal >= values.size()) {
+      reader.Fail();
+      return nullptr;
+    }
+    if (!values[ordinal]) {
+      values[ordinal] = AllocValue(type);
+    }
+    return values[ordinal];
+  };
+
+  std::vector<Label*> labels(reader.Read<uint32_t>());
+  for (auto& label : labels) {
+    label = NewLabel();
+    uint32_t name_length;
+    const char* name = reader.ReadString(&name_length);
+    if (name_length) {
+      label->name = reinterpret_cast<char*>(arena_->Alloc(name_length + 1));
+      std::memcpy(label->name, name, name_length);
+      label->name[name_length] = 0;
+    }
+  }
+
+  uint32_t local_count = reader.Read<uint32_t>();
+  for (uint32_t i = 0; i < local_count && reader.ok(); ++i) {
+    locals_.push_back(read_value());
+  }
+
+  auto read_op = [&](Instr* instr, OpcodeSignatureType sig_type,
+                     void (Instr::*set_src)(Value*), Instr::Op* out_op) {
+    switch (sig_type) {
+      case OPCODE_SIG_TYPE_X:
+        break;
+      case OPCODE_SIG_TYPE_L: {
+        uint32_t id = reader.Read<uint32_t>();
+        if (id >= labels.size()) {
+          reader.Fail();
+          break;
+        }
+        out_op->label = labels[id];
+      } break;
+      case OPCODE_SIG_TYPE_O:
+        if (instr->opcode == &OPCODE_COMMENT_info) {
+          uint32_t length;
+          const char* text = reader.ReadString(&length);
+          auto p = reinterpret_cast<char*>(arena_->Alloc(length + 1));
+          std::memcpy(p, text, length);
+          p[length] = 0;
+          out_op->offset = reinterpret_cast<uint64_t>(p);
+        } else {
+          out_op->offset = reader.Read<uint64_t>();
+        }
+        break;
+      case OPCODE_SIG_TYPE_S:
+        out_op->symbol = resolve_function(reader.Read<uint32_t>());
+        if (!out_op->symbol) {
+          reader.Fail();
+        }
+        break;
+      case OPCODE_SIG_TYPE_V:
+        (instr->*set_src)(read_value());
+        break;
+    }
+  };
+
+  uint32_t block_count = reader.Read<uint32_t>();
+  for (uint32_t i = 0; i < block_count && reader.ok(); ++i) {
+    Block* block = AppendBlock();
+    uint32_t label_count = reader.Read<uint32_t>();
+    for (uint32_t j = 0; j < label_count && reader.ok(); ++j) {
+      uint32_t id = reader.Read<uint32_t>();
+      if (id >= labels.size()) {
+        reader.Fail();
+        break;
+      }
+      MarkLabel(labels[id], block);
+    }
+    uint32_t instr_count = reader.Read<uint32_t>();
+    for (uint32_t j = 0; j < instr_count && reader.ok(); ++j) {
+      auto opcode_info = LookupOpcodeInfo(reader.Read<uint16_t>());
+      uint16_t flags = reader.Read<uint16_t>();
+      if (!opcode_info) {
+        reader.Fail();
+        break;
+      }
+      Value* dest = read_value();
+      if (dest && dest->IsConstant()) {
+        reader.Fail();
+        break;
+      }
+      Instr* instr = AppendInstr(*opcode_info, flags, dest);
+      uint32_t signature = opcode_info->signature;
+      read_op(instr, GET_OPCODE_SIG_TYPE_SRC1(signature), &Instr::set_src1,
+              &instr->src1);
+      read_op(instr, GET_OPCODE_SIG_TYPE_SRC2(signature), &Instr::set_src2,
+              &instr->src2);
+      read_op(instr, GET_OPCODE_SIG_TYPE_SRC3(signature), &Instr::set_src3,
+              &instr->src3);
+      if (opcode_info == &OPCODE_LOAD_MMIO_info ||
+          opcode_info == &OPCODE_STORE_MMIO_info) {
+        auto mmio_range = resolve_mmio_range(uint32_t(instr->src2.offset));
+        if (!mmio_range) {
+          reader.Fail();
+          break;
+        }
+        instr->src1.offset = reinterpret_cast<uint64_t>(mmio_range);
+      }
+    }
+  }
+  current_block_ = nullptr;
+
+  if (!reader.ok()) {
+    Reset();
+    return false;
+  }
+  return true;
+}
+
 void HIRBuilder::InsertLabel(Label* label, Instr* prev_instr) {
   // If we are adding to the end just use the normal path.
   if (prev_instr == last_instr()) {
@@ -1263,7 +1669,16 @@ void HIRBuilder::Prefetch(Value* address, size_t length,
   i->src3.value = NULL;
 }
 
-void HIRBuilder::MemoryBarrier() { AppendInstr(OPCODE_MEMORY_BARRIER_info, 0); }
+void HIRBuilder::MemoryBarrier(uint32_t barrier_type) {
+  AppendInstr(OPCODE_MEMORY_BARRIER_info, barrier_type);
+}
+
+void HIRBuilder::SetRoundingMode(Value* value) {
+  ASSERT_INTEGER_TYPE(value);
+  Instr* i = AppendInstr(OPCODE_SET_ROUNDING_MODE_info, 0);
+  i->set_src1(value);
+  i->src2.value = i->src3.value = NULL;
+}
 
 Value* HIRBuilder::Max(Value* value1, Value* value2) {
   ASSERT_TYPES_EQUAL(value1, value2);
@@ -2070,6 +2485,19 @@ Value* HIRBuilder::AtomicExchange(Value* address, Value* new_value) {
   return i->dest;
 }
 
+Value* HIRBuilder::AtomicCompareExchange(Value* address, Value* old_value,
+                                         Value* new_value) {
+  ASSERT_ADDRESS_TYPE(address);
+  ASSERT_INTEGER_TYPE(old_value);
+  ASSERT_TYPES_EQUAL(old_value, new_value);
+  Instr* i = AppendInstr(OPCODE_ATOMIC_COMPARE_EXCHANGE_info, 0,
+                         AllocValue(INT8_TYPE));
+  i->set_src1(address);
+  i->set_src2(old_value);
+  i->set_src3(new_value);
+  return i->dest;
+}
+
 }  // namespace hir
 }  // namespace cpu
 }  // namespace xe
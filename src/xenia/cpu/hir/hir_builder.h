@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_HIR_HIR_BUILDER_H_
 #define XENIA_CPU_HIR_HIR_BUILDER_H_
 
+#include <functional>
 #include <vector>
 
 #include "xenia/base/arena.h"
@@ -65,6 +66,23 @@ class HIRBuilder {
   void RemoveBlock(Block* block);
   void MergeAdjacentBlocks(Block* left, Block* right);
 
+  // Clones the instructions [first, last] from another builder into this one
+  // immediately before insert_before. The source range must be
+  // self-contained: every non-constant value it uses must be defined within
+  // it and it must not reference labels. Source value tags are clobbered.
+  void CloneInstrsBefore(Instr* first, Instr* last, Instr* insert_before);
+
+  // Appends the HIR to out_data in a self-contained form that Deserialize
+  // reads back, so that translations can be replayed without the guest.
+  // Symbols are stored by guest address. CFG edges and register assignments
+  // are not stored, so this is meant for HIR that hasn't been through passes.
+  void Serialize(std::vector<uint8_t>* out_data);
+  // Replaces the contents of the builder with serialized HIR. MMIO ranges
+  // can't be stored and are looked up again by the address accessed.
+  bool Deserialize(const uint8_t* data, size_t data_size,
+                   std::function<Function*(uint32_t)> resolve_function,
+                   std::function<MMIORange*(uint32_t)> resolve_mmio_range);
+
   // static allocations:
   // Value* AllocStatic(size_t length);
 
@@ -150,7 +168,10 @@ class HIRBuilder {
   void Store(Value* address, Value* value, uint32_t store_flags = 0);
   void Memset(Value* address, Value* value, Value* length);
   void Prefetch(Value* address, size_t length, uint32_t prefetch_flags = 0);
-  void MemoryBarrier();
+  void MemoryBarrier(uint32_t barrier_type = MEMORY_BARRIER_FULL);
+  // Sets the host floating-point mode from guest FPSCR bits: RN in bits 0-1
+  // and NI in bit 2.
+  void SetRoundingMode(Value* value);
 
   Value* Max(Value* value1, Value* value2);
   Value* VectorMax(Value* value1, Value* value2, TypeName part_type,
@@ -235,6 +256,10 @@ class HIRBuilder {
   Value* Unpack(Value* value, uint32_t pack_flags = 0);
 
   Value* AtomicExchange(Value* address, Value* new_value);
+  // Stores new_value to the guest address if it holds old_value, returning
+  // whether it did.
+  Value* AtomicCompareExchange(Value* address, Value* old_value,
+                               Value* new_value);
   Value* AtomicAdd(Value* address, Value* value);
   Value* AtomicSub(Value* address, Value* value);
 
@@ -36,6 +36,8 @@ enum RoundMode {
 
 enum LoadStoreFlags {
   LOAD_STORE_BYTE_SWAP = 1 << 0,
+  // The address has been seen in an MMIO range; check before accessing.
+  LOAD_STORE_CHECK_MMIO = 1 << 1,
 };
 
 enum PrefetchFlags {
@@ -43,6 +45,15 @@ enum PrefetchFlags {
   PREFETCH_STORE = (1 << 2),
 };
 
+enum MemoryBarrierType {
+  // Orders everything, including stores against later loads (sync).
+  MEMORY_BARRIER_FULL = 0,
+  // Orders all but stores against later loads (lwsync).
+  MEMORY_BARRIER_LIGHTWEIGHT = 1,
+  // Orders stores against stores and I/O accesses (eieio).
+  MEMORY_BARRIER_STORE = 2,
+};
+
 enum ArithmeticFlags {
   ARITHMETIC_UNSIGNED = (1 << 2),
   ARITHMETIC_SATURATE = (1 << 3),
@@ -219,6 +230,8 @@ enum Opcode {
   OPCODE_PACK,
   OPCODE_UNPACK,
   OPCODE_ATOMIC_EXCHANGE,
+  OPCODE_ATOMIC_COMPARE_EXCHANGE,
+  OPCODE_SET_ROUNDING_MODE,
   __OPCODE_MAX_VALUE,  // Keep at end.
 };
 
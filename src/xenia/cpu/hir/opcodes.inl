@@ -625,3 +625,15 @@ DEFINE_OPCODE(
     "atomic_exchange",
     OPCODE_SIG_V_V_V,
     OPCODE_FLAG_VOLATILE)
+
+DEFINE_OPCODE(
+    OPCODE_ATOMIC_COMPARE_EXCHANGE,
+    "atomic_compare_exchange",
+    OPCODE_SIG_V_V_V_V,
+    OPCODE_FLAG_MEMORY | OPCODE_FLAG_VOLATILE)
+
+DEFINE_OPCODE(
+    OPCODE_SET_ROUNDING_MODE,
+    "set_rounding_mode",
+    OPCODE_SIG_X_V,
+    OPCODE_FLAG_VOLATILE)
@@ -684,6 +684,257 @@ void Value::CountLeadingZeros(const Value* other) {
   }
 }
 
+void Value::RotateLeft(Value* other) {
+  assert_true(other->type == INT8_TYPE);
+  // Counts wrap at the type size, as with x86 rol.
+  uint8_t sh = uint8_t(other->constant.i8) & uint8_t(GetTypeSize(type) * 8 - 1);
+  if (!sh) {
+    return;
+  }
+  switch (type) {
+    case INT8_TYPE:
+      constant.i8 = xe::rotate_left<uint8_t>(constant.i8, sh);
+      break;
+    case INT16_TYPE:
+      constant.i16 = xe::rotate_left<uint16_t>(constant.i16, sh);
+      break;
+    case INT32_TYPE:
+      constant.i32 = xe::rotate_left<uint32_t>(constant.i32, sh);
+      break;
+    case INT64_TYPE:
+      constant.i64 = xe::rotate_left<uint64_t>(constant.i64, sh);
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
+namespace {
+// Guest element accessors (see vec128.h for the layout).
+uint8_t& VecU8(vec128_t& v, uint32_t n) { return v.u8[n ^ 0x3]; }
+uint16_t& VecU16(vec128_t& v, uint32_t n) { return v.u16[n ^ 0x1]; }
+}  // namespace
+
+void Value::VectorCompare(Opcode opcode, Value* other, TypeName part_type) {
+  assert_true(type == VEC128_TYPE && other->type == VEC128_TYPE);
+  auto& a = constant.v128;
+  auto& b = other->constant.v128;
+  vec128_t result;
+  // Elementwise, so the byte order within the vector doesn't matter here.
+#define COMPARE_ELEMENTS(count, member, stype, utype)                    \
+  for (int n = 0; n < count; ++n) {                                      \
+    bool value = false;                                                  \
+    switch (opcode) {                                                    \
+      case OPCODE_VECTOR_COMPARE_EQ:                                     \
+        value = a.member[n] == b.member[n];                              \
+        break;                                                           \
+      case OPCODE_VECTOR_COMPARE_SGT:                                    \
+        value = stype(a.member[n]) > stype(b.member[n]);                 \
+        break;                                                           \
+      case OPCODE_VECTOR_COMPARE_SGE:                                    \
+        value = stype(a.member[n]) >= stype(b.member[n]);                \
+        break;                                                           \
+      case OPCODE_VECTOR_COMPARE_UGT:                                    \
+        value = utype(a.member[n]) > utype(b.member[n]);                 \
+        break;                                                           \
+      case OPCODE_VECTOR_COMPARE_UGE:                                    \
+        value = utype(a.member[n]) >= utype(b.member[n]);                \
+        break;                                                           \
+      default:                                                           \
+        assert_unhandled_case(opcode);                                   \
+        break;                                                           \
+    }                                                                    \
+    result.member[n] = value ? utype(~utype(0)) : utype(0);              \
+  }
+  switch (part_type) {
+    case INT8_TYPE:
+      COMPARE_ELEMENTS(16, u8, int8_t, uint8_t);
+      break;
+    case INT16_TYPE:
+      COMPARE_ELEMENTS(8, u16, int16_t, uint16_t);
+      break;
+    case INT32_TYPE:
+      COMPARE_ELEMENTS(4, u32, int32_t, uint32_t);
+      break;
+    case FLOAT32_TYPE:
+      for (int n = 0; n < 4; ++n) {
+        bool value = false;
+        switch (opcode) {
+          case OPCODE_VECTOR_COMPARE_EQ:
+            value = a.f32[n] == b.f32[n];
+            break;
+          case OPCODE_VECTOR_COMPARE_SGT:
+          case OPCODE_VECTOR_COMPARE_UGT:
+            value = a.f32[n] > b.f32[n];
+            break;
+          case OPCODE_VECTOR_COMPARE_SGE:
+          case OPCODE_VECTOR_COMPARE_UGE:
+            value = a.f32[n] >= b.f32[n];
+            break;
+          default:
+            assert_unhandled_case(opcode);
+            break;
+        }
+        result.u32[n] = value ? 0xFFFFFFFF : 0;
+      }
+      break;
+    default:
+      assert_unhandled_case(part_type);
+      return;
+  }
+#undef COMPARE_ELEMENTS
+  a = result;
+}
+
+// Shift amounts are taken modulo the element size, as in Altivec.
+#define SHIFT_ELEMENTS(part_type, op, s8, s16, s32)              \
+  switch (part_type) {                                           \
+    case INT8_TYPE:                                              \
+      for (int n = 0; n < 16; ++n) {                             \
+        a.u8[n] = uint8_t(s8(a.u8[n]) op(b.u8[n] & 0x7));        \
+      }                                                          \
+      break;                                                     \
+    case INT16_TYPE:                                             \
+      for (int n = 0; n < 8; ++n) {                              \
+        a.u16[n] = uint16_t(s16(a.u16[n]) op(b.u16[n] & 0xF));   \
+      }                                                          \
+      break;                                                     \
+    case INT32_TYPE:                                             \
+      for (int n = 0; n < 4; ++n) {                              \
+        a.u32[n] = uint32_t(s32(a.u32[n]) op(b.u32[n] & 0x1F));  \
+      }                                                          \
+      break;                                                     \
+    default:                                                     \
+      assert_unhandled_case(part_type);                          \
+      break;                                                     \
+  }
+
+void Value::VectorShl(Value* other, TypeName part_type) {
+  auto& a = constant.v128;
+  auto& b = other->constant.v128;
+  SHIFT_ELEMENTS(part_type, <<, uint8_t, uint16_t, uint32_t);
+}
+
+void Value::VectorShr(Value* other, TypeName part_type) {
+  auto& a = constant.v128;
+  auto& b = other->constant.v128;
+  SHIFT_ELEMENTS(part_type, >>, uint8_t, uint16_t, uint32_t);
+}
+
+void Value::VectorSha(Value* other, TypeName part_type) {
+  auto& a = constant.v128;
+  auto& b = other->constant.v128;
+  SHIFT_ELEMENTS(part_type, >>, int8_t, int16_t, int32_t);
+}
+
+#undef SHIFT_ELEMENTS
+
+void Value::Insert(Value* index, Value* part) {
+  assert_true(type == VEC128_TYPE);
+  uint32_t n = uint32_t(index->constant.i8);
+  switch (part->type) {
+    case INT8_TYPE:
+      VecU8(constant.v128, n & 0xF) = part->constant.i8;
+      break;
+    case INT16_TYPE:
+      VecU16(constant.v128, n & 0x7) = part->constant.i16;
+      break;
+    case INT32_TYPE:
+      constant.v128.u32[n & 0x3] = part->constant.i32;
+      break;
+    default:
+      assert_unhandled_case(part->type);
+      break;
+  }
+}
+
+void Value::Extract(Value* vec, Value* index) {
+  assert_true(vec->type == VEC128_TYPE);
+  uint32_t n = uint32_t(index->constant.i8);
+  switch (type) {
+    case INT8_TYPE:
+      constant.i8 = VecU8(vec->constant.v128, n & 0xF);
+      break;
+    case INT16_TYPE:
+      constant.i16 = VecU16(vec->constant.v128, n & 0x7);
+      break;
+    case INT32_TYPE:
+      constant.i32 = vec->constant.v128.u32[n & 0x3];
+      break;
+    case FLOAT32_TYPE:
+      constant.f32 = vec->constant.v128.f32[n & 0x3];
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
+void Value::Splat(Value* other) {
+  assert_true(type == VEC128_TYPE);
+  switch (other->type) {
+    case INT8_TYPE:
+      constant.v128 = vec128b(other->constant.i8);
+      break;
+    case INT16_TYPE:
+      constant.v128 = vec128s(other->constant.i16);
+      break;
+    case INT32_TYPE:
+      constant.v128 = vec128i(other->constant.i32);
+      break;
+    case FLOAT32_TYPE:
+      constant.v128 = vec128f(other->constant.f32);
+      break;
+    default:
+      assert_unhandled_case(other->type);
+      break;
+  }
+}
+
+void Value::Permute(Value* control, Value* value1, Value* value2,
+                    TypeName part_type) {
+  assert_true(type == VEC128_TYPE);
+  auto& a = value1->constant.v128;
+  auto& b = value2->constant.v128;
+  vec128_t result;
+  switch (part_type) {
+    case INT8_TYPE: {
+      // vperm: each control byte selects from the 32 bytes of a:b.
+      auto c = control->constant.v128;
+      for (uint32_t n = 0; n < 16; ++n) {
+        uint32_t select = VecU8(c, n) & 0x1F;
+        VecU8(result, n) =
+            select < 16 ? VecU8(a, select) : VecU8(b, select - 16);
+      }
+      break;
+    }
+    case INT32_TYPE: {
+      // Control byte n: bits 0-1 pick the word, bit 2 picks a or b.
+      uint32_t c = uint32_t(control->constant.i32);
+      for (uint32_t n = 0; n < 4; ++n) {
+        uint32_t select = (c >> (n * 8)) & 0x7;
+        result.u32[n] = (select & 0x4 ? b : a).u32[select & 0x3];
+      }
+      break;
+    }
+    default:
+      assert_unhandled_case(part_type);
+      return;
+  }
+  constant.v128 = result;
+}
+
+void Value::Swizzle(uint32_t swizzle_mask, TypeName part_type) {
+  assert_true(part_type == INT32_TYPE || part_type == FLOAT32_TYPE);
+  // Same as pshufd.
+  vec128_t result;
+  for (uint32_t n = 0; n < 4; ++n) {
+    result.u32[n] = constant.v128.u32[(swizzle_mask >> (n * 2)) & 0x3];
+  }
+  constant.v128 = result;
+}
+
 bool Value::Compare(Opcode opcode, Value* other) {
   assert_true(type == other->type);
   switch (other->type) {
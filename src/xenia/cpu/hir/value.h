@@ -491,6 +491,19 @@ class Value {
   void ByteSwap();
   void CountLeadingZeros(const Value* other);
   bool Compare(Opcode opcode, Value* other);
+  void RotateLeft(Value* other);
+  // Vector ops. Element indices are in guest (big endian) order, matching
+  // the x64 sequences.
+  void VectorCompare(Opcode opcode, Value* other, TypeName part_type);
+  void VectorShl(Value* other, TypeName part_type);
+  void VectorShr(Value* other, TypeName part_type);
+  void VectorSha(Value* other, TypeName part_type);
+  void Insert(Value* index, Value* part);
+  void Extract(Value* vec, Value* index);
+  void Splat(Value* other);
+  void Permute(Value* control, Value* value1, Value* value2,
+               TypeName part_type);
+  void Swizzle(uint32_t swizzle_mask, TypeName part_type);
 
  private:
   static bool CompareInt8(Opcode opcode, Value* a, Value* b);
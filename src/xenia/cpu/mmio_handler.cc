@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/mmio_handler.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/logging.h"
@@ -44,6 +46,13 @@ std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
   return handler;
 }
 
+MMIOHandler::MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase)
+    : virtual_membase_(virtual_membase), physical_membase_(physical_membase) {
+  size_t page_size = xe::memory::page_size();
+  physical_watch_space_.pages.resize(0x20000000 / page_size);
+  virtual_watch_space_.pages.resize(0xA0000000 / page_size);
+}
+
 MMIOHandler::~MMIOHandler() {
   assert_true(global_handler_ == this);
   global_handler_ = nullptr;
@@ -53,6 +62,7 @@ bool MMIOHandler::RegisterRange(uint32_t virtual_address, uint32_t mask,
                                 uint32_t size, void* context,
                                 MMIOReadCallback read_callback,
                                 MMIOWriteCallback write_callback) {
+  std::lock_guard<xe::mutex> lock(mapped_ranges_mutex_);
   mapped_ranges_.push_back({
       virtual_address, mask, size, context, read_callback, write_callback,
   });
@@ -60,6 +70,7 @@ bool MMIOHandler::RegisterRange(uint32_t virtual_address, uint32_t mask,
 }
 
 MMIORange* MMIOHandler::LookupRange(uint32_t virtual_address) {
+  std::lock_guard<xe::mutex> lock(mapped_ranges_mutex_);
   for (auto& range : mapped_ranges_) {
     if ((virtual_address & range.mask) == range.address) {
       return &range;
@@ -69,24 +80,22 @@ MMIORange* MMIOHandler::LookupRange(uint32_t virtual_address) {
 }
 
 bool MMIOHandler::CheckLoad(uint32_t virtual_address, uint32_t* out_value) {
-  for (const auto& range : mapped_ranges_) {
-    if ((virtual_address & range.mask) == range.address) {
-      *out_value = static_cast<uint32_t>(
-          range.read(nullptr, range.callback_context, virtual_address));
-      return true;
-    }
+  auto range = LookupRange(virtual_address);
+  if (!range) {
+    return false;
   }
-  return false;
+  *out_value = static_cast<uint32_t>(
+      range->read(nullptr, range->callback_context, virtual_address));
+  return true;
 }
 
 bool MMIOHandler::CheckStore(uint32_t virtual_address, uint32_t value) {
-  for (const auto& range : mapped_ranges_) {
-    if ((virtual_address & range.mask) == range.address) {
-      range.write(nullptr, range.callback_context, virtual_address, value);
-      return true;
-    }
+  auto range = LookupRange(virtual_address);
+  if (!range) {
+    return false;
   }
-  return false;
+  range->write(nullptr, range->callback_context, virtual_address, value);
+  return true;
 }
 
 uintptr_t MMIOHandler::AddPhysicalWriteWatch(uint32_t guest_address,
@@ -94,108 +103,213 @@ uintptr_t MMIOHandler::AddPhysicalWriteWatch(uint32_t guest_address,
                                              WriteWatchCallback callback,
                                              void* callback_context,
                                              void* callback_data) {
-  uint32_t base_address = guest_address;
-  assert_true(base_address < 0x1FFFFFFF);
+  assert_true(guest_address < 0x1FFFFFFF);
+  return AddWatch(guest_address, length, false,
+                  xe::memory::PageAccess::kReadOnly, callback,
+                  callback_context, callback_data);
+}
+
+uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
+                                              size_t length,
+                                              WriteWatchCallback callback,
+                                              void* callback_context,
+                                              void* callback_data) {
+  assert_true(guest_address < 0x1FFFFFFF);
+  return AddWatch(guest_address, length, false,
+                  xe::memory::PageAccess::kNoAccess, callback,
+                  callback_context, callback_data);
+}
 
+uintptr_t MMIOHandler::AddVirtualWriteWatch(uint32_t virtual_address,
+                                            size_t length,
+                                            WriteWatchCallback callback,
+                                            void* callback_context,
+                                            void* callback_data) {
+  // Physical memory is aliased into 0xA0000000+ and watched from there.
+  assert_true(virtual_address < 0xA0000000);
+  return AddWatch(virtual_address, length, true,
+                  xe::memory::PageAccess::kReadOnly, callback,
+                  callback_context, callback_data);
+}
+
+uintptr_t MMIOHandler::AddWatch(uint32_t address, size_t length,
+                                bool is_virtual, xe::memory::PageAccess access,
+                                WriteWatchCallback callback,
+                                void* callback_context, void* callback_data) {
   // Can only protect sizes matching system page size.
   // This means we need to round up, which will cause spurious access
   // violations and invalidations.
   // TODO(benvanik): only invalidate if actually within the region?
-  length = xe::round_up(length + (base_address % xe::memory::page_size()),
-                        xe::memory::page_size());
-  base_address = base_address - (base_address % xe::memory::page_size());
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  length = xe::round_up(length + (address % page_size), page_size);
+  address = address - (address % page_size);
 
-  // Add to table. The slot reservation may evict a previous watch, which
-  // could include our target, so we do it first.
   auto entry = new WriteWatchEntry();
-  entry->address = base_address;
+  entry->address = address;
   entry->length = uint32_t(length);
+  entry->is_virtual = is_virtual;
+  entry->access = access;
   entry->callback = callback;
   entry->callback_context = callback_context;
   entry->callback_data = callback_data;
-  write_watch_mutex_.lock();
-  write_watches_.push_back(entry);
-  write_watch_mutex_.unlock();
 
-  // Make the desired range read only under all address spaces.
-  xe::memory::Protect(physical_membase_ + entry->address, entry->length,
-                      xe::memory::PageAccess::kReadOnly, nullptr);
-  xe::memory::Protect(virtual_membase_ + 0xA0000000 + entry->address,
-                      entry->length, xe::memory::PageAccess::kReadOnly,
-                      nullptr);
-  xe::memory::Protect(virtual_membase_ + 0xC0000000 + entry->address,
-                      entry->length, xe::memory::PageAccess::kReadOnly,
-                      nullptr);
-  xe::memory::Protect(virtual_membase_ + 0xE0000000 + entry->address,
-                      entry->length, xe::memory::PageAccess::kReadOnly,
-                      nullptr);
+  std::lock_guard<xe::mutex> lock(write_watch_mutex_);
+  auto& space = is_virtual ? virtual_watch_space_ : physical_watch_space_;
+  auto it = space.watches.insert({entry->address, entry});
+  write_watches_.insert({entry, it});
+  space.max_watch_length = std::max(space.max_watch_length, entry->length);
+
+  // Only pages not already protected at least this strictly are touched.
+  UpdateWatchedPages(entry, 1);
 
   return reinterpret_cast<uintptr_t>(entry);
 }
 
-void MMIOHandler::ClearWriteWatch(WriteWatchEntry* entry) {
-  xe::memory::Protect(physical_membase_ + entry->address, entry->length,
-                      xe::memory::PageAccess::kReadWrite, nullptr);
-  xe::memory::Protect(virtual_membase_ + 0xA0000000 + entry->address,
-                      entry->length, xe::memory::PageAccess::kReadWrite,
+static xe::memory::PageAccess GetWatchedPageAccess(
+    uint16_t write_watch_count, uint16_t access_watch_count) {
+  if (access_watch_count) {
+    return xe::memory::PageAccess::kNoAccess;
+  } else if (write_watch_count) {
+    return xe::memory::PageAccess::kReadOnly;
+  }
+  return xe::memory::PageAccess::kReadWrite;
+}
+
+void MMIOHandler::UpdateWatchedPages(WriteWatchEntry* entry, int delta) {
+  auto& pages = entry->is_virtual ? virtual_watch_space_.pages
+                                  : physical_watch_space_.pages;
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  uint32_t first_page = entry->address / page_size;
+  uint32_t end_page =
+      std::min(first_page + entry->length / page_size, uint32_t(pages.size()));
+  // Adjacent pages changing to the same access are protected together.
+  uint32_t run_start = 0;
+  uint32_t run_length = 0;
+  auto run_access = xe::memory::PageAccess::kReadWrite;
+  for (uint32_t n = first_page; n < end_page; ++n) {
+    auto& page = pages[n];
+    auto old_access =
+        GetWatchedPageAccess(page.write_watch_count, page.access_watch_count);
+    if (entry->access == xe::memory::PageAccess::kNoAccess) {
+      assert_true(delta > 0 || page.access_watch_count);
+      page.access_watch_count += delta;
+    } else {
+      assert_true(delta > 0 || page.write_watch_count);
+      page.write_watch_count += delta;
+    }
+    auto new_access =
+        GetWatchedPageAccess(page.write_watch_count, page.access_watch_count);
+    if (new_access == old_access) {
+      continue;
+    }
+    if (run_length && (run_access != new_access ||
+                       run_start + run_length != n)) {
+      ProtectPages(entry->is_virtual, run_start * page_size,
+                   run_length * page_size, run_access);
+      run_length = 0;
+    }
+    if (!run_length) {
+      run_start = n;
+      run_access = new_access;
+    }
+    ++run_length;
+  }
+  if (run_length) {
+    ProtectPages(entry->is_virtual, run_start * page_size,
+                 run_length * page_size, run_access);
+  }
+}
+
+void MMIOHandler::ProtectPages(bool is_virtual, uint32_t address,
+                               uint32_t length,
+                               xe::memory::PageAccess access) {
+  if (is_virtual) {
+    xe::memory::Protect(virtual_membase_ + address, length, access, nullptr);
+    return;
+  }
+  // Protect the range under all address spaces.
+  xe::memory::Protect(physical_membase_ + address, length, access, nullptr);
+  xe::memory::Protect(virtual_membase_ + 0xA0000000 + address, length, access,
                       nullptr);
-  xe::memory::Protect(virtual_membase_ + 0xC0000000 + entry->address,
-                      entry->length, xe::memory::PageAccess::kReadWrite,
+  xe::memory::Protect(virtual_membase_ + 0xC0000000 + address, length, access,
                       nullptr);
-  xe::memory::Protect(virtual_membase_ + 0xE0000000 + entry->address,
-                      entry->length, xe::memory::PageAccess::kReadWrite,
+  xe::memory::Protect(virtual_membase_ + 0xE0000000 + address, length, access,
                       nullptr);
 }
 
-void MMIOHandler::CancelWriteWatch(uintptr_t watch_handle) {
+bool MMIOHandler::CancelWriteWatch(uintptr_t watch_handle) {
   auto entry = reinterpret_cast<WriteWatchEntry*>(watch_handle);
 
-  // Allow access to the range again.
-  ClearWriteWatch(entry);
-
-  // Remove from table.
-  write_watch_mutex_.lock();
-  auto it = std::find(write_watches_.begin(), write_watches_.end(), entry);
-  if (it != write_watches_.end()) {
-    write_watches_.erase(it);
+  std::lock_guard<xe::mutex> lock(write_watch_mutex_);
+  auto it = write_watches_.find(entry);
+  if (it == write_watches_.end()) {
+    // Already triggered on another thread, which owns the entry now and will
+    // run the callback.
+    return false;
   }
-  write_watch_mutex_.unlock();
+  auto& space =
+      entry->is_virtual ? virtual_watch_space_ : physical_watch_space_;
+  space.watches.erase(it->second);
+  write_watches_.erase(it);
+
+  // Allow access to the range again, unless other watches cover it.
+  UpdateWatchedPages(entry, -1);
 
   delete entry;
+  return true;
+}
+
+void MMIOHandler::TakePageWatches(WatchSpace* space, uint32_t address,
+                                  std::vector<WriteWatchEntry*>* entries) {
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  uint32_t page_address = address - (address % page_size);
+  // Watches starting further back than the longest watch can't reach us.
+  uint32_t low_address = page_address >= space->max_watch_length
+                             ? page_address - space->max_watch_length + 1
+                             : 0;
+  auto it = space->watches.lower_bound(low_address);
+  while (it != space->watches.end() && it->first <= page_address) {
+    auto entry = it->second;
+    if (entry->address + entry->length <= page_address) {
+      ++it;
+      continue;
+    }
+    entries->push_back(entry);
+    write_watches_.erase(entry);
+    it = space->watches.erase(it);
+    UpdateWatchedPages(entry, -1);
+  }
 }
 
 bool MMIOHandler::CheckWriteWatch(void* thread_state, uint64_t fault_address) {
+  // Both membases are 4GB aligned so the low bits are the guest address.
+  uint32_t virtual_address = uint32_t(fault_address);
   uint32_t physical_address = uint32_t(fault_address);
+  bool is_virtual = fault_address < uint64_t(physical_membase_);
+  bool has_physical = !is_virtual || virtual_address >= 0xA0000000;
   if (physical_address > 0x1FFFFFFF) {
     physical_address &= 0x1FFFFFFF;
   }
-  std::list<WriteWatchEntry*> pending_invalidates;
+  // Every watch on the faulting page fires at once, so the page is only
+  // unprotected once however many resources it holds.
+  std::vector<WriteWatchEntry*> pending_invalidates;
   write_watch_mutex_.lock();
-  for (auto it = write_watches_.begin(); it != write_watches_.end();) {
-    auto entry = *it;
-    if (entry->address <= physical_address &&
-        entry->address + entry->length > physical_address) {
-      // Hit!
-      pending_invalidates.push_back(entry);
-      // TODO(benvanik): outside of lock?
-      ClearWriteWatch(entry);
-      auto erase_it = it;
-      ++it;
-      write_watches_.erase(erase_it);
-      continue;
-    }
-    ++it;
+  if (is_virtual) {
+    TakePageWatches(&virtual_watch_space_, virtual_address,
+                    &pending_invalidates);
+  }
+  if (has_physical) {
+    TakePageWatches(&physical_watch_space_, physical_address,
+                    &pending_invalidates);
   }
   write_watch_mutex_.unlock();
   if (pending_invalidates.empty()) {
     // Rethrow access violation - range was not being watched.
     return false;
   }
-  while (!pending_invalidates.empty()) {
-    auto entry = pending_invalidates.back();
-    pending_invalidates.pop_back();
+  for (auto entry : pending_invalidates) {
     entry->callback(entry->callback_context, entry->callback_data,
-                    physical_address);
+                    entry->is_virtual ? virtual_address : physical_address);
     delete entry;
   }
   // Range was watched, so lets eat this access violation.
@@ -373,13 +487,7 @@ bool MMIOHandler::HandleAccessFault(void* thread_state,
   // Only check if in the virtual range, as we only support virtual ranges.
   const MMIORange* range = nullptr;
   if (fault_address < uint64_t(physical_membase_)) {
-    for (const auto& test_range : mapped_ranges_) {
-      if ((uint32_t(fault_address) & test_range.mask) == test_range.address) {
-        // Address is within the range of this mapping.
-        range = &test_range;
-        break;
-      }
-    }
+    range = LookupRange(uint32_t(fault_address));
   }
   if (!range) {
     // Access is not found within any range, so fail and let the caller handle
@@ -428,6 +536,45 @@ bool MMIOHandler::HandleAccessFault(void* thread_state,
   // Advance RIP to the next instruction so that we resume properly.
   SetThreadStateRip(thread_state, rip + mov.length);
 
+  // Faults are expensive; let the JIT know so it can avoid this one.
+  if (access_fault_callback_) {
+    access_fault_callback_(access_fault_callback_context_, rip);
+  }
+
+  return true;
+}
+
+// Breakpoint the current thread is single stepping over, if any.
+thread_local uint64_t code_breakpoint_step_pc = 0;
+
+bool MMIOHandler::HandleBreakpoint(void* thread_state, uint64_t host_pc) {
+  if (!code_breakpoint_callback_) {
+    return false;
+  }
+  switch (code_breakpoint_callback_(code_breakpoint_callback_context_, host_pc,
+                                    false)) {
+    case CodeBreakpointAction::kNotHandled:
+      return false;
+    case CodeBreakpointAction::kResume:
+      SetThreadStateRip(thread_state, host_pc);
+      return true;
+    case CodeBreakpointAction::kStepOver:
+      SetThreadStateRip(thread_state, host_pc);
+      SetThreadStateSingleStep(thread_state, true);
+      code_breakpoint_step_pc = host_pc;
+      return true;
+  }
+  return false;
+}
+
+bool MMIOHandler::HandleSingleStep(void* thread_state) {
+  if (!code_breakpoint_step_pc) {
+    return false;
+  }
+  SetThreadStateSingleStep(thread_state, false);
+  uint64_t host_pc = code_breakpoint_step_pc;
+  code_breakpoint_step_pc = 0;
+  code_breakpoint_callback_(code_breakpoint_callback_context_, host_pc, true);
   return true;
 }
 
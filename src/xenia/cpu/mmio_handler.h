@@ -10,11 +10,14 @@
 #ifndef XENIA_CPU_MMIO_HANDLER_H_
 #define XENIA_CPU_MMIO_HANDLER_H_
 
-#include <list>
+#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 
+#include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 
 namespace xe {
@@ -28,6 +31,26 @@ typedef void (*MMIOWriteCallback)(void* ppc_context, void* callback_context,
 typedef void (*WriteWatchCallback)(void* context_ptr, void* data_ptr,
                                    uint32_t address);
 
+// Notified with the host address of the faulting instruction after an access
+// to an MMIO range has been handled.
+typedef void (*MMIOAccessFaultCallback)(void* context_ptr, uint64_t host_pc);
+
+enum class CodeBreakpointAction {
+  // The trap isn't one of ours; let other handlers see it.
+  kNotHandled,
+  // The trap has been removed; resume at the original instruction.
+  kResume,
+  // The original instruction byte has been restored; single step it and call
+  // back with is_step_complete set so the trap can be put back.
+  kStepOver,
+};
+
+// Notified on the faulting thread when generated code executes an int3 at
+// host_pc, and again once the thread has stepped over it if requested.
+typedef CodeBreakpointAction (*CodeBreakpointCallback)(void* context_ptr,
+                                                       uint64_t host_pc,
+                                                       bool is_step_complete);
+
 struct MMIORange {
   uint32_t address;
   uint32_t mask;
@@ -46,6 +69,8 @@ class MMIOHandler {
                                               uint8_t* physical_membase);
   static MMIOHandler* global_handler() { return global_handler_; }
 
+  // Ranges may be registered from any thread while others are running, and
+  // are never removed.
   bool RegisterRange(uint32_t virtual_address, uint32_t mask, uint32_t size,
                      void* context, MMIOReadCallback read_callback,
                      MMIOWriteCallback write_callback);
@@ -57,42 +82,119 @@ class MMIOHandler {
   uintptr_t AddPhysicalWriteWatch(uint32_t guest_address, size_t length,
                                   WriteWatchCallback callback,
                                   void* callback_context, void* callback_data);
-  void CancelWriteWatch(uintptr_t watch_handle);
+  // Like AddPhysicalWriteWatch, but reads also trigger the callback. The
+  // callback runs before the faulting access is retried, so it may fill in
+  // the memory.
+  uintptr_t AddPhysicalAccessWatch(uint32_t guest_address, size_t length,
+                                   WriteWatchCallback callback,
+                                   void* callback_context,
+                                   void* callback_data);
+  // Watches a range of guest virtual memory that is not backed by physical
+  // memory (such as the XEX heaps). The callback receives the virtual
+  // address written to.
+  uintptr_t AddVirtualWriteWatch(uint32_t virtual_address, size_t length,
+                                 WriteWatchCallback callback,
+                                 void* callback_context, void* callback_data);
+  // Returns false if the watch has already been triggered, in which case
+  // its callback is running or about to run on the faulting thread.
+  bool CancelWriteWatch(uintptr_t watch_handle);
+
+  void set_access_fault_callback(MMIOAccessFaultCallback callback,
+                                 void* callback_context) {
+    access_fault_callback_context_ = callback_context;
+    access_fault_callback_ = callback;
+  }
+
+  // Whether int3s in generated code reach HandleBreakpoint on the thread that
+  // hit them.
+  virtual bool supports_code_breakpoints() const { return true; }
+  void set_code_breakpoint_callback(CodeBreakpointCallback callback,
+                                    void* callback_context) {
+    code_breakpoint_callback_context_ = callback_context;
+    code_breakpoint_callback_ = callback;
+  }
 
  public:
   bool HandleAccessFault(void* thread_state, uint64_t fault_address);
+  // Handles an int3 at host_pc. Returns false if it wasn't a code breakpoint.
+  bool HandleBreakpoint(void* thread_state, uint64_t host_pc);
+  // Handles the single step trap following a stepped over breakpoint.
+  bool HandleSingleStep(void* thread_state);
 
  protected:
   struct WriteWatchEntry {
+    // Physical address, unless is_virtual.
     uint32_t address;
     uint32_t length;
+    bool is_virtual;
+    // kReadOnly for write watches, kNoAccess for access watches.
+    xe::memory::PageAccess access;
     WriteWatchCallback callback;
     void* callback_context;
     void* callback_data;
   };
+  // Number of watches of each kind covering a host page. The page is
+  // protected for the strictest of them.
+  struct WatchedPage {
+    uint16_t write_watch_count;
+    uint16_t access_watch_count;
+  };
+  typedef std::multimap<uint32_t, WriteWatchEntry*> WatchMap;
+  // The watches of one address space.
+  struct WatchSpace {
+    std::vector<WatchedPage> pages;
+    // Watches by page aligned start address.
+    WatchMap watches;
+    // Longest watch ever added, bounding how far before a faulting page a
+    // watch covering it can start.
+    uint32_t max_watch_length = 0;
+  };
 
-  MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase)
-      : virtual_membase_(virtual_membase),
-        physical_membase_(physical_membase) {}
+  MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase);
 
   virtual bool Initialize() = 0;
 
-  void ClearWriteWatch(WriteWatchEntry* entry);
+  uintptr_t AddWatch(uint32_t address, size_t length, bool is_virtual,
+                     xe::memory::PageAccess access, WriteWatchCallback callback,
+                     void* callback_context, void* callback_data);
+  // Adjusts the page counts of the entry's range by delta and protects the
+  // pages whose required access changed, in as few host calls as possible.
+  // Must be called with write_watch_mutex_ held.
+  void UpdateWatchedPages(WriteWatchEntry* entry, int delta);
+  void ProtectPages(bool is_virtual, uint32_t address, uint32_t length,
+                    xe::memory::PageAccess access);
+  // Removes all watches covering the page containing address and appends
+  // them to entries. Must be called with write_watch_mutex_ held.
+  void TakePageWatches(WatchSpace* space, uint32_t address,
+                       std::vector<WriteWatchEntry*>* entries);
   bool CheckWriteWatch(void* thread_state, uint64_t fault_address);
 
   virtual uint64_t GetThreadStateRip(void* thread_state_ptr) = 0;
   virtual void SetThreadStateRip(void* thread_state_ptr, uint64_t rip) = 0;
+  // Sets or clears the trap flag so the thread faults after one instruction.
+  virtual void SetThreadStateSingleStep(void* thread_state_ptr,
+                                        bool single_step) = 0;
   virtual uint64_t* GetThreadStateRegPtr(void* thread_state_ptr,
                                          int32_t be_reg_index) = 0;
 
   uint8_t* virtual_membase_;
   uint8_t* physical_membase_;
 
-  std::vector<MMIORange> mapped_ranges_;
+  // A deque so that range pointers stay valid as more are registered.
+  xe::mutex mapped_ranges_mutex_;
+  std::deque<MMIORange> mapped_ranges_;
+
+  MMIOAccessFaultCallback access_fault_callback_ = nullptr;
+  void* access_fault_callback_context_ = nullptr;
+
+  CodeBreakpointCallback code_breakpoint_callback_ = nullptr;
+  void* code_breakpoint_callback_context_ = nullptr;
 
-  // TODO(benvanik): data structure magic.
   xe::mutex write_watch_mutex_;
-  std::list<WriteWatchEntry*> write_watches_;
+  WatchSpace physical_watch_space_;
+  WatchSpace virtual_watch_space_;
+  // Live watches by handle, so cancelling never touches a triggered entry.
+  std::unordered_map<WriteWatchEntry*, WatchMap::iterator> write_watches_;
 
   static MMIOHandler* global_handler_;
 };
@@ -39,8 +39,14 @@ class MachMMIOHandler : public MMIOHandler {
  protected:
   bool Initialize() override;
 
+  // Exceptions are handled on the exception port thread, not the one that hit
+  // the breakpoint, so the debugger could not block or inspect it.
+  bool supports_code_breakpoints() const override { return false; }
+
   uint64_t GetThreadStateRip(void* thread_state_ptr) override;
   void SetThreadStateRip(void* thread_state_ptr, uint64_t rip) override;
+  void SetThreadStateSingleStep(void* thread_state_ptr,
+                                bool single_step) override;
   uint64_t* GetThreadStateRegPtr(void* thread_state_ptr,
                                  int32_t be_reg_index) override;
 
@@ -198,6 +204,16 @@ void MachMMIOHandler::SetThreadStateRip(void* thread_state_ptr, uint64_t rip) {
   thread_state->__rip = rip;
 }
 
+void MachMMIOHandler::SetThreadStateSingleStep(void* thread_state_ptr,
+                                               bool single_step) {
+  auto thread_state = reinterpret_cast<x86_thread_state64_t*>(thread_state_ptr);
+  if (single_step) {
+    thread_state->__rflags |= 0x100;
+  } else {
+    thread_state->__rflags &= ~0x100;
+  }
+}
+
 uint64_t* MachMMIOHandler::GetThreadStateRegPtr(void* thread_state_ptr,
                                                 int32_t be_reg_index) {
   // Map from BeaEngine register order to x86_thread_state64 order.
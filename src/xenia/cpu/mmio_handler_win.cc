@@ -32,6 +32,8 @@ class WinMMIOHandler : public MMIOHandler {
 
   uint64_t GetThreadStateRip(void* thread_state_ptr) override;
   void SetThreadStateRip(void* thread_state_ptr, uint64_t rip) override;
+  void SetThreadStateSingleStep(void* thread_state_ptr,
+                                bool single_step) override;
   uint64_t* GetThreadStateRegPtr(void* thread_state_ptr,
                                  int32_t reg_index) override;
 };
@@ -85,6 +87,18 @@ LONG CALLBACK MMIOExceptionHandler(PEXCEPTION_POINTERS ex_info) {
       xe::CrashDump();
       return EXCEPTION_CONTINUE_SEARCH;
     }
+  } else if (code == STATUS_BREAKPOINT) {
+    // Possibly a breakpoint patched into generated code.
+    auto host_pc = uint64_t(ex_info->ExceptionRecord->ExceptionAddress);
+    if (MMIOHandler::global_handler()->HandleBreakpoint(ex_info->ContextRecord,
+                                                        host_pc)) {
+      return EXCEPTION_CONTINUE_EXECUTION;
+    }
+  } else if (code == STATUS_SINGLE_STEP) {
+    if (MMIOHandler::global_handler()->HandleSingleStep(
+            ex_info->ContextRecord)) {
+      return EXCEPTION_CONTINUE_EXECUTION;
+    }
   }
   return EXCEPTION_CONTINUE_SEARCH;
 }
@@ -99,6 +113,16 @@ void WinMMIOHandler::SetThreadStateRip(void* thread_state_ptr, uint64_t rip) {
   context->Rip = rip;
 }
 
+void WinMMIOHandler::SetThreadStateSingleStep(void* thread_state_ptr,
+                                              bool single_step) {
+  auto context = reinterpret_cast<LPCONTEXT>(thread_state_ptr);
+  if (single_step) {
+    context->EFlags |= 0x100;
+  } else {
+    context->EFlags &= ~0x100;
+  }
+}
+
 uint64_t* WinMMIOHandler::GetThreadStateRegPtr(void* thread_state_ptr,
                                                int32_t reg_index) {
   auto context = reinterpret_cast<LPCONTEXT>(thread_state_ptr);
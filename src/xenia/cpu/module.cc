@@ -11,9 +11,11 @@
 
 #include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <sstream>  // NOLINT(readability/streams): should be replaced.
 #include <string>
 
+#include "xenia/base/assert.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/profiling.h"
@@ -28,7 +30,65 @@ Module::~Module() = default;
 
 bool Module::ContainsAddress(uint32_t address) { return true; }
 
+// Published indices may hold functions that have since been replaced by a
+// recompile.
+static Symbol* CurrentSymbol(Symbol* symbol) {
+  if (symbol->type() == Symbol::Type::kFunction) {
+    return static_cast<Function*>(symbol)->current();
+  }
+  return symbol;
+}
+
+Symbol* Module::FindIndexedSymbol(uint32_t address) {
+  auto index = index_.load(std::memory_order_acquire);
+  if (!index) {
+    return nullptr;
+  }
+  auto& symbols = index->symbols;
+  auto it = std::lower_bound(
+      symbols.begin(), symbols.end(), address,
+      [](Symbol* symbol, uint32_t value) { return symbol->address() < value; });
+  if (it == symbols.end() || (*it)->address() != address) {
+    return nullptr;
+  }
+  return CurrentSymbol(*it);
+}
+
+void Module::IndexSymbol(Symbol* symbol) {
+  unindexed_.push_back(symbol);
+  auto index = index_.load(std::memory_order_relaxed);
+  size_t indexed_count = index ? index->symbols.size() : 0;
+  if (unindexed_.size() < std::max(size_t(64), indexed_count / 4)) {
+    return;
+  }
+  auto new_index = std::make_unique<SymbolIndex>();
+  auto& symbols = new_index->symbols;
+  symbols.reserve(indexed_count + unindexed_.size());
+  auto address_less = [](Symbol* a, Symbol* b) {
+    return a->address() < b->address();
+  };
+  std::sort(unindexed_.begin(), unindexed_.end(), address_less);
+  if (index) {
+    std::merge(index->symbols.begin(), index->symbols.end(),
+               unindexed_.begin(), unindexed_.end(),
+               std::back_inserter(symbols), address_less);
+  } else {
+    symbols = unindexed_;
+  }
+  std::transform(symbols.begin(), symbols.end(), symbols.begin(),
+                 CurrentSymbol);
+  unindexed_.clear();
+  index_.store(new_index.get(), std::memory_order_release);
+  indices_.push_back(std::move(new_index));
+}
+
 Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
+  Symbol* indexed_symbol = FindIndexedSymbol(address);
+  if (indexed_symbol &&
+      indexed_symbol->status() != Symbol::Status::kDeclaring) {
+    return indexed_symbol;
+  }
+
   lock_.lock();
   const auto it = map_.find(address);
   Symbol* symbol = it != map_.end() ? it->second : nullptr;
@@ -52,9 +112,58 @@ Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
   return symbol;
 }
 
+Function* Module::LookupFunctionContaining(uint32_t address) {
+  Symbol* best = nullptr;
+  auto index = index_.load(std::memory_order_acquire);
+  if (index) {
+    auto& symbols = index->symbols;
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), address,
+                               [](uint32_t value, Symbol* symbol) {
+                                 return value < symbol->address();
+                               });
+    while (it != symbols.begin()) {
+      --it;
+      if ((*it)->type() == Symbol::Type::kFunction) {
+        best = CurrentSymbol(*it);
+        break;
+      }
+    }
+  }
+  {
+    // Recently added functions may start closer.
+    std::lock_guard<xe::mutex> guard(lock_);
+    for (auto symbol : unindexed_) {
+      if (symbol->type() == Symbol::Type::kFunction &&
+          symbol->address() <= address &&
+          (!best || symbol->address() > best->address())) {
+        best = symbol;
+      }
+    }
+  }
+  if (!best) {
+    return nullptr;
+  }
+  auto function = static_cast<Function*>(best);
+  if (!function->has_end_address() || address >= function->end_address()) {
+    return nullptr;
+  }
+  return function;
+}
+
 Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
                                      Symbol** out_symbol) {
   *out_symbol = nullptr;
+
+  // Almost always the symbol already exists and is in the index.
+  Symbol* indexed_symbol = FindIndexedSymbol(address);
+  if (indexed_symbol && indexed_symbol->type() == type) {
+    Symbol::Status status = indexed_symbol->status();
+    if (status != Symbol::Status::kDeclaring) {
+      *out_symbol = indexed_symbol;
+      return status;
+    }
+  }
+
   lock_.lock();
   auto it = map_.find(address);
   Symbol* symbol = it != map_.end() ? it->second : nullptr;
@@ -88,6 +197,7 @@ Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
     }
     map_[address] = symbol;
     list_.emplace_back(symbol);
+    IndexSymbol(symbol);
     status = Symbol::Status::kNew;
   }
   lock_.unlock();
@@ -147,6 +257,30 @@ Symbol::Status Module::DefineVariable(Symbol* symbol) {
   return DefineSymbol(symbol);
 }
 
+void Module::ReplaceFunction(Function* function,
+                             std::unique_ptr<Function> new_function) {
+  assert_true(new_function->address() == function->address());
+  new_function->set_status(Symbol::Status::kDefined);
+  Function* new_symbol = new_function.get();
+
+  std::lock_guard<xe::mutex> guard(lock_);
+  assert_null(function->replacement());
+  map_[function->address()] = new_symbol;
+  auto it = std::find_if(list_.begin(), list_.end(),
+                         [function](const std::unique_ptr<Symbol>& symbol) {
+                           return symbol.get() == function;
+                         });
+  assert_true(it != list_.end());
+  replaced_.push_back(std::move(*it));
+  it->reset(new_function.release());
+  std::replace(unindexed_.begin(), unindexed_.end(),
+               static_cast<Symbol*>(function),
+               static_cast<Symbol*>(new_symbol));
+  // Published indices are immutable and still hold the old function; lookups
+  // through them follow this, and the next republish drops it.
+  function->replacement_.store(new_symbol, std::memory_order_release);
+}
+
 void Module::ForEachFunction(std::function<void(Function*)> callback) {
   std::lock_guard<xe::mutex> guard(lock_);
   for (auto& symbol : list_) {
@@ -157,6 +291,49 @@ void Module::ForEachFunction(std::function<void(Function*)> callback) {
   }
 }
 
+void Module::ForEachFunctionInRange(uint32_t start_address,
+                                    uint32_t end_address,
+                                    std::function<bool(Function*)> callback) {
+  std::lock_guard<xe::mutex> guard(lock_);
+  auto in_range = [start_address, end_address](Symbol* symbol) {
+    return symbol->address() >= start_address &&
+           symbol->address() < end_address;
+  };
+  auto address_less = [](Symbol* a, Symbol* b) {
+    return a->address() < b->address();
+  };
+
+  // Walk the published index merged with what was added since, so only the
+  // requested range is visited no matter how large the module is.
+  std::vector<Symbol*> recent;
+  std::copy_if(unindexed_.begin(), unindexed_.end(),
+               std::back_inserter(recent), in_range);
+  std::sort(recent.begin(), recent.end(), address_less);
+  auto recent_it = recent.begin();
+  std::vector<Symbol*> no_symbols;
+  auto index = index_.load(std::memory_order_relaxed);
+  auto& indexed = index ? index->symbols : no_symbols;
+  auto indexed_it = std::lower_bound(
+      indexed.begin(), indexed.end(), start_address,
+      [](Symbol* symbol, uint32_t value) { return symbol->address() < value; });
+  while (true) {
+    bool has_indexed = indexed_it != indexed.end() && in_range(*indexed_it);
+    Symbol* symbol;
+    if (has_indexed && (recent_it == recent.end() ||
+                        !address_less(*recent_it, *indexed_it))) {
+      symbol = CurrentSymbol(*indexed_it++);
+    } else if (recent_it != recent.end()) {
+      symbol = *recent_it++;
+    } else {
+      break;
+    }
+    if (symbol->type() == Symbol::Type::kFunction &&
+        !callback(static_cast<Function*>(symbol))) {
+      break;
+    }
+  }
+}
+
 void Module::ForEachSymbol(size_t start_index, size_t end_index,
                            std::function<void(Symbol*)> callback) {
   std::lock_guard<xe::mutex> guard(lock_);
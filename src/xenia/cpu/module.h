@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_MODULE_H_
 #define XENIA_CPU_MODULE_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -39,6 +40,9 @@ class Module {
   virtual bool ContainsAddress(uint32_t address);
 
   Symbol* LookupSymbol(uint32_t address, bool wait = true);
+  // Returns the function with the highest start address at or below the given
+  // address if the address is before its end, or null.
+  Function* LookupFunctionContaining(uint32_t address);
   virtual Symbol::Status DeclareFunction(uint32_t address,
                                          Function** out_function);
   virtual Symbol::Status DeclareVariable(uint32_t address, Symbol** out_symbol);
@@ -46,7 +50,17 @@ class Module {
   Symbol::Status DefineFunction(Function* symbol);
   Symbol::Status DefineVariable(Symbol* symbol);
 
+  // Publishes a recompile of a defined function in its place, so that all
+  // lookups return it from then on. The replaced function is kept alive until
+  // the module is destroyed as threads may still be running its code.
+  void ReplaceFunction(Function* function,
+                       std::unique_ptr<Function> new_function);
+
   void ForEachFunction(std::function<void(Function*)> callback);
+  // Calls back for each function in [start_address, end_address) in address
+  // order until the callback returns false.
+  void ForEachFunctionInRange(uint32_t start_address, uint32_t end_address,
+                              std::function<bool(Function*)> callback);
   void ForEachSymbol(size_t start_index, size_t end_index,
                      std::function<void(Symbol*)> callback);
   size_t QuerySymbolCount();
@@ -64,10 +78,31 @@ class Module {
                                Symbol** out_symbol);
   Symbol::Status DefineSymbol(Symbol* symbol);
 
-  // TODO(benvanik): replace with a better data structure.
+  // Immutable once published, sorted by address.
+  struct SymbolIndex {
+    std::vector<Symbol*> symbols;
+  };
+
+  // Searches the published index without locking.
+  Symbol* FindIndexedSymbol(uint32_t address);
+  // Adds a new symbol, republishing the index once enough have accumulated.
+  // lock_ must be held.
+  void IndexSymbol(Symbol* symbol);
+
   xe::mutex lock_;
   std::unordered_map<uint32_t, Symbol*> map_;
   std::vector<std::unique_ptr<Symbol>> list_;
+  // Functions that have been replaced by a recompile.
+  std::vector<std::unique_ptr<Symbol>> replaced_;
+
+  // Lookups of symbols that existed when the index was last published never
+  // touch lock_. Readers may still be using old indices, so all of them are
+  // kept until the module is destroyed; republishing only when the unindexed
+  // set grows by a fraction of the index bounds that overhead.
+  std::atomic<SymbolIndex*> index_ = {nullptr};
+  std::vector<std::unique_ptr<SymbolIndex>> indices_;
+  // Symbols added since the index was published. Guarded by lock_.
+  std::vector<Symbol*> unindexed_;
 };
 
 }  // namespace cpu
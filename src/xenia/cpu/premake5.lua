@@ -20,5 +20,12 @@ project("xenia-cpu")
   local_platform_files("frontend")
   local_platform_files("hir")
 
+  filter("platforms:Linux")
+    links({
+      "unwind",
+    })
+  filter({})
+
+include("compiler/benchmark")
 include("testing")
 include("frontend/testing")
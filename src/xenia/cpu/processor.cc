@@ -11,11 +11,17 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <iterator>
+#include <string>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/compiler/compile_stats.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/frontend/ppc_frontend.h"
@@ -59,11 +65,51 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver,
     : memory_(memory), debugger_(debugger), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  if (FLAGS_recompile_mmio_access_sites && backend_) {
+    memory_->SetMMIOAccessFaultCallback(nullptr, nullptr);
+  }
+
+  if (!compile_threads_.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(compile_queue_mutex_);
+      compile_threads_running_ = false;
+      compile_queue_.clear();
+      precompile_queue_.clear();
+    }
+    compile_queue_cond_.notify_all();
+    for (auto& thread : compile_threads_) {
+      xe::threading::Wait(thread.get(), false);
+    }
+    compile_threads_.clear();
+  }
+
+  if (FLAGS_dump_compile_stats) {
+    compiler::CompileStats::global()->Dump();
+  }
+
+  {
+    std::lock_guard<xe::mutex> guard(code_watch_lock_);
+    for (auto& it : code_watch_pages_) {
+      if (it.second.watch_handle) {
+        memory_->CancelWriteWatch(it.second.watch_handle);
+      }
+    }
+    code_watch_pages_.clear();
+  }
+
   {
     std::lock_guard<xe::mutex> guard(modules_lock_);
     modules_.clear();
   }
 
+  {
+    std::lock_guard<xe::mutex> guard(thread_state_pool_lock_);
+    for (auto thread_state : thread_state_pool_) {
+      delete thread_state;
+    }
+    thread_state_pool_.clear();
+  }
+
   frontend_.reset();
   backend_.reset();
 }
@@ -122,6 +168,26 @@ bool Processor::Setup() {
     return false;
   }
 
+  if (FLAGS_tiered_compilation || FLAGS_hot_function_recompilation ||
+      FLAGS_recompile_mmio_access_sites || FLAGS_precompile_module_functions) {
+    compile_threads_running_ = true;
+    for (int32_t i = 0; i < std::max(FLAGS_compile_thread_count, 1); ++i) {
+      auto thread = xe::threading::Thread::Create(
+          {}, [this]() { CompileThreadMain(); });
+      thread->set_name("Compile Thread " + std::to_string(i));
+      thread->set_priority(xe::threading::ThreadPriority::kBelowNormal);
+      compile_threads_.push_back(std::move(thread));
+    }
+  }
+
+  if (FLAGS_recompile_mmio_access_sites) {
+    memory_->SetMMIOAccessFaultCallback(
+        [](void* context, uint64_t host_pc) {
+          reinterpret_cast<Processor*>(context)->OnMMIOAccessFault(host_pc);
+        },
+        this);
+  }
+
   return true;
 }
 
@@ -189,6 +255,8 @@ Function* Processor::ResolveFunction(uint32_t address) {
     // Grab symbol declaration.
     auto function = LookupFunction(address);
     if (!function) {
+      // Don't leave waiters spinning on us.
+      entry->status = Entry::STATUS_FAILED;
       return nullptr;
     }
 
@@ -202,7 +270,13 @@ Function* Processor::ResolveFunction(uint32_t address) {
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
-    return entry->function;
+    Function* function = entry->function;
+    if (function->is_guest() &&
+        static_cast<GuestFunction*>(function)->is_invalidated()) {
+      RetranslateIfInvalidated(static_cast<GuestFunction*>(function));
+      function = entry->function;
+    }
+    return function;
   } else {
     // Failed or bad state.
     return nullptr;
@@ -264,6 +338,8 @@ bool Processor::DemandFunction(Function* function) {
       return false;
     }
 
+    WatchFunctionCode(static_cast<GuestFunction*>(function));
+
     // Before we give the symbol back to the rest, let the debugger know.
     if (debugger_) {
       debugger_->OnFunctionDefined(function);
@@ -281,6 +357,189 @@ bool Processor::DemandFunction(Function* function) {
   return true;
 }
 
+void Processor::QueueFunctionRecompile(GuestFunction* function) {
+  {
+    std::lock_guard<std::mutex> lock(compile_queue_mutex_);
+    if (!compile_threads_running_) {
+      return;
+    }
+    compile_queue_.push_back(function);
+  }
+  compile_queue_cond_.notify_one();
+}
+
+void Processor::QueueFunctionPrecompile(
+    const std::vector<uint32_t>& addresses) {
+  {
+    std::lock_guard<std::mutex> lock(compile_queue_mutex_);
+    if (!compile_threads_running_) {
+      return;
+    }
+    precompile_queue_.insert(precompile_queue_.end(), addresses.begin(),
+                             addresses.end());
+  }
+  compile_queue_cond_.notify_all();
+}
+
+void Processor::OnMMIOAccessFault(uint64_t host_pc) {
+  // Recompiles never modify a function, so this is the function the faulting
+  // code was placed for even if it has since been replaced.
+  auto function = backend_->code_cache()->LookupFunction(host_pc);
+  if (!function) {
+    return;
+  }
+  auto code_base = reinterpret_cast<uint64_t>(function->machine_code());
+  SourceMapEntry entry;
+  if (!function->LookupCodeOffset(uint32_t(host_pc - code_base), &entry)) {
+    return;
+  }
+  // Only the first fault at each site triggers a recompile; the new code
+  // won't fault there again.
+  if (function->AddMMIOAccessSite(entry.source_offset)) {
+    QueueFunctionRecompile(function);
+  }
+}
+
+void Processor::WatchFunctionCode(GuestFunction* function) {
+  if (!FLAGS_invalidate_modified_code || !function->has_end_address() ||
+      function->end_address() >= 0xA0000000) {
+    // Physical memory code (rare) would need physical watches.
+    return;
+  }
+  uint32_t low = function->address() & ~(kCodeWatchPageSize - 1);
+  uint32_t high = function->end_address();
+  std::lock_guard<xe::mutex> guard(code_watch_lock_);
+  for (uint32_t page = low; page <= high; page += kCodeWatchPageSize) {
+    auto& watch_page = code_watch_pages_[page];
+    if (std::find(watch_page.functions.begin(), watch_page.functions.end(),
+                  function) == watch_page.functions.end()) {
+      watch_page.functions.push_back(function);
+    }
+    if (!watch_page.watch_handle) {
+      watch_page.watch_handle = memory_->AddVirtualWriteWatch(
+          page, kCodeWatchPageSize,
+          [](void* context, void* data, uint32_t address) {
+            reinterpret_cast<Processor*>(context)->OnCodeWritten(address);
+          },
+          this, nullptr);
+    }
+  }
+}
+
+void Processor::OnCodeWritten(uint32_t address) {
+  std::vector<GuestFunction*> functions;
+  {
+    std::lock_guard<xe::mutex> guard(code_watch_lock_);
+    auto it = code_watch_pages_.find(address & ~(kCodeWatchPageSize - 1));
+    if (it == code_watch_pages_.end()) {
+      return;
+    }
+    // The handler has already dropped the watch.
+    functions.swap(it->second.functions);
+    code_watch_pages_.erase(it);
+  }
+  for (auto function : functions) {
+    // Watches are not moved over when a function is recompiled.
+    function = static_cast<GuestFunction*>(function->current());
+    function->set_invalidated(true);
+    backend_->UnlinkFunction(function);
+  }
+  XELOGCPU("Guest code write at %.8X invalidated %d functions", address,
+           int(functions.size()));
+}
+
+void Processor::RetranslateIfInvalidated(GuestFunction* function) {
+  std::lock_guard<xe::mutex> guard(recompile_lock_);
+  if (function->replacement() || !function->is_invalidated()) {
+    // Another thread got here first.
+    return;
+  }
+  // Watch before translating so that writes made while we read the code
+  // invalidate the result.
+  function->set_invalidated(false);
+  function->set_decoded_instrs(nullptr);
+  WatchFunctionCode(function);
+  auto new_function = RecompileFunction(function);
+  if (!new_function) {
+    XELOGE("Unable to retranslate modified function %.8X",
+           function->address());
+    return;
+  }
+  if (function->is_invalidated()) {
+    // Written again while translating; our code was stale on arrival.
+    new_function->set_invalidated(true);
+    backend_->UnlinkFunction(new_function);
+  }
+}
+
+GuestFunction* Processor::RecompileFunction(GuestFunction* function) {
+  auto new_function = frontend_->RecompileFunction(function, debug_info_flags_);
+  if (!new_function) {
+    return nullptr;
+  }
+  // The new code is already in the indirection table; now make every lookup
+  // return the new function too. The old function and its code are never
+  // freed as threads may be inside them, or about to be from a stale
+  // lookup, at any time.
+  auto result = new_function.get();
+  function->module()->ReplaceFunction(function, std::move(new_function));
+  auto entry = entry_table_.Get(function->address());
+  if (entry) {
+    entry->function = result;
+  }
+  return result;
+}
+
+void Processor::CompileThreadMain() {
+  while (true) {
+    GuestFunction* function = nullptr;
+    uint32_t precompile_address = 0;
+    {
+      std::unique_lock<std::mutex> lock(compile_queue_mutex_);
+      compile_queue_cond_.wait(lock, [this]() {
+        return !compile_threads_running_ || !compile_queue_.empty() ||
+               !precompile_queue_.empty();
+      });
+      if (!compile_threads_running_) {
+        return;
+      }
+      if (!compile_queue_.empty()) {
+        function = compile_queue_.front();
+        compile_queue_.pop_front();
+      } else {
+        precompile_address = precompile_queue_.front();
+        precompile_queue_.pop_front();
+      }
+    }
+
+    if (!function) {
+      // The entry table serializes us with any guest thread demanding the
+      // same function. Failures are reported again if it is ever called.
+      ResolveFunction(precompile_address);
+      continue;
+    }
+
+    std::lock_guard<xe::mutex> guard(recompile_lock_);
+    auto current = static_cast<GuestFunction*>(function->current());
+    if (current != function) {
+      // Requested by code that has since been replaced. Only MMIO access
+      // sites found in it after the replacement was translated still need
+      // a recompile.
+      bool has_new_sites = false;
+      for (auto site : function->mmio_access_sites()) {
+        has_new_sites |= current->AddMMIOAccessSite(site);
+      }
+      if (!has_new_sites) {
+        continue;
+      }
+    }
+    // On failure the current code just keeps being used.
+    if (!RecompileFunction(current)) {
+      XELOGW("Unable to recompile function %.8X", current->address());
+    }
+  }
+}
+
 bool Processor::Execute(ThreadState* thread_state, uint32_t address) {
   SCOPE_profile_cpu_f("cpu");
 
@@ -327,6 +586,41 @@ uint64_t Processor::Execute(ThreadState* thread_state, uint32_t address,
   return context->r[3];
 }
 
+ThreadState* Processor::AcquireThreadState(uint32_t thread_id,
+                                           uint32_t stack_size,
+                                           uint32_t pcr_address) {
+  {
+    std::lock_guard<xe::mutex> guard(thread_state_pool_lock_);
+    // Most recently recycled first; its stack is more likely to be cached.
+    for (auto it = thread_state_pool_.rbegin(); it != thread_state_pool_.rend();
+         ++it) {
+      auto thread_state = *it;
+      if (thread_state->stack_size() == stack_size) {
+        thread_state_pool_.erase(std::next(it).base());
+        thread_state->Reset(thread_id, pcr_address);
+        return thread_state;
+      }
+    }
+  }
+  return new ThreadState(this, thread_id, ThreadStackType::kUserStack, 0,
+                         stack_size, pcr_address);
+}
+
+void Processor::RecycleThreadState(ThreadState* thread_state) {
+  if (ThreadState::Get() == thread_state) {
+    ThreadState::Bind(nullptr);
+  }
+  if (thread_state->owns_stack() &&
+      thread_state->stack_type() == ThreadStackType::kUserStack) {
+    std::lock_guard<xe::mutex> guard(thread_state_pool_lock_);
+    if (thread_state_pool_.size() < size_t(FLAGS_thread_state_pool_size)) {
+      thread_state_pool_.push_back(thread_state);
+      return;
+    }
+  }
+  delete thread_state;
+}
+
 Irql Processor::RaiseIrql(Irql new_value) {
   return static_cast<Irql>(
       xe::atomic_exchange(static_cast<uint32_t>(new_value),
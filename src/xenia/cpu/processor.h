@@ -10,12 +10,16 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/entry_table.h"
 #include "xenia/cpu/export_resolver.h"
@@ -81,15 +85,55 @@ class Processor {
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
 
+  // Queues a function to be recompiled at its next tier on a background
+  // compile thread. The function remains usable in the meantime.
+  void QueueFunctionRecompile(GuestFunction* function);
+  // Queues functions to be scanned and compiled ahead of their first call on
+  // the background compile threads. Queued recompiles take priority.
+  void QueueFunctionPrecompile(const std::vector<uint32_t>& addresses);
+
   bool Execute(ThreadState* thread_state, uint32_t address);
   uint64_t Execute(ThreadState* thread_state, uint32_t address, uint64_t args[],
                    size_t arg_count);
 
+  // Returns a thread state with a user stack of stack_size. Stacks of exited
+  // threads are reused when one of the same size has been recycled.
+  ThreadState* AcquireThreadState(uint32_t thread_id, uint32_t stack_size,
+                                  uint32_t pcr_address);
+  // Takes ownership of the thread state of an exited thread, keeping it for
+  // AcquireThreadState if the pool has room and deleting it otherwise.
+  void RecycleThreadState(ThreadState* thread_state);
+
   Irql RaiseIrql(Irql new_value);
   void LowerIrql(Irql old_value);
 
+  // Delivers the APCs pending for the calling guest thread, as exports do
+  // when they release a lock. Set by the kernel; exports that the backend
+  // inlines call it in place of the shim.
+  GuestFunction::ExternHandler check_apcs_handler() const {
+    return check_apcs_handler_;
+  }
+  void set_check_apcs_handler(GuestFunction::ExternHandler handler) {
+    check_apcs_handler_ = handler;
+  }
+
  private:
   bool DemandFunction(Function* function);
+  void CompileThreadMain();
+  // Records the guest load/store at host_pc as touching MMIO and recompiles
+  // its function so that it stops faulting.
+  void OnMMIOAccessFault(uint64_t host_pc);
+  // Write protects the guest code of a translated function so that changes
+  // to it invalidate the translation.
+  void WatchFunctionCode(GuestFunction* function);
+  // Invalidates all functions with code in the watched page containing the
+  // given address. Called from the write fault handler.
+  void OnCodeWritten(uint32_t address);
+  // Retranslates the function if its code was written to.
+  void RetranslateIfInvalidated(GuestFunction* function);
+  // Translates the function again and publishes the result in its place,
+  // returning the new function. recompile_lock_ must be held.
+  GuestFunction* RecompileFunction(GuestFunction* function);
 
   Memory* memory_ = nullptr;
   debug::Debugger* debugger_ = nullptr;
@@ -108,6 +152,35 @@ class Processor {
   uint32_t next_builtin_address_ = 0xFFFF0000u;
 
   Irql irql_;
+  GuestFunction::ExternHandler check_apcs_handler_ = nullptr;
+
+  // Background recompilation of hot functions.
+  std::vector<std::unique_ptr<xe::threading::Thread>> compile_threads_;
+  std::mutex compile_queue_mutex_;
+  std::condition_variable compile_queue_cond_;
+  std::deque<GuestFunction*> compile_queue_;
+  std::deque<uint32_t> precompile_queue_;
+  bool compile_threads_running_ = false;
+
+  // Guest code pages that are write protected, by page address.
+  // Watches are one-shot: a write drops the watch of its page and every
+  // function touching it, and retranslation watches the page again.
+  // Host page granularity, so that writes to data sharing a 64KB guest page
+  // with code only invalidate the functions they are near.
+  static const uint32_t kCodeWatchPageSize = 4 * 1024;
+  struct CodeWatchPage {
+    uintptr_t watch_handle = 0;
+    std::vector<GuestFunction*> functions;
+  };
+  xe::mutex code_watch_lock_;
+  std::unordered_map<uint32_t, CodeWatchPage> code_watch_pages_;
+  // Serializes recompiles, so that each function is only replaced once and
+  // always by a recompile of the function currently published.
+  xe::mutex recompile_lock_;
+
+  // Thread states of exited threads, up to --thread_state_pool_size.
+  xe::mutex thread_state_pool_lock_;
+  std::vector<ThreadState*> thread_state_pool_;
 };
 
 }  // namespace cpu
@@ -55,8 +55,22 @@ struct StackFrame {
   };
 };
 
+// Registers and the top of the stack of a thread, copied while it was
+// suspended so that it can be walked after the thread has been resumed.
+struct StackSnapshot {
+  static const size_t kMaxStackSize = 32 * 1024;
+
+  X64Context context;
+  // Host address the stack bytes were copied from, the thread's rsp.
+  uint64_t stack_address;
+  size_t stack_size;
+  uint8_t stack[kMaxStackSize];
+};
+
 class StackWalker {
  public:
+  virtual ~StackWalker() = default;
+
   // Creates a stack walker. Only one should exist within a process.
   static std::unique_ptr<StackWalker> Create(backend::CodeCache* code_cache);
 
@@ -85,6 +99,19 @@ class StackWalker {
                                    X64Context* out_host_context,
                                    uint64_t* out_stack_hash = nullptr) = 0;
 
+  // Copies the registers and stack of the given thread, referenced by native
+  // thread handle, into out_snapshot. The thread must be suspended. Nothing
+  // is allocated and no locks are taken, so unlike CaptureStackTrace this is
+  // safe whatever locks (heap, loader) the thread was holding.
+  virtual bool CaptureStackSnapshot(void* thread_handle,
+                                    StackSnapshot* out_snapshot) = 0;
+  // Walks a snapshot taken by CaptureStackSnapshot, reading only the copied
+  // stack. The thread may be running again.
+  // Returns the number of frames captured.
+  virtual size_t WalkStackSnapshot(const StackSnapshot& snapshot,
+                                   uint64_t* frame_host_pcs,
+                                   size_t frame_count) = 0;
+
   // Resolves symbol information for the given stack frames.
   // Each frame provided must have host_pc set, and all other fields will be
   // populated.
@@ -0,0 +1,472 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/stack_walker.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <ucontext.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>  // NOLINT(build/include_order)
+
+#include "xenia/base/logging.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+
+class PosixStackWalker : public StackWalker {
+ public:
+  explicit PosixStackWalker(backend::CodeCache* code_cache) {
+    // Get the boundaries of the code cache so we can quickly tell if a frame
+    // is ours or not.
+    code_cache_ = code_cache;
+    code_cache_min_ = code_cache_->base_address();
+    code_cache_max_ = code_cache_->base_address() + code_cache_->total_size();
+  }
+
+  ~PosixStackWalker() override {
+    if (installed_) {
+      sigaction(capture_signal(), &previous_action_, nullptr);
+      sem_destroy(&capture_done_);
+    }
+    instance_ = nullptr;
+  }
+
+  bool Initialize() {
+    // Captures from other threads run in a signal handler on that thread, as
+    // there is no way to read the registers of another thread otherwise.
+    if (sem_init(&capture_done_, 0, 0)) {
+      XELOGE("Unable to create stack capture semaphore");
+      return false;
+    }
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = CaptureSignalHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(capture_signal(), &action, &previous_action_)) {
+      XELOGE("Unable to install stack capture signal handler");
+      sem_destroy(&capture_done_);
+      return false;
+    }
+    installed_ = true;
+    instance_ = this;
+    return true;
+  }
+
+  size_t CaptureStackTrace(uint64_t* frame_host_pcs, size_t frame_offset,
+                           size_t frame_count,
+                           uint64_t* out_stack_hash) override {
+    unw_context_t context;
+    unw_cursor_t cursor;
+    if (unw_getcontext(&context) || unw_init_local(&cursor, &context)) {
+      return 0;
+    }
+    // Skip ourselves.
+    return WalkStack(&cursor, frame_host_pcs, frame_offset + 1, frame_count,
+                     out_stack_hash);
+  }
+
+  size_t CaptureStackTrace(void* thread_handle, uint64_t* frame_host_pcs,
+                           size_t frame_offset, size_t frame_count,
+                           X64Context* out_host_context,
+                           uint64_t* out_stack_hash) override {
+    // The handle is the pthread_t of the thread. It is interrupted with a
+    // signal and walks its own stack from the interrupted context, so it
+    // must not be blocked in a way that defers signals.
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    request_.frame_host_pcs = frame_host_pcs;
+    request_.frame_offset = frame_offset;
+    request_.frame_count = frame_count;
+    request_.out_host_context = out_host_context;
+    request_.snapshot = nullptr;
+    if (!RunCapture(reinterpret_cast<pthread_t>(thread_handle))) {
+      return 0;
+    }
+    if (out_stack_hash) {
+      *out_stack_hash = request_.stack_hash;
+    }
+    return request_.captured_count;
+  }
+
+  bool CaptureStackSnapshot(void* thread_handle,
+                            StackSnapshot* out_snapshot) override {
+    // Copy no further than the end of the thread's stack. This has to be
+    // looked up here as it isn't safe in the signal handler.
+    auto thread = reinterpret_cast<pthread_t>(thread_handle);
+    pthread_attr_t attr;
+    if (pthread_getattr_np(thread, &attr)) {
+      return false;
+    }
+    void* stack_low;
+    size_t stack_size;
+    int result = pthread_attr_getstack(&attr, &stack_low, &stack_size);
+    pthread_attr_destroy(&attr);
+    if (result) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    request_.frame_host_pcs = nullptr;
+    request_.frame_offset = 0;
+    request_.frame_count = 0;
+    request_.out_host_context = nullptr;
+    request_.snapshot = out_snapshot;
+    request_.stack_end = uint64_t(stack_low) + stack_size;
+    return RunCapture(thread) && request_.captured_count;
+  }
+
+  // libunwind only walks live stacks, so generated code frames are walked
+  // with their unwind info and host code is skipped by scanning the copied
+  // stack for the next return address into generated code. Only the
+  // innermost of consecutive host frames is reported.
+  size_t WalkStackSnapshot(const StackSnapshot& snapshot,
+                           uint64_t* frame_host_pcs,
+                           size_t frame_count) override {
+    auto read_stack = [&snapshot](uint64_t address, uint64_t* out_value) {
+      if (address < snapshot.stack_address ||
+          address + 8 > snapshot.stack_address + snapshot.stack_size) {
+        return false;
+      }
+      std::memcpy(out_value,
+                  snapshot.stack + (address - snapshot.stack_address), 8);
+      return true;
+    };
+    auto is_generated_code = [this](uint64_t pc) {
+      return pc >= code_cache_min_ && pc < code_cache_max_ &&
+             code_cache_->LookupUnwindInfo(pc);
+    };
+    uint64_t ip = snapshot.context.rip;
+    uint64_t sp = snapshot.context.int_registers.rsp;
+    size_t frame_index = 0;
+    while (frame_index < frame_count && ip) {
+      frame_host_pcs[frame_index++] = ip;
+      if (ip >= code_cache_min_ && ip < code_cache_max_) {
+        auto unwind_info = reinterpret_cast<backend::CodeUnwindInfo*>(
+            code_cache_->LookupUnwindInfo(ip));
+        if (!unwind_info) {
+          // Thunk or data we have no info for.
+          break;
+        }
+        uint64_t return_address_slot = sp;
+        if (ip >= unwind_info->prolog_end &&
+            !IsInEpilog(ip, unwind_info->stack_size)) {
+          return_address_slot += unwind_info->stack_size;
+        }
+        if (!read_stack(return_address_slot, &ip)) {
+          break;
+        }
+        sp = return_address_slot + 8;
+      } else {
+        uint64_t value = 0;
+        while (read_stack(sp, &value) && !is_generated_code(value)) {
+          sp += 8;
+        }
+        if (!is_generated_code(value)) {
+          break;
+        }
+        ip = value;
+        sp += 8;
+      }
+    }
+    return frame_index;
+  }
+
+  bool ResolveStack(uint64_t* frame_host_pcs, StackFrame* frames,
+                    size_t frame_count) override {
+    for (size_t i = 0; i < frame_count; ++i) {
+      auto& frame = frames[i];
+      std::memset(&frame, 0, sizeof(frame));
+      frame.host_pc = frame_host_pcs[i];
+
+      // If in the generated range, we know it's ours.
+      if (frame.host_pc >= code_cache_min_ && frame.host_pc < code_cache_max_) {
+        // Guest symbol, so we can look it up quickly in the code cache.
+        frame.type = StackFrame::Type::kGuest;
+        auto function = code_cache_->LookupFunction(frame.host_pc);
+        if (function) {
+          frame.guest_symbol.function = function;
+          // Figure out where in guest code we are by looking up the
+          // displacement in x64 from the JIT'ed code start to the PC.
+          if (function->is_guest()) {
+            auto guest_function = static_cast<GuestFunction*>(function);
+            uint32_t host_displacement =
+                uint32_t(frame.host_pc) -
+                uint32_t(uint64_t(guest_function->machine_code()));
+            SourceMapEntry entry;
+            if (guest_function->LookupCodeOffset(host_displacement, &entry)) {
+              frame.guest_pc = entry.source_offset;
+            }
+          }
+        } else {
+          frame.guest_symbol.function = nullptr;
+        }
+      } else {
+        // Host symbol, which means either emulator or system. Only exported
+        // symbols can be named this way.
+        frame.type = StackFrame::Type::kHost;
+        Dl_info info;
+        if (dladdr(reinterpret_cast<void*>(frame.host_pc), &info) &&
+            info.dli_sname) {
+          frame.host_symbol.address = uint64_t(info.dli_saddr);
+          std::strncpy(frame.host_symbol.name, info.dli_sname,
+                       sizeof(frame.host_symbol.name) - 1);
+        }
+      }
+    }
+    return true;
+  }
+
+ private:
+  enum {
+    kCaptureIdle,
+    kCapturePending,
+    kCaptureClaimed,
+  };
+  // Pending capture, filled in by the signal handler on the target thread.
+  struct CaptureRequest {
+    uint64_t* frame_host_pcs;
+    size_t frame_offset;
+    size_t frame_count;
+    X64Context* out_host_context;
+    // If set, the registers and stack are copied here instead of walked.
+    StackSnapshot* snapshot;
+    uint64_t stack_end;
+    uint64_t stack_hash;
+    size_t captured_count;
+    std::atomic<int> state = {kCaptureIdle};
+  };
+
+  static const int kCaptureTimeoutSeconds = 1;
+
+  // Signals the thread to carry out request_ and waits for it to finish.
+  // capture_mutex_ must be held.
+  bool RunCapture(pthread_t thread) {
+    request_.stack_hash = 0;
+    request_.captured_count = 0;
+    request_.state = kCapturePending;
+    if (pthread_kill(thread, capture_signal())) {
+      XELOGE("Unable to signal thread for stack walk");
+      request_.state = kCaptureIdle;
+      return false;
+    }
+
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += kCaptureTimeoutSeconds;
+    while (sem_timedwait(&capture_done_, &deadline)) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Withdraw the request so a late signal leaves our buffers alone. If
+      // the handler has already claimed it we have to wait it out.
+      int expected = kCapturePending;
+      if (request_.state.compare_exchange_strong(expected, kCaptureIdle)) {
+        XELOGE("Timed out waiting for thread stack walk");
+        return false;
+      }
+      while (sem_wait(&capture_done_) && errno == EINTR) {
+      }
+      break;
+    }
+    request_.state = kCaptureIdle;
+    return true;
+  }
+  // SIGRTMIN is not a constant expression.
+  static int capture_signal() { return SIGRTMIN + 1; }
+
+  static void CaptureSignalHandler(int signal, siginfo_t* info,
+                                   void* raw_context) {
+    auto walker = instance_;
+    if (!walker) {
+      return;
+    }
+    auto& request = walker->request_;
+    int expected = kCapturePending;
+    if (!request.state.compare_exchange_strong(expected, kCaptureClaimed)) {
+      // Late signal for a capture that timed out.
+      return;
+    }
+    int saved_errno = errno;
+    auto context = reinterpret_cast<ucontext_t*>(raw_context);
+    if (request.snapshot) {
+      auto snapshot = request.snapshot;
+      CopyHostContext(context, &snapshot->context);
+      uint64_t rsp = snapshot->context.int_registers.rsp;
+      snapshot->stack_address = rsp;
+      snapshot->stack_size =
+          rsp < request.stack_end
+              ? size_t(std::min(uint64_t(StackSnapshot::kMaxStackSize),
+                                request.stack_end - rsp))
+              : 0;
+      std::memcpy(snapshot->stack, reinterpret_cast<const void*>(rsp),
+                  snapshot->stack_size);
+      request.captured_count = 1;
+      sem_post(&walker->capture_done_);
+      errno = saved_errno;
+      return;
+    }
+    if (request.out_host_context) {
+      CopyHostContext(context, request.out_host_context);
+    }
+    // On x86-64 unw_context_t is a ucontext_t, so we can start right at the
+    // interrupted instruction.
+    unw_cursor_t cursor;
+    if (!unw_init_local2(&cursor, reinterpret_cast<unw_context_t*>(context),
+                         UNW_INIT_SIGNAL_FRAME)) {
+      request.captured_count =
+          walker->WalkStack(&cursor, request.frame_host_pcs,
+                            request.frame_offset, request.frame_count,
+                            &request.stack_hash);
+    }
+    sem_post(&walker->capture_done_);
+    errno = saved_errno;
+  }
+
+  static void CopyHostContext(const ucontext_t* context,
+                              X64Context* out_host_context) {
+    auto gregs = context->uc_mcontext.gregs;
+    out_host_context->rip = gregs[REG_RIP];
+    out_host_context->eflags = uint32_t(gregs[REG_EFL]);
+    auto& int_registers = out_host_context->int_registers;
+    int_registers.rax = gregs[REG_RAX];
+    int_registers.rcx = gregs[REG_RCX];
+    int_registers.rdx = gregs[REG_RDX];
+    int_registers.rbx = gregs[REG_RBX];
+    int_registers.rsp = gregs[REG_RSP];
+    int_registers.rbp = gregs[REG_RBP];
+    int_registers.rsi = gregs[REG_RSI];
+    int_registers.rdi = gregs[REG_RDI];
+    int_registers.r8 = gregs[REG_R8];
+    int_registers.r9 = gregs[REG_R9];
+    int_registers.r10 = gregs[REG_R10];
+    int_registers.r11 = gregs[REG_R11];
+    int_registers.r12 = gregs[REG_R12];
+    int_registers.r13 = gregs[REG_R13];
+    int_registers.r14 = gregs[REG_R14];
+    int_registers.r15 = gregs[REG_R15];
+    if (context->uc_mcontext.fpregs) {
+      std::memcpy(&out_host_context->xmm_registers.values,
+                  context->uc_mcontext.fpregs->_xmm,
+                  sizeof(out_host_context->xmm_registers.values));
+    }
+  }
+
+  // Whether the instruction at pc runs after the frame has been freed: the
+  // ret, jmp rel32 or jmp rax that follows the add rsp of an epilog.
+  static bool IsInEpilog(uint64_t pc, uint32_t stack_size) {
+    auto code = reinterpret_cast<const uint8_t*>(pc);
+    if (code[0] != 0xC3 && code[0] != 0xE9 &&
+        !(code[0] == 0xFF && code[1] == 0xE0)) {
+      return false;
+    }
+    if (stack_size <= 0x7F) {
+      // add rsp, imm8
+      return code[-4] == 0x48 && code[-3] == 0x83 && code[-2] == 0xC4 &&
+             code[-1] == stack_size;
+    }
+    // add rsp, imm32
+    uint32_t imm32;
+    std::memcpy(&imm32, code - 4, sizeof(imm32));
+    return code[-7] == 0x48 && code[-6] == 0x81 && code[-5] == 0xC4 &&
+           imm32 == stack_size;
+  }
+
+  // Walks from the frame the cursor is at. Host frames are stepped by
+  // libunwind and generated code frames by the code cache unwind info, after
+  // which libunwind picks up again from the caller.
+  // Only safe registers (rip, rsp) are recovered across generated code, which
+  // is fine as long as host code does not need rbp to find its frames.
+  size_t WalkStack(unw_cursor_t* cursor, uint64_t* frame_host_pcs,
+                   size_t frame_offset, size_t frame_count,
+                   uint64_t* out_stack_hash) {
+    uint64_t stack_hash = 0;
+    size_t frame_index = 0;
+    while (frame_index < frame_offset + frame_count) {
+      unw_word_t ip;
+      unw_word_t sp;
+      if (unw_get_reg(cursor, UNW_REG_IP, &ip) ||
+          unw_get_reg(cursor, UNW_REG_SP, &sp) || !ip) {
+        break;
+      }
+      if (frame_index >= frame_offset) {
+        frame_host_pcs[frame_index - frame_offset] = ip;
+        // FNV-1a over the PCs, for deduping.
+        stack_hash = (stack_hash ^ ip) * 0x100000001B3ull;
+      }
+      ++frame_index;
+
+      if (ip >= code_cache_min_ && ip < code_cache_max_) {
+        auto unwind_info = reinterpret_cast<backend::CodeUnwindInfo*>(
+            code_cache_->LookupUnwindInfo(ip));
+        if (!unwind_info) {
+          // Thunk or data we have no info for.
+          break;
+        }
+        uint64_t return_address_slot = sp;
+        if (ip >= unwind_info->prolog_end &&
+            !IsInEpilog(ip, unwind_info->stack_size)) {
+          return_address_slot += unwind_info->stack_size;
+        }
+        unw_word_t caller_ip =
+            *reinterpret_cast<const uint64_t*>(return_address_slot);
+        if (unw_set_reg(cursor, UNW_REG_IP, caller_ip) ||
+            unw_set_reg(cursor, UNW_REG_SP, return_address_slot + 8)) {
+          break;
+        }
+      } else if (unw_step(cursor) <= 0) {
+        break;
+      }
+    }
+    if (out_stack_hash) {
+      *out_stack_hash = stack_hash;
+    }
+    return frame_index > frame_offset ? frame_index - frame_offset : 0;
+  }
+
+  static PosixStackWalker* instance_;
+
+  backend::CodeCache* code_cache_ = nullptr;
+  uint32_t code_cache_min_ = 0;
+  uint32_t code_cache_max_ = 0;
+
+  bool installed_ = false;
+  struct sigaction previous_action_;
+  // Only one capture from another thread can be in flight at a time.
+  std::mutex capture_mutex_;
+  CaptureRequest request_;
+  sem_t capture_done_;
+};
+
+PosixStackWalker* PosixStackWalker::instance_ = nullptr;
+
+std::unique_ptr<StackWalker> StackWalker::Create(
+    backend::CodeCache* code_cache) {
+  auto stack_walker = std::make_unique<PosixStackWalker>(code_cache);
+  if (!stack_walker->Initialize()) {
+    XELOGE("Unable to initialize stack walker");
+    return nullptr;
+  }
+  return std::unique_ptr<StackWalker>(stack_walker.release());
+}
+
+}  // namespace cpu
+}  // namespace xe
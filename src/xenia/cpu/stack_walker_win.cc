@@ -11,6 +11,8 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cstring>
 #include <mutex>
 
 #include "xenia/base/logging.h"
@@ -202,6 +204,70 @@ class Win32StackWalker : public StackWalker {
     return frame_index - frame_offset;
   }
 
+  bool CaptureStackSnapshot(void* thread_handle,
+                            StackSnapshot* out_snapshot) override {
+    CONTEXT thread_context;
+    thread_context.ContextFlags = CONTEXT_FULL;
+    if (!GetThreadContext(thread_handle, &thread_context)) {
+      return false;
+    }
+    auto& context = out_snapshot->context;
+    context.rip = thread_context.Rip;
+    context.eflags = thread_context.EFlags;
+    std::memcpy(&context.int_registers.values, &thread_context.Rax,
+                sizeof(context.int_registers.values));
+    std::memcpy(&context.xmm_registers.values, &thread_context.Xmm0,
+                sizeof(context.xmm_registers.values));
+
+    // Copy no further than the end of the stack reservation.
+    MEMORY_BASIC_INFORMATION memory_info;
+    if (!VirtualQuery(reinterpret_cast<void*>(thread_context.Rsp),
+                      &memory_info, sizeof(memory_info))) {
+      return false;
+    }
+    uint64_t region_end = uint64_t(memory_info.BaseAddress) +
+                          uint64_t(memory_info.RegionSize);
+    out_snapshot->stack_address = thread_context.Rsp;
+    out_snapshot->stack_size =
+        size_t(std::min(uint64_t(StackSnapshot::kMaxStackSize),
+                        region_end - thread_context.Rsp));
+    std::memcpy(out_snapshot->stack,
+                reinterpret_cast<const void*>(thread_context.Rsp),
+                out_snapshot->stack_size);
+    return true;
+  }
+
+  size_t WalkStackSnapshot(const StackSnapshot& snapshot,
+                           uint64_t* frame_host_pcs,
+                           size_t frame_count) override {
+    CONTEXT thread_context = {0};
+    thread_context.ContextFlags = CONTEXT_FULL;
+    thread_context.Rip = snapshot.context.rip;
+    thread_context.EFlags = snapshot.context.eflags;
+    std::memcpy(&thread_context.Rax, &snapshot.context.int_registers.values,
+                sizeof(snapshot.context.int_registers.values));
+
+    STACKFRAME64 stack_frame = {0};
+    stack_frame.AddrPC.Mode = AddrModeFlat;
+    stack_frame.AddrPC.Offset = thread_context.Rip;
+    stack_frame.AddrFrame.Mode = AddrModeFlat;
+    stack_frame.AddrFrame.Offset = thread_context.Rbp;
+    stack_frame.AddrStack.Mode = AddrModeFlat;
+    stack_frame.AddrStack.Offset = thread_context.Rsp;
+
+    walking_snapshot_ = &snapshot;
+    size_t frame_index = 0;
+    while (frame_index < frame_count &&
+           stack_walk_64_(IMAGE_FILE_MACHINE_AMD64, GetCurrentProcess(),
+                          GetCurrentThread(), &stack_frame, &thread_context,
+                          ReadSnapshotMemory, XSymFunctionTableAccess64,
+                          XSymGetModuleBase64, nullptr) == TRUE) {
+      frame_host_pcs[frame_index++] = stack_frame.AddrPC.Offset;
+    }
+    walking_snapshot_ = nullptr;
+    return frame_index;
+  }
+
   bool ResolveStack(uint64_t* frame_host_pcs, StackFrame* frames,
                     size_t frame_count) override {
     // TODO(benvanik): collect symbols to resolve with dbghelp and resolve
@@ -227,8 +293,10 @@ class Win32StackWalker : public StackWalker {
             uint32_t host_displacement =
                 uint32_t(frame.host_pc) -
                 uint32_t(uint64_t(guest_function->machine_code()));
-            auto entry = guest_function->LookupCodeOffset(host_displacement);
-            frame.guest_pc = entry->source_offset;
+            SourceMapEntry entry;
+            if (guest_function->LookupCodeOffset(host_displacement, &entry)) {
+              frame.guest_pc = entry.source_offset;
+            }
           }
         } else {
           frame.guest_symbol.function = nullptr;
@@ -269,6 +337,29 @@ class Win32StackWalker : public StackWalker {
     return sym_function_table_access_64_(hProcess, AddrBase);
   }
 
+  // Reads stack memory from the snapshot being walked and everything else
+  // (code, unwind data) from the process.
+  static BOOL CALLBACK ReadSnapshotMemory(HANDLE process, DWORD64 address,
+                                          PVOID buffer, DWORD size,
+                                          LPDWORD out_bytes_read) {
+    auto snapshot = walking_snapshot_;
+    uint64_t stack_end = snapshot->stack_address + snapshot->stack_size;
+    if (address >= snapshot->stack_address && address < stack_end) {
+      if (address + size > stack_end) {
+        return FALSE;
+      }
+      std::memcpy(buffer,
+                  snapshot->stack + (address - snapshot->stack_address), size);
+      *out_bytes_read = size;
+      return TRUE;
+    }
+    SIZE_T bytes_read = 0;
+    BOOL result = ReadProcessMemory(process, reinterpret_cast<void*>(address),
+                                    buffer, size, &bytes_read);
+    *out_bytes_read = DWORD(bytes_read);
+    return result;
+  }
+
   static DWORD64 WINAPI XSymGetModuleBase64(_In_ HANDLE hProcess,
                                             _In_ DWORD64 dwAddr) {
     if (dwAddr >= code_cache_min_ && dwAddr < code_cache_max_) {
@@ -282,11 +373,15 @@ class Win32StackWalker : public StackWalker {
 
   std::mutex dbghelp_mutex_;
 
+  static thread_local const StackSnapshot* walking_snapshot_;
+
   static xe::cpu::backend::CodeCache* code_cache_;
   static uint32_t code_cache_min_;
   static uint32_t code_cache_max_;
 };
 
+thread_local const StackSnapshot* Win32StackWalker::walking_snapshot_ =
+    nullptr;
 xe::cpu::backend::CodeCache* Win32StackWalker::code_cache_ = nullptr;
 uint32_t Win32StackWalker::code_cache_min_ = 0;
 uint32_t Win32StackWalker::code_cache_max_ = 0;
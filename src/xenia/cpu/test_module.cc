@@ -49,6 +49,8 @@ TestModule::TestModule(Processor* processor, const std::string& name,
   compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  compiler_->AddPass(std::make_unique<passes::ByteSwapEliminationPass>(
+      processor->backend()->machine_info()));
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
 
   //// Removes all unneeded variables. Try not to add new ones after this.
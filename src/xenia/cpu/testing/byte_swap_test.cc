@@ -44,3 +44,18 @@ TEST_CASE("BYTE_SWAP_V128", "[instr]") {
                     vec128i(0x0F10130C, 0x0B0C0D0E, 0x0000000A, 0x00000000));
           });
 }
+
+TEST_CASE("BYTE_SWAP_I32_AND", "[instr]") {
+  // Both swaps are removed and the mask is applied in guest byte order.
+  TestFunction([](HIRBuilder& b) {
+    auto v = b.ByteSwap(b.Truncate(LoadGPR(b, 4), INT32_TYPE));
+    v = b.And(v, b.LoadConstantUint32(0x0000FF00));
+    StoreGPR(b, 3, b.ZeroExtend(b.ByteSwap(v), INT64_TYPE));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) { ctx->r[4] = 0x11223344; },
+           [](PPCContext* ctx) {
+             auto result = ctx->r[3];
+             REQUIRE(result == 0x00220000);
+           });
+}
@@ -0,0 +1,88 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::compiler::Compiler;
+using xe::cpu::compiler::passes::DeadStoreEliminationPass;
+using xe::cpu::frontend::PPCContext;
+
+// Runs only DeadStoreEliminationPass over the HIR built by generator and
+// returns the number of context stores left to the given offset.
+size_t CountStoresAfterDSE(std::function<void(HIRBuilder& b)> generator,
+                           size_t offset) {
+  xe::Memory memory;
+  memory.Initialize();
+  Processor processor(&memory, nullptr, nullptr);
+  processor.Setup();
+  Compiler compiler(&processor);
+  compiler.AddPass(std::make_unique<DeadStoreEliminationPass>());
+
+  HIRBuilder b;
+  generator(b);
+  REQUIRE(compiler.Compile(&b));
+
+  size_t count = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_STORE_CONTEXT_info &&
+          i->src1.offset == offset) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+TEST_CASE("DSE_DIAMOND_FALLTHROUGH_READ", "[passes]") {
+  // block0:
+  //   store_context r3       <-- read only on the fall-through path
+  //   branch_true r5, block2
+  // block1:
+  //   store_context r4, load_context r3
+  //   return
+  // block2:
+  //   store_context r3
+  //   return
+  size_t count = CountStoresAfterDSE(
+      [](HIRBuilder& b) {
+        auto taken_label = b.NewLabel();
+        StoreGPR(b, 3, b.LoadConstantUint64(1));
+        b.BranchTrue(LoadGPR(b, 5), taken_label);
+        StoreGPR(b, 4, LoadGPR(b, 3));
+        b.Return();
+        b.MarkLabel(taken_label);
+        StoreGPR(b, 3, b.LoadConstantUint64(2));
+        b.Return();
+      },
+      offsetof(PPCContext, r) + 3 * 8);
+  REQUIRE(count == 2);
+}
+
+TEST_CASE("DSE_DIAMOND_KILLED_ON_BOTH_PATHS", "[passes]") {
+  // The first store is overwritten on both paths before anything reads it.
+  size_t count = CountStoresAfterDSE(
+      [](HIRBuilder& b) {
+        auto taken_label = b.NewLabel();
+        StoreGPR(b, 3, b.LoadConstantUint64(1));
+        b.BranchTrue(LoadGPR(b, 5), taken_label);
+        StoreGPR(b, 3, b.LoadConstantUint64(2));
+        b.Return();
+        b.MarkLabel(taken_label);
+        StoreGPR(b, 3, b.LoadConstantUint64(3));
+        b.Return();
+      },
+      offsetof(PPCContext, r) + 3 * 8);
+  REQUIRE(count == 2);
+}
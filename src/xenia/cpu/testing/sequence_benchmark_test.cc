@@ -0,0 +1,115 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::frontend::PPCContext;
+
+// Hidden from the default run. Use `xenia-cpu-tests [benchmark]`.
+
+TEST_CASE("BENCHMARK_INT", "[.benchmark]") {
+  BenchmarkOp("ADD_I32", INT32_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.Add(v, v); });
+  BenchmarkOp("ADD_I64", INT64_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.Add(v, v); });
+  BenchmarkOp("MUL_I32", INT32_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.Mul(v, b.LoadConstantUint32(3));
+  });
+  BenchmarkOp("MUL_I64", INT64_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.Mul(v, b.LoadConstantUint64(3));
+  });
+  BenchmarkOp("DIV_I32", INT32_TYPE,
+              [](HIRBuilder& b, Value* v) {
+                return b.Div(v, b.LoadConstantUint32(3));
+              },
+              [](PPCContext* ctx) {
+                for (int n = 4; n < 8; ++n) {
+                  ctx->r[n] = 0x7FFFFFFF;
+                }
+              });
+  BenchmarkOp("SHL_I64", INT64_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.Shl(v, int8_t(3)); });
+  BenchmarkOp("ROTATE_LEFT_I32", INT32_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.RotateLeft(v, b.LoadConstantInt8(7));
+  });
+  BenchmarkOp("BYTE_SWAP_I32", INT32_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.ByteSwap(v); });
+  BenchmarkOp("BYTE_SWAP_I64", INT64_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.ByteSwap(v); });
+}
+
+TEST_CASE("BENCHMARK_FLOAT", "[.benchmark]") {
+  auto init = [](PPCContext* ctx) {
+    for (int n = 4; n < 8; ++n) {
+      ctx->f[n] = 1.0;
+    }
+  };
+  BenchmarkOp("ADD_F64", FLOAT64_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.Add(v, v); }, init);
+  BenchmarkOp("MUL_F64", FLOAT64_TYPE,
+              [](HIRBuilder& b, Value* v) {
+                return b.Mul(v, b.LoadConstantFloat64(1.0));
+              },
+              init);
+  BenchmarkOp("MUL_ADD_F64", FLOAT64_TYPE,
+              [](HIRBuilder& b, Value* v) {
+                return b.MulAdd(v, b.LoadConstantFloat64(1.0),
+                                b.LoadConstantFloat64(0.0));
+              },
+              init);
+  BenchmarkOp("DIV_F64", FLOAT64_TYPE,
+              [](HIRBuilder& b, Value* v) {
+                return b.Div(v, b.LoadConstantFloat64(1.0));
+              },
+              init);
+  BenchmarkOp("SQRT_F64", FLOAT64_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.Sqrt(v); }, init);
+}
+
+TEST_CASE("BENCHMARK_VECTOR", "[.benchmark]") {
+  BenchmarkOp("VECTOR_ADD_I32", VEC128_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.VectorAdd(v, v, INT32_TYPE, 0);
+  });
+  BenchmarkOp("VECTOR_MAX_I16", VEC128_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.VectorMax(v, b.LoadConstantVec128(vec128s(0x1234)), INT16_TYPE,
+                       0);
+  });
+  BenchmarkOp("VECTOR_SHL_I8", VEC128_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.VectorShl(v, b.LoadConstantVec128(vec128b(1)), INT8_TYPE);
+  });
+  BenchmarkOp("VECTOR_SHL_I8_VARIABLE", VEC128_TYPE,
+              [](HIRBuilder& b, Value* v) {
+                return b.VectorShl(v, v, INT8_TYPE);
+              });
+  BenchmarkOp("VECTOR_SHL_I32", VEC128_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.VectorShl(v, v, INT32_TYPE);
+  });
+  BenchmarkOp("PERMUTE_V128_BY_INT32", VEC128_TYPE,
+              [](HIRBuilder& b, Value* v) {
+                return b.Permute(b.LoadConstantUint32(
+                                     MakePermuteMask(0, 3, 1, 2, 0, 1, 1, 0)),
+                                 v, v, INT32_TYPE);
+              });
+  BenchmarkOp("PERMUTE_V128_BY_V128", VEC128_TYPE,
+              [](HIRBuilder& b, Value* v) {
+                return b.Permute(
+                    b.LoadConstantVec128(vec128b(3, 2, 1, 0, 7, 6, 5, 4, 11,
+                                                 10, 9, 8, 15, 14, 13, 12)),
+                    v, v, INT8_TYPE);
+              });
+  BenchmarkOp("SWIZZLE_V128", VEC128_TYPE, [](HIRBuilder& b, Value* v) {
+    return b.Swizzle(v, INT32_TYPE, MakeSwizzleMask(3, 2, 1, 0));
+  });
+  BenchmarkOp("BYTE_SWAP_V128", VEC128_TYPE,
+              [](HIRBuilder& b, Value* v) { return b.ByteSwap(v); });
+}
@@ -228,3 +228,66 @@ TEST_CASE("SHL_I64", "[instr]") {
         REQUIRE(result == 0x8000000000000000ull);
       });
 }
+
+TEST_CASE("SHL_V128", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.Shl(LoadVR(b, 4), b.Truncate(LoadGPR(b, 1), INT8_TYPE)));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[1] = 0;
+        ctx->v[4] = vec128i(0x00000000, 0x80000000, 0x00000001, 0x80000000);
+      },
+      [](PPCContext* ctx) {
+        auto result1 = ctx->v[3];
+        REQUIRE(result1 ==
+                vec128i(0x00000000, 0x80000000, 0x00000001, 0x80000000));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[1] = 1;
+        ctx->v[4] = vec128i(0x00000000, 0x80000000, 0x00000001, 0x80000000);
+      },
+      [](PPCContext* ctx) {
+        auto result1 = ctx->v[3];
+        REQUIRE(result1 ==
+                vec128i(0x00000001, 0x00000000, 0x00000003, 0x00000000));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[1] = 7;
+        ctx->v[4] = vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF);
+      },
+      [](PPCContext* ctx) {
+        auto result1 = ctx->v[3];
+        REQUIRE(result1 ==
+                vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFF80));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[1] = 8;
+        ctx->v[4] = vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF);
+      },
+      [](PPCContext* ctx) {
+        auto result1 = ctx->v[3];
+        REQUIRE(result1 ==
+                vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF));
+      });
+}
+
+TEST_CASE("SHL_V128_CONSTANT", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.Shl(LoadVR(b, 4), int8_t(3)));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x00000000, 0xE0000000, 0x00000001, 0xF0000000);
+      },
+      [](PPCContext* ctx) {
+        auto result1 = ctx->v[3];
+        REQUIRE(result1 ==
+                vec128i(0x00000007, 0x00000000, 0x0000000F, 0x80000000));
+      });
+}
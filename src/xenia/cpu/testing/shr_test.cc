@@ -265,6 +265,16 @@ TEST_CASE("SHR_V128", "[instr]") {
         REQUIRE(result1 ==
                 vec128i(0x3FFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF));
       });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[1] = 1;
+        ctx->v[4] = vec128i(0x00000001, 0x00000000, 0x00000001, 0x80000000);
+      },
+      [](PPCContext* ctx) {
+        auto result1 = ctx->v[3];
+        REQUIRE(result1 ==
+                vec128i(0x00000000, 0x80000000, 0x00000000, 0xC0000000));
+      });
   test.Run(
       [](PPCContext* ctx) {
         ctx->r[1] = 8;
@@ -276,3 +286,19 @@ TEST_CASE("SHR_V128", "[instr]") {
                 vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF));
       });
 }
+
+TEST_CASE("SHR_V128_CONSTANT", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.Shr(LoadVR(b, 4), int8_t(3)));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x00000007, 0x00000000, 0x0000000F, 0x80000000);
+      },
+      [](PPCContext* ctx) {
+        auto result1 = ctx->v[3];
+        REQUIRE(result1 ==
+                vec128i(0x00000000, 0xE0000000, 0x00000001, 0xF0000000));
+      });
+}
@@ -47,3 +47,16 @@ TEST_CASE("SWIZZLE_V128", "[instr]") {
              REQUIRE(result == vec128i(1, 1, 2, 2));
            });
 }
+
+TEST_CASE("SWIZZLE_V128_CONSTANT", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    StoreVR(b, 3, b.Swizzle(b.LoadConstantVec128(vec128i(0, 1, 2, 3)),
+                            INT32_TYPE, MakeSwizzleMask(3, 2, 1, 0)));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128i(3, 2, 1, 0));
+           });
+}
@@ -10,8 +10,11 @@
 #ifndef XENIA_CPU_TESTING_UTIL_H_
 #define XENIA_CPU_TESTING_UTIL_H_
 
+#include <cstdio>
 #include <vector>
 
+#include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/main.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/frontend/ppc_context.h"
@@ -112,6 +115,122 @@ inline void StoreVR(hir::HIRBuilder& b, int reg, hir::Value* value) {
   b.StoreContext(offsetof(PPCContext, v) + reg * 16, value);
 }
 
+inline hir::Value* LoadBenchmarkValue(hir::HIRBuilder& b, int slot,
+                                      hir::TypeName type) {
+  switch (type) {
+    case hir::FLOAT32_TYPE:
+    case hir::FLOAT64_TYPE:
+      return b.LoadContext(offsetof(PPCContext, f) + slot * 8, type);
+    case hir::VEC128_TYPE:
+      return b.LoadContext(offsetof(PPCContext, v) + slot * 16, type);
+    default:
+      return b.LoadContext(offsetof(PPCContext, r) + slot * 8, type);
+  }
+}
+inline void StoreBenchmarkValue(hir::HIRBuilder& b, int slot,
+                                hir::TypeName type, hir::Value* value) {
+  switch (type) {
+    case hir::FLOAT32_TYPE:
+    case hir::FLOAT64_TYPE:
+      b.StoreContext(offsetof(PPCContext, f) + slot * 8, value);
+      break;
+    case hir::VEC128_TYPE:
+      b.StoreContext(offsetof(PPCContext, v) + slot * 16, value);
+      break;
+    default:
+      b.StoreContext(offsetof(PPCContext, r) + slot * 8, value);
+      break;
+  }
+}
+
+// Times an HIR op compiled through the real pass pipeline and backend.
+// The op is applied kUnroll times to each of chain_count values, each use
+// depending on the previous result, inside a loop that reloads the values
+// from the context every iteration. One chain measures latency; several
+// independent chains measure throughput. The loop overhead is amortized over
+// the unrolled ops but not subtracted.
+// Run with --enable_haswell_instructions=false to compare against the
+// non-AVX2 sequences.
+class BenchmarkFunction {
+ public:
+  static const int kUnroll = 16;
+  static const int kMaxChainCount = 4;
+
+  BenchmarkFunction(
+      hir::TypeName type, int chain_count,
+      std::function<hir::Value*(hir::HIRBuilder& b, hir::Value* value)> op)
+      : chain_count_(chain_count),
+        test_([type, chain_count, op](hir::HIRBuilder& b) {
+          // GPR 3 holds the remaining iteration count and the values live in
+          // the slots after it. Nothing is carried across blocks in SSA form
+          // as the test pipeline has no data flow analysis.
+          auto loop_label = b.NewLabel();
+          b.MarkLabel(loop_label);
+          hir::Value* values[kMaxChainCount];
+          for (int n = 0; n < chain_count; ++n) {
+            values[n] = LoadBenchmarkValue(b, 4 + n, type);
+          }
+          for (int i = 0; i < kUnroll; ++i) {
+            for (int n = 0; n < chain_count; ++n) {
+              values[n] = op(b, values[n]);
+            }
+          }
+          for (int n = 0; n < chain_count; ++n) {
+            StoreBenchmarkValue(b, 4 + n, type, values[n]);
+          }
+          auto count = b.Sub(LoadGPR(b, 3), b.LoadConstantUint64(1));
+          StoreGPR(b, 3, count);
+          b.BranchTrue(count, loop_label);
+          b.Return();
+        }) {
+    assert_true(chain_count > 0 && chain_count <= kMaxChainCount);
+  }
+
+  // Runs the loop for the given number of iterations and returns ns per op.
+  // pre_call initializes the values; GPR 3 is set by the benchmark.
+  double Run(uint64_t iteration_count,
+             std::function<void(PPCContext*)> pre_call) {
+    // Warm up: compiles the function and faults in the code and context.
+    test_.Run(
+        [&](PPCContext* ctx) {
+          pre_call(ctx);
+          ctx->r[3] = 1;
+        },
+        [](PPCContext* ctx) {});
+    uint64_t start_ticks = 0;
+    uint64_t end_ticks = 0;
+    test_.Run(
+        [&](PPCContext* ctx) {
+          pre_call(ctx);
+          ctx->r[3] = iteration_count;
+          start_ticks = Clock::QueryHostTickCount();
+        },
+        [&](PPCContext* ctx) { end_ticks = Clock::QueryHostTickCount(); });
+    double ns = (end_ticks - start_ticks) * 1000000000.0 /
+                Clock::host_tick_frequency();
+    return ns / (double(iteration_count) * kUnroll * chain_count_);
+  }
+
+ private:
+  int chain_count_;
+  TestFunction test_;
+};
+
+// Reports latency and throughput of the op in ns/op.
+inline void BenchmarkOp(
+    const char* name, hir::TypeName type,
+    std::function<hir::Value*(hir::HIRBuilder& b, hir::Value* value)> op,
+    std::function<void(PPCContext*)> pre_call = [](PPCContext* ctx) {}) {
+  const uint64_t kIterationCount = 1000000;
+  double latency_ns = BenchmarkFunction(type, 1, op)
+                          .Run(kIterationCount, pre_call);
+  double throughput_ns =
+      BenchmarkFunction(type, BenchmarkFunction::kMaxChainCount, op)
+          .Run(kIterationCount, pre_call);
+  std::printf("%-24s %8.3f ns/op latency %8.3f ns/op throughput\n", name,
+              latency_ns, throughput_ns);
+}
+
 }  // namespace testing
 }  // namespace cpu
 }  // namespace xe
@@ -232,6 +232,15 @@ TEST_CASE("VECTOR_ADD_I32_SAT_SIGNED", "[instr]") {
         auto result = ctx->v[3];
         REQUIRE(result == vec128i(INT32_MIN));
       });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(INT32_MAX, INT32_MIN, 0x40000000, -5);
+        ctx->v[5] = vec128i(INT32_MAX, INT32_MIN, 0x40000000, 3);
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result == vec128i(INT32_MAX, INT32_MIN, INT32_MAX, -2));
+      });
 }
 
 TEST_CASE("VECTOR_ADD_I32_SAT_UNSIGNED", "[instr]") {
@@ -258,6 +267,16 @@ TEST_CASE("VECTOR_ADD_I32_SAT_UNSIGNED", "[instr]") {
         auto result = ctx->v[3];
         REQUIRE(result == vec128i(UINT32_MAX));
       });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x80000000, 0xFFFFFFFF, 0x7FFFFFFF, 1);
+        ctx->v[5] = vec128i(0x80000000, 0, 0x7FFFFFFF, 0xFFFFFFFF);
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result == vec128i(UINT32_MAX, UINT32_MAX, 0xFFFFFFFE,
+                                  UINT32_MAX));
+      });
 }
 
 TEST_CASE("VECTOR_ADD_F32", "[instr]") {
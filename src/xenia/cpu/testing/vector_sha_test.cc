@@ -144,3 +144,54 @@ TEST_CASE("VECTOR_SHA_I32_CONSTANT", "[instr]") {
                 vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x12345678));
       });
 }
+
+TEST_CASE("VECTOR_SHA_I8_ALL_COUNTS", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.VectorSha(LoadVR(b, 4), LoadVR(b, 5), INT8_TYPE));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128b(0x80);
+        ctx->v[5] =
+            vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result == vec128b(0x80, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC, 0xFE,
+                                  0xFF, 0x80, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC,
+                                  0xFE, 0xFF));
+      });
+}
+
+TEST_CASE("VECTOR_SHA_I16_CONSTANT_MIXED", "[instr]") {
+  // Only the last count differs, so this must not take the splat path.
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.VectorSha(LoadVR(b, 4), b.LoadConstantVec128(vec128s(
+                                                1, 1, 1, 1, 1, 1, 1, 2)),
+                              INT16_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->v[4] = vec128s(0x8001); },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128s(0xC000, 0xC000, 0xC000, 0xC000, 0xC000,
+                                       0xC000, 0xC000, 0xE000));
+           });
+}
+
+TEST_CASE("VECTOR_SHA_I32_CONSTANT_MIXED", "[instr]") {
+  // Only the last count differs, so this must not take the splat path.
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.VectorSha(LoadVR(b, 4),
+                        b.LoadConstantVec128(vec128i(1, 1, 1, 2)), INT32_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->v[4] = vec128i(0x80000001); },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result ==
+                     vec128i(0xC0000000, 0xC0000000, 0xC0000000, 0xE0000000));
+           });
+}
@@ -56,6 +56,27 @@ TEST_CASE("VECTOR_SHL_I8_CONSTANT", "[instr]") {
       });
 }
 
+TEST_CASE("VECTOR_SHL_I8_FOLDED", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.VectorShl(b.LoadConstantVec128(vec128b(
+                            0x7E, 0x7E, 0x7E, 0x7F, 0x80, 0xFF, 0x01, 0x12,
+                            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00)),
+                        b.LoadConstantVec128(vec128b(0, 1, 2, 8, 4, 4, 6, 7, 8,
+                                                     9, 10, 11, 12, 13, 14,
+                                                     15)),
+                        INT8_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128b(0x7E, 0xFC, 0xF8, 0x7F, 0x00, 0xF0,
+                                       0x40, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                       0x00, 0x00, 0x00, 0x00));
+           });
+}
+
 TEST_CASE("VECTOR_SHL_I16", "[instr]") {
   TestFunction test([](HIRBuilder& b) {
     StoreVR(b, 3, b.VectorShl(LoadVR(b, 4), LoadVR(b, 5), INT16_TYPE));
@@ -144,3 +165,54 @@ TEST_CASE("VECTOR_SHL_I32_CONSTANT", "[instr]") {
                 vec128i(0x00000000, 0xFFFF0000, 0x00000002, 0x12345678));
       });
 }
+
+TEST_CASE("VECTOR_SHL_I8_ALL_COUNTS", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.VectorShl(LoadVR(b, 4), LoadVR(b, 5), INT8_TYPE));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128b(0xFF);
+        ctx->v[5] =
+            vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result == vec128b(0xFF, 0xFE, 0xFC, 0xF8, 0xF0, 0xE0, 0xC0,
+                                  0x80, 0xFF, 0xFE, 0xFC, 0xF8, 0xF0, 0xE0,
+                                  0xC0, 0x80));
+      });
+}
+
+TEST_CASE("VECTOR_SHL_I16_CONSTANT_MIXED", "[instr]") {
+  // Only the last count differs, so this must not take the splat path.
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.VectorShl(LoadVR(b, 4), b.LoadConstantVec128(vec128s(
+                                                1, 1, 1, 1, 1, 1, 1, 2)),
+                              INT16_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->v[4] = vec128s(0x8001); },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128s(0x0002, 0x0002, 0x0002, 0x0002, 0x0002,
+                                       0x0002, 0x0002, 0x0004));
+           });
+}
+
+TEST_CASE("VECTOR_SHL_I32_CONSTANT_MIXED", "[instr]") {
+  // Only the last count differs, so this must not take the splat path.
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.VectorShl(LoadVR(b, 4),
+                        b.LoadConstantVec128(vec128i(1, 1, 1, 2)), INT32_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->v[4] = vec128i(0x80000001); },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result ==
+                     vec128i(0x00000002, 0x00000002, 0x00000002, 0x00000004));
+           });
+}
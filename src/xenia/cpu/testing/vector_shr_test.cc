@@ -144,3 +144,54 @@ TEST_CASE("VECTOR_SHR_I32_CONSTANT", "[instr]") {
                 vec128i(0x00000001, 0x0000FFFF, 0x00000000, 0x12345678));
       });
 }
+
+TEST_CASE("VECTOR_SHR_I8_ALL_COUNTS", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.VectorShr(LoadVR(b, 4), LoadVR(b, 5), INT8_TYPE));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128b(0xFF);
+        ctx->v[5] =
+            vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result == vec128b(0xFF, 0x7F, 0x3F, 0x1F, 0x0F, 0x07, 0x03,
+                                  0x01, 0xFF, 0x7F, 0x3F, 0x1F, 0x0F, 0x07,
+                                  0x03, 0x01));
+      });
+}
+
+TEST_CASE("VECTOR_SHR_I16_CONSTANT_MIXED", "[instr]") {
+  // Only the last count differs, so this must not take the splat path.
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.VectorShr(LoadVR(b, 4), b.LoadConstantVec128(vec128s(
+                                                1, 1, 1, 1, 1, 1, 1, 2)),
+                              INT16_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->v[4] = vec128s(0x8001); },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128s(0x4000, 0x4000, 0x4000, 0x4000, 0x4000,
+                                       0x4000, 0x4000, 0x2000));
+           });
+}
+
+TEST_CASE("VECTOR_SHR_I32_CONSTANT_MIXED", "[instr]") {
+  // Only the last count differs, so this must not take the splat path.
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.VectorShr(LoadVR(b, 4),
+                        b.LoadConstantVec128(vec128i(1, 1, 1, 2)), INT32_TYPE));
+    b.Return();
+  });
+  test.Run([](PPCContext* ctx) { ctx->v[4] = vec128i(0x80000001); },
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result ==
+                     vec128i(0x40000000, 0x40000000, 0x40000000, 0x20000000));
+           });
+}
@@ -87,19 +87,7 @@ ThreadState::ThreadState(Processor* processor, uint32_t thread_id,
   // Allocate with 64b alignment.
   context_ = memory::AlignedAlloc<PPCContext>(64);
   assert_true(((uint64_t)context_ & 0x3F) == 0);
-  std::memset(context_, 0, sizeof(PPCContext));
-
-  // Stash pointers to common structures that callbacks may need.
-  context_->reserve_address = memory_->reserve_address();
-  context_->virtual_membase = memory_->virtual_membase();
-  context_->physical_membase = memory_->physical_membase();
-  context_->processor = processor_;
-  context_->thread_state = this;
-  context_->thread_id = thread_id_;
-
-  // Set initial registers.
-  context_->r[1] = stack_base_;
-  context_->r[13] = pcr_address_;
+  InitializeContext();
 }
 
 ThreadState::~ThreadState() {
@@ -116,6 +104,31 @@ ThreadState::~ThreadState() {
   }
 }
 
+void ThreadState::InitializeContext() {
+  std::memset(context_, 0, sizeof(PPCContext));
+
+  // Stash pointers to common structures that callbacks may need.
+  context_->virtual_membase = memory_->virtual_membase();
+  context_->physical_membase = memory_->physical_membase();
+  context_->processor = processor_;
+  context_->thread_state = this;
+  context_->thread_id = thread_id_;
+
+  // Set initial registers.
+  context_->r[1] = stack_base_;
+  context_->r[13] = pcr_address_;
+}
+
+void ThreadState::Reset(uint32_t thread_id, uint32_t pcr_address) {
+  thread_id_ = thread_id;
+  pcr_address_ = pcr_address;
+  name_.clear();
+  // Refill the stack as a fresh one would be, so the new thread doesn't see
+  // what the old one left behind. The guard page is still protected.
+  memory()->Fill(stack_limit_, stack_base_ - stack_limit_, 0xBE);
+  InitializeContext();
+}
+
 void ThreadState::Bind(ThreadState* thread_state) {
   thread_state_ = thread_state;
 }
@@ -47,11 +47,20 @@ class ThreadState {
   uint32_t pcr_address() const { return pcr_address_; }
   xe::cpu::frontend::PPCContext* context() const { return context_; }
 
+  // True if the stack was allocated by us (and is freed with us).
+  bool owns_stack() const { return stack_allocated_; }
+
+  // Readies a thread state of an exited thread for reuse by a new one. The
+  // stack is kept and refilled, and the context is cleared.
+  void Reset(uint32_t thread_id, uint32_t pcr_address);
+
   static void Bind(ThreadState* thread_state);
   static ThreadState* Get();
   static uint32_t GetThreadID();
 
  private:
+  void InitializeContext();
+
   Processor* processor_;
   Memory* memory_;
   uint32_t thread_id_;
@@ -9,7 +9,11 @@
 
 #include "xenia/cpu/xex_module.h"
 
+#include <emmintrin.h>
+
 #include <algorithm>
+#include <cstring>
+#include <map>
 
 #include "xenia/base/byte_order.h"
 #include "xenia/base/logging.h"
@@ -234,6 +238,9 @@ bool XexModule::Load(const std::string& name, const std::string& path,
 
   // Notify backend that we have an executable range.
   processor_->backend()->CommitExecutableRange(low_address_, high_address_);
+  // Attach any machine code persisted from a previous run of this module.
+  processor_->backend()->InitializeCodeCacheFile(name_, low_address_,
+                                                 high_address_);
 
   // Add all imports (variables/functions).
   xex2_opt_import_libraries* opt_import_header = nullptr;
@@ -281,6 +288,11 @@ bool XexModule::Load(const std::string& name, const std::string& path,
     }
   }
 
+  // Warm up the compile threads before the title gets to the code.
+  if (FLAGS_precompile_module_functions) {
+    PrecompileFunctions();
+  }
+
   return true;
 }
 
@@ -304,8 +316,10 @@ bool XexModule::Unload() {
 bool XexModule::SetupLibraryImports(const char* name,
                                     const xex2_import_library* library) {
   ExportResolver* kernel_resolver = nullptr;
+  auto kernel_library_id = ExportResolver::kInvalidLibraryId;
   if (kernel_state_->IsKernelModule(name)) {
     kernel_resolver = processor_->export_resolver();
+    kernel_library_id = kernel_resolver->GetLibraryId(name);
   }
 
   auto user_module = kernel_state_->GetModule(name);
@@ -333,7 +347,8 @@ bool XexModule::SetupLibraryImports(const char* name,
     uint32_t user_export_addr = 0;
 
     if (kernel_resolver) {
-      kernel_export = kernel_resolver->GetExportByOrdinal(name, ordinal);
+      kernel_export =
+          kernel_resolver->GetExportByOrdinal(kernel_library_id, ordinal);
     } else if (user_module) {
       user_export_addr = user_module->GetProcAddressByOrdinal(ordinal);
     }
@@ -436,10 +451,16 @@ bool XexModule::SetupLibraryImports(const char* name,
         // Note that we may not have a handler registered - if not, eventually
         // we'll get directed to UndefinedImport.
         GuestFunction::ExternHandler handler = nullptr;
+        GuestFunction::ExternFastHandler fast_handler = nullptr;
         if (kernel_export) {
           if (kernel_export->function_data.trampoline) {
             handler = (GuestFunction::ExternHandler)
                           kernel_export->function_data.trampoline;
+            // Logged calls need the full trampoline.
+            if ((kernel_export->tags & ExportTag::kFastCall) &&
+                !(kernel_export->tags & ExportTag::kLog)) {
+              fast_handler = kernel_export->function_data.fast_trampoline;
+            }
           } else {
             handler =
                 (GuestFunction::ExternHandler)kernel_export->function_data.shim;
@@ -448,7 +469,8 @@ bool XexModule::SetupLibraryImports(const char* name,
           XELOGW("WARNING: Imported kernel function %s is unimplemented!",
                  import_name.GetString());
         }
-        static_cast<GuestFunction*>(function)->SetupExtern(handler);
+        static_cast<GuestFunction*>(function)->SetupExtern(handler,
+                                                           fast_handler);
       }
       function->set_status(Symbol::Status::kDeclared);
     } else {
@@ -464,11 +486,122 @@ bool XexModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+void XexModule::PrecompileFunctions() {
+  // Function start -> last instruction address, or 0 if unknown.
+  std::map<uint32_t, uint32_t> function_bounds;
+
+  uint32_t entry_point = 0;
+  if (GetOptHeader(XEX_HEADER_ENTRY_POINT, &entry_point) && entry_point) {
+    function_bounds.emplace(entry_point, 0);
+  }
+
+  if (xex_security_info()->export_table) {
+    auto export_table = memory()->TranslateVirtual<const xex2_export_table*>(
+        xex_security_info()->export_table);
+    for (uint32_t i = 0; i < export_table->count; i++) {
+      uint32_t ordinal_offset = export_table->ordOffset[i];
+      if (ordinal_offset) {
+        function_bounds.emplace(
+            ordinal_offset + (export_table->imagebaseaddr << 16), 0);
+      }
+    }
+  }
+
+  // Exception data has an entry for nearly every function in the image:
+  // the start address followed by a packed word holding the function
+  // length in instructions in bits 8-29.
+  auto pdata = xe_xex2_get_pe_section(xex_, ".pdata");
+  if (pdata) {
+    auto entries =
+        memory()->TranslateVirtual<const xe::be<uint32_t>*>(pdata->address);
+    for (uint32_t i = 0; i + 1 < pdata->size / 4; i += 2) {
+      uint32_t start_address = entries[i];
+      uint32_t length = (entries[i + 1] >> 8) & 0x3FFFFF;
+      if (start_address && length) {
+        function_bounds[start_address] = start_address + (length - 1) * 4;
+      }
+    }
+  }
+
+  std::vector<uint32_t> addresses;
+  addresses.reserve(function_bounds.size());
+  for (auto& it : function_bounds) {
+    if (!ContainsAddress(it.first)) {
+      // Exported variable.
+      continue;
+    }
+    auto function = processor_->LookupFunction(this, it.first);
+    if (!function) {
+      continue;
+    }
+    // Known bounds stop the scanner at the real end of the function instead
+    // of the last blr it can prove is the end.
+    if (it.second && !function->end_address()) {
+      function->set_end_address(it.second);
+    }
+    addresses.push_back(it.first);
+  }
+
+  XELOGCPU("Precompiling %d functions in %s", int(addresses.size()),
+           name_.c_str());
+  processor_->QueueFunctionPrecompile(addresses);
+}
+
 std::unique_ptr<Function> XexModule::CreateFunction(uint32_t address) {
   return std::unique_ptr<Function>(
       processor_->backend()->CreateGuestFunction(this, address));
 }
 
+bool XexModule::SearchCodePatterns(uint32_t start, uint32_t end,
+                                   CodePattern* patterns,
+                                   size_t pattern_count) {
+  auto words = memory()->TranslateVirtual<const uint32_t*>(start);
+  size_t word_count = (end - start) / 4;
+  auto MatchAt = [&](size_t index) {
+    bool all_found = true;
+    for (size_t n = 0; n < pattern_count; ++n) {
+      auto& pattern = patterns[n];
+      if (!*pattern.out_address && words[index] == pattern.values[0] &&
+          index + pattern.count <= word_count &&
+          !std::memcmp(words + index, pattern.values,
+                       pattern.count * sizeof(uint32_t))) {
+        *pattern.out_address = start + uint32_t(index * 4);
+      }
+      all_found = all_found && *pattern.out_address;
+    }
+    return all_found;
+  };
+
+  // Compare four words at a time against the first word of each pattern and
+  // only look closer at the rare hits.
+  __m128i first_words[kMaxCodePatterns];
+  assert_true(pattern_count <= kMaxCodePatterns);
+  for (size_t n = 0; n < pattern_count; ++n) {
+    first_words[n] = _mm_set1_epi32(int(patterns[n].values[0]));
+  }
+  size_t index = 0;
+  for (; index + 4 <= word_count; index += 4) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + index));
+    __m128i hits = _mm_setzero_si128();
+    for (size_t n = 0; n < pattern_count; ++n) {
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi32(block, first_words[n]));
+    }
+    int hit_mask = _mm_movemask_ps(_mm_castsi128_ps(hits));
+    for (size_t lane = 0; hit_mask; ++lane, hit_mask >>= 1) {
+      if ((hit_mask & 1) && MatchAt(index + lane)) {
+        return true;
+      }
+    }
+  }
+  for (; index < word_count; ++index) {
+    if (MatchAt(index)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool XexModule::FindSaveRest() {
   // Special stack save/restore functions.
   // http://research.microsoft.com/en-us/um/redmond/projects/invisible/src/crt/md/ppc/xxx.s.htm
@@ -632,12 +765,15 @@ bool XexModule::FindSaveRest() {
       0xCF60EB13, 0x2000804E,
   };
 
-  // TODO(benvanik): these are almost always sequential, if present.
-  //     It'd be smarter to search around the other ones to prevent
-  //     3 full module scans.
+  // All three are found in a single pass over the code sections.
   uint32_t gplr_start = 0;
   uint32_t fpr_start = 0;
   uint32_t vmx_start = 0;
+  CodePattern patterns[] = {
+      {gprlr_code_values, xe::countof(gprlr_code_values), &gplr_start},
+      {fpr_code_values, xe::countof(fpr_code_values), &fpr_start},
+      {vmx_code_values, xe::countof(vmx_code_values), &vmx_start},
+  };
   const xe_xex2_header_t* header = xe_xex2_get_header(xex_);
   for (uint32_t n = 0, i = 0; n < header->section_count; n++) {
     const xe_xex2_section_t* section = &header->sections[n];
@@ -645,25 +781,10 @@ bool XexModule::FindSaveRest() {
         header->exe_address + (i * section->page_size);
     const uint32_t end_address =
         start_address + (section->info.page_count * section->page_size);
-    if (section->info.type == XEX_SECTION_CODE) {
-      if (!gplr_start) {
-        gplr_start = memory_->SearchAligned(start_address, end_address,
-                                            gprlr_code_values,
-                                            xe::countof(gprlr_code_values));
-      }
-      if (!fpr_start) {
-        fpr_start =
-            memory_->SearchAligned(start_address, end_address, fpr_code_values,
-                                   xe::countof(fpr_code_values));
-      }
-      if (!vmx_start) {
-        vmx_start =
-            memory_->SearchAligned(start_address, end_address, vmx_code_values,
-                                   xe::countof(vmx_code_values));
-      }
-      if (gplr_start && fpr_start && vmx_start) {
-        break;
-      }
+    if (section->info.type == XEX_SECTION_CODE &&
+        SearchCodePatterns(start_address, end_address, patterns,
+                           xe::countof(patterns))) {
+      break;
     }
     i += section->info.page_count;
   }
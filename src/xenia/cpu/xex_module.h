@@ -84,7 +84,22 @@ class XexModule : public xe::cpu::Module {
  private:
   bool SetupLibraryImports(const char* name,
                            const xex2_import_library* library);
+  // A run of instruction words to look for in the code sections.
+  struct CodePattern {
+    const uint32_t* values;
+    size_t count;
+    // Address of the first match, or 0 while not yet found.
+    uint32_t* out_address;
+  };
+  static const size_t kMaxCodePatterns = 4;
+  // Searches [start, end) for each pattern not yet found in a single pass.
+  // Returns true once all of them have been found.
+  bool SearchCodePatterns(uint32_t start, uint32_t end, CodePattern* patterns,
+                          size_t pattern_count);
   bool FindSaveRest();
+  // Declares every function start the module metadata tells us about and
+  // queues them all for compilation ahead of use.
+  void PrecompileFunctions();
 
   Processor* processor_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
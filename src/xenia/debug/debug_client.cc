@@ -10,6 +10,8 @@
 #include "xenia/debug/debug_client.h"
 
 #include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
 #include "xenia/ui/loop.h"
 
 namespace xe {
@@ -169,21 +171,38 @@ bool DebugClient::ProcessPacket(proto::PacketReader* packet_reader,
       auto entries = packet_reader->ReadArray<ModuleListEntry>(body->count);
       listener_->OnModulesUpdated(std::move(entries));
     } break;
+    case PacketType::kFunctionListResponse: {
+      auto body = packet_reader->Read<FunctionListResponse>();
+      auto entries = packet_reader->ReadArray<FunctionListEntry>(body->count);
+      listener_->OnFunctionsUpdated(packet->request_id, body,
+                                    std::move(entries));
+    } break;
     case PacketType::kThreadListResponse: {
       auto body = packet_reader->Read<ThreadListResponse>();
       auto entries = packet_reader->ReadArray<ThreadListEntry>(body->count);
       listener_->OnThreadsUpdated(std::move(entries));
     } break;
     case PacketType::kThreadStatesResponse: {
+      // The server bases its next deltas on this state.
+      thread_states_.clear();
       auto body = packet_reader->Read<ThreadStatesResponse>();
       for (size_t i = 0; i < body->count; ++i) {
         auto entry = packet_reader->Read<ThreadStateEntry>();
         auto frames =
             packet_reader->ReadArray<ThreadCallStackFrame>(entry->frame_count);
+        auto thread_state = GetThreadState(entry->thread_handle);
+        std::memcpy(thread_state->entry, entry, sizeof(*entry));
+        thread_state->frames.resize(frames.size());
+        for (size_t j = 0; j < frames.size(); ++j) {
+          std::memcpy(&thread_state->frames[j], frames[j], sizeof(*frames[j]));
+        }
         listener_->OnThreadStateUpdated(entry->thread_handle, entry,
                                         std::move(frames));
       }
     } break;
+    case PacketType::kThreadStatesDeltaNotification: {
+      ProcessThreadStatesDelta(packet_reader);
+    } break;
     default: {
       XELOGE("Unknown incoming packet type");
       return false;
@@ -251,6 +270,120 @@ void DebugClient::Exit() {
   Flush();
 }
 
+void DebugClient::AddBreakpoint(uint32_t address) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  packet_writer_.Begin(PacketType::kBreakpointRequest);
+  auto body = packet_writer_.Append<BreakpointRequest>();
+  body->action = BreakpointRequest::Action::kAdd;
+  body->address = address;
+  packet_writer_.End();
+  Flush();
+}
+
+void DebugClient::RemoveBreakpoint(uint32_t address) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  packet_writer_.Begin(PacketType::kBreakpointRequest);
+  auto body = packet_writer_.Append<BreakpointRequest>();
+  body->action = BreakpointRequest::Action::kRemove;
+  body->address = address;
+  packet_writer_.End();
+  Flush();
+}
+
+request_id_t DebugClient::RequestFunctions(uint32_t module_handle,
+                                           uint32_t address_start,
+                                           uint32_t address_end,
+                                           uint32_t max_count,
+                                           const std::string& filter) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  // 0 is left for packets that aren't responses.
+  if (!++next_request_id_) {
+    ++next_request_id_;
+  }
+  packet_writer_.Begin(PacketType::kFunctionListRequest, next_request_id_);
+  auto body = packet_writer_.Append<FunctionListRequest>();
+  body->module_handle = module_handle;
+  body->address_start = address_start;
+  body->address_end = address_end;
+  body->max_count = max_count;
+  std::memset(body->filter, 0, sizeof(body->filter));
+  std::strncpy(body->filter, filter.c_str(), xe::countof(body->filter) - 1);
+  packet_writer_.End();
+  Flush();
+  return next_request_id_;
+}
+
+void DebugClient::SubscribeThreadStates(uint32_t interval_ms) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  packet_writer_.Begin(PacketType::kThreadStatesSubscribeRequest);
+  auto body = packet_writer_.Append<ThreadStatesSubscribeRequest>();
+  body->interval_ms = interval_ms;
+  packet_writer_.End();
+  Flush();
+}
+
+DebugClient::ThreadState::ThreadState() {
+  entry = memory::AlignedAlloc<ThreadStateEntry>(64);
+  std::memset(entry, 0, sizeof(*entry));
+}
+
+DebugClient::ThreadState::~ThreadState() { memory::AlignedFree(entry); }
+
+DebugClient::ThreadState* DebugClient::GetThreadState(uint32_t thread_handle) {
+  auto& thread_state = thread_states_[thread_handle];
+  if (!thread_state) {
+    thread_state = std::make_unique<ThreadState>();
+    thread_state->entry->thread_handle = thread_handle;
+  }
+  return thread_state.get();
+}
+
+void DebugClient::ProcessThreadStatesDelta(PacketReader* packet_reader) {
+  bool threads_changed = false;
+  while (uint32_t thread_handle = uint32_t(packet_reader->ReadVarint())) {
+    uint32_t flags = uint32_t(packet_reader->ReadVarint());
+    if (flags & kDeltaNewThread) {
+      thread_states_.erase(thread_handle);
+      threads_changed = true;
+    }
+    auto thread_state = GetThreadState(thread_handle);
+    auto entry = thread_state->entry;
+    if (flags & kDeltaGuestContext) {
+      packet_reader->ReadWordDelta(&entry->guest_context,
+                                   sizeof(entry->guest_context));
+    }
+    if (flags & kDeltaHostContext) {
+      packet_reader->ReadWordDelta(&entry->host_context,
+                                   sizeof(entry->host_context));
+    }
+    if (flags & kDeltaCallStack) {
+      size_t frame_count = size_t(packet_reader->ReadVarint());
+      thread_state->frames.resize(frame_count);
+      if (frame_count) {
+        packet_reader->Read(thread_state->frames.data(),
+                            frame_count * sizeof(ThreadCallStackFrame));
+      }
+      entry->frame_count = uint32_t(frame_count);
+    }
+    std::vector<const ThreadCallStackFrame*> frames;
+    for (auto& frame : thread_state->frames) {
+      frames.push_back(&frame);
+    }
+    listener_->OnThreadStateUpdated(thread_handle, entry, std::move(frames));
+  }
+  while (uint32_t thread_handle = uint32_t(packet_reader->ReadVarint())) {
+    thread_states_.erase(thread_handle);
+    threads_changed = true;
+  }
+
+  // Names and such only come with the thread list, so refresh it.
+  if (threads_changed) {
+    packet_writer_.Begin(PacketType::kThreadListRequest);
+    packet_writer_.End();
+    Flush();
+  }
+}
+
 void DebugClient::BeginUpdateAllState() {
   std::lock_guard<std::recursive_mutex> lock(mutex_);
 
@@ -13,6 +13,7 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/socket.h"
@@ -30,6 +31,8 @@ class Loop;
 namespace xe {
 namespace debug {
 
+using proto::FunctionListEntry;
+using proto::FunctionListResponse;
 using proto::ModuleListEntry;
 using proto::ThreadCallStackFrame;
 using proto::ThreadListEntry;
@@ -51,6 +54,9 @@ class DebugClientListener {
   virtual void OnExecutionStateChanged(ExecutionState execution_state) = 0;
   virtual void OnModulesUpdated(
       std::vector<const ModuleListEntry*> entries) = 0;
+  virtual void OnFunctionsUpdated(
+      proto::request_id_t request_id, const FunctionListResponse* response,
+      std::vector<const FunctionListEntry*> entries) = 0;
   virtual void OnThreadsUpdated(
       std::vector<const ThreadListEntry*> entries) = 0;
   virtual void OnThreadStateUpdated(
@@ -77,6 +83,22 @@ class DebugClient {
   void Interrupt();
   void Exit();
 
+  void AddBreakpoint(uint32_t address);
+  void RemoveBreakpoint(uint32_t address);
+
+  // Requests one page of a module's functions, filtered by name on the
+  // server. The page arrives as an OnFunctionsUpdated call with the returned
+  // request ID.
+  proto::request_id_t RequestFunctions(uint32_t module_handle,
+                                       uint32_t address_start,
+                                       uint32_t address_end, uint32_t max_count,
+                                       const std::string& filter);
+
+  // Asks the server to stream thread state changes every interval_ms while
+  // the target is running. Changes arrive as OnThreadStateUpdated calls.
+  // An interval of 0 stops the stream.
+  void SubscribeThreadStates(uint32_t interval_ms);
+
  private:
   bool HandleSocketEvent();
   bool ProcessBuffer(const uint8_t* buffer, size_t buffer_length);
@@ -86,6 +108,16 @@ class DebugClient {
 
   void BeginUpdateAllState();
 
+  // Last known state of each thread that deltas are applied on top of.
+  struct ThreadState {
+    ThreadState();
+    ~ThreadState();
+    ThreadStateEntry* entry;
+    std::vector<ThreadCallStackFrame> frames;
+  };
+  ThreadState* GetThreadState(uint32_t thread_handle);
+  void ProcessThreadStatesDelta(proto::PacketReader* packet_reader);
+
   std::recursive_mutex mutex_;
   std::unique_ptr<Socket> socket_;
   std::unique_ptr<xe::threading::Thread> thread_;
@@ -98,6 +130,9 @@ class DebugClient {
   xe::ui::Loop* loop_ = nullptr;
 
   ExecutionState execution_state_ = ExecutionState::kStopped;
+  proto::request_id_t next_request_id_ = 0;
+
+  std::unordered_map<uint32_t, std::unique_ptr<ThreadState>> thread_states_;
 };
 
 }  // namespace debug
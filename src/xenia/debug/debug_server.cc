@@ -11,7 +11,12 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
 #include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/debug/debugger.h"
 #include "xenia/emulator.h"
@@ -33,6 +38,25 @@ using xe::kernel::XThread;
 constexpr size_t kReceiveBufferSize = 32 * 1024;
 constexpr size_t kReadBufferSize = 1 * 1024 * 1024;
 constexpr size_t kWriteBufferSize = 1 * 1024 * 1024;
+constexpr size_t kMaxCallStackFrames = 64;
+// Keeps a page of FunctionListEntry well within the write buffer.
+constexpr uint32_t kMaxFunctionListCount = 1024;
+// Functions a single list request may visit, matching the filter or not.
+// Bounds how long a rarely matching filter holds the module lock.
+constexpr uint32_t kMaxFunctionListVisitCount = 16 * 1024;
+// Subscriptions are clamped to this so a chatty client can't keep guest
+// threads suspended for stack captures.
+constexpr std::chrono::milliseconds kMinThreadStateInterval(16);
+
+// Whether value contains filter, ignoring ASCII case.
+bool ContainsIgnoringCase(const std::string& value, const char* filter) {
+  auto filter_end = filter + std::strlen(filter);
+  return std::search(value.begin(), value.end(), filter, filter_end,
+                     [](char a, char b) {
+                       return std::tolower(uint8_t(a)) ==
+                              std::tolower(uint8_t(b));
+                     }) != value.end();
+}
 
 DebugServer::DebugServer(Debugger* debugger)
     : debugger_(debugger),
@@ -41,7 +65,12 @@ DebugServer::DebugServer(Debugger* debugger)
   receive_buffer_.resize(kReceiveBufferSize);
 }
 
-DebugServer::~DebugServer() = default;
+DebugServer::~DebugServer() {
+  FreeThreadSnapshots();
+  if (scratch_snapshot_) {
+    memory::AlignedFree(scratch_snapshot_);
+  }
+}
 
 bool DebugServer::Initialize() {
   post_event_ = xe::threading::Event::CreateAutoResetEvent(false);
@@ -58,16 +87,20 @@ bool DebugServer::Initialize() {
   return true;
 }
 
-void DebugServer::PostSynchronous(std::function<void()> fn) {
-  xe::threading::Fence fence;
+void DebugServer::Post(std::function<void()> fn) {
   {
     std::lock_guard<std::mutex> lock(post_mutex_);
-    post_queue_.push_back([&fence, fn]() {
-      fn();
-      fence.Signal();
-    });
+    post_queue_.push_back(std::move(fn));
   }
   post_event_->Set();
+}
+
+void DebugServer::PostSynchronous(std::function<void()> fn) {
+  xe::threading::Fence fence;
+  Post([&fence, fn]() {
+    fn();
+    fence.Signal();
+  });
   fence.Wait();
 }
 
@@ -101,11 +134,20 @@ void DebugServer::AcceptClient(std::unique_ptr<Socket> client) {
     // Main loop.
     bool running = true;
     while (running) {
+      // Wake up for the next thread state delta, if subscribed.
+      auto timeout = std::chrono::milliseconds::max();
+      if (thread_state_interval_.count()) {
+        auto now = std::chrono::steady_clock::now();
+        timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::max(next_thread_state_time_ - now,
+                     std::chrono::steady_clock::duration::zero()));
+      }
+
       xe::threading::WaitHandle* wait_handles[] = {
           client_->wait_handle(), post_event_.get(),
       };
       auto wait_result = xe::threading::WaitMultiple(
-          wait_handles, xe::countof(wait_handles), false, true);
+          wait_handles, xe::countof(wait_handles), false, true, timeout);
       switch (wait_result.first) {
         case xe::threading::WaitResult::kSuccess:
           // Event (read or close).
@@ -131,6 +173,13 @@ void DebugServer::AcceptClient(std::unique_ptr<Socket> client) {
             } break;
           }
           continue;
+        case xe::threading::WaitResult::kTimeout:
+          if (thread_state_interval_.count()) {
+            next_thread_state_time_ =
+                std::chrono::steady_clock::now() + thread_state_interval_;
+            SendThreadStateDeltas();
+          }
+          continue;
         case xe::threading::WaitResult::kAbandoned:
         case xe::threading::WaitResult::kFailed:
           // Error - kill the thread.
@@ -145,6 +194,14 @@ void DebugServer::AcceptClient(std::unique_ptr<Socket> client) {
     // Kill client (likely already disconnected).
     client_.reset();
 
+    // The next client starts from a clean slate.
+    thread_state_interval_ = std::chrono::milliseconds(0);
+    FreeThreadSnapshots();
+    for (auto& it : breakpoints_) {
+      debugger_->RemoveBreakpoint(it.second.get());
+    }
+    breakpoints_.clear();
+
     // Notify debugger we are no longer attached.
     debugger_->set_attached(false);
   });
@@ -237,6 +294,28 @@ bool DebugServer::ProcessPacket(const proto::Packet* packet) {
       }
       SendSuccess(packet->request_id);
     } break;
+    case PacketType::kBreakpointRequest: {
+      auto body = packet_reader_.Read<BreakpointRequest>();
+      auto it = breakpoints_.find(body->address);
+      switch (body->action) {
+        case BreakpointRequest::Action::kAdd: {
+          if (it == breakpoints_.end()) {
+            auto breakpoint = std::make_unique<Breakpoint>(
+                Breakpoint::CODE_TYPE, body->address);
+            if (!debugger_->AddBreakpoint(breakpoint.get())) {
+              breakpoints_.emplace(body->address, std::move(breakpoint));
+            }
+          }
+        } break;
+        case BreakpointRequest::Action::kRemove: {
+          if (it != breakpoints_.end()) {
+            debugger_->RemoveBreakpoint(it->second.get());
+            breakpoints_.erase(it);
+          }
+        } break;
+      }
+      SendSuccess(packet->request_id);
+    } break;
     case PacketType::kModuleListRequest: {
       packet_writer_.Begin(PacketType::kModuleListResponse);
       auto body = packet_writer_.Append<ModuleListResponse>();
@@ -256,6 +335,62 @@ bool DebugServer::ProcessPacket(const proto::Packet* packet) {
       }
       packet_writer_.End();
     } break;
+    case PacketType::kFunctionListRequest: {
+      auto body = packet_reader_.Read<FunctionListRequest>();
+      char filter[xe::countof(body->filter) + 1] = {0};
+      std::strncpy(filter, body->filter, xe::countof(body->filter));
+      uint32_t max_count =
+          std::min(std::max(body->max_count, 1u), kMaxFunctionListCount);
+
+      packet_writer_.Begin(PacketType::kFunctionListResponse,
+                           packet->request_id);
+      // Entries may grow the buffer, so the header is filled in last.
+      size_t response_offset = packet_writer_.buffer_offset();
+      packet_writer_.Append<FunctionListResponse>();
+      uint32_t count = 0;
+      uint32_t visit_count = 0;
+      bool has_more = false;
+      uint32_t next_address = 0;
+      auto module = object_table->LookupObject<XModule>(body->module_handle);
+      auto processor_module = module ? module->processor_module() : nullptr;
+      if (processor_module) {
+        // Only the requested page is walked, so large modules don't hold up
+        // the server or the guest threads declaring functions.
+        processor_module->ForEachFunctionInRange(
+            body->address_start, body->address_end,
+            [&](cpu::Function* function) {
+              if (visit_count++ == kMaxFunctionListVisitCount) {
+                // Resume here even though it may not match.
+                has_more = true;
+                next_address = function->address();
+                return false;
+              }
+              if (*filter && !ContainsIgnoringCase(function->name(), filter)) {
+                return true;
+              }
+              if (count == max_count) {
+                has_more = true;
+                next_address = function->address();
+                return false;
+              }
+              auto entry = packet_writer_.Append<FunctionListEntry>();
+              entry->address = function->address();
+              entry->address_end = function->end_address();
+              std::strncpy(entry->name, function->name().c_str(),
+                           xe::countof(entry->name) - 1);
+              entry->name[xe::countof(entry->name) - 1] = 0;
+              ++count;
+              return true;
+            });
+      }
+      auto response = reinterpret_cast<FunctionListResponse*>(
+          packet_writer_.buffer() + response_offset);
+      response->module_handle = body->module_handle;
+      response->count = count;
+      response->has_more = has_more;
+      response->next_address = next_address;
+      packet_writer_.End();
+    } break;
     case PacketType::kThreadListRequest: {
       packet_writer_.Begin(PacketType::kThreadListResponse);
       auto body = packet_writer_.Append<ThreadListResponse>();
@@ -286,60 +421,42 @@ bool DebugServer::ProcessPacket(const proto::Packet* packet) {
       packet_writer_.End();
     } break;
     case PacketType::kThreadStatesRequest: {
+      // A full update becomes the new base for deltas.
+      FreeThreadSnapshots();
       packet_writer_.Begin(PacketType::kThreadStatesResponse);
       auto body = packet_writer_.Append<ThreadStatesResponse>();
-      auto stack_walker = emulator->processor()->stack_walker();
       auto threads =
-          emulator->kernel_state()->object_table()->GetObjectsByType<XThread>(
-              XObject::kTypeThread);
+          object_table->GetObjectsByType<XThread>(XObject::kTypeThread);
       body->count = uint32_t(threads.size());
-      uint64_t frame_host_pcs[64];
-      cpu::StackFrame frames[64];
+      uint64_t frame_host_pcs[kMaxCallStackFrames];
       for (auto& thread : threads) {
+        auto snapshot = GetThreadSnapshot(thread->handle(), nullptr);
+        size_t count =
+            CaptureThreadState(thread.get(), snapshot, frame_host_pcs);
+
         auto thread_entry_body = packet_writer_.Append<ThreadStateEntry>();
         thread_entry_body->thread_handle = thread->handle();
-
-        // Grab PPC context.
-        // Note that this is only up to date if --store_all_context_values is
-        // enabled (or --debug).
-        if (thread->is_guest_thread()) {
-          std::memcpy(&thread_entry_body->guest_context,
-                      thread->thread_state()->context(),
-                      sizeof(thread_entry_body->guest_context));
-        } else {
-          std::memset(&thread_entry_body->guest_context, 0,
-                      sizeof(thread_entry_body->guest_context));
-        }
-
-        // Grab stack trace and X64 context then resolve all symbols.
-        uint64_t hash;
-        size_t count = stack_walker->CaptureStackTrace(
-            thread->GetWaitHandle()->native_handle(), frame_host_pcs, 0, 64,
-            &thread_entry_body->host_context, &hash);
-        stack_walker->ResolveStack(frame_host_pcs, frames, count);
-
-        // Populate stack frames with additional information.
+        std::memcpy(&thread_entry_body->guest_context,
+                    &snapshot->guest_context,
+                    sizeof(thread_entry_body->guest_context));
+        std::memcpy(&thread_entry_body->host_context, &snapshot->host_context,
+                    sizeof(thread_entry_body->host_context));
         thread_entry_body->frame_count = uint32_t(count);
-        for (size_t i = 0; i < count; ++i) {
-          auto& frame = frames[i];
-          auto frame_body = packet_writer_.Append<ThreadCallStackFrame>();
-          frame_body->host_pc = frame.host_pc;
-          frame_body->host_function_address = frame.host_symbol.address;
-          frame_body->guest_pc = frame.guest_pc;
-          frame_body->guest_function_address = 0;
-          auto function = frame.guest_symbol.function;
-          if (frame.type == cpu::StackFrame::Type::kGuest && function) {
-            frame_body->guest_function_address = function->address();
-            std::strncpy(frame_body->name, function->name().c_str(),
-                         xe::countof(frame_body->name));
-          } else {
-            std::strncpy(frame_body->name, frame.host_symbol.name,
-                         xe::countof(frame_body->name));
-          }
-        }
+        AppendCallStack(frame_host_pcs, count);
       }
       packet_writer_.End();
     } break;
+    case PacketType::kThreadStatesSubscribeRequest: {
+      auto body = packet_reader_.Read<ThreadStatesSubscribeRequest>();
+      thread_state_interval_ = std::chrono::milliseconds(body->interval_ms);
+      if (thread_state_interval_.count()) {
+        thread_state_interval_ =
+            std::max(thread_state_interval_, kMinThreadStateInterval);
+        next_thread_state_time_ =
+            std::chrono::steady_clock::now() + thread_state_interval_;
+      }
+      SendSuccess(packet->request_id);
+    } break;
     default: {
       XELOGE("Unknown packet type");
       SendError(packet->request_id, "Unknown packet type");
@@ -349,27 +466,204 @@ bool DebugServer::ProcessPacket(const proto::Packet* packet) {
   return true;
 }
 
-void DebugServer::OnExecutionContinued() {
-  packet_writer_.Begin(PacketType::kExecutionNotification);
-  auto body = packet_writer_.Append<ExecutionNotification>();
-  body->current_state = ExecutionNotification::State::kRunning;
+DebugServer::ThreadStateSnapshot* DebugServer::GetThreadSnapshot(
+    uint32_t thread_handle, bool* out_is_new) {
+  auto it = thread_snapshots_.find(thread_handle);
+  if (out_is_new) {
+    *out_is_new = it == thread_snapshots_.end();
+  }
+  if (it != thread_snapshots_.end()) {
+    return it->second;
+  }
+  // New threads are diffed against zeros, as the client will be.
+  auto snapshot = memory::AlignedAlloc<ThreadStateSnapshot>(64);
+  std::memset(snapshot, 0, sizeof(*snapshot));
+  thread_snapshots_.emplace(thread_handle, snapshot);
+  return snapshot;
+}
+
+void DebugServer::FreeThreadSnapshots() {
+  for (auto& it : thread_snapshots_) {
+    memory::AlignedFree(it.second);
+  }
+  thread_snapshots_.clear();
+}
+
+size_t DebugServer::CaptureThreadState(XThread* thread,
+                                       ThreadStateSnapshot* snapshot,
+                                       uint64_t* frame_host_pcs) {
+  // Grab PPC context.
+  // Note that this is only up to date if --store_all_context_values is
+  // enabled (or --debug).
+  if (thread->is_guest_thread()) {
+    std::memcpy(&snapshot->guest_context, thread->thread_state()->context(),
+                sizeof(snapshot->guest_context));
+  } else {
+    std::memset(&snapshot->guest_context, 0, sizeof(snapshot->guest_context));
+  }
+
+  // Grab stack trace and X64 context. The hash lets callers skip symbol
+  // resolution when the stack hasn't moved.
+  auto stack_walker = debugger_->emulator()->processor()->stack_walker();
+  return stack_walker->CaptureStackTrace(
+      thread->GetWaitHandle()->native_handle(), frame_host_pcs, 0,
+      kMaxCallStackFrames, &snapshot->host_context, &snapshot->stack_hash);
+}
+
+void DebugServer::AppendCallStack(uint64_t* frame_host_pcs,
+                                  size_t frame_count) {
+  auto stack_walker = debugger_->emulator()->processor()->stack_walker();
+  cpu::StackFrame frames[kMaxCallStackFrames];
+  stack_walker->ResolveStack(frame_host_pcs, frames, frame_count);
+
+  // Populate stack frames with additional information.
+  for (size_t i = 0; i < frame_count; ++i) {
+    auto& frame = frames[i];
+    auto frame_body = packet_writer_.Append<ThreadCallStackFrame>();
+    frame_body->host_pc = frame.host_pc;
+    frame_body->host_function_address = frame.host_symbol.address;
+    frame_body->guest_pc = frame.guest_pc;
+    frame_body->guest_function_address = 0;
+    auto function = frame.guest_symbol.function;
+    if (frame.type == cpu::StackFrame::Type::kGuest && function) {
+      frame_body->guest_function_address = function->address();
+      std::strncpy(frame_body->name, function->name().c_str(),
+                   xe::countof(frame_body->name));
+    } else {
+      std::strncpy(frame_body->name, frame.host_symbol.name,
+                   xe::countof(frame_body->name));
+    }
+  }
+}
+
+void DebugServer::SendThreadStateDeltas() {
+  // Nothing moves while stopped and the client fetches full state on stop.
+  if (debugger_->execution_state() != ExecutionState::kRunning) {
+    return;
+  }
+  if (!scratch_snapshot_) {
+    scratch_snapshot_ = memory::AlignedAlloc<ThreadStateSnapshot>(64);
+  }
+  auto current = scratch_snapshot_;
+  uint32_t generation = ++snapshot_generation_;
+
+  auto object_table = debugger_->emulator()->kernel_state()->object_table();
+  auto threads = object_table->GetObjectsByType<XThread>(XObject::kTypeThread);
+
+  bool any_changes = false;
+  packet_writer_.Begin(PacketType::kThreadStatesDeltaNotification);
+  uint64_t frame_host_pcs[kMaxCallStackFrames];
+  for (auto& thread : threads) {
+    bool is_new;
+    auto snapshot = GetThreadSnapshot(thread->handle(), &is_new);
+    snapshot->generation = generation;
+    size_t frame_count =
+        CaptureThreadState(thread.get(), current, frame_host_pcs);
+
+    uint32_t flags = is_new ? kDeltaNewThread : 0;
+    if (std::memcmp(&snapshot->guest_context, &current->guest_context,
+                    sizeof(current->guest_context))) {
+      flags |= kDeltaGuestContext;
+    }
+    if (std::memcmp(&snapshot->host_context, &current->host_context,
+                    sizeof(current->host_context))) {
+      flags |= kDeltaHostContext;
+    }
+    if (is_new || snapshot->stack_hash != current->stack_hash) {
+      flags |= kDeltaCallStack;
+    }
+    if (!flags) {
+      continue;
+    }
+    any_changes = true;
+
+    packet_writer_.AppendVarint(thread->handle());
+    packet_writer_.AppendVarint(flags);
+    if (flags & kDeltaGuestContext) {
+      packet_writer_.AppendWordDelta(&snapshot->guest_context,
+                                     &current->guest_context,
+                                     sizeof(current->guest_context));
+      std::memcpy(&snapshot->guest_context, &current->guest_context,
+                  sizeof(current->guest_context));
+    }
+    if (flags & kDeltaHostContext) {
+      packet_writer_.AppendWordDelta(&snapshot->host_context,
+                                     &current->host_context,
+                                     sizeof(current->host_context));
+      std::memcpy(&snapshot->host_context, &current->host_context,
+                  sizeof(current->host_context));
+    }
+    if (flags & kDeltaCallStack) {
+      packet_writer_.AppendVarint(frame_count);
+      AppendCallStack(frame_host_pcs, frame_count);
+      snapshot->stack_hash = current->stack_hash;
+    }
+  }
+  packet_writer_.AppendVarint(0);
+
+  // Anything we didn't see this time around has exited.
+  for (auto it = thread_snapshots_.begin(); it != thread_snapshots_.end();) {
+    if (it->second->generation != generation) {
+      any_changes = true;
+      packet_writer_.AppendVarint(it->first);
+      memory::AlignedFree(it->second);
+      it = thread_snapshots_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  packet_writer_.AppendVarint(0);
+
+  if (!any_changes) {
+    packet_writer_.Abort();
+    return;
+  }
   packet_writer_.End();
   Flush();
 }
 
+void DebugServer::OnExecutionContinued() {
+  // May be called from any thread; the writer is owned by the server thread.
+  Post([this]() {
+    packet_writer_.Begin(PacketType::kExecutionNotification);
+    auto body = packet_writer_.Append<ExecutionNotification>();
+    body->current_state = ExecutionNotification::State::kRunning;
+    packet_writer_.End();
+    Flush();
+  });
+}
+
 void DebugServer::OnExecutionInterrupted() {
-  packet_writer_.Begin(PacketType::kExecutionNotification);
-  auto body = packet_writer_.Append<ExecutionNotification>();
-  body->current_state = ExecutionNotification::State::kStopped;
-  body->stop_reason = ExecutionNotification::Reason::kInterrupt;
-  packet_writer_.End();
-  Flush();
+  Post([this]() {
+    packet_writer_.Begin(PacketType::kExecutionNotification);
+    auto body = packet_writer_.Append<ExecutionNotification>();
+    body->current_state = ExecutionNotification::State::kStopped;
+    body->stop_reason = ExecutionNotification::Reason::kInterrupt;
+    packet_writer_.End();
+    Flush();
+  });
+}
+
+void DebugServer::OnBreakpointHit() {
+  Post([this]() {
+    packet_writer_.Begin(PacketType::kExecutionNotification);
+    auto body = packet_writer_.Append<ExecutionNotification>();
+    body->current_state = ExecutionNotification::State::kStopped;
+    body->stop_reason = ExecutionNotification::Reason::kBreakpoint;
+    packet_writer_.End();
+    Flush();
+  });
 }
 
 void DebugServer::Flush() {
   if (!packet_writer_.buffer_offset()) {
     return;
   }
+  if (!client_) {
+    // Nobody to tell.
+    packet_writer_.Reset();
+    return;
+  }
   client_->Send(packet_writer_.buffer(), packet_writer_.buffer_offset());
   packet_writer_.Reset();
 }
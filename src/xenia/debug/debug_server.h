@@ -10,11 +10,13 @@
 #ifndef XENIA_DEBUG_DEBUG_SERVER_H_
 #define XENIA_DEBUG_DEBUG_SERVER_H_
 
+#include <chrono>
 #include <functional>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/socket.h"
@@ -26,6 +28,12 @@
 #include "xenia/debug/proto/packet_writer.h"
 #include "xenia/debug/proto/xdp_protocol.h"
 
+namespace xe {
+namespace kernel {
+class XThread;
+}  // namespace kernel
+}  // namespace xe
+
 namespace xe {
 namespace debug {
 
@@ -41,6 +49,10 @@ class DebugServer {
 
   bool Initialize();
 
+  // Queues fn to run on the server thread and returns immediately.
+  void Post(std::function<void()> fn);
+  // Queues fn to run on the server thread and waits for it to complete.
+  // Must not be called from the server thread.
   void PostSynchronous(std::function<void()> fn);
 
   // TODO(benvanik): better thread type (XThread?)
@@ -49,8 +61,7 @@ class DebugServer {
 
   void OnExecutionContinued();
   void OnExecutionInterrupted();
-  /*void OnBreakpointHit(xe::cpu::ThreadState* thread_state,
-                               Breakpoint* breakpoint);*/
+  void OnBreakpointHit();
 
  private:
   void AcceptClient(std::unique_ptr<Socket> client);
@@ -59,6 +70,22 @@ class DebugServer {
   bool ProcessBuffer(const uint8_t* buffer, size_t buffer_length);
   bool ProcessPacket(const proto::Packet* packet);
 
+  // Last thread state sent to the client, used as the base for deltas.
+  struct ThreadStateSnapshot {
+    cpu::frontend::PPCContext guest_context;
+    cpu::X64Context host_context;
+    uint64_t stack_hash;
+    uint32_t generation;
+  };
+  ThreadStateSnapshot* GetThreadSnapshot(uint32_t thread_handle,
+                                         bool* out_is_new);
+  void FreeThreadSnapshots();
+  size_t CaptureThreadState(kernel::XThread* thread,
+                            ThreadStateSnapshot* snapshot,
+                            uint64_t* frame_host_pcs);
+  void AppendCallStack(uint64_t* frame_host_pcs, size_t frame_count);
+  void SendThreadStateDeltas();
+
   void Flush();
   void SendSuccess(proto::request_id_t request_id);
   void SendError(proto::request_id_t request_id,
@@ -80,6 +107,16 @@ class DebugServer {
   std::vector<uint8_t> receive_buffer_;
   proto::PacketReader packet_reader_;
   proto::PacketWriter packet_writer_;
+
+  // Thread state subscription; an interval of 0 means unsubscribed.
+  std::chrono::milliseconds thread_state_interval_{0};
+  std::chrono::steady_clock::time_point next_thread_state_time_;
+  std::unordered_map<uint32_t, ThreadStateSnapshot*> thread_snapshots_;
+
+  // Breakpoints set by the client, by guest address.
+  std::unordered_map<uint32_t, std::unique_ptr<Breakpoint>> breakpoints_;
+  ThreadStateSnapshot* scratch_snapshot_ = nullptr;
+  uint32_t snapshot_generation_ = 0;
 };
 
 }  // namespace debug
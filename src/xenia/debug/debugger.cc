@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <mutex>
 #include <utility>
 
@@ -38,6 +39,10 @@
 DEFINE_bool(debug, DEFAULT_DEBUG_FLAG,
             "Allow debugging and retain debug information.");
 DEFINE_string(debug_session_path, "", "Debug output path.");
+DEFINE_int32(function_trace_buffer_mb, 32,
+             "Size in MB of each mapping function trace data is allocated "
+             "from. Size it to fit every traced function to keep the trace in "
+             "one contiguous file.");
 DEFINE_bool(wait_for_debugger, false,
             "Waits for a debugger to attach before starting the game.");
 DEFINE_bool(exit_with_debugger, true, "Exit whe the debugger disconnects.");
@@ -86,7 +91,9 @@ bool Debugger::StartSession() {
 
   functions_trace_path_ = xe::join_paths(session_path, L"functions.trace");
   functions_trace_file_ = ChunkedMappedMemoryWriter::Open(
-      functions_trace_path_, 32 * 1024 * 1024, true);
+      functions_trace_path_,
+      size_t(std::max(FLAGS_function_trace_buffer_mb, 1)) * 1024 * 1024,
+      true);
 
   server_ = std::make_unique<DebugServer>(this);
   if (!server_->Initialize()) {
@@ -187,17 +194,19 @@ int Debugger::AddBreakpoint(Breakpoint* breakpoint) {
         std::pair<uint32_t, Breakpoint*>(breakpoint->address(), breakpoint));
   }
 
-  // Find all functions that contain the breakpoint address.
-  auto fns =
-      emulator_->processor()->FindFunctionsWithAddress(breakpoint->address());
-
-  // TODO(benvanik): breakpoints.
-  // Add.
-  // for (auto fn : fns) {
-  //  if (fn->AddBreakpoint(breakpoint)) {
-  //    return 1;
-  //  }
-  //}
+  // Patch into all code for the address, now and as it is translated.
+  if (!emulator_->processor()->backend()->InstallBreakpoint(
+          breakpoint->address())) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    auto range = breakpoints_.equal_range(breakpoint->address());
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == breakpoint) {
+        breakpoints_.erase(it);
+        break;
+      }
+    }
+    return 1;
+  }
 
   return 0;
 }
@@ -223,15 +232,7 @@ int Debugger::RemoveBreakpoint(Breakpoint* breakpoint) {
     }
   }
 
-  // Find all functions that have the breakpoint set.
-  auto fns =
-      emulator_->processor()->FindFunctionsWithAddress(breakpoint->address());
-
-  // Remove.
-  // TODO(benvanik): breakpoints.
-  /*for (auto fn : fns) {
-    fn->RemoveBreakpoint(breakpoint);
-  }*/
+  emulator_->processor()->backend()->UninstallBreakpoint(breakpoint->address());
 
   return 0;
 }
@@ -253,11 +254,14 @@ void Debugger::FindBreakpoints(uint32_t address,
   }
 }
 
-bool Debugger::SuspendAllThreads() {
+bool Debugger::SuspendAllThreads(XThread* except_thread) {
   auto threads =
       emulator_->kernel_state()->object_table()->GetObjectsByType<XThread>(
           XObject::kTypeThread);
   for (auto& thread : threads) {
+    if (thread.get() == except_thread) {
+      continue;
+    }
     if (!XSUCCEEDED(thread->Suspend(nullptr))) {
       return false;
     }
@@ -298,6 +302,8 @@ void Debugger::Continue() {
   assert_true(execution_state_ == ExecutionState::kStopped);
   ResumeAllThreads();
   execution_state_ = ExecutionState::kRunning;
+  ++resume_generation_;
+  resume_cond_.notify_all();
   server_->OnExecutionContinued();
 }
 
@@ -310,7 +316,15 @@ void Debugger::StepOne(uint32_t thread_id) {
 void Debugger::StepTo(uint32_t thread_id, uint32_t target_pc) {
   std::lock_guard<std::recursive_mutex> lock(mutex_);
   assert_true(execution_state_ == ExecutionState::kStopped);
-  //
+  // Run to a temporary breakpoint at the target. Any thread reaching it
+  // stops execution, not just thread_id.
+  if (step_breakpoint_) {
+    RemoveBreakpoint(step_breakpoint_.get());
+  }
+  step_breakpoint_ =
+      std::make_unique<Breakpoint>(Breakpoint::TEMP_TYPE, target_pc);
+  AddBreakpoint(step_breakpoint_.get());
+  Continue();
 }
 
 void Debugger::OnThreadCreated(xe::kernel::XThread* thread) {
@@ -326,39 +340,48 @@ void Debugger::OnThreadDestroyed(xe::kernel::XThread* thread) {
 }
 
 void Debugger::OnFunctionDefined(cpu::Function* function) {
-  // TODO(benvanik): breakpoints?
-  // Man, I'd love not to take this lock.
-  // std::vector<Breakpoint*> breakpoints;
-  //{
-  //  std::lock_guard<std::recursive_mutex> lock(mutex_);
-  //  for (uint32_t address = function->address();
-  //       address <= function->end_address(); address += 4) {
-  //    auto range = breakpoints_.equal_range(address);
-  //    if (range.first == range.second) {
-  //      continue;
-  //    }
-  //    for (auto it = range.first; it != range.second; ++it) {
-  //      Breakpoint* breakpoint = it->second;
-  //      breakpoints.push_back(breakpoint);
-  //    }
-  //  }
-  //}
-  // if (breakpoints.size()) {
-  //  // Breakpoints to add!
-  //  for (auto breakpoint : breakpoints) {
-  //    function->AddBreakpoint(breakpoint);
-  //  }
-  //}
+  // Breakpoints are patched in by the backend as code is placed.
+}
+
+void Debugger::OnBreakpointHit(uint32_t guest_address) {
+  auto thread = XThread::GetCurrentThread();
+  if (!thread) {
+    return;
+  }
+
+  // Held throughout so the breakpoint can't be removed and freed under us.
+  std::unique_lock<std::recursive_mutex> lock(mutex_);
+  auto it = breakpoints_.find(guest_address);
+  if (it == breakpoints_.end()) {
+    // Removed while the thread was trapping; just keep going.
+    return;
+  }
+  OnBreakpointHit(thread, it->second);
+
+  // Wait here rather than suspending ourselves, which could race a quick
+  // Continue.
+  uint64_t generation = resume_generation_;
+  resume_cond_.wait(lock,
+                    [&]() { return resume_generation_ != generation; });
 }
 
 void Debugger::OnBreakpointHit(xe::kernel::XThread* thread,
                                Breakpoint* breakpoint) {
-  // Suspend all threads immediately.
-  SuspendAllThreads();
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
 
-  // TODO(benvanik): notify transports.
+  // Temporary breakpoints only fire once. Removed before suspending anyone
+  // so we can't block on a lock held by a suspended thread.
+  if (breakpoint->type() == Breakpoint::TEMP_TYPE) {
+    RemoveBreakpoint(breakpoint);
+  }
 
-  // Note that we stay suspended.
+  // Another thread may have stopped execution while we were trapping.
+  if (execution_state_ == ExecutionState::kRunning) {
+    // Suspend all other threads immediately.
+    SuspendAllThreads(thread);
+    execution_state_ = ExecutionState::kStopped;
+    server_->OnBreakpointHit();
+  }
 }
 
 }  // namespace debug
@@ -12,6 +12,7 @@
 
 #include <gflags/gflags.h>
 
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -85,10 +86,14 @@ class Debugger {
 
   void OnFunctionDefined(cpu::Function* function);
 
+  // Called on the thread that hit a breakpoint patched into generated code.
+  // Returns once execution is continued.
+  void OnBreakpointHit(uint32_t guest_address);
+  // Stops all other threads and notifies the client.
   void OnBreakpointHit(xe::kernel::XThread* thread, Breakpoint* breakpoint);
 
  private:
-  bool SuspendAllThreads();
+  bool SuspendAllThreads(xe::kernel::XThread* except_thread = nullptr);
   bool ResumeThread(uint32_t thread_id);
   bool ResumeAllThreads();
 
@@ -107,6 +112,12 @@ class Debugger {
   ExecutionState execution_state_ = ExecutionState::kStopped;
 
   std::multimap<uint32_t, Breakpoint*> breakpoints_;
+  // Temporary breakpoint used by StepTo.
+  std::unique_ptr<Breakpoint> step_breakpoint_;
+
+  // Threads stopped at breakpoints wait for this to change.
+  uint64_t resume_generation_ = 0;
+  std::condition_variable_any resume_cond_;
 };
 
 }  // namespace debug
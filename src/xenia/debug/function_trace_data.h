@@ -13,6 +13,7 @@
 #include <cstdint>
 #include <cstring>
 
+#include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 
 namespace xe {
@@ -48,15 +49,19 @@ class FunctionTraceData {
     // + 0   4b  (data size)
     // + 4   4b  start_address
     // + 8   4b  end_address
-    // +12   4b  type (user, external, etc)
+    // +12   2b  type (user, external, etc)
+    // +14   1b  instruction_counter_size (1, 2 or 8)
+    // +15   1b  instruction_sample_shift (1 in 2^n calls counted)
     // +16   8b  function_thread_use  // bitmask of thread id
     // +24   8b  function_call_count
     // +32   4b+ function_caller_history[4]
-    // +48   8b+ instruction_execute_count[instruction count]
+    // +48   nb+ instruction_execute_count[instruction count]
     uint32_t data_size;
     uint32_t start_address;
     uint32_t end_address;
-    uint32_t type;
+    uint16_t type;
+    uint8_t instruction_counter_size;
+    uint8_t instruction_sample_shift;
     uint64_t function_thread_use;
     uint64_t function_call_count;
     uint32_t function_caller_history[kFunctionCallerHistoryCount];
@@ -65,13 +70,21 @@ class FunctionTraceData {
 
   FunctionTraceData() : header_(nullptr) {}
 
+  // Instruction counters are 8b by default. Narrower counters saturate at
+  // their maximum value instead of wrapping.
+  static const uint8_t kDefaultInstructionCounterSize = 8;
+
   void Reset(uint8_t* trace_data, size_t trace_data_size,
-             uint32_t start_address, uint32_t end_address) {
+             uint32_t start_address, uint32_t end_address,
+             uint8_t instruction_counter_size = kDefaultInstructionCounterSize,
+             uint8_t instruction_sample_shift = 0) {
     header_ = reinterpret_cast<Header*>(trace_data);
     header_->data_size = uint32_t(trace_data_size);
     header_->start_address = start_address;
     header_->end_address = end_address;
     header_->type = 0;
+    header_->instruction_counter_size = instruction_counter_size;
+    header_->instruction_sample_shift = instruction_sample_shift;
     header_->function_thread_use = 0;
     header_->function_call_count = 0;
     for (int i = 0; i < kFunctionCallerHistoryCount; ++i) {
@@ -90,6 +103,13 @@ class FunctionTraceData {
     return (header_->end_address - header_->start_address) / 4 + 1;
   }
 
+  uint8_t instruction_counter_size() const {
+    return header_->instruction_counter_size;
+  }
+  uint8_t instruction_sample_shift() const {
+    return header_->instruction_sample_shift;
+  }
+
   Header* header() const { return header_; }
 
   uint8_t* instruction_execute_counts() const {
@@ -98,10 +118,13 @@ class FunctionTraceData {
 
   static size_t SizeOfHeader() { return sizeof(Header); }
 
-  static size_t SizeOfInstructionCounts(uint32_t start_address,
-                                        uint32_t end_address) {
+  static size_t SizeOfInstructionCounts(
+      uint32_t start_address, uint32_t end_address,
+      uint8_t instruction_counter_size = kDefaultInstructionCounterSize) {
     uint32_t instruction_count = (end_address - start_address) / 4 + 1;
-    return instruction_count * 8;
+    // Keep the next function's header 8b aligned.
+    return xe::round_up(size_t(instruction_count) * instruction_counter_size,
+                        size_t(8));
   }
 
  private:
@@ -11,6 +11,7 @@
 #define XENIA_DEBUG_PROTO_PACKET_READER_H_
 
 #include <algorithm>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <vector>
@@ -121,15 +122,39 @@ class PacketReader {
     std::memcpy(buffer, src, buffer_length);
   }
 
+  uint64_t ReadVarint() {
+    assert_not_null(current_packet_);
+    varint_t value;
+    auto src = buffer_.data() + packet_offset_;
+    packet_offset_ += value.Read(src) - src;
+    assert_true(packet_offset_ <= buffer_offset_);
+    return value;
+  }
+
+  // Applies a delta written by PacketWriter::AppendWordDelta to target.
+  void ReadWordDelta(void* target, size_t length) {
+    assert_zero(length % 4);
+    auto target_words = reinterpret_cast<uint32_t*>(target);
+    size_t changed_count = size_t(ReadVarint());
+    size_t next_index = 0;
+    for (size_t i = 0; i < changed_count; ++i) {
+      size_t index = next_index + size_t(ReadVarint());
+      assert_true(index < length / 4);
+      Read(&target_words[index], 4);
+      next_index = index + 1;
+    }
+  }
+
   void ReadString(char* buffer, size_t buffer_length) {
     assert_not_null(current_packet_);
     varint_t length;
     auto src = length.Read(buffer_.data() + packet_offset_);
     assert_not_null(src);
     assert_true(length < buffer_length);
-    assert_true(length.size() + length < (buffer_offset_ - packet_offset_));
+    assert_true(length.size() + length <= (buffer_offset_ - packet_offset_));
     std::memcpy(buffer, src, length);
-    packet_offset_ += length;
+    buffer[length] = 0;
+    packet_offset_ += length.size() + length;
   }
 
   std::string ReadString() {
@@ -137,11 +162,11 @@ class PacketReader {
     varint_t length;
     auto src = length.Read(buffer_.data() + packet_offset_);
     assert_not_null(src);
-    assert_true(length.size() + length < (buffer_offset_ - packet_offset_));
+    assert_true(length.size() + length <= (buffer_offset_ - packet_offset_));
     std::string value;
     value.resize(length.value());
     std::memcpy(const_cast<char*>(value.data()), src, length);
-    packet_offset_ += length;
+    packet_offset_ += length.size() + length;
     return value;
   }
 
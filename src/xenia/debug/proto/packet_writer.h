@@ -11,6 +11,7 @@
 #define XENIA_DEBUG_PROTO_PACKET_WRITER_H_
 
 #include <algorithm>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -34,19 +35,30 @@ class PacketWriter {
   void Reset() { buffer_offset_ = 0; }
 
   void Begin(PacketType packet_type, request_id_t request_id = 0) {
-    assert_null(current_packet_);
-    current_packet_ = Append<Packet>();
-    current_packet_->packet_type = packet_type;
-    current_packet_->request_id = request_id;
-    current_packet_->body_length = 0;
+    assert_false(in_packet_);
+    // Appends may grow the buffer so the packet is tracked by offset.
+    current_packet_offset_ = buffer_offset_;
+    in_packet_ = true;
+    auto packet = Append<Packet>();
+    packet->packet_type = packet_type;
+    packet->request_id = request_id;
+    packet->body_length = 0;
   }
 
   void End() {
-    assert_not_null(current_packet_);
-    current_packet_->body_length =
-        uint32_t((buffer_.data() + buffer_offset_) -
-                 reinterpret_cast<uint8_t*>(current_packet_) - sizeof(Packet));
-    current_packet_ = nullptr;
+    assert_true(in_packet_);
+    auto packet =
+        reinterpret_cast<Packet*>(buffer_.data() + current_packet_offset_);
+    packet->body_length =
+        uint32_t(buffer_offset_ - current_packet_offset_ - sizeof(Packet));
+    in_packet_ = false;
+  }
+
+  // Discards the packet currently being written.
+  void Abort() {
+    assert_true(in_packet_);
+    buffer_offset_ = current_packet_offset_;
+    in_packet_ = false;
   }
 
   uint8_t* Append(size_t length) {
@@ -70,6 +82,37 @@ class PacketWriter {
     std::memcpy(dest, buffer, buffer_length);
   }
 
+  void AppendVarint(uint64_t value) {
+    varint_t varint(value);
+    varint.Write(Append(varint.size()));
+  }
+
+  // Appends the 32-bit words of current that differ from previous as a varint
+  // count followed by (varint index gap, word) pairs. length must be a
+  // multiple of 4. Read back with PacketReader::ReadWordDelta.
+  void AppendWordDelta(const void* previous, const void* current,
+                       size_t length) {
+    assert_zero(length % 4);
+    auto previous_words = reinterpret_cast<const uint32_t*>(previous);
+    auto current_words = reinterpret_cast<const uint32_t*>(current);
+    size_t word_count = length / 4;
+    size_t changed_count = 0;
+    for (size_t i = 0; i < word_count; ++i) {
+      if (previous_words[i] != current_words[i]) {
+        ++changed_count;
+      }
+    }
+    AppendVarint(changed_count);
+    size_t next_index = 0;
+    for (size_t i = 0; i < word_count; ++i) {
+      if (previous_words[i] != current_words[i]) {
+        AppendVarint(i - next_index);
+        Append(&current_words[i], 4);
+        next_index = i + 1;
+      }
+    }
+  }
+
   void AppendString(const char* value) {
     size_t value_length = std::strlen(value);
     varint_t length(value_length);
@@ -88,7 +131,8 @@ class PacketWriter {
   std::vector<uint8_t> buffer_;
   size_t buffer_offset_ = 0;
 
-  Packet* current_packet_ = nullptr;
+  size_t current_packet_offset_ = 0;
+  bool in_packet_ = false;
 };
 
 }  // namespace proto
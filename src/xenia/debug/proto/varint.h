@@ -24,43 +24,37 @@ struct varint_t {
   operator uint64_t() const { return value_; }
   uint64_t value() const { return value_; }
 
+  // Encoded as LEB128: 7 bits per byte, low groups first, with the high bit
+  // set on all but the last byte.
   size_t size() const {
     uint64_t value = value_;
-    size_t i = 0;
-    do {
+    size_t i = 1;
+    while (value >= 0x80) {
       value >>= 7;
       ++i;
-    } while (value >= 0x80);
-    return i + 1;
+    }
+    return i;
   }
 
   const uint8_t* Read(const uint8_t* src) {
-    if (!(src[0] & 0x80)) {
-      value_ = src[0];
-      return src + 1;
-    }
-    uint64_t r = src[0] & 0x7F;
-    size_t i;
-    for (i = 1; i < 10; ++i) {
-      r |= (src[i] & 0x7F) << (7 * i);
-      if (!(src[i] & 0x80)) {
-        break;
-      }
-    }
+    uint64_t r = 0;
+    size_t i = 0;
+    do {
+      r |= uint64_t(src[i] & 0x7F) << (7 * i);
+    } while ((src[i++] & 0x80) && i < 10);
     value_ = r;
-    return src + i + 1;
+    return src + i;
   }
 
   uint8_t* Write(uint8_t* dest) {
     uint64_t value = value_;
     size_t i = 0;
-    do {
-      dest[i] = uint8_t(value | 0x80);
+    while (value >= 0x80) {
+      dest[i++] = uint8_t(value | 0x80);
       value >>= 7;
-      ++i;
-    } while (value >= 0x80);
-    dest[i] = uint8_t(value);
-    return dest + i + 1;
+    }
+    dest[i++] = uint8_t(value);
+    return dest + i;
   }
 
  private:
@@ -29,11 +29,17 @@ enum class PacketType : uint16_t {
 
   kModuleListRequest = 20,
   kModuleListResponse = 21,
+  kFunctionListRequest = 22,
+  kFunctionListResponse = 23,
 
   kThreadListRequest = 30,
   kThreadListResponse = 31,
   kThreadStatesRequest = 32,
   kThreadStatesResponse = 33,
+  kThreadStatesSubscribeRequest = 34,
+  kThreadStatesDeltaNotification = 35,
+
+  kBreakpointRequest = 40,
 };
 
 using request_id_t = uint16_t;
@@ -143,6 +149,39 @@ struct ModuleListEntry {
   char name[256];
 };
 
+// Requests one page of the functions of a module (C->S).
+// Functions in [address_start, address_end) whose name contains filter
+// (ignoring case; empty matches all) are returned in address order, at most
+// max_count of them (clamped by the server). If more may match, has_more is
+// set and the next page starts at next_address. The server also stops after
+// visiting a bounded number of functions, so a page may be short or even
+// empty while has_more is set. The response carries the request_id of the
+// request so clients can drop stale pages.
+struct FunctionListRequest {
+  static const PacketType type = PacketType::kFunctionListRequest;
+
+  uint32_t module_handle;
+  uint32_t address_start;
+  uint32_t address_end;
+  uint32_t max_count;
+  char filter[64];
+};
+struct FunctionListResponse {
+  static const PacketType type = PacketType::kFunctionListResponse;
+
+  uint32_t module_handle;
+  uint32_t count;
+  bool has_more;
+  uint32_t next_address;
+  // FunctionListEntry[count]
+};
+struct FunctionListEntry {
+  uint32_t address;
+  // 0 if not yet known.
+  uint32_t address_end;
+  char name[128];
+};
+
 struct ThreadListRequest {
   static const PacketType type = PacketType::kThreadListRequest;
 };
@@ -203,6 +242,55 @@ struct ThreadCallStackFrame {
   char name[256];
 };
 
+// Adds or removes a code breakpoint at a guest address (C->S).
+// Response is a GenericResponse. Hits are reported as ExecutionNotification
+// with Reason::kBreakpoint.
+struct BreakpointRequest {
+  static const PacketType type = PacketType::kBreakpointRequest;
+
+  enum class Action : uint32_t {
+    kAdd,
+    kRemove,
+  };
+
+  Action action;
+  uint32_t address;
+};
+
+// Subscribes to periodic thread state deltas (C->S).
+// Response is a GenericResponse. While subscribed and the target is running
+// the server sends a ThreadStatesDeltaNotification every interval_ms
+// containing only what changed since the last state it sent (by delta or
+// ThreadStatesResponse). An interval of 0 unsubscribes.
+struct ThreadStatesSubscribeRequest {
+  static const PacketType type = PacketType::kThreadStatesSubscribeRequest;
+
+  uint32_t interval_ms;
+};
+
+// Batched thread state changes (S->C).
+// Unlike other packets the body is varint-packed and must be read in order:
+//   varint changed_count
+//     varint thread_handle
+//     varint ThreadStateDeltaFlags
+//     [kDeltaGuestContext] word delta of guest_context
+//     [kDeltaHostContext]  word delta of host_context
+//     [kDeltaCallStack]    varint frame_count, ThreadCallStackFrame[count]
+//   varint exited_count
+//     varint thread_handle
+// Word deltas are a varint count followed by (varint index gap, uint32 word)
+// pairs and apply on top of the previously sent state. Threads the client has
+// not seen before are sent with kDeltaNewThread against a zeroed state.
+struct ThreadStatesDeltaNotification {
+  static const PacketType type = PacketType::kThreadStatesDeltaNotification;
+};
+enum ThreadStateDeltaFlags : uint32_t {
+  kDeltaNewThread = 1 << 0,
+  kDeltaGuestContext = 1 << 1,
+  kDeltaHostContext = 1 << 2,
+  kDeltaCallStack = 1 << 3,
+};
+
 }  // namespace proto
 }  // namespace debug
 }  // namespace xe
@@ -0,0 +1,250 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/debug/sampling_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string_buffer.h"
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/stack_walker.h"
+#include "xenia/emulator.h"
+#include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/objects/xthread.h"
+
+DEFINE_int32(sample_profile_interval_us, 0,
+             "Samples the stacks of guest threads every N microseconds and "
+             "reports the hottest guest functions on exit. 0 disables.");
+DEFINE_string(sample_profile_path, "",
+              "File the sampling profile report is written to. The log is "
+              "used if empty.");
+DEFINE_int32(sample_profile_report_count, 100,
+             "Number of functions listed in the sampling profile report.");
+
+namespace xe {
+namespace debug {
+
+using xe::kernel::XObject;
+using xe::kernel::XThread;
+
+SamplingProfiler::SamplingProfiler(Emulator* emulator) : emulator_(emulator) {}
+
+SamplingProfiler::~SamplingProfiler() { Stop(); }
+
+bool SamplingProfiler::Start(uint32_t interval_us) {
+  if (running_) {
+    return true;
+  }
+  if (!emulator_->processor()->stack_walker()) {
+    XELOGE("Sampling profiler unavailable: no stack walker on this platform");
+    return false;
+  }
+  interval_us_ = std::max(interval_us, 100u);
+  if (!snapshot_) {
+    snapshot_ = std::make_unique<cpu::StackSnapshot>();
+  }
+  running_ = true;
+  start_ticks_ = Clock::QueryHostTickCount();
+  thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+  thread_->set_name("Sampling Profiler");
+  thread_->set_priority(xe::threading::ThreadPriority::kHighest);
+  XELOGI("Sampling profiler started (every %uus)", interval_us_);
+  return true;
+}
+
+void SamplingProfiler::Stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  xe::threading::Wait(thread_.get(), false);
+  thread_.reset();
+  sampled_ticks_ += Clock::QueryHostTickCount() - start_ticks_;
+}
+
+void SamplingProfiler::Reset() {
+  assert_false(running_);
+  sample_count_ = 0;
+  unattributed_count_ = 0;
+  sampled_ticks_ = 0;
+  functions_.clear();
+  call_edges_.clear();
+}
+
+void SamplingProfiler::ThreadMain() {
+  while (running_) {
+    SampleThreads();
+    xe::threading::Sleep(std::chrono::microseconds(interval_us_));
+  }
+}
+
+void SamplingProfiler::SampleThreads() {
+  auto stack_walker = emulator_->processor()->stack_walker();
+  auto threads =
+      emulator_->kernel_state()->object_table()->GetObjectsByType<XThread>(
+          XObject::kTypeThread);
+  uint64_t frame_host_pcs[kMaxFrameCount];
+  for (auto& thread : threads) {
+    auto host_thread = thread->host_thread();
+    if (!thread->is_guest_thread() || !thread->is_running() || !host_thread) {
+      continue;
+    }
+    if (!host_thread->Suspend()) {
+      continue;
+    }
+    // Nothing between the suspend and resume may allocate or take locks the
+    // guest thread could be holding (the heap, the loader lock, dbghelp's),
+    // so only the raw registers and stack are copied here and the stack is
+    // unwound once the thread is running again.
+    bool captured = stack_walker->CaptureStackSnapshot(
+        host_thread->native_handle(), snapshot_.get());
+    host_thread->Resume();
+    if (!captured) {
+      continue;
+    }
+    size_t frame_count =
+        stack_walker->WalkStackSnapshot(*snapshot_, frame_host_pcs,
+                                        kMaxFrameCount);
+    if (frame_count) {
+      AddSample(frame_host_pcs, frame_count);
+    }
+  }
+}
+
+void SamplingProfiler::AddSample(const uint64_t* frame_host_pcs,
+                                 size_t frame_count) {
+  auto code_cache = emulator_->processor()->backend()->code_cache();
+  ++sample_count_;
+
+  // Frames are ordered leaf first; only those in JIT code are kept.
+  cpu::GuestFunction* guest_frames[kMaxFrameCount];
+  size_t guest_frame_count = 0;
+  bool leaf_in_host = false;
+  for (size_t i = 0; i < frame_count; ++i) {
+    auto function = code_cache->LookupFunction(frame_host_pcs[i]);
+    if (!function) {
+      leaf_in_host |= i == 0;
+      continue;
+    }
+    guest_frames[guest_frame_count++] = function;
+  }
+  if (!guest_frame_count) {
+    ++unattributed_count_;
+    return;
+  }
+
+  auto& leaf = functions_[guest_frames[0]];
+  if (leaf_in_host) {
+    ++leaf.in_host;
+  } else {
+    ++leaf.self;
+  }
+  for (size_t i = 0; i < guest_frame_count; ++i) {
+    // Count recursive functions once per sample.
+    if (std::find(guest_frames, guest_frames + i, guest_frames[i]) !=
+        guest_frames + i) {
+      continue;
+    }
+    ++functions_[guest_frames[i]].inclusive;
+  }
+  for (size_t i = 0; i + 1 < guest_frame_count; ++i) {
+    ++call_edges_[{guest_frames[i + 1], guest_frames[i]}];
+  }
+}
+
+void SamplingProfiler::DumpReport(const std::wstring& path) {
+  assert_false(running_);
+
+  std::vector<std::pair<cpu::GuestFunction*, FunctionSamples>> functions(
+      functions_.begin(), functions_.end());
+  std::sort(functions.begin(), functions.end(),
+            [](const std::pair<cpu::GuestFunction*, FunctionSamples>& a,
+               const std::pair<cpu::GuestFunction*, FunctionSamples>& b) {
+              uint64_t a_total = a.second.self + a.second.in_host;
+              uint64_t b_total = b.second.self + b.second.in_host;
+              if (a_total != b_total) {
+                return a_total > b_total;
+              }
+              return a.second.inclusive > b.second.inclusive;
+            });
+  size_t report_count = std::min(
+      functions.size(),
+      static_cast<size_t>(std::max(FLAGS_sample_profile_report_count, 0)));
+
+  auto function_name = [](cpu::GuestFunction* function) {
+    return function->module()->name() + "!" + function->name();
+  };
+  double percent_per_sample = sample_count_ ? 100.0 / sample_count_ : 0.0;
+
+  StringBuffer sb;
+  sb.AppendFormat(
+      "Sampling profile: %llu samples over %.1fs, %llu outside guest code\n",
+      sample_count_,
+      static_cast<double>(sampled_ticks_) / Clock::host_tick_frequency(),
+      unattributed_count_);
+  sb.Append("   self%   host%   incl%  address  function\n");
+  for (size_t i = 0; i < report_count; ++i) {
+    auto function = functions[i].first;
+    const auto& samples = functions[i].second;
+    sb.AppendFormat("  %6.2f  %6.2f  %6.2f  %.8X %s\n",
+                    samples.self * percent_per_sample,
+                    samples.in_host * percent_per_sample,
+                    samples.inclusive * percent_per_sample,
+                    function->address(), function_name(function).c_str());
+  }
+
+  // Callers of the hottest functions, by the number of samples in which the
+  // caller called into them.
+  sb.Append("Callers:\n");
+  for (size_t i = 0; i < std::min(report_count, size_t(32)); ++i) {
+    auto callee = functions[i].first;
+    sb.AppendFormat("  %.8X %s\n", callee->address(),
+                    function_name(callee).c_str());
+    for (const auto& edge : call_edges_) {
+      if (edge.first.second != callee) {
+        continue;
+      }
+      auto caller = edge.first.first;
+      sb.AppendFormat("    %6.2f  %.8X %s\n", edge.second * percent_per_sample,
+                      caller->address(), function_name(caller).c_str());
+    }
+  }
+
+  if (!path.empty()) {
+    FILE* file = xe::filesystem::OpenFile(path, "wb");
+    if (file) {
+      fwrite(sb.GetString(), 1, sb.length(), file);
+      fclose(file);
+      XELOGI("Sampling profile written to %ls", path.c_str());
+      return;
+    }
+    XELOGE("Unable to write sampling profile to %ls", path.c_str());
+  }
+  std::string report = sb.to_string();
+  size_t line_start = 0;
+  while (line_start < report.size()) {
+    size_t line_end = report.find('\n', line_start);
+    if (line_end == std::string::npos) {
+      line_end = report.size();
+    }
+    XELOGI("%s", report.substr(line_start, line_end - line_start).c_str());
+    line_start = line_end + 1;
+  }
+}
+
+}  // namespace debug
+}  // namespace xe
@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_DEBUG_SAMPLING_PROFILER_H_
+#define XENIA_DEBUG_SAMPLING_PROFILER_H_
+
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "xenia/base/threading.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/stack_walker.h"
+
+DECLARE_int32(sample_profile_interval_us);
+DECLARE_string(sample_profile_path);
+
+namespace xe {
+class Emulator;
+}  // namespace xe
+
+namespace xe {
+namespace debug {
+
+// Periodically suspends guest threads, walks their host stacks and attributes
+// the samples to the guest functions found in the JIT code cache. Unlike
+// --trace_functions this needs no recompilation and barely perturbs timing.
+class SamplingProfiler {
+ public:
+  explicit SamplingProfiler(Emulator* emulator);
+  ~SamplingProfiler();
+
+  bool is_running() const { return running_; }
+
+  // Starts sampling every interval_us microseconds on a background thread.
+  bool Start(uint32_t interval_us);
+  // Stops sampling. Collected samples are kept until Reset.
+  void Stop();
+  void Reset();
+
+  // Writes a flat profile and the callers of the hottest functions to the
+  // given file, or the log if path is empty.
+  void DumpReport(const std::wstring& path);
+
+ private:
+  static const size_t kMaxFrameCount = 64;
+
+  struct FunctionSamples {
+    // Samples with the leaf in this function's code.
+    uint64_t self = 0;
+    // Samples with the leaf in host code (kernel exports, emulator) called
+    // from this function.
+    uint64_t in_host = 0;
+    // Samples with this function anywhere on the stack.
+    uint64_t inclusive = 0;
+  };
+
+  void ThreadMain();
+  void SampleThreads();
+  void AddSample(const uint64_t* frame_host_pcs, size_t frame_count);
+
+  Emulator* emulator_ = nullptr;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::atomic<bool> running_ = {false};
+  uint32_t interval_us_ = 0;
+
+  // Only touched by the sampling thread while running.
+  std::unique_ptr<cpu::StackSnapshot> snapshot_;
+  uint64_t sample_count_ = 0;
+  uint64_t unattributed_count_ = 0;
+  uint64_t start_ticks_ = 0;
+  uint64_t sampled_ticks_ = 0;
+  std::unordered_map<cpu::GuestFunction*, FunctionSamples> functions_;
+  std::map<std::pair<cpu::GuestFunction*, cpu::GuestFunction*>, uint64_t>
+      call_edges_;
+};
+
+}  // namespace debug
+}  // namespace xe
+
+#endif  // XENIA_DEBUG_SAMPLING_PROFILER_H_
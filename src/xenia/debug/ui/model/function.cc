@@ -9,12 +9,18 @@
 
 #include "xenia/debug/ui/model/function.h"
 
+#include <cstdio>
+
 namespace xe {
 namespace debug {
 namespace ui {
 namespace model {
 
-//
+std::string Function::to_string() const {
+  char value[160];
+  std::snprintf(value, sizeof(value), "%.8X %s", entry_.address, entry_.name);
+  return value;
+}
 
 }  // namespace model
 }  // namespace ui
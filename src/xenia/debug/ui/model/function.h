@@ -11,6 +11,10 @@
 #define XENIA_DEBUG_UI_MODEL_FUNCTION_H_
 
 #include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "xenia/debug/proto/xdp_protocol.h"
 
 namespace xe {
 namespace debug {
@@ -19,6 +23,19 @@ namespace model {
 
 class Function {
  public:
+  explicit Function(const proto::FunctionListEntry* entry) {
+    std::memcpy(&entry_, entry, sizeof(entry_));
+  }
+
+  uint32_t address() const { return entry_.address; }
+  uint32_t address_end() const { return entry_.address_end; }
+  std::string name() const { return entry_.name; }
+  const proto::FunctionListEntry* entry() const { return &entry_; }
+
+  std::string to_string() const;
+
+ private:
+  proto::FunctionListEntry entry_ = {0};
 };
 
 }  // namespace model
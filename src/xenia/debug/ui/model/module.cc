@@ -16,10 +16,51 @@ namespace debug {
 namespace ui {
 namespace model {
 
+// Enough to fill the function list a few times over.
+constexpr uint32_t kFunctionPageSize = 256;
+
 void Module::Update(const proto::ModuleListEntry* entry) {
   std::memcpy(&entry_, entry, sizeof(entry_));
 }
 
+void Module::SetFunctionFilter(std::string filter) {
+  function_filter_ = std::move(filter);
+  functions_.clear();
+  has_more_functions_ = true;
+  next_function_address_ = 0;
+  pending_function_request_ = 0;
+  FetchMoreFunctions();
+}
+
+void Module::FetchMoreFunctions() {
+  if (!has_more_functions_ || pending_function_request_) {
+    return;
+  }
+  pending_function_request_ = system_->client()->RequestFunctions(
+      module_handle(), next_function_address_, UINT32_MAX,
+      kFunctionPageSize, function_filter_);
+}
+
+bool Module::UpdateFunctions(
+    proto::request_id_t request_id,
+    const proto::FunctionListResponse* response,
+    std::vector<const proto::FunctionListEntry*> entries) {
+  if (request_id != pending_function_request_) {
+    return false;
+  }
+  pending_function_request_ = 0;
+  for (auto entry : entries) {
+    functions_.emplace_back(std::make_unique<Function>(entry));
+  }
+  has_more_functions_ = response->has_more;
+  next_function_address_ = response->next_address;
+  if (entries.empty() && has_more_functions_) {
+    // The server stopped before finding a match; keep scanning.
+    FetchMoreFunctions();
+  }
+  return true;
+}
+
 }  // namespace model
 }  // namespace ui
 }  // namespace debug
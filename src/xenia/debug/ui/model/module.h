@@ -11,9 +11,12 @@
 #define XENIA_DEBUG_UI_MODEL_MODULE_H_
 
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "xenia/debug/proto/xdp_protocol.h"
+#include "xenia/debug/ui/model/function.h"
 
 namespace xe {
 namespace debug {
@@ -36,10 +39,35 @@ class Module {
 
   void Update(const proto::ModuleListEntry* entry);
 
+  // Functions are fetched from the server a page at a time as they are
+  // needed, so attaching doesn't wait on modules with huge function counts.
+  // Loaded functions are in address order and match function_filter().
+  const std::vector<std::unique_ptr<Function>>& functions() const {
+    return functions_;
+  }
+  bool has_more_functions() const { return has_more_functions_; }
+  const std::string& function_filter() const { return function_filter_; }
+
+  // Drops the loaded functions and fetches the first page of those whose
+  // name contains filter.
+  void SetFunctionFilter(std::string filter);
+  // Fetches the next page, unless all are loaded or a fetch is in flight.
+  void FetchMoreFunctions();
+  // Appends a page. Returns false if it was for a superseded fetch.
+  bool UpdateFunctions(proto::request_id_t request_id,
+                       const proto::FunctionListResponse* response,
+                       std::vector<const proto::FunctionListEntry*> entries);
+
  private:
   System* system_ = nullptr;
   bool is_dead_ = false;
   proto::ModuleListEntry entry_ = {0};
+
+  std::vector<std::unique_ptr<Function>> functions_;
+  std::string function_filter_;
+  bool has_more_functions_ = true;
+  uint32_t next_function_address_ = 0;
+  proto::request_id_t pending_function_request_ = 0;
 };
 
 }  // namespace model
@@ -18,6 +18,8 @@ namespace model {
 
 using namespace xe::debug::proto;  // NOLINT(build/namespaces)
 
+constexpr uint32_t kThreadStateUpdateIntervalMs = 250;
+
 System::System(xe::ui::Loop* loop, DebugClient* client)
     : loop_(loop), client_(client) {
   client_->set_listener(this);
@@ -55,6 +57,10 @@ Thread* System::GetThreadByHandle(uint32_t thread_handle) {
 }
 
 void System::OnExecutionStateChanged(ExecutionState execution_state) {
+  // Keep thread views live while running; full state is fetched on stop.
+  if (execution_state == ExecutionState::kRunning) {
+    client_->SubscribeThreadStates(kThreadStateUpdateIntervalMs);
+  }
   on_execution_state_changed();
 }
 
@@ -85,6 +91,16 @@ void System::OnModulesUpdated(std::vector<const ModuleListEntry*> entries) {
   on_modules_updated();
 }
 
+void System::OnFunctionsUpdated(
+    request_id_t request_id, const FunctionListResponse* response,
+    std::vector<const FunctionListEntry*> entries) {
+  auto module = GetModuleByHandle(response->module_handle);
+  if (module &&
+      module->UpdateFunctions(request_id, response, std::move(entries))) {
+    on_functions_updated(module);
+  }
+}
+
 void System::OnThreadsUpdated(std::vector<const ThreadListEntry*> entries) {
   std::unordered_set<uint32_t> extra_threads;
   for (size_t i = 0; i < threads_.size(); ++i) {
@@ -45,6 +45,7 @@ class System : public DebugClientListener {
 
   Delegate<void> on_execution_state_changed;
   Delegate<void> on_modules_updated;
+  Delegate<Module*> on_functions_updated;
   Delegate<void> on_threads_updated;
   Delegate<Thread*> on_thread_state_updated;
 
@@ -52,6 +53,10 @@ class System : public DebugClientListener {
   void OnExecutionStateChanged(ExecutionState execution_state) override;
   void OnModulesUpdated(
       std::vector<const proto::ModuleListEntry*> entries) override;
+  void OnFunctionsUpdated(
+      proto::request_id_t request_id,
+      const proto::FunctionListResponse* response,
+      std::vector<const proto::FunctionListEntry*> entries) override;
   void OnThreadsUpdated(
       std::vector<const proto::ThreadListEntry*> entries) override;
   void OnThreadStateUpdated(
@@ -17,6 +17,9 @@ namespace ui {
 namespace views {
 namespace cpu {
 
+// Item at the end of a partially loaded function list that loads the rest.
+const uint32_t kLoadMoreFunctionsId = 0;
+
 CpuView::CpuView()
     : View("CPU"),
       gr_registers_control_(RegisterSet::kGeneral),
@@ -47,6 +50,7 @@ el::Element* CpuView::BuildUI() {
                      .distribution(LayoutDistribution::kAvailable)
                      .axis(Axis::kX)
                      .child(TextBoxNode()
+                                .id("function_filter")
                                 .type(EditType::kSearch)
                                 .placeholder("Filter")));
 
@@ -180,6 +184,30 @@ el::Element* CpuView::BuildUI() {
                      UpdateFunctionList();
                      return true;
                    });
+  handler_->Listen(el::EventType::kChanged, TBIDC("function_filter"),
+                   [this](const el::Event& ev) {
+                     auto function_filter =
+                         root_element_.GetElementById<el::TextBox>(
+                             TBIDC("function_filter"));
+                     if (function_module_) {
+                       function_module_->SetFunctionFilter(
+                           function_filter->text());
+                     }
+                     UpdateFunctionList();
+                     return true;
+                   });
+  handler_->Listen(el::EventType::kChanged, TBIDC("function_listbox"),
+                   [this](const el::Event& ev) {
+                     auto function_listbox =
+                         root_element_.GetElementById<el::ListBox>(
+                             TBIDC("function_listbox"));
+                     if (function_module_ &&
+                         uint32_t(function_listbox->selected_item_id()) ==
+                             kLoadMoreFunctionsId) {
+                       function_module_->FetchMoreFunctions();
+                     }
+                     return true;
+                   });
   handler_->Listen(
       el::EventType::kChanged, TBIDC("thread_dropdown"),
       [this](const el::Event& ev) {
@@ -204,6 +232,11 @@ void CpuView::Setup(DebugClient* client) {
   system()->on_execution_state_changed.AddListener(
       [this]() { UpdateElementState(); });
   system()->on_modules_updated.AddListener([this]() { UpdateModuleList(); });
+  system()->on_functions_updated.AddListener([this](model::Module* module) {
+    if (module == function_module_) {
+      UpdateFunctionList();
+    }
+  });
   system()->on_threads_updated.AddListener([this]() { UpdateThreadList(); });
 }
 
@@ -235,17 +268,40 @@ void CpuView::UpdateModuleList() {
 void CpuView::UpdateFunctionList() {
   el::DropDownButton* module_dropdown;
   el::ListBox* function_listbox;
+  el::TextBox* function_filter;
   root_element_.GetElementsById({
       {TBIDC("module_dropdown"), &module_dropdown},
       {TBIDC("function_listbox"), &function_listbox},
+      {TBIDC("function_filter"), &function_filter},
   });
   auto module_handle = module_dropdown->selected_item_id();
   auto module = system()->GetModuleByHandle(module_handle);
+  auto function_items = function_listbox->default_source();
+  function_items->clear();
+  function_module_ = module;
   if (!module) {
-    function_listbox->default_source()->clear();
     return;
   }
-  // TODO(benvanik): fetch list.
+
+  // Only the first page is fetched when a module is shown; the rest load on
+  // request from the end of the list.
+  auto filter = function_filter->text();
+  if (module->function_filter() != filter) {
+    module->SetFunctionFilter(filter);
+  } else if (module->functions().empty()) {
+    module->FetchMoreFunctions();
+  }
+
+  for (auto& function : module->functions()) {
+    auto item = std::make_unique<el::GenericStringItem>(function->to_string());
+    item->id = function->address();
+    function_items->push_back(std::move(item));
+  }
+  if (module->has_more_functions()) {
+    auto item = std::make_unique<el::GenericStringItem>("Load more...");
+    item->id = kLoadMoreFunctionsId;
+    function_items->push_back(std::move(item));
+  }
 }
 
 void CpuView::UpdateThreadList() {
@@ -42,6 +42,8 @@ class CpuView : public View {
 
   // TODO(benvanik): better state machine.
   model::Thread* current_thread_ = nullptr;
+  // Module whose functions are listed.
+  model::Module* function_module_ = nullptr;
 
   RegisterListControl gr_registers_control_;
   RegisterListControl fr_registers_control_;
@@ -11,27 +11,139 @@
 
 #include <gflags/gflags.h>
 
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
 #include "xenia/apu/audio_system.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/string.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/thread_state.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/hid/input_system.h"
 #include "xenia/kernel/kernel.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/modules.h"
+#include "xenia/kernel/objects/xthread.h"
 #include "xenia/memory.h"
 #include "xenia/vfs/virtual_file_system.h"
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/host_path_device.h"
 #include "xenia/vfs/devices/stfs_container_device.h"
 
 DEFINE_double(time_scalar, 1.0,
               "Scalar used to speed or slow time (1x, 2x, 1/2x, etc).");
+DEFINE_double(fast_forward_time_scalar, 8.0,
+              "Time scalar used while fast-forwarding.");
+DEFINE_bool(fast_forward, false, "Start with fast-forward enabled.");
+DEFINE_bool(parallel_startup, true,
+            "Run independent emulator setup steps (GL context creation, CPU "
+            "backend, audio, kernel modules) concurrently.");
+DEFINE_int32(numa_node, -1,
+             "NUMA node to keep guest memory, generated code and all emulator "
+             "threads on, or -1 to leave placement to the host.");
+DEFINE_bool(numa_interleave, false,
+            "Interleave guest memory and generated code across all NUMA "
+            "nodes. Ignored if --numa_node is set.");
 
 namespace xe {
 
+namespace {
+
+// Runs a group of independent setup steps concurrently (or in order without
+// --parallel_startup) and logs how long each one took.
+class StartupTaskGroup {
+ public:
+  void Add(const char* name, std::function<X_STATUS()> fn) {
+    tasks_.push_back({name, std::move(fn), X_STATUS_SUCCESS, 0});
+  }
+
+  // Runs all tasks, the first on the calling thread, and returns the first
+  // failure in the order the tasks were added.
+  X_STATUS Run() {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < tasks_.size(); ++i) {
+      if (FLAGS_parallel_startup) {
+        threads.emplace_back([this, i]() { RunTask(&tasks_[i]); });
+      } else {
+        RunTask(&tasks_[i]);
+      }
+    }
+    if (!tasks_.empty()) {
+      RunTask(&tasks_[0]);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    double ms_per_tick = 1000.0 / Clock::host_tick_frequency();
+    X_STATUS result = X_STATUS_SUCCESS;
+    for (auto& task : tasks_) {
+      XELOGI("Startup: %-24s %8.1fms", task.name, task.ticks * ms_per_tick);
+      if (XFAILED(task.result) && !XFAILED(result)) {
+        XELOGE("Startup: %s failed (%.8X)", task.name, task.result);
+        result = task.result;
+      }
+    }
+    tasks_.clear();
+    return result;
+  }
+
+ private:
+  struct Task {
+    const char* name;
+    std::function<X_STATUS()> fn;
+    X_STATUS result;
+    uint64_t ticks;
+  };
+
+  static void RunTask(Task* task) {
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    task->result = task->fn();
+    task->ticks = Clock::QueryHostTickCount() - start_ticks;
+  }
+
+  std::vector<Task> tasks_;
+};
+
+// Logs the host NUMA topology and applies --numa_node or --numa_interleave.
+// Must run before any memory it affects is mapped.
+void ConfigureNuma() {
+  auto& node_masks = xe::threading::numa_node_masks();
+  XELOGI("Host has %d NUMA node(s)", int(node_masks.size()));
+  for (size_t i = 0; i < node_masks.size(); ++i) {
+    XELOGI("  Node %d: processors %.16llX", int(i), node_masks[i]);
+  }
+
+  if (FLAGS_numa_node >= 0) {
+    if (size_t(FLAGS_numa_node) >= node_masks.size() ||
+        !node_masks[FLAGS_numa_node]) {
+      XELOGW("NUMA node %d has no processors; placement left to the host",
+             FLAGS_numa_node);
+      return;
+    }
+    if (!xe::threading::set_process_affinity_mask(
+            node_masks[FLAGS_numa_node])) {
+      XELOGW("Unable to restrict threads to NUMA node %d", FLAGS_numa_node);
+    }
+    xe::memory::set_numa_placement(FLAGS_numa_node);
+    XELOGI("Using NUMA node %d", FLAGS_numa_node);
+  } else if (FLAGS_numa_interleave) {
+    xe::memory::set_numa_placement(xe::memory::kNumaInterleave);
+    XELOGI("Interleaving memory across NUMA nodes");
+  }
+}
+
+}  // namespace
+
 Emulator::Emulator(const std::wstring& command_line)
     : command_line_(command_line) {}
 
@@ -43,6 +155,13 @@ Emulator::~Emulator() {
     debugger_->StopSession();
   }
 
+  if (sampling_profiler_) {
+    // Report while the sampled functions and threads are still alive.
+    sampling_profiler_->Stop();
+    sampling_profiler_->DumpReport(xe::to_wstring(FLAGS_sample_profile_path));
+    sampling_profiler_.reset();
+  }
+
   // Give the systems time to shutdown before we delete them.
   graphics_system_->Shutdown();
   audio_system_->Shutdown();
@@ -58,6 +177,9 @@ Emulator::~Emulator() {
 
   debugger_.reset();
 
+  if (FLAGS_kernel_call_stats && export_resolver_) {
+    export_resolver_->DumpCallStats();
+  }
   export_resolver_.reset();
 }
 
@@ -77,6 +199,7 @@ X_STATUS Emulator::Setup(ui::Window* display_window) {
   // Before we can set thread affinity we must enable the process to use all
   // logical processors.
   xe::threading::EnableAffinityConfiguration();
+  ConfigureNuma();
 
   // Create memory system first, as it is required for other systems.
   memory_ = std::make_unique<Memory>();
@@ -111,10 +234,6 @@ X_STATUS Emulator::Setup(ui::Window* display_window) {
   if (!graphics_system_) {
     return X_STATUS_NOT_IMPLEMENTED;
   }
-  display_window_->loop()->PostSynchronous([this]() {
-    display_window_->set_context(
-        graphics_system_->CreateContext(display_window_));
-  });
 
   // Initialize the HID.
   input_system_ = xe::hid::InputSystem::Create(this);
@@ -133,24 +252,59 @@ X_STATUS Emulator::Setup(ui::Window* display_window) {
   // Shared kernel state.
   kernel_state_ = std::make_unique<xe::kernel::KernelState>(this);
 
-  // Setup the core components.
-  if (!processor_->Setup()) {
+  uint64_t startup_ticks = Clock::QueryHostTickCount();
+  StartupTaskGroup tasks;
+
+  // The display context is created on the UI thread while the CPU backend
+  // initializes; nothing else can run until the backend is up as the
+  // remaining steps create guest-visible threads.
+  tasks.Add("processor setup", [this]() {
+    return processor_->Setup() ? X_STATUS_SUCCESS : X_STATUS_UNSUCCESSFUL;
+  });
+  tasks.Add("display context", [this]() {
+    display_window_->loop()->PostSynchronous([this]() {
+      display_window_->set_context(
+          graphics_system_->CreateContext(display_window_));
+    });
+    return X_STATUS_SUCCESS;
+  });
+  result = tasks.Run();
+  if (result) {
     return result;
   }
-  result = graphics_system_->Setup(processor_.get(), display_window_->loop(),
+
+  // Graphics, audio and the HLE kernel modules only share the kernel state,
+  // the guest heaps and the MMIO handler (both graphics and audio register
+  // MMIO ranges), all of which lock internally.
+  tasks.Add("graphics setup", [this]() {
+    return graphics_system_->Setup(processor_.get(), display_window_->loop(),
                                    display_window_);
+  });
+  tasks.Add("audio setup", [this]() {
+    return audio_system_->Setup(kernel_state_.get());
+  });
+  tasks.Add("kernel modules", [this]() {
+    kernel_state_->LoadKernelModule<kernel::XboxkrnlModule>();
+    kernel_state_->LoadKernelModule<kernel::XamModule>();
+    return X_STATUS_SUCCESS;
+  });
+  result = tasks.Run();
   if (result) {
     return result;
   }
 
-  result = audio_system_->Setup(kernel_state_.get());
-  if (result) {
-    return result;
+  XELOGI("Startup: %-24s %8.1fms", "total",
+         (Clock::QueryHostTickCount() - startup_ticks) * 1000.0 /
+             Clock::host_tick_frequency());
+
+  if (FLAGS_sample_profile_interval_us > 0) {
+    sampling_profiler_ = std::make_unique<debug::SamplingProfiler>(this);
+    sampling_profiler_->Start(FLAGS_sample_profile_interval_us);
   }
 
-  // HLE kernel modules.
-  kernel_state_->LoadKernelModule<kernel::XboxkrnlModule>();
-  kernel_state_->LoadKernelModule<kernel::XamModule>();
+  if (FLAGS_fast_forward) {
+    SetFastForward(true);
+  }
 
   // Finish initializing the display.
   display_window_->loop()->PostSynchronous([this]() {
@@ -226,7 +380,13 @@ X_STATUS Emulator::LaunchDiscImage(std::wstring path) {
   auto mount_path = "\\Device\\Cdrom0";
 
   // Register the disc image in the virtual filesystem.
-  auto device = std::make_unique<vfs::DiscImageDevice>(mount_path, path);
+  std::unique_ptr<vfs::DiscImageDevice> device;
+  if (vfs::CompressedDiscImageDevice::IsCompressedImage(path)) {
+    device =
+        std::make_unique<vfs::CompressedDiscImageDevice>(mount_path, path);
+  } else {
+    device = std::make_unique<vfs::DiscImageDevice>(mount_path, path);
+  }
   if (!device->Initialize()) {
     xe::FatalError("Unable to mount disc image; file not found or corrupt.");
     return X_STATUS_NO_SUCH_FILE;
@@ -294,4 +454,180 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
   }
 }
 
+// Snapshot file layout: header, memory heaps (see Memory::Save), GPU
+// registers, then the guest register state of each guest thread.
+static const uint32_t kSnapshotMagic = 0x504E5358;  // 'XSNP'
+static const uint32_t kSnapshotVersion = 2;
+
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t title_id;
+  uint32_t thread_count;
+};
+
+// The guest registers of a context; everything from the link register up to
+// the host bookkeeping that starts at thread_id.
+static const size_t kContextStateOffset =
+    offsetof(cpu::frontend::PPCContext, lr);
+static const size_t kContextStateSize =
+    offsetof(cpu::frontend::PPCContext, thread_id) - kContextStateOffset;
+
+std::vector<kernel::object_ref<kernel::XThread>>
+Emulator::SuspendGuestThreads() {
+  std::vector<kernel::object_ref<kernel::XThread>> threads;
+  for (auto& thread : kernel_state_->GetThreads()) {
+    if (thread->is_guest_thread() &&
+        XSUCCEEDED(thread->Suspend(nullptr))) {
+      threads.push_back(std::move(thread));
+    }
+  }
+  return threads;
+}
+
+void Emulator::ResumeGuestThreads(
+    const std::vector<kernel::object_ref<kernel::XThread>>& threads) {
+  for (auto& thread : threads) {
+    thread->Resume();
+  }
+}
+
+X_STATUS Emulator::SaveSnapshot(const std::wstring& path) {
+  xe::filesystem::CreateParentFolder(path);
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to create snapshot %S", path.c_str());
+    return X_STATUS_ACCESS_DENIED;
+  }
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  auto threads = SuspendGuestThreads();
+
+  SnapshotHeader header = {kSnapshotMagic, kSnapshotVersion,
+                           kernel_state_->title_id(),
+                           uint32_t(threads.size())};
+  fwrite(&header, sizeof(header), 1, file);
+  bool succeeded = memory_->Save(file);
+  auto register_file = graphics_system_->register_file();
+  uint32_t register_count =
+      register_file ? uint32_t(gpu::RegisterFile::kRegisterCount) : 0;
+  fwrite(&register_count, sizeof(register_count), 1, file);
+  if (register_file) {
+    fwrite(register_file->values, sizeof(register_file->values), 1, file);
+  }
+  for (auto& thread : threads) {
+    uint32_t thread_id = thread->thread_id();
+    auto context =
+        reinterpret_cast<uint8_t*>(thread->thread_state()->context());
+    fwrite(&thread_id, sizeof(thread_id), 1, file);
+    fwrite(context + kContextStateOffset, kContextStateSize, 1, file);
+  }
+  succeeded = succeeded && !ferror(file);
+
+  ResumeGuestThreads(threads);
+  fclose(file);
+  if (!succeeded) {
+    XELOGE("Failed to write snapshot %S", path.c_str());
+    return X_STATUS_UNSUCCESSFUL;
+  }
+  XELOGI("Saved snapshot %S in %.1fms", path.c_str(),
+         (Clock::QueryHostTickCount() - start_ticks) * 1000.0 /
+             Clock::host_tick_frequency());
+  return X_STATUS_SUCCESS;
+}
+
+X_STATUS Emulator::RestoreSnapshot(const std::wstring& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    XELOGE("Unable to open snapshot %S", path.c_str());
+    return X_STATUS_NO_SUCH_FILE;
+  }
+  SnapshotHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != kSnapshotMagic || header.version != kSnapshotVersion) {
+    XELOGE("%S is not a supported snapshot", path.c_str());
+    fclose(file);
+    return X_STATUS_UNSUCCESSFUL;
+  }
+  if (header.title_id != kernel_state_->title_id()) {
+    XELOGE("Snapshot %S is of title %.8X, not the running %.8X",
+           path.c_str(), header.title_id, kernel_state_->title_id());
+    fclose(file);
+    return X_STATUS_UNSUCCESSFUL;
+  }
+
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  auto threads = SuspendGuestThreads();
+  bool succeeded = memory_->Restore(file);
+
+  uint32_t register_count = 0;
+  if (succeeded &&
+      fread(&register_count, sizeof(register_count), 1, file) != 1) {
+    succeeded = false;
+  }
+  auto register_file = graphics_system_->register_file();
+  if (succeeded && register_count) {
+    if (register_file &&
+        register_count == gpu::RegisterFile::kRegisterCount) {
+      succeeded = fread(register_file->values, sizeof(register_file->values),
+                        1, file) == 1;
+    } else {
+      XELOGW("Snapshot GPU registers don't match this backend; skipped");
+      fseek(file, long(register_count * sizeof(uint32_t)), SEEK_CUR);
+    }
+  }
+
+  std::vector<uint8_t> context_state(kContextStateSize);
+  for (uint32_t i = 0; succeeded && i < header.thread_count; ++i) {
+    uint32_t thread_id;
+    if (fread(&thread_id, sizeof(thread_id), 1, file) != 1 ||
+        fread(context_state.data(), kContextStateSize, 1, file) != 1) {
+      succeeded = false;
+      break;
+    }
+    auto thread = kernel_state_->GetThreadByID(thread_id);
+    if (!thread || !thread->is_guest_thread()) {
+      XELOGW("Snapshot thread %.8X no longer exists; skipped", thread_id);
+      continue;
+    }
+    auto context = thread->thread_state()->context();
+    std::memcpy(reinterpret_cast<uint8_t*>(context) + kContextStateOffset,
+                context_state.data(), kContextStateSize);
+    context->reserved_addr = 0;
+  }
+  fclose(file);
+
+  // Textures and buffers were cached from the memory just replaced.
+  graphics_system_->ClearCaches();
+  ResumeGuestThreads(threads);
+  if (!succeeded) {
+    XELOGE("Failed to restore snapshot %S; guest state is inconsistent",
+           path.c_str());
+    return X_STATUS_UNSUCCESSFUL;
+  }
+  XELOGI("Restored snapshot %S in %.1fms", path.c_str(),
+         (Clock::QueryHostTickCount() - start_ticks) * 1000.0 /
+             Clock::host_tick_frequency());
+  return X_STATUS_SUCCESS;
+}
+
+void Emulator::SetFastForward(bool enabled) {
+  if (enabled == fast_forward_) {
+    return;
+  }
+  fast_forward_ = enabled;
+  if (enabled) {
+    fast_forward_restore_time_scalar_ = Clock::guest_time_scalar();
+    Clock::set_guest_time_scalar(FLAGS_fast_forward_time_scalar);
+  } else {
+    Clock::set_guest_time_scalar(fast_forward_restore_time_scalar_);
+  }
+  if (audio_system_) {
+    audio_system_->set_fast_forward(enabled);
+  }
+  if (graphics_system_) {
+    graphics_system_->set_fast_forward(enabled);
+  }
+  XELOGI("Fast-forward %s", enabled ? "on" : "off");
+}
+
 }  // namespace xe
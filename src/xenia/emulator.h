@@ -11,8 +11,10 @@
 #define XENIA_EMULATOR_H_
 
 #include <string>
+#include <vector>
 
 #include "xenia/debug/debugger.h"
+#include "xenia/debug/sampling_profiler.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/memory.h"
 #include "xenia/vfs/virtual_file_system.h"
@@ -74,10 +76,29 @@ class Emulator {
   X_STATUS LaunchDiscImage(std::wstring path);
   X_STATUS LaunchStfsContainer(std::wstring path);
 
+  // Writes guest memory, the GPU register file and guest thread contexts to
+  // a file. Guest threads are suspended while it's written.
+  X_STATUS SaveSnapshot(const std::wstring& path);
+  // Rewinds the running title to a snapshot it saved earlier in the session.
+  // Kernel objects aren't part of snapshots, so the ones in use then must
+  // still exist, and thread contexts are only meaningful for threads parked
+  // where they were when it was taken.
+  X_STATUS RestoreSnapshot(const std::wstring& path);
+
+  // Runs the guest clock at --fast_forward_time_scalar and stops pacing it
+  // to the display and audio device. The previous time scalar is restored
+  // when turned off.
+  void SetFastForward(bool enabled);
+  bool is_fast_forward() const { return fast_forward_; }
+
  private:
   X_STATUS CompleteLaunch(const std::wstring& path,
                           const std::string& module_path);
 
+  std::vector<kernel::object_ref<kernel::XThread>> SuspendGuestThreads();
+  void ResumeGuestThreads(
+      const std::vector<kernel::object_ref<kernel::XThread>>& threads);
+
   std::wstring command_line_;
 
   ui::Window* display_window_;
@@ -85,6 +106,7 @@ class Emulator {
   std::unique_ptr<Memory> memory_;
 
   std::unique_ptr<debug::Debugger> debugger_;
+  std::unique_ptr<debug::SamplingProfiler> sampling_profiler_;
 
   std::unique_ptr<cpu::Processor> processor_;
   std::unique_ptr<apu::AudioSystem> audio_system_;
@@ -95,6 +117,9 @@ class Emulator {
   std::unique_ptr<vfs::VirtualFileSystem> file_system_;
 
   std::unique_ptr<kernel::KernelState> kernel_state_;
+
+  bool fast_forward_ = false;
+  double fast_forward_restore_time_scalar_ = 1.0;
 };
 
 }  // namespace xe
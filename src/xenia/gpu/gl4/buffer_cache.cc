@@ -0,0 +1,393 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/gl4/buffer_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+const size_t kBufferCacheCapacity = 128 * 1024 * 1024;
+const size_t kBufferCacheAlignment = 256;
+
+// Space freed in a frame is only reused this many frames later, by which
+// point the command processor has waited for the GPU to finish with it.
+const uint32_t kReclaimFrameCount = 4;
+// Ranges rewritten within this many frames of being uploaded are streamed
+// for kDynamicFrameCount frames before being cached again.
+const uint32_t kStaticFrameCount = 4;
+const uint32_t kDynamicFrameCount = 120;
+// Entries not used for this many frames are evicted when space runs out.
+const uint32_t kMinUnusedFrames = 8;
+
+BufferCache::BufferCache()
+    : memory_(nullptr),
+      buffer_(0),
+      host_base_(nullptr),
+      frame_number_(0),
+      upload_bytes_(0),
+      evict_unused_(false) {}
+
+BufferCache::~BufferCache() = default;
+
+bool BufferCache::Initialize(Memory* memory) {
+  memory_ = memory;
+
+  glCreateBuffers(1, &buffer_);
+  glNamedBufferStorage(
+      buffer_, kBufferCacheCapacity, nullptr,
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+  host_base_ = reinterpret_cast<uint8_t*>(glMapNamedBufferRange(
+      buffer_, 0, kBufferCacheCapacity,
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT));
+  if (!host_base_) {
+    XELOGE("Unable to map buffer cache");
+    glDeleteBuffers(1, &buffer_);
+    buffer_ = 0;
+    return false;
+  }
+
+  free_ranges_.clear();
+  free_ranges_.insert({0, kBufferCacheCapacity});
+  return true;
+}
+
+void BufferCache::Shutdown() {
+  if (!buffer_) {
+    return;
+  }
+  Clear();
+  retired_entries_.clear();
+  glUnmapNamedBuffer(buffer_);
+  glDeleteBuffers(1, &buffer_);
+  buffer_ = 0;
+  host_base_ = nullptr;
+}
+
+bool BufferCache::Allocate(size_t length, size_t* out_offset) {
+  for (auto it = free_ranges_.begin(); it != free_ranges_.end(); ++it) {
+    if (it->second < length) {
+      continue;
+    }
+    *out_offset = it->first;
+    size_t remaining = it->second - length;
+    size_t remaining_offset = it->first + length;
+    free_ranges_.erase(it);
+    if (remaining) {
+      free_ranges_.insert({remaining_offset, remaining});
+    }
+    return true;
+  }
+  return false;
+}
+
+void BufferCache::Free(size_t offset, size_t length) {
+  auto it = free_ranges_.insert({offset, length}).first;
+  // Merge with the following range.
+  auto next = std::next(it);
+  if (next != free_ranges_.end() && it->first + it->second == next->first) {
+    it->second += next->second;
+    free_ranges_.erase(next);
+  }
+  // Merge with the preceding range.
+  if (it != free_ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second == it->first) {
+      prev->second += it->second;
+      free_ranges_.erase(it);
+    }
+  }
+}
+
+void BufferCache::RetireEntry(std::unique_ptr<Entry> entry) {
+  if (entry->write_watch_handle) {
+    memory_->CancelWriteWatch(entry->write_watch_handle);
+    entry->write_watch_handle = 0;
+  }
+  retired_entries_.push_back({std::move(entry), frame_number_});
+}
+
+uint32_t BufferCache::GetConvertedIndexCount(IndexConversion conversion,
+                                             uint32_t index_count) {
+  switch (conversion) {
+    case IndexConversion::kNone:
+      return index_count;
+    case IndexConversion::kQuadListToTriangleList:
+      return index_count / 4 * 6;
+    case IndexConversion::kQuadListToLineList:
+      return index_count / 4 * 8;
+  }
+  assert_unhandled_case(conversion);
+  return index_count;
+}
+
+// Quads are split along their 1-3 diagonal, keeping their winding.
+template <typename T, typename F>
+static void ExpandQuads(BufferCache::IndexConversion conversion,
+                        uint32_t index_count, T* dest, F corner) {
+  uint32_t quad_count = index_count / 4;
+  if (conversion == BufferCache::IndexConversion::kQuadListToTriangleList) {
+    for (uint32_t i = 0; i < quad_count; ++i) {
+      T v0 = corner(i * 4 + 0);
+      T v1 = corner(i * 4 + 1);
+      T v2 = corner(i * 4 + 2);
+      T v3 = corner(i * 4 + 3);
+      *dest++ = v0;
+      *dest++ = v1;
+      *dest++ = v3;
+      *dest++ = v1;
+      *dest++ = v2;
+      *dest++ = v3;
+    }
+  } else {
+    for (uint32_t i = 0; i < quad_count; ++i) {
+      T v0 = corner(i * 4 + 0);
+      T v1 = corner(i * 4 + 1);
+      T v2 = corner(i * 4 + 2);
+      T v3 = corner(i * 4 + 3);
+      *dest++ = v0;
+      *dest++ = v1;
+      *dest++ = v1;
+      *dest++ = v2;
+      *dest++ = v2;
+      *dest++ = v3;
+      *dest++ = v3;
+      *dest++ = v0;
+    }
+  }
+}
+
+void BufferCache::ConvertIndices(IndexConversion conversion,
+                                 uint32_t element_size, const void* src,
+                                 uint32_t index_count, void* dest,
+                                 uint32_t* out_min_index,
+                                 uint32_t* out_max_index) {
+  uint32_t min_index = UINT32_MAX;
+  uint32_t max_index = 0;
+  auto track = [&min_index, &max_index](uint32_t index) {
+    min_index = std::min(min_index, index);
+    max_index = std::max(max_index, index);
+  };
+  if (element_size == 1) {
+    assert_true(conversion == IndexConversion::kNone);
+    assert_null(out_min_index);
+    std::memcpy(dest, src, index_count);
+    return;
+  } else if (element_size == 2) {
+    auto src_16 = reinterpret_cast<const uint16_t*>(src);
+    auto dest_16 = reinterpret_cast<uint16_t*>(dest);
+    if (conversion == IndexConversion::kNone) {
+      if (!out_min_index) {
+        xe::copy_and_swap_16_aligned(dest_16, src_16, index_count);
+        return;
+      }
+      uint16_t min_16, max_16;
+      xe::copy_and_swap_16_min_max(dest_16, src_16, index_count, &min_16,
+                                   &max_16);
+      if (index_count) {
+        min_index = min_16;
+        max_index = max_16;
+      }
+    } else {
+      ExpandQuads(conversion, index_count, dest_16,
+                  [src_16, &track](uint32_t i) {
+                    uint16_t index = xe::byte_swap(src_16[i]);
+                    track(index);
+                    return index;
+                  });
+    }
+  } else {
+    assert_true(element_size == 4);
+    auto src_32 = reinterpret_cast<const uint32_t*>(src);
+    auto dest_32 = reinterpret_cast<uint32_t*>(dest);
+    if (conversion == IndexConversion::kNone) {
+      if (!out_min_index) {
+        xe::copy_and_swap_32_aligned(dest_32, src_32, index_count);
+        return;
+      }
+      xe::copy_and_swap_32_min_max(dest_32, src_32, index_count, &min_index,
+                                   &max_index);
+    } else {
+      ExpandQuads(conversion, index_count, dest_32,
+                  [src_32, &track](uint32_t i) {
+                    uint32_t index = xe::byte_swap(src_32[i]);
+                    track(index);
+                    return index;
+                  });
+    }
+  }
+  if (out_min_index) {
+    *out_min_index = min_index;
+    *out_max_index = max_index;
+  }
+}
+
+void BufferCache::GenerateIndices(IndexConversion conversion,
+                                  uint32_t index_count, uint16_t* dest) {
+  assert_true(conversion != IndexConversion::kNone);
+  ExpandQuads(conversion, index_count, dest,
+              [](uint32_t i) { return uint16_t(i); });
+}
+
+bool BufferCache::Demand(uint32_t guest_address, uint32_t length,
+                         uint32_t element_size, IndexConversion conversion,
+                         size_t* out_offset, uint32_t* out_min_index,
+                         uint32_t* out_max_index) {
+  EntryKey key = {guest_address, length, element_size, conversion};
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    auto entry = it->second.get();
+    if (!entry->pending_invalidation) {
+      entry->last_used_frame = frame_number_;
+      *out_offset = entry->offset;
+      if (out_min_index) {
+        *out_min_index = entry->min_index;
+        *out_max_index = entry->max_index;
+      }
+      return true;
+    }
+    // Rewritten since it was uploaded.
+    if (frame_number_ - entry->upload_frame < kStaticFrameCount) {
+      dynamic_ranges_[key] = frame_number_ + kDynamicFrameCount;
+    }
+    RetireEntry(std::move(it->second));
+    entries_.erase(it);
+  }
+
+  auto dynamic_it = dynamic_ranges_.find(key);
+  if (dynamic_it != dynamic_ranges_.end()) {
+    if (int32_t(frame_number_ - dynamic_it->second) < 0) {
+      return false;
+    }
+    dynamic_ranges_.erase(dynamic_it);
+  }
+
+  uint32_t converted_length =
+      GetConvertedIndexCount(conversion, length / element_size) * element_size;
+  size_t allocated_length =
+      xe::round_up(size_t(converted_length), kBufferCacheAlignment);
+  size_t offset;
+  if (!Allocate(allocated_length, &offset)) {
+    evict_unused_ = true;
+    return false;
+  }
+
+  auto entry = std::make_unique<Entry>();
+  entry->key = key;
+  entry->offset = offset;
+  entry->allocated_length = allocated_length;
+  entry->upload_frame = frame_number_;
+  entry->last_used_frame = frame_number_;
+  entry->pending_invalidation = false;
+
+  // Watch before copying so that writes racing the copy aren't missed.
+  entry->write_watch_handle = memory_->AddPhysicalWriteWatch(
+      guest_address, length,
+      [](void* context_ptr, void* data_ptr, uint32_t address) {
+        auto self = reinterpret_cast<BufferCache*>(context_ptr);
+        auto touched_entry = reinterpret_cast<Entry*>(data_ptr);
+        touched_entry->write_watch_handle = 0;
+        touched_entry->pending_invalidation = true;
+        std::lock_guard<xe::mutex> lock(self->invalidated_entries_mutex_);
+        self->invalidated_entries_.push_back(touched_entry->key);
+      },
+      this, entry.get());
+
+  bool is_index_data = element_size > 1;
+  entry->min_index = UINT32_MAX;
+  entry->max_index = 0;
+  ConvertIndices(conversion, element_size,
+                 memory_->TranslatePhysical(guest_address),
+                 length / element_size, host_base_ + offset,
+                 is_index_data ? &entry->min_index : nullptr,
+                 is_index_data ? &entry->max_index : nullptr);
+  if (out_min_index) {
+    *out_min_index = entry->min_index;
+    *out_max_index = entry->max_index;
+  }
+
+  upload_bytes_ += converted_length;
+
+  *out_offset = offset;
+  entries_.insert({key, std::move(entry)});
+  return true;
+}
+
+void BufferCache::EvictUnusedEntries() {
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (frame_number_ - it->second->last_used_frame >= kMinUnusedFrames) {
+      RetireEntry(std::move(it->second));
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void BufferCache::Scavenge() {
+  SCOPE_profile_cpu_f("gpu");
+
+  std::vector<EntryKey> invalidated_entries;
+  {
+    std::lock_guard<xe::mutex> lock(invalidated_entries_mutex_);
+    invalidated_entries.swap(invalidated_entries_);
+  }
+  for (auto& key : invalidated_entries) {
+    auto it = entries_.find(key);
+    if (it == entries_.end() || !it->second->pending_invalidation) {
+      // Already dropped by Demand.
+      continue;
+    }
+    if (frame_number_ - it->second->upload_frame < kStaticFrameCount) {
+      dynamic_ranges_[key] = frame_number_ + kDynamicFrameCount;
+    }
+    RetireEntry(std::move(it->second));
+    entries_.erase(it);
+  }
+
+  if (evict_unused_) {
+    evict_unused_ = false;
+    EvictUnusedEntries();
+  }
+
+  auto end = std::partition(
+      retired_entries_.begin(), retired_entries_.end(),
+      [this](const RetiredEntry& retired) {
+        return frame_number_ - retired.frame < kReclaimFrameCount;
+      });
+  for (auto it = end; it != retired_entries_.end(); ++it) {
+    Free(it->entry->offset, it->entry->allocated_length);
+  }
+  retired_entries_.erase(end, retired_entries_.end());
+
+  ++frame_number_;
+}
+
+void BufferCache::Clear() {
+  for (auto& it : entries_) {
+    RetireEntry(std::move(it.second));
+  }
+  entries_.clear();
+  dynamic_ranges_.clear();
+  std::lock_guard<xe::mutex> lock(invalidated_entries_mutex_);
+  invalidated_entries_.clear();
+}
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
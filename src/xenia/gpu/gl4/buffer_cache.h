@@ -0,0 +1,154 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_GL4_BUFFER_CACHE_H_
+#define XENIA_GPU_GL4_BUFFER_CACHE_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/memory.h"
+#include "xenia/ui/gl/gl_context.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+// Vertex and index data converted from guest memory, kept across frames in
+// a single GL buffer. Each entry is write watched and dropped once the guest
+// writes to it. Ranges the guest keeps rewriting are reported as dynamic so
+// callers can stream them instead of taking a fault per frame.
+class BufferCache {
+ public:
+  // Rewrites index data into a primitive type GL draws directly, so that
+  // no geometry shader is needed to expand it.
+  enum class IndexConversion : uint32_t {
+    kNone,
+    // Each quad becomes two triangles.
+    kQuadListToTriangleList,
+    // Each quad becomes its four edges, for quads drawn as wireframe.
+    kQuadListToLineList,
+  };
+
+  BufferCache();
+  ~BufferCache();
+
+  bool Initialize(Memory* memory);
+  void Shutdown();
+
+  GLuint handle() const { return buffer_; }
+  // Total bytes converted into the cache so far.
+  uint64_t upload_bytes() const { return upload_bytes_; }
+
+  // Returns the offset in handle() of the guest data byte swapped in
+  // element_size units (1 to copy as is) and rewritten by conversion,
+  // converting it on first use. Returns false if the data should be streamed
+  // instead. For index data, out_min_index/out_max_index receive the range
+  // of indices it holds if given.
+  bool Demand(uint32_t guest_address, uint32_t length, uint32_t element_size,
+              IndexConversion conversion, size_t* out_offset,
+              uint32_t* out_min_index = nullptr,
+              uint32_t* out_max_index = nullptr);
+
+  // Number of indices index_count indices become after conversion.
+  static uint32_t GetConvertedIndexCount(IndexConversion conversion,
+                                         uint32_t index_count);
+  // Byte swaps index_count indices of element_size bytes from src into dest,
+  // rewriting them by conversion. Elements of 1 byte are copied as is.
+  // If out_min_index is given, the smallest and largest index are found in
+  // the same pass (UINT32_MAX and 0 for no indices).
+  static void ConvertIndices(IndexConversion conversion,
+                             uint32_t element_size, const void* src,
+                             uint32_t index_count, void* dest,
+                             uint32_t* out_min_index = nullptr,
+                             uint32_t* out_max_index = nullptr);
+  // Writes the indices an auto indexed draw of index_count vertices becomes
+  // after conversion, as 16-bit indices.
+  static void GenerateIndices(IndexConversion conversion, uint32_t index_count,
+                              uint16_t* dest);
+
+  // Drops invalidated entries and reclaims space the GPU is done with. Call
+  // once per frame.
+  void Scavenge();
+  void Clear();
+
+ private:
+  struct EntryKey {
+    uint32_t guest_address;
+    uint32_t length;
+    uint32_t element_size;
+    IndexConversion conversion;
+    bool operator==(const EntryKey& other) const {
+      return guest_address == other.guest_address && length == other.length &&
+             element_size == other.element_size &&
+             conversion == other.conversion;
+    }
+  };
+  struct EntryKeyHasher {
+    size_t operator()(const EntryKey& key) const {
+      return size_t(key.guest_address) ^ (size_t(key.length) << 8) ^
+             key.element_size ^ (size_t(key.conversion) << 4);
+    }
+  };
+  struct Entry {
+    EntryKey key;
+    size_t offset;
+    size_t allocated_length;
+    // Range of the indices held, for index data.
+    uint32_t min_index;
+    uint32_t max_index;
+    uint32_t upload_frame;
+    uint32_t last_used_frame;
+    uintptr_t write_watch_handle;
+    // Set from the write watch callback on whichever thread wrote.
+    std::atomic<bool> pending_invalidation;
+  };
+  // An entry dropped in a frame the GPU may still be reading. It is kept
+  // alive, as its write watch callback may still be running.
+  struct RetiredEntry {
+    std::unique_ptr<Entry> entry;
+    uint32_t frame;
+  };
+
+  bool Allocate(size_t length, size_t* out_offset);
+  void Free(size_t offset, size_t length);
+  void RetireEntry(std::unique_ptr<Entry> entry);
+  void EvictUnusedEntries();
+
+  Memory* memory_;
+  GLuint buffer_;
+  uint8_t* host_base_;
+  uint32_t frame_number_;
+  uint64_t upload_bytes_;
+
+  // Free ranges by offset, coalesced on free.
+  std::map<size_t, size_t> free_ranges_;
+  std::vector<RetiredEntry> retired_entries_;
+  // Set when an allocation failed so that Scavenge makes room.
+  bool evict_unused_;
+
+  std::unordered_map<EntryKey, std::unique_ptr<Entry>, EntryKeyHasher>
+      entries_;
+  // Frame at which each range the guest rewrote soon after upload stops
+  // being treated as dynamic.
+  std::unordered_map<EntryKey, uint32_t, EntryKeyHasher> dynamic_ranges_;
+
+  xe::mutex invalidated_entries_mutex_;
+  std::vector<EntryKey> invalidated_entries_;
+};
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_GL4_BUFFER_CACHE_H_
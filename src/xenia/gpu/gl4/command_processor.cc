@@ -10,9 +10,12 @@
 #include "xenia/gpu/gl4/command_processor.h"
 
 #include <algorithm>
+#include <cstring>
 
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/string.h"
 #include "xenia/gpu/gl4/gl4_gpu_flags.h"
 #include "xenia/gpu/gl4/gl4_graphics_system.h"
 #include "xenia/gpu/gpu_flags.h"
@@ -20,6 +23,7 @@
 #include "xenia/gpu/texture_info.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/emulator.h"
+#include "xenia/hid/input_system.h"
 #include "xenia/profiling.h"
 
 #include "third_party/xxhash/xxhash.h"
@@ -38,6 +42,22 @@ const GLuint kAnyTarget = UINT_MAX;
 const size_t kScratchBufferCapacity = 256 * 1024 * 1024;
 const size_t kScratchBufferAlignment = 256;
 
+// EDRAM is 2048 tiles of 80x16 samples at 32bpp. 64bpp targets take two
+// tiles per 80x16 samples.
+const uint32_t kEdramTileWidth = 80;
+const uint32_t kEdramTileHeight = 16;
+const uint32_t kEdramTileCount = 2048;
+
+// Reported for occlusion queries we could not measure; enough for titles to
+// treat what they queried as visible.
+const uint32_t kUnmeasuredOcclusionSampleCount = 1000;
+
+static bool IsColorRenderTargetFormat64bpp(ColorRenderTargetFormat format) {
+  return format == ColorRenderTargetFormat::k_16_16_16_16 ||
+         format == ColorRenderTargetFormat::k_16_16_16_16_FLOAT ||
+         format == ColorRenderTargetFormat::k_32_32_FLOAT;
+}
+
 CommandProcessor::CachedPipeline::CachedPipeline()
     : vertex_program(0), fragment_program(0), handles({0}) {}
 
@@ -45,8 +65,6 @@ CommandProcessor::CachedPipeline::~CachedPipeline() {
   glDeleteProgramPipelines(1, &handles.default_pipeline);
   glDeleteProgramPipelines(1, &handles.point_list_pipeline);
   glDeleteProgramPipelines(1, &handles.rect_list_pipeline);
-  glDeleteProgramPipelines(1, &handles.quad_list_pipeline);
-  glDeleteProgramPipelines(1, &handles.line_quad_list_pipeline);
 }
 
 CommandProcessor::CommandProcessor(GL4GraphicsSystem* graphics_system)
@@ -65,18 +83,66 @@ CommandProcessor::CommandProcessor(GL4GraphicsSystem* graphics_system)
       read_ptr_writeback_ptr_(0),
       write_ptr_index_event_(xe::threading::Event::CreateAutoResetEvent(false)),
       write_ptr_index_(0),
+      wait_event_(xe::threading::Event::CreateAutoResetEvent(false)),
       bin_select_(0xFFFFFFFFull),
       bin_mask_(0xFFFFFFFFull),
       active_vertex_shader_(nullptr),
       active_pixel_shader_(nullptr),
       active_framebuffer_(nullptr),
       last_framebuffer_texture_(0),
+      last_framebuffer_texture_scale_(1),
+      resolution_scale_(1),
       point_list_geometry_program_(0),
       rect_list_geometry_program_(0),
-      quad_list_geometry_program_(0),
       draw_index_count_(0),
+      dirty_state_groups_(kDirtyAll),
       draw_batcher_(graphics_system_->register_file()),
-      scratch_buffer_(kScratchBufferCapacity, kScratchBufferAlignment) {}
+      scratch_buffer_(kScratchBufferCapacity, kScratchBufferAlignment) {
+  // Registers read by each Update*State call. Anything not listed here is
+  // either read directly at draw time or doesn't affect GL state.
+  static const struct {
+    uint32_t index;
+    uint8_t groups;
+  } kStateRegisters[] = {
+      {XE_GPU_REG_RB_MODECONTROL, kDirtyRenderTargets},
+      {XE_GPU_REG_RB_SURFACE_INFO, kDirtyRenderTargets | kDirtyViewport},
+      {XE_GPU_REG_RB_COLOR_INFO, kDirtyRenderTargets},
+      {XE_GPU_REG_RB_COLOR1_INFO, kDirtyRenderTargets},
+      {XE_GPU_REG_RB_COLOR2_INFO, kDirtyRenderTargets},
+      {XE_GPU_REG_RB_COLOR3_INFO, kDirtyRenderTargets},
+      {XE_GPU_REG_RB_COLOR_MASK, kDirtyRenderTargets},
+      {XE_GPU_REG_RB_DEPTHCONTROL, kDirtyRenderTargets | kDirtyDepthStencil},
+      {XE_GPU_REG_RB_STENCILREFMASK,
+       kDirtyRenderTargets | kDirtyDepthStencil},
+      {XE_GPU_REG_RB_DEPTH_INFO, kDirtyRenderTargets},
+      {XE_GPU_REG_PA_CL_VTE_CNTL, kDirtyViewport},
+      {XE_GPU_REG_PA_SU_SC_MODE_CNTL, kDirtyViewport | kDirtyRasterizer},
+      {XE_GPU_REG_PA_SC_WINDOW_OFFSET, kDirtyViewport},
+      {XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL, kDirtyViewport},
+      {XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR, kDirtyViewport},
+      {XE_GPU_REG_PA_CL_VPORT_XOFFSET, kDirtyViewport},
+      {XE_GPU_REG_PA_CL_VPORT_YOFFSET, kDirtyViewport},
+      {XE_GPU_REG_PA_CL_VPORT_ZOFFSET, kDirtyViewport},
+      {XE_GPU_REG_PA_CL_VPORT_XSCALE, kDirtyViewport},
+      {XE_GPU_REG_PA_CL_VPORT_YSCALE, kDirtyViewport},
+      {XE_GPU_REG_PA_CL_VPORT_ZSCALE, kDirtyViewport},
+      {XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL, kDirtyRasterizer},
+      {XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR, kDirtyRasterizer},
+      {XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX, kDirtyRasterizer},
+      {XE_GPU_REG_RB_BLENDCONTROL_0, kDirtyBlend},
+      {XE_GPU_REG_RB_BLENDCONTROL_1, kDirtyBlend},
+      {XE_GPU_REG_RB_BLENDCONTROL_2, kDirtyBlend},
+      {XE_GPU_REG_RB_BLENDCONTROL_3, kDirtyBlend},
+      {XE_GPU_REG_RB_BLEND_RED, kDirtyBlend},
+      {XE_GPU_REG_RB_BLEND_GREEN, kDirtyBlend},
+      {XE_GPU_REG_RB_BLEND_BLUE, kDirtyBlend},
+      {XE_GPU_REG_RB_BLEND_ALPHA, kDirtyBlend},
+  };
+  std::memset(register_dirty_groups_, 0, sizeof(register_dirty_groups_));
+  for (auto& state_register : kStateRegisters) {
+    register_dirty_groups_[state_register.index] |= state_register.groups;
+  }
+}
 
 CommandProcessor::~CommandProcessor() = default;
 
@@ -102,6 +168,7 @@ void CommandProcessor::Shutdown() {
 
   worker_running_ = false;
   write_ptr_index_event_->Set();
+  wait_event_->Set();
   worker_thread_->Wait(0, 0, 0, nullptr);
   worker_thread_.reset();
 }
@@ -150,8 +217,18 @@ void CommandProcessor::CallInThread(std::function<void()> fn) {
   }
 }
 
+CommandProcessor::Stats CommandProcessor::stats() const {
+  Stats stats;
+  stats.draw_count = draw_count_;
+  stats.upload_bytes = upload_bytes_ + buffer_cache_.upload_bytes();
+  stats.shader_compile_ticks = shader_compile_ticks_;
+  stats.stall_ticks = stall_ticks_;
+  return stats;
+}
+
 void CommandProcessor::ClearCaches() {
   texture_cache()->Clear();
+  buffer_cache_.Clear();
 
   for (auto& cached_framebuffer : cached_framebuffers_) {
     glDeleteFramebuffers(1, &cached_framebuffer.framebuffer);
@@ -159,14 +236,17 @@ void CommandProcessor::ClearCaches() {
   cached_framebuffers_.clear();
 
   for (auto& cached_color_render_target : cached_color_render_targets_) {
-    glDeleteTextures(1, &cached_color_render_target.texture);
+    glDeleteTextures(1, &cached_color_render_target->texture);
   }
   cached_color_render_targets_.clear();
 
   for (auto& cached_depth_render_target : cached_depth_render_targets_) {
-    glDeleteTextures(1, &cached_depth_render_target.texture);
+    glDeleteTextures(1, &cached_depth_render_target->texture);
   }
   cached_depth_render_targets_.clear();
+  for (auto& active_render_target : active_render_targets_) {
+    active_render_target = nullptr;
+  }
 }
 
 void CommandProcessor::WorkerThreadMain() {
@@ -176,6 +256,9 @@ void CommandProcessor::WorkerThreadMain() {
     return;
   }
 
+  // With decode ahead, only what the decode thread has walked is ready.
+  auto& submitted_ptr_index =
+      decode_thread_ ? decode_ptr_index_ : write_ptr_index_;
   while (worker_running_) {
     while (!pending_fns_.empty()) {
       auto fn = std::move(pending_fns_.front());
@@ -183,12 +266,13 @@ void CommandProcessor::WorkerThreadMain() {
       fn();
     }
 
-    uint32_t write_ptr_index = write_ptr_index_.load();
+    uint32_t write_ptr_index = submitted_ptr_index.load();
     if (write_ptr_index == 0xBAADF00D || read_ptr_index_ == write_ptr_index) {
       SCOPE_profile_cpu_i("gpu", "xe::gpu::gl4::CommandProcessor::Stall");
       // We've run out of commands to execute.
       // We spin here waiting for new ones, as the overhead of waiting on our
       // event is too high.
+      uint64_t stall_start = Clock::QueryHostTickCount();
       PrepareForWait();
       do {
         // TODO(benvanik): if we go longer than Nms, switch to waiting?
@@ -197,11 +281,17 @@ void CommandProcessor::WorkerThreadMain() {
         // xe::threading::Wait(write_ptr_index_event_.get(), true,
         //                     std::chrono::milliseconds(wait_time_ms));
         xe::threading::MaybeYield();
-        write_ptr_index = write_ptr_index_.load();
+        if (!FLAGS_thread_safe_gl) {
+          // CPU threads may be waiting on a readback or a query.
+          readback_cache_.Poll();
+          PollOcclusionQueries();
+        }
+        write_ptr_index = submitted_ptr_index.load();
       } while (worker_running_ && pending_fns_.empty() &&
                (write_ptr_index == 0xBAADF00D ||
                 read_ptr_index_ == write_ptr_index));
       ReturnFromWait();
+      stall_ticks_ += Clock::QueryHostTickCount() - stall_start;
       if (!worker_running_ || !pending_fns_.empty()) {
         continue;
       }
@@ -224,6 +314,9 @@ void CommandProcessor::WorkerThreadMain() {
 }
 
 bool CommandProcessor::SetupGL() {
+  // GPU profiling scopes on this thread are timed on our context.
+  Profiler::set_thread_gpu_timer(&gpu_timer_);
+
   // Circular buffer holding scratch vertex/index data.
   if (!scratch_buffer_.Initialize()) {
     XELOGE("Unable to initialize scratch buffer");
@@ -236,12 +329,53 @@ bool CommandProcessor::SetupGL() {
     return false;
   }
 
+  resolution_scale_ =
+      uint32_t(std::min(std::max(FLAGS_resolution_scale, 1), 4));
+
   // Texture cache that keeps track of any textures/samplers used.
-  if (!texture_cache_.Initialize(memory_, &scratch_buffer_)) {
+  if (!texture_cache_.Initialize(memory_, &scratch_buffer_,
+                                 resolution_scale_)) {
     XELOGE("Unable to initialize texture cache");
     return false;
   }
 
+  if (!buffer_cache_.Initialize(memory_)) {
+    XELOGE("Unable to initialize buffer cache");
+    return false;
+  }
+
+  if (FLAGS_gpu_guest_memory_buffer) {
+    if (!GLEW_AMD_pinned_memory) {
+      XELOGW("GL_AMD_pinned_memory not supported, copying vertex data");
+    } else {
+      // Covers all of physical memory so that guest addresses are offsets.
+      while (glGetError() != GL_NO_ERROR) {
+      }
+      glGenBuffers(1, &guest_memory_buffer_);
+      glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD,
+                   guest_memory_buffer_);
+      glBufferData(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, 0x20000000,
+                   memory_->physical_membase(), GL_STREAM_READ);
+      glBindBuffer(GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD, 0);
+      if (glGetError() != GL_NO_ERROR) {
+        XELOGW("Unable to pin guest physical memory, copying vertex data");
+        glDeleteBuffers(1, &guest_memory_buffer_);
+        guest_memory_buffer_ = 0;
+      }
+    }
+  }
+
+  if (!readback_cache_.Initialize(memory_)) {
+    XELOGE("Unable to initialize readback cache");
+    return false;
+  }
+
+  // Persisted shaders load in the background while the title boots.
+  if (!FLAGS_shader_cache_path.empty()) {
+    shader_cache_file_ =
+        GL4ShaderCacheFile::Open(xe::to_wstring(FLAGS_shader_cache_path));
+  }
+
   const std::string geometry_header =
       "#version 450\n"
       "#extension all : warn\n"
@@ -370,58 +504,64 @@ bool CommandProcessor::SetupGL() {
       "    EndPrimitive();\n"
       "  }\n"
       "}\n";
-  std::string quad_list_shader =
-      geometry_header +
-      "layout(lines_adjacency) in;\n"
-      "layout(triangle_strip, max_vertices = 4) out;\n"
-      "void main() {\n"
-      "  const int order[4] = { 0, 1, 3, 2 };\n"
-      "  for (int i = 0; i < 4; ++i) {\n"
-      "    int input_index = order[i];\n"
-      "    gl_Position = gl_in[input_index].gl_Position;\n"
-      "    gl_PointSize = gl_in[input_index].gl_PointSize;\n"
-      "    out_vtx = in_vtx[input_index];\n"
-      "    EmitVertex();\n"
-      "  }\n"
-      "  EndPrimitive();\n"
-      "}\n";
-  std::string line_quad_list_shader =
-      geometry_header +
-      "layout(lines_adjacency) in;\n"
-      "layout(line_strip, max_vertices = 5) out;\n"
-      "void main() {\n"
-      "  gl_Position = gl_in[0].gl_Position;\n"
-      "  gl_PointSize = gl_in[0].gl_PointSize;\n"
-      "  out_vtx = in_vtx[0];\n"
-      "  EmitVertex();\n"
-      "  gl_Position = gl_in[1].gl_Position;\n"
-      "  gl_PointSize = gl_in[1].gl_PointSize;\n"
-      "  out_vtx = in_vtx[1];\n"
-      "  EmitVertex();\n"
-      "  gl_Position = gl_in[2].gl_Position;\n"
-      "  gl_PointSize = gl_in[2].gl_PointSize;\n"
-      "  out_vtx = in_vtx[2];\n"
-      "  EmitVertex();\n"
-      "  gl_Position = gl_in[3].gl_Position;\n"
-      "  gl_PointSize = gl_in[3].gl_PointSize;\n"
-      "  out_vtx = in_vtx[3];\n"
-      "  EmitVertex();\n"
-      "  gl_Position = gl_in[0].gl_Position;\n"
-      "  gl_PointSize = gl_in[0].gl_PointSize;\n"
-      "  out_vtx = in_vtx[0];\n"
-      "  EmitVertex();\n"
-      "  EndPrimitive();\n"
-      "}\n";
-  point_list_geometry_program_ = CreateGeometryProgram(point_list_shader);
-  rect_list_geometry_program_ = CreateGeometryProgram(rect_list_shader);
-  quad_list_geometry_program_ = CreateGeometryProgram(quad_list_shader);
-  line_quad_list_geometry_program_ =
-      CreateGeometryProgram(line_quad_list_shader);
-  if (!point_list_geometry_program_ || !rect_list_geometry_program_ ||
-      !quad_list_geometry_program_ || !line_quad_list_geometry_program_) {
+  point_list_geometry_program_ =
+      CreateProgram(GL_GEOMETRY_SHADER, point_list_shader);
+  rect_list_geometry_program_ =
+      CreateProgram(GL_GEOMETRY_SHADER, rect_list_shader);
+  if (!point_list_geometry_program_ || !rect_list_geometry_program_) {
     return false;
   }
 
+  if (FLAGS_async_shader_compilation && FLAGS_thread_safe_gl) {
+    // The compile thread would hold the global GL lock for its lifetime.
+    XELOGW("--async_shader_compilation is ignored with --thread_safe_gl");
+  } else if (FLAGS_async_shader_compilation) {
+    if (FLAGS_async_shader_placeholder) {
+      const std::string placeholder_shader =
+          "#version 450\n"
+          "layout(location = 0) out vec4 oC[4];\n"
+          "void main() {\n"
+          "  oC[0] = vec4(0.5, 0.5, 0.5, 1.0);\n"
+          "}\n";
+      placeholder_fragment_program_ =
+          CreateProgram(GL_FRAGMENT_SHADER, placeholder_shader);
+      if (!placeholder_fragment_program_) {
+        return false;
+      }
+    }
+
+    // Programs are shared between contexts so they can be built on a
+    // context of their own without blocking command processing. Creating the
+    // context leaves none current on this thread.
+    shader_compile_context_ = context_->CreateShared();
+    context_->MakeCurrent();
+    if (!shader_compile_context_) {
+      XELOGE("Unable to create shader compile context");
+      return false;
+    }
+    shader_compile_running_ = true;
+    shader_compile_thread_ = xe::threading::Thread::Create(
+        {}, [this]() { ShaderCompileThreadMain(); });
+    shader_compile_thread_->set_name("GL4 Shader Compile");
+  }
+
+  if (FLAGS_shader_analysis_threads > 0) {
+    shader_analysis_running_ = true;
+    for (int32_t i = 0; i < FLAGS_shader_analysis_threads; ++i) {
+      auto thread = xe::threading::Thread::Create(
+          {}, [this]() { ShaderAnalysisThreadMain(); });
+      thread->set_name("GL4 Shader Analysis");
+      shader_analysis_threads_.push_back(std::move(thread));
+    }
+  }
+
+  if (FLAGS_gpu_decode_ahead) {
+    decode_ptr_index_ = read_ptr_index_.load();
+    decode_thread_ = xe::threading::Thread::Create(
+        {}, [this]() { CommandDecodeThreadMain(); });
+    decode_thread_->set_name("GL4 Command Decode");
+  }
+
   glEnable(GL_SCISSOR_TEST);
   glClipControl(GL_UPPER_LEFT, GL_ZERO_TO_ONE);
   glPointParameteri(GL_POINT_SPRITE_COORD_ORIGIN, GL_UPPER_LEFT);
@@ -429,9 +569,10 @@ bool CommandProcessor::SetupGL() {
   return true;
 }
 
-GLuint CommandProcessor::CreateGeometryProgram(const std::string& source) {
+GLuint CommandProcessor::CreateProgram(GLenum shader_type,
+                                       const std::string& source) {
   auto source_str = source.c_str();
-  GLuint program = glCreateShaderProgramv(GL_GEOMETRY_SHADER, 1, &source_str);
+  GLuint program = glCreateShaderProgramv(shader_type, 1, &source_str);
 
   // Get error log, if we failed to link.
   GLint link_status = 0;
@@ -452,18 +593,79 @@ GLuint CommandProcessor::CreateGeometryProgram(const std::string& source) {
 }
 
 void CommandProcessor::ShutdownGL() {
+  Profiler::set_thread_gpu_timer(nullptr);
+  gpu_timer_.Shutdown();
+
+  if (shader_compile_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(shader_compile_mutex_);
+      shader_compile_running_ = false;
+    }
+    shader_compile_cond_.notify_all();
+    xe::threading::Wait(shader_compile_thread_.get(), false);
+    shader_compile_thread_.reset();
+    shader_compile_queue_.clear();
+  }
+  if (!shader_analysis_threads_.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(shader_analysis_mutex_);
+      shader_analysis_running_ = false;
+    }
+    shader_analysis_cond_.notify_all();
+    for (auto& thread : shader_analysis_threads_) {
+      xe::threading::Wait(thread.get(), false);
+    }
+    shader_analysis_threads_.clear();
+    shader_analysis_queue_.clear();
+  }
+  if (decode_thread_) {
+    // Exits on its own now that worker_running_ is cleared.
+    xe::threading::Wait(decode_thread_.get(), false);
+    decode_thread_.reset();
+    decoded_shader_loads_.clear();
+  }
+
+  glDeleteProgram(placeholder_fragment_program_);
   glDeleteProgram(point_list_geometry_program_);
   glDeleteProgram(rect_list_geometry_program_);
-  glDeleteProgram(quad_list_geometry_program_);
-  glDeleteProgram(line_quad_list_geometry_program_);
+  for (auto fence : frame_fences_) {
+    glDeleteSync(fence);
+  }
+  frame_fences_.clear();
+  if (active_occlusion_query_) {
+    glEndQuery(GL_SAMPLES_PASSED);
+    free_occlusion_queries_.push_back(active_occlusion_query_);
+    active_occlusion_query_ = 0;
+  }
+  for (auto& pending : pending_occlusion_queries_) {
+    free_occlusion_queries_.push_back(pending.query);
+  }
+  pending_occlusion_queries_.clear();
+  if (!free_occlusion_queries_.empty()) {
+    glDeleteQueries(GLsizei(free_occlusion_queries_.size()),
+                    free_occlusion_queries_.data());
+    free_occlusion_queries_.clear();
+  }
+  readback_cache_.Shutdown();
+  if (guest_memory_buffer_) {
+    glDeleteBuffers(1, &guest_memory_buffer_);
+    guest_memory_buffer_ = 0;
+  }
+  buffer_cache_.Shutdown();
   texture_cache_.Shutdown();
   draw_batcher_.Shutdown();
   scratch_buffer_.Shutdown();
 
   all_pipelines_.clear();
+  active_pipeline_state_ = nullptr;
+  cached_pipeline_states_.clear();
+  all_pipeline_states_.clear();
   all_shaders_.clear();
   shader_cache_.clear();
+  shader_cache_file_.reset();
 
+  // Destroying a context makes it current, so do it last.
+  shader_compile_context_.reset();
   context_.reset();
 }
 
@@ -492,6 +694,12 @@ void CommandProcessor::UpdateWritePointer(uint32_t value) {
   write_ptr_index_event_->Set();
 }
 
+void CommandProcessor::NotifyRegisterWritten(uint32_t index) {
+  if (index == wait_register_index_) {
+    wait_event_->Set();
+  }
+}
+
 void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   RegisterFile* regs = register_file_;
   if (index >= RegisterFile::kRegisterCount) {
@@ -500,6 +708,7 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 
   regs->values[index].u32 = value;
+  dirty_state_groups_ |= register_dirty_groups_[index];
 
   // If this is a COHER register, set the dirty flag.
   // This will block the command processor the next time it WAIT_MEM_REGs and
@@ -520,6 +729,40 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 }
 
+void CommandProcessor::WriteRegisterRange(uint32_t index,
+                                          const uint32_t* guest_values,
+                                          uint32_t count) {
+  RegisterFile* regs = register_file_;
+  if (index + count > RegisterFile::kRegisterCount) {
+    for (uint32_t n = 0; n < count; ++n) {
+      WriteRegister(index + n, xe::byte_swap(guest_values[n]));
+    }
+    return;
+  }
+
+  xe::copy_and_swap_32_unaligned(&regs->values[index].u32, guest_values,
+                                 count);
+  uint32_t end_index = index + count;
+  for (uint32_t n = index; n < end_index; ++n) {
+    dirty_state_groups_ |= register_dirty_groups_[n];
+  }
+
+  // Registers with side effects go through the slow path again. Rewriting
+  // the stored value is harmless.
+  if (index <= XE_GPU_REG_SCRATCH_REG7 && end_index > XE_GPU_REG_SCRATCH_REG0) {
+    uint32_t first = std::max(index, uint32_t(XE_GPU_REG_SCRATCH_REG0));
+    uint32_t last = std::min(end_index - 1, uint32_t(XE_GPU_REG_SCRATCH_REG7));
+    for (uint32_t n = first; n <= last; ++n) {
+      WriteRegister(n, regs->values[n].u32);
+    }
+  }
+  if (index <= XE_GPU_REG_COHER_STATUS_HOST &&
+      end_index > XE_GPU_REG_COHER_STATUS_HOST) {
+    WriteRegister(XE_GPU_REG_COHER_STATUS_HOST,
+                  regs->values[XE_GPU_REG_COHER_STATUS_HOST].u32);
+  }
+}
+
 void CommandProcessor::MakeCoherent() {
   SCOPE_profile_cpu_f("gpu");
 
@@ -560,8 +803,10 @@ void CommandProcessor::PrepareForWait() {
   // TODO(benvanik): fences and fancy stuff. We should figure out a way to
   // make interrupt callbacks from the GPU so that we don't have to do a full
   // synchronize here.
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
   glFlush();
   // glFinish();
+  readback_cache_.Poll();
 
   if (FLAGS_thread_safe_gl) {
     context_->ClearCurrent();
@@ -578,47 +823,16 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
                                  uint32_t frontbuffer_width,
                                  uint32_t frontbuffer_height) {
   SCOPE_profile_cpu_f("gpu");
-  if (!swap_request_handler_) {
+  auto presenter = graphics_system_->presenter();
+  if (!presenter) {
     return;
   }
 
-  // If there was a swap pending we drop it on the floor.
-  // This prevents the display from pulling the backbuffer out from under us.
-  // If we skip a lot then we may need to buffer more, but as the display
-  // thread should be fairly idle that shouldn't happen.
-  if (!FLAGS_vsync) {
-    std::lock_guard<xe::mutex> lock(swap_state_.mutex);
-    if (swap_state_.pending) {
-      swap_state_.pending = false;
-      // TODO(benvanik): frame skip counter.
-      XELOGW("Skipped frame!");
-    }
-  } else {
-    // Spin until no more pending swap.
-    while (true) {
-      {
-        std::lock_guard<xe::mutex> lock(swap_state_.mutex);
-        if (!swap_state_.pending) {
-          break;
-        }
-      }
-      xe::threading::MaybeYield();
-    }
-  }
-
-  // One-time initialization.
-  // TODO(benvanik): move someplace more sane?
-  if (!swap_state_.front_buffer_texture) {
-    std::lock_guard<xe::mutex> lock(swap_state_.mutex);
-    swap_state_.width = frontbuffer_width;
-    swap_state_.height = frontbuffer_height;
-    glCreateTextures(GL_TEXTURE_2D, 1, &swap_state_.front_buffer_texture);
-    glCreateTextures(GL_TEXTURE_2D, 1, &swap_state_.back_buffer_texture);
-    glTextureStorage2D(swap_state_.front_buffer_texture, 1, GL_RGBA8,
-                       swap_state_.width, swap_state_.height);
-    glTextureStorage2D(swap_state_.back_buffer_texture, 1, GL_RGBA8,
-                       swap_state_.width, swap_state_.height);
+  auto input_system = graphics_system_->emulator()->input_system();
+  if (input_system) {
+    input_system->OnFramePresented();
   }
+  graphics_system_->on_frame_presented();
 
   // Lookup the framebuffer in the recently-resolved list.
   // TODO(benvanik): make this much more sophisticated.
@@ -631,32 +845,78 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
                                         ? active_framebuffer_->color_targets[0]
                                         : last_framebuffer_texture_;*/
 
-  // Copy the the given framebuffer to the current backbuffer.
-  Rect2D src_rect(0, 0, frontbuffer_width ? frontbuffer_width : 1280,
-                  frontbuffer_height ? frontbuffer_height : 720);
-  Rect2D dest_rect(0, 0, swap_state_.width, swap_state_.height);
-  reinterpret_cast<xe::ui::gl::GLContext*>(context_.get())
-      ->blitter()
-      ->CopyColorTexture2D(framebuffer_texture, src_rect,
-                           swap_state_.back_buffer_texture, dest_rect,
-                           GL_LINEAR);
+  // While fast-forwarding most frames are never copied out, but they are
+  // still fenced and cleaned up after like any other.
+  bool present = true;
+  if (graphics_system_->fast_forward()) {
+    int32_t interval = std::max(FLAGS_fast_forward_present_interval, 1);
+    present = counter_ % uint32_t(interval) == 0;
+  }
+
+  GLsync back_buffer_fence = nullptr;
+  if (present) {
+    // Get a buffer to copy the frame to. This only waits if the display has
+    // fallen behind by every buffer and frame skip is off.
+    if (FLAGS_thread_safe_gl) {
+      // The display needs the GL lock to give a buffer back.
+      context_->ClearCurrent();
+      presenter->WaitForFreeBuffer();
+      context_->MakeCurrent();
+    }
+    uint32_t width = frontbuffer_width ? frontbuffer_width : 1280;
+    uint32_t height = frontbuffer_height ? frontbuffer_height : 720;
+    GLuint back_buffer_texture = presenter->BeginFrame(
+        width * resolution_scale_, height * resolution_scale_);
+    if (!back_buffer_texture) {
+      // Shutting down.
+      return;
+    }
 
-  // Need to finish to be sure the other context sees the right data.
-  // TODO(benvanik): prevent this? fences?
-  glFinish();
+    // Copy the given framebuffer to the back buffer.
+    SCOPE_profile_gpu_i("gpu-gl4",
+                        "xe::gpu::gl4::CommandProcessor::IssueSwap");
+    Rect2D src_rect(0, 0, width * last_framebuffer_texture_scale_,
+                    height * last_framebuffer_texture_scale_);
+    Rect2D dest_rect(0, 0, width * resolution_scale_,
+                     height * resolution_scale_);
+    reinterpret_cast<xe::ui::gl::GLContext*>(context_.get())
+        ->blitter()
+        ->CopyColorTexture2D(framebuffer_texture, src_rect,
+                             back_buffer_texture, dest_rect, GL_LINEAR);
+
+    // The presenter waits on this before handing the frame to the display.
+    // The flush makes sure the fence is submitted so it can't wait forever.
+    back_buffer_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  // Fence the streaming buffers for the frame so they are only waited on
+  // once the write head wraps around to data still in use.
+  scratch_buffer_.InsertFence();
+  draw_batcher_.InsertFences();
+  frame_fences_.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+  glFlush();
 
-  {
-    // Set pending so that the display will swap the next time it can.
-    std::lock_guard<xe::mutex> lock(swap_state_.mutex);
-    swap_state_.pending = true;
+  if (back_buffer_fence) {
+    presenter->EndFrame(back_buffer_fence);
   }
 
-  // Notify the display a swap is pending so that our changes are picked up.
-  // It does the actual front/back buffer swap.
-  swap_request_handler_();
+  // Hand GPU profiling timestamps that are in to the profiler.
+  gpu_timer_.Poll();
 
   // Remove any dead textures, etc.
   texture_cache_.Scavenge();
+  buffer_cache_.Scavenge();
+  readback_cache_.Poll();
+  PollOcclusionQueries();
+
+  // Record at most a few frames ahead of the GPU so latency stays bounded.
+  while (frame_fences_.size() > kMaxFramesInFlight) {
+    SCOPE_profile_cpu_i("gpu", "WaitForFrame");
+    glClientWaitSync(frame_fences_.front(), GL_SYNC_FLUSH_COMMANDS_BIT,
+                     GL_TIMEOUT_IGNORED);
+    glDeleteSync(frame_fences_.front());
+    frame_fences_.pop_front();
+  }
 }
 
 class CommandProcessor::RingbufferReader {
@@ -676,6 +936,19 @@ class CommandProcessor::RingbufferReader {
 
   uint32_t Peek() { return xe::load_and_swap<uint32_t>(membase_ + ptr_); }
 
+  // Unswapped words at the read pointer, and how many can be read before the
+  // ring wraps.
+  const uint32_t* host_ptr() const {
+    return reinterpret_cast<const uint32_t*>(membase_ + ptr_);
+  }
+  uint32_t contiguous_words() const {
+    if (!ptr_mask_) {
+      // Indirect buffers don't wrap.
+      return UINT_MAX;
+    }
+    return ptr_mask_ + 1 - (ptr_ - base_ptr_) / sizeof(uint32_t);
+  }
+
   void CheckRead(uint32_t words) {
     assert_true(ptr_ + words * sizeof(uint32_t) <= end_ptr_);
   }
@@ -708,6 +981,18 @@ class CommandProcessor::RingbufferReader {
   uint32_t offset_;
 };
 
+void CommandProcessor::WriteRegisterRange(RingbufferReader* reader,
+                                          uint32_t index, uint32_t count) {
+  // At most one split, where the ring wraps.
+  while (count) {
+    uint32_t run = std::min(count, reader->contiguous_words());
+    WriteRegisterRange(index, reader->host_ptr(), run);
+    reader->Advance(run);
+    index += run;
+    count -= run;
+  }
+}
+
 void CommandProcessor::ExecutePrimaryBuffer(uint32_t start_index,
                                             uint32_t end_index) {
   SCOPE_profile_cpu_f("gpu");
@@ -794,10 +1079,12 @@ bool CommandProcessor::ExecutePacketType0(RingbufferReader* reader,
 
   uint32_t base_index = (packet & 0x7FFF);
   uint32_t write_one_reg = (packet >> 15) & 0x1;
-  for (uint32_t m = 0; m < count; m++) {
-    uint32_t reg_data = reader->Read();
-    uint32_t target_index = write_one_reg ? base_index : base_index + m;
-    WriteRegister(target_index, reg_data);
+  if (write_one_reg) {
+    for (uint32_t m = 0; m < count; m++) {
+      WriteRegister(base_index, reader->Read());
+    }
+  } else {
+    WriteRegisterRange(reader, base_index, count);
   }
 
   trace_writer_.WritePacketEnd();
@@ -889,6 +1176,9 @@ bool CommandProcessor::ExecutePacketType3(RingbufferReader* reader,
     case PM4_EVENT_WRITE_EXT:
       result = ExecutePacketType3_EVENT_WRITE_EXT(reader, packet, count);
       break;
+    case PM4_EVENT_WRITE_ZPD:
+      result = ExecutePacketType3_EVENT_WRITE_ZPD(reader, packet, count);
+      break;
     case PM4_DRAW_INDX:
       result = ExecutePacketType3_DRAW_INDX(reader, packet, count);
       break;
@@ -1051,19 +1341,33 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingbufferReader* reader,
   uint32_t ref = reader->Read();
   uint32_t mask = reader->Read();
   uint32_t wait = reader->Read();
+  bool is_memory = (wait_info & 0x10) != 0;
+  auto endianness = static_cast<Endian>(poll_reg_addr & 0x3);
+  if (is_memory) {
+    poll_reg_addr &= ~0x3;
+  } else {
+    assert_true(poll_reg_addr < RegisterFile::kRegisterCount);
+    wait_register_index_ = poll_reg_addr;
+  }
+
+  // Rather than polling, we sleep until the value may have changed: register
+  // writes from the CPU notify us, and memory is write watched (which also
+  // catches stores from the kernel). The interval in the packet bounds the
+  // sleep in case a write slips past both.
+  auto timeout = std::chrono::milliseconds(std::max(1u, wait / 0x100));
+  if (graphics_system_->fast_forward()) {
+    // Don't let a missed notification hold up a fast-forward for long.
+    timeout = std::chrono::milliseconds(1);
+  }
+  uintptr_t watch_handle = 0;
   bool matched = false;
-  do {
+  while (worker_running_) {
     uint32_t value;
-    if (wait_info & 0x10) {
-      // Memory.
-      auto endianness = static_cast<Endian>(poll_reg_addr & 0x3);
-      poll_reg_addr &= ~0x3;
+    if (is_memory) {
       value = xe::load<uint32_t>(memory_->TranslatePhysical(poll_reg_addr));
       value = GpuSwap(value, endianness);
       trace_writer_.WriteMemoryRead(CpuToGpu(poll_reg_addr), 4);
     } else {
-      // Register.
-      assert_true(poll_reg_addr < RegisterFile::kRegisterCount);
       value = register_file_->values[poll_reg_addr].u32;
       if (poll_reg_addr == XE_GPU_REG_COHER_STATUS_HOST) {
         MakeCoherent();
@@ -1096,23 +1400,44 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingbufferReader* reader,
         matched = true;
         break;
     }
-    if (!matched) {
-      // Wait.
-      if (wait >= 0x100) {
-        PrepareForWait();
-        if (!FLAGS_vsync) {
-          // User wants it fast and dangerous.
-          xe::threading::MaybeYield();
-        } else {
-          xe::threading::Sleep(std::chrono::milliseconds(wait / 0x100));
-        }
-        xe::threading::SyncMemory();
-        ReturnFromWait();
-      } else {
-        xe::threading::MaybeYield();
-      }
+    if (matched) {
+      break;
     }
-  } while (!matched);
+    if (is_memory && !watch_handle) {
+      // Check again once armed in case the write landed in between.
+      wait_watch_triggered_ = false;
+      watch_handle = memory_->AddPhysicalWriteWatch(
+          poll_reg_addr, 4,
+          [](void* context_ptr, void* data_ptr, uint32_t address) {
+            auto self = reinterpret_cast<CommandProcessor*>(context_ptr);
+            self->wait_watch_triggered_ = true;
+            self->wait_event_->Set();
+          },
+          this, nullptr);
+      continue;
+    }
+
+    SCOPE_profile_cpu_i("gpu", "xe::gpu::gl4::CommandProcessor::WaitRegMem");
+    if (wait >= 0x100) {
+      PrepareForWait();
+    }
+    xe::threading::Wait(wait_event_.get(), false, timeout);
+    if (wait >= 0x100) {
+      ReturnFromWait();
+    }
+    if (watch_handle && wait_watch_triggered_) {
+      // The watch fires before the store is retried, so give the writer a
+      // moment before looking (and watching) again.
+      watch_handle = 0;
+      xe::threading::MaybeYield();
+    }
+    xe::threading::SyncMemory();
+  }
+
+  if (watch_handle && !wait_watch_triggered_) {
+    memory_->CancelWriteWatch(watch_handle);
+  }
+  wait_register_index_ = UINT32_MAX;
   return true;
 }
 
@@ -1278,6 +1603,121 @@ bool CommandProcessor::ExecutePacketType3_EVENT_WRITE_EXT(
   return true;
 }
 
+bool CommandProcessor::ExecutePacketType3_EVENT_WRITE_ZPD(
+    RingbufferReader* reader, uint32_t packet, uint32_t count) {
+  // generate a z_pass done event
+  // D3D writes this marker to the counts on D3DISSUE_END and waits for the
+  // GPU to replace it. It's big endian in a little endian struct.
+  const uint32_t kQueryFinished = xe::byte_swap(0xFFFFFEED);
+  uint32_t initiator = reader->Read();
+  reader->Advance(count - 1);
+  // Writeback initiator.
+  WriteRegister(XE_GPU_REG_VGT_EVENT_INITIATOR, initiator & 0x3F);
+
+  auto& regs = *register_file_;
+  uint32_t address = regs.values[XE_GPU_REG_RB_SAMPLE_COUNT_ADDR].u32;
+  auto counts = reinterpret_cast<xe_gpu_depth_sample_counts*>(
+      memory_->TranslatePhysical(address));
+  // Older versions of D3D mark ZFail instead of ZPass.
+  bool is_end = (counts->ZPass_A == kQueryFinished &&
+                 counts->ZPass_B == kQueryFinished) ||
+                (counts->ZFail_A == kQueryFinished &&
+                 counts->ZFail_B == kQueryFinished);
+
+  if (FLAGS_occlusion_query_fake_sample_count >= 0) {
+    WriteOcclusionQueryResult(
+        address, is_end ? FLAGS_occlusion_query_fake_sample_count : 0);
+    return true;
+  }
+
+  // Draws recorded so far belong before the query boundary.
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
+
+  if (!is_end) {
+    // Begin. GL allows only one samples passed query at a time, so one that
+    // was never ended is dropped.
+    if (active_occlusion_query_) {
+      glEndQuery(GL_SAMPLES_PASSED);
+      free_occlusion_queries_.push_back(active_occlusion_query_);
+      active_occlusion_query_ = 0;
+    }
+    // The guest reuses the counts once it has the result, so a result still
+    // pending for them is stale.
+    for (auto it = pending_occlusion_queries_.begin();
+         it != pending_occlusion_queries_.end();) {
+      if (it->guest_address == address) {
+        free_occlusion_queries_.push_back(it->query);
+        it = pending_occlusion_queries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    WriteOcclusionQueryResult(address, 0);
+    GLuint query;
+    if (free_occlusion_queries_.empty()) {
+      glCreateQueries(GL_SAMPLES_PASSED, 1, &query);
+    } else {
+      query = free_occlusion_queries_.back();
+      free_occlusion_queries_.pop_back();
+    }
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+    active_occlusion_query_ = query;
+    active_occlusion_query_address_ = address;
+    return true;
+  }
+
+  if (!active_occlusion_query_ || active_occlusion_query_address_ != address) {
+    // Nothing was measured for these counts. Report everything visible
+    // rather than have the title cull what it queried.
+    XELOGW("EVENT_WRITE_ZPD: end without a matching begin at %.8X", address);
+    WriteOcclusionQueryResult(address, kUnmeasuredOcclusionSampleCount);
+    return true;
+  }
+  glEndQuery(GL_SAMPLES_PASSED);
+  pending_occlusion_queries_.push_back(
+      {active_occlusion_query_, address, counter_});
+  active_occlusion_query_ = 0;
+  // The markers stay in place until the result is in, which the guest sees
+  // as the query still being busy.
+  PollOcclusionQueries();
+  return true;
+}
+
+void CommandProcessor::PollOcclusionQueries() {
+  uint32_t max_latency =
+      uint32_t(std::max(FLAGS_occlusion_query_max_latency, 0));
+  while (!pending_occlusion_queries_.empty()) {
+    auto& pending = pending_occlusion_queries_.front();
+    // Queries finish in order, so the first one not in means none after it
+    // are either.
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available && counter_ - pending.frame < max_latency) {
+      break;
+    }
+    // Blocks if the result isn't in yet.
+    GLuint samples = 0;
+    glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT, &samples);
+    // Samples are counted at the scaled resolution.
+    samples /= resolution_scale_ * resolution_scale_;
+    WriteOcclusionQueryResult(pending.guest_address, samples);
+    free_occlusion_queries_.push_back(pending.query);
+    pending_occlusion_queries_.pop_front();
+  }
+}
+
+void CommandProcessor::WriteOcclusionQueryResult(uint32_t guest_address,
+                                                 uint32_t samples) {
+  // Clearing the rest also removes the end markers.
+  auto counts = reinterpret_cast<xe_gpu_depth_sample_counts*>(
+      memory_->TranslatePhysical(guest_address));
+  std::memset(counts, 0, sizeof(xe_gpu_depth_sample_counts));
+  counts->ZPass_A = samples;
+  counts->Total_A = samples;
+  trace_writer_.WriteMemoryWrite(CpuToGpu(guest_address),
+                                 sizeof(xe_gpu_depth_sample_counts));
+}
+
 bool CommandProcessor::ExecutePacketType3_DRAW_INDX(RingbufferReader* reader,
                                                     uint32_t packet,
                                                     uint32_t count) {
@@ -1307,22 +1747,11 @@ bool CommandProcessor::ExecutePacketType3_DRAW_INDX(RingbufferReader* reader,
   } else {
     // Unknown source select.
     assert_always();
+    return false;
   }
   draw_index_count_ = index_count;
 
-  bool draw_valid = false;
-  if (src_sel == 0x0) {
-    // Indexed draw.
-    draw_valid = draw_batcher_.BeginDrawElements(prim_type, index_count,
-                                                 index_buffer_info_.format);
-  } else if (src_sel == 0x2) {
-    // Auto draw.
-    draw_valid = draw_batcher_.BeginDrawArrays(prim_type, index_count);
-  } else {
-    // Unknown source select.
-    assert_always();
-  }
-  if (!draw_valid) {
+  if (!BeginDraw(prim_type, index_count)) {
     return false;
   }
   return IssueDraw();
@@ -1345,13 +1774,49 @@ bool CommandProcessor::ExecutePacketType3_DRAW_INDX_2(RingbufferReader* reader,
   index_buffer_info_.length = 0;
   reader->Advance(count - 1);
   draw_index_count_ = index_count;
-  bool draw_valid = draw_batcher_.BeginDrawArrays(prim_type, index_count);
-  if (!draw_valid) {
+  if (!BeginDraw(prim_type, index_count)) {
     return false;
   }
   return IssueDraw();
 }
 
+bool CommandProcessor::BeginDraw(PrimitiveType prim_type,
+                                 uint32_t index_count) {
+  auto& info = index_buffer_info_;
+
+  // Quads are converted to triangles (or lines, when drawn as wireframe) in
+  // the index buffer instead of going through a geometry shader.
+  info.conversion = BufferCache::IndexConversion::kNone;
+  if (prim_type == PrimitiveType::kQuadList) {
+    uint32_t pa_su_sc_mode_cntl =
+        register_file_->values[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32;
+    bool line_mode = ((pa_su_sc_mode_cntl >> 3) & 0x3) != 0 &&
+                     ((pa_su_sc_mode_cntl >> 5) & 0x7) == 1;
+    if (line_mode) {
+      info.conversion = BufferCache::IndexConversion::kQuadListToLineList;
+      prim_type = PrimitiveType::kLineList;
+    } else {
+      info.conversion = BufferCache::IndexConversion::kQuadListToTriangleList;
+      prim_type = PrimitiveType::kTriangleList;
+    }
+  }
+
+  uint32_t converted_count =
+      BufferCache::GetConvertedIndexCount(info.conversion, index_count);
+  if (info.guest_base) {
+    return draw_batcher_.BeginDrawElements(prim_type, converted_count,
+                                           info.format);
+  } else if (info.conversion != BufferCache::IndexConversion::kNone) {
+    // Auto draws get generated indices. Guest auto draws are limited to
+    // 0xFFFF vertices, so 16 bits are enough.
+    info.format = IndexFormat::kInt16;
+    info.count = index_count;
+    return draw_batcher_.BeginDrawElements(prim_type, converted_count,
+                                           info.format);
+  }
+  return draw_batcher_.BeginDrawArrays(prim_type, index_count);
+}
+
 bool CommandProcessor::ExecutePacketType3_SET_CONSTANT(RingbufferReader* reader,
                                                        uint32_t packet,
                                                        uint32_t count) {
@@ -1382,10 +1847,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT(RingbufferReader* reader,
       reader->Skip(count - 1);
       return true;
   }
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->Read();
-    WriteRegister(index, data);
-  }
+  WriteRegisterRange(reader, index, count - 1);
   return true;
 }
 
@@ -1393,10 +1855,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT2(
     RingbufferReader* reader, uint32_t packet, uint32_t count) {
   uint32_t offset_type = reader->Read();
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->Read();
-    WriteRegister(index, data);
-  }
+  WriteRegisterRange(reader, index, count - 1);
   return true;
 }
 
@@ -1431,11 +1890,8 @@ bool CommandProcessor::ExecutePacketType3_LOAD_ALU_CONSTANT(
       return true;
   }
   trace_writer_.WriteMemoryRead(CpuToGpu(address), size_dwords * 4);
-  for (uint32_t n = 0; n < size_dwords; n++, index++) {
-    uint32_t data = xe::load_and_swap<uint32_t>(
-        memory_->TranslatePhysical(address + n * 4));
-    WriteRegister(index, data);
-  }
+  WriteRegisterRange(index, memory_->TranslatePhysical<uint32_t*>(address),
+                     size_dwords);
   return true;
 }
 
@@ -1443,10 +1899,7 @@ bool CommandProcessor::ExecutePacketType3_SET_SHADER_CONSTANTS(
     RingbufferReader* reader, uint32_t packet, uint32_t count) {
   uint32_t offset_type = reader->Read();
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->Read();
-    WriteRegister(index, data);
-  }
+  WriteRegisterRange(reader, index, count - 1);
   return true;
 }
 
@@ -1492,13 +1945,153 @@ bool CommandProcessor::ExecutePacketType3_INVALIDATE_STATE(
   return true;
 }
 
+void CommandProcessor::CommandDecodeThreadMain() {
+  while (worker_running_) {
+    uint32_t write_ptr_index = write_ptr_index_.load();
+    uint32_t decode_ptr_index = decode_ptr_index_.load();
+    if (write_ptr_index == 0xBAADF00D || decode_ptr_index == write_ptr_index) {
+      // The event is set on every write pointer update.
+      xe::threading::Wait(write_ptr_index_event_.get(), false,
+                          std::chrono::milliseconds(1));
+      continue;
+    }
+    DecodePrimaryBuffer(decode_ptr_index, write_ptr_index);
+  }
+}
+
+void CommandProcessor::DecodePrimaryBuffer(uint32_t start_index,
+                                           uint32_t end_index) {
+  SCOPE_profile_cpu_f("gpu");
+
+  uint32_t start_ptr = primary_buffer_ptr_ + start_index * sizeof(uint32_t);
+  start_ptr = (primary_buffer_ptr_ & ~0x1FFFFFFF) | (start_ptr & 0x1FFFFFFF);
+  uint32_t end_ptr = primary_buffer_ptr_ + end_index * sizeof(uint32_t);
+  end_ptr = (primary_buffer_ptr_ & ~0x1FFFFFFF) | (end_ptr & 0x1FFFFFFF);
+
+  uint32_t ptr_mask = (primary_buffer_size_ / sizeof(uint32_t)) - 1;
+  RingbufferReader reader(memory_->physical_membase(), primary_buffer_ptr_,
+                          ptr_mask, start_ptr, end_ptr);
+  while (reader.can_read() && worker_running_) {
+    if (DecodePacket(&reader)) {
+      continue;
+    }
+    // The guest may be holding back whatever comes next until the wait is
+    // satisfied, so hand over what we have and let the worker pass it.
+    uint32_t index = (start_index + reader.offset()) & ptr_mask;
+    decode_ptr_index_ = index;
+    while (worker_running_ && read_ptr_index_ != index) {
+      xe::threading::Sleep(std::chrono::microseconds(100));
+    }
+  }
+  decode_ptr_index_ = end_index;
+}
+
+bool CommandProcessor::DecodeIndirectBuffer(uint32_t ptr, uint32_t length) {
+  uint32_t ptr_mask = 0;
+  RingbufferReader reader(memory_->physical_membase(), primary_buffer_ptr_,
+                          ptr_mask, ptr, ptr + length * sizeof(uint32_t));
+  while (reader.can_read()) {
+    if (!DecodePacket(&reader)) {
+      // The rest is left to the worker.
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CommandProcessor::DecodePacket(RingbufferReader* reader) {
+  // Keep in sync with ExecutePacket. Only what is worth doing ahead of the
+  // worker is looked at; everything else is skipped.
+  static const size_t kMaxDecodedShaderLoads = 256;
+  const uint32_t packet = reader->Read();
+  switch (packet >> 30) {
+    case 0x00:
+      if (packet) {
+        reader->Skip(((packet >> 16) & 0x3FFF) + 1);
+      }
+      return true;
+    case 0x01:
+      reader->Skip(2);
+      return true;
+    case 0x02:
+      return true;
+  }
+
+  uint32_t opcode = (packet >> 8) & 0x7F;
+  uint32_t count = ((packet >> 16) & 0x3FFF) + 1;
+  auto data_end_offset = reader->offset() + count;
+  ShaderType shader_type;
+  uint32_t guest_address;
+  uint32_t dword_count;
+  switch (opcode) {
+    case PM4_INDIRECT_BUFFER: {
+      uint32_t list_ptr = CpuToGpu(reader->Read());
+      uint32_t list_length = reader->Read();
+      reader->Skip(data_end_offset - reader->offset());
+      return DecodeIndirectBuffer(GpuToCpu(list_ptr), list_length);
+    }
+    case PM4_WAIT_REG_MEM:
+      reader->Skip(count);
+      return false;
+    case PM4_IM_LOAD: {
+      uint32_t addr_type = reader->Read();
+      shader_type = static_cast<ShaderType>(addr_type & 0x3);
+      guest_address = addr_type & ~0x3;
+      dword_count = reader->Read() & 0xFFFF;
+    } break;
+    case PM4_IM_LOAD_IMMEDIATE:
+      shader_type = static_cast<ShaderType>(reader->Read());
+      dword_count = reader->Read() & 0xFFFF;
+      guest_address = reader->ptr();
+      break;
+    default:
+      reader->Skip(count);
+      return true;
+  }
+  reader->Skip(data_end_offset - reader->offset());
+
+  uint64_t hash =
+      XXH64(memory_->TranslatePhysical<uint32_t*>(guest_address),
+            dword_count * sizeof(uint32_t), 0);
+  std::lock_guard<std::mutex> lock(decoded_shader_loads_mutex_);
+  if (decoded_shader_loads_.size() < kMaxDecodedShaderLoads) {
+    decoded_shader_loads_.push_back(
+        {shader_type, guest_address, dword_count, hash});
+  }
+  return true;
+}
+
+bool CommandProcessor::TakeDecodedShaderHash(ShaderType shader_type,
+                                             uint32_t guest_address,
+                                             uint32_t dword_count,
+                                             uint64_t* out_hash) {
+  std::lock_guard<std::mutex> lock(decoded_shader_loads_mutex_);
+  // Loads in front of ours were skipped by the worker (predicated packets).
+  while (!decoded_shader_loads_.empty()) {
+    auto load = decoded_shader_loads_.front();
+    decoded_shader_loads_.pop_front();
+    if (load.shader_type == shader_type &&
+        load.guest_address == guest_address &&
+        load.dword_count == dword_count) {
+      *out_hash = load.hash;
+      return true;
+    }
+  }
+  return false;
+}
+
 bool CommandProcessor::LoadShader(ShaderType shader_type,
                                   uint32_t guest_address,
                                   const uint32_t* host_address,
                                   uint32_t dword_count) {
-  // Hash the input memory and lookup the shader.
+  // Hash the input memory (unless the decode thread already did) and lookup
+  // the shader.
   GL4Shader* shader_ptr = nullptr;
-  uint64_t hash = XXH64(host_address, dword_count * sizeof(uint32_t), 0);
+  uint64_t hash;
+  if (!decode_thread_ ||
+      !TakeDecodedShaderHash(shader_type, guest_address, dword_count, &hash)) {
+    hash = XXH64(host_address, dword_count * sizeof(uint32_t), 0);
+  }
   auto it = shader_cache_.find(hash);
   if (it != shader_cache_.end()) {
     // Found in the cache.
@@ -1513,10 +2106,20 @@ bool CommandProcessor::LoadShader(ShaderType shader_type,
     shader_cache_.insert({hash, shader_ptr});
     all_shaders_.emplace_back(std::move(shader));
 
-    XELOGGPU("Set %s shader at %0.8X (%db):\n%s",
+    XELOGGPU("Set %s shader at %0.8X (%db), hash %.16llX",
              shader_type == ShaderType::kVertex ? "vertex" : "pixel",
-             guest_address, dword_count * 4,
-             shader_ptr->ucode_disassembly().c_str());
+             guest_address, dword_count * 4, hash);
+    if (shader_analysis_running_) {
+      // Titles tend to load shaders in batches well ahead of using them.
+      {
+        std::lock_guard<std::mutex> lock(shader_analysis_mutex_);
+        shader_analysis_queue_.push_back(shader_ptr);
+      }
+      shader_analysis_cond_.notify_one();
+    } else {
+      shader_ptr->Analyze();
+      XELOGGPU("%s", shader_ptr->ucode_disassembly().c_str());
+    }
   }
   switch (shader_type) {
     case ShaderType::kVertex:
@@ -1565,6 +2168,11 @@ bool CommandProcessor::IssueDraw() {
   UpdateStatus status;
   bool mismatch = false;
   status = UpdateShaders(draw_batcher_.prim_type());
+  if (status == UpdateStatus::kPending) {
+    // Skip the draw rather than wait for the shaders to compile.
+    draw_batcher_.DiscardDraw();
+    return true;
+  }
   CHECK_ISSUE_UPDATE_STATUS(status, mismatch, "Unable to prepare draw shaders");
   status = UpdateRenderTargets();
   CHECK_ISSUE_UPDATE_STATUS(status, mismatch, "Unable to setup render targets");
@@ -1590,8 +2198,8 @@ bool CommandProcessor::IssueDraw() {
   if (!draw_batcher_.CommitDraw()) {
     return false;
   }
-  // TODO(benvanik): find a way to get around glVertexArrayVertexBuffer below.
-  draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
+  ++draw_count_;
+  MarkRenderTargetsWritten();
   return true;
 }
 
@@ -1614,7 +2222,99 @@ bool CommandProcessor::SetShadowRegister(float* dest, uint32_t register_name) {
   return true;
 }
 
-CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
+CommandProcessor::UpdateStatus CommandProcessor::PrepareShader(
+    GL4Shader* shader, const xenos::xe_gpu_program_cntl_t& program_cntl) {
+  bool is_vertex = shader->type() == ShaderType::kVertex;
+  if (!shader->has_prepared()) {
+    if (shader_compile_thread_) {
+      if (!shader->BeginAsyncPrepare()) {
+        return UpdateStatus::kError;
+      }
+      {
+        std::lock_guard<std::mutex> lock(shader_compile_mutex_);
+        shader_compile_queue_.push_back({shader, program_cntl});
+      }
+      shader_compile_cond_.notify_one();
+      return UpdateStatus::kPending;
+    }
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    bool prepared =
+        is_vertex
+            ? shader->PrepareVertexShader(&shader_translator_, program_cntl,
+                                          shader_cache_file_.get())
+            : shader->PreparePixelShader(&shader_translator_, program_cntl,
+                                         shader_cache_file_.get());
+    shader_compile_ticks_ += Clock::QueryHostTickCount() - start_ticks;
+    if (!prepared) {
+      XELOGE("Unable to prepare %s shader", is_vertex ? "vertex" : "pixel");
+      return UpdateStatus::kError;
+    }
+  } else if (shader->is_compile_pending()) {
+    return UpdateStatus::kPending;
+  } else if (!shader->is_valid()) {
+    XELOGE("%s shader invalid", is_vertex ? "Vertex" : "Pixel");
+    return UpdateStatus::kError;
+  }
+  return UpdateStatus::kCompatible;
+}
+
+void CommandProcessor::ShaderCompileThreadMain() {
+  shader_compile_context_->MakeCurrent();
+  while (true) {
+    PendingShaderCompile pending;
+    {
+      std::unique_lock<std::mutex> lock(shader_compile_mutex_);
+      shader_compile_cond_.wait(lock, [this]() {
+        return !shader_compile_running_ || !shader_compile_queue_.empty();
+      });
+      if (!shader_compile_running_) {
+        break;
+      }
+      pending = shader_compile_queue_.front();
+      shader_compile_queue_.pop_front();
+    }
+    SCOPE_profile_cpu_i("gpu", "xe::gpu::gl4::CommandProcessor::CompileShader");
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    bool is_valid = pending.shader->PrepareProgram(
+        &shader_compile_translator_, pending.program_cntl,
+        shader_cache_file_.get());
+    shader_compile_ticks_ += Clock::QueryHostTickCount() - start_ticks;
+    if (!is_valid) {
+      XELOGE("Unable to prepare %s shader",
+             pending.shader->type() == ShaderType::kVertex ? "vertex"
+                                                            : "pixel");
+    }
+    // The program must be complete before the drawing context can use it.
+    glFinish();
+    pending.shader->EndAsyncPrepare(is_valid);
+  }
+  shader_compile_context_->ClearCurrent();
+}
+
+void CommandProcessor::ShaderAnalysisThreadMain() {
+  while (true) {
+    GL4Shader* shader;
+    {
+      std::unique_lock<std::mutex> lock(shader_analysis_mutex_);
+      shader_analysis_cond_.wait(lock, [this]() {
+        return !shader_analysis_running_ || !shader_analysis_queue_.empty();
+      });
+      if (!shader_analysis_running_) {
+        break;
+      }
+      shader = shader_analysis_queue_.front();
+      shader_analysis_queue_.pop_front();
+    }
+    SCOPE_profile_cpu_i("gpu", "xe::gpu::gl4::CommandProcessor::AnalyzeShader");
+    // Does nothing if the shader was bound and analyzed in the meantime.
+    shader->Analyze();
+    XELOGGPU("%s shader %.16llX:\n%s",
+             shader->type() == ShaderType::kVertex ? "Vertex" : "Pixel",
+             shader->data_hash(), shader->ucode_disassembly().c_str());
+  }
+}
+
+CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
     PrimitiveType prim_type) {
   auto& regs = update_shaders_regs_;
 
@@ -1628,8 +2328,6 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
               register_file_->values[XE_GPU_REG_SQ_PS_CONST].u32 == 0x00000000);
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
   dirty |= SetShadowRegister(&regs.sq_program_cntl, XE_GPU_REG_SQ_PROGRAM_CNTL);
   dirty |= regs.vertex_shader != active_vertex_shader_;
   dirty |= regs.pixel_shader != active_pixel_shader_;
@@ -1641,36 +2339,50 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
   regs.pixel_shader = active_pixel_shader_;
   regs.prim_type = prim_type;
 
+  // Joins analysis still queued or running on the worker threads.
+  active_vertex_shader_->Analyze();
+  active_pixel_shader_->Analyze();
+
+  active_sampler_descs_.clear();
+  uint32_t used_fetch_slots = 0;
+  for (GL4Shader* shader : {active_vertex_shader_, active_pixel_shader_}) {
+    const auto& sampler_inputs = shader->sampler_inputs();
+    for (size_t i = 0; i < sampler_inputs.count; ++i) {
+      const auto& desc = sampler_inputs.descs[i];
+      if (used_fetch_slots & (1 << desc.fetch_slot)) {
+        continue;
+      }
+      used_fetch_slots |= 1 << desc.fetch_slot;
+      active_sampler_descs_.push_back(&desc);
+    }
+  }
+
   SCOPE_profile_cpu_f("gpu");
 
   draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
 
   xe_gpu_program_cntl_t program_cntl;
   program_cntl.dword_0 = regs.sq_program_cntl;
-  if (!active_vertex_shader_->has_prepared()) {
-    if (!active_vertex_shader_->PrepareVertexShader(&shader_translator_,
-                                                    program_cntl)) {
-      XELOGE("Unable to prepare vertex shader");
-      return UpdateStatus::kError;
-    }
-  } else if (!active_vertex_shader_->is_valid()) {
-    XELOGE("Vertex shader invalid");
+  auto vertex_status = PrepareShader(active_vertex_shader_, program_cntl);
+  auto pixel_status = PrepareShader(active_pixel_shader_, program_cntl);
+  if (vertex_status == UpdateStatus::kError ||
+      pixel_status == UpdateStatus::kError) {
     return UpdateStatus::kError;
   }
-
-  if (!active_pixel_shader_->has_prepared()) {
-    if (!active_pixel_shader_->PreparePixelShader(&shader_translator_,
-                                                  program_cntl)) {
-      XELOGE("Unable to prepare pixel shader");
-      return UpdateStatus::kError;
-    }
-  } else if (!active_pixel_shader_->is_valid()) {
-    XELOGE("Pixel shader invalid");
-    return UpdateStatus::kError;
+  if (vertex_status == UpdateStatus::kPending ||
+      (pixel_status == UpdateStatus::kPending &&
+       !placeholder_fragment_program_)) {
+    // Check again on the next draw.
+    regs.vertex_shader = nullptr;
+    return UpdateStatus::kPending;
   }
 
   GLuint vertex_program = active_vertex_shader_->program();
   GLuint fragment_program = active_pixel_shader_->program();
+  if (pixel_status == UpdateStatus::kPending) {
+    fragment_program = placeholder_fragment_program_;
+    regs.pixel_shader = nullptr;
+  }
 
   uint64_t key = (uint64_t(vertex_program) << 32) | fragment_program;
   CachedPipeline* cached_pipeline = nullptr;
@@ -1690,7 +2402,7 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
   }
   if (!cached_pipeline->handles.default_pipeline) {
     // Perhaps it's a bit wasteful to do all of these, but oh well.
-    GLuint pipelines[5];
+    GLuint pipelines[3];
     glCreateProgramPipelines(GLsizei(xe::countof(pipelines)), pipelines);
 
     glUseProgramStages(pipelines[0], GL_VERTEX_SHADER_BIT, vertex_program);
@@ -1708,30 +2420,6 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
                        rect_list_geometry_program_);
     glUseProgramStages(pipelines[2], GL_FRAGMENT_SHADER_BIT, fragment_program);
     cached_pipeline->handles.rect_list_pipeline = pipelines[2];
-
-    glUseProgramStages(pipelines[3], GL_VERTEX_SHADER_BIT, vertex_program);
-    glUseProgramStages(pipelines[3], GL_GEOMETRY_SHADER_BIT,
-                       quad_list_geometry_program_);
-    glUseProgramStages(pipelines[3], GL_FRAGMENT_SHADER_BIT, fragment_program);
-    cached_pipeline->handles.quad_list_pipeline = pipelines[3];
-
-    glUseProgramStages(pipelines[4], GL_VERTEX_SHADER_BIT, vertex_program);
-    glUseProgramStages(pipelines[4], GL_GEOMETRY_SHADER_BIT,
-                       line_quad_list_geometry_program_);
-    glUseProgramStages(pipelines[4], GL_FRAGMENT_SHADER_BIT, fragment_program);
-    cached_pipeline->handles.line_quad_list_pipeline = pipelines[4];
-
-    // This can be set once, as the buffer never changes.
-    glVertexArrayElementBuffer(active_vertex_shader_->vao(),
-                               scratch_buffer_.handle());
-  }
-
-  bool line_mode = false;
-  if (((regs.pa_su_sc_mode_cntl >> 3) & 0x3) != 0) {
-    uint32_t front_poly_mode = (regs.pa_su_sc_mode_cntl >> 5) & 0x7;
-    if (front_poly_mode == 1) {
-      line_mode = true;
-    }
   }
 
   GLuint pipeline;
@@ -1746,14 +2434,6 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
     case PrimitiveType::kRectangleList:
       pipeline = cached_pipeline->handles.rect_list_pipeline;
       break;
-    case PrimitiveType::kQuadList: {
-      if (line_mode) {
-        pipeline = cached_pipeline->handles.line_quad_list_pipeline;
-      } else {
-        pipeline = cached_pipeline->handles.quad_list_pipeline;
-      }
-      break;
-    }
   }
 
   draw_batcher_.ReconfigurePipeline(active_vertex_shader_, active_pixel_shader_,
@@ -1761,11 +2441,24 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateShaders(
 
   glBindProgramPipeline(pipeline);
   glBindVertexArray(active_vertex_shader_->vao());
+  if (vertex_array_ != active_vertex_shader_->vao()) {
+    // Bindings of another VAO; forget them.
+    vertex_array_ = active_vertex_shader_->vao();
+    vertex_array_element_buffer_ = 0;
+    for (auto& binding : vertex_buffer_bindings_) {
+      binding.buffer = 0;
+    }
+  }
 
   return UpdateStatus::kMismatch;
 }
 
 CommandProcessor::UpdateStatus CommandProcessor::UpdateRenderTargets() {
+  if (!(dirty_state_groups_ & kDirtyRenderTargets)) {
+    return UpdateStatus::kCompatible;
+  }
+  dirty_state_groups_ &= ~kDirtyRenderTargets;
+
   auto& regs = update_render_targets_regs_;
 
   bool dirty = false;
@@ -1804,6 +2497,14 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateRenderTargets() {
   const auto& shader_targets =
       active_pixel_shader_->alloc_counts().color_targets;
   GLuint color_targets[4] = {kAnyTarget, kAnyTarget, kAnyTarget, kAnyTarget};
+  for (auto& active_render_target : active_render_targets_) {
+    active_render_target = nullptr;
+  }
+  uint32_t samples_x = surface_msaa == MsaaSamples::k4X ? 2 : 1;
+  active_render_target_samples_y_ = surface_msaa != MsaaSamples::k1X ? 2 : 1;
+  uint32_t row_tiles =
+      xe::round_up(surface_pitch * samples_x, kEdramTileWidth) /
+      kEdramTileWidth;
   if (enable_mode == ModeControl::kColorDepth) {
     uint32_t color_info[4] = {
         regs.rb_color_info, regs.rb_color1_info, regs.rb_color2_info,
@@ -1820,8 +2521,11 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateRenderTargets() {
       uint32_t color_base = color_info[n] & 0xFFF;
       auto color_format =
           static_cast<ColorRenderTargetFormat>((color_info[n] >> 16) & 0xF);
-      color_targets[n] = GetColorRenderTarget(surface_pitch, surface_msaa,
-                                              color_base, color_format);
+      auto color_target = GetCachedColorRenderTarget(color_base, color_format);
+      color_targets[n] = color_target ? color_target->texture : 0;
+      active_render_targets_[n] = color_target;
+      active_render_target_row_tiles_[n] =
+          row_tiles * (IsColorRenderTargetFormat64bpp(color_format) ? 2 : 1);
       draw_buffers[n] = GL_COLOR_ATTACHMENT0 + n;
       glColorMaski(n, !!(write_mask & 0x1), !!(write_mask & 0x2),
                    !!(write_mask & 0x4), !!(write_mask & 0x8));
@@ -1839,8 +2543,11 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateRenderTargets() {
     uint32_t depth_base = regs.rb_depth_info & 0xFFF;
     auto depth_format =
         static_cast<DepthRenderTargetFormat>((regs.rb_depth_info >> 16) & 0x1);
-    depth_target = GetDepthRenderTarget(surface_pitch, surface_msaa, depth_base,
-                                        depth_format);
+    auto cached_depth_target =
+        GetCachedDepthRenderTarget(depth_base, depth_format);
+    depth_target = cached_depth_target ? cached_depth_target->texture : 0;
+    active_render_targets_[4] = cached_depth_target;
+    active_render_target_row_tiles_[4] = row_tiles;
     // TODO(benvanik): when a game switches does it expect to keep the same
     //     depth buffer contents?
   }
@@ -1879,12 +2586,8 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateState() {
   UpdateStatus status;
   status = UpdateViewportState();
   CHECK_UPDATE_STATUS(status, mismatch, "Unable to update viewport state");
-  status = UpdateRasterizerState();
-  CHECK_UPDATE_STATUS(status, mismatch, "Unable to update rasterizer state");
-  status = UpdateBlendState();
-  CHECK_UPDATE_STATUS(status, mismatch, "Unable to update blend state");
-  status = UpdateDepthStencilState();
-  CHECK_UPDATE_STATUS(status, mismatch, "Unable to update depth/stencil state");
+  status = UpdatePipelineState();
+  CHECK_UPDATE_STATUS(status, mismatch, "Unable to update pipeline state");
 
   return mismatch ? UpdateStatus::kMismatch : UpdateStatus::kCompatible;
 }
@@ -1893,30 +2596,35 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateViewportState() {
   auto& regs = update_viewport_state_regs_;
 
   bool dirty = false;
-  // dirty |= SetShadowRegister(&state_regs.pa_cl_clip_cntl,
-  //     XE_GPU_REG_PA_CL_CLIP_CNTL);
-  dirty |= SetShadowRegister(&regs.rb_surface_info, XE_GPU_REG_RB_SURFACE_INFO);
-  dirty |= SetShadowRegister(&regs.pa_cl_vte_cntl, XE_GPU_REG_PA_CL_VTE_CNTL);
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.pa_sc_window_offset,
-                             XE_GPU_REG_PA_SC_WINDOW_OFFSET);
-  dirty |= SetShadowRegister(&regs.pa_sc_window_scissor_tl,
-                             XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL);
-  dirty |= SetShadowRegister(&regs.pa_sc_window_scissor_br,
-                             XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR);
-  dirty |= SetShadowRegister(&regs.pa_cl_vport_xoffset,
-                             XE_GPU_REG_PA_CL_VPORT_XOFFSET);
-  dirty |= SetShadowRegister(&regs.pa_cl_vport_yoffset,
-                             XE_GPU_REG_PA_CL_VPORT_YOFFSET);
-  dirty |= SetShadowRegister(&regs.pa_cl_vport_zoffset,
-                             XE_GPU_REG_PA_CL_VPORT_ZOFFSET);
-  dirty |= SetShadowRegister(&regs.pa_cl_vport_xscale,
-                             XE_GPU_REG_PA_CL_VPORT_XSCALE);
-  dirty |= SetShadowRegister(&regs.pa_cl_vport_yscale,
-                             XE_GPU_REG_PA_CL_VPORT_YSCALE);
-  dirty |= SetShadowRegister(&regs.pa_cl_vport_zscale,
-                             XE_GPU_REG_PA_CL_VPORT_ZSCALE);
+  if (dirty_state_groups_ & kDirtyViewport) {
+    dirty_state_groups_ &= ~kDirtyViewport;
+    // dirty |= SetShadowRegister(&state_regs.pa_cl_clip_cntl,
+    //     XE_GPU_REG_PA_CL_CLIP_CNTL);
+    dirty |=
+        SetShadowRegister(&regs.rb_surface_info, XE_GPU_REG_RB_SURFACE_INFO);
+    dirty |=
+        SetShadowRegister(&regs.pa_cl_vte_cntl, XE_GPU_REG_PA_CL_VTE_CNTL);
+    dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
+                               XE_GPU_REG_PA_SU_SC_MODE_CNTL);
+    dirty |= SetShadowRegister(&regs.pa_sc_window_offset,
+                               XE_GPU_REG_PA_SC_WINDOW_OFFSET);
+    dirty |= SetShadowRegister(&regs.pa_sc_window_scissor_tl,
+                               XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL);
+    dirty |= SetShadowRegister(&regs.pa_sc_window_scissor_br,
+                               XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR);
+    dirty |= SetShadowRegister(&regs.pa_cl_vport_xoffset,
+                               XE_GPU_REG_PA_CL_VPORT_XOFFSET);
+    dirty |= SetShadowRegister(&regs.pa_cl_vport_yoffset,
+                               XE_GPU_REG_PA_CL_VPORT_YOFFSET);
+    dirty |= SetShadowRegister(&regs.pa_cl_vport_zoffset,
+                               XE_GPU_REG_PA_CL_VPORT_ZOFFSET);
+    dirty |= SetShadowRegister(&regs.pa_cl_vport_xscale,
+                               XE_GPU_REG_PA_CL_VPORT_XSCALE);
+    dirty |= SetShadowRegister(&regs.pa_cl_vport_yscale,
+                               XE_GPU_REG_PA_CL_VPORT_YSCALE);
+    dirty |= SetShadowRegister(&regs.pa_cl_vport_zscale,
+                               XE_GPU_REG_PA_CL_VPORT_ZSCALE);
+  }
 
   // Much of this state machine is extracted from:
   // https://github.com/freedreno/mesa/blob/master/src/mesa/drivers/dri/r200/r200_state.c
@@ -1981,7 +2689,10 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateViewportState() {
   GLsizei ws_h = ((regs.pa_sc_window_scissor_br >> 16) & 0x7FFF) - ws_y;
   ws_x += window_offset_x;
   ws_y += window_offset_y;
-  glScissorIndexed(0, ws_x, ws_y, ws_w, ws_h);
+  // Everything below is in guest pixels; render targets are
+  // resolution_scale_ times larger.
+  GLint scale = resolution_scale_;
+  glScissorIndexed(0, ws_x * scale, ws_y * scale, ws_w * scale, ws_h * scale);
 
   // HACK: no clue where to get these values.
   // RB_SURFACE_INFO
@@ -2026,7 +2737,9 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateViewportState() {
     float vph = -2 * window_height_scalar * vsy;
     float vpx = window_width_scalar * vox - vpw / 2 + window_offset_x;
     float vpy = window_height_scalar * voy - vph / 2 + window_offset_y;
-    glViewportIndexedf(0, vpx + texel_offset_x, vpy + texel_offset_y, vpw, vph);
+    glViewportIndexedf(0, (vpx + texel_offset_x) * scale,
+                       (vpy + texel_offset_y) * scale, vpw * scale,
+                       vph * scale);
 
     // TODO(benvanik): depth range adjustment?
     // float voz = vport_zoffset_enable ? regs.pa_cl_vport_zoffset : 0;
@@ -2038,7 +2751,9 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateViewportState() {
     float vph = 2 * 2560.0f * window_height_scalar;
     float vpx = -2560.0f * window_width_scalar + window_offset_x;
     float vpy = -2560.0f * window_height_scalar + window_offset_y;
-    glViewportIndexedf(0, vpx + texel_offset_x, vpy + texel_offset_y, vpw, vph);
+    glViewportIndexedf(0, (vpx + texel_offset_x) * scale,
+                       (vpy + texel_offset_y) * scale, vpw * scale,
+                       vph * scale);
   }
   float voz = vport_zoffset_enable ? regs.pa_cl_vport_zoffset : 0;
   float vsz = vport_zscale_enable ? regs.pa_cl_vport_zscale : 1;
@@ -2047,126 +2762,108 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateViewportState() {
   return UpdateStatus::kMismatch;
 }
 
-CommandProcessor::UpdateStatus CommandProcessor::UpdateRasterizerState() {
-  auto& regs = update_rasterizer_state_regs_;
+CommandProcessor::UpdateStatus CommandProcessor::UpdatePipelineState() {
+  auto& reg_file = *register_file_;
 
-  bool dirty = false;
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_tl,
-                             XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL);
-  dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_br,
-                             XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR);
-  dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
-                             XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
-  if (!dirty) {
+  // Alpha testing -- ALPHAREF, ALPHAFUNC, ALPHATESTENABLE
+  // Deprecated in GL, implemented in shader.
+  // if(ALPHATESTENABLE && frag_out.a [<=/ALPHAFUNC] ALPHAREF) discard;
+  uint32_t color_control = reg_file[XE_GPU_REG_RB_COLORCONTROL].u32;
+  draw_batcher_.set_alpha_test((color_control & 0x4) != 0,  // ALPAHTESTENABLE
+                               color_control & 0x7,         // ALPHAFUNC
+                               reg_file[XE_GPU_REG_RB_ALPHA_REF].f32);
+
+  const uint8_t kPipelineStateGroups =
+      kDirtyRasterizer | kDirtyBlend | kDirtyDepthStencil;
+  if (!(dirty_state_groups_ & kPipelineStateGroups)) {
+    return UpdateStatus::kCompatible;
+  }
+  dirty_state_groups_ &= ~kPipelineStateGroups;
+
+  PipelineStateKey key;
+  key.pa_su_sc_mode_cntl = reg_file[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32;
+  key.pa_sc_screen_scissor_tl =
+      reg_file[XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL].u32;
+  key.pa_sc_screen_scissor_br =
+      reg_file[XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR].u32;
+  key.multi_prim_ib_reset_index =
+      reg_file[XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX].u32;
+  key.rb_blendcontrol[0] = reg_file[XE_GPU_REG_RB_BLENDCONTROL_0].u32;
+  key.rb_blendcontrol[1] = reg_file[XE_GPU_REG_RB_BLENDCONTROL_1].u32;
+  key.rb_blendcontrol[2] = reg_file[XE_GPU_REG_RB_BLENDCONTROL_2].u32;
+  key.rb_blendcontrol[3] = reg_file[XE_GPU_REG_RB_BLENDCONTROL_3].u32;
+  key.rb_blend_rgba[0] = reg_file[XE_GPU_REG_RB_BLEND_RED].u32;
+  key.rb_blend_rgba[1] = reg_file[XE_GPU_REG_RB_BLEND_GREEN].u32;
+  key.rb_blend_rgba[2] = reg_file[XE_GPU_REG_RB_BLEND_BLUE].u32;
+  key.rb_blend_rgba[3] = reg_file[XE_GPU_REG_RB_BLEND_ALPHA].u32;
+  key.rb_depthcontrol = reg_file[XE_GPU_REG_RB_DEPTHCONTROL].u32;
+  key.rb_stencilrefmask = reg_file[XE_GPU_REG_RB_STENCILREFMASK].u32;
+  if (active_pipeline_state_ && active_pipeline_state_->key == key) {
     return UpdateStatus::kCompatible;
   }
 
   SCOPE_profile_cpu_f("gpu");
 
-  draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
-
-  // Scissoring.
-  // TODO(benvanik): is this used? we are using scissoring for window scissor.
-  if (regs.pa_sc_screen_scissor_tl != 0 &&
-      regs.pa_sc_screen_scissor_br != 0x20002000) {
-    assert_always();
-    // glEnable(GL_SCISSOR_TEST);
-    // TODO(benvanik): signed?
-    int32_t screen_scissor_x = regs.pa_sc_screen_scissor_tl & 0x7FFF;
-    int32_t screen_scissor_y = (regs.pa_sc_screen_scissor_tl >> 16) & 0x7FFF;
-    int32_t screen_scissor_w =
-        regs.pa_sc_screen_scissor_br & 0x7FFF - screen_scissor_x;
-    int32_t screen_scissor_h =
-        (regs.pa_sc_screen_scissor_br >> 16) & 0x7FFF - screen_scissor_y;
-    glScissor(screen_scissor_x, screen_scissor_y, screen_scissor_w,
-              screen_scissor_h);
+  uint64_t hash = XXH64(&key, sizeof(key), 0);
+  CachedPipelineState* state = nullptr;
+  auto it = cached_pipeline_states_.find(hash);
+  if (it != cached_pipeline_states_.end() && it->second->key == key) {
+    state = it->second;
   } else {
-    // glDisable(GL_SCISSOR_TEST);
+    auto new_state = std::make_unique<CachedPipelineState>();
+    new_state->key = key;
+    DecodePipelineState(new_state.get());
+    state = new_state.get();
+    all_pipeline_states_.emplace_back(std::move(new_state));
+    cached_pipeline_states_[hash] = state;
   }
 
-  switch (regs.pa_su_sc_mode_cntl & 0x3) {
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
+  ApplyPipelineState(*state, active_pipeline_state_);
+  active_pipeline_state_ = state;
+
+  return UpdateStatus::kMismatch;
+}
+
+void CommandProcessor::DecodePipelineState(CachedPipelineState* state) {
+  const auto& key = state->key;
+
+  switch (key.pa_su_sc_mode_cntl & 0x3) {
     case 0:
-      glDisable(GL_CULL_FACE);
+    default:
+      state->cull_enabled = false;
+      state->cull_face = GL_BACK;
       break;
     case 1:
-      glEnable(GL_CULL_FACE);
-      glCullFace(GL_FRONT);
+      state->cull_enabled = true;
+      state->cull_face = GL_FRONT;
       break;
     case 2:
-      glEnable(GL_CULL_FACE);
-      glCullFace(GL_BACK);
+      state->cull_enabled = true;
+      state->cull_face = GL_BACK;
       break;
   }
-  if (regs.pa_su_sc_mode_cntl & 0x4) {
-    glFrontFace(GL_CW);
-  } else {
-    glFrontFace(GL_CCW);
-  }
+  state->front_face = (key.pa_su_sc_mode_cntl & 0x4) ? GL_CW : GL_CCW;
 
   static const GLenum kFillModes[3] = {
       GL_POINT, GL_LINE, GL_FILL,
   };
-  bool poly_mode = ((regs.pa_su_sc_mode_cntl >> 3) & 0x3) != 0;
+  bool poly_mode = ((key.pa_su_sc_mode_cntl >> 3) & 0x3) != 0;
   if (poly_mode) {
-    uint32_t front_poly_mode = (regs.pa_su_sc_mode_cntl >> 5) & 0x7;
-    uint32_t back_poly_mode = (regs.pa_su_sc_mode_cntl >> 8) & 0x7;
+    uint32_t front_poly_mode = (key.pa_su_sc_mode_cntl >> 5) & 0x7;
+    uint32_t back_poly_mode = (key.pa_su_sc_mode_cntl >> 8) & 0x7;
     // GL only supports both matching.
     assert_true(front_poly_mode == back_poly_mode);
-    glPolygonMode(GL_FRONT_AND_BACK, kFillModes[front_poly_mode]);
-  } else {
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-  }
-
-  if (regs.pa_su_sc_mode_cntl & (1 << 19)) {
-    glProvokingVertex(GL_LAST_VERTEX_CONVENTION);
+    state->polygon_mode = kFillModes[front_poly_mode];
   } else {
-    glProvokingVertex(GL_FIRST_VERTEX_CONVENTION);
-  }
-
-  if (regs.pa_su_sc_mode_cntl & (1 << 21)) {
-    glEnable(GL_PRIMITIVE_RESTART);
-  } else {
-    glDisable(GL_PRIMITIVE_RESTART);
-  }
-  glPrimitiveRestartIndex(regs.multi_prim_ib_reset_index);
-
-  return UpdateStatus::kMismatch;
-}
-
-CommandProcessor::UpdateStatus CommandProcessor::UpdateBlendState() {
-  auto& reg_file = *register_file_;
-  auto& regs = update_blend_state_regs_;
-
-  // Alpha testing -- ALPHAREF, ALPHAFUNC, ALPHATESTENABLE
-  // Deprecated in GL, implemented in shader.
-  // if(ALPHATESTENABLE && frag_out.a [<=/ALPHAFUNC] ALPHAREF) discard;
-  uint32_t color_control = reg_file[XE_GPU_REG_RB_COLORCONTROL].u32;
-  draw_batcher_.set_alpha_test((color_control & 0x4) != 0,  // ALPAHTESTENABLE
-                               color_control & 0x7,         // ALPHAFUNC
-                               reg_file[XE_GPU_REG_RB_ALPHA_REF].f32);
-
-  bool dirty = false;
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[0], XE_GPU_REG_RB_BLENDCONTROL_0);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[1], XE_GPU_REG_RB_BLENDCONTROL_1);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[2], XE_GPU_REG_RB_BLENDCONTROL_2);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[3], XE_GPU_REG_RB_BLENDCONTROL_3);
-  dirty |= SetShadowRegister(&regs.rb_blend_rgba[0], XE_GPU_REG_RB_BLEND_RED);
-  dirty |= SetShadowRegister(&regs.rb_blend_rgba[1], XE_GPU_REG_RB_BLEND_GREEN);
-  dirty |= SetShadowRegister(&regs.rb_blend_rgba[2], XE_GPU_REG_RB_BLEND_BLUE);
-  dirty |= SetShadowRegister(&regs.rb_blend_rgba[3], XE_GPU_REG_RB_BLEND_ALPHA);
-  if (!dirty) {
-    return UpdateStatus::kCompatible;
+    state->polygon_mode = GL_FILL;
   }
 
-  SCOPE_profile_cpu_f("gpu");
-
-  draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
+  state->provoking_vertex = (key.pa_su_sc_mode_cntl & (1 << 19))
+                                ? GL_LAST_VERTEX_CONVENTION
+                                : GL_FIRST_VERTEX_CONVENTION;
+  state->primitive_restart_enabled = (key.pa_su_sc_mode_cntl & (1 << 21)) != 0;
+  state->primitive_restart_index = key.multi_prim_ib_reset_index;
 
   static const GLenum blend_map[] = {
       /*  0 */ GL_ZERO,
@@ -2194,56 +2891,30 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateBlendState() {
       /*  3 */ GL_MAX,
       /*  4 */ GL_FUNC_REVERSE_SUBTRACT,
   };
-  for (int i = 0; i < xe::countof(regs.rb_blendcontrol); ++i) {
-    uint32_t blend_control = regs.rb_blendcontrol[i];
+  for (int i = 0; i < xe::countof(key.rb_blendcontrol); ++i) {
+    uint32_t blend_control = key.rb_blendcontrol[i];
+    auto& blend = state->blend[i];
     // A2XX_RB_BLEND_CONTROL_COLOR_SRCBLEND
-    auto src_blend = blend_map[(blend_control & 0x0000001F) >> 0];
+    blend.src = blend_map[(blend_control & 0x0000001F) >> 0];
     // A2XX_RB_BLEND_CONTROL_COLOR_DESTBLEND
-    auto dest_blend = blend_map[(blend_control & 0x00001F00) >> 8];
+    blend.dest = blend_map[(blend_control & 0x00001F00) >> 8];
     // A2XX_RB_BLEND_CONTROL_COLOR_COMB_FCN
-    auto blend_op = blend_op_map[(blend_control & 0x000000E0) >> 5];
+    blend.op = blend_op_map[(blend_control & 0x000000E0) >> 5];
     // A2XX_RB_BLEND_CONTROL_ALPHA_SRCBLEND
-    auto src_blend_alpha = blend_map[(blend_control & 0x001F0000) >> 16];
+    blend.src_alpha = blend_map[(blend_control & 0x001F0000) >> 16];
     // A2XX_RB_BLEND_CONTROL_ALPHA_DESTBLEND
-    auto dest_blend_alpha = blend_map[(blend_control & 0x1F000000) >> 24];
+    blend.dest_alpha = blend_map[(blend_control & 0x1F000000) >> 24];
     // A2XX_RB_BLEND_CONTROL_ALPHA_COMB_FCN
-    auto blend_op_alpha = blend_op_map[(blend_control & 0x00E00000) >> 21];
+    blend.op_alpha = blend_op_map[(blend_control & 0x00E00000) >> 21];
     // A2XX_RB_COLORCONTROL_BLEND_DISABLE ?? Can't find this!
     // Just guess based on actions.
-    bool blend_enable =
-        !((src_blend == GL_ONE) && (dest_blend == GL_ZERO) &&
-          (blend_op == GL_FUNC_ADD) && (src_blend_alpha == GL_ONE) &&
-          (dest_blend_alpha == GL_ZERO) && (blend_op_alpha == GL_FUNC_ADD));
-    if (blend_enable) {
-      glEnablei(GL_BLEND, i);
-      glBlendEquationSeparatei(i, blend_op, blend_op_alpha);
-      glBlendFuncSeparatei(i, src_blend, dest_blend, src_blend_alpha,
-                           dest_blend_alpha);
-    } else {
-      glDisablei(GL_BLEND, i);
-    }
+    blend.enabled =
+        !((blend.src == GL_ONE) && (blend.dest == GL_ZERO) &&
+          (blend.op == GL_FUNC_ADD) && (blend.src_alpha == GL_ONE) &&
+          (blend.dest_alpha == GL_ZERO) && (blend.op_alpha == GL_FUNC_ADD));
   }
-
-  glBlendColor(regs.rb_blend_rgba[0], regs.rb_blend_rgba[1],
-               regs.rb_blend_rgba[2], regs.rb_blend_rgba[3]);
-
-  return UpdateStatus::kMismatch;
-}
-
-CommandProcessor::UpdateStatus CommandProcessor::UpdateDepthStencilState() {
-  auto& regs = update_depth_stencil_state_regs_;
-
-  bool dirty = false;
-  dirty |= SetShadowRegister(&regs.rb_depthcontrol, XE_GPU_REG_RB_DEPTHCONTROL);
-  dirty |=
-      SetShadowRegister(&regs.rb_stencilrefmask, XE_GPU_REG_RB_STENCILREFMASK);
-  if (!dirty) {
-    return UpdateStatus::kCompatible;
-  }
-
-  SCOPE_profile_cpu_f("gpu");
-
-  draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
+  std::memcpy(state->blend_color, key.rb_blend_rgba,
+              sizeof(state->blend_color));
 
   static const GLenum compare_func_map[] = {
       /*  0 */ GL_NEVER,
@@ -2265,73 +2936,177 @@ CommandProcessor::UpdateStatus CommandProcessor::UpdateDepthStencilState() {
       /*  6 */ GL_INCR,
       /*  7 */ GL_DECR,
   };
+  uint32_t depth_control = key.rb_depthcontrol;
   // A2XX_RB_DEPTHCONTROL_Z_ENABLE
-  if (regs.rb_depthcontrol & 0x00000002) {
-    glEnable(GL_DEPTH_TEST);
-  } else {
-    glDisable(GL_DEPTH_TEST);
-  }
-  // glDisable(GL_DEPTH_TEST);
+  state->depth_test_enabled = (depth_control & 0x00000002) != 0;
   // A2XX_RB_DEPTHCONTROL_Z_WRITE_ENABLE
-  glDepthMask((regs.rb_depthcontrol & 0x00000004) ? GL_TRUE : GL_FALSE);
+  state->depth_mask = (depth_control & 0x00000004) ? GL_TRUE : GL_FALSE;
   // A2XX_RB_DEPTHCONTROL_EARLY_Z_ENABLE
   // ?
   // A2XX_RB_DEPTHCONTROL_ZFUNC
-  glDepthFunc(compare_func_map[(regs.rb_depthcontrol & 0x00000070) >> 4]);
+  state->depth_func = compare_func_map[(depth_control & 0x00000070) >> 4];
   // A2XX_RB_DEPTHCONTROL_STENCIL_ENABLE
-  if (regs.rb_depthcontrol & 0x00000001) {
-    glEnable(GL_STENCIL_TEST);
-  } else {
-    glDisable(GL_STENCIL_TEST);
-  }
+  state->stencil_test_enabled = (depth_control & 0x00000001) != 0;
   // RB_STENCILREFMASK_STENCILREF
-  uint32_t stencil_ref = (regs.rb_stencilrefmask & 0x000000FF);
+  state->stencil_ref = key.rb_stencilrefmask & 0x000000FF;
   // RB_STENCILREFMASK_STENCILMASK
-  uint32_t stencil_read_mask = (regs.rb_stencilrefmask & 0x0000FF00) >> 8;
+  state->stencil_read_mask = (key.rb_stencilrefmask & 0x0000FF00) >> 8;
   // RB_STENCILREFMASK_STENCILWRITEMASK
-  glStencilMask((regs.rb_stencilrefmask & 0x00FF0000) >> 16);
+  state->stencil_write_mask = (key.rb_stencilrefmask & 0x00FF0000) >> 16;
+  // A2XX_RB_DEPTHCONTROL_STENCILFUNC
+  // A2XX_RB_DEPTHCONTROL_STENCILFAIL
+  // A2XX_RB_DEPTHCONTROL_STENCILZFAIL
+  // A2XX_RB_DEPTHCONTROL_STENCILZPASS
+  auto& front = state->stencil[0];
+  front.func = compare_func_map[(depth_control & 0x00000700) >> 8];
+  front.fail = stencil_op_map[(depth_control & 0x00003800) >> 11];
+  front.zfail = stencil_op_map[(depth_control & 0x000E0000) >> 17];
+  front.zpass = stencil_op_map[(depth_control & 0x0001C000) >> 14];
   // A2XX_RB_DEPTHCONTROL_BACKFACE_ENABLE
-  bool backface_enabled = (regs.rb_depthcontrol & 0x00000080) != 0;
-  if (backface_enabled) {
-    // A2XX_RB_DEPTHCONTROL_STENCILFUNC
-    glStencilFuncSeparate(
-        GL_FRONT, compare_func_map[(regs.rb_depthcontrol & 0x00000700) >> 8],
-        stencil_ref, stencil_read_mask);
-    // A2XX_RB_DEPTHCONTROL_STENCILFAIL
-    // A2XX_RB_DEPTHCONTROL_STENCILZFAIL
-    // A2XX_RB_DEPTHCONTROL_STENCILZPASS
-    glStencilOpSeparate(
-        GL_FRONT, stencil_op_map[(regs.rb_depthcontrol & 0x00003800) >> 11],
-        stencil_op_map[(regs.rb_depthcontrol & 0x000E0000) >> 17],
-        stencil_op_map[(regs.rb_depthcontrol & 0x0001C000) >> 14]);
+  if (depth_control & 0x00000080) {
     // A2XX_RB_DEPTHCONTROL_STENCILFUNC_BF
-    glStencilFuncSeparate(
-        GL_BACK, compare_func_map[(regs.rb_depthcontrol & 0x00700000) >> 20],
-        stencil_ref, stencil_read_mask);
     // A2XX_RB_DEPTHCONTROL_STENCILFAIL_BF
     // A2XX_RB_DEPTHCONTROL_STENCILZFAIL_BF
     // A2XX_RB_DEPTHCONTROL_STENCILZPASS_BF
-    glStencilOpSeparate(
-        GL_BACK, stencil_op_map[(regs.rb_depthcontrol & 0x03800000) >> 23],
-        stencil_op_map[(regs.rb_depthcontrol & 0xE0000000) >> 29],
-        stencil_op_map[(regs.rb_depthcontrol & 0x1C000000) >> 26]);
+    auto& back = state->stencil[1];
+    back.func = compare_func_map[(depth_control & 0x00700000) >> 20];
+    back.fail = stencil_op_map[(depth_control & 0x03800000) >> 23];
+    back.zfail = stencil_op_map[(depth_control & 0xE0000000) >> 29];
+    back.zpass = stencil_op_map[(depth_control & 0x1C000000) >> 26];
   } else {
     // Backfaces disabled - treat backfaces as frontfaces.
-    glStencilFunc(compare_func_map[(regs.rb_depthcontrol & 0x00000700) >> 8],
-                  stencil_ref, stencil_read_mask);
-    glStencilOp(stencil_op_map[(regs.rb_depthcontrol & 0x00003800) >> 11],
-                stencil_op_map[(regs.rb_depthcontrol & 0x000E0000) >> 17],
-                stencil_op_map[(regs.rb_depthcontrol & 0x0001C000) >> 14]);
+    state->stencil[1] = front;
   }
+}
 
-  return UpdateStatus::kMismatch;
+void CommandProcessor::ApplyPipelineState(
+    const CachedPipelineState& state, const CachedPipelineState* previous) {
+  const auto& key = state.key;
+#define PIPELINE_STATE_CHANGED(field) \
+  (!previous ||                       \
+   std::memcmp(&state.field, &previous->field, sizeof(state.field)) != 0)
+
+  // Scissoring.
+  // TODO(benvanik): is this used? we are using scissoring for window scissor.
+  if (key.pa_sc_screen_scissor_tl != 0 &&
+      key.pa_sc_screen_scissor_br != 0x20002000) {
+    assert_always();
+    // glEnable(GL_SCISSOR_TEST);
+    // TODO(benvanik): signed?
+    int32_t screen_scissor_x = key.pa_sc_screen_scissor_tl & 0x7FFF;
+    int32_t screen_scissor_y = (key.pa_sc_screen_scissor_tl >> 16) & 0x7FFF;
+    int32_t screen_scissor_w =
+        key.pa_sc_screen_scissor_br & 0x7FFF - screen_scissor_x;
+    int32_t screen_scissor_h =
+        (key.pa_sc_screen_scissor_br >> 16) & 0x7FFF - screen_scissor_y;
+    glScissor(screen_scissor_x, screen_scissor_y, screen_scissor_w,
+              screen_scissor_h);
+  } else {
+    // glDisable(GL_SCISSOR_TEST);
+  }
+
+  if (PIPELINE_STATE_CHANGED(cull_enabled)) {
+    state.cull_enabled ? glEnable(GL_CULL_FACE) : glDisable(GL_CULL_FACE);
+  }
+  if (PIPELINE_STATE_CHANGED(cull_face)) {
+    glCullFace(state.cull_face);
+  }
+  if (PIPELINE_STATE_CHANGED(front_face)) {
+    glFrontFace(state.front_face);
+  }
+  if (PIPELINE_STATE_CHANGED(polygon_mode)) {
+    glPolygonMode(GL_FRONT_AND_BACK, state.polygon_mode);
+  }
+  if (PIPELINE_STATE_CHANGED(provoking_vertex)) {
+    glProvokingVertex(state.provoking_vertex);
+  }
+  if (PIPELINE_STATE_CHANGED(primitive_restart_enabled)) {
+    state.primitive_restart_enabled ? glEnable(GL_PRIMITIVE_RESTART)
+                                    : glDisable(GL_PRIMITIVE_RESTART);
+  }
+  if (PIPELINE_STATE_CHANGED(primitive_restart_index)) {
+    glPrimitiveRestartIndex(state.primitive_restart_index);
+  }
+
+  for (int i = 0; i < xe::countof(state.blend); ++i) {
+    const auto& blend = state.blend[i];
+    if (PIPELINE_STATE_CHANGED(blend[i])) {
+      if (blend.enabled) {
+        glEnablei(GL_BLEND, i);
+        glBlendEquationSeparatei(i, blend.op, blend.op_alpha);
+        glBlendFuncSeparatei(i, blend.src, blend.dest, blend.src_alpha,
+                             blend.dest_alpha);
+      } else {
+        glDisablei(GL_BLEND, i);
+      }
+    }
+  }
+  if (PIPELINE_STATE_CHANGED(blend_color)) {
+    glBlendColor(state.blend_color[0], state.blend_color[1],
+                 state.blend_color[2], state.blend_color[3]);
+  }
+
+  if (PIPELINE_STATE_CHANGED(depth_test_enabled)) {
+    state.depth_test_enabled ? glEnable(GL_DEPTH_TEST)
+                             : glDisable(GL_DEPTH_TEST);
+  }
+  if (PIPELINE_STATE_CHANGED(depth_mask)) {
+    glDepthMask(state.depth_mask);
+  }
+  if (PIPELINE_STATE_CHANGED(depth_func)) {
+    glDepthFunc(state.depth_func);
+  }
+  if (PIPELINE_STATE_CHANGED(stencil_test_enabled)) {
+    state.stencil_test_enabled ? glEnable(GL_STENCIL_TEST)
+                               : glDisable(GL_STENCIL_TEST);
+  }
+  if (PIPELINE_STATE_CHANGED(stencil_write_mask)) {
+    glStencilMask(state.stencil_write_mask);
+  }
+  static const GLenum kStencilFaces[2] = {GL_FRONT, GL_BACK};
+  for (int i = 0; i < 2; ++i) {
+    const auto& stencil = state.stencil[i];
+    if (PIPELINE_STATE_CHANGED(stencil[i].func) ||
+        PIPELINE_STATE_CHANGED(stencil_ref) ||
+        PIPELINE_STATE_CHANGED(stencil_read_mask)) {
+      glStencilFuncSeparate(kStencilFaces[i], stencil.func, state.stencil_ref,
+                            state.stencil_read_mask);
+    }
+    if (PIPELINE_STATE_CHANGED(stencil[i].fail) ||
+        PIPELINE_STATE_CHANGED(stencil[i].zfail) ||
+        PIPELINE_STATE_CHANGED(stencil[i].zpass)) {
+      glStencilOpSeparate(kStencilFaces[i], stencil.fail, stencil.zfail,
+                          stencil.zpass);
+    }
+  }
+
+#undef PIPELINE_STATE_CHANGED
 }
 
 CommandProcessor::UpdateStatus CommandProcessor::PopulateIndexBuffer() {
   auto& regs = *register_file_;
   auto& info = index_buffer_info_;
+  info.min_index = UINT32_MAX;
+  info.max_index = 0;
   if (!info.guest_base) {
-    // No index buffer or auto draw.
+    if (info.conversion == BufferCache::IndexConversion::kNone) {
+      // No index buffer or auto draw.
+      return UpdateStatus::kCompatible;
+    }
+    if (info.count) {
+      info.min_index = 0;
+      info.max_index = info.count - 1;
+    }
+    // Auto draw of a primitive type drawn through generated indices.
+    uint32_t converted_count =
+        BufferCache::GetConvertedIndexCount(info.conversion, info.count);
+    auto allocation =
+        scratch_buffer_.Acquire(converted_count * sizeof(uint16_t));
+    BufferCache::GenerateIndices(
+        info.conversion, info.count,
+        reinterpret_cast<uint16_t*>(allocation.host_ptr));
+    BindIndexBuffer(scratch_buffer_.handle(), allocation.offset);
+    scratch_buffer_.Commit(std::move(allocation));
     return UpdateStatus::kCompatible;
   }
 
@@ -2351,30 +3126,55 @@ CommandProcessor::UpdateStatus CommandProcessor::PopulateIndexBuffer() {
 
   trace_writer_.WriteMemoryRead(info.guest_base, info.length);
 
-  size_t total_size =
-      info.count * (info.format == IndexFormat::kInt32 ? sizeof(uint32_t)
-                                                       : sizeof(uint16_t));
-  CircularBuffer::Allocation allocation;
-  if (!scratch_buffer_.AcquireCached(info.guest_base, total_size,
-                                     &allocation)) {
-    if (info.format == IndexFormat::kInt32) {
-      auto dest = reinterpret_cast<uint32_t*>(allocation.host_ptr);
-      auto src = memory_->TranslatePhysical<const uint32_t*>(info.guest_base);
-      xe::copy_and_swap_32_aligned(dest, src, info.count);
+  uint32_t index_size =
+      info.format == IndexFormat::kInt32 ? sizeof(uint32_t) : sizeof(uint16_t);
+  size_t total_size = info.count * index_size;
+  GLuint buffer = buffer_cache_.handle();
+  size_t offset;
+  if (!buffer_cache_.Demand(info.guest_base, uint32_t(total_size), index_size,
+                            info.conversion, &offset, &info.min_index,
+                            &info.max_index)) {
+    buffer = scratch_buffer_.handle();
+    size_t converted_size =
+        BufferCache::GetConvertedIndexCount(info.conversion, info.count) *
+        index_size;
+    CircularBuffer::Allocation allocation;
+    bool cached;
+    if (info.conversion == BufferCache::IndexConversion::kNone) {
+      cached = scratch_buffer_.AcquireCached(info.guest_base, total_size,
+                                             &allocation);
     } else {
-      auto dest = reinterpret_cast<uint16_t*>(allocation.host_ptr);
-      auto src = memory_->TranslatePhysical<const uint16_t*>(info.guest_base);
-      xe::copy_and_swap_16_aligned(dest, src, info.count);
+      // The cache key can't tell converted data apart from the original.
+      allocation = scratch_buffer_.Acquire(converted_size);
+      cached = false;
+    }
+    if (!cached) {
+      BufferCache::ConvertIndices(
+          info.conversion, index_size,
+          memory_->TranslatePhysical(info.guest_base), info.count,
+          allocation.host_ptr, &info.min_index, &info.max_index);
+      upload_bytes_ += converted_size;
+      offset = allocation.offset;
+      scratch_buffer_.Commit(std::move(allocation));
+    } else {
+      offset = allocation.offset;
     }
-    draw_batcher_.set_index_buffer(allocation);
-    scratch_buffer_.Commit(std::move(allocation));
-  } else {
-    draw_batcher_.set_index_buffer(allocation);
   }
+  BindIndexBuffer(buffer, offset);
 
   return UpdateStatus::kCompatible;
 }
 
+void CommandProcessor::BindIndexBuffer(GLuint buffer, size_t offset) {
+  draw_batcher_.set_index_buffer(offset);
+  if (vertex_array_element_buffer_ != buffer) {
+    // Switching changes the indices of every draw batched so far.
+    draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
+    glVertexArrayElementBuffer(vertex_array_, buffer);
+    vertex_array_element_buffer_ = buffer;
+  }
+}
+
 CommandProcessor::UpdateStatus CommandProcessor::PopulateVertexBuffers() {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
@@ -2383,6 +3183,8 @@ CommandProcessor::UpdateStatus CommandProcessor::PopulateVertexBuffers() {
   auto& regs = *register_file_;
   assert_not_null(active_vertex_shader_);
 
+  GLuint vao = active_vertex_shader_->vao();
+
   const auto& buffer_inputs = active_vertex_shader_->buffer_inputs();
   for (uint32_t buffer_index = 0; buffer_index < buffer_inputs.count;
        ++buffer_index) {
@@ -2401,43 +3203,90 @@ CommandProcessor::UpdateStatus CommandProcessor::PopulateVertexBuffers() {
         fetch = &group->vertex_fetch_2;
         break;
     }
+    // Shaders byte swap the data as they fetch it.
     assert_true(fetch->endian == 2);
 
     size_t valid_range = size_t(fetch->size * 4);
+    GLsizei stride = desc.stride_words * 4;
 
     trace_writer_.WriteMemoryRead(fetch->address << 2, valid_range);
 
-    CircularBuffer::Allocation allocation;
-    if (!scratch_buffer_.AcquireCached(fetch->address << 2, valid_range,
-                                       &allocation)) {
-      // Copy and byte swap the entire buffer.
-      // We could be smart about this to save GPU bandwidth by building a CRC
-      // as we copy and only if it differs from the previous value committing
-      // it (and if it matches just discard and reuse).
-      xe::copy_and_swap_32_aligned(
-          reinterpret_cast<uint32_t*>(allocation.host_ptr),
-          memory_->TranslatePhysical<const uint32_t*>(fetch->address << 2),
-          valid_range / 4);
-
-      // TODO(benvanik): if we could find a way to avoid this, we could use
-      // multidraw without flushing.
-      glVertexArrayVertexBuffer(active_vertex_shader_->vao(), buffer_index,
-                                scratch_buffer_.handle(), allocation.offset,
-                                desc.stride_words * 4);
+    GLuint buffer = buffer_cache_.handle();
+    size_t buffer_offset;
+    if (guest_memory_buffer_) {
+      // Shaders take vertex data as laid out in guest memory, so it can be
+      // read in place.
+      buffer = guest_memory_buffer_;
+      buffer_offset = (fetch->address << 2) & 0x1FFFFFFF;
+    } else if (!buffer_cache_.Demand(
+                   fetch->address << 2, uint32_t(valid_range), 1,
+                   BufferCache::IndexConversion::kNone, &buffer_offset)) {
+      // Changing every frame; stream it. Indexed draws only need the
+      // vertices they reference.
+      buffer = scratch_buffer_.handle();
+      auto& info = index_buffer_info_;
+      size_t range_start = 0;
+      size_t range_end = valid_range;
+      if (FLAGS_vertex_upload_index_range && stride &&
+          info.min_index <= info.max_index &&
+          (size_t(info.max_index) + 1) * stride <= valid_range) {
+        range_start = size_t(info.min_index) * stride;
+        range_end = (size_t(info.max_index) + 1) * stride;
+      }
+      buffer_offset =
+          StreamVertexData(fetch->address << 2, range_start, range_end);
+    }
 
-      scratch_buffer_.Commit(std::move(allocation));
-    } else {
-      // TODO(benvanik): if we could find a way to avoid this, we could use
-      // multidraw without flushing.
-      glVertexArrayVertexBuffer(active_vertex_shader_->vao(), buffer_index,
-                                scratch_buffer_.handle(), allocation.offset,
-                                desc.stride_words * 4);
+    // With a single stream the offset can usually be expressed in whole
+    // vertices, leaving the binding (and the batch) untouched.
+    GLintptr offset = GLintptr(buffer_offset);
+    if (buffer_inputs.count == 1 && stride && offset % stride == 0) {
+      draw_batcher_.set_vertex_offset(uint32_t(offset / stride));
+      offset = 0;
+    }
+    auto& binding = vertex_buffer_bindings_[buffer_index];
+    if (binding.buffer != buffer || binding.offset != offset ||
+        binding.stride != stride) {
+      // Rebinding changes the vertices of every draw batched so far.
+      draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
+      glVertexArrayVertexBuffer(vao, buffer_index, buffer, offset, stride);
+      binding.buffer = buffer;
+      binding.offset = offset;
+      binding.stride = stride;
     }
   }
 
   return UpdateStatus::kCompatible;
 }
 
+size_t CommandProcessor::StreamVertexData(uint32_t guest_address,
+                                          size_t range_start,
+                                          size_t range_end) {
+  // The binding starts range_start bytes before the allocation, which must
+  // not be before the start of the buffer.
+  CircularBuffer::Allocation allocation;
+  bool cached = scratch_buffer_.AcquireCached(
+      guest_address + uint32_t(range_start), range_end - range_start,
+      &allocation);
+  if (allocation.offset < range_start) {
+    if (!cached) {
+      scratch_buffer_.Discard(std::move(allocation));
+    }
+    range_start = 0;
+    cached = scratch_buffer_.AcquireCached(guest_address, range_end,
+                                           &allocation);
+  }
+  size_t buffer_offset = allocation.offset - range_start;
+  if (!cached) {
+    uint32_t range_address = guest_address + uint32_t(range_start);
+    std::memcpy(allocation.host_ptr, memory_->TranslatePhysical(range_address),
+                range_end - range_start);
+    upload_bytes_ += range_end - range_start;
+    scratch_buffer_.Commit(std::move(allocation));
+  }
+  return buffer_offset;
+}
+
 CommandProcessor::UpdateStatus CommandProcessor::PopulateSamplers() {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
@@ -2445,19 +3294,10 @@ CommandProcessor::UpdateStatus CommandProcessor::PopulateSamplers() {
 
   bool mismatch = false;
 
-  // VS and PS samplers are shared, but may be used exclusively.
-  // We walk each and setup lazily.
-  bool has_setup_sampler[32] = {false};
-
-  // Vertex texture samplers.
-  const auto& vertex_sampler_inputs = active_vertex_shader_->sampler_inputs();
-  for (size_t i = 0; i < vertex_sampler_inputs.count; ++i) {
-    const auto& desc = vertex_sampler_inputs.descs[i];
-    if (has_setup_sampler[desc.fetch_slot]) {
-      continue;
-    }
-    has_setup_sampler[desc.fetch_slot] = true;
-    auto status = PopulateSampler(desc);
+  // Textures are fetched through bindless handles in the draw header, so this
+  // binds nothing; it only picks the handle for each slot in use.
+  for (auto desc : active_sampler_descs_) {
+    auto status = PopulateSampler(*desc);
     if (status == UpdateStatus::kError) {
       return status;
     } else if (status == UpdateStatus::kMismatch) {
@@ -2465,22 +3305,6 @@ CommandProcessor::UpdateStatus CommandProcessor::PopulateSamplers() {
     }
   }
 
-  // Pixel shader texture sampler.
-  const auto& pixel_sampler_inputs = active_pixel_shader_->sampler_inputs();
-  for (size_t i = 0; i < pixel_sampler_inputs.count; ++i) {
-    const auto& desc = pixel_sampler_inputs.descs[i];
-    if (has_setup_sampler[desc.fetch_slot]) {
-      continue;
-    }
-    has_setup_sampler[desc.fetch_slot] = true;
-    auto status = PopulateSampler(desc);
-    if (status == UpdateStatus::kError) {
-      return UpdateStatus::kError;
-    } else if (status == UpdateStatus::kMismatch) {
-      mismatch = true;
-    }
-  }
-
   return mismatch ? UpdateStatus::kMismatch : UpdateStatus::kCompatible;
 }
 
@@ -2505,6 +3329,19 @@ CommandProcessor::UpdateStatus CommandProcessor::PopulateSampler(
   }
   assert_true(fetch.type == 0x2);
 
+  // Fast path: same constants as last time and the guest hasn't written to
+  // the texture (the write watch would have flagged it).
+  auto entry_view =
+      texture_cache_.LookupFetchSlot(desc.fetch_slot, fetch, desc.tex_fetch);
+  if (entry_view) {
+    const auto& texture_info = entry_view->texture->texture_info;
+    trace_writer_.WriteMemoryRead(texture_info.guest_address,
+                                  texture_info.input_length);
+    draw_batcher_.set_texture_sampler(desc.fetch_slot,
+                                      entry_view->texture_sampler_handle);
+    return UpdateStatus::kCompatible;
+  }
+
   TextureInfo texture_info;
   if (!TextureInfo::Prepare(fetch, &texture_info)) {
     XELOGE("Unable to parse texture fetcher info");
@@ -2519,12 +3356,16 @@ CommandProcessor::UpdateStatus CommandProcessor::PopulateSampler(
   trace_writer_.WriteMemoryRead(texture_info.guest_address,
                                 texture_info.input_length);
 
-  auto entry_view = texture_cache_.Demand(texture_info, sampler_info);
+  // The texture may be (re)uploaded, which must not affect batched draws.
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kStateChange);
+  entry_view = texture_cache_.Demand(texture_info, sampler_info);
   if (!entry_view) {
     // Unable to create/fetch/etc.
     XELOGE("Failed to demand texture");
     return UpdateStatus::kCompatible;
   }
+  texture_cache_.UpdateFetchSlot(desc.fetch_slot, fetch, desc.tex_fetch,
+                                 entry_view);
 
   // Shaders will use bindless to fetch right from it.
   draw_batcher_.set_texture_sampler(desc.fetch_slot,
@@ -2537,6 +3378,12 @@ bool CommandProcessor::IssueCopy() {
   SCOPE_profile_cpu_f("gpu");
   auto& regs = *register_file_;
 
+  // Resolves read what the batched draws render.
+  draw_batcher_.Flush(DrawBatcher::FlushMode::kMakeCoherent);
+  // Resolves end guest render passes, so on the GPU timeline they separate
+  // the batches of each pass.
+  SCOPE_profile_gpu_i("gpu-gl4", "xe::gpu::gl4::CommandProcessor::IssueCopy");
+
   // This is used to resolve surfaces, taking them from EDRAM render targets
   // to system memory. It can optionally clear color/depth surfaces, too.
   // The command buffer has stuff for actually doing this by drawing, however
@@ -2589,6 +3436,7 @@ bool CommandProcessor::IssueCopy() {
   TextureFormat src_format = TextureFormat::kUnknown;
   GLuint color_targets[4] = {kAnyTarget, kAnyTarget, kAnyTarget, kAnyTarget};
   GLuint depth_target = kAnyTarget;
+  CachedRenderTarget* source_target = nullptr;
   if (copy_src_select <= 3) {
     // Source from a color target.
     uint32_t color_info[4] = {
@@ -2599,8 +3447,9 @@ bool CommandProcessor::IssueCopy() {
     uint32_t color_base = color_info[copy_src_select] & 0xFFF;
     auto color_format = static_cast<ColorRenderTargetFormat>(
         (color_info[copy_src_select] >> 16) & 0xF);
-    color_targets[copy_src_select] = GetColorRenderTarget(
-        surface_pitch, surface_msaa, color_base, color_format);
+    auto color_target = GetCachedColorRenderTarget(color_base, color_format);
+    color_targets[copy_src_select] = color_target ? color_target->texture : 0;
+    source_target = color_target;
     src_format = ColorRenderTargetToTextureFormat(color_format);
   } else {
     // Source from depth/stencil.
@@ -2608,8 +3457,10 @@ bool CommandProcessor::IssueCopy() {
     uint32_t depth_base = depth_info & 0xFFF;
     auto depth_format =
         static_cast<DepthRenderTargetFormat>((depth_info >> 16) & 0x1);
-    depth_target = GetDepthRenderTarget(surface_pitch, surface_msaa, depth_base,
-                                        depth_format);
+    auto cached_depth_target =
+        GetCachedDepthRenderTarget(depth_base, depth_format);
+    depth_target = cached_depth_target ? cached_depth_target->texture : 0;
+    source_target = cached_depth_target;
     src_format = DepthRenderTargetToTextureFormat(depth_format);
   }
   auto source_framebuffer = GetFramebuffer(color_targets, depth_target);
@@ -2783,7 +3634,9 @@ bool CommandProcessor::IssueCopy() {
       GpuSwap(xe::load<float>(vertex_addr + 20), Endian(fetch->endian)))));
   Rect2D dest_rect(dest_min_x, dest_min_y, dest_max_x - dest_min_x,
                    dest_max_y - dest_min_y);
-  Rect2D src_rect(0, 0, dest_rect.width, dest_rect.height);
+  // The source is in render target pixels, the destination in guest ones.
+  Rect2D src_rect(0, 0, dest_rect.width * resolution_scale_,
+                  dest_rect.height * resolution_scale_);
 
   // The dest base address passed in has already been offset by the window
   // offset, so to ensure texture lookup works we need to offset it.
@@ -2800,7 +3653,18 @@ bool CommandProcessor::IssueCopy() {
 
   auto blitter = static_cast<xe::ui::gl::GLContext*>(context_.get())->blitter();
 
-  // Make active so glReadPixels reads from us.
+  // Lets the texture cache skip resolves of EDRAM that hasn't changed since
+  // the last time it was resolved to the same place.
+  uint64_t source_version =
+      source_target ? GetRenderTargetVersion(source_target) : 0;
+
+  // Both commands leave the result in a texture in the cache, which is also
+  // what gets read back.
+  GLuint dest_texture = 0;
+  uint32_t dest_texture_scale = 1;
+  TextureFormat dest_format = copy_src_select <= 3
+                                  ? ColorFormatToTextureFormat(copy_dest_format)
+                                  : src_format;
   switch (copy_command) {
     case CopyCommand::kRaw: {
       // This performs a byte-for-byte copy of the textures from src to dest
@@ -2808,25 +3672,21 @@ bool CommandProcessor::IssueCopy() {
       if (copy_src_select <= 3) {
         // Source from a bound render target.
         // TODO(benvanik): RAW copy.
-        last_framebuffer_texture_ = texture_cache_.CopyTexture(
+        dest_texture = texture_cache_.CopyTexture(
             blitter, copy_dest_base, dest_logical_width, dest_logical_height,
-            dest_block_width, dest_block_height,
-            ColorFormatToTextureFormat(copy_dest_format),
+            dest_block_width, dest_block_height, dest_format,
             copy_dest_swap ? true : false, color_targets[copy_src_select],
-            src_rect, dest_rect);
-        if (!FLAGS_disable_framebuffer_readback) {
-          // glReadPixels(x, y, w, h, read_format, read_type, ptr);
-        }
+            src_rect, dest_rect, source_version, &dest_texture_scale);
+        last_framebuffer_texture_ = dest_texture;
+        last_framebuffer_texture_scale_ = dest_texture_scale;
       } else {
         // Source from the bound depth/stencil target.
         // TODO(benvanik): RAW copy.
-        texture_cache_.CopyTexture(
+        dest_texture = texture_cache_.CopyTexture(
             blitter, copy_dest_base, dest_logical_width, dest_logical_height,
-            dest_block_width, dest_block_height, src_format,
-            copy_dest_swap ? true : false, depth_target, src_rect, dest_rect);
-        if (!FLAGS_disable_framebuffer_readback) {
-          // glReadPixels(x, y, w, h, GL_DEPTH_STENCIL, read_type, ptr);
-        }
+            dest_block_width, dest_block_height, dest_format,
+            copy_dest_swap ? true : false, depth_target, src_rect, dest_rect,
+            source_version, &dest_texture_scale);
       }
       break;
     }
@@ -2835,24 +3695,20 @@ bool CommandProcessor::IssueCopy() {
         // Source from a bound render target.
         // Either copy the readbuffer into an existing texture or create a new
         // one in the cache so we can service future upload requests.
-        last_framebuffer_texture_ = texture_cache_.ConvertTexture(
+        dest_texture = texture_cache_.ConvertTexture(
             blitter, copy_dest_base, dest_logical_width, dest_logical_height,
-            dest_block_width, dest_block_height,
-            ColorFormatToTextureFormat(copy_dest_format),
+            dest_block_width, dest_block_height, dest_format,
             copy_dest_swap ? true : false, color_targets[copy_src_select],
-            src_rect, dest_rect);
-        if (!FLAGS_disable_framebuffer_readback) {
-          // glReadPixels(x, y, w, h, read_format, read_type, ptr);
-        }
+            src_rect, dest_rect, source_version, &dest_texture_scale);
+        last_framebuffer_texture_ = dest_texture;
+        last_framebuffer_texture_scale_ = dest_texture_scale;
       } else {
         // Source from the bound depth/stencil target.
-        texture_cache_.ConvertTexture(
+        dest_texture = texture_cache_.ConvertTexture(
             blitter, copy_dest_base, dest_logical_width, dest_logical_height,
-            dest_block_width, dest_block_height, src_format,
-            copy_dest_swap ? true : false, depth_target, src_rect, dest_rect);
-        if (!FLAGS_disable_framebuffer_readback) {
-          // glReadPixels(x, y, w, h, GL_DEPTH_STENCIL, read_type, ptr);
-        }
+            dest_block_width, dest_block_height, dest_format,
+            copy_dest_swap ? true : false, depth_target, src_rect, dest_rect,
+            source_version, &dest_texture_scale);
       }
       break;
     }
@@ -2863,6 +3719,23 @@ bool CommandProcessor::IssueCopy() {
       return false;
   }
 
+  // Write the result back to guest memory for titles that read it on the
+  // CPU. This is deferred until they actually touch it.
+  GLenum readback_format;
+  GLenum readback_type;
+  if (!FLAGS_disable_framebuffer_readback && dest_texture &&
+      TextureCache::GetReadbackFormat(dest_format, &readback_format,
+                                      &readback_type)) {
+    uint32_t bytes_per_pixel =
+        FormatInfo::Get(uint32_t(dest_format))->bits_per_pixel / 8;
+    readback_cache_.Enqueue(
+        blitter, dest_texture, dest_texture_scale, readback_format,
+        readback_type, bytes_per_pixel, dest_rect,
+        copy_dest_base +
+            (dest_rect.y * copy_dest_pitch + dest_rect.x) * bytes_per_pixel,
+        copy_dest_pitch * bytes_per_pixel);
+  }
+
   // Perform any requested clears.
   uint32_t copy_depth_clear = regs[XE_GPU_REG_RB_DEPTH_CLEAR].u32;
   uint32_t copy_color_clear = regs[XE_GPU_REG_RB_COLOR_CLEAR].u32;
@@ -2885,6 +3758,9 @@ bool CommandProcessor::IssueCopy() {
                               copy_src_select, color);
     glColorMaski(copy_src_select, old_color_mask[0], old_color_mask[1],
                  old_color_mask[2], old_color_mask[3]);
+    if (source_target) {
+      MarkRenderTargetWritten(source_target, 0);
+    }
   }
 
   // TODO(benvanik): figure out real condition here (maybe when color cleared?)
@@ -2913,6 +3789,9 @@ bool CommandProcessor::IssueCopy() {
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, old_draw_framebuffer);
     glDepthMask(old_depth_mask);
     glStencilMask(old_stencil_mask);
+    if (source_target) {
+      MarkRenderTargetWritten(source_target, 0);
+    }
   }
 
   return true;
@@ -2922,29 +3801,63 @@ GLuint CommandProcessor::GetColorRenderTarget(uint32_t pitch,
                                               MsaaSamples samples,
                                               uint32_t base,
                                               ColorRenderTargetFormat format) {
+  auto cached = GetCachedColorRenderTarget(base, format);
+  return cached ? cached->texture : 0;
+}
+
+GLuint CommandProcessor::GetDepthRenderTarget(uint32_t pitch,
+                                              MsaaSamples samples,
+                                              uint32_t base,
+                                              DepthRenderTargetFormat format) {
+  auto cached = GetCachedDepthRenderTarget(base, format);
+  return cached ? cached->texture : 0;
+}
+
+// Creates the texture for a render target. If another target already owns
+// storage at the same base, the new one is a view of it so that the guest
+// reinterpreting EDRAM as another format of the same size sees the same data.
+static GLuint CreateRenderTargetTexture(GLuint alias_texture,
+                                        GLenum internal_format,
+                                        uint32_t width, uint32_t height) {
+  GLuint texture;
+  if (alias_texture) {
+    // Views require a name that has never been bound.
+    glGenTextures(1, &texture);
+    glTextureView(texture, GL_TEXTURE_2D, alias_texture, internal_format, 0, 1,
+                  0, 1);
+  } else {
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, 1, internal_format, width, height);
+  }
+  return texture;
+}
+
+CommandProcessor::CachedColorRenderTarget*
+CommandProcessor::GetCachedColorRenderTarget(uint32_t base,
+                                             ColorRenderTargetFormat format) {
   // Because we don't know the height of anything, we allocate at full res.
   // At 2560x2560, it's impossible for EDRAM to fit anymore.
-  uint32_t width = 2560;
-  uint32_t height = 2560;
+  uint32_t width = 2560 * resolution_scale_;
+  uint32_t height = 2560 * resolution_scale_;
 
   // NOTE: we strip gamma formats down to normal ones.
   if (format == ColorRenderTargetFormat::k_8_8_8_8_GAMMA) {
     format = ColorRenderTargetFormat::k_8_8_8_8;
   }
 
-  for (auto it = cached_color_render_targets_.begin();
-       it != cached_color_render_targets_.end(); ++it) {
-    if (it->base == base && it->width == width && it->height == height &&
-        it->format == format) {
-      return it->texture;
+  GLuint alias_texture = 0;
+  for (auto& it : cached_color_render_targets_) {
+    if (it->base != base) {
+      continue;
+    }
+    if (it->format == format) {
+      return it.get();
+    }
+    if (!alias_texture && IsColorRenderTargetFormat64bpp(it->format) ==
+                              IsColorRenderTargetFormat64bpp(format)) {
+      alias_texture = it->texture;
     }
   }
-  cached_color_render_targets_.push_back(CachedColorRenderTarget());
-  auto cached = &cached_color_render_targets_.back();
-  cached->base = base;
-  cached->width = width;
-  cached->height = height;
-  cached->format = format;
 
   GLenum internal_format;
   switch (format) {
@@ -2980,35 +3893,41 @@ GLuint CommandProcessor::GetColorRenderTarget(uint32_t pitch,
       break;
     default:
       assert_unhandled_case(format);
-      return 0;
+      return nullptr;
   }
 
-  glCreateTextures(GL_TEXTURE_2D, 1, &cached->texture);
-  glTextureStorage2D(cached->texture, 1, internal_format, width, height);
-
-  return cached->texture;
-}
-
-GLuint CommandProcessor::GetDepthRenderTarget(uint32_t pitch,
-                                              MsaaSamples samples,
-                                              uint32_t base,
-                                              DepthRenderTargetFormat format) {
-  uint32_t width = 2560;
-  uint32_t height = 2560;
-
-  for (auto it = cached_depth_render_targets_.begin();
-       it != cached_depth_render_targets_.end(); ++it) {
-    if (it->base == base && it->width == width && it->height == height &&
-        it->format == format) {
-      return it->texture;
-    }
-  }
-  cached_depth_render_targets_.push_back(CachedDepthRenderTarget());
-  auto cached = &cached_depth_render_targets_.back();
+  auto cached = std::make_unique<CachedColorRenderTarget>();
   cached->base = base;
   cached->width = width;
   cached->height = height;
   cached->format = format;
+  cached->texture =
+      CreateRenderTargetTexture(alias_texture, internal_format, width, height);
+  cached->edram_tile_end = base;
+  cached->last_write = 0;
+  cached_color_render_targets_.push_back(std::move(cached));
+  return cached_color_render_targets_.back().get();
+}
+
+CommandProcessor::CachedDepthRenderTarget*
+CommandProcessor::GetCachedDepthRenderTarget(uint32_t base,
+                                             DepthRenderTargetFormat format) {
+  uint32_t width = 2560 * resolution_scale_;
+  uint32_t height = 2560 * resolution_scale_;
+
+  GLuint alias_texture = 0;
+  for (auto& it : cached_depth_render_targets_) {
+    if (it->base != base) {
+      continue;
+    }
+    if (it->format == format) {
+      return it.get();
+    }
+    // Both formats are stored as D24S8.
+    if (!alias_texture) {
+      alias_texture = it->texture;
+    }
+  }
 
   GLenum internal_format;
   switch (format) {
@@ -3021,13 +3940,67 @@ GLuint CommandProcessor::GetDepthRenderTarget(uint32_t pitch,
       break;
     default:
       assert_unhandled_case(format);
-      return 0;
+      return nullptr;
   }
 
-  glCreateTextures(GL_TEXTURE_2D, 1, &cached->texture);
-  glTextureStorage2D(cached->texture, 1, internal_format, width, height);
+  auto cached = std::make_unique<CachedDepthRenderTarget>();
+  cached->base = base;
+  cached->width = width;
+  cached->height = height;
+  cached->format = format;
+  cached->texture =
+      CreateRenderTargetTexture(alias_texture, internal_format, width, height);
+  cached->edram_tile_end = base;
+  cached->last_write = 0;
+  cached_depth_render_targets_.push_back(std::move(cached));
+  return cached_depth_render_targets_.back().get();
+}
 
-  return cached->texture;
+void CommandProcessor::MarkRenderTargetsWritten() {
+  // Draws can't reach past the bottom of the window scissor.
+  auto& regs = *register_file_;
+  uint32_t scissor_bottom =
+      (regs[XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR].u32 >> 16) & 0x7FFF;
+  uint32_t tile_rows = xe::round_up(
+                           scissor_bottom * active_render_target_samples_y_,
+                           kEdramTileHeight) /
+                       kEdramTileHeight;
+  for (int i = 0; i < xe::countof(active_render_targets_); ++i) {
+    if (active_render_targets_[i]) {
+      MarkRenderTargetWritten(active_render_targets_[i],
+                              active_render_target_row_tiles_[i] * tile_rows);
+    }
+  }
+}
+
+void CommandProcessor::MarkRenderTargetWritten(CachedRenderTarget* target,
+                                               uint32_t tile_count) {
+  target->edram_tile_end =
+      std::max(target->edram_tile_end,
+               std::min(target->base + tile_count, kEdramTileCount));
+  target->last_write = ++edram_write_count_;
+}
+
+uint64_t CommandProcessor::GetRenderTargetVersion(
+    const CachedRenderTarget* target) {
+  // A target that was never drawn to still covers at least its base tile.
+  uint32_t begin = target->base;
+  uint32_t end = std::max(target->edram_tile_end, begin + 1);
+  uint64_t version = target->last_write;
+  auto overlaps = [begin, end](const CachedRenderTarget* other) {
+    return other->base < end && begin < other->edram_tile_end;
+  };
+  for (auto& it : cached_color_render_targets_) {
+    if (overlaps(it.get())) {
+      version = std::max(version, it->last_write);
+    }
+  }
+  for (auto& it : cached_depth_render_targets_) {
+    if (overlaps(it.get())) {
+      version = std::max(version, it->last_write);
+    }
+  }
+  return version;
 }
 
 CommandProcessor::CachedFramebuffer* CommandProcessor::GetFramebuffer(
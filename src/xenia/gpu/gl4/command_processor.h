@@ -11,18 +11,24 @@
 #define XENIA_GPU_GL4_COMMAND_PROCESSOR_H_
 
 #include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "xenia/base/threading.h"
+#include "xenia/gpu/gl4/buffer_cache.h"
 #include "xenia/gpu/gl4/draw_batcher.h"
 #include "xenia/gpu/gl4/gl4_shader.h"
+#include "xenia/gpu/gl4/gl4_shader_cache_file.h"
 #include "xenia/gpu/gl4/gl4_shader_translator.h"
+#include "xenia/gpu/gl4/readback_cache.h"
 #include "xenia/gpu/gl4/texture_cache.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/tracing.h"
@@ -31,6 +37,7 @@
 #include "xenia/memory.h"
 #include "xenia/ui/gl/circular_buffer.h"
 #include "xenia/ui/gl/gl_context.h"
+#include "xenia/ui/gl/gpu_timer.h"
 
 namespace xe {
 namespace kernel {
@@ -44,20 +51,6 @@ namespace gl4 {
 
 class GL4GraphicsSystem;
 
-struct SwapState {
-  // Lock must be held when changing data in this structure.
-  xe::mutex mutex;
-  // Dimensions of the framebuffer textures. Should match window size.
-  uint32_t width = 0;
-  uint32_t height = 0;
-  // Current front buffer, being drawn to the screen.
-  GLuint front_buffer_texture = 0;
-  // Current back buffer, being updated by the CP.
-  GLuint back_buffer_texture = 0;
-  // Whether the back buffer is dirty and a swap is pending.
-  bool pending = false;
-};
-
 enum class SwapMode {
   kNormal,
   kIgnored,
@@ -77,15 +70,10 @@ class CommandProcessor {
 
   void ClearCaches();
 
-  SwapState& swap_state() { return swap_state_; }
   void set_swap_mode(SwapMode swap_mode) { swap_mode_ = swap_mode; }
   void IssueSwap(uint32_t frontbuffer_ptr, uint32_t frontbuffer_width,
                  uint32_t frontbuffer_height);
 
-  void set_swap_request_handler(std::function<void()> fn) {
-    swap_request_handler_ = fn;
-  }
-
   void RequestFrameTrace(const std::wstring& root_path);
   void BeginTracing(const std::wstring& root_path);
   void EndTracing();
@@ -94,9 +82,24 @@ class CommandProcessor {
   void EnableReadPointerWriteBack(uint32_t ptr, uint32_t block_size);
 
   void UpdateWritePointer(uint32_t value);
+  // Called after the CPU writes a register, to wake a WAIT_REG_MEM on it.
+  void NotifyRegisterWritten(uint32_t index);
 
   void ExecutePacket(uint32_t ptr, uint32_t count);
 
+  // Running totals for benchmarking. Read from the worker thread (e.g. with
+  // CallInThread) and diff snapshots to measure a span of work.
+  struct Stats {
+    uint64_t draw_count;
+    // Index and vertex data converted for upload.
+    uint64_t upload_bytes;
+    // Host ticks spent translating and compiling shaders, on any thread.
+    uint64_t shader_compile_ticks;
+    // Host ticks the worker spent waiting for commands.
+    uint64_t stall_ticks;
+  };
+  Stats stats() const;
+
   // HACK: for debugging; would be good to have this in a base type.
   TextureCache* texture_cache() { return &texture_cache_; }
   GL4Shader* active_vertex_shader() const { return active_vertex_shader_; }
@@ -112,10 +115,24 @@ class CommandProcessor {
  private:
   class RingbufferReader;
 
+  // Groups of registers consumed by one Update*State call. WriteRegister
+  // marks the groups of each register written so that draws only look at
+  // groups that may have changed.
+  enum DirtyStateGroup : uint8_t {
+    kDirtyRenderTargets = 1 << 0,
+    kDirtyViewport = 1 << 1,
+    kDirtyRasterizer = 1 << 2,
+    kDirtyBlend = 1 << 3,
+    kDirtyDepthStencil = 1 << 4,
+    kDirtyAll = 0xFF,
+  };
+
   enum class UpdateStatus {
     kCompatible,
     kMismatch,
     kError,
+    // Shaders are still compiling asynchronously; the draw should be skipped.
+    kPending,
   };
 
   struct CachedFramebuffer {
@@ -123,19 +140,25 @@ class CommandProcessor {
     GLuint depth_target;
     GLuint framebuffer;
   };
-  struct CachedColorRenderTarget {
+  // EDRAM is modeled as a range of tiles per render target, starting at its
+  // base tile and growing as draws reach further down the surface. Targets
+  // whose ranges overlap alias the same EDRAM, so a resolve has to consider
+  // writes made through any of them.
+  struct CachedRenderTarget {
     uint32_t base;
     uint32_t width;
     uint32_t height;
-    xenos::ColorRenderTargetFormat format;
     GLuint texture;
+    // One past the last EDRAM tile written through this target.
+    uint32_t edram_tile_end;
+    // Value of edram_write_count_ at the last write through this target.
+    uint64_t last_write;
   };
-  struct CachedDepthRenderTarget {
-    uint32_t base;
-    uint32_t width;
-    uint32_t height;
+  struct CachedColorRenderTarget : CachedRenderTarget {
+    xenos::ColorRenderTargetFormat format;
+  };
+  struct CachedDepthRenderTarget : CachedRenderTarget {
     xenos::DepthRenderTargetFormat format;
-    GLuint texture;
   };
   struct CachedPipeline {
     CachedPipeline();
@@ -146,18 +169,72 @@ class CommandProcessor {
       GLuint default_pipeline;
       GLuint point_list_pipeline;
       GLuint rect_list_pipeline;
-      GLuint quad_list_pipeline;
-      GLuint line_quad_list_pipeline;
       // TODO(benvanik): others with geometry shaders.
     } handles;
   };
 
+  // Raster, blend and depth/stencil registers of a draw.
+  struct PipelineStateKey {
+    uint32_t pa_su_sc_mode_cntl;
+    uint32_t pa_sc_screen_scissor_tl;
+    uint32_t pa_sc_screen_scissor_br;
+    uint32_t multi_prim_ib_reset_index;
+    uint32_t rb_blendcontrol[4];
+    uint32_t rb_blend_rgba[4];
+    uint32_t rb_depthcontrol;
+    uint32_t rb_stencilrefmask;
+    bool operator==(const PipelineStateKey& other) const {
+      return std::memcmp(this, &other, sizeof(*this)) == 0;
+    }
+  };
+  // GL fixed function state decoded from a PipelineStateKey. Shaders are
+  // bound through CachedPipeline, as GL binds program pipelines separately.
+  struct CachedPipelineState {
+    PipelineStateKey key;
+    bool cull_enabled;
+    GLenum cull_face;
+    GLenum front_face;
+    GLenum polygon_mode;
+    GLenum provoking_vertex;
+    bool primitive_restart_enabled;
+    GLuint primitive_restart_index;
+    struct {
+      bool enabled;
+      GLenum op;
+      GLenum op_alpha;
+      GLenum src;
+      GLenum dest;
+      GLenum src_alpha;
+      GLenum dest_alpha;
+    } blend[4];
+    float blend_color[4];
+    bool depth_test_enabled;
+    GLboolean depth_mask;
+    GLenum depth_func;
+    bool stencil_test_enabled;
+    GLuint stencil_write_mask;
+    GLint stencil_ref;
+    GLuint stencil_read_mask;
+    // Front, then back.
+    struct {
+      GLenum func;
+      GLenum fail;
+      GLenum zfail;
+      GLenum zpass;
+    } stencil[2];
+  };
+
   void WorkerThreadMain();
   bool SetupGL();
   void ShutdownGL();
-  GLuint CreateGeometryProgram(const std::string& source);
+  GLuint CreateProgram(GLenum shader_type, const std::string& source);
 
   void WriteRegister(uint32_t index, uint32_t value);
+  // Writes count consecutive registers from big-endian guest values.
+  void WriteRegisterRange(uint32_t index, const uint32_t* guest_values,
+                          uint32_t count);
+  void WriteRegisterRange(RingbufferReader* reader, uint32_t index,
+                          uint32_t count);
   void MakeCoherent();
   void PrepareForWait();
   void ReturnFromWait();
@@ -191,6 +268,8 @@ class CommandProcessor {
                                           uint32_t packet, uint32_t count);
   bool ExecutePacketType3_EVENT_WRITE_EXT(RingbufferReader* reader,
                                           uint32_t packet, uint32_t count);
+  bool ExecutePacketType3_EVENT_WRITE_ZPD(RingbufferReader* reader,
+                                          uint32_t packet, uint32_t count);
   bool ExecutePacketType3_DRAW_INDX(RingbufferReader* reader, uint32_t packet,
                                     uint32_t count);
   bool ExecutePacketType3_DRAW_INDX_2(RingbufferReader* reader, uint32_t packet,
@@ -211,25 +290,62 @@ class CommandProcessor {
   bool ExecutePacketType3_INVALIDATE_STATE(RingbufferReader* reader,
                                            uint32_t packet, uint32_t count);
 
+  void CommandDecodeThreadMain();
+  void DecodePrimaryBuffer(uint32_t start_index, uint32_t end_index);
+  bool DecodeIndirectBuffer(uint32_t ptr, uint32_t length);
+  // Returns false after a packet the worker has to execute before anything
+  // behind it may be decoded.
+  bool DecodePacket(RingbufferReader* reader);
+  // Pops the hash the decode thread computed for this shader load, if any.
+  bool TakeDecodedShaderHash(ShaderType shader_type, uint32_t guest_address,
+                             uint32_t dword_count, uint64_t* out_hash);
+
   bool LoadShader(ShaderType shader_type, uint32_t guest_address,
                   const uint32_t* host_address, uint32_t dword_count);
 
+  // Opens the draw in the batcher as the primitive type it is drawn with on
+  // the host, picking the index conversion it needs.
+  bool BeginDraw(PrimitiveType prim_type, uint32_t index_count);
   bool IssueDraw();
+  UpdateStatus PrepareShader(GL4Shader* shader,
+                             const xenos::xe_gpu_program_cntl_t& program_cntl);
+  void ShaderCompileThreadMain();
+  void ShaderAnalysisThreadMain();
   UpdateStatus UpdateShaders(PrimitiveType prim_type);
   UpdateStatus UpdateRenderTargets();
   UpdateStatus UpdateState();
   UpdateStatus UpdateViewportState();
-  UpdateStatus UpdateRasterizerState();
-  UpdateStatus UpdateBlendState();
-  UpdateStatus UpdateDepthStencilState();
+  UpdateStatus UpdatePipelineState();
+  static void DecodePipelineState(CachedPipelineState* state);
+  // Issues the GL calls for the fields of state that differ from previous,
+  // or all of them if there is no previous state.
+  void ApplyPipelineState(const CachedPipelineState& state,
+                          const CachedPipelineState* previous);
   UpdateStatus PopulateIndexBuffer();
+  void BindIndexBuffer(GLuint buffer, size_t offset);
   UpdateStatus PopulateVertexBuffers();
+  // Streams [range_start, range_end) of the vertex data at guest_address and
+  // returns the offset in the scratch buffer the data at guest_address would
+  // be at.
+  size_t StreamVertexData(uint32_t guest_address, size_t range_start,
+                          size_t range_end);
   UpdateStatus PopulateSamplers();
   UpdateStatus PopulateSampler(const Shader::SamplerDesc& desc);
   bool IssueCopy();
 
   CachedFramebuffer* GetFramebuffer(GLuint color_targets[4],
                                     GLuint depth_target);
+  CachedColorRenderTarget* GetCachedColorRenderTarget(
+      uint32_t base, xenos::ColorRenderTargetFormat format);
+  CachedDepthRenderTarget* GetCachedDepthRenderTarget(
+      uint32_t base, xenos::DepthRenderTargetFormat format);
+  // Records a draw into the active render targets.
+  void MarkRenderTargetsWritten();
+  void MarkRenderTargetWritten(CachedRenderTarget* target,
+                               uint32_t tile_count);
+  // Returns a value that changes whenever EDRAM covered by the target is
+  // written, through it or any aliasing target.
+  uint64_t GetRenderTargetVersion(const CachedRenderTarget* target);
 
   Memory* memory_;
   GL4GraphicsSystem* graphics_system_;
@@ -248,56 +364,165 @@ class CommandProcessor {
   kernel::object_ref<kernel::XHostThread> worker_thread_;
 
   std::unique_ptr<xe::ui::GraphicsContext> context_;
+  // Frames the CP may record ahead of the GPU before waiting.
+  static const size_t kMaxFramesInFlight = 2;
+
   SwapMode swap_mode_;
-  SwapState swap_state_;
-  std::function<void()> swap_request_handler_;
+  // Fences at the end of each frame still in flight.
+  std::deque<GLsync> frame_fences_;
   std::queue<std::function<void()>> pending_fns_;
 
   uint32_t counter_;
 
+  uint64_t draw_count_ = 0;
+  uint64_t upload_bytes_ = 0;
+  std::atomic<uint64_t> shader_compile_ticks_{0};
+  uint64_t stall_ticks_ = 0;
+
   uint32_t primary_buffer_ptr_;
   uint32_t primary_buffer_size_;
 
-  uint32_t read_ptr_index_;
+  std::atomic<uint32_t> read_ptr_index_;
   uint32_t read_ptr_update_freq_;
   uint32_t read_ptr_writeback_ptr_;
 
   std::unique_ptr<xe::threading::Event> write_ptr_index_event_;
   std::atomic<uint32_t> write_ptr_index_;
 
+  // Command stream decoding ahead of the worker (--gpu_decode_ahead). The
+  // decode thread walks what the guest submits and hands it to the worker
+  // by advancing decode_ptr_index_, which the worker then executes up to.
+  struct DecodedShaderLoad {
+    ShaderType shader_type;
+    uint32_t guest_address;
+    uint32_t dword_count;
+    uint64_t hash;
+  };
+  std::unique_ptr<xe::threading::Thread> decode_thread_;
+  std::atomic<uint32_t> decode_ptr_index_{0};
+  // Shader loads in the decoded commands, in command order.
+  std::mutex decoded_shader_loads_mutex_;
+  std::deque<DecodedShaderLoad> decoded_shader_loads_;
+
+  // Set when whatever WAIT_REG_MEM is waiting on may have been written.
+  std::unique_ptr<xe::threading::Event> wait_event_;
+  // Register being waited on, or UINT32_MAX.
+  std::atomic<uint32_t> wait_register_index_{UINT32_MAX};
+  // Set by the write watch on the memory being waited on.
+  std::atomic<bool> wait_watch_triggered_{false};
+
   uint64_t bin_select_;
   uint64_t bin_mask_;
 
   GL4ShaderTranslator shader_translator_;
   std::vector<std::unique_ptr<GL4Shader>> all_shaders_;
   std::unordered_map<uint64_t, GL4Shader*> shader_cache_;
+  std::unique_ptr<GL4ShaderCacheFile> shader_cache_file_;
+  // Asynchronous shader compilation (--async_shader_compilation).
+  struct PendingShaderCompile {
+    GL4Shader* shader;
+    xenos::xe_gpu_program_cntl_t program_cntl;
+  };
+  std::unique_ptr<xe::ui::GraphicsContext> shader_compile_context_;
+  std::unique_ptr<xe::threading::Thread> shader_compile_thread_;
+  GL4ShaderTranslator shader_compile_translator_;
+  std::mutex shader_compile_mutex_;
+  std::condition_variable shader_compile_cond_;
+  std::deque<PendingShaderCompile> shader_compile_queue_;
+  bool shader_compile_running_ = false;
+  // Microcode analysis of newly loaded shaders (--shader_analysis_threads),
+  // joined when each shader is first bound.
+  std::vector<std::unique_ptr<xe::threading::Thread>> shader_analysis_threads_;
+  std::mutex shader_analysis_mutex_;
+  std::condition_variable shader_analysis_cond_;
+  std::deque<GL4Shader*> shader_analysis_queue_;
+  bool shader_analysis_running_ = false;
+  GLuint placeholder_fragment_program_ = 0;
   GL4Shader* active_vertex_shader_;
   GL4Shader* active_pixel_shader_;
+  // Samplers of the active shaders, one per fetch slot. VS and PS samplers
+  // share fetch slots.
+  std::vector<const Shader::SamplerDesc*> active_sampler_descs_;
   CachedFramebuffer* active_framebuffer_;
   GLuint last_framebuffer_texture_;
+  // Size of last_framebuffer_texture_ relative to the guest's.
+  uint32_t last_framebuffer_texture_scale_;
+  // Multiple of the guest resolution render targets are created at.
+  uint32_t resolution_scale_;
 
   std::vector<CachedFramebuffer> cached_framebuffers_;
-  std::vector<CachedColorRenderTarget> cached_color_render_targets_;
-  std::vector<CachedDepthRenderTarget> cached_depth_render_targets_;
+  std::vector<std::unique_ptr<CachedColorRenderTarget>>
+      cached_color_render_targets_;
+  std::vector<std::unique_ptr<CachedDepthRenderTarget>>
+      cached_depth_render_targets_;
+  // Targets bound by the last UpdateRenderTargets (4 color, then depth) and
+  // the number of EDRAM tiles in one 16-sample row of each.
+  CachedRenderTarget* active_render_targets_[5] = {nullptr};
+  uint32_t active_render_target_row_tiles_[5] = {0};
+  uint32_t active_render_target_samples_y_ = 1;
+  uint64_t edram_write_count_ = 0;
   std::vector<std::unique_ptr<CachedPipeline>> all_pipelines_;
   std::unordered_map<uint64_t, CachedPipeline*> cached_pipelines_;
+  // Keyed by the hash of PipelineStateKey.
+  std::vector<std::unique_ptr<CachedPipelineState>> all_pipeline_states_;
+  std::unordered_map<uint64_t, CachedPipelineState*> cached_pipeline_states_;
+  CachedPipelineState* active_pipeline_state_ = nullptr;
   GLuint point_list_geometry_program_;
   GLuint rect_list_geometry_program_;
-  GLuint quad_list_geometry_program_;
-  GLuint line_quad_list_geometry_program_;
   struct {
     xenos::IndexFormat format;
     xenos::Endian endianness;
     uint32_t count;
     uint32_t guest_base;
     size_t length;
+    BufferCache::IndexConversion conversion;
+    // Indices the draw references, set by PopulateIndexBuffer when known.
+    // min_index > max_index otherwise.
+    uint32_t min_index;
+    uint32_t max_index;
   } index_buffer_info_;
   uint32_t draw_index_count_;
+  // Buffer bindings last made on vertex_array_. Draws are only flushed when
+  // a binding actually changes.
+  struct VertexBufferBinding {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizei stride;
+  };
+  GLuint vertex_array_ = 0;
+  GLuint vertex_array_element_buffer_ = 0;
+  VertexBufferBinding vertex_buffer_bindings_[32];
+
+  // DirtyStateGroup bits for each register and those written since the last
+  // draw consumed them.
+  uint8_t register_dirty_groups_[RegisterFile::kRegisterCount];
+  uint8_t dirty_state_groups_;
 
   TextureCache texture_cache_;
+  BufferCache buffer_cache_;
+  // Guest physical memory pinned as a buffer with --gpu_guest_memory_buffer,
+  // or 0 if not in use.
+  GLuint guest_memory_buffer_ = 0;
+  ReadbackCache readback_cache_;
 
   DrawBatcher draw_batcher_;
   xe::ui::gl::CircularBuffer scratch_buffer_;
+  xe::ui::gl::GpuTimer gpu_timer_;
+
+  // Writes the results of finished occlusion queries to guest memory,
+  // waiting for those --occlusion_query_max_latency frames old.
+  void PollOcclusionQueries();
+  void WriteOcclusionQueryResult(uint32_t guest_address, uint32_t samples);
+  struct PendingOcclusionQuery {
+    GLuint query;
+    uint32_t guest_address;
+    uint32_t frame;
+  };
+  // Query between the ZPD begin and end events, or 0.
+  GLuint active_occlusion_query_ = 0;
+  uint32_t active_occlusion_query_address_ = 0;
+  std::deque<PendingOcclusionQuery> pending_occlusion_queries_;
+  std::vector<GLuint> free_occlusion_queries_;
 
  private:
   bool SetShadowRegister(uint32_t* dest, uint32_t register_name);
@@ -335,32 +560,8 @@ class CommandProcessor {
     UpdateViewportStateRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_viewport_state_regs_;
-  struct UpdateRasterizerStateRegisters {
-    uint32_t pa_su_sc_mode_cntl;
-    uint32_t pa_sc_screen_scissor_tl;
-    uint32_t pa_sc_screen_scissor_br;
-    uint32_t multi_prim_ib_reset_index;
-
-    UpdateRasterizerStateRegisters() { Reset(); }
-    void Reset() { std::memset(this, 0, sizeof(*this)); }
-  } update_rasterizer_state_regs_;
-  struct UpdateBlendStateRegisters {
-    uint32_t rb_blendcontrol[4];
-    float rb_blend_rgba[4];
-
-    UpdateBlendStateRegisters() { Reset(); }
-    void Reset() { std::memset(this, 0, sizeof(*this)); }
-  } update_blend_state_regs_;
-  struct UpdateDepthStencilStateRegisters {
-    uint32_t rb_depthcontrol;
-    uint32_t rb_stencilrefmask;
-
-    UpdateDepthStencilStateRegisters() { Reset(); }
-    void Reset() { std::memset(this, 0, sizeof(*this)); }
-  } update_depth_stencil_state_regs_;
   struct UpdateShadersRegisters {
     PrimitiveType prim_type;
-    uint32_t pa_su_sc_mode_cntl;
     uint32_t sq_program_cntl;
     GL4Shader* vertex_shader;
     GL4Shader* pixel_shader;
@@ -9,12 +9,14 @@
 
 #include "xenia/gpu/gl4/draw_batcher.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/gpu/gl4/gl4_gpu_flags.h"
 #include "xenia/gpu/gpu_flags.h"
+#include "xenia/profiling.h"
 
 namespace xe {
 namespace gpu {
@@ -71,6 +73,7 @@ bool DrawBatcher::ReconfigurePipeline(GL4Shader* vertex_shader,
   batch_state_.vertex_shader = vertex_shader;
   batch_state_.pixel_shader = pixel_shader;
   batch_state_.pipeline = pipeline;
+  UpdateConstantRanges();
 
   return true;
 }
@@ -241,11 +244,18 @@ bool DrawBatcher::CommitDraw() {
   return true;
 }
 
+void DrawBatcher::InsertFences() {
+  command_buffer_.InsertFence();
+  state_buffer_.InsertFence();
+}
+
 bool DrawBatcher::Flush(FlushMode mode) {
   if (batch_state_.draw_count) {
 #if FINE_GRAINED_DRAW_SCOPES
     SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
+    // Batches are the unit of GPU time in the profiler.
+    SCOPE_profile_gpu_i("gpu-gl4", "xe::gpu::gl4::DrawBatcher::Flush");
 
     assert_not_zero(batch_state_.command_stride);
     assert_not_zero(batch_state_.state_stride);
@@ -290,9 +300,8 @@ bool DrawBatcher::Flush(FlushMode mode) {
         // (register_file_->values[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32
         // & 0x3) == 0);
         break;
-      case PrimitiveType::kQuadList:
-        prim_type = GL_LINES_ADJACENCY;
-        break;
+      // Quad lists are converted to triangle or line lists by the command
+      // processor.
       default:
       case PrimitiveType::kUnknown0x07:
         prim_type = GL_POINTS;
@@ -350,15 +359,56 @@ bool DrawBatcher::Flush(FlushMode mode) {
   return true;
 }
 
+void DrawBatcher::UpdateConstantRanges() {
+  // Every draw gets a fresh state block, so constants the shaders never read
+  // can be left as garbage. Most shaders read a few dozen of the 512.
+  float_const_ranges_.clear();
+  auto add_shader = [this](GL4Shader* shader, uint32_t base) {
+    if (!shader) {
+      return;
+    }
+    if (shader->is_compile_pending()) {
+      // A placeholder program is drawing in its place and reads nothing. The
+      // pipeline changes once the shader is ready.
+      return;
+    }
+    const auto& map = shader->constant_register_map();
+    if (map.float_dynamic_addressing) {
+      float_const_ranges_.push_back({base, 256});
+      return;
+    }
+    // Temporaries are initialized from the first constants.
+    uint32_t temp_count = std::min(shader->temp_register_count(), 256u);
+    uint32_t n = 0;
+    while (n < 256) {
+      bool is_read = n < temp_count ||
+                     (map.float_bitmap[n / 64] & (uint64_t(1) << (n % 64)));
+      if (!is_read) {
+        ++n;
+        continue;
+      }
+      auto& ranges = float_const_ranges_;
+      if (!ranges.empty() &&
+          ranges.back().start + ranges.back().count == base + n) {
+        ++ranges.back().count;
+      } else {
+        ranges.push_back({base + n, 1});
+      }
+      ++n;
+    }
+  };
+  add_shader(batch_state_.vertex_shader, 0);
+  add_shader(batch_state_.pixel_shader, 256);
+}
+
 void DrawBatcher::CopyConstants() {
-  // TODO(benvanik): partial updates, etc. We could use shader constant access
-  // knowledge that we get at compile time to only upload those constants
-  // required. If we did this as a variable length then we could really cut
-  // down on state block sizes.
-
-  std::memcpy(active_draw_.header->float_consts,
-              &register_file_->values[XE_GPU_REG_SHADER_CONSTANT_000_X].f32,
-              sizeof(active_draw_.header->float_consts));
+  auto src = reinterpret_cast<const float4*>(
+      &register_file_->values[XE_GPU_REG_SHADER_CONSTANT_000_X].f32);
+  for (const auto& range : float_const_ranges_) {
+    std::memcpy(active_draw_.header->float_consts + range.start,
+                src + range.start, range.count * sizeof(float4));
+  }
+  // These are small enough that tracking their use isn't worth it.
   std::memcpy(
       active_draw_.header->bool_consts,
       &register_file_->values[XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031].f32,
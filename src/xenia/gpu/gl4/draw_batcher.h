@@ -10,6 +10,8 @@
 #ifndef XENIA_GPU_GL4_DRAW_BATCHER_H_
 #define XENIA_GPU_GL4_DRAW_BATCHER_H_
 
+#include <vector>
+
 #include "xenia/gpu/gl4/gl4_shader.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/xenos.h"
@@ -78,11 +80,21 @@ class DrawBatcher {
   void set_texture_sampler(int index, GLuint64 handle) {
     active_draw_.header->texture_samplers[index] = handle;
   }
-  void set_index_buffer(const CircularBuffer::Allocation& allocation) {
+  // Added to every vertex index of the draw, so that draws sourcing vertices
+  // from different parts of one buffer can share a binding.
+  void set_vertex_offset(uint32_t vertex_offset) {
+    if (batch_state_.indexed) {
+      active_draw_.draw_elements_cmd->base_vertex = GLint(vertex_offset);
+    } else {
+      active_draw_.draw_arrays_cmd->first_index = vertex_offset;
+    }
+  }
+  // Byte offset of the indices in the bound element buffer.
+  void set_index_buffer(size_t offset) {
     // Offset is used in glDrawElements.
     auto& cmd = active_draw_.draw_elements_cmd;
     size_t index_size = batch_state_.index_type == GL_UNSIGNED_SHORT ? 2 : 4;
-    cmd->first_index = GLuint(allocation.offset / index_size);
+    cmd->first_index = GLuint(offset / index_size);
   }
 
   bool ReconfigurePipeline(GL4Shader* vertex_shader, GL4Shader* pixel_shader,
@@ -94,9 +106,12 @@ class DrawBatcher {
   void DiscardDraw();
   bool CommitDraw();
   bool Flush(FlushMode mode);
+  // Fences the command and state buffers against all draws flushed so far.
+  void InsertFences();
 
  private:
   bool BeginDraw();
+  void UpdateConstantRanges();
   void CopyConstants();
 
   RegisterFile* register_file_;
@@ -127,6 +142,13 @@ class DrawBatcher {
     GLsizei draw_count;
   } batch_state_;
 
+  struct ConstantRange {
+    uint32_t start;
+    uint32_t count;
+  };
+  // Float constants (in float4s) read by the current pipeline's shaders.
+  std::vector<ConstantRange> float_const_ranges_;
+
   // This must match GL4Shader's header.
   struct CommonHeader {
     float4 window_scale;  // sx,sy, ?, ?
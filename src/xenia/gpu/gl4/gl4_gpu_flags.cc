@@ -12,3 +12,60 @@
 DEFINE_bool(disable_framebuffer_readback, false,
             "Disable framebuffer readback.");
 DEFINE_bool(disable_textures, false, "Disable textures and use colors only.");
+DEFINE_string(shader_cache_path, "",
+              "Persists translated shaders and program binaries to this path "
+              "so that later runs can skip translation. Disabled if empty.");
+DEFINE_bool(async_shader_compilation, false,
+            "Translates and compiles shaders on a background thread instead "
+            "of stalling the GPU. Draws are skipped until their shaders are "
+            "ready.");
+DEFINE_bool(async_shader_placeholder, false,
+            "With --async_shader_compilation, draws whose pixel shader is "
+            "still compiling use a flat placeholder instead of being skipped.");
+DEFINE_int32(shader_analysis_threads, 2,
+             "Threads that disassemble and analyze newly loaded shaders ahead "
+             "of their first draw. 0 to analyze them on load.");
+DEFINE_bool(gpu_decode_ahead, true,
+            "Walks submitted command buffers on a separate thread ahead of the "
+            "GL worker, hashing shader microcode before it is loaded.");
+DEFINE_bool(gpu_texture_untiling, false,
+            "Untiles and endian swaps tiled textures with a compute shader "
+            "instead of on the CPU.");
+DEFINE_bool(gpu_guest_memory_buffer, false,
+            "Draws from vertex data in guest memory in place, with guest "
+            "physical memory pinned as a buffer (GL_AMD_pinned_memory), "
+            "instead of copying it. Guest writes to vertex data still in use "
+            "by the GPU become visible to it.");
+DEFINE_bool(vertex_upload_index_range, true,
+            "Streams only the vertices indexed draws reference. Disable for "
+            "titles whose shaders fetch vertices by computed index.");
+DEFINE_int32(occlusion_query_max_latency, 2,
+             "Frames an occlusion query result may take before the GPU is "
+             "waited on for it. Results that are in sooner are written back "
+             "as soon as they are seen.");
+DEFINE_int32(occlusion_query_fake_sample_count, -1,
+             "Reports this many samples passed for every occlusion query "
+             "instead of measuring them. -1 to use real queries.");
+DEFINE_int32(texture_cache_budget_mb, 1024,
+             "Evicts the least recently used textures once their total size "
+             "exceeds this many megabytes. 0 to disable.");
+DEFINE_int32(texture_mip_drop_levels, 1,
+             "Leaves out up to this many of the largest mip levels of new "
+             "textures while over --texture_cache_budget_mb.");
+DEFINE_int32(texture_stream_budget_kb, 0,
+             "Uploads mip levels smallest first, at most this many kilobytes "
+             "per frame, sampling the levels already there in the meantime. "
+             "0 to upload all levels at once.");
+DEFINE_int32(texture_transcode_cache_mb, 32,
+             "Keeps up to this many megabytes of textures decoded from "
+             "formats GL lacks, so that reloading them skips decoding.");
+DEFINE_int32(resolution_scale, 1,
+             "Renders at this multiple of the guest resolution, 1 to 4. "
+             "Resolves read back to guest memory are downsampled.");
+DEFINE_int32(present_buffer_count, 3,
+             "Frame buffers passed between the GPU and the display, 2 to 8. "
+             "2 is double buffering, 3 triple buffering.");
+DEFINE_bool(present_frame_skip, true,
+            "Shows only the newest finished frame, dropping older ones the "
+            "display hasn't gotten to, so the GPU never waits for the "
+            "display. Always on without --vsync.");
@@ -14,6 +14,23 @@
 
 DECLARE_bool(disable_framebuffer_readback);
 DECLARE_bool(disable_textures);
+DECLARE_string(shader_cache_path);
+DECLARE_bool(async_shader_compilation);
+DECLARE_bool(async_shader_placeholder);
+DECLARE_int32(shader_analysis_threads);
+DECLARE_bool(gpu_decode_ahead);
+DECLARE_bool(gpu_texture_untiling);
+DECLARE_bool(gpu_guest_memory_buffer);
+DECLARE_bool(vertex_upload_index_range);
+DECLARE_int32(occlusion_query_max_latency);
+DECLARE_int32(occlusion_query_fake_sample_count);
+DECLARE_int32(texture_cache_budget_mb);
+DECLARE_int32(texture_mip_drop_levels);
+DECLARE_int32(texture_stream_budget_kb);
+DECLARE_int32(texture_transcode_cache_mb);
+DECLARE_int32(resolution_scale);
+DECLARE_int32(present_buffer_count);
+DECLARE_bool(present_frame_skip);
 
 #define FINE_GRAINED_DRAW_SCOPES 0
 
@@ -80,14 +80,18 @@ X_STATUS GL4GraphicsSystem::Setup(cpu::Processor* processor,
   // Create rendering control.
   // This must happen on the UI thread.
   std::unique_ptr<xe::ui::GraphicsContext> processor_context;
+  std::unique_ptr<xe::ui::GraphicsContext> presenter_context;
   target_loop_->PostSynchronous([&]() {
     // Setup the GL context the command processor will do all its drawing in.
     // It's shared with the display context so that we can resolve framebuffers
     // from it.
     processor_context = display_context_->CreateShared();
     processor_context->ClearCurrent();
+    // The presenter waits for frames on its own context.
+    presenter_context = display_context_->CreateShared();
+    presenter_context->ClearCurrent();
   });
-  if (!processor_context) {
+  if (!processor_context || !presenter_context) {
     xe::FatalError(
         "Unable to initialize GL context. Xenia requires OpenGL 4.5. Ensure "
         "you have the latest drivers for your GPU and that it supports OpenGL "
@@ -95,6 +99,15 @@ X_STATUS GL4GraphicsSystem::Setup(cpu::Processor* processor,
     return X_STATUS_UNSUCCESSFUL;
   }
 
+  // Frames pass from the command processor to the display through the
+  // presenter, so that neither holds up the other.
+  presenter_ = std::make_unique<Presenter>();
+  if (!presenter_->Initialize(std::move(presenter_context),
+                              [this]() { target_window_->Invalidate(); })) {
+    XELOGE("Unable to initialize presenter");
+    return X_STATUS_UNSUCCESSFUL;
+  }
+
   // Create command processor. This will spin up a thread to process all
   // incoming ringbuffer packets.
   command_processor_ = std::make_unique<CommandProcessor>(this);
@@ -102,8 +115,6 @@ X_STATUS GL4GraphicsSystem::Setup(cpu::Processor* processor,
     XELOGE("Unable to initialize command processor");
     return X_STATUS_UNSUCCESSFUL;
   }
-  command_processor_->set_swap_request_handler(
-      [this]() { target_window_->Invalidate(); });
 
   // Let the processor know we want register access callbacks.
   memory_->AddVirtualMappedRange(
@@ -111,27 +122,19 @@ X_STATUS GL4GraphicsSystem::Setup(cpu::Processor* processor,
       reinterpret_cast<cpu::MMIOReadCallback>(MMIOReadRegisterThunk),
       reinterpret_cast<cpu::MMIOWriteCallback>(MMIOWriteRegisterThunk));
 
-  // 60hz vsync timer.
+  // 60hz vsync timer. Frame paced titles are sensitive to jitter, so it
+  // runs above everything else.
   worker_running_ = true;
   worker_thread_ =
       kernel::object_ref<kernel::XHostThread>(new kernel::XHostThread(
           emulator()->kernel_state(), 128 * 1024, 0, [this]() {
-            uint64_t vsync_duration = FLAGS_vsync ? 16 : 1;
-            uint64_t last_frame_time = Clock::QueryGuestTickCount();
-            while (worker_running_) {
-              uint64_t current_time = Clock::QueryGuestTickCount();
-              uint64_t elapsed = (current_time - last_frame_time) /
-                                 (Clock::guest_tick_frequency() / 1000);
-              if (elapsed >= vsync_duration) {
-                MarkVblank();
-                last_frame_time = current_time;
-              }
-              xe::threading::Sleep(std::chrono::milliseconds(1));
-            }
+            VblankThreadMain();
             return 0;
           }));
   worker_thread_->set_name("GL4 Vsync");
   worker_thread_->Create();
+  worker_thread_->host_thread()->set_priority(
+      xe::threading::ThreadPriority::kHighest);
 
   if (FLAGS_trace_gpu_stream) {
     BeginTracing();
@@ -146,12 +149,18 @@ void GL4GraphicsSystem::Shutdown() {
   worker_running_ = false;
   worker_thread_->Wait(0, 0, 0, nullptr);
   worker_thread_.reset();
+  if (FLAGS_vsync_stats) {
+    DumpVblankStats();
+  }
 
+  // Releases the command processor if it's waiting for a buffer.
+  presenter_->Shutdown();
   command_processor_->Shutdown();
 
   // TODO(benvanik): remove mapped range.
 
   command_processor_.reset();
+  presenter_.reset();
 
   GraphicsSystem::Shutdown();
 }
@@ -279,6 +288,93 @@ void GL4GraphicsSystem::ClearCaches() {
       [&]() { command_processor_->ClearCaches(); });
 }
 
+void GL4GraphicsSystem::VblankThreadMain() {
+  // Vblanks are scheduled in guest time, so they follow the time scalar, and
+  // on absolute deadlines so that a late wakeup doesn't delay all later ones.
+  uint64_t frequency = Clock::guest_tick_frequency();
+  uint64_t period = FLAGS_vsync ? frequency / 60 : frequency / 1000;
+  uint64_t next_vblank = Clock::QueryGuestTickCount() + period;
+  while (worker_running_) {
+    uint64_t now = Clock::QueryGuestTickCount();
+    if (now < next_vblank) {
+      // Plain sleeps may overshoot by a scheduler quantum, so they are only
+      // used until close to the deadline (in short steps, to notice
+      // shutdown). PreciseSleep spins out the rest, unless fast-forwarding
+      // where a late vblank doesn't matter but a spinning core does.
+      uint64_t remaining_us = uint64_t((next_vblank - now) * 1000000.0 /
+                                       frequency / Clock::guest_time_scalar());
+      if (fast_forward()) {
+        xe::threading::Sleep(std::chrono::microseconds(
+            std::min<uint64_t>(std::max<uint64_t>(remaining_us, 1), 4000)));
+      } else if (remaining_us > 3000) {
+        xe::threading::Sleep(std::chrono::microseconds(
+            std::min<uint64_t>(remaining_us - 2000, 4000)));
+      } else {
+        xe::threading::PreciseSleep(std::chrono::microseconds(remaining_us));
+      }
+      continue;
+    }
+
+    uint64_t callback_start = Clock::QueryHostTickCount();
+    MarkVblank();
+    if (FLAGS_vsync_stats) {
+      uint64_t callback_ticks = Clock::QueryHostTickCount() - callback_start;
+      RecordVblankStat(&vblank_jitter_,
+                       (now - next_vblank) * 1000000 / frequency);
+      RecordVblankStat(&vblank_callback_, callback_ticks * 1000000 /
+                                              Clock::host_tick_frequency());
+    }
+
+    next_vblank += period;
+    now = Clock::QueryGuestTickCount();
+    if (now >= next_vblank) {
+      // More than a period behind (debugger, slow callback). Skip ahead
+      // rather than delivering a burst of vblanks.
+      uint64_t skipped = (now - next_vblank) / period + 1;
+      next_vblank += skipped * period;
+      vblanks_skipped_ += skipped;
+    }
+  }
+}
+
+void GL4GraphicsSystem::RecordVblankStat(VblankStats* stats, uint64_t us) {
+  static const uint64_t kBoundsUs[] = {50, 100, 250, 500, 1000, 2000, 4000};
+  static_assert(sizeof(kBoundsUs) / sizeof(uint64_t) == kVblankBucketCount - 1,
+                "one bound per bucket");
+  size_t bucket = 0;
+  while (bucket < kVblankBucketCount - 1 && us >= kBoundsUs[bucket]) {
+    ++bucket;
+  }
+  ++stats->count;
+  stats->total_us += us;
+  stats->max_us = std::max(stats->max_us, us);
+  ++stats->histogram[bucket];
+}
+
+void GL4GraphicsSystem::DumpVblankStats() {
+  XELOGI("Vblank timing (histogram buckets <50 <100 <250 <500 <1000 <2000 "
+         "<4000 >=4000 us), %lld skipped:",
+         static_cast<long long>(vblanks_skipped_));
+  auto dump = [](const char* name, const VblankStats& stats) {
+    XELOGI(
+        "  %-16s %8lld samples %8.1fus avg %8lldus max | %lld %lld %lld %lld "
+        "%lld %lld %lld %lld",
+        name, static_cast<long long>(stats.count),
+        stats.count ? double(stats.total_us) / stats.count : 0.0,
+        static_cast<long long>(stats.max_us),
+        static_cast<long long>(stats.histogram[0]),
+        static_cast<long long>(stats.histogram[1]),
+        static_cast<long long>(stats.histogram[2]),
+        static_cast<long long>(stats.histogram[3]),
+        static_cast<long long>(stats.histogram[4]),
+        static_cast<long long>(stats.histogram[5]),
+        static_cast<long long>(stats.histogram[6]),
+        static_cast<long long>(stats.histogram[7]));
+  };
+  dump("jitter", vblank_jitter_);
+  dump("callback", vblank_callback_);
+}
+
 void GL4GraphicsSystem::MarkVblank() {
   SCOPE_profile_cpu_f("gpu");
 
@@ -292,28 +388,29 @@ void GL4GraphicsSystem::MarkVblank() {
 }
 
 void GL4GraphicsSystem::Swap(xe::ui::UIEvent* e) {
-  // Check for pending swap.
-  auto& swap_state = command_processor_->swap_state();
-  {
-    std::lock_guard<xe::mutex> lock(swap_state.mutex);
-    if (swap_state.pending) {
-      swap_state.pending = false;
-      std::swap(swap_state.front_buffer_texture,
-                swap_state.back_buffer_texture);
-    }
+  if (!presenter_) {
+    return;
   }
 
-  if (!swap_state.front_buffer_texture) {
+  // Takes the next ready frame, if any, or else redraws the last one.
+  uint32_t width = 0;
+  uint32_t height = 0;
+  GLuint front_buffer_texture = presenter_->BeginPresent(&width, &height);
+  if (!front_buffer_texture) {
     // Not yet ready.
     return;
   }
 
   // Blit the frontbuffer.
   display_context_->blitter()->BlitTexture2D(
-      swap_state.front_buffer_texture,
-      Rect2D(0, 0, swap_state.width, swap_state.height),
+      front_buffer_texture, Rect2D(0, 0, width, height),
       Rect2D(0, 0, target_window_->width(), target_window_->height()),
       GL_LINEAR);
+
+  // Let the CP know when we are done reading the front buffer.
+  GLsync front_buffer_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+  presenter_->EndPresent(front_buffer_fence);
 }
 
 uint32_t GL4GraphicsSystem::ReadRegister(uint32_t addr) {
@@ -353,6 +450,7 @@ void GL4GraphicsSystem::WriteRegister(uint32_t addr, uint32_t value) {
 
   assert_true(r < RegisterFile::kRegisterCount);
   register_file_.values[r].u32 = value;
+  command_processor_->NotifyRegisterWritten(r);
 }
 
 }  // namespace gl4
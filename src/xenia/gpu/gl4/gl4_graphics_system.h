@@ -13,6 +13,7 @@
 #include <memory>
 
 #include "xenia/gpu/gl4/command_processor.h"
+#include "xenia/gpu/gl4/presenter.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/kernel/objects/xthread.h"
@@ -34,10 +35,11 @@ class GL4GraphicsSystem : public GraphicsSystem {
                  ui::Window* target_window) override;
   void Shutdown() override;
 
-  RegisterFile* register_file() { return &register_file_; }
+  RegisterFile* register_file() override { return &register_file_; }
   CommandProcessor* command_processor() const {
     return command_processor_.get();
   }
+  Presenter* presenter() const { return presenter_.get(); }
 
   void InitializeRingBuffer(uint32_t ptr, uint32_t page_count) override;
   void EnableReadPointerWriteBack(uint32_t ptr, uint32_t block_size) override;
@@ -50,6 +52,7 @@ class GL4GraphicsSystem : public GraphicsSystem {
   void ClearCaches() override;
 
  private:
+  void VblankThreadMain();
   void MarkVblank();
   void Swap(xe::ui::UIEvent* e);
   uint32_t ReadRegister(uint32_t addr);
@@ -66,11 +69,30 @@ class GL4GraphicsSystem : public GraphicsSystem {
 
   RegisterFile register_file_;
   std::unique_ptr<CommandProcessor> command_processor_;
+  std::unique_ptr<Presenter> presenter_;
 
   xe::ui::gl::GLContext* display_context_ = nullptr;
 
   std::atomic<bool> worker_running_;
   kernel::object_ref<kernel::XHostThread> worker_thread_;
+
+  // --vsync_stats, only touched by the vblank thread until it has exited.
+  // The last histogram bucket holds everything at or above the last bound.
+  static const size_t kVblankBucketCount = 8;
+  struct VblankStats {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t histogram[kVblankBucketCount];
+  };
+  static void RecordVblankStat(VblankStats* stats, uint64_t us);
+  void DumpVblankStats();
+  // How late each vblank was delivered relative to its schedule.
+  VblankStats vblank_jitter_ = {0};
+  // Time spent in the guest interrupt callback.
+  VblankStats vblank_callback_ = {0};
+  // Vblanks dropped because we fell more than a period behind.
+  uint64_t vblanks_skipped_ = 0;
 };
 
 }  // namespace gl4
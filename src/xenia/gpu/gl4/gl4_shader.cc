@@ -13,6 +13,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/gpu/gl4/gl4_gpu_flags.h"
+#include "xenia/gpu/gl4/gl4_shader_cache_file.h"
 #include "xenia/gpu/gl4/gl4_shader_translator.h"
 #include "xenia/gpu/gpu_flags.h"
 
@@ -26,7 +27,10 @@ GL4Shader::GL4Shader(ShaderType shader_type, uint64_t data_hash,
                      const uint32_t* dword_ptr, uint32_t dword_count)
     : Shader(shader_type, data_hash, dword_ptr, dword_count),
       program_(0),
-      vao_(0) {}
+      binary_format_(0),
+      vao_(0),
+      temp_register_count_(0),
+      compile_pending_(false) {}
 
 GL4Shader::~GL4Shader() {
   glDeleteProgram(program_);
@@ -133,55 +137,28 @@ bool GL4Shader::PrepareVertexArrayObject() {
 
     for (uint32_t i = 0; i < desc.element_count; ++i, ++el_index) {
       const auto& el = desc.elements[i];
-      auto comp_count = GetVertexFormatComponentCount(el.format);
-      GLenum comp_type;
+      // Elements are fetched as the raw big endian dwords and decoded by the
+      // shader (see GL4ShaderTranslator), so vertex buffers are plain copies
+      // of guest memory.
       switch (el.format) {
-        case VertexFormat::k_8_8_8_8:
-          comp_type = el.is_signed ? GL_BYTE : GL_UNSIGNED_BYTE;
-          break;
-        case VertexFormat::k_2_10_10_10:
-          comp_type = el.is_signed ? GL_INT_2_10_10_10_REV
-                                   : GL_UNSIGNED_INT_2_10_10_10_REV;
-          break;
         case VertexFormat::k_10_11_11:
-          // assert_false(el.is_signed);
-          XELOGW("Signed k_10_11_11 vertex format not supported by GL");
-          comp_type = GL_UNSIGNED_INT_10F_11F_11F_REV;
+          if (el.is_signed) {
+            XELOGW("Signed k_10_11_11 vertex format not supported");
+          }
           break;
-        /*case VertexFormat::k_11_11_10:
-        break;*/
+        case VertexFormat::k_8_8_8_8:
+        case VertexFormat::k_2_10_10_10:
         case VertexFormat::k_16_16:
-          comp_type = el.is_signed ? GL_SHORT : GL_UNSIGNED_SHORT;
-          break;
         case VertexFormat::k_16_16_FLOAT:
-          comp_type = GL_HALF_FLOAT;
-          break;
         case VertexFormat::k_16_16_16_16:
-          comp_type = el.is_signed ? GL_SHORT : GL_UNSIGNED_SHORT;
-          break;
         case VertexFormat::k_16_16_16_16_FLOAT:
-          comp_type = GL_HALF_FLOAT;
-          break;
         case VertexFormat::k_32:
-          comp_type = el.is_signed ? GL_INT : GL_UNSIGNED_INT;
-          break;
         case VertexFormat::k_32_32:
-          comp_type = el.is_signed ? GL_INT : GL_UNSIGNED_INT;
-          break;
         case VertexFormat::k_32_32_32_32:
-          comp_type = el.is_signed ? GL_INT : GL_UNSIGNED_INT;
-          break;
         case VertexFormat::k_32_FLOAT:
-          comp_type = GL_FLOAT;
-          break;
         case VertexFormat::k_32_32_FLOAT:
-          comp_type = GL_FLOAT;
-          break;
         case VertexFormat::k_32_32_32_FLOAT:
-          comp_type = GL_FLOAT;
-          break;
         case VertexFormat::k_32_32_32_32_FLOAT:
-          comp_type = GL_FLOAT;
           break;
         default:
           assert_unhandled_case(el.format);
@@ -190,8 +167,9 @@ bool GL4Shader::PrepareVertexArrayObject() {
 
       glEnableVertexArrayAttrib(vao_, el_index);
       glVertexArrayAttribBinding(vao_, el_index, buffer_index);
-      glVertexArrayAttribFormat(vao_, el_index, comp_count, comp_type,
-                                el.is_normalized, el.offset_words * 4);
+      glVertexArrayAttribIFormat(vao_, el_index,
+                                 GetVertexFormatSizeInWords(el.format),
+                                 GL_UNSIGNED_INT, el.offset_words * 4);
     }
   }
 
@@ -200,7 +178,8 @@ bool GL4Shader::PrepareVertexArrayObject() {
 
 bool GL4Shader::PrepareVertexShader(
     GL4ShaderTranslator* shader_translator,
-    const xenos::xe_gpu_program_cntl_t& program_cntl) {
+    const xenos::xe_gpu_program_cntl_t& program_cntl,
+    GL4ShaderCacheFile* cache_file) {
   if (has_prepared_) {
     return is_valid_;
   }
@@ -211,6 +190,147 @@ bool GL4Shader::PrepareVertexShader(
     XELOGE("Unable to prepare vertex shader array object");
     return false;
   }
+
+  is_valid_ = PrepareProgram(shader_translator, program_cntl, cache_file);
+  return is_valid_;
+}
+
+bool GL4Shader::PreparePixelShader(
+    GL4ShaderTranslator* shader_translator,
+    const xenos::xe_gpu_program_cntl_t& program_cntl,
+    GL4ShaderCacheFile* cache_file) {
+  if (has_prepared_) {
+    return is_valid_;
+  }
+  has_prepared_ = true;
+
+  is_valid_ = PrepareProgram(shader_translator, program_cntl, cache_file);
+  return is_valid_;
+}
+
+bool GL4Shader::BeginAsyncPrepare() {
+  assert_false(has_prepared_);
+  has_prepared_ = true;
+  if (shader_type_ == ShaderType::kVertex && !PrepareVertexArrayObject()) {
+    XELOGE("Unable to prepare vertex shader array object");
+    return false;
+  }
+  compile_pending_ = true;
+  return true;
+}
+
+void GL4Shader::EndAsyncPrepare(bool is_valid) {
+  is_valid_ = is_valid;
+  compile_pending_.store(false, std::memory_order_release);
+}
+
+bool GL4Shader::PrepareProgram(
+    GL4ShaderTranslator* shader_translator,
+    const xenos::xe_gpu_program_cntl_t& program_cntl,
+    GL4ShaderCacheFile* cache_file) {
+  temp_register_count_ =
+      GL4ShaderTranslator::GetTempRegisterCount(shader_type_, program_cntl);
+  if (LoadCachedProgram(cache_file, program_cntl)) {
+    return true;
+  }
+  bool compiled = shader_type_ == ShaderType::kVertex
+                      ? CompileVertexProgram(shader_translator, program_cntl)
+                      : CompilePixelProgram(shader_translator, program_cntl);
+  if (!compiled) {
+    return false;
+  }
+  if (cache_file) {
+    cache_file->Append(shader_type_, data_hash_, program_cntl.dword_0,
+                       translated_disassembly_, binary_format_,
+                       translated_binary_);
+  }
+  return true;
+}
+
+bool GL4Shader::CompileVertexProgram(
+    GL4ShaderTranslator* shader_translator,
+    const xenos::xe_gpu_program_cntl_t& program_cntl) {
+  // Decoding of the raw vertex fetch inputs, matching what GL would do with
+  // the equivalent vertex attribute formats.
+  static const std::string vertex_fetch =
+      "uint xe_bswap(uint v) {\n"
+      "  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) |\n"
+      "         (v >> 24);\n"
+      "}\n"
+      "uvec2 xe_bswap(uvec2 v) {\n"
+      "  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) |\n"
+      "         (v >> 24);\n"
+      "}\n"
+      "uvec3 xe_bswap(uvec3 v) {\n"
+      "  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) |\n"
+      "         (v >> 24);\n"
+      "}\n"
+      "uvec4 xe_bswap(uvec4 v) {\n"
+      "  return (v << 24) | ((v << 8) & 0xFF0000u) | ((v >> 8) & 0xFF00u) |\n"
+      "         (v >> 24);\n"
+      "}\n"
+      "vec4 xe_unpack_8_8_8_8(uint v, bool is_signed, bool is_normalized) {\n"
+      "  if (is_normalized) {\n"
+      "    return is_signed ? unpackSnorm4x8(v) : unpackUnorm4x8(v);\n"
+      "  }\n"
+      "  return is_signed ? vec4((ivec4(v) << ivec4(24, 16, 8, 0)) >> 24)\n"
+      "                   : vec4((uvec4(v) >> uvec4(0, 8, 16, 24)) & 0xFFu);\n"
+      "}\n"
+      "vec4 xe_unpack_2_10_10_10(uint v, bool is_signed,\n"
+      "                          bool is_normalized) {\n"
+      "  if (is_signed) {\n"
+      "    vec4 c = vec4((ivec4(v) << ivec4(22, 12, 2, 0)) >>\n"
+      "                  ivec4(22, 22, 22, 30));\n"
+      "    return is_normalized\n"
+      "               ? max(c / vec4(511.0, 511.0, 511.0, 1.0), -1.0)\n"
+      "               : c;\n"
+      "  }\n"
+      "  vec4 c = vec4((uvec4(v) >> uvec4(0, 10, 20, 30)) &\n"
+      "                uvec4(0x3FFu, 0x3FFu, 0x3FFu, 3u));\n"
+      "  return is_normalized ? c / vec4(1023.0, 1023.0, 1023.0, 3.0) : c;\n"
+      "}\n"
+      "float xe_unpack_small_float(uint v, int mantissa_bits) {\n"
+      "  uint exponent = v >> mantissa_bits;\n"
+      "  float mantissa = float(v & ((1u << mantissa_bits) - 1u)) /\n"
+      "                   float(1u << mantissa_bits);\n"
+      "  return exponent == 0u ? ldexp(mantissa, -14)\n"
+      "                        : ldexp(1.0 + mantissa, int(exponent) - 15);\n"
+      "}\n"
+      "vec3 xe_unpack_10_11_11(uint v) {\n"
+      "  return vec3(xe_unpack_small_float(v & 0x7FFu, 6),\n"
+      "              xe_unpack_small_float((v >> 11) & 0x7FFu, 6),\n"
+      "              xe_unpack_small_float(v >> 22, 5));\n"
+      "}\n"
+      "vec2 xe_unpack_16_16(uint v, bool is_signed, bool is_normalized) {\n"
+      "  if (is_normalized) {\n"
+      "    return is_signed ? unpackSnorm2x16(v) : unpackUnorm2x16(v);\n"
+      "  }\n"
+      "  return is_signed ? vec2((ivec2(v) << ivec2(16, 0)) >> 16)\n"
+      "                   : vec2((uvec2(v) >> uvec2(0, 16)) & 0xFFFFu);\n"
+      "}\n"
+      "vec4 xe_unpack_16_16_16_16(uvec2 v, bool is_signed,\n"
+      "                           bool is_normalized) {\n"
+      "  return vec4(xe_unpack_16_16(v.x, is_signed, is_normalized),\n"
+      "              xe_unpack_16_16(v.y, is_signed, is_normalized));\n"
+      "}\n"
+      "vec4 xe_unpack_16_16_16_16_float(uvec2 v) {\n"
+      "  return vec4(unpackHalf2x16(v.x), unpackHalf2x16(v.y));\n"
+      "}\n"
+      "float xe_unpack_32(uint v, bool is_signed, bool is_normalized) {\n"
+      "  if (is_signed) {\n"
+      "    return is_normalized ? max(float(int(v)) / 2147483647.0, -1.0)\n"
+      "                         : float(int(v));\n"
+      "  }\n"
+      "  return is_normalized ? float(v) / 4294967295.0 : float(v);\n"
+      "}\n"
+      "vec2 xe_unpack_32(uvec2 v, bool is_signed, bool is_normalized) {\n"
+      "  return vec2(xe_unpack_32(v.x, is_signed, is_normalized),\n"
+      "              xe_unpack_32(v.y, is_signed, is_normalized));\n"
+      "}\n"
+      "vec4 xe_unpack_32(uvec4 v, bool is_signed, bool is_normalized) {\n"
+      "  return vec4(xe_unpack_32(v.xy, is_signed, is_normalized),\n"
+      "              xe_unpack_32(v.zw, is_signed, is_normalized));\n"
+      "}\n";
   std::string apply_transform =
       "vec4 applyTransform(const in StateData state, vec4 pos) {\n"
       "  if (state.vtx_fmt.w == 0.0) {\n"
@@ -229,7 +349,7 @@ bool GL4Shader::PrepareVertexShader(
       "  return pos;\n"
       "}\n";
   std::string source =
-      GetHeader() + apply_transform +
+      GetHeader() + vertex_fetch + apply_transform +
       "out gl_PerVertex {\n"
       "  vec4 gl_Position;\n"
       "  float gl_PointSize;\n"
@@ -260,22 +380,12 @@ bool GL4Shader::PrepareVertexShader(
   }
   source += translated_source;
 
-  if (!CompileProgram(source)) {
-    return false;
-  }
-
-  is_valid_ = true;
-  return true;
+  return CompileProgram(source);
 }
 
-bool GL4Shader::PreparePixelShader(
+bool GL4Shader::CompilePixelProgram(
     GL4ShaderTranslator* shader_translator,
     const xenos::xe_gpu_program_cntl_t& program_cntl) {
-  if (has_prepared_) {
-    return is_valid_;
-  }
-  has_prepared_ = true;
-
   std::string source =
       GetHeader() +
       "layout(origin_upper_left, pixel_center_integer) in vec4 gl_FragCoord;\n"
@@ -315,11 +425,61 @@ bool GL4Shader::PreparePixelShader(
 
   source += translated_source;
 
-  if (!CompileProgram(source)) {
+  return CompileProgram(source);
+}
+
+bool GL4Shader::LoadCachedProgram(
+    GL4ShaderCacheFile* cache_file,
+    const xenos::xe_gpu_program_cntl_t& program_cntl) {
+  if (!cache_file) {
+    return false;
+  }
+  auto record =
+      cache_file->Lookup(shader_type_, data_hash_, program_cntl.dword_0);
+  if (!record) {
     return false;
   }
+  std::string source(record->source, record->source_length);
+
+  if (record->binary_length &&
+      LoadProgramBinary(record->binary_format, record->binary,
+                        record->binary_length)) {
+    translated_disassembly_ = std::move(source);
+    translated_binary_.assign(record->binary,
+                              record->binary + record->binary_length);
+    binary_format_ = record->binary_format;
+    FindHostDisassembly();
+    return true;
+  }
 
-  is_valid_ = true;
+  // The driver may reject binaries at any time (such as after an update that
+  // kept the version string), so fall back to compiling the cached source and
+  // replace the stale record.
+  if (!CompileProgram(std::move(source))) {
+    glDeleteProgram(program_);
+    program_ = 0;
+    return false;
+  }
+  cache_file->Append(shader_type_, data_hash_, program_cntl.dword_0,
+                     translated_disassembly_, binary_format_,
+                     translated_binary_);
+  return true;
+}
+
+bool GL4Shader::LoadProgramBinary(GLenum binary_format, const uint8_t* binary,
+                                  size_t binary_length) {
+  assert_zero(program_);
+
+  GLuint program = glCreateProgram();
+  glProgramParameteri(program, GL_PROGRAM_SEPARABLE, GL_TRUE);
+  glProgramBinary(program, binary_format, binary, GLsizei(binary_length));
+  GLint link_status = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+  if (!link_status) {
+    glDeleteProgram(program);
+    return false;
+  }
+  program_ = program;
   return true;
 }
 
@@ -385,35 +545,9 @@ bool GL4Shader::CompileProgram(std::string source) {
   glGetProgramiv(program_, GL_PROGRAM_BINARY_LENGTH, &binary_length);
   if (binary_length) {
     translated_binary_.resize(binary_length);
-    GLenum binary_format;
-    glGetProgramBinary(program_, binary_length, &binary_length, &binary_format,
-                       translated_binary_.data());
-
-    // If we are on nvidia, we can find the disassembly string.
-    // I haven't been able to figure out from the format how to do this
-    // without a search like this.
-    const char* disasm_start = nullptr;
-    size_t search_offset = 0;
-    char* search_start = reinterpret_cast<char*>(translated_binary_.data());
-    while (true) {
-      auto p = reinterpret_cast<char*>(
-          memchr(translated_binary_.data() + search_offset, '!',
-                 translated_binary_.size() - search_offset));
-      if (!p) {
-        break;
-      }
-      if (p[0] == '!' && p[1] == '!' && p[2] == 'N' && p[3] == 'V') {
-        disasm_start = p;
-        break;
-      }
-      search_offset = p - search_start;
-      ++search_offset;
-    }
-    if (disasm_start) {
-      host_disassembly_ = std::string(disasm_start);
-    } else {
-      host_disassembly_ = std::string("Shader disassembly not available.");
-    }
+    glGetProgramBinary(program_, binary_length, &binary_length,
+                       &binary_format_, translated_binary_.data());
+    const char* disasm_start = FindHostDisassembly();
 
     // Append to shader dump.
     if (!FLAGS_dump_shaders.empty()) {
@@ -432,6 +566,35 @@ bool GL4Shader::CompileProgram(std::string source) {
   return true;
 }
 
+const char* GL4Shader::FindHostDisassembly() {
+  // If we are on nvidia, we can find the disassembly string.
+  // I haven't been able to figure out from the format how to do this
+  // without a search like this.
+  const char* disasm_start = nullptr;
+  size_t search_offset = 0;
+  char* search_start = reinterpret_cast<char*>(translated_binary_.data());
+  while (true) {
+    auto p = reinterpret_cast<char*>(
+        memchr(translated_binary_.data() + search_offset, '!',
+               translated_binary_.size() - search_offset));
+    if (!p) {
+      break;
+    }
+    if (p[0] == '!' && p[1] == '!' && p[2] == 'N' && p[3] == 'V') {
+      disasm_start = p;
+      break;
+    }
+    search_offset = p - search_start;
+    ++search_offset;
+  }
+  if (disasm_start) {
+    host_disassembly_ = std::string(disasm_start);
+  } else {
+    host_disassembly_ = std::string("Shader disassembly not available.");
+  }
+  return disasm_start;
+}
+
 }  // namespace gl4
 }  // namespace gpu
 }  // namespace xe
@@ -10,6 +10,7 @@
 #ifndef XENIA_GPU_GL4_GL4_SHADER_H_
 #define XENIA_GPU_GL4_GL4_SHADER_H_
 
+#include <atomic>
 #include <string>
 
 #include "xenia/gpu/shader.h"
@@ -19,6 +20,7 @@ namespace xe {
 namespace gpu {
 namespace gl4 {
 
+class GL4ShaderCacheFile;
 class GL4ShaderTranslator;
 
 class GL4Shader : public Shader {
@@ -29,20 +31,53 @@ class GL4Shader : public Shader {
 
   GLuint program() const { return program_; }
   GLuint vao() const { return vao_; }
+  // Float constants at the start of the shader's half of the constant file
+  // that the program copies into temporaries. Valid once prepared.
+  uint32_t temp_register_count() const { return temp_register_count_; }
 
+  // cache_file may be null. If the shader is found in it translation and
+  // compilation are skipped; otherwise the compiled shader is added to it.
   bool PrepareVertexShader(GL4ShaderTranslator* shader_translator,
-                           const xenos::xe_gpu_program_cntl_t& program_cntl);
+                           const xenos::xe_gpu_program_cntl_t& program_cntl,
+                           GL4ShaderCacheFile* cache_file);
   bool PreparePixelShader(GL4ShaderTranslator* shader_translator,
-                          const xenos::xe_gpu_program_cntl_t& program_cntl);
+                          const xenos::xe_gpu_program_cntl_t& program_cntl,
+                          GL4ShaderCacheFile* cache_file);
+
+  // Asynchronous preparation: the drawing thread calls BeginAsyncPrepare and
+  // hands the shader to a thread with a shared context that calls
+  // PrepareProgram followed by EndAsyncPrepare. Vertex array objects aren't
+  // shared between contexts so they are created in BeginAsyncPrepare.
+  // is_valid() is meaningless while is_compile_pending().
+  bool BeginAsyncPrepare();
+  bool PrepareProgram(GL4ShaderTranslator* shader_translator,
+                      const xenos::xe_gpu_program_cntl_t& program_cntl,
+                      GL4ShaderCacheFile* cache_file);
+  void EndAsyncPrepare(bool is_valid);
+  bool is_compile_pending() const {
+    return compile_pending_.load(std::memory_order_acquire);
+  }
 
  protected:
   std::string GetHeader();
   std::string GetFooter();
   bool PrepareVertexArrayObject();
+  bool CompileVertexProgram(GL4ShaderTranslator* shader_translator,
+                            const xenos::xe_gpu_program_cntl_t& program_cntl);
+  bool CompilePixelProgram(GL4ShaderTranslator* shader_translator,
+                           const xenos::xe_gpu_program_cntl_t& program_cntl);
+  bool LoadCachedProgram(GL4ShaderCacheFile* cache_file,
+                         const xenos::xe_gpu_program_cntl_t& program_cntl);
+  bool LoadProgramBinary(GLenum binary_format, const uint8_t* binary,
+                         size_t binary_length);
   bool CompileProgram(std::string source);
+  const char* FindHostDisassembly();
 
   GLuint program_;
+  GLenum binary_format_;
   GLuint vao_;
+  uint32_t temp_register_count_;
+  std::atomic<bool> compile_pending_;
 };
 
 }  // namespace gl4
@@ -0,0 +1,244 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/gl4/gl4_shader_cache_file.h"
+
+#include <cstring>
+
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/string.h"
+#include "xenia/gpu/gl4/gl4_shader_translator.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+// 'XSC1'
+static const uint32_t kFileMagic = 0x31435358;
+// Bump whenever the file layout changes.
+static const uint32_t kFileVersion = 1;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t fingerprint;
+};
+static_assert(sizeof(FileHeader) == 16, "header layout");
+
+struct RecordHeader {
+  uint64_t data_hash;
+  uint32_t shader_type;
+  uint32_t program_cntl;
+  uint32_t source_length;
+  uint32_t binary_format;
+  uint32_t binary_length;
+  uint32_t reserved;
+};
+static_assert(sizeof(RecordHeader) == 32, "record layout");
+
+GL4ShaderCacheFile::~GL4ShaderCacheFile() {
+  WaitForLoad();
+  if (file_) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+std::unique_ptr<GL4ShaderCacheFile> GL4ShaderCacheFile::Open(
+    const std::wstring& root_path) {
+  auto cache_file =
+      std::unique_ptr<GL4ShaderCacheFile>(new GL4ShaderCacheFile());
+
+  // Program binaries are only valid for the exact driver that produced them.
+  std::string driver_id = std::to_string(GL4ShaderTranslator::kVersion);
+  for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    auto value = reinterpret_cast<const char*>(glGetString(name));
+    driver_id += '\n';
+    driver_id += value ? value : "";
+  }
+  cache_file->fingerprint_ = XXH64(driver_id.data(), driver_id.size(), 0);
+
+  char file_name[64];
+  std::snprintf(file_name, xe::countof(file_name), "gl4_%.16llX.xsc",
+                static_cast<unsigned long long>(cache_file->fingerprint_));
+  auto base_path = xe::to_absolute_path(root_path);
+  xe::filesystem::CreateFolder(base_path);
+  cache_file->path_ = xe::join_paths(base_path, xe::to_wstring(file_name));
+
+  // Only one instance appends to a file; the others use it read-only.
+  cache_file->write_lock_ =
+      xe::filesystem::FileLock::TryAcquire(cache_file->path_ + L".lock");
+
+  auto file_ptr = cache_file.get();
+  cache_file->load_thread_ = xe::threading::Thread::Create({}, [file_ptr]() {
+    if (!file_ptr->Load()) {
+      // Missing, truncated header, or stale. Start over.
+      file_ptr->records_.clear();
+      file_ptr->file_data_.clear();
+      if (!file_ptr->write_lock_) {
+        XELOGGPU("Shader cache file is owned by another instance and not "
+                 "usable yet");
+        return;
+      }
+      if (!file_ptr->Create()) {
+        XELOGE("Unable to create shader cache file");
+        return;
+      }
+    }
+    XELOGGPU("Shader cache file: %d shaders",
+             int(file_ptr->records_.size()));
+  });
+  cache_file->load_thread_->set_name("GL4 Shader Cache Load");
+  return cache_file;
+}
+
+void GL4ShaderCacheFile::WaitForLoad() {
+  if (!load_thread_) {
+    return;
+  }
+  xe::threading::Wait(load_thread_.get(), false);
+  load_thread_.reset();
+}
+
+bool GL4ShaderCacheFile::Load() {
+  if (!xe::filesystem::PathExists(path_)) {
+    return false;
+  }
+  FILE* file = xe::filesystem::OpenFile(path_, "rb");
+  if (!file) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (file_size < long(sizeof(FileHeader))) {
+    fclose(file);
+    return false;
+  }
+  file_data_.resize(file_size);
+  bool read_ok =
+      fread(file_data_.data(), 1, file_size, file) == size_t(file_size);
+  fclose(file);
+  if (!read_ok) {
+    return false;
+  }
+
+  auto header = reinterpret_cast<const FileHeader*>(file_data_.data());
+  if (header->magic != kFileMagic || header->version != kFileVersion ||
+      header->fingerprint != fingerprint_) {
+    return false;
+  }
+
+  // Walk records. A partial trailing record (from a crash mid-write) ends the
+  // walk and is overwritten by subsequent appends.
+  size_t offset = sizeof(FileHeader);
+  while (offset + sizeof(RecordHeader) <= file_data_.size()) {
+    auto record_header =
+        reinterpret_cast<const RecordHeader*>(file_data_.data() + offset);
+    size_t record_size = sizeof(RecordHeader) +
+                         xe::round_up(record_header->source_length, 4) +
+                         xe::round_up(record_header->binary_length, 4);
+    if (offset + record_size > file_data_.size()) {
+      break;
+    }
+    const uint8_t* p = file_data_.data() + offset + sizeof(RecordHeader);
+    ShaderRecord record;
+    record.shader_type = ShaderType(record_header->shader_type);
+    record.data_hash = record_header->data_hash;
+    record.program_cntl = record_header->program_cntl;
+    record.source = reinterpret_cast<const char*>(p);
+    record.source_length = record_header->source_length;
+    p += xe::round_up(record_header->source_length, 4);
+    record.binary_format = record_header->binary_format;
+    record.binary = p;
+    record.binary_length = record_header->binary_length;
+    records_[{record.shader_type, record.data_hash, record.program_cntl}] =
+        record;
+    offset += record_size;
+  }
+
+  if (!write_lock_) {
+    // Use whatever the writing instance has published so far. A partial
+    // record at the end is just one it is still writing.
+    return true;
+  }
+  if (offset == file_data_.size()) {
+    file_ = xe::filesystem::OpenFile(path_, "ab");
+    return file_ != nullptr;
+  }
+
+  // Partial tail; rewrite only the valid prefix so that new appends don't
+  // leave stale bytes behind.
+  file_ = xe::filesystem::OpenFile(path_, "wb");
+  if (!file_) {
+    return false;
+  }
+  fwrite(file_data_.data(), 1, offset, file_);
+  fflush(file_);
+  return true;
+}
+
+bool GL4ShaderCacheFile::Create() {
+  file_ = xe::filesystem::OpenFile(path_, "wb");
+  if (!file_) {
+    return false;
+  }
+  FileHeader header;
+  header.magic = kFileMagic;
+  header.version = kFileVersion;
+  header.fingerprint = fingerprint_;
+  fwrite(&header, sizeof(header), 1, file_);
+  fflush(file_);
+  return true;
+}
+
+const GL4ShaderCacheFile::ShaderRecord* GL4ShaderCacheFile::Lookup(
+    ShaderType shader_type, uint64_t data_hash, uint32_t program_cntl) {
+  WaitForLoad();
+  auto it = records_.find({shader_type, data_hash, program_cntl});
+  return it != records_.end() ? &it->second : nullptr;
+}
+
+void GL4ShaderCacheFile::Append(ShaderType shader_type, uint64_t data_hash,
+                                uint32_t program_cntl,
+                                const std::string& source,
+                                GLenum binary_format,
+                                const std::vector<uint8_t>& binary) {
+  WaitForLoad();
+  if (!file_) {
+    return;
+  }
+
+  RecordHeader record_header;
+  record_header.data_hash = data_hash;
+  record_header.shader_type = uint32_t(shader_type);
+  record_header.program_cntl = program_cntl;
+  record_header.source_length = uint32_t(source.size());
+  record_header.binary_format = binary.empty() ? 0 : binary_format;
+  record_header.binary_length = uint32_t(binary.size());
+  record_header.reserved = 0;
+
+  static const uint8_t kPadding[4] = {0};
+  fwrite(&record_header, sizeof(record_header), 1, file_);
+  fwrite(source.data(), 1, source.size(), file_);
+  fwrite(kPadding, 1, xe::round_up(source.size(), 4) - source.size(), file_);
+  if (!binary.empty()) {
+    fwrite(binary.data(), 1, binary.size(), file_);
+    fwrite(kPadding, 1, xe::round_up(binary.size(), 4) - binary.size(),
+           file_);
+  }
+  fflush(file_);
+}
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,116 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_GL4_GL4_SHADER_CACHE_FILE_H_
+#define XENIA_GPU_GL4_GL4_SHADER_CACHE_FILE_H_
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/threading.h"
+#include "xenia/gpu/shader.h"
+#include "xenia/ui/gl/gl_context.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+// On-disk store of translated shaders and their linked program binaries.
+// Files are append-only: each newly compiled shader is written as a record
+// as soon as it links so that a crash only loses the tail of the file. When
+// a key appears more than once the last record wins.
+//
+// Shaders are keyed by their microcode hash and the program_cntl they were
+// translated with. Files are keyed by the translator version and the GL
+// vendor/renderer/version strings so that neither stale translations nor
+// binaries from another driver are ever used.
+//
+// Several emulator instances may share a cache directory. The first to open
+// the file holds its lock and appends to it; the others only read what had
+// been written at open time and never modify the file.
+//
+// The file is read on a background thread so that opening it doesn't stall
+// startup; the first lookup waits for the load to complete. Lookups and
+// appends must all come from the same thread (the one compiling shaders).
+class GL4ShaderCacheFile {
+ public:
+  struct ShaderRecord {
+    ShaderType shader_type;
+    uint64_t data_hash;
+    uint32_t program_cntl;
+    // Translated GLSL, including the GL4Shader header and footer.
+    const char* source;
+    uint32_t source_length;
+    // Program binary from glGetProgramBinary, if the driver provided one.
+    GLenum binary_format;
+    const uint8_t* binary;
+    uint32_t binary_length;
+  };
+
+  ~GL4ShaderCacheFile();
+
+  // Opens or creates the cache file for the current GL context and starts
+  // loading it in the background.
+  static std::unique_ptr<GL4ShaderCacheFile> Open(
+      const std::wstring& root_path);
+
+  // Returns the record for the given shader, if present.
+  const ShaderRecord* Lookup(ShaderType shader_type, uint64_t data_hash,
+                             uint32_t program_cntl);
+
+  // Appends a shader to the file. binary may be empty.
+  void Append(ShaderType shader_type, uint64_t data_hash,
+              uint32_t program_cntl, const std::string& source,
+              GLenum binary_format, const std::vector<uint8_t>& binary);
+
+ private:
+  struct RecordKey {
+    ShaderType shader_type;
+    uint64_t data_hash;
+    uint32_t program_cntl;
+    bool operator==(const RecordKey& other) const {
+      return shader_type == other.shader_type &&
+             data_hash == other.data_hash &&
+             program_cntl == other.program_cntl;
+    }
+  };
+  struct RecordKeyHasher {
+    size_t operator()(const RecordKey& key) const {
+      return size_t(key.data_hash ^ (uint64_t(key.program_cntl) << 1) ^
+                    uint64_t(key.shader_type));
+    }
+  };
+
+  GL4ShaderCacheFile() = default;
+
+  void WaitForLoad();
+  bool Load();
+  bool Create();
+
+  std::wstring path_;
+  uint64_t fingerprint_ = 0;
+
+  std::unique_ptr<xe::threading::Thread> load_thread_;
+  // Held while this instance is the one appending to the file.
+  std::unique_ptr<xe::filesystem::FileLock> write_lock_;
+  FILE* file_ = nullptr;
+  // Contents of the file as loaded at open time. Records point into this.
+  std::vector<uint8_t> file_data_;
+  std::unordered_map<RecordKey, ShaderRecord, RecordKeyHasher> records_;
+};
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_GL4_GL4_SHADER_CACHE_FILE_H_
@@ -10,6 +10,7 @@
 #include "xenia/gpu/gl4/gl4_shader_translator.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
@@ -60,12 +61,64 @@ const char* GetVertexFormatTypeName(const GL4Shader::BufferDescElement& el) {
   }
 }
 
+// Vertex fetch inputs are the raw big endian dwords of the element.
+const char* GetVertexFormatRawTypeName(const GL4Shader::BufferDescElement& el) {
+  static const char* type_names[] = {"uint", "uint", "uvec2", "uvec3",
+                                     "uvec4"};
+  return type_names[GetVertexFormatSizeInWords(el.format)];
+}
+
+// Returns the GLSL function (see GL4Shader::CompileVertexProgram) that turns
+// the byte swapped raw input into the fetched value. Decoders of integer
+// formats also take is_signed and is_normalized.
+const char* GetVertexFormatDecoder(const GL4Shader::BufferDescElement& el,
+                                   bool* out_takes_flags) {
+  *out_takes_flags = true;
+  switch (el.format) {
+    case VertexFormat::k_8_8_8_8:
+      return "xe_unpack_8_8_8_8";
+    case VertexFormat::k_2_10_10_10:
+      return "xe_unpack_2_10_10_10";
+    case VertexFormat::k_16_16:
+      return "xe_unpack_16_16";
+    case VertexFormat::k_16_16_16_16:
+      return "xe_unpack_16_16_16_16";
+    case VertexFormat::k_32:
+    case VertexFormat::k_32_32:
+    case VertexFormat::k_32_32_32_32:
+      return "xe_unpack_32";
+    default:
+      break;
+  }
+  *out_takes_flags = false;
+  switch (el.format) {
+    case VertexFormat::k_10_11_11:
+      return "xe_unpack_10_11_11";
+    case VertexFormat::k_16_16_FLOAT:
+      return "unpackHalf2x16";
+    case VertexFormat::k_16_16_16_16_FLOAT:
+      return "xe_unpack_16_16_16_16_float";
+    default:
+      return "uintBitsToFloat";
+  }
+}
+
 GL4ShaderTranslator::GL4ShaderTranslator() : output_(kOutputCapacity) {}
 
 GL4ShaderTranslator::~GL4ShaderTranslator() = default;
 
+uint32_t GL4ShaderTranslator::GetTempRegisterCount(
+    ShaderType shader_type, const xenos::xe_gpu_program_cntl_t& program_cntl) {
+  uint32_t temp_regs = program_cntl.vs_regs + program_cntl.ps_regs + 1;
+  if (shader_type == ShaderType::kPixel) {
+    temp_regs = std::max(16u, temp_regs);
+  }
+  return temp_regs;
+}
+
 void GL4ShaderTranslator::Reset(GL4Shader* shader) {
   output_.Reset();
+  std::memset(used_registers_, 0, sizeof(used_registers_));
   shader_type_ = shader->type();
   dwords_ = shader->data();
 }
@@ -82,6 +135,12 @@ std::string GL4ShaderTranslator::TranslateVertexShader(
   assert_true(program_cntl.vs_export_mode == 0 ||
               program_cntl.vs_export_mode == 2);
 
+  // Translate the body first so that only the registers it uses need to be
+  // declared.
+  TranslateBlocks(vertex_shader);
+  std::string body = output_.to_string();
+  output_.Reset();
+
   // Add vertex shader input.
   uint32_t el_index = 0;
   const auto& buffer_inputs = vertex_shader->buffer_inputs();
@@ -89,11 +148,10 @@ std::string GL4ShaderTranslator::TranslateVertexShader(
     const auto& input = buffer_inputs.descs[n];
     for (uint32_t m = 0; m < input.element_count; m++) {
       const auto& el = input.elements[m];
-      const char* type_name = GetVertexFormatTypeName(el);
       const auto& fetch = el.vtx_fetch;
       uint32_t fetch_slot = fetch.const_index * 3 + fetch.const_index_sel;
-      Append("layout(location = %d) in %s vf%u_%d;\n", el_index, type_name,
-             fetch_slot, fetch.offset);
+      Append("layout(location = %d) in %s vf%u_%d_raw;\n", el_index,
+             GetVertexFormatRawTypeName(el), fetch_slot, fetch.offset);
       el_index++;
     }
   }
@@ -101,10 +159,32 @@ std::string GL4ShaderTranslator::TranslateVertexShader(
   // Vertex shader main() header.
   Append("void processVertex(const in StateData state) {\n");
 
-  // Add temporaries for any registers we may use.
-  uint32_t temp_regs = program_cntl.vs_regs + program_cntl.ps_regs;
-  for (uint32_t n = 0; n <= temp_regs; n++) {
-    Append("  vec4 r%d = state.float_consts[%d];\n", n, n);
+  // Decode the vertex fetch inputs, byte swapping them first.
+  for (uint32_t n = 0; n < buffer_inputs.count; n++) {
+    const auto& input = buffer_inputs.descs[n];
+    for (uint32_t m = 0; m < input.element_count; m++) {
+      const auto& el = input.elements[m];
+      const auto& fetch = el.vtx_fetch;
+      uint32_t fetch_slot = fetch.const_index * 3 + fetch.const_index_sel;
+      bool takes_flags;
+      const char* decoder = GetVertexFormatDecoder(el, &takes_flags);
+      Append("  %s vf%u_%d = %s(xe_bswap(vf%u_%d_raw)",
+             GetVertexFormatTypeName(el), fetch_slot, fetch.offset, decoder,
+             fetch_slot, fetch.offset);
+      if (takes_flags) {
+        Append(", %s, %s", el.is_signed ? "true" : "false",
+               el.is_normalized ? "true" : "false");
+      }
+      Append(");\n");
+    }
+  }
+
+  // Add temporaries for any registers we use.
+  uint32_t temp_regs = GetTempRegisterCount(ShaderType::kVertex, program_cntl);
+  for (uint32_t n = 0; n < temp_regs; n++) {
+    if (is_register_used(n)) {
+      Append("  vec4 r%d = state.float_consts[%d];\n", n, n);
+    }
   }
 
 #if FLOW_CONTROL
@@ -124,7 +204,7 @@ std::string GL4ShaderTranslator::TranslateVertexShader(
   Append("  int a0 = 0;\n");      // Address register.
 
   // Execute blocks.
-  TranslateBlocks(vertex_shader);
+  output_.Append(body);
 
   Append("}\n");
   return output_.to_string();
@@ -139,13 +219,21 @@ std::string GL4ShaderTranslator::TranslatePixelShader(
   // If the same PS is used with different VS that output different amounts
   // (and less than the number of required registers), things may die.
 
+  // Translate the body first so that only the registers it uses need to be
+  // declared.
+  TranslateBlocks(pixel_shader);
+  std::string body = output_.to_string();
+  output_.Reset();
+
   // Pixel shader main() header.
   Append("void processFragment(const in StateData state) {\n");
 
-  // Add temporary registers.
-  uint32_t temp_regs = program_cntl.vs_regs + program_cntl.ps_regs;
-  for (uint32_t n = 0; n <= std::max(15u, temp_regs); n++) {
-    Append("  vec4 r%d = state.float_consts[%d];\n", n, n + 256);
+  // Add temporary registers we use.
+  uint32_t temp_regs = GetTempRegisterCount(ShaderType::kPixel, program_cntl);
+  for (uint32_t n = 0; n < temp_regs; n++) {
+    if (is_register_used(n)) {
+      Append("  vec4 r%d = state.float_consts[%d];\n", n, n + 256);
+    }
   }
   Append("  vec4 t;\n");
   Append("  vec4 pv;\n");   // Previous Vector result.
@@ -155,11 +243,13 @@ std::string GL4ShaderTranslator::TranslatePixelShader(
 
   // Bring registers local.
   for (uint32_t n = 0; n < kMaxInterpolators; n++) {
-    Append("  r%d = vtx.o[%d];\n", n, n);
+    if (is_register_used(n)) {
+      Append("  r%d = vtx.o[%d];\n", n, n);
+    }
   }
 
   // Execute blocks.
-  TranslateBlocks(pixel_shader);
+  output_.Append(body);
 
   Append("}\n");
   return output_.to_string();
@@ -200,7 +290,7 @@ void GL4ShaderTranslator::AppendSrcReg(const ucode::instr_alu_t& op,
     if (num & 0x80) {
       Append("abs(");
     }
-    Append("r%u", num & 0x7F);
+    Append("r%u", UseRegister(num));
     if (num & 0x80) {
       Append(")");
     }
@@ -453,7 +543,7 @@ void GL4ShaderTranslator::AppendOpDestRegName(const ucode::instr_alu_t& op,
   if (!op.export_data) {
     // Register.
     // TODO(benvanik): relative? abs? etc
-    Append("r%u", dest_num);
+    Append("r%u", UseRegister(dest_num));
   } else {
     // Export.
     switch (shader_type_) {
@@ -1433,7 +1523,7 @@ void GL4ShaderTranslator::PrintDestFetch(uint32_t dst_reg, uint32_t dst_swiz) {
 }
 
 void GL4ShaderTranslator::AppendFetchDest(uint32_t dst_reg, uint32_t dst_swiz) {
-  Append("r%u.", dst_reg);
+  Append("r%u.", UseRegister(dst_reg));
   for (int i = 0; i < 4; i++) {
     Append("%c", chan_names[dst_swiz & 0x7]);
     dst_swiz >>= 3;
@@ -1827,7 +1917,7 @@ bool GL4ShaderTranslator::TranslateVertexFetch(
 
   // Translate.
   Append("  ");
-  Append("r%u.xyzw", vtx->dst_reg);
+  Append("r%u.xyzw", UseRegister(vtx->dst_reg));
   Append(" = vec4(");
   uint32_t fetch_slot = vtx->const_index * 3 + vtx->const_index_sel;
   // TODO(benvanik): detect xyzw = xyzw, etc.
@@ -1844,7 +1934,7 @@ bool GL4ShaderTranslator::TranslateVertexFetch(
       // ?
       Append("?");
     } else if ((dst_swiz & 0x7) == 7) {
-      Append("r%u.%c", vtx->dst_reg, chan_names[i]);
+      Append("r%u.%c", UseRegister(vtx->dst_reg), chan_names[i]);
     } else {
       Append("vf%u_%d.%c", fetch_slot, vtx->offset, chan_names[dst_swiz & 0x3]);
     }
@@ -1968,7 +2058,7 @@ bool GL4ShaderTranslator::TranslateTextureFetch(
   // TODO(benvanik): if sampler == null, set to invalid color.
   Append("  if (state.texture_samplers[%d].x != 0) {\n", tex->const_idx & 0xF);
   if (tex->dimension == DIMENSION_CUBE) {
-    Append("    t.xyz = r%u.", tex->src_reg);
+    Append("    t.xyz = r%u.", UseRegister(tex->src_reg));
     src_swiz = tex->src_swiz;
     for (int i = 0; i < src_component_count; i++) {
       Append("%c", chan_names[src_swiz & 0x3]);
@@ -1982,7 +2072,7 @@ bool GL4ShaderTranslator::TranslateTextureFetch(
     Append("    t = texture(");
     Append("%s(state.texture_samplers[%d])", sampler_type,
            tex->const_idx & 0xF);
-    Append(", r%u.", tex->src_reg);
+    Append(", r%u.", UseRegister(tex->src_reg));
     src_swiz = tex->src_swiz;
     for (int i = 0; i < src_component_count; i++) {
       Append("%c", chan_names[src_swiz & 0x3]);
@@ -1991,7 +2081,7 @@ bool GL4ShaderTranslator::TranslateTextureFetch(
     Append(");\n");
   }
   Append("  } else {\n");
-  Append("    t = vec4(r%u.", tex->src_reg);
+  Append("    t = vec4(r%u.", UseRegister(tex->src_reg));
   src_swiz = tex->src_swiz;
   for (int i = 0; i < src_component_count; i++) {
     Append("%c", chan_names[src_swiz & 0x3]);
@@ -2010,7 +2100,7 @@ bool GL4ShaderTranslator::TranslateTextureFetch(
   }
   Append("  }\n");
 
-  Append("  r%u.xyzw = vec4(", tex->dst_reg);
+  Append("  r%u.xyzw = vec4(", UseRegister(tex->dst_reg));
   uint32_t dst_swiz = tex->dst_swiz;
   for (int i = 0; i < 4; i++) {
     if (i) {
@@ -2025,7 +2115,7 @@ bool GL4ShaderTranslator::TranslateTextureFetch(
       Append("?");
       assert_always();
     } else if ((dst_swiz & 0x7) == 7) {
-      Append("r%u.%c", tex->dst_reg, chan_names[i]);
+      Append("r%u.%c", UseRegister(tex->dst_reg), chan_names[i]);
     } else {
       Append("t.%c", chan_names[dst_swiz & 0x3]);
     }
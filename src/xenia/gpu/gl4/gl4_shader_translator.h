@@ -25,10 +25,19 @@ namespace gl4 {
 class GL4ShaderTranslator {
  public:
   static const uint32_t kMaxInterpolators = 16;
+  // Bump whenever the generated GLSL changes (including the GL4Shader headers)
+  // so that persisted shader caches are discarded.
+  static const uint32_t kVersion = 3;
 
   GL4ShaderTranslator();
   ~GL4ShaderTranslator();
 
+  // Number of temporary registers the translated code declares. They are
+  // initialized from the first float constants of the shader's half of the
+  // constant file, so those are read as well.
+  static uint32_t GetTempRegisterCount(
+      ShaderType shader_type, const xenos::xe_gpu_program_cntl_t& program_cntl);
+
   std::string TranslateVertexShader(
       GL4Shader* vertex_shader,
       const xenos::xe_gpu_program_cntl_t& program_cntl);
@@ -42,11 +51,23 @@ class GL4ShaderTranslator {
 
   static const int kOutputCapacity = 64 * 1024;
   StringBuffer output_;
+  // Temporary registers referenced by the translated code. Only these get
+  // declared, which keeps the driver from chewing through unused ones.
+  uint64_t used_registers_[2];
 
   bool is_vertex_shader() const { return shader_type_ == ShaderType::kVertex; }
   bool is_pixel_shader() const { return shader_type_ == ShaderType::kPixel; }
 
   void Reset(GL4Shader* shader);
+  // Marks the register as used and returns its number.
+  uint32_t UseRegister(uint32_t num) {
+    num &= 0x7F;
+    used_registers_[num / 64] |= uint64_t(1) << (num % 64);
+    return num;
+  }
+  bool is_register_used(uint32_t num) const {
+    return (used_registers_[num / 64] >> (num % 64)) & 1;
+  }
 
   void AppendSrcReg(const ucode::instr_alu_t& op, int i);
   void AppendSrcReg(const ucode::instr_alu_t& op, uint32_t num, uint32_t type,
@@ -77,3 +77,51 @@ project("xenia-gpu-gl4-trace-viewer")
       "2>&1",
       "1>scratch/stdout-trace-viewer.txt",
     })
+
+group("src")
+project("xenia-gpu-gl4-trace-bench")
+  uuid("e901f9b2-227a-4072-a57c-0121ac941bc9")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "elemental-forms",
+    "gflags",
+    "glew",
+    "xenia-apu",
+    "xenia-apu-nop",
+    "xenia-apu-xaudio2",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+    "xenia-debug",
+    "xenia-gpu",
+    "xenia-gpu-gl4",
+    "xenia-hid-nop",
+    "xenia-hid-winkey",
+    "xenia-hid-xinput",
+    "xenia-kernel",
+    "xenia-ui",
+    "xenia-ui-gl",
+    "xenia-vfs",
+  })
+  defines({
+    "GLEW_STATIC=1",
+    "GLEW_MX=1",
+  })
+  includedirs({
+    project_root.."/third_party/elemental-forms/src",
+    project_root.."/build_tools/third_party/gflags/src",
+  })
+  files({
+    "trace_bench_main.cc",
+    "../../base/main_"..platform_suffix..".cc",
+  })
+
+  filter("platforms:Windows")
+    debugdir(project_root)
+    debugargs({
+      "--flagfile=scratch/flags.txt",
+      "2>&1",
+      "1>scratch/stdout-trace-bench.txt",
+    })
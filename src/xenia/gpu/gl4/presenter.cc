@@ -0,0 +1,275 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/gl4/presenter.h"
+
+#include <algorithm>
+
+#include "xenia/base/logging.h"
+#include "xenia/gpu/gl4/gl4_gpu_flags.h"
+#include "xenia/gpu/gpu_flags.h"
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+Presenter::Presenter() = default;
+
+Presenter::~Presenter() = default;
+
+bool Presenter::Initialize(std::unique_ptr<xe::ui::GraphicsContext> context,
+                           std::function<void()> request_present) {
+  context_ = std::move(context);
+  request_present_ = std::move(request_present);
+  // Without vsync the display never catches up with a fast title, so only the
+  // newest frame is worth showing.
+  skip_frames_ = FLAGS_present_frame_skip || !FLAGS_vsync;
+  buffers_.resize(std::min(std::max(FLAGS_present_buffer_count, 2), 8));
+
+  running_ = true;
+  thread_ = xe::threading::Thread::Create(
+      {}, [this]() { PresenterThreadMain(); });
+  thread_->set_name("GL4 Presenter");
+  return true;
+}
+
+void Presenter::Shutdown() {
+  if (thread_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      running_ = false;
+    }
+    cond_.notify_all();
+    xe::threading::Wait(thread_.get(), false);
+    thread_.reset();
+  }
+  if (frames_skipped_) {
+    XELOGI("Presenter skipped %lld frames",
+           static_cast<long long>(frames_skipped_));
+  }
+
+  // The buffers stay around (empty) until we are destroyed in case the
+  // command processor or display is still using one.
+  if (context_) {
+    context_->MakeCurrent();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& buffer : buffers_) {
+      if (buffer.fence) {
+        glDeleteSync(buffer.fence);
+        buffer.fence = nullptr;
+      }
+      glDeleteTextures(1, &buffer.texture);
+      buffer.texture = 0;
+    }
+    queued_frames_.clear();
+    ready_frames_.clear();
+    writing_buffer_ = SIZE_MAX;
+    displayed_buffer_ = SIZE_MAX;
+    context_->ClearCurrent();
+  }
+}
+
+void Presenter::WaitForFreeBuffer() {
+  SCOPE_profile_cpu_f("gpu");
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this]() {
+    return !running_ ||
+           std::any_of(buffers_.begin(), buffers_.end(), [](Buffer& buffer) {
+             return buffer.state == BufferState::kFree;
+           });
+  });
+}
+
+GLuint Presenter::BeginFrame(uint32_t width, uint32_t height) {
+  SCOPE_profile_cpu_f("gpu");
+  Buffer* buffer = nullptr;
+  GLsync fence = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() {
+      if (!running_) {
+        return true;
+      }
+      for (size_t i = 0; i < buffers_.size(); ++i) {
+        if (buffers_[i].state == BufferState::kFree) {
+          writing_buffer_ = i;
+          return true;
+        }
+      }
+      return false;
+    });
+    if (!running_) {
+      return 0;
+    }
+    buffer = &buffers_[writing_buffer_];
+    buffer->state = BufferState::kWriting;
+    fence = buffer->fence;
+    buffer->fence = nullptr;
+  }
+
+  // Don't overwrite the buffer until the display is done with it. This waits
+  // on the GPU.
+  if (fence) {
+    glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fence);
+  }
+
+  if (buffer->width != width || buffer->height != height) {
+    glDeleteTextures(1, &buffer->texture);
+    glCreateTextures(GL_TEXTURE_2D, 1, &buffer->texture);
+    glTextureStorage2D(buffer->texture, 1, GL_RGBA8, width, height);
+    buffer->width = width;
+    buffer->height = height;
+  }
+  return buffer->texture;
+}
+
+void Presenter::EndFrame(GLsync fence) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (writing_buffer_ == SIZE_MAX) {
+      // Shut down since BeginFrame.
+      glDeleteSync(fence);
+      return;
+    }
+    auto& buffer = buffers_[writing_buffer_];
+    buffer.state = BufferState::kQueued;
+    buffer.fence = fence;
+    queued_frames_.push_back(writing_buffer_);
+    writing_buffer_ = SIZE_MAX;
+  }
+  cond_.notify_all();
+}
+
+GLuint Presenter::BeginPresent(uint32_t* out_width, uint32_t* out_height) {
+  GLuint texture = 0;
+  GLsync fence = nullptr;
+  bool released = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_frames_.empty()) {
+      // The buffer on screen keeps the fence of its last read, which the
+      // command processor waits on before reusing it.
+      if (displayed_buffer_ != SIZE_MAX) {
+        buffers_[displayed_buffer_].state = BufferState::kFree;
+        released = true;
+      }
+      displayed_buffer_ = ready_frames_.front();
+      ready_frames_.pop_front();
+      auto& buffer = buffers_[displayed_buffer_];
+      buffer.state = BufferState::kDisplayed;
+      fence = buffer.fence;
+      buffer.fence = nullptr;
+    }
+    if (displayed_buffer_ == SIZE_MAX) {
+      return 0;
+    }
+    auto& buffer = buffers_[displayed_buffer_];
+    texture = buffer.texture;
+    *out_width = buffer.width;
+    *out_height = buffer.height;
+  }
+  if (released) {
+    cond_.notify_all();
+  }
+
+  // Already signaled (the presenter thread waited for it), but waiting makes
+  // the writes visible to this context.
+  if (fence) {
+    glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fence);
+  }
+  return texture;
+}
+
+void Presenter::EndPresent(GLsync fence) {
+  bool more_ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (displayed_buffer_ == SIZE_MAX) {
+      glDeleteSync(fence);
+      return;
+    }
+    auto& buffer = buffers_[displayed_buffer_];
+    if (buffer.fence) {
+      glDeleteSync(buffer.fence);
+    }
+    buffer.fence = fence;
+    more_ready = !ready_frames_.empty();
+  }
+  // Without frame skip every frame is shown, one per repaint.
+  if (more_ready) {
+    request_present_();
+  }
+}
+
+void Presenter::PresenterThreadMain() {
+  // With --thread_safe_gl only one context may be current at a time, so we
+  // only hold ours while touching GL.
+  if (!FLAGS_thread_safe_gl) {
+    context_->MakeCurrent();
+  }
+  while (true) {
+    size_t index;
+    GLsync fence;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock,
+                 [this]() { return !running_ || !queued_frames_.empty(); });
+      if (!running_) {
+        break;
+      }
+      index = queued_frames_.front();
+      fence = buffers_[index].fence;
+    }
+
+    // Waiting for the frame here keeps a slow frame on the GPU from holding
+    // up the display.
+    if (FLAGS_thread_safe_gl) {
+      context_->MakeCurrent();
+    }
+    {
+      SCOPE_profile_cpu_i("gpu", "xe::gpu::gl4::Presenter::WaitForFrame");
+      glClientWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_frames_.pop_front();
+      buffers_[index].state = BufferState::kReady;
+      ready_frames_.push_back(index);
+      if (skip_frames_) {
+        // Drop frames the display hasn't gotten to; they were never read,
+        // so they can be reused right away.
+        while (ready_frames_.size() > 1) {
+          auto& buffer = buffers_[ready_frames_.front()];
+          ready_frames_.pop_front();
+          glDeleteSync(buffer.fence);
+          buffer.fence = nullptr;
+          buffer.state = BufferState::kFree;
+          ++frames_skipped_;
+        }
+      }
+    }
+    if (FLAGS_thread_safe_gl) {
+      context_->ClearCurrent();
+    }
+    cond_.notify_all();
+
+    request_present_();
+  }
+  if (!FLAGS_thread_safe_gl) {
+    context_->ClearCurrent();
+  }
+}
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
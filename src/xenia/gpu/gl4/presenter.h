@@ -0,0 +1,106 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_GL4_PRESENTER_H_
+#define XENIA_GPU_GL4_PRESENTER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/base/threading.h"
+#include "xenia/ui/gl/gl_context.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+// Hands frames from the command processor to the display through a small
+// queue of frame buffers, so neither waits on the other.
+// The command processor copies each frame into a free buffer and queues it.
+// The presenter thread waits for it to finish on the GPU (on a context of its
+// own), applies the frame skip policy and asks the display to repaint. The
+// display draws the newest (or, without frame skip, oldest) ready frame.
+// Without frame skip the command processor only waits once every buffer is
+// queued or on screen; with it, older ready frames are dropped instead.
+class Presenter {
+ public:
+  Presenter();
+  ~Presenter();
+
+  // request_present is called from any thread when a frame is ready to be
+  // drawn.
+  bool Initialize(std::unique_ptr<xe::ui::GraphicsContext> context,
+                  std::function<void()> request_present);
+  void Shutdown();
+
+  uint64_t frames_skipped() const { return frames_skipped_; }
+
+  // Command processor thread. Returns a buffer of the given size to copy the
+  // next frame to, waiting if none is free. The GPU waits for the display to
+  // stop reading it before any later commands.
+  GLuint BeginFrame(uint32_t width, uint32_t height);
+  // Waits until BeginFrame won't, for when no context may be current during
+  // the wait (--thread_safe_gl).
+  void WaitForFreeBuffer();
+  // Queues the buffer from BeginFrame. fence is signaled when it's written.
+  void EndFrame(GLsync fence);
+
+  // Display thread. Returns the buffer to draw, or 0 if there is none yet.
+  GLuint BeginPresent(uint32_t* out_width, uint32_t* out_height);
+  // fence is signaled when the display is done reading the buffer.
+  void EndPresent(GLsync fence);
+
+ private:
+  enum class BufferState {
+    kFree,
+    kWriting,
+    kQueued,
+    kReady,
+    kDisplayed,
+  };
+  struct Buffer {
+    GLuint texture = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    BufferState state = BufferState::kFree;
+    // kQueued, kReady: signaled when the command processor has written it.
+    // kFree, kDisplayed: signaled when the display has last read it.
+    GLsync fence = nullptr;
+  };
+
+  void PresenterThreadMain();
+
+  std::unique_ptr<xe::ui::GraphicsContext> context_;
+  std::function<void()> request_present_;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  bool skip_frames_ = false;
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool running_ = false;
+  std::vector<Buffer> buffers_;
+  // Indices into buffers_ in submission order.
+  std::deque<size_t> queued_frames_;
+  std::deque<size_t> ready_frames_;
+  size_t writing_buffer_ = SIZE_MAX;
+  size_t displayed_buffer_ = SIZE_MAX;
+  uint64_t frames_skipped_ = 0;
+};
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_GL4_PRESENTER_H_
@@ -0,0 +1,263 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/gl4/readback_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+// Buffers are sized in these steps so that they can be reused by resolves
+// of slightly different sizes.
+const size_t kReadbackBufferGranularity = 64 * 1024;
+
+ReadbackCache::ReadbackCache() : memory_(nullptr) {}
+
+ReadbackCache::~ReadbackCache() { Shutdown(); }
+
+bool ReadbackCache::Initialize(Memory* memory) {
+  memory_ = memory;
+  gpu_thread_id_ = std::this_thread::get_id();
+  return true;
+}
+
+void ReadbackCache::Shutdown() {
+  for (auto& readback : pending_readbacks_) {
+    Retire(readback.get(), false);
+    WaitForFence(readback.get());
+    // A callback may still be running on another thread.
+    while (!readback->finished) {
+      xe::threading::MaybeYield();
+    }
+    free_readbacks_.push_back(std::move(readback));
+  }
+  pending_readbacks_.clear();
+  for (auto& readback : free_readbacks_) {
+    glUnmapNamedBuffer(readback->buffer);
+    glDeleteBuffers(1, &readback->buffer);
+  }
+  free_readbacks_.clear();
+  for (auto& staging_texture : staging_textures_) {
+    glDeleteTextures(1, &staging_texture.handle);
+  }
+  staging_textures_.clear();
+}
+
+ReadbackCache::Readback* ReadbackCache::AcquireReadback(uint32_t length) {
+  for (auto it = free_readbacks_.begin(); it != free_readbacks_.end(); ++it) {
+    if ((*it)->capacity >= length) {
+      pending_readbacks_.push_back(std::move(*it));
+      free_readbacks_.erase(it);
+      return pending_readbacks_.back().get();
+    }
+  }
+
+  auto readback = std::make_unique<Readback>();
+  readback->capacity = xe::round_up(length, kReadbackBufferGranularity);
+  glCreateBuffers(1, &readback->buffer);
+  glNamedBufferStorage(
+      readback->buffer, readback->capacity, nullptr,
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+  readback->host_ptr = reinterpret_cast<const uint8_t*>(glMapNamedBufferRange(
+      readback->buffer, 0, readback->capacity,
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT));
+  if (!readback->host_ptr) {
+    XELOGE("Unable to map readback buffer");
+    glDeleteBuffers(1, &readback->buffer);
+    return nullptr;
+  }
+  readback->fence = 0;
+  readback->ready_event = xe::threading::Event::CreateManualResetEvent(false);
+  readback->finished = true;
+  pending_readbacks_.push_back(std::move(readback));
+  return pending_readbacks_.back().get();
+}
+
+GLuint ReadbackCache::Downsample(Blitter* blitter, GLuint texture,
+                                 uint32_t texture_scale, bool is_depth,
+                                 Rect2D rect) {
+  GLint internal_format = 0;
+  glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_INTERNAL_FORMAT,
+                               &internal_format);
+  StagingTexture* staging_texture = nullptr;
+  for (auto& it : staging_textures_) {
+    if (it.internal_format == GLenum(internal_format)) {
+      staging_texture = &it;
+      break;
+    }
+  }
+  if (!staging_texture) {
+    staging_textures_.push_back({GLenum(internal_format), 0, 0, 0});
+    staging_texture = &staging_textures_.back();
+  }
+  if (staging_texture->width < rect.width ||
+      staging_texture->height < rect.height) {
+    // Grown to the largest resolve seen so far.
+    glDeleteTextures(1, &staging_texture->handle);
+    staging_texture->width = std::max(staging_texture->width, rect.width);
+    staging_texture->height = std::max(staging_texture->height, rect.height);
+    glCreateTextures(GL_TEXTURE_2D, 1, &staging_texture->handle);
+    glTextureParameteri(staging_texture->handle, GL_TEXTURE_BASE_LEVEL, 0);
+    glTextureParameteri(staging_texture->handle, GL_TEXTURE_MAX_LEVEL, 1);
+    glTextureStorage2D(staging_texture->handle, 1, internal_format,
+                       staging_texture->width, staging_texture->height);
+  }
+
+  int32_t scale = texture_scale;
+  Rect2D src_rect(rect.x * scale, rect.y * scale, rect.width * scale,
+                  rect.height * scale);
+  Rect2D dest_rect(0, 0, rect.width, rect.height);
+  if (is_depth) {
+    blitter->CopyDepthTexture(texture, src_rect, staging_texture->handle,
+                              dest_rect);
+  } else {
+    blitter->CopyColorTexture2D(texture, src_rect, staging_texture->handle,
+                                dest_rect, GL_LINEAR);
+  }
+  return staging_texture->handle;
+}
+
+bool ReadbackCache::Enqueue(Blitter* blitter, GLuint texture,
+                            uint32_t texture_scale, GLenum format,
+                            GLenum type, uint32_t bytes_per_pixel,
+                            Rect2D rect, uint32_t guest_address,
+                            uint32_t guest_pitch) {
+  SCOPE_profile_cpu_f("gpu");
+  if (rect.width <= 0 || rect.height <= 0) {
+    return true;
+  }
+  uint32_t length =
+      (rect.height - 1) * guest_pitch + rect.width * bytes_per_pixel;
+
+  // Newer data wins. If the new readback doesn't cover an old one entirely
+  // the rest of the old one has to land first.
+  Poll();
+  for (auto& readback : pending_readbacks_) {
+    if (readback->finished ||
+        readback->guest_address >= guest_address + length ||
+        guest_address >= readback->guest_address + readback->length) {
+      continue;
+    }
+    bool covered = readback->guest_address >= guest_address &&
+                   readback->guest_address + readback->length <=
+                       guest_address + length;
+    Retire(readback.get(), !covered);
+  }
+
+  auto readback = AcquireReadback(length);
+  if (!readback) {
+    return false;
+  }
+  readback->guest_address = guest_address;
+  readback->length = length;
+  readback->ready_event->Reset();
+  readback->finished = false;
+
+  if (texture_scale > 1) {
+    texture = Downsample(blitter, texture, texture_scale,
+                         format == GL_DEPTH_STENCIL, rect);
+    rect.x = 0;
+    rect.y = 0;
+  }
+
+  glPixelStorei(GL_PACK_ROW_LENGTH, guest_pitch / bytes_per_pixel);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+  glGetTextureSubImage(texture, 0, rect.x, rect.y, 0, rect.width,
+                       rect.height, 1, format, type,
+                       static_cast<GLsizei>(readback->capacity), nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+  readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  readback->watch_handle = memory_->AddPhysicalAccessWatch(
+      guest_address, length, WatchCallback, this, readback);
+  return true;
+}
+
+void ReadbackCache::Poll() {
+  if (pending_readbacks_.empty()) {
+    return;
+  }
+  for (auto it = pending_readbacks_.begin();
+       it != pending_readbacks_.end();) {
+    auto readback = it->get();
+    if (readback->fence) {
+      GLenum result =
+          glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+      if (result == GL_ALREADY_SIGNALED ||
+          result == GL_CONDITION_SATISFIED) {
+        glDeleteSync(readback->fence);
+        readback->fence = 0;
+        readback->ready_event->Set();
+      }
+    }
+    if (!readback->fence && readback->finished) {
+      free_readbacks_.push_back(std::move(*it));
+      it = pending_readbacks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void ReadbackCache::WaitForFence(Readback* readback) {
+  assert_true(std::this_thread::get_id() == gpu_thread_id_);
+  if (!readback->fence) {
+    return;
+  }
+  glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                   GL_TIMEOUT_IGNORED);
+  glDeleteSync(readback->fence);
+  readback->fence = 0;
+  readback->ready_event->Set();
+}
+
+void ReadbackCache::Retire(Readback* readback, bool copy) {
+  if (readback->finished) {
+    return;
+  }
+  if (!memory_->CancelWriteWatch(readback->watch_handle)) {
+    // The CPU got there first; the faulting thread copies it.
+    return;
+  }
+  if (copy) {
+    WaitForFence(readback);
+    std::memcpy(memory_->TranslatePhysical(readback->guest_address),
+                readback->host_ptr, readback->length);
+  }
+  readback->finished = true;
+}
+
+void ReadbackCache::WatchCallback(void* context_ptr, void* data_ptr,
+                                  uint32_t address) {
+  SCOPE_profile_cpu_f("gpu");
+  auto self = reinterpret_cast<ReadbackCache*>(context_ptr);
+  auto readback = reinterpret_cast<Readback*>(data_ptr);
+  if (std::this_thread::get_id() == self->gpu_thread_id_) {
+    // The GPU thread itself touched the memory, so nobody else will poll.
+    self->WaitForFence(readback);
+  } else {
+    xe::threading::Wait(readback->ready_event.get(), false);
+  }
+  std::memcpy(self->memory_->TranslatePhysical(readback->guest_address),
+              readback->host_ptr, readback->length);
+  readback->finished = true;
+}
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,102 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_GL4_READBACK_CACHE_H_
+#define XENIA_GPU_GL4_READBACK_CACHE_H_
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/threading.h"
+#include "xenia/memory.h"
+#include "xenia/ui/gl/blitter.h"
+#include "xenia/ui/gl/gl_context.h"
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+using xe::ui::gl::Blitter;
+using xe::ui::gl::Rect2D;
+
+// Copies resolved textures back to guest memory without stalling the GPU.
+// Each readback is packed into a persistently mapped buffer and fenced, and
+// the destination range is access watched. The copy into guest memory only
+// happens when the CPU first touches the range: the faulting thread waits
+// for the fence (signaled when the GPU thread polls) and copies the data
+// over itself. Resolves the CPU never looks at cost nothing beyond the
+// packing.
+class ReadbackCache {
+ public:
+  ReadbackCache();
+  ~ReadbackCache();
+
+  // Must be called on the GPU thread.
+  bool Initialize(Memory* memory);
+  void Shutdown();
+
+  // Reads rect of the texture into guest memory at guest_address, the
+  // location of the rect origin, with rows guest_pitch bytes apart. Pending
+  // readbacks overlapping the range are superseded. rect is in guest pixels;
+  // textures texture_scale times larger are downsampled first.
+  bool Enqueue(Blitter* blitter, GLuint texture, uint32_t texture_scale,
+               GLenum format, GLenum type, uint32_t bytes_per_pixel,
+               Rect2D rect, uint32_t guest_address, uint32_t guest_pitch);
+
+  // Retires readbacks the GPU has finished. Call regularly from the GPU
+  // thread, including while waiting on the guest.
+  void Poll();
+
+ private:
+  struct Readback {
+    GLuint buffer;
+    size_t capacity;
+    const uint8_t* host_ptr;
+    // Owned by the GPU thread. 0 once the GPU has written the buffer.
+    GLsync fence;
+    uint32_t guest_address;
+    uint32_t length;
+    uintptr_t watch_handle;
+    // Set once host_ptr holds the data.
+    std::unique_ptr<xe::threading::Event> ready_event;
+    // Set once nothing will touch the readback until it is reused.
+    std::atomic<bool> finished;
+  };
+
+  // Guest sized copy of a scaled texture, reused by resolves of the same
+  // internal format.
+  struct StagingTexture {
+    GLenum internal_format;
+    GLuint handle;
+    int32_t width;
+    int32_t height;
+  };
+
+  Readback* AcquireReadback(uint32_t length);
+  GLuint Downsample(Blitter* blitter, GLuint texture, uint32_t texture_scale,
+                    bool is_depth, Rect2D rect);
+  void WaitForFence(Readback* readback);
+  void Retire(Readback* readback, bool copy);
+  static void WatchCallback(void* context_ptr, void* data_ptr,
+                            uint32_t address);
+
+  Memory* memory_;
+  std::thread::id gpu_thread_id_;
+  std::vector<std::unique_ptr<Readback>> pending_readbacks_;
+  std::vector<std::unique_ptr<Readback>> free_readbacks_;
+  std::vector<StagingTexture> staging_textures_;
+};
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_GL4_READBACK_CACHE_H_
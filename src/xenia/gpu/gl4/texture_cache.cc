@@ -9,13 +9,18 @@
 
 #include "xenia/gpu/gl4/texture_cache.h"
 
+#include <emmintrin.h>
+
 #include <algorithm>
 #include <cstring>
+#include <string>
 
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/gpu/gl4/gl4_gpu_flags.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/profiling.h"
 
@@ -25,11 +30,25 @@ namespace gl4 {
 
 using xe::gpu::xenos::Endian;
 
+// Bindless handles can't be made non-resident while frames still in flight
+// may sample them.
+const uint32_t kMinUnusedFrames = 4;
+
+// Formats GL has no equivalent for are decoded on the CPU into another.
+enum class TextureConversion {
+  kNone,
+  // Blocks of two 8:8 endpoints and 2 bit indices, decoded to RG8.
+  kCTX1ToRG8,
+  // Blocks of 4 bit values as in the alpha of DXT3, expanded to R8.
+  kDXT3AToR8,
+};
+
 struct TextureConfig {
   TextureFormat texture_format;
   GLenum internal_format;
   GLenum format;
   GLenum type;
+  TextureConversion conversion;
 };
 
 // https://code.google.com/p/glsnewton/source/browse/trunk/Source/uDDSLoader.pas?r=62
@@ -129,11 +148,13 @@ static const TextureConfig texture_configs[64] = {
     {TextureFormat::k_11_11_10_AS_16_16_16_16, GL_R11F_G11F_B10F,
      GL_INVALID_ENUM, GL_INVALID_ENUM},
     {TextureFormat::k_32_32_32_FLOAT, GL_RGB32F, GL_RGB, GL_FLOAT},
-    {TextureFormat::k_DXT3A, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
-     GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, GL_UNSIGNED_BYTE},
-    {TextureFormat::k_DXT5A, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
-     GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_UNSIGNED_BYTE},
-    {TextureFormat::k_CTX1, GL_INVALID_ENUM, GL_INVALID_ENUM, GL_INVALID_ENUM},
+    {TextureFormat::k_DXT3A, GL_R8, GL_RED, GL_UNSIGNED_BYTE,
+     TextureConversion::kDXT3AToR8},
+    // The alpha block of DXT5 on its own is the same as RGTC1.
+    {TextureFormat::k_DXT5A, GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RED_RGTC1,
+     GL_UNSIGNED_BYTE},
+    {TextureFormat::k_CTX1, GL_RG8, GL_RG, GL_UNSIGNED_BYTE,
+     TextureConversion::kCTX1ToRG8},
     {TextureFormat::k_DXT3A_AS_1_1_1_1, GL_INVALID_ENUM, GL_INVALID_ENUM,
      GL_INVALID_ENUM},
     {TextureFormat::kUnknown, GL_INVALID_ENUM, GL_INVALID_ENUM,
@@ -142,7 +163,80 @@ static const TextureConfig texture_configs[64] = {
      GL_INVALID_ENUM},
 };
 
-TextureCache::TextureCache() : memory_(nullptr), scratch_buffer_(nullptr) {
+// Untiles and endian swaps one dword of the output per invocation. z selects
+// the cube face. Mirrors TextureUntile/TextureInfo::TiledOffset2D*.
+static const char* const kUntileShaderSource = R"(
+#version 450
+precision highp int;
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+// offset_x, offset_y, block_width, block_height (in blocks).
+layout(location = 0) uniform uvec4 tile_rect;
+// input_width (in blocks), output_pitch, bytes_per_block, log_bpp.
+layout(location = 1) uniform uvec4 tile_format;
+// Input and output face lengths in dwords.
+layout(location = 2) uniform uvec2 face_lengths;
+layout(location = 3) uniform uint endianness;
+layout(std430, binding = 1) restrict readonly buffer TiledData {
+  uint tiled_data[];
+};
+layout(std430, binding = 2) restrict writeonly buffer UntiledData {
+  uint untiled_data[];
+};
+uint TiledOffset2DOuter(uint y, uint width, uint log_bpp) {
+  uint macro = ((y >> 5) * (width >> 5)) << (log_bpp + 7);
+  uint micro = ((y & 6) << 2) << log_bpp;
+  return macro + ((micro & ~15u) << 1) + (micro & 15) +
+         ((y & 8) << (3 + log_bpp)) + ((y & 1) << 4);
+}
+uint TiledOffset2DInner(uint x, uint y, uint bpp, uint base_offset) {
+  uint macro = (x >> 5) << (bpp + 7);
+  uint micro = (x & 7) << bpp;
+  uint offset = base_offset + (macro + ((micro & ~15u) << 1) + (micro & 15));
+  return ((offset & ~511u) << 3) + ((offset & 448) << 2) + (offset & 63) +
+         ((y & 16) << 7) + (((((y & 8) >> 2) + (x >> 3)) & 3) << 6);
+}
+void main() {
+  uint byte_x = gl_GlobalInvocationID.x * 4;
+  uint y = gl_GlobalInvocationID.y;
+  uint bytes_per_block = tile_format.z;
+  if (byte_x >= tile_rect.z * bytes_per_block || y >= tile_rect.w) {
+    return;
+  }
+  uint tiled_x = tile_rect.x + byte_x / bytes_per_block;
+  uint tiled_y = tile_rect.y + y;
+  uint log_bpp = tile_format.w;
+  uint base_offset = TiledOffset2DOuter(tiled_y, tile_format.x, log_bpp);
+  uint block = TiledOffset2DInner(tiled_x, tiled_y, log_bpp, base_offset) >>
+               log_bpp;
+  uint face = gl_GlobalInvocationID.z;
+  uint value = tiled_data[face * face_lengths.x +
+                          (block * bytes_per_block +
+                           byte_x % bytes_per_block) / 4];
+  if (endianness == 1) {  // k8in16
+    value = ((value & 0x00FF00FFu) << 8) | ((value >> 8) & 0x00FF00FFu);
+  } else if (endianness == 2) {  // k8in32
+    value = (value << 24) | ((value & 0xFF00u) << 8) |
+            ((value >> 8) & 0xFF00u) | (value >> 24);
+  } else if (endianness == 3) {  // k16in32
+    value = (value << 16) | (value >> 16);
+  }
+  untiled_data[face * face_lengths.y + (y * tile_format.y + byte_x) / 4] =
+      value;
+}
+)";
+
+TextureCache::TextureCache()
+    : memory_(nullptr),
+      scratch_buffer_(nullptr),
+      resolution_scale_(1),
+      untile_program_(0),
+      stream_bytes_remaining_(0),
+      frame_number_(0),
+      resident_bytes_(0),
+      transcoded_bytes_(0),
+      uploads_this_frame_(0),
+      evictions_this_frame_(0),
+      transcode_hits_this_frame_(0) {
   invalidated_textures_sets_[0].reserve(64);
   invalidated_textures_sets_[1].reserve(64);
   invalidated_textures_ = &invalidated_textures_sets_[0];
@@ -150,13 +244,41 @@ TextureCache::TextureCache() : memory_(nullptr), scratch_buffer_(nullptr) {
 
 TextureCache::~TextureCache() { Shutdown(); }
 
-bool TextureCache::Initialize(Memory* memory, CircularBuffer* scratch_buffer) {
+bool TextureCache::Initialize(Memory* memory, CircularBuffer* scratch_buffer,
+                              uint32_t resolution_scale) {
   memory_ = memory;
   scratch_buffer_ = scratch_buffer;
+  resolution_scale_ = resolution_scale;
+  std::memset(fetch_slots_, 0, sizeof(fetch_slots_));
+
+  if (FLAGS_gpu_texture_untiling) {
+    untile_program_ =
+        glCreateShaderProgramv(GL_COMPUTE_SHADER, 1, &kUntileShaderSource);
+    GLint link_status = 0;
+    glGetProgramiv(untile_program_, GL_LINK_STATUS, &link_status);
+    if (!link_status) {
+      GLint log_length = 0;
+      glGetProgramiv(untile_program_, GL_INFO_LOG_LENGTH, &log_length);
+      std::string info_log;
+      info_log.resize(std::max(log_length, 1) - 1);
+      glGetProgramInfoLog(untile_program_, log_length, &log_length,
+                          const_cast<char*>(info_log.data()));
+      XELOGE("Unable to link untile program, untiling on the CPU: %s",
+             info_log.c_str());
+      glDeleteProgram(untile_program_);
+      untile_program_ = 0;
+    }
+  }
   return true;
 }
 
-void TextureCache::Shutdown() { Clear(); }
+void TextureCache::Shutdown() {
+  Clear();
+  if (untile_program_) {
+    glDeleteProgram(untile_program_);
+    untile_program_ = 0;
+  }
+}
 
 void TextureCache::Scavenge() {
   invalidated_textures_mutex_.lock();
@@ -167,14 +289,62 @@ void TextureCache::Scavenge() {
     invalidated_textures_ = &invalidated_textures_sets_[0];
   }
   invalidated_textures_mutex_.unlock();
-  if (invalidated_textures.empty()) {
-    return;
-  }
-
   for (auto& entry : invalidated_textures) {
     EvictTexture(entry);
   }
   invalidated_textures.clear();
+
+  if (FLAGS_texture_cache_budget_mb > 0) {
+    EvictUnusedTextures(uint64_t(FLAGS_texture_cache_budget_mb) * 1024 * 1024);
+  }
+
+  TrimTranscodedTextures(
+      uint64_t(std::max(FLAGS_texture_transcode_cache_mb, 0)) * 1024 * 1024);
+
+  FreeRetiredHandles(false);
+  // Textures created during the frame share the budget with streaming.
+  stream_bytes_remaining_ = int64_t(FLAGS_texture_stream_budget_kb) * 1024;
+  if (!streaming_textures_.empty()) {
+    StreamTextureLevels();
+  }
+
+  COUNT_profile_cpu("gpu/TextureCache/ResidentKB",
+                    int(resident_bytes_ / 1024));
+  COUNT_profile_cpu("gpu/TextureCache/Uploads", uploads_this_frame_);
+  COUNT_profile_cpu("gpu/TextureCache/Evictions", evictions_this_frame_);
+  COUNT_profile_cpu("gpu/TextureCache/TranscodeHits",
+                    transcode_hits_this_frame_);
+  uploads_this_frame_ = 0;
+  evictions_this_frame_ = 0;
+  transcode_hits_this_frame_ = 0;
+  ++frame_number_;
+}
+
+void TextureCache::EvictUnusedTextures(uint64_t budget) {
+  if (resident_bytes_ <= budget) {
+    return;
+  }
+  // Recently used textures are left alone as frames in flight may sample
+  // them, even if that means staying over budget for a while.
+  std::vector<TextureEntry*> candidates;
+  for (auto& it : texture_entries_) {
+    auto entry = it.second;
+    if (entry->pending_invalidation ||
+        frame_number_ - entry->last_used_frame < kMinUnusedFrames) {
+      continue;
+    }
+    candidates.push_back(entry);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const TextureEntry* a, const TextureEntry* b) {
+              return a->last_used_frame < b->last_used_frame;
+            });
+  for (auto entry : candidates) {
+    if (resident_bytes_ <= budget) {
+      break;
+    }
+    EvictTexture(entry);
+  }
 }
 
 void TextureCache::Clear() {
@@ -209,6 +379,10 @@ void TextureCache::EvictAllTextures() {
     delete entry;
     read_buffer_textures_.erase(it);
   }
+
+  FreeRetiredHandles(true);
+  transcoded_textures_.clear();
+  transcoded_bytes_ = 0;
 }
 
 TextureCache::TextureEntryView* TextureCache::Demand(
@@ -219,6 +393,7 @@ TextureCache::TextureEntryView* TextureCache::Demand(
     XELOGE("Failed to setup texture");
     return nullptr;
   }
+  texture_entry->last_used_frame = frame_number_;
 
   // We likely have the sampler in the texture view listing, so scan for it.
   uint64_t sampler_hash = sampler_info.hash();
@@ -245,7 +420,7 @@ TextureCache::TextureEntryView* TextureCache::Demand(
   // Get the uvec2 handle to the texture/sampler pair and make it resident.
   // The handle can be passed directly to the shader.
   view->texture_sampler_handle = glGetTextureSamplerHandleARB(
-      texture_entry->handle, sampler_entry->handle);
+      texture_entry->sample_handle, sampler_entry->handle);
   if (!view->texture_sampler_handle) {
     assert_always("Unable to get texture handle?");
     return nullptr;
@@ -258,6 +433,31 @@ TextureCache::TextureEntryView* TextureCache::Demand(
   return view_ptr;
 }
 
+TextureCache::TextureEntryView* TextureCache::LookupFetchSlot(
+    uint32_t fetch_slot, const xenos::xe_gpu_texture_fetch_t& fetch,
+    const ucode::instr_fetch_tex_t& tex_fetch) {
+  assert_true(fetch_slot < kFetchSlotCount);
+  auto& slot = fetch_slots_[fetch_slot];
+  if (!slot.view || slot.view->texture->pending_invalidation ||
+      std::memcmp(&slot.fetch, &fetch, sizeof(fetch)) ||
+      std::memcmp(&slot.tex_fetch, &tex_fetch, sizeof(tex_fetch))) {
+    return nullptr;
+  }
+  slot.view->texture->last_used_frame = frame_number_;
+  return slot.view;
+}
+
+void TextureCache::UpdateFetchSlot(uint32_t fetch_slot,
+                                   const xenos::xe_gpu_texture_fetch_t& fetch,
+                                   const ucode::instr_fetch_tex_t& tex_fetch,
+                                   TextureEntryView* view) {
+  assert_true(fetch_slot < kFetchSlotCount);
+  auto& slot = fetch_slots_[fetch_slot];
+  slot.fetch = fetch;
+  slot.tex_fetch = tex_fetch;
+  slot.view = view;
+}
+
 TextureCache::SamplerEntry* TextureCache::LookupOrInsertSampler(
     const SamplerInfo& sampler_info, uint64_t opt_hash) {
   const uint64_t hash = opt_hash ? opt_hash : sampler_info.hash();
@@ -278,10 +478,11 @@ TextureCache::SamplerEntry* TextureCache::LookupOrInsertSampler(
   GLfloat border_color[4] = {0.0f};
   glSamplerParameterfv(entry->handle, GL_TEXTURE_BORDER_COLOR, border_color);
 
-  // TODO(benvanik): setup LODs for mipmapping.
+  // Textures only have the levels the guest provided (or fewer), so the
+  // level range is left to them.
   glSamplerParameterf(entry->handle, GL_TEXTURE_LOD_BIAS, 0.0f);
-  glSamplerParameterf(entry->handle, GL_TEXTURE_MIN_LOD, 0.0f);
-  glSamplerParameterf(entry->handle, GL_TEXTURE_MAX_LOD, 0.0f);
+  glSamplerParameterf(entry->handle, GL_TEXTURE_MIN_LOD, -1000.0f);
+  glSamplerParameterf(entry->handle, GL_TEXTURE_MAX_LOD, 1000.0f);
 
   // Texture wrapping modes.
   // TODO(benvanik): not sure if the middle ones are correct.
@@ -311,12 +512,10 @@ TextureCache::SamplerEntry* TextureCache::LookupOrInsertSampler(
           min_filter = GL_NEAREST;
           break;
         case ucode::TEX_FILTER_POINT:
-          // min_filter = GL_NEAREST_MIPMAP_NEAREST;
-          min_filter = GL_NEAREST;
+          min_filter = GL_NEAREST_MIPMAP_NEAREST;
           break;
         case ucode::TEX_FILTER_LINEAR:
-          // min_filter = GL_NEAREST_MIPMAP_LINEAR;
-          min_filter = GL_NEAREST;
+          min_filter = GL_NEAREST_MIPMAP_LINEAR;
           break;
         default:
           assert_unhandled_case(sampler_info.mip_filter);
@@ -329,12 +528,10 @@ TextureCache::SamplerEntry* TextureCache::LookupOrInsertSampler(
           min_filter = GL_LINEAR;
           break;
         case ucode::TEX_FILTER_POINT:
-          // min_filter = GL_LINEAR_MIPMAP_NEAREST;
-          min_filter = GL_LINEAR;
+          min_filter = GL_LINEAR_MIPMAP_NEAREST;
           break;
         case ucode::TEX_FILTER_LINEAR:
-          // min_filter = GL_LINEAR_MIPMAP_LINEAR;
-          min_filter = GL_LINEAR;
+          min_filter = GL_LINEAR_MIPMAP_LINEAR;
           break;
         default:
           assert_unhandled_case(sampler_info.mip_filter);
@@ -409,6 +606,32 @@ void TextureCache::EvictSampler(SamplerEntry* entry) {
   delete entry;
 }
 
+// Pre-shader swizzle.
+// TODO(benvanik): can this be dynamic? Maybe per view?
+// We may have to emulate this in the shader.
+static void SetTextureSwizzle(GLuint texture, uint32_t swizzle) {
+  uint32_t swizzle_r = swizzle & 0x7;
+  uint32_t swizzle_g = (swizzle >> 3) & 0x7;
+  uint32_t swizzle_b = (swizzle >> 6) & 0x7;
+  uint32_t swizzle_a = (swizzle >> 9) & 0x7;
+  static const GLenum swizzle_map[] = {
+      GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, GL_ZERO, GL_ONE,
+  };
+  glTextureParameteri(texture, GL_TEXTURE_SWIZZLE_R, swizzle_map[swizzle_r]);
+  glTextureParameteri(texture, GL_TEXTURE_SWIZZLE_G, swizzle_map[swizzle_g]);
+  glTextureParameteri(texture, GL_TEXTURE_SWIZZLE_B, swizzle_map[swizzle_b]);
+  glTextureParameteri(texture, GL_TEXTURE_SWIZZLE_A, swizzle_map[swizzle_a]);
+}
+
+static void GetLevelInfo(const TextureInfo& texture_info, uint32_t level,
+                         TextureInfo* out_info) {
+  if (!level) {
+    *out_info = texture_info;
+  } else {
+    texture_info.GetMipLevel2D(level, out_info);
+  }
+}
+
 TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
     const TextureInfo& texture_info, uint64_t opt_hash) {
   const uint64_t hash = opt_hash ? opt_hash : texture_info.hash();
@@ -431,7 +654,15 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
   entry->texture_info = texture_info;
   entry->write_watch_handle = 0;
   entry->pending_invalidation = false;
+  entry->last_used_frame = frame_number_;
+  entry->resolve_source = {};
+  entry->resolution_scale = 1;
+  entry->first_level = 0;
+  entry->level_count = 1;
+  entry->uploaded_level = 0;
   entry->handle = 0;
+  entry->sample_handle = 0;
+  entry->length = texture_info.output_length;
 
   // Check read buffer textures - there may be one waiting for us.
   // TODO(benvanik): speed up existence check?
@@ -444,10 +675,15 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
       // Found! Acquire the handle and remove the readbuffer entry.
       read_buffer_textures_.erase(it);
       entry->handle = read_buffer_entry->handle;
+      entry->sample_handle = entry->handle;
+      entry->resolve_source = read_buffer_entry->resolve_source;
+      entry->resolution_scale = read_buffer_entry->resolution_scale;
       delete read_buffer_entry;
       // TODO(benvanik): set more texture properties? swizzle/etc?
       auto entry_ptr = entry.get();
       texture_entries_.insert({hash, entry.release()});
+      resident_bytes_ += entry_ptr->length * entry_ptr->resolution_scale *
+                         entry_ptr->resolution_scale;
       return entry_ptr;
     }
   }
@@ -468,40 +704,24 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
       break;
   }
 
-  // Setup the base texture.
+  // Setup the base texture. Immutable storage limits the levels sampled to
+  // those allocated.
   glCreateTextures(target, 1, &entry->handle);
-
-  // TODO(benvanik): texture mip levels.
-  glTextureParameteri(entry->handle, GL_TEXTURE_BASE_LEVEL, 0);
-  glTextureParameteri(entry->handle, GL_TEXTURE_MAX_LEVEL, 1);
-
-  // Pre-shader swizzle.
-  // TODO(benvanik): can this be dynamic? Maybe per view?
-  // We may have to emulate this in the shader.
-  uint32_t swizzle_r = texture_info.swizzle & 0x7;
-  uint32_t swizzle_g = (texture_info.swizzle >> 3) & 0x7;
-  uint32_t swizzle_b = (texture_info.swizzle >> 6) & 0x7;
-  uint32_t swizzle_a = (texture_info.swizzle >> 9) & 0x7;
-  static const GLenum swizzle_map[] = {
-      GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA, GL_ZERO, GL_ONE,
-  };
-  glTextureParameteri(entry->handle, GL_TEXTURE_SWIZZLE_R,
-                      swizzle_map[swizzle_r]);
-  glTextureParameteri(entry->handle, GL_TEXTURE_SWIZZLE_G,
-                      swizzle_map[swizzle_g]);
-  glTextureParameteri(entry->handle, GL_TEXTURE_SWIZZLE_B,
-                      swizzle_map[swizzle_b]);
-  glTextureParameteri(entry->handle, GL_TEXTURE_SWIZZLE_A,
-                      swizzle_map[swizzle_a]);
+  SetTextureSwizzle(entry->handle, texture_info.swizzle);
 
   // Upload/convert.
   bool uploaded = false;
   switch (texture_info.dimension) {
     case Dimension::k2D:
-      uploaded = UploadTexture2D(entry->handle, texture_info);
+      uploaded = AllocateTexture2D(entry.get()) &&
+                 UploadTextureLevels(entry.get());
+      if (uploaded) {
+        UpdateSampleHandles(entry.get());
+      }
       break;
     case Dimension::kCube:
       uploaded = UploadTextureCube(entry->handle, texture_info);
+      entry->sample_handle = entry->handle;
       break;
     case Dimension::k1D:
     case Dimension::k3D:
@@ -510,6 +730,7 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
   }
   if (!uploaded) {
     XELOGE("Failed to convert/upload texture");
+    glDeleteTextures(1, &entry->handle);
     return nullptr;
   }
 
@@ -535,6 +756,11 @@ TextureCache::TextureEntry* TextureCache::LookupOrInsertTexture(
   // Add to map - map takes ownership.
   auto entry_ptr = entry.get();
   texture_entries_.insert({hash, entry.release()});
+  resident_bytes_ += entry_ptr->length;
+  if (entry_ptr->uploaded_level) {
+    streaming_textures_.push_back(entry_ptr);
+  }
+  ++uploads_this_frame_;
   return entry_ptr;
 }
 
@@ -545,25 +771,71 @@ TextureCache::TextureEntry* TextureCache::LookupAddress(uint32_t guest_address,
   // TODO(benvanik): worth speeding up?
   for (auto it = texture_entries_.begin(); it != texture_entries_.end(); ++it) {
     const auto& texture_info = it->second->texture_info;
+    // Textures missing their top level can't be resolved into.
     if (texture_info.guest_address == guest_address &&
         texture_info.dimension == Dimension::k2D &&
+        !it->second->first_level &&
         texture_info.size_2d.input_width == width &&
         texture_info.size_2d.input_height == height) {
+      it->second->last_used_frame = frame_number_;
       return it->second;
     }
   }
   return nullptr;
 }
 
+bool TextureCache::GetReadbackFormat(TextureFormat format, GLenum* out_format,
+                                     GLenum* out_type) {
+  const auto& config = texture_configs[uint32_t(format)];
+  auto format_info = FormatInfo::Get(uint32_t(format));
+  if (config.format == GL_INVALID_ENUM || config.type == GL_INVALID_ENUM ||
+      format_info->type == FormatType::kCompressed ||
+      config.type == GL_FLOAT_32_UNSIGNED_INT_24_8_REV) {
+    // The float depth format reads back as 64 bits per pixel.
+    return false;
+  }
+  *out_format = config.format;
+  *out_type = config.type;
+  return true;
+}
+
 GLuint TextureCache::CopyTexture(Blitter* blitter, uint32_t guest_address,
                                  uint32_t logical_width,
                                  uint32_t logical_height, uint32_t block_width,
                                  uint32_t block_height, TextureFormat format,
                                  bool swap_channels, GLuint src_texture,
-                                 Rect2D src_rect, Rect2D dest_rect) {
+                                 Rect2D src_rect, Rect2D dest_rect,
+                                 uint64_t src_version,
+                                 uint32_t* out_resolution_scale) {
   return ConvertTexture(blitter, guest_address, logical_width, logical_height,
                         block_width, block_height, format, swap_channels,
-                        src_texture, src_rect, dest_rect);
+                        src_texture, src_rect, dest_rect, src_version,
+                        out_resolution_scale);
+}
+
+static Rect2D ScaleRect(Rect2D rect, int32_t scale) {
+  return Rect2D(rect.x * scale, rect.y * scale, rect.width * scale,
+                rect.height * scale);
+}
+
+// Records the resolve into resolve_source. Returns false if it matches what
+// was last resolved there, in which case the copy can be skipped.
+static bool UpdateResolveSource(TextureCache::ResolveSource* resolve_source,
+                                GLuint src_texture, uint64_t src_version,
+                                Rect2D src_rect, Rect2D dest_rect) {
+  if (src_version && resolve_source->version == src_version &&
+      resolve_source->texture == src_texture &&
+      std::memcmp(&resolve_source->src_rect, &src_rect, sizeof(src_rect)) ==
+          0 &&
+      std::memcmp(&resolve_source->dest_rect, &dest_rect, sizeof(dest_rect)) ==
+          0) {
+    return false;
+  }
+  resolve_source->texture = src_texture;
+  resolve_source->version = src_version;
+  resolve_source->src_rect = src_rect;
+  resolve_source->dest_rect = dest_rect;
+  return true;
 }
 
 GLuint TextureCache::ConvertTexture(Blitter* blitter, uint32_t guest_address,
@@ -572,7 +844,8 @@ GLuint TextureCache::ConvertTexture(Blitter* blitter, uint32_t guest_address,
                                     uint32_t block_width, uint32_t block_height,
                                     TextureFormat format, bool swap_channels,
                                     GLuint src_texture, Rect2D src_rect,
-                                    Rect2D dest_rect) {
+                                    Rect2D dest_rect, uint64_t src_version,
+                                    uint32_t* out_resolution_scale) {
   const auto& config = texture_configs[uint32_t(format)];
   if (config.format == GL_INVALID_ENUM) {
     assert_always("Unhandled destination texture format");
@@ -587,13 +860,18 @@ GLuint TextureCache::ConvertTexture(Blitter* blitter, uint32_t guest_address,
   if (texture_entry) {
     // Have existing texture.
     assert_false(texture_entry->pending_invalidation);
-    if (config.format == GL_DEPTH_STENCIL) {
+    Rect2D scaled_rect = ScaleRect(dest_rect, texture_entry->resolution_scale);
+    if (!UpdateResolveSource(&texture_entry->resolve_source, src_texture,
+                             src_version, src_rect, dest_rect)) {
+      // Nothing was drawn since it was last resolved here.
+    } else if (config.format == GL_DEPTH_STENCIL) {
       blitter->CopyDepthTexture(src_texture, src_rect, texture_entry->handle,
-                                dest_rect);
+                                scaled_rect);
     } else {
       blitter->CopyColorTexture2D(src_texture, src_rect, texture_entry->handle,
-                                  dest_rect, GL_LINEAR);
+                                  scaled_rect, GL_LINEAR);
     }
+    *out_resolution_scale = texture_entry->resolution_scale;
 
     // HACK: remove texture from write watch list so readback won't kill us.
     if (texture_entry->write_watch_handle) {
@@ -612,13 +890,18 @@ GLuint TextureCache::ConvertTexture(Blitter* blitter, uint32_t guest_address,
         entry->logical_width == logical_width &&
         entry->logical_height == logical_height && entry->format == format) {
       // Found an existing entry - just reupload.
-      if (config.format == GL_DEPTH_STENCIL) {
+      Rect2D scaled_rect = ScaleRect(dest_rect, entry->resolution_scale);
+      if (!UpdateResolveSource(&entry->resolve_source, src_texture,
+                               src_version, src_rect, dest_rect)) {
+        // Nothing was drawn since it was last resolved here.
+      } else if (config.format == GL_DEPTH_STENCIL) {
         blitter->CopyDepthTexture(src_texture, src_rect, entry->handle,
-                                  dest_rect);
+                                  scaled_rect);
       } else {
         blitter->CopyColorTexture2D(src_texture, src_rect, entry->handle,
-                                    dest_rect, GL_LINEAR);
+                                    scaled_rect, GL_LINEAR);
       }
+      *out_resolution_scale = entry->resolution_scale;
       return entry->handle;
     }
   }
@@ -634,19 +917,29 @@ GLuint TextureCache::ConvertTexture(Blitter* blitter, uint32_t guest_address,
   entry->block_width = block_width;
   entry->block_height = block_height;
   entry->format = format;
-
+  entry->resolve_source = {};
+  entry->resolution_scale = resolution_scale_;
+  UpdateResolveSource(&entry->resolve_source, src_texture, src_version,
+                      src_rect, dest_rect);
+
+  // Kept at the render target resolution so that sampling it later doesn't
+  // throw the extra detail away.
+  Rect2D scaled_rect = ScaleRect(dest_rect, resolution_scale_);
   glCreateTextures(GL_TEXTURE_2D, 1, &entry->handle);
   glTextureParameteri(entry->handle, GL_TEXTURE_BASE_LEVEL, 0);
   glTextureParameteri(entry->handle, GL_TEXTURE_MAX_LEVEL, 1);
-  glTextureStorage2D(entry->handle, 1, config.internal_format, logical_width,
-                     logical_height);
+  glTextureStorage2D(entry->handle, 1, config.internal_format,
+                     logical_width * resolution_scale_,
+                     logical_height * resolution_scale_);
   if (config.format == GL_DEPTH_STENCIL) {
-    blitter->CopyDepthTexture(src_texture, src_rect, entry->handle, dest_rect);
+    blitter->CopyDepthTexture(src_texture, src_rect, entry->handle,
+                              scaled_rect);
   } else {
-    blitter->CopyColorTexture2D(src_texture, src_rect, entry->handle, dest_rect,
-                                GL_LINEAR);
+    blitter->CopyColorTexture2D(src_texture, src_rect, entry->handle,
+                                scaled_rect, GL_LINEAR);
   }
 
+  *out_resolution_scale = resolution_scale_;
   GLuint handle = entry->handle;
   read_buffer_textures_.push_back(entry.release());
   return handle;
@@ -658,10 +951,26 @@ void TextureCache::EvictTexture(TextureEntry* entry) {
     entry->write_watch_handle = 0;
   }
 
+  for (auto& slot : fetch_slots_) {
+    if (slot.view && slot.view->texture == entry) {
+      slot.view = nullptr;
+    }
+  }
   for (auto& view : entry->views) {
     glMakeTextureHandleNonResidentARB(view->texture_sampler_handle);
   }
+  if (entry->sample_handle != entry->handle) {
+    glDeleteTextures(1, &entry->sample_handle);
+    auto it = std::find(streaming_textures_.begin(), streaming_textures_.end(),
+                        entry);
+    if (it != streaming_textures_.end()) {
+      streaming_textures_.erase(it);
+    }
+  }
   glDeleteTextures(1, &entry->handle);
+  resident_bytes_ -=
+      entry->length * entry->resolution_scale * entry->resolution_scale;
+  ++evictions_this_frame_;
 
   uint64_t texture_hash = entry->texture_info.hash();
   for (auto it = texture_entries_.find(texture_hash);
@@ -691,7 +1000,7 @@ void TextureSwap(Endian endianness, void* dest, const void* src,
     case Endian::k16in32:  // Swap high and low 16 bits within a 32 bit word
       xe::copy_and_swap_16_in_32_aligned(reinterpret_cast<uint32_t*>(dest),
                                          reinterpret_cast<const uint32_t*>(src),
-                                         length);
+                                         length / 4);
       break;
     default:
     case Endian::kUnspecified:
@@ -700,98 +1009,381 @@ void TextureSwap(Endian endianness, void* dest, const void* src,
   }
 }
 
-bool TextureCache::UploadTexture2D(GLuint texture,
-                                   const TextureInfo& texture_info) {
-  SCOPE_profile_cpu_f("gpu");
-  const auto host_address =
-      memory_->TranslatePhysical(texture_info.guest_address);
-
-  const auto& config =
-      texture_configs[uint32_t(texture_info.format_info->format)];
-  if (config.format == GL_INVALID_ENUM) {
-    assert_always("Unhandled texture format");
-    return false;
+// Untiles block_height rows of block_width blocks starting at the packed
+// tile offset. Contiguous runs of blocks are swapped as a unit.
+void TextureUntile(Endian endianness, uint8_t* dest, const uint8_t* src,
+                   uint32_t offset_x, uint32_t offset_y, uint32_t block_width,
+                   uint32_t block_height, uint32_t input_width,
+                   uint32_t output_pitch, uint32_t bytes_per_block) {
+  auto bpp = (bytes_per_block >> 2) +
+             ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
+  uint32_t run_length = TextureInfo::TiledRunLength(bpp);
+  for (uint32_t y = 0, output_base_offset = 0; y < block_height;
+       y++, output_base_offset += output_pitch) {
+    auto input_base_offset =
+        TextureInfo::TiledOffset2DOuter(offset_y + y, input_width, bpp);
+    for (uint32_t x = 0, output_offset = output_base_offset;
+         x < block_width;) {
+      uint32_t tiled_x = offset_x + x;
+      uint32_t count = std::min(run_length - (tiled_x & (run_length - 1)),
+                                block_width - x);
+      auto input_offset =
+          TextureInfo::TiledOffset2DInner(tiled_x, offset_y + y, bpp,
+                                          input_base_offset) >>
+          bpp;
+      TextureSwap(endianness, dest + output_offset,
+                  src + input_offset * bytes_per_block,
+                  count * bytes_per_block);
+      x += count;
+      output_offset += count * bytes_per_block;
+    }
   }
+}
 
-  size_t unpack_length = texture_info.output_length;
-  glTextureStorage2D(texture, 1, config.internal_format,
-                     texture_info.size_2d.output_width,
-                     texture_info.size_2d.output_height);
-
-  auto allocation = scratch_buffer_->Acquire(unpack_length);
-
+// Copies the blocks of a 2D texture from guest memory into rows of
+// output_pitch, untiling and endian swapping them along the way.
+static void ReadTexture2D(const TextureInfo& texture_info,
+                          const uint8_t* host_address, uint8_t* dest) {
+  uint32_t bytes_per_block = texture_info.format_info->block_width *
+                             texture_info.format_info->block_height *
+                             texture_info.format_info->bits_per_pixel / 8;
+  // Guest storage is whole tiles, of which only the start is the image.
+  uint32_t block_width =
+      std::min(texture_info.size_2d.block_width,
+               texture_info.size_2d.output_pitch / bytes_per_block);
+  uint32_t block_height =
+      std::min(texture_info.size_2d.block_height,
+               texture_info.size_2d.output_height /
+                   texture_info.format_info->block_height);
   if (!texture_info.is_tiled) {
     if (texture_info.size_2d.input_pitch == texture_info.size_2d.output_pitch) {
       // Fast path copy entire image.
-      TextureSwap(texture_info.endianness, allocation.host_ptr, host_address,
-                  unpack_length);
+      TextureSwap(texture_info.endianness, dest, host_address,
+                  texture_info.output_length);
     } else {
       // Slow path copy row-by-row because strides differ.
       // UNPACK_ROW_LENGTH only works for uncompressed images, and likely does
       // this exact thing under the covers, so we just always do it here.
       const uint8_t* src = host_address;
-      uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
       uint32_t pitch = std::min(texture_info.size_2d.input_pitch,
                                 texture_info.size_2d.output_pitch);
-      for (uint32_t y = 0; y < std::min(texture_info.size_2d.block_height,
-                                        texture_info.size_2d.logical_height);
-           y++) {
+      for (uint32_t y = 0; y < block_height; y++) {
         TextureSwap(texture_info.endianness, dest, src, pitch);
         src += texture_info.size_2d.input_pitch;
         dest += texture_info.size_2d.output_pitch;
       }
     }
   } else {
-    // Untile image.
-    // We could do this in a shader to speed things up, as this is pretty slow.
-
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
-    const uint8_t* src = host_address;
-    uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
-    uint32_t bytes_per_block = texture_info.format_info->block_width *
-                               texture_info.format_info->block_height *
-                               texture_info.format_info->bits_per_pixel / 8;
-
     // Tiled textures can be packed; get the offset into the packed texture.
     uint32_t offset_x;
     uint32_t offset_y;
     TextureInfo::GetPackedTileOffset(texture_info, &offset_x, &offset_y);
+    TextureUntile(texture_info.endianness, dest, host_address, offset_x,
+                  offset_y, block_width, block_height,
+                  texture_info.size_2d.input_width /
+                      texture_info.format_info->block_width,
+                  texture_info.size_2d.output_pitch, bytes_per_block);
+  }
+}
 
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
-    for (uint32_t y = 0, output_base_offset = 0;
-         y < std::min(texture_info.size_2d.block_height,
-                      texture_info.size_2d.logical_height);
-         y++, output_base_offset += texture_info.size_2d.output_pitch) {
-      auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-          offset_y + y, (texture_info.size_2d.input_width /
-                         texture_info.format_info->block_width),
-          bpp);
-      for (uint32_t x = 0, output_offset = output_base_offset;
-           x < texture_info.size_2d.block_width;
-           x++, output_offset += bytes_per_block) {
-        auto input_offset =
-            TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                            input_base_offset) >>
-            bpp;
-        TextureSwap(texture_info.endianness, dest + output_offset,
-                    src + input_offset * bytes_per_block, bytes_per_block);
+// http://fileadmin.cs.lth.se/cs/Personal/Michael_Doggett/talks/unc-xenos-doggett.pdf
+static void TranscodeCTX1ToRG8(const uint8_t* src, uint32_t block_width,
+                               uint32_t block_height, uint8_t* dest,
+                               uint32_t dest_pitch) {
+  for (uint32_t by = 0; by < block_height; ++by) {
+    for (uint32_t bx = 0; bx < block_width; ++bx, src += 8) {
+      uint8_t r[4] = {src[0], src[2], uint8_t((2 * src[0] + src[2]) / 3),
+                      uint8_t((src[0] + 2 * src[2]) / 3)};
+      uint8_t g[4] = {src[1], src[3], uint8_t((2 * src[1] + src[3]) / 3),
+                      uint8_t((src[1] + 2 * src[3]) / 3)};
+      uint32_t indices;
+      std::memcpy(&indices, src + 4, sizeof(indices));
+      uint8_t* block_dest = dest + by * 4 * dest_pitch + bx * 4 * 2;
+      for (uint32_t y = 0; y < 4; ++y) {
+        uint8_t* row = block_dest + y * dest_pitch;
+        for (uint32_t x = 0; x < 4; ++x, indices >>= 2) {
+          row[x * 2 + 0] = r[indices & 3];
+          row[x * 2 + 1] = g[indices & 3];
+        }
       }
     }
   }
-  size_t unpack_offset = allocation.offset;
-  scratch_buffer_->Commit(std::move(allocation));
-  // TODO(benvanik): avoid flush on entire buffer by using another texture
-  // buffer.
+}
+
+static void TranscodeDXT3AToR8(const uint8_t* src, uint32_t block_width,
+                               uint32_t block_height, uint8_t* dest,
+                               uint32_t dest_pitch) {
+  const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+  for (uint32_t by = 0; by < block_height; ++by) {
+    for (uint32_t bx = 0; bx < block_width; ++bx, src += 8) {
+      // Split the 16 nibbles (low first) into bytes and scale them by 17,
+      // which maps 0xF to 0xFF.
+      __m128i block = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+      __m128i low = _mm_and_si128(block, nibble_mask);
+      __m128i high = _mm_and_si128(_mm_srli_epi16(block, 4), nibble_mask);
+      __m128i texels = _mm_unpacklo_epi8(low, high);
+      texels = _mm_or_si128(texels, _mm_slli_epi16(texels, 4));
+      uint8_t* block_dest = dest + by * 4 * dest_pitch + bx * 4;
+      for (uint32_t y = 0; y < 4; ++y) {
+        uint32_t row = _mm_cvtsi128_si32(texels);
+        std::memcpy(block_dest + y * dest_pitch, &row, sizeof(row));
+        texels = _mm_srli_si128(texels, 4);
+      }
+    }
+  }
+}
+
+bool TextureCache::UntileTextureOnGpu(
+    const TextureInfo& texture_info, const uint8_t* host_address,
+    uint32_t block_width, uint32_t block_height, uint32_t input_width,
+    uint32_t output_pitch, uint32_t face_count, uint32_t input_face_length,
+    uint32_t output_face_length, const CircularBuffer::Allocation& output) {
+  if (!untile_program_) {
+    return false;
+  }
+  uint32_t bytes_per_block = texture_info.format_info->block_width *
+                             texture_info.format_info->block_height *
+                             texture_info.format_info->bits_per_pixel / 8;
+  uint32_t offset_x;
+  uint32_t offset_y;
+  TextureInfo::GetPackedTileOffset(texture_info, &offset_x, &offset_y);
+  // Each invocation writes one whole dword, so rows and faces must be dword
+  // aligned and, for small blocks, every dword must come from a single run.
+  if (output_pitch % 4 || input_face_length % 4 || output_face_length % 4 ||
+      (bytes_per_block < 4 && offset_x % (4 / bytes_per_block))) {
+    return false;
+  }
+  auto log_bpp = (bytes_per_block >> 2) +
+                 ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
+
+  // Stage the raw guest data. The output allocation is written only by the
+  // GPU and must not be committed by the caller.
+  auto input = scratch_buffer_->Acquire(texture_info.input_length);
+  std::memcpy(input.host_ptr, host_address, texture_info.input_length);
+  size_t input_offset = input.offset;
+  size_t input_length = input.aligned_length;
+  scratch_buffer_->Commit(std::move(input));
   scratch_buffer_->Flush();
 
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, scratch_buffer_->handle(),
+                    input_offset, input_length);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, scratch_buffer_->handle(),
+                    output.offset, output.aligned_length);
+  glProgramUniform4ui(untile_program_, 0, offset_x, offset_y, block_width,
+                      block_height);
+  glProgramUniform4ui(untile_program_, 1, input_width, output_pitch,
+                      bytes_per_block, log_bpp);
+  glProgramUniform2ui(untile_program_, 2, input_face_length / 4,
+                      output_face_length / 4);
+  glProgramUniform1ui(untile_program_, 3,
+                      static_cast<GLuint>(texture_info.endianness));
+  // A bound program takes precedence over the draw pipeline; unbinding it
+  // afterwards restores the pipeline.
+  glUseProgram(untile_program_);
+  uint32_t dword_width = xe::round_up(block_width * bytes_per_block, 4) / 4;
+  glDispatchCompute(xe::round_up(dword_width, 8) / 8,
+                    xe::round_up(block_height, 8) / 8, face_count);
+  glUseProgram(0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+  // The result is consumed by the pixel unpack that follows.
+  glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT |
+                  GL_TEXTURE_UPDATE_BARRIER_BIT);
+  return true;
+}
+
+bool TextureCache::AllocateTexture2D(TextureEntry* entry) {
+  const auto& texture_info = entry->texture_info;
+  const auto& config =
+      texture_configs[uint32_t(texture_info.format_info->format)];
+  if (config.format == GL_INVALID_ENUM) {
+    assert_always("Unhandled texture format");
+    return false;
+  }
+
+  std::vector<uint64_t> level_lengths(texture_info.mip_levels);
+  uint64_t length = 0;
+  for (uint32_t level = 0; level < texture_info.mip_levels; ++level) {
+    TextureInfo level_info;
+    GetLevelInfo(texture_info, level, &level_info);
+    level_lengths[level] = level_info.output_length;
+    length += level_info.output_length;
+  }
+
+  // While over budget leave out the largest levels, which are most of the
+  // size but only sampled up close.
+  uint64_t budget = uint64_t(std::max(FLAGS_texture_cache_budget_mb, 0)) *
+                    1024 * 1024;
+  uint32_t max_drop_levels =
+      uint32_t(std::max(FLAGS_texture_mip_drop_levels, 0));
+  uint32_t first_level = 0;
+  while (budget && resident_bytes_ + length > budget &&
+         first_level < max_drop_levels &&
+         first_level + 1 < texture_info.mip_levels) {
+    length -= level_lengths[first_level++];
+  }
+  entry->first_level = first_level;
+  entry->level_count = texture_info.mip_levels - first_level;
+  entry->uploaded_level = entry->level_count;
+  entry->length = length;
+
+  TextureInfo top_info;
+  GetLevelInfo(texture_info, first_level, &top_info);
+  glTextureStorage2D(entry->handle, entry->level_count, config.internal_format,
+                     top_info.size_2d.output_width,
+                     top_info.size_2d.output_height);
+  return true;
+}
+
+// Uploads levels smallest first, as far as --texture_stream_budget_kb allows.
+// The smallest level always goes so that there is something to sample.
+bool TextureCache::UploadTextureLevels(TextureEntry* entry) {
+  const auto& texture_info = entry->texture_info;
+  bool is_streaming = FLAGS_texture_stream_budget_kb > 0;
+  TextureInfo top_info;
+  GetLevelInfo(texture_info, entry->first_level, &top_info);
+  while (entry->uploaded_level) {
+    uint32_t level = entry->uploaded_level - 1;
+    TextureInfo level_info;
+    GetLevelInfo(texture_info, entry->first_level + level, &level_info);
+    if (is_streaming && level != entry->level_count - 1 &&
+        stream_bytes_remaining_ < int64_t(level_info.output_length)) {
+      break;
+    }
+    // Compressed levels smaller than a block are still uploaded as one.
+    if (!UploadTexture2D(
+            entry->handle, level,
+            std::max(top_info.size_2d.output_width >> level, 1u),
+            std::max(top_info.size_2d.output_height >> level, 1u),
+            level_info)) {
+      return false;
+    }
+    stream_bytes_remaining_ -= level_info.output_length;
+    entry->uploaded_level = level;
+  }
+  return true;
+}
+
+// Points the views of the texture at the levels uploaded so far. Bindless
+// handles freeze the state of their texture, so rather than raising
+// GL_TEXTURE_BASE_LEVEL this creates a view of just those levels.
+void TextureCache::UpdateSampleHandles(TextureEntry* entry) {
+  GLuint sample_handle = entry->handle;
+  if (entry->uploaded_level) {
+    const auto& config =
+        texture_configs[uint32_t(entry->texture_info.format_info->format)];
+    glGenTextures(1, &sample_handle);
+    glTextureView(sample_handle, GL_TEXTURE_2D, entry->handle,
+                  config.internal_format, entry->uploaded_level,
+                  entry->level_count - entry->uploaded_level, 0, 1);
+    SetTextureSwizzle(sample_handle, entry->texture_info.swizzle);
+  }
+  if (entry->sample_handle && entry->sample_handle != entry->handle) {
+    retired_textures_.emplace_back(frame_number_, entry->sample_handle);
+  }
+  entry->sample_handle = sample_handle;
+  for (auto& view : entry->views) {
+    retired_handles_.emplace_back(frame_number_,
+                                  view->texture_sampler_handle);
+    view->texture_sampler_handle =
+        glGetTextureSamplerHandleARB(sample_handle, view->sampler->handle);
+    glMakeTextureHandleResidentARB(view->texture_sampler_handle);
+  }
+}
+
+void TextureCache::StreamTextureLevels() {
+  SCOPE_profile_cpu_f("gpu");
+  auto it = streaming_textures_.begin();
+  while (it != streaming_textures_.end() && stream_bytes_remaining_ > 0) {
+    auto entry = *it;
+    uint32_t uploaded_level = entry->uploaded_level;
+    bool uploaded = UploadTextureLevels(entry);
+    if (entry->uploaded_level != uploaded_level) {
+      UpdateSampleHandles(entry);
+    }
+    if (!uploaded) {
+      XELOGE("Failed to upload texture level; leaving it out");
+    }
+    if (!uploaded || !entry->uploaded_level) {
+      it = streaming_textures_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void TextureCache::FreeRetiredHandles(bool all) {
+  size_t kept = 0;
+  for (auto& retired : retired_handles_) {
+    if (!all && frame_number_ - retired.first < kMinUnusedFrames) {
+      retired_handles_[kept++] = retired;
+    } else {
+      glMakeTextureHandleNonResidentARB(retired.second);
+    }
+  }
+  retired_handles_.resize(kept);
+  kept = 0;
+  for (auto& retired : retired_textures_) {
+    if (!all && frame_number_ - retired.first < kMinUnusedFrames) {
+      retired_textures_[kept++] = retired;
+    } else {
+      glDeleteTextures(1, &retired.second);
+    }
+  }
+  retired_textures_.resize(kept);
+}
+
+bool TextureCache::UploadTexture2D(GLuint texture, GLint level, GLsizei width,
+                                   GLsizei height,
+                                   const TextureInfo& texture_info) {
+  SCOPE_profile_cpu_f("gpu");
+  const auto host_address =
+      memory_->TranslatePhysical(texture_info.guest_address);
+
+  const auto& config =
+      texture_configs[uint32_t(texture_info.format_info->format)];
+  if (config.format == GL_INVALID_ENUM) {
+    assert_always("Unhandled texture format");
+    return false;
+  }
+
+  if (config.conversion != TextureConversion::kNone) {
+    return UploadTranscodedTexture2D(texture, level, width, height,
+                                     texture_info);
+  }
+
+  size_t unpack_length = texture_info.output_length;
+  auto allocation = scratch_buffer_->Acquire(unpack_length);
+  bool untiled_on_gpu = false;
+
+  if (texture_info.is_tiled &&
+      UntileTextureOnGpu(
+          texture_info, host_address, texture_info.size_2d.block_width,
+          std::min(texture_info.size_2d.block_height,
+                   texture_info.size_2d.logical_height),
+          texture_info.size_2d.input_width /
+              texture_info.format_info->block_width,
+          texture_info.size_2d.output_pitch, 1, 0, 0, allocation)) {
+    untiled_on_gpu = true;
+  } else {
+    ReadTexture2D(texture_info, host_address,
+                  reinterpret_cast<uint8_t*>(allocation.host_ptr));
+  }
+  size_t unpack_offset = allocation.offset;
+  if (!untiled_on_gpu) {
+    // The GPU wrote the allocation otherwise; flushing it would clobber that.
+    scratch_buffer_->Commit(std::move(allocation));
+    // TODO(benvanik): avoid flush on entire buffer by using another texture
+    // buffer.
+    scratch_buffer_->Flush();
+  }
+
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, scratch_buffer_->handle());
   if (texture_info.is_compressed()) {
-    glCompressedTextureSubImage2D(
-        texture, 0, 0, 0, texture_info.size_2d.output_width,
-        texture_info.size_2d.output_height, config.format,
-        static_cast<GLsizei>(unpack_length),
-        reinterpret_cast<void*>(unpack_offset));
+    glCompressedTextureSubImage2D(texture, level, 0, 0, width, height,
+                                  config.format,
+                                  static_cast<GLsizei>(unpack_length),
+                                  reinterpret_cast<void*>(unpack_offset));
   } else {
     // Most of these don't seem to have an effect on compressed images.
     // glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
@@ -799,14 +1391,103 @@ bool TextureCache::UploadTexture2D(GLuint texture,
     // glPixelStorei(GL_UNPACK_ROW_LENGTH, texture_info.size_2d.input_width);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    glTextureSubImage2D(texture, 0, 0, 0, texture_info.size_2d.output_width,
-                        texture_info.size_2d.output_height, config.format,
+    glTextureSubImage2D(texture, level, 0, 0, width, height, config.format,
                         config.type, reinterpret_cast<void*>(unpack_offset));
   }
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
   return true;
 }
 
+bool TextureCache::UploadTranscodedTexture2D(GLuint texture, GLint level,
+                                             GLsizei width, GLsizei height,
+                                             const TextureInfo& texture_info) {
+  SCOPE_profile_cpu_f("gpu");
+  const auto host_address =
+      memory_->TranslatePhysical(texture_info.guest_address);
+  const auto& config =
+      texture_configs[uint32_t(texture_info.format_info->format)];
+  uint32_t block_width = texture_info.size_2d.output_width / 4;
+  uint32_t block_height = texture_info.size_2d.output_height / 4;
+  uint32_t bytes_per_texel =
+      config.conversion == TextureConversion::kCTX1ToRG8 ? 2 : 1;
+  uint32_t output_pitch = texture_info.size_2d.output_width * bytes_per_texel;
+  size_t unpack_length = output_pitch * texture_info.size_2d.output_height;
+
+  // Keyed by the guest data and layout but not the address, so that the
+  // same texture loaded again (anywhere) isn't decoded again.
+  TextureInfo key_info = texture_info;
+  key_info.guest_address = 0;
+  key_info.mip_address = 0;
+  uint64_t key =
+      XXH64(host_address, texture_info.input_length, key_info.hash());
+  auto it = transcoded_textures_.find(key);
+  if (it == transcoded_textures_.end() ||
+      it->second.data.size() != unpack_length) {
+    if (it != transcoded_textures_.end()) {
+      transcoded_bytes_ -= it->second.data.size();
+      transcoded_textures_.erase(it);
+    }
+    std::vector<uint8_t> blocks(texture_info.output_length);
+    ReadTexture2D(texture_info, host_address, blocks.data());
+    TranscodedTexture transcoded;
+    transcoded.data.resize(unpack_length);
+    switch (config.conversion) {
+      case TextureConversion::kCTX1ToRG8:
+        TranscodeCTX1ToRG8(blocks.data(), block_width, block_height,
+                           transcoded.data.data(), output_pitch);
+        break;
+      case TextureConversion::kDXT3AToR8:
+        TranscodeDXT3AToR8(blocks.data(), block_width, block_height,
+                           transcoded.data.data(), output_pitch);
+        break;
+      default:
+        assert_unhandled_case(config.conversion);
+        return false;
+    }
+    transcoded_bytes_ += unpack_length;
+    it = transcoded_textures_.emplace(key, std::move(transcoded)).first;
+  } else {
+    ++transcode_hits_this_frame_;
+  }
+  it->second.last_used_frame = frame_number_;
+
+  auto allocation = scratch_buffer_->Acquire(unpack_length);
+  std::memcpy(allocation.host_ptr, it->second.data.data(), unpack_length);
+  size_t unpack_offset = allocation.offset;
+  scratch_buffer_->Commit(std::move(allocation));
+  scratch_buffer_->Flush();
+
+  // Levels smaller than a block only take the start of each row.
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, scratch_buffer_->handle());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, texture_info.size_2d.output_width);
+  glTextureSubImage2D(texture, level, 0, 0, width, height, config.format,
+                      config.type, reinterpret_cast<void*>(unpack_offset));
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return true;
+}
+
+void TextureCache::TrimTranscodedTextures(uint64_t budget) {
+  if (transcoded_bytes_ <= budget) {
+    return;
+  }
+  std::vector<std::pair<uint32_t, uint64_t>> candidates;
+  candidates.reserve(transcoded_textures_.size());
+  for (auto& it : transcoded_textures_) {
+    candidates.emplace_back(it.second.last_used_frame, it.first);
+  }
+  std::sort(candidates.begin(), candidates.end());
+  for (auto& candidate : candidates) {
+    if (transcoded_bytes_ <= budget) {
+      break;
+    }
+    auto it = transcoded_textures_.find(candidate.second);
+    transcoded_bytes_ -= it->second.data.size();
+    transcoded_textures_.erase(it);
+  }
+}
+
 bool TextureCache::UploadTextureCube(GLuint texture,
                                      const TextureInfo& texture_info) {
   SCOPE_profile_cpu_f("gpu");
@@ -815,7 +1496,8 @@ bool TextureCache::UploadTextureCube(GLuint texture,
 
   const auto& config =
       texture_configs[uint32_t(texture_info.format_info->format)];
-  if (config.format == GL_INVALID_ENUM) {
+  if (config.format == GL_INVALID_ENUM ||
+      config.conversion != TextureConversion::kNone) {
     assert_always("Unhandled texture format");
     return false;
   }
@@ -826,6 +1508,7 @@ bool TextureCache::UploadTextureCube(GLuint texture,
                      texture_info.size_cube.output_height);
 
   auto allocation = scratch_buffer_->Acquire(unpack_length);
+  bool untiled_on_gpu = false;
   if (!texture_info.is_tiled) {
     if (texture_info.size_cube.input_pitch ==
         texture_info.size_cube.output_pitch) {
@@ -848,8 +1531,17 @@ bool TextureCache::UploadTextureCube(GLuint texture,
         }
       }
     }
+  } else if (UntileTextureOnGpu(texture_info, host_address,
+                                texture_info.size_cube.block_width,
+                                texture_info.size_cube.block_height,
+                                texture_info.size_cube.input_width /
+                                    texture_info.format_info->block_width,
+                                texture_info.size_cube.output_pitch, 6,
+                                texture_info.size_cube.input_face_length,
+                                texture_info.size_cube.output_face_length,
+                                allocation)) {
+    untiled_on_gpu = true;
   } else {
-    // TODO(benvanik): optimize this inner loop (or work by tiles).
     const uint8_t* src = host_address;
     uint8_t* dest = reinterpret_cast<uint8_t*>(allocation.host_ptr);
     uint32_t bytes_per_block = texture_info.format_info->block_width *
@@ -859,36 +1551,25 @@ bool TextureCache::UploadTextureCube(GLuint texture,
     uint32_t offset_x;
     uint32_t offset_y;
     TextureInfo::GetPackedTileOffset(texture_info, &offset_x, &offset_y);
-    auto bpp = (bytes_per_block >> 2) +
-               ((bytes_per_block >> 1) >> (bytes_per_block >> 2));
     for (int face = 0; face < 6; ++face) {
-      for (uint32_t y = 0, output_base_offset = 0;
-           y < texture_info.size_cube.block_height;
-           y++, output_base_offset += texture_info.size_cube.output_pitch) {
-        auto input_base_offset = TextureInfo::TiledOffset2DOuter(
-            offset_y + y, (texture_info.size_cube.input_width /
-                           texture_info.format_info->block_width),
-            bpp);
-        for (uint32_t x = 0, output_offset = output_base_offset;
-             x < texture_info.size_cube.block_width;
-             x++, output_offset += bytes_per_block) {
-          auto input_offset =
-              TextureInfo::TiledOffset2DInner(offset_x + x, offset_y + y, bpp,
-                                              input_base_offset) >>
-              bpp;
-          TextureSwap(texture_info.endianness, dest + output_offset,
-                      src + input_offset * bytes_per_block, bytes_per_block);
-        }
-      }
+      TextureUntile(texture_info.endianness, dest, src, offset_x, offset_y,
+                    texture_info.size_cube.block_width,
+                    texture_info.size_cube.block_height,
+                    texture_info.size_cube.input_width /
+                        texture_info.format_info->block_width,
+                    texture_info.size_cube.output_pitch, bytes_per_block);
       src += texture_info.size_cube.input_face_length;
       dest += texture_info.size_cube.output_face_length;
     }
   }
   size_t unpack_offset = allocation.offset;
-  scratch_buffer_->Commit(std::move(allocation));
-  // TODO(benvanik): avoid flush on entire buffer by using another texture
-  // buffer.
-  scratch_buffer_->Flush();
+  if (!untiled_on_gpu) {
+    // The GPU wrote the allocation otherwise; flushing it would clobber that.
+    scratch_buffer_->Commit(std::move(allocation));
+    // TODO(benvanik): avoid flush on entire buffer by using another texture
+    // buffer.
+    scratch_buffer_->Flush();
+  }
 
   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, scratch_buffer_->handle());
   if (texture_info.is_compressed()) {
@@ -10,8 +10,10 @@
 #ifndef XENIA_GPU_GL4_TEXTURE_CACHE_H_
 #define XENIA_GPU_GL4_TEXTURE_CACHE_H_
 
+#include <atomic>
 #include <mutex>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/mutex.h"
@@ -33,6 +35,15 @@ using xe::ui::gl::Rect2D;
 class TextureCache {
  public:
   struct TextureEntry;
+  // The render target contents last resolved into a texture, so that
+  // resolving them again with nothing drawn in between can be skipped.
+  struct ResolveSource {
+    GLuint texture;
+    // Version of the EDRAM contents at the time; 0 if unknown.
+    uint64_t version;
+    Rect2D src_rect;
+    Rect2D dest_rect;
+  };
   struct SamplerEntry {
     SamplerInfo sampler_info;
     GLuint handle;
@@ -47,16 +58,38 @@ class TextureCache {
     TextureInfo texture_info;
     uintptr_t write_watch_handle;
     GLuint handle;
-    bool pending_invalidation;
+    // Set from the write watch callback on whichever thread wrote.
+    std::atomic<bool> pending_invalidation;
+    // Frame number of the last Demand/lookup, for LRU eviction.
+    uint32_t last_used_frame;
+    ResolveSource resolve_source;
+    // Size of the texture relative to the guest's. 1 unless it was created
+    // by a resolve at a higher internal resolution.
+    uint32_t resolution_scale;
+    // Host level 0 is guest level first_level, as the largest levels are
+    // left out while over budget. level_count host levels are allocated.
+    uint32_t first_level;
+    uint32_t level_count;
+    // Host levels from this one on have been uploaded. Until all have, views
+    // sample through sample_handle, a view of only those levels; otherwise
+    // it is the same as handle.
+    uint32_t uploaded_level;
+    GLuint sample_handle;
+    // Host size of all levels at a resolution_scale of 1.
+    uint64_t length;
     std::vector<std::unique_ptr<TextureEntryView>> views;
   };
 
   TextureCache();
   ~TextureCache();
 
-  bool Initialize(Memory* memory, CircularBuffer* scratch_buffer);
+  // Resolves into new textures keep render targets' resolution_scale.
+  bool Initialize(Memory* memory, CircularBuffer* scratch_buffer,
+                  uint32_t resolution_scale);
   void Shutdown();
 
+  // Called once per frame. Evicts invalidated textures and, when over
+  // --texture_cache_budget_mb, the least recently used ones.
   void Scavenge();
   void Clear();
   void EvictAllTextures();
@@ -64,18 +97,52 @@ class TextureCache {
   TextureEntryView* Demand(const TextureInfo& texture_info,
                            const SamplerInfo& sampler_info);
 
+  // Returns the view last demanded for the fetch slot if the fetch constant
+  // and fetch instruction are unchanged and the guest hasn't written to the
+  // texture since. This lets draws skip preparing and hashing the texture and
+  // sampler info when nothing changed, which is the common case.
+  TextureEntryView* LookupFetchSlot(uint32_t fetch_slot,
+                                    const xenos::xe_gpu_texture_fetch_t& fetch,
+                                    const ucode::instr_fetch_tex_t& tex_fetch);
+  void UpdateFetchSlot(uint32_t fetch_slot,
+                       const xenos::xe_gpu_texture_fetch_t& fetch,
+                       const ucode::instr_fetch_tex_t& tex_fetch,
+                       TextureEntryView* view);
+
+  // Gets the format and type to read back a texture of the given format
+  // with. Returns false if it can't be read back as laid out in guest memory.
+  static bool GetReadbackFormat(TextureFormat format, GLenum* out_format,
+                                GLenum* out_type);
+
+  // Resolves src_rect of src_texture into dest_rect, in guest pixels, of the
+  // texture at guest_address. The returned texture is out_resolution_scale
+  // times the guest size.
   GLuint CopyTexture(Blitter* blitter, uint32_t guest_address,
                      uint32_t logical_width, uint32_t logical_height,
                      uint32_t block_width, uint32_t block_height,
                      TextureFormat format, bool swap_channels,
-                     GLuint src_texture, Rect2D src_rect, Rect2D dest_rect);
+                     GLuint src_texture, Rect2D src_rect, Rect2D dest_rect,
+                     uint64_t src_version, uint32_t* out_resolution_scale);
   GLuint ConvertTexture(Blitter* blitter, uint32_t guest_address,
                         uint32_t logical_width, uint32_t logical_height,
                         uint32_t block_width, uint32_t block_height,
                         TextureFormat format, bool swap_channels,
-                        GLuint src_texture, Rect2D src_rect, Rect2D dest_rect);
+                        GLuint src_texture, Rect2D src_rect, Rect2D dest_rect,
+                        uint64_t src_version, uint32_t* out_resolution_scale);
 
  private:
+  static const uint32_t kFetchSlotCount = 32;
+  struct FetchSlot {
+    xenos::xe_gpu_texture_fetch_t fetch;
+    ucode::instr_fetch_tex_t tex_fetch;
+    TextureEntryView* view;
+  };
+
+  struct TranscodedTexture {
+    std::vector<uint8_t> data;
+    uint32_t last_used_frame;
+  };
+
   struct ReadBufferTexture {
     uint32_t guest_address;
     uint32_t logical_width;
@@ -84,6 +151,8 @@ class TextureCache {
     uint32_t block_height;
     TextureFormat format;
     GLuint handle;
+    ResolveSource resolve_source;
+    uint32_t resolution_scale;
   };
 
   SamplerEntry* LookupOrInsertSampler(const SamplerInfo& sampler_info,
@@ -94,17 +163,60 @@ class TextureCache {
   TextureEntry* LookupAddress(uint32_t guest_address, uint32_t width,
                               uint32_t height, TextureFormat format);
   void EvictTexture(TextureEntry* entry);
-
-  bool UploadTexture2D(GLuint texture, const TextureInfo& texture_info);
+  void EvictUnusedTextures(uint64_t budget);
+
+  bool AllocateTexture2D(TextureEntry* entry);
+  bool UploadTextureLevels(TextureEntry* entry);
+  void UpdateSampleHandles(TextureEntry* entry);
+  void StreamTextureLevels();
+  void FreeRetiredHandles(bool all);
+  bool UploadTexture2D(GLuint texture, GLint level, GLsizei width,
+                       GLsizei height, const TextureInfo& texture_info);
+  bool UploadTranscodedTexture2D(GLuint texture, GLint level, GLsizei width,
+                                 GLsizei height,
+                                 const TextureInfo& texture_info);
+  void TrimTranscodedTextures(uint64_t budget);
   bool UploadTextureCube(GLuint texture, const TextureInfo& texture_info);
+  bool UntileTextureOnGpu(const TextureInfo& texture_info,
+                          const uint8_t* host_address, uint32_t block_width,
+                          uint32_t block_height, uint32_t input_width,
+                          uint32_t output_pitch, uint32_t face_count,
+                          uint32_t input_face_length,
+                          uint32_t output_face_length,
+                          const CircularBuffer::Allocation& output);
 
   Memory* memory_;
   CircularBuffer* scratch_buffer_;
+  uint32_t resolution_scale_;
+  // Compute program used with --gpu_texture_untiling, or 0 if unavailable.
+  GLuint untile_program_;
   std::unordered_map<uint64_t, SamplerEntry*> sampler_entries_;
   std::unordered_map<uint64_t, TextureEntry*> texture_entries_;
 
   std::vector<ReadBufferTexture*> read_buffer_textures_;
 
+  FetchSlot fetch_slots_[kFetchSlotCount];
+
+  // Textures with levels still to upload, oldest first.
+  std::vector<TextureEntry*> streaming_textures_;
+  // What --texture_stream_budget_kb leaves for the rest of the frame.
+  int64_t stream_bytes_remaining_;
+  // Handles and texture views replaced while streaming, with the frame they
+  // were replaced in. Frames in flight may still be sampling them.
+  std::vector<std::pair<uint32_t, GLuint64>> retired_handles_;
+  std::vector<std::pair<uint32_t, GLuint>> retired_textures_;
+
+  uint32_t frame_number_;
+  // Sum of the length of all texture entries.
+  uint64_t resident_bytes_;
+  // Decoded data of textures in formats GL lacks, by hash of the guest data
+  // and layout, so that reloads skip decoding.
+  std::unordered_map<uint64_t, TranscodedTexture> transcoded_textures_;
+  uint64_t transcoded_bytes_;
+  int uploads_this_frame_;
+  int evictions_this_frame_;
+  int transcode_hits_this_frame_;
+
   xe::mutex invalidated_textures_mutex_;
   std::vector<TextureEntry*>* invalidated_textures_;
   std::vector<TextureEntry*> invalidated_textures_sets_[2];
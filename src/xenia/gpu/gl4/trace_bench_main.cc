@@ -0,0 +1,199 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/threading.h"
+#include "xenia/emulator.h"
+#include "xenia/gpu/gl4/command_processor.h"
+#include "xenia/gpu/gl4/gl4_graphics_system.h"
+#include "xenia/gpu/trace_reader.h"
+#include "xenia/profiling.h"
+#include "xenia/ui/window.h"
+
+DEFINE_string(target_trace_file, "", "Specifies the trace file to replay.");
+DEFINE_int32(trace_bench_iterations, 10,
+             "Number of times to replay the whole trace.");
+
+namespace xe {
+namespace gpu {
+namespace gl4 {
+
+// Measurements for one frame of one replay.
+struct FrameSample {
+  uint64_t ticks;
+  CommandProcessor::Stats stats;
+};
+
+// Replays one frame on the command processor thread and measures the time
+// the thread spent on it, including the swap at its end.
+FrameSample ReplayFrame(GL4GraphicsSystem* graphics_system,
+                        const TraceReader::Frame* frame,
+                        xe::threading::Event* done_event) {
+  auto command_processor = graphics_system->command_processor();
+  FrameSample sample;
+  CommandProcessor::Stats start_stats;
+  uint64_t start_ticks;
+  command_processor->CallInThread([&]() {
+    start_stats = command_processor->stats();
+    start_ticks = Clock::QueryHostTickCount();
+  });
+  graphics_system->PlayTrace(frame->start_ptr,
+                             frame->end_ptr - frame->start_ptr,
+                             GraphicsSystem::TracePlaybackMode::kUntilEnd);
+  command_processor->CallInThread([&]() {
+    sample.ticks = Clock::QueryHostTickCount() - start_ticks;
+    auto end_stats = command_processor->stats();
+    sample.stats.draw_count = end_stats.draw_count - start_stats.draw_count;
+    sample.stats.upload_bytes =
+        end_stats.upload_bytes - start_stats.upload_bytes;
+    sample.stats.shader_compile_ticks =
+        end_stats.shader_compile_ticks - start_stats.shader_compile_ticks;
+    done_event->Set();
+  });
+  xe::threading::Wait(done_event, false);
+  return sample;
+}
+
+double TicksToMillis(uint64_t ticks) {
+  return ticks * 1000.0 / Clock::host_tick_frequency();
+}
+
+void PrintReport(int frame_count,
+                 const std::vector<std::vector<FrameSample>>& iterations) {
+  std::printf("%6s %10s %10s %10s %8s %12s %12s\n", "frame", "min ms",
+              "mean ms", "max ms", "draws", "upload KB", "compile ms");
+  for (int n = 0; n < frame_count; ++n) {
+    uint64_t min_ticks = UINT64_MAX;
+    uint64_t max_ticks = 0;
+    uint64_t total_ticks = 0;
+    uint64_t upload_bytes = 0;
+    uint64_t compile_ticks = 0;
+    for (auto& samples : iterations) {
+      auto& sample = samples[n];
+      min_ticks = std::min(min_ticks, sample.ticks);
+      max_ticks = std::max(max_ticks, sample.ticks);
+      total_ticks += sample.ticks;
+      upload_bytes += sample.stats.upload_bytes;
+      compile_ticks += sample.stats.shader_compile_ticks;
+    }
+    // Draw counts only change while shaders are compiling.
+    auto& last_sample = iterations.back()[n];
+    std::printf("%6d %10.3f %10.3f %10.3f %8llu %12.1f %12.3f\n", n,
+                TicksToMillis(min_ticks),
+                TicksToMillis(total_ticks / iterations.size()),
+                TicksToMillis(max_ticks),
+                static_cast<unsigned long long>(last_sample.stats.draw_count),
+                upload_bytes / 1024.0 / iterations.size(),
+                TicksToMillis(compile_ticks));
+  }
+
+  std::printf("\n%9s %10s %8s %12s %12s\n", "iteration", "total ms", "draws",
+              "upload KB", "compile ms");
+  for (size_t i = 0; i < iterations.size(); ++i) {
+    uint64_t total_ticks = 0;
+    uint64_t draw_count = 0;
+    uint64_t upload_bytes = 0;
+    uint64_t compile_ticks = 0;
+    for (auto& sample : iterations[i]) {
+      total_ticks += sample.ticks;
+      draw_count += sample.stats.draw_count;
+      upload_bytes += sample.stats.upload_bytes;
+      compile_ticks += sample.stats.shader_compile_ticks;
+    }
+    std::printf("%9d %10.3f %8llu %12.1f %12.3f\n", int(i),
+                TicksToMillis(total_ticks),
+                static_cast<unsigned long long>(draw_count),
+                upload_bytes / 1024.0, TicksToMillis(compile_ticks));
+  }
+}
+
+int trace_bench_main(const std::vector<std::wstring>& args) {
+  // Grab path from the flag or unnamed argument.
+  if (FLAGS_target_trace_file.empty() && args.size() < 2) {
+    XELOGE("No trace file specified");
+    return 1;
+  }
+  std::wstring path;
+  if (!FLAGS_target_trace_file.empty()) {
+    path = xe::to_wstring(FLAGS_target_trace_file);
+  } else {
+    path = args[1];
+  }
+  auto abs_path = xe::to_absolute_path(path);
+
+  TraceReader reader;
+  if (!reader.Open(abs_path)) {
+    XELOGE("Could not load trace file");
+    return 1;
+  }
+
+  // The GL context is created from the window, so one is needed even though
+  // nothing is ever drawn to it beyond the replayed frames.
+  auto emulator = std::make_unique<Emulator>(L"");
+  auto loop = ui::Loop::Create();
+  auto window = xe::ui::Window::Create(loop.get(), L"xenia-gpu-trace-bench");
+  loop->PostSynchronous([&window]() {
+    xe::threading::set_name("Win32 Loop");
+    if (!window->Initialize()) {
+      FatalError("Failed to initialize main window");
+      return;
+    }
+  });
+  window->Resize(1280, 720);
+
+  X_STATUS result = emulator->Setup(window.get());
+  if (XFAILED(result)) {
+    XELOGE("Failed to setup emulator: %.8X", result);
+    return 1;
+  }
+  Profiler::set_display(nullptr);
+
+  // Playback writes to all of physical memory.
+  emulator->memory()
+      ->LookupHeapByType(true, 4096)
+      ->AllocFixed(0, 0x1FFFFFFF, 4096,
+                   kMemoryAllocationReserve | kMemoryAllocationCommit,
+                   kMemoryProtectRead | kMemoryProtectWrite);
+
+  auto graphics_system =
+      static_cast<GL4GraphicsSystem*>(emulator->graphics_system());
+  auto done_event = xe::threading::Event::CreateAutoResetEvent(false);
+  int iteration_count = std::max(FLAGS_trace_bench_iterations, 1);
+  std::vector<std::vector<FrameSample>> iterations(iteration_count);
+  for (auto& samples : iterations) {
+    samples.reserve(reader.frame_count());
+    for (int n = 0; n < reader.frame_count(); ++n) {
+      samples.push_back(
+          ReplayFrame(graphics_system, reader.frame(n), done_event.get()));
+    }
+  }
+
+  PrintReport(reader.frame_count(), iterations);
+
+  emulator.reset();
+  window.reset();
+  loop.reset();
+  return 0;
+}
+
+}  // namespace gl4
+}  // namespace gpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-gpu-gl4-trace-bench",
+                   L"xenia-gpu-gl4-trace-bench some.trace",
+                   xe::gpu::gl4::trace_bench_main);
@@ -21,6 +21,7 @@
 #include "xenia/emulator.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/gpu/register_file.h"
+#include "xenia/gpu/trace_reader.h"
 #include "xenia/gpu/tracing.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/profiling.h"
@@ -37,11 +38,6 @@ DEFINE_string(target_trace_file, "", "Specifies the trace file to load.");
 namespace xe {
 namespace gpu {
 
-enum class PacketCategory {
-  kGeneric,
-  kDraw,
-  kSwap,
-};
 struct PacketTypeInfo {
   PacketCategory category;
   const char* name;
@@ -534,240 +530,6 @@ bool DisasmPacket(const uint8_t* base_ptr, PacketInfo* out_info) {
   }
 }
 
-PacketCategory GetPacketCategory(const uint8_t* base_ptr) {
-  const uint32_t packet = xe::load_and_swap<uint32_t>(base_ptr);
-  const uint32_t packet_type = packet >> 30;
-  switch (packet_type) {
-    case 0x00:
-    case 0x01:
-    case 0x02: {
-      return PacketCategory::kGeneric;
-    }
-    case 0x03: {
-      uint32_t opcode = (packet >> 8) & 0x7F;
-      switch (opcode) {
-        case PM4_DRAW_INDX:
-        case PM4_DRAW_INDX_2:
-          return PacketCategory::kDraw;
-        case PM4_XE_SWAP:
-          return PacketCategory::kSwap;
-        default:
-          return PacketCategory::kGeneric;
-      }
-    }
-    default: {
-      assert_unhandled_case(packet_type);
-      return PacketCategory::kGeneric;
-    }
-  }
-}
-
-// TODO(benvanik): move to tracing.h/cc
-
-class TraceReader {
- public:
-  struct Frame {
-    struct Command {
-      enum class Type {
-        kDraw,
-        kSwap,
-      };
-      const uint8_t* head_ptr;
-      const uint8_t* start_ptr;
-      const uint8_t* end_ptr;
-      Type type;
-      union {
-        struct {
-          //
-        } draw;
-        struct {
-          //
-        } swap;
-      };
-    };
-
-    const uint8_t* start_ptr;
-    const uint8_t* end_ptr;
-    int command_count;
-    std::vector<Command> commands;
-  };
-
-  TraceReader() : trace_data_(nullptr), trace_size_(0) {}
-  ~TraceReader() = default;
-
-  const Frame* frame(int n) const { return &frames_[n]; }
-  int frame_count() const { return int(frames_.size()); }
-
-  bool Open(const std::wstring& path) {
-    Close();
-
-    mmap_ = MappedMemory::Open(path, MappedMemory::Mode::kRead);
-    if (!mmap_) {
-      return false;
-    }
-
-    trace_data_ = reinterpret_cast<const uint8_t*>(mmap_->data());
-    trace_size_ = mmap_->size();
-
-    ParseTrace();
-
-    return true;
-  }
-
-  void Close() {
-    mmap_.reset();
-    trace_data_ = nullptr;
-    trace_size_ = 0;
-  }
-
-  // void Foo() {
-  //  auto trace_ptr = trace_data;
-  //  while (trace_ptr < trace_data + trace_size) {
-  //    auto cmd_type = *reinterpret_cast<const TraceCommandType*>(trace_ptr);
-  //    switch (cmd_type) {
-  //      case TraceCommandType::kPrimaryBufferStart:
-  //        break;
-  //      case TraceCommandType::kPrimaryBufferEnd:
-  //        break;
-  //      case TraceCommandType::kIndirectBufferStart:
-  //        break;
-  //      case TraceCommandType::kIndirectBufferEnd:
-  //        break;
-  //      case TraceCommandType::kPacketStart:
-  //        break;
-  //      case TraceCommandType::kPacketEnd:
-  //        break;
-  //      case TraceCommandType::kMemoryRead:
-  //        break;
-  //      case TraceCommandType::kMemoryWrite:
-  //        break;
-  //      case TraceCommandType::kEvent:
-  //        break;
-  //    }
-  //    /*trace_ptr = graphics_system->PlayTrace(
-  //    trace_ptr, trace_size - (trace_ptr - trace_data),
-  //    GraphicsSystem::TracePlaybackMode::kBreakOnSwap);*/
-  //  }
-  //}
-
- protected:
-  void ParseTrace() {
-    auto trace_ptr = trace_data_;
-    Frame current_frame = {
-        trace_ptr, nullptr, 0,
-    };
-    const PacketStartCommand* packet_start = nullptr;
-    const uint8_t* packet_start_ptr = nullptr;
-    const uint8_t* last_ptr = trace_ptr;
-    bool pending_break = false;
-    while (trace_ptr < trace_data_ + trace_size_) {
-      ++current_frame.command_count;
-      auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(trace_ptr));
-      switch (type) {
-        case TraceCommandType::kPrimaryBufferStart: {
-          auto cmd =
-              reinterpret_cast<const PrimaryBufferStartCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd) + cmd->count * 4;
-          break;
-        }
-        case TraceCommandType::kPrimaryBufferEnd: {
-          auto cmd =
-              reinterpret_cast<const PrimaryBufferEndCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd);
-          break;
-        }
-        case TraceCommandType::kIndirectBufferStart: {
-          auto cmd =
-              reinterpret_cast<const IndirectBufferStartCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd) + cmd->count * 4;
-          break;
-        }
-        case TraceCommandType::kIndirectBufferEnd: {
-          auto cmd =
-              reinterpret_cast<const IndirectBufferEndCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd);
-          break;
-        }
-        case TraceCommandType::kPacketStart: {
-          auto cmd = reinterpret_cast<const PacketStartCommand*>(trace_ptr);
-          packet_start_ptr = trace_ptr;
-          packet_start = cmd;
-          trace_ptr += sizeof(*cmd) + cmd->count * 4;
-          break;
-        }
-        case TraceCommandType::kPacketEnd: {
-          auto cmd = reinterpret_cast<const PacketEndCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd);
-          if (!packet_start_ptr) {
-            continue;
-          }
-          auto packet_category =
-              GetPacketCategory(packet_start_ptr + sizeof(*packet_start));
-          switch (packet_category) {
-            case PacketCategory::kDraw: {
-              Frame::Command command;
-              command.type = Frame::Command::Type::kDraw;
-              command.head_ptr = packet_start_ptr;
-              command.start_ptr = last_ptr;
-              command.end_ptr = trace_ptr;
-              current_frame.commands.push_back(std::move(command));
-              last_ptr = trace_ptr;
-              break;
-            }
-            case PacketCategory::kSwap: {
-              //
-              break;
-            }
-          }
-          if (pending_break) {
-            current_frame.end_ptr = trace_ptr;
-            frames_.push_back(std::move(current_frame));
-            current_frame.start_ptr = trace_ptr;
-            current_frame.end_ptr = nullptr;
-            current_frame.command_count = 0;
-            pending_break = false;
-          }
-          break;
-        }
-        case TraceCommandType::kMemoryRead: {
-          auto cmd = reinterpret_cast<const MemoryReadCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd) + cmd->length;
-          break;
-        }
-        case TraceCommandType::kMemoryWrite: {
-          auto cmd = reinterpret_cast<const MemoryWriteCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd) + cmd->length;
-          break;
-        }
-        case TraceCommandType::kEvent: {
-          auto cmd = reinterpret_cast<const EventCommand*>(trace_ptr);
-          trace_ptr += sizeof(*cmd);
-          switch (cmd->event_type) {
-            case EventType::kSwap: {
-              pending_break = true;
-              break;
-            }
-          }
-          break;
-        }
-        default:
-          // Broken trace file?
-          assert_unhandled_case(type);
-          break;
-      }
-    }
-    if (pending_break || current_frame.command_count) {
-      current_frame.end_ptr = trace_ptr;
-      frames_.push_back(std::move(current_frame));
-    }
-  }
-
-  std::unique_ptr<MappedMemory> mmap_;
-  const uint8_t* trace_data_;
-  size_t trace_size_;
-  std::vector<Frame> frames_;
-};
-
 class TracePlayer : public TraceReader {
  public:
   TracePlayer(xe::ui::Loop* loop, GraphicsSystem* graphics_system)
@@ -1031,6 +793,9 @@ ShaderDisplayType DrawShaderTypeUI() {
 
 void DrawShaderUI(xe::ui::Window* window, TracePlayer& player, Memory* memory,
                   gl4::GL4Shader* shader, ShaderDisplayType display_type) {
+  // Loaded shaders are analyzed in the background until first bound.
+  shader->Analyze();
+
   // Must be prepared for advanced display modes.
   if (display_type != ShaderDisplayType::kUcode) {
     if (!shader->has_prepared()) {
@@ -19,3 +19,8 @@ DEFINE_string(dump_shaders, "",
               "Path to write GPU shaders to as they are compiled.");
 
 DEFINE_bool(vsync, true, "Enable VSYNC.");
+DEFINE_bool(vsync_stats, false,
+            "Log vblank timing jitter and interrupt callback durations on "
+            "shutdown.");
+DEFINE_int32(fast_forward_present_interval, 8,
+             "While fast-forwarding, present only every Nth guest frame.");
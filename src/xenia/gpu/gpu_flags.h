@@ -20,5 +20,7 @@ DECLARE_bool(trace_gpu_stream);
 DECLARE_string(dump_shaders);
 
 DECLARE_bool(vsync);
+DECLARE_bool(vsync_stats);
+DECLARE_int32(fast_forward_present_interval);
 
 #endif  // XENIA_GPU_GPU_FLAGS_H_
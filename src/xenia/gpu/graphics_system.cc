@@ -26,6 +26,11 @@ std::unique_ptr<GraphicsSystem> GraphicsSystem::Create(Emulator* emulator) {
   if (FLAGS_gpu.compare("gl4") == 0) {
     return xe::gpu::gl4::Create(emulator);
   } else {
+    if (FLAGS_gpu.compare("any") != 0) {
+      XELOGW("Graphics system '%s' is not available in this build",
+             FLAGS_gpu.c_str());
+    }
+
     // Create best available.
     std::unique_ptr<GraphicsSystem> best;
 
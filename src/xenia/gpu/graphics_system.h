@@ -14,7 +14,9 @@
 #include <memory>
 #include <thread>
 
+#include "xenia/base/delegate.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/gpu/register_file.h"
 #include "xenia/memory.h"
 #include "xenia/ui/loop.h"
 #include "xenia/ui/window.h"
@@ -43,6 +45,9 @@ class GraphicsSystem {
                          ui::Window* target_window);
   virtual void Shutdown();
 
+  // The GPU register file, or null if the backend keeps none.
+  virtual RegisterFile* register_file() { return nullptr; }
+
   void SetInterruptCallback(uint32_t callback, uint32_t user_data);
   virtual void InitializeRingBuffer(uint32_t ptr, uint32_t page_count) = 0;
   virtual void EnableReadPointerWriteBack(uint32_t ptr,
@@ -61,6 +66,14 @@ class GraphicsSystem {
                          TracePlaybackMode playback_mode) {}
   virtual void ClearCaches() {}
 
+  // While set, only every --fast_forward_present_interval frame is presented
+  // and vblanks are timed with plain sleeps.
+  void set_fast_forward(bool fast_forward) { fast_forward_ = fast_forward; }
+  bool fast_forward() const { return fast_forward_; }
+
+  // Fired on the command processor thread as each guest frame is presented.
+  Delegate<void> on_frame_presented;
+
  protected:
   explicit GraphicsSystem(Emulator* emulator);
 
@@ -72,6 +85,8 @@ class GraphicsSystem {
 
   uint32_t interrupt_callback_ = 0;
   uint32_t interrupt_callback_data_ = 0;
+
+  std::atomic<bool> fast_forward_ = {false};
 };
 
 }  // namespace gpu
@@ -9,7 +9,9 @@
 
 #include "xenia/gpu/register_file.h"
 
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 #include "xenia/base/math.h"
 
@@ -18,20 +20,50 @@ namespace gpu {
 
 RegisterFile::RegisterFile() { std::memset(values, 0, sizeof(values)); }
 
-const RegisterInfo* RegisterFile::GetRegisterInfo(uint32_t index) {
-  switch (index) {
+namespace {
+
+struct RegisterTableEntry {
+  uint32_t index;
+  RegisterInfo info;
+};
+const RegisterTableEntry kRegisterTable[] = {
 #define XE_GPU_REGISTER(index, type, name) \
-  case index: {                            \
-    static const RegisterInfo reg_info = { \
-        RegisterInfo::Type::type, #name,   \
-    };                                     \
-    return &reg_info;                      \
-  }
+  {index, {RegisterInfo::Type::type, #name}},
 #include "xenia/gpu/register_table.inc"
 #undef XE_GPU_REGISTER
-    default:
+};
+
+// Maps every register index up to the highest one known to its entry in
+// kRegisterTable plus one, or to 0 if the register is unknown.
+class RegisterInfoMap {
+ public:
+  RegisterInfoMap() {
+    uint32_t max_index = 0;
+    for (auto& entry : kRegisterTable) {
+      max_index = std::max(max_index, entry.index);
+    }
+    entries_.resize(max_index + 1);
+    for (size_t i = 0; i < xe::countof(kRegisterTable); ++i) {
+      entries_[kRegisterTable[i].index] = uint16_t(i + 1);
+    }
+  }
+
+  const RegisterInfo* Lookup(uint32_t index) const {
+    if (index >= entries_.size() || !entries_[index]) {
       return nullptr;
+    }
+    return &kRegisterTable[entries_[index] - 1].info;
   }
+
+ private:
+  std::vector<uint16_t> entries_;
+};
+
+}  // namespace
+
+const RegisterInfo* RegisterFile::GetRegisterInfo(uint32_t index) {
+  static const RegisterInfoMap register_info_map;
+  return register_info_map.Lookup(index);
 }
 
 }  //  namespace gpu
@@ -35,6 +35,8 @@ class RegisterFile {
  public:
   RegisterFile();
 
+  // Returns the type and name of the register, or nullptr if it is unknown.
+  // Lookups index a table built on first use.
   static const RegisterInfo* GetRegisterInfo(uint32_t index);
 
   static const size_t kRegisterCount = 0x5003;
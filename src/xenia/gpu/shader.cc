@@ -13,6 +13,7 @@
 
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/ucode_disassembler.h"
 
 namespace xe {
@@ -25,6 +26,7 @@ Shader::Shader(ShaderType shader_type, uint64_t data_hash,
                const uint32_t* dword_ptr, uint32_t dword_count)
     : shader_type_(shader_type),
       data_hash_(data_hash),
+      analysis_state_(AnalysisState::kPending),
       has_prepared_(false),
       is_valid_(false) {
   data_.resize(dword_count);
@@ -32,6 +34,21 @@ Shader::Shader(ShaderType shader_type, uint64_t data_hash,
   std::memset(&alloc_counts_, 0, sizeof(alloc_counts_));
   std::memset(&buffer_inputs_, 0, sizeof(buffer_inputs_));
   std::memset(&sampler_inputs_, 0, sizeof(sampler_inputs_));
+  std::memset(&constant_register_map_, 0, sizeof(constant_register_map_));
+}
+
+Shader::~Shader() = default;
+
+void Shader::Analyze() {
+  auto state = AnalysisState::kPending;
+  if (!analysis_state_.compare_exchange_strong(state, AnalysisState::kRunning,
+                                               std::memory_order_acquire)) {
+    while (analysis_state_.load(std::memory_order_acquire) !=
+           AnalysisState::kDone) {
+      xe::threading::MaybeYield();
+    }
+    return;
+  }
 
   // Disassemble ucode and stash.
   // TODO(benvanik): debug only.
@@ -40,9 +57,9 @@ Shader::Shader(ShaderType shader_type, uint64_t data_hash,
 
   // Gather input/output registers/etc.
   GatherIO();
-}
 
-Shader::~Shader() = default;
+  analysis_state_.store(AnalysisState::kDone, std::memory_order_release);
+}
 
 void Shader::GatherIO() {
   // Process all execution blocks.
@@ -121,6 +138,7 @@ void Shader::GatherExec(const instr_cf_exec_t* cf) {
       // TODO(benvanik): gather registers used, predicate bits used, etc.
       auto alu =
           reinterpret_cast<const instr_alu_t*>(data_.data() + alu_off * 3);
+      GatherConstantReads(alu);
       if (alu->export_data && alu->vector_write_mask) {
         switch (alu->vector_dest) {
           case 0:
@@ -153,6 +171,41 @@ void Shader::GatherExec(const instr_cf_exec_t* cf) {
   }
 }
 
+void Shader::GatherConstantReads(const instr_alu_t* alu) {
+  auto& map = constant_register_map_;
+  // Operands the instruction doesn't use may be marked too; that only costs
+  // a few extra constants being uploaded.
+  bool src3_is_constant = !alu->src3_sel;
+  switch (alu->scalar_opc) {
+    case MUL_CONST_0:
+    case MUL_CONST_1:
+    case ADD_CONST_0:
+    case ADD_CONST_1:
+    case SUB_CONST_0:
+    case SUB_CONST_1:
+      // src3 is always a constant, src3_sel is part of the second operand.
+      src3_is_constant = true;
+      break;
+  }
+  if (!alu->src1_sel || !alu->src2_sel || src3_is_constant) {
+    if (alu->const_0_rel_abs || alu->const_1_rel_abs) {
+      map.float_dynamic_addressing = true;
+    }
+  }
+  auto mark = [&map](uint32_t index) {
+    map.float_bitmap[index / 64] |= uint64_t(1) << (index % 64);
+  };
+  if (!alu->src1_sel) {
+    mark(alu->src1_reg);
+  }
+  if (!alu->src2_sel) {
+    mark(alu->src2_reg);
+  }
+  if (src3_is_constant) {
+    mark(alu->src3_reg);
+  }
+}
+
 void Shader::GatherVertexFetch(const instr_fetch_vtx_t* vtx) {
   // dst_reg/dst_swiz
   // src_reg/src_swiz
@@ -10,6 +10,7 @@
 #ifndef XENIA_GPU_SHADER_H_
 #define XENIA_GPU_SHADER_H_
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -24,6 +25,13 @@ class Shader {
   virtual ~Shader();
 
   ShaderType type() const { return shader_type_; }
+  uint64_t data_hash() const { return data_hash_; }
+
+  // Disassembles the microcode and gathers its inputs and outputs. Until this
+  // has run only type() and data() are valid. May be called from several
+  // threads at once: the first does the work and the rest wait for it.
+  void Analyze();
+
   bool has_prepared() const { return has_prepared_; }
   bool is_valid() const { return is_valid_; }
   const std::string& ucode_disassembly() const { return ucode_disassembly_; }
@@ -80,6 +88,17 @@ class Shader {
   const AllocCounts& alloc_counts() const { return alloc_counts_; }
   const std::vector<ucode::instr_cf_alloc_t>& allocs() const { return allocs_; }
 
+  // Float constants read by ALU instructions, relative to the shader's half of
+  // the constant file (vertex shaders use c0-c255, pixel shaders c256-c511).
+  struct ConstantRegisterMap {
+    uint64_t float_bitmap[256 / 64];
+    // Constants are indexed with the address register, so any may be read.
+    bool float_dynamic_addressing;
+  };
+  const ConstantRegisterMap& constant_register_map() const {
+    return constant_register_map_;
+  }
+
  protected:
   Shader(ShaderType shader_type, uint64_t data_hash, const uint32_t* dword_ptr,
          uint32_t dword_count);
@@ -87,12 +106,20 @@ class Shader {
   void GatherIO();
   void GatherAlloc(const ucode::instr_cf_alloc_t* cf);
   void GatherExec(const ucode::instr_cf_exec_t* cf);
+  void GatherConstantReads(const ucode::instr_alu_t* alu);
   void GatherVertexFetch(const ucode::instr_fetch_vtx_t* vtx);
   void GatherTextureFetch(const ucode::instr_fetch_tex_t* tex);
 
+  enum class AnalysisState {
+    kPending,
+    kRunning,
+    kDone,
+  };
+
   ShaderType shader_type_;
   uint64_t data_hash_;
   std::vector<uint32_t> data_;
+  std::atomic<AnalysisState> analysis_state_;
   bool has_prepared_;
   bool is_valid_;
 
@@ -106,6 +133,7 @@ class Shader {
   std::vector<ucode::instr_cf_alloc_t> allocs_;
   BufferInputs buffer_inputs_;
   SamplerInputs sampler_inputs_;
+  ConstantRegisterMap constant_register_map_;
 };
 
 }  // namespace gpu
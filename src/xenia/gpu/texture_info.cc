@@ -152,7 +152,8 @@ bool TextureInfo::Prepare(const xe_gpu_texture_fetch_t& fetch,
       info.CalculateTextureSizes1D(fetch);
       break;
     case Dimension::k2D:
-      info.CalculateTextureSizes2D(fetch);
+      info.CalculateTextureSizes2D(fetch.size_2d.width + 1,
+                                   fetch.size_2d.height + 1);
       break;
     case Dimension::k3D:
       // TODO(benvanik): calculate size.
@@ -162,6 +163,69 @@ bool TextureInfo::Prepare(const xe_gpu_texture_fetch_t& fetch,
       break;
   }
 
+  info.mip_address = fetch.mip_address << 12;
+  info.has_packed_mips = fetch.packed_mips != 0;
+  info.mip_levels = 1;
+  if (info.dimension == Dimension::k2D && fetch.mip_max_level) {
+    uint32_t width = info.size_2d.logical_width;
+    uint32_t height = info.size_2d.logical_height;
+    bool is_pow2 = !(width & (width - 1)) && !(height & (height - 1));
+    bool has_mip_storage =
+        info.mip_address ||
+        (info.has_packed_mips && std::min(width, height) <= 16);
+    if (is_pow2 && has_mip_storage) {
+      info.mip_levels = std::min(uint32_t(fetch.mip_max_level),
+                                 xe::log2_floor(std::max(width, height))) +
+                        1;
+    }
+  }
+
+  return true;
+}
+
+bool TextureInfo::GetMipLevel2D(uint32_t level, TextureInfo* out_info) const {
+  assert_true(dimension == Dimension::k2D);
+  if (!level || level >= mip_levels) {
+    return false;
+  }
+  auto& info = *out_info;
+  info = *this;
+  info.mip_address = 0;
+  info.mip_levels = 1;
+  info.has_packed_mips = false;
+
+  // Walk the chain up to the level, stopping early if we reach the packed
+  // tile that holds it.
+  uint32_t address = mip_address;
+  uint32_t packed_tile = kNotPacked;
+  if (has_packed_mips &&
+      std::min(size_2d.logical_width, size_2d.logical_height) <= 16) {
+    // All levels share the base level's tile, in which it comes first.
+    address = guest_address;
+    packed_tile = level;
+  } else {
+    uint32_t i = 1;
+    for (; i <= level; ++i) {
+      uint32_t width = std::max(size_2d.logical_width >> i, 1u);
+      uint32_t height = std::max(size_2d.logical_height >> i, 1u);
+      if (has_packed_mips && std::min(width, height) <= 16) {
+        packed_tile = level - i;
+        break;
+      }
+      if (i < level) {
+        info.CalculateTextureSizes2D(width, height);
+        address += info.input_length;
+      }
+    }
+  }
+  info.guest_address = address;
+  info.packed_tile = packed_tile;
+  info.CalculateTextureSizes2D(std::max(size_2d.logical_width >> level, 1u),
+                               std::max(size_2d.logical_height >> level, 1u));
+  info.size_2d.block_width =
+      info.size_2d.output_width / format_info->block_width;
+  info.size_2d.block_height =
+      info.size_2d.output_height / format_info->block_height;
   return true;
 }
 
@@ -170,9 +234,9 @@ void TextureInfo::CalculateTextureSizes1D(const xe_gpu_texture_fetch_t& fetch) {
   size_1d.width = fetch.size_1d.width;
 }
 
-void TextureInfo::CalculateTextureSizes2D(const xe_gpu_texture_fetch_t& fetch) {
-  size_2d.logical_width = 1 + fetch.size_2d.width;
-  size_2d.logical_height = 1 + fetch.size_2d.height;
+void TextureInfo::CalculateTextureSizes2D(uint32_t width, uint32_t height) {
+  size_2d.logical_width = width;
+  size_2d.logical_height = height;
 
   // Here be dragons. The values here are used in texture_cache.cc to copy
   // images and create GL textures. Changes here will impact that code.
@@ -292,7 +356,12 @@ void TextureInfo::GetPackedTileOffset(const TextureInfo& texture_info,
   // The minimum dimension is what matters most: if either width or height
   // is <= 16 this mode kicks in.
 
-  if (std::min(texture_info.size_2d.logical_width,
+  // Mip levels follow in the remaining space, each at half the offset of the
+  // one before: 8x8 at 8, 4x4 at 4, and then 2x2 and 1x1 along the other
+  // axis.
+
+  if (texture_info.packed_tile == kNotPacked ||
+      std::min(texture_info.size_2d.logical_width,
                texture_info.size_2d.logical_height) > 16) {
     // Too big, not packed.
     *out_offset_x = 0;
@@ -300,15 +369,27 @@ void TextureInfo::GetPackedTileOffset(const TextureInfo& texture_info,
     return;
   }
 
-  if (xe::log2_ceil(texture_info.size_2d.logical_width) >
-      xe::log2_ceil(texture_info.size_2d.logical_height)) {
-    // Wider than tall. Laid out vertically.
-    *out_offset_x = 0;
-    *out_offset_y = 16;
+  uint32_t tile = texture_info.packed_tile;
+  bool is_wide = xe::log2_ceil(texture_info.size_2d.logical_width) >
+                 xe::log2_ceil(texture_info.size_2d.logical_height);
+  if (tile < 3) {
+    if (is_wide) {
+      // Wider than tall. Laid out vertically.
+      *out_offset_x = 0;
+      *out_offset_y = 16 >> tile;
+    } else {
+      // Taller than wide. Laid out horizontally.
+      *out_offset_x = 16 >> tile;
+      *out_offset_y = 0;
+    }
   } else {
-    // Taller than wide. Laid out horizontally.
-    *out_offset_x = 16;
-    *out_offset_y = 0;
+    if (is_wide) {
+      *out_offset_x = 16 >> (tile - 2);
+      *out_offset_y = 0;
+    } else {
+      *out_offset_x = 0;
+      *out_offset_y = 16 >> (tile - 2);
+    }
   }
   *out_offset_x /= texture_info.format_info->block_width;
   *out_offset_y /= texture_info.format_info->block_height;
@@ -10,6 +10,7 @@
 #ifndef XENIA_GPU_TEXTURE_INFO_H_
 #define XENIA_GPU_TEXTURE_INFO_H_
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 
@@ -167,6 +168,19 @@ struct TextureInfo {
   bool is_tiled;
   uint32_t input_length;
   uint32_t output_length;
+  // Levels 1+ of a mip chain are stored one after another from mip_address.
+  // With has_packed_mips, levels no larger than 16 in either dimension share
+  // a single tile instead (the base level's, if it is that small).
+  uint32_t mip_address;
+  // Number of levels including the base; 1 if not mipmapped. Only 2D
+  // textures with power of two sizes are mipmapped for now.
+  uint32_t mip_levels;
+  bool has_packed_mips;
+  // Position of the level within its packed tile, if small enough to be in
+  // one, or kNotPacked.
+  uint32_t packed_tile;
+
+  static const uint32_t kNotPacked = UINT32_MAX;
 
   bool is_compressed() const {
     return format_info->type == FormatType::kCompressed;
@@ -209,6 +223,12 @@ struct TextureInfo {
   static bool Prepare(const xenos::xe_gpu_texture_fetch_t& fetch,
                       TextureInfo* out_info);
 
+  // Describes level 1 <= level < mip_levels of a 2D texture as a texture of
+  // its own, so that it can be untiled and uploaded like a base level.
+  // size_2d.block_width/block_height are the exact size of the level in
+  // blocks rather than tile aligned.
+  bool GetMipLevel2D(uint32_t level, TextureInfo* out_info) const;
+
   static void GetPackedTileOffset(const TextureInfo& texture_info,
                                   uint32_t* out_offset_x,
                                   uint32_t* out_offset_y);
@@ -216,6 +236,12 @@ struct TextureInfo {
                                      uint32_t log_bpp);
   static uint32_t TiledOffset2DInner(uint32_t x, uint32_t y, uint32_t bpp,
                                      uint32_t base_offset);
+  // Tiled memory stores runs of this many horizontally adjacent blocks
+  // contiguously, starting at any x that is a multiple of the run length.
+  // Untiling can copy whole runs instead of looking up every block.
+  static uint32_t TiledRunLength(uint32_t log_bpp) {
+    return log_bpp >= 4 ? 1 : std::min(8u, 16u >> log_bpp);
+  }
 
   uint64_t hash() const;
   bool operator==(const TextureInfo& other) const {
@@ -224,7 +250,7 @@ struct TextureInfo {
 
  private:
   void CalculateTextureSizes1D(const xenos::xe_gpu_texture_fetch_t& fetch);
-  void CalculateTextureSizes2D(const xenos::xe_gpu_texture_fetch_t& fetch);
+  void CalculateTextureSizes2D(uint32_t width, uint32_t height);
   void CalculateTextureSizesCube(const xenos::xe_gpu_texture_fetch_t& fetch);
 };
 
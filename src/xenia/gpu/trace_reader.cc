@@ -0,0 +1,234 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/trace_reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/memory.h"
+#include "xenia/gpu/xenos.h"
+
+namespace xe {
+namespace gpu {
+
+PacketCategory GetPacketCategory(const uint8_t* base_ptr) {
+  const uint32_t packet = xe::load_and_swap<uint32_t>(base_ptr);
+  const uint32_t packet_type = packet >> 30;
+  switch (packet_type) {
+    case 0x00:
+    case 0x01:
+    case 0x02: {
+      return PacketCategory::kGeneric;
+    }
+    case 0x03: {
+      uint32_t opcode = (packet >> 8) & 0x7F;
+      switch (opcode) {
+        case xenos::PM4_DRAW_INDX:
+        case xenos::PM4_DRAW_INDX_2:
+          return PacketCategory::kDraw;
+        case xenos::PM4_XE_SWAP:
+          return PacketCategory::kSwap;
+        default:
+          return PacketCategory::kGeneric;
+      }
+    }
+    default: {
+      assert_unhandled_case(packet_type);
+      return PacketCategory::kGeneric;
+    }
+  }
+}
+
+namespace {
+
+// Returns the size of the trace command at ptr including its payload, or 0
+// if it is not a valid command.
+size_t GetTraceCommandSize(const uint8_t* ptr) {
+  auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(ptr));
+  switch (type) {
+    case TraceCommandType::kPrimaryBufferStart: {
+      auto cmd = reinterpret_cast<const PrimaryBufferStartCommand*>(ptr);
+      return sizeof(*cmd) + cmd->count * 4;
+    }
+    case TraceCommandType::kPrimaryBufferEnd:
+      return sizeof(PrimaryBufferEndCommand);
+    case TraceCommandType::kIndirectBufferStart: {
+      auto cmd = reinterpret_cast<const IndirectBufferStartCommand*>(ptr);
+      return sizeof(*cmd) + cmd->count * 4;
+    }
+    case TraceCommandType::kIndirectBufferEnd:
+      return sizeof(IndirectBufferEndCommand);
+    case TraceCommandType::kPacketStart: {
+      auto cmd = reinterpret_cast<const PacketStartCommand*>(ptr);
+      return sizeof(*cmd) + cmd->count * 4;
+    }
+    case TraceCommandType::kPacketEnd:
+      return sizeof(PacketEndCommand);
+    case TraceCommandType::kMemoryRead: {
+      auto cmd = reinterpret_cast<const MemoryReadCommand*>(ptr);
+      return sizeof(*cmd) + cmd->length;
+    }
+    case TraceCommandType::kMemoryWrite: {
+      auto cmd = reinterpret_cast<const MemoryWriteCommand*>(ptr);
+      return sizeof(*cmd) + cmd->length;
+    }
+    case TraceCommandType::kEvent:
+      return sizeof(EventCommand);
+    default:
+      // Broken trace file?
+      assert_unhandled_case(type);
+      return 0;
+  }
+}
+
+}  // namespace
+
+bool TraceReader::Open(const std::wstring& path) {
+  Close();
+
+  mmap_ = MappedMemory::Open(path, MappedMemory::Mode::kRead, 0, 0,
+                             MappedMemory::AccessHint::kSequential);
+  if (!mmap_) {
+    return false;
+  }
+
+  trace_data_ = reinterpret_cast<const uint8_t*>(mmap_->data());
+  trace_size_ = mmap_->size();
+
+  if (!ReadFrameIndex()) {
+    // Traces that were not closed cleanly have no index.
+    IndexFrames();
+  }
+
+  return true;
+}
+
+void TraceReader::Close() {
+  mmap_.reset();
+  trace_data_ = nullptr;
+  trace_size_ = 0;
+  frames_.clear();
+}
+
+const TraceReader::Frame* TraceReader::frame(int n) const {
+  auto frame = &frames_[n];
+  if (!frame->parsed) {
+    ParseFrame(frame);
+  }
+  return frame;
+}
+
+bool TraceReader::ReadFrameIndex() {
+  TraceFrameIndexFooter footer;
+  if (trace_size_ < sizeof(footer)) {
+    return false;
+  }
+  size_t footer_offset = trace_size_ - sizeof(footer);
+  std::memcpy(&footer, trace_data_ + footer_offset, sizeof(footer));
+  if (footer.magic != kTraceFrameIndexMagic ||
+      footer.index_offset > footer_offset ||
+      (footer_offset - footer.index_offset) / sizeof(uint64_t) !=
+          footer.frame_count) {
+    return false;
+  }
+
+  auto index_ptr = trace_data_ + footer.index_offset;
+  uint64_t frame_start = 0;
+  for (uint32_t i = 0; i < footer.frame_count; ++i) {
+    uint64_t frame_end;
+    std::memcpy(&frame_end, index_ptr + i * sizeof(uint64_t),
+                sizeof(frame_end));
+    if (frame_end < frame_start || frame_end > footer.index_offset) {
+      frames_.clear();
+      return false;
+    }
+    AddFrame(trace_data_ + frame_start, trace_data_ + frame_end);
+    frame_start = frame_end;
+  }
+  trace_size_ = size_t(footer.index_offset);
+  return true;
+}
+
+void TraceReader::IndexFrames() {
+  auto trace_ptr = trace_data_;
+  auto trace_end = trace_data_ + trace_size_;
+  const uint8_t* frame_start_ptr = trace_ptr;
+  bool pending_break = false;
+  while (trace_ptr < trace_end) {
+    auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(trace_ptr));
+    size_t command_size = GetTraceCommandSize(trace_ptr);
+    if (!command_size) {
+      break;
+    }
+    if (type == TraceCommandType::kEvent &&
+        reinterpret_cast<const EventCommand*>(trace_ptr)->event_type ==
+            EventType::kSwap) {
+      pending_break = true;
+    }
+    trace_ptr += command_size;
+    if (type == TraceCommandType::kPacketEnd && pending_break) {
+      AddFrame(frame_start_ptr, trace_ptr);
+      frame_start_ptr = trace_ptr;
+      pending_break = false;
+    }
+  }
+  trace_ptr = std::min(trace_ptr, trace_end);
+  if (trace_ptr > frame_start_ptr) {
+    AddFrame(frame_start_ptr, trace_ptr);
+  }
+}
+
+void TraceReader::AddFrame(const uint8_t* start_ptr, const uint8_t* end_ptr) {
+  Frame frame;
+  frame.start_ptr = start_ptr;
+  frame.end_ptr = end_ptr;
+  frame.command_count = 0;
+  frame.parsed = false;
+  frames_.push_back(std::move(frame));
+}
+
+void TraceReader::ParseFrame(Frame* frame) const {
+  frame->parsed = true;
+  auto trace_ptr = frame->start_ptr;
+  const PacketStartCommand* packet_start = nullptr;
+  const uint8_t* packet_start_ptr = nullptr;
+  const uint8_t* last_ptr = trace_ptr;
+  while (trace_ptr < frame->end_ptr) {
+    auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(trace_ptr));
+    size_t command_size = GetTraceCommandSize(trace_ptr);
+    if (!command_size) {
+      break;
+    }
+    ++frame->command_count;
+    if (type == TraceCommandType::kPacketStart) {
+      packet_start_ptr = trace_ptr;
+      packet_start = reinterpret_cast<const PacketStartCommand*>(trace_ptr);
+    }
+    trace_ptr += command_size;
+    if (type != TraceCommandType::kPacketEnd || !packet_start_ptr) {
+      continue;
+    }
+    auto packet_category =
+        GetPacketCategory(packet_start_ptr + sizeof(*packet_start));
+    if (packet_category == PacketCategory::kDraw) {
+      Frame::Command command;
+      command.type = Frame::Command::Type::kDraw;
+      command.head_ptr = packet_start_ptr;
+      command.start_ptr = last_ptr;
+      command.end_ptr = trace_ptr;
+      frame->commands.push_back(std::move(command));
+      last_ptr = trace_ptr;
+    }
+  }
+}
+
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_TRACE_READER_H_
+#define XENIA_GPU_TRACE_READER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xenia/base/mapped_memory.h"
+#include "xenia/gpu/tracing.h"
+
+namespace xe {
+namespace gpu {
+
+enum class PacketCategory {
+  kGeneric,
+  kDraw,
+  kSwap,
+};
+PacketCategory GetPacketCategory(const uint8_t* base_ptr);
+
+// Maps a trace file and splits it into frames and the draws within them.
+// Frame bounds come from the index TraceWriter appends, or from a quick scan
+// of traces without one; the draws of a frame are found on first access.
+class TraceReader {
+ public:
+  struct Frame {
+    struct Command {
+      enum class Type {
+        kDraw,
+        kSwap,
+      };
+      const uint8_t* head_ptr;
+      const uint8_t* start_ptr;
+      const uint8_t* end_ptr;
+      Type type;
+      union {
+        struct {
+          //
+        } draw;
+        struct {
+          //
+        } swap;
+      };
+    };
+
+    const uint8_t* start_ptr;
+    const uint8_t* end_ptr;
+    int command_count;
+    std::vector<Command> commands;
+    bool parsed;
+  };
+
+  TraceReader() : trace_data_(nullptr), trace_size_(0) {}
+  ~TraceReader() = default;
+
+  const Frame* frame(int n) const;
+  int frame_count() const { return int(frames_.size()); }
+
+  bool Open(const std::wstring& path);
+  void Close();
+
+ protected:
+  // Reads frame bounds from the index at the end of the trace, if present.
+  bool ReadFrameIndex();
+  // Finds frame bounds by walking all trace commands.
+  void IndexFrames();
+  void AddFrame(const uint8_t* start_ptr, const uint8_t* end_ptr);
+  void ParseFrame(Frame* frame) const;
+
+  std::unique_ptr<MappedMemory> mmap_;
+  const uint8_t* trace_data_;
+  // Size of the trace commands, excluding the frame index.
+  size_t trace_size_;
+  mutable std::vector<Frame> frames_;
+};
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_TRACE_READER_H_
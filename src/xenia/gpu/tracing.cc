@@ -9,16 +9,27 @@
 
 #include "xenia/gpu/tracing.h"
 
+#include <cstring>
+
 #include "xenia/base/filesystem.h"
 #include "xenia/base/string.h"
 
+#include "third_party/xxhash/xxhash.h"
+
 namespace xe {
 namespace gpu {
 
+// Records are handed to the writer thread in chunks of about this size.
+const size_t kTraceChunkSize = 16 * 1024 * 1024;
+
 TraceWriter::TraceWriter(uint8_t* membase)
-    : membase_(membase), file_(nullptr) {}
+    : membase_(membase),
+      file_(nullptr),
+      writer_running_(false),
+      trace_offset_(0),
+      pending_frame_end_(false) {}
 
-TraceWriter::~TraceWriter() = default;
+TraceWriter::~TraceWriter() { Close(); }
 
 bool TraceWriter::Open(const std::wstring& path) {
   Close();
@@ -28,20 +39,175 @@ bool TraceWriter::Open(const std::wstring& path) {
   xe::filesystem::CreateFolder(base_path);
 
   file_ = xe::filesystem::OpenFile(canonical_path, "wb");
-  return file_ != nullptr;
+  if (!file_) {
+    return false;
+  }
+
+  recorded_ranges_.clear();
+  trace_offset_ = 0;
+  frame_end_offsets_.clear();
+  pending_frame_end_ = false;
+  current_chunk_.reserve(kTraceChunkSize);
+  writer_running_ = true;
+  writer_thread_ = xe::threading::Thread::Create(
+      {}, [this]() { WriterThreadMain(); });
+  writer_thread_->set_name("GPU Trace Writer");
+  return true;
 }
 
 void TraceWriter::Flush() {
   if (file_) {
-    fflush(file_);
+    SubmitChunk();
   }
 }
 
 void TraceWriter::Close() {
-  if (file_) {
-    fflush(file_);
-    fclose(file_);
-    file_ = nullptr;
+  if (!file_) {
+    return;
+  }
+  SubmitChunk();
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    writer_running_ = false;
+  }
+  writer_cond_.notify_all();
+  xe::threading::Wait(writer_thread_.get(), false);
+  writer_thread_.reset();
+  free_chunks_.clear();
+  recorded_ranges_.clear();
+
+  WriteFrameIndex();
+  fflush(file_);
+  fclose(file_);
+  file_ = nullptr;
+}
+
+void TraceWriter::WriteFrameIndex() {
+  // Whatever was recorded after the last swap is a frame of its own.
+  uint64_t last_frame_end =
+      frame_end_offsets_.empty() ? 0 : frame_end_offsets_.back();
+  if (trace_offset_ > last_frame_end) {
+    frame_end_offsets_.push_back(trace_offset_);
+  }
+  fwrite(frame_end_offsets_.data(), sizeof(uint64_t),
+         frame_end_offsets_.size(), file_);
+  TraceFrameIndexFooter footer = {
+      kTraceFrameIndexMagic, uint32_t(frame_end_offsets_.size()),
+      trace_offset_,
+  };
+  fwrite(&footer, sizeof(footer), 1, file_);
+  frame_end_offsets_.clear();
+}
+
+void TraceWriter::WriteBytes(const void* data, size_t length) {
+  trace_offset_ += length;
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  current_chunk_.insert(current_chunk_.end(), bytes, bytes + length);
+  if (current_chunk_.size() >= kTraceChunkSize) {
+    SubmitChunk();
+  }
+}
+
+void TraceWriter::SubmitChunk() {
+  if (current_chunk_.empty()) {
+    return;
+  }
+  std::vector<uint8_t> next_chunk;
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    pending_chunks_.push_back(std::move(current_chunk_));
+    if (!free_chunks_.empty()) {
+      next_chunk = std::move(free_chunks_.back());
+      free_chunks_.pop_back();
+    }
+  }
+  writer_cond_.notify_one();
+  current_chunk_ = std::move(next_chunk);
+  current_chunk_.clear();
+  current_chunk_.reserve(kTraceChunkSize);
+}
+
+void TraceWriter::WriterThreadMain() {
+  while (true) {
+    std::vector<uint8_t> chunk;
+    {
+      std::unique_lock<std::mutex> lock(writer_mutex_);
+      writer_cond_.wait(lock, [this]() {
+        return !writer_running_ || !pending_chunks_.empty();
+      });
+      if (pending_chunks_.empty()) {
+        // Only exits once everything has been written.
+        break;
+      }
+      chunk = std::move(pending_chunks_.front());
+      pending_chunks_.pop_front();
+    }
+    fwrite(chunk.data(), 1, chunk.size(), file_);
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    free_chunks_.push_back(std::move(chunk));
+  }
+}
+
+void TraceWriter::ForgetRecordedRanges(uint32_t base_ptr, size_t length) {
+  uint32_t end_ptr = base_ptr + uint32_t(length);
+  auto it = recorded_ranges_.lower_bound(base_ptr);
+  if (it != recorded_ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second.length > base_ptr) {
+      it = prev;
+    }
+  }
+  while (it != recorded_ranges_.end() && it->first < end_ptr) {
+    it = recorded_ranges_.erase(it);
+  }
+}
+
+void TraceWriter::WritePacketStart(uint32_t base_ptr, uint32_t count) {
+  if (!file_) {
+    return;
+  }
+  auto cmd = PacketStartCommand({
+      TraceCommandType::kPacketStart, base_ptr, count,
+  });
+  WriteBytes(&cmd, sizeof(cmd));
+  WriteBytes(membase_ + base_ptr, count * 4);
+  // Playback copies packets into memory too.
+  ForgetRecordedRanges(base_ptr, count * 4);
+}
+
+void TraceWriter::WriteMemoryRead(uint32_t base_ptr, size_t length) {
+  if (!file_) {
+    return;
+  }
+  uint64_t hash = XXH64(membase_ + base_ptr, length, 0);
+  auto it = recorded_ranges_.find(base_ptr);
+  if (it != recorded_ranges_.end() && it->second.length == length &&
+      it->second.hash == hash) {
+    return;
+  }
+  ForgetRecordedRanges(base_ptr, length);
+  recorded_ranges_.insert({base_ptr, {uint32_t(length), hash}});
+
+  auto cmd = MemoryReadCommand({
+      TraceCommandType::kMemoryRead, base_ptr, uint32_t(length),
+  });
+  WriteBytes(&cmd, sizeof(cmd));
+  WriteBytes(membase_ + base_ptr, length);
+}
+
+void TraceWriter::WriteEvent(EventType event_type) {
+  if (!file_) {
+    return;
+  }
+  auto cmd = EventCommand({
+      TraceCommandType::kEvent, event_type,
+  });
+  WriteBytes(&cmd, sizeof(cmd));
+  if (event_type == EventType::kSwap) {
+    // Frames can be played back on their own, so each must carry all the
+    // memory it reads.
+    recorded_ranges_.clear();
+    pending_frame_end_ = true;
   }
 }
 
@@ -10,8 +10,15 @@
 #ifndef XENIA_GPU_TRACING_H_
 #define XENIA_GPU_TRACING_H_
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include "xenia/base/threading.h"
 #include "xenia/memory.h"
 
 namespace xe {
@@ -80,6 +87,18 @@ struct EventCommand {
   EventType event_type;
 };
 
+const uint32_t kTraceFrameIndexMagic = 0x58444E49;  // 'INDX'
+
+// Ends traces closed by TraceWriter, preceded by the end offset of each
+// frame as a uint64_t, so that readers can find frames without walking the
+// whole trace.
+struct TraceFrameIndexFooter {
+  uint32_t magic;
+  uint32_t frame_count;
+  // Offset of the frame index, which is also the size of the commands.
+  uint64_t index_offset;
+};
+
 class TraceWriter {
  public:
   explicit TraceWriter(uint8_t* membase);
@@ -88,7 +107,9 @@ class TraceWriter {
   bool is_open() const { return file_ != nullptr; }
 
   bool Open(const std::wstring& path);
+  // Hands everything recorded so far to the writer thread.
   void Flush();
+  // Waits for all records to reach the file.
   void Close();
 
   void WritePrimaryBufferStart(uint32_t base_ptr, uint32_t count) {
@@ -98,7 +119,7 @@ class TraceWriter {
     auto cmd = PrimaryBufferStartCommand({
         TraceCommandType::kPrimaryBufferStart, base_ptr, 0,
     });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
+    WriteBytes(&cmd, sizeof(cmd));
   }
 
   void WritePrimaryBufferEnd() {
@@ -108,7 +129,7 @@ class TraceWriter {
     auto cmd = PrimaryBufferEndCommand({
         TraceCommandType::kPrimaryBufferEnd,
     });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
+    WriteBytes(&cmd, sizeof(cmd));
   }
 
   void WriteIndirectBufferStart(uint32_t base_ptr, uint32_t count) {
@@ -118,7 +139,7 @@ class TraceWriter {
     auto cmd = IndirectBufferStartCommand({
         TraceCommandType::kIndirectBufferStart, base_ptr, 0,
     });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
+    WriteBytes(&cmd, sizeof(cmd));
   }
 
   void WriteIndirectBufferEnd() {
@@ -128,19 +149,10 @@ class TraceWriter {
     auto cmd = IndirectBufferEndCommand({
         TraceCommandType::kIndirectBufferEnd,
     });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
+    WriteBytes(&cmd, sizeof(cmd));
   }
 
-  void WritePacketStart(uint32_t base_ptr, uint32_t count) {
-    if (!file_) {
-      return;
-    }
-    auto cmd = PacketStartCommand({
-        TraceCommandType::kPacketStart, base_ptr, count,
-    });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    fwrite(membase_ + base_ptr, 4, count, file_);
-  }
+  void WritePacketStart(uint32_t base_ptr, uint32_t count);
 
   void WritePacketEnd() {
     if (!file_) {
@@ -149,20 +161,18 @@ class TraceWriter {
     auto cmd = PacketEndCommand({
         TraceCommandType::kPacketEnd,
     });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-  }
-
-  void WriteMemoryRead(uint32_t base_ptr, size_t length) {
-    if (!file_) {
-      return;
+    WriteBytes(&cmd, sizeof(cmd));
+    if (pending_frame_end_) {
+      // Frames end with the packet that swapped.
+      frame_end_offsets_.push_back(trace_offset_);
+      pending_frame_end_ = false;
     }
-    auto cmd = MemoryReadCommand({
-        TraceCommandType::kMemoryRead, base_ptr, uint32_t(length),
-    });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    fwrite(membase_ + base_ptr, 1, length, file_);
   }
 
+  // Skipped if the range has already been recorded with the same contents
+  // this frame, as playback will still have them in place.
+  void WriteMemoryRead(uint32_t base_ptr, size_t length);
+
   void WriteMemoryWrite(uint32_t base_ptr, size_t length) {
     if (!file_) {
       return;
@@ -170,23 +180,44 @@ class TraceWriter {
     auto cmd = MemoryWriteCommand({
         TraceCommandType::kMemoryWrite, base_ptr, uint32_t(length),
     });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    fwrite(membase_ + base_ptr, 1, length, file_);
+    WriteBytes(&cmd, sizeof(cmd));
+    WriteBytes(membase_ + base_ptr, length);
   }
 
-  void WriteEvent(EventType event_type) {
-    if (!file_) {
-      return;
-    }
-    auto cmd = EventCommand({
-        TraceCommandType::kEvent, event_type,
-    });
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-  }
+  void WriteEvent(EventType event_type);
 
  private:
+  struct RecordedRange {
+    uint32_t length;
+    uint64_t hash;
+  };
+
+  void WriteBytes(const void* data, size_t length);
+  void WriteFrameIndex();
+  void SubmitChunk();
+  void ForgetRecordedRanges(uint32_t base_ptr, size_t length);
+  void WriterThreadMain();
+
   uint8_t* membase_;
   FILE* file_;
+
+  // Records are buffered into chunks that a background thread writes out,
+  // so the GPU thread never blocks on disk.
+  std::vector<uint8_t> current_chunk_;
+  std::unique_ptr<xe::threading::Thread> writer_thread_;
+  std::mutex writer_mutex_;
+  std::condition_variable writer_cond_;
+  std::deque<std::vector<uint8_t>> pending_chunks_;
+  std::vector<std::vector<uint8_t>> free_chunks_;
+  bool writer_running_;
+
+  // Memory read contents recorded this frame, by guest address.
+  std::map<uint32_t, RecordedRange> recorded_ranges_;
+
+  // Bytes recorded so far and where each frame ended, for the frame index.
+  uint64_t trace_offset_;
+  std::vector<uint64_t> frame_end_offsets_;
+  bool pending_frame_end_;
 };
 
 }  // namespace gpu
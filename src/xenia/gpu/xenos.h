@@ -191,6 +191,34 @@ inline int GetVertexFormatComponentCount(VertexFormat format) {
   }
 }
 
+// Size of a single element in the vertex buffer.
+inline int GetVertexFormatSizeInWords(VertexFormat format) {
+  switch (format) {
+    case VertexFormat::k_8_8_8_8:
+    case VertexFormat::k_2_10_10_10:
+    case VertexFormat::k_10_11_11:
+    case VertexFormat::k_11_11_10:
+    case VertexFormat::k_16_16:
+    case VertexFormat::k_16_16_FLOAT:
+    case VertexFormat::k_32:
+    case VertexFormat::k_32_FLOAT:
+      return 1;
+    case VertexFormat::k_16_16_16_16:
+    case VertexFormat::k_16_16_16_16_FLOAT:
+    case VertexFormat::k_32_32:
+    case VertexFormat::k_32_32_FLOAT:
+      return 2;
+    case VertexFormat::k_32_32_32_FLOAT:
+      return 3;
+    case VertexFormat::k_32_32_32_32:
+    case VertexFormat::k_32_32_32_32_FLOAT:
+      return 4;
+    default:
+      assert_unhandled_case(format);
+      return 0;
+  }
+}
+
 #define XE_GPU_MAKE_SWIZZLE(x, y, z, w)                        \
   (((XE_GPU_SWIZZLE_##x) << 0) | ((XE_GPU_SWIZZLE_##y) << 3) | \
    ((XE_GPU_SWIZZLE_##z) << 6) | ((XE_GPU_SWIZZLE_##w) << 9))
@@ -351,7 +379,8 @@ XEPACKEDUNION(xe_gpu_texture_fetch_t, {
     uint32_t unk4_1 : 22;
     uint32_t unk5 : 9;  // dword_5
     uint32_t dimension : 2;
-    uint32_t unk5b : 21;
+    uint32_t packed_mips : 1;
+    uint32_t mip_address : 20;
   });
   XEPACKEDSTRUCTANONYMOUS({
     uint32_t dword_0;
@@ -392,6 +421,20 @@ XEPACKEDUNION(xe_gpu_fetch_group_t, {
   });
 });
 
+// Sample counts at XE_GPU_REG_RB_SAMPLE_COUNT_ADDR, written by
+// PM4_EVENT_WRITE_ZPD. Unlike most GPU writes these are little endian; D3D
+// swaps them itself. The _A/_B halves are per tile.
+XEPACKEDSTRUCT(xe_gpu_depth_sample_counts, {
+  uint32_t Total_A;
+  uint32_t Total_B;
+  uint32_t ZFail_A;
+  uint32_t ZFail_B;
+  uint32_t ZPass_A;
+  uint32_t ZPass_B;
+  uint32_t StencilFail_A;
+  uint32_t StencilFail_B;
+});
+
 // Opcodes (IT_OPCODE) for Type-3 commands in the ringbuffer.
 // https://github.com/freedreno/amd-gpu/blob/master/include/api/gsl_pm4types.h
 // Not sure if all of these are used.
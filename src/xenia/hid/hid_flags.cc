@@ -10,3 +10,19 @@
 #include "xenia/hid/hid_flags.h"
 
 DEFINE_string(hid, "any", "Input system. Use: [any, nop, winkey, xinput]");
+DEFINE_int32(hid_poll_rate, 250,
+             "Rate (in Hz) controllers are polled at on a background thread. "
+             "0 queries the drivers synchronously on every guest request.");
+DEFINE_int32(hid_reprobe_interval_ms, 1000,
+             "How often disconnected controllers are checked for when "
+             "polling in the background.");
+DEFINE_bool(hid_latency_stats, false,
+            "Measures the time from controller state changes to the guest "
+            "reading them and to the next presented frame. Logged on exit.");
+DEFINE_string(hid_record, "",
+              "Records the input the guest reads, per presented frame, along "
+              "with the guest clock base to the given file. File I/O is "
+              "completed synchronously so --hid_replay runs match.");
+DEFINE_string(hid_replay, "",
+              "Replays a --hid_record file instead of reading controllers, "
+              "for reproducible benchmark runs.");
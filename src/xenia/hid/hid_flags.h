@@ -13,5 +13,10 @@
 #include <gflags/gflags.h>
 
 DECLARE_string(hid);
+DECLARE_int32(hid_poll_rate);
+DECLARE_int32(hid_reprobe_interval_ms);
+DECLARE_bool(hid_latency_stats);
+DECLARE_string(hid_record);
+DECLARE_string(hid_replay);
 
 #endif  // XENIA_HID_HID_FLAGS_H_
@@ -0,0 +1,184 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/hid/input_recording.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+
+namespace xe {
+namespace hid {
+
+static const uint32_t kRecordingMagic = 0x524E4958;  // 'XINR'
+static const uint32_t kRecordingVersion = 1;
+
+struct RecordingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t time_base;
+};
+
+InputRecording::~InputRecording() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+std::unique_ptr<InputRecording> InputRecording::Create(
+    const std::wstring& path, uint64_t time_base) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to create input recording %S", path.c_str());
+    return nullptr;
+  }
+  RecordingHeader header = {kRecordingMagic, kRecordingVersion, time_base};
+  fwrite(&header, sizeof(header), 1, file);
+
+  auto recording = std::unique_ptr<InputRecording>(new InputRecording());
+  recording->file_ = file;
+  recording->time_base_ = time_base;
+  return recording;
+}
+
+std::unique_ptr<InputRecording> InputRecording::Load(
+    const std::wstring& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    XELOGE("Unable to open input recording %S", path.c_str());
+    return nullptr;
+  }
+  RecordingHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != kRecordingMagic ||
+      header.version != kRecordingVersion) {
+    XELOGE("%S is not a supported input recording", path.c_str());
+    fclose(file);
+    return nullptr;
+  }
+
+  auto recording = std::unique_ptr<InputRecording>(new InputRecording());
+  recording->time_base_ = header.time_base;
+  Entry entry;
+  size_t entry_count = 0;
+  while (fread(&entry, sizeof(entry), 1, file) == 1) {
+    recording->tracks_[TrackKey(entry.type, entry.user_index)]
+        .entries.push_back(entry);
+    ++entry_count;
+  }
+  fclose(file);
+  XELOGI("Replaying %zu input events from %S", entry_count, path.c_str());
+  return recording;
+}
+
+void InputRecording::RecordCapabilities(uint32_t frame, uint32_t user_index,
+                                        X_RESULT result,
+                                        const X_INPUT_CAPABILITIES& caps) {
+  Record(EntryType::kCapabilities, frame, user_index, result, &caps,
+         sizeof(caps), true);
+}
+
+void InputRecording::RecordState(uint32_t frame, uint32_t user_index,
+                                 X_RESULT result, const X_INPUT_STATE& state) {
+  Record(EntryType::kState, frame, user_index, result, &state, sizeof(state),
+         true);
+}
+
+void InputRecording::RecordKeystroke(uint32_t frame, uint32_t user_index,
+                                     X_RESULT result,
+                                     const X_INPUT_KEYSTROKE& keystroke) {
+  // Keystrokes are events; only the ones delivered matter.
+  if (result != X_ERROR_SUCCESS) {
+    return;
+  }
+  Record(EntryType::kKeystroke, frame, user_index, result, &keystroke,
+         sizeof(keystroke), false);
+}
+
+void InputRecording::Record(EntryType type, uint32_t frame,
+                            uint32_t user_index, X_RESULT result,
+                            const void* data, size_t length,
+                            bool only_changes) {
+  Entry entry;
+  std::memset(&entry, 0, sizeof(entry));
+  entry.type = type;
+  entry.frame = frame;
+  entry.user_index = user_index;
+  entry.result = result;
+  // Failed queries leave the output undefined.
+  if (result == X_ERROR_SUCCESS) {
+    std::memcpy(entry.data, data, length);
+  }
+
+  std::lock_guard<xe::mutex> lock(mutex_);
+  auto& entries = tracks_[TrackKey(type, user_index)].entries;
+  if (only_changes && !entries.empty() && entries[0].result == result &&
+      !std::memcmp(entries[0].data, entry.data, sizeof(entry.data))) {
+    return;
+  }
+  entries.assign(1, entry);
+  fwrite(&entry, sizeof(entry), 1, file_);
+}
+
+X_RESULT InputRecording::ReplayCapabilities(uint32_t frame,
+                                            uint32_t user_index,
+                                            X_INPUT_CAPABILITIES* out_caps) {
+  return Replay(EntryType::kCapabilities, frame, user_index, out_caps,
+                sizeof(*out_caps));
+}
+
+X_RESULT InputRecording::ReplayState(uint32_t frame, uint32_t user_index,
+                                     X_INPUT_STATE* out_state) {
+  return Replay(EntryType::kState, frame, user_index, out_state,
+                sizeof(*out_state));
+}
+
+X_RESULT InputRecording::ReplayKeystroke(uint32_t frame, uint32_t user_index,
+                                         X_INPUT_KEYSTROKE* out_keystroke) {
+  std::lock_guard<xe::mutex> lock(mutex_);
+  auto it = tracks_.find(TrackKey(EntryType::kKeystroke, user_index));
+  if (it == tracks_.end()) {
+    return X_ERROR_EMPTY;
+  }
+  auto& track = it->second;
+  if (track.next_keystroke >= track.entries.size() ||
+      track.entries[track.next_keystroke].frame > frame) {
+    return X_ERROR_EMPTY;
+  }
+  auto& entry = track.entries[track.next_keystroke++];
+  std::memcpy(out_keystroke, entry.data, sizeof(*out_keystroke));
+  return entry.result;
+}
+
+X_RESULT InputRecording::Replay(EntryType type, uint32_t frame,
+                                uint32_t user_index, void* out_data,
+                                size_t length) {
+  // Tracks are not modified during replay.
+  auto it = tracks_.find(TrackKey(type, user_index));
+  if (it == tracks_.end()) {
+    return X_ERROR_DEVICE_NOT_CONNECTED;
+  }
+  auto& entries = it->second.entries;
+  auto next = std::upper_bound(
+      entries.begin(), entries.end(), frame,
+      [](uint32_t frame, const Entry& entry) { return frame < entry.frame; });
+  if (next == entries.begin()) {
+    return X_ERROR_DEVICE_NOT_CONNECTED;
+  }
+  auto& entry = *(next - 1);
+  if (entry.result == X_ERROR_SUCCESS) {
+    std::memcpy(out_data, entry.data, length);
+  }
+  return entry.result;
+}
+
+}  // namespace hid
+}  // namespace xe
@@ -0,0 +1,105 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_HID_INPUT_RECORDING_H_
+#define XENIA_HID_INPUT_RECORDING_H_
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/hid/input.h"
+#include "xenia/xbox.h"
+
+namespace xe {
+namespace hid {
+
+// What the guest got back from the input system, keyed by the number of
+// frames presented when it asked, plus the guest clock base of the run.
+// Replaying a recording hands the guest the same input on the same frames
+// regardless of what the host controllers do (--hid_record/--hid_replay).
+class InputRecording {
+ public:
+  ~InputRecording();
+
+  // Starts a new recording of a run using the given guest clock base.
+  static std::unique_ptr<InputRecording> Create(const std::wstring& path,
+                                                uint64_t time_base);
+  // Loads a recording for replay.
+  static std::unique_ptr<InputRecording> Load(const std::wstring& path);
+
+  bool is_replaying() const { return file_ == nullptr; }
+  uint64_t guest_system_time_base() const { return time_base_; }
+
+  // Recording. Capabilities and states are only written when they change.
+  void RecordCapabilities(uint32_t frame, uint32_t user_index, X_RESULT result,
+                          const X_INPUT_CAPABILITIES& caps);
+  void RecordState(uint32_t frame, uint32_t user_index, X_RESULT result,
+                   const X_INPUT_STATE& state);
+  void RecordKeystroke(uint32_t frame, uint32_t user_index, X_RESULT result,
+                       const X_INPUT_KEYSTROKE& keystroke);
+
+  // Replay. Returns what was last recorded at or before the frame. Each
+  // recorded keystroke is returned once, on or after its frame.
+  X_RESULT ReplayCapabilities(uint32_t frame, uint32_t user_index,
+                              X_INPUT_CAPABILITIES* out_caps);
+  X_RESULT ReplayState(uint32_t frame, uint32_t user_index,
+                       X_INPUT_STATE* out_state);
+  X_RESULT ReplayKeystroke(uint32_t frame, uint32_t user_index,
+                           X_INPUT_KEYSTROKE* out_keystroke);
+
+ private:
+  enum class EntryType : uint32_t {
+    kCapabilities = 0,
+    kState = 1,
+    kKeystroke = 2,
+  };
+
+  // On-disk record, in host byte order. Payloads keep their guest layout.
+  struct Entry {
+    EntryType type;
+    uint32_t frame;
+    uint32_t user_index;
+    X_RESULT result;
+    uint8_t data[sizeof(X_INPUT_CAPABILITIES)];
+  };
+
+  // Entries of one type for one user, in frame order.
+  struct Track {
+    std::vector<Entry> entries;
+    // Keystrokes before this index have been replayed.
+    size_t next_keystroke = 0;
+  };
+
+  InputRecording() = default;
+
+  static uint64_t TrackKey(EntryType type, uint32_t user_index) {
+    return (uint64_t(type) << 32) | user_index;
+  }
+
+  void Record(EntryType type, uint32_t frame, uint32_t user_index,
+              X_RESULT result, const void* data, size_t length,
+              bool only_changes);
+  X_RESULT Replay(EntryType type, uint32_t frame, uint32_t user_index,
+                  void* out_data, size_t length);
+
+  xe::mutex mutex_;
+  FILE* file_ = nullptr;
+  uint64_t time_base_ = 0;
+  // Recording keeps only the last entry of each track, replay all of them.
+  std::unordered_map<uint64_t, Track> tracks_;
+};
+
+}  // namespace hid
+}  // namespace xe
+
+#endif  // XENIA_HID_INPUT_RECORDING_H_
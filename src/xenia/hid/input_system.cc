@@ -9,10 +9,18 @@
 
 #include "xenia/hid/input_system.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
 #include "xenia/emulator.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/hid/hid_flags.h"
 #include "xenia/hid/input_driver.h"
+#include "xenia/hid/input_recording.h"
 #include "xenia/profiling.h"
 
 #include "xenia/hid/nop/nop_hid.h"
@@ -24,6 +32,10 @@
 namespace xe {
 namespace hid {
 
+// Upper bounds of all but the last latency histogram bucket, in microseconds.
+static const uint64_t kLatencyBoundsUs[] = {1000,  2000,  4000, 8000,
+                                            16667, 33333, 66667};
+
 std::unique_ptr<InputSystem> InputSystem::Create(Emulator* emulator) {
   auto input_system = std::make_unique<InputSystem>(emulator);
 
@@ -64,13 +76,42 @@ std::unique_ptr<InputSystem> InputSystem::Create(Emulator* emulator) {
 }
 
 InputSystem::InputSystem(Emulator* emulator)
-    : emulator_(emulator), memory_(emulator->memory()) {}
+    : emulator_(emulator), memory_(emulator->memory()) {
+  std::memset(last_gamepads_, 0, sizeof(last_gamepads_));
+}
 
-InputSystem::~InputSystem() = default;
+InputSystem::~InputSystem() {
+  StopPolling();
+  if (FLAGS_hid_latency_stats) {
+    DumpLatencyStats();
+  }
+}
 
 X_STATUS InputSystem::Setup() {
   processor_ = emulator_->processor();
 
+  if (!FLAGS_hid_replay.empty()) {
+    recording_ = InputRecording::Load(xe::to_wstring(FLAGS_hid_replay));
+    if (!recording_) {
+      return X_STATUS_UNSUCCESSFUL;
+    }
+    // Dates the guest sees (and any time-seeded randomness) must match too.
+    Clock::set_guest_system_time_base(recording_->guest_system_time_base());
+    // Host controllers are ignored, so there's nothing to poll.
+    return X_STATUS_SUCCESS;
+  }
+  if (!FLAGS_hid_record.empty()) {
+    recording_ = InputRecording::Create(xe::to_wstring(FLAGS_hid_record),
+                                        Clock::guest_system_time_base());
+    if (!recording_) {
+      return X_STATUS_UNSUCCESSFUL;
+    }
+  }
+
+  if (FLAGS_hid_poll_rate > 0) {
+    StartPolling(FLAGS_hid_poll_rate);
+  }
+
   return X_STATUS_SUCCESS;
 }
 
@@ -82,6 +123,20 @@ X_RESULT InputSystem::GetCapabilities(uint32_t user_index, uint32_t flags,
                                       X_INPUT_CAPABILITIES* out_caps) {
   SCOPE_profile_cpu_f("hid");
 
+  if (replaying()) {
+    return recording_->ReplayCapabilities(presented_frame_count_, user_index,
+                                          out_caps);
+  }
+  X_RESULT result = QueryCapabilities(user_index, flags, out_caps);
+  if (recording_) {
+    recording_->RecordCapabilities(presented_frame_count_, user_index, result,
+                                   *out_caps);
+  }
+  return result;
+}
+
+X_RESULT InputSystem::QueryCapabilities(uint32_t user_index, uint32_t flags,
+                                        X_INPUT_CAPABILITIES* out_caps) {
   bool any_connected = false;
   for (auto& driver : drivers_) {
     X_RESULT result = driver->GetCapabilities(user_index, flags, out_caps);
@@ -98,6 +153,40 @@ X_RESULT InputSystem::GetCapabilities(uint32_t user_index, uint32_t flags,
 X_RESULT InputSystem::GetState(uint32_t user_index, X_INPUT_STATE* out_state) {
   SCOPE_profile_cpu_f("hid");
 
+  if (replaying()) {
+    return recording_->ReplayState(presented_frame_count_, user_index,
+                                   out_state);
+  }
+  if (FLAGS_hid_latency_stats) {
+    TrackStateRead(user_index);
+  }
+  X_RESULT result = polling_ && user_index < kMaxUsers
+                        ? ReadCachedState(user_index, out_state)
+                        : QueryState(user_index, out_state);
+  if (recording_) {
+    recording_->RecordState(presented_frame_count_, user_index, result,
+                            *out_state);
+  }
+  return result;
+}
+
+X_RESULT InputSystem::ReadCachedState(uint32_t user_index,
+                                      X_INPUT_STATE* out_state) {
+  auto& cached = cached_states_[user_index];
+  X_RESULT result;
+  uint32_t sequence;
+  do {
+    sequence = cached.sequence.load(std::memory_order_acquire);
+    result = cached.result;
+    std::memcpy(out_state, &cached.state, sizeof(X_INPUT_STATE));
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) ||
+           sequence != cached.sequence.load(std::memory_order_relaxed));
+  return result;
+}
+
+X_RESULT InputSystem::QueryState(uint32_t user_index,
+                                 X_INPUT_STATE* out_state) {
   bool any_connected = false;
   for (auto& driver : drivers_) {
     X_RESULT result = driver->GetState(user_index, out_state);
@@ -105,12 +194,161 @@ X_RESULT InputSystem::GetState(uint32_t user_index, X_INPUT_STATE* out_state) {
       any_connected = true;
     }
     if (result == X_ERROR_SUCCESS) {
+      if (FLAGS_hid_latency_stats) {
+        TrackStateChange(user_index, result, *out_state);
+      }
       return result;
     }
   }
   return any_connected ? X_ERROR_EMPTY : X_ERROR_DEVICE_NOT_CONNECTED;
 }
 
+void InputSystem::StartPolling(uint32_t rate_hz) {
+  poll_interval_us_ = 1000000 / std::min(rate_hz, 1000u);
+  // Fill the cache before anyone can read it.
+  for (uint32_t user_index = 0; user_index < kMaxUsers; ++user_index) {
+    PollUser(user_index);
+  }
+  polling_ = true;
+  poll_thread_ =
+      xe::threading::Thread::Create({}, [this]() { PollThreadMain(); });
+  poll_thread_->set_name("HID Polling");
+  poll_thread_->set_priority(xe::threading::ThreadPriority::kAboveNormal);
+}
+
+void InputSystem::StopPolling() {
+  if (!polling_) {
+    return;
+  }
+  polling_ = false;
+  xe::threading::Wait(poll_thread_.get(), false);
+  poll_thread_.reset();
+}
+
+void InputSystem::PollThreadMain() {
+  while (polling_) {
+    for (uint32_t user_index = 0; user_index < kMaxUsers; ++user_index) {
+      PollUser(user_index);
+    }
+    xe::threading::Sleep(std::chrono::microseconds(poll_interval_us_));
+  }
+}
+
+void InputSystem::PollUser(uint32_t user_index) {
+  // Querying empty slots can stall for milliseconds on some drivers, so
+  // those are only retried every so often.
+  uint32_t now_ms = Clock::QueryHostUptimeMillis();
+  auto& cached = cached_states_[user_index];
+  if (cached.result == X_ERROR_DEVICE_NOT_CONNECTED &&
+      int32_t(now_ms - next_probe_ms_[user_index]) < 0) {
+    return;
+  }
+
+  X_INPUT_STATE state;
+  std::memset(&state, 0, sizeof(state));
+  X_RESULT result = QueryState(user_index, &state);
+  if (result == X_ERROR_DEVICE_NOT_CONNECTED) {
+    next_probe_ms_[user_index] = now_ms + FLAGS_hid_reprobe_interval_ms;
+  }
+
+  // Only this thread writes, so a plain increment pair is enough.
+  uint32_t sequence = cached.sequence.load(std::memory_order_relaxed);
+  cached.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  cached.result = result;
+  std::memcpy(&cached.state, &state, sizeof(X_INPUT_STATE));
+  cached.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void InputSystem::OnFramePresented() {
+  ++presented_frame_count_;
+  if (!FLAGS_hid_latency_stats) {
+    return;
+  }
+  std::lock_guard<xe::mutex> lock(latency_mutex_);
+  if (unpresented_change_ticks_) {
+    uint64_t us = RecordLatency(&present_latency_, unpresented_change_ticks_);
+    COUNT_profile_cpu("hid/InputSystem/PresentLatencyUs", us);
+    unpresented_change_ticks_ = 0;
+  }
+}
+
+void InputSystem::TrackStateChange(uint32_t user_index, X_RESULT result,
+                                   const X_INPUT_STATE& state) {
+  if (user_index >= kMaxUsers) {
+    return;
+  }
+  std::lock_guard<xe::mutex> lock(latency_mutex_);
+  auto& last_gamepad = last_gamepads_[user_index];
+  if (!std::memcmp(&last_gamepad, &state.gamepad, sizeof(X_INPUT_GAMEPAD))) {
+    return;
+  }
+  std::memcpy(&last_gamepad, &state.gamepad, sizeof(X_INPUT_GAMEPAD));
+  // Measure from the oldest change the guest hasn't seen yet.
+  if (!unread_change_ticks_[user_index]) {
+    unread_change_ticks_[user_index] = Clock::QueryHostTickCount();
+  }
+}
+
+void InputSystem::TrackStateRead(uint32_t user_index) {
+  if (user_index >= kMaxUsers) {
+    return;
+  }
+  std::lock_guard<xe::mutex> lock(latency_mutex_);
+  uint64_t change_ticks = unread_change_ticks_[user_index];
+  if (!change_ticks) {
+    return;
+  }
+  unread_change_ticks_[user_index] = 0;
+  uint64_t us = RecordLatency(&read_latency_, change_ticks);
+  COUNT_profile_cpu("hid/InputSystem/ReadLatencyUs", us);
+  if (!unpresented_change_ticks_) {
+    unpresented_change_ticks_ = change_ticks;
+  }
+}
+
+uint64_t InputSystem::RecordLatency(LatencyStats* stats,
+                                    uint64_t change_ticks) {
+  static_assert(sizeof(kLatencyBoundsUs) / sizeof(uint64_t) ==
+                    kLatencyBucketCount - 1,
+                "one bound per bucket");
+  uint64_t ticks = Clock::QueryHostTickCount() - change_ticks;
+  uint64_t us = ticks * 1000000 / Clock::host_tick_frequency();
+  size_t bucket = 0;
+  while (bucket < kLatencyBucketCount - 1 && us >= kLatencyBoundsUs[bucket]) {
+    ++bucket;
+  }
+  ++stats->count;
+  stats->total_ticks += ticks;
+  stats->max_ticks = std::max(stats->max_ticks, ticks);
+  ++stats->histogram[bucket];
+  return us;
+}
+
+void InputSystem::DumpLatencyStats() {
+  double ms_per_tick = 1000.0 / Clock::host_tick_frequency();
+  XELOGI("Input latency (histogram buckets <1 <2 <4 <8 <16.7 <33.3 <66.7 "
+         ">=66.7 ms):");
+  auto dump = [ms_per_tick](const char* name, const LatencyStats& stats) {
+    XELOGI(
+        "  %-20s %8lld samples %8.2fms avg %8.2fms max | %lld %lld %lld %lld "
+        "%lld %lld %lld %lld",
+        name, static_cast<long long>(stats.count),
+        stats.count ? stats.total_ticks * ms_per_tick / stats.count : 0.0,
+        stats.max_ticks * ms_per_tick,
+        static_cast<long long>(stats.histogram[0]),
+        static_cast<long long>(stats.histogram[1]),
+        static_cast<long long>(stats.histogram[2]),
+        static_cast<long long>(stats.histogram[3]),
+        static_cast<long long>(stats.histogram[4]),
+        static_cast<long long>(stats.histogram[5]),
+        static_cast<long long>(stats.histogram[6]),
+        static_cast<long long>(stats.histogram[7]));
+  };
+  dump("change to guest read", read_latency_);
+  dump("change to present", present_latency_);
+}
+
 X_RESULT InputSystem::SetState(uint32_t user_index,
                                X_INPUT_VIBRATION* vibration) {
   SCOPE_profile_cpu_f("hid");
@@ -132,6 +370,20 @@ X_RESULT InputSystem::GetKeystroke(uint32_t user_index, uint32_t flags,
                                    X_INPUT_KEYSTROKE* out_keystroke) {
   SCOPE_profile_cpu_f("hid");
 
+  if (replaying()) {
+    return recording_->ReplayKeystroke(presented_frame_count_, user_index,
+                                       out_keystroke);
+  }
+  X_RESULT result = QueryKeystroke(user_index, flags, out_keystroke);
+  if (recording_) {
+    recording_->RecordKeystroke(presented_frame_count_, user_index, result,
+                                *out_keystroke);
+  }
+  return result;
+}
+
+X_RESULT InputSystem::QueryKeystroke(uint32_t user_index, uint32_t flags,
+                                     X_INPUT_KEYSTROKE* out_keystroke) {
   bool any_connected = false;
   for (auto& driver : drivers_) {
     X_RESULT result = driver->GetKeystroke(user_index, flags, out_keystroke);
@@ -10,11 +10,15 @@
 #ifndef XENIA_HID_INPUT_SYSTEM_H_
 #define XENIA_HID_INPUT_SYSTEM_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
+#include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/hid/input.h"
+#include "xenia/hid/input_recording.h"
 #include "xenia/memory.h"
 #include "xenia/xbox.h"
 
@@ -49,12 +53,81 @@ class InputSystem {
   X_RESULT GetKeystroke(uint32_t user_index, uint32_t flags,
                         X_INPUT_KEYSTROKE* out_keystroke);
 
+  // Called by the graphics system when the guest presents a frame.
+  void OnFramePresented();
+
  private:
+  static const uint32_t kMaxUsers = 4;
+
+  // Latest state of a user as published by the polling thread. Readers retry
+  // while the sequence is odd or changes under them (a seqlock), so neither
+  // side ever waits on the other.
+  struct CachedState {
+    std::atomic<uint32_t> sequence = {0};
+    X_RESULT result = X_ERROR_DEVICE_NOT_CONNECTED;
+    X_INPUT_STATE state;
+  };
+
+  // Buckets of the latency histograms. The last bucket holds everything at or
+  // above the last bound.
+  static const size_t kLatencyBucketCount = 8;
+
+  struct LatencyStats {
+    uint64_t count;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+    uint64_t histogram[kLatencyBucketCount];
+  };
+
+  // True when input comes from a --hid_replay recording.
+  bool replaying() const { return recording_ && recording_->is_replaying(); }
+
+  // Ask each driver in turn. May block for a while on some drivers.
+  X_RESULT QueryCapabilities(uint32_t user_index, uint32_t flags,
+                             X_INPUT_CAPABILITIES* out_caps);
+  X_RESULT QueryState(uint32_t user_index, X_INPUT_STATE* out_state);
+  X_RESULT QueryKeystroke(uint32_t user_index, uint32_t flags,
+                          X_INPUT_KEYSTROKE* out_keystroke);
+  // Reads the state last published by the polling thread.
+  X_RESULT ReadCachedState(uint32_t user_index, X_INPUT_STATE* out_state);
+
+  void StartPolling(uint32_t rate_hz);
+  void StopPolling();
+  void PollThreadMain();
+  void PollUser(uint32_t user_index);
+
+  // --hid_latency_stats tracking. The state change time is kept until the
+  // guest reads the state and then until the next frame is presented.
+  void TrackStateChange(uint32_t user_index, X_RESULT result,
+                        const X_INPUT_STATE& state);
+  void TrackStateRead(uint32_t user_index);
+  // Returns the latency in microseconds.
+  uint64_t RecordLatency(LatencyStats* stats, uint64_t change_ticks);
+  void DumpLatencyStats();
+
   Emulator* emulator_ = nullptr;
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
 
   std::vector<std::unique_ptr<InputDriver>> drivers_;
+
+  CachedState cached_states_[kMaxUsers];
+  std::unique_ptr<xe::threading::Thread> poll_thread_;
+  std::atomic<bool> polling_ = {false};
+  uint32_t poll_interval_us_ = 0;
+  // Polling thread only: uptime (ms) disconnected users are next probed at.
+  uint32_t next_probe_ms_[kMaxUsers] = {0};
+
+  // --hid_record/--hid_replay, keyed by the presented frame count.
+  std::unique_ptr<InputRecording> recording_;
+  std::atomic<uint32_t> presented_frame_count_ = {0};
+
+  xe::mutex latency_mutex_;
+  X_INPUT_GAMEPAD last_gamepads_[kMaxUsers];
+  uint64_t unread_change_ticks_[kMaxUsers] = {0};
+  uint64_t unpresented_change_ticks_ = 0;
+  LatencyStats read_latency_ = {0};
+  LatencyStats present_latency_ = {0};
 };
 
 }  // namespace hid
@@ -9,8 +9,11 @@
 
 #include "xenia/kernel/async_request.h"
 
-#include "xenia/kernel/xobject.h"
+#include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/objects/xevent.h"
+#include "xenia/kernel/objects/xthread.h"
+#include "xenia/kernel/xobject.h"
+#include "xenia/memory.h"
 
 namespace xe {
 namespace kernel {
@@ -22,6 +25,8 @@ XAsyncRequest::XAsyncRequest(KernelState* kernel_state, XObject* object,
       object_(object),
       callback_(callback),
       callback_context_(callback_context),
+      io_status_block_ptr_(0),
+      apc_thread_(nullptr),
       apc_routine_(0),
       apc_context_(0) {
   object_->Retain();
@@ -31,6 +36,9 @@ XAsyncRequest::~XAsyncRequest() {
   for (auto it = wait_events_.begin(); it != wait_events_.end(); ++it) {
     (*it)->Release();
   }
+  if (apc_thread_) {
+    apc_thread_->Release();
+  }
   object_->Release();
 }
 
@@ -39,5 +47,36 @@ void XAsyncRequest::AddWaitEvent(XEvent* ev) {
   wait_events_.push_back(ev);
 }
 
+void XAsyncRequest::SetApc(XThread* thread, uint32_t apc_routine,
+                           uint32_t apc_context) {
+  if (apc_thread_) {
+    apc_thread_->Release();
+  }
+  thread->Retain();
+  apc_thread_ = thread;
+  apc_routine_ = apc_routine;
+  apc_context_ = apc_context;
+}
+
+void XAsyncRequest::Complete(X_STATUS result, uint32_t information) {
+  if (io_status_block_ptr_) {
+    auto io_status_block =
+        kernel_state_->memory()->TranslateVirtual<X_IO_STATUS_BLOCK*>(
+            io_status_block_ptr_);
+    io_status_block->information = information;
+    io_status_block->status = result;
+  }
+  for (auto ev : wait_events_) {
+    ev->Set(0, false);
+  }
+  if (apc_thread_ && apc_routine_) {
+    apc_thread_->EnqueueApc(apc_routine_, apc_context_, io_status_block_ptr_,
+                            0);
+  }
+  if (callback_) {
+    callback_(this, callback_context_);
+  }
+}
+
 }  // namespace kernel
 }  // namespace xe
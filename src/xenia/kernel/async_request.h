@@ -12,6 +12,7 @@
 
 #include <vector>
 
+#include "xenia/base/type_pool.h"
 #include "xenia/xbox.h"
 
 namespace xe {
@@ -20,8 +21,10 @@ namespace kernel {
 class KernelState;
 class XEvent;
 class XObject;
+class XThread;
 
-class XAsyncRequest {
+// One is created for every file read/write, so their memory is recycled.
+class XAsyncRequest : public PooledObject<XAsyncRequest> {
  public:
   typedef void (*CompletionCallback)(XAsyncRequest* request, void* context);
 
@@ -34,7 +37,16 @@ class XAsyncRequest {
 
   void AddWaitEvent(XEvent* ev);
 
-  // Complete(result)
+  // Guest X_IO_STATUS_BLOCK written on completion, if any.
+  void set_io_status_block(uint32_t io_status_block_ptr) {
+    io_status_block_ptr_ = io_status_block_ptr;
+  }
+  // Queues the given APC to the thread on completion.
+  void SetApc(XThread* thread, uint32_t apc_routine, uint32_t apc_context);
+
+  // Writes the io status block, signals all wait events, queues the APC and
+  // finally calls the completion callback. May be called from any thread.
+  void Complete(X_STATUS result, uint32_t information);
 
  protected:
   KernelState* kernel_state_;
@@ -43,6 +55,8 @@ class XAsyncRequest {
   void* callback_context_;
 
   std::vector<XEvent*> wait_events_;
+  uint32_t io_status_block_ptr_;
+  XThread* apc_thread_;
   uint32_t apc_routine_;
   uint32_t apc_context_;
 };
@@ -25,23 +25,16 @@ static const wchar_t* kThumbnailFileName = L"__thumbnail.png";
 static int content_device_id_ = 0;
 
 ContentPackage::ContentPackage(KernelState* kernel_state, std::string root_name,
-                               const XCONTENT_DATA& data,
-                               std::wstring package_path)
-    : kernel_state_(kernel_state), root_name_(std::move(root_name)) {
-  device_path_ = std::string("\\Device\\Content\\") +
-                 std::to_string(++content_device_id_) + "\\";
-
-  auto fs = kernel_state_->file_system();
-  auto device =
-      std::make_unique<vfs::HostPathDevice>(device_path_, package_path, false);
-  device->Initialize();
-  fs->RegisterDevice(std::move(device));
-  fs->RegisterSymbolicLink(root_name_ + ":", device_path_);
+                               std::string device_path)
+    : kernel_state_(kernel_state),
+      root_name_(std::move(root_name)),
+      device_path_(std::move(device_path)) {
+  kernel_state_->file_system()->RegisterSymbolicLink(root_name_ + ":",
+                                                     device_path_);
 }
 
 ContentPackage::~ContentPackage() {
   kernel_state_->file_system()->UnregisterSymbolicLink(root_name_ + ":");
-  // TODO(benvanik): unregister device.
 }
 
 ContentManager::ContentManager(KernelState* kernel_state,
@@ -96,28 +89,61 @@ std::wstring ContentManager::ResolvePackagePath(const XCONTENT_DATA& data) {
 
 std::vector<XCONTENT_DATA> ContentManager::ListContent(uint32_t device_id,
                                                        uint32_t content_type) {
-  std::vector<XCONTENT_DATA> result;
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
 
   // Search path:
   // content_root/title_id/type_name/*
   auto package_root = ResolvePackageRoot(content_type);
-  auto file_infos = xe::filesystem::ListFiles(package_root);
-  for (const auto& file_info : file_infos) {
-    if (file_info.type != xe::filesystem::FileInfo::Type::kDirectory) {
-      // Directories only.
-      continue;
+  xe::filesystem::FileInfo root_info;
+  if (!xe::filesystem::GetInfo(package_root, &root_info)) {
+    return {};
+  }
+  auto it = content_listings_.find(package_root);
+  if (it == content_listings_.end() ||
+      it->second.write_timestamp != root_info.write_timestamp) {
+    ContentListing listing;
+    listing.write_timestamp = root_info.write_timestamp;
+    auto file_infos = xe::filesystem::ListFiles(package_root);
+    for (const auto& file_info : file_infos) {
+      if (file_info.type != xe::filesystem::FileInfo::Type::kDirectory) {
+        // Directories only.
+        continue;
+      }
+      listing.package_names.push_back(file_info.name);
     }
+    content_listings_[package_root] = std::move(listing);
+    it = content_listings_.find(package_root);
+  }
+
+  std::vector<XCONTENT_DATA> result;
+  result.reserve(it->second.package_names.size());
+  for (const auto& package_name : it->second.package_names) {
     XCONTENT_DATA content_data;
     content_data.device_id = device_id;
     content_data.content_type = content_type;
-    content_data.display_name = file_info.name;
-    content_data.file_name = xe::to_string(file_info.name);
+    content_data.display_name = package_name;
+    content_data.file_name = xe::to_string(package_name);
     result.emplace_back(std::move(content_data));
   }
-
   return result;
 }
 
+std::string ContentManager::MountPackage(const std::wstring& package_path) {
+  auto it = mounted_packages_.find(package_path);
+  if (it != mounted_packages_.end()) {
+    return it->second;
+  }
+
+  auto device_path = std::string("\\Device\\Content\\") +
+                     std::to_string(++content_device_id_) + "\\";
+  auto device =
+      std::make_unique<vfs::HostPathDevice>(device_path, package_path, false);
+  device->Initialize();
+  kernel_state_->file_system()->RegisterDevice(std::move(device));
+  mounted_packages_.insert({package_path, device_path});
+  return device_path;
+}
+
 std::unique_ptr<ContentPackage> ContentManager::ResolvePackage(
     std::string root_name, const XCONTENT_DATA& data) {
   auto package_path = ResolvePackagePath(data);
@@ -125,10 +151,10 @@ std::unique_ptr<ContentPackage> ContentManager::ResolvePackage(
     return nullptr;
   }
 
-  std::lock_guard<xe::recursive_mutex> lock(content_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
 
   auto package = std::make_unique<ContentPackage>(kernel_state_, root_name,
-                                                  data, package_path);
+                                                  MountPackage(package_path));
   return package;
 }
 
@@ -139,7 +165,7 @@ bool ContentManager::ContentExists(const XCONTENT_DATA& data) {
 
 X_RESULT ContentManager::CreateContent(std::string root_name,
                                        const XCONTENT_DATA& data) {
-  std::lock_guard<xe::recursive_mutex> lock(content_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
 
   if (open_packages_.count(root_name)) {
     // Already content open with this root name.
@@ -155,6 +181,7 @@ X_RESULT ContentManager::CreateContent(std::string root_name,
   if (!xe::filesystem::CreateFolder(package_path)) {
     return X_ERROR_ACCESS_DENIED;
   }
+  content_listings_.erase(ResolvePackageRoot(data.content_type));
 
   auto package = ResolvePackage(root_name, data);
   assert_not_null(package);
@@ -166,7 +193,7 @@ X_RESULT ContentManager::CreateContent(std::string root_name,
 
 X_RESULT ContentManager::OpenContent(std::string root_name,
                                      const XCONTENT_DATA& data) {
-  std::lock_guard<xe::recursive_mutex> lock(content_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
 
   if (open_packages_.count(root_name)) {
     // Already content open with this root name.
@@ -189,7 +216,7 @@ X_RESULT ContentManager::OpenContent(std::string root_name,
 }
 
 X_RESULT ContentManager::CloseContent(std::string root_name) {
-  std::lock_guard<xe::recursive_mutex> lock(content_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
 
   auto it = open_packages_.find(root_name);
   if (it == open_packages_.end()) {
@@ -205,7 +232,7 @@ X_RESULT ContentManager::CloseContent(std::string root_name) {
 
 X_RESULT ContentManager::GetContentThumbnail(const XCONTENT_DATA& data,
                                              std::vector<uint8_t>* buffer) {
-  std::lock_guard<xe::recursive_mutex> lock(content_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
   auto package_path = ResolvePackagePath(data);
   auto thumb_path = xe::join_paths(package_path, kThumbnailFileName);
   if (xe::filesystem::PathExists(thumb_path)) {
@@ -224,7 +251,7 @@ X_RESULT ContentManager::GetContentThumbnail(const XCONTENT_DATA& data,
 
 X_RESULT ContentManager::SetContentThumbnail(const XCONTENT_DATA& data,
                                              std::vector<uint8_t> buffer) {
-  std::lock_guard<xe::recursive_mutex> lock(content_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
   auto package_path = ResolvePackagePath(data);
   xe::filesystem::CreateFolder(package_path);
   if (xe::filesystem::PathExists(package_path)) {
@@ -239,11 +266,28 @@ X_RESULT ContentManager::SetContentThumbnail(const XCONTENT_DATA& data,
 }
 
 X_RESULT ContentManager::DeleteContent(const XCONTENT_DATA& data) {
-  std::lock_guard<xe::recursive_mutex> lock(content_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(content_mutex_);
 
   auto package_path = ResolvePackagePath(data);
   if (xe::filesystem::PathExists(package_path)) {
+    // The mounted device describes files that are about to go away. Drop it
+    // along with the roots of any packages opened on it; a new one is mounted
+    // if the package is created again.
+    auto mounted_it = mounted_packages_.find(package_path);
+    if (mounted_it != mounted_packages_.end()) {
+      for (auto it = open_packages_.begin(); it != open_packages_.end();) {
+        if (it->second->device_path() == mounted_it->second) {
+          delete it->second;
+          it = open_packages_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      kernel_state_->file_system()->UnregisterDevice(mounted_it->second);
+      mounted_packages_.erase(mounted_it);
+    }
     xe::filesystem::DeleteFolder(package_path);
+    content_listings_.erase(ResolvePackageRoot(data.content_type));
     return X_ERROR_SUCCESS;
   } else {
     return X_ERROR_FILE_NOT_FOUND;
@@ -48,12 +48,16 @@ struct XCONTENT_DATA {
   }
 };
 
+// An open package, binding a root name (like 'save:') to the device the
+// package contents are mounted on.
 class ContentPackage {
  public:
   ContentPackage(KernelState* kernel_state, std::string root_name,
-                 const XCONTENT_DATA& data, std::wstring package_path);
+                 std::string device_path);
   ~ContentPackage();
 
+  const std::string& device_path() const { return device_path_; }
+
  private:
   KernelState* kernel_state_;
   std::string root_name_;
@@ -81,15 +85,32 @@ class ContentManager {
                                std::vector<uint8_t> buffer);
   X_RESULT DeleteContent(const XCONTENT_DATA& data);
 
+  uint64_t lock_contention_count() const {
+    return content_mutex_.contention_count();
+  }
+
  private:
   std::wstring ResolvePackageRoot(uint32_t content_type);
   std::wstring ResolvePackagePath(const XCONTENT_DATA& data);
+  // Returns the device path the package is mounted on, mounting it on first
+  // use. Devices stay mounted so reopening a package skips the directory scan.
+  std::string MountPackage(const std::wstring& package_path);
 
   KernelState* kernel_state_;
   std::wstring root_path_;
 
-  xe::recursive_mutex content_mutex_;
+  xe::counted_recursive_mutex content_mutex_;
   std::unordered_map<std::string, ContentPackage*> open_packages_;
+  // Package path -> mounted device path.
+  std::unordered_map<std::wstring, std::string> mounted_packages_;
+
+  // Package listings per package root, reused while the root folder's write
+  // timestamp is unchanged.
+  struct ContentListing {
+    uint64_t write_timestamp;
+    std::vector<std::wstring> package_names;
+  };
+  std::unordered_map<std::wstring, ContentListing> content_listings_;
 };
 
 }  // namespace kernel
@@ -33,11 +33,15 @@ class Dispatcher {
 
   NativeList* dpc_list() const { return dpc_list_; }
 
+  uint64_t lock_contention_count() const {
+    return lock_.contention_count();
+  }
+
  private:
  private:
   KernelState* kernel_state_;
 
-  xe::mutex lock_;
+  xe::counted_mutex lock_;
   NativeList* dpc_list_;
 };
 
@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <string>
 
 #include "xenia/base/assert.h"
@@ -29,11 +30,14 @@
 #include "xenia/kernel/xboxkrnl_module.h"
 #include "xenia/kernel/xboxkrnl_private.h"
 #include "xenia/kernel/xobject.h"
+#include "xenia/profiling.h"
 
 DEFINE_bool(headless, false,
             "Don't display any UI, using defaults for prompts as needed.");
 DEFINE_string(content_root, "content",
               "Root path for content (save/etc) storage.");
+DEFINE_int32(io_worker_count, 2,
+             "Number of host threads servicing asynchronous guest file I/O.");
 
 namespace xe {
 namespace kernel {
@@ -54,7 +58,8 @@ KernelState::KernelState(Emulator* emulator)
       has_notified_startup_(false),
       process_type_(X_PROCTYPE_USER),
       process_info_block_address_(0),
-      dispatch_thread_running_(false) {
+      dispatch_thread_running_(false),
+      io_threads_running_(false) {
   processor_ = emulator->processor();
   file_system_ = emulator->file_system();
 
@@ -99,6 +104,18 @@ KernelState::~KernelState() {
     dispatch_thread_->Wait(0, 0, 0, nullptr);
   }
 
+  if (io_threads_running_) {
+    {
+      std::lock_guard<std::mutex> lock(io_mutex_);
+      io_threads_running_ = false;
+    }
+    io_cond_.notify_all();
+    for (auto& io_thread : io_threads_) {
+      io_thread->Wait(0, 0, 0, nullptr);
+    }
+    io_threads_.clear();
+  }
+
   executable_module_.reset();
   user_modules_.clear();
   kernel_modules_.clear();
@@ -174,7 +191,7 @@ bool KernelState::IsKernelModule(const char* name) {
     // Executing module isn't a kernel module.
     return false;
   }
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(object_mutex_);
   for (auto kernel_module : kernel_modules_) {
     if (kernel_module->Matches(name)) {
       return true;
@@ -204,7 +221,7 @@ object_ref<XModule> KernelState::GetModule(const char* name) {
     // Some games request this, for some reason. wtf.
     return nullptr;
   }
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(object_mutex_);
   for (auto kernel_module : kernel_modules_) {
     if (kernel_module->Matches(name)) {
       return retain_object(kernel_module.get());
@@ -281,7 +298,7 @@ void KernelState::SetExecutableModule(object_ref<XUserModule> module) {
 }
 
 void KernelState::LoadKernelModule(object_ref<XKernelModule> kernel_module) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(object_mutex_);
   kernel_modules_.push_back(std::move(kernel_module));
 }
 
@@ -296,7 +313,7 @@ object_ref<XUserModule> KernelState::LoadUserModule(const char* raw_name) {
 
   object_ref<XUserModule> module;
   {
-    std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+    std::lock_guard<xe::counted_recursive_mutex> lock(object_mutex_);
 
     // See if we've already loaded it
     for (auto& existing_module : user_modules_) {
@@ -336,8 +353,13 @@ object_ref<XUserModule> KernelState::LoadUserModule(const char* raw_name) {
   return module;
 }
 
+std::vector<object_ref<XUserModule>> KernelState::GetUserModules() {
+  std::lock_guard<xe::counted_recursive_mutex> lock(object_mutex_);
+  return user_modules_;
+}
+
 void KernelState::TerminateTitle(bool from_guest_thread) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(object_mutex_);
 
   // First: call terminate routines.
   // TODO(benvanik): these might take arguments.
@@ -354,24 +376,27 @@ void KernelState::TerminateTitle(bool from_guest_thread) {
   */
 
   // Second: Kill all guest threads.
-  for (auto it = threads_by_id_.begin(); it != threads_by_id_.end();) {
-    if (it->second->is_guest_thread()) {
-      auto thread = it->second;
-
-      if (from_guest_thread && XThread::IsInThread(thread)) {
-        // Don't terminate ourselves.
+  {
+    std::lock_guard<xe::counted_recursive_mutex> threads_lock(threads_mutex_);
+    for (auto it = threads_by_id_.begin(); it != threads_by_id_.end();) {
+      if (it->second->is_guest_thread()) {
+        auto thread = it->second;
+
+        if (from_guest_thread && XThread::IsInThread(thread)) {
+          // Don't terminate ourselves.
+          ++it;
+          continue;
+        }
+
+        if (thread->is_running()) {
+          thread->Terminate(0);
+        }
+
+        // Erase it from the thread list.
+        it = threads_by_id_.erase(it);
+      } else {
         ++it;
-        continue;
-      }
-
-      if (thread->is_running()) {
-        thread->Terminate(0);
       }
-
-      // Erase it from the thread list.
-      it = threads_by_id_.erase(it);
-    } else {
-      ++it;
     }
   }
 
@@ -385,7 +410,11 @@ void KernelState::TerminateTitle(bool from_guest_thread) {
   user_modules_.clear();
 
   if (from_guest_thread) {
-    threads_by_id_.erase(XThread::GetCurrentThread()->thread_id());
+    {
+      std::lock_guard<xe::counted_recursive_mutex> threads_lock(
+          threads_mutex_);
+      threads_by_id_.erase(XThread::GetCurrentThread()->thread_id());
+    }
 
     // Now commit suicide (using Terminate, because we can't call into guest
     // code anymore)
@@ -397,7 +426,7 @@ void KernelState::TerminateTitle(bool from_guest_thread) {
 }
 
 void KernelState::RegisterThread(XThread* thread) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(threads_mutex_);
   threads_by_id_[thread->thread_id()] = thread;
 
   auto pib =
@@ -406,7 +435,7 @@ void KernelState::RegisterThread(XThread* thread) {
 }
 
 void KernelState::UnregisterThread(XThread* thread) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(threads_mutex_);
   auto it = threads_by_id_.find(thread->thread_id());
   if (it != threads_by_id_.end()) {
     threads_by_id_.erase(it);
@@ -418,15 +447,13 @@ void KernelState::UnregisterThread(XThread* thread) {
 }
 
 void KernelState::OnThreadExecute(XThread* thread) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
-
   // Must be called on executing thread.
   assert_true(XThread::GetCurrentThread() == thread);
 
   // Call DllMain(DLL_THREAD_ATTACH) for each user module:
   // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682583%28v=vs.85%29.aspx
   auto thread_state = thread->thread_state();
-  for (auto user_module : user_modules_) {
+  for (auto& user_module : GetUserModules()) {
     if (user_module->dll_module() && user_module->entry_point()) {
       uint64_t args[] = {
           user_module->handle(),
@@ -440,15 +467,13 @@ void KernelState::OnThreadExecute(XThread* thread) {
 }
 
 void KernelState::OnThreadExit(XThread* thread) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
-
   // Must be called on executing thread.
   assert_true(XThread::GetCurrentThread() == thread);
 
   // Call DllMain(DLL_THREAD_DETACH) for each user module:
   // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682583%28v=vs.85%29.aspx
   auto thread_state = thread->thread_state();
-  for (auto user_module : user_modules_) {
+  for (auto& user_module : GetUserModules()) {
     if (user_module->dll_module() && user_module->entry_point()) {
       uint64_t args[] = {
           user_module->handle(),
@@ -466,7 +491,7 @@ void KernelState::OnThreadExit(XThread* thread) {
 }
 
 object_ref<XThread> KernelState::GetThreadByID(uint32_t thread_id) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(threads_mutex_);
   XThread* thread = nullptr;
   auto it = threads_by_id_.find(thread_id);
   if (it != threads_by_id_.end()) {
@@ -475,8 +500,18 @@ object_ref<XThread> KernelState::GetThreadByID(uint32_t thread_id) {
   return retain_object(thread);
 }
 
+std::vector<object_ref<XThread>> KernelState::GetThreads() {
+  std::lock_guard<xe::counted_recursive_mutex> lock(threads_mutex_);
+  std::vector<object_ref<XThread>> threads;
+  threads.reserve(threads_by_id_.size());
+  for (auto& it : threads_by_id_) {
+    threads.push_back(retain_object(it.second));
+  }
+  return threads;
+}
+
 void KernelState::RegisterNotifyListener(XNotifyListener* listener) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_mutex> lock(notify_mutex_);
   notify_listeners_.push_back(retain_object(listener));
 
   // Games seem to expect a few notifications on startup, only for the first
@@ -484,23 +519,27 @@ void KernelState::RegisterNotifyListener(XNotifyListener* listener) {
   // http://cs.rin.ru/forum/viewtopic.php?f=38&t=60668&hilit=resident+evil+5&start=375
   if (!has_notified_startup_ && listener->mask() & 0x00000001) {
     has_notified_startup_ = true;
-    // XN_SYS_UI (on, off)
-    listener->EnqueueNotification(0x00000009, 1);
-    listener->EnqueueNotification(0x00000009, 0);
-    // XN_SYS_SIGNINCHANGED x2
-    listener->EnqueueNotification(0x0000000A, 1);
-    listener->EnqueueNotification(0x0000000A, 1);
-    // XN_SYS_INPUTDEVICESCHANGED x2
-    listener->EnqueueNotification(0x00000012, 0);
-    listener->EnqueueNotification(0x00000012, 0);
-    // XN_SYS_INPUTDEVICECONFIGCHANGED x2
-    listener->EnqueueNotification(0x00000013, 0);
-    listener->EnqueueNotification(0x00000013, 0);
+    const XNotifyListener::Notification startup_notifications[] = {
+        // XN_SYS_UI (on, off)
+        {0x00000009, 1},
+        {0x00000009, 0},
+        // XN_SYS_SIGNINCHANGED x2
+        {0x0000000A, 1},
+        {0x0000000A, 1},
+        // XN_SYS_INPUTDEVICESCHANGED x2
+        {0x00000012, 0},
+        {0x00000012, 0},
+        // XN_SYS_INPUTDEVICECONFIGCHANGED x2
+        {0x00000013, 0},
+        {0x00000013, 0},
+    };
+    listener->EnqueueNotifications(startup_notifications,
+                                   xe::countof(startup_notifications));
   }
 }
 
 void KernelState::UnregisterNotifyListener(XNotifyListener* listener) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_mutex> lock(notify_mutex_);
   for (auto it = notify_listeners_.begin(); it != notify_listeners_.end();
        ++it) {
     if ((*it).get() == listener) {
@@ -511,13 +550,28 @@ void KernelState::UnregisterNotifyListener(XNotifyListener* listener) {
 }
 
 void KernelState::BroadcastNotification(XNotificationID id, uint32_t data) {
-  std::lock_guard<xe::recursive_mutex> lock(object_mutex_);
+  std::lock_guard<xe::counted_mutex> lock(notify_mutex_);
   for (auto it = notify_listeners_.begin(); it != notify_listeners_.end();
        ++it) {
     (*it)->EnqueueNotification(id, data);
   }
 }
 
+void KernelState::ReportLockContention() {
+  SCOPE_profile_cpu_f("kernel");
+  COUNT_profile_cpu("kernel/Locks/Objects", object_mutex_.contention_count());
+  COUNT_profile_cpu("kernel/Locks/Threads", threads_mutex_.contention_count());
+  COUNT_profile_cpu("kernel/Locks/Notify", notify_mutex_.contention_count());
+  COUNT_profile_cpu("kernel/Locks/NativeObjects",
+                    native_object_mutex_.contention_count());
+  COUNT_profile_cpu("kernel/Locks/ObjectTable",
+                    object_table_->lock_contention_count());
+  COUNT_profile_cpu("kernel/Locks/Dispatcher",
+                    dispatcher_->lock_contention_count());
+  COUNT_profile_cpu("kernel/Locks/Content",
+                    content_manager_->lock_contention_count());
+}
+
 void KernelState::CompleteOverlapped(uint32_t overlapped_ptr, X_RESULT result) {
   CompleteOverlappedEx(overlapped_ptr, result, result, 0);
 }
@@ -585,5 +639,65 @@ void KernelState::CompleteOverlappedDeferredEx(
   dispatch_cond_.notify_all();
 }
 
+void KernelState::QueueIoRequest(std::function<void()> fn) {
+  std::unique_lock<std::mutex> lock(io_mutex_);
+  if (!io_threads_running_) {
+    io_threads_running_ = true;
+    int32_t worker_count = std::max(1, FLAGS_io_worker_count);
+    for (int32_t i = 0; i < worker_count; ++i) {
+      auto io_thread = object_ref<XHostThread>(
+          new XHostThread(this, 128 * 1024, 0, [this]() {
+            while (true) {
+              std::unique_lock<std::mutex> lock(io_mutex_);
+              io_cond_.wait(lock, [this]() {
+                return !io_threads_running_ || !io_queue_.empty();
+              });
+              if (!io_threads_running_) {
+                break;
+              }
+              auto fn = std::move(io_queue_.front());
+              io_queue_.pop_front();
+              lock.unlock();
+              fn();
+            }
+            return 0;
+          }));
+      io_thread->set_name("Kernel I/O Thread " + std::to_string(i));
+      io_thread->Create();
+      io_threads_.push_back(std::move(io_thread));
+    }
+  }
+  io_queue_.push_back(std::move(fn));
+  lock.unlock();
+  io_cond_.notify_one();
+}
+
+void KernelState::WaitCriticalSection(uint32_t cs_ptr) {
+  std::unique_lock<std::mutex> lock(critical_section_wait_mutex_);
+  auto& key = critical_section_wait_keys_[cs_ptr];
+  if (!key) {
+    key = std::make_unique<CriticalSectionWaitKey>();
+  }
+  auto wait_key = key.get();
+  ++wait_key->waiter_count;
+  wait_key->cond.wait(lock, [wait_key]() { return wait_key->release_count; });
+  --wait_key->release_count;
+  if (!--wait_key->waiter_count && !wait_key->release_count) {
+    critical_section_wait_keys_.erase(cs_ptr);
+  }
+}
+
+void KernelState::ReleaseCriticalSection(uint32_t cs_ptr) {
+  std::lock_guard<std::mutex> lock(critical_section_wait_mutex_);
+  auto& key = critical_section_wait_keys_[cs_ptr];
+  if (!key) {
+    key = std::make_unique<CriticalSectionWaitKey>();
+  }
+  ++key->release_count;
+  if (key->waiter_count) {
+    key->cond.notify_one();
+  }
+}
+
 }  // namespace kernel
 }  // namespace xe
@@ -18,6 +18,7 @@
 #include <list>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/mutex.h"
@@ -106,7 +107,6 @@ class KernelState {
   ContentManager* content_manager() const { return content_manager_.get(); }
 
   ObjectTable* object_table() const { return object_table_; }
-  xe::recursive_mutex& object_mutex() { return object_mutex_; }
 
   uint32_t process_type() const;
   void set_process_type(uint32_t value);
@@ -147,6 +147,8 @@ class KernelState {
   void OnThreadExecute(XThread* thread);
   void OnThreadExit(XThread* thread);
   object_ref<XThread> GetThreadByID(uint32_t thread_id);
+  // Snapshot of all live guest and host threads.
+  std::vector<object_ref<XThread>> GetThreads();
 
   void RegisterNotifyListener(XNotifyListener* listener);
   void UnregisterNotifyListener(XNotifyListener* listener);
@@ -164,8 +166,26 @@ class KernelState {
                                     uint32_t overlapped_ptr, X_RESULT result,
                                     uint32_t extended_error, uint32_t length);
 
+  // Keyed event contended critical sections park on, keyed by the guest
+  // address of the critical section. Each release wakes exactly one waiter;
+  // a release with nobody waiting yet is kept for the next waiter, as the
+  // waiter may have announced itself in the lock count but not parked yet.
+  void WaitCriticalSection(uint32_t cs_ptr);
+  void ReleaseCriticalSection(uint32_t cs_ptr);
+
+  // Queues blocking file I/O to the I/O worker pool so the issuing guest
+  // thread can continue. Workers are spun up on first use.
+  void QueueIoRequest(std::function<void()> fn);
+
+  // Reports how often each kernel lock was contended to the profiler. Called
+  // once a frame.
+  void ReportLockContention();
+
  private:
   void LoadKernelModule(object_ref<XKernelModule> kernel_module);
+  // Copies the user module list, so callers can run module code without
+  // holding object_mutex_.
+  std::vector<object_ref<XUserModule>> GetUserModules();
 
   Emulator* emulator_;
   Memory* memory_;
@@ -179,10 +199,18 @@ class KernelState {
   std::unique_ptr<ContentManager> content_manager_;
 
   ObjectTable* object_table_;
-  xe::recursive_mutex object_mutex_;
+
+  // Locks are taken in declaration order. None are held while calling into
+  // guest code, so a slow DllMain can't stall unrelated kernel calls.
+  // Guards the module lists and terminate notifications.
+  xe::counted_recursive_mutex object_mutex_;
+  xe::counted_recursive_mutex threads_mutex_;
   std::unordered_map<uint32_t, XThread*> threads_by_id_;
+  xe::counted_mutex notify_mutex_;
   std::vector<object_ref<XNotifyListener>> notify_listeners_;
   bool has_notified_startup_;
+  // Serializes stashing XObjects in guest dispatch headers.
+  xe::counted_recursive_mutex native_object_mutex_;
 
   uint32_t process_type_;
   object_ref<XUserModule> executable_module_;
@@ -198,6 +226,21 @@ class KernelState {
   std::condition_variable dispatch_cond_;
   std::list<std::function<void()>> dispatch_queue_;
 
+  std::atomic<bool> io_threads_running_;
+  std::vector<object_ref<XHostThread>> io_threads_;
+  std::mutex io_mutex_;
+  std::condition_variable io_cond_;
+  std::list<std::function<void()>> io_queue_;
+
+  struct CriticalSectionWaitKey {
+    std::condition_variable cond;
+    uint32_t waiter_count = 0;
+    uint32_t release_count = 0;
+  };
+  std::mutex critical_section_wait_mutex_;
+  std::unordered_map<uint32_t, std::unique_ptr<CriticalSectionWaitKey>>
+      critical_section_wait_keys_;
+
   friend class XObject;
 };
 
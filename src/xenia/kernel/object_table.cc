@@ -12,76 +12,96 @@
 #include <algorithm>
 #include <cstring>
 
-#include "xenia/kernel/xobject.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/objects/xthread.h"
+#include "xenia/kernel/xobject.h"
 
 namespace xe {
 namespace kernel {
 
 ObjectTable::ObjectTable()
-    : table_capacity_(0), table_(nullptr), last_free_entry_(0) {}
+    : table_capacity_(0), free_slot_head_(0), free_slot_tail_(0) {
+  for (auto& page : pages_) {
+    page = nullptr;
+  }
+}
 
 ObjectTable::~ObjectTable() {
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
 
   // Release all objects.
   for (uint32_t n = 0; n < table_capacity_; n++) {
-    ObjectTableEntry& entry = table_[n];
+    ObjectTableEntry& entry = *GetEntry(n);
     if (entry.object) {
-      entry.object->Release();
+      entry.object.load()->Release();
     }
   }
 
+  for (auto& page : pages_) {
+    delete[] page.load();
+    page = nullptr;
+  }
   table_capacity_ = 0;
-  last_free_entry_ = 0;
-  free(table_);
-  table_ = nullptr;
+  free_slot_head_ = 0;
+  free_slot_tail_ = 0;
 }
 
-X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
-  // Find a free slot.
-  uint32_t slot = last_free_entry_;
-  uint32_t scan_count = 0;
-  while (scan_count < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (!entry.object) {
-      *out_slot = slot;
-      return X_STATUS_SUCCESS;
+ObjectTable::ObjectTableEntry* ObjectTable::GetEntry(uint32_t slot) {
+  if (slot >= kMaxPageCount * kEntriesPerPage) {
+    return nullptr;
+  }
+  auto page = pages_[slot / kEntriesPerPage].load(std::memory_order_acquire);
+  if (!page) {
+    return nullptr;
+  }
+  return &page[slot % kEntriesPerPage];
+}
+
+X_STATUS ObjectTable::AllocateSlot(uint32_t* out_slot) {
+  if (!free_slot_head_) {
+    // Table out of slots, add a page. Existing pages stay where they are as
+    // lookups may be reading them.
+    uint32_t page_index = table_capacity_ / kEntriesPerPage;
+    if (page_index >= kMaxPageCount) {
+      return X_STATUS_NO_MEMORY;
     }
-    scan_count++;
-    slot = (slot + 1) % table_capacity_;
-    if (slot == 0) {
-      // Never allow 0 handles.
-      scan_count++;
-      slot++;
+    uint32_t first_slot = table_capacity_;
+    auto page = new ObjectTableEntry[kEntriesPerPage];
+    for (uint32_t n = 0; n < kEntriesPerPage - 1; ++n) {
+      page[n].next_free_slot = first_slot + n + 1;
     }
-  }
+    pages_[page_index].store(page, std::memory_order_release);
+    table_capacity_ += kEntriesPerPage;
 
-  // Table out of slots, expand.
-  uint32_t new_table_capacity = std::max(16 * 1024u, table_capacity_ * 2);
-  size_t new_table_size = new_table_capacity * sizeof(ObjectTableEntry);
-  size_t old_table_size = table_capacity_ * sizeof(ObjectTableEntry);
-  auto new_table =
-      reinterpret_cast<ObjectTableEntry*>(realloc(table_, new_table_size));
-  if (!new_table) {
-    return X_STATUS_NO_MEMORY;
-  }
-  // Zero out new memory.
-  if (new_table_size > old_table_size) {
-    std::memset(reinterpret_cast<uint8_t*>(new_table) + old_table_size, 0,
-                new_table_size - old_table_size);
+    // Never allow 0 handles.
+    free_slot_head_ = first_slot ? first_slot : 1;
+    free_slot_tail_ = first_slot + kEntriesPerPage - 1;
   }
-  last_free_entry_ = table_capacity_;
-  table_capacity_ = new_table_capacity;
-  table_ = new_table;
 
-  // Never allow 0 handles.
-  slot = ++last_free_entry_;
+  uint32_t slot = free_slot_head_;
+  ObjectTableEntry& entry = *GetEntry(slot);
+  free_slot_head_ = entry.next_free_slot;
+  if (!free_slot_head_) {
+    free_slot_tail_ = 0;
+  }
+  entry.next_free_slot = 0;
   *out_slot = slot;
-
   return X_STATUS_SUCCESS;
 }
 
+void ObjectTable::FreeSlot(uint32_t slot) {
+  // Freed slots go to the back of the list so a handle value isn't handed out
+  // again until every other free slot has been. A stale handle racing a
+  // lock-free lookup is then very unlikely to find a new object in its slot.
+  GetEntry(slot)->next_free_slot = 0;
+  if (free_slot_tail_) {
+    GetEntry(free_slot_tail_)->next_free_slot = slot;
+  } else {
+    free_slot_head_ = slot;
+  }
+  free_slot_tail_ = slot;
+}
+
 X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
   assert_not_null(out_handle);
 
@@ -89,14 +109,14 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
 
   uint32_t slot = 0;
   {
-    std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+    std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
 
     // Find a free slot.
-    result = FindFreeSlot(&slot);
+    result = AllocateSlot(&slot);
 
     // Stash.
     if (XSUCCEEDED(result)) {
-      ObjectTableEntry& entry = table_[slot];
+      ObjectTableEntry& entry = *GetEntry(slot);
       entry.object = object;
       entry.handle_ref_count = 1;
 
@@ -116,7 +136,7 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
   X_STATUS result = X_STATUS_SUCCESS;
   handle = TranslateHandle(handle);
 
-  XObject* object = LookupObject(handle, false);
+  XObject* object = LookupObject(handle);
   if (object) {
     result = AddHandle(object, out_handle);
     object->Release();  // Release the ref that LookupObject took
@@ -128,7 +148,7 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
 }
 
 X_STATUS ObjectTable::RetainHandle(X_HANDLE handle) {
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
 
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
@@ -140,7 +160,7 @@ X_STATUS ObjectTable::RetainHandle(X_HANDLE handle) {
 }
 
 X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
 
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
@@ -170,14 +190,21 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
-  if (entry->object) {
-    auto object = entry->object;
-    entry->object = nullptr;
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
+  auto object = entry->object.exchange(nullptr);
+  if (object) {
     entry->handle_ref_count = 0;
 
+    // Lookups that saw the object before it was cleared are retaining it;
+    // they must finish before the table's reference can go away.
+    while (entry->reader_count.load()) {
+      xe::threading::MaybeYield();
+    }
+
     // Release now that the object has been removed from the table.
     object->Release();
+
+    FreeSlot(handle >> 2);
   }
 
   return X_STATUS_SUCCESS;
@@ -189,61 +216,42 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
     return nullptr;
   }
 
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
-
   // Lower 2 bits are ignored.
-  uint32_t slot = handle >> 2;
-  if (slot <= table_capacity_) {
-    return &table_[slot];
-  }
-
-  return nullptr;
+  return GetEntry(handle >> 2);
 }
 
-XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
+XObject* ObjectTable::LookupObject(X_HANDLE handle) {
   handle = TranslateHandle(handle);
   if (!handle) {
     return nullptr;
   }
 
-  XObject* object = nullptr;
-  if (!already_locked) {
-    table_mutex_.lock();
-  }
-
   // Lower 2 bits are ignored.
-  uint32_t slot = handle >> 2;
-
-  // Verify slot.
-  if (slot < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (entry.object) {
-      object = entry.object;
-    }
+  ObjectTableEntry* entry = GetEntry(handle >> 2);
+  if (!entry) {
+    return nullptr;
   }
 
-  // Retain the object pointer.
+  // Announce the read before loading the object so that a concurrent
+  // RemoveHandle either clears it first or waits for the retain below.
+  ++entry->reader_count;
+  XObject* object = entry->object.load();
   if (object) {
     object->Retain();
   }
-
-  if (!already_locked) {
-    table_mutex_.unlock();
-  }
+  --entry->reader_count;
 
   return object;
 }
 
 void ObjectTable::GetObjectsByType(XObject::Type type,
                                    std::vector<object_ref<XObject>>* results) {
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
   for (uint32_t slot = 0; slot < table_capacity_; ++slot) {
-    auto& entry = table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
-      }
+    auto object = GetEntry(slot)->object.load();
+    if (object && object->type() == type) {
+      object->Retain();
+      results->push_back(object_ref<XObject>(object));
     }
   }
 }
@@ -262,7 +270,7 @@ X_HANDLE ObjectTable::TranslateHandle(X_HANDLE handle) {
 }
 
 X_STATUS ObjectTable::AddNameMapping(const std::string& name, X_HANDLE handle) {
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
   if (name_table_.count(name)) {
     return X_STATUS_OBJECT_NAME_COLLISION;
   }
@@ -271,7 +279,7 @@ X_STATUS ObjectTable::AddNameMapping(const std::string& name, X_HANDLE handle) {
 }
 
 void ObjectTable::RemoveNameMapping(const std::string& name) {
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
   auto it = name_table_.find(name);
   if (it != name_table_.end()) {
     name_table_.erase(it);
@@ -280,7 +288,7 @@ void ObjectTable::RemoveNameMapping(const std::string& name) {
 
 X_STATUS ObjectTable::GetObjectByName(const std::string& name,
                                       X_HANDLE* out_handle) {
-  std::lock_guard<xe::recursive_mutex> lock(table_mutex_);
+  std::lock_guard<xe::counted_recursive_mutex> lock(table_mutex_);
   auto it = name_table_.find(name);
   if (it == name_table_.end()) {
     *out_handle = X_INVALID_HANDLE_VALUE;
@@ -289,7 +297,7 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
   *out_handle = it->second;
 
   // We need to ref the handle. I think.
-  auto obj = LookupObject(it->second, true);
+  auto obj = LookupObject(it->second);
   if (obj) {
     obj->RetainHandle();
     obj->Release();
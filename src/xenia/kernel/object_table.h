@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_OBJECT_TABLE_H_
 #define XENIA_KERNEL_OBJECT_TABLE_H_
 
+#include <atomic>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -33,9 +34,13 @@ class ObjectTable {
   X_STATUS ReleaseHandle(X_HANDLE handle);
   X_STATUS RemoveHandle(X_HANDLE handle);
 
+  uint64_t lock_contention_count() const {
+    return table_mutex_.contention_count();
+  }
+
   template <typename T>
   object_ref<T> LookupObject(X_HANDLE handle) {
-    auto object = LookupObject(handle, false);
+    auto object = LookupObject(handle);
     auto result = object_ref<T>(reinterpret_cast<T*>(object));
     return result;
   }
@@ -52,23 +57,42 @@ class ObjectTable {
   }
 
  private:
-  typedef struct {
+  // Entries live in fixed size pages that are never moved or freed while the
+  // table is alive, so LookupObject can read them without table_mutex_.
+  static const uint32_t kEntriesPerPage = 4096;
+  static const uint32_t kMaxPageCount = 256;
+
+  struct ObjectTableEntry {
+    // Guarded by table_mutex_.
     int handle_ref_count = 0;
-    XObject* object = nullptr;
-  } ObjectTableEntry;
+    // Written under table_mutex_, read without it.
+    std::atomic<XObject*> object{nullptr};
+    // Lock-free lookups currently reading object. Removal waits for this to
+    // drain before dropping the table's reference, so a lookup never
+    // retains an object that is being destroyed.
+    std::atomic<uint32_t> reader_count{0};
+    // Next slot on the free list while object is null, or 0 at its end.
+    // Guarded by table_mutex_.
+    uint32_t next_free_slot = 0;
+  };
 
+  ObjectTableEntry* GetEntry(uint32_t slot);
   ObjectTableEntry* LookupTable(X_HANDLE handle);
-  XObject* LookupObject(X_HANDLE handle, bool already_locked);
+  XObject* LookupObject(X_HANDLE handle);
   void GetObjectsByType(XObject::Type type,
                         std::vector<object_ref<XObject>>* results);
 
   X_HANDLE TranslateHandle(X_HANDLE handle);
-  X_STATUS FindFreeSlot(uint32_t* out_slot);
+  X_STATUS AllocateSlot(uint32_t* out_slot);
+  void FreeSlot(uint32_t slot);
 
-  xe::recursive_mutex table_mutex_;
+  xe::counted_recursive_mutex table_mutex_;
   uint32_t table_capacity_;
-  ObjectTableEntry* table_;
-  uint32_t last_free_entry_;
+  std::atomic<ObjectTableEntry*> pages_[kMaxPageCount];
+  // Ends of the FIFO list of unused slots threaded through the entries. Slot 0
+  // is never handed out, so 0 means the list is empty.
+  uint32_t free_slot_head_;
+  uint32_t free_slot_tail_;
   std::unordered_map<std::string, X_HANDLE> name_table_;
 };
 
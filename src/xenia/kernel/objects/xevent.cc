@@ -7,9 +7,12 @@
  ******************************************************************************
  */
 
-#include "xenia/base/logging.h"
 #include "xenia/kernel/objects/xevent.h"
 
+#include "xenia/base/atomic.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
+
 namespace xe {
 namespace kernel {
 
@@ -20,6 +23,8 @@ XEvent::~XEvent() = default;
 void XEvent::Initialize(bool manual_reset, bool initial_state) {
   assert_false(event_);
 
+  manual_reset_ = manual_reset;
+  signaled_ = initial_state;
   if (manual_reset) {
     event_ = xe::threading::Event::CreateManualResetEvent(initial_state);
   } else {
@@ -45,24 +50,49 @@ void XEvent::InitializeNative(void* native_ptr, X_DISPATCH_HEADER* header) {
 
   bool initial_state = header->signal_state ? true : false;
   Initialize(manual_reset, initial_state);
+  native_header_ = header;
+}
+
+void XEvent::SetNativeSignalState(uint32_t signal_state) {
+  if (native_header_) {
+    xe::atomic_exchange(
+        xe::byte_swap(signal_state),
+        reinterpret_cast<uint32_t*>(&native_header_->signal_state));
+  }
 }
 
 int32_t XEvent::Set(uint32_t priority_increment, bool wait) {
+  std::lock_guard<std::mutex> lock(state_mutex_);
+  SetNativeSignalState(1);
+  if (manual_reset_ && signaled_) {
+    // Stays signaled until reset; nothing to wake.
+    return 1;
+  }
+  signaled_ = true;
   event_->Set();
   return 1;
 }
 
 int32_t XEvent::Pulse(uint32_t priority_increment, bool wait) {
+  std::lock_guard<std::mutex> lock(state_mutex_);
+  SetNativeSignalState(0);
+  signaled_ = false;
   event_->Pulse();
   return 1;
 }
 
 int32_t XEvent::Reset() {
+  std::lock_guard<std::mutex> lock(state_mutex_);
+  SetNativeSignalState(0);
+  if (!signaled_) {
+    return 1;
+  }
+  signaled_ = false;
   event_->Reset();
   return 1;
 }
 
-void XEvent::Clear() { event_->Reset(); }
+void XEvent::Clear() { Reset(); }
 
 }  // namespace kernel
 }  // namespace xe
@@ -10,7 +10,11 @@
 #ifndef XENIA_KERNEL_OBJECTS_XEVENT_H_
 #define XENIA_KERNEL_OBJECTS_XEVENT_H_
 
+#include <atomic>
+#include <mutex>
+
 #include "xenia/base/threading.h"
+#include "xenia/base/type_pool.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
 
@@ -22,7 +26,9 @@ struct X_KEVENT {
   X_DISPATCH_HEADER header;
 };
 
-class XEvent : public XObject {
+// Events are created and destroyed constantly (per I/O request, per native
+// dispatcher object) so their memory is recycled.
+class XEvent : public XObject, public PooledObject<XEvent> {
  public:
   explicit XEvent(KernelState* kernel_state);
   ~XEvent() override;
@@ -35,10 +41,24 @@ class XEvent : public XObject {
   int32_t Reset();
   void Clear();
 
+  bool IsKnownSignaled() override { return manual_reset_ && signaled_; }
   xe::threading::WaitHandle* GetWaitHandle() override { return event_.get(); }
 
  private:
+  void SetNativeSignalState(uint32_t signal_state);
+
   std::unique_ptr<xe::threading::Event> event_;
+  bool manual_reset_ = false;
+  // Mirror of the host event's state, so that setting a signaled manual
+  // reset event, resetting an unsignaled event and waiting on a signaled
+  // manual reset event need no host call. Host waits consume auto reset
+  // events behind our back, so for them true only means "maybe signaled".
+  // Changed together with the host event under state_mutex_.
+  std::mutex state_mutex_;
+  std::atomic<bool> signaled_{false};
+  // Guest KEVENT header for native events, kept in sync for guest code that
+  // reads it directly.
+  X_DISPATCH_HEADER* native_header_ = nullptr;
 };
 
 }  // namespace kernel
@@ -11,6 +11,7 @@
 
 #include "xenia/base/math.h"
 #include "xenia/kernel/async_request.h"
+#include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/objects/xevent.h"
 
 namespace xe {
@@ -100,12 +101,25 @@ X_STATUS XFile::Read(void* buffer, size_t buffer_length, size_t byte_offset,
 
 X_STATUS XFile::Read(void* buffer, size_t buffer_length, size_t byte_offset,
                      XAsyncRequest* request) {
+  if (byte_offset == -1) {
+    // Read from current position.
+    byte_offset = position_;
+  }
+  // Advance now so back-to-back requests from the current position don't
+  // overlap. A short read past the end of file leaves the position at EOF+.
+  position_ = byte_offset + buffer_length;
+
   // Also tack on our event so that any waiters wake.
   request->AddWaitEvent(async_event_);
-  position_ = byte_offset;
-  // return entry_->ReadAsync(buffer, buffer_length, byte_offset, request);
-  X_STATUS result = X_STATUS_NOT_IMPLEMENTED;
-  return result;
+  kernel_state()->QueueIoRequest(
+      [this, buffer, buffer_length, byte_offset, request]() {
+        size_t bytes_read = 0;
+        X_STATUS result =
+            ReadSync(buffer, buffer_length, byte_offset, &bytes_read);
+        request->Complete(result, static_cast<uint32_t>(bytes_read));
+        delete request;
+      });
+  return X_STATUS_PENDING;
 }
 
 X_STATUS XFile::Write(const void* buffer, size_t buffer_length,
@@ -123,5 +137,25 @@ X_STATUS XFile::Write(const void* buffer, size_t buffer_length,
   return result;
 }
 
+X_STATUS XFile::Write(const void* buffer, size_t buffer_length,
+                      size_t byte_offset, XAsyncRequest* request) {
+  if (byte_offset == -1) {
+    // Write from current position.
+    byte_offset = position_;
+  }
+  position_ = byte_offset + buffer_length;
+
+  request->AddWaitEvent(async_event_);
+  kernel_state()->QueueIoRequest(
+      [this, buffer, buffer_length, byte_offset, request]() {
+        size_t bytes_written = 0;
+        X_STATUS result =
+            WriteSync(buffer, buffer_length, byte_offset, &bytes_written);
+        request->Complete(result, static_cast<uint32_t>(bytes_written));
+        delete request;
+      });
+  return X_STATUS_PENDING;
+}
+
 }  // namespace kernel
 }  // namespace xe
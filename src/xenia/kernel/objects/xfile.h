@@ -96,11 +96,17 @@ class XFile : public XObject {
 
   X_STATUS Read(void* buffer, size_t buffer_length, size_t byte_offset,
                 size_t* out_bytes_read);
+  // Queues the read to the kernel I/O workers and returns X_STATUS_PENDING.
+  // The request is completed with the result and deleted once done.
   X_STATUS Read(void* buffer, size_t buffer_length, size_t byte_offset,
                 XAsyncRequest* request);
 
   X_STATUS Write(const void* buffer, size_t buffer_length, size_t byte_offset,
                  size_t* out_bytes_written);
+  X_STATUS Write(const void* buffer, size_t buffer_length, size_t byte_offset,
+                 XAsyncRequest* request);
+  // Returns once all data written so far has reached the device.
+  X_STATUS Flush() { return FlushSync(); }
 
   xe::threading::WaitHandle* GetWaitHandle() override {
     return async_event_->GetWaitHandle();
@@ -114,6 +120,7 @@ class XFile : public XObject {
                              size_t byte_offset, size_t* out_bytes_written) {
     return X_STATUS_ACCESS_DENIED;
   }
+  virtual X_STATUS FlushSync() { return X_STATUS_SUCCESS; }
 
  private:
   vfs::Entry* entry_ = nullptr;
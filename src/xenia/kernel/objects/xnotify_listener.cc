@@ -15,7 +15,11 @@ namespace xe {
 namespace kernel {
 
 XNotifyListener::XNotifyListener(KernelState* kernel_state)
-    : XObject(kernel_state, kTypeNotifyListener) {}
+    : XObject(kernel_state, kTypeNotifyListener) {
+  for (uint32_t i = 0; i < kRingSize; ++i) {
+    ring_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
 
 XNotifyListener::~XNotifyListener() {
   kernel_state_->UnregisterNotifyListener(this);
@@ -30,27 +34,115 @@ void XNotifyListener::Initialize(uint64_t mask) {
   kernel_state_->RegisterNotifyListener(this);
 }
 
-void XNotifyListener::EnqueueNotification(XNotificationID id, uint32_t data) {
-  // Ignore if the notification doesn't match our mask.
-  if ((mask_ & uint64_t(1 << (id >> 25))) == 0) {
+bool XNotifyListener::Accepts(XNotificationID id) const {
+  return (mask_ & uint64_t(1 << (id >> 25))) != 0;
+}
+
+bool XNotifyListener::PushPending(const Notification& notification) {
+  uint32_t pos = ring_tail_.load(std::memory_order_relaxed);
+  while (true) {
+    auto& slot = ring_[pos % kRingSize];
+    uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    int32_t diff = int32_t(sequence - pos);
+    if (diff == 0) {
+      if (ring_tail_.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+        slot.notification = notification;
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      // Full.
+      return false;
+    } else {
+      pos = ring_tail_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void XNotifyListener::DrainPending() {
+  // Caller holds lock_; we are the only consumer.
+  while (true) {
+    auto& slot = ring_[ring_head_ % kRingSize];
+    uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != ring_head_ + 1) {
+      break;
+    }
+    auto notification = slot.notification;
+    slot.sequence.store(ring_head_ + kRingSize, std::memory_order_release);
+    ring_head_++;
+
+    auto it = notifications_.find(notification.id);
+    if (it != notifications_.end()) {
+      // Already exists. Overwrite.
+      it->second = notification.data;
+    } else {
+      // New.
+      notification_count_++;
+      notifications_.insert({notification.id, notification.data});
+    }
+  }
+}
+
+void XNotifyListener::Signal() {
+  if (!signaled_.exchange(true, std::memory_order_acq_rel)) {
+    wait_handle_->Set();
+  }
+}
+
+void XNotifyListener::ResetIfIdle() {
+  // Caller holds lock_.
+  if (notification_count_) {
     return;
   }
+  signaled_.store(false, std::memory_order_release);
+  wait_handle_->Reset();
+  // A producer may have pushed after our drain while signaled_ was still set;
+  // re-arm so it isn't lost.
+  auto& slot = ring_[ring_head_ % kRingSize];
+  if (slot.sequence.load(std::memory_order_acquire) == ring_head_ + 1) {
+    Signal();
+  }
+}
 
-  std::lock_guard<xe::mutex> lock(lock_);
-  if (notifications_.count(id)) {
-    // Already exists. Overwrite.
-    notifications_[id] = data;
-  } else {
-    // New.
-    notification_count_++;
-    notifications_.insert({id, data});
+void XNotifyListener::EnqueueNotification(XNotificationID id, uint32_t data) {
+  Notification notification = {id, data};
+  EnqueueNotifications(&notification, 1);
+}
+
+void XNotifyListener::EnqueueNotifications(const Notification* notifications,
+                                           size_t count) {
+  bool any = false;
+  for (size_t i = 0; i < count; ++i) {
+    // Ignore if the notification doesn't match our mask.
+    if (!Accepts(notifications[i].id)) {
+      continue;
+    }
+    any = true;
+    if (!PushPending(notifications[i])) {
+      // Ring is full (nobody is dequeuing); fold it into the table directly.
+      std::lock_guard<xe::mutex> lock(lock_);
+      DrainPending();
+      if (!PushPending(notifications[i])) {
+        auto& notification = notifications[i];
+        if (notifications_.count(notification.id)) {
+          notifications_[notification.id] = notification.data;
+        } else {
+          notification_count_++;
+          notifications_.insert({notification.id, notification.data});
+        }
+      }
+    }
+  }
+  if (any) {
+    Signal();
   }
-  wait_handle_->Set();
 }
 
 bool XNotifyListener::DequeueNotification(XNotificationID* out_id,
                                           uint32_t* out_data) {
   std::lock_guard<xe::mutex> lock(lock_);
+  DrainPending();
   bool dequeued = false;
   if (notification_count_) {
     dequeued = true;
@@ -59,16 +151,15 @@ bool XNotifyListener::DequeueNotification(XNotificationID* out_id,
     *out_data = it->second;
     notifications_.erase(it);
     notification_count_--;
-    if (!notification_count_) {
-      wait_handle_->Reset();
-    }
   }
+  ResetIfIdle();
   return dequeued;
 }
 
 bool XNotifyListener::DequeueNotification(XNotificationID id,
                                           uint32_t* out_data) {
   std::lock_guard<xe::mutex> lock(lock_);
+  DrainPending();
   bool dequeued = false;
   if (notification_count_) {
     auto it = notifications_.find(id);
@@ -77,11 +168,9 @@ bool XNotifyListener::DequeueNotification(XNotificationID id,
       *out_data = it->second;
       notifications_.erase(it);
       notification_count_--;
-      if (!notification_count_) {
-        wait_handle_->Reset();
-      }
     }
   }
+  ResetIfIdle();
   return dequeued;
 }
 
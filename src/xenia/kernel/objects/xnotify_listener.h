@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_OBJECTS_XNOTIFY_LISTENER_H_
 #define XENIA_KERNEL_OBJECTS_XNOTIFY_LISTENER_H_
 
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 
@@ -30,7 +31,16 @@ class XNotifyListener : public XObject {
 
   void Initialize(uint64_t mask);
 
+  struct Notification {
+    XNotificationID id;
+    uint32_t data;
+  };
+
+  // Producers never take lock_: notifications go into a lock-free ring that
+  // is drained by the dequeuing (guest) side. The wait handle is only set on
+  // the transition from idle, so a batch costs one wake.
   void EnqueueNotification(XNotificationID id, uint32_t data);
+  void EnqueueNotifications(const Notification* notifications, size_t count);
   bool DequeueNotification(XNotificationID* out_id, uint32_t* out_data);
   bool DequeueNotification(XNotificationID id, uint32_t* out_data);
 
@@ -39,7 +49,24 @@ class XNotifyListener : public XObject {
   }
 
  private:
+  static const uint32_t kRingSize = 64;
+  struct RingSlot {
+    std::atomic<uint32_t> sequence;
+    Notification notification;
+  };
+
+  bool Accepts(XNotificationID id) const;
+  bool PushPending(const Notification& notification);
+  void DrainPending();
+  void Signal();
+  void ResetIfIdle();
+
   std::unique_ptr<xe::threading::Event> wait_handle_;
+  std::atomic<bool> signaled_ = {false};
+  RingSlot ring_[kRingSize];
+  std::atomic<uint32_t> ring_tail_ = {0};
+  uint32_t ring_head_ = 0;  // Guarded by lock_.
+
   xe::mutex lock_;
   std::unordered_map<XNotificationID, uint32_t> notifications_;
   size_t notification_count_ = 0;
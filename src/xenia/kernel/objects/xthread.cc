@@ -11,7 +11,10 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <mutex>
 
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
@@ -28,8 +31,16 @@
 
 DEFINE_bool(ignore_thread_priorities, true,
             "Ignores game-specified thread priorities.");
+DEFINE_string(thread_priority_titles, "",
+              "Comma-separated title IDs (hex) whose thread priorities are "
+              "applied to host threads even with --ignore_thread_priorities.");
 DEFINE_bool(ignore_thread_affinities, true,
             "Ignores game-specified thread affinities.");
+DEFINE_string(guest_core_host_cores, "",
+              "Comma-separated host physical core index for each of the 3 "
+              "guest cores (e.g. '0,1,2'). Guest hardware threads on the same "
+              "guest core are placed on SMT siblings of the mapped host core. "
+              "Empty uses host cores 0-2.");
 
 namespace xe {
 namespace kernel {
@@ -74,11 +85,19 @@ XThread::~XThread() {
   }
 
   delete apc_list_;
+  for (auto list : {&host_apc_head_, &host_apc_free_}) {
+    auto apc = list->exchange(nullptr);
+    while (apc) {
+      auto next = apc->next;
+      delete apc;
+      apc = next;
+    }
+  }
 
   thread_.reset();
 
   if (thread_state_) {
-    delete thread_state_;
+    kernel_state()->processor()->RecycleThreadState(thread_state_);
   }
   kernel_state()->memory()->SystemHeapFree(scratch_address_);
   kernel_state()->memory()->SystemHeapFree(tls_address_);
@@ -145,6 +164,61 @@ uint8_t GetFakeCpuNumber(uint8_t proc_mask) {
   return cpu_number;
 }
 
+// Maps a guest hardware thread mask (bits 0-5, two threads per core) to a host
+// affinity mask. Each guest core is assigned a host physical core and the two
+// hardware threads on it are split across that core's SMT siblings, so guest
+// threads that share a core also share host caches.
+uint64_t GuestToHostAffinityMask(uint8_t proc_mask) {
+  static uint64_t guest_thread_masks[6] = {0};
+  static std::once_flag once;
+  std::call_once(once, []() {
+    // Only cores the process may run on, e.g. those of the --numa_node.
+    auto core_masks = xe::threading::available_core_masks();
+    if (core_masks.empty()) {
+      core_masks = xe::threading::physical_core_masks();
+    }
+    if (core_masks.empty()) {
+      // No topology at all; every guest thread runs anywhere it may.
+      uint64_t process_mask = xe::threading::process_affinity_mask();
+      for (uint64_t& guest_thread_mask : guest_thread_masks) {
+        guest_thread_mask = process_mask;
+      }
+      return;
+    }
+    uint32_t host_cores[3] = {0, 1, 2};
+    if (!FLAGS_guest_core_host_cores.empty()) {
+      const char* p = FLAGS_guest_core_host_cores.c_str();
+      for (int i = 0; i < 3 && *p; ++i) {
+        char* end = nullptr;
+        host_cores[i] = static_cast<uint32_t>(std::strtoul(p, &end, 10));
+        p = *end == ',' ? end + 1 : end;
+      }
+    }
+    for (int i = 0; i < 3; ++i) {
+      uint64_t core_mask = core_masks[host_cores[i] % core_masks.size()];
+      // Split the siblings of the core between its two guest hw threads.
+      uint64_t sibling_masks[2] = {0, 0};
+      uint32_t sibling_count = 0;
+      for (uint32_t bit = 0; bit < 64; ++bit) {
+        if (core_mask & (1ull << bit)) {
+          sibling_masks[sibling_count++ % 2] |= 1ull << bit;
+        }
+      }
+      guest_thread_masks[i * 2 + 0] = sibling_masks[0];
+      guest_thread_masks[i * 2 + 1] =
+          sibling_masks[1] ? sibling_masks[1] : sibling_masks[0];
+    }
+  });
+
+  uint64_t host_mask = 0;
+  for (int i = 0; i < 6; ++i) {
+    if (proc_mask & (1 << i)) {
+      host_mask |= guest_thread_masks[i];
+    }
+  }
+  return host_mask;
+}
+
 X_STATUS XThread::Create() {
   // Thread kernel object
   // This call will also setup the native pointer for us.
@@ -218,11 +292,10 @@ X_STATUS XThread::Create() {
     return X_STATUS_NO_MEMORY;
   }
 
-  // Allocate processor thread state.
-  // This is thread safe.
-  thread_state_ = new cpu::ThreadState(
-      kernel_state()->processor(), thread_id_, cpu::ThreadStackType::kUserStack,
-      0, creation_params_.stack_size, pcr_address_);
+  // Allocate processor thread state, reusing the stack of an exited thread
+  // if possible. This is thread safe.
+  thread_state_ = kernel_state()->processor()->AcquireThreadState(
+      thread_id_, creation_params_.stack_size, pcr_address_);
   XELOGI("XThread%08X (%X) Stack: %.8X-%.8X", handle(),
          thread_state_->thread_id(), thread_state_->stack_limit(),
          thread_state_->stack_base());
@@ -325,7 +398,9 @@ X_STATUS XThread::Create() {
     XELOGE("CreateThread failed");
     return X_STATUS_NO_MEMORY;
   }
-  thread_->set_affinity_mask(proc_mask);
+  if (proc_mask) {
+    thread_->set_affinity_mask(GuestToHostAffinityMask(proc_mask));
+  }
 
   // Set the thread name based on host ID (for easier debugging).
   if (name_.empty()) {
@@ -336,7 +411,7 @@ X_STATUS XThread::Create() {
   }
 
   if (creation_params_.creation_flags & 0x60) {
-    thread_->set_priority(creation_params_.creation_flags & 0x20 ? 1 : 0);
+    SetPriority(creation_params_.creation_flags & 0x20 ? 1 : 0);
   }
 
   if (emulator()->debugger()) {
@@ -468,28 +543,73 @@ void XThread::UnlockApc(bool queue_delivery) {
   }
 }
 
+void XThread::PushHostApcs(std::atomic<HostApc*>* list, HostApc* first,
+                           HostApc* last) {
+  auto head = list->load(std::memory_order_relaxed);
+  do {
+    last->next = head;
+  } while (!list->compare_exchange_weak(head, first, std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
 void XThread::EnqueueApc(uint32_t normal_routine, uint32_t normal_context,
                          uint32_t arg1, uint32_t arg2) {
-  LockApc();
-
-  // Allocate APC.
-  // We'll tag it as special and free it when dispatched.
-  uint32_t apc_ptr = memory()->SystemHeapAlloc(XAPC::kSize);
-  auto apc = reinterpret_cast<XAPC*>(memory()->TranslateVirtual(apc_ptr));
-
-  apc->Initialize();
-  apc->kernel_routine = XAPC::kDummyKernelRoutine;
-  apc->rundown_routine = XAPC::kDummyRundownRoutine;
+  // Take the whole free list (exchange avoids ABA), use one node and give the
+  // rest back.
+  auto apc = host_apc_free_.exchange(nullptr, std::memory_order_acquire);
+  if (apc) {
+    auto rest = apc->next;
+    if (rest) {
+      auto rest_last = rest;
+      while (rest_last->next) {
+        rest_last = rest_last->next;
+      }
+      PushHostApcs(&host_apc_free_, rest, rest_last);
+    }
+  } else {
+    apc = new HostApc();
+  }
   apc->normal_routine = normal_routine;
   apc->normal_context = normal_context;
   apc->arg1 = arg1;
   apc->arg2 = arg2;
-  apc->enqueued = 1;
 
-  uint32_t list_entry_ptr = apc_ptr + 8;
-  apc_list_->Insert(list_entry_ptr);
+  // Only the push onto an empty queue needs to wake the thread; later pushes
+  // are picked up by the same delivery.
+  auto head = host_apc_head_.load(std::memory_order_relaxed);
+  do {
+    apc->next = head;
+  } while (!host_apc_head_.compare_exchange_weak(
+      head, apc, std::memory_order_release, std::memory_order_relaxed));
+  if (!head) {
+    thread_->QueueUserCallback([this]() { DeliverAPCs(); });
+  }
+}
 
-  UnlockApc(true);
+void XThread::DeliverHostAPCs() {
+  auto apc = host_apc_head_.exchange(nullptr, std::memory_order_acquire);
+  if (!apc) {
+    return;
+  }
+  // Producers push LIFO; reverse to deliver in FIFO order.
+  HostApc* first = nullptr;
+  HostApc* last = apc;
+  while (apc) {
+    auto next = apc->next;
+    apc->next = first;
+    first = apc;
+    apc = next;
+  }
+
+  auto processor = kernel_state()->processor();
+  for (apc = first; apc; apc = apc->next) {
+    XELOGD("Delivering APC to %.8X", apc->normal_routine);
+    // normal_routine(normal_context, system_arg1, system_arg2)
+    uint64_t normal_args[] = {apc->normal_context, apc->arg1, apc->arg2};
+    processor->Execute(thread_state_, apc->normal_routine, normal_args,
+                       xe::countof(normal_args));
+  }
+  PushHostApcs(&host_apc_free_, first, last);
 }
 
 void XThread::DeliverAPCs() {
@@ -556,6 +676,8 @@ void XThread::DeliverAPCs() {
     }
   }
   UnlockApc(true);
+
+  DeliverHostAPCs();
 }
 
 void XThread::RundownAPCs() {
@@ -587,25 +709,59 @@ void XThread::RundownAPCs() {
     }
   }
   UnlockApc(true);
+
+  // Host APCs have no rundown routine; just drop them.
+  auto apc = host_apc_head_.exchange(nullptr, std::memory_order_acquire);
+  if (apc) {
+    auto last = apc;
+    while (last->next) {
+      last = last->next;
+    }
+    PushHostApcs(&host_apc_free_, apc, last);
+  }
 }
 
-int32_t XThread::QueryPriority() { return thread_->priority(); }
+int32_t XThread::QueryPriority() { return priority_; }
+
+bool XThread::ShouldApplyPriorities(KernelState* kernel_state) {
+  if (!FLAGS_ignore_thread_priorities) {
+    return true;
+  }
+  uint32_t title_id = kernel_state->title_id();
+  const char* p = FLAGS_thread_priority_titles.c_str();
+  while (*p) {
+    char* end = nullptr;
+    auto id = static_cast<uint32_t>(std::strtoul(p, &end, 16));
+    if (end == p) {
+      break;
+    }
+    if (id == title_id) {
+      return true;
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  return false;
+}
 
 void XThread::SetPriority(int32_t increment) {
   priority_ = increment;
-  int32_t target_priority = 0;
-  if (increment > 0x22) {
+  // Guest increments follow NT: +/-1 and +/-2 are the above/below normal and
+  // highest/lowest levels, and +/-15 saturate to time critical and idle.
+  // Those two stop at highest/lowest so a title can't starve the host (and
+  // the emulator's own threads).
+  int32_t target_priority;
+  if (increment >= 2) {
     target_priority = xe::threading::ThreadPriority::kHighest;
-  } else if (increment > 0x11) {
+  } else if (increment == 1) {
     target_priority = xe::threading::ThreadPriority::kAboveNormal;
-  } else if (increment < -0x22) {
+  } else if (increment <= -2) {
     target_priority = xe::threading::ThreadPriority::kLowest;
-  } else if (increment < -0x11) {
+  } else if (increment == -1) {
     target_priority = xe::threading::ThreadPriority::kBelowNormal;
   } else {
     target_priority = xe::threading::ThreadPriority::kNormal;
   }
-  if (!FLAGS_ignore_thread_priorities) {
+  if (thread_ && ShouldApplyPriorities(kernel_state())) {
     thread_->set_priority(target_priority);
   }
 }
@@ -619,15 +775,15 @@ void XThread::SetAffinity(uint32_t affinity) {
   // 3 - core 1, thread 1 - user
   // 4 - core 2, thread 0 - xaudio
   // 5 - core 2, thread 1 - user
-  // TODO(benvanik): implement better thread distribution.
-  // NOTE: these are logical processors, not physical processors or cores.
+  // Host placement is done by GuestToHostAffinityMask, which keeps threads of
+  // the same guest core on SMT siblings of one host core.
   if (xe::threading::logical_processor_count() < 6) {
     XELOGW("Too few processors - scheduling will be wonky");
   }
   SetActiveCpu(GetFakeCpuNumber(affinity));
   affinity_ = affinity;
-  if (!FLAGS_ignore_thread_affinities) {
-    thread_->set_affinity_mask(affinity);
+  if (!FLAGS_ignore_thread_affinities && affinity) {
+    thread_->set_affinity_mask(GuestToHostAffinityMask(affinity));
   }
 }
 
@@ -663,23 +819,19 @@ X_STATUS XThread::Suspend(uint32_t* out_suspend_count) {
 
 X_STATUS XThread::Delay(uint32_t processor_mode, uint32_t alertable,
                         uint64_t interval) {
-  int64_t timeout_ticks = interval;
-  uint32_t timeout_ms;
+  // Positive intervals are absolute times based on January 1, 1601 and
+  // negative ones are relative, both in 100ns ticks.
+  int64_t timeout_ticks = Clock::ScaleGuestDurationFileTime(int64_t(interval));
   if (timeout_ticks > 0) {
-    // Absolute time, based on January 1, 1601.
-    // TODO(benvanik): convert time to relative time.
-    assert_always();
-    timeout_ms = 0;
-  } else if (timeout_ticks < 0) {
-    // Relative time.
-    timeout_ms = uint32_t(-timeout_ticks / 10000);  // Ticks -> MS
-  } else {
-    timeout_ms = 0;
+    // Convert to relative, as the due time may already have passed.
+    timeout_ticks = std::min(
+        int64_t(0), int64_t(Clock::QueryGuestSystemTime()) - timeout_ticks);
   }
-  timeout_ms = Clock::ScaleGuestDurationMillis(timeout_ms);
+  // Titles delay for fractions of a millisecond in their frame loops, so the
+  // wait is not rounded to the host's sleep granularity.
+  auto timeout = std::chrono::microseconds(-timeout_ticks / 10);
   if (alertable) {
-    auto result =
-        xe::threading::AlertableSleep(std::chrono::milliseconds(timeout_ms));
+    auto result = xe::threading::AlertablePreciseSleep(timeout);
     switch (result) {
       default:
       case xe::threading::SleepResult::kSuccess:
@@ -688,7 +840,7 @@ X_STATUS XThread::Delay(uint32_t processor_mode, uint32_t alertable,
         return X_STATUS_USER_APC;
     }
   } else {
-    xe::threading::Sleep(std::chrono::milliseconds(timeout_ms));
+    xe::threading::PreciseSleep(timeout);
     return X_STATUS_SUCCESS;
   }
 }
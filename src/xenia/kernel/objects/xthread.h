@@ -129,6 +129,7 @@ class XThread : public XObject {
   bool is_running() const { return running_; }
 
   cpu::ThreadState* thread_state() const { return thread_state_; }
+  xe::threading::Thread* host_thread() const { return thread_.get(); }
   uint32_t thread_id() const { return thread_id_; }
   uint32_t last_error();
   void set_last_error(uint32_t error_code);
@@ -150,6 +151,9 @@ class XThread : public XObject {
   void LockApc();
   void UnlockApc(bool queue_delivery);
   NativeList* apc_list() const { return apc_list_; }
+  // Queues a user-mode APC from the host. Never blocks: the APC goes onto a
+  // lock-free queue drained by the target thread, separate from the guest
+  // visible apc_list().
   void EnqueueApc(uint32_t normal_routine, uint32_t normal_context,
                   uint32_t arg1, uint32_t arg2);
 
@@ -170,7 +174,10 @@ class XThread : public XObject {
 
  protected:
   void DeliverAPCs();
+  void DeliverHostAPCs();
   void RundownAPCs();
+  // Whether guest priorities are applied to the host thread for this title.
+  static bool ShouldApplyPriorities(KernelState* kernel_state);
 
   CreationParams creation_params_ = {0};
 
@@ -192,6 +199,21 @@ class XThread : public XObject {
   std::atomic<uint32_t> irql_ = {0};
   xe::mutex apc_lock_;
   NativeList* apc_list_ = nullptr;
+
+  // APCs queued by EnqueueApc. Producers push onto host_apc_head_ (LIFO) and
+  // the owning thread takes the whole list at once, so neither side locks.
+  // Delivered nodes are recycled through host_apc_free_.
+  struct HostApc {
+    HostApc* next;
+    uint32_t normal_routine;
+    uint32_t normal_context;
+    uint32_t arg1;
+    uint32_t arg2;
+  };
+  static void PushHostApcs(std::atomic<HostApc*>* list, HostApc* first,
+                           HostApc* last);
+  std::atomic<HostApc*> host_apc_head_ = {nullptr};
+  std::atomic<HostApc*> host_apc_free_ = {nullptr};
 };
 
 class XHostThread : public XThread {
@@ -605,6 +605,8 @@ void XUserModule::Dump() {
                       library->min_version.build, library->min_version.qfe);
       sb.AppendFormat("\n");
 
+      auto library_id = export_resolver->GetLibraryId(library->name);
+
       // Counts.
       int known_count = 0;
       int unknown_count = 0;
@@ -615,7 +617,7 @@ void XUserModule::Dump() {
 
         if (kernel_state_->IsKernelModule(library->name)) {
           auto kernel_export =
-              export_resolver->GetExportByOrdinal(library->name, info->ordinal);
+              export_resolver->GetExportByOrdinal(library_id, info->ordinal);
           if (kernel_export) {
             known_count++;
             if (kernel_export->is_implemented()) {
@@ -664,7 +666,7 @@ void XUserModule::Dump() {
         cpu::Export* kernel_export = nullptr;
         if (kernel_state_->IsKernelModule(library->name)) {
           kernel_export =
-              export_resolver->GetExportByOrdinal(library->name, info->ordinal);
+              export_resolver->GetExportByOrdinal(library_id, info->ordinal);
           if (kernel_export) {
             name = kernel_export->name;
             implemented = kernel_export->is_implemented();
@@ -15,6 +15,7 @@ project("xenia-kernel")
     "xenia-hid",
     "xenia-ui",
     "xenia-vfs",
+    "xxhash",
   })
   defines({
   })
@@ -9,13 +9,80 @@
 
 #include "xenia/kernel/util/shim_utils.h"
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+DEFINE_bool(log_kernel_calls, false,
+            "Log every kernel export call. Important exports are always "
+            "logged.");
+
 namespace xe {
 namespace kernel {
 namespace shim {
 
-thread_local StringBuffer string_buffer_;
+size_t FormatKernelCall(const void* record_ptr, size_t record_length,
+                        char* out, size_t out_capacity) {
+  KernelCallRecord record;
+  std::memset(&record, 0, sizeof(record));
+  std::memcpy(&record, record_ptr, std::min(record_length, sizeof(record)));
+
+  size_t offset = 0;
+  auto append = [&](const char* fmt, auto... args) {
+    if (offset < out_capacity) {
+      int n = std::snprintf(out + offset, out_capacity - offset, fmt, args...);
+      if (n > 0) {
+        offset = std::min(offset + size_t(n), out_capacity - 1);
+      }
+    }
+  };
 
-StringBuffer* thread_local_string_buffer() { return &string_buffer_; }
+  using Slot = KernelCallRecord::Slot;
+  append("%s(", record.export_entry->name);
+  for (uint32_t i = 0; i < record.slot_count; ++i) {
+    Slot type = record.slot_types[i];
+    uint64_t value = record.slots[i];
+    bool is_deref = type >= Slot::kDerefInt;
+    if (is_deref) {
+      append(i && record.slot_types[i - 1] >= Slot::kDerefInt ? ", " : "(");
+    } else if (i) {
+      append(", ");
+    }
+    float float_value;
+    double double_value;
+    std::memcpy(&float_value, &value, sizeof(float_value));
+    std::memcpy(&double_value, &value, sizeof(double_value));
+    switch (type) {
+      case Slot::kInt:
+      case Slot::kDerefInt:
+        append("%d", int32_t(value));
+        break;
+      case Slot::kDword:
+      case Slot::kPointer:
+      case Slot::kDerefDword:
+        append("%.8X", uint32_t(value));
+        break;
+      case Slot::kQword:
+      case Slot::kDerefQword:
+        append("%.16" PRIX64, value);
+        break;
+      case Slot::kFloat:
+      case Slot::kDerefFloat:
+        append("%G", float_value);
+        break;
+      case Slot::kDouble:
+      case Slot::kDerefDouble:
+        append("%G", double_value);
+        break;
+    }
+    if (is_deref && (i + 1 == record.slot_count ||
+                     record.slot_types[i + 1] < Slot::kDerefInt)) {
+      append(")");
+    }
+  }
+  append(")");
+  return offset;
+}
 
 }  // namespace shim
 }  // namespace kernel
@@ -10,16 +10,23 @@
 #ifndef XENIA_KERNEL_UTIL_SHIM_UTILS_H_
 #define XENIA_KERNEL_UTIL_SHIM_UTILS_H_
 
+#include <gflags/gflags.h>
+
+#include <cstddef>
 #include <cstring>
 #include <string>
+#include <type_traits>
 
 #include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/frontend/ppc_context.h"
 #include "xenia/kernel/kernel_state.h"
 
+DECLARE_bool(log_kernel_calls);
+
 namespace xe {
 namespace kernel {
 
@@ -98,6 +105,9 @@ class Param {
     PPCContext* ppc_context;
     int ordinal;
     int float_ordinal;
+    // Register arguments passed by a fast trampoline, or null to read them
+    // from the context.
+    const uint64_t* args;
   };
 
   Param& operator=(const Param&) = delete;
@@ -110,7 +120,9 @@ class Param {
 
   template <typename V>
   void LoadValue(Init& init, V* out_value) {
-    if (ordinal_ <= 7) {
+    if (init.args) {
+      *out_value = V(init.args[ordinal_]);
+    } else if (ordinal_ <= 7) {
       *out_value = V(init.ppc_context->r[3 + ordinal_]);
     } else {
       uint32_t stack_ptr =
@@ -314,51 +326,95 @@ using pointer_result_t = shim::Result<uint32_t>;
 
 namespace shim {
 
-inline void AppendParam(StringBuffer* string_buffer, int_t param) {
-  string_buffer->AppendFormat("%d", int32_t(param));
+// Compact binary form of a kernel call, recorded by the trampolines and only
+// formatted into text by the log writer thread (see FormatKernelCall).
+// Each param captures one or more slots: its raw value plus, for pointers,
+// the values it points at.
+struct KernelCallRecord {
+  enum class Slot : uint8_t {
+    kInt,
+    kDword,
+    kQword,
+    kFloat,
+    kDouble,
+    kPointer,
+    // Pointed-to values, printed in parens after the preceding kPointer.
+    kDerefInt,
+    kDerefDword,
+    kDerefQword,
+    kDerefFloat,
+    kDerefDouble,
+  };
+  static const size_t kMaxSlots = 24;
+
+  cpu::Export* export_entry;
+  uint32_t slot_count;
+  Slot slot_types[kMaxSlots];
+  uint64_t slots[kMaxSlots];
+
+  size_t length() const {
+    return offsetof(KernelCallRecord, slots) + slot_count * sizeof(uint64_t);
+  }
+  void Add(Slot type, uint64_t value) {
+    if (slot_count < kMaxSlots) {
+      slot_types[slot_count] = type;
+      slots[slot_count] = value;
+      ++slot_count;
+    }
+  }
+  template <typename T>
+  void AddBits(Slot type, T value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(value));
+    Add(type, bits);
+  }
+};
+
+inline void CaptureParam(KernelCallRecord* record, int_t param) {
+  record->Add(KernelCallRecord::Slot::kInt, uint32_t(int32_t(param)));
 }
-inline void AppendParam(StringBuffer* string_buffer, dword_t param) {
-  string_buffer->AppendFormat("%.8X", uint32_t(param));
+inline void CaptureParam(KernelCallRecord* record, dword_t param) {
+  record->Add(KernelCallRecord::Slot::kDword, uint32_t(param));
 }
-inline void AppendParam(StringBuffer* string_buffer, qword_t param) {
-  string_buffer->AppendFormat("%.16llX", uint64_t(param));
+inline void CaptureParam(KernelCallRecord* record, qword_t param) {
+  record->Add(KernelCallRecord::Slot::kQword, uint64_t(param));
 }
-inline void AppendParam(StringBuffer* string_buffer, float_t param) {
-  string_buffer->AppendFormat("%G", static_cast<float>(param));
+inline void CaptureParam(KernelCallRecord* record, float_t param) {
+  record->AddBits(KernelCallRecord::Slot::kFloat, static_cast<float>(param));
 }
-inline void AppendParam(StringBuffer* string_buffer, double_t param) {
-  string_buffer->AppendFormat("%G", static_cast<double>(param));
+inline void CaptureParam(KernelCallRecord* record, double_t param) {
+  record->AddBits(KernelCallRecord::Slot::kDouble, static_cast<double>(param));
 }
-inline void AppendParam(StringBuffer* string_buffer, lpvoid_t param) {
-  string_buffer->AppendFormat("%.8X", uint32_t(param));
+inline void CaptureParam(KernelCallRecord* record, lpvoid_t param) {
+  record->Add(KernelCallRecord::Slot::kPointer, uint32_t(param));
 }
-inline void AppendParam(StringBuffer* string_buffer, lpdword_t param) {
-  string_buffer->AppendFormat("%.8X", param.guest_address());
+inline void CaptureParam(KernelCallRecord* record, lpdword_t param) {
+  record->Add(KernelCallRecord::Slot::kPointer, param.guest_address());
   if (param) {
-    string_buffer->AppendFormat("(%.8X)", param.value());
+    record->Add(KernelCallRecord::Slot::kDerefDword, param.value());
   }
 }
-inline void AppendParam(StringBuffer* string_buffer, lpqword_t param) {
-  string_buffer->AppendFormat("%.8X", param.guest_address());
+inline void CaptureParam(KernelCallRecord* record, lpqword_t param) {
+  record->Add(KernelCallRecord::Slot::kPointer, param.guest_address());
   if (param) {
-    string_buffer->AppendFormat("(%.16llX)", param.value());
+    record->Add(KernelCallRecord::Slot::kDerefQword, param.value());
   }
 }
-inline void AppendParam(StringBuffer* string_buffer, lpfloat_t param) {
-  string_buffer->AppendFormat("%.8X", param.guest_address());
+inline void CaptureParam(KernelCallRecord* record, lpfloat_t param) {
+  record->Add(KernelCallRecord::Slot::kPointer, param.guest_address());
   if (param) {
-    string_buffer->AppendFormat("(%G)", param.value());
+    record->AddBits(KernelCallRecord::Slot::kDerefFloat, param.value());
   }
 }
-inline void AppendParam(StringBuffer* string_buffer, lpdouble_t param) {
-  string_buffer->AppendFormat("%.8X", param.guest_address());
+inline void CaptureParam(KernelCallRecord* record, lpdouble_t param) {
+  record->Add(KernelCallRecord::Slot::kPointer, param.guest_address());
   if (param) {
-    string_buffer->AppendFormat("(%G)", param.value());
+    record->AddBits(KernelCallRecord::Slot::kDerefDouble, param.value());
   }
 }
 template <typename T>
-void AppendParam(StringBuffer* string_buffer, pointer_t<T> param) {
-  string_buffer->AppendFormat("%.8X", param.guest_address());
+void CaptureParam(KernelCallRecord* record, pointer_t<T> param) {
+  record->Add(KernelCallRecord::Slot::kPointer, param.guest_address());
 }
 
 enum class KernelModuleId {
@@ -367,38 +423,45 @@ enum class KernelModuleId {
 };
 
 template <size_t I = 0, typename... Ps>
-typename std::enable_if<I == sizeof...(Ps)>::type AppendKernelCallParams(
-    StringBuffer& string_buffer, xe::cpu::Export* export_entry,
-    const std::tuple<Ps...>&) {}
+typename std::enable_if<I == sizeof...(Ps)>::type CaptureKernelCallParams(
+    KernelCallRecord* record, const std::tuple<Ps...>&) {}
 
 template <size_t I = 0, typename... Ps>
     typename std::enable_if <
-    I<sizeof...(Ps)>::type AppendKernelCallParams(
-        StringBuffer& string_buffer, xe::cpu::Export* export_entry,
-        const std::tuple<Ps...>& params) {
-  if (I) {
-    string_buffer.Append(", ");
-  }
-  auto param = std::get<I>(params);
-  AppendParam(&string_buffer, param);
-  AppendKernelCallParams<I + 1>(string_buffer, export_entry, params);
+    I<sizeof...(Ps)>::type CaptureKernelCallParams(
+        KernelCallRecord* record, const std::tuple<Ps...>& params) {
+  CaptureParam(record, std::get<I>(params));
+  CaptureKernelCallParams<I + 1>(record, params);
 }
 
-StringBuffer* thread_local_string_buffer();
+size_t FormatKernelCall(const void* record, size_t record_length, char* out,
+                        size_t out_capacity);
 
 template <typename Tuple>
-void PrintKernelCall(cpu::Export* export_entry, const Tuple& params) {
-  auto& string_buffer = *thread_local_string_buffer();
-  string_buffer.Reset();
-  string_buffer.Append(export_entry->name);
-  string_buffer.Append('(');
-  AppendKernelCallParams(string_buffer, export_entry, params);
-  string_buffer.Append(')');
-  if (export_entry->tags & ExportTag::kImportant) {
-    xe::LogLine('i', string_buffer.GetString(), string_buffer.length());
-  } else {
-    xe::LogLine('d', string_buffer.GetString(), string_buffer.length());
+void LogKernelCall(cpu::Export* export_entry, const Tuple& params) {
+  bool important = (export_entry->tags & xe::cpu::ExportTag::kImportant) != 0;
+  if (!xe::ShouldLog(LogCategory::kKernel,
+                     important ? LogLevel::kInfo : LogLevel::kDebug)) {
+    return;
+  }
+  KernelCallRecord record;
+  record.export_entry = export_entry;
+  record.slot_count = 0;
+  CaptureKernelCallParams(&record, params);
+  xe::LogRecord(important ? 'i' : 'd', FormatKernelCall, &record,
+                record.length());
+}
+
+// Tags applied to every registered export. Calls are only logged (and the
+// per-call logging branch only taken) when --log_kernel_calls is set or the
+// export is marked important.
+inline xe::cpu::ExportTag::type ExportRegistrationTags(
+    xe::cpu::ExportTag::type tags) {
+  tags |= xe::cpu::ExportTag::kImplemented;
+  if (FLAGS_log_kernel_calls || (tags & xe::cpu::ExportTag::kImportant)) {
+    tags |= xe::cpu::ExportTag::kLog;
   }
+  return tags;
 }
 
 template <typename F, typename Tuple, std::size_t... I>
@@ -406,22 +469,37 @@ auto KernelTrampoline(F&& f, Tuple&& t, std::index_sequence<I...>) {
   return std::forward<F>(f)(std::get<I>(std::forward<Tuple>(t))...);
 }
 
+inline constexpr bool AllOf() { return true; }
+template <typename... Bs>
+constexpr bool AllOf(bool b, Bs... bs) {
+  return b && AllOf(bs...);
+}
+
+// Whether an export taking the given params can get a fast trampoline: all of
+// them must be integers or pointers passed in registers.
+template <typename... Ps>
+constexpr bool IsFastCallable() {
+  return sizeof...(Ps) <= xe::cpu::kFastCallArgCount &&
+         AllOf((!std::is_base_of<ParamBase<float>, Ps>::value &&
+                !std::is_base_of<ParamBase<double>, Ps>::value)...);
+}
+
 template <KernelModuleId MODULE, uint16_t ORDINAL, typename R, typename... Ps>
 xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
                                 xe::cpu::ExportTag::type tags) {
   static const auto export_entry =
       new cpu::Export(ORDINAL, xe::cpu::Export::Type::kFunction, name,
-                      tags | ExportTag::kImplemented | ExportTag::kLog);
+                      ExportRegistrationTags(tags));
   static R (*FN)(Ps&...) = fn;
   struct X {
     static void Trampoline(PPCContext* ppc_context) {
-      ++export_entry->function_data.call_count;
+      xe::cpu::ExportCallScope call_scope(export_entry);
       Param::Init init = {
           ppc_context, sizeof...(Ps), 0,
       };
       auto params = std::make_tuple<Ps...>(Ps(init)...);
       if (export_entry->tags & ExportTag::kLog) {
-        PrintKernelCall(export_entry, params);
+        LogKernelCall(export_entry, params);
       }
       auto result =
           KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
@@ -431,8 +509,24 @@ xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
         // TODO(benvanik): log result.
       }
     }
+    static void FastTrampoline(PPCContext* ppc_context, uint64_t arg0,
+                               uint64_t arg1, uint64_t arg2) {
+      xe::cpu::ExportCallScope call_scope(export_entry);
+      const uint64_t args[] = {arg0, arg1, arg2};
+      Param::Init init = {
+          ppc_context, sizeof...(Ps), 0, args,
+      };
+      auto params = std::make_tuple<Ps...>(Ps(init)...);
+      auto result =
+          KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
+                           std::make_index_sequence<sizeof...(Ps)>());
+      result.Store(ppc_context);
+    }
   };
   export_entry->function_data.trampoline = &X::Trampoline;
+  if (IsFastCallable<Ps...>()) {
+    export_entry->function_data.fast_trampoline = &X::FastTrampoline;
+  }
   return export_entry;
 }
 
@@ -441,23 +535,37 @@ xe::cpu::Export* RegisterExport(void (*fn)(Ps&...), const char* name,
                                 xe::cpu::ExportTag::type tags) {
   static const auto export_entry =
       new cpu::Export(ORDINAL, xe::cpu::Export::Type::kFunction, name,
-                      tags | ExportTag::kImplemented | ExportTag::kLog);
+                      ExportRegistrationTags(tags));
   static void (*FN)(Ps&...) = fn;
   struct X {
     static void Trampoline(PPCContext* ppc_context) {
-      ++export_entry->function_data.call_count;
+      xe::cpu::ExportCallScope call_scope(export_entry);
       Param::Init init = {
           ppc_context, sizeof...(Ps),
       };
       auto params = std::make_tuple<Ps...>(Ps(init)...);
       if (export_entry->tags & ExportTag::kLog) {
-        PrintKernelCall(export_entry, params);
+        LogKernelCall(export_entry, params);
       }
       KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
                        std::make_index_sequence<sizeof...(Ps)>());
     }
+    static void FastTrampoline(PPCContext* ppc_context, uint64_t arg0,
+                               uint64_t arg1, uint64_t arg2) {
+      xe::cpu::ExportCallScope call_scope(export_entry);
+      const uint64_t args[] = {arg0, arg1, arg2};
+      Param::Init init = {
+          ppc_context, sizeof...(Ps), 0, args,
+      };
+      auto params = std::make_tuple<Ps...>(Ps(init)...);
+      KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
+                       std::make_index_sequence<sizeof...(Ps)>());
+    }
   };
   export_entry->function_data.trampoline = &X::Trampoline;
+  if (IsFastCallable<Ps...>()) {
+    export_entry->function_data.fast_trampoline = &X::FastTrampoline;
+  }
   return export_entry;
 }
 
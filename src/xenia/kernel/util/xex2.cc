@@ -11,30 +11,50 @@
 
 #include <gflags/gflags.h>
 
+#include <wmmintrin.h>
+
 #include <algorithm>
 #include <cstring>
 #include <vector>
 
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif  // XE_COMPILER_MSVC
+
 #include "third_party/crypto/rijndael-alg-fst.h"
 #include "third_party/crypto/rijndael-alg-fst.c"
 #include "third_party/mspack/lzx.h"
 #include "third_party/mspack/lzxd.c"
 #include "third_party/mspack/mspack.h"
 #include "third_party/pe/pe_image.h"
+#include "third_party/xxhash/xxhash.h"
 
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/platform.h"
+#include "xenia/base/string.h"
+#include "xenia/base/thread_pool.h"
+#include "xenia/base/threading.h"
 
 namespace xe {}  // namespace xe
 
 DEFINE_bool(xex_dev_key, false, "Use the devkit key.");
+DEFINE_string(xex_image_cache_path, "",
+              "Caches decrypted and decompressed XEX images in this path, "
+              "keyed by XEX hash, so later loads skip decryption and "
+              "decompression. Disabled if empty.");
 
 typedef struct xe_xex2 {
   xe::Memory* memory;
 
   xe_xex2_header_t header;
+  // Size of the image allocated at header.exe_address.
+  uint32_t image_size;
 
   std::vector<PESection*>* sections;
 
@@ -49,6 +69,8 @@ int xe_xex2_read_header(const uint8_t* addr, const size_t length,
 int xe_xex2_decrypt_key(xe_xex2_header_t* header);
 int xe_xex2_read_image(xe_xex2_ref xex, const uint8_t* xex_addr,
                        const uint32_t xex_length, xe::Memory* memory);
+bool xe_xex2_read_cached_image(xe_xex2_ref xex, uint64_t xex_hash);
+void xe_xex2_write_cached_image(xe_xex2_ref xex, uint64_t xex_hash);
 int xe_xex2_load_pe(xe_xex2_ref xex);
 int xe_xex2_find_import_infos(xe_xex2_ref xex,
                               const xe_xex2_import_library_t* library);
@@ -70,7 +92,16 @@ xe_xex2_ref xe_xex2_load(xe::Memory* memory, const void* addr,
     return nullptr;
   }
 
-  if (xe_xex2_read_image(xex, (const uint8_t*)addr, uint32_t(length), memory)) {
+  // The key guess depends on --xex_dev_key, so it is part of the cache key.
+  uint64_t xex_hash = 0;
+  bool image_cached = false;
+  if (!FLAGS_xex_image_cache_path.empty()) {
+    xex_hash = XXH64(addr, length, FLAGS_xex_dev_key ? 1 : 0);
+    image_cached = xe_xex2_read_cached_image(xex, xex_hash);
+  }
+
+  if (!image_cached &&
+      xe_xex2_read_image(xex, (const uint8_t*)addr, uint32_t(length), memory)) {
     xe_xex2_dealloc(xex);
     return nullptr;
   }
@@ -80,6 +111,11 @@ xe_xex2_ref xe_xex2_load(xe::Memory* memory, const void* addr,
     return nullptr;
   }
 
+  // Only images that passed PE validation are worth caching.
+  if (!FLAGS_xex_image_cache_path.empty() && !image_cached) {
+    xe_xex2_write_cached_image(xex, xex_hash);
+  }
+
   for (size_t n = 0; n < xex->header.import_library_count; n++) {
     auto library = &xex->header.import_libraries[n];
     if (xe_xex2_find_import_infos(xex, library)) {
@@ -515,31 +551,227 @@ struct mspack_system* mspack_memory_sys_create() {
 }
 void mspack_memory_sys_destroy(struct mspack_system* sys) { free(sys); }
 
-void xe_xex2_decrypt_buffer(const uint8_t* session_key,
-                            const uint8_t* input_buffer,
-                            const size_t input_size, uint8_t* output_buffer,
-                            const size_t output_size) {
+// AES-128-CBC decryption of image data. CBC decryption of a block only
+// depends on the previous ciphertext block, so large inputs are split into
+// chunks decrypted in parallel, and AES-NI is used when the host has it.
+typedef struct {
   uint32_t rk[4 * (MAXNR + 1)];
+  int32_t nr;
+  bool use_aesni;
+  __m128i dk[11];
+} xe_xex2_aes_key_t;
+
+// A run of contiguous ciphertext decrypted to contiguous plaintext. |iv| is
+// the preceding ciphertext block, or null for a zero IV.
+typedef struct {
+  const uint8_t* ct;
+  uint8_t* pt;
+  size_t length;
+  const uint8_t* iv;
+} xe_xex2_aes_segment_t;
+
+#if XE_COMPILER_MSVC
+#define XE_XEX2_AESNI_TARGET
+#else
+#define XE_XEX2_AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif  // XE_COMPILER_MSVC
+
+static bool xe_xex2_has_aesni() {
+#if XE_COMPILER_MSVC
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 25)) != 0;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES);
+#endif  // XE_COMPILER_MSVC
+}
+
+XE_XEX2_AESNI_TARGET static __m128i xe_xex2_aesni_expand(__m128i key,
+                                                         __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+XE_XEX2_AESNI_TARGET static void xe_xex2_aesni_key_setup(
+    const uint8_t* key, xe_xex2_aes_key_t* out_key) {
+  __m128i ek[11];
+  ek[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+#define XE_XEX2_EXPAND(i, rcon) \
+  ek[i] = xe_xex2_aesni_expand(  \
+      ek[i - 1], _mm_aeskeygenassist_si128(ek[i - 1], rcon))
+  XE_XEX2_EXPAND(1, 0x01);
+  XE_XEX2_EXPAND(2, 0x02);
+  XE_XEX2_EXPAND(3, 0x04);
+  XE_XEX2_EXPAND(4, 0x08);
+  XE_XEX2_EXPAND(5, 0x10);
+  XE_XEX2_EXPAND(6, 0x20);
+  XE_XEX2_EXPAND(7, 0x40);
+  XE_XEX2_EXPAND(8, 0x80);
+  XE_XEX2_EXPAND(9, 0x1B);
+  XE_XEX2_EXPAND(10, 0x36);
+#undef XE_XEX2_EXPAND
+  // Equivalent inverse cipher schedule.
+  out_key->dk[0] = ek[10];
+  for (int i = 1; i < 10; ++i) {
+    out_key->dk[i] = _mm_aesimc_si128(ek[10 - i]);
+  }
+  out_key->dk[10] = ek[0];
+}
+
+XE_XEX2_AESNI_TARGET static void xe_xex2_aesni_decrypt_cbc(
+    const xe_xex2_aes_key_t* key, __m128i iv, const uint8_t* ct, uint8_t* pt,
+    size_t block_count) {
+  const __m128i* dk = key->dk;
+  auto src = reinterpret_cast<const __m128i*>(ct);
+  auto dest = reinterpret_cast<__m128i*>(pt);
+  size_t n = 0;
+  // Four independent blocks at a time to hide aesdec latency.
+  for (; n + 4 <= block_count; n += 4) {
+    __m128i c0 = _mm_loadu_si128(src + n + 0);
+    __m128i c1 = _mm_loadu_si128(src + n + 1);
+    __m128i c2 = _mm_loadu_si128(src + n + 2);
+    __m128i c3 = _mm_loadu_si128(src + n + 3);
+    __m128i b0 = _mm_xor_si128(c0, dk[0]);
+    __m128i b1 = _mm_xor_si128(c1, dk[0]);
+    __m128i b2 = _mm_xor_si128(c2, dk[0]);
+    __m128i b3 = _mm_xor_si128(c3, dk[0]);
+    for (int r = 1; r < 10; ++r) {
+      b0 = _mm_aesdec_si128(b0, dk[r]);
+      b1 = _mm_aesdec_si128(b1, dk[r]);
+      b2 = _mm_aesdec_si128(b2, dk[r]);
+      b3 = _mm_aesdec_si128(b3, dk[r]);
+    }
+    b0 = _mm_aesdeclast_si128(b0, dk[10]);
+    b1 = _mm_aesdeclast_si128(b1, dk[10]);
+    b2 = _mm_aesdeclast_si128(b2, dk[10]);
+    b3 = _mm_aesdeclast_si128(b3, dk[10]);
+    _mm_storeu_si128(dest + n + 0, _mm_xor_si128(b0, iv));
+    _mm_storeu_si128(dest + n + 1, _mm_xor_si128(b1, c0));
+    _mm_storeu_si128(dest + n + 2, _mm_xor_si128(b2, c1));
+    _mm_storeu_si128(dest + n + 3, _mm_xor_si128(b3, c2));
+    iv = c3;
+  }
+  for (; n < block_count; ++n) {
+    __m128i c = _mm_loadu_si128(src + n);
+    __m128i b = _mm_xor_si128(c, dk[0]);
+    for (int r = 1; r < 10; ++r) {
+      b = _mm_aesdec_si128(b, dk[r]);
+    }
+    b = _mm_aesdeclast_si128(b, dk[10]);
+    _mm_storeu_si128(dest + n, _mm_xor_si128(b, iv));
+    iv = c;
+  }
+}
+
+void xe_xex2_aes_key_setup(const uint8_t* session_key,
+                           xe_xex2_aes_key_t* out_key) {
+  out_key->nr = rijndaelKeySetupDec(out_key->rk, session_key, 128);
+  out_key->use_aesni = xe_xex2_has_aesni();
+  if (out_key->use_aesni) {
+    xe_xex2_aesni_key_setup(session_key, out_key);
+  }
+}
+
+void xe_xex2_decrypt_segment(const xe_xex2_aes_key_t* key,
+                             const xe_xex2_aes_segment_t& segment) {
   uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key, 128);
-  const uint8_t* ct = input_buffer;
-  uint8_t* pt = output_buffer;
-  for (size_t n = 0; n < input_size; n += 16, ct += 16, pt += 16) {
-    // Decrypt 16 uint8_ts from input -> output.
-    rijndaelDecrypt(rk, Nr, ct, pt);
-    for (size_t i = 0; i < 16; i++) {
-      // XOR with previous.
-      pt[i] ^= ivec[i];
-      // Set previous.
-      ivec[i] = ct[i];
+  if (segment.iv) {
+    std::memcpy(ivec, segment.iv, 16);
+  }
+  size_t block_count = segment.length / 16;
+  const uint8_t* ct = segment.ct;
+  uint8_t* pt = segment.pt;
+  if (key->use_aesni) {
+    xe_xex2_aesni_decrypt_cbc(
+        key, _mm_loadu_si128(reinterpret_cast<const __m128i*>(ivec)), ct, pt,
+        block_count);
+    if (block_count) {
+      std::memcpy(ivec, ct + (block_count - 1) * 16, 16);
+    }
+    ct += block_count * 16;
+    pt += block_count * 16;
+  } else {
+    for (size_t n = 0; n < block_count; n++, ct += 16, pt += 16) {
+      // Decrypt 16 uint8_ts from input -> output.
+      rijndaelDecrypt(key->rk, key->nr, ct, pt);
+      for (size_t i = 0; i < 16; i++) {
+        // XOR with previous.
+        pt[i] ^= ivec[i];
+        // Set previous.
+        ivec[i] = ct[i];
+      }
+    }
+  }
+  size_t tail_length = segment.length % 16;
+  if (tail_length) {
+    // Partial trailing block; decrypt a padded copy.
+    uint8_t tail_ct[16] = {0};
+    uint8_t tail_pt[16];
+    std::memcpy(tail_ct, ct, tail_length);
+    rijndaelDecrypt(key->rk, key->nr, tail_ct, tail_pt);
+    for (size_t i = 0; i < tail_length; i++) {
+      pt[i] = tail_pt[i] ^ ivec[i];
     }
   }
 }
 
+void xe_xex2_decrypt_segments(const uint8_t* session_key,
+                              const std::vector<xe_xex2_aes_segment_t>& input) {
+  // Chunks smaller than this aren't worth handing to another thread.
+  const size_t kChunkSize = 256 * 1024;
+
+  xe_xex2_aes_key_t key;
+  xe_xex2_aes_key_setup(session_key, &key);
+
+  // Split large segments on block boundaries; each chunk's IV is simply the
+  // ciphertext block before it.
+  std::vector<xe_xex2_aes_segment_t> chunks;
+  size_t total_length = 0;
+  for (auto& segment : input) {
+    total_length += segment.length;
+    size_t offset = 0;
+    while (offset < segment.length) {
+      size_t length = std::min(kChunkSize, segment.length - offset);
+      xe_xex2_aes_segment_t chunk = {
+          segment.ct + offset, segment.pt + offset, length,
+          offset ? segment.ct + offset - 16 : segment.iv};
+      chunks.push_back(chunk);
+      offset += length;
+    }
+  }
+
+  if (total_length < 4 * kChunkSize) {
+    for (auto& chunk : chunks) {
+      xe_xex2_decrypt_segment(&key, chunk);
+    }
+    return;
+  }
+  // The loader is blocked on this.
+  xe::threading::TaskGroup group(xe::threading::TaskPriority::kHigh);
+  for (auto& chunk : chunks) {
+    group.Run([&key, &chunk]() { xe_xex2_decrypt_segment(&key, chunk); });
+  }
+  group.Wait();
+}
+
+void xe_xex2_decrypt_buffer(const uint8_t* session_key,
+                            const uint8_t* input_buffer,
+                            const size_t input_size, uint8_t* output_buffer,
+                            const size_t output_size) {
+  xe_xex2_aes_segment_t segment = {input_buffer, output_buffer,
+                                   std::min(input_size, output_size), nullptr};
+  xe_xex2_decrypt_segments(session_key, {segment});
+}
+
 int xe_xex2_read_image_uncompressed(const xe_xex2_header_t* header,
                                     const uint8_t* xex_addr,
                                     const uint32_t xex_length,
-                                    xe::Memory* memory) {
+                                    xe::Memory* memory,
+                                    uint32_t* out_image_size) {
   // Allocate in-place the XEX memory.
   const uint32_t exe_length = xex_length - header->exe_offset;
   uint32_t uncompressed_size = exe_length;
@@ -565,10 +797,12 @@ int xe_xex2_read_image_uncompressed(const xe_xex2_header_t* header,
         return 1;
       }
       memcpy(buffer, p, exe_length);
+      *out_image_size = uncompressed_size;
       return 0;
     case XEX_ENCRYPTION_NORMAL:
       xe_xex2_decrypt_buffer(header->session_key, p, exe_length, buffer,
                              uncompressed_size);
+      *out_image_size = uncompressed_size;
       return 0;
     default:
       assert_always();
@@ -581,7 +815,8 @@ int xe_xex2_read_image_uncompressed(const xe_xex2_header_t* header,
 int xe_xex2_read_image_basic_compressed(const xe_xex2_header_t* header,
                                         const uint8_t* xex_addr,
                                         const uint32_t xex_length,
-                                        xe::Memory* memory) {
+                                        xe::Memory* memory,
+                                        uint32_t* out_image_size) {
   const uint32_t exe_length = xex_length - header->exe_offset;
   const uint8_t* source_buffer = (const uint8_t*)xex_addr + header->exe_offset;
   const uint8_t* p = source_buffer;
@@ -620,9 +855,8 @@ int xe_xex2_read_image_basic_compressed(const xe_xex2_header_t* header,
   std::memset(buffer, 0, total_size);  // Quickly zero the contents.
   uint8_t* d = buffer;
 
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, header->session_key, 128);
+  // Encrypted blocks form one contiguous CBC stream scattered into the image.
+  std::vector<xe_xex2_aes_segment_t> segments;
 
   for (size_t n = 0; n < comp_info->block_count; n++) {
     const uint32_t data_size = comp_info->blocks[n].data_size;
@@ -638,18 +872,9 @@ int xe_xex2_read_image_basic_compressed(const xe_xex2_header_t* header,
         memcpy(d, p, exe_length - (p - source_buffer));
         break;
       case XEX_ENCRYPTION_NORMAL: {
-        const uint8_t* ct = p;
-        uint8_t* pt = d;
-        for (size_t m = 0; m < data_size; m += 16, ct += 16, pt += 16) {
-          // Decrypt 16 uint8_ts from input -> output.
-          rijndaelDecrypt(rk, Nr, ct, pt);
-          for (size_t i = 0; i < 16; i++) {
-            // XOR with previous.
-            pt[i] ^= ivec[i];
-            // Set previous.
-            ivec[i] = ct[i];
-          }
-        }
+        xe_xex2_aes_segment_t segment = {
+            p, d, data_size, p != source_buffer ? p - 16 : nullptr};
+        segments.push_back(segment);
       } break;
       default:
         assert_always();
@@ -660,13 +885,19 @@ int xe_xex2_read_image_basic_compressed(const xe_xex2_header_t* header,
     d += data_size + zero_size;
   }
 
+  if (!segments.empty()) {
+    xe_xex2_decrypt_segments(header->session_key, segments);
+  }
+
+  *out_image_size = total_size;
   return 0;
 }
 
 int xe_xex2_read_image_compressed(const xe_xex2_header_t* header,
                                   const uint8_t* xex_addr,
                                   const uint32_t xex_length,
-                                  xe::Memory* memory) {
+                                  xe::Memory* memory,
+                                  uint32_t* out_image_size) {
   const uint32_t exe_length = xex_length - header->exe_offset;
   const uint8_t* exe_buffer = (const uint8_t*)xex_addr + header->exe_offset;
 
@@ -770,6 +1001,7 @@ int xe_xex2_read_image_compressed(const xe_xex2_header_t* header,
                 header->file_format_info.compression_info.normal.window_bits, 0,
                 32768, (off_t)header->loader_info.image_size);
   result_code = lzxd_decompress(lzxd, (off_t)header->loader_info.image_size);
+  *out_image_size = uncompressed_size;
 
   if (lzxd) {
     lzxd_free(lzxd);
@@ -801,19 +1033,116 @@ int xe_xex2_read_image(xe_xex2_ref xex, const uint8_t* xex_addr,
   switch (header->file_format_info.compression_type) {
     case XEX_COMPRESSION_NONE:
       return xe_xex2_read_image_uncompressed(header, xex_addr, xex_length,
-                                             memory);
+                                             memory, &xex->image_size);
     case XEX_COMPRESSION_BASIC:
-      return xe_xex2_read_image_basic_compressed(header, xex_addr, xex_length,
-                                                 memory);
+      return xe_xex2_read_image_basic_compressed(
+          header, xex_addr, xex_length, memory, &xex->image_size);
     case XEX_COMPRESSION_NORMAL:
       return xe_xex2_read_image_compressed(header, xex_addr, xex_length,
-                                           memory);
+                                           memory, &xex->image_size);
     default:
       assert_always();
       return 1;
   }
 }
 
+// 'XIC1'
+static const uint32_t kImageCacheMagic = 0x31434958;
+// Bump whenever the file layout or image reading changes.
+static const uint32_t kImageCacheVersion = 1;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t xex_hash;
+  uint32_t exe_address;
+  uint32_t image_size;
+} xe_xex2_image_cache_header_t;
+
+std::wstring xe_xex2_image_cache_file_path(uint64_t xex_hash) {
+  char file_name[64];
+  std::snprintf(file_name, xe::countof(file_name), "xex_%.16llX.img",
+                static_cast<unsigned long long>(xex_hash));
+  return xe::join_paths(
+      xe::to_absolute_path(xe::to_wstring(FLAGS_xex_image_cache_path)),
+      xe::to_wstring(file_name));
+}
+
+bool xe_xex2_read_cached_image(xe_xex2_ref xex, uint64_t xex_hash) {
+  auto path = xe_xex2_image_cache_file_path(xex_hash);
+  if (!xe::filesystem::PathExists(path)) {
+    return false;
+  }
+  // Mapped rather than read so that all instances loading the same image
+  // share one copy in the OS page cache.
+  auto mapping = xe::MappedMemory::Open(
+      path, xe::MappedMemory::Mode::kRead, 0, 0,
+      xe::MappedMemory::AccessHint::kSequential);
+  if (!mapping) {
+    return false;
+  }
+  const xe_xex2_header_t* header = &xex->header;
+  xe_xex2_image_cache_header_t cache_header;
+  if (mapping->size() < sizeof(cache_header)) {
+    return false;
+  }
+  std::memcpy(&cache_header, mapping->data(), sizeof(cache_header));
+  if (cache_header.magic != kImageCacheMagic ||
+      cache_header.version != kImageCacheVersion ||
+      cache_header.xex_hash != xex_hash ||
+      cache_header.exe_address != header->exe_address ||
+      mapping->size() != sizeof(cache_header) + cache_header.image_size) {
+    // Stale; it is rewritten after a normal load.
+    return false;
+  }
+
+  bool alloc_result =
+      xex->memory->LookupHeap(header->exe_address)
+          ->AllocFixed(
+              header->exe_address, cache_header.image_size, 4096,
+              xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
+              xe::kMemoryProtectRead | xe::kMemoryProtectWrite);
+  if (!alloc_result) {
+    return false;
+  }
+  std::memcpy(xex->memory->TranslateVirtual(header->exe_address),
+              mapping->data() + sizeof(cache_header), cache_header.image_size);
+  xex->image_size = cache_header.image_size;
+  XELOGI("Loaded XEX image from cache (%.16llX)",
+         static_cast<unsigned long long>(xex_hash));
+  return true;
+}
+
+void xe_xex2_write_cached_image(xe_xex2_ref xex, uint64_t xex_hash) {
+  auto base_path =
+      xe::to_absolute_path(xe::to_wstring(FLAGS_xex_image_cache_path));
+  xe::filesystem::CreateFolder(base_path);
+  auto path = xe_xex2_image_cache_file_path(xex_hash);
+  // Other instances may be loading the same image right now. Write to a name
+  // only we use and publish it with a rename so that readers never see a
+  // partial file; the last writer wins, with identical contents.
+  auto temp_path =
+      path + L"." + std::to_wstring(xe::threading::current_thread_system_id());
+  FILE* file = xe::filesystem::OpenFile(temp_path, "wb");
+  if (!file) {
+    XELOGW("Unable to write XEX image cache file");
+    return;
+  }
+  const xe_xex2_header_t* header = &xex->header;
+  xe_xex2_image_cache_header_t cache_header = {
+      kImageCacheMagic, kImageCacheVersion, xex_hash, header->exe_address,
+      xex->image_size};
+  bool write_ok =
+      fwrite(&cache_header, sizeof(cache_header), 1, file) == 1 &&
+      fwrite(xex->memory->TranslateVirtual(header->exe_address), 1,
+             xex->image_size, file) == xex->image_size;
+  write_ok = fclose(file) == 0 && write_ok;
+  if (!write_ok || !xe::filesystem::RenameFile(temp_path, path)) {
+    XELOGW("Unable to write XEX image cache file");
+    xe::filesystem::DeleteFile(temp_path);
+  }
+}
+
 int xe_xex2_load_pe(xe_xex2_ref xex) {
   const xe_xex2_header_t* header = &xex->header;
   const uint8_t* p = xex->memory->TranslateVirtual(header->exe_address);
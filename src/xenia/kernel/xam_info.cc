@@ -182,6 +182,7 @@ SHIM_CALL XamAlloc_shim(PPCContext* ppc_context, KernelState* kernel_state) {
 
   // Allocate from the heap. Not sure why XAM does this specially, perhaps
   // it keeps stuff in a separate heap?
+  MemoryTagScope tag_scope(MemoryTag::kXamAlloc);
   uint32_t ptr = kernel_state->memory()->SystemHeapAlloc(size);
   SHIM_SET_MEM_32(out_ptr, ptr);
 
@@ -7,10 +7,17 @@
  ******************************************************************************
  */
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/objects/xevent.h"
 #include "xenia/kernel/objects/xthread.h"
@@ -103,6 +110,263 @@ void StoreSockaddr(const sockaddr& addr, uint8_t* ptr) {
   }
 }
 
+// Overlapped socket operations (WSARecv/WSASend and friends).
+// Operations on sockets that are ready complete immediately on the calling
+// thread. Anything else is queued, and a single reactor thread waits for
+// all queued sockets in one select() and completes them as they become
+// ready, so guest threads never block in host calls for overlapped I/O.
+// On completion the XWSAOVERLAPPED holds the WSA error (0 on success) in
+// internal, the byte count in internal_high and the flags in offset. Then
+// the completion routine is queued as an APC on the thread that started the
+// operation if there is one, and the overlapped event is set otherwise.
+class SocketReactor {
+ public:
+  struct Operation {
+    bool is_send;
+    SOCKET socket;
+    // Point into guest memory.
+    std::vector<WSABUF> buffers;
+    DWORD flags;
+    // Guest receive flags, source address and its length, if any. from_len
+    // is the size of the guest source address buffer at the time of the call.
+    uint32_t flags_ptr;
+    uint32_t from_ptr;
+    uint32_t from_len_ptr;
+    int from_len;
+    // Destination address for sends, if to_len is non-zero.
+    sockaddr to;
+    int to_len;
+    uint32_t overlapped_ptr;
+    // Guest completion routine and the thread to run it on, if any.
+    uint32_t completion_routine;
+    object_ref<XThread> completion_thread;
+  };
+
+  static SocketReactor* Get() {
+    static SocketReactor reactor;
+    return &reactor;
+  }
+
+  ~SocketReactor() {
+    if (thread_) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        Wake();
+      }
+      cond_.notify_all();
+      xe::threading::Wait(thread_.get(), false);
+    }
+    if (wake_socket_ != INVALID_SOCKET) {
+      closesocket(wake_socket_);
+    }
+  }
+
+  // Completes the operation now if the socket is ready and returns the
+  // result, or queues it and returns WSA_IO_PENDING.
+  int Submit(Operation op) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Operations on a socket complete in order.
+    bool is_behind = std::any_of(
+        pending_.begin(), pending_.end(),
+        [&op](const Operation& other) { return other.socket == op.socket; });
+    if (!is_behind && IsReady(op)) {
+      DWORD bytes = 0;
+      int error = Perform(&op, &bytes);
+      Complete(op, error, bytes);
+      return error;
+    }
+    if (!thread_) {
+      if (!CreateWakeSocket()) {
+        XELOGW("Socket reactor has no wake socket; polling instead");
+      }
+      running_ = true;
+      thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+      thread_->set_name("Socket Reactor");
+    }
+    pending_.push_back(std::move(op));
+    Wake();
+    lock.unlock();
+    cond_.notify_one();
+    return WSA_IO_PENDING;
+  }
+
+  // Aborts all queued operations on the socket.
+  void Cancel(SOCKET socket) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      if (it->socket == socket) {
+        Complete(*it, WSA_OPERATION_ABORTED, 0);
+        it = pending_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    // Take the socket out of the select before it is closed.
+    Wake();
+  }
+
+  // Performs the operation synchronously, returning the WSA error.
+  static int Perform(Operation* op, DWORD* out_bytes) {
+    int ret;
+    if (op->is_send) {
+      ret = WSASendTo(op->socket, op->buffers.data(),
+                      static_cast<DWORD>(op->buffers.size()), out_bytes,
+                      op->flags, op->to_len ? &op->to : nullptr, op->to_len,
+                      nullptr, nullptr);
+    } else {
+      if (op->from_ptr && (!op->from_len_ptr ||
+                           op->from_len < int(sizeof(Xsockaddr_t)))) {
+        // Too small for the address, as WSARecvFrom would report it.
+        return WSAEFAULT;
+      }
+      sockaddr from = {0};
+      int from_len = sizeof(from);
+      ret = WSARecvFrom(op->socket, op->buffers.data(),
+                        static_cast<DWORD>(op->buffers.size()), out_bytes,
+                        &op->flags, &from, &from_len, nullptr, nullptr);
+      if (!ret && op->from_ptr) {
+        StoreSockaddr(from, kernel_memory()->TranslateVirtual(op->from_ptr));
+      }
+      if (!ret && op->from_len_ptr) {
+        xe::store_and_swap<uint32_t>(
+            kernel_memory()->TranslateVirtual(op->from_len_ptr), from_len);
+      }
+    }
+    return ret ? WSAGetLastError() : 0;
+  }
+
+ private:
+  SocketReactor() = default;
+
+  // Creates a loopback UDP socket connected to itself. Queue changes send a
+  // byte to it to wake the reactor thread out of select().
+  bool CreateWakeSocket() {
+    SOCKET wake_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (wake_socket == INVALID_SOCKET) {
+      return false;
+    }
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int addr_len = sizeof(addr);
+    u_long non_blocking = 1;
+    if (bind(wake_socket, reinterpret_cast<sockaddr*>(&addr), addr_len) ||
+        getsockname(wake_socket, reinterpret_cast<sockaddr*>(&addr),
+                    &addr_len) ||
+        connect(wake_socket, reinterpret_cast<sockaddr*>(&addr), addr_len) ||
+        ioctlsocket(wake_socket, FIONBIO, &non_blocking)) {
+      closesocket(wake_socket);
+      return false;
+    }
+    wake_socket_ = wake_socket;
+    return true;
+  }
+
+  // Must be called with mutex_ held.
+  void Wake() {
+    if (wake_socket_ != INVALID_SOCKET) {
+      char byte = 0;
+      send(wake_socket_, &byte, 1, 0);
+    }
+  }
+
+  static bool IsReady(const Operation& op) {
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(op.socket, &set);
+    timeval timeout = {0, 0};
+    return select(0, op.is_send ? nullptr : &set, op.is_send ? &set : nullptr,
+                  nullptr, &timeout) != 0;
+  }
+
+  static void Complete(const Operation& op, int error, DWORD bytes) {
+    auto overlapped =
+        kernel_memory()->TranslateVirtual<XWSAOVERLAPPED*>(op.overlapped_ptr);
+    overlapped->internal_high = bytes;
+    overlapped->offset = op.flags;
+    overlapped->internal = error;
+    if (!error && op.flags_ptr) {
+      xe::store_and_swap<uint32_t>(
+          kernel_memory()->TranslateVirtual(op.flags_ptr), op.flags);
+    }
+    if (op.completion_routine) {
+      // completion_routine(error, bytes, overlapped), delivered when the
+      // thread next waits alertably. The event handle is the guest's to use
+      // as context. APCs only carry three arguments, so flags are left to
+      // WSAGetOverlappedResult.
+      op.completion_thread->EnqueueApc(op.completion_routine, error, bytes,
+                                       op.overlapped_ptr);
+      return;
+    }
+    auto evt = kernel_state()->object_table()->LookupObject<XEvent>(
+        overlapped->event_handle);
+    if (evt) {
+      evt->Set(0, false);
+    }
+  }
+
+  void ThreadMain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [this]() { return !running_ || !pending_.empty(); });
+      if (!running_) {
+        break;
+      }
+
+      // One select for everything queued. FD_SET ignores sockets past
+      // FD_SETSIZE; those are picked up once earlier ones complete.
+      fd_set read_set;
+      fd_set write_set;
+      FD_ZERO(&read_set);
+      FD_ZERO(&write_set);
+      for (auto& op : pending_) {
+        FD_SET(op.socket, op.is_send ? &write_set : &read_set);
+      }
+      bool has_wake_socket = wake_socket_ != INVALID_SOCKET;
+      if (has_wake_socket) {
+        FD_SET(wake_socket_, &read_set);
+      }
+      lock.unlock();
+      // Blocks until something is ready or the queue changes. Without a wake
+      // socket it has to poll to pick up newly queued operations.
+      timeval timeout = {0, 5000};
+      int ret = select(0, &read_set, &write_set, nullptr,
+                       has_wake_socket ? nullptr : &timeout);
+      int error = ret < 0 ? WSAGetLastError() : 0;
+      if (ret > 0 && has_wake_socket && FD_ISSET(wake_socket_, &read_set)) {
+        char bytes[64];
+        while (recv(wake_socket_, bytes, sizeof(bytes), 0) > 0) {
+        }
+      }
+      lock.lock();
+
+      for (auto it = pending_.begin(); it != pending_.end();) {
+        if (error) {
+          // Probably a socket closed under us. Fail everything rather than
+          // spinning on it; the guest will retry what it still wants.
+          Complete(*it, error, 0);
+        } else if (FD_ISSET(it->socket,
+                            it->is_send ? &write_set : &read_set)) {
+          DWORD bytes = 0;
+          Complete(*it, Perform(&*it, &bytes), bytes);
+        } else {
+          ++it;
+          continue;
+        }
+        it = pending_.erase(it);
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool running_ = false;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  SOCKET wake_socket_ = INVALID_SOCKET;
+  std::list<Operation> pending_;
+};
+
 // https://github.com/joolswills/mameox/blob/master/MAMEoX/Sources/xbox_Network.cpp#L136
 struct XNetStartupParams {
   BYTE cfgSizeOfStruct;
@@ -235,26 +499,178 @@ SHIM_CALL NetDll_WSAGetLastError_shim(PPCContext* ppc_context,
   SHIM_SET_RETURN_32(err);
 }
 
+// Runs a WSARecv/WSASend family call, overlapped or not. Returns 0 or
+// SOCKET_ERROR with the WSA error set.
+uint32_t StartSocketOperation(SocketReactor::Operation op,
+                              uint32_t buffers_ptr, uint32_t buffer_count,
+                              uint32_t num_bytes_ptr, uint32_t overlapped_ptr,
+                              uint32_t completion_routine) {
+  auto buffers = kernel_memory()->TranslateVirtual<XWSABUF*>(buffers_ptr);
+  for (uint32_t i = 0; i < buffer_count; ++i) {
+    WSABUF buffer;
+    buffer.len = buffers[i].len;
+    buffer.buf = kernel_memory()->TranslateVirtual<char*>(buffers[i].buf_ptr);
+    op.buffers.push_back(buffer);
+  }
+
+  int error;
+  DWORD bytes = 0;
+  if (!overlapped_ptr) {
+    // Blocking (or not) as the socket was set up by the guest.
+    error = SocketReactor::Perform(&op, &bytes);
+    if (!error && op.flags_ptr) {
+      xe::store_and_swap<uint32_t>(
+          kernel_memory()->TranslateVirtual(op.flags_ptr), op.flags);
+    }
+  } else {
+    auto overlapped =
+        kernel_memory()->TranslateVirtual<XWSAOVERLAPPED*>(overlapped_ptr);
+    overlapped->internal = WSA_IO_PENDING;
+    overlapped->internal_high = 0;
+    if (completion_routine) {
+      op.completion_routine = completion_routine;
+      op.completion_thread = retain_object(XThread::GetCurrentThread());
+    } else {
+      auto evt = kernel_state()->object_table()->LookupObject<XEvent>(
+          overlapped->event_handle);
+      if (evt) {
+        evt->Reset();
+      }
+    }
+    op.overlapped_ptr = overlapped_ptr;
+    error = SocketReactor::Get()->Submit(std::move(op));
+    bytes = overlapped->internal_high;
+  }
+
+  if (error) {
+    WSASetLastError(error);
+    return static_cast<uint32_t>(SOCKET_ERROR);
+  }
+  if (num_bytes_ptr) {
+    xe::store_and_swap<uint32_t>(
+        kernel_memory()->TranslateVirtual(num_bytes_ptr), bytes);
+  }
+  return 0;
+}
+
 dword_result_t NetDll_WSARecvFrom(dword_t caller, dword_t socket,
                                   pointer_t<XWSABUF> buffers_ptr,
                                   dword_t buffer_count,
                                   lpdword_t num_bytes_recv, lpdword_t flags_ptr,
                                   pointer_t<Xsockaddr_t> from_addr,
+                                  lpdword_t from_len_ptr,
                                   pointer_t<XWSAOVERLAPPED> overlapped_ptr,
                                   lpvoid_t completion_routine_ptr) {
-  if (overlapped_ptr) {
+  SocketReactor::Operation op = {};
+  op.is_send = false;
+  op.socket = socket;
+  op.flags = flags_ptr ? flags_ptr.value() : 0;
+  op.flags_ptr = flags_ptr.guest_address();
+  op.from_ptr = from_addr.guest_address();
+  op.from_len_ptr = from_len_ptr.guest_address();
+  op.from_len = from_len_ptr ? int(from_len_ptr.value()) : 0;
+  return StartSocketOperation(
+      std::move(op), buffers_ptr.guest_address(), buffer_count,
+      num_bytes_recv.guest_address(), overlapped_ptr.guest_address(),
+      completion_routine_ptr.guest_address());
+}
+DECLARE_XAM_EXPORT(NetDll_WSARecvFrom, ExportTag::kNetworking);
+
+dword_result_t NetDll_WSARecv(dword_t caller, dword_t socket,
+                              pointer_t<XWSABUF> buffers_ptr,
+                              dword_t buffer_count, lpdword_t num_bytes_recv,
+                              lpdword_t flags_ptr,
+                              pointer_t<XWSAOVERLAPPED> overlapped_ptr,
+                              lpvoid_t completion_routine_ptr) {
+  SocketReactor::Operation op = {};
+  op.is_send = false;
+  op.socket = socket;
+  op.flags = flags_ptr ? flags_ptr.value() : 0;
+  op.flags_ptr = flags_ptr.guest_address();
+  return StartSocketOperation(
+      std::move(op), buffers_ptr.guest_address(), buffer_count,
+      num_bytes_recv.guest_address(), overlapped_ptr.guest_address(),
+      completion_routine_ptr.guest_address());
+}
+DECLARE_XAM_EXPORT(NetDll_WSARecv, ExportTag::kNetworking);
+
+dword_result_t NetDll_WSASendTo(dword_t caller, dword_t socket,
+                                pointer_t<XWSABUF> buffers_ptr,
+                                dword_t buffer_count, lpdword_t num_bytes_sent,
+                                dword_t flags, pointer_t<Xsockaddr_t> to_addr,
+                                dword_t to_len,
+                                pointer_t<XWSAOVERLAPPED> overlapped_ptr,
+                                lpvoid_t completion_routine_ptr) {
+  SocketReactor::Operation op = {};
+  op.is_send = true;
+  op.socket = socket;
+  op.flags = flags;
+  if (to_addr) {
+    LoadSockaddr(reinterpret_cast<const uint8_t*>(to_addr.host_address()),
+                 &op.to);
+    op.to_len = to_len;
+  }
+  return StartSocketOperation(
+      std::move(op), buffers_ptr.guest_address(), buffer_count,
+      num_bytes_sent.guest_address(), overlapped_ptr.guest_address(),
+      completion_routine_ptr.guest_address());
+}
+DECLARE_XAM_EXPORT(NetDll_WSASendTo, ExportTag::kNetworking);
+
+dword_result_t NetDll_WSASend(dword_t caller, dword_t socket,
+                              pointer_t<XWSABUF> buffers_ptr,
+                              dword_t buffer_count, lpdword_t num_bytes_sent,
+                              dword_t flags,
+                              pointer_t<XWSAOVERLAPPED> overlapped_ptr,
+                              lpvoid_t completion_routine_ptr) {
+  SocketReactor::Operation op = {};
+  op.is_send = true;
+  op.socket = socket;
+  op.flags = flags;
+  return StartSocketOperation(
+      std::move(op), buffers_ptr.guest_address(), buffer_count,
+      num_bytes_sent.guest_address(), overlapped_ptr.guest_address(),
+      completion_routine_ptr.guest_address());
+}
+DECLARE_XAM_EXPORT(NetDll_WSASend, ExportTag::kNetworking);
+
+dword_result_t NetDll_WSAGetOverlappedResult(
+    dword_t caller, dword_t socket, pointer_t<XWSAOVERLAPPED> overlapped_ptr,
+    lpdword_t bytes_transferred, dword_t wait, lpdword_t flags_ptr) {
+  if (overlapped_ptr->internal == WSA_IO_PENDING) {
+    if (!wait) {
+      WSASetLastError(WSA_IO_INCOMPLETE);
+      return 0;
+    }
     auto evt = kernel_state()->object_table()->LookupObject<XEvent>(
         overlapped_ptr->event_handle);
-
-    if (evt) {
-      evt->Set(0, false);
+    while (overlapped_ptr->internal == WSA_IO_PENDING) {
+      if (evt) {
+        evt->Wait(0, 0, 0, nullptr);
+      } else {
+        xe::threading::Sleep(std::chrono::milliseconds(1));
+      }
     }
   }
+  if (bytes_transferred) {
+    *bytes_transferred = overlapped_ptr->internal_high;
+  }
+  if (flags_ptr) {
+    *flags_ptr = overlapped_ptr->offset;
+  }
+  if (overlapped_ptr->internal) {
+    WSASetLastError(overlapped_ptr->internal);
+    return 0;
+  }
+  return 1;
+}
+DECLARE_XAM_EXPORT(NetDll_WSAGetOverlappedResult, ExportTag::kNetworking);
 
+dword_result_t NetDll_WSACancelOverlappedIO(dword_t caller, dword_t socket) {
+  SocketReactor::Get()->Cancel(socket);
   return 0;
 }
-DECLARE_XAM_EXPORT(NetDll_WSARecvFrom,
-                   ExportTag::kNetworking | ExportTag::kStub);
+DECLARE_XAM_EXPORT(NetDll_WSACancelOverlappedIO, ExportTag::kNetworking);
 
 dword_result_t NtWaitForMultipleObjectsEx(
     dword_t count, pointer_t<xe::be<uint32_t>> handles, dword_t wait_type,
@@ -423,6 +839,7 @@ SHIM_CALL NetDll_closesocket_shim(PPCContext* ppc_context,
   uint32_t socket_handle = SHIM_GET_ARG_32(1);
 
   XELOGD("NetDll_closesocket(%d, %.8X)", caller, socket_handle);
+  SocketReactor::Get()->Cancel(socket_handle);
   int ret = closesocket(socket_handle);
 
   SHIM_SET_RETURN_32(ret);
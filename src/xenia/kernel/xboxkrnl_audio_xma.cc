@@ -346,7 +346,7 @@ SHIM_CALL XMABlockWhileInUse_shim(PPCContext* ppc_context,
     if (!context.input_buffer_0_valid && !context.input_buffer_1_valid) {
       break;
     }
-    xe::threading::Sleep(std::chrono::milliseconds(1));
+    xe::threading::PreciseSleep(std::chrono::microseconds(500));
   } while (true);
 
   SHIM_SET_RETURN_32(0);
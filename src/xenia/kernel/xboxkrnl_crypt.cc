@@ -8,13 +8,12 @@
 */
 
 #include "xenia/base/logging.h"
+#include "xenia/base/sha1.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl_private.h"
 #include "xenia/xbox.h"
 
-#include "third_party/crypto/TinySHA1.hpp"
-
 namespace xe {
 namespace kernel {
 
@@ -24,22 +23,22 @@ typedef struct {
   uint8_t buffer[64];         // 0x18
 } XECRYPT_SHA_STATE;
 
-void InitSha1(sha1::SHA1* sha, const XECRYPT_SHA_STATE* state) {
+xe::Sha1 InitSha1(const XECRYPT_SHA_STATE* state) {
   uint32_t digest[5];
   for (int i = 0; i < 5; i++) {
     digest[i] = state->state[i];
   }
-
-  sha->init(digest, state->buffer, state->count);
+  return xe::Sha1(digest, state->count, state->buffer);
 }
 
-void StoreSha1(sha1::SHA1* sha, XECRYPT_SHA_STATE* state) {
+void StoreSha1(const xe::Sha1& sha, XECRYPT_SHA_STATE* state) {
   for (int i = 0; i < 5; i++) {
-    state->state[i] = sha->getDigest()[i];
+    state->state[i] = sha.digest()[i];
   }
 
-  state->count = static_cast<uint32_t>(sha->getByteCount());
-  std::memcpy(state->buffer, sha->getBlock(), sha->getBlockByteIndex());
+  // The guest only keeps a 32-bit count.
+  state->count = static_cast<uint32_t>(sha.byte_count());
+  std::memcpy(state->buffer, sha.partial_block(), sha.partial_block_length());
 }
 
 void XeCryptShaInit(pointer_t<XECRYPT_SHA_STATE> sha_state) {
@@ -55,22 +54,20 @@ DECLARE_XBOXKRNL_EXPORT(XeCryptShaInit, ExportTag::kImplemented);
 
 void XeCryptShaUpdate(pointer_t<XECRYPT_SHA_STATE> sha_state, lpvoid_t input,
                       dword_t input_size) {
-  sha1::SHA1 sha;
-  InitSha1(&sha, sha_state);
+  auto sha = InitSha1(sha_state);
 
-  sha.processBytes(input, input_size);
+  sha.Update(input.as<const uint8_t*>(), input_size);
 
-  StoreSha1(&sha, sha_state);
+  StoreSha1(sha, sha_state);
 }
 DECLARE_XBOXKRNL_EXPORT(XeCryptShaUpdate, ExportTag::kImplemented);
 
 void XeCryptShaFinal(pointer_t<XECRYPT_SHA_STATE> sha_state,
                      pointer_t<xe::be<uint32_t>> out, dword_t out_size) {
-  sha1::SHA1 sha;
-  InitSha1(&sha, sha_state);
+  auto sha = InitSha1(sha_state);
 
   uint32_t digest[5];
-  sha.finalize(digest);
+  sha.Finalize(digest);
 
   for (int i = 0; i < 5; i++) {
     sha_state->state[i] = digest[i];
@@ -85,20 +82,20 @@ DECLARE_XBOXKRNL_EXPORT(XeCryptShaFinal, ExportTag::kImplemented);
 void XeCryptSha(lpvoid_t input_1, dword_t input_1_size, lpvoid_t input_2,
                 dword_t input_2_size, lpvoid_t input_3, dword_t input_3_size,
                 pointer_t<xe::be<uint32_t>> output, dword_t output_size) {
-  sha1::SHA1 sha;
+  xe::Sha1 sha;
 
   if (input_1 && input_1_size) {
-    sha.processBytes(input_1, input_1_size);
+    sha.Update(input_1.as<const uint8_t*>(), input_1_size);
   }
   if (input_2 && input_2_size) {
-    sha.processBytes(input_2, input_2_size);
+    sha.Update(input_2.as<const uint8_t*>(), input_2_size);
   }
   if (input_3 && input_3_size) {
-    sha.processBytes(input_3, input_3_size);
+    sha.Update(input_3.as<const uint8_t*>(), input_3_size);
   }
 
   uint32_t digest[5];
-  sha.finalize(digest);
+  sha.Finalize(digest);
 
   for (uint32_t i = 0; i < output_size / 4; i++) {
     output[i] = digest[i];
@@ -40,10 +40,13 @@ typedef struct {
   xe::be<uint32_t> exception_information[15];
 } X_EXCEPTION_RECORD;
 static_assert_size(X_EXCEPTION_RECORD, 0x50);
-void AppendParam(StringBuffer* string_buffer,
-                 pointer_t<X_EXCEPTION_RECORD> record) {
-  string_buffer->AppendFormat("%.8X(%.8X)", record.guest_address(),
-                              uint32_t(record->exception_code));
+void CaptureParam(shim::KernelCallRecord* call_record,
+                  pointer_t<X_EXCEPTION_RECORD> record) {
+  using Slot = shim::KernelCallRecord::Slot;
+  call_record->Add(Slot::kPointer, record.guest_address());
+  if (record) {
+    call_record->Add(Slot::kDerefDword, uint32_t(record->exception_code));
+  }
 }
 
 void RtlRaiseException(pointer_t<X_EXCEPTION_RECORD> record) {
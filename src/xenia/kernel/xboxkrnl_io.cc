@@ -7,9 +7,12 @@
  ******************************************************************************
  */
 
+#include <gflags/gflags.h>
+
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/hid/hid_flags.h"
 #include "xenia/kernel/async_request.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/objects/xevent.h"
@@ -20,6 +23,10 @@
 #include "xenia/vfs/device.h"
 #include "xenia/xbox.h"
 
+DEFINE_bool(async_file_io, true,
+            "Complete file reads/writes that have an event or APC on host I/O "
+            "worker threads instead of blocking the calling guest thread.");
+
 namespace xe {
 namespace kernel {
 
@@ -155,14 +162,32 @@ dword_result_t NtOpenFile(lpdword_t handle_out, dword_t desired_access,
 }
 DECLARE_XBOXKRNL_EXPORT(NtOpenFile, ExportTag::kImplemented);
 
-class xeNtReadFileState {
- public:
-  uint32_t x;
-};
-void xeNtReadFileCompleted(XAsyncRequest* request, xeNtReadFileState* state) {
-  // TODO(benvanik): set io_status_block_ptr
-  delete request;
-  delete state;
+// Returns true if the request should be queued to the I/O workers rather
+// than completed on the calling thread. Only requests with a completion
+// target (an event or APC) can be observed finishing later. Input recordings
+// need completions in issue order, so those runs stay synchronous.
+bool ShouldCompleteAsync(XEvent* ev, uint32_t apc_routine) {
+  if (!FLAGS_hid_record.empty() || !FLAGS_hid_replay.empty()) {
+    return false;
+  }
+  return FLAGS_async_file_io && (ev || (apc_routine & ~1));
+}
+
+XAsyncRequest* CreateFileRequest(XFile* file, XEvent* ev,
+                                 uint32_t apc_routine, uint32_t apc_context,
+                                 uint32_t io_status_block_ptr) {
+  auto request = new XAsyncRequest(kernel_state(), file, nullptr, nullptr);
+  request->set_io_status_block(io_status_block_ptr);
+  if (ev) {
+    // The event is signaled again when the request completes.
+    ev->Reset();
+    request->AddWaitEvent(ev);
+  }
+  if ((apc_routine & ~1) && apc_context) {
+    request->SetApc(XThread::GetCurrentThread(), apc_routine & ~1,
+                    apc_context);
+  }
+  return request;
 }
 
 dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
@@ -184,7 +209,7 @@ dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
   }
 
   if (XSUCCEEDED(result)) {
-    if (true) {
+    if (!ShouldCompleteAsync(ev.get(), apc_routine_ptr)) {
       // Synchronous.
       size_t bytes_read = 0;
       result = file->Read(buffer, buffer_length,
@@ -208,23 +233,17 @@ dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
       // we have written the info out.
       signal_event = true;
     } else {
-      // TODO(benvanik): async.
-
-      // X_STATUS_PENDING if not returning immediately.
-      // XFile is waitable and signalled after each async req completes.
-      // reset the input event (->Reset())
-      /*xeNtReadFileState* call_state = new xeNtReadFileState();
-      XAsyncRequest* request = new XAsyncRequest(
-      state, file,
-      (XAsyncRequest::CompletionCallback)xeNtReadFileCompleted,
-      call_state);*/
-      // result = file->Read(buffer, buffer_length, byte_offset, request);
+      // Asynchronous. The I/O worker writes the io status block, signals the
+      // event and the file, and queues the APC once the read is done.
       if (io_status_block) {
         io_status_block->status = X_STATUS_PENDING;
         io_status_block->information = 0;
       }
-
-      result = X_STATUS_PENDING;
+      auto request =
+          CreateFileRequest(file.get(), ev.get(), apc_routine_ptr,
+                            apc_context, io_status_block.guest_address());
+      result = file->Read(buffer, buffer_length,
+                          byte_offset_ptr ? *byte_offset_ptr : -1, request);
     }
   }
 
@@ -246,9 +265,6 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
                            pointer_t<X_IO_STATUS_BLOCK> io_status_block,
                            lpvoid_t buffer, dword_t buffer_length,
                            lpqword_t byte_offset_ptr) {
-  // Async not supported yet.
-  assert_zero(apc_routine);
-
   X_STATUS result = X_STATUS_SUCCESS;
   uint32_t info = 0;
 
@@ -267,8 +283,7 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
 
   // Execute write.
   if (XSUCCEEDED(result)) {
-    // TODO(benvanik): async path.
-    if (true) {
+    if (!ShouldCompleteAsync(ev.get(), apc_routine)) {
       // Synchronous request.
       size_t bytes_written = 0;
       result =
@@ -282,9 +297,17 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
       // we have written the info out.
       signal_event = true;
     } else {
-      // X_STATUS_PENDING if not returning immediately.
-      result = X_STATUS_PENDING;
-      info = 0;
+      // X_STATUS_PENDING until the I/O worker completes the request.
+      auto request =
+          CreateFileRequest(file.get(), ev.get(), apc_routine, apc_context,
+                            io_status_block.guest_address());
+      if (io_status_block) {
+        io_status_block->status = X_STATUS_PENDING;
+        io_status_block->information = 0;
+      }
+      result = file->Write(buffer, buffer_length,
+                           byte_offset_ptr ? *byte_offset_ptr : -1, request);
+      return result;
     }
   }
 
@@ -645,7 +668,13 @@ SHIM_CALL NtFlushBuffersFile_shim(PPCContext* ppc_context,
 
   XELOGD("NtFlushBuffersFile(%.8X, %.8X)", file_handle, io_status_block_ptr);
 
-  auto result = X_STATUS_SUCCESS;
+  X_STATUS result = X_STATUS_SUCCESS;
+  auto file = kernel_state->object_table()->LookupObject<XFile>(file_handle);
+  if (file) {
+    result = file->Flush();
+  } else {
+    result = X_STATUS_INVALID_HANDLE;
+  }
 
   if (io_status_block_ptr) {
     SHIM_SET_MEM_32(io_status_block_ptr, result);  // Status
@@ -130,6 +130,7 @@ SHIM_CALL NtAllocateVirtualMemory_shim(PPCContext* ppc_context,
   }
   uint32_t protect = FromXdkProtectFlags(protect_bits);
   uint32_t address = 0;
+  MemoryTagScope tag_scope(MemoryTag::kNtAllocateVirtualMemory);
   if (base_addr_value) {
     auto heap = kernel_state->memory()->LookupHeap(base_addr_value);
     if (heap->AllocFixed(base_addr_value, adjusted_size, page_size,
@@ -316,6 +317,7 @@ SHIM_CALL MmAllocatePhysicalMemoryEx_shim(PPCContext* ppc_context,
   bool top_down = true;
   auto heap = kernel_state->memory()->LookupHeapByType(true, page_size);
   uint32_t base_address;
+  MemoryTagScope tag_scope(MemoryTag::kMmAllocatePhysicalMemory);
   if (!heap->AllocRange(min_addr_range, max_addr_range, adjusted_size,
                         adjusted_alignment, allocation_type, protect, top_down,
                         &base_address)) {
@@ -319,10 +319,14 @@ SHIM_CALL XexGetProcedureAddress_shim(PPCContext* ppc_context,
   SHIM_SET_RETURN_32(result);
 }
 
-void AppendParam(StringBuffer* string_buffer,
-                 pointer_t<X_EX_TITLE_TERMINATE_REGISTRATION> reg) {
-  string_buffer->AppendFormat("%.8X(%.8X, %.8X)", reg.guest_address(),
-                              reg->notification_routine, reg->priority);
+void CaptureParam(shim::KernelCallRecord* record,
+                  pointer_t<X_EX_TITLE_TERMINATE_REGISTRATION> reg) {
+  using Slot = shim::KernelCallRecord::Slot;
+  record->Add(Slot::kPointer, reg.guest_address());
+  if (reg) {
+    record->Add(Slot::kDerefDword, uint32_t(reg->notification_routine));
+    record->Add(Slot::kDerefDword, uint32_t(reg->priority));
+  }
 }
 
 void ExRegisterTitleTerminateNotification(
@@ -14,6 +14,7 @@
 
 #include "xenia/base/atomic.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/string.h"
 #include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
@@ -76,10 +77,8 @@ void RtlFillMemoryUlong(lpvoid_t destination, dword_t length, dword_t pattern) {
   // NOTE: length must be % 4, so we can work on uint32s.
   uint32_t count = length >> 2;
 
-  uint32_t* p = destination.as<uint32_t*>();
-  for (uint32_t n = 0; n < count; n++, p++) {
-    *p = xe::byte_swap((uint32_t)pattern);
-  }
+  xe::fill_bulk_32(destination.as<uint32_t*>(),
+                   xe::byte_swap((uint32_t)pattern), count);
 }
 DECLARE_XBOXKRNL_EXPORT(RtlFillMemoryUlong, ExportTag::kImplemented);
 
@@ -126,7 +125,8 @@ void RtlInitAnsiString(pointer_t<X_ANSI_STRING> destination,
 
   destination->pointer = source.guest_address();
 }
-DECLARE_XBOXKRNL_EXPORT(RtlInitAnsiString, ExportTag::kImplemented);
+DECLARE_XBOXKRNL_EXPORT(RtlInitAnsiString,
+                        ExportTag::kImplemented | ExportTag::kFastCall);
 
 // http://msdn.microsoft.com/en-us/library/ff561899
 void RtlFreeAnsiString(pointer_t<X_ANSI_STRING> string) {
@@ -149,7 +149,8 @@ void RtlInitUnicodeString(pointer_t<X_UNICODE_STRING> destination,
     destination->reset();
   }
 }
-DECLARE_XBOXKRNL_EXPORT(RtlInitUnicodeString, ExportTag::kImplemented);
+DECLARE_XBOXKRNL_EXPORT(RtlInitUnicodeString,
+                        ExportTag::kImplemented | ExportTag::kFastCall);
 
 // http://msdn.microsoft.com/en-us/library/ff561903
 void RtlFreeUnicodeString(pointer_t<X_UNICODE_STRING> string) {
@@ -352,6 +353,9 @@ dword_result_t RtlInitializeCriticalSectionAndSpinCount(
 DECLARE_XBOXKRNL_EXPORT(RtlInitializeCriticalSectionAndSpinCount,
                         ExportTag::kImplemented);
 
+// Times a contended RtlEnterCriticalSection yields before it sleeps.
+const uint32_t kCriticalSectionYieldCount = 4;
+
 SHIM_CALL RtlEnterCriticalSection_shim(PPCContext* ppc_context,
                                        KernelState* kernel_state) {
   // VOID
@@ -363,29 +367,39 @@ SHIM_CALL RtlEnterCriticalSection_shim(PPCContext* ppc_context,
   uint32_t thread_id = XThread::GetCurrentThreadId();
 
   auto cs = reinterpret_cast<X_RTL_CRITICAL_SECTION*>(SHIM_MEM_ADDR(cs_ptr));
-  uint32_t spin_wait_remaining = cs->spin_count_div_256 * 256;
 
-spin:
-  if (xe::atomic_inc(&cs->lock_count) != 0) {
-    // If this thread already owns the CS increment the recursion count.
-    if (cs->owning_thread_id == thread_id) {
-      cs->recursion_count++;
+  // Only this thread can have set the owner to itself.
+  if (cs->owning_thread_id == thread_id) {
+    xe::atomic_inc(&cs->lock_count);
+    cs->recursion_count++;
+    return;
+  }
+
+  // Locks are usually held briefly, so try to grab it for a while before
+  // going to sleep: the spin count the title asked for, then a few yields.
+  uint32_t spin_wait_remaining = cs->spin_count_div_256 * 256;
+  uint32_t yield_wait_remaining = kCriticalSectionYieldCount;
+  while (true) {
+    if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
+      // Now own the lock.
+      cs->owning_thread_id = thread_id;
+      cs->recursion_count = 1;
       return;
     }
-    xe::atomic_dec(&cs->lock_count);
-
-    // Thread was locked - spin wait.
     if (spin_wait_remaining) {
-      spin_wait_remaining--;
-      goto spin;
+      --spin_wait_remaining;
+    } else if (yield_wait_remaining) {
+      --yield_wait_remaining;
+      xe::threading::MaybeYield();
+    } else {
+      break;
     }
+  }
 
-    // All out of spin waits, create a full waiter.
-    // TODO(benvanik): contention - do a real wait!
-    // XELOGE("RtlEnterCriticalSection tried to really lock!");
-    spin_wait_remaining = 0;  // HACK: spin forever
-    xe::threading::MaybeYield();
-    goto spin;
+  // Register as a waiter. Unless the lock was released in the meantime the
+  // owner sees the count and hands the lock over to one waiter on leave.
+  if (xe::atomic_inc(&cs->lock_count) != 0) {
+    kernel_state->WaitCriticalSection(cs_ptr);
   }
 
   // Now own the lock.
@@ -445,14 +459,20 @@ SHIM_CALL RtlLeaveCriticalSection_shim(PPCContext* ppc_context,
   // Not owned - unlock!
   cs->owning_thread_id = 0;
   if (xe::atomic_dec(&cs->lock_count) != -1) {
-    // There were waiters - wake one of them.
-    // TODO(benvanik): wake a waiter.
-    XELOGE("RtlLeaveCriticalSection would have woken a waiter");
+    // There were waiters - hand the lock to one of them. The count they
+    // added keeps anybody else from taking it in between.
+    kernel_state->ReleaseCriticalSection(cs_ptr);
   }
 
   XThread::GetCurrentThread()->CheckApcs();
 }
 
+// Tail of RtlLeaveCriticalSection for the backend's inlined release.
+void RtlLeaveCriticalSectionCheckApcs(PPCContext* ppc_context,
+                                      KernelState* kernel_state) {
+  XThread::GetCurrentThread()->CheckApcs();
+}
+
 struct X_TIME_FIELDS {
   xe::be<uint16_t> year;
   xe::be<uint16_t> month;
@@ -520,4 +540,6 @@ void xe::kernel::xboxkrnl::RegisterRtlExports(
   SHIM_SET_MAPPING("xboxkrnl.exe", RtlEnterCriticalSection, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", RtlTryEnterCriticalSection, state);
   SHIM_SET_MAPPING("xboxkrnl.exe", RtlLeaveCriticalSection, state);
+  kernel_state->processor()->set_check_apcs_handler(
+      RtlLeaveCriticalSectionCheckApcs);
 }
@@ -9,9 +9,13 @@
 
 #include <cstring>
 #include <iomanip>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
+#include <vector>
 
 #include "xenia/base/logging.h"
+#include "xenia/base/mutex.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/objects/xthread.h"
 #include "xenia/kernel/objects/xuser_module.h"
@@ -23,19 +27,6 @@
 namespace xe {
 namespace kernel {
 
-enum FormatState {
-  FS_Invalid = 0,
-  FS_Unknown,
-  FS_Start,
-  FS_Flags,
-  FS_Width,
-  FS_PrecisionStart,
-  FS_Precision,
-  FS_Size,
-  FS_Type,
-  FS_End,
-};
-
 enum FormatFlags {
   FF_LeftJustify = 1 << 0,
   FF_AddLeadingZeros = 1 << 1,
@@ -51,19 +42,28 @@ enum FormatFlags {
   FF_ForceLeadingZero = 1 << 11,
 };
 
-enum ArgumentSize {
-  AS_Default = 0,
-  AS_Short,
-  AS_Long,
-  AS_LongLong,
+// Width or precision given as '*', taken from the argument list.
+const int32_t kFormatFromArg = INT32_MIN;
+
+// One conversion, or a run of literal text when type is 0. Offsets and
+// lengths are in characters of the format string.
+struct FormatSpec {
+  uint16_t type;
+  uint32_t flags;
+  int32_t width;
+  int32_t precision;  // -1 if unspecified.
+  uint32_t literal_offset;
+  uint32_t literal_length;
 };
 
-class FormatData {
- public:
-  virtual uint16_t get() = 0;
-  virtual uint16_t peek(int32_t offset) = 0;
-  virtual void skip(int32_t count) = 0;
-  virtual bool put(uint16_t c) = 0;
+// A format string parsed into specs. The raw guest text is kept so that a
+// cached parse can be checked against the string at the same address.
+struct ParsedFormat {
+  std::string source;
+  bool wide;
+  // False if the string ends inside a conversion.
+  bool valid;
+  std::vector<FormatSpec> specs;
 };
 
 class ArgList {
@@ -72,6 +72,80 @@ class ArgList {
   virtual uint64_t get64() = 0;
 };
 
+// Writes formatted text straight into a buffer (usually guest memory). Wide
+// buffers are big endian. Text past the capacity is dropped but still
+// counted, as _snprintf and _vscwprintf need.
+class FormatOutput {
+ public:
+  FormatOutput(uint8_t* buffer, size_t capacity)
+      : narrow_(buffer), capacity_(capacity) {}
+  FormatOutput(uint16_t* buffer, size_t capacity)
+      : wide_(buffer), capacity_(capacity) {}
+
+  int32_t count() const { return int32_t(count_); }
+
+  void PutNarrow(const uint8_t* text, int32_t length) {
+    size_t fit = std::min(size_t(length), room());
+    if (narrow_) {
+      std::memcpy(narrow_ + count_, text, fit);
+    } else if (wide_) {
+      for (size_t i = 0; i < fit; ++i) {
+        xe::store_and_swap<uint16_t>(wide_ + count_ + i, text[i]);
+      }
+    }
+    count_ += length;
+  }
+
+  // Returns false if a character doesn't fit a narrow buffer.
+  bool PutWide(const uint16_t* text, int32_t length, bool swap) {
+    size_t fit = std::min(size_t(length), room());
+    if (wide_) {
+      if (swap) {
+        std::memcpy(wide_ + count_, text, fit * 2);
+      } else {
+        xe::copy_and_swap(wide_ + count_, text, fit);
+      }
+    } else {
+      for (int32_t i = 0; i < length; ++i) {
+        uint16_t c = swap ? xe::byte_swap(text[i]) : text[i];
+        if (c >= 0x100) {
+          return false;
+        }
+        if (narrow_ && size_t(i) < fit) {
+          narrow_[count_ + i] = uint8_t(c);
+        }
+      }
+    }
+    count_ += length;
+    return true;
+  }
+
+  void Fill(uint8_t c, int32_t length) {
+    if (length <= 0) {
+      return;
+    }
+    size_t fit = std::min(size_t(length), room());
+    if (narrow_) {
+      std::memset(narrow_ + count_, c, fit);
+    } else if (wide_) {
+      for (size_t i = 0; i < fit; ++i) {
+        xe::store_and_swap<uint16_t>(wide_ + count_ + i, c);
+      }
+    }
+    count_ += length;
+  }
+
+ private:
+  size_t room() const {
+    return count_ < capacity_ ? capacity_ - count_ : 0;
+  }
+
+  uint8_t* narrow_ = nullptr;
+  uint16_t* wide_ = nullptr;
+  size_t capacity_;
+  size_t count_ = 0;
+};
+
 // Making the assumption that the Xbox 360's implementation of the
 // printf-functions matches what is described on MSDN's documentation for the
 // Windows CRT:
@@ -112,12 +186,190 @@ std::string format_double(double value, int32_t precision, uint16_t c,
   return temp.str();
 }
 
-int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
-                    const bool wide) {
-  int32_t count = 0;
+static void ParseFormat(ParsedFormat* format) {
+  auto& source = format->source;
+  size_t length = format->wide ? source.size() / 2 : source.size();
+  auto at = [&](size_t i) -> uint16_t {
+    if (i >= length) {
+      return 0;
+    }
+    if (format->wide) {
+      return xe::load_and_swap<uint16_t>(source.data() + i * 2);
+    }
+    return uint8_t(source[i]);
+  };
+  auto add_literal = [&](size_t start, size_t end) {
+    if (end > start) {
+      FormatSpec spec = {0};
+      spec.literal_offset = uint32_t(start);
+      spec.literal_length = uint32_t(end - start);
+      format->specs.push_back(spec);
+    }
+  };
+
+  format->specs.clear();
+  format->valid = false;
+  size_t literal_start = 0;
+  size_t i = 0;
+  while (i < length) {
+    if (at(i) != '%') {
+      ++i;
+      continue;
+    }
+    add_literal(literal_start, i);
+    if (++i == length) {
+      return;
+    }
+    if (at(i) == '%') {
+      // Output with the literal text that follows.
+      literal_start = i++;
+      continue;
+    }
+
+    FormatSpec spec = {0};
+    spec.precision = -1;
+
+    // https://msdn.microsoft.com/en-us/library/8aky45ct.aspx
+    for (;; ++i) {
+      uint16_t c = at(i);
+      if (c == '-') {
+        spec.flags |= FF_LeftJustify;
+      } else if (c == '+') {
+        spec.flags |= FF_AddPositive;
+      } else if (c == '0') {
+        spec.flags |= FF_AddLeadingZeros;
+      } else if (c == ' ') {
+        spec.flags |= FF_AddPositiveAsSpace;
+      } else if (c == '#') {
+        spec.flags |= FF_AddPrefix;
+      } else {
+        break;
+      }
+    }
+
+    // https://msdn.microsoft.com/en-us/library/25366k66.aspx
+    if (at(i) == '*') {
+      spec.width = kFormatFromArg;
+      ++i;
+    } else {
+      for (; at(i) >= '0' && at(i) <= '9'; ++i) {
+        spec.width = spec.width * 10 + (at(i) - '0');
+      }
+    }
+
+    // https://msdn.microsoft.com/en-us/library/0ecbz014.aspx
+    if (at(i) == '.') {
+      spec.precision = 0;
+      if (at(++i) == '*') {
+        spec.precision = kFormatFromArg;
+        ++i;
+      } else {
+        for (; at(i) >= '0' && at(i) <= '9'; ++i) {
+          spec.precision = spec.precision * 10 + (at(i) - '0');
+        }
+      }
+    }
+
+    // https://msdn.microsoft.com/en-us/library/tcxf1dw6.aspx
+    switch (at(i)) {
+      case 'l':
+        if (at(i + 1) == 'l') {
+          spec.flags |= FF_IsLongLong;
+          ++i;
+        } else {
+          spec.flags |= FF_IsLong;
+        }
+        ++i;
+        break;
+      case 'h':
+        spec.flags |= FF_IsShort;
+        ++i;
+        break;
+      case 'w':
+        spec.flags |= FF_IsWide;
+        ++i;
+        break;
+      case 'I':
+        if (at(i + 1) == '6' && at(i + 2) == '4') {
+          spec.flags |= FF_IsLongLong;
+          i += 2;
+        } else if (at(i + 1) == '3' && at(i + 2) == '2') {
+          i += 2;
+        }
+        ++i;
+        break;
+    }
+
+    if (i >= length) {
+      return;
+    }
+    spec.type = at(i++);
+    format->specs.push_back(spec);
+    literal_start = i;
+  }
+  add_literal(literal_start, length);
+  format->valid = true;
+}
+
+// Parsed formats by guest address. Titles format the same few strings over
+// and over, and checking that the text is unchanged is much cheaper than
+// parsing it again.
+class FormatCache {
+ public:
+  std::shared_ptr<const ParsedFormat> Lookup(PPCContext* ppc_context,
+                                             uint32_t format_ptr,
+                                             bool wide) {
+    auto host_ptr = SHIM_MEM_ADDR(format_ptr);
+    size_t byte_length = 0;
+    if (wide) {
+      auto s = reinterpret_cast<const uint16_t*>(host_ptr);
+      while (s[byte_length / 2]) {
+        byte_length += 2;
+      }
+    } else {
+      byte_length = std::strlen(reinterpret_cast<const char*>(host_ptr));
+    }
+
+    std::lock_guard<xe::mutex> lock(mutex_);
+    auto it = formats_.find(format_ptr);
+    if (it != formats_.end()) {
+      auto& format = it->second;
+      if (format->wide == wide && format->source.size() == byte_length &&
+          !std::memcmp(format->source.data(), host_ptr, byte_length)) {
+        return format;
+      }
+    }
+
+    auto format = std::make_shared<ParsedFormat>();
+    format->source.assign(reinterpret_cast<const char*>(host_ptr),
+                          byte_length);
+    format->wide = wide;
+    ParseFormat(format.get());
+    if (formats_.size() >= kMaxFormats) {
+      formats_.clear();
+    }
+    formats_[format_ptr] = format;
+    return format;
+  }
+
+ private:
+  // Formats built at runtime (on the stack, say) would otherwise pile up.
+  static const size_t kMaxFormats = 4096;
+
+  xe::mutex mutex_;
+  std::unordered_map<uint32_t, std::shared_ptr<const ParsedFormat>> formats_;
+};
+
+static FormatCache format_cache;
+
+int32_t format_core(PPCContext* ppc_context, const ParsedFormat& format,
+                    ArgList& args, const bool wide, FormatOutput& output) {
+  if (!format.valid) {
+    return -1;
+  }
 
   char work[512];
-  wchar_t wwork[4];
+  uint16_t wwork[1];
 
   struct {
     const void* buffer;
@@ -131,434 +383,284 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
     int32_t length;
   } prefix;
 
-  auto state = FS_Unknown;
-  uint32_t flags = 0;
-  int32_t width = 0;
-  int32_t precision = -1;
-  ArgumentSize size = AS_Default;
-  int32_t radix = 0;
-  const char* digits = nullptr;
-
-  text.buffer = nullptr;
-  text.is_wide = false;
-  text.swap_wide = true;
-  text.length = 0;
-  prefix.buffer[0] = '\0';
-  prefix.length = 0;
-
-  for (uint16_t c = data.get();; c = data.get()) {
-    if (state == FS_Unknown) {
-      if (!c) {  // the end
-        return count;
-      } else if (c != '%') {
-      output:
-        if (!data.put(c)) {
-          return -1;
-        }
-        ++count;
-        continue;
+  for (auto& spec : format.specs) {
+    if (!spec.type) {
+      if (!format.wide) {
+        output.PutNarrow(reinterpret_cast<const uint8_t*>(
+                             format.source.data() + spec.literal_offset),
+                         spec.literal_length);
+      } else if (!output.PutWide(reinterpret_cast<const uint16_t*>(
+                                     format.source.data()) +
+                                     spec.literal_offset,
+                                 spec.literal_length, true)) {
+        return -1;
       }
-
-      state = FS_Start;
-      c = data.get();
-      // fall through
+      continue;
     }
 
-    // in any state, if c is \0, it's bad
-    if (!c) {
-      return -1;
+    uint16_t c = spec.type;
+    uint32_t flags = spec.flags;
+    int32_t width = spec.width;
+    int32_t precision = spec.precision;
+    int32_t radix = 0;
+    const char* digits = nullptr;
+
+    if (width == kFormatFromArg) {
+      width = (int32_t)args.get32();
+      if (width < 0) {
+        flags |= FF_LeftJustify;
+        width = -width;
+      }
     }
-
-  restart:
-    switch (state) {
-      case FS_Invalid:
-      case FS_Unknown:
-      case FS_End:
-      default: { assert_always(); }
-
-      case FS_Start: {
-        if (c == '%') {
-          state = FS_Unknown;
-          goto output;
-        }
-
-        state = FS_Flags;
-
-        // reset to defaults
-        flags = 0;
-        width = 0;
+    if (precision == kFormatFromArg) {
+      precision = (int32_t)args.get32();
+      if (precision < 0) {
         precision = -1;
-        size = AS_Default;
-        radix = 0;
-        digits = nullptr;
-
-        text.buffer = nullptr;
-        text.is_wide = false;
-        text.swap_wide = true;
-        text.length = 0;
-        prefix.buffer[0] = '\0';
-        prefix.length = 0;
-
-        // fall through, don't need to goto restart
       }
+    }
 
-      // https://msdn.microsoft.com/en-us/library/8aky45ct.aspx
-      case FS_Flags: {
-        if (c == '-') {
-          flags |= FF_LeftJustify;
-          continue;
-        } else if (c == '+') {
-          flags |= FF_AddPositive;
-          continue;
-        } else if (c == '0') {
-          flags |= FF_AddLeadingZeros;
-          continue;
-        } else if (c == ' ') {
-          flags |= FF_AddPositiveAsSpace;
-          continue;
-        } else if (c == '#') {
-          flags |= FF_AddPrefix;
-          continue;
+    text.buffer = nullptr;
+    text.is_wide = false;
+    text.swap_wide = true;
+    text.length = 0;
+    prefix.buffer[0] = '\0';
+    prefix.length = 0;
+
+    // https://msdn.microsoft.com/en-us/library/hf4y5e3w.aspx
+    switch (c) {
+      // wide character
+      case 'C': {
+        if (!(flags & (FF_IsShort | FF_IsLong | FF_IsWide))) {
+          flags |= FF_IsWide;
         }
-
-        state = FS_Width;
-        // fall through, don't need to goto restart
+        // fall through
       }
 
-      // https://msdn.microsoft.com/en-us/library/25366k66.aspx
-      case FS_Width: {
-        if (c == '*') {
-          width = (int32_t)args.get32();
-          if (width < 0) {
-            flags |= FF_LeftJustify;
-            width = -width;
-          }
-          state = FS_PrecisionStart;
-          continue;
-        } else if (c >= '0' && c <= '9') {
-          width *= 10;
-          width += c - '0';
-          continue;
+      // character
+      case 'c': {
+        bool is_wide = ((flags & (FF_IsLong | FF_IsWide)) != 0) ^ wide;
+        auto value = args.get32();
+
+        if (!is_wide) {
+          work[0] = (uint8_t)value;
+          text.buffer = &work[0];
+          text.length = 1;
+          text.is_wide = false;
+        } else {
+          wwork[0] = (uint16_t)value;
+          text.buffer = &wwork[0];
+          text.length = 1;
+          text.is_wide = true;
+          text.swap_wide = false;
         }
 
-        state = FS_PrecisionStart;
-        // fall through, don't need to goto restart
+        break;
       }
 
-      // https://msdn.microsoft.com/en-us/library/0ecbz014.aspx
-      case FS_PrecisionStart: {
-        if (c == '.') {
-          state = FS_Precision;
-          precision = 0;
-          continue;
+      // signed decimal integer
+      case 'd':
+      case 'i': {
+        flags |= FF_IsSigned;
+        digits = "0123456789";
+        radix = 10;
+
+      integer:
+        assert_not_null(digits);
+        assert_not_zero(radix);
+
+        int64_t value;
+
+        if (flags & FF_IsLongLong) {
+          value = (int64_t)args.get64();
+        } else if (flags & FF_IsLong) {
+          value = (int32_t)args.get32();
+        } else if (flags & FF_IsShort) {
+          value = (int16_t)args.get32();
+        } else {
+          value = (int32_t)args.get32();
         }
 
-        state = FS_Size;
-        goto restart;
-      }
-
-      // https://msdn.microsoft.com/en-us/library/0ecbz014.aspx
-      case FS_Precision: {
-        if (c == '*') {
-          precision = (int32_t)args.get32();
-          if (precision < 0) {
-            precision = -1;
-          }
-          state = FS_Size;
-          continue;
-        } else if (c >= '0' && c <= '9') {
-          precision *= 10;
-          precision += c - '0';
-          continue;
+        if (precision >= 0) {
+          precision = std::min(precision, (int32_t)xe::countof(work) - 1);
+        } else {
+          precision = 1;
         }
 
-        state = FS_Size;
-        // fall through
-      }
-
-      // https://msdn.microsoft.com/en-us/library/tcxf1dw6.aspx
-      case FS_Size: {
-        if (c == 'l') {
-          if (data.peek(0) == 'l') {
-            data.skip(1);
-            flags |= FF_IsLongLong;
-          } else {
-            flags |= FF_IsLong;
-          }
-          state = FS_Type;
-          continue;
-        } else if (c == 'h') {
-          flags |= FF_IsShort;
-          state = FS_Type;
-          continue;
-        } else if (c == 'w') {
-          flags |= FF_IsWide;
-          state = FS_Type;
-          continue;
-        } else if (c == 'I') {
-          if (data.peek(0) == '6' && data.peek(1) == '4') {
-            data.skip(2);
-            flags |= FF_IsLongLong;
-            state = FS_Type;
-            continue;
-          } else if (data.peek(0) == '3' && data.peek(1) == '2') {
-            data.skip(2);
-            state = FS_Type;
-            continue;
-          } else {
-            state = FS_Type;
-            continue;
-          }
+        if ((flags & FF_IsSigned) && value < 0) {
+          value = -value;
+          flags |= FF_AddNegative;
         }
 
-        // fall through
-      }
-
-      // https://msdn.microsoft.com/en-us/library/hf4y5e3w.aspx
-      case FS_Type: {
-        // wide character
-        switch (c) {
-          case 'C': {
-            if (!(flags & (FF_IsShort | FF_IsLong | FF_IsWide))) {
-              flags |= FF_IsWide;
-            }
-            // fall through
-          }
-
-          // character
-          case 'c': {
-            bool is_wide = ((flags & (FF_IsLong | FF_IsWide)) != 0) ^ wide;
-            auto value = args.get32();
-
-            if (!is_wide) {
-              work[0] = (uint8_t)value;
-              text.buffer = &work[0];
-              text.length = 1;
-              text.is_wide = false;
-            } else {
-              wwork[0] = (uint16_t)value;
-              text.buffer = &wwork[0];
-              text.length = 1;
-              text.is_wide = true;
-              text.swap_wide = false;
-            }
-
-            break;
-          }
-
-          // signed decimal integer
-          case 'd':
-          case 'i': {
-            flags |= FF_IsSigned;
-            digits = "0123456789";
-            radix = 10;
-
-          integer:
-            assert_not_null(digits);
-            assert_not_zero(radix);
-
-            int64_t value;
-
-            if (flags & FF_IsLongLong) {
-              value = (int64_t)args.get64();
-            } else if (flags & FF_IsLong) {
-              value = (int32_t)args.get32();
-            } else if (flags & FF_IsShort) {
-              value = (int16_t)args.get32();
-            } else {
-              value = (int32_t)args.get32();
-            }
-
-            if (precision >= 0) {
-              precision = std::min(precision, (int32_t)xe::countof(work));
-            } else {
-              precision = 1;
-            }
-
-            if ((flags & FF_IsSigned) && value < 0) {
-              value = -value;
-              flags |= FF_AddNegative;
-            }
-
-            if (!(flags & FF_IsLongLong)) {
-              value &= UINT32_MAX;
-            }
-
-            if (value == 0) {
-              prefix.length = 0;
-            }
-
-            char* end = &work[xe::countof(work) - 1];
-            char* start = end;
-            start[0] = '\0';
+        if (!(flags & FF_IsLongLong)) {
+          value &= UINT32_MAX;
+        }
 
-            while (precision-- > 0 || value != 0) {
-              auto digit = (int32_t)(value % radix);
-              value /= radix;
-              assert_true(digit < strlen(digits));
-              *--start = digits[digit];
-            }
+        if (value == 0) {
+          prefix.length = 0;
+        }
 
-            if ((flags & FF_ForceLeadingZero) &&
-                (start == end || *start != '0')) {
-              *--start = '0';
-            }
+        char* end = &work[xe::countof(work) - 1];
+        char* start = end;
+        start[0] = '\0';
 
-            text.buffer = start;
-            text.length = (int32_t)(end - start);
-            text.is_wide = false;
-            break;
-          }
+        while (precision-- > 0 || value != 0) {
+          auto digit = (int32_t)(value % radix);
+          value /= radix;
+          assert_true(digit < strlen(digits));
+          *--start = digits[digit];
+        }
 
-          // unsigned octal integer
-          case 'o': {
-            digits = "01234567";
-            radix = 8;
-            if (flags & FF_AddPrefix) {
-              flags |= FF_ForceLeadingZero;
-            }
-            goto integer;
-          }
+        if ((flags & FF_ForceLeadingZero) && (start == end || *start != '0')) {
+          *--start = '0';
+        }
 
-          // unsigned decimal integer
-          case 'u': {
-            digits = "0123456789";
-            radix = 10;
-            goto integer;
-          }
+        text.buffer = start;
+        text.length = (int32_t)(end - start);
+        text.is_wide = false;
+        break;
+      }
 
-          // unsigned hexadecimal integer
-          case 'x':
-          case 'X': {
-            digits = c == 'x' ? "0123456789abcdef" : "0123456789ABCDEF";
-            radix = 16;
+      // unsigned octal integer
+      case 'o': {
+        digits = "01234567";
+        radix = 8;
+        if (flags & FF_AddPrefix) {
+          flags |= FF_ForceLeadingZero;
+        }
+        goto integer;
+      }
 
-            if (flags & FF_AddPrefix) {
-              prefix.buffer[0] = '0';
-              prefix.buffer[1] = c == 'x' ? 'x' : 'X';
-              prefix.length = 2;
-            }
+      // unsigned decimal integer
+      case 'u': {
+        digits = "0123456789";
+        radix = 10;
+        goto integer;
+      }
 
-            goto integer;
-          }
+      // unsigned hexadecimal integer
+      case 'x':
+      case 'X': {
+        digits = c == 'x' ? "0123456789abcdef" : "0123456789ABCDEF";
+        radix = 16;
 
-          // floating-point with exponent
-          case 'e':
-          case 'E': {
-            // fall through
-          }
+        if (flags & FF_AddPrefix) {
+          prefix.buffer[0] = '0';
+          prefix.buffer[1] = c == 'x' ? 'x' : 'X';
+          prefix.length = 2;
+        }
 
-          // floating-point without exponent
-          case 'f': {
-          floatingpoint:
-            flags |= FF_IsSigned;
+        goto integer;
+      }
 
-            int64_t dummy = args.get64();
-            double value = *(double*)&dummy;
+      // floating-point with exponent
+      case 'e':
+      case 'E':
+      // floating-point without exponent
+      case 'f':
+      // floating-point with or without exponent
+      case 'g':
+      case 'G':
+      // floating-point in hexadecimal
+      case 'a':
+      case 'A': {
+        flags |= FF_IsSigned;
+
+        int64_t dummy = args.get64();
+        double value = *(double*)&dummy;
+
+        if (value < 0) {
+          value = -value;
+          flags |= FF_AddNegative;
+        }
 
-            if (value < 0) {
-              value = -value;
-              flags |= FF_AddNegative;
-            }
+        auto s = format_double(value, precision, c, flags);
+        auto length = (int32_t)s.size();
+        assert_true(length < xe::countof(work));
 
-            auto s = format_double(value, precision, c, flags);
-            auto length = (int32_t)s.size();
-            assert_true(length < xe::countof(work));
+        auto start = &work[0];
+        auto end = &start[length];
 
-            auto start = &work[0];
-            auto end = &start[length];
+        std::memcpy(start, s.c_str(), length);
+        end[0] = '\0';
 
-            std::memcpy(start, s.c_str(), length);
-            end[0] = '\0';
+        text.buffer = start;
+        text.length = (int32_t)(end - start);
+        text.is_wide = false;
+        break;
+      }
 
-            text.buffer = start;
-            text.length = (int32_t)(end - start);
-            text.is_wide = false;
-            break;
-          }
+      // pointer to integer
+      case 'n': {
+        auto pointer = (uint32_t)args.get32();
+        if (flags & FF_IsShort) {
+          SHIM_SET_MEM_16(pointer, (uint16_t)output.count());
+        } else {
+          SHIM_SET_MEM_32(pointer, (uint32_t)output.count());
+        }
+        continue;
+      }
 
-          // floating-point with or without exponent
-          case 'g':
-          case 'G': {
-            goto floatingpoint;
-          }
+      // pointer
+      case 'p': {
+        digits = "0123456789ABCDEF";
+        radix = 16;
+        precision = 8;
+        flags &= ~(FF_IsLongLong | FF_IsShort);
+        flags |= FF_IsLong;
+        goto integer;
+      }
 
-          // floating-point in hexadecimal
-          case 'a':
-          case 'A': {
-            goto floatingpoint;
-          }
+      // wide string
+      case 'S': {
+        if (!(flags & (FF_IsShort | FF_IsLong | FF_IsWide))) {
+          flags |= FF_IsWide;
+        }
+        // fall through
+      }
 
-          // pointer to integer
-          case 'n': {
-            auto pointer = (uint32_t)args.get32();
-            if (flags & FF_IsShort) {
-              SHIM_SET_MEM_16(pointer, (uint16_t)count);
-            } else {
-              SHIM_SET_MEM_32(pointer, (uint32_t)count);
+      // string
+      case 's': {
+        uint32_t pointer = args.get32();
+        int32_t cap = precision < 0 ? INT32_MAX : precision;
+
+        if (pointer == 0) {
+          auto nullstr = "(null)";
+          text.buffer = nullstr;
+          text.length = std::min((int32_t)strlen(nullstr), cap);
+          text.is_wide = false;
+        } else {
+          void* str = SHIM_MEM_ADDR(pointer);
+          bool is_wide = ((flags & (FF_IsLong | FF_IsWide)) != 0) ^ wide;
+          int32_t length;
+
+          if (!is_wide) {
+            length = 0;
+            for (auto s = (const uint8_t*)str; cap > 0 && *s; ++s, cap--) {
+              length++;
             }
-            continue;
-          }
-
-          // pointer
-          case 'p': {
-            digits = "0123456789ABCDEF";
-            radix = 16;
-            precision = 8;
-            flags &= ~(FF_IsLongLong | FF_IsShort);
-            flags |= FF_IsLong;
-            goto integer;
-          }
-
-          // wide string
-          case 'S': {
-            if (!(flags & (FF_IsShort | FF_IsLong | FF_IsWide))) {
-              flags |= FF_IsWide;
+          } else {
+            length = 0;
+            for (auto s = (const uint16_t*)str; cap > 0 && *s; ++s, cap--) {
+              length++;
             }
-            // fall through
           }
 
-          // string
-          case 's': {
-            uint32_t pointer = args.get32();
-            int32_t cap = precision < 0 ? INT32_MAX : precision;
-
-            if (pointer == 0) {
-              auto nullstr = "(null)";
-              text.buffer = nullstr;
-              text.length = std::min((int32_t)strlen(nullstr), cap);
-              text.is_wide = false;
-            } else {
-              void* str = SHIM_MEM_ADDR(pointer);
-              bool is_wide = ((flags & (FF_IsLong | FF_IsWide)) != 0) ^ wide;
-              int32_t length;
-
-              if (!is_wide) {
-                length = 0;
-                for (auto s = (const uint8_t*)str; cap > 0 && *s; ++s, cap--) {
-                  length++;
-                }
-              } else {
-                length = 0;
-                for (auto s = (const uint16_t*)str; cap > 0 && *s; ++s, cap--) {
-                  length++;
-                }
-              }
-
-              text.buffer = str;
-              text.length = length;
-              text.is_wide = is_wide;
-            }
-            break;
-          }
+          text.buffer = str;
+          text.length = length;
+          text.is_wide = is_wide;
+        }
+        break;
+      }
 
-          // ANSI_STRING / UNICODE_STRING
-          case 'Z': {
-            assert_always();
-          }
+      // ANSI_STRING / UNICODE_STRING
+      case 'Z': {
+        assert_always();
+        break;
+      }
 
-          default: { assert_always(); }
-        }
+      default: {
+        assert_always();
+        break;
       }
     }
 
@@ -577,78 +679,33 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
 
     int32_t padding = width - text.length - prefix.length;
 
-    if (!(flags & (FF_LeftJustify | FF_AddLeadingZeros)) && padding > 0) {
-      count += padding;
-      while (padding-- > 0) {
-        if (!data.put(' ')) {
-          return -1;
-        }
-      }
+    if (!(flags & (FF_LeftJustify | FF_AddLeadingZeros))) {
+      output.Fill(' ', padding);
     }
 
-    if (prefix.length > 0) {
-      int32_t remaining = prefix.length;
-      count += prefix.length;
-      auto b = &prefix.buffer[0];
-      while (remaining-- > 0) {
-        if (!data.put(*b++)) {
-          return -1;
-        }
-      }
-    }
+    output.PutNarrow(reinterpret_cast<const uint8_t*>(prefix.buffer),
+                     prefix.length);
 
-    if ((flags & FF_AddLeadingZeros) && !(flags & (FF_LeftJustify)) &&
-        padding > 0) {
-      count += padding;
-      while (padding-- > 0) {
-        if (!data.put('0')) {
-          return -1;
-        }
-      }
+    if ((flags & FF_AddLeadingZeros) && !(flags & FF_LeftJustify)) {
+      output.Fill('0', padding);
     }
 
-    int32_t remaining = text.length;
     if (!text.is_wide) {
       // it's a const char*
-      auto b = (const uint8_t*)text.buffer;
-      while (remaining-- > 0) {
-        if (!data.put(*b++)) {
-          return -1;
-        }
-      }
-    } else {
-      // it's a const wchar_t*
-      auto b = (const uint16_t*)text.buffer;
-      if (text.swap_wide) {
-        while (remaining-- > 0) {
-          if (!data.put(xe::byte_swap(*b++))) {
-            return -1;
-          }
-        }
-      } else {
-        while (remaining-- > 0) {
-          if (!data.put(*b++)) {
-            return -1;
-          }
-        }
-      }
+      output.PutNarrow((const uint8_t*)text.buffer, text.length);
+    } else if (!output.PutWide((const uint16_t*)text.buffer, text.length,
+                               text.swap_wide)) {
+      // it's a const wchar_t*, and didn't fit a narrow buffer
+      return -1;
     }
-    count += text.length;
 
     // right padding
-    if ((flags & FF_LeftJustify) && padding > 0) {
-      count += padding;
-      while (padding-- > 0) {
-        if (!data.put(' ')) {
-          return -1;
-        }
-      }
+    if (flags & FF_LeftJustify) {
+      output.Fill(' ', padding);
     }
-
-    state = FS_Unknown;
   }
 
-  return count;
+  return output.count();
 }
 
 class StackArgList : public ArgList {
@@ -688,129 +745,33 @@ class ArrayArgList : public ArgList {
   int32_t index_;
 };
 
-class StringFormatData : public FormatData {
- public:
-  StringFormatData(const uint8_t* input) : input_(input) {}
-
-  uint16_t get() {
-    uint16_t result = *input_;
-    if (result) {
-      input_++;
-    }
-    return result;
-  }
-
-  uint16_t peek(int32_t offset) { return input_[offset]; }
-
-  void skip(int32_t count) {
-    while (count-- > 0) {
-      if (!*input_) {
-        break;
-      }
-    }
-  }
-
-  bool put(uint16_t c) {
-    if (c >= 0x100) {
-      return false;
-    }
-    output_ << (char)c;
-    return true;
-  }
-
-  std::string str() const { return output_.str(); }
-
- private:
-  const uint8_t* input_;
-  std::ostringstream output_;
-};
-
-class WideStringFormatData : public FormatData {
- public:
-  WideStringFormatData(const uint16_t* input) : input_(input) {}
-
-  uint16_t get() {
-    uint16_t result = *input_;
-    if (result) {
-      input_++;
-    }
-    return xe::byte_swap(result);
-  }
-
-  uint16_t peek(int32_t offset) { return input_[offset]; }
-
-  void skip(int32_t count) {
-    while (count-- > 0) {
-      if (!*input_) {
-        break;
-      }
-    }
-  }
-
-  bool put(uint16_t c) {
-    output_ << (wchar_t)c;
-    return true;
-  }
-
-  std::wstring wstr() const { return output_.str(); }
-
- private:
-  const uint16_t* input_;
-  std::wostringstream output_;
-};
-
-class WideCountFormatData : public FormatData {
- public:
-  WideCountFormatData(const uint16_t* input) : input_(input), count_(0) {}
-
-  uint16_t get() {
-    uint16_t result = *input_;
-    if (result) {
-      input_++;
-    }
-    return xe::byte_swap(result);
-  }
-
-  uint16_t peek(int32_t offset) { return input_[offset]; }
-
-  void skip(int32_t count) {
-    while (count-- > 0) {
-      if (!*input_) {
-        break;
-      }
-    }
-  }
-
-  bool put(uint16_t c) {
-    ++count_;
-    return true;
-  }
-
-  const int32_t count() const { return count_; }
-
- private:
-  const uint16_t* input_;
-  int32_t count_;
-};
-
 SHIM_CALL DbgPrint_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t format_ptr = SHIM_GET_ARG_32(0);
   if (!format_ptr) {
     SHIM_SET_RETURN_32(X_STATUS_INVALID_PARAMETER);
     return;
   }
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, false);
 
+  char buffer[512];
   StackArgList args(ppc_context, 1);
-  StringFormatData data(format);
-
-  int32_t count = format_core(ppc_context, data, args, false);
+  FormatOutput output(reinterpret_cast<uint8_t*>(buffer), sizeof(buffer));
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     SHIM_SET_RETURN_32(X_STATUS_SUCCESS);
     return;
   }
 
-  XELOGD("(DbgPrint) %s", data.str().c_str());
+  if (size_t(count) <= sizeof(buffer)) {
+    XELOGD("(DbgPrint) %.*s", count, buffer);
+  } else {
+    // Too long for the stack; format again now that we know the length.
+    std::vector<uint8_t> long_buffer(count);
+    StackArgList long_args(ppc_context, 1);
+    FormatOutput long_output(long_buffer.data(), long_buffer.size());
+    format_core(ppc_context, *format, long_args, false, long_output);
+    XELOGD("(DbgPrint) %.*s", count, long_buffer.data());
+  }
 
   SHIM_SET_RETURN_32(X_STATUS_SUCCESS);
 }
@@ -821,8 +782,10 @@ SHIM_CALL _snprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   int32_t buffer_count = SHIM_GET_ARG_32(1);
   uint32_t format_ptr = SHIM_GET_ARG_32(2);
 
-  XELOGD("_snprintf(%08X, %i, %08X, ...)", buffer_ptr, buffer_count,
-         format_ptr);
+  if (FLAGS_log_kernel_calls) {
+    XELOGD("_snprintf(%08X, %i, %08X, ...)", buffer_ptr, buffer_count,
+           format_ptr);
+  }
 
   if (buffer_ptr == 0 || buffer_count <= 0 || format_ptr == 0) {
     SHIM_SET_RETURN_32(-1);
@@ -830,23 +793,21 @@ SHIM_CALL _snprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, false);
 
   StackArgList args(ppc_context, 3);
-  StringFormatData data(format);
+  FormatOutput output(buffer, buffer_count);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count < 0) {
     if (buffer_count > 0) {
       buffer[0] = '\0';  // write a null, just to be safe
     }
   } else if (count <= buffer_count) {
-    std::memcpy(buffer, data.str().c_str(), count);
     if (count < buffer_count) {
       buffer[count] = '\0';
     }
   } else {
-    std::memcpy(buffer, data.str().c_str(), buffer_count);
     count = -1;  // for return value
   }
   SHIM_SET_RETURN_32(count);
@@ -857,7 +818,9 @@ SHIM_CALL sprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t buffer_ptr = SHIM_GET_ARG_32(0);
   uint32_t format_ptr = SHIM_GET_ARG_32(1);
 
-  XELOGD("sprintf(%08X, %08X, ...)", buffer_ptr, format_ptr);
+  if (FLAGS_log_kernel_calls) {
+    XELOGD("sprintf(%08X, %08X, ...)", buffer_ptr, format_ptr);
+  }
 
   if (buffer_ptr == 0 || format_ptr == 0) {
     SHIM_SET_RETURN_32(-1);
@@ -865,16 +828,15 @@ SHIM_CALL sprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, false);
 
   StackArgList args(ppc_context, 2);
-  StringFormatData data(format);
+  FormatOutput output(buffer, SIZE_MAX);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    std::memcpy(buffer, data.str().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -885,7 +847,9 @@ SHIM_CALL swprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t buffer_ptr = SHIM_GET_ARG_32(0);
   uint32_t format_ptr = SHIM_GET_ARG_32(1);
 
-  XELOGD("swprintf(%08X, %08X, ...)", buffer_ptr, format_ptr);
+  if (FLAGS_log_kernel_calls) {
+    XELOGD("swprintf(%08X, %08X, ...)", buffer_ptr, format_ptr);
+  }
 
   if (buffer_ptr == 0 || format_ptr == 0) {
     SHIM_SET_RETURN_32(-1);
@@ -893,16 +857,15 @@ SHIM_CALL swprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint16_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint16_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, true);
 
   StackArgList args(ppc_context, 2);
-  WideStringFormatData data(format);
+  FormatOutput output(buffer, SIZE_MAX);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -915,8 +878,10 @@ SHIM_CALL _vsnprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t format_ptr = SHIM_GET_ARG_32(2);
   uint32_t arg_ptr = SHIM_GET_ARG_32(3);
 
-  XELOGD("_vsnprintf(%08X, %i, %08X, %08X)", buffer_ptr, buffer_count,
-         format_ptr, arg_ptr);
+  if (FLAGS_log_kernel_calls) {
+    XELOGD("_vsnprintf(%08X, %i, %08X, %08X)", buffer_ptr, buffer_count,
+           format_ptr, arg_ptr);
+  }
 
   if (buffer_ptr == 0 || buffer_count <= 0 || format_ptr == 0) {
     SHIM_SET_RETURN_32(-1);
@@ -924,27 +889,22 @@ SHIM_CALL _vsnprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, false);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  StringFormatData data(format);
+  FormatOutput output(buffer, buffer_count);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count < 0) {
     // Error.
     if (buffer_count > 0) {
       buffer[0] = '\0';  // write a null, just to be safe
     }
-  } else if (count <= buffer_count) {
+  } else if (count < buffer_count) {
     // Fit within the buffer.
-    std::memcpy(buffer, data.str().c_str(), count);
-    if (count < buffer_count) {
-      buffer[count] = '\0';
-    }
-  } else {
-    // Overflowed buffer. We still return the count we would have written.
-    std::memcpy(buffer, data.str().c_str(), buffer_count);
+    buffer[count] = '\0';
   }
+  // Overflowed buffer. We still return the count we would have written.
   SHIM_SET_RETURN_32(count);
 }
 
@@ -954,7 +914,9 @@ SHIM_CALL vsprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t format_ptr = SHIM_GET_ARG_32(1);
   uint32_t arg_ptr = SHIM_GET_ARG_32(2);
 
-  XELOGD("vsprintf(%08X, %08X, %08X)", buffer_ptr, format_ptr, arg_ptr);
+  if (FLAGS_log_kernel_calls) {
+    XELOGD("vsprintf(%08X, %08X, %08X)", buffer_ptr, format_ptr, arg_ptr);
+  }
 
   if (buffer_ptr == 0 || format_ptr == 0) {
     SHIM_SET_RETURN_32(-1);
@@ -962,16 +924,15 @@ SHIM_CALL vsprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint8_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint8_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, false);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  StringFormatData data(format);
+  FormatOutput output(buffer, SIZE_MAX);
 
-  int32_t count = format_core(ppc_context, data, args, false);
+  int32_t count = format_core(ppc_context, *format, args, false, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    std::memcpy(buffer, data.str().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -982,20 +943,21 @@ SHIM_CALL _vscwprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t format_ptr = SHIM_GET_ARG_32(0);
   uint32_t arg_ptr = SHIM_GET_ARG_32(1);
 
-  XELOGD("_vscwprintf(%08X, %08X)", format_ptr, arg_ptr);
+  if (FLAGS_log_kernel_calls) {
+    XELOGD("_vscwprintf(%08X, %08X)", format_ptr, arg_ptr);
+  }
 
   if (format_ptr == 0) {
     SHIM_SET_RETURN_32(-1);
     return;
   }
 
-  auto format = (const uint16_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, true);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  WideCountFormatData data(format);
+  FormatOutput output(static_cast<uint16_t*>(nullptr), 0);
 
-  int32_t count = format_core(ppc_context, data, args, true);
-  assert_true(count < 0 || data.count() == count);
+  int32_t count = format_core(ppc_context, *format, args, true, output);
   SHIM_SET_RETURN_32(count);
 }
 
@@ -1005,7 +967,9 @@ SHIM_CALL vswprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   uint32_t format_ptr = SHIM_GET_ARG_32(1);
   uint32_t arg_ptr = SHIM_GET_ARG_32(2);
 
-  XELOGD("vswprintf(%08X, %08X, %08X)", buffer_ptr, format_ptr, arg_ptr);
+  if (FLAGS_log_kernel_calls) {
+    XELOGD("vswprintf(%08X, %08X, %08X)", buffer_ptr, format_ptr, arg_ptr);
+  }
 
   if (buffer_ptr == 0 || format_ptr == 0) {
     SHIM_SET_RETURN_32(-1);
@@ -1013,16 +977,15 @@ SHIM_CALL vswprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   }
 
   auto buffer = (uint16_t*)SHIM_MEM_ADDR(buffer_ptr);
-  auto format = (const uint16_t*)SHIM_MEM_ADDR(format_ptr);
+  auto format = format_cache.Lookup(ppc_context, format_ptr, true);
 
   ArrayArgList args(ppc_context, arg_ptr);
-  WideStringFormatData data(format);
+  FormatOutput output(buffer, SIZE_MAX);
 
-  int32_t count = format_core(ppc_context, data, args, true);
+  int32_t count = format_core(ppc_context, *format, args, true, output);
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -440,11 +440,6 @@ DECLARE_XBOXKRNL_EXPORT(KeInitializeEvent,
 
 dword_result_t KeSetEvent(pointer_t<X_KEVENT> event_ptr, dword_t increment,
                           dword_t wait) {
-  // Update dispatch header.
-  xe::atomic_exchange(
-      xe::byte_swap<uint32_t>(1),
-      reinterpret_cast<uint32_t*>(&event_ptr->header.signal_state));
-
   auto ev = XObject::GetNativeObject<XEvent>(kernel_state(), event_ptr);
   if (!ev) {
     assert_always();
@@ -469,10 +464,6 @@ dword_result_t KePulseEvent(pointer_t<X_KEVENT> event_ptr, dword_t increment,
 DECLARE_XBOXKRNL_EXPORT(KePulseEvent, ExportTag::kImplemented);
 
 dword_result_t KeResetEvent(pointer_t<X_KEVENT> event_ptr) {
-  // Update dispatch header.
-  xe::atomic_exchange(
-      0, reinterpret_cast<uint32_t*>(&event_ptr->header.signal_state));
-
   auto ev = XObject::GetNativeObject<XEvent>(kernel_state(), event_ptr);
   if (!ev) {
     assert_always();
@@ -884,7 +875,11 @@ SHIM_CALL KeWaitForMultipleObjects_shim(PPCContext* ppc_context,
 
   X_STATUS result = X_STATUS_SUCCESS;
 
-  std::vector<object_ref<XObject>> objects;
+  if (count > XObject::kMaxWaitObjects) {
+    SHIM_SET_RETURN_32(X_STATUS_INVALID_PARAMETER);
+    return;
+  }
+  object_ref<XObject> objects[XObject::kMaxWaitObjects];
   for (uint32_t n = 0; n < count; n++) {
     uint32_t object_ptr_ptr = SHIM_MEM_32(objects_ptr + n * 4);
     void* object_ptr = SHIM_MEM_ADDR(object_ptr_ptr);
@@ -894,12 +889,11 @@ SHIM_CALL KeWaitForMultipleObjects_shim(PPCContext* ppc_context,
       SHIM_SET_RETURN_32(X_STATUS_INVALID_PARAMETER);
       return;
     }
-    objects.push_back(std::move(object_ref));
+    objects[n] = std::move(object_ref);
   }
 
   uint64_t timeout = timeout_ptr ? SHIM_MEM_64(timeout_ptr) : 0;
-  result = XObject::WaitMultiple(uint32_t(objects.size()),
-                                 reinterpret_cast<XObject**>(objects.data()),
+  result = XObject::WaitMultiple(count, reinterpret_cast<XObject**>(objects),
                                  wait_type, wait_reason, processor_mode,
                                  alertable, timeout_ptr ? &timeout : nullptr);
 
@@ -913,7 +907,10 @@ dword_result_t NtWaitForMultipleObjectsEx(
   assert_true(wait_type <= 1);
   X_STATUS result = X_STATUS_SUCCESS;
 
-  std::vector<object_ref<XObject>> objects(count);
+  if (count > XObject::kMaxWaitObjects) {
+    return X_STATUS_INVALID_PARAMETER;
+  }
+  object_ref<XObject> objects[XObject::kMaxWaitObjects];
   for (uint32_t n = 0; n < count; n++) {
     uint32_t object_handle = handles[n];
     auto object =
@@ -926,7 +923,7 @@ dword_result_t NtWaitForMultipleObjectsEx(
 
   uint64_t timeout = timeout_ptr ? uint64_t(*timeout_ptr) : 0;
   result = XObject::WaitMultiple(
-      count, reinterpret_cast<XObject**>(objects.data()), wait_type, 6,
+      count, reinterpret_cast<XObject**>(objects), wait_type, 6,
       wait_mode, alertable, timeout_ptr ? &timeout : nullptr);
 
   return result;
@@ -1291,9 +1288,6 @@ pointer_result_t InterlockedPushEntrySList(
   uint32_t old_head = 0;
 
   do {
-    // Kill the guest reservation
-    xe::atomic_exchange(0, kernel_memory()->reserve_address());
-
     old_hdr = *plist_ptr;
     new_hdr.depth = old_hdr.depth + 1;
     new_hdr.sequence = old_hdr.sequence + 1;
@@ -1307,7 +1301,8 @@ pointer_result_t InterlockedPushEntrySList(
   return old_head;
 }
 DECLARE_XBOXKRNL_EXPORT(InterlockedPushEntrySList,
-                        ExportTag::kImplemented | ExportTag::kHighFrequency);
+                        ExportTag::kImplemented | ExportTag::kHighFrequency |
+                            ExportTag::kFastCall);
 
 pointer_result_t InterlockedPopEntrySList(pointer_t<X_SLIST_HEADER> plist_ptr) {
   assert_not_null(plist_ptr);
@@ -1317,9 +1312,6 @@ pointer_result_t InterlockedPopEntrySList(pointer_t<X_SLIST_HEADER> plist_ptr) {
   alignas(8) X_SLIST_HEADER old_hdr = {0};
   alignas(8) X_SLIST_HEADER new_hdr = {0};
   do {
-    // Kill the guest reservation (guest InterlockedPushEntrySList uses this)
-    xe::atomic_exchange(0, kernel_memory()->reserve_address());
-
     old_hdr = *plist_ptr;
     auto next = kernel_memory()->TranslateVirtual<X_SINGLE_LIST_ENTRY*>(
         old_hdr.next.next);
@@ -1337,7 +1329,8 @@ pointer_result_t InterlockedPopEntrySList(pointer_t<X_SLIST_HEADER> plist_ptr) {
   return popped;
 }
 DECLARE_XBOXKRNL_EXPORT(InterlockedPopEntrySList,
-                        ExportTag::kImplemented | ExportTag::kHighFrequency);
+                        ExportTag::kImplemented | ExportTag::kHighFrequency |
+                            ExportTag::kFastCall);
 
 pointer_result_t InterlockedFlushSList(pointer_t<X_SLIST_HEADER> plist_ptr) {
   alignas(8) X_SLIST_HEADER old_hdr = {0};
@@ -1345,9 +1338,6 @@ pointer_result_t InterlockedFlushSList(pointer_t<X_SLIST_HEADER> plist_ptr) {
   uint32_t first = 0;
 
   do {
-    // Kill the guest reservation
-    xe::atomic_exchange(0, kernel_memory()->reserve_address());
-
     old_hdr = *plist_ptr;
 
     first = old_hdr.next.next;
@@ -1359,7 +1349,8 @@ pointer_result_t InterlockedFlushSList(pointer_t<X_SLIST_HEADER> plist_ptr) {
 
   return first;
 }
-DECLARE_XBOXKRNL_EXPORT(InterlockedFlushSList, ExportTag::kImplemented);
+DECLARE_XBOXKRNL_EXPORT(InterlockedFlushSList,
+                        ExportTag::kImplemented | ExportTag::kFastCall);
 
 }  // namespace kernel
 }  // namespace xe
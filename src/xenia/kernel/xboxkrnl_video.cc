@@ -273,11 +273,16 @@ struct BufferScaling {
   xe::be<uint16_t> bb_width;
   xe::be<uint16_t> bb_height;
 };
-void AppendParam(StringBuffer* string_buffer, pointer_t<BufferScaling> param) {
-  string_buffer->AppendFormat(
-      "%.8X(scale %dx%d -> %dx%d))", param.guest_address(),
-      uint16_t(param->bb_width), uint16_t(param->bb_height),
-      uint16_t(param->fb_width), uint16_t(param->fb_height));
+void CaptureParam(shim::KernelCallRecord* record,
+                  pointer_t<BufferScaling> param) {
+  using Slot = shim::KernelCallRecord::Slot;
+  record->Add(Slot::kPointer, param.guest_address());
+  if (param) {
+    record->Add(Slot::kDerefInt, uint16_t(param->bb_width));
+    record->Add(Slot::kDerefInt, uint16_t(param->bb_height));
+    record->Add(Slot::kDerefInt, uint16_t(param->fb_width));
+    record->Add(Slot::kDerefInt, uint16_t(param->fb_height));
+  }
 }
 
 dword_result_t VdCallGraphicsNotificationRoutines(
@@ -369,6 +374,9 @@ void VdSwap(lpvoid_t buffer_ptr,  // ptr into primary ringbuffer
   // Set by VdCallGraphicsNotificationRoutines.
   dwords[3] = last_frontbuffer_width_;
   dwords[4] = last_frontbuffer_height_;
+
+  kernel_state()->ReportLockContention();
+  kernel_state()->memory()->ReportUsage();
 }
 DECLARE_XBOXKRNL_EXPORT(VdSwap, ExportTag::kVideo | ExportTag::kImportant);
 
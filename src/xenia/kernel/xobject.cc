@@ -122,6 +122,10 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
     // Object doesn't support waiting.
     return X_STATUS_SUCCESS;
   }
+  if (!alertable && IsKnownSignaled()) {
+    // Alertable waits still go to the host so pending APCs are delivered.
+    return X_STATUS_SUCCESS;
+  }
 
   auto timeout_ms =
       opt_timeout ? std::chrono::milliseconds(Clock::ScaleGuestDurationMillis(
@@ -149,6 +153,15 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
 X_STATUS XObject::SignalAndWait(XObject* signal_object, XObject* wait_object,
                                 uint32_t wait_reason, uint32_t processor_mode,
                                 uint32_t alertable, uint64_t* opt_timeout) {
+  if (signal_object->type() == kTypeEvent) {
+    // Events track their state alongside the host event, so signal through
+    // XEvent. This gives up the atomicity of the host call, which the guest
+    // can't observe beyond scheduling.
+    static_cast<XEvent*>(signal_object)->Set(0, false);
+    return wait_object->Wait(wait_reason, processor_mode, alertable,
+                             opt_timeout);
+  }
+
   auto timeout_ms =
       opt_timeout ? std::chrono::milliseconds(Clock::ScaleGuestDurationMillis(
                         TimeoutTicksToMs(*opt_timeout)))
@@ -177,7 +190,12 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
                                uint32_t wait_type, uint32_t wait_reason,
                                uint32_t processor_mode, uint32_t alertable,
                                uint64_t* opt_timeout) {
-  std::vector<xe::threading::WaitHandle*> wait_handles(count);
+  // Waits are hot; keep the handle list on the stack.
+  assert_true(count <= kMaxWaitObjects);
+  if (count > kMaxWaitObjects) {
+    return X_STATUS_INVALID_PARAMETER;
+  }
+  xe::threading::WaitHandle* wait_handles[kMaxWaitObjects];
   for (size_t i = 0; i < count; ++i) {
     wait_handles[i] = objects[i]->GetWaitHandle();
     assert_not_null(wait_handles[i]);
@@ -189,7 +207,7 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
                   : std::chrono::milliseconds::max();
 
   if (wait_type) {
-    auto result = xe::threading::WaitAny(std::move(wait_handles),
+    auto result = xe::threading::WaitAny(wait_handles, count,
                                          alertable ? true : false, timeout_ms);
     switch (result.first) {
       case xe::threading::WaitResult::kSuccess:
@@ -207,7 +225,7 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
         return X_STATUS_UNSUCCESSFUL;
     }
   } else {
-    auto result = xe::threading::WaitAll(std::move(wait_handles),
+    auto result = xe::threading::WaitAll(wait_handles, count,
                                          alertable ? true : false, timeout_ms);
     switch (result) {
       case xe::threading::WaitResult::kSuccess:
@@ -227,7 +245,8 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
 }
 
 uint8_t* XObject::CreateNative(uint32_t size) {
-  std::lock_guard<xe::recursive_mutex> lock(kernel_state_->object_mutex());
+  std::lock_guard<xe::counted_recursive_mutex> lock(
+      kernel_state_->native_object_mutex_);
 
   uint32_t total_size = size + sizeof(X_OBJECT_HEADER);
 
@@ -255,7 +274,8 @@ uint8_t* XObject::CreateNative(uint32_t size) {
 }
 
 void XObject::SetNativePointer(uint32_t native_ptr, bool uninitialized) {
-  std::lock_guard<xe::recursive_mutex> lock(kernel_state_->object_mutex());
+  std::lock_guard<xe::counted_recursive_mutex> lock(
+      kernel_state_->native_object_mutex_);
 
   // If hit: We've already setup the native ptr with CreateNative!
   assert_zero(guest_object_ptr_);
@@ -289,21 +309,27 @@ object_ref<XObject> XObject::GetNativeObject(KernelState* kernel_state,
   // We identify this by checking the low bit of wait_list_blink - if it's 1,
   // we have already put our pointer in there.
 
-  std::lock_guard<xe::recursive_mutex> lock(kernel_state->object_mutex());
-
   auto header = reinterpret_cast<X_DISPATCH_HEADER*>(native_ptr);
 
+  // Fast path: once stashed the pointer never changes, so objects that have
+  // already been seen (nearly every wait) don't need the object lock.
+  auto stashed_object = LoadStashedNative(header);
+  if (stashed_object) {
+    return retain_object<XObject>(stashed_object);
+  }
+
+  std::lock_guard<xe::counted_recursive_mutex> lock(
+      kernel_state->native_object_mutex_);
+
   if (as_type == -1) {
     as_type = header->type;
   }
 
-  if (header->wait_list_blink & 0x1) {
+  stashed_object = LoadStashedNative(header);
+  if (stashed_object) {
     // Already initialized.
-    uint64_t object_ptr = ((uint64_t)header->wait_list_flink << 32) |
-                          ((header->wait_list_blink) & ~0x1);
-    XObject* object = reinterpret_cast<XObject*>(object_ptr);
     // TODO(benvanik): assert nothing has been changed in the struct.
-    return retain_object<XObject>(object);
+    return retain_object<XObject>(stashed_object);
   } else {
     // First use, create new.
     // http://www.nirsoft.net/kernel_struct/vista/KOBJECTS.html
@@ -158,6 +158,10 @@ class XObject {
                                uint32_t processor_mode, uint32_t alertable,
                                uint64_t* opt_timeout);
 
+  // Maximum number of objects a single WaitMultiple may wait on, matching
+  // MAXIMUM_WAIT_OBJECTS.
+  static const uint32_t kMaxWaitObjects = 64;
+
   static object_ref<XObject> GetNativeObject(KernelState* kernel_state,
                                              void* native_ptr,
                                              int32_t as_type = -1);
@@ -165,6 +169,9 @@ class XObject {
   static object_ref<T> GetNativeObject(KernelState* kernel_state,
                                        void* native_ptr, int32_t as_type = -1);
 
+  // True if a wait on the object would be satisfied right away without
+  // changing its state, letting non-alertable waits skip the host.
+  virtual bool IsKnownSignaled() { return false; }
   virtual xe::threading::WaitHandle* GetWaitHandle() { return nullptr; }
 
  protected:
@@ -177,12 +184,29 @@ class XObject {
     return reinterpret_cast<T*>(CreateNative(sizeof(T)));
   }
 
-  // Stash native pointer into X_DISPATCH_HEADER
+  // Stash native pointer into X_DISPATCH_HEADER.
+  // wait_list_blink is written last with release ordering as its low bit
+  // publishes the binding to lock-free readers (see LoadStashedNative).
   static void StashNative(X_DISPATCH_HEADER* header, void* native_ptr) {
     uint64_t object_ptr = reinterpret_cast<uint64_t>(native_ptr);
     object_ptr |= 0x1;
     header->wait_list_flink = (uint32_t)(object_ptr >> 32);
-    header->wait_list_blink = (uint32_t)(object_ptr & 0xFFFFFFFF);
+    reinterpret_cast<std::atomic<uint32_t>*>(&header->wait_list_blink)
+        ->store(xe::byte_swap(uint32_t(object_ptr & 0xFFFFFFFF)),
+                std::memory_order_release);
+  }
+
+  // Returns the object stashed in X_DISPATCH_HEADER, if any.
+  static XObject* LoadStashedNative(X_DISPATCH_HEADER* header) {
+    uint32_t blink = xe::byte_swap(
+        reinterpret_cast<std::atomic<uint32_t>*>(&header->wait_list_blink)
+            ->load(std::memory_order_acquire));
+    if (!(blink & 0x1)) {
+      return nullptr;
+    }
+    uint64_t object_ptr =
+        (uint64_t(header->wait_list_flink) << 32) | (blink & ~0x1);
+    return reinterpret_cast<XObject*>(object_ptr);
   }
 
   static uint32_t TimeoutTicksToMs(int64_t timeout_ticks);
@@ -12,6 +12,7 @@
 #include <gflags/gflags.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <mutex>
 
@@ -20,6 +21,7 @@
 #include "xenia/base/math.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/mmio_handler.h"
+#include "xenia/profiling.h"
 
 // TODO(benvanik): move xbox.h out
 #include "xenia/xbox.h"
@@ -30,12 +32,43 @@ DEFINE_bool(protect_zero, false,
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.");
 
+DEFINE_bool(guest_large_pages, false,
+            "Back guest memory with large host pages where available.");
+
 namespace xe {
 
 uint32_t get_page_count(uint32_t value, uint32_t page_size) {
   return xe::round_up(value, page_size) / page_size;
 }
 
+// Live guest regions by size (up to 4kb, 64kb, 1mb, 16mb and larger) and by
+// MemoryTag, summed over all heaps.
+static const uint32_t kRegionSizeClassCount = 5;
+struct RegionStats {
+  std::atomic<uint32_t> size_class_counts[kRegionSizeClassCount];
+  std::atomic<uint32_t> tag_counts[size_t(MemoryTag::kCount)];
+  std::atomic<uint64_t> tag_bytes[size_t(MemoryTag::kCount)];
+};
+static RegionStats region_stats_;
+
+static thread_local MemoryTag current_memory_tag_ = MemoryTag::kOther;
+
+uint32_t GetRegionSizeClass(uint64_t size) {
+  uint32_t size_class = 0;
+  for (uint64_t limit = 4096;
+       size > limit && size_class < kRegionSizeClassCount - 1; limit *= 16) {
+    ++size_class;
+  }
+  return size_class;
+}
+
+MemoryTagScope::MemoryTagScope(MemoryTag tag)
+    : previous_tag_(current_memory_tag_) {
+  current_memory_tag_ = tag;
+}
+
+MemoryTagScope::~MemoryTagScope() { current_memory_tag_ = previous_tag_; }
+
 /**
  * Memory map:
  * 0x00000000 - 0x3FFFFFFF (1024mb) - virtual 4k pages
@@ -68,6 +101,166 @@ uint32_t get_page_count(uint32_t value, uint32_t page_size) {
  * this.
  */
 
+// Small system heap allocations are carved out of 64k chunks with one size
+// class per chunk, instead of each taking a whole page. Freed blocks are
+// cached per host thread and moved to and from the shared free lists in
+// batches, so kernel object churn rarely takes a lock.
+class SystemHeapPool : public std::enable_shared_from_this<SystemHeapPool> {
+ public:
+  static const uint32_t kChunkSize = 64 * 1024;
+  static const uint32_t kMinBlockSize = 32;
+  // 32b to 2kb blocks.
+  static const uint32_t kClassCount = 7;
+  static const uint32_t kBatchSize = 32;
+  static const uint32_t kMaxCachedBlocks = kBatchSize * 2;
+
+  explicit SystemHeapPool(Memory* memory) : memory_(memory) {
+    for (auto& tag : chunk_tags_) {
+      tag = 0;
+    }
+  }
+
+  // Returns the size class serving the request, or -1 if it is too large to
+  // be pooled. Blocks are aligned to their size.
+  static int GetSizeClass(uint32_t size, uint32_t alignment) {
+    uint32_t block_size = std::max(size, alignment);
+    for (uint32_t size_class = 0; size_class < kClassCount; ++size_class) {
+      if (block_size <= kMinBlockSize << size_class) {
+        return int(size_class);
+      }
+    }
+    return -1;
+  }
+
+  uint32_t Alloc(bool physical, int size_class);
+  // Returns false if the address was not allocated from the pool.
+  bool Free(uint32_t address);
+
+ private:
+  struct ThreadCache {
+    ~ThreadCache() { Flush(); }
+    // Returns all cached blocks to their pool, if it is still alive.
+    void Flush();
+
+    SystemHeapPool* owner = nullptr;
+    std::weak_ptr<SystemHeapPool> pool;
+    std::vector<uint32_t> blocks[2][kClassCount];
+  };
+
+  ThreadCache* GetThreadCache();
+  bool AcquireBlocks(bool physical, int size_class,
+                     std::vector<uint32_t>* blocks);
+  void ReturnBlocks(bool physical, int size_class,
+                    std::vector<uint32_t>* blocks, size_t count);
+
+  Memory* memory_;
+  xe::mutex mutex_;
+  std::vector<uint32_t> free_blocks_[2][kClassCount];
+  // Per 64k of address space: 0 if not a pool chunk, otherwise the physical
+  // bit and size class + 1. Set before any block of the chunk is handed out
+  // and never cleared.
+  std::atomic<uint8_t> chunk_tags_[0x10000];
+
+  static thread_local ThreadCache thread_cache_;
+};
+
+thread_local SystemHeapPool::ThreadCache SystemHeapPool::thread_cache_;
+
+void SystemHeapPool::ThreadCache::Flush() {
+  auto live_pool = pool.lock();
+  if (live_pool) {
+    for (int physical = 0; physical < 2; ++physical) {
+      for (int size_class = 0; size_class < int(kClassCount); ++size_class) {
+        auto& cached = blocks[physical][size_class];
+        live_pool->ReturnBlocks(!!physical, size_class, &cached,
+                                cached.size());
+      }
+    }
+  }
+  for (auto& kind_blocks : blocks) {
+    for (auto& cached : kind_blocks) {
+      cached.clear();
+    }
+  }
+  owner = nullptr;
+  pool.reset();
+}
+
+SystemHeapPool::ThreadCache* SystemHeapPool::GetThreadCache() {
+  auto cache = &thread_cache_;
+  // A dead pool may have been replaced by one at the same address.
+  if (cache->owner != this || cache->pool.expired()) {
+    cache->Flush();
+    cache->owner = this;
+    cache->pool = shared_from_this();
+  }
+  return cache;
+}
+
+bool SystemHeapPool::AcquireBlocks(bool physical, int size_class,
+                                   std::vector<uint32_t>* blocks) {
+  std::lock_guard<xe::mutex> lock(mutex_);
+  auto& free_blocks = free_blocks_[physical][size_class];
+  if (free_blocks.empty()) {
+    uint32_t chunk_address;
+    auto heap = memory_->LookupHeapByType(physical, 4096);
+    if (!heap->Alloc(kChunkSize, kChunkSize,
+                     kMemoryAllocationReserve | kMemoryAllocationCommit,
+                     kMemoryProtectRead | kMemoryProtectWrite, false,
+                     &chunk_address)) {
+      return false;
+    }
+    chunk_tags_[chunk_address / kChunkSize] =
+        uint8_t((physical ? 0x80 : 0) | (size_class + 1));
+    uint32_t block_size = kMinBlockSize << size_class;
+    // Reversed so that blocks are handed out in address order.
+    for (uint32_t offset = kChunkSize; offset; offset -= block_size) {
+      free_blocks.push_back(chunk_address + offset - block_size);
+    }
+  }
+  size_t count = std::min(free_blocks.size(), size_t(kBatchSize));
+  blocks->insert(blocks->end(), free_blocks.end() - count, free_blocks.end());
+  free_blocks.resize(free_blocks.size() - count);
+  return true;
+}
+
+void SystemHeapPool::ReturnBlocks(bool physical, int size_class,
+                                  std::vector<uint32_t>* blocks,
+                                  size_t count) {
+  if (!count) {
+    return;
+  }
+  std::lock_guard<xe::mutex> lock(mutex_);
+  auto& free_blocks = free_blocks_[physical][size_class];
+  free_blocks.insert(free_blocks.end(), blocks->end() - count, blocks->end());
+  blocks->resize(blocks->size() - count);
+}
+
+uint32_t SystemHeapPool::Alloc(bool physical, int size_class) {
+  auto& blocks = GetThreadCache()->blocks[physical][size_class];
+  if (blocks.empty() && !AcquireBlocks(physical, size_class, &blocks)) {
+    return 0;
+  }
+  uint32_t address = blocks.back();
+  blocks.pop_back();
+  return address;
+}
+
+bool SystemHeapPool::Free(uint32_t address) {
+  uint8_t tag = chunk_tags_[address / kChunkSize];
+  if (!tag) {
+    return false;
+  }
+  bool physical = !!(tag & 0x80);
+  int size_class = (tag & 0x7F) - 1;
+  auto& blocks = GetThreadCache()->blocks[physical][size_class];
+  blocks.push_back(address);
+  if (blocks.size() > kMaxCachedBlocks) {
+    ReturnBlocks(physical, size_class, &blocks, kBatchSize);
+  }
+  return true;
+}
+
 static Memory* active_memory_ = nullptr;
 
 void CrashDump() { active_memory_->DumpMap(); }
@@ -86,6 +279,9 @@ Memory::~Memory() {
   // requests.
   mmio_handler_.reset();
 
+  // Chunks go away with the heaps; thread caches notice the pool is gone.
+  system_heap_pool_.reset();
+
   heaps_.v00000000.Dispose();
   heaps_.v40000000.Dispose();
   heaps_.v80000000.Dispose();
@@ -141,6 +337,13 @@ int Memory::Initialize() {
   virtual_membase_ = mapping_base_;
   physical_membase_ = mapping_base_ + 0x100000000ull;
 
+  if (FLAGS_guest_large_pages) {
+    AdviseLargePages();
+  }
+  if (xe::memory::numa_placement() != xe::memory::kNumaNodeAny) {
+    AdviseNumaPlacement();
+  }
+
   // Prepare virtual heaps.
   heaps_.v00000000.Initialize(virtual_membase_, 0x00000000, 0x40000000, 4096);
   heaps_.v40000000.Initialize(virtual_membase_, 0x40000000,
@@ -189,6 +392,8 @@ int Memory::Initialize() {
   heaps_.vA0000000.Alloc(0x340000, 64 * 1024, kMemoryAllocationReserve,
                          kMemoryProtectNoAccess, true, &unk_phys_alloc);
 
+  system_heap_pool_ = std::make_shared<SystemHeapPool>(this);
+
   return 0;
 }
 
@@ -250,6 +455,48 @@ int Memory::MapViews(uint8_t* mapping_base) {
   return 0;
 }
 
+void Memory::AdviseLargePages() {
+  size_t large_page_size = xe::memory::large_page_size();
+  uint64_t advised_length = 0;
+  uint64_t total_length = 0;
+  for (size_t n = 0; n < xe::countof(map_info); n++) {
+    size_t length =
+        map_info[n].virtual_address_end - map_info[n].virtual_address_start + 1;
+    total_length += length;
+    if (large_page_size &&
+        xe::memory::AdviseLargePages(views_.all_views[n], length)) {
+      advised_length += length;
+    }
+  }
+  if (!advised_length) {
+    XELOGW("Large pages are unavailable; guest memory uses %dKB pages",
+           system_page_size_ / 1024);
+    return;
+  }
+  XELOGI("Guest memory: %lldMB of %lldMB backed by %lldKB large pages",
+         advised_length / (1024 * 1024), total_length / (1024 * 1024),
+         uint64_t(large_page_size / 1024));
+}
+
+void Memory::AdviseNumaPlacement() {
+  int placement = xe::memory::numa_placement();
+  bool advised = true;
+  for (size_t n = 0; n < xe::countof(map_info); n++) {
+    size_t length =
+        map_info[n].virtual_address_end - map_info[n].virtual_address_start + 1;
+    advised &= xe::memory::AdviseNumaPlacement(views_.all_views[n], length,
+                                               placement);
+  }
+  if (!advised) {
+    XELOGW("Guest memory: NUMA placement unavailable; pages come from the "
+           "node that first touches them");
+  } else if (placement == xe::memory::kNumaInterleave) {
+    XELOGI("Guest memory: interleaved across NUMA nodes");
+  } else {
+    XELOGI("Guest memory: placed on NUMA node %d", placement);
+  }
+}
+
 void Memory::UnmapViews() {
   for (size_t n = 0; n < xe::countof(views_.all_views); n++) {
     if (views_.all_views[n]) {
@@ -302,17 +549,17 @@ BaseHeap* Memory::LookupHeapByType(bool physical, uint32_t page_size) {
 }
 
 void Memory::Zero(uint32_t address, uint32_t size) {
-  std::memset(TranslateVirtual(address), 0, size);
+  xe::fill_bulk(TranslateVirtual(address), 0, size);
 }
 
 void Memory::Fill(uint32_t address, uint32_t size, uint8_t value) {
-  std::memset(TranslateVirtual(address), value, size);
+  xe::fill_bulk(TranslateVirtual(address), value, size);
 }
 
 void Memory::Copy(uint32_t dest, uint32_t src, uint32_t size) {
   uint8_t* pdest = TranslateVirtual(dest);
   const uint8_t* psrc = TranslateVirtual(src);
-  std::memcpy(pdest, psrc, size);
+  xe::copy_bulk(pdest, psrc, size);
 }
 
 uint32_t Memory::SearchAligned(uint32_t start, uint32_t end,
@@ -366,14 +613,53 @@ uintptr_t Memory::AddPhysicalWriteWatch(uint32_t physical_address,
       physical_address, length, callback, callback_context, callback_data);
 }
 
-void Memory::CancelWriteWatch(uintptr_t watch_handle) {
-  mmio_handler_->CancelWriteWatch(watch_handle);
+uintptr_t Memory::AddPhysicalAccessWatch(uint32_t physical_address,
+                                         uint32_t length,
+                                         cpu::WriteWatchCallback callback,
+                                         void* callback_context,
+                                         void* callback_data) {
+  return mmio_handler_->AddPhysicalAccessWatch(
+      physical_address, length, callback, callback_context, callback_data);
+}
+
+uintptr_t Memory::AddVirtualWriteWatch(uint32_t virtual_address,
+                                       uint32_t length,
+                                       cpu::WriteWatchCallback callback,
+                                       void* callback_context,
+                                       void* callback_data) {
+  return mmio_handler_->AddVirtualWriteWatch(
+      virtual_address, length, callback, callback_context, callback_data);
+}
+
+bool Memory::CancelWriteWatch(uintptr_t watch_handle) {
+  return mmio_handler_->CancelWriteWatch(watch_handle);
+}
+
+void Memory::SetMMIOAccessFaultCallback(cpu::MMIOAccessFaultCallback callback,
+                                        void* callback_context) {
+  mmio_handler_->set_access_fault_callback(callback, callback_context);
+}
+
+bool Memory::SetCodeBreakpointCallback(cpu::CodeBreakpointCallback callback,
+                                       void* callback_context) {
+  if (!mmio_handler_->supports_code_breakpoints()) {
+    return false;
+  }
+  mmio_handler_->set_code_breakpoint_callback(callback, callback_context);
+  return true;
 }
 
 uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
                                  uint32_t system_heap_flags) {
-  // TODO(benvanik): lightweight pool.
   bool is_physical = !!(system_heap_flags & kSystemHeapPhysical);
+  int size_class = SystemHeapPool::GetSizeClass(size, alignment);
+  if (size_class >= 0 && system_heap_pool_) {
+    uint32_t address = system_heap_pool_->Alloc(is_physical, size_class);
+    if (address) {
+      Zero(address, size);
+      return address;
+    }
+  }
   auto heap = LookupHeapByType(is_physical, 4096);
   uint32_t address;
   if (!heap->Alloc(size, alignment,
@@ -389,7 +675,9 @@ void Memory::SystemHeapFree(uint32_t address) {
   if (!address) {
     return;
   }
-  // TODO(benvanik): lightweight pool.
+  if (system_heap_pool_ && system_heap_pool_->Free(address)) {
+    return;
+  }
   auto heap = LookupHeap(address);
   heap->Release(address);
 }
@@ -422,6 +710,105 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
+void Memory::ReportUsage() {
+  SCOPE_profile_cpu_f("memory");
+
+#define REPORT_HEAP_USAGE(name, heap)                                  \
+  {                                                                    \
+    uint32_t page_kb = heap.page_size() / 1024;                        \
+    uint32_t free_run_count;                                           \
+    uint32_t largest_free_run;                                         \
+    heap.QueryFreeRuns(&free_run_count, &largest_free_run);            \
+    COUNT_profile_cpu("memory/" name "/CommittedKB",                   \
+                      heap.committed_page_count() * page_kb);          \
+    COUNT_profile_cpu("memory/" name "/ReservedKB",                    \
+                      heap.reserved_page_count() * page_kb);           \
+    COUNT_profile_cpu("memory/" name "/FreeRuns", free_run_count);     \
+    COUNT_profile_cpu("memory/" name "/LargestFreeKB",                 \
+                      largest_free_run * page_kb);                     \
+  }
+  REPORT_HEAP_USAGE("v00000000", heaps_.v00000000);
+  REPORT_HEAP_USAGE("v40000000", heaps_.v40000000);
+  REPORT_HEAP_USAGE("v80000000", heaps_.v80000000);
+  REPORT_HEAP_USAGE("v90000000", heaps_.v90000000);
+  REPORT_HEAP_USAGE("physical", heaps_.physical);
+  REPORT_HEAP_USAGE("vA0000000", heaps_.vA0000000);
+  REPORT_HEAP_USAGE("vC0000000", heaps_.vC0000000);
+  REPORT_HEAP_USAGE("vE0000000", heaps_.vE0000000);
+#undef REPORT_HEAP_USAGE
+
+  auto& size_counts = region_stats_.size_class_counts;
+  COUNT_profile_cpu("memory/Regions/Upto4KB", size_counts[0].load());
+  COUNT_profile_cpu("memory/Regions/Upto64KB", size_counts[1].load());
+  COUNT_profile_cpu("memory/Regions/Upto1MB", size_counts[2].load());
+  COUNT_profile_cpu("memory/Regions/Upto16MB", size_counts[3].load());
+  COUNT_profile_cpu("memory/Regions/Over16MB", size_counts[4].load());
+
+  auto& tag_bytes = region_stats_.tag_bytes;
+  auto& tag_counts = region_stats_.tag_counts;
+  COUNT_profile_cpu("memory/Tags/OtherKB",
+                    tag_bytes[size_t(MemoryTag::kOther)] / 1024);
+  COUNT_profile_cpu("memory/Tags/OtherRegions",
+                    tag_counts[size_t(MemoryTag::kOther)].load());
+  COUNT_profile_cpu(
+      "memory/Tags/NtAllocateVirtualMemoryKB",
+      tag_bytes[size_t(MemoryTag::kNtAllocateVirtualMemory)] / 1024);
+  COUNT_profile_cpu(
+      "memory/Tags/NtAllocateVirtualMemoryRegions",
+      tag_counts[size_t(MemoryTag::kNtAllocateVirtualMemory)].load());
+  COUNT_profile_cpu(
+      "memory/Tags/MmAllocatePhysicalMemoryKB",
+      tag_bytes[size_t(MemoryTag::kMmAllocatePhysicalMemory)] / 1024);
+  COUNT_profile_cpu(
+      "memory/Tags/MmAllocatePhysicalMemoryRegions",
+      tag_counts[size_t(MemoryTag::kMmAllocatePhysicalMemory)].load());
+  COUNT_profile_cpu("memory/Tags/XamAllocKB",
+                    tag_bytes[size_t(MemoryTag::kXamAlloc)] / 1024);
+  COUNT_profile_cpu("memory/Tags/XamAllocRegions",
+                    tag_counts[size_t(MemoryTag::kXamAlloc)].load());
+
+  // Everything the title has committed is backed by the console's 512mb; the
+  // heaps aliasing the physical heap are already counted in it.
+  uint64_t committed_bytes = 0;
+  for (BaseHeap* heap : {static_cast<BaseHeap*>(&heaps_.v00000000),
+                         static_cast<BaseHeap*>(&heaps_.v40000000),
+                         static_cast<BaseHeap*>(&heaps_.v80000000),
+                         static_cast<BaseHeap*>(&heaps_.v90000000),
+                         static_cast<BaseHeap*>(&heaps_.physical)}) {
+    committed_bytes += uint64_t(heap->committed_page_count()) *
+                       heap->page_size();
+  }
+  COUNT_profile_cpu("memory/CommittedMB", committed_bytes / (1024 * 1024));
+  if (!usage_warning_logged_ && committed_bytes >= 480ull * 1024 * 1024) {
+    usage_warning_logged_ = true;
+    XELOGW("Guest has committed %lluMB, nearing the console's 512MB",
+           committed_bytes / (1024 * 1024));
+  }
+}
+
+bool Memory::Save(FILE* file) {
+  // The physical heap holds the contents of the heaps mapped onto it.
+  return heaps_.v00000000.Save(file, true) &&
+         heaps_.v40000000.Save(file, true) &&
+         heaps_.v80000000.Save(file, true) &&
+         heaps_.v90000000.Save(file, true) &&
+         heaps_.physical.Save(file, true) &&
+         heaps_.vA0000000.Save(file, false) &&
+         heaps_.vC0000000.Save(file, false) &&
+         heaps_.vE0000000.Save(file, false);
+}
+
+bool Memory::Restore(FILE* file) {
+  return heaps_.v00000000.Restore(file, true) &&
+         heaps_.v40000000.Restore(file, true) &&
+         heaps_.v80000000.Restore(file, true) &&
+         heaps_.v90000000.Restore(file, true) &&
+         heaps_.physical.Restore(file, true) &&
+         heaps_.vA0000000.Restore(file, false) &&
+         heaps_.vC0000000.Restore(file, false) &&
+         heaps_.vE0000000.Restore(file, false);
+}
+
 xe::memory::PageAccess ToPageAccess(uint32_t protect) {
   if ((protect & kMemoryProtectRead) && !(protect & kMemoryProtectWrite)) {
     return xe::memory::PageAccess::kReadOnly;
@@ -434,7 +821,12 @@ xe::memory::PageAccess ToPageAccess(uint32_t protect) {
 }
 
 BaseHeap::BaseHeap()
-    : membase_(nullptr), heap_base_(0), heap_size_(0), page_size_(0) {}
+    : membase_(nullptr),
+      heap_base_(0),
+      heap_size_(0),
+      page_size_(0),
+      reserved_page_count_(0),
+      committed_page_count_(0) {}
 
 BaseHeap::~BaseHeap() = default;
 
@@ -445,6 +837,111 @@ void BaseHeap::Initialize(uint8_t* membase, uint32_t heap_base,
   heap_size_ = heap_size - 1;
   page_size_ = page_size;
   page_table_.resize(heap_size / page_size);
+  free_ranges_.clear();
+  free_ranges_.insert({0, uint32_t(page_table_.size())});
+  reserved_page_count_ = 0;
+  committed_page_count_ = 0;
+}
+
+void BaseHeap::SetPageState(PageEntry* page_entry, uint32_t state) {
+  uint32_t old_state = page_entry->state;
+  if (!old_state != !state) {
+    if (state) {
+      ++reserved_page_count_;
+    } else {
+      --reserved_page_count_;
+    }
+  }
+  bool was_committed = (old_state & kMemoryAllocationCommit) != 0;
+  bool is_committed = (state & kMemoryAllocationCommit) != 0;
+  if (was_committed != is_committed) {
+    if (is_committed) {
+      ++committed_page_count_;
+    } else {
+      --committed_page_count_;
+    }
+  }
+  page_entry->state = state;
+}
+
+void BaseHeap::CountRegionAllocated(uint32_t page_count, MemoryTag tag) {
+  if (!counts_allocations_) {
+    return;
+  }
+  uint64_t size = uint64_t(page_count) * page_size_;
+  ++region_stats_.size_class_counts[GetRegionSizeClass(size)];
+  ++region_stats_.tag_counts[size_t(tag)];
+  region_stats_.tag_bytes[size_t(tag)] += size;
+}
+
+void BaseHeap::CountRegionReleased(uint32_t page_count, MemoryTag tag) {
+  if (!counts_allocations_) {
+    return;
+  }
+  uint64_t size = uint64_t(page_count) * page_size_;
+  --region_stats_.size_class_counts[GetRegionSizeClass(size)];
+  --region_stats_.tag_counts[size_t(tag)];
+  region_stats_.tag_bytes[size_t(tag)] -= size;
+}
+
+void BaseHeap::QueryFreeRuns(uint32_t* out_run_count,
+                             uint32_t* out_largest_run) {
+  std::lock_guard<xe::recursive_mutex> lock(heap_mutex_);
+  *out_run_count = uint32_t(free_ranges_.size());
+  *out_largest_run = 0;
+  for (auto& run : free_ranges_) {
+    *out_largest_run = std::max(*out_largest_run, run.second);
+  }
+}
+
+void BaseHeap::MarkPagesUsed(uint32_t start_page_number,
+                             uint32_t page_count) {
+  if (!page_count) {
+    return;
+  }
+  uint32_t end_page_number = start_page_number + page_count;
+  // Start from the run containing the first page, if any.
+  auto it = free_ranges_.upper_bound(start_page_number);
+  if (it != free_ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second > start_page_number) {
+      it = prev;
+    }
+  }
+  while (it != free_ranges_.end() && it->first < end_page_number) {
+    uint32_t run_start = it->first;
+    uint32_t run_end = it->first + it->second;
+    it = free_ranges_.erase(it);
+    if (run_start < start_page_number) {
+      free_ranges_.insert({run_start, start_page_number - run_start});
+    }
+    if (run_end > end_page_number) {
+      free_ranges_.insert({end_page_number, run_end - end_page_number});
+    }
+  }
+}
+
+void BaseHeap::MarkPagesFree(uint32_t start_page_number, uint32_t page_count) {
+  if (!page_count) {
+    return;
+  }
+  // Drop any part of the range already free so runs never overlap.
+  MarkPagesUsed(start_page_number, page_count);
+  auto it = free_ranges_.insert({start_page_number, page_count}).first;
+  // Merge with the following run.
+  auto next = std::next(it);
+  if (next != free_ranges_.end() && it->first + it->second == next->first) {
+    it->second += next->second;
+    free_ranges_.erase(next);
+  }
+  // Merge with the preceding run.
+  if (it != free_ranges_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second == it->first) {
+      prev->second += it->second;
+      free_ranges_.erase(it);
+    }
+  }
 }
 
 void BaseHeap::Dispose() {
@@ -460,6 +957,147 @@ void BaseHeap::Dispose() {
   }
 }
 
+bool BaseHeap::Save(FILE* file, bool save_contents) {
+  std::lock_guard<xe::recursive_mutex> lock(heap_mutex_);
+  uint32_t header[] = {heap_base_, page_size_, uint32_t(page_table_.size())};
+  fwrite(header, sizeof(header), 1, file);
+  fwrite(page_table_.data(), sizeof(PageEntry), page_table_.size(), file);
+  if (!save_contents) {
+    return !ferror(file);
+  }
+
+  // Runs of committed pages, ended by an empty run.
+  uint32_t page_count = uint32_t(page_table_.size());
+  uint32_t page_number = 0;
+  while (true) {
+    while (page_number < page_count &&
+           !(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+    }
+    uint32_t run_end = page_number;
+    while (run_end < page_count &&
+           (page_table_[run_end].state & kMemoryAllocationCommit)) {
+      ++run_end;
+    }
+    uint32_t run[] = {page_number, run_end - page_number};
+    fwrite(run, sizeof(run), 1, file);
+    if (page_number == run_end) {
+      break;
+    }
+    for (; page_number < run_end; ++page_number) {
+      uint8_t* host_address = membase_ + heap_base_ + page_number * page_size_;
+      uint32_t protect = page_table_[page_number].current_protect;
+      if (!(protect & kMemoryProtectRead)) {
+        // Guard pages and the like.
+        xe::memory::Protect(host_address, page_size_,
+                            xe::memory::PageAccess::kReadOnly, nullptr);
+      }
+      fwrite(host_address, page_size_, 1, file);
+      if (!(protect & kMemoryProtectRead)) {
+        xe::memory::Protect(host_address, page_size_, ToPageAccess(protect),
+                            nullptr);
+      }
+    }
+  }
+  return !ferror(file);
+}
+
+bool BaseHeap::Restore(FILE* file, bool restore_contents) {
+  std::lock_guard<xe::recursive_mutex> lock(heap_mutex_);
+  uint32_t header[3];
+  if (fread(header, sizeof(header), 1, file) != 1 ||
+      header[0] != heap_base_ || header[1] != page_size_ ||
+      header[2] != page_table_.size()) {
+    XELOGE("BaseHeap::Restore snapshot doesn't match heap %.8X", heap_base_);
+    return false;
+  }
+  uint32_t page_count = uint32_t(page_table_.size());
+  std::vector<PageEntry> page_table(page_count);
+  if (fread(page_table.data(), sizeof(PageEntry), page_count, file) !=
+      page_count) {
+    return false;
+  }
+
+  if (restore_contents) {
+    while (true) {
+      uint32_t run[2];
+      if (fread(run, sizeof(run), 1, file) != 1 || run[0] > page_count ||
+          run[1] > page_count - run[0]) {
+        XELOGE("BaseHeap::Restore snapshot is truncated or corrupt");
+        return false;
+      }
+      if (!run[1]) {
+        break;
+      }
+      uint8_t* host_address = membase_ + heap_base_ + run[0] * page_size_;
+      size_t length = size_t(run[1]) * page_size_;
+      if (!xe::memory::AllocFixed(host_address, length,
+                                  xe::memory::AllocationType::kCommit,
+                                  xe::memory::PageAccess::kReadWrite) ||
+          fread(host_address, length, 1, file) != 1) {
+        XELOGE("BaseHeap::Restore failed to restore %.8X",
+               heap_base_ + run[0] * page_size_);
+        return false;
+      }
+    }
+  }
+
+  // Swap the regions counted in the allocation stats.
+  for (bool allocated : {false, true}) {
+    if (allocated) {
+      page_table_ = std::move(page_table);
+    }
+    for (uint32_t page_number = 0; page_number < page_count; ++page_number) {
+      auto& page_entry = page_table_[page_number];
+      if (!page_entry.state || page_entry.base_address != page_number ||
+          !page_entry.region_page_count) {
+        continue;
+      }
+      if (allocated) {
+        CountRegionAllocated(page_entry.region_page_count,
+                             MemoryTag(page_entry.tag));
+      } else {
+        CountRegionReleased(page_entry.region_page_count,
+                            MemoryTag(page_entry.tag));
+      }
+      page_number += page_entry.region_page_count - 1;
+    }
+  }
+
+  free_ranges_.clear();
+  reserved_page_count_ = 0;
+  committed_page_count_ = 0;
+  for (uint32_t page_number = 0; page_number < page_count;) {
+    uint32_t run_end = page_number;
+    bool is_free = !page_table_[page_number].state;
+    uint32_t protect = page_table_[page_number].current_protect;
+    bool is_committed =
+        (page_table_[page_number].state & kMemoryAllocationCommit) != 0;
+    while (run_end < page_count &&
+           (page_table_[run_end].state == 0) == is_free &&
+           page_table_[run_end].current_protect == protect &&
+           ((page_table_[run_end].state & kMemoryAllocationCommit) != 0) ==
+               is_committed) {
+      ++run_end;
+    }
+    if (!is_free) {
+      reserved_page_count_ += run_end - page_number;
+    }
+    if (is_committed) {
+      committed_page_count_ += run_end - page_number;
+    }
+    if (is_free) {
+      MarkPagesFree(page_number, run_end - page_number);
+    } else if (is_committed) {
+      xe::memory::Protect(membase_ + heap_base_ + page_number * page_size_,
+                          size_t(run_end - page_number) * page_size_,
+                          ToPageAccess(protect), nullptr);
+    }
+    page_number = run_end;
+  }
+  return true;
+}
+
 void BaseHeap::DumpMap() {
   std::lock_guard<xe::recursive_mutex> lock(heap_mutex_);
   XELOGE("------------------------------------------------------------------");
@@ -589,10 +1227,15 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
       // Region is based on reservation.
       page_entry.base_address = start_page_number;
       page_entry.region_page_count = page_count;
+      page_entry.tag = uint32_t(current_memory_tag_);
     }
     page_entry.allocation_protect = protect;
     page_entry.current_protect = protect;
-    page_entry.state = kMemoryAllocationReserve | allocation_type;
+    SetPageState(&page_entry, kMemoryAllocationReserve | allocation_type);
+  }
+  MarkPagesUsed(start_page_number, page_count);
+  if (allocation_type & kMemoryAllocationReserve) {
+    CountRegionAllocated(page_count, current_memory_tag_);
   }
 
   return true;
@@ -623,76 +1266,48 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   std::lock_guard<xe::recursive_mutex> lock(heap_mutex_);
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
+  // The base page must match the requested alignment, so each free run
+  // overlapping the requested range is checked for an aligned base with
+  // enough free pages after it.
   uint32_t start_page_number = UINT_MAX;
   uint32_t end_page_number = UINT_MAX;
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
   if (top_down) {
-    for (int64_t base_page_number = high_page_number - page_count;
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          base_page_number = page_number - page_count;
-          base_page_number -= base_page_number % page_scan_stride;
-          base_page_number += page_scan_stride;  // cancel out loop logic
+    auto it = free_ranges_.lower_bound(high_page_number);
+    while (it != free_ranges_.begin()) {
+      --it;
+      uint32_t run_start = std::max(it->first, low_page_number);
+      uint32_t run_end = std::min(it->first + it->second, high_page_number);
+      if (run_end < run_start + page_count) {
+        if (it->first + it->second <= low_page_number) {
+          // All remaining runs are below the requested range.
           break;
         }
+        continue;
       }
-      if (!any_taken) {
-        // Found our place.
+      uint32_t base_page_number = run_end - page_count;
+      base_page_number -= base_page_number % page_scan_stride;
+      if (base_page_number >= run_start) {
+        start_page_number = base_page_number;
+        end_page_number = base_page_number + page_count - 1;
         break;
       }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
     }
   } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
+    auto it = free_ranges_.upper_bound(low_page_number);
+    if (it != free_ranges_.begin()) {
+      --it;
+    }
+    for (; it != free_ranges_.end() && it->first < high_page_number; ++it) {
+      uint32_t run_start = std::max(it->first, low_page_number);
+      uint32_t run_end = std::min(it->first + it->second, high_page_number);
+      uint32_t base_page_number = xe::round_up(run_start, page_scan_stride);
+      if (base_page_number + page_count <= run_end) {
+        start_page_number = base_page_number;
+        end_page_number = base_page_number + page_count - 1;
         break;
       }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
     }
   }
   if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
@@ -728,10 +1343,13 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     auto& page_entry = page_table_[page_number];
     page_entry.base_address = start_page_number;
     page_entry.region_page_count = page_count;
+    page_entry.tag = uint32_t(current_memory_tag_);
     page_entry.allocation_protect = protect;
     page_entry.current_protect = protect;
-    page_entry.state = kMemoryAllocationReserve | allocation_type;
+    SetPageState(&page_entry, kMemoryAllocationReserve | allocation_type);
   }
+  MarkPagesUsed(start_page_number, page_count);
+  CountRegionAllocated(page_count, current_memory_tag_);
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -762,7 +1380,7 @@ bool BaseHeap::Decommit(uint32_t address, uint32_t size) {
   for (uint32_t page_number = start_page_number; page_number <= end_page_number;
        ++page_number) {
     auto& page_entry = page_table_[page_number];
-    page_entry.state &= ~kMemoryAllocationCommit;
+    SetPageState(&page_entry, page_entry.state & ~kMemoryAllocationCommit);
   }
 
   return true;
@@ -811,8 +1429,14 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
   for (uint32_t page_number = base_page_number; page_number <= end_page_number;
        ++page_number) {
     auto& page_entry = page_table_[page_number];
+    SetPageState(&page_entry, 0);
     page_entry.qword = 0;
   }
+  MarkPagesFree(base_page_number, base_page_entry.region_page_count);
+  if (base_page_entry.state) {
+    CountRegionReleased(base_page_entry.region_page_count,
+                        MemoryTag(base_page_entry.tag));
+  }
 
   return true;
 }
@@ -975,6 +1599,7 @@ void PhysicalHeap::Initialize(uint8_t* membase, uint32_t heap_base,
                               VirtualHeap* parent_heap) {
   BaseHeap::Initialize(membase, heap_base, heap_size, page_size);
   parent_heap_ = parent_heap;
+  counts_allocations_ = false;
 }
 
 bool PhysicalHeap::Alloc(uint32_t size, uint32_t alignment,
@@ -10,7 +10,10 @@
 #ifndef XENIA_MEMORY_H_
 #define XENIA_MEMORY_H_
 
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -22,6 +25,8 @@
 
 namespace xe {
 
+class SystemHeapPool;
+
 enum SystemHeapFlag : uint32_t {
   kSystemHeapVirtual = 1 << 0,
   kSystemHeapPhysical = 1 << 1,
@@ -71,11 +76,34 @@ union PageEntry {
     uint32_t allocation_protect : 4;
     uint32_t current_protect : 4;
     uint32_t state : 2;
-    uint32_t reserved : 14;
+    uint32_t tag : 4;  // MemoryTag of the region
+    uint32_t reserved : 10;
   };
   uint64_t qword;
 };
 
+// The guest API a region was allocated through, for usage reporting.
+enum class MemoryTag : uint32_t {
+  kOther = 0,
+  kNtAllocateVirtualMemory,
+  kMmAllocatePhysicalMemory,
+  kXamAlloc,
+
+  kCount,
+};
+
+// Tags the regions reserved by the calling thread while in scope. Small
+// system heap allocations are carved out of pooled chunks and take the tag
+// of the allocation that created the chunk.
+class MemoryTagScope {
+ public:
+  explicit MemoryTagScope(MemoryTag tag);
+  ~MemoryTagScope();
+
+ private:
+  MemoryTag previous_tag_;
+};
+
 class BaseHeap {
  public:
   virtual ~BaseHeap();
@@ -105,18 +133,50 @@ class BaseHeap {
   bool QueryProtect(uint32_t address, uint32_t* out_protect);
   uint32_t GetPhysicalAddress(uint32_t address);
 
+  uint32_t reserved_page_count() const { return reserved_page_count_; }
+  uint32_t committed_page_count() const { return committed_page_count_; }
+  // Free space fragmentation: the number of free runs and the length of the
+  // largest one, in pages.
+  void QueryFreeRuns(uint32_t* out_run_count, uint32_t* out_largest_run);
+
+  // Writes the page table and, if requested, the contents of all committed
+  // pages (heaps aliasing the physical heap have none of their own).
+  bool Save(FILE* file, bool save_contents);
+  // Replaces the page table and contents with ones written by Save and
+  // reapplies the page protections.
+  bool Restore(FILE* file, bool restore_contents);
+
  protected:
   BaseHeap();
 
   void Initialize(uint8_t* membase, uint32_t heap_base, uint32_t heap_size,
                   uint32_t page_size);
 
+  // Removes pages from or returns pages to free_ranges_. Must be called with
+  // heap_mutex_ held whenever page states change between free and not.
+  void MarkPagesUsed(uint32_t start_page_number, uint32_t page_count);
+  void MarkPagesFree(uint32_t start_page_number, uint32_t page_count);
+
+  // Changes a page's state, keeping the page counters in step.
+  void SetPageState(PageEntry* page_entry, uint32_t state);
+  // Counts a region being reserved or released in the allocation stats.
+  void CountRegionAllocated(uint32_t page_count, MemoryTag tag);
+  void CountRegionReleased(uint32_t page_count, MemoryTag tag);
+
   uint8_t* membase_;
   uint32_t heap_base_;
   uint32_t heap_size_;
   uint32_t page_size_;
   std::vector<PageEntry> page_table_;
+  // Runs of free pages as start page number -> page count, coalesced on
+  // release, so that allocation walks free runs instead of pages.
+  std::map<uint32_t, uint32_t> free_ranges_;
   xe::recursive_mutex heap_mutex_;
+  std::atomic<uint32_t> reserved_page_count_;
+  std::atomic<uint32_t> committed_page_count_;
+  // Heaps aliasing the physical heap leave the allocation stats to it so
+  // that regions are not counted twice.
+  bool counts_allocations_ = true;
 };
 
 class VirtualHeap : public BaseHeap {
@@ -181,8 +241,6 @@ class Memory {
                                (guest_address & 0x1FFFFFFF));
   }
 
-  inline uint64_t* reserve_address() { return &reserve_address_; }
-
   // TODO(benvanik): make poly memory utils for these.
   void Zero(uint32_t address, uint32_t size);
   void Fill(uint32_t address, uint32_t size, uint8_t value);
@@ -199,7 +257,23 @@ class Memory {
   uintptr_t AddPhysicalWriteWatch(uint32_t physical_address, uint32_t length,
                                   cpu::WriteWatchCallback callback,
                                   void* callback_context, void* callback_data);
-  void CancelWriteWatch(uintptr_t watch_handle);
+  uintptr_t AddPhysicalAccessWatch(uint32_t physical_address, uint32_t length,
+                                   cpu::WriteWatchCallback callback,
+                                   void* callback_context,
+                                   void* callback_data);
+  uintptr_t AddVirtualWriteWatch(uint32_t virtual_address, uint32_t length,
+                                 cpu::WriteWatchCallback callback,
+                                 void* callback_context, void* callback_data);
+  // Returns false if the watch has already been triggered.
+  bool CancelWriteWatch(uintptr_t watch_handle);
+
+  // Sets a callback notified of each handled MMIO access fault.
+  void SetMMIOAccessFaultCallback(cpu::MMIOAccessFaultCallback callback,
+                                  void* callback_context);
+  // Sets the callback that handles int3s patched into generated code. Returns
+  // false if the host can't route them, in which case none may be patched.
+  bool SetCodeBreakpointCallback(cpu::CodeBreakpointCallback callback,
+                                 void* callback_context);
 
   uint32_t SystemHeapAlloc(uint32_t size, uint32_t alignment = 0x20,
                            uint32_t system_heap_flags = kSystemHeapDefault);
@@ -210,8 +284,22 @@ class Memory {
 
   void DumpMap();
 
+  // Publishes per heap committed and reserved sizes, free space
+  // fragmentation, allocation counts by size and live sizes by MemoryTag to
+  // the profiler. Called once per frame.
+  void ReportUsage();
+
+  // Snapshot of all heaps, sparse by committed pages. Guest threads must not
+  // run while either is called.
+  bool Save(FILE* file);
+  bool Restore(FILE* file);
+
  private:
   int MapViews(uint8_t* mapping_base);
+  // Requests large page backing for all views and logs what was obtained.
+  void AdviseLargePages();
+  // Places all views per xe::memory::numa_placement() and logs the result.
+  void AdviseNumaPlacement();
   void UnmapViews();
 
  private:
@@ -219,7 +307,6 @@ class Memory {
   uint32_t system_page_size_ = 0;
   uint8_t* virtual_membase_ = nullptr;
   uint8_t* physical_membase_ = nullptr;
-  uint64_t reserve_address_ = 0;
 
   xe::memory::FileMappingHandle mapping_ = nullptr;
   uint8_t* mapping_base_ = nullptr;
@@ -239,6 +326,8 @@ class Memory {
   } views_ = {{0}};
 
   std::unique_ptr<cpu::MMIOHandler> mmio_handler_;
+  // Serves small SystemHeapAlloc requests.
+  std::shared_ptr<SystemHeapPool> system_heap_pool_;
 
   struct {
     VirtualHeap v00000000;
@@ -252,6 +341,9 @@ class Memory {
     PhysicalHeap vE0000000;
   } heaps_;
 
+  // Set once guest usage has been logged as nearing the console's memory.
+  bool usage_warning_logged_ = false;
+
   friend class BaseHeap;
 };
 
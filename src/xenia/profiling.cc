@@ -9,7 +9,13 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 // NOTE: this must be included before microprofile as macro expansion needs
 // XELOGI.
@@ -31,16 +37,117 @@
 
 #include "xenia/profiling.h"
 
+#include "xenia/base/filesystem.h"
+#include "xenia/base/math.h"
+#include "xenia/base/threading.h"
+
 #if XE_OPTION_PROFILING
 #include "third_party/microprofile/microprofileui.h"
 #endif  // XE_OPTION_PROFILING
 
 DEFINE_bool(show_profiler, false, "Show profiling UI by default.");
+DEFINE_string(profile_trace_path, "xenia_trace",
+              "Prefix of the Chrome trace JSON files written by profile trace "
+              "captures.");
+DEFINE_int32(profile_trace_startup_ms, 0,
+             "Capture a profile trace of the first N ms after startup.");
+DEFINE_bool(perf_counters, false,
+            "Collect hardware performance counters (IPC, cache misses, branch "
+            "mispredicts) for each profiled thread. Linux perf_event only.");
+DEFINE_bool(perf_counters_zones, false,
+            "Attach perf counter deltas to each scope in profile traces. "
+            "Requires --perf_counters; costs two syscalls per scope.");
 
 namespace xe {
 
 std::unique_ptr<ProfilerDisplay> Profiler::display_ = nullptr;
 
+namespace {
+
+struct ThreadPerfCounters {
+  std::string name;
+  std::unique_ptr<PerfCounters> counters;
+};
+
+#if XE_OPTION_PROFILING
+// GPU times of GPU profiling scopes, by key. Keys only need to stay unique
+// for the few frames the profiler waits before reading them, so they wrap.
+const uint32_t kGpuTimestampCount = 64 * 1024;
+std::atomic<uint32_t> gpu_timestamp_next_key_(0);
+std::atomic<uint64_t> gpu_timestamps_[kGpuTimestampCount];
+thread_local ProfilerGpuTimer* thread_gpu_timer_ = nullptr;
+#endif  // XE_OPTION_PROFILING
+
+std::mutex perf_counters_mutex_;
+std::vector<std::unique_ptr<ThreadPerfCounters>> perf_counters_threads_;
+thread_local ThreadPerfCounters* current_perf_counters_ = nullptr;
+
+void LogThreadPerfCounters(ThreadPerfCounters* thread) {
+  PerfCounters::Values values;
+  if (!thread->counters->Read(&values)) {
+    return;
+  }
+  double per_kilo_instruction =
+      values.instructions ? 1000.0 / values.instructions : 0.0;
+  XELOGI(
+      "Perf counters: %-28s %10.3fG cycles, IPC %.2f, %.2f cache / %.2f "
+      "branch misses per 1k instructions",
+      thread->name.c_str(), values.cycles / 1000000000.0, values.ipc(),
+      values.cache_misses * per_kilo_instruction,
+      values.branch_misses * per_kilo_instruction);
+}
+
+void PerfCountersThreadEnter(const char* name) {
+  if (!FLAGS_perf_counters) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(perf_counters_mutex_);
+  if (current_perf_counters_) {
+    current_perf_counters_->name = name ? name : "";
+    return;
+  }
+  auto counters = PerfCounters::Create();
+  if (!counters) {
+    static bool warned = false;
+    if (!warned) {
+      XELOGW("Hardware performance counters are unavailable");
+      warned = true;
+    }
+    return;
+  }
+  auto thread = std::make_unique<ThreadPerfCounters>();
+  thread->name = name ? name : "";
+  thread->counters = std::move(counters);
+  current_perf_counters_ = thread.get();
+  perf_counters_threads_.push_back(std::move(thread));
+}
+
+void PerfCountersThreadExit() {
+  if (!current_perf_counters_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(perf_counters_mutex_);
+  LogThreadPerfCounters(current_perf_counters_);
+  auto it = std::find_if(perf_counters_threads_.begin(),
+                         perf_counters_threads_.end(),
+                         [](const std::unique_ptr<ThreadPerfCounters>& t) {
+                           return t.get() == current_perf_counters_;
+                         });
+  perf_counters_threads_.erase(it);
+  current_perf_counters_ = nullptr;
+}
+
+// Reports the threads that are still running. Counters of other threads can
+// be read, but not closed, as the owning thread may still be using them.
+void DumpPerfCounters() {
+  std::lock_guard<std::mutex> lock(perf_counters_mutex_);
+  for (auto& thread : perf_counters_threads_) {
+    LogThreadPerfCounters(thread.get());
+  }
+}
+
+}  // namespace
+
 #if XE_OPTION_PROFILING
 
 bool Profiler::is_enabled() { return true; }
@@ -48,6 +155,10 @@ bool Profiler::is_enabled() { return true; }
 bool Profiler::is_visible() { return is_enabled() && MicroProfileIsDrawing(); }
 
 void Profiler::Initialize() {
+  if (FLAGS_profile_trace_startup_ms > 0) {
+    ProfileTrace::Start(FLAGS_profile_trace_startup_ms);
+  }
+
   // Custom groups.
   MicroProfileSetEnableAllGroups(false);
   MicroProfileForceEnableGroup("apu", MicroProfileTokenTypeCpu);
@@ -86,6 +197,7 @@ void Profiler::Dump() {
 }
 
 void Profiler::Shutdown() {
+  DumpPerfCounters();
   display_.reset();
   MicroProfileShutdown();
 }
@@ -97,10 +209,15 @@ uint32_t Profiler::GetColor(const char* str) {
 }
 
 void Profiler::ThreadEnter(const char* name) {
+  ProfileTrace::SetThreadName(name);
+  PerfCountersThreadEnter(name);
   MicroProfileOnThreadCreate(name);
 }
 
-void Profiler::ThreadExit() { MicroProfileOnThreadExit(); }
+void Profiler::ThreadExit() {
+  PerfCountersThreadExit();
+  MicroProfileOnThreadExit();
+}
 
 bool Profiler::OnKeyDown(int key_code) {
   // http://msdn.microsoft.com/en-us/library/windows/desktop/dd375731(v=vs.85).aspx
@@ -169,8 +286,19 @@ void Profiler::set_display(std::unique_ptr<ProfilerDisplay> display) {
   display_ = std::move(display);
 }
 
+void Profiler::set_thread_gpu_timer(ProfilerGpuTimer* timer) {
+  thread_gpu_timer_ = timer;
+}
+
+void Profiler::SetGpuTimestamp(uint32_t key, uint64_t timestamp_ns) {
+  gpu_timestamps_[key % kGpuTimestampCount].store(timestamp_ns,
+                                                  std::memory_order_relaxed);
+}
+
 void Profiler::Present() {
   SCOPE_profile_cpu_f("internal");
+  // Flipping marks the start of the frame on the GPU timeline too.
+  thread_gpu_timer_ = display_ ? display_->gpu_timer() : nullptr;
   MicroProfileFlip();
 #if XE_OPTION_PROFILING_UI
   if (!display_) {
@@ -186,12 +314,19 @@ void Profiler::Present() {
 
 bool Profiler::is_enabled() { return false; }
 bool Profiler::is_visible() { return false; }
-void Profiler::Initialize() {}
+void Profiler::Initialize() {
+  if (FLAGS_profile_trace_startup_ms > 0) {
+    ProfileTrace::Start(FLAGS_profile_trace_startup_ms);
+  }
+}
 void Profiler::Dump() {}
-void Profiler::Shutdown() {}
+void Profiler::Shutdown() { DumpPerfCounters(); }
 uint32_t Profiler::GetColor(const char* str) { return 0; }
-void Profiler::ThreadEnter(const char* name) {}
-void Profiler::ThreadExit() {}
+void Profiler::ThreadEnter(const char* name) {
+  ProfileTrace::SetThreadName(name);
+  PerfCountersThreadEnter(name);
+}
+void Profiler::ThreadExit() { PerfCountersThreadExit(); }
 bool Profiler::OnKeyDown(int key_code) { return false; }
 bool Profiler::OnKeyUp(int key_code) { return false; }
 void Profiler::OnMouseDown(bool left_button, bool right_button) {}
@@ -199,19 +334,246 @@ void Profiler::OnMouseUp() {}
 void Profiler::OnMouseMove(int x, int y) {}
 void Profiler::OnMouseWheel(int x, int y, int dy) {}
 void Profiler::set_display(std::unique_ptr<ProfilerDisplay> display) {}
+void Profiler::set_thread_gpu_timer(ProfilerGpuTimer* timer) {}
+void Profiler::SetGpuTimestamp(uint32_t key, uint64_t timestamp_ns) {}
 void Profiler::Present() {}
 
 #endif  // XE_OPTION_PROFILING
 
+void Profiler::ToggleTrace() {
+  if (ProfileTrace::is_active()) {
+    ProfileTrace::Stop();
+  } else {
+    ProfileTrace::Start();
+  }
+}
+
+namespace {
+
+struct TraceEvent {
+  const char* group_name;
+  const char* scope_name;
+  uint64_t start_ticks;
+  uint64_t end_ticks;
+  bool has_counters;
+};
+
+// Events of one thread. Only the owning thread appends; the writer reads the
+// first |count| events after the capture stopped.
+struct ThreadTraceBuffer {
+  static const size_t kCapacity = 128 * 1024;
+
+  uint32_t thread_id = 0;
+  std::string thread_name;  // Guarded by trace_mutex_.
+  uint32_t generation = 0;
+  std::unique_ptr<TraceEvent[]> events;
+  // Parallel to events, allocated on the first scope with counters.
+  std::unique_ptr<PerfCounters::Values[]> counters;
+  std::atomic<size_t> count{0};
+  std::atomic<uint64_t> dropped_count{0};
+};
+
+std::mutex trace_mutex_;
+std::vector<std::shared_ptr<ThreadTraceBuffer>> trace_buffers_;
+// Bumped on each Start so buffers lazily reset on their first new event.
+std::atomic<uint32_t> trace_generation_(0);
+uint64_t trace_start_ticks_ = 0;
+uint32_t trace_file_index_ = 0;
+
+ThreadTraceBuffer* GetThreadTraceBuffer() {
+  static thread_local std::shared_ptr<ThreadTraceBuffer> buffer;
+  if (!buffer) {
+    buffer = std::make_shared<ThreadTraceBuffer>();
+    buffer->thread_id = xe::threading::current_thread_id();
+    std::lock_guard<std::mutex> lock(trace_mutex_);
+    trace_buffers_.push_back(buffer);
+  }
+  return buffer.get();
+}
+
+void AppendJsonString(std::string* out, const char* value) {
+  out->push_back('"');
+  for (const char* c = value; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      out->push_back('\\');
+    }
+    if (uint8_t(*c) >= 0x20) {
+      out->push_back(*c);
+    }
+  }
+  out->push_back('"');
+}
+
+}  // namespace
+
+std::atomic<bool> ProfileTrace::active_(false);
+
+void ProfileTrace::Start(uint32_t duration_ms) {
+  uint32_t generation;
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex_);
+    if (active_) {
+      return;
+    }
+    generation = ++trace_generation_;
+    trace_start_ticks_ = Clock::QueryHostTickCount();
+    active_ = true;
+  }
+  XELOGI("Profile trace capture started");
+  if (duration_ms) {
+    std::thread([generation, duration_ms]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+      if (trace_generation_ == generation) {
+        Stop();
+      }
+    }).detach();
+  }
+}
+
+void ProfileTrace::Stop() {
+  std::lock_guard<std::mutex> lock(trace_mutex_);
+  if (!active_) {
+    return;
+  }
+  active_ = false;
+  uint32_t generation = trace_generation_;
+
+  char suffix[32];
+  std::snprintf(suffix, xe::countof(suffix), "_%u.json", trace_file_index_++);
+  auto path = xe::to_wstring(FLAGS_profile_trace_path + suffix);
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to open profile trace file %s",
+           xe::to_string(path).c_str());
+    return;
+  }
+
+  double us_per_tick = 1000000.0 / Clock::host_tick_frequency();
+  size_t event_count = 0;
+  uint64_t dropped_count = 0;
+  std::string json = "{\"traceEvents\":[\n";
+  bool first = true;
+  char line[256];
+  for (auto& buffer : trace_buffers_) {
+    if (!buffer->thread_name.empty()) {
+      std::snprintf(line, xe::countof(line),
+                    "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                    "\"name\":\"thread_name\",\"args\":{\"name\":",
+                    first ? "" : ",\n", buffer->thread_id);
+      json += line;
+      AppendJsonString(&json, buffer->thread_name.c_str());
+      json += "}}";
+      first = false;
+    }
+    if (buffer->generation != generation) {
+      continue;
+    }
+    size_t count = buffer->count.load(std::memory_order_acquire);
+    dropped_count += buffer->dropped_count.exchange(0);
+    for (size_t i = 0; i < count; ++i) {
+      const auto& event = buffer->events[i];
+      json += first ? "" : ",\n";
+      first = false;
+      json += "{\"ph\":\"X\",\"pid\":1,\"cat\":";
+      AppendJsonString(&json, event.group_name);
+      json += ",\"name\":";
+      AppendJsonString(&json, event.scope_name);
+      std::snprintf(
+          line, xe::countof(line), ",\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+          buffer->thread_id,
+          (event.start_ticks - trace_start_ticks_) * us_per_tick,
+          (event.end_ticks - event.start_ticks) * us_per_tick);
+      json += line;
+      if (event.has_counters) {
+        const auto& counters = buffer->counters[i];
+        std::snprintf(line, xe::countof(line),
+                      ",\"args\":{\"cycles\":%" PRIu64
+                      ",\"instructions\":%" PRIu64
+                      ",\"ipc\":%.3f,\"cache_misses\":%" PRIu64
+                      ",\"branch_misses\":%" PRIu64 "}",
+                      counters.cycles, counters.instructions, counters.ipc(),
+                      counters.cache_misses, counters.branch_misses);
+        json += line;
+      }
+      json += "}";
+      if (json.size() > 1024 * 1024) {
+        fwrite(json.data(), 1, json.size(), file);
+        json.clear();
+      }
+    }
+    event_count += count;
+  }
+  json += "\n]}\n";
+  fwrite(json.data(), 1, json.size(), file);
+  fclose(file);
+
+  XELOGI("Profile trace: wrote %lld events to %s (%lld dropped)",
+         static_cast<long long>(event_count), xe::to_string(path).c_str(),
+         static_cast<long long>(dropped_count));
+}
+
+void ProfileTrace::SetThreadName(const char* name) {
+  auto buffer = GetThreadTraceBuffer();
+  std::lock_guard<std::mutex> lock(trace_mutex_);
+  buffer->thread_name = name ? name : "";
+}
+
+void ProfileTrace::Record(const char* group_name, const char* scope_name,
+                          uint64_t start_ticks, uint64_t end_ticks,
+                          const PerfCounters::Values* counters) {
+  auto buffer = GetThreadTraceBuffer();
+  uint32_t generation = trace_generation_.load(std::memory_order_relaxed);
+  if (buffer->generation != generation) {
+    buffer->generation = generation;
+    buffer->count.store(0, std::memory_order_relaxed);
+  }
+  if (!buffer->events) {
+    buffer->events.reset(new TraceEvent[ThreadTraceBuffer::kCapacity]);
+  }
+  size_t count = buffer->count.load(std::memory_order_relaxed);
+  if (count == ThreadTraceBuffer::kCapacity) {
+    buffer->dropped_count.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (counters) {
+    if (!buffer->counters) {
+      buffer->counters.reset(
+          new PerfCounters::Values[ThreadTraceBuffer::kCapacity]);
+    }
+    buffer->counters[count] = *counters;
+  }
+  buffer->events[count] = {group_name, scope_name, start_ticks, end_ticks,
+                           counters != nullptr};
+  buffer->count.store(count + 1, std::memory_order_release);
+}
+
+bool ProfileTrace::ReadScopeCounters(PerfCounters::Values* out_values) {
+  if (!FLAGS_perf_counters_zones || !current_perf_counters_) {
+    return false;
+  }
+  return current_perf_counters_->counters->Read(out_values);
+}
+
 }  // namespace xe
 
 #if XE_OPTION_PROFILING
 
-uint32_t MicroProfileGpuInsertTimeStamp() { return 0; }
+uint32_t MicroProfileGpuInsertTimeStamp() {
+  uint32_t key = xe::gpu_timestamp_next_key_.fetch_add(1) %
+                 xe::kGpuTimestampCount;
+  xe::gpu_timestamps_[key].store(0, std::memory_order_relaxed);
+  if (xe::thread_gpu_timer_) {
+    xe::thread_gpu_timer_->InsertTimestamp(key);
+  }
+  return key;
+}
 
-uint64_t MicroProfileGpuGetTimeStamp(uint32_t nKey) { return 0; }
+uint64_t MicroProfileGpuGetTimeStamp(uint32_t nKey) {
+  return xe::gpu_timestamps_[nKey % xe::kGpuTimestampCount].load(
+      std::memory_order_relaxed);
+}
 
-uint64_t MicroProfileTicksPerSecondGpu() { return 0; }
+uint64_t MicroProfileTicksPerSecondGpu() { return 1000000000ull; }
 
 const char* MicroProfileGetThreadName() { return "TODO: get thread name!"; }
 
@@ -10,8 +10,11 @@
 #ifndef XENIA_PROFILING_H_
 #define XENIA_PROFILING_H_
 
+#include <atomic>
 #include <memory>
 
+#include "xenia/base/clock.h"
+#include "xenia/base/perf_counters.h"
 #include "xenia/base/string.h"
 
 #if XE_PLATFORM_WIN32
@@ -29,6 +32,14 @@
 
 namespace xe {
 
+#define XE_PROFILE_TRACE_PASTE_(a, b) a##b
+#define XE_PROFILE_TRACE_PASTE(a, b) XE_PROFILE_TRACE_PASTE_(a, b)
+// Records the containing block into a running ProfileTrace capture.
+#define XE_PROFILE_TRACE_SCOPE(group_name, scope_name)                  \
+  xe::ProfileTraceScope XE_PROFILE_TRACE_PASTE(xe_profile_trace_scope_, \
+                                               __LINE__)(group_name,    \
+                                                         scope_name)
+
 #if XE_OPTION_PROFILING
 
 // Defines a profiling scope for CPU tasks.
@@ -51,19 +62,23 @@ namespace xe {
 
 // Enters a previously defined CPU profiling scope, active for the duration
 // of the containing block.
-#define SCOPE_profile_cpu(name) MICROPROFILE_SCOPE(name)
+#define SCOPE_profile_cpu(name) \
+  MICROPROFILE_SCOPE(name);     \
+  XE_PROFILE_TRACE_SCOPE("cpu", #name)
 
 // Enters a CPU profiling scope, active for the duration of the containing
 // block. No previous definition required.
-#define SCOPE_profile_cpu_i(group_name, scope_name) \
-  MICROPROFILE_SCOPEI(group_name, scope_name,       \
-                      xe::Profiler::GetColor(scope_name))
+#define SCOPE_profile_cpu_i(group_name, scope_name)        \
+  MICROPROFILE_SCOPEI(group_name, scope_name,              \
+                      xe::Profiler::GetColor(scope_name)); \
+  XE_PROFILE_TRACE_SCOPE(group_name, scope_name)
 
 // Enters a CPU profiling scope by function name, active for the duration of
 // the containing block. No previous definition required.
-#define SCOPE_profile_cpu_f(group_name)         \
-  MICROPROFILE_SCOPEI(group_name, __FUNCTION__, \
-                      xe::Profiler::GetColor(__FUNCTION__))
+#define SCOPE_profile_cpu_f(group_name)                      \
+  MICROPROFILE_SCOPEI(group_name, __FUNCTION__,              \
+                      xe::Profiler::GetColor(__FUNCTION__)); \
+  XE_PROFILE_TRACE_SCOPE(group_name, __FUNCTION__)
 
 // Enters a previously defined GPU profiling scope, active for the duration
 // of the containing block.
@@ -93,15 +108,11 @@ namespace xe {
 #define DEFINE_profile_gpu(name, group_name, scope_name)
 #define DECLARE_profile_cpu(name)
 #define DECLARE_profile_gpu(name)
-#define SCOPE_profile_cpu(name) \
-  do {                          \
-  } while (false)
-#define SCOPE_profile_cpu_f(name) \
-  do {                            \
-  } while (false)
+#define SCOPE_profile_cpu(name) XE_PROFILE_TRACE_SCOPE("cpu", #name)
+#define SCOPE_profile_cpu_f(group_name) \
+  XE_PROFILE_TRACE_SCOPE(group_name, __FUNCTION__)
 #define SCOPE_profile_cpu_i(group_name, scope_name) \
-  do {                                              \
-  } while (false)
+  XE_PROFILE_TRACE_SCOPE(group_name, scope_name)
 #define SCOPE_profile_gpu(name) \
   do {                          \
   } while (false)
@@ -125,6 +136,17 @@ namespace xe {
 
 #endif  // XE_OPTION_PROFILING
 
+// Issues the GPU timestamps of GPU profiling scopes on one thread (and its
+// graphics context). Results are delivered to Profiler::SetGpuTimestamp,
+// possibly frames later; the profiler only reads them a few frames after.
+class ProfilerGpuTimer {
+ public:
+  virtual ~ProfilerGpuTimer() = default;
+
+  // Records the time the GPU reaches this point in its commands as |key|.
+  virtual void InsertTimestamp(uint32_t key) = 0;
+};
+
 class ProfilerDisplay {
  public:
   enum class BoxType {
@@ -140,7 +162,8 @@ class ProfilerDisplay {
   virtual uint32_t width() const = 0;
   virtual uint32_t height() const = 0;
 
-  // TODO(benvanik): GPU timestamping.
+  // Timer for GPU frame boundaries, which are marked when presenting.
+  virtual ProfilerGpuTimer* gpu_timer() { return nullptr; }
 
   virtual void Begin() = 0;
   virtual void End() = 0;
@@ -180,6 +203,14 @@ class Profiler {
   static void OnMouseWheel(int x, int y, int dy);
   static void ToggleDisplay();
   static void TogglePause();
+  // Starts or stops a ProfileTrace capture.
+  static void ToggleTrace();
+
+  // Sets the timer GPU profiling scopes on the calling thread use. Scopes on
+  // threads without one get no GPU time.
+  static void set_thread_gpu_timer(ProfilerGpuTimer* timer);
+  // Stores a timestamp, in nanoseconds, requested from a ProfilerGpuTimer.
+  static void SetGpuTimestamp(uint32_t key, uint64_t timestamp_ns);
 
   // Gets the current display, if any.
   static ProfilerDisplay* display() { return display_.get(); }
@@ -192,6 +223,68 @@ class Profiler {
   static std::unique_ptr<ProfilerDisplay> display_;
 };
 
+// Records CPU profiling scopes from all threads over a time window and writes
+// them out as a Chrome trace event JSON file (chrome://tracing, Perfetto).
+// Works independently of microprofile, so it is also available on platforms
+// without the profiler UI. Scope names must be string literals.
+class ProfileTrace {
+ public:
+  static bool is_active() { return active_.load(std::memory_order_relaxed); }
+
+  // Starts a capture. If |duration_ms| is nonzero it stops by itself.
+  static void Start(uint32_t duration_ms = 0);
+  // Stops the running capture and writes it to the next trace file.
+  static void Stop();
+
+  // Names the calling thread in written traces.
+  static void SetThreadName(const char* name);
+  // Appends a completed scope for the calling thread, optionally with the
+  // hardware counter deltas over the scope.
+  static void Record(const char* group_name, const char* scope_name,
+                     uint64_t start_ticks, uint64_t end_ticks,
+                     const PerfCounters::Values* counters = nullptr);
+
+  // Reads the perf counters of the calling thread if scopes should carry
+  // them (--perf_counters_zones).
+  static bool ReadScopeCounters(PerfCounters::Values* out_values);
+
+ private:
+  static std::atomic<bool> active_;
+};
+
+class ProfileTraceScope {
+ public:
+  ProfileTraceScope(const char* group_name, const char* scope_name) {
+    if (ProfileTrace::is_active()) {
+      group_name_ = group_name;
+      scope_name_ = scope_name;
+      has_counters_ = ProfileTrace::ReadScopeCounters(&start_counters_);
+      start_ticks_ = Clock::QueryHostTickCount();
+    }
+  }
+  ~ProfileTraceScope() {
+    if (scope_name_) {
+      uint64_t end_ticks = Clock::QueryHostTickCount();
+      PerfCounters::Values counters;
+      if (has_counters_ && ProfileTrace::ReadScopeCounters(&counters)) {
+        counters = counters - start_counters_;
+        ProfileTrace::Record(group_name_, scope_name_, start_ticks_,
+                             end_ticks, &counters);
+      } else {
+        ProfileTrace::Record(group_name_, scope_name_, start_ticks_,
+                             end_ticks);
+      }
+    }
+  }
+
+ private:
+  const char* group_name_ = nullptr;
+  const char* scope_name_ = nullptr;
+  uint64_t start_ticks_ = 0;
+  bool has_counters_ = false;
+  PerfCounters::Values start_counters_;
+};
+
 }  // namespace xe
 
 #endif  // XENIA_PROFILING_H_
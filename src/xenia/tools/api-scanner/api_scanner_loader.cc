@@ -8,64 +8,105 @@
  */
 
 #include "api_scanner_loader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/mapped_memory.h"
 #include "xenia/kernel/xam_module.h"
 #include "xenia/kernel/xboxkrnl_module.h"
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
+#include "xenia/vfs/devices/disc_image_device.h"
+#include "xenia/vfs/devices/stfs_container_device.h"
+#include "xenia/vfs/devices/stfs_container_entry.h"
 
 namespace xe {
 namespace tools {
 
+// Every title loads at its own base address, which is the same for most, so
+// loaders take turns with the shared guest memory.
+static std::mutex guest_memory_mutex;
+
 void apiscanner_logger::operator()(const LogType type, const char* szMessage) {
   switch (type) {
     case LT_WARNING:
-      fprintf(stderr, "[W] %s\n", szMessage);
+      fprintf(stderr, "[W] %S: %s\n", target.c_str(), szMessage);
       break;
     case LT_ERROR:
-      fprintf(stderr, "[!] %s\n", szMessage);
+      fprintf(stderr, "[!] %S: %s\n", target.c_str(), szMessage);
       break;
     default:
       break;
   }
 }
 
-apiscanner_loader::apiscanner_loader()
-    : export_resolver(nullptr), memory_(nullptr) {
-  export_resolver = std::make_unique<xe::cpu::ExportResolver>();
+apiscanner_loader::apiscanner_loader(Memory* memory,
+                                     xe::cpu::ExportResolver* export_resolver)
+    : memory_(memory), export_resolver(export_resolver) {}
 
+apiscanner_loader::~apiscanner_loader() = default;
+
+std::unique_ptr<xe::cpu::ExportResolver>
+apiscanner_loader::CreateExportResolver() {
+  auto export_resolver = std::make_unique<xe::cpu::ExportResolver>();
   kernel::XamModule::RegisterExportTable(export_resolver.get());
   kernel::XboxkrnlModule::RegisterExportTable(export_resolver.get());
-
-  memory_ = std::make_unique<Memory>();
-  memory_->Initialize();
+  return export_resolver;
 }
 
-apiscanner_loader::~apiscanner_loader() {
-  if (export_resolver != nullptr) {
-    export_resolver.reset();
+bool apiscanner_loader::LoadTitleImports(const std::wstring& target,
+                                         title* out_title) {
+  log.target = target;
+  std::vector<uint8_t> xex_data;
+  if (!ReadTarget(target, &xex_data)) {
+    return false;
   }
+  return ExtractImports(xex_data.data(), xex_data.size(), *out_title);
+}
 
-  if (memory_ != nullptr) {
-    memory_.reset();
+bool apiscanner_loader::ReadTarget(const std::wstring& target,
+                                   std::vector<uint8_t>* out_data) {
+  // Same guess as Emulator::LaunchPath.
+  auto last_slash = target.find_last_of(xe::kPathSeparator);
+  auto last_dot = target.find_last_of('.');
+  if (last_dot < last_slash) {
+    last_dot = std::wstring::npos;
+  }
+  if (last_dot != std::wstring::npos &&
+      (target.substr(last_dot) == L".xex" ||
+       target.substr(last_dot) == L".elf")) {
+    auto mmap = MappedMemory::Open(target, MappedMemory::Mode::kRead);
+    if (!mmap) {
+      log(log.LT_ERROR, "Could not open xex file");
+      return false;
+    }
+    out_data->assign(mmap->data(), mmap->data() + mmap->size());
+    return true;
   }
-}
 
-bool apiscanner_loader::LoadTitleImports(const std::wstring& target) {
-  auto type(file_system.InferType(target));
-  int result = file_system.InitializeFromPath(type, target);
-  if (result) {
+  auto mount_path = "\\Device\\Cdrom0";
+  bool is_stfs = last_dot == std::wstring::npos;
+  std::unique_ptr<vfs::Device> device;
+  if (is_stfs) {
+    device = std::make_unique<vfs::StfsContainerDevice>(mount_path, target);
+  } else if (vfs::CompressedDiscImageDevice::IsCompressedImage(target)) {
+    device = std::make_unique<vfs::CompressedDiscImageDevice>(mount_path,
+                                                              target);
+  } else {
+    device = std::make_unique<vfs::DiscImageDevice>(mount_path, target);
+  }
+  if (!device->Initialize()) {
     log(log.LT_ERROR, "Could not load target");
     return false;
   }
+  vfs::VirtualFileSystem file_system;
+  file_system.RegisterDevice(std::move(device));
+  file_system.RegisterSymbolicLink("game:", mount_path);
 
-  return ReadTarget();
-}
-
-bool apiscanner_loader::ReadTarget() {
   // XXX Do a wildcard search for all xex files?
-  const char path[] = "game:\\default.xex";
-
-  kernel::XFile* file(nullptr);
-  bool read_result(false);
-  auto fs_entry = file_system.ResolvePath(path);
+  auto fs_entry = file_system.ResolvePath("game:\\default.xex");
   if (!fs_entry) {
     log(log.LT_WARNING, "Could not resolve xex path");
     return false;
@@ -73,73 +114,44 @@ bool apiscanner_loader::ReadTarget() {
 
   // If the FS supports mapping, map the file in and load from that.
   if (fs_entry->can_map()) {
-    auto mmap = fs_entry->CreateMemoryMapping(kernel::fs::Mode::READ, 0, 0);
+    auto mmap = fs_entry->OpenMapped(MappedMemory::Mode::kRead);
     if (!mmap) {
-      if (file) {
-        file->Release();
-      }
       log(log.LT_WARNING, "Could not map filesystem");
       return false;
     }
+    out_data->assign(mmap->data(), mmap->data() + mmap->size());
+    return true;
+  }
 
-    title res;
-    read_result = ExtractImports(mmap->address(), mmap->length(), res);
-    if (read_result) {
-      loaded_titles.push_back(res);
-    }
-  } else {
-    kernel::XFileInfo file_info;
-    if (fs_entry->QueryInfo(&file_info)) {
-      if (file) {
-        file->Release();
-      }
-      log(log.LT_WARNING, "Could not read xex attributes");
-      return false;
-    }
-
-    // Load into memory
-    std::vector<uint8_t> buffer(file_info.file_length);
-
-    // XXX No kernel state again
-    int result = file_system.Open(std::move(fs_entry), nullptr,
-                                  kernel::fs::Mode::READ, false, &file);
-    if (result) {
-      if (file) {
-        file->Release();
-      }
-      log(log.LT_WARNING, "Could not open xex file");
-      return false;
-    }
-
-    size_t bytes_read = 0;
-    result = file->Read(buffer.data(), buffer.size(), 0, &bytes_read);
-    if (result) {
-      if (file) {
-        file->Release();
-      }
-      log(log.LT_ERROR, "Could not read xex data");
-      return false;
-    }
-
-    title res;
-    read_result = ExtractImports(buffer.data(), bytes_read, res);
-    if (read_result) {
-      loaded_titles.push_back(res);
+  // Opening an XFile needs a kernel, so copy the block runs of the container
+  // ourselves.
+  assert_true(is_stfs);
+  auto stfs_entry = static_cast<vfs::StfsContainerEntry*>(fs_entry);
+  out_data->resize(stfs_entry->size());
+  size_t bytes_read = 0;
+  for (auto& record : stfs_entry->block_list()) {
+    if (record.file_offset >= out_data->size()) {
+      break;
     }
+    size_t length =
+        std::min(record.length, out_data->size() - record.file_offset);
+    std::memcpy(out_data->data() + record.file_offset,
+                stfs_entry->mmap()->data() + record.offset, length);
+    bytes_read = record.file_offset + length;
   }
-
-  if (file) {
-    file->Release();
+  if (bytes_read != out_data->size()) {
+    log(log.LT_ERROR, "Could not read xex data");
+    return false;
   }
-
-  return read_result;
+  return true;
 }
 
 bool apiscanner_loader::ExtractImports(const void* addr, const size_t length,
                                        title& info) {
   // Load the XEX into memory and decrypt.
+  std::lock_guard<std::mutex> lock(guest_memory_mutex);
   xe_xex2_options_t xex_options = {0};
-  xe_xex2_ref xex_(xe_xex2_load(memory_.get(), addr, length, xex_options));
+  xe_xex2_ref xex_(xe_xex2_load(memory_, addr, length, xex_options));
   if (!xex_) {
     log(log.LT_ERROR, "Failed to parse xex file");
     return false;
@@ -148,6 +160,7 @@ bool apiscanner_loader::ExtractImports(const void* addr, const size_t length,
   const xe_xex2_header_t* header = xe_xex2_get_header(xex_);
 
   info.title_id = header->execution_info.title_id;
+  info.imports.clear();
 
   // XXX Copy out library versions?
   for (size_t n = 0; n < header->import_library_count; n++) {
@@ -164,17 +177,24 @@ bool apiscanner_loader::ExtractImports(const void* addr, const size_t length,
             library->name, import_info->ordinal);
 
         if ((kernel_export &&
-             kernel_export->type == xe::cpu::KernelExport::Variable) ||
+             kernel_export->type == xe::cpu::Export::Type::kVariable) ||
             import_info->thunk_address) {
-          const std::string named(kernel_export ? kernel_export->name : "");
-          info.imports.push_back(named);
+          info.imports.push_back(
+              {library->name, import_info->ordinal,
+               kernel_export ? kernel_export->name : ""});
         }
       }
     }
   }
 
+  // The image stays in guest memory; release it so that the next title can
+  // load at the same address.
+  uint32_t exe_address = header->exe_address;
   xe_xex2_dealloc(xex_);
-  std::sort(info.imports.begin(), info.imports.end());
+  memory_->LookupHeap(exe_address)->Release(exe_address);
+
+  std::sort(info.imports.begin(), info.imports.end(),
+            [](const import& a, const import& b) { return a.name < b.name; });
 
   return true;
 }
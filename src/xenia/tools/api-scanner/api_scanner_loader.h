@@ -7,16 +7,17 @@
  ******************************************************************************
  */
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "xenia/base/main.h"
 #include "xenia/base/math.h"
 #include "xenia/base/string.h"
 #include "xenia/cpu/export_resolver.h"
-#include "xenia/kernel/fs/filesystem.h"
-#include "xenia/kernel/objects/xfile.h"
 #include "xenia/kernel/util/xex2.h"
 #include "xenia/memory.h"
+#include "xenia/vfs/virtual_file_system.h"
 #include "xenia/xbox.h"
 
 namespace xe {
@@ -26,33 +27,49 @@ class apiscanner_logger {
  public:
   enum LogType { LT_WARNING, LT_ERROR };
 
+  // Messages are prefixed with the target so that parallel scans can be
+  // told apart.
+  std::wstring target;
+
   void operator()(const LogType type, const char* szMessage);
 };
 
+// Loads titles into guest memory, of which only one can exist per process.
+// Loaders on different threads share it: packages are read in parallel and
+// only loading the xex into guest memory is serialized. A loader must only be
+// used by one thread at a time. The export resolver is only read and may be
+// shared between loaders.
 class apiscanner_loader {
  private:
-  kernel::fs::FileSystem file_system;
   apiscanner_logger log;
-  std::unique_ptr<Memory> memory_;
-  std::unique_ptr<xe::cpu::ExportResolver> export_resolver;
+  Memory* memory_;
+  xe::cpu::ExportResolver* export_resolver;
 
  public:
-  apiscanner_loader();
+  apiscanner_loader(Memory* memory, xe::cpu::ExportResolver* export_resolver);
   ~apiscanner_loader();
 
-  bool LoadTitleImports(const std::wstring& target);
+  // Creates a resolver with the kernel export tables registered.
+  static std::unique_ptr<xe::cpu::ExportResolver> CreateExportResolver();
+
+  struct import {
+    std::string library;
+    uint32_t ordinal;
+    // Empty if the export is unknown to us.
+    std::string name;
+  };
 
   struct title {
     uint32_t title_id;
-    std::vector<std::string> imports;
+    std::vector<import> imports;
   };
 
-  const std::vector<title>& GetAllTitles() const { return loaded_titles; }
+  // Mounts an STFS container, disc image or naked xex the same way the
+  // emulator does and reads the imports of its default.xex.
+  bool LoadTitleImports(const std::wstring& target, title* out_title);
 
  private:
-  std::vector<title> loaded_titles;
-
-  bool ReadTarget();
+  bool ReadTarget(const std::wstring& target, std::vector<uint8_t>* out_data);
   bool ExtractImports(const void* addr, const size_t length, title& info);
 };
 
@@ -10,28 +10,251 @@
 #include <gflags/gflags.h>
 #include "api_scanner_loader.h"
 
+#include <cstring>
+#include <mutex>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/thread_pool.h"
+
 namespace xe {
 namespace tools {
 
 DEFINE_string(target, "", "List of file to extract imports from");
+DEFINE_string(target_list, "",
+              "Batch mode: text file with one package path per line.");
+DEFINE_string(target_dir, "",
+              "Batch mode: directory searched recursively for packages (STFS "
+              "containers, .iso images and .xex files).");
+DEFINE_int32(jobs, 0,
+             "Batch mode: packages scanned in parallel. 0 uses the shared "
+             "thread pool size.");
+DEFINE_string(report, "", "Batch mode: file the import report is written to.");
+DEFINE_string(report_format, "csv", "Batch mode: report format, csv or json.");
+
+struct scan_result {
+  std::wstring target;
+  bool loaded;
+  apiscanner_loader::title title;
+};
+
+// Guesses whether a file found in --target_dir is something we can load.
+bool IsPackage(const std::wstring& path) {
+  auto last_slash = path.find_last_of(xe::kPathSeparator);
+  auto last_dot = path.find_last_of('.');
+  if (last_dot != std::wstring::npos && last_dot > last_slash) {
+    auto extension = path.substr(last_dot);
+    return extension == L".iso" || extension == L".xex";
+  }
+  // STFS containers have no extension; check their magic.
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+  char magic[4] = {0};
+  bool is_stfs = fread(magic, sizeof(magic), 1, file) == 1 &&
+                 (!std::memcmp(magic, "CON ", 4) ||
+                  !std::memcmp(magic, "LIVE", 4) ||
+                  !std::memcmp(magic, "PIRS", 4));
+  fclose(file);
+  return is_stfs;
+}
 
-int api_scanner_main(std::vector<std::wstring>& args) {
+void FindPackages(const std::wstring& path,
+                  std::vector<std::wstring>* out_targets) {
+  for (auto& file_info : xe::filesystem::ListFiles(path)) {
+    auto file_path = xe::join_paths(path, file_info.name);
+    if (file_info.type == xe::filesystem::FileInfo::Type::kDirectory) {
+      FindPackages(file_path, out_targets);
+    } else if (IsPackage(file_path)) {
+      out_targets->push_back(file_path);
+    }
+  }
+}
+
+bool ReadTargetList(const std::wstring& path,
+                    std::vector<std::wstring>* out_targets) {
+  FILE* file = xe::filesystem::OpenFile(path, "r");
+  if (!file) {
+    return false;
+  }
+  char line_buffer[4096];
+  while (fgets(line_buffer, sizeof(line_buffer), file)) {
+    std::string line(line_buffer);
+    while (!line.empty() &&
+           (line.back() == '\n' || line.back() == '\r' || line.back() == ' ')) {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      out_targets->push_back(xe::to_absolute_path(xe::to_wstring(line)));
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+std::string EscapeCsv(const std::string& value) {
+  if (value.find_first_of(",\"\n") == std::string::npos) {
+    return value;
+  }
+  std::string escaped = "\"";
+  for (char c : value) {
+    if (c == '"') {
+      escaped += '"';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+std::string EscapeJson(const std::string& value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+// One row per import, plus a row without an import for packages that
+// could not be loaded.
+void WriteCsvReport(FILE* file, const std::vector<scan_result>& results) {
+  fprintf(file, "package,title_id,status,library,ordinal,name\n");
+  for (auto& result : results) {
+    auto package = EscapeCsv(xe::to_string(result.target));
+    if (!result.loaded) {
+      fprintf(file, "%s,,failed,,,\n", package.c_str());
+      continue;
+    }
+    for (auto& import : result.title.imports) {
+      fprintf(file, "%s,%08x,ok,%s,%u,%s\n", package.c_str(),
+              result.title.title_id, EscapeCsv(import.library).c_str(),
+              import.ordinal, EscapeCsv(import.name).c_str());
+    }
+  }
+}
+
+void WriteJsonReport(FILE* file, const std::vector<scan_result>& results) {
+  fprintf(file, "[");
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& result = results[i];
+    fprintf(file, "%s\n  {\"package\": \"%s\", ", i ? "," : "",
+            EscapeJson(xe::to_string(result.target)).c_str());
+    if (!result.loaded) {
+      fprintf(file, "\"status\": \"failed\"}");
+      continue;
+    }
+    fprintf(file, "\"status\": \"ok\", \"title_id\": \"%08x\", \"imports\": [",
+            result.title.title_id);
+    auto& imports = result.title.imports;
+    for (size_t j = 0; j < imports.size(); ++j) {
+      fprintf(file,
+              "%s\n    {\"library\": \"%s\", \"ordinal\": %u, "
+              "\"name\": \"%s\"}",
+              j ? "," : "", EscapeJson(imports[j].library).c_str(),
+              imports[j].ordinal, EscapeJson(imports[j].name).c_str());
+    }
+    fprintf(file, "\n  ]}");
+  }
+  fprintf(file, "\n]\n");
+}
+
+int RunBatch() {
+  std::vector<std::wstring> targets;
+  if (!FLAGS_target_list.empty() &&
+      !ReadTargetList(xe::to_wstring(FLAGS_target_list), &targets)) {
+    fprintf(stderr, "Could not read %s\n", FLAGS_target_list.c_str());
+    return 1;
+  }
+  if (!FLAGS_target_dir.empty()) {
+    FindPackages(xe::to_absolute_path(xe::to_wstring(FLAGS_target_dir)),
+                 &targets);
+  }
+  if (FLAGS_report_format != "csv" && FLAGS_report_format != "json") {
+    fprintf(stderr, "Unknown report format %s\n",
+            FLAGS_report_format.c_str());
+    return 1;
+  }
+
+  // Guest memory is a process wide singleton, so all jobs share it.
+  Memory memory;
+  if (memory.Initialize()) {
+    fprintf(stderr, "Could not initialize guest memory\n");
+    return 1;
+  }
+  auto export_resolver = apiscanner_loader::CreateExportResolver();
+  uint32_t job_count =
+      FLAGS_jobs > 0 ? uint32_t(FLAGS_jobs)
+                     : xe::threading::ThreadPool::global()->worker_count();
+  xe::threading::ThreadPool pool(job_count);
+
+  std::vector<scan_result> results(targets.size());
+  {
+    xe::threading::TaskGroup group(xe::threading::TaskPriority::kNormal,
+                                   &pool);
+    for (size_t i = 0; i < targets.size(); ++i) {
+      group.Run([&, i]() {
+        apiscanner_loader loader(&memory, export_resolver.get());
+        auto& result = results[i];
+        result.target = targets[i];
+        result.loaded = loader.LoadTitleImports(result.target, &result.title);
+      });
+    }
+    group.Wait();
+  }
+
+  size_t loaded_count = 0;
+  for (auto& result : results) {
+    loaded_count += result.loaded ? 1 : 0;
+  }
+  fprintf(stderr, "Scanned %zu of %zu packages\n", loaded_count,
+          results.size());
+
+  FILE* file = stdout;
+  if (!FLAGS_report.empty()) {
+    file = xe::filesystem::OpenFile(xe::to_wstring(FLAGS_report), "w");
+    if (!file) {
+      fprintf(stderr, "Could not write %s\n", FLAGS_report.c_str());
+      return 1;
+    }
+  }
+  if (FLAGS_report_format == "json") {
+    WriteJsonReport(file, results);
+  } else {
+    WriteCsvReport(file, results);
+  }
+  if (file != stdout) {
+    fclose(file);
+  }
+  return 0;
+}
+
+int api_scanner_main(const std::vector<std::wstring>& args) {
   // XXX we need gflags to split multiple flags into arrays for us
 
+  if (!FLAGS_target_list.empty() || !FLAGS_target_dir.empty()) {
+    return RunBatch();
+  }
+
   if (args.size() == 2 || !FLAGS_target.empty()) {
-    apiscanner_loader loader_;
+    Memory memory;
+    if (memory.Initialize()) {
+      fprintf(stderr, "Could not initialize guest memory\n");
+      return 1;
+    }
+    auto export_resolver = apiscanner_loader::CreateExportResolver();
+    apiscanner_loader loader_(&memory, export_resolver.get());
     std::wstring target(FLAGS_target.empty() ? args[1]
                                              : xe::to_wstring(FLAGS_target));
 
     std::wstring target_abs = xe::to_absolute_path(target);
 
-    // XXX For each target?
-    if (loader_.LoadTitleImports(target)) {
-      for (const auto title : loader_.GetAllTitles()) {
-        printf("%08x\n", title.title_id);
-        for (const auto import : title.imports) {
-          printf("\t%s\n", import.c_str());
-        }
+    apiscanner_loader::title title;
+    if (loader_.LoadTitleImports(target_abs, &title)) {
+      printf("%08x\n", title.title_id);
+      for (const auto& import : title.imports) {
+        printf("\t%s\n", import.name.c_str());
       }
     }
   }
@@ -42,5 +265,7 @@ int api_scanner_main(std::vector<std::wstring>& args) {
 }  // namespace tools
 }  // namespace xe
 
-DEFINE_ENTRY_POINT(L"api-scanner", L"api-scanner --target=<target file>",
+DEFINE_ENTRY_POINT(L"api-scanner",
+                   L"api-scanner --target=<target file> | "
+                   L"--target_list=<file> | --target_dir=<dir>",
                    xe::tools::api_scanner_main);
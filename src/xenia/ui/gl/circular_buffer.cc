@@ -21,7 +21,9 @@ namespace gl {
 CircularBuffer::CircularBuffer(size_t capacity, size_t alignment)
     : capacity_(capacity),
       alignment_(alignment),
-      write_head_(0),
+      write_position_(0),
+      read_position_(0),
+      fenced_position_(0),
       dirty_start_(UINT64_MAX),
       dirty_end_(0),
       buffer_(0),
@@ -49,6 +51,10 @@ void CircularBuffer::Shutdown() {
   if (!buffer_) {
     return;
   }
+  for (auto& fence : fences_) {
+    glDeleteSync(fence.sync);
+  }
+  fences_.clear();
   glUnmapNamedBuffer(buffer_);
   glDeleteBuffers(1, &buffer_);
   buffer_ = 0;
@@ -56,26 +62,36 @@ void CircularBuffer::Shutdown() {
 
 bool CircularBuffer::CanAcquire(size_t length) {
   size_t aligned_length = xe::round_up(length, alignment_);
-  return write_head_ + aligned_length <= capacity_;
+  return write_position_ % capacity_ + aligned_length <= capacity_;
 }
 
 CircularBuffer::Allocation CircularBuffer::Acquire(size_t length) {
   // Addresses must always be % 256.
   size_t aligned_length = xe::round_up(length, alignment_);
   assert_true(aligned_length <= capacity_, "Request too large");
-  if (write_head_ + aligned_length > capacity_) {
-    // Flush and wait.
-    WaitUntilClean();
+
+  size_t offset = write_position_ % capacity_;
+  if (offset + aligned_length > capacity_) {
+    // Skip the tail so the allocation is contiguous. Cached data from the
+    // previous lap is about to be overwritten.
+    Flush();
+    ClearCache();
+    write_position_ += capacity_ - offset;
+    offset = 0;
+  }
+  uint64_t end_position = write_position_ + aligned_length;
+  if (end_position - read_position_ > capacity_) {
+    RetireFences(end_position - capacity_, true);
   }
 
   Allocation allocation;
-  allocation.host_ptr = host_base_ + write_head_;
-  allocation.gpu_ptr = gpu_base_ + write_head_;
-  allocation.offset = write_head_;
+  allocation.host_ptr = host_base_ + offset;
+  allocation.gpu_ptr = gpu_base_ + offset;
+  allocation.offset = offset;
   allocation.length = length;
   allocation.aligned_length = aligned_length;
   allocation.cache_key = 0;
-  write_head_ += aligned_length;
+  write_position_ = end_position;
   return allocation;
 }
 
@@ -83,17 +99,20 @@ bool CircularBuffer::AcquireCached(uint32_t key, size_t length,
                                    Allocation* out_allocation) {
   uint64_t full_key = key | (length << 32);
   auto it = allocation_cache_.find(full_key);
-  if (it != allocation_cache_.end()) {
-    uintptr_t write_head = it->second;
+  if (it != allocation_cache_.end() && it->second >= fenced_position_) {
+    size_t offset = it->second % capacity_;
     size_t aligned_length = xe::round_up(length, alignment_);
-    out_allocation->host_ptr = host_base_ + write_head;
-    out_allocation->gpu_ptr = gpu_base_ + write_head;
-    out_allocation->offset = write_head;
+    out_allocation->host_ptr = host_base_ + offset;
+    out_allocation->gpu_ptr = gpu_base_ + offset;
+    out_allocation->offset = offset;
     out_allocation->length = length;
     out_allocation->aligned_length = aligned_length;
     out_allocation->cache_key = full_key;
     return true;
   } else {
+    if (it != allocation_cache_.end()) {
+      allocation_cache_.erase(it);
+    }
     *out_allocation = Acquire(length);
     out_allocation->cache_key = full_key;
     return false;
@@ -101,7 +120,7 @@ bool CircularBuffer::AcquireCached(uint32_t key, size_t length,
 }
 
 void CircularBuffer::Discard(Allocation allocation) {
-  write_head_ -= allocation.aligned_length;
+  write_position_ -= allocation.aligned_length;
 }
 
 void CircularBuffer::Commit(Allocation allocation) {
@@ -111,7 +130,13 @@ void CircularBuffer::Commit(Allocation allocation) {
   dirty_end_ = std::max(dirty_end_, end);
   assert_true(dirty_end_ <= capacity_);
   if (allocation.cache_key) {
-    allocation_cache_.insert({allocation.cache_key, allocation.offset});
+    // Position of the allocation in the lap it was made in.
+    uint64_t position =
+        write_position_ - (write_position_ % capacity_) + allocation.offset;
+    if (position + allocation.aligned_length > write_position_) {
+      position -= capacity_;
+    }
+    allocation_cache_.insert({allocation.cache_key, position});
   }
 }
 
@@ -127,11 +152,46 @@ void CircularBuffer::Flush() {
 
 void CircularBuffer::ClearCache() { allocation_cache_.clear(); }
 
+void CircularBuffer::InsertFence() {
+  if (write_position_ == fenced_position_) {
+    return;
+  }
+  // Cheaply drop whatever the GPU has already finished with so the list of
+  // fences stays short.
+  RetireFences(write_position_, false);
+  Fence fence;
+  fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  fence.write_position = write_position_;
+  fences_.push_back(fence);
+  fenced_position_ = write_position_;
+}
+
+void CircularBuffer::RetireFences(uint64_t position, bool wait) {
+  while (read_position_ < position) {
+    if (fences_.empty()) {
+      if (!wait) {
+        return;
+      }
+      // Everything in use was written since the last fence, so there's
+      // nothing to do but drain the GPU.
+      InsertFence();
+      continue;
+    }
+    auto& fence = fences_.front();
+    GLenum result = glClientWaitSync(fence.sync, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                     wait ? GL_TIMEOUT_IGNORED : 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+      return;
+    }
+    glDeleteSync(fence.sync);
+    read_position_ = fence.write_position;
+    fences_.pop_front();
+  }
+}
+
 void CircularBuffer::WaitUntilClean() {
   Flush();
-  glFinish();
-  write_head_ = 0;
-  ClearCache();
+  RetireFences(write_position_, true);
 }
 
 }  // namespace gl
@@ -10,6 +10,7 @@
 #ifndef XENIA_UI_GL_CIRCULAR_BUFFER_H_
 #define XENIA_UI_GL_CIRCULAR_BUFFER_H_
 
+#include <deque>
 #include <unordered_map>
 
 #include "xenia/ui/gl/gl.h"
@@ -18,8 +19,11 @@ namespace xe {
 namespace ui {
 namespace gl {
 
-// TODO(benvanik): uh, make this circular.
-// TODO(benvanik): fences to prevent this from ever flushing.
+// Persistently mapped ring buffer for streaming data to the GPU.
+// Users call InsertFence after submitting commands reading what they have
+// written (such as at the end of each frame). When the write head catches
+// up with data the GPU may still be reading, Acquire waits only on the
+// oldest fences that cover the space it needs, rather than the whole GPU.
 class CircularBuffer {
  public:
   CircularBuffer(size_t capacity, size_t alignment = 256);
@@ -41,7 +45,12 @@ class CircularBuffer {
   GLuint64 gpu_handle() const { return gpu_base_; }
   size_t capacity() const { return capacity_; }
 
+  // Whether the allocation fits contiguously before the buffer wraps.
+  // Allocations made after a false result start over at the beginning, so
+  // users needing contiguous ranges should flush them first.
   bool CanAcquire(size_t length);
+  // Allocates space for writing, waiting for the GPU if it is still using
+  // it.
   Allocation Acquire(size_t length);
   bool AcquireCached(uint32_t key, size_t length, Allocation* out_allocation);
   void Discard(Allocation allocation);
@@ -49,19 +58,40 @@ class CircularBuffer {
   void Flush();
   void ClearCache();
 
+  // Fences everything acquired so far against GPU commands issued so far.
+  void InsertFence();
+  // Waits until the GPU is done with all data in the buffer.
   void WaitUntilClean();
 
  private:
+  struct Fence {
+    GLsync sync;
+    // Write position at the time the fence was inserted.
+    uint64_t write_position;
+  };
+
+  // Retires fences in order until at least position is no longer in use.
+  // With wait false only already-signaled fences are retired.
+  void RetireFences(uint64_t position, bool wait);
+
   size_t capacity_;
   size_t alignment_;
-  uintptr_t write_head_;
+  // Positions count bytes ever allocated; offsets are position % capacity.
+  // Everything between the read and write positions may still be in use by
+  // the GPU.
+  uint64_t write_position_;
+  uint64_t read_position_;
+  uint64_t fenced_position_;
+  std::deque<Fence> fences_;
   uintptr_t dirty_start_;
   uintptr_t dirty_end_;
   GLuint buffer_;
   GLuint64 gpu_base_;
   uint8_t* host_base_;
 
-  std::unordered_map<uint64_t, uintptr_t> allocation_cache_;
+  // Cached positions by key. Only entries written after the last fence are
+  // reused so that every use is covered by a later fence.
+  std::unordered_map<uint64_t, uint64_t> allocation_cache_;
 };
 
 }  // namespace gl
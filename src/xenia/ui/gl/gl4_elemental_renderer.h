@@ -14,7 +14,6 @@
 #include <memory>
 
 #include "el/graphics/renderer.h"
-#include "xenia/ui/gl/circular_buffer.h"
 #include "xenia/ui/gl/gl_context.h"
 
 namespace xe {
@@ -58,25 +57,11 @@ class GL4ElementalRenderer : public el::graphics::Renderer {
 
   static const uint32_t kMaxVertexBatchSize = 6 * 2048;
 
-  bool Initialize();
-  void Flush();
-
   size_t max_vertex_batch_size() const override { return kMaxVertexBatchSize; }
 
   GLContext* context_ = nullptr;
+  ImmediateDrawer* drawer_ = nullptr;
 
-  GLuint program_ = 0;
-  GLuint vao_ = 0;
-  CircularBuffer vertex_buffer_;
-
-  static const size_t kMaxCommands = 512;
-  struct {
-    GLenum prim_type;
-    size_t vertex_offset;
-    size_t vertex_count;
-  } draw_commands_[kMaxCommands] = {{0}};
-  uint32_t draw_command_count_ = 0;
-  GL4Bitmap* current_bitmap_ = nullptr;
   Vertex vertices_[kMaxVertexBatchSize];
 };
 
@@ -82,6 +82,7 @@ GLContext::GLContext(Window* target_window, HGLRC glrc)
 
 GLContext::~GLContext() {
   MakeCurrent();
+  immediate_drawer_.Shutdown();
   blitter_.Shutdown();
   ClearCurrent();
   if (glrc_) {
@@ -184,6 +185,12 @@ bool GLContext::Initialize(Window* target_window) {
     return false;
   }
 
+  if (!immediate_drawer_.Initialize()) {
+    FatalGLError("Unable to initialize immediate drawer.");
+    ClearCurrent();
+    return false;
+  }
+
   ClearCurrent();
 
   return true;
@@ -407,7 +414,7 @@ void GLContext::SetupDebugging() {
 }
 
 std::unique_ptr<ProfilerDisplay> GLContext::CreateProfilerDisplay() {
-  return std::make_unique<GLProfilerDisplay>(target_window_);
+  return std::make_unique<GLProfilerDisplay>(this);
 }
 
 std::unique_ptr<el::graphics::Renderer> GLContext::CreateElementalRenderer() {
@@ -16,6 +16,7 @@
 
 #include "xenia/ui/gl/blitter.h"
 #include "xenia/ui/gl/gl.h"
+#include "xenia/ui/gl/immediate_drawer.h"
 #include "xenia/ui/graphics_context.h"
 
 DECLARE_bool(thread_safe_gl);
@@ -47,6 +48,8 @@ class GLContext : public GraphicsContext {
   void EndSwap() override;
 
   Blitter* blitter() { return &blitter_; }
+  // Only on the window context (not shared ones).
+  ImmediateDrawer* immediate_drawer() { return &immediate_drawer_; }
 
  private:
   explicit GLContext(Window* target_window);
@@ -71,6 +74,7 @@ class GLContext : public GraphicsContext {
   std::unique_ptr<WGLEWContext> wglew_context_;
 
   Blitter blitter_;
+  ImmediateDrawer immediate_drawer_;
 };
 
 }  // namespace gl
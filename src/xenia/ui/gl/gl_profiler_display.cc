@@ -10,13 +10,14 @@
 #include "xenia/ui/gl/gl_profiler_display.h"
 
 #include <algorithm>
-#include <string>
 
 #include "third_party/microprofile/microprofile.h"
 #include "third_party/microprofile/microprofileui.h"
 
 #include "xenia/base/assert.h"
 #include "xenia/base/math.h"
+#include "xenia/ui/gl/gl_context.h"
+#include "xenia/ui/gl/immediate_drawer.h"
 
 namespace xe {
 namespace ui {
@@ -136,11 +137,10 @@ const uint8_t profiler_font[] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 };
 
-GLProfilerDisplay::GLProfilerDisplay(xe::ui::Window* window)
-    : window_(window),
-      vertex_buffer_(MICROPROFILE_MAX_VERTICES * sizeof(Vertex) * 10,
-                     sizeof(Vertex)) {
-  if (!SetupFont() || !SetupState() || !SetupShaders()) {
+GLProfilerDisplay::GLProfilerDisplay(GLContext* context)
+    : window_(context->target_window()),
+      drawer_(context->immediate_drawer()) {
+  if (!SetupFont()) {
     // Hrm.
     assert_always();
   }
@@ -234,6 +234,15 @@ bool GLProfilerDisplay::SetupFont() {
       b <<= 1;
     }
   }
+  // Bake in the drop shadow: texels just above a glyph are opaque black.
+  for (int y = 0; y < FONT_TEX_Y - 1; ++y) {
+    for (int x = 0; x < FONT_TEX_X; ++x) {
+      uint32_t& texel = unpacked[y * FONT_TEX_X + x];
+      if (!texel && unpacked[(y + 1) * FONT_TEX_X + x] == 0xFFFFFFFFu) {
+        texel = 0xFF000000u;
+      }
+    }
+  }
 
   glCreateTextures(GL_TEXTURE_2D, 1, &font_texture_);
   glTextureParameteri(font_texture_, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -250,107 +259,10 @@ bool GLProfilerDisplay::SetupFont() {
   return true;
 }
 
-bool GLProfilerDisplay::SetupState() {
-  if (!vertex_buffer_.Initialize()) {
-    return false;
-  }
-  return true;
-}
-
-bool GLProfilerDisplay::SetupShaders() {
-  const std::string header =
-      R"(
-#version 450
-#extension GL_ARB_bindless_texture : require
-#extension GL_ARB_explicit_uniform_location : require
-#extension GL_ARB_shading_language_420pack : require
-precision highp float;
-precision highp int;
-layout(std140, column_major) uniform;
-layout(std430, column_major) buffer;
-)";
-  const std::string vertex_shader_source = header +
-                                           R"(
-layout(location = 0) uniform mat4 projection_matrix;
-layout(location = 0) in vec2 in_pos;
-layout(location = 1) in vec4 in_color;
-layout(location = 2) in vec2 in_uv;
-layout(location = 0) out vec4 vtx_color;
-layout(location = 1) out vec2 vtx_uv;
-void main() {
-  gl_Position = projection_matrix * vec4(in_pos.xy, 0.0, 1.0);
-  vtx_color = in_color;
-  vtx_uv = in_uv;
-})";
-  const std::string fragment_shader_source = header +
-                                             R"(
-layout(location = 1, bindless_sampler) uniform sampler2D font_texture;
-layout(location = 2) uniform float font_height;
-layout(location = 0) in vec4 vtx_color;
-layout(location = 1) in vec2 vtx_uv;
-layout(location = 0) out vec4 oC;
-void main() {
-  if (vtx_uv.x > 1.0) {
-    oC = vtx_color;
-  } else {
-    vec4 color = texture(font_texture, vtx_uv);
-    oC = color.rgba * vtx_color;
-    if (color.a < 0.5) {
-      vec4 c1 = texture(font_texture, vtx_uv + vec2(0.0, font_height));
-      oC = vec4(0, 0, 0, c1.a);
-    }
-  }
-})";
-
-  GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  const char* vertex_shader_source_ptr = vertex_shader_source.c_str();
-  GLint vertex_shader_source_length = GLint(vertex_shader_source.size());
-  glShaderSource(vertex_shader, 1, &vertex_shader_source_ptr,
-                 &vertex_shader_source_length);
-  glCompileShader(vertex_shader);
-
-  GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  const char* fragment_shader_source_ptr = fragment_shader_source.c_str();
-  GLint fragment_shader_source_length = GLint(fragment_shader_source.size());
-  glShaderSource(fragment_shader, 1, &fragment_shader_source_ptr,
-                 &fragment_shader_source_length);
-  glCompileShader(fragment_shader);
-
-  program_ = glCreateProgram();
-  glAttachShader(program_, vertex_shader);
-  glAttachShader(program_, fragment_shader);
-  glLinkProgram(program_);
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
-
-  glProgramUniformHandleui64ARB(program_, 1, font_handle_);
-  glProgramUniform1f(program_, 2, 1.0f / FONT_TEX_Y);
-
-  glCreateVertexArrays(1, &vao_);
-  glEnableVertexArrayAttrib(vao_, 0);
-  glVertexArrayAttribBinding(vao_, 0, 0);
-  glVertexArrayAttribFormat(vao_, 0, 2, GL_FLOAT, GL_FALSE,
-                            offsetof(Vertex, x));
-  glEnableVertexArrayAttrib(vao_, 1);
-  glVertexArrayAttribBinding(vao_, 1, 0);
-  glVertexArrayAttribFormat(vao_, 1, 4, GL_UNSIGNED_BYTE, GL_TRUE,
-                            offsetof(Vertex, color));
-  glEnableVertexArrayAttrib(vao_, 2);
-  glVertexArrayAttribBinding(vao_, 2, 0);
-  glVertexArrayAttribFormat(vao_, 2, 2, GL_FLOAT, GL_FALSE,
-                            offsetof(Vertex, u));
-  glVertexArrayVertexBuffer(vao_, 0, vertex_buffer_.handle(), 0,
-                            sizeof(Vertex));
-
-  return true;
-}
-
 GLProfilerDisplay::~GLProfilerDisplay() {
-  vertex_buffer_.Shutdown();
+  gpu_timer_.Shutdown();
   glMakeTextureHandleNonResidentARB(font_handle_);
   glDeleteTextures(1, &font_texture_);
-  glDeleteVertexArrays(1, &vao_);
-  glDeleteProgram(program_);
 }
 
 uint32_t GLProfilerDisplay::width() const { return window_->width(); }
@@ -358,88 +270,17 @@ uint32_t GLProfilerDisplay::width() const { return window_->width(); }
 uint32_t GLProfilerDisplay::height() const { return window_->height(); }
 
 void GLProfilerDisplay::Begin() {
-  glEnablei(GL_BLEND, 0);
-  glBlendFunci(0, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glDisable(GL_DEPTH_TEST);
-  glDisable(GL_STENCIL_TEST);
-  glDisable(GL_SCISSOR_TEST);
-
-  glViewport(0, 0, width(), height());
-
-  float left = 0.0f;
-  float right = static_cast<float>(width());
-  float bottom = static_cast<float>(height());
-  float top = 0.0f;
-  float z_near = -1.0f;
-  float z_far = 1.0f;
-  float projection[16] = {0};
-  projection[0] = 2.0f / (right - left);
-  projection[5] = 2.0f / (top - bottom);
-  projection[10] = -2.0f / (z_far - z_near);
-  projection[12] = -(right + left) / (right - left);
-  projection[13] = -(top + bottom) / (top - bottom);
-  projection[14] = -(z_far + z_near) / (z_far - z_near);
-  projection[15] = 1.0f;
-  glProgramUniformMatrix4fv(program_, 0, 1, GL_FALSE, projection);
-
-  glUseProgram(program_);
-  glBindVertexArray(vao_);
-}
+  // Frame start timestamps from earlier presents.
+  gpu_timer_.Poll();
 
-void GLProfilerDisplay::End() {
-  Flush();
-  glUseProgram(0);
-  glBindVertexArray(0);
+  drawer_->Begin(width(), height());
 }
 
-GLProfilerDisplay::Vertex* GLProfilerDisplay::BeginVertices(size_t count) {
-  if (draw_command_count_ + 1 > kMaxCommands) {
-    Flush();
-  }
-  size_t total_length = sizeof(Vertex) * count;
-  if (!vertex_buffer_.CanAcquire(total_length)) {
-    Flush();
-  }
-  current_allocation_ = vertex_buffer_.Acquire(total_length);
-  return reinterpret_cast<Vertex*>(current_allocation_.host_ptr);
-}
-
-void GLProfilerDisplay::EndVertices(GLenum prim_type) {
-  size_t vertex_count = current_allocation_.length / sizeof(Vertex);
-
-  if (draw_command_count_ &&
-      draw_commands_[draw_command_count_ - 1].prim_type == prim_type) {
-    // Coalesce.
-    auto& prev_command = draw_commands_[draw_command_count_ - 1];
-    prev_command.vertex_count += vertex_count;
-  } else {
-    auto& command = draw_commands_[draw_command_count_++];
-    command.prim_type = prim_type;
-    command.vertex_offset = current_allocation_.offset / sizeof(Vertex);
-    command.vertex_count = vertex_count;
-  }
-
-  vertex_buffer_.Commit(std::move(current_allocation_));
-}
-
-void GLProfilerDisplay::Flush() {
-  if (!draw_command_count_) {
-    return;
-  }
-  vertex_buffer_.Flush();
-  for (size_t i = 0; i < draw_command_count_; ++i) {
-    glDrawArrays(draw_commands_[i].prim_type,
-                 GLint(draw_commands_[i].vertex_offset),
-                 GLsizei(draw_commands_[i].vertex_count));
-  }
-  draw_command_count_ = 0;
-  // TODO(benvanik): don't finish here.
-  vertex_buffer_.WaitUntilClean();
-}
+void GLProfilerDisplay::End() { drawer_->End(); }
 
 void GLProfilerDisplay::DrawBox(int x0, int y0, int x1, int y1, uint32_t color,
                                 BoxType type) {
-  auto v = BeginVertices(6);
+  auto v = drawer_->BeginVertices(GL_TRIANGLES, 0, 6);
   if (type == BoxType::kFlat) {
     color =
         ((color & 0xff) << 16) | ((color >> 16) & 0xff) | (0xff00ff00 & color);
@@ -500,7 +341,7 @@ void GLProfilerDisplay::DrawBox(int x0, int y0, int x1, int y1, uint32_t color,
     Q3(v, u, 2.0f);
     Q3(v, v, 3.0f);
   }
-  EndVertices(GL_TRIANGLES);
+  drawer_->EndVertices();
 }
 
 void GLProfilerDisplay::DrawLine2D(uint32_t count, float* vertices,
@@ -508,7 +349,7 @@ void GLProfilerDisplay::DrawLine2D(uint32_t count, float* vertices,
   if (!count || !vertices) {
     return;
   }
-  auto v = BeginVertices(2 * (count - 1));
+  auto v = drawer_->BeginVertices(GL_LINES, 0, 2 * (count - 1));
   color = 0xff000000 | ((color & 0xff) << 16) | (color & 0xff00ff00) |
           ((color >> 16) & 0xff);
   for (uint32_t i = 0; i < count - 1; ++i) {
@@ -524,7 +365,7 @@ void GLProfilerDisplay::DrawLine2D(uint32_t count, float* vertices,
     v[1].v = 2.0f;
     v += 2;
   }
-  EndVertices(GL_LINES);
+  drawer_->EndVertices();
 }
 
 void GLProfilerDisplay::DrawText(int x, int y, uint32_t color, const char* text,
@@ -538,7 +379,8 @@ void GLProfilerDisplay::DrawText(int x, int y, uint32_t color, const char* text,
   float fY = static_cast<float>(y);
   float fY2 = fY + (MICROPROFILE_TEXT_HEIGHT + 1);
 
-  auto v = BeginVertices(6 * text_length);
+  auto v =
+      drawer_->BeginVertices(GL_TRIANGLES, font_handle_, 6 * text_length);
   const char* pStr = text;
   color = 0xff000000 | ((color & 0xff) << 16) | (color & 0xff00) |
           ((color >> 16) & 0xff);
@@ -574,7 +416,7 @@ void GLProfilerDisplay::DrawText(int x, int y, uint32_t color, const char* text,
     v += 6;
   }
 
-  EndVertices(GL_TRIANGLES);
+  drawer_->EndVertices();
 }
 
 }  // namespace gl
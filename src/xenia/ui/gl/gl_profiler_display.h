@@ -11,22 +11,25 @@
 #define XENIA_UI_GL_GL_PROFILER_DISPLAY_H_
 
 #include "xenia/profiling.h"
-#include "xenia/ui/gl/circular_buffer.h"
+#include "xenia/ui/gl/gpu_timer.h"
 #include "xenia/ui/window.h"
 
 namespace xe {
 namespace ui {
 namespace gl {
 
+class GLContext;
+class ImmediateDrawer;
+
 class GLProfilerDisplay : public ProfilerDisplay {
  public:
-  explicit GLProfilerDisplay(xe::ui::Window* window);
+  explicit GLProfilerDisplay(GLContext* context);
   virtual ~GLProfilerDisplay();
 
   uint32_t width() const override;
   uint32_t height() const override;
 
-  // TODO(benvanik): GPU timestamping.
+  ProfilerGpuTimer* gpu_timer() override { return &gpu_timer_; }
 
   void Begin() override;
   void End() override;
@@ -37,38 +40,13 @@ class GLProfilerDisplay : public ProfilerDisplay {
                 size_t text_length) override;
 
  private:
-  struct Vertex {
-    float x;
-    float y;
-    uint32_t color;
-    float u;
-    float v;
-  };
-
   bool SetupFont();
-  bool SetupState();
-  bool SetupShaders();
-
-  Vertex* BeginVertices(size_t count);
-  void EndVertices(GLenum prim_type);
-  void Flush();
 
   xe::ui::Window* window_ = nullptr;
-  GLuint program_ = 0;
-  GLuint vao_ = 0;
+  ImmediateDrawer* drawer_ = nullptr;
   GLuint font_texture_ = 0;
   GLuint64 font_handle_ = 0;
-  CircularBuffer vertex_buffer_;
-
-  static const size_t kMaxCommands = 32;
-  struct {
-    GLenum prim_type;
-    size_t vertex_offset;
-    size_t vertex_count;
-  } draw_commands_[kMaxCommands];
-  uint32_t draw_command_count_ = 0;
-
-  CircularBuffer::Allocation current_allocation_;
+  GpuTimer gpu_timer_;
 
   struct {
     uint16_t char_offsets[256];
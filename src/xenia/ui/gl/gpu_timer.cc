@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/ui/gl/gpu_timer.h"
+
+namespace xe {
+namespace ui {
+namespace gl {
+
+// Beyond this many unresolved queries (if nothing polls) new timestamps are
+// dropped and read as 0.
+const size_t kMaxPendingQueries = 16 * 1024;
+
+GpuTimer::GpuTimer() = default;
+
+GpuTimer::~GpuTimer() = default;
+
+void GpuTimer::Shutdown() {
+  for (auto& pending : pending_queries_) {
+    glDeleteQueries(1, &pending.query);
+  }
+  pending_queries_.clear();
+  if (!free_queries_.empty()) {
+    glDeleteQueries(static_cast<GLsizei>(free_queries_.size()),
+                    free_queries_.data());
+    free_queries_.clear();
+  }
+}
+
+void GpuTimer::InsertTimestamp(uint32_t key) {
+  if (pending_queries_.size() >= kMaxPendingQueries) {
+    return;
+  }
+  GLuint query;
+  if (free_queries_.empty()) {
+    glCreateQueries(GL_TIMESTAMP, 1, &query);
+  } else {
+    query = free_queries_.back();
+    free_queries_.pop_back();
+  }
+  glQueryCounter(query, GL_TIMESTAMP);
+  pending_queries_.push_back({query, key});
+}
+
+void GpuTimer::Poll() {
+  while (!pending_queries_.empty()) {
+    auto& pending = pending_queries_.front();
+    GLint available = 0;
+    glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+    GLuint64 timestamp = 0;
+    glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &timestamp);
+    Profiler::SetGpuTimestamp(pending.key, timestamp);
+    free_queries_.push_back(pending.query);
+    pending_queries_.pop_front();
+  }
+}
+
+}  // namespace gl
+}  // namespace ui
+}  // namespace xe
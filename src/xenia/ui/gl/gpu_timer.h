@@ -0,0 +1,52 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_UI_GL_GPU_TIMER_H_
+#define XENIA_UI_GL_GPU_TIMER_H_
+
+#include <deque>
+#include <vector>
+
+#include "xenia/profiling.h"
+#include "xenia/ui/gl/gl.h"
+
+namespace xe {
+namespace ui {
+namespace gl {
+
+// Times GPU profiling scopes with GL timestamp queries. Queries belong to the
+// context they are issued on, so each context needs its own timer, polled on
+// the thread it is current on.
+class GpuTimer : public ProfilerGpuTimer {
+ public:
+  GpuTimer();
+  ~GpuTimer() override;
+
+  // Deletes all queries. The context must be current.
+  void Shutdown();
+
+  void InsertTimestamp(uint32_t key) override;
+  // Hands completed timestamps to the profiler, without waiting on any.
+  void Poll();
+
+ private:
+  struct PendingQuery {
+    GLuint query;
+    uint32_t key;
+  };
+  // Queries complete in order, so only the oldest needs checking.
+  std::deque<PendingQuery> pending_queries_;
+  std::vector<GLuint> free_queries_;
+};
+
+}  // namespace gl
+}  // namespace ui
+}  // namespace xe
+
+#endif  // XENIA_UI_GL_GPU_TIMER_H_
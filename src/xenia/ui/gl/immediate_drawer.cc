@@ -0,0 +1,246 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/ui/gl/immediate_drawer.h"
+
+#include <cstring>
+#include <string>
+
+#include "xenia/base/assert.h"
+#include "xenia/profiling.h"
+
+namespace xe {
+namespace ui {
+namespace gl {
+
+// Enough for the profiler with everything expanded, so that frames never
+// need to wait for the ring to wrap.
+const size_t kVertexBufferCapacity = 4 * 1024 * 1024;
+
+ImmediateDrawer::ImmediateDrawer()
+    : vertex_buffer_(kVertexBufferCapacity, sizeof(Vertex)) {}
+
+ImmediateDrawer::~ImmediateDrawer() = default;
+
+bool ImmediateDrawer::Initialize() {
+  if (!vertex_buffer_.Initialize()) {
+    return false;
+  }
+
+  const std::string header =
+      R"(
+#version 450
+#extension GL_ARB_bindless_texture : require
+#extension GL_ARB_explicit_uniform_location : require
+#extension GL_ARB_shading_language_420pack : require
+precision highp float;
+precision highp int;
+layout(std140, column_major) uniform;
+layout(std430, column_major) buffer;
+)";
+  const std::string vertex_shader_source = header +
+                                           R"(
+layout(location = 0) uniform mat4 projection_matrix;
+layout(location = 0) in vec2 in_pos;
+layout(location = 1) in vec4 in_color;
+layout(location = 2) in vec2 in_uv;
+layout(location = 0) out vec4 vtx_color;
+layout(location = 1) out vec2 vtx_uv;
+void main() {
+  gl_Position = projection_matrix * vec4(in_pos.xy, 0.0, 1.0);
+  vtx_color = in_color;
+  vtx_uv = in_uv;
+})";
+  const std::string fragment_shader_source = header +
+                                             R"(
+layout(location = 1, bindless_sampler) uniform sampler2D texture_sampler;
+layout(location = 0) in vec4 vtx_color;
+layout(location = 1) in vec2 vtx_uv;
+layout(location = 0) out vec4 oC;
+void main() {
+  oC = vtx_color;
+  if (vtx_uv.x <= 1.0) {
+    oC *= texture(texture_sampler, vtx_uv);
+  }
+})";
+
+  GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+  const char* vertex_shader_source_ptr = vertex_shader_source.c_str();
+  GLint vertex_shader_source_length = GLint(vertex_shader_source.size());
+  glShaderSource(vertex_shader, 1, &vertex_shader_source_ptr,
+                 &vertex_shader_source_length);
+  glCompileShader(vertex_shader);
+
+  GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+  const char* fragment_shader_source_ptr = fragment_shader_source.c_str();
+  GLint fragment_shader_source_length = GLint(fragment_shader_source.size());
+  glShaderSource(fragment_shader, 1, &fragment_shader_source_ptr,
+                 &fragment_shader_source_length);
+  glCompileShader(fragment_shader);
+
+  program_ = glCreateProgram();
+  glAttachShader(program_, vertex_shader);
+  glAttachShader(program_, fragment_shader);
+  glLinkProgram(program_);
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+
+  glCreateVertexArrays(1, &vao_);
+  glEnableVertexArrayAttrib(vao_, 0);
+  glVertexArrayAttribBinding(vao_, 0, 0);
+  glVertexArrayAttribFormat(vao_, 0, 2, GL_FLOAT, GL_FALSE,
+                            offsetof(Vertex, x));
+  glEnableVertexArrayAttrib(vao_, 1);
+  glVertexArrayAttribBinding(vao_, 1, 0);
+  glVertexArrayAttribFormat(vao_, 1, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                            offsetof(Vertex, color));
+  glEnableVertexArrayAttrib(vao_, 2);
+  glVertexArrayAttribBinding(vao_, 2, 0);
+  glVertexArrayAttribFormat(vao_, 2, 2, GL_FLOAT, GL_FALSE,
+                            offsetof(Vertex, u));
+  glVertexArrayVertexBuffer(vao_, 0, vertex_buffer_.handle(), 0,
+                            sizeof(Vertex));
+
+  return true;
+}
+
+void ImmediateDrawer::Shutdown() {
+  if (!program_) {
+    return;
+  }
+  vertex_buffer_.Shutdown();
+  glDeleteVertexArrays(1, &vao_);
+  glDeleteProgram(program_);
+  vao_ = 0;
+  program_ = 0;
+}
+
+void ImmediateDrawer::Begin(int render_target_width,
+                            int render_target_height) {
+  glEnablei(GL_BLEND, 0);
+  glBlendFunci(0, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_STENCIL_TEST);
+  glEnable(GL_SCISSOR_TEST);
+
+  glViewport(0, 0, render_target_width, render_target_height);
+  SetScissor(0, 0, render_target_width, render_target_height);
+
+  float left = 0.0f;
+  float right = static_cast<float>(render_target_width);
+  float bottom = static_cast<float>(render_target_height);
+  float top = 0.0f;
+  float z_near = -1.0f;
+  float z_far = 1.0f;
+  float projection[16] = {0};
+  projection[0] = 2.0f / (right - left);
+  projection[5] = 2.0f / (top - bottom);
+  projection[10] = -2.0f / (z_far - z_near);
+  projection[12] = -(right + left) / (right - left);
+  projection[13] = -(top + bottom) / (top - bottom);
+  projection[14] = -(z_far + z_near) / (z_far - z_near);
+  projection[15] = 1.0f;
+  glProgramUniformMatrix4fv(program_, 0, 1, GL_FALSE, projection);
+
+  glUseProgram(program_);
+  glBindVertexArray(vao_);
+}
+
+void ImmediateDrawer::End() {
+  Flush();
+  glUseProgram(0);
+  glBindVertexArray(0);
+  // Later clears would be clipped otherwise.
+  glDisable(GL_SCISSOR_TEST);
+}
+
+void ImmediateDrawer::Flush() {
+  if (draw_commands_.empty()) {
+    return;
+  }
+  SCOPE_profile_cpu_f("gpu");
+  vertex_buffer_.Flush();
+  GLuint64 bound_texture_handle = 0;
+  const int* bound_scissor = nullptr;
+  for (auto& command : draw_commands_) {
+    if (command.texture_handle &&
+        command.texture_handle != bound_texture_handle) {
+      glProgramUniformHandleui64ARB(program_, 1, command.texture_handle);
+      bound_texture_handle = command.texture_handle;
+    }
+    if (!bound_scissor ||
+        std::memcmp(bound_scissor, command.scissor, sizeof(command.scissor))) {
+      glScissor(command.scissor[0], command.scissor[1], command.scissor[2],
+                command.scissor[3]);
+      bound_scissor = command.scissor;
+    }
+    glDrawArrays(command.prim_type, GLint(command.vertex_offset),
+                 GLsizei(command.vertex_count));
+  }
+  draw_commands_.clear();
+  vertex_buffer_.InsertFence();
+}
+
+void ImmediateDrawer::SetScissor(int x, int y, int width, int height) {
+  scissor_[0] = x;
+  scissor_[1] = y;
+  scissor_[2] = width;
+  scissor_[3] = height;
+}
+
+ImmediateDrawer::Vertex* ImmediateDrawer::BeginVertices(
+    GLenum prim_type, GLuint64 texture_handle, size_t count) {
+  // Runs are merged, so only lists work.
+  assert_true(prim_type == GL_TRIANGLES || prim_type == GL_LINES);
+  size_t length = sizeof(Vertex) * count;
+  if (!vertex_buffer_.CanAcquire(length)) {
+    // Recorded geometry must be drawn before the ring wraps over it.
+    Flush();
+  }
+  current_allocation_ = vertex_buffer_.Acquire(length);
+  current_prim_type_ = prim_type;
+  current_texture_handle_ = texture_handle;
+  return reinterpret_cast<Vertex*>(current_allocation_.host_ptr);
+}
+
+void ImmediateDrawer::EndVertices() {
+  size_t vertex_offset = current_allocation_.offset / sizeof(Vertex);
+  size_t vertex_count = current_allocation_.length / sizeof(Vertex);
+  vertex_buffer_.Commit(std::move(current_allocation_));
+
+  // Extend the last run if this continues it in the ring and draws the same
+  // way. Untextured geometry can go with any texture.
+  if (!draw_commands_.empty()) {
+    auto& prev_command = draw_commands_.back();
+    if (prev_command.prim_type == current_prim_type_ &&
+        prev_command.vertex_offset + prev_command.vertex_count ==
+            vertex_offset &&
+        !std::memcmp(prev_command.scissor, scissor_, sizeof(scissor_)) &&
+        (!current_texture_handle_ || !prev_command.texture_handle ||
+         prev_command.texture_handle == current_texture_handle_)) {
+      prev_command.vertex_count += vertex_count;
+      if (current_texture_handle_) {
+        prev_command.texture_handle = current_texture_handle_;
+      }
+      return;
+    }
+  }
+
+  DrawCommand command;
+  command.prim_type = current_prim_type_;
+  command.texture_handle = current_texture_handle_;
+  std::memcpy(command.scissor, scissor_, sizeof(scissor_));
+  command.vertex_offset = vertex_offset;
+  command.vertex_count = vertex_count;
+  draw_commands_.push_back(command);
+}
+
+}  // namespace gl
+}  // namespace ui
+}  // namespace xe
@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_UI_GL_IMMEDIATE_DRAWER_H_
+#define XENIA_UI_GL_IMMEDIATE_DRAWER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "xenia/ui/gl/circular_buffer.h"
+#include "xenia/ui/gl/gl.h"
+
+namespace xe {
+namespace ui {
+namespace gl {
+
+// Draws 2D UI geometry (elemental forms, the profiler) from one persistently
+// mapped vertex ring. Geometry is only recorded until End or Flush, then
+// drawn with one draw per run of geometry sharing a primitive type, texture
+// and scissor rect, and fenced once.
+// Vertices with u > 1 are untextured and drawn in their color alone, so
+// they don't split runs of textured geometry.
+class ImmediateDrawer {
+ public:
+  struct Vertex {
+    float x;
+    float y;
+    uint32_t color;  // ABGR.
+    float u;
+    float v;
+  };
+
+  ImmediateDrawer();
+  ~ImmediateDrawer();
+
+  bool Initialize();
+  void Shutdown();
+
+  // Starts drawing to a target of the given size, in pixels with the origin
+  // at the top left. Blending is enabled and depth/stencil tests disabled.
+  void Begin(int render_target_width, int render_target_height);
+  // Draws everything recorded and restores the program and vertex array.
+  void End();
+  // Draws everything recorded so far, such as before changing a texture
+  // that recorded geometry samples.
+  void Flush();
+
+  // Clips geometry recorded afterwards, in GL window coordinates (origin at
+  // the bottom left).
+  void SetScissor(int x, int y, int width, int height);
+
+  // Returns space for count vertices, drawn as prim_type sampling the given
+  // bindless texture (0 if all vertices are untextured). Must be followed by
+  // EndVertices.
+  Vertex* BeginVertices(GLenum prim_type, GLuint64 texture_handle,
+                        size_t count);
+  void EndVertices();
+
+ private:
+  struct DrawCommand {
+    GLenum prim_type;
+    GLuint64 texture_handle;
+    int scissor[4];
+    size_t vertex_offset;
+    size_t vertex_count;
+  };
+
+  GLuint program_ = 0;
+  GLuint vao_ = 0;
+  CircularBuffer vertex_buffer_;
+
+  int scissor_[4] = {0};
+  std::vector<DrawCommand> draw_commands_;
+  CircularBuffer::Allocation current_allocation_;
+  GLenum current_prim_type_ = 0;
+  GLuint64 current_texture_handle_ = 0;
+};
+
+}  // namespace gl
+}  // namespace ui
+}  // namespace xe
+
+#endif  // XENIA_UI_GL_IMMEDIATE_DRAWER_H_
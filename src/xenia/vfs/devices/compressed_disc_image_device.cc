@@ -0,0 +1,365 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <unordered_map>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+
+DEFINE_int32(disc_image_cache_mb, 64,
+             "Memory budget (in MB) for decompressed blocks, shared by all "
+             "compressed disc images.");
+DEFINE_int32(disc_image_readahead_blocks, 8,
+             "Blocks of compressed disc images decompressed ahead of "
+             "sequential reads.");
+
+namespace xe {
+namespace vfs {
+
+const uint32_t kImageMagic = 0x49444358;  // 'XCDI'
+const uint32_t kImageVersion = 1;
+const size_t kImageHeaderSize = 24;
+const uint32_t kMinBlockSize = 4 * 1024;
+const uint32_t kMaxBlockSize = 4 * 1024 * 1024;
+const uint32_t kCodecStored = 0;
+const uint32_t kCodecLz4 = 1;
+
+static std::atomic<uint32_t> next_cache_id_(0);
+
+// LRU cache of decompressed blocks shared by all compressed images.
+class BlockCache {
+ public:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Block;
+
+  static BlockCache* global() {
+    static BlockCache cache;
+    return &cache;
+  }
+
+  Block Find(uint64_t key) {
+    std::lock_guard<xe::mutex> lock(mutex_);
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+      return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->block;
+  }
+
+  void Insert(uint64_t key, Block block) {
+    size_t budget = size_t(std::max(FLAGS_disc_image_cache_mb, 0)) << 20;
+    std::lock_guard<xe::mutex> lock(mutex_);
+    if (block->size() > budget || map_.count(key)) {
+      return;
+    }
+    size_bytes_ += block->size();
+    lru_.push_front({key, std::move(block)});
+    map_[key] = lru_.begin();
+    while (size_bytes_ > budget) {
+      size_bytes_ -= lru_.back().block->size();
+      map_.erase(lru_.back().key);
+      lru_.pop_back();
+    }
+  }
+
+  // Drops every block of the given image.
+  void Evict(uint32_t cache_id) {
+    std::lock_guard<xe::mutex> lock(mutex_);
+    for (auto it = lru_.begin(); it != lru_.end();) {
+      if (uint32_t(it->key >> 32) == cache_id) {
+        size_bytes_ -= it->block->size();
+        map_.erase(it->key);
+        it = lru_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    uint64_t key;
+    Block block;
+  };
+
+  xe::mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> lru_;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> map_;
+  size_t size_bytes_ = 0;
+};
+
+// Decodes a raw LZ4 block (without a frame header). Fails unless the input is
+// well formed and decodes to exactly dest_length bytes.
+bool Lz4DecompressBlock(const uint8_t* src, size_t src_length, uint8_t* dest,
+                        size_t dest_length) {
+  const uint8_t* ip = src;
+  const uint8_t* ip_end = src + src_length;
+  uint8_t* op = dest;
+  uint8_t* op_end = dest + dest_length;
+  auto read_length = [&](size_t* length) {
+    uint8_t value;
+    do {
+      if (ip == ip_end) {
+        return false;
+      }
+      value = *ip++;
+      *length += value;
+    } while (value == 255);
+    return true;
+  };
+  while (ip < ip_end) {
+    uint8_t token = *ip++;
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !read_length(&literal_length)) {
+      return false;
+    }
+    if (literal_length > size_t(ip_end - ip) ||
+        literal_length > size_t(op_end - op)) {
+      return false;
+    }
+    std::memcpy(op, ip, literal_length);
+    ip += literal_length;
+    op += literal_length;
+    if (ip == ip_end) {
+      // The last sequence has no match.
+      break;
+    }
+
+    if (ip_end - ip < 2) {
+      return false;
+    }
+    size_t match_offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t match_length = token & 0xF;
+    if (match_length == 15 && !read_length(&match_length)) {
+      return false;
+    }
+    match_length += 4;
+    if (!match_offset || match_offset > size_t(op - dest) ||
+        match_length > size_t(op_end - op)) {
+      return false;
+    }
+    // Matches may overlap the bytes they produce, so copy front to back.
+    const uint8_t* match = op - match_offset;
+    for (size_t i = 0; i < match_length; ++i) {
+      op[i] = match[i];
+    }
+    op += match_length;
+  }
+  return op == op_end;
+}
+
+CompressedDiscImageDevice::CompressedDiscImageDevice(
+    const std::string& mount_path, const std::wstring& local_path)
+    : DiscImageDevice(mount_path, local_path),
+      cache_id_(next_cache_id_++),
+      last_read_block_(UINT32_MAX),
+      readahead_tasks_(xe::threading::TaskPriority::kLow) {}
+
+CompressedDiscImageDevice::~CompressedDiscImageDevice() {
+  readahead_tasks_.Wait();
+  BlockCache::global()->Evict(cache_id_);
+}
+
+bool CompressedDiscImageDevice::IsCompressedImage(const std::wstring& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+  uint32_t magic = 0;
+  bool is_compressed =
+      fread(&magic, sizeof(magic), 1, file) == 1 && magic == kImageMagic;
+  fclose(file);
+  return is_compressed;
+}
+
+bool CompressedDiscImageDevice::OpenImage() {
+  file_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead, 0, 0,
+                             MappedMemory::AccessHint::kRandom);
+  if (!file_) {
+    XELOGE("Compressed disc image could not be mapped");
+    return false;
+  }
+  size_t file_size = file_->size();
+  const uint8_t* header = file_->data();
+  if (file_size < kImageHeaderSize ||
+      xe::load<uint32_t>(header + 0) != kImageMagic ||
+      xe::load<uint32_t>(header + 4) != kImageVersion) {
+    XELOGE("Compressed disc image has an unsupported header");
+    return false;
+  }
+  block_size_ = xe::load<uint32_t>(header + 8);
+  codec_ = xe::load<uint32_t>(header + 12);
+  uint64_t image_size = xe::load<uint64_t>(header + 16);
+  if (block_size_ < kMinBlockSize || block_size_ > kMaxBlockSize ||
+      (block_size_ & (block_size_ - 1)) ||
+      (codec_ != kCodecStored && codec_ != kCodecLz4)) {
+    XELOGE("Compressed disc image has an unsupported block size or codec");
+    return false;
+  }
+  uint64_t block_count = image_size / block_size_ + 1;
+  if (image_size % block_size_ == 0) {
+    --block_count;
+  }
+  uint64_t data_offset = kImageHeaderSize + (block_count + 1) * 8;
+  if (block_count >= UINT32_MAX || data_offset > file_size) {
+    XELOGE("Compressed disc image block index is truncated");
+    return false;
+  }
+  block_count_ = uint32_t(block_count);
+  block_offsets_ = header + kImageHeaderSize;
+  file_->Prefetch(0, size_t(data_offset));
+
+  // Blocks are checked against the file once here rather than per read.
+  uint64_t previous_offset = data_offset;
+  for (uint32_t i = 0; i <= block_count_; ++i) {
+    uint64_t offset = xe::load<uint64_t>(block_offsets_ + i * 8);
+    if (offset < previous_offset || offset > file_size) {
+      XELOGE("Compressed disc image block %u is out of bounds", i);
+      return false;
+    }
+    previous_offset = offset;
+  }
+
+  image_size_ = size_t(image_size);
+  return true;
+}
+
+bool CompressedDiscImageDevice::DecompressBlock(
+    uint32_t block_index, std::vector<uint8_t>* out_data) {
+  size_t start = size_t(xe::load<uint64_t>(block_offsets_ + block_index * 8));
+  size_t end =
+      size_t(xe::load<uint64_t>(block_offsets_ + (block_index + 1) * 8));
+  size_t block_offset = size_t(block_index) * block_size_;
+  size_t length = std::min(size_t(block_size_), image_size_ - block_offset);
+
+  // Fetch the whole block in one go instead of faulting it in page by page.
+  file_->Prefetch(start, end - start);
+  out_data->resize(length);
+  const uint8_t* src = file_->data() + start;
+  if (end - start == length) {
+    xe::copy_bulk(out_data->data(), src, length);
+    return true;
+  }
+  if (codec_ == kCodecLz4 &&
+      Lz4DecompressBlock(src, end - start, out_data->data(), length)) {
+    return true;
+  }
+  XELOGE("Compressed disc image block %u is corrupt", block_index);
+  return false;
+}
+
+CompressedDiscImageDevice::Block CompressedDiscImageDevice::GetBlock(
+    uint32_t block_index) {
+  auto block = BlockCache::global()->Find(block_key(block_index));
+  if (block) {
+    return block;
+  }
+  auto data = std::make_shared<std::vector<uint8_t>>();
+  if (!DecompressBlock(block_index, data.get())) {
+    return nullptr;
+  }
+  BlockCache::global()->Insert(block_key(block_index), data);
+  return data;
+}
+
+bool CompressedDiscImageDevice::ReadImage(size_t offset, void* buffer,
+                                          size_t length) {
+  if (offset > image_size_ || length > image_size_ - offset) {
+    return false;
+  }
+  if (!length) {
+    return true;
+  }
+  uint32_t first_block = uint32_t(offset / block_size_);
+  uint32_t last_block = uint32_t((offset + length - 1) / block_size_);
+
+  // Large reads span many blocks; the missing ones are decompressed in
+  // parallel.
+  std::vector<Block> blocks(last_block - first_block + 1);
+  size_t missing_count = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    blocks[i] =
+        BlockCache::global()->Find(block_key(first_block + uint32_t(i)));
+    missing_count += blocks[i] ? 0 : 1;
+  }
+  if (missing_count > 1) {
+    xe::threading::TaskGroup group(xe::threading::TaskPriority::kHigh);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      if (!blocks[i]) {
+        group.Run([this, &blocks, first_block, i]() {
+          blocks[i] = GetBlock(first_block + uint32_t(i));
+        });
+      }
+    }
+    group.Wait();
+  } else if (missing_count) {
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      if (!blocks[i]) {
+        blocks[i] = GetBlock(first_block + uint32_t(i));
+      }
+    }
+  }
+
+  auto dest = reinterpret_cast<uint8_t*>(buffer);
+  size_t block_offset = offset - size_t(first_block) * block_size_;
+  for (auto& block : blocks) {
+    if (!block) {
+      return false;
+    }
+    size_t copy_length = std::min(length, block->size() - block_offset);
+    std::memcpy(dest, block->data() + block_offset, copy_length);
+    dest += copy_length;
+    length -= copy_length;
+    block_offset = 0;
+  }
+
+  // Reads that pick up where the last one left off are likely streaming.
+  uint32_t previous_block = last_read_block_.exchange(last_block);
+  if (first_block == previous_block || first_block == previous_block + 1) {
+    QueueReadahead(last_block + 1);
+  }
+  return true;
+}
+
+void CompressedDiscImageDevice::QueueReadahead(uint32_t first_block_index) {
+  uint32_t end_block_index = uint32_t(
+      std::min(uint64_t(block_count_),
+               uint64_t(first_block_index) +
+                   std::max(FLAGS_disc_image_readahead_blocks, 0)));
+  for (uint32_t i = first_block_index; i < end_block_index; ++i) {
+    if (BlockCache::global()->Find(block_key(i))) {
+      continue;
+    }
+    {
+      std::lock_guard<xe::mutex> lock(readahead_mutex_);
+      if (!readahead_pending_.insert(i).second) {
+        continue;
+      }
+    }
+    readahead_tasks_.Run([this, i]() {
+      GetBlock(i);
+      std::lock_guard<xe::mutex> lock(readahead_mutex_);
+      readahead_pending_.erase(i);
+    });
+  }
+}
+
+}  // namespace vfs
+}  // namespace xe
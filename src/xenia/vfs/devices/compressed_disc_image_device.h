@@ -0,0 +1,86 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
+#define XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/base/thread_pool.h"
+#include "xenia/vfs/devices/disc_image_device.h"
+
+namespace xe {
+namespace vfs {
+
+// GDFX disc image split into fixed-size blocks that are compressed
+// independently, so only the blocks a title reads are fetched and
+// decompressed. All values are little endian:
+//   uint32_t magic;       'XCDI'
+//   uint32_t version;     1
+//   uint32_t block_size;  Power of two, 4KB to 4MB.
+//   uint32_t codec;       0 stored, 1 LZ4 block format.
+//   uint64_t image_size;  Size of the uncompressed image.
+//   uint64_t block_offsets[block_count + 1];  File offset of each block, and
+//                                             of the end of the last one.
+// Blocks whose stored size equals their uncompressed size are stored as-is.
+//
+// Decompressed blocks are kept in an LRU cache shared by all images, and
+// the blocks following sequential reads are decompressed ahead of time on
+// the thread pool.
+class CompressedDiscImageDevice : public DiscImageDevice {
+ public:
+  CompressedDiscImageDevice(const std::string& mount_path,
+                            const std::wstring& local_path);
+  ~CompressedDiscImageDevice() override;
+
+  // Whether the file at the given path starts with the image magic.
+  static bool IsCompressedImage(const std::wstring& path);
+
+  bool ReadImage(size_t offset, void* buffer, size_t length) override;
+
+ protected:
+  bool OpenImage() override;
+
+ private:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Block;
+
+  uint64_t block_key(uint32_t block_index) const {
+    return (uint64_t(cache_id_) << 32) | block_index;
+  }
+  // Returns the block from the cache, decompressing it on a miss.
+  Block GetBlock(uint32_t block_index);
+  bool DecompressBlock(uint32_t block_index, std::vector<uint8_t>* out_data);
+  void QueueReadahead(uint32_t first_block_index);
+
+  // The compressed file. mmap_ stays null so that entries are read through
+  // ReadImage.
+  std::unique_ptr<MappedMemory> file_;
+  uint32_t block_size_ = 0;
+  uint32_t block_count_ = 0;
+  uint32_t codec_ = 0;
+  const uint8_t* block_offsets_ = nullptr;
+  // Distinguishes this image's blocks in the shared cache.
+  uint32_t cache_id_ = 0;
+
+  // Last block of the previous read, to detect sequential reads.
+  std::atomic<uint32_t> last_read_block_;
+  xe::mutex readahead_mutex_;
+  std::unordered_set<uint32_t> readahead_pending_;
+  xe::threading::TaskGroup readahead_tasks_;
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
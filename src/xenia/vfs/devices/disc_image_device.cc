@@ -9,6 +9,8 @@
 
 #include "xenia/vfs/devices/disc_image_device.h"
 
+#include <cstring>
+
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/vfs/devices/disc_image_entry.h"
@@ -25,22 +27,22 @@ DiscImageDevice::DiscImageDevice(const std::string& mount_path,
 DiscImageDevice::~DiscImageDevice() = default;
 
 bool DiscImageDevice::Initialize() {
-  mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead);
-  if (!mmap_) {
-    XELOGE("Disc image could not be mapped");
+  if (!OpenImage()) {
     return false;
   }
 
-  ParseState state = {0};
-  state.ptr = mmap_->data();
-  state.size = mmap_->size();
+  ParseState& state = parse_state_;
+  state = {0};
+  state.size = image_size_;
   auto result = Verify(&state);
   if (result != Error::kSuccess) {
     XELOGE("Failed to verify disc image header: %d", result);
     return false;
   }
 
-  result = ReadAllEntries(&state, state.ptr + state.root_offset);
+  // Only the root directory is parsed now; subdirectories are parsed when
+  // first accessed.
+  result = ReadAllEntries(&state);
   if (result != Error::kSuccess) {
     XELOGE("Failed to read all GDFX entries: %d", result);
     return false;
@@ -49,6 +51,27 @@ bool DiscImageDevice::Initialize() {
   return true;
 }
 
+bool DiscImageDevice::OpenImage() {
+  // Files are read with explicit prefetching (see DiscImageFile), so the OS
+  // readahead would only pull in unrelated sectors.
+  mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead, 0, 0,
+                             MappedMemory::AccessHint::kRandom);
+  if (!mmap_) {
+    XELOGE("Disc image could not be mapped");
+    return false;
+  }
+  image_size_ = mmap_->size();
+  return true;
+}
+
+bool DiscImageDevice::ReadImage(size_t offset, void* buffer, size_t length) {
+  if (offset > image_size_ || length > image_size_ - offset) {
+    return false;
+  }
+  std::memcpy(buffer, mmap_->data() + offset, length);
+  return true;
+}
+
 DiscImageDevice::Error DiscImageDevice::Verify(ParseState* state) {
   // Find sector 32 of the game partition - try at a few points.
   static const size_t likely_offsets[] = {
@@ -68,12 +91,13 @@ DiscImageDevice::Error DiscImageDevice::Verify(ParseState* state) {
   }
 
   // Read sector 32 to get FS state.
-  if (state->size < state->game_offset + (32 * kXESectorSize)) {
+  uint8_t fs_header[28];
+  if (!ReadImage(state->game_offset + (32 * kXESectorSize), fs_header,
+                 sizeof(fs_header))) {
     return Error::kErrorReadError;
   }
-  uint8_t* fs_ptr = state->ptr + state->game_offset + (32 * kXESectorSize);
-  state->root_sector = xe::load<uint32_t>(fs_ptr + 20);
-  state->root_size = xe::load<uint32_t>(fs_ptr + 24);
+  state->root_sector = xe::load<uint32_t>(fs_header + 20);
+  state->root_size = xe::load<uint32_t>(fs_header + 24);
   state->root_offset =
       state->game_offset + (state->root_sector * kXESectorSize);
   if (state->root_size < 13 || state->root_size > 32 * 1024 * 1024) {
@@ -85,16 +109,21 @@ DiscImageDevice::Error DiscImageDevice::Verify(ParseState* state) {
 
 bool DiscImageDevice::VerifyMagic(ParseState* state, size_t offset) {
   // Simple check to see if the given offset contains the magic value.
-  return std::memcmp(state->ptr + offset, "MICROSOFT*XBOX*MEDIA", 20) == 0;
+  char magic[20];
+  return ReadImage(offset, magic, sizeof(magic)) &&
+         std::memcmp(magic, "MICROSOFT*XBOX*MEDIA", 20) == 0;
 }
 
-DiscImageDevice::Error DiscImageDevice::ReadAllEntries(
-    ParseState* state, const uint8_t* root_buffer) {
+DiscImageDevice::Error DiscImageDevice::ReadAllEntries(ParseState* state) {
   auto root_entry = new DiscImageEntry(this, nullptr, "", mmap_.get());
   root_entry->attributes_ = kFileAttributeDirectory;
   root_entry_ = std::unique_ptr<Entry>(root_entry);
 
-  if (!ReadEntry(state, root_buffer, 0, root_entry)) {
+  std::vector<uint8_t> root_buffer(state->root_size);
+  if (!ReadImage(state->root_offset, root_buffer.data(), state->root_size)) {
+    return Error::kErrorReadError;
+  }
+  if (!ReadEntry(state, root_buffer.data(), 0, root_entry)) {
     return Error::kErrorOutOfMemory;
   }
 
@@ -135,17 +164,13 @@ bool DiscImageDevice::ReadEntry(ParseState* state, const uint8_t* buffer,
     entry->data_offset_ = 0;
     entry->data_size_ = 0;
     if (length) {
-      // Not a leaf - read in children.
+      // Not a leaf - children are read in on first access.
       if (state->size < state->game_offset + (sector * kXESectorSize)) {
         // Out of bounds read.
         return false;
       }
-      // Read child list.
-      uint8_t* folder_ptr =
-          state->ptr + state->game_offset + (sector * kXESectorSize);
-      if (!ReadEntry(state, folder_ptr, 0, entry)) {
-        return false;
-      }
+      entry->directory_offset_ = state->game_offset + (sector * kXESectorSize);
+      entry->children_pending_ = true;
     }
   } else {
     // File.
@@ -161,5 +186,14 @@ bool DiscImageDevice::ReadEntry(ParseState* state, const uint8_t* buffer,
   return true;
 }
 
+void DiscImageDevice::ReadDirectory(DiscImageEntry* entry) {
+  std::lock_guard<xe::recursive_mutex> lock(mutex_);
+  std::vector<uint8_t> buffer(entry->size_);
+  if (!ReadImage(entry->directory_offset_, buffer.data(), buffer.size()) ||
+      !ReadEntry(&parse_state_, buffer.data(), 0, entry)) {
+    XELOGE("Failed to read GDFX directory %s", entry->path().c_str());
+  }
+}
+
 }  // namespace vfs
 }  // namespace xe
@@ -12,6 +12,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "xenia/base/mapped_memory.h"
 #include "xenia/vfs/device.h"
@@ -30,14 +31,29 @@ class DiscImageDevice : public Device {
   bool Initialize() override;
 
   uint32_t total_allocation_units() const override {
-    return uint32_t(mmap_->size() / sectors_per_allocation_unit() /
+    return uint32_t(image_size_ / sectors_per_allocation_unit() /
                     bytes_per_sector());
   }
   uint32_t available_allocation_units() const override { return 0; }
   uint32_t sectors_per_allocation_unit() const override { return 1; }
   uint32_t bytes_per_sector() const override { return 2 * 1024; }
 
+  // Copies |length| bytes of the image at |offset| into |buffer|. Used for
+  // entries that can't be mapped.
+  virtual bool ReadImage(size_t offset, void* buffer, size_t length);
+
+ protected:
+  // Opens local_path_ and sets image_size_. The image is read through mmap_
+  // if it's set, and through ReadImage otherwise.
+  virtual bool OpenImage();
+
+  std::wstring local_path_;
+  std::unique_ptr<MappedMemory> mmap_;
+  size_t image_size_ = 0;
+
  private:
+  friend class DiscImageEntry;
+
   enum class Error {
     kSuccess = 0,
     kErrorOutOfMemory = -1,
@@ -46,23 +62,23 @@ class DiscImageDevice : public Device {
     kErrorDamagedFile = -31,
   };
 
-  std::wstring local_path_;
-  std::unique_ptr<MappedMemory> mmap_;
-
   typedef struct {
-    uint8_t* ptr;
     size_t size;         // Size (bytes) of total image.
     size_t game_offset;  // Offset (bytes) of game partition.
     size_t root_sector;  // Offset (sector) of root.
     size_t root_offset;  // Offset (bytes) of root.
     size_t root_size;    // Size (bytes) of root.
   } ParseState;
+  // Kept after mount so directories can be parsed on first access.
+  ParseState parse_state_;
 
   Error Verify(ParseState* state);
   bool VerifyMagic(ParseState* state, size_t offset);
-  Error ReadAllEntries(ParseState* state, const uint8_t* root_buffer);
+  Error ReadAllEntries(ParseState* state);
   bool ReadEntry(ParseState* state, const uint8_t* buffer,
                  uint16_t entry_ordinal, DiscImageEntry* parent);
+  // Parses the child list of a directory whose children are pending.
+  void ReadDirectory(DiscImageEntry* entry);
 };
 
 }  // namespace vfs
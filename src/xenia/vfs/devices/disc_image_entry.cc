@@ -12,6 +12,7 @@
 #include <algorithm>
 
 #include "xenia/base/math.h"
+#include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_file.h"
 
 namespace xe {
@@ -22,7 +23,8 @@ DiscImageEntry::DiscImageEntry(Device* device, Entry* parent, std::string path,
     : Entry(device, parent, path),
       mmap_(mmap),
       data_offset_(0),
-      data_size_(0) {}
+      data_size_(0),
+      directory_offset_(0) {}
 
 DiscImageEntry::~DiscImageEntry() = default;
 
@@ -34,9 +36,13 @@ X_STATUS DiscImageEntry::Open(kernel::KernelState* kernel_state,
   return X_STATUS_SUCCESS;
 }
 
+void DiscImageEntry::PopulateChildrenInternal() {
+  static_cast<DiscImageDevice*>(device_)->ReadDirectory(this);
+}
+
 std::unique_ptr<MappedMemory> DiscImageEntry::OpenMapped(
     MappedMemory::Mode mode, size_t offset, size_t length) {
-  if (mode != MappedMemory::Mode::kRead) {
+  if (mode != MappedMemory::Mode::kRead || !mmap_) {
     // Only allow reads.
     return nullptr;
   }
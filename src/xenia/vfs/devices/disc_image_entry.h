@@ -28,6 +28,7 @@ class DiscImageEntry : public Entry {
                  MappedMemory* mmap);
   ~DiscImageEntry() override;
 
+  // Null for images that are read through DiscImageDevice::ReadImage.
   MappedMemory* mmap() const { return mmap_; }
   size_t data_offset() const { return data_offset_; }
   size_t data_size() const { return data_size_; }
@@ -35,17 +36,22 @@ class DiscImageEntry : public Entry {
   X_STATUS Open(kernel::KernelState* kernel_state, uint32_t desired_access,
                 kernel::object_ref<kernel::XFile>* out_file) override;
 
-  bool can_map() const override { return true; }
+  bool can_map() const override { return mmap_ != nullptr; }
   std::unique_ptr<MappedMemory> OpenMapped(MappedMemory::Mode mode,
                                            size_t offset,
                                            size_t length) override;
 
+ protected:
+  void PopulateChildrenInternal() override;
+
  private:
   friend class DiscImageDevice;
 
   MappedMemory* mmap_;
   size_t data_offset_;
   size_t data_size_;
+  // Offset of the child list in the image for directories.
+  size_t directory_offset_;
 };
 
 }  // namespace vfs
@@ -11,11 +11,19 @@
 
 #include <algorithm>
 
+#include "xenia/base/memory.h"
+#include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_entry.h"
 
 namespace xe {
 namespace vfs {
 
+// Reads at least this large have their source range paged in up front so the
+// OS can service it with large I/Os instead of one fault per page.
+constexpr size_t kPrefetchThreshold = 64 * 1024;
+// How far past a sequential read to hint for readahead.
+constexpr size_t kReadaheadSize = 1 * 1024 * 1024;
+
 DiscImageFile::DiscImageFile(kernel::KernelState* kernel_state,
                              uint32_t file_access, DiscImageEntry* entry)
     : XFile(kernel_state, file_access, entry), entry_(entry) {}
@@ -30,7 +38,29 @@ X_STATUS DiscImageFile::ReadSync(void* buffer, size_t buffer_length,
   size_t real_offset = entry_->data_offset() + byte_offset;
   size_t real_length =
       std::min(buffer_length, entry_->data_size() - byte_offset);
-  std::memcpy(buffer, entry_->mmap()->data() + real_offset, real_length);
+  auto mmap = entry_->mmap();
+  if (!mmap) {
+    // The device does its own caching and readahead.
+    auto device = static_cast<DiscImageDevice*>(entry_->device());
+    if (!device->ReadImage(real_offset, buffer, real_length)) {
+      return X_STATUS_UNSUCCESSFUL;
+    }
+    *out_bytes_read = real_length;
+    return X_STATUS_SUCCESS;
+  }
+  bool sequential =
+      next_sequential_offset_.exchange(byte_offset + real_length,
+                                       std::memory_order_relaxed) ==
+      byte_offset;
+  if (real_length >= kPrefetchThreshold) {
+    mmap->Prefetch(real_offset, real_length);
+  }
+  if (sequential) {
+    mmap->Prefetch(real_offset + real_length,
+                   std::min(kReadaheadSize,
+                            entry_->data_size() - byte_offset - real_length));
+  }
+  xe::copy_bulk(buffer, mmap->data() + real_offset, real_length);
   *out_bytes_read = real_length;
   return X_STATUS_SUCCESS;
 }
@@ -10,6 +10,8 @@
 #ifndef XENIA_VFS_DEVICES_DISC_IMAGE_FILE_H_
 #define XENIA_VFS_DEVICES_DISC_IMAGE_FILE_H_
 
+#include <atomic>
+
 #include "xenia/kernel/objects/xfile.h"
 
 namespace xe {
@@ -29,6 +31,9 @@ class DiscImageFile : public kernel::XFile {
 
  private:
   DiscImageEntry* entry_;
+  // End of the last read, used to detect sequential streaming. Concurrent
+  // reads through one handle only race on this prefetch hint.
+  std::atomic<size_t> next_sequential_offset_ = {0};
 };
 
 }  // namespace vfs
@@ -69,6 +69,7 @@ X_STATUS HostPathEntry::Open(kernel::KernelState* kernel_state,
 std::unique_ptr<MappedMemory> HostPathEntry::OpenMapped(MappedMemory::Mode mode,
                                                         size_t offset,
                                                         size_t length) {
+  HostPathFile::FlushBufferedWrites(this);
   return MappedMemory::Open(local_path_, mode, offset, length);
 }
 
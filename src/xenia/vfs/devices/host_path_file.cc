@@ -9,19 +9,95 @@
 
 #include "xenia/vfs/devices/host_path_file.h"
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include "xenia/base/logging.h"
 #include "xenia/vfs/devices/host_path_entry.h"
 
+DEFINE_int32(host_file_cache_mb, 32,
+             "Memory budget (in MB) shared by the read caches of all open "
+             "host files. 0 disables caching.");
+DEFINE_int32(host_file_write_behind_kb, 1024,
+             "Data (in KB) each open host file may buffer before writes "
+             "block on the host. 0 writes through.");
+
 namespace xe {
 namespace vfs {
 
+// Readahead window bounds. Reads at least kMaxReadahead in size go straight
+// to the host file.
+constexpr size_t kMinReadahead = 64 * 1024;
+constexpr size_t kMaxReadahead = 1024 * 1024;
+
+static std::atomic<uint64_t> cache_hits_(0);
+static std::atomic<uint64_t> cache_misses_(0);
+static std::atomic<size_t> cache_bytes_in_use_(0);
+
+// Open handles that may buffer writes, by entry. Reads through any handle of
+// an entry flush all of them first.
+static std::mutex writable_files_mutex_;
+static std::unordered_multimap<HostPathEntry*, HostPathFile*> writable_files_;
+
+HostPathFile::CacheStats HostPathFile::cache_stats() {
+  return {cache_hits_.load(), cache_misses_.load(), cache_bytes_in_use_.load()};
+}
+
+void HostPathFile::FlushBufferedWrites(HostPathEntry* entry) {
+  // Held throughout so that no file can be destroyed while flushing it.
+  std::lock_guard<std::mutex> lock(writable_files_mutex_);
+  auto range = writable_files_.equal_range(entry);
+  for (auto it = range.first; it != range.second; ++it) {
+    // Failures stay with the handle that wrote the data.
+    it->second->DrainWrites();
+  }
+}
+
 HostPathFile::HostPathFile(
     kernel::KernelState* kernel_state, uint32_t file_access,
     HostPathEntry* entry,
     std::unique_ptr<xe::filesystem::FileHandle> file_handle)
     : XFile(kernel_state, file_access, entry),
-      file_handle_(std::move(file_handle)) {}
+      file_handle_(std::move(file_handle)),
+      flush_tasks_(xe::threading::TaskPriority::kLow) {
+  if (file_access &
+      (FileAccess::kFileWriteData | FileAccess::kFileAppendData)) {
+    std::lock_guard<std::mutex> lock(writable_files_mutex_);
+    writable_files_.insert({entry, this});
+  }
+}
 
-HostPathFile::~HostPathFile() = default;
+HostPathFile::~HostPathFile() {
+  {
+    std::lock_guard<std::mutex> lock(writable_files_mutex_);
+    auto range = writable_files_.equal_range(
+        static_cast<HostPathEntry*>(entry()));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == this) {
+        writable_files_.erase(it);
+        break;
+      }
+    }
+  }
+  // Everything the guest wrote must be on the host file before the handle
+  // closes, or a reopen would read stale data.
+  flush_tasks_.Wait();
+  FlushWrites();
+  ResizeCache(0);
+}
+
+void HostPathFile::ResizeCache(size_t new_size) {
+  cache_bytes_in_use_ -= cache_.size();
+  if (new_size) {
+    cache_.resize(new_size);
+  } else {
+    std::vector<uint8_t>().swap(cache_);
+  }
+  cache_bytes_in_use_ += cache_.size();
+}
 
 X_STATUS HostPathFile::ReadSync(void* buffer, size_t buffer_length,
                                 size_t byte_offset, size_t* out_bytes_read) {
@@ -29,6 +105,61 @@ X_STATUS HostPathFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_ACCESS_DENIED;
   }
 
+  // Only files on read-only devices are cached, so no other handle can write
+  // behind the cache's back.
+  if (FLAGS_host_file_cache_mb <= 0 || !entry()->is_read_only() ||
+      buffer_length >= kMaxReadahead) {
+    // Other handles of the file may have buffered writes we must see.
+    FlushBufferedWrites(static_cast<HostPathEntry*>(entry()));
+    return ReadUncached(buffer, buffer_length, byte_offset, out_bytes_read);
+  }
+
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  bool sequential = byte_offset == next_sequential_offset_;
+  next_sequential_offset_ = byte_offset + buffer_length;
+  if (byte_offset >= cache_offset_ &&
+      byte_offset + buffer_length <= cache_offset_ + cache_length_) {
+    ++cache_hits_;
+    std::memcpy(buffer, cache_.data() + (byte_offset - cache_offset_),
+                buffer_length);
+    *out_bytes_read = buffer_length;
+    return X_STATUS_SUCCESS;
+  }
+  ++cache_misses_;
+
+  // Grow the window while the guest keeps streaming, shrink it on seeks.
+  readahead_size_ = sequential ? std::min(readahead_size_ * 2, kMaxReadahead)
+                               : kMinReadahead;
+  readahead_size_ = std::max(readahead_size_, kMinReadahead);
+  size_t fill_size = std::max(readahead_size_, buffer_length);
+  size_t budget = static_cast<size_t>(FLAGS_host_file_cache_mb) * 1024 * 1024;
+  if (fill_size > cache_.size() &&
+      cache_bytes_in_use_ + fill_size - cache_.size() > budget) {
+    // Over budget; give up our window so other files can use it.
+    ResizeCache(0);
+    cache_length_ = 0;
+    return ReadUncached(buffer, buffer_length, byte_offset, out_bytes_read);
+  }
+  if (fill_size > cache_.size()) {
+    ResizeCache(fill_size);
+  }
+
+  size_t bytes_read = 0;
+  cache_offset_ = byte_offset;
+  cache_length_ = 0;
+  if (!file_handle_->Read(byte_offset, cache_.data(), fill_size,
+                          &bytes_read)) {
+    return X_STATUS_END_OF_FILE;
+  }
+  cache_length_ = bytes_read;
+  *out_bytes_read = std::min(buffer_length, bytes_read);
+  std::memcpy(buffer, cache_.data(), *out_bytes_read);
+  return X_STATUS_SUCCESS;
+}
+
+X_STATUS HostPathFile::ReadUncached(void* buffer, size_t buffer_length,
+                                    size_t byte_offset,
+                                    size_t* out_bytes_read) {
   if (file_handle_->Read(byte_offset, buffer, buffer_length, out_bytes_read)) {
     return X_STATUS_SUCCESS;
   } else {
@@ -44,11 +175,103 @@ X_STATUS HostPathFile::WriteSync(const void* buffer, size_t buffer_length,
     return X_STATUS_ACCESS_DENIED;
   }
 
-  if (file_handle_->Write(byte_offset, buffer, buffer_length,
-                          out_bytes_written)) {
-    return X_STATUS_SUCCESS;
-  } else {
-    return X_STATUS_END_OF_FILE;
+  size_t limit = std::max(FLAGS_host_file_write_behind_kb, 0) * size_t(1024);
+  bool write_through;
+  {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    write_through = write_through_;
+  }
+  if (write_through || buffer_length > limit) {
+    // Too big to buffer; let everything before it land first.
+    X_STATUS result = FlushWrites();
+    if (XFAILED(result)) {
+      *out_bytes_written = 0;
+      return result;
+    }
+    if (file_handle_->Write(byte_offset, buffer, buffer_length,
+                            out_bytes_written)) {
+      return X_STATUS_SUCCESS;
+    } else {
+      return X_STATUS_END_OF_FILE;
+    }
+  }
+
+  bool over_limit;
+  {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (XFAILED(deferred_write_status_)) {
+      X_STATUS result = deferred_write_status_;
+      deferred_write_status_ = X_STATUS_SUCCESS;
+      *out_bytes_written = 0;
+      return result;
+    }
+    auto bytes = reinterpret_cast<const uint8_t*>(buffer);
+    if (!pending_writes_.empty() &&
+        pending_writes_.back().offset + pending_writes_.back().data.size() ==
+            byte_offset) {
+      auto& data = pending_writes_.back().data;
+      data.insert(data.end(), bytes, bytes + buffer_length);
+    } else {
+      pending_writes_.push_back(
+          {byte_offset, std::vector<uint8_t>(bytes, bytes + buffer_length)});
+    }
+    pending_write_bytes_ += buffer_length;
+    over_limit = pending_write_bytes_ > limit;
+    if (!flush_queued_ && !over_limit) {
+      flush_queued_ = true;
+      flush_tasks_.Run([this]() {
+        // Nobody is waiting on this flush; a failure fails the next call.
+        DrainWrites();
+      });
+    }
+  }
+  if (over_limit) {
+    // The host can't keep up; make the guest wait for it.
+    X_STATUS result = FlushWrites();
+    *out_bytes_written = XSUCCEEDED(result) ? buffer_length : 0;
+    return result;
+  }
+  *out_bytes_written = buffer_length;
+  return X_STATUS_SUCCESS;
+}
+
+X_STATUS HostPathFile::FlushSync() { return FlushWrites(); }
+
+X_STATUS HostPathFile::FlushWrites() {
+  DrainWrites();
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  X_STATUS result = deferred_write_status_;
+  deferred_write_status_ = X_STATUS_SUCCESS;
+  return result;
+}
+
+void HostPathFile::DrainWrites() {
+  std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+  std::vector<PendingWrite> writes;
+  {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    writes.swap(pending_writes_);
+    pending_write_bytes_ = 0;
+    flush_queued_ = false;
+  }
+  X_STATUS result = X_STATUS_SUCCESS;
+  for (auto& write : writes) {
+    size_t bytes_written = 0;
+    if (!file_handle_->Write(write.offset, write.data.data(),
+                             write.data.size(), &bytes_written) ||
+        bytes_written != write.data.size()) {
+      XELOGE("Failed to write %zu buffered bytes at %zu to %s",
+             write.data.size(), write.offset, path().c_str());
+      result = X_STATUS_END_OF_FILE;
+      break;
+    }
+  }
+  if (XFAILED(result)) {
+    // Buffered writes already reported success. Fail the next call and stop
+    // buffering so that later failures are reported by their own calls.
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    deferred_write_status_ = result;
+    write_through_ = true;
   }
 }
 
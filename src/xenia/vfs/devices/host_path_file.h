@@ -10,9 +10,13 @@
 #ifndef XENIA_VFS_DEVICES_HOST_PATH_FILE_H_
 #define XENIA_VFS_DEVICES_HOST_PATH_FILE_H_
 
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "xenia/base/filesystem.h"
+#include "xenia/base/thread_pool.h"
 #include "xenia/kernel/objects/xfile.h"
 
 namespace xe {
@@ -27,14 +31,66 @@ class HostPathFile : public kernel::XFile {
                std::unique_ptr<xe::filesystem::FileHandle> file_handle);
   ~HostPathFile() override;
 
+  struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    size_t bytes_in_use;
+  };
+  // Read cache counters across all open host files. Only files on read-only
+  // devices are cached.
+  static CacheStats cache_stats();
+
+  // Writes the data buffered by every open handle of the entry to the host
+  // file so that other handles and mappings see it.
+  static void FlushBufferedWrites(HostPathEntry* entry);
+
  protected:
   X_STATUS ReadSync(void* buffer, size_t buffer_length, size_t byte_offset,
                     size_t* out_bytes_read) override;
   X_STATUS WriteSync(const void* buffer, size_t buffer_length,
                      size_t byte_offset, size_t* out_bytes_written) override;
+  X_STATUS FlushSync() override;
 
  private:
+  // Reads directly from the host file, bypassing the cache.
+  X_STATUS ReadUncached(void* buffer, size_t buffer_length, size_t byte_offset,
+                        size_t* out_bytes_read);
+  void ResizeCache(size_t new_size);
+  // Writes all buffered data to the host file, in the order it was written.
+  // A failure is kept to be reported by the next FlushWrites or write.
+  void DrainWrites();
+  // Drains and returns the first failure since the last flush.
+  X_STATUS FlushWrites();
+
   std::unique_ptr<xe::filesystem::FileHandle> file_handle_;
+
+  // Single window of file data read ahead of the guest. Its size adapts: it
+  // doubles on each sequential miss and resets on a seek.
+  std::mutex cache_mutex_;
+  std::vector<uint8_t> cache_;
+  size_t cache_offset_ = 0;
+  size_t cache_length_ = 0;
+  size_t readahead_size_ = 0;
+  size_t next_sequential_offset_ = 0;
+
+  // Writes copied out of guest memory but not yet on the host file. Adjacent
+  // writes are merged. A background task drains them; reads, flushes and
+  // closing the file drain them first.
+  struct PendingWrite {
+    size_t offset;
+    std::vector<uint8_t> data;
+  };
+  std::mutex write_mutex_;
+  std::vector<PendingWrite> pending_writes_;
+  size_t pending_write_bytes_ = 0;
+  bool flush_queued_ = false;
+  // Set once a background flush failed. Writes then go straight to the host
+  // so that each failure is reported by the call that caused it.
+  bool write_through_ = false;
+  X_STATUS deferred_write_status_ = X_STATUS_SUCCESS;
+  // Held while draining so that writes reach the host file in order.
+  std::mutex flush_mutex_;
+  xe::threading::TaskGroup flush_tasks_;
 };
 
 }  // namespace vfs
@@ -79,7 +79,10 @@ bool StfsContainerDevice::Initialize() {
     return false;
   }
 
-  mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead);
+  // Blocks of a file are scattered through the package and prefetched per
+  // run by StfsContainerFile.
+  mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead, 0, 0,
+                             MappedMemory::AccessHint::kRandom);
   if (!mmap_) {
     XELOGE("STFS container could not be mapped");
     return false;
@@ -189,28 +192,9 @@ StfsContainerDevice::Error StfsContainerDevice::ReadAllEntries(
       entry->write_timestamp_ = update_timestamp;
       all_entries.push_back(entry);
 
-      // Fill in all block records.
-      // It's easier to do this now and just look them up later, at the cost
-      // of some memory. Nasty chain walk.
-      // TODO(benvanik): optimize if flag 0x40 (consecutive) is set.
-      if (entry->attributes() & X_FILE_ATTRIBUTE_NORMAL) {
-        uint32_t block_index = start_block_index;
-        size_t remaining_size = file_size;
-        uint32_t info = 0x80;
-        while (remaining_size && block_index && info >= 0x80) {
-          size_t block_size =
-              std::min(static_cast<size_t>(0x1000), remaining_size);
-          size_t offset = BlockToOffset(ComputeBlockNumber(block_index));
-          entry->block_list_.push_back({offset, block_size});
-          remaining_size -= block_size;
-          auto block_hash = GetBlockHash(map_ptr, block_index, 0);
-          if (table_size_shift_ && block_hash.info < 0x80) {
-            block_hash = GetBlockHash(map_ptr, block_index, 1);
-          }
-          block_index = block_hash.next_block_index;
-          info = block_hash.info;
-        }
-      }
+      // The block chain is walked on first read so mounting doesn't need to
+      // touch every hash table in the package.
+      entry->start_block_index_ = start_block_index;
 
       parent_entry->children_.emplace_back(std::unique_ptr<Entry>(entry));
     }
@@ -228,6 +212,39 @@ StfsContainerDevice::Error StfsContainerDevice::ReadAllEntries(
   return Error::kSuccess;
 }
 
+void StfsContainerDevice::ReadBlockList(StfsContainerEntry* entry) {
+  // Fill in all block records, coalescing blocks that are physically adjacent
+  // in the container into a single run.
+  // TODO(benvanik): optimize if flag 0x40 (consecutive) is set.
+  if (!(entry->attributes() & X_FILE_ATTRIBUTE_NORMAL)) {
+    return;
+  }
+  const uint8_t* map_ptr = mmap_->data();
+  auto& block_list = entry->block_list_;
+  uint32_t block_index = entry->start_block_index_;
+  size_t remaining_size = entry->size();
+  size_t file_offset = 0;
+  uint32_t info = 0x80;
+  while (remaining_size && block_index && info >= 0x80) {
+    size_t block_size = std::min(static_cast<size_t>(0x1000), remaining_size);
+    size_t offset = BlockToOffset(ComputeBlockNumber(block_index));
+    if (!block_list.empty() &&
+        block_list.back().offset + block_list.back().length == offset) {
+      block_list.back().length += block_size;
+    } else {
+      block_list.push_back({file_offset, offset, block_size});
+    }
+    file_offset += block_size;
+    remaining_size -= block_size;
+    auto block_hash = GetBlockHash(map_ptr, block_index, 0);
+    if (table_size_shift_ && block_hash.info < 0x80) {
+      block_hash = GetBlockHash(map_ptr, block_index, 1);
+    }
+    block_index = block_hash.next_block_index;
+    info = block_hash.info;
+  }
+}
+
 size_t StfsContainerDevice::BlockToOffset(uint32_t block) {
   if (block >= 0xFFFFFF) {
     return ~0ull;
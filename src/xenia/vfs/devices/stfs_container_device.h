@@ -19,6 +19,8 @@
 namespace xe {
 namespace vfs {
 
+class StfsContainerEntry;
+
 // http://www.free60.org/STFS
 
 enum class StfsPackageType {
@@ -138,6 +140,8 @@ class StfsContainerDevice : public Device {
   uint32_t bytes_per_sector() const override { return 4 * 1024; }
 
  private:
+  friend class StfsContainerEntry;
+
   enum class Error {
     kSuccess = 0,
     kErrorOutOfMemory = -1,
@@ -153,6 +157,8 @@ class StfsContainerDevice : public Device {
 
   Error ReadHeaderAndVerify(const uint8_t* map_ptr);
   Error ReadAllEntries(const uint8_t* map_ptr);
+  // Walks the block chain of a file entry and fills in its block runs.
+  void ReadBlockList(StfsContainerEntry* entry);
   size_t BlockToOffset(uint32_t block);
   uint32_t ComputeBlockNumber(uint32_t block_index);
 
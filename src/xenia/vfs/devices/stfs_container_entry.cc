@@ -10,6 +10,7 @@
 #include "xenia/vfs/devices/stfs_container_entry.h"
 
 #include "xenia/base/math.h"
+#include "xenia/vfs/devices/stfs_container_device.h"
 #include "xenia/vfs/devices/stfs_container_file.h"
 
 namespace xe {
@@ -20,7 +21,8 @@ StfsContainerEntry::StfsContainerEntry(Device* device, Entry* parent,
     : Entry(device, parent, path),
       mmap_(mmap),
       data_offset_(0),
-      data_size_(0) {}
+      data_size_(0),
+      start_block_index_(0) {}
 
 StfsContainerEntry::~StfsContainerEntry() = default;
 
@@ -32,5 +34,13 @@ X_STATUS StfsContainerEntry::Open(kernel::KernelState* kernel_state,
   return X_STATUS_SUCCESS;
 }
 
+const std::vector<StfsContainerEntry::BlockRecord>&
+StfsContainerEntry::block_list() {
+  std::call_once(block_list_once_, [this]() {
+    static_cast<StfsContainerDevice*>(device_)->ReadBlockList(this);
+  });
+  return block_list_;
+}
+
 }  // namespace vfs
 }  // namespace xe
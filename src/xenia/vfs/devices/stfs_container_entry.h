@@ -10,6 +10,7 @@
 #ifndef XENIA_VFS_DEVICES_STFS_CONTAINER_ENTRY_H_
 #define XENIA_VFS_DEVICES_STFS_CONTAINER_ENTRY_H_
 
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -35,11 +36,15 @@ class StfsContainerEntry : public Entry {
   X_STATUS Open(kernel::KernelState* kernel_state, uint32_t desired_access,
                 kernel::object_ref<kernel::XFile>* out_file) override;
 
+  // A run of physically contiguous blocks in the container.
+  // Runs are sorted by file_offset and together cover the whole file.
   struct BlockRecord {
-    size_t offset;
+    size_t file_offset;  // Offset of the run within the file.
+    size_t offset;       // Offset of the run within the container.
     size_t length;
   };
-  const std::vector<BlockRecord>& block_list() const { return block_list_; }
+  // Built from the block chain on first use.
+  const std::vector<BlockRecord>& block_list();
 
  private:
   friend class StfsContainerDevice;
@@ -47,6 +52,8 @@ class StfsContainerEntry : public Entry {
   MappedMemory* mmap_;
   size_t data_offset_;
   size_t data_size_;
+  uint32_t start_block_index_;
+  std::once_flag block_list_once_;
   std::vector<BlockRecord> block_list_;
 };
 
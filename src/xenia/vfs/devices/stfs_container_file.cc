@@ -11,6 +11,7 @@
 
 #include <algorithm>
 
+#include "xenia/base/memory.h"
 #include "xenia/vfs/devices/stfs_container_entry.h"
 
 namespace xe {
@@ -30,26 +31,49 @@ X_STATUS StfsContainerFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_END_OF_FILE;
   }
 
-  // Each block is 4096.
-  // Blocks may not be sequential, so we need to read by blocks and handle the
-  // offsets.
+  // Blocks may not be sequential, so the file is stored as runs of
+  // contiguous blocks. Find the run containing the start of the read and copy
+  // whole runs from there.
   size_t real_length = std::min(buffer_length, entry_->size() - byte_offset);
-  size_t start_block = byte_offset / 4096;
-  size_t end_block =
-      std::min(entry_->block_list().size(),
-               (size_t)ceil((byte_offset + real_length) / 4096.0));
+  auto& block_list = entry_->block_list();
+  auto it = std::upper_bound(block_list.begin(), block_list.end(), byte_offset,
+                             [](size_t offset,
+                                const StfsContainerEntry::BlockRecord& record) {
+                               return offset < record.file_offset;
+                             });
+  if (it != block_list.begin()) {
+    --it;
+  }
+  auto mmap = entry_->mmap();
+  if (real_length >= 64 * 1024) {
+    // Page in the runs ahead of the copies so large reads don't fault one
+    // page at a time.
+    size_t prefetch_offset = byte_offset;
+    for (auto run = it; run != block_list.end() &&
+                        run->file_offset < byte_offset + real_length;
+         ++run) {
+      size_t run_skip = prefetch_offset - run->file_offset;
+      if (run_skip >= run->length) {
+        break;
+      }
+      mmap->Prefetch(run->offset + run_skip, run->length - run_skip);
+      prefetch_offset = run->file_offset + run->length;
+    }
+  }
   uint8_t* dest_ptr = reinterpret_cast<uint8_t*>(buffer);
+  size_t read_offset = byte_offset;
   size_t remaining_length = real_length;
-  for (size_t n = start_block; n < end_block; n++) {
-    auto& record = entry_->block_list()[n];
-    size_t offset = record.offset;
-    size_t read_length = std::min(remaining_length, record.length);
-    if (n == start_block) {
-      offset += byte_offset % 4096;
-      read_length = std::min(read_length, record.length - (byte_offset % 4096));
+  for (; remaining_length && it != block_list.end(); ++it) {
+    size_t run_skip = read_offset - it->file_offset;
+    if (run_skip >= it->length) {
+      // Block chain ended early.
+      break;
     }
-    memcpy(dest_ptr, entry_->mmap()->data() + offset, read_length);
+    size_t read_length = std::min(remaining_length, it->length - run_skip);
+    xe::copy_bulk(dest_ptr, mmap->data() + it->offset + run_skip,
+                  read_length);
     dest_ptr += read_length;
+    read_offset += read_length;
     remaining_length -= read_length;
   }
   *out_bytes_read = real_length;
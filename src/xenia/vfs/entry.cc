@@ -9,6 +9,9 @@
 
 #include "xenia/vfs/entry.h"
 
+#include <algorithm>
+#include <cctype>
+
 #include "xenia/base/filesystem.h"
 #include "xenia/base/string.h"
 #include "xenia/vfs/device.h"
@@ -16,6 +19,14 @@
 namespace xe {
 namespace vfs {
 
+namespace {
+std::string FoldCase(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(),
+                 [](char c) { return static_cast<char>(std::tolower(c)); });
+  return name;
+}
+}  // namespace
+
 Entry::Entry(Device* device, Entry* parent, const std::string& path)
     : device_(device),
       parent_(parent),
@@ -39,6 +50,8 @@ void Entry::Dump(xe::StringBuffer* string_buffer, int indent) {
   }
   string_buffer->Append(name());
   string_buffer->Append('\n');
+  std::lock_guard<xe::recursive_mutex> lock(device_->mutex());
+  EnsureChildrenPopulated();
   for (auto& child : children_) {
     child->Dump(string_buffer, indent + 2);
   }
@@ -46,20 +59,51 @@ void Entry::Dump(xe::StringBuffer* string_buffer, int indent) {
 
 bool Entry::is_read_only() const { return device_->is_read_only(); }
 
-Entry* Entry::GetChild(std::string name) {
+void Entry::EnsureChildrenPopulated() {
+  if (!children_pending_) {
+    return;
+  }
+  children_pending_ = false;
+  PopulateChildrenInternal();
+}
+
+size_t Entry::child_count() {
   std::lock_guard<xe::recursive_mutex> lock(device_->mutex());
-  // TODO(benvanik): a faster search
-  for (auto& child : children_) {
-    if (strcasecmp(child->name().c_str(), name.c_str()) == 0) {
-      return child.get();
-    }
+  EnsureChildrenPopulated();
+  return children_.size();
+}
+
+void Entry::EnsureChildIndex() {
+  // Lookups on other threads build the index too, so it is only touched under
+  // the device mutex (recursive, callers usually hold it already).
+  std::lock_guard<xe::recursive_mutex> lock(device_->mutex());
+  if (indexed_child_count_ == children_.size()) {
+    return;
   }
-  return nullptr;
+  if (indexed_child_count_ > children_.size()) {
+    child_index_.clear();
+    indexed_child_count_ = 0;
+  }
+  child_index_.reserve(children_.size());
+  for (size_t i = indexed_child_count_; i < children_.size(); ++i) {
+    auto child = children_[i].get();
+    child_index_.emplace(FoldCase(child->name()), child);
+  }
+  indexed_child_count_ = children_.size();
+}
+
+Entry* Entry::GetChild(std::string name) {
+  std::lock_guard<xe::recursive_mutex> lock(device_->mutex());
+  EnsureChildrenPopulated();
+  EnsureChildIndex();
+  auto it = child_index_.find(FoldCase(std::move(name)));
+  return it != child_index_.end() ? it->second : nullptr;
 }
 
 Entry* Entry::IterateChildren(const xe::filesystem::WildcardEngine& engine,
                               size_t* current_index) {
   std::lock_guard<xe::recursive_mutex> lock(device_->mutex());
+  EnsureChildrenPopulated();
   while (*current_index < children_.size()) {
     auto& child = children_[*current_index];
     *current_index = *current_index + 1;
@@ -106,6 +150,9 @@ bool Entry::Delete(Entry* entry) {
       break;
     }
   }
+  // Removal may expose a shadowed duplicate name, so rebuild from scratch.
+  child_index_.clear();
+  indexed_child_count_ = 0;
   Touch();
   return true;
 }
@@ -12,6 +12,7 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/filesystem.h"
@@ -96,7 +97,7 @@ class Entry {
 
   Entry* GetChild(std::string name);
 
-  size_t child_count() const { return children_.size(); }
+  size_t child_count();
   Entry* IterateChildren(const xe::filesystem::WildcardEngine& engine,
                          size_t* current_index);
 
@@ -125,6 +126,16 @@ class Entry {
   }
   virtual bool DeleteEntryInternal(Entry* entry) { return false; }
 
+  // Devices that parse directories on first access set children_pending_ and
+  // override this to fill children_. Called once, with the device mutex held.
+  virtual void PopulateChildrenInternal() {}
+  void EnsureChildrenPopulated();
+
+  // Rebuilds child_index_ if children_ has been appended to since it was last
+  // built. Devices populate children_ directly while mounting. Takes the
+  // device mutex; the index is only valid while the caller holds it.
+  void EnsureChildIndex();
+
   Device* device_;
   Entry* parent_;
   std::string path_;
@@ -137,6 +148,12 @@ class Entry {
   uint64_t access_timestamp_;
   uint64_t write_timestamp_;
   std::vector<std::unique_ptr<Entry>> children_;
+  bool children_pending_ = false;
+  // Case-folded child name -> child, covering the first indexed_child_count_
+  // entries of children_. The first of any duplicate names wins, as with the
+  // linear scan it replaces.
+  std::unordered_map<std::string, Entry*> child_index_;
+  size_t indexed_child_count_ = 0;
 };
 
 }  // namespace vfs
@@ -9,6 +9,9 @@
 
 #include "xenia/vfs/virtual_file_system.h"
 
+#include <algorithm>
+#include <cctype>
+
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
@@ -26,15 +29,31 @@ VirtualFileSystem::~VirtualFileSystem() {
   symlinks_.clear();
 }
 
+void VirtualFileSystem::InvalidatePathCache() { path_cache_.clear(); }
+
 bool VirtualFileSystem::RegisterDevice(std::unique_ptr<Device> device) {
   std::lock_guard<xe::mutex> lock(mutex_);
+  InvalidatePathCache();
   devices_.emplace_back(std::move(device));
   return true;
 }
 
+bool VirtualFileSystem::UnregisterDevice(const std::string& mount_path) {
+  std::lock_guard<xe::mutex> lock(mutex_);
+  for (auto it = devices_.begin(); it != devices_.end(); ++it) {
+    if ((*it)->mount_path() == mount_path) {
+      InvalidatePathCache();
+      devices_.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
 bool VirtualFileSystem::RegisterSymbolicLink(std::string path,
                                              std::string target) {
   std::lock_guard<xe::mutex> lock(mutex_);
+  InvalidatePathCache();
   symlinks_.insert({path, target});
   return true;
 }
@@ -45,6 +64,7 @@ bool VirtualFileSystem::UnregisterSymbolicLink(std::string path) {
   if (it == symlinks_.end()) {
     return false;
   }
+  InvalidatePathCache();
   symlinks_.erase(it);
   return true;
 }
@@ -52,6 +72,14 @@ bool VirtualFileSystem::UnregisterSymbolicLink(std::string path) {
 Entry* VirtualFileSystem::ResolvePath(std::string path) {
   std::lock_guard<xe::mutex> lock(mutex_);
 
+  std::string cache_key(path);
+  std::transform(cache_key.begin(), cache_key.end(), cache_key.begin(),
+                 [](char c) { return static_cast<char>(std::tolower(c)); });
+  auto cache_it = path_cache_.find(cache_key);
+  if (cache_it != path_cache_.end()) {
+    return cache_it->second;
+  }
+
   // Resolve relative paths
   std::string normalized_path(xe::filesystem::CanonicalizePath(path));
 
@@ -85,7 +113,14 @@ Entry* VirtualFileSystem::ResolvePath(std::string path) {
   // Scan all devices.
   for (auto& device : devices_) {
     if (strcasecmp(device_path.c_str(), device->mount_path().c_str()) == 0) {
-      return device->ResolvePath(relative_path);
+      auto entry = device->ResolvePath(relative_path);
+      if (entry) {
+        if (path_cache_.size() >= kMaxPathCacheSize) {
+          path_cache_.clear();
+        }
+        path_cache_.emplace(std::move(cache_key), entry);
+      }
+      return entry;
     }
   }
 
@@ -132,12 +167,18 @@ bool VirtualFileSystem::DeletePath(std::string path) {
   if (!entry) {
     return false;
   }
-  auto parent = entry->parent();
-  if (!parent) {
+  if (!entry->parent()) {
     // Can't delete root.
     return false;
   }
-  return parent->Delete(entry);
+  return DeleteEntry(entry);
+}
+
+bool VirtualFileSystem::DeleteEntry(Entry* entry) {
+  // Hold the lock across the delete so no resolve can cache the entry again.
+  std::lock_guard<xe::mutex> lock(mutex_);
+  InvalidatePathCache();
+  return entry->Delete();
 }
 
 X_STATUS VirtualFileSystem::OpenFile(
@@ -222,7 +263,7 @@ X_STATUS VirtualFileSystem::OpenFile(
         return X_STATUS_ACCESS_DENIED;
       case FileDisposition::kSuperscede:
         // Replace (by delete + recreate).
-        if (!entry->Delete()) {
+        if (!DeleteEntry(entry)) {
           return X_STATUS_ACCESS_DENIED;
         }
         entry = nullptr;
@@ -236,7 +277,7 @@ X_STATUS VirtualFileSystem::OpenFile(
       case FileDisposition::kOverwrite:
       case FileDisposition::kOverwriteIf:
         // Overwrite (we do by delete + recreate).
-        if (!entry->Delete()) {
+        if (!DeleteEntry(entry)) {
           return X_STATUS_ACCESS_DENIED;
         }
         entry = nullptr;
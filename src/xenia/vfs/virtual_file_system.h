@@ -29,6 +29,8 @@ class VirtualFileSystem {
   ~VirtualFileSystem();
 
   bool RegisterDevice(std::unique_ptr<Device> device);
+  // Removes and destroys the device mounted at the given path.
+  bool UnregisterDevice(const std::string& mount_path);
 
   bool RegisterSymbolicLink(std::string path, std::string target);
   bool UnregisterSymbolicLink(std::string path);
@@ -46,9 +48,20 @@ class VirtualFileSystem {
                     FileAction* out_action);
 
  private:
+  // Drops all cached path resolutions. Must be called whenever an entry is
+  // deleted or the device/symlink tables change. Requires mutex_ held.
+  void InvalidatePathCache();
+  // Deletes the entry from its parent, invalidating the path cache.
+  bool DeleteEntry(Entry* entry);
+
   xe::mutex mutex_;
   std::vector<std::unique_ptr<Device>> devices_;
   std::unordered_map<std::string, std::string> symlinks_;
+  // Case-folded path as given to ResolvePath -> resolved entry. Only
+  // successful resolutions are cached, so creating entries never makes it
+  // stale. Cleared wholesale when it grows past kMaxPathCacheSize.
+  static const size_t kMaxPathCacheSize = 4096;
+  std::unordered_map<std::string, Entry*> path_cache_;
 };
 
 }  // namespace vfs